@@ -41,3 +41,9 @@ if [[ -x $root/src/robinhood/$prefix-diff ]]; then
 else
     echo "src/robinhood/$prefix-diff is not built: can't generate man/$prefix-diff.1" >&2
 fi
+
+if [[ -x $root/src/robinhood/$prefix-export ]]; then
+    $dir/cmd2man.sh $root/src/robinhood/$prefix-export "export robinhood DB contents to a columnar file" "$main(1), $prefix-report(1), $prefix-find(1), $prefix-du(1)" | txt2man -v "Robinhood $VERSION" -t $prefix-export -s 1 -I file -I attrs -I date -I duration -I N -I log_level -I config_file | $dir/fix_man_options.sh > $root/man/$prefix-export.1
+else
+    echo "src/robinhood/$prefix-export is not built: can't generate man/$prefix-export.1" >&2
+fi
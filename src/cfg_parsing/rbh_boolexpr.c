@@ -351,7 +351,8 @@ static int criteria2condition(const type_key_value *key_value,
         else if ((flags & PFLG_STATUS)
                  && !strcasecmp(key_value->varname, "status")) {
 
-            if ((get_status_str(smi->sm, p_triplet->val.str) == NULL)
+            p_triplet->status = get_status_str(smi->sm, p_triplet->val.str);
+            if ((p_triplet->status == NULL)
                 && (strlen(p_triplet->val.str) > 0)) {
                 char tmp[RBH_NAME_MAX];
 
@@ -479,6 +480,7 @@ static int interpret_condition(type_key_value *key_value,
     }
 
     p_triplet->flags = 0;
+    p_triplet->status = NULL;
 
     /* lighten the following line of code */
     pcrit = &criteria_descr[crit];
@@ -33,6 +33,7 @@
 #include "policy_rules.h"
 #include "policy_run.h"
 #include "status_manager.h"
+#include "rbh_metrics.h"
 
 char config_file[RBH_PATH_MAX] = "";
 
@@ -44,6 +45,7 @@ struct mod_cfgs {
     {&log_cfg_hdlr,        MODULE_MASK_ALWAYS},
     {&updt_params_hdlr,    MODULE_MASK_ALWAYS},
     {&lmgr_cfg_hdlr,       MODULE_MASK_ALWAYS},
+    {&metrics_cfg_hdlr,    MODULE_MASK_ALWAYS},
     {&entry_proc_cfg_hdlr, MODULE_MASK_ENTRY_PROCESSOR},
     {&fs_scan_cfg_hdlr,    MODULE_MASK_FS_SCAN},
 #ifdef HAVE_CHANGELOGS
@@ -30,12 +30,20 @@
 #include "rbh_misc.h"
 #include "global_config.h"
 #include "rbh_cfg_helpers.h"
+#include "rbh_metrics.h"
+#include "rbh_prof.h"
+#include "rbh_trace.h"
 #include "chglog_reader.h"
+#include "cl_spool.h"
+#include "cl_fanout.h"
+#include "rbh_fidpath.h"
 
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include <glib.h>
 #include "lustre_extended_types.h"
 
@@ -47,6 +55,116 @@
 /* for logs */
 #define CHGLOG_TAG  "ChangeLog"
 
+struct reader_thr_info_t;
+
+/* Size of the queue of records waiting to be parsed by a worker. */
+#define CL_WORKER_QUEUE_SIZE    4096
+/* Max number of records dequeued by a worker at once. */
+#define CL_WORKER_BATCH         256
+
+/* Priority lanes of pending ops: namespace changes are pushed ahead of
+ * attribute updates. */
+enum cl_lane {
+    LANE_NAMESPACE = 0,
+    LANE_ATTRS,
+    CL_LANE_COUNT
+};
+
+/* Lag histograms: bucket i counts records with a lag in
+ * [2^(i-1), 2^i[ milliseconds. */
+#define CL_LAG_BUCKETS          32
+
+typedef struct cl_lag_hist {
+    unsigned long long buckets[CL_LAG_BUCKETS];
+    unsigned long long count;
+} cl_lag_hist_t;
+
+/* Number of slots to remember the time records were fed (replay mode). */
+#define REPLAY_FEED_SLOTS       65536
+
+/* Number of slots to remember the fetch time of traced records. */
+#define CL_TRACE_SLOTS          1021
+
+/* Parsing worker: records of a MDT are dispatched to its workers
+ * according to their fid, so all the records about a given entry
+ * are coalesced by the same worker. */
+typedef struct cl_worker_t {
+    /** MDT reader this worker belongs to */
+    struct reader_thr_info_t *info;
+
+    /** worker index */
+    unsigned int index;
+
+    /** thread id */
+    pthread_t thr_id;
+
+    /** Records waiting to be parsed (ring buffer).
+     * Protected by info->lock. */
+    CL_REC_TYPE *in_queue[CL_WORKER_QUEUE_SIZE];
+    unsigned int in_first;
+    unsigned int in_count;
+    pthread_cond_t in_cond;     /* in_queue is not empty */
+
+    /** Bookkeeping for acknowledging records in order
+     * (protected by info->lock). */
+    /* oldest record that is being parsed (0 if none) */
+    unsigned long long oldest_taken;
+    /* oldest record in op queues (0 if none) */
+    unsigned long long oldest_queued;
+    /* number of ops pushed to the pipeline / committed */
+    unsigned long long nb_pushed;
+    unsigned long long nb_committed;
+    /* all the records of this worker up to this one are committed
+     * (relevant while some of its ops are in the pipeline) */
+    unsigned long long last_committed;
+
+    /** number of records of interest (ie. not MARK, IOCTL, ...) */
+    unsigned long long interesting_records;
+
+    /** number of suppressed records */
+    unsigned long long suppressed_records;
+
+    /** number of records merged into a previous op */
+    unsigned long long merged_records;
+
+    /** number of records cancelled (created and removed in a row) */
+    unsigned long long cancelled_records;
+
+    /** number of records handled by this worker */
+    unsigned long long nb_records;
+
+    /** Queues of pending changelogs to push to the pipeline
+     * (one per priority lane). All the queued ops about a given entry
+     * are in the same lane. */
+    struct rh_list_head lanes[CL_LANE_COUNT];
+    unsigned int lane_count[CL_LANE_COUNT];
+    unsigned int op_queue_count;    /* total */
+
+    /* ops pushed from each lane in the current round */
+    unsigned int lane_credits[CL_LANE_COUNT];
+    /* lane for the ops of the record being processed */
+    enum cl_lane insert_lane;
+
+    /** Store the ops for easier access. Each element in the hash
+     * table is also in a lane list. This hash table doesn't
+     * need a lock per slot since there is only one thread using it.
+     * It grows with the number of queued ops. */
+    struct id_hash *id_hash;
+    unsigned int hash_size;
+    /* longest slot list since the last stats dump */
+    unsigned int hash_max_chain;
+
+    /** On pre LU-1331 versions of Lustre, a CL_RENAME is always
+     * followed by a CL_EXT, however these may not be
+     * contiguous. Temporarily store the CL_RENAME changelog until we
+     * get the CL_EXT. */
+    CL_REC_TYPE *cl_rename;
+
+    /** trace of the record being processed (NULL if not sampled) */
+    rbh_trace_t *trace;
+
+} cl_worker_t;
+
 /* reader thread info, one per MDT */
 typedef struct reader_thr_info_t {
     /** reader thread index */
@@ -62,12 +180,6 @@ typedef struct reader_thr_info_t {
     /** nbr of records read by this thread */
     unsigned long long nb_read;
 
-    /** number of records of interest (ie. not MARK, IOCTL, ...) */
-    unsigned long long interesting_records;
-
-    /** number of suppressed/merged records */
-    unsigned long long suppressed_records;
-
     /** time when the last line was read */
     time_t last_read_time;
 
@@ -86,6 +198,9 @@ typedef struct reader_thr_info_t {
     /** last record pushed to the pipeline */
     unsigned long long last_pushed;
 
+    /** last record dispatched to workers (protected by lock) */
+    unsigned long long last_dispatched;
+
     /* number of times the changelog has been reopened */
     unsigned int nb_reopen;
 
@@ -95,15 +210,72 @@ typedef struct reader_thr_info_t {
     /** log handler */
     void *chglog_hdlr;
 
-    /** Queue of pending changelogs to push to the pipeline. */
-    struct rh_list_head op_queue;
-    unsigned int op_queue_count;
-
-    /** Store the ops for easier access. Each element in the hash
-     * table is also in the op_queue list. This hash table doesn't
-     * need a lock per slot since there is only one reader. The
-     * slot counts won't be used either. */
-    struct id_hash *id_hash;
+    /** parsing workers */
+    cl_worker_t *workers;
+    unsigned int nb_workers;
+    /* worker of the last CL_RENAME (its CL_EXT goes to the same one) */
+    unsigned int rename_worker;
+    /* no more records will be dispatched */
+    bool workers_stop;
+
+    /** Replay mode: records are read from a capture file */
+    int replay_fd;
+    struct timeval replay_start;        /* time the replay started */
+    struct timeval replay_first_rec;    /* time of the first record */
+    /* time records were fed, to measure the lag until they are committed
+     * (protected by lock) */
+    struct replay_feed {
+        unsigned long long index;
+        struct timeval tv;
+    } *replay_feed;
+    double lag_sum;
+    double lag_max;
+    unsigned long long lag_count;
+
+    /** Lag of records since the last stats dump (protected by lock):
+     * from the MDT record time to the push to the pipeline, from the push
+     * to the DB commit, and from the record time to the commit. */
+    cl_lag_hist_t lag_reader;
+    cl_lag_hist_t lag_pipeline;
+    cl_lag_hist_t lag_total;
+    /* moving average of the pipeline lag (sec) */
+    double pipeline_lag;
+
+    /** current max age of queued ops (tuned if queue_auto_tune is set) */
+    time_t queue_age;
+    time_t last_tuning;
+
+    /** connection to the publisher (subscriber mode) */
+    cl_sub_t *sub;
+    /** serializes changelog clears (pipeline callbacks, and
+     * acknowledgements of subscribers when publishing) */
+    pthread_mutex_t clear_lock;
+
+    /** local spool of records (NULL if disabled) */
+    cl_spool_t *spool;
+    /* thread replaying records from the spool */
+    pthread_t replay_thr;
+    /* last record cleared from the MDT, once spooled */
+    unsigned long long last_spooled_cleared;
+    /* an alert has been raised because the spool is full */
+    bool spool_full;
+
+    /** records saved at the last shutdown (see state_dir), processed
+     * before the records read from the MDT */
+    CL_REC_TYPE **state_recs;
+    unsigned int state_count;
+    unsigned int state_next;    /* next one to be dispatched */
+    /* pending records are saved to the state file when stopping */
+    bool save_state;
+
+    /** last cleared record to be saved in the DB by the position flusher
+     * (protected by lock), and the last one saved (flusher only) */
+    unsigned long long position;
+    unsigned long long saved_position;
+
+    /** protects workers' input queues and ack bookkeeping */
+    pthread_mutex_t lock;
+    pthread_cond_t dispatch_cond;   /* room in an input queue */
 
     ull_t cl_counters[CL_LAST]; /* since program start time */
     ull_t cl_reported[CL_LAST]; /* last reported stat (for incremental diff) */
@@ -115,16 +287,20 @@ typedef struct reader_thr_info_t {
     unsigned long long last_report_record_id;
     unsigned int last_reopen;
 
-    /** On pre LU-1331 versions of Lustre, a CL_RENAME is always
-     * followed by a CL_EXT, however these may not be
-     * contiguous. Temporarily store the CL_RENAME changelog until we
-     * get the CL_EXT. */
-    CL_REC_TYPE *cl_rename;
+    /** Sampled tracing (protected by lock): fetch time of traced records,
+     * and traces of the committed records waiting for changelog clear */
+    struct trace_feed {
+        unsigned long long index;
+        struct timeval tv;
+    } trace_feed[CL_TRACE_SLOTS];
+    GSList *committed_traces;
 
 } reader_thr_info_t;
 
-/* Number of entries in each readers' op hash table. */
+/* Initial number of entries in each readers' op hash table. */
 #define ID_CHGLOG_HASH_SIZE 7919
+/* Grow the op hash table when the average slot list exceeds this length. */
+#define ID_CHGLOG_HASH_MAX_LOAD 2
 
 extern chglog_reader_config_t cl_reader_config;
 static run_flags_t behavior_flags = 0;
@@ -135,6 +311,30 @@ static run_flags_t behavior_flags = 0;
 /** array of reader info */
 static reader_thr_info_t *reader_info = NULL;
 
+/** replay mode: file to read records from (NULL to read MDT changelogs) */
+static const char *replay_file = NULL;
+static bool replay_realtime = false;
+#define replaying (replay_file != NULL)
+
+/** fan-out: records are published to subscribers / received from
+ * a publisher */
+#define publishing (!replaying && !EMPTY_STRING(cl_reader_config.publish))
+#define subscribing (!replaying && !EMPTY_STRING(cl_reader_config.subscribe))
+
+#define mdtname(_info) (cl_reader_config.mdt_def[(_info)->thr_index].mdt_name)
+
+/** Position flusher: saves the last cleared record of each MDT in the DB,
+ * out of the pipeline callbacks. Updates between two flushes are
+ * coalesced. */
+#define POSITION_FLUSH_INTERVAL 1   /* seconds */
+static pthread_t flush_thr;
+static bool flush_started = false;
+static bool flush_stop = false;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+
+static void cl_reader_metrics_collect(metrics_out_t *out, void *arg);
+
 /**
  * Close the changelog for a thread.
  */
@@ -142,6 +342,18 @@ static int log_close(reader_thr_info_t *p_info)
 {
     int rc;
 
+    if (replaying) {
+        close(p_info->replay_fd);
+        return 0;
+    }
+
+    if (subscribing) {
+        if (p_info->sub != NULL)
+            cl_sub_close(p_info->sub);
+        p_info->sub = NULL;
+        return 0;
+    }
+
     /* close the log and clear input buffers */
     rc = llapi_changelog_fini(&p_info->chglog_hdlr);
 
@@ -152,6 +364,9 @@ static int log_close(reader_thr_info_t *p_info)
     return abs(rc);
 }
 
+/* approximate memory of a record allocated by liblustreapi */
+#define CL_REC_MEM(_rec) (sizeof(CL_REC_TYPE) + (_rec)->cr_namelen)
+
 /**
  * Free allocated structures in op_extra_info_t field.
  */
@@ -160,19 +375,39 @@ static void free_extra_info(void *ptr)
     op_extra_info_t *p_info = (op_extra_info_t *)ptr;
 
     if (p_info->is_changelog_record && p_info->log_record.p_log_rec) {
+        mem_account(MEM_TAG_CHGLOG,
+                    -(long long)CL_REC_MEM(p_info->log_record.p_log_rec), -1);
         llapi_changelog_free(&p_info->log_record.p_log_rec);
     }
 }
 
-static void free_extra_info2(void *ptr)
+/**
+ * Clear the changelog of a MDT up to the given record.
+ */
+static int changelog_clear(reader_thr_info_t *p_info, unsigned long long recno)
 {
-    op_extra_info_t *p_info = (op_extra_info_t *)ptr;
+    int rc;
 
-    if (p_info->is_changelog_record && p_info->log_record.p_log_rec) {
-        /* if this is a locally allocated record, just "free" it */
-        free(p_info->log_record.p_log_rec);
-        p_info->log_record.p_log_rec = NULL;
-    }
+    DisplayLog(LVL_DEBUG, CHGLOG_TAG,
+               "%s: acknowledging ChangeLog records up to #%llu",
+               p_info->mdtdevice, recno);
+
+    DisplayLog(LVL_FULL, CHGLOG_TAG, "llapi_changelog_clear('%s', '%s', %llu)",
+               p_info->mdtdevice,
+               cl_reader_config.mdt_def[p_info->thr_index].reader_id, recno);
+
+    rc = llapi_changelog_clear(p_info->mdtdevice,
+                               cl_reader_config.mdt_def[p_info->thr_index].
+                               reader_id, recno);
+
+    if (rc)
+        DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                   "ERROR: llapi_changelog_clear(\"%s\", \"%s\", %llu) returned %d",
+                   p_info->mdtdevice,
+                   cl_reader_config.mdt_def[p_info->thr_index].reader_id,
+                   recno, rc);
+
+    return rc;
 }
 
 /**
@@ -189,31 +424,352 @@ static int clear_changelog_records(reader_thr_info_t *p_info)
         return 0;
     }
 
-    DisplayLog(LVL_DEBUG, CHGLOG_TAG,
-               "%s: acknowledging ChangeLog records up to #%llu",
-               p_info->mdtdevice, p_info->last_committed_record);
+    if (replaying) {
+        /* no changelog to clear */
+        p_info->last_cleared_record = p_info->last_committed_record;
+        return 0;
+    }
 
-    DisplayLog(LVL_FULL, CHGLOG_TAG, "llapi_changelog_clear('%s', '%s', %llu)",
-               p_info->mdtdevice,
-               cl_reader_config.mdt_def[p_info->thr_index].reader_id,
-               p_info->last_committed_record);
+    if (p_info->spool != NULL) {
+        /* records are cleared from the MDT once they are spooled:
+         * just release them from the spool */
+        cl_spool_release(p_info->spool, p_info->last_committed_record);
+        p_info->last_cleared_record = p_info->last_committed_record;
+        return 0;
+    }
 
-    rc = llapi_changelog_clear(p_info->mdtdevice,
-                               cl_reader_config.mdt_def[p_info->thr_index].
-                               reader_id, p_info->last_committed_record);
+    if (subscribing) {
+        /* the publisher clears the records from the MDT once they are
+         * acknowledged by all its subscribers */
+        rc = cl_sub_ack(p_info->sub, p_info->last_committed_record);
+        if (rc == 0)
+            p_info->last_cleared_record = p_info->last_committed_record;
+        return rc;
+    }
+
+    if (publishing) {
+        unsigned long long recno;
+
+        /* keep the records some subscribers did not acknowledge */
+        P(p_info->clear_lock);
+        recno = cl_pub_clear_limit(p_info->thr_index,
+                                   p_info->last_committed_record);
+        if (recno <= p_info->last_cleared_record) {
+            V(p_info->clear_lock);
+            return 0;
+        }
+        rc = changelog_clear(p_info, recno);
+        if (rc == 0)
+            p_info->last_cleared_record = recno;
+        V(p_info->clear_lock);
+        return rc;
+    }
+
+    rc = changelog_clear(p_info, p_info->last_committed_record);
+    if (rc == 0)
+        p_info->last_cleared_record = p_info->last_committed_record;
+
+    return rc;
+}
+
+/**
+ * Save the last committed record, so we don't get old records from
+ * other registered readers when restarting. This is done asynchronously
+ * by the position flusher. Records are only cleared once committed,
+ * so the saved position never goes beyond the DB contents.
+ */
+static void save_position(reader_thr_info_t *p_info)
+{
+    /* (replayed records are not related to the current changelogs) */
+    if (replaying || p_info->last_cleared_record == 0)
+        return;
+
+    P(p_info->lock);
+    if (p_info->last_cleared_record > p_info->position)
+        p_info->position = p_info->last_cleared_record;
+    V(p_info->lock);
+}
+
+/* trace of a committed record, waiting for its changelog clear */
+struct cl_trace_ent {
+    unsigned long long recno;
+    rbh_trace_t *trace;
+    struct timeval commit_time;
+};
+
+/** Keep the trace of a committed record until it is cleared
+ * (info->lock must be held). */
+static void trace_committed(reader_thr_info_t *p_info,
+                            unsigned long long recno, rbh_trace_t *trace)
+{
+    struct cl_trace_ent *ent = MemAlloc(sizeof(*ent));
+
+    if (ent == NULL)
+        return;
+
+    trace_get(trace);
+    ent->recno = recno;
+    ent->trace = trace;
+    gettimeofday(&ent->commit_time, NULL);
+    p_info->committed_traces = g_slist_prepend(p_info->committed_traces, ent);
+}
+
+/** Release the traces of cleared records (or all of them if all is set). */
+static void trace_cleared(reader_thr_info_t *p_info, bool all)
+{
+    GSList *cleared = NULL, *curr, *next;
+    struct timeval now;
+
+    P(p_info->lock);
+    for (curr = p_info->committed_traces; curr != NULL; curr = next) {
+        struct cl_trace_ent *ent = curr->data;
+
+        next = curr->next;
+        if (all || ent->recno <= p_info->last_cleared_record) {
+            p_info->committed_traces =
+                g_slist_remove_link(p_info->committed_traces, curr);
+            cleared = g_slist_concat(curr, cleared);
+        }
+    }
+    V(p_info->lock);
+
+    if (cleared == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+    for (curr = cleared; curr != NULL; curr = curr->next) {
+        struct cl_trace_ent *ent = curr->data;
 
+        if (!all)
+            trace_span(ent->trace, "changelog clear", &ent->commit_time,
+                       &now);
+        trace_put(ent->trace);
+        MemFree(ent);
+    }
+    g_slist_free(cleared);
+}
+
+/** All the subscribers acknowledged more records of a MDT (publisher). */
+static void pub_clear_cb(unsigned int mdt_index)
+{
+    reader_thr_info_t *p_info = &reader_info[mdt_index];
+
+    /* nothing committed yet */
+    if (p_info->last_committed_record == 0)
+        return;
+
+    if (clear_changelog_records(p_info) == 0) {
+        save_position(p_info);
+        trace_cleared(p_info, false);
+    }
+}
+
+/** Save the changed positions of all readers in the DB. */
+static void flush_positions(lmgr_t *lmgr)
+{
+    unsigned int i;
+
+    for (i = 0; i < cl_reader_config.mdt_count; i++) {
+        reader_thr_info_t *info = &reader_info[i];
+        unsigned long long position;
+        char var_tmp[256];
+        char val_tmp[256];
+
+        P(info->lock);
+        position = info->position;
+        V(info->lock);
+
+        if (position == info->saved_position)
+            continue;
+
+        sprintf(var_tmp, "%s_%s", CL_LAST_COMMITTED, mdtname(info));
+        sprintf(val_tmp, "%llu", position);
+        if (ListMgr_SetVar(lmgr, var_tmp, val_tmp))
+            DisplayLog(LVL_MAJOR, CHGLOG_TAG,
+                       "Failed to save last committed record for %s",
+                       mdtname(info));
+        else
+            info->saved_position = position;
+    }
+}
+
+static void *position_flusher_thr(void *arg)
+{
+    lmgr_t lmgr;
+    int rc;
+
+    rc = ListMgr_InitAccess(&lmgr);
     if (rc) {
+        DisplayLog(LVL_CRIT, CHGLOG_TAG, "Could not connect to database "
+                   "(error %d): changelog positions won't be saved", rc);
+        return NULL;
+    }
+
+    P(flush_lock);
+    while (!flush_stop) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += POSITION_FLUSH_INTERVAL;
+        pthread_cond_timedwait(&flush_cond, &flush_lock, &deadline);
+
+        V(flush_lock);
+        flush_positions(&lmgr);
+        P(flush_lock);
+    }
+    V(flush_lock);
+
+    /* last positions, after the final clear */
+    flush_positions(&lmgr);
+    ListMgr_CloseAccess(&lmgr);
+    return NULL;
+}
+
+static int start_position_flusher(void)
+{
+    unsigned int i;
+
+    /* positions loaded from the DB are already saved */
+    for (i = 0; i < cl_reader_config.mdt_count; i++)
+        reader_info[i].saved_position = reader_info[i].position;
+
+    if (pthread_create(&flush_thr, NULL, position_flusher_thr, NULL)) {
+        int err = errno;
         DisplayLog(LVL_CRIT, CHGLOG_TAG,
-                   "ERROR: llapi_changelog_clear(\"%s\", \"%s\", %llu) returned %d",
-                   p_info->mdtdevice,
-                   cl_reader_config.mdt_def[p_info->thr_index].reader_id,
-                   p_info->last_committed_record, rc);
-    } else {
-        p_info->last_cleared_record = p_info->last_committed_record;
+                   "ERROR creating changelog position flusher thread: %s",
+                   strerror(err));
+        return err;
     }
+    flush_started = true;
+    return 0;
+}
 
-    return rc;
+static void stop_position_flusher(void)
+{
+    if (!flush_started)
+        return;
+
+    P(flush_lock);
+    flush_stop = true;
+    pthread_cond_signal(&flush_cond);
+    V(flush_lock);
+
+    pthread_join(flush_thr, NULL);
+    flush_started = false;
+}
+
+/**
+ * Get the highest record id such that all the records up to it are
+ * committed. Records of the different workers are committed out of order,
+ * so this is bounded by the oldest record still being processed by each
+ * worker. (info->lock must be held)
+ */
+static unsigned long long committed_watermark(const reader_thr_info_t *p_info)
+{
+    unsigned long long wm = p_info->last_dispatched;
+    unsigned int i;
+
+    for (i = 0; i < p_info->nb_workers; i++) {
+        const cl_worker_t *worker = &p_info->workers[i];
+
+        if (worker->in_count > 0)
+            wm = MIN2(wm, worker->in_queue[worker->in_first]->cr_index - 1);
+        if (worker->oldest_taken != 0)
+            wm = MIN2(wm, worker->oldest_taken - 1);
+        if (worker->oldest_queued != 0)
+            wm = MIN2(wm, worker->oldest_queued - 1);
+        /* the ops of a worker are committed in the order they are pushed */
+        if (worker->nb_committed < worker->nb_pushed)
+            wm = MIN2(wm, worker->last_committed);
+    }
+    return wm;
+}
+
+/** positive difference between 2 times, in seconds */
+static inline double tv_diff_sec(const struct timeval *end,
+                                 const struct timeval *start)
+{
+    double diff = (end->tv_sec - start->tv_sec)
+        + (end->tv_usec - start->tv_usec) / 1000000.0;
+
+    /* MDT and client clocks may be slightly different */
+    return diff > 0.0 ? diff : 0.0;
+}
+
+static void lag_hist_add(cl_lag_hist_t *hist, double sec)
+{
+    unsigned long long ms = (unsigned long long)(sec * 1000.0);
+    unsigned int b = 0;
+
+    while (ms > 0 && b < CL_LAG_BUCKETS - 1) {
+        ms >>= 1;
+        b++;
+    }
+    hist->buckets[b]++;
+    hist->count++;
+}
+
+/** lag (sec) for the given percentile (0-100): upper bound of its bucket */
+static double lag_percentile(const cl_lag_hist_t *hist, unsigned int pct)
+{
+    unsigned long long sum = 0;
+    unsigned long long thr = (hist->count * pct + 99) / 100;
+    unsigned int i;
 
+    for (i = 0; i < CL_LAG_BUCKETS; i++) {
+        sum += hist->buckets[i];
+        if (sum >= thr && sum > 0)
+            return i == 0 ? 0.0 : (1ULL << i) / 1000.0;
+    }
+    return (1ULL << (CL_LAG_BUCKETS - 1)) / 1000.0;
+}
+
+/**
+ * Account the lag of a committed record (info->lock must be held).
+ */
+static void account_lag(reader_thr_info_t *p_info, const entry_proc_op_t *pop)
+{
+    const changelog_record_t *clrec = &pop->extra_info.log_record;
+    struct timeval now, rec_time;
+    double pipeline;
+
+    gettimeofday(&now, NULL);
+    rec_time.tv_sec = cltime2sec(clrec->p_log_rec->cr_time);
+    rec_time.tv_usec = cltime2nsec(clrec->p_log_rec->cr_time) / 1000;
+
+    pipeline = tv_diff_sec(&now, &clrec->push_time);
+    lag_hist_add(&p_info->lag_reader, tv_diff_sec(&clrec->push_time,
+                                                  &rec_time));
+    lag_hist_add(&p_info->lag_pipeline, pipeline);
+    lag_hist_add(&p_info->lag_total, tv_diff_sec(&now, &rec_time));
+
+    p_info->pipeline_lag = (p_info->pipeline_lag == 0.0) ? pipeline
+        : 0.8 * p_info->pipeline_lag + 0.2 * pipeline;
+}
+
+/**
+ * Replay mode: account the lag between the time a record was fed
+ * and the time it is committed (info->lock must be held).
+ */
+static void replay_account_lag(reader_thr_info_t *p_info,
+                               unsigned long long index)
+{
+    struct replay_feed *feed = &p_info->replay_feed[index % REPLAY_FEED_SLOTS];
+    struct timeval now, lag;
+    double sec;
+
+    /* the slot may have been reused by a more recent record */
+    if (feed->index != index)
+        return;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &feed->tv, &lag);
+    sec = lag.tv_sec + lag.tv_usec / 1000000.0;
+
+    p_info->lag_sum += sec;
+    p_info->lag_count++;
+    if (sec > p_info->lag_max)
+        p_info->lag_max = sec;
 }
 
 /**
@@ -224,8 +780,10 @@ static int log_record_callback(lmgr_t *lmgr, struct entry_proc_op_t *pop,
                                void *param)
 {
     int rc;
-    reader_thr_info_t *p_info = (reader_thr_info_t *)param;
+    cl_worker_t *worker = (cl_worker_t *)param;
+    reader_thr_info_t *p_info = worker->info;
     CL_REC_TYPE *logrec = pop->extra_info.log_record.p_log_rec;
+    unsigned long long committed, last_pushed;
 
     /** Check that a log record is set for this entry
      * (should always be the case).
@@ -236,8 +794,27 @@ static int log_record_callback(lmgr_t *lmgr, struct entry_proc_op_t *pop,
         return EINVAL;
     }
 
+    P(p_info->lock);
+    /* all the previous ops of this worker are committed too */
+    worker->nb_committed = pop->extra_info.log_record.push_seq;
+    if (logrec->cr_index > worker->last_committed)
+        worker->last_committed = logrec->cr_index;
+    committed = committed_watermark(p_info);
+    last_pushed = p_info->last_pushed;
+    account_lag(p_info, pop);
+    if (replaying)
+        replay_account_lag(p_info, logrec->cr_index);
+    if (pop->trace != NULL)
+        trace_committed(p_info, logrec->cr_index, pop->trace);
+    V(p_info->lock);
+
     /* New highest committed record so far. */
-    p_info->last_committed_record = logrec->cr_index;
+    if (committed <= p_info->last_committed_record)
+        committed = p_info->last_committed_record;
+    p_info->last_committed_record = committed;
+
+    if (committed == p_info->last_cleared_record)
+        return 0;
 
     /* batching llapi_changelog_clear() calls.
      * clear the record in any of those cases:
@@ -247,31 +824,22 @@ static int log_record_callback(lmgr_t *lmgr, struct entry_proc_op_t *pop,
      * do nothing in all other cases:
      */
     if ((cl_reader_config.batch_ack_count > 1)
-        && (logrec->cr_index < p_info->last_pushed)
-        && ((logrec->cr_index - p_info->last_cleared_record)
+        && (committed < last_pushed)
+        && ((committed - p_info->last_cleared_record)
             < cl_reader_config.batch_ack_count)) {
         DisplayLog(LVL_FULL, CHGLOG_TAG,
-                   "callback - %s cl_record: %llu, last_cleared: %llu, last_pushed: %llu",
-                   p_info->mdtdevice, logrec->cr_index,
-                   p_info->last_cleared_record, p_info->last_pushed);
+                   "callback - %s cl_record: %llu, committed: %llu, "
+                   "last_cleared: %llu, last_pushed: %llu",
+                   p_info->mdtdevice, logrec->cr_index, committed,
+                   p_info->last_cleared_record, last_pushed);
         /* do nothing, don't clear log now */
         return 0;
     }
 
     rc = clear_changelog_records(p_info);
-
-    if ((rc == 0) && (p_info->last_committed_record != 0)) {
-        char var_tmp[256];
-        char val_tmp[256];
-        /* save the last committed record, so we don't get old records from
-         * other registrated readers when restarting */
-        sprintf(var_tmp, "%s_%s", CL_LAST_COMMITTED,
-                cl_reader_config.mdt_def[p_info->thr_index].mdt_name);
-        sprintf(val_tmp, "%llu", p_info->last_committed_record);
-        if (ListMgr_SetVar(lmgr, var_tmp, val_tmp))
-            DisplayLog(LVL_MAJOR, CHGLOG_TAG,
-                       "Failed to save last committed record for %s",
-                       cl_reader_config.mdt_def[p_info->thr_index].mdt_name);
+    if (rc == 0) {
+        save_position(p_info);
+        trace_cleared(p_info, false);
     }
 
     return rc;
@@ -392,21 +960,24 @@ static void dump_record(int debug_level, const char *mdt,
 
 /* Dumps the nth most recent entries in the queue. If -1, dump them
  * all. */
-static void dump_op_queue(reader_thr_info_t *p_info, int debug_level, int num)
+static void dump_op_queue(cl_worker_t *worker, int debug_level, int num)
 {
     entry_proc_op_t *op;
+    int lane;
 
     if (log_config.debug_level < debug_level || num == 0)
         return;
 
-    rh_list_for_each_entry_reverse(op, &p_info->op_queue, list) {
-        dump_record(debug_level, op->extra_info.log_record.mdt,
-                    op->extra_info.log_record.p_log_rec);
+    for (lane = 0; lane < CL_LANE_COUNT; lane++) {
+        rh_list_for_each_entry_reverse(op, &worker->lanes[lane], list) {
+            dump_record(debug_level, op->extra_info.log_record.mdt,
+                        op->extra_info.log_record.p_log_rec);
 
-        if (num != -1) {
-            num--;
-            if (num == 0)
-                return;
+            if (num != -1) {
+                num--;
+                if (num == 0)
+                    return;
+            }
         }
     }
 }
@@ -414,12 +985,26 @@ static void dump_op_queue(reader_thr_info_t *p_info, int debug_level, int num)
 /** extract parent_id and name attributes from the changelog record */
 static void set_name(CL_REC_TYPE *logrec, entry_proc_op_t *p_op)
 {
-    /* is there entry name in log rec? */
-    if (logrec->cr_namelen == 0)
-        return;
-    ATTR_MASK_SET(&p_op->fs_attrs, name);
-    rh_strncpy(ATTR(&p_op->fs_attrs, name), rh_get_cl_cr_name(logrec),
-               sizeof(ATTR(&p_op->fs_attrs, name)));
+    const changelog_record_t *cl_rec = &p_op->extra_info.log_record;
+
+    if (cl_rec->is_view) {
+        /* the name is referenced in the original record */
+        size_t len = MIN2(cl_rec->view_namelen,
+                          sizeof(ATTR(&p_op->fs_attrs, name)) - 1);
+
+        if (len == 0)
+            return;
+        ATTR_MASK_SET(&p_op->fs_attrs, name);
+        memcpy(ATTR(&p_op->fs_attrs, name), cl_rec->view_name, len);
+        ATTR(&p_op->fs_attrs, name)[len] = '\0';
+    } else {
+        /* is there entry name in log rec? */
+        if (logrec->cr_namelen == 0)
+            return;
+        ATTR_MASK_SET(&p_op->fs_attrs, name);
+        rh_strncpy(ATTR(&p_op->fs_attrs, name), rh_get_cl_cr_name(logrec),
+                   sizeof(ATTR(&p_op->fs_attrs, name)));
+    }
 
     /* parent id is always set when name is (Cf. comment in lfs.c) */
     if (fid_is_sane(&logrec->cr_pfid)) {
@@ -427,7 +1012,7 @@ static void set_name(CL_REC_TYPE *logrec, entry_proc_op_t *p_op)
         ATTR(&p_op->fs_attrs, parent_id) = logrec->cr_pfid;
 
         ATTR_MASK_SET(&p_op->fs_attrs, path_update);
-        ATTR(&p_op->fs_attrs, path_update) = time(NULL);
+        ATTR(&p_op->fs_attrs, path_update) = coarse_time();
     } else {
         DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Error: insane parent fid " DFID
                    " in %s changelog record (namelen=%u)",
@@ -436,64 +1021,283 @@ static void set_name(CL_REC_TYPE *logrec, entry_proc_op_t *p_op)
     }
 }
 
-/* Push the oldest (all=FALSE) or all (all=TRUE) entries into the pipeline. */
-static void process_op_queue(reader_thr_info_t *p_info, bool push_all)
+/* Update the oldest record queued by a worker (info->lock must be held). */
+static void update_oldest_queued(cl_worker_t *worker)
 {
-    time_t oldest = time(NULL) - cl_reader_config.queue_max_age;
-    CL_REC_TYPE *rec;
+    int lane;
 
-    DisplayLog(LVL_FULL, CHGLOG_TAG, "processing changelog queue");
+    worker->oldest_queued = 0;
 
-    while (!rh_list_empty(&p_info->op_queue)) {
-        entry_proc_op_t *op =
-            rh_list_first_entry(&p_info->op_queue, entry_proc_op_t, list);
+    /* ops are queued in record order in each lane */
+    for (lane = 0; lane < CL_LANE_COUNT; lane++) {
+        entry_proc_op_t *op;
+        unsigned long long index;
 
-        /* Stop when the queue is below our limit, and when the oldest
-         * element is still new enough. */
-        if (!push_all &&
-            (p_info->op_queue_count < cl_reader_config.queue_max_size) &&
-            (op->timestamp.changelog_inserted > oldest))
-            break;
+        if (rh_list_empty(&worker->lanes[lane]))
+            continue;
+
+        op = rh_list_first_entry(&worker->lanes[lane], entry_proc_op_t, list);
+        index = op->extra_info.log_record.p_log_rec->cr_index;
+        if (worker->oldest_queued == 0 || index < worker->oldest_queued)
+            worker->oldest_queued = index;
+    }
+
+    if (worker->cl_rename != NULL &&
+        (worker->oldest_queued == 0 ||
+         worker->cl_rename->cr_index < worker->oldest_queued))
+        worker->oldest_queued = worker->cl_rename->cr_index;
+}
 
-        rh_list_del(&op->list);
-        rh_list_del(&op->id_hash_list);
+/* Push a set of ops dequeued by a worker into the pipeline. */
+static void push_ops(cl_worker_t *worker, entry_proc_op_t **ops,
+                     unsigned int count)
+{
+    reader_thr_info_t *p_info = worker->info;
+    struct timeval now;
+    unsigned int i;
 
-        rec = op->extra_info.log_record.p_log_rec;
-        DisplayLog(LVL_FULL, CHGLOG_TAG, "pushing cl record #%llu: age=%ld",
-                   rec->cr_index,
-                   time(NULL) - op->timestamp.changelog_inserted);
-        /* Push the entry to the pipeline */
-        p_info->last_pushed = rec->cr_index;
+    gettimeofday(&now, NULL);
 
-        /* Set parent_id+name from changelog record info, as they are used
-         * in pipeline for stage locking. */
-        set_name(rec, op);
-        EntryProcessor_Push(op);
+    P(p_info->lock);
+    if (count > 0 && worker->nb_committed == worker->nb_pushed) {
+        /* no op of this worker in the pipeline: all its records before
+         * this op are committed */
+        unsigned long long first =
+            ops[0]->extra_info.log_record.p_log_rec->cr_index;
 
-        p_info->op_queue_count--;
+        if (first - 1 > worker->last_committed)
+            worker->last_committed = first - 1;
     }
-}
 
-/* Flags to insert_into_hash. */
-#define PLR_FLG_FREE2       0x0001  /* must free changelog record
-                                       on completion */
-#define CHECK_IF_LAST_ENTRY 0x0002  /* check whether the unlinked file is
-                                       the last one. */
-#define GET_FID_FROM_DB     0x0004  /* fid is not valid, get it from DB */
+    for (i = 0; i < count; i++) {
+        CL_REC_TYPE *rec = ops[i]->extra_info.log_record.p_log_rec;
 
-/* Insert the operation into the internal hash table. */
-static int insert_into_hash(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec,
-                            unsigned int flags)
+        ops[i]->extra_info.log_record.push_seq = ++worker->nb_pushed;
+        ops[i]->extra_info.log_record.push_time = now;
+        if (rec->cr_index > p_info->last_pushed)
+            p_info->last_pushed = rec->cr_index;
+        if (ops[i]->trace != NULL)
+            trace_span(ops[i]->trace, "changelog queue",
+                       &ops[i]->stage_enter_time, &now);
+    }
+    update_oldest_queued(worker);
+    V(p_info->lock);
+
+    if (count > 0)
+        EntryProcessor_PushBatch(ops, count);
+}
+
+/* Push the oldest (all=FALSE) or all (all=TRUE) entries into the pipeline. */
+/* While the pipeline is congested, records keep being coalesced in the
+ * queue, up to this factor of queue_max_size. */
+#define CONGESTED_QUEUE_FACTOR 4
+
+/* Remove an op from the hash table of queued ops. */
+static inline void hash_del_op(cl_worker_t *worker, entry_proc_op_t *op)
 {
-    entry_proc_op_t *op;
-    struct id_hash_slot *slot;
+    rh_list_del(&op->id_hash_list);
+    get_hash_slot(worker->id_hash, &op->entry_id)->count--;
+}
+
+/* Grow the hash table of queued ops, to keep slot lists short. */
+static void hash_grow(cl_worker_t *worker)
+{
+    struct id_hash *new_hash;
+    unsigned int size = worker->id_hash->hash_size * 2 + 1;
+
+    new_hash = id_hash_resize(worker->id_hash, size);
+    if (new_hash == NULL) {
+        DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Failed to grow the hash table "
+                   "of queued records to %u slots", size);
+        return;
+    }
+    worker->id_hash = new_hash;
+    worker->hash_size = size;
+    DisplayLog(LVL_DEBUG, CHGLOG_TAG, "Hash table of queued records "
+               "resized to %u slots (%u records queued)", size,
+               worker->op_queue_count);
+}
+
+/* Remove the first op of a lane, to push it to the pipeline. */
+static entry_proc_op_t *dequeue_op(cl_worker_t *worker, enum cl_lane lane)
+{
+    entry_proc_op_t *op =
+        rh_list_first_entry(&worker->lanes[lane], entry_proc_op_t, list);
+    CL_REC_TYPE *rec = op->extra_info.log_record.p_log_rec;
+
+    rh_list_del(&op->list);
+    hash_del_op(worker, op);
+    worker->lane_count[lane]--;
+    worker->op_queue_count--;
+
+    DisplayLog(LVL_FULL, CHGLOG_TAG, "pushing cl record #%llu: age=%ld",
+               rec->cr_index, coarse_time() - op->timestamp.changelog_inserted);
+
+    /* Set parent_id+name from changelog record info, as they are used
+     * in pipeline for stage locking. */
+    set_name(rec, op);
+
+    return op;
+}
+
+/* Select the lane to push the next op from: in each round, a lane can
+ * push up to its weight of ops, the namespace lane first. */
+static enum cl_lane next_lane(cl_worker_t *worker)
+{
+    const unsigned int weight[CL_LANE_COUNT] = {
+        [LANE_NAMESPACE] = cl_reader_config.namespace_lane_weight,
+        [LANE_ATTRS] = cl_reader_config.attrs_lane_weight,
+    };
+    int lane, round;
+
+    for (round = 0; round < 2; round++) {
+        for (lane = 0; lane < CL_LANE_COUNT; lane++) {
+            if (!rh_list_empty(&worker->lanes[lane])
+                && worker->lane_credits[lane] < weight[lane]) {
+                worker->lane_credits[lane]++;
+                return lane;
+            }
+        }
+        /* no lane can push anymore: start a new round */
+        memset(worker->lane_credits, 0, sizeof(worker->lane_credits));
+    }
+
+    /* should not happen if there are queued ops */
+    return rh_list_empty(&worker->lanes[LANE_NAMESPACE]) ?
+        LANE_ATTRS : LANE_NAMESPACE;
+}
+
+/* Insertion time of the oldest queued op. */
+static time_t oldest_insertion(const cl_worker_t *worker)
+{
+    time_t oldest = 0;
+    int lane;
+
+    for (lane = 0; lane < CL_LANE_COUNT; lane++) {
+        entry_proc_op_t *op;
+
+        if (rh_list_empty(&worker->lanes[lane]))
+            continue;
+
+        op = rh_list_first_entry(&worker->lanes[lane], entry_proc_op_t, list);
+        if (oldest == 0 || op->timestamp.changelog_inserted < oldest)
+            oldest = op->timestamp.changelog_inserted;
+    }
+    return oldest;
+}
+
+/**
+ * Tune the max age of queued ops according to the pipeline load:
+ * while the pipeline is saturated, records are kept longer in the queue
+ * (so more of them are coalesced). When it is idle, they are pushed
+ * sooner (to reduce the latency).
+ */
+static time_t tune_queue_age(reader_thr_info_t *info)
+{
+    time_t max_age = cl_reader_config.queue_max_age;
+    time_t min_age = MIN2(cl_reader_config.queue_min_age, max_age);
+    time_t now = coarse_time();
+    time_t age;
+
+    if (!cl_reader_config.queue_auto_tune)
+        return max_age;
+
+    P(info->lock);
+    age = info->queue_age;
+    if (now - info->last_tuning >= cl_reader_config.queue_check_interval) {
+        info->last_tuning = now;
+
+        /* saturated: the pipeline takes longer than the time
+         * records are queued */
+        if (EntryProcessor_Congested() || info->pipeline_lag > age)
+            age = MAX2(age * 2, age + 1);
+        /* idle */
+        else if (info->pipeline_lag < age / 4.0)
+            age /= 2;
+
+        age = MIN2(MAX2(age, min_age), max_age);
+        if (age != info->queue_age) {
+            DisplayLog(LVL_DEBUG, CHGLOG_TAG, "%s: queue max age %lds -> "
+                       "%lds (pipeline lag=%.3fs)", info->mdtdevice,
+                       info->queue_age, age, info->pipeline_lag);
+            info->queue_age = age;
+        }
+    }
+    V(info->lock);
+
+    /* configuration may have been reloaded */
+    return MIN2(MAX2(age, min_age), max_age);
+}
+
+static void process_op_queue(cl_worker_t *worker, bool push_all)
+{
+    time_t oldest = coarse_time() - tune_queue_age(worker->info);
+    unsigned int max_size = cl_reader_config.queue_max_size;
+    bool congested = !push_all && EntryProcessor_Congested();
+    entry_proc_op_t *ops[CL_WORKER_BATCH];
+    unsigned int count = 0;
+
+    if (congested)
+        max_size *= CONGESTED_QUEUE_FACTOR;
+
+    DisplayLog(LVL_FULL, CHGLOG_TAG, "processing changelog queue");
+
+    while (worker->op_queue_count > 0) {
+        /* Stop when the queue is below our limit, and when the oldest
+         * element is still new enough (or the pipeline is congested). */
+        if (!push_all &&
+            (worker->op_queue_count < max_size) &&
+            (congested || oldest_insertion(worker) > oldest))
+            break;
+
+        /* Push the entries to the pipeline */
+        ops[count++] = dequeue_op(worker, next_lane(worker));
+        if (count == CL_WORKER_BATCH) {
+            push_ops(worker, ops, count);
+            count = 0;
+        }
+    }
+    push_ops(worker, ops, count);
+}
+
+/* Push all the ops of a lane. */
+static void push_lane(cl_worker_t *worker, enum cl_lane lane)
+{
+    entry_proc_op_t *ops[CL_WORKER_BATCH];
+    unsigned int count = 0;
+
+    while (!rh_list_empty(&worker->lanes[lane])) {
+        ops[count++] = dequeue_op(worker, lane);
+        if (count == CL_WORKER_BATCH) {
+            push_ops(worker, ops, count);
+            count = 0;
+        }
+    }
+    push_ops(worker, ops, count);
+}
 
-    op = EntryProcessor_Get();
-    if (!op) {
+/* Flags to insert_into_hash. */
+#define CHECK_IF_LAST_ENTRY 0x0002  /* check whether the unlinked file is
+                                       the last one. */
+#define GET_FID_FROM_DB     0x0004  /* fid is not valid, get it from DB */
+#define NEW_ENTRY           0x0008  /* entry created by this record: no need
+                                       to look it up in DB */
+
+static entry_proc_op_t *get_op(void)
+{
+    entry_proc_op_t *op = EntryProcessor_Get();
+
+    if (!op)
         DisplayLog(LVL_CRIT, CHGLOG_TAG,
                    "CRITICAL ERROR: EntryProcessor_Get failed to allocate a new op");
-        return -1;
-    }
+    return op;
+}
+
+/* Insert an operation for the given record into the internal hash table. */
+static void queue_op(cl_worker_t *worker, entry_proc_op_t *op,
+                     CL_REC_TYPE *p_rec, unsigned int flags)
+{
+    struct id_hash_slot *slot;
 
     /* first, it will check if it already exists in database */
     op->pipeline_stage = entry_proc_descr.GET_INFO_DB;
@@ -504,40 +1308,93 @@ static int insert_into_hash(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec,
     op->extra_info.log_record.p_log_rec = p_rec;
 
     /* set mdt name */
-    op->extra_info.log_record.mdt =
-        cl_reader_config.mdt_def[p_info->thr_index].mdt_name;
+    op->extra_info.log_record.mdt = mdtname(worker->info);
 
-    if (flags & PLR_FLG_FREE2)
-        op->extra_info_free_func = free_extra_info2;
-    else
+    /* record views don't own their record */
+    if (!op->extra_info.log_record.is_view) {
         op->extra_info_free_func = free_extra_info;
+        mem_account(MEM_TAG_CHGLOG, CL_REC_MEM(p_rec), 1);
+    }
 
     /* if the unlink record is not tagged as last unlink,
      * always check the previous value of nlink in DB */
     op->check_if_last_entry = (p_rec->cr_type == CL_UNLINK)
         && !(p_rec->cr_flags & CLF_UNLINK_LAST);
     op->get_fid_from_db = !!(flags & GET_FID_FROM_DB);
+    op->db_new_entry = !!(flags & NEW_ENTRY);
 
     /* set callback function + args */
     op->callback_func = log_record_callback;
-    op->callback_param = p_info;
+    op->callback_param = worker;
 
     /* Set entry ID */
     if (!op->get_fid_from_db)
         EntryProcessor_SetEntryId(op, &p_rec->cr_tfid);
 
+    /* the trace of the record goes with its op */
+    if (worker->trace != NULL && op->trace == NULL) {
+        op->trace = worker->trace;
+        worker->trace = NULL;
+        gettimeofday(&op->stage_enter_time, NULL);
+    }
+
     /* Add the entry on the pending queue ... */
-    op->timestamp.changelog_inserted = time(NULL);
-    rh_list_add_tail(&op->list, &p_info->op_queue);
-    p_info->op_queue_count++;
+    op->timestamp.changelog_inserted = coarse_time();
+    op->extra_info.log_record.lane = worker->insert_lane;
+    rh_list_add_tail(&op->list, &worker->lanes[worker->insert_lane]);
+    worker->lane_count[worker->insert_lane]++;
+    worker->op_queue_count++;
 
     /* ... and the hash table. */
-    slot = get_hash_slot(p_info->id_hash, &op->entry_id);
+    if (worker->op_queue_count
+        > ID_CHGLOG_HASH_MAX_LOAD * worker->id_hash->hash_size)
+        hash_grow(worker);
+    slot = get_hash_slot(worker->id_hash, &op->entry_id);
     rh_list_add_tail(&op->id_hash_list, &slot->list);
+    slot->count++;
+    if (slot->count > worker->hash_max_chain)
+        worker->hash_max_chain = slot->count;
+}
+
+/* Insert the operation into the internal hash table. */
+static int insert_into_hash(cl_worker_t *worker, CL_REC_TYPE *p_rec,
+                            unsigned int flags)
+{
+    entry_proc_op_t *op = get_op();
+
+    if (!op)
+        return -1;
 
+    queue_op(worker, op, p_rec, flags);
     return 0;
 }
 
+/* Get an op for a view of rec_in. Its record header is initialized
+ * from rec_in and must be completed by the caller. */
+static entry_proc_op_t *get_view_op(const CL_REC_TYPE *rec_in,
+                                    const char *name, size_t namelen)
+{
+    entry_proc_op_t *op = get_op();
+    changelog_record_t *cl_rec;
+
+    if (!op)
+        return NULL;
+
+    cl_rec = &op->extra_info.log_record;
+    cl_rec->is_view = 1;
+
+    /* Copy the fix part of the changelog structure, without any
+     * extension (jobid, rename...) or name: the name is referenced
+     * in rec_in. */
+    memcpy(&cl_rec->view, rec_in, sizeof(CL_REC_TYPE));
+    cl_rec->view.cr_flags = 0;
+    cl_rec->view.cr_namelen = 0;
+    cl_rec->view_name = name;
+    cl_rec->view_namelen = namelen;
+
+    return op;
+}
+
 /* Describes which records can be safely ignored. By default a record
  * is never ignored. It is only necessary to add an entry in this
  * table if the record may be skipped (and thus has a mask defined) or
@@ -580,7 +1437,7 @@ static const struct {
  *
  * Returns TRUE or FALSE.
  */
-static bool can_ignore_record(const reader_thr_info_t *p_info,
+static bool can_ignore_record(const cl_worker_t *worker,
                               const CL_REC_TYPE *logrec_in)
 {
     entry_proc_op_t *op, *t1;
@@ -597,7 +1454,7 @@ static bool can_ignore_record(const reader_thr_info_t *p_info,
      * changelog record must be set. All the changelog record with the
      * same FID will go into the same bucket, so parse that slot
      * instead of the whole op_queue list. */
-    slot = get_hash_slot(p_info->id_hash, &logrec_in->cr_tfid);
+    slot = get_hash_slot(worker->id_hash, &logrec_in->cr_tfid);
     ignore_mask = record_filters[logrec_in->cr_type].ignore_mask;
 
     rh_list_for_each_entry_safe_reverse(op, t1, &slot->list, id_hash_list) {
@@ -626,6 +1483,171 @@ static bool can_ignore_record(const reader_thr_info_t *p_info,
     return false;
 }
 
+/* Records that only denote a change of data or attributes. They can be
+ * merged into the previous op about the same entry, as the pipeline gets
+ * the current attributes of the entry anyway. */
+#ifdef HAVE_CL_LAYOUT
+#define CL_LAYOUT_MASK (1 << CL_LAYOUT)
+#else
+#define CL_LAYOUT_MASK 0
+#endif
+#define MERGEABLE_RECORDS (1 << CL_TRUNC | 1 << CL_CLOSE | 1 << CL_MTIME \
+                           | 1 << CL_CTIME | 1 << CL_SETATTR | CL_LAYOUT_MASK)
+
+/* Ops the previous records can be merged to. Ops that remove the entry
+ * or change its HSM state are kept apart. */
+#define MERGE_TARGETS (MERGEABLE_RECORDS | 1 << CL_CREATE | 1 << CL_MKNOD \
+                       | 1 << CL_MKDIR | 1 << CL_SOFTLINK | 1 << CL_HARDLINK \
+                       | 1 << CL_EXT)
+
+/* Get the last queued op about the given entry. */
+static entry_proc_op_t *last_entry_op(const cl_worker_t *worker,
+                                      const entry_id_t *id)
+{
+    struct id_hash_slot *slot;
+    entry_proc_op_t *op;
+
+    slot = get_hash_slot(worker->id_hash, id);
+
+    rh_list_for_each_entry_reverse(op, &slot->list, id_hash_list) {
+        /* ops that will get their fid from the DB can't be matched */
+        if (!op->get_fid_from_db &&
+            entry_id_equal(&op->extra_info.log_record.p_log_rec->cr_tfid, id))
+            return op;
+    }
+    return NULL;
+}
+
+/* Records that change the namespace. */
+#define NAMESPACE_RECORDS (1 << CL_CREATE | 1 << CL_MKDIR | 1 << CL_MKNOD \
+                           | 1 << CL_SOFTLINK | 1 << CL_HARDLINK \
+                           | 1 << CL_UNLINK | 1 << CL_RMDIR | 1 << CL_RENAME \
+                           | 1 << CL_EXT)
+
+/* Lane of the ops queued for an entry (-1 if there is none) */
+static int entry_lane(const cl_worker_t *worker, const entry_id_t *id)
+{
+    entry_proc_op_t *op;
+
+    if (id == NULL)
+        return -1;
+
+    op = last_entry_op(worker, id);
+    return op ? op->extra_info.log_record.lane : -1;
+}
+
+/* Select the lane for the ops of a record. Ops about an entry must be
+ * pushed in order, so they go to the lane where this entry already has
+ * pending ops. */
+static enum cl_lane record_lane(cl_worker_t *worker, CL_REC_TYPE *p_rec)
+{
+    /* a record can be about 2 entries (rename) */
+    const entry_id_t *id2 = NULL;
+    int lane1, lane2;
+
+    if (p_rec->cr_type == CL_EXT) {
+        if (worker->cl_rename != NULL)
+            id2 = &worker->cl_rename->cr_tfid;
+    }
+#if defined(HAVE_CHANGELOG_EXTEND_REC) || defined(HAVE_FLEX_CL)
+    else if (p_rec->cr_type == CL_RENAME && rh_is_rename_one_record(p_rec)) {
+#ifdef HAVE_FLEX_CL
+        id2 = &changelog_rec_rename(p_rec)->cr_sfid;
+#else
+        id2 = &p_rec->cr_sfid;
+#endif
+    }
+#endif
+
+    lane1 = entry_lane(worker, &p_rec->cr_tfid);
+    lane2 = entry_lane(worker, id2);
+
+    if (!(NAMESPACE_RECORDS & (1 << p_rec->cr_type)))
+        return (lane1 == LANE_NAMESPACE) ? LANE_NAMESPACE : LANE_ATTRS;
+
+    if (lane1 != LANE_ATTRS && lane2 != LANE_ATTRS)
+        return LANE_NAMESPACE;
+
+    /* The record must be queued after pending attribute updates.
+     * If the other entry has pending namespace ops, push them first
+     * so they are still processed before this record. */
+    if (lane1 == LANE_NAMESPACE || lane2 == LANE_NAMESPACE)
+        push_lane(worker, LANE_NAMESPACE);
+
+    return LANE_ATTRS;
+}
+
+/* Remove an op from the queue, and release it. */
+static void drop_queued_op(cl_worker_t *worker, entry_proc_op_t *op)
+{
+    rh_list_del(&op->list);
+    hash_del_op(worker, op);
+    worker->lane_count[op->extra_info.log_record.lane]--;
+    worker->op_queue_count--;
+    EntryProcessor_Release(op);
+}
+
+/* Coalesce a record with the last queued op about the same entry:
+ * - data and attribute changes are merged into this op, if it has been
+ *   queued for less than queue_max_age;
+ * - a CREATE followed by an UNLINK is a no-op, so both are dropped.
+ *
+ * Returns TRUE if the record has been coalesced (it can be released).
+ */
+static bool coalesce_record(cl_worker_t *worker, const CL_REC_TYPE *logrec_in)
+{
+    entry_proc_op_t *op;
+    CL_REC_TYPE *logrec;
+    unsigned int type = logrec_in->cr_type;
+
+    if (!((MERGEABLE_RECORDS & (1 << type)) || type == CL_UNLINK))
+        return false;
+
+    op = last_entry_op(worker, &logrec_in->cr_tfid);
+    if (op == NULL || op->timestamp.changelog_inserted
+        + cl_reader_config.queue_max_age < coarse_time())
+        return false;
+
+    logrec = op->extra_info.log_record.p_log_rec;
+
+    if (type == CL_UNLINK) {
+        /* The entry has no other name than the created one (else the
+         * last queued op would be a HARDLINK or a rename).
+         * It doesn't exist in the DB yet, so just forget about it. */
+        if (logrec->cr_type != CL_CREATE)
+            return false;
+        /* the entry may have been renamed in between */
+        if (worker->cl_rename != NULL
+            && entry_id_equal(&worker->cl_rename->cr_tfid,
+                              &logrec_in->cr_tfid))
+            return false;
+
+        DisplayLog(LVL_FULL, CHGLOG_TAG, "Dropping CREATE #%llu of " DFID
+                   ": removed by UNLINK #%llu", logrec->cr_index,
+                   PFID(&logrec->cr_tfid), logrec_in->cr_index);
+        DisplayChangelogs("(cancelled records %s:%llu/%llu)",
+                          mdtname(worker->info), logrec->cr_index,
+                          logrec_in->cr_index);
+        drop_queued_op(worker, op);
+        worker->cancelled_records += 2;
+        return true;
+    }
+
+    if (!(MERGE_TARGETS & (1 << logrec->cr_type)))
+        return false;
+
+    op->extra_info.log_record.merged_types |= (1 << type);
+
+    DisplayLog(LVL_FULL, CHGLOG_TAG, "Merging %s #%llu into %s #%llu",
+               changelog_type2str(type), logrec_in->cr_index,
+               changelog_type2str(logrec->cr_type), logrec->cr_index);
+    DisplayChangelogs("(merged record %s:%llu into %llu)",
+                      mdtname(worker->info), logrec_in->cr_index,
+                      logrec->cr_index);
+    worker->merged_records++;
+    return true;
+}
+
 /**
  * Convert rename flags to unlink flags, depending on Lustre client/server
  * versions.
@@ -668,7 +1690,7 @@ static uint16_t cl_rename2unlink_flags(uint16_t flags,
 }
 
 /**
- * Create a fake unlink changelog record that will be used to remove a
+ * Insert a fake unlink changelog record that will be used to remove a
  * file that is overriden during a rename operation.
  *
  * rec_in is a changelog of type CL_RENAME (if rename is recorded with
@@ -676,80 +1698,59 @@ static uint16_t cl_rename2unlink_flags(uint16_t flags,
  * CL_RENAME+CL_EXT). This function is called because the rename
  * operation is deleting the destination, so we need to insert a fake
  * CL_UNLINK into the pipeline for that operation.
+ *
+ * The unlink is a view of rec_in, which must be queued after it.
  */
-static CL_REC_TYPE *create_fake_unlink_record(const reader_thr_info_t *p_info,
-                                              CL_REC_TYPE *rec_in,
-                                              unsigned int *insert_flags)
+static int insert_unlink_view(cl_worker_t *worker, const CL_REC_TYPE *rec_in)
 {
+    entry_proc_op_t *op;
     CL_REC_TYPE *rec;
-    size_t name_len;
-
-    /* Build a simple changelog record with no extension (jobid, rename...).
-     * So, just allocate enough space for the record and the source name. */
-    name_len = strlen(rh_get_cl_cr_name(rec_in));
-    rec = MemAlloc(sizeof(CL_REC_TYPE) + name_len + 1);
-    if (rec == NULL)
-        return NULL;
-
-    /* Copy the fix part of the changelog structure */
-    memcpy(rec, rec_in, sizeof(CL_REC_TYPE));
-
-    /* set target flags before using any accessor on it */
-    rec->cr_flags = cl_rename2unlink_flags(rec_in->cr_flags, insert_flags);
-
-    /* record has to be freed */
-    *insert_flags |= PLR_FLG_FREE2;
+    unsigned int insert_flags = 0;
+    const char *name = rh_get_cl_cr_name(rec_in);
 
     /* unlinked entry is the target name */
-    memcpy(rh_get_cl_cr_name(rec), rh_get_cl_cr_name(rec_in), name_len);
-    rh_get_cl_cr_name(rec)[name_len] = 0;   /* terminate string */
-    rec->cr_namelen = name_len + 1;
+    op = get_view_op(rec_in, name, strnlen(name, rec_in->cr_namelen));
+    if (op == NULL)
+        return -1;
+    rec = &op->extra_info.log_record.view;
 
+    rec->cr_flags = cl_rename2unlink_flags(rec_in->cr_flags, &insert_flags);
     rec->cr_type = CL_UNLINK;
     rec->cr_index = rec_in->cr_index - 1;
 
     DisplayLog(LVL_DEBUG, CHGLOG_TAG,
                "Unlink: object=" DFID ", name=%.*s, flags=%#x",
-               PFID(&rec->cr_tfid), rec->cr_namelen,
-               rh_get_cl_cr_name(rec), rec->cr_flags);
+               PFID(&rec->cr_tfid), op->extra_info.log_record.view_namelen,
+               name, rec->cr_flags);
 
-    return rec;
+    queue_op(worker, op, rec, insert_flags);
+    return 0;
 }
 
 #if defined(HAVE_CHANGELOG_EXTEND_REC) || defined(HAVE_FLEX_CL)
 /**
- * Create a fake rename record to ensure compatibility with older
+ * Insert a fake rename record to ensure compatibility with older
  * Lustre records.
  *
  * rec_in is a single rename record of type CL_RENAME; Lustre won't
  * issue a CL_EXT record for this rename. But RH's pipeline expects a
  * CL_RENAME followed by a CL_EXT record. So this function creates an
- * old fashion CL_RENAME that will be followed by a CL_EXT.
+ * old fashion CL_RENAME (as a view of rec_in) that will be followed
+ * by a CL_EXT.
  *
  * This is only used if LU-1331 fix is present on the Lustre server.
  */
-static CL_REC_TYPE *create_fake_rename_record(const reader_thr_info_t *p_info,
-                                              CL_REC_TYPE *rec_in)
+static int insert_rename_view(cl_worker_t *worker, CL_REC_TYPE *rec_in)
 {
+    entry_proc_op_t *op;
     CL_REC_TYPE *rec;
-    size_t sname_len;
-
-    /* Build a simple changelog record with no extension (jobid, rename...).
-     * So, just allocate enough space for the record and the source name. */
-    sname_len = changelog_rec_snamelen(rec_in);
-    rec = MemAlloc(sizeof(CL_REC_TYPE) + sname_len + 1);
-    if (rec == NULL)
-        return NULL;
-
-    /* Copy the fix part of the changelog structure */
-    memcpy(rec, rec_in, sizeof(CL_REC_TYPE));
 
-    /* set target flags before using any accessor on it */
-    rec->cr_flags = 0;  /* simplest record */
-
-    rec->cr_namelen = sname_len + 1;    /* add 1 for final NULL-byte */
-    memcpy(rh_get_cl_cr_name(rec), changelog_rec_sname(rec_in), sname_len);
-    rh_get_cl_cr_name(rec)[sname_len] = 0;  /* terminate string */
+    /* the name is the source name */
+    op = get_view_op(rec_in, changelog_rec_sname(rec_in),
+                     changelog_rec_snamelen(rec_in));
+    if (op == NULL)
+        return -1;
+    rec = &op->extra_info.log_record.view;
 
     /* we don't want to acknowledge this record as long as the 2
      * records are not processed. acknowledge n-1 instead */
@@ -768,64 +1769,95 @@ static CL_REC_TYPE *create_fake_rename_record(const reader_thr_info_t *p_info,
     rec->cr_pfid = rec_in->cr_spfid;    /* the source parent */
 #endif
 
-    return rec;
+    queue_op(worker, op, rec, 0);
+    return 0;
 }
 #endif
 
-#define mdtname(_info) (cl_reader_config.mdt_def[(_info)->thr_index].mdt_name)
+/**
+ * Drop the cached paths of renamed and removed directories (and of their
+ * descendants), before later records resolve paths through them.
+ */
+static void invalidate_paths(CL_REC_TYPE *p_rec)
+{
+    switch (p_rec->cr_type) {
+    case CL_RMDIR:
+    case CL_EXT:
+        fidpath_invalidate(&p_rec->cr_tfid);
+        break;
+
+    case CL_RENAME:
+        /* renamed entry (old records), or overwritten target */
+        if (!FID_IS_ZERO(&p_rec->cr_tfid))
+            fidpath_invalidate(&p_rec->cr_tfid);
+#if defined(HAVE_CHANGELOG_EXTEND_REC) || defined(HAVE_FLEX_CL)
+        if (rh_is_rename_one_record(p_rec))
+#ifdef HAVE_FLEX_CL
+            fidpath_invalidate(&changelog_rec_rename(p_rec)->cr_sfid);
+#else
+            fidpath_invalidate(&p_rec->cr_sfid);
+#endif
+#endif
+        break;
+
+    default:
+        break;
+    }
+}
 
 /**
- * This handles a single log record.
+ * This handles a single log record (in a parsing worker).
  */
-static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
+static int process_log_rec(cl_worker_t *worker, CL_REC_TYPE *p_rec)
 {
-    unsigned int opnum;
+    unsigned int opnum = p_rec->cr_type;
 
     /* display the log record in debug mode */
-    dump_record(LVL_DEBUG, mdtname(p_info), p_rec);
+    dump_record(LVL_DEBUG, mdtname(worker->info), p_rec);
+    worker->nb_records++;
 
-    /* update stats */
-    opnum = p_rec->cr_type;
-    if ((opnum >= 0) && (opnum < CL_LAST))
-        p_info->cl_counters[opnum]++;
-    else {
-        DisplayLog(LVL_CRIT, CHGLOG_TAG,
-                   "Log record type %d out of bounds.", opnum);
-        return EINVAL;
-    }
+    /* even if the record is ignored, the namespace changed */
+    invalidate_paths(p_rec);
 
     /* This record might be of interest. But try to check whether it
      * might create a duplicate operation anyway. */
-    if (can_ignore_record(p_info, p_rec)) {
+    if (can_ignore_record(worker, p_rec)) {
         DisplayLog(LVL_FULL, CHGLOG_TAG, "Ignoring event %s",
                    changelog_type2str(opnum));
-        DisplayChangelogs("(ignored redundant record %s:%llu)", mdtname(p_info),
-                          p_rec->cr_index);
-        p_info->suppressed_records++;
+        DisplayChangelogs("(ignored redundant record %s:%llu)",
+                          mdtname(worker->info), p_rec->cr_index);
+        worker->suppressed_records++;
+        llapi_changelog_free(&p_rec);
+        goto done;
+    }
+
+    /* Else, try to merge it with the previous op about this entry. */
+    if (coalesce_record(worker, p_rec)) {
         llapi_changelog_free(&p_rec);
         goto done;
     }
 
-    p_info->interesting_records++;
+    worker->insert_lane = record_lane(worker, p_rec);
+
+    worker->interesting_records++;
 
     if (p_rec->cr_type == CL_RENAME) {
         /* Ensure there is no pending rename. */
-        if (p_info->cl_rename) {
+        if (worker->cl_rename) {
             /* Should never happen. */
             DisplayLog(LVL_CRIT, CHGLOG_TAG,
                        "Got 2 CL_RENAME in a row without a CL_EXT.");
-            dump_record(LVL_CRIT, mdtname(p_info), p_rec);
-            dump_op_queue(p_info, LVL_CRIT, 32);
+            dump_record(LVL_CRIT, mdtname(worker->info), p_rec);
+            dump_op_queue(worker, LVL_CRIT, 32);
 
             /* Discarding bogus entry. */
-            llapi_changelog_free(&p_info->cl_rename);
-            p_info->cl_rename = NULL;
+            llapi_changelog_free(&worker->cl_rename);
+            worker->cl_rename = NULL;
         }
 #if defined(HAVE_CHANGELOG_EXTEND_REC) || defined(HAVE_FLEX_CL)
         /* extended record: 1 single RENAME record per rename op;
          * there is no EXT. */
         if (rh_is_rename_one_record(p_rec)) {
-            CL_REC_TYPE *p_rec2;
 #ifdef HAVE_FLEX_CL
             struct changelog_ext_rename *cr_ren;
 #endif
@@ -841,19 +1873,10 @@ static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
                 cl_reader_config.mds_has_lu1331 = true;
             }
 
-            if (!FID_IS_ZERO(&p_rec->cr_tfid)) {
-                CL_REC_TYPE *unlink;
-                unsigned int insert_flags;
-
-                unlink = create_fake_unlink_record(p_info,
-                                                   p_rec, &insert_flags);
-                if (unlink) {
-                    insert_into_hash(p_info, unlink, insert_flags);
-                } else {
-                    DisplayLog(LVL_CRIT, CHGLOG_TAG,
-                               "Could not allocate an UNLINK record.");
-                }
-            }
+            if (!FID_IS_ZERO(&p_rec->cr_tfid)
+                && insert_unlink_view(worker, p_rec) != 0)
+                DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                           "Could not allocate an UNLINK record.");
 #ifdef HAVE_FLEX_CL
             cr_ren = changelog_rec_rename(p_rec);
             DisplayLog(LVL_DEBUG, CHGLOG_TAG,
@@ -877,8 +1900,7 @@ static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
              * push RNMTO to add target path information.
              */
             /* 1) build & push RNMFRM */
-            p_rec2 = create_fake_rename_record(p_info, p_rec);
-            insert_into_hash(p_info, p_rec2, PLR_FLG_FREE2);
+            insert_rename_view(worker, p_rec);
 
             /* 2) update RNMTO */
             p_rec->cr_type = CL_EXT;    /* CL_RENAME -> CL_RNMTO */
@@ -887,21 +1909,21 @@ static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
 #else
             p_rec->cr_tfid = p_rec->cr_sfid;    /* removed fid -> renamed fid */
 #endif
-            insert_into_hash(p_info, p_rec, 0);
+            insert_into_hash(worker, p_rec, 0);
         } else
 #endif
         {
             /* This CL_RENAME is followed by CL_EXT, so keep it until
              * then. */
-            p_info->cl_rename = p_rec;
+            worker->cl_rename = p_rec;
         }
     } else if (p_rec->cr_type == CL_EXT) {
 
-        if (!p_info->cl_rename) {
+        if (!worker->cl_rename) {
             /* Should never happen. */
             DisplayLog(LVL_CRIT, CHGLOG_TAG, "Got CL_EXT without a CL_RENAME.");
-            dump_record(LVL_CRIT, mdtname(p_info), p_rec);
-            dump_op_queue(p_info, LVL_CRIT, 32);
+            dump_record(LVL_CRIT, mdtname(worker->info), p_rec);
+            dump_op_queue(worker, LVL_CRIT, 32);
 
             /* Discarding bogus entry. */
             llapi_changelog_free(&p_rec);
@@ -911,7 +1933,7 @@ static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
 
         if (!cl_reader_config.mds_has_lu543 &&
             (FID_IS_ZERO(&p_rec->cr_tfid) ||
-             !entry_id_equal(&p_info->cl_rename->cr_tfid, &p_rec->cr_tfid))) {
+             !entry_id_equal(&worker->cl_rename->cr_tfid, &p_rec->cr_tfid))) {
             /* tfid if 0, or the two fids are different, so we have LU-543. */
             cl_reader_config.mds_has_lu543 = true;
             DisplayLog(LVL_EVENT, CHGLOG_TAG,
@@ -922,20 +1944,11 @@ static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
         /* If target fid is not zero: unlink the target.
          * e.g. "mv a b" and b exists => rm b.
          */
-        if (!FID_IS_ZERO(&p_rec->cr_tfid)) {
-            CL_REC_TYPE *unlink;
-            unsigned int insert_flags;
-
-            /* Push an unlink. */
-            unlink = create_fake_unlink_record(p_info, p_rec, &insert_flags);
-
-            if (unlink) {
-                insert_into_hash(p_info, unlink, insert_flags);
-            } else {
-                DisplayLog(LVL_CRIT, CHGLOG_TAG,
-                           "Could not allocate an UNLINK record.");
-            }
-        }
+        /* Push an unlink. */
+        if (!FID_IS_ZERO(&p_rec->cr_tfid)
+            && insert_unlink_view(worker, p_rec) != 0)
+            DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                       "Could not allocate an UNLINK record.");
 
         /* Push the rename and the ext.
          *
@@ -951,120 +1964,734 @@ static int process_log_rec(reader_thr_info_t *p_info, CL_REC_TYPE *p_rec)
          * world should be rather slim to non-existent. */
 
         /* indicate the target fid as the renamed entry */
-        p_rec->cr_tfid = p_info->cl_rename->cr_tfid;
+        p_rec->cr_tfid = worker->cl_rename->cr_tfid;
+
+        insert_into_hash(worker, worker->cl_rename, 0);
+        worker->cl_rename = NULL;
+        insert_into_hash(worker, p_rec, 0);
+    } else {
+        unsigned int flags = 0;
+
+        /* A created entry can't be in the DB, unless previous records
+         * are about the same fid (e.g. records read again). */
+        if ((p_rec->cr_type == CL_CREATE || p_rec->cr_type == CL_MKDIR)
+            && last_entry_op(worker, &p_rec->cr_tfid) == NULL)
+            flags |= NEW_ENTRY;
+
+        /* build the record to be processed in the pipeline */
+        insert_into_hash(worker, p_rec, flags);
+    }
+
+ done:
+    return 0;
+}
+
+static inline void cl_update_stats(reader_thr_info_t *info,
+                                   CL_REC_TYPE *p_rec)
+{
+    /* update thread info */
+    info->last_read_time = time(NULL);
+    info->nb_read++;
+    info->last_read_record = p_rec->cr_index;
+    info->last_read_record_time.tv_sec = (time_t)cltime2sec(p_rec->cr_time);
+    info->last_read_record_time.tv_usec = cltime2nsec(p_rec->cr_time) / 1000;
+
+    /* if no record has been read, save it as the previous last */
+    if (info->last_report_record_id == 0) {
+        info->last_report_record_id = info->last_read_record - 1;
+        info->last_report_record_time = info->last_read_record_time;
+    }
+
+    if (trace_sampled(p_rec->cr_index)) {
+        struct trace_feed *feed =
+            &info->trace_feed[p_rec->cr_index % CL_TRACE_SLOTS];
+
+        P(info->lock);
+        feed->index = p_rec->cr_index;
+        gettimeofday(&feed->tv, NULL);
+        V(info->lock);
+    }
+}
+
+/* get a changelog line (with retries) */
+typedef enum { cl_ok, cl_continue, cl_stop } cl_status_e;
+
+/* Get the next record of the capture file (replay mode). */
+static cl_status_e cl_replay_one(reader_thr_info_t *info,
+                                 CL_REC_TYPE **pp_rec)
+{
+    struct replay_feed *feed;
+    CL_REC_TYPE *p_rec;
+    struct timeval now;
+    int rc;
+
+    rc = cl_recfile_read(info->replay_fd, &p_rec);
+    if (rc == ENODATA) {
+        DisplayLog(LVL_EVENT, CHGLOG_TAG, "End of replay file '%s' reached",
+                   replay_file);
+        return cl_stop;
+    } else if (rc) {
+        DisplayLog(LVL_CRIT, CHGLOG_TAG, "Error reading record from '%s': "
+                   "%s", replay_file, strerror(rc));
+        return cl_stop;
+    }
+
+    if (replay_realtime) {
+        struct timeval rec_time, delay, target;
+
+        rec_time.tv_sec = cltime2sec(p_rec->cr_time);
+        rec_time.tv_usec = cltime2nsec(p_rec->cr_time) / 1000;
+        if (info->nb_read == 0)
+            info->replay_first_rec = rec_time;
+
+        /* feed records at the same pace as they were generated */
+        timersub(&rec_time, &info->replay_first_rec, &delay);
+        timeradd(&info->replay_start, &delay, &target);
+        gettimeofday(&now, NULL);
+        if (timercmp(&target, &now, >)) {
+            timersub(&target, &now, &delay);
+            if (delay.tv_sec > 0)
+                rh_sleep(delay.tv_sec);
+            rh_usleep(delay.tv_usec);
+        }
+    }
+
+    gettimeofday(&now, NULL);
+    feed = &info->replay_feed[p_rec->cr_index % REPLAY_FEED_SLOTS];
+    P(info->lock);
+    feed->index = p_rec->cr_index;
+    feed->tv = now;
+    V(info->lock);
+
+    cl_update_stats(info, p_rec);
+    *pp_rec = p_rec;
+    return cl_ok;
+}
+
+/* Get the next record from the publisher (subscriber mode). */
+static cl_status_e cl_sub_get_one(reader_thr_info_t *info,
+                                  CL_REC_TYPE **pp_rec)
+{
+    int rc;
+
+    rc = cl_sub_recv(info->sub, pp_rec);
+    switch (rc) {
+    case 0:
+        cl_update_stats(info, *pp_rec);
+        return cl_ok;
+
+    case EAGAIN:
+        /* no record for a while: check for stop requests */
+        return cl_continue;
+
+    case ENODATA:
+        DisplayLog(LVL_EVENT, CHGLOG_TAG, "All the records of %s have been "
+                   "received from the publisher", info->mdtdevice);
+        return cl_stop;
+
+    default:
+        if (rc != ENOTCONN)
+            DisplayLog(LVL_EVENT, CHGLOG_TAG, "Lost connection to publisher "
+                       "'%s': %s. Reconnecting in 1 sec...",
+                       cl_reader_config.subscribe, strerror(rc));
+        if (one_shot)
+            return cl_stop;
+
+        rh_sleep(1);
+        info->nb_reopen++;
+        /* from the record after the last received one */
+        cl_sub_reconnect(info->sub);
+        return cl_continue;
+    }
+}
+
+static cl_status_e cl_get_one(reader_thr_info_t *info, CL_REC_TYPE **pp_rec)
+{
+    int rc;
+
+    if (replaying)
+        return cl_replay_one(info, pp_rec);
+    if (subscribing)
+        return cl_sub_get_one(info, pp_rec);
+
+    /* get next record */
+    rc = llapi_changelog_recv(info->chglog_hdlr, pp_rec);
+
+    if (!EMPTY_STRING(log_config.changelogs_file) && rc != 0 && rc != 1) {
+        DisplayChangelogs
+            (">>> llapi_changelog_recv returned error %d (last record = %llu)",
+             rc, info->last_read_record);
+        FlushLogs();
+    }
+
+    switch (rc) {
+    case 0:
+        /* Successfully retrieved a record. Update thread info. pp_rec
+         * should never be NULL. */
+        cl_update_stats(info, *pp_rec);
+
+        return cl_ok;
+
+    case 1:    /* EOF */
+    case -EINVAL:  /* FS unmounted */
+    case -EPROTO:  /* error in KUC channel */
+
+        /* warn if it is an error */
+        if (rc != 1)
+            DisplayLog(LVL_EVENT, CHGLOG_TAG,
+                       "Error %d in llapi_changelog_recv(): %s. "
+                       "Trying to reopen it.", rc, strerror(-rc));
+
+        if (one_shot)
+            return cl_stop;
+
+        /* Close, wait and open the log again (from last_read_record + 1) */
+        log_close(info);
+
+        if (cl_reader_config.force_polling) {
+            DisplayLog(LVL_FULL, CHGLOG_TAG,
+                       "EOF reached on changelog from %s, reopening in %ld sec",
+                       info->mdtdevice, cl_reader_config.polling_interval);
+            /* sleep during polling interval */
+            rh_sleep(cl_reader_config.polling_interval);
+        } else {
+            DisplayLog(LVL_EVENT, CHGLOG_TAG,
+                       "WARNING: EOF reached on ChangeLog whereas FOLLOW flag "
+                       "was specified. Re-opening in 1 sec...");
+            rh_sleep(1);
+        }
+
+        info->nb_reopen++;
+
+        rc = llapi_changelog_start(&info->chglog_hdlr, info->flags,
+                                   info->mdtdevice, info->last_read_record + 1);
+        if (rc) {
+            /* will try to recover from this error */
+            rh_sleep(1);
+        }
+
+        return cl_continue;
+
+    case -EINTR:
+        DisplayLog(LVL_EVENT, CHGLOG_TAG,
+                   "llapi_changelog_recv() interrupted. Retrying.");
+        return cl_continue;
+
+    default:
+        DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                   "Error in llapi_changelog_recv(): %d: %s",
+                   rc, strerror(abs(rc)));
+
+        /* will try to recover from this error */
+        rh_sleep(1);
+
+        return cl_continue;
+    }
+
+    /* Unreachable */
+    return cl_continue;
+}
+
+/** start the trace of a sampled record, with the time spent until it is
+ * dispatched to its worker */
+static rbh_trace_t *trace_record(cl_worker_t *worker, CL_REC_TYPE *p_rec)
+{
+    reader_thr_info_t *info = worker->info;
+    struct trace_feed *feed = &info->trace_feed[p_rec->cr_index
+                                                % CL_TRACE_SLOTS];
+    struct timeval rec_time, fetch_time, now;
+    rbh_trace_t *trace;
+    char name[128];
+
+    snprintf(name, sizeof(name), "%llu %s "DFID, p_rec->cr_index,
+             changelog_type2str(p_rec->cr_type), PFID(&p_rec->cr_tfid));
+    trace = trace_new(name, p_rec->cr_index, mdtname(info));
+    if (trace == NULL)
+        return NULL;
+
+    gettimeofday(&now, NULL);
+    P(info->lock);
+    fetch_time = (feed->index == p_rec->cr_index) ? feed->tv : now;
+    V(info->lock);
+
+    rec_time.tv_sec = cltime2sec(p_rec->cr_time);
+    rec_time.tv_usec = cltime2nsec(p_rec->cr_time) / 1000;
+    if (timercmp(&rec_time, &fetch_time, <))
+        trace_span(trace, "MDT to reader", &rec_time, &fetch_time);
+    trace_span(trace, "dispatch", &fetch_time, &now);
+
+    return trace;
+}
+
+/** a thread that parses and coalesces the records of a given worker */
+static void *cl_worker_thr(void *arg)
+{
+    cl_worker_t *worker = (cl_worker_t *)arg;
+    reader_thr_info_t *info = worker->info;
+    CL_REC_TYPE *recs[CL_WORKER_BATCH];
+    unsigned int i, count;
+    bool stop = false;
+    /* Next time we will have to push. */
+    time_t next_push_time = time(NULL) + cl_reader_config.queue_check_interval;
+
+    prof_set_role(PROF_ROLE_CHGLOG, "worker");
+
+    while (!stop) {
+        struct timespec deadline = {.tv_sec = next_push_time,.tv_nsec = 0 };
+
+        /* get the next records from the reader thread */
+        P(info->lock);
+        while (worker->in_count == 0 && !info->workers_stop
+               && coarse_time() < next_push_time)
+            pthread_cond_timedwait(&worker->in_cond, &info->lock, &deadline);
+
+        count = MIN2(worker->in_count, CL_WORKER_BATCH);
+        if (count > 0) {
+            /* the reader thread may be waiting for room in the queue */
+            if (worker->in_count == CL_WORKER_QUEUE_SIZE)
+                pthread_cond_signal(&info->dispatch_cond);
+
+            worker->oldest_taken = worker->in_queue[worker->in_first]->cr_index;
+            for (i = 0; i < count; i++) {
+                recs[i] = worker->in_queue[worker->in_first];
+                worker->in_first = (worker->in_first + 1)
+                    % CL_WORKER_QUEUE_SIZE;
+            }
+            worker->in_count -= count;
+        }
+        /* stop when the reader is done and the queue is drained */
+        stop = info->workers_stop && (worker->in_count == 0);
+        V(info->lock);
+
+        /* handle the records and queue them for the pipeline */
+        for (i = 0; i < count; i++) {
+            if (trace_sampled(recs[i]->cr_index))
+                worker->trace = trace_record(worker, recs[i]);
+
+            process_log_rec(worker, recs[i]);
+
+            /* record merged into a previous op, or ignored */
+            if (worker->trace != NULL) {
+                trace_put(worker->trace);
+                worker->trace = NULL;
+            }
+        }
+
+        /* Is it time to flush? Flush everything when stopping,
+         * unless queued ops are saved to the state file. */
+        if ((stop && !info->save_state)
+            || worker->op_queue_count >= cl_reader_config.queue_max_size
+            || next_push_time <= coarse_time()) {
+            process_op_queue(worker, stop);
+
+            next_push_time = coarse_time() + cl_reader_config.queue_check_interval;
+
+            if (!EMPTY_STRING(log_config.changelogs_file))
+                FlushLogs();
+        }
+
+        P(info->lock);
+        worker->oldest_taken = 0;
+        update_oldest_queued(worker);
+        V(info->lock);
+    }
+
+    return NULL;
+}
+
+/** select the worker in charge of a record, according to its fid */
+static unsigned int record_worker(reader_thr_info_t *info, CL_REC_TYPE *p_rec)
+{
+    if (info->nb_workers == 1)
+        return 0;
+
+    /* all records of a rename must be processed in order by the same
+     * worker: dispatch them according to the renamed entry */
+    if (p_rec->cr_type == CL_EXT)
+        return info->rename_worker;
+
+    if (p_rec->cr_type == CL_RENAME) {
+#if defined(HAVE_CHANGELOG_EXTEND_REC) || defined(HAVE_FLEX_CL)
+        if (rh_is_rename_one_record(p_rec))
+#ifdef HAVE_FLEX_CL
+            return hash_id(&changelog_rec_rename(p_rec)->cr_sfid,
+                           info->nb_workers);
+#else
+            return hash_id(&p_rec->cr_sfid, info->nb_workers);
+#endif
+#endif
+        /* this CL_RENAME is followed by CL_EXT */
+        info->rename_worker = hash_id(&p_rec->cr_tfid, info->nb_workers);
+        return info->rename_worker;
+    }
+
+    return hash_id(&p_rec->cr_tfid, info->nb_workers);
+}
+
+/** hand a record over to a parsing worker */
+static void dispatch_log_rec(reader_thr_info_t *info, CL_REC_TYPE *p_rec)
+{
+    unsigned int opnum = p_rec->cr_type;
+    cl_worker_t *worker;
+
+    /* update stats */
+    if (opnum < CL_LAST)
+        info->cl_counters[opnum]++;
+    else {
+        DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                   "Log record type %d out of bounds.", opnum);
+        llapi_changelog_free(&p_rec);
+        return;
+    }
+
+    worker = &info->workers[record_worker(info, p_rec)];
+
+    P(info->lock);
+    while (worker->in_count == CL_WORKER_QUEUE_SIZE)
+        pthread_cond_wait(&info->dispatch_cond, &info->lock);
+
+    worker->in_queue[(worker->in_first + worker->in_count)
+                     % CL_WORKER_QUEUE_SIZE] = p_rec;
+    if (worker->in_count++ == 0)
+        pthread_cond_signal(&worker->in_cond);
+
+    info->last_dispatched = p_rec->cr_index;
+    V(info->lock);
+}
+
+/** a thread that replays spooled records */
+static void *spool_replay_thr(void *arg)
+{
+    reader_thr_info_t *info = (reader_thr_info_t *)arg;
+    CL_REC_TYPE *p_rec;
+
+    prof_set_role(PROF_ROLE_CHGLOG, "spool_replay");
+
+    while (cl_spool_next(info->spool, &p_rec) == 0)
+        dispatch_log_rec(info, p_rec);
+
+    return NULL;
+}
+
+/** Flush the spool, and clear the spooled records from the MDT. */
+static void spool_sync_clear(reader_thr_info_t *info)
+{
+    unsigned long long synced = cl_spool_sync(info->spool);
+
+    if (synced > info->last_spooled_cleared
+        && changelog_clear(info, synced) == 0)
+        info->last_spooled_cleared = synced;
+}
+
+/** Append a record to the spool, waiting for free space if needed. */
+static void spool_record(reader_thr_info_t *info, CL_REC_TYPE *p_rec)
+{
+    int rc;
+
+    while ((rc = cl_spool_append(info->spool, p_rec)) != 0
+           && !info->force_stop) {
+        if (rc == ENOSPC) {
+            if (!info->spool_full) {
+                info->spool_full = true;
+                DisplayLog(LVL_CRIT, CHGLOG_TAG, "Spool of %s is full "
+                           "(spool_max_size=%llu): records are kept in "
+                           "the MDT changelog", info->mdtdevice,
+                           cl_reader_config.spool_max_size);
+                RaiseAlert("Changelog spool is full",
+                           "Changelog spool of %s is full (spool_max_size="
+                           "%llu bytes) in '%s'.\nRecords are no longer "
+                           "drained from the MDT until some room is freed.",
+                           info->mdtdevice, cl_reader_config.spool_max_size,
+                           cl_reader_config.spool_dir);
+            }
+            /* room is freed as spooled records are committed */
+            spool_sync_clear(info);
+            cl_spool_wait_space(info->spool, 1);
+        } else {
+            /* will try to recover from this error */
+            rh_sleep(1);
+        }
+    }
 
-        insert_into_hash(p_info, p_info->cl_rename, 0);
-        p_info->cl_rename = NULL;
-        insert_into_hash(p_info, p_rec, 0);
-    } else {
-        /* build the record to be processed in the pipeline */
-        insert_into_hash(p_info, p_rec, 0);
+    if (rc == 0 && info->spool_full) {
+        info->spool_full = false;
+        DisplayLog(LVL_EVENT, CHGLOG_TAG, "Spool of %s is no longer full",
+                   info->mdtdevice);
     }
 
- done:
-    return 0;
+    llapi_changelog_free(&p_rec);
 }
 
-static inline void cl_update_stats(reader_thr_info_t *info,
-                                   CL_REC_TYPE *p_rec)
+/* State file: the records of the ops that are not committed when the
+ * daemon stops. They are still in the MDT changelog (which is cleared up
+ * to the committed records only), so a missing or invalid state file
+ * only means they are read again from the MDT. */
+#define CL_STATE_MAGIC  0x52424853  /* "RBHS" */
+
+struct cl_state_hdr {
+    uint32_t magic;
+    uint32_t count;
+    /* all the records up to this one were read from the MDT */
+    uint64_t last_read;
+};
+
+struct cl_state_collect {
+    reader_thr_info_t *info;
+    CL_REC_TYPE **recs;
+    unsigned int count;
+    unsigned int size;
+    /* records of views (which don't own their record) */
+    unsigned long long *views;
+    unsigned int nb_views;
+    unsigned int views_size;
+    bool error;
+};
+
+static void state_path(const reader_thr_info_t *info, char *path, size_t size)
 {
-    /* update thread info */
-    info->last_read_time = time(NULL);
-    info->nb_read++;
-    info->last_read_record = p_rec->cr_index;
-    info->last_read_record_time.tv_sec = (time_t)cltime2sec(p_rec->cr_time);
-    info->last_read_record_time.tv_usec = cltime2nsec(p_rec->cr_time) / 1000;
+    snprintf(path, size, "%s/%s.%s.state", cl_reader_config.state_dir,
+             info->mdtdevice,
+             cl_reader_config.mdt_def[info->thr_index].reader_id);
+}
 
-    /* if no record has been read, save it as the previous last */
-    if (info->last_report_record_id == 0) {
-        info->last_report_record_id = info->last_read_record - 1;
-        info->last_report_record_time = info->last_read_record_time;
+static void state_add_rec(struct cl_state_collect *st, CL_REC_TYPE *rec)
+{
+    if (st->count == st->size) {
+        unsigned int size = MAX2(2 * st->size, 1024);
+        CL_REC_TYPE **recs = MemRealloc(st->recs, size * sizeof(*recs));
+
+        if (recs == NULL) {
+            st->error = true;
+            return;
+        }
+        st->recs = recs;
+        st->size = size;
     }
+    st->recs[st->count++] = rec;
 }
 
-/* get a changelog line (with retries) */
-typedef enum { cl_ok, cl_continue, cl_stop } cl_status_e;
-
-static cl_status_e cl_get_one(reader_thr_info_t *info, CL_REC_TYPE **pp_rec)
+static void state_add_op(struct cl_state_collect *st, entry_proc_op_t *op)
 {
-    int rc;
+    const changelog_record_t *cl_rec = &op->extra_info.log_record;
 
-    /* get next record */
-    rc = llapi_changelog_recv(info->chglog_hdlr, pp_rec);
+    if (!cl_rec->is_view) {
+        state_add_rec(st, cl_rec->p_log_rec);
+        return;
+    }
 
-    if (!EMPTY_STRING(log_config.changelogs_file) && rc != 0 && rc != 1) {
-        DisplayChangelogs
-            (">>> llapi_changelog_recv returned error %d (last record = %llu)",
-             rc, info->last_read_record);
-        FlushLogs();
+    /* a view is rebuilt from the record it was created for */
+    if (st->nb_views == st->views_size) {
+        unsigned int size = MAX2(2 * st->views_size, 64);
+        unsigned long long *views = MemRealloc(st->views,
+                                               size * sizeof(*views));
+        if (views == NULL) {
+            st->error = true;
+            return;
+        }
+        st->views = views;
+        st->views_size = size;
     }
+    st->views[st->nb_views++] = cl_rec->p_log_rec->cr_index + 1;
+}
 
-    switch (rc) {
-    case 0:
-        /* Successfully retrieved a record. Update thread info. pp_rec
-         * should never be NULL. */
-        cl_update_stats(info, *pp_rec);
+/** collect the changelog ops of a reader, that are left in the pipeline */
+static void state_collect_op(entry_proc_op_t *op, void *arg)
+{
+    struct cl_state_collect *st = arg;
 
-        return cl_ok;
+    if (!op->extra_info.is_changelog_record
+        || op->extra_info.log_record.p_log_rec == NULL
+        || op->callback_func != log_record_callback
+        || ((cl_worker_t *)op->callback_param)->info != st->info)
+        return;
 
-    case 1:    /* EOF */
-    case -EINVAL:  /* FS unmounted */
-    case -EPROTO:  /* error in KUC channel */
+    state_add_op(st, op);
+}
 
-        /* warn if it is an error */
-        if (rc != 1)
-            DisplayLog(LVL_EVENT, CHGLOG_TAG,
-                       "Error %d in llapi_changelog_recv(): %s. "
-                       "Trying to reopen it.", rc, strerror(-rc));
+static int rec_index_cmp(const void *a, const void *b)
+{
+    unsigned long long ia = (*(CL_REC_TYPE * const *)a)->cr_index;
+    unsigned long long ib = (*(CL_REC_TYPE * const *)b)->cr_index;
 
-        if (one_shot)
-            return cl_stop;
+    return (ia > ib) - (ia < ib);
+}
 
-        /* Close, wait and open the log again (from last_read_record + 1) */
-        log_close(info);
+static bool state_has_rec(const struct cl_state_collect *st,
+                          unsigned long long index)
+{
+    unsigned int lo = 0, hi = st->count;
 
-        if (cl_reader_config.force_polling) {
-            DisplayLog(LVL_FULL, CHGLOG_TAG,
-                       "EOF reached on changelog from %s, reopening in %ld sec",
-                       info->mdtdevice, cl_reader_config.polling_interval);
-            /* sleep during polling interval */
-            rh_sleep(cl_reader_config.polling_interval);
-        } else {
-            DisplayLog(LVL_EVENT, CHGLOG_TAG,
-                       "WARNING: EOF reached on ChangeLog whereas FOLLOW flag "
-                       "was specified. Re-opening in 1 sec...");
-            rh_sleep(1);
-        }
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
 
-        info->nb_reopen++;
+        if (st->recs[mid]->cr_index < index)
+            lo = mid + 1;
+        else if (st->recs[mid]->cr_index > index)
+            hi = mid;
+        else
+            return true;
+    }
+    return false;
+}
 
-        rc = llapi_changelog_start(&info->chglog_hdlr, info->flags,
-                                   info->mdtdevice, info->last_read_record + 1);
-        if (rc) {
-            /* will try to recover from this error */
-            rh_sleep(1);
+/** write the state file of a reader (once the pipeline is terminated) */
+static void save_state(reader_thr_info_t *info)
+{
+    struct cl_state_collect st;
+    struct cl_state_hdr hdr;
+    char path[RBH_PATH_MAX];
+    char tmp[RBH_PATH_MAX + 4];
+    unsigned int i, j;
+    int fd, rc = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.info = info;
+
+    /* ops in the pipeline, then ops in worker queues */
+    EntryProcessor_ForEachPending(state_collect_op, &st);
+    for (i = 0; i < info->nb_workers; i++) {
+        cl_worker_t *worker = &info->workers[i];
+        entry_proc_op_t *op;
+
+        for (j = 0; j < CL_LANE_COUNT; j++)
+            rh_list_for_each_entry(op, &worker->lanes[j], list)
+                state_add_op(&st, op);
+        if (worker->cl_rename != NULL)
+            state_add_rec(&st, worker->cl_rename);
+    }
+    /* and records of the previous state that were not dispatched */
+    for (i = info->state_next; i < info->state_count; i++)
+        state_add_rec(&st, info->state_recs[i]);
+
+    if (st.error) {
+        DisplayLog(LVL_CRIT, CHGLOG_TAG, "Memory error saving the state of "
+                   "%s: pending records will be read again from the MDT",
+                   info->mdtdevice);
+        goto out;
+    }
+
+    qsort(st.recs, st.count, sizeof(*st.recs), rec_index_cmp);
+    for (i = 0; i < st.nb_views; i++) {
+        if (!state_has_rec(&st, st.views[i])) {
+            DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Cannot save the state of %s: "
+                       "record #%llu is no longer available. Pending "
+                       "records will be read again from the MDT",
+                       info->mdtdevice, st.views[i]);
+            goto out;
         }
+    }
 
-        return cl_continue;
+    state_path(info, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        DisplayLog(LVL_CRIT, CHGLOG_TAG, "Cannot create state file '%s': %s",
+                   tmp, strerror(errno));
+        goto out;
+    }
 
-    case -EINTR:
-        DisplayLog(LVL_EVENT, CHGLOG_TAG,
-                   "llapi_changelog_recv() interrupted. Retrying.");
-        return cl_continue;
+    hdr.magic = CL_STATE_MAGIC;
+    hdr.count = st.count;
+    hdr.last_read = info->last_read_record;
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        rc = errno ? errno : EIO;
+    for (i = 0; i < st.count && rc == 0; i++)
+        rc = cl_recfile_write(fd, st.recs[i]);
+    if (rc == 0 && fsync(fd) != 0)
+        rc = errno;
+    close(fd);
+
+    if (rc == 0 && rename(tmp, path) != 0)
+        rc = errno;
+    if (rc) {
+        DisplayLog(LVL_CRIT, CHGLOG_TAG, "Failed to write state file '%s': "
+                   "%s", path, strerror(rc));
+        unlink(tmp);
+        goto out;
+    }
 
-    default:
-        DisplayLog(LVL_CRIT, CHGLOG_TAG,
-                   "Error in llapi_changelog_recv(): %d: %s",
-                   rc, strerror(abs(rc)));
+    DisplayLog(LVL_EVENT, CHGLOG_TAG, "%u pending records of %s saved to "
+               "'%s' (last read record: %llu)", st.count, info->mdtdevice,
+               path, info->last_read_record);
+ out:
+    MemFree(st.recs);
+    MemFree(st.views);
+}
 
-        /* will try to recover from this error */
-        rh_sleep(1);
+/**
+ * Load the state file of a reader, if any.
+ * @param[in,out] start_rec  first record to be read from the MDT.
+ */
+static void load_state(reader_thr_info_t *info, unsigned long long *start_rec)
+{
+    struct cl_state_hdr hdr;
+    char path[RBH_PATH_MAX];
+    CL_REC_TYPE *rec;
+    unsigned int i;
+    int fd, rc = 0;
+
+    state_path(info, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Cannot open state file '%s': "
+                       "%s", path, strerror(errno));
+        return;
+    }
 
-        return cl_continue;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+        || hdr.magic != CL_STATE_MAGIC) {
+        DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Ignoring invalid state file '%s'",
+                   path);
+        goto out_close;
     }
 
-    /* Unreachable */
-    return cl_continue;
+    /* records up to start_rec - 1 are committed */
+    if (hdr.last_read + 1 < *start_rec) {
+        DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Ignoring obsolete state file '%s' "
+                   "(last_read=%llu, last committed=%llu)", path,
+                   (unsigned long long)hdr.last_read, *start_rec - 1);
+        goto out_close;
+    }
+
+    info->state_recs = MemCalloc(MAX2(hdr.count, 1), sizeof(*info->state_recs));
+    if (info->state_recs == NULL)
+        goto out_close;
+
+    for (i = 0; i < hdr.count; i++) {
+        rc = cl_recfile_read(fd, &rec);
+        if (rc)
+            break;
+        if (rec->cr_index < *start_rec) {
+            llapi_changelog_free(&rec);
+            continue;
+        }
+        info->state_recs[info->state_count++] = rec;
+    }
+
+    if (rc) {
+        DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Error reading state file '%s': "
+                   "%s. Reading records from the MDT", path, strerror(rc));
+        for (i = 0; i < info->state_count; i++)
+            llapi_changelog_free(&info->state_recs[i]);
+        MemFree(info->state_recs);
+        info->state_recs = NULL;
+        info->state_count = 0;
+        goto out_close;
+    }
+
+    DisplayLog(LVL_EVENT, CHGLOG_TAG, "Loaded %u pending records of %s from "
+               "'%s' (resuming MDT changelog at record %llu)",
+               info->state_count, info->mdtdevice, path,
+               (unsigned long long)hdr.last_read + 1);
+    *start_rec = hdr.last_read + 1;
+    info->last_read_record = hdr.last_read;
+
+ out_close:
+    close(fd);
+    /* if the daemon stops before these records are committed, they are
+     * saved again (or read again from the MDT) */
+    unlink(path);
 }
 
 /** a thread that reads lines from a given changelog */
@@ -1073,20 +2700,26 @@ static void *chglog_reader_thr(void *arg)
     reader_thr_info_t *info = (reader_thr_info_t *)arg;
     CL_REC_TYPE *p_rec = NULL;
     cl_status_e st;
-    /* Next time we will have to push. */
-    time_t next_push_time = time(NULL) + cl_reader_config.queue_check_interval;
+    unsigned int i, unsynced = 0;
+    time_t next_sync = time(NULL) + 1;
 
-    /* loop until a TERM signal is caught */
-    while (!info->force_stop) {
-        /* Is it time to flush? */
-        if (info->op_queue_count >= cl_reader_config.queue_max_size ||
-            next_push_time <= time(NULL)) {
-            process_op_queue(info, false);
+    prof_set_role(PROF_ROLE_CHGLOG, "reader");
 
-            next_push_time = time(NULL) + cl_reader_config.queue_check_interval;
+    /* first process the records saved at the last shutdown */
+    while (info->state_next < info->state_count && !info->force_stop) {
+        p_rec = info->state_recs[info->state_next];
+        info->state_recs[info->state_next++] = NULL;
+        dispatch_log_rec(info, p_rec);
+    }
 
-            if (!EMPTY_STRING(log_config.changelogs_file))
-                FlushLogs();
+    /* loop until a TERM signal is caught */
+    while (!info->force_stop) {
+        if (info->spool != NULL
+            && (unsynced >= cl_reader_config.batch_ack_count
+                || coarse_time() >= next_sync)) {
+            spool_sync_clear(info);
+            unsynced = 0;
+            next_sync = coarse_time() + 1;
         }
 
         st = cl_get_one(info, &p_rec);
@@ -1095,12 +2728,37 @@ static void *chglog_reader_thr(void *arg)
         else if (st == cl_stop)
             break;
 
-        /* handle the line and push it to the pipeline */
-        process_log_rec(info, p_rec);
+        if (info->spool != NULL) {
+            /* drain the MDT: the record is replayed from the spool */
+            spool_record(info, p_rec);
+            unsynced++;
+        } else {
+            if (publishing)
+                cl_pub_record(info->thr_index, p_rec);
+            /* the record is parsed and pushed to the pipeline by a worker */
+            dispatch_log_rec(info, p_rec);
+        }
+    }
+
+    if (info->spool != NULL) {
+        spool_sync_clear(info);
+        /* When stopping, remaining records are kept in the spool.
+         * Else (one shot), replay all the spooled records. */
+        cl_spool_close_writer(info->spool);
+        if (info->force_stop)
+            cl_spool_stop(info->spool);
+        pthread_join(info->replay_thr, NULL);
     }
 
-    /* Stopping. Flush the internal queue. */
-    process_op_queue(info, true);
+    /* Stopping. Workers flush their internal queue. */
+    P(info->lock);
+    info->workers_stop = true;
+    for (i = 0; i < info->nb_workers; i++)
+        pthread_cond_signal(&info->workers[i].in_cond);
+    V(info->lock);
+
+    for (i = 0; i < info->nb_workers; i++)
+        pthread_join(info->workers[i].thr_id, NULL);
 
     DisplayLog(LVL_CRIT, CHGLOG_TAG, "Changelog reader thread terminating");
     FlushLogs();
@@ -1126,11 +2784,101 @@ static void action_sigchld(int sig)
 }
 #endif
 
+/** create the parsing workers of a reader */
+static int start_workers(reader_thr_info_t *info)
+{
+    unsigned int i, j;
+
+    info->nb_workers = cl_reader_config.parsing_threads;
+    info->workers = (cl_worker_t *)MemCalloc(info->nb_workers,
+                                             sizeof(cl_worker_t));
+    if (info->workers == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < info->nb_workers; i++) {
+        cl_worker_t *worker = &info->workers[i];
+
+        worker->info = info;
+        worker->index = i;
+        for (j = 0; j < CL_LANE_COUNT; j++)
+            rh_list_init(&worker->lanes[j]);
+        worker->id_hash = id_hash_init(ID_CHGLOG_HASH_SIZE, false);
+        if (worker->id_hash == NULL)
+            return ENOMEM;
+        worker->hash_size = ID_CHGLOG_HASH_SIZE;
+        pthread_cond_init(&worker->in_cond, NULL);
+
+        if (pthread_create(&worker->thr_id, NULL, cl_worker_thr, worker)) {
+            int err = errno;
+            DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                       "ERROR creating ChangeLog parsing thread: %s",
+                       strerror(err));
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+void cl_reader_set_replay(const char *file, bool realtime)
+{
+    replay_file = file;
+    replay_realtime = realtime;
+}
+
+/** open the capture file to be replayed by a reader */
+static int replay_open(reader_thr_info_t *info)
+{
+    info->replay_fd = open(replay_file, O_RDONLY);
+    if (info->replay_fd < 0) {
+        int rc = errno;
+
+        DisplayLog(LVL_CRIT, CHGLOG_TAG, "Cannot open replay file '%s': %s",
+                   replay_file, strerror(rc));
+        return rc;
+    }
+
+    info->replay_feed = MemCalloc(REPLAY_FEED_SLOTS,
+                                  sizeof(*info->replay_feed));
+    if (info->replay_feed == NULL) {
+        close(info->replay_fd);
+        return ENOMEM;
+    }
+
+    DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Replaying changelog records from "
+               "'%s' at %s speed", replay_file,
+               replay_realtime ? "real-time" : "maximum");
+    gettimeofday(&info->replay_start, NULL);
+    return 0;
+}
+
+/** report the performance of a replay */
+static void replay_report(reader_thr_info_t *info)
+{
+    struct timeval now, elapsed;
+    double sec;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &info->replay_start, &elapsed);
+    sec = elapsed.tv_sec + elapsed.tv_usec / 1000000.0;
+
+    DisplayLog(LVL_MAJOR, "STATS", "Replay of '%s' (%s speed): %llu records "
+               "in %.2fs (%.1f records/sec)", replay_file,
+               replay_realtime ? "real-time" : "maximum", info->nb_read, sec,
+               sec > 0.0 ? info->nb_read / sec : 0.0);
+    if (info->lag_count > 0)
+        DisplayLog(LVL_MAJOR, "STATS", "   end-to-end lag: avg=%.3fs, "
+                   "max=%.3fs (%llu samples)",
+                   info->lag_sum / info->lag_count, info->lag_max,
+                   info->lag_count);
+}
+
 /** start ChangeLog Reader module */
 int cl_reader_start(run_flags_t flags, int mdt_index)
 {
     int i, rc;
     char mdtdevice[128];
+    char spool_name[256];
 #ifdef _LLAPI_FORKS
     struct sigaction act_sigchld;
 #endif
@@ -1162,6 +2910,10 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
         return EINVAL;
     }
 
+    /* a capture file holds the records of a single MDT */
+    if (replaying && mdt_index == -1)
+        mdt_index = 0;
+
     if (mdt_index != -1) {
         /* hack the configuration structure to keep only the specified MDT */
         if (mdt_index != 0)
@@ -1182,6 +2934,21 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
     if (reader_info == NULL)
         return ENOMEM;
 
+    metrics_register(cl_reader_metrics_collect, NULL);
+
+    if (!EMPTY_STRING(cl_reader_config.trace_file)) {
+        rc = trace_init(cl_reader_config.trace_file,
+                        cl_reader_config.trace_sample_rate);
+        if (rc)
+            return rc;
+    }
+
+    if (publishing) {
+        rc = cl_pub_init(&cl_reader_config);
+        if (rc)
+            return rc;
+    }
+
 #ifdef _LLAPI_FORKS
     /* initialize sigchild handler */
     memset(&act_sigchld, 0, sizeof(act_sigchld));
@@ -1215,9 +2982,11 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
 
         memset(info, 0, sizeof(reader_thr_info_t));
         info->thr_index = i;
-        rh_list_init(&info->op_queue);
         info->last_report = time(NULL);
-        info->id_hash = id_hash_init(ID_CHGLOG_HASH_SIZE, false);
+        info->queue_age = cl_reader_config.queue_max_age;
+        pthread_mutex_init(&info->lock, NULL);
+        pthread_mutex_init(&info->clear_lock, NULL);
+        pthread_cond_init(&info->dispatch_cond, NULL);
 
         snprintf(mdtdevice, 128, "%s-%s", get_fsname(),
                  cl_reader_config.mdt_def[i].mdt_name);
@@ -1228,7 +2997,7 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
               || cl_reader_config.force_polling) ? 0 : CHANGELOG_FLAG_FOLLOW)
             | CHANGELOG_FLAG_BLOCK;
 
-        if (dbget) {
+        if (dbget && !replaying) {
             char lastcl_var[256];
             char val_str[1024];
 
@@ -1239,11 +3008,32 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
                 last_rec = str2bigint(val_str);
                 if (last_rec == -1LL)
                     last_rec = 0;
-                else
+                else {
+                    info->position = last_rec;
                     /* start rec = last rec + 1 */
                     last_rec++;
+                }
             }
         }
+        if (!EMPTY_STRING(cl_reader_config.state_dir) && !replaying
+            && EMPTY_STRING(cl_reader_config.spool_dir))
+            load_state(info, &last_rec);
+
+        if (!EMPTY_STRING(cl_reader_config.spool_dir) && !replaying) {
+            snprintf(spool_name, sizeof(spool_name), "%s.%s", mdtdevice,
+                     cl_reader_config.mdt_def[i].reader_id);
+            rc = cl_spool_open(cl_reader_config.spool_dir, spool_name,
+                               cl_reader_config.spool_max_size,
+                               last_rec > 0 ? last_rec - 1 : 0, &info->spool);
+            if (rc)
+                return rc;
+
+            /* spooled records are already cleared from the MDT */
+            info->last_spooled_cleared = cl_spool_last(info->spool);
+            if (info->last_spooled_cleared >= last_rec)
+                last_rec = info->last_spooled_cleared + 1;
+        }
+
         DisplayLog(LVL_DEBUG, CHGLOG_TAG,
                    "Opening chglog for %s (start_rec=%llu)", mdtdevice,
                    last_rec);
@@ -1251,8 +3041,17 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
         /* open the changelog (if we are in one_shot mode,
          * don't use the CHANGELOG_FLAG_FOLLOW flag)
          */
-        rc = llapi_changelog_start(&info->chglog_hdlr,
-                                   info->flags, info->mdtdevice, last_rec);
+        if (replaying)
+            rc = replay_open(info);
+        else if (subscribing)
+            rc = cl_sub_open(cl_reader_config.subscribe,
+                             cl_reader_config.mdt_def[i].reader_id,
+                             cl_reader_config.mdt_def[i].mdt_name, last_rec,
+                             last_rec > 0 ? last_rec - 1 : 0, !one_shot,
+                             &info->sub);
+        else
+            rc = llapi_changelog_start(&info->chglog_hdlr,
+                                       info->flags, info->mdtdevice, last_rec);
 
         if (rc) {
             DisplayLog(LVL_CRIT, CHGLOG_TAG,
@@ -1261,6 +3060,21 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
             return abs(rc);
         }
 
+        /* create the workers that parse its records */
+        rc = start_workers(info);
+        if (rc)
+            return rc;
+
+        if (info->spool != NULL
+            && pthread_create(&info->replay_thr, NULL, spool_replay_thr,
+                              info)) {
+            int err = errno;
+            DisplayLog(LVL_CRIT, CHGLOG_TAG,
+                       "ERROR creating ChangeLog spool thread: %s",
+                       strerror(err));
+            return err;
+        }
+
         /* then create the thread that manages it */
         if (pthread_create(&info->thr_id, NULL, chglog_reader_thr, info)) {
             int err = errno;
@@ -1275,6 +3089,14 @@ int cl_reader_start(run_flags_t flags, int mdt_index)
     if (dbget)
         ListMgr_CloseAccess(&lmgr);
 
+    if (publishing) {
+        rc = cl_pub_listen(pub_clear_cb);
+        if (rc)
+            return rc;
+    }
+
+    if (!replaying)
+        return start_position_flusher();
     return 0;
 }
 
@@ -1285,6 +3107,9 @@ int cl_reader_terminate(void)
 
     /* ask threads to stop */
     for (i = 0; i < cl_reader_config.mdt_count; i++) {
+        /* spooled records are already local */
+        reader_info[i].save_state = !EMPTY_STRING(cl_reader_config.state_dir)
+            && !replaying && reader_info[i].spool == NULL;
         reader_info[i].force_stop = true;
     }
 
@@ -1320,16 +3145,167 @@ int cl_reader_done(void)
         reader_thr_info_t *info = &reader_info[i];
 
         /* Clear the records that are still batched for clearing. */
-        clear_changelog_records(info);
+        P(info->lock);
+        info->last_committed_record = MAX2(info->last_committed_record,
+                                           committed_watermark(info));
+        V(info->lock);
+        if (clear_changelog_records(info) == 0) {
+            save_position(info);
+            trace_cleared(info, false);
+        }
+        /* records that could not be cleared */
+        trace_cleared(info, true);
+
+        if (info->save_state)
+            save_state(info);
+
+        if (info->state_recs != NULL) {
+            unsigned int j;
+
+            for (j = info->state_next; j < info->state_count; j++)
+                llapi_changelog_free(&info->state_recs[j]);
+            MemFree(info->state_recs);
+            info->state_recs = NULL;
+        }
 
         log_close(info);
+
+        if (info->spool != NULL) {
+            cl_spool_close(info->spool);
+            info->spool = NULL;
+        }
+
+        if (replaying) {
+            replay_report(info);
+            MemFree(info->replay_feed);
+            info->replay_feed = NULL;
+        }
     }
 
+    /* disconnect subscribers */
+    if (publishing)
+        cl_pub_stop();
+
+    /* save the final positions */
+    stop_position_flusher();
+
     cl_reader_dump_stats();
 
+    trace_close();
+
     return 0;
 }
 
+/** export changelog reader stats to the metrics endpoint */
+static void cl_reader_metrics_collect(metrics_out_t *out, void *arg)
+{
+    unsigned int i, j;
+
+    if (reader_info == NULL)
+        return;
+
+    /* no lock, as for the stats dump */
+    for (i = 0; i < cl_reader_config.mdt_count; i++) {
+        reader_thr_info_t *info = &reader_info[i];
+        const char *labels[] = { "mdt", cl_reader_config.mdt_def[i].mdt_name,
+                                 NULL, NULL, NULL };
+        unsigned long long interesting = 0, suppressed = 0, merged = 0;
+        unsigned int pending = 0;
+
+        for (j = 0; j < info->nb_workers; j++) {
+            interesting += info->workers[j].interesting_records;
+            suppressed += info->workers[j].suppressed_records;
+            merged += info->workers[j].merged_records;
+            pending += info->workers[j].op_queue_count;
+        }
+
+        metrics_family(out, "changelog_records_read_total", METRIC_COUNTER,
+                       "Changelog records read");
+        metrics_value(out, labels, info->nb_read);
+        metrics_family(out, "changelog_records_interesting_total",
+                       METRIC_COUNTER, "Changelog records that were "
+                       "processed");
+        metrics_value(out, labels, interesting);
+        metrics_family(out, "changelog_records_suppressed_total",
+                       METRIC_COUNTER, "Changelog records that were ignored");
+        metrics_value(out, labels, suppressed);
+        metrics_family(out, "changelog_records_merged_total", METRIC_COUNTER,
+                       "Changelog records merged with a pending one");
+        metrics_value(out, labels, merged);
+        metrics_family(out, "changelog_records_pending", METRIC_GAUGE,
+                       "Changelog records waiting to be pushed to the "
+                       "pipeline");
+        metrics_value(out, labels, pending);
+        metrics_family(out, "changelog_last_read_record", METRIC_GAUGE,
+                       "Index of the last read changelog record");
+        metrics_value(out, labels, info->last_read_record);
+        metrics_family(out, "changelog_last_committed_record", METRIC_GAUGE,
+                       "Index of the last changelog record committed to DB");
+        metrics_value(out, labels, info->last_committed_record);
+        metrics_family(out, "changelog_last_cleared_record", METRIC_GAUGE,
+                       "Index of the last cleared changelog record");
+        metrics_value(out, labels, info->last_cleared_record);
+        metrics_family(out, "changelog_pipeline_lag_seconds", METRIC_GAUGE,
+                       "Average delay from the push of records to the "
+                       "pipeline to their commit");
+        metrics_value(out, labels, info->pipeline_lag);
+        metrics_family(out, "changelog_reopen_total", METRIC_COUNTER,
+                       "Times the changelog was reopened");
+        metrics_value(out, labels, info->nb_reopen);
+
+        metrics_family(out, "changelog_records_total", METRIC_COUNTER,
+                       "Changelog records read by type");
+        labels[2] = "type";
+        for (j = 0; j < CL_LAST; j++) {
+            labels[3] = changelog_type2str(j);
+            metrics_value(out, labels, info->cl_counters[j]);
+        }
+    }
+}
+
+static void dump_lag_hist(const char *name, const cl_lag_hist_t *hist)
+{
+    if (hist->count == 0)
+        return;
+
+    DisplayLog(LVL_MAJOR, "STATS", "   %-19s : p50 < %.3fs, p90 < %.3fs, "
+               "p99 < %.3fs", name, lag_percentile(hist, 50),
+               lag_percentile(hist, 90), lag_percentile(hist, 99));
+}
+
+/** dump the lag of records committed since the last dump */
+static void dump_lag_stats(reader_thr_info_t *info)
+{
+    cl_lag_hist_t reader, pipeline, total;
+    time_t queue_age;
+
+    P(info->lock);
+    reader = info->lag_reader;
+    pipeline = info->lag_pipeline;
+    total = info->lag_total;
+    memset(&info->lag_reader, 0, sizeof(info->lag_reader));
+    memset(&info->lag_pipeline, 0, sizeof(info->lag_pipeline));
+    memset(&info->lag_total, 0, sizeof(info->lag_total));
+    queue_age = info->queue_age;
+    V(info->lock);
+
+    if (cl_reader_config.queue_auto_tune)
+        DisplayLog(LVL_MAJOR, "STATS", "   queue max age       = %lds "
+                   "(auto-tuned in [%ld-%ld]s)", queue_age,
+                   MIN2(cl_reader_config.queue_min_age,
+                        cl_reader_config.queue_max_age),
+                   cl_reader_config.queue_max_age);
+
+    if (total.count == 0)
+        return;
+
+    DisplayLog(LVL_MAJOR, "STATS", "   record lag (%llu committed records "
+               "sampled):", total.count);
+    dump_lag_hist("record -> push", &reader);
+    dump_lag_hist("push -> DB commit", &pipeline);
+    dump_lag_hist("record -> DB commit", &total);
+}
+
 /** dump changelog processing stats */
 int cl_reader_dump_stats(void)
 {
@@ -1343,6 +3319,29 @@ int cl_reader_dump_stats(void)
     for (i = 0; i < cl_reader_config.mdt_count; i++) {
         double speed, speed2;
         unsigned int interval, interval2 = 0;
+        unsigned long long interesting = 0, suppressed = 0, merged = 0;
+        unsigned long long cancelled = 0, nb_records = 0, nb_ops = 0;
+        unsigned int pending = 0, to_parse = 0, pending_ns = 0;
+        unsigned int hash_slots = 0, max_chain = 0;
+
+        for (j = 0; j < reader_info[i].nb_workers; j++) {
+            cl_worker_t *worker = &reader_info[i].workers[j];
+
+            interesting += worker->interesting_records;
+            suppressed += worker->suppressed_records;
+            merged += worker->merged_records;
+            cancelled += worker->cancelled_records;
+            nb_records += worker->nb_records;
+            nb_ops += worker->nb_pushed;
+            pending += worker->op_queue_count;
+            pending_ns += worker->lane_count[LANE_NAMESPACE];
+            to_parse += worker->in_count;
+            /* no lock, just for information (the hash table may be
+             * resized meanwhile) */
+            hash_slots += worker->hash_size;
+            max_chain = MAX2(max_chain, worker->hash_max_chain);
+            worker->hash_max_chain = 0;
+        }
 
         DisplayLog(LVL_MAJOR, "STATS", "ChangeLog reader #%u:", i);
 
@@ -1354,11 +3353,39 @@ int cl_reader_dump_stats(void)
         DisplayLog(LVL_MAJOR, "STATS", "   records read        = %llu",
                    reader_info[i].nb_read);
         DisplayLog(LVL_MAJOR, "STATS", "   interesting records = %llu",
-                   reader_info[i].interesting_records);
+                   interesting);
         DisplayLog(LVL_MAJOR, "STATS", "   suppressed records  = %llu",
-                   reader_info[i].suppressed_records);
-        DisplayLog(LVL_MAJOR, "STATS", "   records pending     = %u",
-                   reader_info[i].op_queue_count);
+                   suppressed);
+        DisplayLog(LVL_MAJOR, "STATS", "   merged records      = %llu",
+                   merged);
+        DisplayLog(LVL_MAJOR, "STATS", "   cancelled records   = %llu",
+                   cancelled);
+        if (nb_ops > 0)
+            DisplayLog(LVL_MAJOR, "STATS", "   coalescing ratio    = %.2f "
+                       "records/op", (double)nb_records / (double)nb_ops);
+        DisplayLog(LVL_MAJOR, "STATS", "   records pending     = %u "
+                   "(namespace: %u, attributes: %u)", pending, pending_ns,
+                   pending - pending_ns);
+        DisplayLog(LVL_MAJOR, "STATS", "   queue hash          = %u slots, "
+                   "load factor %.2f, max chain %u", hash_slots,
+                   hash_slots ? (double)pending / hash_slots : 0.0,
+                   max_chain);
+        DisplayLog(LVL_MAJOR, "STATS", "   records to be parsed = %u "
+                   "(%u parsing threads)", to_parse,
+                   reader_info[i].nb_workers);
+        if (reader_info[i].spool != NULL) {
+            unsigned long long last_spooled, last_replayed;
+            uint64_t spool_size;
+
+            cl_spool_stats(reader_info[i].spool, &spool_size, &last_spooled,
+                           &last_replayed);
+            FormatFileSize(tmp_buff, sizeof(tmp_buff), spool_size);
+            DisplayLog(LVL_MAJOR, "STATS", "   spool size          = %s%s "
+                       "(last spooled: #%llu, last replayed: #%llu)",
+                       tmp_buff, reader_info[i].spool_full ? " (FULL)" : "",
+                       last_spooled, last_replayed);
+        }
+        dump_lag_stats(&reader_info[i]);
 
         if (reader_info[i].nb_read) {
             time_t now = time(NULL);
@@ -1465,6 +3492,63 @@ int cl_reader_dump_stats(void)
             DisplayLog(LVL_MAJOR, "STATS", "   %s", tmp_buff);
     }
 
+    if (publishing)
+        cl_pub_dump_stats();
+
+    return 0;
+}
+
+int cl_reader_follow(lmgr_t *lmgr, int mdt_index)
+{
+    /* last seen position of each MDT */
+    static unsigned long long *follow_pos = NULL;
+    static time_t follow_time = 0;
+    time_t now = time(NULL);
+    int i, rc = 0;
+
+    if (follow_pos == NULL) {
+        follow_pos = MemCalloc(cl_reader_config.mdt_count,
+                               sizeof(*follow_pos));
+        if (follow_pos == NULL)
+            return ENOMEM;
+    }
+
+    for (i = 0; i < cl_reader_config.mdt_count; i++) {
+        const char *name = cl_reader_config.mdt_def[i].mdt_name;
+        char var[256];
+        char val[1024];
+        long long pos;
+
+        if (mdt_index != -1 && mdt_index != i)
+            continue;
+
+        snprintf(var, sizeof(var), "%s_%s", CL_LAST_COMMITTED, name);
+        rc = ListMgr_GetVar(lmgr, var, val, sizeof(val));
+        if (rc == DB_NOT_EXISTS) {
+            DisplayLog(LVL_VERB, CHGLOG_TAG, "%s: no record committed yet",
+                       name);
+            continue;
+        } else if (rc) {
+            DisplayLog(LVL_MAJOR, CHGLOG_TAG, "Failed to get last committed "
+                       "record for %s: %s (%d)", name, lmgr_err2str(rc), rc);
+            return rc;
+        }
+
+        pos = str2bigint(val);
+        if (pos == -1LL)
+            continue;
+
+        if (follow_pos[i] != 0 && now > follow_time)
+            DisplayLog(LVL_EVENT, CHGLOG_TAG, "%s: active reader committed "
+                       "record #%lld (%.1f rec/sec)", name, pos,
+                       (double)(pos - (long long)follow_pos[i])
+                       / (now - follow_time));
+        else
+            DisplayLog(LVL_EVENT, CHGLOG_TAG, "%s: active reader committed "
+                       "record #%lld", name, pos);
+        follow_pos[i] = pos;
+    }
+    follow_time = now;
     return 0;
 }
 
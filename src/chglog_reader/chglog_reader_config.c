@@ -27,6 +27,7 @@
 #include "rbh_cfg.h"
 #include "rbh_cfg_helpers.h"
 #include "rbh_logs.h"
+#include "rbh_trace.h"
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
@@ -56,6 +57,20 @@ static void cl_reader_set_default_cfg(void *module_config)
     p_config->queue_max_size = 1000;
     p_config->queue_max_age = 5;    /* 5s */
     p_config->queue_check_interval = 1; /* every second */
+    p_config->queue_auto_tune = false;
+    p_config->queue_min_age = 1;    /* 1s */
+    p_config->parsing_threads = 1;
+    p_config->namespace_lane_weight = 4;
+    p_config->attrs_lane_weight = 1;
+    p_config->spool_dir[0] = '\0';
+    p_config->spool_max_size = 1024LL * 1024 * 1024;   /* 1GB */
+    p_config->state_dir[0] = '\0';
+    p_config->publish[0] = '\0';
+    p_config->subscribers[0] = '\0';
+    p_config->publish_buffer = 100000;
+    p_config->subscribe[0] = '\0';
+    p_config->trace_file[0] = '\0';
+    p_config->trace_sample_rate = 0;
     p_config->mds_has_lu543 = false;
     p_config->mds_has_lu1331 = false;
 
@@ -78,6 +93,20 @@ static void cl_reader_write_default(FILE *output)
     print_line(output, 1, "queue_max_size   : 1000");
     print_line(output, 1, "queue_max_age    : 5s");
     print_line(output, 1, "queue_check_interval : 1s");
+    print_line(output, 1, "queue_auto_tune  : no");
+    print_line(output, 1, "queue_min_age    : 1s");
+    print_line(output, 1, "parsing_threads  : 1");
+    print_line(output, 1, "namespace_lane_weight : 4");
+    print_line(output, 1, "attrs_lane_weight     : 1");
+    print_line(output, 1, "spool_dir        : \"\" (disabled)");
+    print_line(output, 1, "spool_max_size   : 1GB");
+    print_line(output, 1, "state_dir        : \"\" (disabled)");
+    print_line(output, 1, "publish          : \"\" (disabled)");
+    print_line(output, 1, "subscribers      : \"\"");
+    print_line(output, 1, "publish_buffer   : 100000");
+    print_line(output, 1, "subscribe        : \"\" (disabled)");
+    print_line(output, 1, "trace_file       : \"\" (disabled)");
+    print_line(output, 1, "trace_sample_rate : 0 (disabled)");
     print_line(output, 1, "mds_has_lu543    : no");
     print_line(output, 1, "mds_has_lu1331   : no");
 
@@ -130,6 +159,69 @@ static void cl_reader_write_template(FILE *output)
     print_line(output, 1, "queue_check_interval = 1s ;");
     fprintf(output, "\n");
 
+    print_line(output, 1, "# tune the max age of queued records between "
+               "queue_min_age and");
+    print_line(output, 1, "# queue_max_age: records are kept longer while "
+               "the pipeline is saturated");
+    print_line(output, 1, "# (more coalescing), and pushed sooner when it is "
+               "idle (lower latency)");
+    print_line(output, 1, "queue_auto_tune  = no ;");
+    print_line(output, 1, "queue_min_age    = 1s ;");
+    fprintf(output, "\n");
+
+    print_line(output, 1, "# number of threads parsing the records of each MDT");
+    print_line(output, 1, "# (in addition to the thread reading them)");
+    print_line(output, 1, "parsing_threads  = 1 ;");
+    fprintf(output, "\n");
+
+    print_line(output, 1, "# namespace changes (create, unlink, rename...) are "
+               "pushed ahead of");
+    print_line(output, 1, "# attribute updates: number of records pushed "
+               "from each lane in turn");
+    print_line(output, 1, "namespace_lane_weight = 4 ;");
+    print_line(output, 1, "attrs_lane_weight     = 1 ;");
+    fprintf(output, "\n");
+
+    print_line(output, 1, "# drain records from the MDT to local spool files, "
+               "and process them from there");
+    print_line(output, 1, "# (an alert is raised when the spool of a MDT is "
+               "full):");
+    print_line(output, 1, "#spool_dir       = \"/var/spool/robinhood\" ;");
+    print_line(output, 1, "#spool_max_size  = 1GB ;");
+    fprintf(output, "\n");
+
+    print_line(output, 1, "# save pending records to a local state file when "
+               "the daemon stops,");
+    print_line(output, 1, "# so they are not read again from the MDT at "
+               "restart:");
+    print_line(output, 1, "#state_dir       = \"/var/lib/robinhood\" ;");
+    fprintf(output, "\n");
+
+    print_line(output, 1, "# publish the records read from the MDTs to other "
+               "robinhood instances,");
+    print_line(output, 1, "# so the MDTs serve a single changelog reader. "
+               "Records are cleared");
+    print_line(output, 1, "# once committed locally and acknowledged by all "
+               "the subscribers:");
+    print_line(output, 1, "#publish         = \"/var/run/robinhood/"
+               "changelog.sock\" ;");
+    print_line(output, 1, "#subscribers     = \"hsm,purge\" ;");
+    print_line(output, 1, "#publish_buffer  = 100000 ;");
+    print_line(output, 1, "# or get records from a publisher "
+               "(reader_id identifies this instance):");
+    print_line(output, 1, "#subscribe       = \"/var/run/robinhood/"
+               "changelog.sock\" ;");
+    fprintf(output, "\n");
+
+    print_line(output, 1, "# trace 1 record out of trace_sample_rate, from "
+               "the MDT to its changelog");
+    print_line(output, 1, "# clear (Chrome trace event format, see "
+               "chrome://tracing or Perfetto):");
+    print_line(output, 1, "#trace_file      = \"/var/log/robinhood/"
+               "trace.json\" ;");
+    print_line(output, 1, "#trace_sample_rate = 1000 ;");
+    fprintf(output, "\n");
+
     print_line(output, 1,
                "# uncomment to dump all changelog records to the file");
 
@@ -215,6 +307,11 @@ static int cl_reader_read_cfg(config_file_t config, void *module_config,
     static const char *cl_cfg_allow[] = {
         "force_polling", "polling_interval", "batch_ack_count",
         "queue_max_size", "queue_max_age", "queue_check_interval",
+        "queue_auto_tune", "queue_min_age",
+        "parsing_threads", "namespace_lane_weight", "attrs_lane_weight",
+        "spool_dir", "spool_max_size", "state_dir",
+        "publish", "subscribers", "publish_buffer", "subscribe",
+        "trace_file", "trace_sample_rate",
         "mds_has_lu543", "mds_has_lu1331", MDT_DEF_BLOCK,
         NULL
     };
@@ -231,6 +328,33 @@ static int cl_reader_read_cfg(config_file_t config, void *module_config,
          &p_config->queue_max_age, 0},
         {"queue_check_interval", PT_DURATION, PFLG_NOT_NULL | PFLG_POSITIVE,
          &p_config->queue_check_interval, 0},
+        {"queue_auto_tune", PT_BOOL, 0, &p_config->queue_auto_tune, 0},
+        {"queue_min_age", PT_DURATION, PFLG_POSITIVE,
+         &p_config->queue_min_age, 0},
+        {"parsing_threads", PT_INT, PFLG_NOT_NULL | PFLG_POSITIVE,
+         &p_config->parsing_threads, 0},
+        {"namespace_lane_weight", PT_INT, PFLG_NOT_NULL | PFLG_POSITIVE,
+         &p_config->namespace_lane_weight, 0},
+        {"attrs_lane_weight", PT_INT, PFLG_NOT_NULL | PFLG_POSITIVE,
+         &p_config->attrs_lane_weight, 0},
+        {"spool_dir", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_REMOVE_FINAL_SLASH |
+         PFLG_NO_WILDCARDS, p_config->spool_dir, sizeof(p_config->spool_dir)},
+        {"spool_max_size", PT_SIZE, PFLG_NOT_NULL | PFLG_POSITIVE,
+         &p_config->spool_max_size, 0},
+        {"state_dir", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_REMOVE_FINAL_SLASH |
+         PFLG_NO_WILDCARDS, p_config->state_dir, sizeof(p_config->state_dir)},
+        {"publish", PT_STRING, PFLG_NO_WILDCARDS, p_config->publish,
+         sizeof(p_config->publish)},
+        {"subscribers", PT_STRING, PFLG_NO_WILDCARDS, p_config->subscribers,
+         sizeof(p_config->subscribers)},
+        {"publish_buffer", PT_INT, PFLG_NOT_NULL | PFLG_POSITIVE,
+         &p_config->publish_buffer, 0},
+        {"subscribe", PT_STRING, PFLG_NO_WILDCARDS, p_config->subscribe,
+         sizeof(p_config->subscribe)},
+        {"trace_file", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_NO_WILDCARDS,
+         p_config->trace_file, sizeof(p_config->trace_file)},
+        {"trace_sample_rate", PT_INT, PFLG_POSITIVE,
+         &p_config->trace_sample_rate, 0},
         {"mds_has_lu543", PT_BOOL, 0, &p_config->mds_has_lu543, 0},
         {"mds_has_lu1331", PT_BOOL, 0, &p_config->mds_has_lu1331, 0},
         END_OF_PARAMS
@@ -299,6 +423,26 @@ static int cl_reader_read_cfg(config_file_t config, void *module_config,
 
     CheckUnknownParameters(chglog_block, CHGLOG_CFG_BLOCK, cl_cfg_allow);
 
+    if (!EMPTY_STRING(p_config->publish)
+        && !EMPTY_STRING(p_config->subscribe)) {
+        strcpy(msg_out, CHGLOG_CFG_BLOCK "::publish and "
+               CHGLOG_CFG_BLOCK "::subscribe are exclusive");
+        return EINVAL;
+    }
+    if ((!EMPTY_STRING(p_config->publish)
+         || !EMPTY_STRING(p_config->subscribe))
+        && !EMPTY_STRING(p_config->spool_dir)) {
+        strcpy(msg_out, CHGLOG_CFG_BLOCK "::spool_dir cannot be used with "
+               "publish or subscribe");
+        return EINVAL;
+    }
+    if (!EMPTY_STRING(p_config->publish)
+        && EMPTY_STRING(p_config->subscribers)) {
+        strcpy(msg_out, CHGLOG_CFG_BLOCK "::subscribers must be set when "
+               "publishing records");
+        return EINVAL;
+    }
+
 #ifdef _DEBUG_CHGLOG
     printf("%u MDT definitions parsed successfully, ptr = %p\n",
            p_config->mdt_count, p_config->mdt_def);
@@ -338,7 +482,38 @@ static int cl_reader_reload_cfg(chglog_reader_config_t *cfg)
                       "%ld",);
     SCALAR_PARAM_UPDT(cfg, queue_check_interval, CHGLOG_CFG_BLOCK,
                       "queue_check_interval", "%ld",);
+    SCALAR_PARAM_UPDT(cfg, queue_auto_tune, CHGLOG_CFG_BLOCK,
+                      "queue_auto_tune", "%s", bool2str);
+    SCALAR_PARAM_UPDT(cfg, queue_min_age, CHGLOG_CFG_BLOCK, "queue_min_age",
+                      "%ld",);
+    SCALAR_PARAM_UPDT(cfg, namespace_lane_weight, CHGLOG_CFG_BLOCK,
+                      "namespace_lane_weight", "%u",);
+    SCALAR_PARAM_UPDT(cfg, attrs_lane_weight, CHGLOG_CFG_BLOCK,
+                      "attrs_lane_weight", "%u",);
+    if (cfg->trace_sample_rate != cl_reader_config.trace_sample_rate) {
+        SCALAR_PARAM_UPDT(cfg, trace_sample_rate, CHGLOG_CFG_BLOCK,
+                          "trace_sample_rate", "%u",);
+        trace_set_ratio(cl_reader_config.trace_sample_rate);
+    }
 
+    if (cfg->parsing_threads != cl_reader_config.parsing_threads)
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "parsing_threads");
+    if (strcmp(cfg->spool_dir, cl_reader_config.spool_dir))
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "spool_dir");
+    if (cfg->spool_max_size != cl_reader_config.spool_max_size)
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "spool_max_size");
+    if (strcmp(cfg->state_dir, cl_reader_config.state_dir))
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "state_dir");
+    if (strcmp(cfg->publish, cl_reader_config.publish))
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "publish");
+    if (strcmp(cfg->subscribers, cl_reader_config.subscribers))
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "subscribers");
+    if (cfg->publish_buffer != cl_reader_config.publish_buffer)
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "publish_buffer");
+    if (strcmp(cfg->subscribe, cl_reader_config.subscribe))
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "subscribe");
+    if (strcmp(cfg->trace_file, cl_reader_config.trace_file))
+        NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "trace_file");
     if (cfg->mds_has_lu543 != cl_reader_config.mds_has_lu543)
         NO_PARAM_UPDT_MSG(CHGLOG_CFG_BLOCK, "mds_has_lu543");
     if (cfg->mds_has_lu1331 != cl_reader_config.mds_has_lu1331)
@@ -0,0 +1,892 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Changelog fan-out.
+ *
+ * The publisher keeps the last 'publish_buffer' records of each MDT in a
+ * ring. Each subscriber connection is served by a thread that sends
+ * records from the ring, or reads them from the MDT with its own changelog
+ * handle while the subscriber is behind the ring (catch-up). The same
+ * thread reads the acknowledgements of the subscriber.
+ *
+ * Messages are a header followed by a payload: HELLO (subscriber ->
+ * publisher, once), REC (a raw changelog record), END (no more records,
+ * for subscribers that don't follow the changelog) and ACK
+ * (subscriber -> publisher).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cl_fanout.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "global_config.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <glib.h>
+
+#define FANOUT_TAG "ClFanout"
+
+#define FANOUT_MAGIC    0x52424846  /* "RBHF" */
+#define FANOUT_VERSION  1
+
+enum fanout_msg {
+    MSG_HELLO = 1,
+    MSG_REC,
+    MSG_END,
+    MSG_ACK,
+};
+
+struct fanout_hdr {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t len;   /* payload length */
+};
+
+struct fanout_hello {
+    uint32_t version;
+    uint32_t follow;
+    char     id[READER_ID_MAX];
+    char     mdt[MDT_NAME_MAX];
+    uint64_t start_rec;
+    uint64_t committed;
+};
+
+/* max size of a record (including its names) */
+#define FANOUT_REC_MAX  (64 * 1024)
+/* max records sent at once */
+#define FANOUT_BATCH    256
+/* acknowledgements are read every FANOUT_BATCH records during catch-up */
+#define CATCHUP_ACK_INTERVAL    (16 * FANOUT_BATCH)
+/* timeouts for sending to a subscriber and reading the hello (sec) */
+#define FANOUT_SEND_TIMEOUT     60
+#define FANOUT_HELLO_TIMEOUT    10
+
+/* ==== publisher side ==== */
+
+struct pub_mdt {
+    char          *name;
+    char          *device;
+    /* last published records (ordered by index) */
+    CL_REC_TYPE  **ring;
+    unsigned int   first;
+    unsigned int   count;
+};
+
+struct pub_sub {
+    char               id[READER_ID_MAX];
+    unsigned int       mdt;
+    /* all the records up to this one are committed by the subscriber */
+    unsigned long long acked;
+    /* next record to be sent */
+    unsigned long long next;
+    unsigned long long nb_sent;
+    unsigned long long nb_catchup;
+    unsigned int       nb_connect;
+    bool               follow;
+
+    int                fd;
+    bool               connected;
+    /* the thread has terminated but is not joined yet */
+    bool               joinable;
+    pthread_t          thr;
+};
+
+static struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;   /* new records, or stopping */
+    struct pub_mdt     *mdts;
+    unsigned int        mdt_count;
+    unsigned int        ring_size;
+    struct pub_sub     *subs;
+    unsigned int        sub_count;
+    const char         *addr;
+    int                 sock;
+    pthread_t           listen_thr;
+    bool                listening;
+    bool                stop;
+    cl_pub_clear_cb_t   clear_cb;
+} pub = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .sock = -1,
+};
+
+static int send_msg(int fd, uint32_t type, const void *payload, size_t len)
+{
+    struct fanout_hdr hdr = {.magic = FANOUT_MAGIC, .type = type,
+        .len = len };
+    int rc;
+
+    rc = rh_write_all(fd, &hdr, sizeof(hdr));
+    if (rc == 0 && len > 0)
+        rc = rh_write_all(fd, payload, len);
+    return -rc;
+}
+
+/** append a record message to a send buffer */
+static void append_rec(GString *buf, const CL_REC_TYPE *rec)
+{
+    struct fanout_hdr hdr = {.magic = FANOUT_MAGIC, .type = MSG_REC,
+        .len = rh_cl_rec_size(rec) };
+
+    g_string_append_len(buf, (const gchar *)&hdr, sizeof(hdr));
+    g_string_append_len(buf, (const gchar *)rec, hdr.len);
+}
+
+/**
+ * Read a message header and check it.
+ * @return 0 on success, a positive error code else.
+ */
+static int read_hdr(int fd, struct fanout_hdr *hdr)
+{
+    int rc;
+
+    rc = rh_read_all(fd, hdr, sizeof(*hdr));
+    if (rc)
+        return (rc == -ENODATA) ? ECONNRESET : -rc;
+    if (hdr->magic != FANOUT_MAGIC || hdr->len > FANOUT_REC_MAX)
+        return EPROTO;
+    return 0;
+}
+
+static unsigned long long ring_index(const struct pub_mdt *m, unsigned int i)
+{
+    return m->ring[(m->first + i) % pub.ring_size]->cr_index;
+}
+
+/** position of the first record >= recno in the ring (pub.lock held) */
+static unsigned int ring_search(const struct pub_mdt *m,
+                                unsigned long long recno)
+{
+    unsigned int lo = 0, hi = m->count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (ring_index(m, mid) < recno)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/** lowest acknowledged record of the subscribers of a MDT (pub.lock held) */
+static unsigned long long min_acked(unsigned int mdt_index)
+{
+    unsigned long long min = ~0ULL;
+    unsigned int i;
+
+    for (i = 0; i < pub.sub_count; i++)
+        if (pub.subs[i].mdt == mdt_index)
+            min = MIN2(min, pub.subs[i].acked);
+    return min;
+}
+
+static void pub_ack(struct pub_sub *s, unsigned long long recno)
+{
+    unsigned long long before, after;
+
+    P(pub.lock);
+    before = min_acked(s->mdt);
+    if (recno > s->acked)
+        s->acked = recno;
+    after = min_acked(s->mdt);
+    V(pub.lock);
+
+    DisplayLog(LVL_FULL, FANOUT_TAG, "%s acknowledged records of %s up to "
+               "#%llu", s->id, pub.mdts[s->mdt].name, recno);
+
+    if (after > before && pub.clear_cb != NULL)
+        pub.clear_cb(s->mdt);
+}
+
+/**
+ * Read the acknowledgements sent by a subscriber.
+ * @return 0 on success, a positive error code if the connection is lost.
+ */
+static int read_acks(struct pub_sub *s)
+{
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN };
+
+    while (poll(&pfd, 1, 0) > 0) {
+        struct fanout_hdr hdr;
+        uint64_t recno;
+        int rc;
+
+        rc = read_hdr(s->fd, &hdr);
+        if (rc)
+            return rc;
+        if (hdr.type != MSG_ACK || hdr.len != sizeof(recno))
+            return EPROTO;
+        rc = rh_read_all(s->fd, &recno, sizeof(recno));
+        if (rc)
+            return -rc;
+        pub_ack(s, recno);
+    }
+    return 0;
+}
+
+/**
+ * Send the records of the MDT changelog from s->next, up to 'limit',
+ * until the end of the changelog.
+ * @param[out] eof  the end of the changelog was reached.
+ * @return 0 on success, a positive error code if the connection is lost.
+ */
+static int pub_catch_up(struct pub_sub *s, unsigned long long limit,
+                        bool *eof)
+{
+    struct pub_mdt *m = &pub.mdts[s->mdt];
+    GString *buf = g_string_sized_new(FANOUT_BATCH * 256);
+    CL_REC_TYPE *rec;
+    void *hdlr;
+    unsigned int n = 0, batch = 0;
+    int rc;
+
+    *eof = false;
+
+    DisplayLog(LVL_DEBUG, FANOUT_TAG, "Reading records of %s from #%llu "
+               "for %s", m->device, s->next, s->id);
+
+    rc = llapi_changelog_start(&hdlr, CHANGELOG_FLAG_BLOCK, m->device,
+                               s->next);
+    if (rc) {
+        DisplayLog(LVL_CRIT, FANOUT_TAG, "ERROR %d opening changelog of %s: "
+                   "%s", rc, m->device, strerror(abs(rc)));
+        g_string_free(buf, TRUE);
+        /* not a connection error: retried later */
+        return 0;
+    }
+
+    while (!pub.stop) {
+        rc = llapi_changelog_recv(hdlr, &rec);
+        if (rc == 1) {
+            *eof = true;
+            rc = 0;
+            break;
+        } else if (rc) {
+            DisplayLog(LVL_MAJOR, FANOUT_TAG, "Error in llapi_changelog_recv()"
+                       " for %s: %d: %s", m->device, rc, strerror(abs(rc)));
+            rc = 0;
+            break;
+        }
+
+        if (rec->cr_index > limit) {
+            llapi_changelog_free(&rec);
+            break;
+        }
+
+        append_rec(buf, rec);
+        s->next = rec->cr_index + 1;
+        llapi_changelog_free(&rec);
+
+        if (++batch == FANOUT_BATCH) {
+            rc = -rh_write_all(s->fd, buf->str, buf->len);
+            if (rc)
+                break;
+            g_string_truncate(buf, 0);
+            s->nb_sent += batch;
+            s->nb_catchup += batch;
+            batch = 0;
+        }
+        if (++n % CATCHUP_ACK_INTERVAL == 0) {
+            rc = read_acks(s);
+            if (rc)
+                break;
+        }
+    }
+
+    if (rc == 0 && batch > 0) {
+        rc = -rh_write_all(s->fd, buf->str, buf->len);
+        if (rc == 0) {
+            s->nb_sent += batch;
+            s->nb_catchup += batch;
+        }
+    }
+
+    llapi_changelog_fini(&hdlr);
+    g_string_free(buf, TRUE);
+    return rc;
+}
+
+/** thread that serves a subscriber */
+static void *pub_sub_thr(void *arg)
+{
+    struct pub_sub *s = arg;
+    struct pub_mdt *m = &pub.mdts[s->mdt];
+    GString *buf = g_string_sized_new(FANOUT_BATCH * 256);
+    bool idle = false;
+    int rc = 0;
+
+    while (rc == 0) {
+        unsigned long long limit = 0;
+        unsigned int i, pos, batch = 0;
+        bool catch_up = false;
+        struct timespec deadline;
+
+        rc = read_acks(s);
+        if (rc)
+            break;
+
+        P(pub.lock);
+        if (pub.stop) {
+            V(pub.lock);
+            break;
+        }
+
+        if (m->count > 0 && s->next >= ring_index(m, 0)) {
+            pos = ring_search(m, s->next);
+            for (i = pos; i < m->count && batch < FANOUT_BATCH; i++, batch++)
+                append_rec(buf, m->ring[(m->first + i) % pub.ring_size]);
+            if (batch > 0)
+                s->next = ring_index(m, i - 1) + 1;
+        } else if (!idle) {
+            /* the subscriber is behind the ring (or nothing was published
+             * yet): get the missing records from the MDT */
+            catch_up = true;
+            limit = (m->count > 0) ? ring_index(m, 0) - 1 : ~0ULL;
+        }
+
+        if (batch == 0 && !catch_up) {
+            if (!s->follow) {
+                V(pub.lock);
+                rc = send_msg(s->fd, MSG_END, NULL, 0);
+                break;
+            }
+            /* wait for new records */
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&pub.cond, &pub.lock, &deadline);
+            idle = false;
+        }
+        V(pub.lock);
+
+        if (batch > 0) {
+            rc = -rh_write_all(s->fd, buf->str, buf->len);
+            g_string_truncate(buf, 0);
+            if (rc == 0)
+                s->nb_sent += batch;
+        } else if (catch_up) {
+            bool eof;
+
+            rc = pub_catch_up(s, limit, &eof);
+            /* nothing more in the MDT: wait for new records */
+            idle = eof;
+        }
+    }
+
+    if (rc && !pub.stop)
+        DisplayLog(LVL_EVENT, FANOUT_TAG, "Subscriber %s of %s disconnected "
+                   "(last sent #%llu): %s", s->id, m->name, s->next - 1,
+                   strerror(rc));
+
+    g_string_free(buf, TRUE);
+
+    P(pub.lock);
+    close(s->fd);
+    s->fd = -1;
+    s->connected = false;
+    s->joinable = true;
+    V(pub.lock);
+    return NULL;
+}
+
+/** handle a new connection */
+static void pub_accept(int fd)
+{
+    struct timeval timeout = {.tv_sec = FANOUT_HELLO_TIMEOUT };
+    struct fanout_hdr hdr;
+    struct fanout_hello hello;
+    struct pub_sub *s = NULL;
+    unsigned int i;
+    int rc;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    timeout.tv_sec = FANOUT_SEND_TIMEOUT;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    rc = read_hdr(fd, &hdr);
+    if (rc == 0 && (hdr.type != MSG_HELLO || hdr.len != sizeof(hello)))
+        rc = EPROTO;
+    if (rc == 0)
+        rc = -rh_read_all(fd, &hello, sizeof(hello));
+    if (rc == 0 && hello.version != FANOUT_VERSION)
+        rc = EPROTONOSUPPORT;
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FANOUT_TAG, "Invalid subscriber connection: "
+                   "%s", strerror(rc));
+        close(fd);
+        return;
+    }
+    hello.id[sizeof(hello.id) - 1] = '\0';
+    hello.mdt[sizeof(hello.mdt) - 1] = '\0';
+
+    P(pub.lock);
+    for (i = 0; i < pub.sub_count; i++) {
+        if (!strcmp(pub.subs[i].id, hello.id)
+            && !strcmp(pub.mdts[pub.subs[i].mdt].name, hello.mdt)) {
+            s = &pub.subs[i];
+            break;
+        }
+    }
+    if (s == NULL || s->connected || pub.stop) {
+        V(pub.lock);
+        DisplayLog(LVL_MAJOR, FANOUT_TAG, "Rejecting subscriber %s for %s: "
+                   "%s", hello.id, hello.mdt, s == NULL ?
+                   "not in the subscribers list" : "already connected");
+        close(fd);
+        return;
+    }
+
+    if (s->joinable) {
+        pthread_join(s->thr, NULL);
+        s->joinable = false;
+    }
+
+    if (hello.committed > s->acked)
+        s->acked = hello.committed;
+    s->next = hello.start_rec;
+    s->follow = hello.follow;
+    s->fd = fd;
+    s->connected = true;
+    s->nb_connect++;
+
+    rc = pthread_create(&s->thr, NULL, pub_sub_thr, s);
+    if (rc) {
+        s->connected = false;
+        s->fd = -1;
+        V(pub.lock);
+        DisplayLog(LVL_CRIT, FANOUT_TAG, "ERROR creating subscriber thread: "
+                   "%s", strerror(rc));
+        close(fd);
+        return;
+    }
+    V(pub.lock);
+
+    DisplayLog(LVL_EVENT, FANOUT_TAG, "Subscriber %s connected for %s "
+               "(from record #%llu, committed #%llu)", hello.id, hello.mdt,
+               (unsigned long long)hello.start_rec,
+               (unsigned long long)hello.committed);
+
+    /* records acknowledged before the connection */
+    pub_ack(s, hello.committed);
+}
+
+static void *pub_listen_thr(void *arg)
+{
+    for (;;) {
+        int fd = accept(pub.sock, NULL, NULL);
+
+        if (fd < 0) {
+            if (pub.stop)
+                break;
+            if (errno != EINTR && errno != ECONNABORTED) {
+                DisplayLog(LVL_MAJOR, FANOUT_TAG, "accept() failed: %s",
+                           strerror(errno));
+                rh_sleep(1);
+            }
+            continue;
+        }
+        pub_accept(fd);
+    }
+    return NULL;
+}
+
+int cl_pub_init(const chglog_reader_config_t *config)
+{
+    gchar **ids;
+    unsigned int i, j, nb_ids;
+    char device[128];
+
+    pub.addr = config->publish;
+    pub.ring_size = config->publish_buffer;
+    pub.mdt_count = config->mdt_count;
+    pub.mdts = MemCalloc(pub.mdt_count, sizeof(*pub.mdts));
+    if (pub.mdts == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < pub.mdt_count; i++) {
+        snprintf(device, sizeof(device), "%s-%s", get_fsname(),
+                 config->mdt_def[i].mdt_name);
+        pub.mdts[i].name = strdup(config->mdt_def[i].mdt_name);
+        pub.mdts[i].device = strdup(device);
+        pub.mdts[i].ring = MemCalloc(pub.ring_size, sizeof(CL_REC_TYPE *));
+        if (pub.mdts[i].name == NULL || pub.mdts[i].device == NULL
+            || pub.mdts[i].ring == NULL)
+            return ENOMEM;
+    }
+
+    ids = g_strsplit(config->subscribers, ",", -1);
+    for (nb_ids = 0; ids[nb_ids] != NULL; nb_ids++)
+        g_strstrip(ids[nb_ids]);
+
+    pub.subs = MemCalloc(MAX2(nb_ids * pub.mdt_count, 1),
+                         sizeof(*pub.subs));
+    if (pub.subs == NULL) {
+        g_strfreev(ids);
+        return ENOMEM;
+    }
+
+    for (j = 0; j < nb_ids; j++) {
+        if (EMPTY_STRING(ids[j]))
+            continue;
+        if (strlen(ids[j]) >= READER_ID_MAX) {
+            DisplayLog(LVL_CRIT, FANOUT_TAG, "Subscriber id '%s' is too long "
+                       "(max length=%u)", ids[j], READER_ID_MAX - 1);
+            g_strfreev(ids);
+            return EINVAL;
+        }
+        for (i = 0; i < pub.mdt_count; i++) {
+            struct pub_sub *s = &pub.subs[pub.sub_count++];
+
+            strcpy(s->id, ids[j]);
+            s->mdt = i;
+            s->fd = -1;
+        }
+    }
+    g_strfreev(ids);
+
+    DisplayLog(LVL_MAJOR, FANOUT_TAG, "Publishing changelog records to %u "
+               "subscribers (%s): records are cleared from the MDT once "
+               "acknowledged by all of them", pub.sub_count / pub.mdt_count,
+               config->subscribers);
+    return 0;
+}
+
+int cl_pub_listen(cl_pub_clear_cb_t clear_cb)
+{
+    int rc;
+
+    pub.clear_cb = clear_cb;
+
+    pub.sock = rh_listen(pub.addr);
+    if (pub.sock < 0) {
+        rc = -pub.sock;
+        DisplayLog(LVL_CRIT, FANOUT_TAG, "Failed to listen on '%s': %s",
+                   pub.addr, strerror(rc));
+        return rc;
+    }
+
+    rc = pthread_create(&pub.listen_thr, NULL, pub_listen_thr, NULL);
+    if (rc) {
+        DisplayLog(LVL_CRIT, FANOUT_TAG, "ERROR creating publisher thread: "
+                   "%s", strerror(rc));
+        close(pub.sock);
+        pub.sock = -1;
+        return rc;
+    }
+    pub.listening = true;
+
+    DisplayLog(LVL_EVENT, FANOUT_TAG, "Publishing changelog records on '%s'",
+               pub.addr);
+    return 0;
+}
+
+void cl_pub_record(unsigned int mdt_index, const CL_REC_TYPE *rec)
+{
+    struct pub_mdt *m = &pub.mdts[mdt_index];
+    CL_REC_TYPE *copy, *evicted = NULL;
+    size_t len = rh_cl_rec_size(rec);
+
+    /* allocated with malloc, as it is freed by llapi_changelog_free() */
+    copy = malloc(len);
+    if (copy == NULL) {
+        /* subscribers will get it from the MDT */
+        DisplayLog(LVL_MAJOR, FANOUT_TAG, "Cannot allocate record #%llu",
+                   rec->cr_index);
+        return;
+    }
+    memcpy(copy, rec, len);
+
+    P(pub.lock);
+    /* the changelog may have been reopened from an older record */
+    if (m->count > 0 && rec->cr_index <= ring_index(m, m->count - 1)) {
+        V(pub.lock);
+        free(copy);
+        return;
+    }
+    if (m->count == pub.ring_size) {
+        evicted = m->ring[m->first];
+        m->first = (m->first + 1) % pub.ring_size;
+        m->count--;
+    }
+    m->ring[(m->first + m->count) % pub.ring_size] = copy;
+    m->count++;
+    pthread_cond_broadcast(&pub.cond);
+    V(pub.lock);
+
+    if (evicted != NULL)
+        llapi_changelog_free(&evicted);
+}
+
+unsigned long long cl_pub_clear_limit(unsigned int mdt_index,
+                                      unsigned long long committed)
+{
+    unsigned long long acked;
+
+    P(pub.lock);
+    acked = min_acked(mdt_index);
+    V(pub.lock);
+
+    return MIN2(committed, acked);
+}
+
+void cl_pub_stop(void)
+{
+    unsigned int i, j;
+
+    if (pub.mdts == NULL)
+        return;
+
+    P(pub.lock);
+    pub.stop = true;
+    pthread_cond_broadcast(&pub.cond);
+    for (i = 0; i < pub.sub_count; i++)
+        if (pub.subs[i].connected)
+            shutdown(pub.subs[i].fd, SHUT_RDWR);
+    V(pub.lock);
+
+    if (pub.listening) {
+        /* wake up accept() */
+        shutdown(pub.sock, SHUT_RDWR);
+        pthread_join(pub.listen_thr, NULL);
+        close(pub.sock);
+        if (pub.addr[0] == '/')
+            unlink(pub.addr);
+        pub.listening = false;
+    }
+
+    /* no more connections: join subscriber threads */
+    for (i = 0; i < pub.sub_count; i++) {
+        struct pub_sub *s = &pub.subs[i];
+        bool join;
+
+        P(pub.lock);
+        join = s->connected || s->joinable;
+        V(pub.lock);
+        if (join)
+            pthread_join(s->thr, NULL);
+        s->joinable = false;
+    }
+
+    for (i = 0; i < pub.mdt_count; i++) {
+        struct pub_mdt *m = &pub.mdts[i];
+
+        for (j = 0; j < m->count; j++)
+            llapi_changelog_free(&m->ring[(m->first + j) % pub.ring_size]);
+        MemFree(m->ring);
+        free(m->name);
+        free(m->device);
+    }
+    MemFree(pub.mdts);
+    pub.mdts = NULL;
+    MemFree(pub.subs);
+    pub.subs = NULL;
+    pub.sub_count = 0;
+}
+
+void cl_pub_dump_stats(void)
+{
+    unsigned int i;
+
+    if (pub.mdts == NULL)
+        return;
+
+    DisplayLog(LVL_MAJOR, "STATS", "ChangeLog subscribers:");
+
+    P(pub.lock);
+    for (i = 0; i < pub.sub_count; i++) {
+        const struct pub_sub *s = &pub.subs[i];
+
+        DisplayLog(LVL_MAJOR, "STATS", "   %s for %s: %s, acknowledged=#%llu,"
+                   " next=#%llu, records sent=%llu (%llu read again from the "
+                   "MDT), connections=%u", s->id, pub.mdts[s->mdt].name,
+                   s->connected ? "connected" : "disconnected", s->acked,
+                   s->next, s->nb_sent, s->nb_catchup, s->nb_connect);
+    }
+    V(pub.lock);
+}
+
+/* ==== subscriber side ==== */
+
+struct cl_sub {
+    char               *addr;
+    struct fanout_hello hello;
+    /* next record to be received */
+    unsigned long long  next;
+
+    /* protects fd and acked against concurrent acknowledgements */
+    pthread_mutex_t     lock;
+    int                 fd;
+    unsigned long long  acked;
+};
+
+/* wait for records up to this time before returning EAGAIN (ms) */
+#define SUB_RECV_TIMEOUT    1000
+
+/** connect and say hello (sub->lock held) */
+static int sub_connect(cl_sub_t *sub)
+{
+    struct timeval timeout = {.tv_sec = FANOUT_SEND_TIMEOUT };
+    int fd, rc, one = 1;
+
+    fd = rh_connect(sub->addr);
+    if (fd < 0) {
+        DisplayLog(LVL_MAJOR, FANOUT_TAG, "Cannot connect to publisher '%s': "
+                   "%s", sub->addr, strerror(-fd));
+        return -fd;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+    sub->hello.start_rec = sub->next;
+    sub->hello.committed = sub->acked;
+    rc = send_msg(fd, MSG_HELLO, &sub->hello, sizeof(sub->hello));
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FANOUT_TAG, "Cannot send hello to publisher "
+                   "'%s': %s", sub->addr, strerror(rc));
+        close(fd);
+        return rc;
+    }
+
+    sub->fd = fd;
+    DisplayLog(LVL_EVENT, FANOUT_TAG, "Connected to publisher '%s' as %s "
+               "for %s (from record #%llu)", sub->addr, sub->hello.id,
+               sub->hello.mdt, sub->next);
+    return 0;
+}
+
+int cl_sub_open(const char *addr, const char *id, const char *mdt_name,
+                unsigned long long start_rec, unsigned long long committed,
+                bool follow, cl_sub_t **p_sub)
+{
+    cl_sub_t *sub;
+
+    sub = MemCalloc(1, sizeof(*sub));
+    if (sub == NULL)
+        return ENOMEM;
+
+    sub->addr = strdup(addr);
+    if (sub->addr == NULL) {
+        MemFree(sub);
+        return ENOMEM;
+    }
+    sub->hello.version = FANOUT_VERSION;
+    sub->hello.follow = follow;
+    rh_strncpy(sub->hello.id, id, sizeof(sub->hello.id));
+    rh_strncpy(sub->hello.mdt, mdt_name, sizeof(sub->hello.mdt));
+    sub->next = start_rec;
+    sub->acked = committed;
+    sub->fd = -1;
+    pthread_mutex_init(&sub->lock, NULL);
+
+    /* the publisher may not be started yet: the reader reconnects */
+    P(sub->lock);
+    sub_connect(sub);
+    V(sub->lock);
+
+    *p_sub = sub;
+    return 0;
+}
+
+int cl_sub_recv(cl_sub_t *sub, CL_REC_TYPE **pp_rec)
+{
+    struct pollfd pfd = {.fd = sub->fd, .events = POLLIN };
+    struct fanout_hdr hdr;
+    CL_REC_TYPE *rec;
+    int rc;
+
+    if (sub->fd < 0)
+        return ENOTCONN;
+
+    rc = poll(&pfd, 1, SUB_RECV_TIMEOUT);
+    if (rc == 0)
+        return EAGAIN;
+    else if (rc < 0)
+        return (errno == EINTR) ? EAGAIN : errno;
+
+    rc = read_hdr(sub->fd, &hdr);
+    if (rc)
+        return rc;
+
+    if (hdr.type == MSG_END)
+        return ENODATA;
+    if (hdr.type != MSG_REC || hdr.len < sizeof(CL_REC_TYPE))
+        return EPROTO;
+
+    /* allocated with malloc, as it is freed by llapi_changelog_free() */
+    rec = malloc(hdr.len);
+    if (rec == NULL)
+        return ENOMEM;
+
+    rc = rh_read_all(sub->fd, rec, hdr.len);
+    if (rc) {
+        free(rec);
+        return -rc;
+    }
+
+    sub->next = rec->cr_index + 1;
+    *pp_rec = rec;
+    return 0;
+}
+
+int cl_sub_reconnect(cl_sub_t *sub)
+{
+    int rc;
+
+    P(sub->lock);
+    if (sub->fd >= 0) {
+        close(sub->fd);
+        sub->fd = -1;
+    }
+    rc = sub_connect(sub);
+    V(sub->lock);
+    return rc;
+}
+
+int cl_sub_ack(cl_sub_t *sub, unsigned long long recno)
+{
+    uint64_t val = recno;
+    int rc;
+
+    P(sub->lock);
+    /* sent with the hello when reconnecting */
+    sub->acked = recno;
+    if (sub->fd < 0)
+        rc = ENOTCONN;
+    else
+        rc = send_msg(sub->fd, MSG_ACK, &val, sizeof(val));
+    V(sub->lock);
+    return rc;
+}
+
+void cl_sub_close(cl_sub_t *sub)
+{
+    if (sub->fd >= 0)
+        close(sub->fd);
+    pthread_mutex_destroy(&sub->lock);
+    free(sub->addr);
+    MemFree(sub);
+}
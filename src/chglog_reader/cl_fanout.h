@@ -0,0 +1,105 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Changelog fan-out: a single robinhood instance reads the MDT changelogs
+ * and publishes their records to other robinhood instances (subscribers)
+ * over a socket, so each MDT only serves one changelog reader.
+ *
+ * Each subscriber acknowledges the records it has committed. MDT
+ * changelogs are only cleared up to the records that are committed by the
+ * publisher and acknowledged by all the configured subscribers, so a
+ * subscriber that is stopped or lagging gets the records it missed when it
+ * reconnects: recent records from the publisher's memory, older ones read
+ * again from the MDT.
+ *
+ * Records are sent in their raw format: the publisher and its
+ * subscribers must run on the same architecture and Lustre version.
+ */
+
+#ifndef _CL_FANOUT_H
+#define _CL_FANOUT_H
+
+#include "chglog_reader.h"
+#include "lustre_extended_types.h"
+
+/* ==== publisher side ==== */
+
+/** called when the records of a MDT have been acknowledged by all the
+ * subscribers, so more records may be cleared */
+typedef void (*cl_pub_clear_cb_t)(unsigned int mdt_index);
+
+/**
+ * Initialize the publisher for the MDTs and subscribers of the given
+ * config (publish, subscribers, publish_buffer). Records can be published
+ * as soon as it returns.
+ */
+int cl_pub_init(const chglog_reader_config_t *config);
+
+/** Start accepting subscribers. */
+int cl_pub_listen(cl_pub_clear_cb_t clear_cb);
+
+/** Publish a record read from the MDT of the given index (copied). */
+void cl_pub_record(unsigned int mdt_index, const CL_REC_TYPE *rec);
+
+/**
+ * @return the last record of a MDT that can be cleared from its changelog,
+ *         given the last record committed by the publisher.
+ */
+unsigned long long cl_pub_clear_limit(unsigned int mdt_index,
+                                      unsigned long long committed);
+
+/** Disconnect the subscribers and stop publishing. */
+void cl_pub_stop(void);
+
+/** Dump subscriber stats to the log. */
+void cl_pub_dump_stats(void);
+
+/* ==== subscriber side ==== */
+
+typedef struct cl_sub cl_sub_t;
+
+/**
+ * Connect to a publisher, to receive the records of a MDT.
+ * @param id         the id of this subscriber (as in the publisher's
+ *                   subscribers list).
+ * @param start_rec  first record to be received.
+ * @param committed  records up to this one are already committed.
+ * @param follow     keep receiving new records (else the connection ends
+ *                   when all the current records have been received).
+ * If the publisher cannot be reached, the subscriber is still returned:
+ * cl_sub_recv() then fails with ENOTCONN until cl_sub_reconnect() succeeds.
+ */
+int cl_sub_open(const char *addr, const char *id, const char *mdt_name,
+                unsigned long long start_rec, unsigned long long committed,
+                bool follow, cl_sub_t **p_sub);
+
+/**
+ * Get the next record from the publisher. The record must be released by
+ * llapi_changelog_free().
+ * @return 0 on success, EAGAIN if no record was received for a while,
+ *         ENODATA when all records have been received (no follow),
+ *         another error code if the connection is lost.
+ */
+int cl_sub_recv(cl_sub_t *sub, CL_REC_TYPE **pp_rec);
+
+/** Reconnect to the publisher, from the record after the last received. */
+int cl_sub_reconnect(cl_sub_t *sub);
+
+/** Acknowledge the records up to recno (may be called by any thread). */
+int cl_sub_ack(cl_sub_t *sub, unsigned long long recno);
+
+/** Disconnect from the publisher. */
+void cl_sub_close(cl_sub_t *sub);
+
+#endif
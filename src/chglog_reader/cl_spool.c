@@ -0,0 +1,699 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Local spool of changelog records.
+ *
+ * The spool is split into segment files "<dir>/<name>.<seq>", that hold
+ * records in their raw format, each preceded by a small header.
+ * Records are only appended to the last segment. A segment is removed
+ * when all its records are committed to the database.
+ * After a crash, records of the remaining segments are replayed,
+ * except the ones that were already committed (at least once semantics,
+ * like records left in the MDT changelog).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cl_spool.h"
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <glib.h>
+
+#define SPOOL_TAG "ClSpool"
+
+/* header of each record */
+#define SPOOL_REC_MAGIC 0x52424843  /* "RBHC" */
+struct spool_rec_hdr {
+    uint32_t magic;
+    uint32_t len;   /* record length */
+};
+
+/* max size of a record (including its names) */
+#define SPOOL_REC_MAX   (64 * 1024)
+/* the spool is split in this number of segments */
+#define SPOOL_SEGMENTS  16
+
+struct spool_segment {
+    unsigned int seq;
+    unsigned long long first;   /* first record (0 if empty) */
+    unsigned long long last;    /* last record */
+    uint64_t size;
+};
+
+struct cl_spool {
+    char *dir;
+    char *name;
+    uint64_t max_size;
+    uint64_t seg_size;
+    /* records up to this one were committed before opening the spool */
+    unsigned long long skip_upto;
+
+    pthread_mutex_t lock;
+    pthread_cond_t data_cond;   /* new records, or replay stopped */
+    pthread_cond_t space_cond;  /* segments released */
+
+    /** The following fields are protected by lock */
+    /* segments (struct spool_segment), from the oldest one */
+    GQueue segments;
+    uint64_t total_size;
+    unsigned long long committed;
+    unsigned long long last_appended;
+    unsigned long long last_replayed;
+    bool writer_closed;
+    bool stopped;
+
+    /** writer side */
+    int wr_fd;  /* last segment (-1 if not open) */
+    unsigned int next_seq;
+    unsigned long long last_synced;
+    bool dir_dirty; /* a segment was created since the last sync */
+
+    /** replay side */
+    GList *rd_seg;  /* segment being replayed (its records
+                     * up to rd_off have been replayed) */
+    int rd_fd;
+    uint64_t rd_off;
+};
+
+static void seg_path(const cl_spool_t *spool, unsigned int seq, char *path,
+                     size_t size)
+{
+    snprintf(path, size, "%s/%s.%08u", spool->dir, spool->name, seq);
+}
+
+/** Load an existing segment, and remove the incomplete record that may
+ * have been written at its end by a crash.
+ * @return NULL if the segment has no record. */
+static struct spool_segment *load_segment(cl_spool_t *spool, unsigned int seq)
+{
+    char path[RBH_PATH_MAX];
+    struct spool_segment *seg;
+    struct spool_rec_hdr hdr;
+    CL_REC_TYPE *rec;
+    uint64_t off = 0;
+    struct stat st;
+    int fd;
+
+    seg_path(spool, seq, path, sizeof(path));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to open spool file %s: %s",
+                   path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    seg = MemAlloc(sizeof(*seg));
+    rec = MemAlloc(SPOOL_REC_MAX);
+    if (seg == NULL || rec == NULL) {
+        close(fd);
+        if (seg)
+            MemFree(seg);
+        if (rec)
+            MemFree(rec);
+        return NULL;
+    }
+    memset(seg, 0, sizeof(*seg));
+    seg->seq = seq;
+
+    while (off < st.st_size) {
+        if (pread(fd, &hdr, sizeof(hdr), off) != sizeof(hdr)
+            || hdr.magic != SPOOL_REC_MAGIC || hdr.len > SPOOL_REC_MAX
+            || hdr.len < sizeof(CL_REC_TYPE)
+            || pread(fd, rec, hdr.len, off + sizeof(hdr)) != hdr.len)
+            break;
+
+        if (seg->first == 0)
+            seg->first = rec->cr_index;
+        seg->last = rec->cr_index;
+        off += sizeof(hdr) + hdr.len;
+    }
+    close(fd);
+    MemFree(rec);
+    seg->size = off;
+
+    if (off < st.st_size) {
+        DisplayLog(LVL_MAJOR, SPOOL_TAG, "Incomplete record at offset %"
+                   PRIu64 " of spool file %s: truncating it", off, path);
+        if (truncate(path, off) != 0)
+            DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to truncate %s: %s",
+                       path, strerror(errno));
+    }
+
+    if (seg->first == 0) {
+        unlink(path);
+        MemFree(seg);
+        return NULL;
+    }
+    return seg;
+}
+
+static gint cmp_seq(gconstpointer a, gconstpointer b)
+{
+    unsigned int s1 = *(const unsigned int *)a;
+    unsigned int s2 = *(const unsigned int *)b;
+
+    return (s1 < s2) ? -1 : (s1 > s2);
+}
+
+/** list the segments of the spool, and load them */
+static int load_segments(cl_spool_t *spool)
+{
+    size_t len = strlen(spool->name);
+    struct dirent *ent;
+    GArray *seqs;
+    unsigned int i;
+    DIR *dir;
+
+    dir = opendir(spool->dir);
+    if (dir == NULL) {
+        int rc = errno;
+
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Cannot open spool directory %s: %s",
+                   spool->dir, strerror(rc));
+        return rc;
+    }
+
+    seqs = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+    while ((ent = readdir(dir)) != NULL) {
+        unsigned int seq;
+        char *end;
+
+        if (strncmp(ent->d_name, spool->name, len) != 0
+            || ent->d_name[len] != '.' || ent->d_name[len + 1] == '\0')
+            continue;
+
+        seq = strtoul(ent->d_name + len + 1, &end, 10);
+        if (*end != '\0')
+            continue;
+        g_array_append_val(seqs, seq);
+    }
+    closedir(dir);
+
+    g_array_sort(seqs, cmp_seq);
+
+    for (i = 0; i < seqs->len; i++) {
+        unsigned int seq = g_array_index(seqs, unsigned int, i);
+        struct spool_segment *seg;
+
+        spool->next_seq = seq + 1;
+
+        seg = load_segment(spool, seq);
+        if (seg == NULL)
+            continue;
+
+        if (seg->last <= spool->skip_upto) {
+            char path[RBH_PATH_MAX];
+
+            /* all its records are already committed */
+            seg_path(spool, seq, path, sizeof(path));
+            unlink(path);
+            MemFree(seg);
+            continue;
+        }
+
+        g_queue_push_tail(&spool->segments, seg);
+        spool->total_size += seg->size;
+        spool->last_appended = seg->last;
+    }
+    g_array_free(seqs, TRUE);
+
+    return 0;
+}
+
+int cl_spool_open(const char *dir, const char *name, uint64_t max_size,
+                  unsigned long long committed, cl_spool_t **p_spool)
+{
+    cl_spool_t *spool;
+    int rc;
+
+    if (mkdir(dir, 0750) != 0 && errno != EEXIST) {
+        rc = errno;
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Cannot create spool directory %s: %s",
+                   dir, strerror(rc));
+        return rc;
+    }
+
+    spool = MemAlloc(sizeof(*spool));
+    if (spool == NULL)
+        return ENOMEM;
+    memset(spool, 0, sizeof(*spool));
+
+    spool->dir = strdup(dir);
+    spool->name = strdup(name);
+    spool->max_size = max_size;
+    spool->seg_size = max_size / SPOOL_SEGMENTS;
+    spool->skip_upto = committed;
+    spool->committed = committed;
+    spool->wr_fd = -1;
+    spool->rd_fd = -1;
+    pthread_mutex_init(&spool->lock, NULL);
+    pthread_cond_init(&spool->data_cond, NULL);
+    pthread_cond_init(&spool->space_cond, NULL);
+    g_queue_init(&spool->segments);
+
+    rc = load_segments(spool);
+    if (rc) {
+        cl_spool_close(spool);
+        return rc;
+    }
+    spool->last_synced = spool->last_appended;
+    spool->rd_seg = g_queue_peek_head_link(&spool->segments);
+
+    if (spool->total_size > 0)
+        DisplayLog(LVL_EVENT, SPOOL_TAG, "%u spool files loaded for %s "
+                   "(%" PRIu64 " bytes, last record #%llu)",
+                   g_queue_get_length(&spool->segments), name,
+                   spool->total_size, spool->last_appended);
+
+    *p_spool = spool;
+    return 0;
+}
+
+unsigned long long cl_spool_last(cl_spool_t *spool)
+{
+    unsigned long long last;
+
+    P(spool->lock);
+    last = spool->last_appended;
+    V(spool->lock);
+    return last;
+}
+
+unsigned long long cl_spool_sync(cl_spool_t *spool)
+{
+    if (spool->last_synced == spool->last_appended)
+        return spool->last_synced;
+
+    if (fdatasync(spool->wr_fd) != 0) {
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to sync spool file: %s",
+                   strerror(errno));
+        return spool->last_synced;
+    }
+
+    if (spool->dir_dirty) {
+        /* make the new segments persistent */
+        int fd = open(spool->dir, O_RDONLY | O_DIRECTORY);
+
+        if (fd < 0 || fsync(fd) != 0) {
+            DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to sync spool directory "
+                       "%s: %s", spool->dir, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return spool->last_synced;
+        }
+        close(fd);
+        spool->dir_dirty = false;
+    }
+
+    /* last_appended is only modified by the writer (the caller) */
+    spool->last_synced = spool->last_appended;
+    return spool->last_synced;
+}
+
+/** create a new segment to append records (called by the writer) */
+static int new_segment(cl_spool_t *spool)
+{
+    char path[RBH_PATH_MAX];
+    struct spool_segment *seg;
+    int fd, rc;
+
+    /* the records of the previous segments must be safe */
+    if (spool->wr_fd != -1) {
+        cl_spool_sync(spool);
+        if (spool->last_synced != spool->last_appended)
+            return EIO;
+    }
+
+    seg = MemAlloc(sizeof(*seg));
+    if (seg == NULL)
+        return ENOMEM;
+    memset(seg, 0, sizeof(*seg));
+    seg->seq = spool->next_seq++;
+
+    seg_path(spool, seg->seq, path, sizeof(path));
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0640);
+    if (fd < 0) {
+        rc = errno;
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to create spool file %s: %s",
+                   path, strerror(rc));
+        MemFree(seg);
+        return rc;
+    }
+
+    if (spool->wr_fd != -1)
+        close(spool->wr_fd);
+    spool->wr_fd = fd;
+    spool->dir_dirty = true;
+
+    P(spool->lock);
+    g_queue_push_tail(&spool->segments, seg);
+    if (spool->rd_seg == NULL)
+        spool->rd_seg = g_queue_peek_tail_link(&spool->segments);
+    V(spool->lock);
+
+    DisplayLog(LVL_DEBUG, SPOOL_TAG, "New spool file %s", path);
+    return 0;
+}
+
+int cl_recfile_write(int fd, const CL_REC_TYPE *rec)
+{
+    struct spool_rec_hdr hdr;
+    struct iovec iov[2];
+    ssize_t rc;
+
+    hdr.magic = SPOOL_REC_MAGIC;
+    hdr.len = rh_cl_rec_size(rec);
+    if (hdr.len > SPOOL_REC_MAX)
+        return EINVAL;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *)rec;
+    iov[1].iov_len = hdr.len;
+
+    rc = writev(fd, iov, 2);
+    if (rc < 0)
+        return errno;
+    if (rc != sizeof(hdr) + hdr.len)
+        return EIO;
+    return 0;
+}
+
+int cl_recfile_read(int fd, CL_REC_TYPE **pp_rec)
+{
+    struct spool_rec_hdr hdr;
+    CL_REC_TYPE *rec;
+    ssize_t rc;
+
+    rc = read(fd, &hdr, sizeof(hdr));
+    if (rc == 0)
+        return ENODATA;
+    if (rc < 0)
+        return errno;
+    if (rc != sizeof(hdr) || hdr.magic != SPOOL_REC_MAGIC
+        || hdr.len > SPOOL_REC_MAX || hdr.len < sizeof(CL_REC_TYPE))
+        return EINVAL;
+
+    /* allocated with malloc, as it is freed by llapi_changelog_free() */
+    rec = malloc(hdr.len);
+    if (rec == NULL)
+        return ENOMEM;
+
+    rc = read(fd, rec, hdr.len);
+    if (rc != hdr.len) {
+        free(rec);
+        return (rc < 0) ? errno : EINVAL;
+    }
+
+    *pp_rec = rec;
+    return 0;
+}
+
+int cl_spool_append(cl_spool_t *spool, const CL_REC_TYPE *rec)
+{
+    struct spool_segment *tail;
+    size_t len;
+    bool full;
+    int rc;
+
+    len = sizeof(struct spool_rec_hdr) + rh_cl_rec_size(rec);
+
+    if (len > sizeof(struct spool_rec_hdr) + SPOOL_REC_MAX) {
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Record #%llu is too large to be "
+                   "spooled (%zu bytes)", rec->cr_index, len);
+        return EINVAL;
+    }
+
+    P(spool->lock);
+    full = (spool->total_size + len > spool->max_size);
+    tail = g_queue_peek_tail(&spool->segments);
+    V(spool->lock);
+
+    if (full)
+        return ENOSPC;
+
+    /* segments loaded from a previous run are not appended */
+    if (spool->wr_fd == -1 || tail->size + len > spool->seg_size) {
+        rc = new_segment(spool);
+        if (rc)
+            return rc;
+        tail = g_queue_peek_tail(&spool->segments);
+    }
+
+    rc = cl_recfile_write(spool->wr_fd, rec);
+    if (rc) {
+        DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to write record #%llu to "
+                   "spool: %s", rec->cr_index, strerror(rc));
+        /* remove the partial record */
+        if (ftruncate(spool->wr_fd, tail->size) != 0)
+            DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to truncate spool file: "
+                       "%s", strerror(errno));
+        return rc;
+    }
+
+    P(spool->lock);
+    if (tail->first == 0)
+        tail->first = rec->cr_index;
+    tail->last = rec->cr_index;
+    tail->size += len;
+    spool->total_size += len;
+    spool->last_appended = rec->cr_index;
+    pthread_cond_signal(&spool->data_cond);
+    V(spool->lock);
+
+    return 0;
+}
+
+void cl_spool_wait_space(cl_spool_t *spool, unsigned int timeout)
+{
+    struct timespec deadline = {.tv_sec = time(NULL) + timeout,.tv_nsec = 0 };
+
+    P(spool->lock);
+    pthread_cond_timedwait(&spool->space_cond, &spool->lock, &deadline);
+    V(spool->lock);
+}
+
+/** Remove segments whose records are all committed (lock must be held).
+ * The segment being replayed and the one being written are kept. */
+static void purge_segments(cl_spool_t *spool)
+{
+    bool released = false;
+    GList *link;
+
+    while ((link = g_queue_peek_head_link(&spool->segments)) != NULL
+           && link != spool->rd_seg && link->next != NULL) {
+        struct spool_segment *seg = link->data;
+        char path[RBH_PATH_MAX];
+
+        if (seg->last > spool->committed)
+            break;
+
+        seg_path(spool, seg->seq, path, sizeof(path));
+        if (unlink(path) != 0)
+            DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to remove spool file %s: "
+                       "%s", path, strerror(errno));
+        else
+            DisplayLog(LVL_DEBUG, SPOOL_TAG, "Spool file %s released "
+                       "(records #%llu to #%llu)", path, seg->first,
+                       seg->last);
+
+        spool->total_size -= seg->size;
+        g_queue_pop_head(&spool->segments);
+        MemFree(seg);
+        released = true;
+    }
+
+    if (released)
+        pthread_cond_broadcast(&spool->space_cond);
+}
+
+void cl_spool_release(cl_spool_t *spool, unsigned long long committed)
+{
+    P(spool->lock);
+    if (committed > spool->committed) {
+        spool->committed = committed;
+        purge_segments(spool);
+    }
+    V(spool->lock);
+}
+
+/** Wait for a record to replay (lock must be held).
+ * @return the segment to read it from, or NULL if there is none. */
+static struct spool_segment *wait_record(cl_spool_t *spool, int *err)
+{
+    for (;;) {
+        if (spool->stopped) {
+            *err = ESHUTDOWN;
+            return NULL;
+        }
+
+        if (spool->rd_seg != NULL) {
+            struct spool_segment *seg = spool->rd_seg->data;
+
+            if (spool->rd_off < seg->size)
+                return seg;
+
+            if (spool->rd_seg->next != NULL) {
+                /* the segment is complete: go to the next one */
+                spool->rd_seg = spool->rd_seg->next;
+                spool->rd_off = 0;
+                if (spool->rd_fd != -1)
+                    close(spool->rd_fd);
+                spool->rd_fd = -1;
+                purge_segments(spool);
+                continue;
+            }
+        }
+
+        if (spool->writer_closed) {
+            *err = ENODATA;
+            return NULL;
+        }
+        pthread_cond_wait(&spool->data_cond, &spool->lock);
+    }
+}
+
+int cl_spool_next(cl_spool_t *spool, CL_REC_TYPE **pp_rec)
+{
+    for (;;) {
+        struct spool_segment *seg;
+        struct spool_rec_hdr hdr;
+        CL_REC_TYPE *rec;
+        uint64_t seg_size;
+        int rc = 0;
+
+        P(spool->lock);
+        seg = wait_record(spool, &rc);
+        seg_size = seg ? seg->size : 0;
+        V(spool->lock);
+
+        if (seg == NULL)
+            return rc;
+
+        /* the segment can't be released while it is being replayed */
+        if (spool->rd_fd == -1) {
+            char path[RBH_PATH_MAX];
+
+            seg_path(spool, seg->seq, path, sizeof(path));
+            spool->rd_fd = open(path, O_RDONLY);
+            if (spool->rd_fd < 0) {
+                DisplayLog(LVL_CRIT, SPOOL_TAG, "Failed to open spool file "
+                           "%s: %s", path, strerror(errno));
+                rh_sleep(1);
+                continue;
+            }
+        }
+
+        rec = NULL;
+        if (pread(spool->rd_fd, &hdr, sizeof(hdr), spool->rd_off)
+            == sizeof(hdr) && hdr.magic == SPOOL_REC_MAGIC
+            && hdr.len <= SPOOL_REC_MAX && hdr.len >= sizeof(CL_REC_TYPE)) {
+            /* allocated with malloc, as it is freed by
+             * llapi_changelog_free() */
+            rec = malloc(hdr.len);
+            if (rec != NULL && pread(spool->rd_fd, rec, hdr.len,
+                                     spool->rd_off + sizeof(hdr)) != hdr.len) {
+                free(rec);
+                rec = NULL;
+            }
+        }
+
+        if (rec == NULL) {
+            DisplayLog(LVL_CRIT, SPOOL_TAG, "Invalid record at offset %"
+                       PRIu64 " of spool file #%u: skipping the end of file",
+                       spool->rd_off, seg->seq);
+            spool->rd_off = seg_size;
+            continue;
+        }
+        spool->rd_off += sizeof(hdr) + hdr.len;
+
+        /* already committed before a restart */
+        if (rec->cr_index <= spool->skip_upto) {
+            free(rec);
+            continue;
+        }
+
+        P(spool->lock);
+        spool->last_replayed = rec->cr_index;
+        V(spool->lock);
+
+        *pp_rec = rec;
+        return 0;
+    }
+}
+
+void cl_spool_close_writer(cl_spool_t *spool)
+{
+    P(spool->lock);
+    spool->writer_closed = true;
+    pthread_cond_broadcast(&spool->data_cond);
+    V(spool->lock);
+}
+
+void cl_spool_stop(cl_spool_t *spool)
+{
+    P(spool->lock);
+    spool->stopped = true;
+    pthread_cond_broadcast(&spool->data_cond);
+    V(spool->lock);
+}
+
+void cl_spool_close(cl_spool_t *spool)
+{
+    struct spool_segment *seg;
+
+    if (spool->wr_fd != -1)
+        close(spool->wr_fd);
+    if (spool->rd_fd != -1)
+        close(spool->rd_fd);
+
+    /* segments are kept for the next run */
+    while ((seg = g_queue_pop_head(&spool->segments)) != NULL)
+        MemFree(seg);
+
+    pthread_cond_destroy(&spool->space_cond);
+    pthread_cond_destroy(&spool->data_cond);
+    pthread_mutex_destroy(&spool->lock);
+    free(spool->name);
+    free(spool->dir);
+    MemFree(spool);
+}
+
+void cl_spool_stats(cl_spool_t *spool, uint64_t *size,
+                    unsigned long long *last_spooled,
+                    unsigned long long *last_replayed)
+{
+    P(spool->lock);
+    *size = spool->total_size;
+    *last_spooled = spool->last_appended;
+    *last_replayed = spool->last_replayed;
+    V(spool->lock);
+}
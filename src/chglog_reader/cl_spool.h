@@ -0,0 +1,98 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Local spool of changelog records: records are drained from the MDT
+ * to append-only segment files, and replayed from them into the pipeline.
+ */
+
+#ifndef _CL_SPOOL_H
+#define _CL_SPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lustre_extended_types.h"
+
+/* spool of a MDT changelog (opaque) */
+typedef struct cl_spool cl_spool_t;
+
+/**
+ * Open the spool of a changelog reader (spool files are named
+ * "<dir>/<name>.<seq>"). Existing records are loaded, so they are replayed
+ * before records read from the MDT.
+ * @param committed  records up to this one are already committed
+ *                   (they are not replayed).
+ */
+int cl_spool_open(const char *dir, const char *name, uint64_t max_size,
+                  unsigned long long committed, cl_spool_t **p_spool);
+
+/** last record in the spool (0 if none) */
+unsigned long long cl_spool_last(cl_spool_t *spool);
+
+/**
+ * Append a record to the spool (called by a single writer thread).
+ * @return ENOSPC if the spool is full.
+ */
+int cl_spool_append(cl_spool_t *spool, const CL_REC_TYPE *rec);
+
+/**
+ * Flush appended records to disk.
+ * @return the last record that is safely stored in the spool (0 if none).
+ */
+unsigned long long cl_spool_sync(cl_spool_t *spool);
+
+/** wait up to 'timeout' seconds for free space in the spool */
+void cl_spool_wait_space(cl_spool_t *spool, unsigned int timeout);
+
+/**
+ * Get the next record to be replayed (wait for it if needed).
+ * The record must be released by llapi_changelog_free().
+ * @return 0 on success, ENODATA when the writer is closed and all records
+ *         have been replayed, ESHUTDOWN if the replay is stopped.
+ */
+int cl_spool_next(cl_spool_t *spool, CL_REC_TYPE **pp_rec);
+
+/** Release spool segments whose records are all committed. */
+void cl_spool_release(cl_spool_t *spool, unsigned long long committed);
+
+/** No more records will be appended. */
+void cl_spool_close_writer(cl_spool_t *spool);
+
+/** Interrupt the replay (remaining records are kept for the next run). */
+void cl_spool_stop(cl_spool_t *spool);
+
+/** Close the spool and free its resources. */
+void cl_spool_close(cl_spool_t *spool);
+
+/** Get the current spool size, and the last records spooled and replayed. */
+void cl_spool_stats(cl_spool_t *spool, uint64_t *size,
+                    unsigned long long *last_spooled,
+                    unsigned long long *last_replayed);
+
+/**
+ * Raw record files (changelog captures). Records are stored in the same
+ * format as in the spool.
+ */
+/** Write a record at the current offset of fd. */
+int cl_recfile_write(int fd, const CL_REC_TYPE *rec);
+
+/**
+ * Read the next record from fd. The record must be released by
+ * llapi_changelog_free().
+ * @return 0 on success, ENODATA at the end of file, EINVAL if the record
+ *         is invalid or truncated.
+ */
+int cl_recfile_read(int fd, CL_REC_TYPE **pp_rec);
+
+#endif
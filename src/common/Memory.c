@@ -0,0 +1,191 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Memory accounting per subsystem (tagged allocations).
+ *
+ * Each thread updates its own counters, without atomic operation.
+ * A block can be released by another thread than the one that allocated it:
+ * the counters of a thread can be negative, but their sum is right.
+ * The counters of exiting threads are merged into global counters.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "Memory.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/* header of tagged blocks (keeps the alignment of malloc) */
+struct mem_hdr {
+    size_t      size;
+    mem_tag_t   tag;
+} __attribute__ ((aligned(16)));
+
+struct mem_counters {
+    volatile long long   bytes[MEM_TAG_COUNT];
+    volatile long long   count[MEM_TAG_COUNT];
+    struct mem_counters *next;
+};
+
+static const char *mem_tag_names[MEM_TAG_COUNT] = {
+    [MEM_TAG_PIPELINE] = "pipeline",
+    [MEM_TAG_CHGLOG] = "changelog records",
+    [MEM_TAG_POLICY] = "policy queues",
+    [MEM_TAG_DBRESULT] = "DB results",
+    [MEM_TAG_SCAN] = "scan tasks",
+};
+
+/* list of thread counters, and counters of exited threads */
+static pthread_mutex_t      counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mem_counters *counters_list = NULL;
+static struct mem_counters  exited_counters;
+
+static pthread_once_t       counters_once = PTHREAD_ONCE_INIT;
+static pthread_key_t        counters_key;
+static __thread struct mem_counters *my_counters = NULL;
+
+static void counters_release(void *arg)
+{
+    struct mem_counters *c = arg;
+    struct mem_counters **pc;
+    int i;
+
+    P(counters_lock);
+    for (i = 0; i < MEM_TAG_COUNT; i++) {
+        exited_counters.bytes[i] += c->bytes[i];
+        exited_counters.count[i] += c->count[i];
+    }
+    for (pc = &counters_list; *pc != NULL; pc = &(*pc)->next) {
+        if (*pc == c) {
+            *pc = c->next;
+            break;
+        }
+    }
+    V(counters_lock);
+    free(c);
+}
+
+static void counters_key_init(void)
+{
+    pthread_key_create(&counters_key, counters_release);
+}
+
+/** get the counters of the current thread */
+static struct mem_counters *get_counters(void)
+{
+    struct mem_counters *c;
+
+    if (likely(my_counters != NULL))
+        return my_counters;
+
+    pthread_once(&counters_once, counters_key_init);
+
+    c = calloc(1, sizeof(*c));
+    /* count in global counters if there is no memory */
+    if (c == NULL)
+        return NULL;
+
+    P(counters_lock);
+    c->next = counters_list;
+    counters_list = c;
+    V(counters_lock);
+
+    pthread_setspecific(counters_key, c);
+    my_counters = c;
+    return c;
+}
+
+void mem_account(mem_tag_t tag, long long bytes, long long count)
+{
+    struct mem_counters *c = get_counters();
+
+    if (unlikely(c == NULL)) {
+        __sync_fetch_and_add(&exited_counters.bytes[tag], bytes);
+        __sync_fetch_and_add(&exited_counters.count[tag], count);
+        return;
+    }
+    c->bytes[tag] += bytes;
+    c->count[tag] += count;
+}
+
+void *mem_alloc_tag(mem_tag_t tag, size_t size, int zero)
+{
+    struct mem_hdr *h;
+
+    if (size > SIZE_MAX - sizeof(*h)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    h = zero ? calloc(1, sizeof(*h) + size) : malloc(sizeof(*h) + size);
+    if (h == NULL)
+        return NULL;
+
+    h->size = size;
+    h->tag = tag;
+    mem_account(tag, size, 1);
+    return h + 1;
+}
+
+void mem_free_tag(void *ptr)
+{
+    struct mem_hdr *h;
+
+    if (ptr == NULL)
+        return;
+
+    h = (struct mem_hdr *)ptr - 1;
+    mem_account(h->tag, -(long long)h->size, -1);
+    free(h);
+}
+
+void mem_tag_stats(mem_tag_t tag, long long *bytes, long long *count)
+{
+    struct mem_counters *c;
+
+    P(counters_lock);
+    *bytes = exited_counters.bytes[tag];
+    *count = exited_counters.count[tag];
+    /* the values of running threads may be slightly outdated */
+    for (c = counters_list; c != NULL; c = c->next) {
+        *bytes += c->bytes[tag];
+        *count += c->count[tag];
+    }
+    V(counters_lock);
+}
+
+const char *mem_tag_name(mem_tag_t tag)
+{
+    return tag < MEM_TAG_COUNT ? mem_tag_names[tag] : "?";
+}
+
+void mem_dump_stats(void)
+{
+    char  buff[256];
+    int   i;
+
+    DisplayLog(LVL_MAJOR, "STATS", "==== Memory usage by subsystem =====");
+    for (i = 0; i < MEM_TAG_COUNT; i++) {
+        long long bytes, count;
+
+        mem_tag_stats(i, &bytes, &count);
+        FormatFileSize(buff, sizeof(buff), bytes > 0 ? bytes : 0);
+        DisplayLog(LVL_MAJOR, "STATS", "%-18s: %s in %lld objects",
+                   mem_tag_name(i), buff, count);
+    }
+}
@@ -58,6 +58,9 @@ static void global_cfg_set_default(void *module_config)
 #if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
     conf->direct_mds_stat = false;
 #endif
+#ifdef _HAVE_FID
+    conf->fid_path_cache_size = 100000;
+#endif
 }
 
 static void global_cfg_write_default(FILE *output)
@@ -77,6 +80,9 @@ static void global_cfg_write_default(FILE *output)
 
 #if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
     print_line(output, 1, "direct_mds_stat :   no");
+#endif
+#ifdef _HAVE_FID
+    print_line(output, 1, "fid_path_cache_size    :  100000");
 #endif
     print_end_block(output, 0);
 }
@@ -91,7 +97,7 @@ static int global_cfg_read(config_file_t config, void *module_config,
     static const char * const allowed_params[] = {
         "fs_path", "fs_type", "stay_in_fs", "check_mounted",
         "direct_mds_stat", "fs_key", "last_access_only_atime",
-        "uid_gid_as_numbers", NULL
+        "uid_gid_as_numbers", "fid_path_cache_size", NULL
     };
     const cfg_param_t cfg_params[] = {
         {"fs_path", PT_STRING, PFLG_MANDATORY | PFLG_ABSOLUTE_PATH |
@@ -115,6 +121,11 @@ static int global_cfg_read(config_file_t config, void *module_config,
 #if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
         {"direct_mds_stat", PT_BOOL, 0, &conf->direct_mds_stat, 0}
         ,
+#endif
+#ifdef _HAVE_FID
+        {"fid_path_cache_size", PT_INT, PFLG_POSITIVE,
+         (int *)&conf->fid_path_cache_size, 0}
+        ,
 #endif
         END_OF_PARAMS
     };
@@ -222,6 +233,13 @@ static int global_cfg_set(void *module_config, bool reload)
     }
 #endif
 
+#ifdef _HAVE_FID
+    if (conf->fid_path_cache_size != global_config.fid_path_cache_size)
+        DisplayLog(LVL_MAJOR, "GlobalConfig",
+                   GLOBAL_CONFIG_BLOCK
+                   "::fid_path_cache_size changed in config file, but cannot be modified dynamically");
+#endif
+
     return 0;
 }
 
@@ -259,6 +277,11 @@ static void global_cfg_write_template(FILE *output)
     print_line(output, 1,
                "# There are no guarantees that all filesystems will correctly store atime");
     print_line(output, 1, "last_access_only_atime = no ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Store numeric uid/gid in the database (names are resolved by reports).");
+    print_line(output, 1,
+               "# Existing databases are converted by running 'robinhood --alter-db'");
     print_line(output, 1, "uid_gid_as_numbers = no ;");
 
 #if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
@@ -267,6 +290,14 @@ static void global_cfg_write_template(FILE *output)
                "# File info is asked directly to MDS on Lustre filesystems");
     print_line(output, 1, "# (scan faster, but size information is missing)");
     print_line(output, 1, "direct_mds_stat        =    no ;");
+#endif
+#ifdef _HAVE_FID
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# max directories in the cache used to resolve entry paths");
+    print_line(output, 1,
+               "# from their parent FID and name (0 to always call fid2path)");
+    print_line(output, 1, "# fid_path_cache_size = 100000 ;");
 #endif
     print_end_block(output, 0);
 }
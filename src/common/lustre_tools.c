@@ -46,6 +46,9 @@
 #define TAG_FIDPATH     "FidPath"
 #define TAG_LLAPI       "llapi"
 
+/* layout of a file, in lov_user_md format */
+#define XATTR_LUSTRE_LOV "lustre.lov"
+
 #if HAVE_LLAPI_LOG_CALLBACKS
 /**
  * Map LLAPI log levels to robinhood's ones.
@@ -315,6 +318,88 @@ int File_GetStripeByDirFd(int dirfd, const char *fname,
     return rc;
 }
 
+int File_GetStripeByFd(int fd, stripe_info_t *p_stripe_info,
+                        stripe_items_t *p_stripe_items)
+{
+    struct lov_user_md *p_lum;
+    ssize_t len;
+    int rc;
+
+    p_lum = MemAlloc(LUM_SIZE_MAX);
+    if (!p_lum)
+        return -ENOMEM;
+
+    memset(p_lum, 0, LUM_SIZE_MAX);
+    /* served from the layout got at open time */
+    len = fgetxattr(fd, XATTR_LUSTRE_LOV, p_lum, LUM_SIZE_MAX);
+    if (len >= 0) {
+        rc = fill_stripe_info(p_lum, p_stripe_info, p_stripe_items);
+    } else {
+        rc = -errno;
+
+        if (rc == -ENODATA) {
+            DisplayLog(LVL_DEBUG, TAG_STRIPE,
+                       "File descriptor %d has no stripe information", fd);
+            set_empty_stripe(p_stripe_info, p_stripe_items);
+            rc = 0;
+        } else if ((rc != -ENOENT) && (rc != -ESTALE)) {
+            DisplayLog(LVL_CRIT, TAG_STRIPE,
+                       "Error %d getting stripe info for fd %d", rc, fd);
+        }
+    }
+
+    MemFree(p_lum);
+    return rc;
+}
+
+int File_GetStripeByLovEA(const void *lovea, size_t len,
+                          stripe_info_t *p_stripe_info,
+                          stripe_items_t *p_stripe_items)
+{
+    struct lov_user_md *p_lum;
+    int rc;
+
+    if (len < sizeof(struct lov_user_md_v1) || len > LUM_SIZE_MAX)
+        return -EINVAL;
+
+    p_lum = MemAlloc(LUM_SIZE_MAX);
+    if (!p_lum)
+        return -ENOMEM;
+
+    memset(p_lum, 0, LUM_SIZE_MAX);
+    memcpy(p_lum, lovea, len);
+
+    /* the stripe count must match the size of the EA */
+    if (len < sizeof(struct lov_user_md_v1)
+        + p_lum->lmm_stripe_count * sizeof(struct lov_user_ost_data_v1))
+        rc = -EINVAL;
+    else
+        rc = fill_stripe_info(p_lum, p_stripe_info, p_stripe_items);
+
+    MemFree(p_lum);
+    return rc;
+}
+
+#ifdef _HAVE_FID
+/* entry opened by the current thread (see Lustre_SetEntryFd) */
+static __thread entry_id_t entry_fd_id;
+static __thread int entry_fd = -1;
+
+void Lustre_SetEntryFd(const entry_id_t *p_id, int fd)
+{
+    if (p_id != NULL)
+        entry_fd_id = *p_id;
+    entry_fd = fd;
+}
+
+int Lustre_GetEntryFd(const entry_id_t *p_id)
+{
+    if (entry_fd < 0 || !entry_id_equal(p_id, &entry_fd_id))
+        return -1;
+    return entry_fd;
+}
+#endif
+
 /**
  * check if a file has data on the given OST.
  */
@@ -358,27 +443,64 @@ bool DataOnOST(size_t fsize, unsigned int ost_index,
 
 #define div_upper_round(_n, _d) (((_n)/(_d)) + ((_n) % (_d) ? 1 : 0))
 
+/** check the stripe size can be used to compute block distribution */
+static bool check_stripe_size(const stripe_info_t *sinfo)
+{
+    /* unsane value, file may not be stripped */
+    if (sinfo->stripe_size == 0)
+        return false;
+
+    if ((sinfo->stripe_size % DEV_BSIZE) != 0) {
+        DisplayLog(LVL_CRIT, __func__,
+                   "Unexpected stripe_size value %lu: not a multiple of DEV_BSIZE (%u)",
+                   sinfo->stripe_size, DEV_BSIZE);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * computes blocks on the given stripe index, knowing the number
+ * of full stripes of the file and the size of the last one.
+ */
+static blkcnt_t stripe_index_blocks(unsigned long full_stripes,
+                                    unsigned long last_stripe_size,
+                                    const stripe_info_t *sinfo,
+                                    unsigned int stripe_index)
+{
+    unsigned long match_full, extra_blocks = 0;
+
+    /* the file ends before this stripe */
+    if (full_stripes < stripe_index)
+        return 0;
+
+    /* how many full stripes for the given index? */
+    match_full = (full_stripes - stripe_index) / sinfo->stripe_count;
+    /* + an extra stripe? */
+    if (((full_stripes - stripe_index) % sinfo->stripe_count) > 0)
+        match_full++;
+    else
+        /* last full stripe is just before this OST: extra blocks are on it */
+        extra_blocks = div_upper_round(last_stripe_size, DEV_BSIZE);
+
+    /* return value (in blocks):
+     * match_full * stripe_size / DEV_BSIZE + extra_blocks
+     */
+    return match_full * (sinfo->stripe_size / DEV_BSIZE) + extra_blocks;
+}
+
 /** computes blocks on the given OST */
 blkcnt_t BlocksOnOST(blkcnt_t blocks, unsigned int ost_index,
                      const stripe_info_t *sinfo, const stripe_items_t *sitems)
 {
-    unsigned long full_stripes, last_stripe_size, match_full, extra_blocks = 0;
     int i;
     int stripe_index = -1;
 
     /* if block=0 the answer is obviously 0 */
     if (blocks == 0)
         return 0;
-    /* unsane value, file may not be stripped */
-    if (sinfo->stripe_size == 0)
-        return 0;
-
-    if ((sinfo->stripe_size % DEV_BSIZE) != 0) {
-        DisplayLog(LVL_CRIT, __func__,
-                   "Unexpected stripe_size value %lu: not a multiple of DEV_BSIZE (%u)",
-                   sinfo->stripe_size, DEV_BSIZE);
+    if (!check_stripe_size(sinfo))
         return 0;
-    }
 
     /* what is the stripe index for this OST? */
     for (i = 0; i < sinfo->stripe_count; i++) {
@@ -391,22 +513,34 @@ blkcnt_t BlocksOnOST(blkcnt_t blocks, unsigned int ost_index,
         /* no data on the given OST */
         return 0;
 
+    return stripe_index_blocks((blocks * DEV_BSIZE) / sinfo->stripe_size,
+                               (blocks * DEV_BSIZE) % sinfo->stripe_size,
+                               sinfo, stripe_index);
+}
+
+/** computes blocks on all the OSTs of a file */
+unsigned int BlocksByOST(blkcnt_t blocks, const stripe_info_t *sinfo,
+                         const stripe_items_t *sitems,
+                         blkcnt_t *stripe_blocks)
+{
+    unsigned long full_stripes, last_stripe_size;
+    unsigned int i, n;
+
+    n = MIN2(sinfo->stripe_count, sitems->count);
+
+    if (blocks == 0 || !check_stripe_size(sinfo)) {
+        for (i = 0; i < n; i++)
+            stripe_blocks[i] = 0;
+        return n;
+    }
+
     full_stripes = (blocks * DEV_BSIZE) / sinfo->stripe_size;
     last_stripe_size = (blocks * DEV_BSIZE) % sinfo->stripe_size;
 
-    /* how many full stripes for the given index? */
-    match_full = (full_stripes - stripe_index) / sinfo->stripe_count;
-    /* + an extra stripe? */
-    if (((full_stripes - stripe_index) % sinfo->stripe_count) > 0)
-        match_full++;
-    else
-        /* last full stripe is just before this OST: extra blocks are on it */
-        extra_blocks = div_upper_round(last_stripe_size, DEV_BSIZE);
-
-    /* return value (in blocks):
-     * match_full * stripe_size / DEV_BSIZE + extra_blocks
-     */
-    return match_full * (sinfo->stripe_size / DEV_BSIZE) + extra_blocks;
+    for (i = 0; i < n; i++)
+        stripe_blocks[i] = stripe_index_blocks(full_stripes, last_stripe_size,
+                                               sinfo, i);
+    return n;
 }
 
 #ifdef HAVE_LLAPI_GETPOOL_INFO
@@ -678,13 +812,106 @@ int Get_OST_usage(const char *fs_path, unsigned int ost_index,
     return 0;
 }
 
+/* max concurrent OST statfs requests */
+#define OST_STATFS_THREADS  16
+/* protection against endless loops (e.g. if fs_path is not Lustre) */
+#define OST_INDEX_MAX       65536
+
+/** shared state of a batched OST statfs collection */
+struct ost_batch {
+    pthread_mutex_t  lock;
+    const char      *fs_path;
+    unsigned int     next;   /**< next OST index to query */
+    unsigned int     end;    /**< first index beyond the last OST */
+    ost_usage_t     *table;
+    unsigned int     size;   /**< allocated items in table */
+    int              rc;     /**< allocation error */
+};
+
+static void *ost_batch_worker(void *arg)
+{
+    struct ost_batch *b = arg;
+
+    for (;;) {
+        struct statfs stfs;
+        unsigned int idx;
+        int rc;
+
+        P(b->lock);
+        if (b->rc != 0 || b->next >= b->end) {
+            V(b->lock);
+            return NULL;
+        }
+        idx = b->next++;
+        V(b->lock);
+
+        rc = Get_OST_usage(b->fs_path, idx, &stfs);
+
+        P(b->lock);
+        if (rc == ENODEV) {
+            /* end of OST list */
+            if (idx < b->end)
+                b->end = idx;
+        } else if (idx < b->end) {
+            if (idx >= b->size) {
+                unsigned int size = MAX2(2 * b->size, idx + 1);
+                ost_usage_t *tmp;
+
+                tmp = MemRealloc(b->table, size * sizeof(*tmp));
+                if (tmp == NULL) {
+                    b->rc = ENOMEM;
+                    V(b->lock);
+                    return NULL;
+                }
+                b->table = tmp;
+                b->size = size;
+            }
+            b->table[idx].rc = rc;
+            b->table[idx].stfs = stfs;
+        }
+        V(b->lock);
+    }
+}
+
+int Get_all_OST_usage(const char *fs_path, ost_usage_t **p_table,
+                      unsigned int *p_count)
+{
+    struct ost_batch b;
+    pthread_t threads[OST_STATFS_THREADS - 1];
+    unsigned int i, nb_thr = 0;
+
+    memset(&b, 0, sizeof(b));
+    pthread_mutex_init(&b.lock, NULL);
+    b.fs_path = fs_path;
+    b.end = OST_INDEX_MAX;
+
+    /* the calling thread is one of the workers */
+    for (i = 0; i < OST_STATFS_THREADS - 1; i++) {
+        if (pthread_create(&threads[i], NULL, ost_batch_worker, &b) != 0)
+            break;
+        nb_thr++;
+    }
+    ost_batch_worker(&b);
+    for (i = 0; i < nb_thr; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&b.lock);
+
+    if (b.rc != 0) {
+        MemFree(b.table);
+        return b.rc;
+    }
+
+    *p_table = b.table;
+    *p_count = b.end;
+    return 0;
+}
+
 #ifdef HAVE_LLAPI_GETPOOL_INFO
-/** Retrieve pool usage info
- *  @return 0 on success
- */
-int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
+int Get_pool_members(const char *poolname, unsigned int **p_indexes,
+                     unsigned int *p_count)
 {
-    struct statfs ost_statfs;
+    unsigned int *indexes = NULL;
     int rc, i, count;
     char pool[LOV_MAXPOOLNAME + 10];
 #ifdef FIND_MAX_OSTS
@@ -695,17 +922,12 @@ int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
     char **ostlist = NULL;
     int bufsize = sizeof(struct obd_uuid) * obdcount;
     char *buffer = MemAlloc(bufsize + (sizeof(*ostlist) * obdcount));
-    ostlist = (char **)(buffer + bufsize);
 
-    /* sanity check */
-    if (!pool_statfs) {
-        MemFree(buffer);
-        return EFAULT;
-    }
+    if (buffer == NULL)
+        return ENOMEM;
+    ostlist = (char **)(buffer + bufsize);
 #endif
 
-    memset(pool_statfs, 0, sizeof(struct statfs));
-
     /* retrieve list of OSTs in the pool */
     sprintf(pool, "%s.%s", get_fsname(), poolname);
 #ifdef FIND_MAX_OSTS
@@ -714,24 +936,35 @@ int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
     do {
         rc = llapi_get_poolmembers(pool, ostlist, obdcount, buffer, bufsize);
         if (rc == -EOVERFLOW) {
+            char *tmp;
+
             /* buffer too small, increase obdcount by 2 */
             obdcount *= 2;
             bufsize = sizeof(struct obd_uuid) * obdcount;
-            buffer =
-                MemRealloc(buffer, bufsize + (sizeof(*ostlist) * obdcount));
-            if (buffer == NULL)
-                return ENOMEM;
+            tmp = MemRealloc(buffer, bufsize + (sizeof(*ostlist) * obdcount));
+            if (tmp == NULL) {
+                rc = -ENOMEM;
+                break;
+            }
+            buffer = tmp;
             ostlist = (char **)(buffer + bufsize);
         }
     } while (rc == -EOVERFLOW);
 #endif
 
-    if (rc < 0)
-        return -rc;
-
+    if (rc < 0) {
+        rc = -rc;
+        goto out;
+    }
     count = rc;
+    rc = 0;
+
+    indexes = MemCalloc(MAX2(count, 1), sizeof(*indexes));
+    if (indexes == NULL) {
+        rc = ENOMEM;
+        goto out;
+    }
 
-    /* get OST info and sum them */
     for (i = 0; i < count; i++) {
         char *ost;
         int index;
@@ -740,7 +973,8 @@ int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
         if (!ost) {
             DisplayLog(LVL_CRIT, TAG_POOLDF, "Invalid OST format: '%s'",
                        ostlist[i]);
-            return EINVAL;
+            rc = EINVAL;
+            goto out;
         }
 
         /* skip '-' */
@@ -748,12 +982,50 @@ int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
         if (sscanf(ost, "OST%d", &index) != 1) {
             DisplayLog(LVL_CRIT, TAG_POOLDF, "Could not find OST index in"
                        " string '%s'", ost);
-            return EINVAL;
+            rc = EINVAL;
+            goto out;
         }
+        indexes[i] = index;
+    }
+
+    *p_indexes = indexes;
+    *p_count = count;
+    indexes = NULL;
+
+out:
+    if (indexes != NULL)
+        MemFree(indexes);
+#ifndef FIND_MAX_OSTS
+    MemFree(buffer);
+#endif
+    return rc;
+}
 
-        rc = Get_OST_usage(get_mount_point(NULL), index, &ost_statfs);
+/** Retrieve pool usage info
+ *  @return 0 on success
+ */
+int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
+{
+    struct statfs ost_statfs;
+    unsigned int *indexes;
+    unsigned int i, count;
+    int rc;
+
+    /* sanity check */
+    if (!pool_statfs)
+        return EFAULT;
+
+    memset(pool_statfs, 0, sizeof(struct statfs));
+
+    rc = Get_pool_members(poolname, &indexes, &count);
+    if (rc)
+        return rc;
+
+    /* get OST info and sum them */
+    for (i = 0; i < count; i++) {
+        rc = Get_OST_usage(get_mount_point(NULL), indexes[i], &ost_statfs);
         if (rc)
-            return rc;
+            break;
 
         /* sum info to struct statfs */
         pool_statfs->f_blocks += ost_statfs.f_blocks;
@@ -762,7 +1034,8 @@ int Get_pool_usage(const char *poolname, struct statfs *pool_statfs)
         pool_statfs->f_bsize = ost_statfs.f_bsize;
     }
 
-    return 0;
+    MemFree(indexes);
+    return rc;
 }
 #endif
 
@@ -875,6 +1148,51 @@ int lustre_mds_stat_by_fid(const entry_id_t *p_id, struct stat *inode)
 }
 #endif
 
+#if defined(_HAVE_FID) && defined(HAVE_LLAPI_GET_MDT_INDEX_BY_FID)
+#define TAG_MDTIDX      "MDT_index"
+
+int Lustre_GetMDTCount(unsigned int *count)
+{
+    int n = 0;
+    int rc;
+
+    rc = llapi_get_obd_count((char *)get_mount_point(NULL), &n, 1);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, TAG_MDTIDX, "Failed to get MDT count: %s",
+                   strerror(-rc));
+        return rc;
+    }
+    *count = (n > 0) ? n : 1;
+    return 0;
+}
+
+static int mnt_fd = -1;
+
+int Lustre_GetMDTIndex(const entry_id_t *p_id)
+{
+    int mdt_index = 0;
+    int rc;
+
+    /* ensure the filesystem root is opened */
+    if (mnt_fd < 0) {
+        P(dir_lock);
+        if (mnt_fd < 0)
+            mnt_fd = open(get_mount_point(NULL), O_RDONLY | O_DIRECTORY);
+        V(dir_lock);
+        if (mnt_fd < 0)
+            return -errno;
+    }
+
+    rc = llapi_get_mdt_index_by_fid(mnt_fd, p_id, &mdt_index);
+    if (rc) {
+        DisplayLog(LVL_DEBUG, TAG_MDTIDX, "Failed to get MDT index of "DFID
+                   ": %s", PFID(p_id), strerror(-rc));
+        return rc;
+    }
+    return mdt_index;
+}
+#endif
+
 #define BRIEF_OST_FORMAT "ost#%u:%u"
 #define HUMAN_OST_FORMAT "ost#%u: %u"
 
@@ -341,8 +341,162 @@ attr_mask_t params_mask(const char *str, const char *str_descr, bool *err)
     return args.mask;
 }
 
-/** argument structure for build_cmd() callback */
-struct build_cmd_args {
+/* ========== parameter templates ==========
+ * Strings with placeholders are parsed once into a list of chunks
+ * (literal parts and placeholders), that are cached by each thread
+ * and rendered into a buffer of the thread. This avoids parsing the
+ * strings and allocating intermediate strings for each entry.
+ */
+
+/** literal part or placeholder of a parameter template */
+struct param_chunk {
+    /** offset and length of the literal part in the template string */
+    unsigned int              start;
+    unsigned int              len;
+    /** placeholder name (NULL for literal parts) */
+    char                     *name;
+    /** std parameter of this name (NULL if none) */
+    const struct param_descr *std;
+};
+
+/** parsed string with placeholders */
+struct param_template {
+    char               *str;
+    struct param_chunk *chunks;
+    unsigned int        count;
+    bool                has_placeholder;
+};
+
+/* Reloaded configurations can make cached templates useless:
+ * the cache is flushed when it exceeds this size. */
+#define TEMPLATE_CACHE_MAX  1024
+
+/* templates of the current thread, with and without strict braces */
+static __thread GHashTable *template_cache[2] = { NULL, NULL };
+/* buffer to render templates */
+static __thread GString *subst_buff = NULL;
+
+static void template_free(gpointer data)
+{
+    struct param_template *t = data;
+    unsigned int i;
+
+    for (i = 0; i < t->count; i++)
+        free(t->chunks[i].name);
+    free(t->chunks);
+    free(t->str);
+    free(t);
+}
+
+/** argument structure for add_chunk() callback */
+struct template_args {
+    GArray *chunks;
+    /** index following the last processed placeholder */
+    int     last_idx;
+};
+
+static void add_literal(struct template_args *args, int start, int end)
+{
+    struct param_chunk c = {
+        .start = start,
+        .len = end - start,
+    };
+
+    if (end > start)
+        g_array_append_val(args->chunks, c);
+}
+
+/** callback function to split a template into chunks */
+static int add_chunk(const char *name, int begin_idx, int end_idx,
+                     void *udata)
+{
+    struct template_args *args = udata;
+    struct param_chunk c = { 0 };
+
+    add_literal(args, args->last_idx, begin_idx);
+
+    c.name = strdup(name);
+    if (!c.name)
+        return -ENOMEM;
+    c.std = get_stdarg(name);
+    g_array_append_val(args->chunks, c);
+
+    args->last_idx = end_idx + 1;
+    return 0;
+}
+
+static struct param_template *template_compile(const char *str,
+                                               const char *str_descr,
+                                               bool strict_braces)
+{
+    struct param_template *t;
+    struct template_args args = { .last_idx = 0 };
+    unsigned int i;
+
+    t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+    t->str = strdup(str);
+    args.chunks = g_array_new(FALSE, FALSE, sizeof(struct param_chunk));
+    if (!t->str || !args.chunks)
+        goto err_free;
+
+    if (placeholder_foreach(t->str, str_descr, add_chunk, (void *)&args,
+                            PH_ALLOW_EMPTY | (strict_braces ? PH_STRICT_BRACES :
+                                              0)))
+        goto err_free;
+
+    /* the end of the string */
+    add_literal(&args, args.last_idx, strlen(t->str));
+
+    t->count = args.chunks->len;
+    t->chunks = (struct param_chunk *)g_array_free(args.chunks, FALSE);
+    for (i = 0; i < t->count; i++)
+        if (t->chunks[i].name != NULL)
+            t->has_placeholder = true;
+    return t;
+
+ err_free:
+    if (args.chunks) {
+        for (i = 0; i < args.chunks->len; i++)
+            free(g_array_index(args.chunks, struct param_chunk, i).name);
+        g_array_free(args.chunks, TRUE);
+    }
+    free(t->str);
+    free(t);
+    return NULL;
+}
+
+/** get a template from the cache of the thread, or parse it */
+static const struct param_template *template_get(const char *str,
+                                                 const char *str_descr,
+                                                 bool strict_braces)
+{
+    GHashTable **cache = &template_cache[strict_braces ? 1 : 0];
+    struct param_template *t;
+
+    if (*cache != NULL) {
+        t = g_hash_table_lookup(*cache, str);
+        if (t != NULL)
+            return t;
+    }
+
+    t = template_compile(str, str_descr, strict_braces);
+    if (t == NULL)
+        return NULL;
+
+    if (*cache == NULL)
+        *cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                       template_free);
+    else if (g_hash_table_size(*cache) >= TEMPLATE_CACHE_MAX)
+        g_hash_table_remove_all(*cache);
+
+    g_hash_table_insert(*cache, t->str, t);
+    return t;
+}
+
+/** argument structure for rendering templates */
+struct subst_args {
     bool quote;
 
     /** entry id, attrs, ... */
@@ -354,15 +508,8 @@ struct build_cmd_args {
     const char **addl_params;
     /** status manager instance from context */
     const sm_instance_t *smi;
-    /** description of the string being parsed */
+    /** description of the string being rendered */
     const char *str_descr;
-    /** original string passed to subst_cmd_params() */
-    const char *orig_str;
-    /** index following the last processed placeholder in orig_str */
-    int last_idx;
-    /** String being built (to be returned by subst_cmd_params()).
-     * Initially allocated and empty (""). */
-    GString *out_str;
 };
 
 char *quote_shell_arg(const char *arg)
@@ -411,38 +558,41 @@ char *quote_shell_arg(const char *arg)
     return quoted;
 }
 
-/** callback function to build a command by replacing placeholders. */
-static int build_cmd(const char *name, int begin_idx, int end_idx, void *udata)
+/** append a value quoted as a shell argument,
+ * the same way as quote_shell_arg() */
+static void append_quoted(GString *out, const char *arg)
 {
-    struct build_cmd_args *args = udata;
+    const char *c;
+
+    g_string_append_c(out, '\'');
+    for (c = arg; *c != '\0'; c++) {
+        if (*c == '\'')
+            g_string_append(out, "'\\''");
+        else
+            g_string_append_c(out, *c);
+    }
+    g_string_append_c(out, '\'');
+}
+
+/** append the value of a placeholder */
+static int append_placeholder(GString *out, const struct param_chunk *c,
+                              const struct subst_args *args)
+{
+    const char *name = c->name;
     const char *val = NULL;
-    char *quoted_arg = NULL;
     bool free_val = false;
     int rc;
 
-    if (unlikely(args == NULL))
-        return -EINVAL;
-
-    /* append from last position to current position as is */
-    if (begin_idx > args->last_idx)
-        g_string_append_len(args->out_str, args->orig_str + args->last_idx,
-                            begin_idx - args->last_idx);
-
-    /* get value for the current parameter */
-
     /* 1) search in user parameters */
     if (val == NULL && args->user_params != NULL)
         val = rbh_param_get(args->user_params, name);
 
     /* 2) search in std parameters */
-    if (val == NULL) {
-        const struct param_descr *a = get_stdarg(name);
-
-        if (a != NULL) {
-            val = a->get_func(args->id, args->attrs, a->attr_index, &free_val);
-            if (val == NULL)
-                return -ENOENT;
-        }
+    if (val == NULL && c->std != NULL) {
+        val = c->std->get_func(args->id, args->attrs, c->std->attr_index,
+                               &free_val);
+        if (val == NULL)
+            return -ENOENT;
     }
 
     /* 3) search in additional parameters */
@@ -485,38 +635,47 @@ static int build_cmd(const char *name, int begin_idx, int end_idx, void *udata)
         return -EINVAL;
     }
 
-    if (args->quote) {
-        /* quote the value and append it to command line */
-        quoted_arg = quote_shell_arg(val);
-        if (!quoted_arg) {
-            rc = -ENOMEM;
-            goto out_free;
-        }
-
-        g_string_append(args->out_str, quoted_arg);
-    } else
-        g_string_append(args->out_str, val);
-
-    args->last_idx = end_idx + 1;
-    rc = 0;
+    if (args->quote)
+        append_quoted(out, val);
+    else
+        g_string_append(out, val);
 
- out_free:
-    free(quoted_arg);
     if (free_val)
         free((char *)val);
-    return rc;
+    return 0;
 }
 
-char *subst_params(const char *str_in,
-                   const char *str_descr,
-                   const entry_id_t *p_id,
-                   const attr_set_t *p_attrs,
-                   const action_params_t *params,
-                   const char **subst_array,
-                   const struct sm_instance *smi,
-                   bool quote, bool strict_braces)
+/** replace placeholders of a template by their value */
+static int template_render(const struct param_template *t, GString *out,
+                           const struct subst_args *args)
+{
+    unsigned int i;
+    int rc;
+
+    for (i = 0; i < t->count; i++) {
+        const struct param_chunk *c = &t->chunks[i];
+
+        if (c->name == NULL) {
+            g_string_append_len(out, t->str + c->start, c->len);
+            continue;
+        }
+        rc = append_placeholder(out, c, args);
+        if (rc)
+            return rc;
+    }
+    return 0;
+}
+
+const char *subst_params_r(const char *str_in,
+                           const char *str_descr,
+                           const entry_id_t *p_id,
+                           const attr_set_t *p_attrs,
+                           const action_params_t *params,
+                           const char **subst_array,
+                           const struct sm_instance *smi,
+                           bool quote, bool strict_braces)
 {
-    struct build_cmd_args args = {
+    struct subst_args args = {
         .quote = quote,
         .id = p_id,
         .attrs = p_attrs,
@@ -524,38 +683,49 @@ char *subst_params(const char *str_in,
         .addl_params = subst_array,
         .smi = smi,
         .str_descr = str_descr,
-        .orig_str = str_in,
-        .last_idx = 0,
-        .out_str = NULL,
     };
-    char *ret;
+    const struct param_template *t;
 
-    args.out_str = g_string_new("");
+    if (!str_descr)
+        return NULL;
 
-    if (!args.out_str || !args.str_descr)
-        goto err_free;
+    t = template_get(str_in, str_descr, strict_braces);
+    if (t == NULL)
+        return NULL;
 
-    if (placeholder_foreach(str_in, args.str_descr, build_cmd, (void *)&args,
-                            PH_ALLOW_EMPTY | (strict_braces ? PH_STRICT_BRACES :
-                                              0)))
-        goto err_free;
+    if (!t->has_placeholder)
+        return str_in;
+
+    if (subst_buff == NULL)
+        subst_buff = g_string_sized_new(RBH_PATH_MAX);
+    else
+        g_string_truncate(subst_buff, 0);
+
+    if (template_render(t, subst_buff, &args))
+        return NULL;
 
-    /* append the end of the string */
-    if (args.last_idx < strlen(str_in))
-        g_string_append(args.out_str, str_in + args.last_idx);
+    DisplayLog(LVL_FULL, PARAMS_TAG, "'%s'->'%s' in %s", str_in,
+               subst_buff->str, str_descr);
+    return subst_buff->str;
+}
 
-    /* don't release the string itself (freed by the caller) */
-    ret = args.out_str->str;
-    g_string_free(args.out_str, FALSE);
+char *subst_params(const char *str_in,
+                   const char *str_descr,
+                   const entry_id_t *p_id,
+                   const attr_set_t *p_attrs,
+                   const action_params_t *params,
+                   const char **subst_array,
+                   const struct sm_instance *smi,
+                   bool quote, bool strict_braces)
+{
+    const char *res;
 
-    DisplayLog(LVL_FULL, PARAMS_TAG, "'%s'->'%s' in %s", str_in, ret,
-               str_descr);
-    return ret;
+    res = subst_params_r(str_in, str_descr, p_id, p_attrs, params,
+                         subst_array, smi, quote, strict_braces);
+    if (res == NULL)
+        return NULL;
 
- err_free:
-    if (args.out_str)
-        g_string_free(args.out_str, TRUE);
-    return NULL;
+    return g_strdup(res);
 }
 
 /*
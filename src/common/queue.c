@@ -14,7 +14,16 @@
 
 /**
  * Module for handling queue of items with feedback management.
- * The algorithm is based on a cyclic queue.
+ *
+ * The queue is a ring of slots with sequence numbers: a slot at position
+ * pos can be written when its sequence is pos, and read when it is pos + 1.
+ * Producers and consumers reserve their position with an atomic increment,
+ * so they never take a lock. Semaphores count free and filled slots, so a
+ * reserved position is always available (or about to be released by the
+ * thread that still holds it).
+ *
+ * Acknowledgement counters are split into QUEUE_STAT_SLOTS sets, so worker
+ * threads don't share counters. They are summed up by RetrieveQueueStats().
  */
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -26,17 +35,27 @@
 #include "rbh_misc.h"
 
 #include <pthread.h>
+#include <sched.h>
 
 #define QUEUE_TAG "Queue"
 
-/* cyclic queue utilities */
-#define is_empty(pq) ((pq)->first_index == (pq)->last_index)
-#define is_full(pq)  ((pq)->first_index == \
-                      ((pq)->last_index + 1) % (pq)->array_size)
-#define nb_items(pq) (((pq)->last_index - (pq)->first_index) % (pq)->array_size)
+/* counters per cache line */
+#define STATUS_PER_LINE     (64 / sizeof(unsigned int))
+#define FEEDBACK_PER_LINE   (64 / sizeof(unsigned long long))
+
+#define ROUND_UP(_n, _m) ((((_n) + (_m) - 1) / (_m)) * (_m))
 
-#define lockq(pq) pthread_mutex_lock(&((pq)->queue_lock))
-#define unlockq(pq) pthread_mutex_unlock(&((pq)->queue_lock))
+/* counter set of the current thread */
+static __thread int stat_slot = -1;
+static unsigned int next_stat_slot = 0;
+
+static inline unsigned int my_stat_slot(void)
+{
+    if (stat_slot == -1)
+        stat_slot = __sync_fetch_and_add(&next_stat_slot, 1)
+                    % QUEUE_STAT_SLOTS;
+    return stat_slot;
+}
 
 /**
  * Initialize a queue.
@@ -44,6 +63,7 @@
 int CreateQueue(entry_queue_t *p_queue, unsigned int queue_size,
                 unsigned int max_status, unsigned int feedback_count)
 {
+    unsigned int i;
     int rc;
 
     if (!p_queue)
@@ -52,35 +72,41 @@ int CreateQueue(entry_queue_t *p_queue, unsigned int queue_size,
     /* number of slots that can be used */
     p_queue->queue_size = queue_size;
 
-    /* array must be 1 slot larger than queue_size because 1 slot is lost
-     * in cyclic queue management */
-    p_queue->array_size = queue_size + 1;
+    /* positions are mapped to slots by a mask */
+    for (p_queue->array_size = 1;
+         p_queue->array_size < queue_size * QUEUE_MAX_GROWTH;
+         p_queue->array_size <<= 1)
+        ;
 
-    p_queue->first_index = 0;
-    p_queue->last_index = 0;
+    p_queue->head = 0;
+    p_queue->tail = 0;
 
     /* allocates array of entries and stats */
-    p_queue->queue = MemCalloc(p_queue->array_size, sizeof(void *));
-    if (p_queue->queue == NULL)
+    p_queue->slots = MemCalloc(p_queue->array_size, sizeof(struct queue_slot));
+    if (p_queue->slots == NULL)
         return ENOMEM;
+    for (i = 0; i < p_queue->array_size; i++)
+        p_queue->slots[i].seq = i;
 
     p_queue->status_count = max_status + 1;
-    p_queue->status_array = MemCalloc(max_status + 1, sizeof(unsigned int));
+    p_queue->status_stride = ROUND_UP(p_queue->status_count, STATUS_PER_LINE);
+    p_queue->status_array = MemCalloc(QUEUE_STAT_SLOTS * p_queue->status_stride,
+                                      sizeof(unsigned int));
     if (p_queue->status_array == NULL)
         return ENOMEM;
 
     p_queue->feedback_count = feedback_count;
+    p_queue->feedback_stride = ROUND_UP(feedback_count, FEEDBACK_PER_LINE);
     p_queue->feedback_array =
-        MemCalloc(feedback_count, sizeof(unsigned long long));
+        MemCalloc(QUEUE_STAT_SLOTS * p_queue->feedback_stride,
+                  sizeof(unsigned long long));
     if (p_queue->feedback_array == NULL)
         return ENOMEM;
 
-    /* init locks */
-    pthread_mutex_init(&p_queue->queue_lock, NULL);
-
     rc = sem_init(&p_queue->sem_empty, 0, queue_size);
     if (rc)
         return rc;
+    p_queue->empty_debt = 0;
 
     rc = sem_init(&p_queue->sem_full, 0, 0);
     if (rc)
@@ -100,14 +126,12 @@ int CreateQueue(entry_queue_t *p_queue, unsigned int queue_size,
  */
 void Reset_StatusCount(entry_queue_t *p_queue)
 {
-    unsigned int i;
+    unsigned int i, j;
 
-    lockq(p_queue);
-
-    for (i = 0; i < p_queue->status_count; i++)
-        p_queue->status_array[i] = 0;
-
-    unlockq(p_queue);
+    for (i = 0; i < QUEUE_STAT_SLOTS; i++)
+        for (j = 0; j < p_queue->status_count; j++)
+            p_queue->status_array[i * p_queue->status_stride + j] = 0;
+    __sync_synchronize();
 }
 
 /**
@@ -115,6 +139,8 @@ void Reset_StatusCount(entry_queue_t *p_queue)
  */
 void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index)
 {
+    unsigned int i;
+
     if (feedback_index >= p_queue->feedback_count) {
         DisplayLog(LVL_CRIT, QUEUE_TAG,
                    "Error: feedback_index overflow (feedback_index=%u, max=%u)",
@@ -122,12 +148,92 @@ void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index)
         return;
     }
 
-    lockq(p_queue);
+    for (i = 0; i < QUEUE_STAT_SLOTS; i++)
+        p_queue->feedback_array[i * p_queue->feedback_stride
+                                + feedback_index] = 0;
+    __sync_synchronize();
+}
 
-    p_queue->feedback_array[feedback_index] = 0;
+/** release a free place */
+static inline void queue_release_slot(entry_queue_t *p_queue)
+{
+    unsigned int debt;
+
+    /* the queue was shrunk: keep this slot */
+    while ((debt = p_queue->empty_debt) > 0)
+        if (__sync_bool_compare_and_swap(&p_queue->empty_debt, debt,
+                                         debt - 1))
+            return;
+    sem_post_safe(&p_queue->sem_empty);
+}
 
-    unlockq(p_queue);
+unsigned int Queue_Resize(entry_queue_t *p_queue, unsigned int queue_size)
+{
+    static pthread_mutex_t resize_lock = PTHREAD_MUTEX_INITIALIZER;
+    unsigned int debt;
+
+    if (queue_size == 0)
+        queue_size = 1;
+    if (queue_size > p_queue->array_size) {
+        DisplayLog(LVL_MAJOR, QUEUE_TAG, "Queue size can't exceed %u "
+                   "without restarting (%u requested)", p_queue->array_size,
+                   queue_size);
+        queue_size = p_queue->array_size;
+    }
+
+    P(resize_lock);
+    while (p_queue->queue_size < queue_size) {
+        /* cancel the debt first */
+        debt = p_queue->empty_debt;
+        if (debt > 0) {
+            if (!__sync_bool_compare_and_swap(&p_queue->empty_debt, debt,
+                                              debt - 1))
+                continue;
+        } else
+            sem_post_safe(&p_queue->sem_empty);
+        p_queue->queue_size++;
+    }
+    while (p_queue->queue_size > queue_size) {
+        /* take a free place, or the next released one */
+        if (sem_trywait(&p_queue->sem_empty) != 0)
+            __sync_fetch_and_add(&p_queue->empty_debt, 1);
+        p_queue->queue_size--;
+    }
+    V(resize_lock);
+
+    return queue_size;
+}
+
+/** store an entry, once a free place has been taken */
+static void queue_push(entry_queue_t *p_queue, void *entry)
+{
+    unsigned long pos = __sync_fetch_and_add(&p_queue->tail, 1);
+    struct queue_slot *slot = &p_queue->slots[pos & (p_queue->array_size - 1)];
 
+    /* the slot may still be read by the consumer of the previous round */
+    while (slot->seq != pos)
+        sched_yield();
+
+    slot->entry = entry;
+    __sync_synchronize();
+    slot->seq = pos + 1;
+}
+
+/** retrieve an entry, once a filled place has been taken */
+static void *queue_pop(entry_queue_t *p_queue)
+{
+    unsigned long pos = __sync_fetch_and_add(&p_queue->head, 1);
+    struct queue_slot *slot = &p_queue->slots[pos & (p_queue->array_size - 1)];
+    void *entry;
+
+    /* the slot may still be written by its producer */
+    while (slot->seq != pos + 1)
+        sched_yield();
+
+    entry = slot->entry;
+    __sync_synchronize();
+    slot->seq = pos + p_queue->array_size;
+    return entry;
 }
 
 /**
@@ -136,37 +242,25 @@ void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index)
  */
 int Queue_Insert(entry_queue_t *p_queue, void *entry)
 {
+    return Queue_InsertBatch(p_queue, &entry, 1);
+}
 
-    if (p_queue == NULL)
-        return EFAULT;
-
-    sem_wait_safe(&p_queue->sem_empty); /* wait for free places */
-
-    lockq(p_queue); /* enter into the critical section */
-
-    /* The queue should not be full */
-    if (is_full(p_queue)) {
+int Queue_InsertBatch(entry_queue_t *p_queue, void **entries,
+                      unsigned int count)
+{
+    unsigned int i;
 
-        unlockq(p_queue);
-        DisplayLog(LVL_CRIT, QUEUE_TAG,
-                   "UNEXPECTED ERROR: queue should not be full!");
+    if (p_queue == NULL)
         return EFAULT;
-    } else {
-
-        /* Inserts data into the queue */
-        p_queue->queue[p_queue->last_index] = entry;
-        p_queue->last_index = (p_queue->last_index + 1) % p_queue->array_size;
 
+    for (i = 0; i < count; i++) {
+        sem_wait_safe(&p_queue->sem_empty); /* wait for free places */
+        queue_push(p_queue, entries[i]);
+        sem_post_safe(&p_queue->sem_full);  /* increase filled places */
     }
 
-    p_queue->last_submitted = time(NULL);
-
-    unlockq(p_queue);
-
-    sem_post_safe(&p_queue->sem_full);  /* increase filled places */
-
+    p_queue->last_submitted = coarse_time();
     return 0;
-
 }
 
 /**
@@ -176,37 +270,47 @@ int Queue_Insert(entry_queue_t *p_queue, void *entry)
  */
 int Queue_Get(entry_queue_t *p_queue, void **p_ptr)
 {
-    lockq(p_queue);
-    p_queue->nb_thr_waiting++;
-    unlockq(p_queue);
+    unsigned int count;
 
-    sem_wait_safe(&p_queue->sem_full);  /* wait for filled places */
+    return Queue_GetBatch(p_queue, p_ptr, 1, &count);
+}
 
-    lockq(p_queue); /* enters into the critical section */
+int Queue_GetBatch(entry_queue_t *p_queue, void **entries, unsigned int max,
+                   unsigned int *p_count)
+{
+    unsigned int count = 0;
 
-    p_queue->nb_thr_waiting--;
+    if (max == 0)
+        return EINVAL;
 
-    /* The queue should not be empty */
-    if (is_empty(p_queue)) {
+    __sync_fetch_and_add(&p_queue->nb_thr_waiting, 1);
+    sem_wait_safe(&p_queue->sem_full);  /* wait for filled places */
+    __sync_fetch_and_sub(&p_queue->nb_thr_waiting, 1);
 
-        unlockq(p_queue);
-        DisplayLog(LVL_CRIT, QUEUE_TAG,
-                   "UNEXPECTED ERROR: queue should not be empty!");
-        return EFAULT;
-    } else {
-        /* retrieves data into the queue */
-        *p_ptr = p_queue->queue[p_queue->first_index];
-        p_queue->first_index = (p_queue->first_index + 1) % p_queue->array_size;
-    }
+    do {
+        entries[count++] = queue_pop(p_queue);
+        queue_release_slot(p_queue); /* increase free places */
+    } while (count < max && sem_trywait(&p_queue->sem_full) == 0);
 
-    p_queue->last_unqueued = time(NULL);
+    p_queue->last_unqueued = coarse_time();
+    *p_count = count;
+    return 0;
+}
 
-    unlockq(p_queue);
+/**
+ * Get an entry from the queue, if there is one available.
+ * \retval EAGAIN if the queue is empty.
+ */
+int Queue_TryGet(entry_queue_t *p_queue, void **p_ptr)
+{
+    if (sem_trywait(&p_queue->sem_full) != 0)
+        return EAGAIN;
 
-    sem_post_safe(&p_queue->sem_empty); /* increase free places */
+    *p_ptr = queue_pop(p_queue);
+    queue_release_slot(p_queue); /* increase free places */
 
+    p_queue->last_unqueued = coarse_time();
     return 0;
-
 }
 
 /**
@@ -219,28 +323,31 @@ void Queue_Acknowledge(entry_queue_t *p_queue, unsigned int status,
                        unsigned long long *feedback_array,
                        unsigned int feedback_count)
 {
+    unsigned int slot = my_stat_slot();
+    unsigned long long *feedback;
     unsigned int i;
 
-    lockq(p_queue);
-
     if (status >= p_queue->status_count)
         DisplayLog(LVL_CRIT, QUEUE_TAG,
                    "ERROR: status overflow (status=%u, max=%u)", status,
                    p_queue->status_count - 1);
     else
-        p_queue->status_array[status]++;
+        __sync_fetch_and_add(&p_queue->status_array[slot *
+                                p_queue->status_stride + status], 1);
 
     if (feedback_count > p_queue->feedback_count)
         DisplayLog(LVL_CRIT, QUEUE_TAG,
                    "ERROR: feedback_array overflow (feedback_count=%u, max=%u)",
                    feedback_count, p_queue->feedback_count);
 
+    /* the counter set may be shared with other threads if there are
+     * more than QUEUE_STAT_SLOTS of them */
+    feedback = &p_queue->feedback_array[slot * p_queue->feedback_stride];
     for (i = 0; i < MIN2(feedback_count, p_queue->feedback_count); i++)
-        p_queue->feedback_array[i] += feedback_array[i];
-
-    p_queue->last_ack = time(NULL);
+        if (feedback_array[i] != 0)
+            __sync_fetch_and_add(&feedback[i], feedback_array[i]);
 
-    unlockq(p_queue);
+    p_queue->last_ack = coarse_time();
 }
 
 void RetrieveQueueStats(entry_queue_t *p_queue, unsigned int *p_nb_thr_wait,
@@ -249,14 +356,17 @@ void RetrieveQueueStats(entry_queue_t *p_queue, unsigned int *p_nb_thr_wait,
                         unsigned int *status_array,
                         unsigned long long *feedback_array)
 {
-    unsigned int i;
-
-    lockq(p_queue);
+    unsigned int i, j;
 
     if (p_nb_thr_wait)
         *p_nb_thr_wait = p_queue->nb_thr_waiting;
-    if (p_nb_items)
-        *p_nb_items = nb_items(p_queue);
+    if (p_nb_items) {
+        unsigned long head = p_queue->head;
+        unsigned long tail = p_queue->tail;
+
+        /* consumers may have reserved positions that are not filled yet */
+        *p_nb_items = (tail > head) ? (unsigned int)(tail - head) : 0;
+    }
     if (p_last_submitted)
         *p_last_submitted = p_queue->last_submitted;
     if (p_last_unqueued)
@@ -264,13 +374,23 @@ void RetrieveQueueStats(entry_queue_t *p_queue, unsigned int *p_nb_thr_wait,
     if (p_last_ack)
         *p_last_ack = p_queue->last_ack;
 
-    if (status_array)
-        for (i = 0; i < p_queue->status_count; i++)
-            status_array[i] = p_queue->status_array[i];
+    __sync_synchronize();
 
-    if (feedback_array)
-        for (i = 0; i < p_queue->feedback_count; i++)
-            feedback_array[i] = p_queue->feedback_array[i];
+    if (status_array) {
+        for (j = 0; j < p_queue->status_count; j++)
+            status_array[j] = 0;
+        for (i = 0; i < QUEUE_STAT_SLOTS; i++)
+            for (j = 0; j < p_queue->status_count; j++)
+                status_array[j] +=
+                    p_queue->status_array[i * p_queue->status_stride + j];
+    }
 
-    unlockq(p_queue);
+    if (feedback_array) {
+        for (j = 0; j < p_queue->feedback_count; j++)
+            feedback_array[j] = 0;
+        for (i = 0; i < QUEUE_STAT_SLOTS; i++)
+            for (j = 0; j < p_queue->feedback_count; j++)
+                feedback_array[j] +=
+                    p_queue->feedback_array[i * p_queue->feedback_stride + j];
+    }
 }
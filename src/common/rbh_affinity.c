@@ -0,0 +1,297 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * CPU and NUMA placement of thread groups.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_affinity.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#define AFFINITY_TAG "Affinity"
+#define NODE_PREFIX  "node:"
+#define SYSFS_NODE   "/sys/devices/system/node"
+
+/* NUMA topology, loaded once */
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+static unsigned int nb_nodes = 1;
+static cpu_set_t node_cpus[AFFINITY_MAX_NODES];
+static unsigned char cpu_node[CPU_SETSIZE];
+
+typedef void (*list_add_fn)(unsigned int val, void *arg);
+
+/**
+ * Parse a list of values and ranges ("0-3,8,10-11").
+ * @return 0 on success, EINVAL if the list is invalid or a value
+ *         exceeds max.
+ */
+static int parse_list(const char *str, unsigned int max, list_add_fn add,
+                      void *arg)
+{
+    const char *c = str;
+
+    while (*c != '\0') {
+        unsigned long first, last, i;
+        char *end;
+
+        while (isspace(*c))
+            c++;
+        if (!isdigit(*c))
+            return EINVAL;
+        first = last = strtoul(c, &end, 10);
+        c = end;
+        if (*c == '-') {
+            c++;
+            if (!isdigit(*c))
+                return EINVAL;
+            last = strtoul(c, &end, 10);
+            c = end;
+        }
+        while (isspace(*c))
+            c++;
+        if (last < first || last >= max)
+            return EINVAL;
+        if (*c == ',')
+            c++;
+        else if (*c != '\0')
+            return EINVAL;
+
+        if (add != NULL)
+            for (i = first; i <= last; i++)
+                add(i, arg);
+    }
+    return 0;
+}
+
+static void add_cpu(unsigned int cpu, void *arg)
+{
+    cpu_set_t *set = arg;
+
+    CPU_SET(cpu, set);
+}
+
+static void add_node(unsigned int node, void *arg)
+{
+    *(unsigned long long *)arg |= (1ULL << node);
+}
+
+/** read a list from a sysfs file */
+static int read_sysfs_list(const char *path, unsigned int max,
+                           list_add_fn add, void *arg)
+{
+    char buf[4096];
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return errno;
+    if (fgets(buf, sizeof(buf), f) == NULL) {
+        fclose(f);
+        return EIO;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    /* empty list (e.g. memory-only node) */
+    if (EMPTY_STRING(buf))
+        return 0;
+    return parse_list(buf, max, add, arg);
+}
+
+static void topology_load(void)
+{
+    unsigned long long nodes = 0;
+    char path[RBH_PATH_MAX];
+    unsigned int n, cpu;
+
+    if (read_sysfs_list(SYSFS_NODE "/online", AFFINITY_MAX_NODES, add_node,
+                        &nodes) != 0 || nodes == 0)
+        return;     /* not NUMA: single node */
+
+    for (n = 0; n < AFFINITY_MAX_NODES; n++) {
+        if (!(nodes & (1ULL << n)))
+            continue;
+        snprintf(path, sizeof(path), SYSFS_NODE "/node%u/cpulist", n);
+        CPU_ZERO(&node_cpus[n]);
+        if (read_sysfs_list(path, CPU_SETSIZE, add_cpu, &node_cpus[n]) != 0)
+            continue;
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &node_cpus[n]))
+                cpu_node[cpu] = n;
+        if (n + 1 > nb_nodes)
+            nb_nodes = n + 1;
+    }
+}
+
+static inline void topology_init(void)
+{
+    pthread_once(&topo_once, topology_load);
+}
+
+/** get the CPU set of an affinity string */
+static int affinity_parse(const char *str, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+
+    if (!strncmp(str, NODE_PREFIX, strlen(NODE_PREFIX))) {
+        unsigned long long nodes = 0;
+        unsigned int n;
+        int rc;
+
+        rc = parse_list(str + strlen(NODE_PREFIX), AFFINITY_MAX_NODES,
+                        add_node, &nodes);
+        if (rc)
+            return rc;
+
+        topology_init();
+        for (n = 0; n < nb_nodes; n++)
+            if (nodes & (1ULL << n))
+                CPU_OR(set, set, &node_cpus[n]);
+        /* unknown node */
+        if (CPU_COUNT(set) == 0)
+            return EINVAL;
+        return 0;
+    }
+
+    return parse_list(str, CPU_SETSIZE, add_cpu, set);
+}
+
+int affinity_check(const char *str)
+{
+    cpu_set_t set;
+
+    if (EMPTY_STRING(str))
+        return 0;
+    return affinity_parse(str, &set);
+}
+
+int affinity_set_thread(const char *str, const char *group)
+{
+    cpu_set_t set;
+    int rc;
+
+    if (EMPTY_STRING(str))
+        return 0;
+
+    rc = affinity_parse(str, &set);
+    if (rc) {
+        DisplayLog(LVL_CRIT, AFFINITY_TAG, "Invalid CPU affinity '%s' for "
+                   "%s threads", str, group);
+        return rc;
+    }
+
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc)
+        DisplayLog(LVL_MAJOR, AFFINITY_TAG, "Failed to set CPU affinity '%s' "
+                   "of %s thread: %s", str, group, strerror(rc));
+    return rc;
+}
+
+unsigned int numa_node_count(void)
+{
+    topology_init();
+    return nb_nodes;
+}
+
+unsigned int numa_current_node(void)
+{
+    int cpu;
+
+    topology_init();
+    if (nb_nodes == 1)
+        return 0;
+
+    cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return 0;
+    return cpu_node[cpu];
+}
+
+/** append a CPU or node set as a list of ranges */
+static void append_ranges(char *buf, size_t size, size_t *len,
+                          bool (*is_in)(unsigned int, const void *),
+                          const void *arg, unsigned int max)
+{
+    unsigned int i, first;
+    bool first_range = true;
+
+    for (i = 0; i < max; i++) {
+        if (!is_in(i, arg))
+            continue;
+        first = i;
+        while (i + 1 < max && is_in(i + 1, arg))
+            i++;
+        if (*len < size)
+            *len += snprintf(buf + *len, size - *len, first_range ? "%u" :
+                             ",%u", first);
+        if (i > first && *len < size)
+            *len += snprintf(buf + *len, size - *len, "-%u", i);
+        first_range = false;
+    }
+}
+
+static bool cpu_isset(unsigned int cpu, const void *arg)
+{
+    const cpu_set_t *set = arg;
+
+    return CPU_ISSET(cpu, set);
+}
+
+static bool node_isset(unsigned int node, const void *arg)
+{
+    return (*(const unsigned long long *)arg) & (1ULL << node);
+}
+
+void affinity_describe(const char *str, char *buf, size_t size)
+{
+    unsigned long long nodes = 0;
+    cpu_set_t set;
+    size_t len = 0;
+    unsigned int cpu;
+
+    if (EMPTY_STRING(str)) {
+        snprintf(buf, size, "any CPU");
+        return;
+    }
+    if (affinity_parse(str, &set) != 0) {
+        snprintf(buf, size, "invalid");
+        return;
+    }
+
+    topology_init();
+    len = snprintf(buf, size, "cpus ");
+    append_ranges(buf, size, &len, cpu_isset, &set, CPU_SETSIZE);
+
+    if (nb_nodes == 1 || len >= size)
+        return;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &set))
+            nodes |= (1ULL << cpu_node[cpu]);
+    len += snprintf(buf + len, size - len, " (node ");
+    append_ranges(buf, size, &len, node_isset, &nodes, nb_nodes);
+    if (len < size)
+        snprintf(buf + len, size - len, ")");
+}
@@ -21,12 +21,19 @@
 
 #include "rbh_misc.h"
 #include "rbh_logs.h"
+#include "rbh_evloop.h"
 
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #define TAG "ExecCmd"
 
+struct exec_ctx;
+
 /**
  * When executing an external processes, two I/O channels are open on its
  * stdout / stderr streams.  Every time a line is read from these channels
@@ -45,24 +52,29 @@ struct io_chan_arg {
  * termination watcher, stdout watcher, stderr watcher), we need to wait for
  * all of them to complete before calling g_main_loop_quit(). Use custom
  * reference counting for this purpose.
+ * Commands run on the shared event loop (see rbh_evloop.h) have no loop of
+ * their own: their context is released and done_cb is called instead.
  */
 struct exec_ctx {
     GMainLoop    *loop;
     GMainContext *gctx;
     int           ref;
     int           rc;
+    struct io_chan_arg chan_args[2];
+    cmd_done_cb_t done_cb;
+    void         *done_arg;
 };
 
-static inline void ctx_incref(struct exec_ctx *ctx)
-{
-    assert(ctx->ref >= 0);
-    ctx->ref++;
-}
-
 static inline void ctx_decref(struct exec_ctx *ctx)
 {
     assert(ctx->ref > 0);
-    if (--ctx->ref == 0)
+    if (--ctx->ref > 0)
+        return;
+
+    if (ctx->done_cb != NULL) {
+        ctx->done_cb(ctx->done_arg, ctx->rc);
+        g_free(ctx);
+    } else
         g_main_loop_quit(ctx->loop);
 }
 
@@ -190,8 +202,8 @@ static int iochan_null_enc(GIOChannel *chan)
  * g_child_watch_add will bind the source to the "main" main context,
  * g_main_context_get_default(), which is not what we want
  */
-static int g_child_watch_add_tothread(GPid pid,
-                                      GChildWatchFunc function, gpointer data)
+static int g_child_watch_add_toctx(GMainContext *gctx, GPid pid,
+                                   GChildWatchFunc function, gpointer data)
 {
     GSource *source;
     guint id;
@@ -202,15 +214,15 @@ static int g_child_watch_add_tothread(GPid pid,
     source = g_child_watch_source_new(pid);
 
     g_source_set_callback(source, (GSourceFunc) function, data, NULL);
-    id = g_source_attach(source, g_main_context_get_thread_default());
+    id = g_source_attach(source, gctx);
     g_source_unref(source);
 
     return id;
 }
 
-static int g_io_add_watch_tothread(GIOChannel *channel,
-                                   GIOCondition condition,
-                                   GIOFunc func, gpointer user_data)
+static int g_io_add_watch_toctx(GMainContext *gctx, GIOChannel *channel,
+                                GIOCondition condition,
+                                GIOFunc func, gpointer user_data)
 {
     GSource *source;
     guint id;
@@ -221,19 +233,19 @@ static int g_io_add_watch_tothread(GIOChannel *channel,
 
     g_source_set_callback(source, (GSourceFunc) func, user_data, NULL);
 
-    id = g_source_attach(source, g_main_context_get_thread_default());
+    id = g_source_attach(source, gctx);
     g_source_unref(source);
 
     return id;
 }
 
 /**
- * Execute synchronously an external command, read its output and invoke
- * a user-provided filter function on every line of it.
+ * Spawn a command and register its watchers in ctx->gctx.
+ * On success, ctx is released by the last watcher (see ctx_decref).
  */
-int execute_shell_command(char **cmd, parse_cb_t cb_func, void *cb_arg)
+static int spawn_command(char **cmd, parse_cb_t cb_func, void *cb_arg,
+                         struct exec_ctx *ctx)
 {
-    struct exec_ctx     ctx = { 0 };
     GPid                pid;
     GError             *err_desc = NULL;
     GSpawnFlags         flags = G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD;
@@ -243,13 +255,7 @@ int execute_shell_command(char **cmd, parse_cb_t cb_func, void *cb_arg)
     int                 p_stdout;
     int                 p_stderr;
     bool                success;
-    int                 rc = 0;
-
-    ctx.gctx = g_main_context_new();
-    g_main_context_push_thread_default(ctx.gctx);
-    ctx.loop = g_main_loop_new(ctx.gctx, false);
-    ctx.ref = 0;
-    ctx.rc = 0;
+    int                 rc;
 
     DisplayLog(LVL_DEBUG, TAG, "Spawning external command \"%s\"", cmd[0]);
 
@@ -265,32 +271,18 @@ int execute_shell_command(char **cmd, parse_cb_t cb_func, void *cb_arg)
                                        cb_func ? &p_stderr : NULL,  /* STDERR */
                                        &err_desc);
     if (!success) {
-        rc = -ECHILD;
         log_cmd = concat_cmd(cmd);
         DisplayLog(LVL_MAJOR, TAG, "Failed to execute \"%s\": %s",
                    log_cmd, err_desc->message);
         free(log_cmd);
-        goto out_free;
+        g_error_free(err_desc);
+        return -ECHILD;
     }
 
-    /* register a watcher in the loop, thus increase refcount of our exec_ctx */
-    ctx_incref(&ctx);
-    g_child_watch_add_tothread(pid, watch_child_cb, &ctx);
+    /* one reference for the child watcher */
+    ctx->ref = 1;
 
     if (cb_func != NULL) {
-        struct io_chan_arg out_args = {
-            .ident    = STDOUT_FILENO,
-            .cb       = cb_func,
-            .udata    = cb_arg,
-            .exec_ctx = &ctx
-        };
-        struct io_chan_arg err_args = {
-            .ident    = STDERR_FILENO,
-            .cb       = cb_func,
-            .udata    = cb_arg,
-            .exec_ctx = &ctx
-        };
-
         out_chan = g_io_channel_unix_new(p_stdout);
         err_chan = g_io_channel_unix_new(p_stderr);
 
@@ -299,32 +291,149 @@ int execute_shell_command(char **cmd, parse_cb_t cb_func, void *cb_arg)
         g_io_channel_set_close_on_unref(err_chan, true);
 
         if ((rc = iochan_null_enc(out_chan)) ||
-            (rc = iochan_null_enc(err_chan)))
-            goto out_free;
-
-        /* update refcount for the two watchers */
-        ctx_incref(&ctx);
-        ctx_incref(&ctx);
+            (rc = iochan_null_enc(err_chan))) {
+            /* don't read the output, but still reap the child */
+            g_io_channel_unref(out_chan);
+            g_io_channel_unref(err_chan);
+            out_chan = err_chan = NULL;
+            ctx->rc = rc;
+        } else {
+            ctx->chan_args[0] = (struct io_chan_arg) {
+                .ident    = STDOUT_FILENO,
+                .cb       = cb_func,
+                .udata    = cb_arg,
+                .exec_ctx = ctx
+            };
+            ctx->chan_args[1] = (struct io_chan_arg) {
+                .ident    = STDERR_FILENO,
+                .cb       = cb_func,
+                .udata    = cb_arg,
+                .exec_ctx = ctx
+            };
+            /* references for the two watchers */
+            ctx->ref += 2;
+        }
+    }
 
-        g_io_add_watch_tothread(out_chan, G_IO_IN | G_IO_HUP,
-                                readline_cb, &out_args);
-        g_io_add_watch_tothread(err_chan, G_IO_IN | G_IO_HUP,
-                                readline_cb, &err_args);
+    /* all references are taken before the watchers are attached,
+     * as they may run in another thread */
+    if (out_chan != NULL) {
+        g_io_add_watch_toctx(ctx->gctx, out_chan, G_IO_IN | G_IO_HUP,
+                             readline_cb, &ctx->chan_args[0]);
+        g_io_add_watch_toctx(ctx->gctx, err_chan, G_IO_IN | G_IO_HUP,
+                             readline_cb, &ctx->chan_args[1]);
     }
+    g_child_watch_add_toctx(ctx->gctx, pid, watch_child_cb, ctx);
 
-    g_main_loop_run(ctx.loop);
+    return 0;
+}
+
+/** completion of a synchronous command run on the shared loop */
+struct sync_wait {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            done;
+    int             rc;
+};
+
+static void sync_done_cb(void *arg, int rc)
+{
+    struct sync_wait *w = arg;
+
+    P(w->lock);
+    w->rc = rc;
+    w->done = true;
+    pthread_cond_signal(&w->cond);
+    V(w->lock);
+}
+
+/** run a command in a private loop of the calling thread */
+static int execute_private_loop(char **cmd, parse_cb_t cb_func, void *cb_arg)
+{
+    struct exec_ctx     ctx = { 0 };
+    int                 rc;
+
+    ctx.gctx = g_main_context_new();
+    g_main_context_push_thread_default(ctx.gctx);
+    ctx.loop = g_main_loop_new(ctx.gctx, false);
+
+    rc = spawn_command(cmd, cb_func, cb_arg, &ctx);
+    if (rc == 0)
+        g_main_loop_run(ctx.loop);
 
- out_free:
     g_main_loop_unref(ctx.loop);
     g_main_context_pop_thread_default(ctx.gctx);
     g_main_context_unref(ctx.gctx);
 
-    if (err_desc)
-        g_error_free(err_desc);
-
     return rc ? rc : ctx.rc;
 }
 
+/**
+ * Execute synchronously an external command, read its output and invoke
+ * a user-provided filter function on every line of it.
+ * The command is watched by the shared event loop, while the calling thread
+ * waits for its completion (a private loop is only created when called
+ * from the event loop itself).
+ */
+int execute_shell_command(char **cmd, parse_cb_t cb_func, void *cb_arg)
+{
+    struct sync_wait w = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .done = false,
+        .rc = 0
+    };
+    struct exec_ctx *ctx;
+    GMainContext    *gctx;
+    int              rc;
+
+    gctx = evloop_context();
+    if (gctx == NULL || evloop_is_current())
+        return execute_private_loop(cmd, cb_func, cb_arg);
+
+    ctx = g_new0(struct exec_ctx, 1);
+    ctx->gctx = gctx;
+    ctx->done_cb = sync_done_cb;
+    ctx->done_arg = &w;
+
+    rc = spawn_command(cmd, cb_func, cb_arg, ctx);
+    if (rc) {
+        g_free(ctx);
+        return rc;
+    }
+
+    P(w.lock);
+    while (!w.done)
+        pthread_cond_wait(&w.cond, &w.lock);
+    V(w.lock);
+
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.cond);
+    return w.rc;
+}
+
+int execute_shell_command_async(char **cmd, parse_cb_t cb_func, void *cb_arg,
+                                cmd_done_cb_t done_cb, void *done_arg)
+{
+    struct exec_ctx *ctx;
+    GMainContext    *gctx;
+    int              rc;
+
+    gctx = evloop_context();
+    if (gctx == NULL)
+        return -ECHILD;
+
+    ctx = g_new0(struct exec_ctx, 1);
+    ctx->gctx = gctx;
+    ctx->done_cb = done_cb;
+    ctx->done_arg = done_arg;
+
+    rc = spawn_command(cmd, cb_func, cb_arg, ctx);
+    if (rc)
+        g_free(ctx);
+    return rc;
+}
+
 /**
  * Template callback to redirect stderr to robinhood log
  * @param arg (void*)log_level.
@@ -356,3 +465,448 @@ int cb_stderr_to_log(void *arg, char *line, size_t size, int stream)
     DisplayLogFn(lvl, TAG, "%s", line);
     return 0;
 }
+
+/* ---- co-process helpers ----
+ * A helper is a long-lived command. Requests are written to its stdin,
+ * one line per entry: "<id> <request>". The helper answers on its stdout
+ * with "<id> <status>[ <output>]" lines, possibly out of order.
+ * A reader thread per helper dispatches replies to the pending requests,
+ * and redirects helper stderr to the log.
+ * If the helper terminates, its pending requests fail with -EPIPE and a new
+ * helper is started by the next request.
+ */
+struct coproc_req {
+    guint64        id;
+    unsigned int   gen;
+    int            rc;
+    bool           done;
+    GString       *out;
+    cmd_done_cb_t  done_cb;     /* NULL for synchronous requests */
+    void          *done_arg;
+};
+
+struct coproc {
+    char          **cmd;
+    char           *name;       /* command line, for logs */
+
+    pthread_mutex_t lock;       /* protects all fields below */
+    pthread_cond_t  cond;       /* a synchronous request is done */
+    bool            running;
+    unsigned int    gen;        /* incremented when a helper is started */
+    int             in_fd;
+    guint64         next_id;
+    GHashTable     *pending;    /* id -> struct coproc_req */
+
+    /* serializes writes, so the reader thread never waits for a writer */
+    pthread_mutex_t write_lock;
+};
+
+struct coproc_reader_arg {
+    struct coproc *cp;
+    unsigned int   gen;
+    GPid           pid;
+    int            in_fd;
+    int            out_fd;
+    int            err_fd;
+};
+
+static GHashTable     *coproc_registry = NULL;
+static pthread_mutex_t coproc_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct coproc *coproc_get(char **cmd)
+{
+    struct coproc *cp;
+    char *name = concat_cmd(cmd);
+
+    if (name == NULL)
+        return NULL;
+
+    P(coproc_registry_lock);
+    if (coproc_registry == NULL)
+        coproc_registry = g_hash_table_new(g_str_hash, g_str_equal);
+
+    cp = g_hash_table_lookup(coproc_registry, name);
+    if (cp == NULL) {
+        cp = g_new0(struct coproc, 1);
+        cp->cmd = g_strdupv(cmd);
+        cp->name = name;
+        cp->in_fd = -1;
+        cp->pending = g_hash_table_new(g_int64_hash, g_int64_equal);
+        pthread_mutex_init(&cp->lock, NULL);
+        pthread_cond_init(&cp->cond, NULL);
+        pthread_mutex_init(&cp->write_lock, NULL);
+        g_hash_table_insert(coproc_registry, cp->name, cp);
+    } else
+        free(name);
+    V(coproc_registry_lock);
+
+    return cp;
+}
+
+/** complete a request (called with cp->lock held, req removed from table) */
+static void coproc_req_done(struct coproc *cp, struct coproc_req *req, int rc,
+                            GSList **async_done)
+{
+    req->rc = rc;
+    if (req->done_cb != NULL) {
+        /* called after the lock is released */
+        *async_done = g_slist_prepend(*async_done, req);
+    } else {
+        req->done = true;
+        pthread_cond_broadcast(&cp->cond);
+    }
+}
+
+static void coproc_run_callbacks(GSList *async_done)
+{
+    GSList *l;
+
+    for (l = async_done; l != NULL; l = l->next) {
+        struct coproc_req *req = l->data;
+
+        req->done_cb(req->done_arg, req->rc);
+        g_free(req);
+    }
+    g_slist_free(async_done);
+}
+
+/** handle a "<id> <status>[ <output>]" line */
+static void coproc_reply(struct coproc *cp, char *line)
+{
+    struct coproc_req *req;
+    GSList *async_done = NULL;
+    guint64 id;
+    long status;
+    char *next;
+
+    id = g_ascii_strtoull(line, &next, 10);
+    if (next == line || *next != ' ') {
+        DisplayLog(LVL_MAJOR, TAG, "%s: invalid reply '%s'", cp->name, line);
+        return;
+    }
+    line = next + 1;
+    status = strtol(line, &next, 10);
+    if (next == line || (*next != ' ' && *next != '\0')) {
+        DisplayLog(LVL_MAJOR, TAG, "%s: invalid status in reply '%s'",
+                   cp->name, line);
+        return;
+    }
+    if (*next == ' ')
+        next++;
+
+    P(cp->lock);
+    req = g_hash_table_lookup(cp->pending, &id);
+    if (req == NULL) {
+        V(cp->lock);
+        DisplayLog(LVL_MAJOR, TAG, "%s: reply to unknown request #%"
+                   G_GUINT64_FORMAT, cp->name, id);
+        return;
+    }
+    g_hash_table_remove(cp->pending, &id);
+
+    if (req->out != NULL && req->out->len == 0)
+        g_string_append(req->out, next);
+    coproc_req_done(cp, req, (int)status, &async_done);
+    V(cp->lock);
+
+    coproc_run_callbacks(async_done);
+}
+
+/** process the complete lines of a stream buffer */
+static void coproc_parse_lines(struct coproc *cp, GString *buf, int stream)
+{
+    char *eol;
+
+    while ((eol = memchr(buf->str, '\n', buf->len)) != NULL) {
+        *eol = '\0';
+        if (stream == STDOUT_FILENO)
+            coproc_reply(cp, buf->str);
+        else
+            DisplayLog(LVL_EVENT, TAG, "%s: %s", cp->name, buf->str);
+        g_string_erase(buf, 0, eol - buf->str + 1);
+    }
+}
+
+static gboolean coproc_match_gen(gpointer key, gpointer value, gpointer udata)
+{
+    return ((struct coproc_req *)value)->gen == *(unsigned int *)udata;
+}
+
+/** the helper terminated: fail its pending requests */
+static void coproc_terminated(struct coproc_reader_arg *ra)
+{
+    struct coproc *cp = ra->cp;
+    GSList *async_done = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    P(cp->write_lock);
+    P(cp->lock);
+    if (cp->gen == ra->gen) {
+        cp->running = false;
+        cp->in_fd = -1;
+    }
+    V(cp->lock);
+    close(ra->in_fd);
+    V(cp->write_lock);
+
+    P(cp->lock);
+    g_hash_table_iter_init(&iter, cp->pending);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct coproc_req *req = value;
+
+        if (req->gen == ra->gen)
+            coproc_req_done(cp, req, -EPIPE, &async_done);
+    }
+    g_hash_table_foreach_remove(cp->pending, coproc_match_gen, &ra->gen);
+    V(cp->lock);
+
+    coproc_run_callbacks(async_done);
+}
+
+static void *coproc_reader_thr(void *arg)
+{
+    struct coproc_reader_arg *ra = arg;
+    struct pollfd fds[2] = {
+        {.fd = ra->out_fd, .events = POLLIN},
+        {.fd = ra->err_fd, .events = POLLIN},
+    };
+    GString *bufs[2] = { g_string_new(""), g_string_new("") };
+    char buf[4096];
+    const char *msg = "";
+    int status, i;
+
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            DisplayLog(LVL_CRIT, TAG, "%s: poll failed: %s", ra->cp->name,
+                       strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < 2; i++) {
+            ssize_t n;
+
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+
+            n = read(fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                continue;
+            }
+            g_string_append_len(bufs[i], buf, n);
+            /* first stream is stdout, second is stderr */
+            coproc_parse_lines(ra->cp, bufs[i],
+                               i == 0 ? STDOUT_FILENO : STDERR_FILENO);
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+        g_string_free(bufs[i], TRUE);
+    }
+
+    /* close stdin so the helper terminates */
+    coproc_terminated(ra);
+
+    if (waitpid(ra->pid, &status, 0) == ra->pid)
+        child_status2errno(status, &msg);
+    DisplayLog(LVL_MAJOR, TAG, "Co-process '%s' (pid %d) terminated: %s",
+               ra->cp->name, ra->pid, msg);
+    g_spawn_close_pid(ra->pid);
+    g_free(ra);
+    return NULL;
+}
+
+/** start the helper (called with cp->lock held) */
+static int coproc_start(struct coproc *cp)
+{
+    struct coproc_reader_arg *ra;
+    GError *err_desc = NULL;
+    pthread_attr_t attr;
+    pthread_t thread;
+    char **argv;
+    int rc;
+
+    rc = subst_shell_params(cp->cmd, "co-process command", NULL, NULL, NULL,
+                            NULL, NULL, true, &argv);
+    if (rc)
+        return rc;
+
+    ra = g_new0(struct coproc_reader_arg, 1);
+    ra->cp = cp;
+
+    if (!g_spawn_async_with_pipes(NULL, argv, NULL,
+                                  G_SPAWN_SEARCH_PATH
+                                  | G_SPAWN_DO_NOT_REAP_CHILD,
+                                  NULL, NULL, &ra->pid, &ra->in_fd,
+                                  &ra->out_fd, &ra->err_fd, &err_desc)) {
+        DisplayLog(LVL_MAJOR, TAG, "Failed to start co-process \"%s\": %s",
+                   cp->name, err_desc->message);
+        g_error_free(err_desc);
+        g_strfreev(argv);
+        g_free(ra);
+        return -ECHILD;
+    }
+    g_strfreev(argv);
+
+    ra->gen = ++cp->gen;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, coproc_reader_thr, ra);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, TAG, "Failed to start co-process reader "
+                   "thread: %s", strerror(rc));
+        /* closing its stdin makes the helper terminate */
+        close(ra->in_fd);
+        close(ra->out_fd);
+        close(ra->err_fd);
+        waitpid(ra->pid, NULL, 0);
+        g_spawn_close_pid(ra->pid);
+        g_free(ra);
+        return -rc;
+    }
+
+    DisplayLog(LVL_EVENT, TAG, "Started co-process '%s' (pid %d)", cp->name,
+               ra->pid);
+    cp->in_fd = ra->in_fd;
+    cp->running = true;
+    return 0;
+}
+
+/** write a buffer to a pipe, without raising SIGPIPE */
+static int write_nosigpipe(int fd, const char *buf, size_t len)
+{
+    static const struct timespec no_wait = { 0, 0 };
+    sigset_t set, old;
+    int rc = 0;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            rc = -errno;
+            break;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    /* consume the signal raised by the failed write */
+    if (rc == -EPIPE)
+        sigtimedwait(&set, NULL, &no_wait);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+/**
+ * Register and send a request.
+ * @return 0 if the request will be completed (possibly with an error)
+ *         by the reader thread, an error code if it was not sent.
+ */
+static int coproc_send(struct coproc *cp, struct coproc_req *req,
+                       const char *request)
+{
+    char *line;
+    int rc;
+
+    if (strchr(request, '\n') != NULL) {
+        DisplayLog(LVL_MAJOR, TAG, "%s: request '%s' contains a newline",
+                   cp->name, request);
+        return -EINVAL;
+    }
+
+    P(cp->lock);
+    if (!cp->running) {
+        rc = coproc_start(cp);
+        if (rc) {
+            V(cp->lock);
+            return rc;
+        }
+    }
+    req->id = ++cp->next_id;
+    req->gen = cp->gen;
+    g_hash_table_insert(cp->pending, &req->id, req);
+    V(cp->lock);
+
+    line = g_strdup_printf("%" G_GUINT64_FORMAT " %s\n", req->id, request);
+
+    P(cp->write_lock);
+    P(cp->lock);
+    if (cp->running && cp->gen == req->gen) {
+        int fd = cp->in_fd;
+
+        V(cp->lock);
+        rc = write_nosigpipe(fd, line, strlen(line));
+    } else {
+        V(cp->lock);
+        rc = -EPIPE;
+    }
+    V(cp->write_lock);
+    g_free(line);
+
+    if (rc) {
+        bool owned;
+
+        P(cp->lock);
+        /* the reader thread may have already failed the request */
+        owned = g_hash_table_remove(cp->pending, &req->id);
+        V(cp->lock);
+        if (owned) {
+            DisplayLog(LVL_MAJOR, TAG, "%s: failed to send request: %s",
+                       cp->name, strerror(-rc));
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int coproc_call(struct coproc *cp, const char *request, GString *out)
+{
+    struct coproc_req req = { 0 };
+    int rc;
+
+    req.out = out;
+
+    rc = coproc_send(cp, &req, request);
+    if (rc)
+        return rc;
+
+    P(cp->lock);
+    while (!req.done)
+        pthread_cond_wait(&cp->cond, &cp->lock);
+    V(cp->lock);
+
+    return req.rc;
+}
+
+int coproc_call_async(struct coproc *cp, const char *request,
+                      cmd_done_cb_t done_cb, void *done_arg)
+{
+    struct coproc_req *req;
+    int rc;
+
+    req = g_new0(struct coproc_req, 1);
+    req->done_cb = done_cb;
+    req->done_arg = done_arg;
+
+    rc = coproc_send(cp, req, request);
+    if (rc)
+        g_free(req);
+    return rc;
+}
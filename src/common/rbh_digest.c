@@ -0,0 +1,317 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * CRC32C uses the crc32 instruction of SSE4.2 when the CPU supports it,
+ * else a lookup table. SHA-256 is a plain portable implementation
+ * (FIPS 180-4).
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_digest.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+/* ---- CRC32C ---- */
+
+/* reversed Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[256];
+static bool crc32c_hw_ok = false;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_once(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[i] = c;
+    }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    crc32c_hw_ok = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__ ((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    unsigned long long c;
+
+    /* align to 8 bytes */
+    while (len > 0 && ((uintptr_t)p & 7)) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+        len--;
+    }
+
+    c = crc;
+    while (len >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+static uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (crc32c_hw_ok)
+        return crc32c_hw(crc, buf, len);
+#endif
+    return crc32c_sw(crc, buf, len);
+}
+
+/* ---- SHA-256 ---- */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(_x, _n)   (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+static void sha256_block(uint32_t *state, const uint8_t *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    unsigned int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16)
+            | ((uint32_t)p[4 * i + 2] << 8) | (uint32_t)p[4 * i + 3];
+
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18)
+            ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19)
+            ^ (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; i++) {
+        uint32_t s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void sha256_init(struct rbh_digest *d)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(d->u.sha.state, init, sizeof(init));
+    d->u.sha.length = 0;
+    d->u.sha.used = 0;
+}
+
+static void sha256_update(struct rbh_digest *d, const uint8_t *p, size_t len)
+{
+    d->u.sha.length += len;
+
+    if (d->u.sha.used > 0) {
+        size_t n = sizeof(d->u.sha.block) - d->u.sha.used;
+
+        if (n > len)
+            n = len;
+        memcpy(d->u.sha.block + d->u.sha.used, p, n);
+        d->u.sha.used += n;
+        p += n;
+        len -= n;
+
+        if (d->u.sha.used < sizeof(d->u.sha.block))
+            return;
+        sha256_block(d->u.sha.state, d->u.sha.block);
+        d->u.sha.used = 0;
+    }
+
+    while (len >= sizeof(d->u.sha.block)) {
+        sha256_block(d->u.sha.state, p);
+        p += sizeof(d->u.sha.block);
+        len -= sizeof(d->u.sha.block);
+    }
+
+    memcpy(d->u.sha.block, p, len);
+    d->u.sha.used = len;
+}
+
+static void sha256_final(struct rbh_digest *d, uint8_t *out)
+{
+    uint64_t bits = d->u.sha.length * 8;
+    uint8_t *blk = d->u.sha.block;
+    unsigned int i;
+
+    blk[d->u.sha.used++] = 0x80;
+    if (d->u.sha.used > 56) {
+        memset(blk + d->u.sha.used, 0, 64 - d->u.sha.used);
+        sha256_block(d->u.sha.state, blk);
+        d->u.sha.used = 0;
+    }
+    memset(blk + d->u.sha.used, 0, 56 - d->u.sha.used);
+    for (i = 0; i < 8; i++)
+        blk[56 + i] = bits >> (56 - 8 * i);
+    sha256_block(d->u.sha.state, blk);
+
+    for (i = 0; i < 8; i++) {
+        out[4 * i] = d->u.sha.state[i] >> 24;
+        out[4 * i + 1] = d->u.sha.state[i] >> 16;
+        out[4 * i + 2] = d->u.sha.state[i] >> 8;
+        out[4 * i + 3] = d->u.sha.state[i];
+    }
+}
+
+/* ---- generic interface ---- */
+
+digest_type_e str2digest_type(const char *str)
+{
+    if (!strcasecmp(str, "crc32c"))
+        return DIGEST_CRC32C;
+    if (!strcasecmp(str, "sha256"))
+        return DIGEST_SHA256;
+    return DIGEST_NONE;
+}
+
+const char *digest_type2str(digest_type_e type)
+{
+    switch (type) {
+    case DIGEST_CRC32C:
+        return "crc32c";
+    case DIGEST_SHA256:
+        return "sha256";
+    default:
+        return "none";
+    }
+}
+
+void digest_init(struct rbh_digest *d, digest_type_e type)
+{
+    d->type = type;
+
+    switch (type) {
+    case DIGEST_CRC32C:
+        pthread_once(&crc32c_once, crc32c_init_once);
+        d->u.crc = 0xFFFFFFFF;
+        break;
+    case DIGEST_SHA256:
+        sha256_init(d);
+        break;
+    default:
+        break;
+    }
+}
+
+void digest_update(struct rbh_digest *d, const void *buf, size_t len)
+{
+    switch (d->type) {
+    case DIGEST_CRC32C:
+        d->u.crc = crc32c_update(d->u.crc, buf, len);
+        break;
+    case DIGEST_SHA256:
+        sha256_update(d, buf, len);
+        break;
+    default:
+        break;
+    }
+}
+
+void digest_final(struct rbh_digest *d, char *out)
+{
+    uint8_t sha[32];
+    char *curr;
+    unsigned int i;
+
+    switch (d->type) {
+    case DIGEST_CRC32C:
+        snprintf(out, DIGEST_STR_MAX, "crc32c:%08x", d->u.crc ^ 0xFFFFFFFF);
+        break;
+    case DIGEST_SHA256:
+        sha256_final(d, sha);
+        curr = out + sprintf(out, "sha256:");
+        for (i = 0; i < sizeof(sha); i++)
+            curr += sprintf(curr, "%02x", sha[i]);
+        break;
+    default:
+        out[0] = '\0';
+        break;
+    }
+}
@@ -0,0 +1,416 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Shared event loop.
+ *
+ * Timers are one-shot GLib sources, re-armed after each call with the
+ * delay returned by the callback (so periodic tasks follow changes of
+ * their interval in configuration). A timer is referenced by the registry,
+ * by its armed source and by its running callback; it is freed when the
+ * last reference is dropped.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_evloop.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "rbh_prof.h"
+#include "Memory.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define EVLOOP_TAG "EvLoop"
+
+/** max threads running offloaded timers */
+#define EVLOOP_MAX_OFFLOAD  4
+/** offload threads exit after this idle time (seconds) */
+#define EVLOOP_IDLE_TIME    30
+
+struct evtimer {
+    int              id;
+    int              flags;
+    evloop_timer_cb_t cb;
+    void            *arg;
+    /** armed source (NULL while the callback runs) */
+    GSource         *source;
+    unsigned int     ref;
+    bool             removed;
+    bool             running;
+    pthread_t        runner;
+    struct evtimer  *next;      /**< registry */
+    struct evtimer  *next_q;    /**< offload queue */
+};
+
+static pthread_once_t evl_once = PTHREAD_ONCE_INIT;
+
+/* protects everything below */
+static pthread_mutex_t evl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static GMainContext *evl_ctx = NULL;
+static GMainLoop *evl_loop = NULL;
+static pthread_t evl_thread;
+static bool evl_started = false;
+static int evl_init_rc = 0;
+
+/* a callback completed */
+static pthread_cond_t evl_done_cond = PTHREAD_COND_INITIALIZER;
+/* an offloaded timer is queued */
+static pthread_cond_t evl_offload_cond = PTHREAD_COND_INITIALIZER;
+
+static struct evtimer *timers = NULL;
+static int next_timer_id = 1;
+
+static struct evtimer *offload_first = NULL;
+static struct evtimer *offload_last = NULL;
+static unsigned int offload_threads = 0;
+static unsigned int offload_idle = 0;
+
+static struct evloop_stats_t {
+    unsigned long long runs;            /**< timer callbacks */
+    unsigned long long offloaded;       /**< callbacks run by offload
+                                             threads */
+    unsigned long long offload_spawns;  /**< offload threads started */
+} evl_stats = { 0 };
+
+static void *evloop_thr(void *arg)
+{
+    prof_set_role(PROF_ROLE_OTHER, "evloop");
+    g_main_context_push_thread_default(evl_ctx);
+    g_main_loop_run(evl_loop);
+    return NULL;
+}
+
+/* the loop thread does not survive fork(): a new loop is started in the
+ * child at its first use (without the timers of the parent) */
+static void evloop_atfork_child(void)
+{
+    pthread_mutex_init(&evl_lock, NULL);
+    pthread_cond_init(&evl_done_cond, NULL);
+    pthread_cond_init(&evl_offload_cond, NULL);
+
+    evl_started = false;
+    evl_init_rc = 0;
+    timers = NULL;
+    offload_first = offload_last = NULL;
+    offload_threads = offload_idle = 0;
+}
+
+static void evloop_atfork_init(void)
+{
+    pthread_atfork(NULL, NULL, evloop_atfork_child);
+}
+
+/** start the loop thread. evl_lock must be held. */
+static void evloop_start(void)
+{
+    evl_started = true;
+    evl_ctx = g_main_context_new();
+    evl_loop = g_main_loop_new(evl_ctx, false);
+
+    evl_init_rc = pthread_create(&evl_thread, NULL, evloop_thr, NULL);
+    if (evl_init_rc)
+        DisplayLog(LVL_CRIT, EVLOOP_TAG, "Failed to start event loop "
+                   "thread: %s", strerror(evl_init_rc));
+}
+
+GMainContext *evloop_context(void)
+{
+    GMainContext *ctx;
+
+    pthread_once(&evl_once, evloop_atfork_init);
+
+    P(evl_lock);
+    if (!evl_started)
+        evloop_start();
+    ctx = evl_init_rc ? NULL : evl_ctx;
+    V(evl_lock);
+
+    return ctx;
+}
+
+bool evloop_is_current(void)
+{
+    bool current;
+
+    P(evl_lock);
+    current = evl_started && evl_init_rc == 0
+              && pthread_equal(pthread_self(), evl_thread);
+    V(evl_lock);
+
+    return current;
+}
+
+/** drop a reference to a timer. evl_lock must be held. */
+static void timer_put(struct evtimer *t)
+{
+    if (--t->ref == 0)
+        MemFree(t);
+}
+
+/** the armed source of a timer is released */
+static void timer_source_release(gpointer data)
+{
+    P(evl_lock);
+    timer_put(data);
+    V(evl_lock);
+}
+
+static gboolean timer_dispatch(gpointer data);
+
+/** arm the source of a timer. evl_lock must be held. */
+static void timer_arm(struct evtimer *t, unsigned int delay_ms)
+{
+    GSource *src;
+
+    if (delay_ms >= 1000 && delay_ms % 1000 == 0)
+        /* fired together with the other timers of the same second */
+        src = g_timeout_source_new_seconds(delay_ms / 1000);
+    else
+        src = g_timeout_source_new(delay_ms);
+
+    t->ref++;
+    g_source_set_callback(src, timer_dispatch, t, timer_source_release);
+    t->source = src;
+    g_source_attach(src, evl_ctx);
+}
+
+/** unlink a timer from the registry. evl_lock must be held. */
+static void timer_unregister(struct evtimer *t)
+{
+    struct evtimer **curr;
+
+    for (curr = &timers; *curr != NULL; curr = &(*curr)->next) {
+        if (*curr == t) {
+            *curr = t->next;
+            timer_put(t);
+            return;
+        }
+    }
+}
+
+/** a timer callback returned */
+static void timer_done(struct evtimer *t, unsigned int next_ms)
+{
+    P(evl_lock);
+    t->running = false;
+    if (!t->removed) {
+        if (next_ms > 0)
+            timer_arm(t, next_ms);
+        else {
+            t->removed = true;
+            timer_unregister(t);
+        }
+    }
+    pthread_cond_broadcast(&evl_done_cond);
+    /* reference of the running callback */
+    timer_put(t);
+    V(evl_lock);
+}
+
+static void timer_run(struct evtimer *t)
+{
+    unsigned int next_ms;
+
+    next_ms = t->cb(t->arg);
+    timer_done(t, next_ms);
+}
+
+static void *offload_thr(void *arg)
+{
+    prof_set_role(PROF_ROLE_OTHER, "evloop");
+
+    P(evl_lock);
+    for (;;) {
+        struct evtimer *t;
+
+        while (offload_first == NULL) {
+            struct timespec deadline;
+            int rc;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += EVLOOP_IDLE_TIME;
+
+            offload_idle++;
+            rc = pthread_cond_timedwait(&evl_offload_cond, &evl_lock,
+                                        &deadline);
+            offload_idle--;
+
+            if (rc == ETIMEDOUT && offload_first == NULL) {
+                /* idle for too long */
+                offload_threads--;
+                V(evl_lock);
+                return NULL;
+            }
+        }
+
+        t = offload_first;
+        offload_first = t->next_q;
+        if (offload_first == NULL)
+            offload_last = NULL;
+        t->runner = pthread_self();
+        V(evl_lock);
+
+        timer_run(t);
+
+        P(evl_lock);
+    }
+}
+
+/** queue a timer for the offload threads. evl_lock must be held. */
+static void timer_offload(struct evtimer *t)
+{
+    t->next_q = NULL;
+    if (offload_last != NULL)
+        offload_last->next_q = t;
+    else
+        offload_first = t;
+    offload_last = t;
+
+    if (offload_idle > 0) {
+        pthread_cond_signal(&evl_offload_cond);
+    } else if (offload_threads < EVLOOP_MAX_OFFLOAD) {
+        pthread_attr_t attr;
+        pthread_t thread;
+        int rc;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&thread, &attr, offload_thr, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc == 0) {
+            offload_threads++;
+            evl_stats.offload_spawns++;
+        } else if (offload_threads == 0)
+            DisplayLog(LVL_CRIT, EVLOOP_TAG, "Failed to start offload "
+                       "thread: %s", strerror(rc));
+    }
+    /* else: run by the next available thread */
+}
+
+/** a timer expired (called in the loop thread) */
+static gboolean timer_dispatch(gpointer data)
+{
+    struct evtimer *t = data;
+
+    P(evl_lock);
+    if (t->removed || t->source == NULL) {
+        V(evl_lock);
+        return false;
+    }
+    g_source_unref(t->source);
+    t->source = NULL;
+    t->running = true;
+    t->ref++;
+    evl_stats.runs++;
+
+    if (t->flags & EVLOOP_OFFLOAD) {
+        evl_stats.offloaded++;
+        timer_offload(t);
+        V(evl_lock);
+        return false;
+    }
+    t->runner = pthread_self();
+    V(evl_lock);
+
+    timer_run(t);
+    return false;
+}
+
+int evloop_timer_add(unsigned int delay_ms, int flags, evloop_timer_cb_t cb,
+                     void *arg)
+{
+    struct evtimer *t;
+    int id;
+
+    if (evloop_context() == NULL)
+        return -evl_init_rc;
+
+    t = MemCalloc(1, sizeof(*t));
+    if (t == NULL)
+        return -ENOMEM;
+
+    t->flags = flags;
+    t->cb = cb;
+    t->arg = arg;
+    /* reference of the registry */
+    t->ref = 1;
+
+    P(evl_lock);
+    id = t->id = next_timer_id++;
+    t->next = timers;
+    timers = t;
+    timer_arm(t, delay_ms);
+    V(evl_lock);
+
+    return id;
+}
+
+void evloop_timer_remove(int id)
+{
+    struct evtimer *t;
+
+    P(evl_lock);
+    for (t = timers; t != NULL; t = t->next)
+        if (t->id == id)
+            break;
+    if (t == NULL) {
+        V(evl_lock);
+        return;
+    }
+
+    t->removed = true;
+    /* keep it while waiting for its callback */
+    t->ref++;
+    timer_unregister(t);
+
+    if (t->source != NULL) {
+        GSource *src = t->source;
+
+        t->source = NULL;
+        /* the source release takes evl_lock */
+        V(evl_lock);
+        g_source_destroy(src);
+        g_source_unref(src);
+        P(evl_lock);
+    }
+
+    while (t->running && !pthread_equal(t->runner, pthread_self()))
+        pthread_cond_wait(&evl_done_cond, &evl_lock);
+
+    timer_put(t);
+    V(evl_lock);
+}
+
+void evloop_dump_stats(void)
+{
+    struct evloop_stats_t st;
+    unsigned int nb_timers = 0, threads;
+    struct evtimer *t;
+
+    P(evl_lock);
+    st = evl_stats;
+    threads = offload_threads;
+    for (t = timers; t != NULL; t = t->next)
+        nb_timers++;
+    V(evl_lock);
+
+    DisplayLog(LVL_MAJOR, "STATS", "Event loop: %u timers, %llu runs "
+               "(%llu offloaded), offload threads: %u running, %llu started",
+               nb_timers, st.runs, st.offloaded, threads, st.offload_spawns);
+}
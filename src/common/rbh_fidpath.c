@@ -0,0 +1,362 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Cache of directory paths, indexed by directory FID.
+ *
+ * As for the DB path cache (listmgr_path.c), the parent of a cached
+ * directory is always cached (or is the root). Directories missing from the
+ * cache are resolved by walking their linkEA up to a cached ancestor, then
+ * cached top-down. So a renamed or removed directory can only have cached
+ * descendants if it is cached itself, in which case its subtree is dropped.
+ * The whole cache is dropped when it is full.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef _HAVE_FID
+
+#include "rbh_fidpath.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "global_config.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+
+#define FIDPATH_TAG "FidPath"
+
+/* max depth of a path (protection against loops in the namespace) */
+#define MAX_DEPTH   1024
+
+static pthread_mutex_t      fp_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable          *fp_hash = NULL;
+/* incremented when entries are dropped: paths resolved meanwhile are not
+ * cached */
+static unsigned long long   fp_gen = 0;
+
+static unsigned long long   fp_hits = 0;
+static unsigned long long   fp_misses = 0;
+static unsigned long long   fp_linkea = 0;
+static unsigned long long   fp_invalidated = 0;
+
+static guint id_hash(gconstpointer k)
+{
+    const entry_id_t *id = k;
+
+    return (guint)(id->f_seq ^ (id->f_seq >> 32) ^ id->f_oid);
+}
+
+static gboolean id_equal(gconstpointer k1, gconstpointer k2)
+{
+    return entry_id_equal((const entry_id_t *)k1, (const entry_id_t *)k2);
+}
+
+/** fp_lock must be held */
+static bool cache_enabled(void)
+{
+    if (global_config.fid_path_cache_size == 0)
+        return false;
+
+    if (fp_hash == NULL)
+        fp_hash = g_hash_table_new_full(id_hash, id_equal, g_free, g_free);
+    return true;
+}
+
+/** fp_lock must be held */
+static bool cache_get(const entry_id_t *p_id, char *path, size_t size)
+{
+    const char *cached;
+
+    if (entry_id_equal(p_id, get_root_id())) {
+        rh_strncpy(path, get_mount_point(NULL), size);
+        return true;
+    }
+
+    cached = g_hash_table_lookup(fp_hash, p_id);
+    if (cached == NULL)
+        return false;
+
+    rh_strncpy(path, cached, size);
+    return true;
+}
+
+/** fp_lock must be held */
+static void cache_insert(const entry_id_t *p_id, const char *path,
+                         unsigned long long gen)
+{
+    entry_id_t *key;
+
+    if (fp_gen != gen)
+        return;
+
+    /* start over: the inserted entry would not have its parent cached */
+    if (g_hash_table_size(fp_hash) >= global_config.fid_path_cache_size) {
+        g_hash_table_remove_all(fp_hash);
+        fp_gen++;
+        return;
+    }
+
+    key = g_new(entry_id_t, 1);
+    *key = *p_id;
+    g_hash_table_insert(fp_hash, key, g_strdup(path));
+}
+
+/** append "/name" to a path */
+static int path_append(char *path, size_t size, const char *name)
+{
+    size_t len = strlen(path);
+
+    /* the mount point may end with a slash */
+    if (len > 0 && path[len - 1] == '/')
+        len--;
+
+    if (len + 1 + strlen(name) >= size)
+        return -ENAMETOOLONG;
+
+    path[len] = '/';
+    strcpy(path + len + 1, name);
+    return 0;
+}
+
+/** get the parent and name of an entry from its linkEA */
+static int get_name_parent(const entry_id_t *p_id, entry_id_t *parent,
+                           char **name)
+{
+    char fid_path[RBH_PATH_MAX];
+    char buff[RBH_NAME_MAX];
+    int rc;
+
+    BuildFidPath(p_id, fid_path);
+    rc = Lustre_GetNameParent(fid_path, 0, parent, buff, sizeof(buff));
+    if (rc)
+        return rc;
+
+    *name = strdup(buff);
+    if (*name == NULL)
+        return -ENOMEM;
+    return 0;
+}
+
+/** resolve a directory missing from the cache, and cache its path */
+static int dir_walk(const entry_id_t *dir_id, char *path, size_t size,
+                    unsigned long long gen)
+{
+    entry_id_t         *ids;
+    char              **names;
+    entry_id_t          cur = *dir_id;
+    unsigned int        depth = 0, linkea = 0, i;
+    int                 rc = 0;
+
+    ids = MemCalloc(MAX_DEPTH, sizeof(*ids));
+    names = MemCalloc(MAX_DEPTH, sizeof(*names));
+    if (ids == NULL || names == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    for (;;) {
+        entry_id_t parent;
+        bool found = false;
+
+        if (depth > 0) {
+            P(fp_lock);
+            found = cache_get(&cur, path, size);
+            V(fp_lock);
+        }
+        if (found)
+            break;
+
+        if (depth >= MAX_DEPTH) {
+            DisplayLog(LVL_MAJOR, FIDPATH_TAG, "Path of "DFID" is deeper "
+                       "than %u levels: loop in namespace?", PFID(dir_id),
+                       MAX_DEPTH);
+            rc = -ELOOP;
+            goto out;
+        }
+
+        linkea++;
+        rc = get_name_parent(&cur, &parent, &names[depth]);
+        if (rc)
+            goto out;
+        ids[depth] = cur;
+        depth++;
+        cur = parent;
+    }
+
+    /* 'path' is the path of the first cached ancestor:
+     * build and cache the paths down to the directory */
+    P(fp_lock);
+    for (i = depth; i-- > 0;) {
+        rc = path_append(path, size, names[i]);
+        if (rc)
+            break;
+        cache_insert(&ids[i], path, gen);
+    }
+    V(fp_lock);
+
+out:
+    P(fp_lock);
+    fp_linkea += linkea;
+    V(fp_lock);
+
+    if (names != NULL) {
+        for (i = 0; i < depth; i++)
+            free(names[i]);
+        MemFree(names);
+    }
+    if (ids != NULL)
+        MemFree(ids);
+    return rc;
+}
+
+/**
+ * Get the path of a directory.
+ * @param[out] cached  the directory is in the cache when returning.
+ */
+static int dir_lookup(const entry_id_t *dir_id, char *path, size_t size,
+                      bool *cached)
+{
+    unsigned long long gen;
+    int rc;
+
+    *cached = false;
+
+    P(fp_lock);
+    if (!cache_enabled()) {
+        V(fp_lock);
+        return Lustre_GetFullPath(dir_id, path, size);
+    }
+    gen = fp_gen;
+    if (cache_get(dir_id, path, size)) {
+        fp_hits++;
+        V(fp_lock);
+        *cached = true;
+        return 0;
+    }
+    fp_misses++;
+    V(fp_lock);
+
+    rc = dir_walk(dir_id, path, size, gen);
+    if (rc == 0) {
+        *cached = true;
+        return 0;
+    }
+
+    if (rc != -ENOENT)
+        DisplayLog(LVL_DEBUG, FIDPATH_TAG, "Could not resolve the path of "
+                   DFID" from its linkEA (%s): calling fid2path",
+                   PFID(dir_id), strerror(-rc));
+    return Lustre_GetFullPath(dir_id, path, size);
+}
+
+int fidpath_dir_lookup(const entry_id_t *dir_id, char *path, size_t size)
+{
+    bool cached;
+
+    return dir_lookup(dir_id, path, size, &cached);
+}
+
+int fidpath_child_path(const entry_id_t *parent_id, const char *name,
+                       const entry_id_t *child_dir, char *path, size_t size)
+{
+    unsigned long long gen;
+    bool cached;
+    int rc;
+
+    P(fp_lock);
+    gen = fp_gen;
+    V(fp_lock);
+
+    rc = dir_lookup(parent_id, path, size, &cached);
+    if (rc)
+        return rc;
+    rc = path_append(path, size, name);
+    if (rc)
+        return rc;
+
+    /* only cached if its parent is */
+    if (child_dir != NULL && cached) {
+        P(fp_lock);
+        cache_insert(child_dir, path, gen);
+        V(fp_lock);
+    }
+    return 0;
+}
+
+struct prefix {
+    const char *str;
+    size_t      len;
+};
+
+static gboolean is_below(gpointer key, gpointer value, gpointer arg)
+{
+    const struct prefix *pfx = arg;
+    const char *path = value;
+
+    return !strncmp(path, pfx->str, pfx->len) && path[pfx->len] == '/';
+}
+
+void fidpath_invalidate(const entry_id_t *p_id)
+{
+    struct prefix pfx;
+    char *cached;
+
+    P(fp_lock);
+    if (fp_hash == NULL)
+        goto out;
+
+    /* a walk may be resolving a path through this entry */
+    fp_gen++;
+
+    cached = g_hash_table_lookup(fp_hash, p_id);
+    if (cached == NULL)
+        goto out;
+
+    /* take the path before the entry is freed */
+    cached = g_strdup(cached);
+    g_hash_table_remove(fp_hash, p_id);
+
+    pfx.str = cached;
+    pfx.len = strlen(cached);
+    fp_invalidated += 1 + g_hash_table_foreach_remove(fp_hash, is_below,
+                                                      &pfx);
+    g_free(cached);
+out:
+    V(fp_lock);
+}
+
+void fidpath_dump_stats(void)
+{
+    unsigned long long total;
+
+    P(fp_lock);
+    if (fp_hash == NULL) {
+        V(fp_lock);
+        return;
+    }
+    total = fp_hits + fp_misses;
+    DisplayLog(LVL_MAJOR, "STATS", "FID path cache: %u/%u directories, "
+               "hit ratio: %.1f%% (%llu/%llu), linkEA lookups: %llu, "
+               "invalidated: %llu", g_hash_table_size(fp_hash),
+               global_config.fid_path_cache_size,
+               total ? 100.0 * fp_hits / total : 0.0, fp_hits, total,
+               fp_linkea, fp_invalidated);
+    V(fp_lock);
+}
+
+#endif
@@ -0,0 +1,180 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * String interning.
+ *
+ * Open addressing hash table of strings, with lock-free readers: slots only
+ * change from NULL to a string, and writers are serialized by a mutex.
+ * When the table grows, the old one is not freed as it may still be read.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_intern.h"
+#include "RW_Lock.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* initial number of slots (power of 2) */
+#define INTERN_INIT_SLOTS 1024
+
+struct intern_str {
+    unsigned int hash;
+    unsigned int len;
+    /* 8 bytes aligned */
+    char         str[];
+};
+
+struct intern_table {
+    unsigned int                  mask;   /* slot count - 1 */
+    struct intern_str *volatile   slots[];
+};
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct intern_table *volatile intern_table = NULL;
+static unsigned int intern_count = 0;
+
+static inline unsigned int str_hash(const char *str, unsigned int *len)
+{
+    /* FNV-1a */
+    unsigned int h = 2166136261U;
+    const char *c;
+
+    for (c = str; *c != '\0'; c++)
+        h = (h ^ (unsigned char)*c) * 16777619U;
+    *len = c - str;
+    return h;
+}
+
+static struct intern_table *table_new(unsigned int slots)
+{
+    struct intern_table *t;
+
+    t = calloc(1, sizeof(*t) + slots * sizeof(t->slots[0]));
+    if (t != NULL)
+        t->mask = slots - 1;
+    return t;
+}
+
+/** @return the slot of str, or the free slot where it must be inserted */
+static struct intern_str *volatile *table_slot(struct intern_table *t,
+                                               const char *str,
+                                               unsigned int hash,
+                                               unsigned int len)
+{
+    unsigned int i;
+
+    /* tables are never full */
+    for (i = hash & t->mask;; i = (i + 1) & t->mask) {
+        struct intern_str *s = t->slots[i];
+
+        if (s == NULL || (s->hash == hash && s->len == len
+                          && !memcmp(s->str, str, len)))
+            return &t->slots[i];
+    }
+}
+
+/** double the size of the table, called with intern_lock */
+static void table_grow(void)
+{
+    struct intern_table *old = intern_table;
+    struct intern_table *new;
+    unsigned int i;
+
+    new = table_new(2 * (old->mask + 1));
+    if (new == NULL)
+        /* keep the current table, with a higher load */
+        return;
+
+    for (i = 0; i <= old->mask; i++) {
+        struct intern_str *s = old->slots[i];
+
+        if (s != NULL)
+            *table_slot(new, s->str, s->hash, s->len) = s;
+    }
+
+    __sync_synchronize();
+    intern_table = new;
+    /* the old table may be in use by readers: it is not freed */
+}
+
+const char *str_intern_lookup(const char *str)
+{
+    struct intern_table *t = intern_table;
+    struct intern_str *s;
+    unsigned int hash, len;
+
+    if (t == NULL)
+        return NULL;
+
+    hash = str_hash(str, &len);
+    s = *table_slot(t, str, hash, len);
+    return s != NULL ? s->str : NULL;
+}
+
+const char *str_intern(const char *str)
+{
+    struct intern_str *volatile *slot;
+    struct intern_str *s;
+    unsigned int hash, len;
+
+    s = NULL;
+    hash = str_hash(str, &len);
+    if (intern_table != NULL) {
+        s = *table_slot(intern_table, str, hash, len);
+        if (s != NULL)
+            return s->str;
+    }
+
+    P(intern_lock);
+    if (intern_table == NULL) {
+        intern_table = table_new(INTERN_INIT_SLOTS);
+        if (intern_table == NULL)
+            goto out_unlock;
+    }
+
+    /* check again, it may have been inserted in the meantime */
+    slot = table_slot(intern_table, str, hash, len);
+    s = *slot;
+    if (s != NULL)
+        goto out_unlock;
+
+    s = malloc(sizeof(*s) + len + 1);
+    if (s == NULL)
+        goto out_unlock;
+    s->hash = hash;
+    s->len = len;
+    memcpy(s->str, str, len + 1);
+
+    /* make the string visible before the slot */
+    __sync_synchronize();
+    *slot = s;
+    intern_count++;
+
+    /* keep a load factor below 1/2 */
+    if (2 * intern_count > intern_table->mask + 1)
+        table_grow();
+
+ out_unlock:
+    V(intern_lock);
+    return s != NULL ? s->str : NULL;
+}
+
+unsigned int str_intern_count(void)
+{
+    return intern_count;
+}
@@ -105,7 +105,8 @@ typedef struct alert_type {
     char            title[MAIL_TITLE_MAX];
     char          **entries;
     char          **info;
-    unsigned int    count;
+    unsigned int    count;      /* number of listed entries */
+    unsigned int    total;      /* number of alerts (listed or not) */
 
     /* estimated size for mail (not perfectly accurate: add margins to be
      * safe) */
@@ -118,6 +119,53 @@ alert_type_t *alert_list = NULL;
 bool alert_batching = false;
 unsigned int alert_count = 0;
 
+/* alert mails sent in the current hour (protected by alert_mutex) */
+static time_t       mail_window_start = 0;
+static unsigned int mail_window_count = 0;
+
+/* alert digest thread (see alert_digest_interval) */
+static pthread_cond_t digest_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t digest_once = PTHREAD_ONCE_INIT;
+static bool           digest_flush_now = false;
+
+/* Asynchronous logging (async_log = yes): each thread formats its log lines
+ * into its own ring buffer, and a single writer thread batches the writes to
+ * log files and syslog. Lines are dropped (and counted) when a ring is full.
+ */
+
+/* size of the ring of each thread */
+#define ASYNC_RING_SIZE         (64 * 1024)
+/* max delay before a line is written (ms) */
+#define ASYNC_WRITE_PERIOD_MS   100
+
+/* record header in a ring (followed by the line, without final '\0') */
+typedef struct async_rec {
+    struct _log_stream_ *stream;
+    unsigned int         len;
+} async_rec_t;
+
+typedef struct async_ring {
+    volatile uint64_t  head;    /* only moved by the owner thread */
+    volatile uint64_t  tail;    /* only moved by holders of async_mutex */
+    volatile bool      orphan;  /* the owner thread has exited */
+    struct async_ring *next;
+    char               buf[ASYNC_RING_SIZE];
+} async_ring_t;
+
+/* protects the ring list and serializes the consumers of the rings */
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  async_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t  async_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   async_key;
+static async_ring_t   *async_rings = NULL;
+static volatile bool   async_writer_up = false;
+
+/* number of dropped lines, and last reported value (under async_mutex) */
+static volatile unsigned long long async_dropped = 0;
+static unsigned long long  async_dropped_reported = 0;
+
+static void async_drain(void);
+
 /* log line headers */
 static char prog_name[RBH_PATH_MAX];
 static char machine_name[RBH_PATH_MAX];
@@ -347,11 +395,6 @@ int InitializeLogs(const char *program_name)
 
 }   /* InitializeLogs */
 
-int TestDisplayLevel(log_level level)
-{
-    return (log_config.debug_level >= level);
-}
-
 /* flush a single log descriptor */
 static void flush_log_descr(log_stream_t *p_log)
 {
@@ -370,6 +413,13 @@ void FlushLogs(void)
 {
     log_init_check();
 
+    /* write the pending asynchronous lines */
+    if (async_writer_up) {
+        P(async_mutex);
+        async_drain();
+        V(async_mutex);
+    }
+
     flush_log_descr(&log);
     flush_log_descr(&report);
     flush_log_descr(&alert);
@@ -466,6 +516,315 @@ static void clean_str(char *str)
     }
 }
 
+/** write the header of a log file line, returns its length */
+static int log_line_header(char *line_log, time_t now, unsigned int th,
+                           const char *tag)
+{
+    struct tm date;
+
+    localtime_r(&now, &date);
+
+    return snprintf(line_log, MAX_LINE_LEN,
+                    "%.4d/%.2d/%.2d %.2d:%.2d:%.2d %s%s%s[%lu/%u] %s%s",
+                    1900 + date.tm_year, date.tm_mon + 1, date.tm_mday,
+                    date.tm_hour, date.tm_min, date.tm_sec,
+                    log_config.log_process ? prog_name : "",
+                    log_config.log_host ? "@" : "",
+                    log_config.log_host ? machine_name : "",
+                    (unsigned long)getpid(), th,
+                    tag ? tag : "", tag ? " | " : "");
+}
+
+/* copy data to/from a ring at the given position, taking care of the wrap */
+static void ring_write(async_ring_t *r, uint64_t pos, const void *data,
+                       unsigned int len)
+{
+    unsigned int off = pos % ASYNC_RING_SIZE;
+    unsigned int n = MIN(len, ASYNC_RING_SIZE - off);
+
+    memcpy(r->buf + off, data, n);
+    memcpy(r->buf, (const char *)data + n, len - n);
+}
+
+static void ring_read(const async_ring_t *r, uint64_t pos, void *data,
+                      unsigned int len)
+{
+    unsigned int off = pos % ASYNC_RING_SIZE;
+    unsigned int n = MIN(len, ASYNC_RING_SIZE - off);
+
+    memcpy(data, r->buf + off, n);
+    memcpy((char *)data + n, r->buf, len - n);
+}
+
+/** write a line taken from a ring */
+static void async_write_line(log_stream_t *p_log, const char *line)
+{
+    pthread_rwlock_rdlock(&p_log->f_lock);
+    if (p_log->log_type == RBH_LOG_SYSLOG)
+        syslog(log_config.syslog_priority, "%s", line);
+    else
+        fprintf(p_log->f_log != NULL ? p_log->f_log : stderr, "%s\n", line);
+    pthread_rwlock_unlock(&p_log->f_lock);
+}
+
+/** Write the contents of all rings, then flush the streams.
+ * Called with async_mutex held. */
+static void async_drain(void)
+{
+    char line_log[MAX_LINE_LEN + 64];
+    async_ring_t **pr = &async_rings;
+    bool wrote_log = false;
+#ifdef HAVE_CHANGELOGS
+    bool wrote_chglogs = false;
+#endif
+    unsigned long long dropped;
+
+    while (*pr != NULL) {
+        async_ring_t *r = *pr;
+        uint64_t tail = r->tail;
+        uint64_t head = r->head;
+
+        /* read the records after the head was published */
+        __sync_synchronize();
+
+        while (tail != head) {
+            async_rec_t rec;
+
+            ring_read(r, tail, &rec, sizeof(rec));
+            ring_read(r, tail + sizeof(rec), line_log, rec.len);
+            line_log[rec.len] = '\0';
+            tail += sizeof(rec) + rec.len;
+
+            async_write_line(rec.stream, line_log);
+#ifdef HAVE_CHANGELOGS
+            if (rec.stream == &chglogs)
+                wrote_chglogs = true;
+            else
+#endif
+                wrote_log = true;
+        }
+        /* release the space once the records were read */
+        __sync_synchronize();
+        r->tail = tail;
+
+        if (r->orphan && r->head == tail) {
+            *pr = r->next;
+            free(r);
+        } else
+            pr = &r->next;
+    }
+
+    dropped = async_dropped;
+    if (dropped != async_dropped_reported) {
+        int written = 0;
+
+        if (log.log_type != RBH_LOG_SYSLOG)
+            written = log_line_header(line_log, time(NULL), GetThreadIndex(),
+                                      "Log");
+        snprintf(line_log + written, MAX_LINE_LEN - written,
+                 "%s%llu log lines dropped (async log buffer full)",
+                 log.log_type == RBH_LOG_SYSLOG ? "Log | " : "",
+                 dropped - async_dropped_reported);
+        async_write_line(&log, line_log);
+        async_dropped_reported = dropped;
+        wrote_log = true;
+    }
+
+    /* one flush for the whole batch */
+    if (wrote_log)
+        flush_log_descr(&log);
+#ifdef HAVE_CHANGELOGS
+    if (wrote_chglogs)
+        flush_log_descr(&chglogs);
+#endif
+}
+
+static void *async_writer_thr(void *arg)
+{
+    struct timespec deadline;
+
+    P(async_mutex);
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ASYNC_WRITE_PERIOD_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&async_cond, &async_mutex, &deadline);
+        async_drain();
+    }
+    return NULL;
+}
+
+/* the ring of an exiting thread is freed by the writer, once drained */
+static void async_ring_release(void *arg)
+{
+    async_ring_t *r = arg;
+
+    r->orphan = true;
+}
+
+/* write pending lines at exit */
+static void async_exit(void)
+{
+    P(async_mutex);
+    async_drain();
+    V(async_mutex);
+}
+
+/* the writer does not survive fork() (e.g. daemon()): restart it in the
+ * child, which inherits the pending lines */
+static void async_atfork_child(void)
+{
+    pthread_mutex_init(&async_mutex, NULL);
+    async_writer_up = false;
+}
+
+static void async_init(void)
+{
+    pthread_key_create(&async_key, async_ring_release);
+    atexit(async_exit);
+    pthread_atfork(NULL, NULL, async_atfork_child);
+}
+
+/** start the writer thread if it is not running.
+ * @return false if it could not be started. */
+static bool async_check_writer(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc = 0;
+
+    if (async_writer_up)
+        return true;
+
+    pthread_once(&async_once, async_init);
+
+    P(async_mutex);
+    if (!async_writer_up) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&thread, &attr, async_writer_thr, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc == 0)
+            async_writer_up = true;
+    }
+    V(async_mutex);
+
+    if (rc) {
+        log_config.async_log = false;
+        DisplayLog(LVL_CRIT, "Log", "Failed to start log writer thread: %s. "
+                   "Switching to synchronous logging.", strerror(rc));
+        return false;
+    }
+    return true;
+}
+
+/** get the ring of the current thread (allocate it at first call) */
+static async_ring_t *async_get_ring(void)
+{
+    async_ring_t *r = pthread_getspecific(async_key);
+
+    if (r != NULL)
+        return r;
+
+    r = malloc(sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->head = r->tail = 0;
+    r->orphan = false;
+
+    P(async_mutex);
+    r->next = async_rings;
+    async_rings = r;
+    V(async_mutex);
+
+    pthread_setspecific(async_key, r);
+    return r;
+}
+
+/** append a line to the ring of the current thread */
+static void async_push(log_stream_t *p_log, const char *line,
+                       unsigned int len)
+{
+    async_ring_t *r = async_get_ring();
+    async_rec_t rec = {.stream = p_log, .len = len };
+    uint64_t head, used;
+
+    if (r == NULL) {
+        __sync_fetch_and_add(&async_dropped, 1);
+        return;
+    }
+
+    head = r->head;
+    used = head - r->tail;
+    /* don't overwrite the space before the writer is done with it */
+    __sync_synchronize();
+
+    if (used + sizeof(rec) + len > ASYNC_RING_SIZE) {
+        __sync_fetch_and_add(&async_dropped, 1);
+        pthread_cond_signal(&async_cond);
+        return;
+    }
+
+    ring_write(r, head, &rec, sizeof(rec));
+    ring_write(r, head + sizeof(rec), line, len);
+    /* publish the record before moving the head */
+    __sync_synchronize();
+    r->head = head + sizeof(rec) + len;
+
+    /* wake up the writer before the ring is full */
+    if (used + sizeof(rec) + len > ASYNC_RING_SIZE / 2)
+        pthread_cond_signal(&async_cond);
+}
+
+/** Format a line to the ring of the current thread.
+ * The main log and the changelog dump are asynchronous. Reports and alerts
+ * are always written synchronously, so they are never dropped. */
+static bool display_line_async(log_stream_t *p_log, const char *tag,
+                               const char *format, va_list arglist,
+                               time_t now, unsigned int th)
+{
+    char line_log[MAX_LINE_LEN + 64];
+    int  written = 0;
+    int  would_print;
+    unsigned int len;
+
+    if (p_log != &log
+#ifdef HAVE_CHANGELOGS
+        && p_log != &chglogs
+#endif
+        )
+        return false;
+
+    if (!async_check_writer())
+        return false;
+
+    if (p_log->log_type == RBH_LOG_SYSLOG) {
+        if (tag)
+            written = snprintf(line_log, MAX_LINE_LEN, "%s | ", tag);
+    } else
+        written = log_line_header(line_log, now, th, tag);
+
+    would_print = vsnprintf(line_log + written, MAX_LINE_LEN - written,
+                            format, arglist);
+    if (would_print < 0)
+        would_print = 0;
+    if (p_log->log_type != RBH_LOG_SYSLOG)
+        clean_str(line_log);
+
+    if (would_print >= MAX_LINE_LEN - written)
+        len = MAX_LINE_LEN - 1
+            + snprintf(line_log + MAX_LINE_LEN - 1, 64,
+                       "... <Line truncated. Original size=%u>", would_print);
+    else
+        len = written + would_print;
+
+    async_push(p_log, line_log, len);
+    return true;
+}
+
 static void display_line_log(log_stream_t *p_log, const char *tag,
                              const char *format, va_list arglist)
 {
@@ -484,6 +843,10 @@ static void display_line_log(log_stream_t *p_log, const char *tag,
         }
     }
 
+    if (log_initialized && log_config.async_log
+        && display_line_async(p_log, tag, format, arglist, now, th))
+        return;
+
     pthread_rwlock_rdlock(&p_log->f_lock);
     /* if logs are not initalized or the log is a NULL FILE*,
      * default logging to stderr */
@@ -520,18 +883,7 @@ static void display_line_log(log_stream_t *p_log, const char *tag,
         vsyslog(log_config.syslog_priority, new_format, arglist);
     } else {    /* log to a file */
 
-        localtime_r(&now, &date);
-
-        written =
-            snprintf(line_log, MAX_LINE_LEN,
-                     "%.4d/%.2d/%.2d %.2d:%.2d:%.2d %s%s%s[%lu/%u] %s%s",
-                     1900 + date.tm_year, date.tm_mon + 1, date.tm_mday,
-                     date.tm_hour, date.tm_min, date.tm_sec,
-                     log_config.log_process ? prog_name : "",
-                     log_config.log_host ? "@" : "",
-                     log_config.log_host ? machine_name : "",
-                     (unsigned long)getpid(), th,
-                     tag ? tag : "", tag ? " | " : "");
+        written = log_line_header(line_log, now, th, tag);
 
         would_print =
             vsnprintf(line_log + written, MAX_LINE_LEN - written, format,
@@ -581,6 +933,14 @@ void vDisplayLogFn(log_level debug_level, const char *tag, const char *format,
     if (log_config.debug_level >= debug_level) {
         display_line_log(&log, tag, format, ap);
 
+        /* the writer thread flushes each batch: just wake it up for major
+         * errors */
+        if (log_config.async_log) {
+            if (debug_level <= LVL_MAJOR)
+                pthread_cond_signal(&async_cond);
+            return;
+        }
+
         /* test if it's time to flush.
          * Also flush major errors, to display it immediately. */
         if ((now - last_time_flush_log) > TIME_FLUSH_LOG
@@ -637,6 +997,29 @@ void Alert_StartBatching()
  * release mutex ASAP if release_mutex_asap is true,
  * else: don't release it.
  */
+/**
+ * Check the hourly limit of alert mails, and account a new mail.
+ * Must be called under the protection of alert_mutex.
+ */
+static bool alert_mail_allowed(void)
+{
+    time_t now;
+
+    if (log_config.alert_mail_max == 0)
+        return true;
+
+    now = time(NULL);
+    if (now - mail_window_start >= 3600) {
+        mail_window_start = now;
+        mail_window_count = 0;
+    }
+    if (mail_window_count >= log_config.alert_mail_max)
+        return false;
+
+    mail_window_count++;
+    return true;
+}
+
 static void FlushAlerts(bool release_mutex_asap)
 {
     alert_type_t   *pcurr;
@@ -646,6 +1029,7 @@ static void FlushAlerts(bool release_mutex_asap)
     GString        *contents = NULL;
     time_t          now;
     struct tm       date;
+    bool            send_mail = false;
 
     /* first list scan, to determine the number of alerts, etc... */
     for (pcurr = alert_list; pcurr != NULL; pcurr = pcurr->next) {
@@ -659,6 +1043,21 @@ static void FlushAlerts(bool release_mutex_asap)
         return;
     }
 
+    if (!EMPTY_STRING(log_config.alert_mail)) {
+        send_mail = alert_mail_allowed();
+
+        /* the digest thread will send them later */
+        if (!send_mail && log_config.alert_digest_interval > 0) {
+            if (release_mutex_asap)
+                V(alert_mutex);
+            return;
+        }
+        if (!send_mail)
+            DisplayLog(LVL_MAJOR, "Alert", "Max number of alert mails per "
+                       "hour reached (%u): %u alerts not sent by mail",
+                       log_config.alert_mail_max, alert_count);
+    }
+
     now = time(NULL);
     localtime_r(&now, &date);
 
@@ -680,7 +1079,7 @@ static void FlushAlerts(bool release_mutex_asap)
     g_string_append_printf(contents, "%u alerts:\n", alert_count);
 
     for (pcurr = alert_list; pcurr != NULL; pcurr = pcurr->next) {
-        g_string_append_printf(contents, "\t* %u %s\n", pcurr->count,
+        g_string_append_printf(contents, "\t* %u %s\n", pcurr->total,
                                pcurr->title);
     }
 
@@ -689,6 +1088,9 @@ static void FlushAlerts(bool release_mutex_asap)
 
         g_string_append_printf(contents, "\n==== alert '%s' ====\n\n",
                                pcurr->title);
+        if (pcurr->total > pcurr->count)
+            g_string_append_printf(contents, "(%u first entries of %u)\n\n",
+                                   pcurr->count, pcurr->total);
 
         for (i = 0; i < pcurr->count; i++) {
             /* print and free */
@@ -722,7 +1124,7 @@ static void FlushAlerts(bool release_mutex_asap)
         V(alert_mutex);
 
     /* send the mail and/or write the alert in alert file */
-    if (!EMPTY_STRING(log_config.alert_mail))
+    if (send_mail)
         SendMail(log_config.alert_mail, title, contents->str);
 
     if (!EMPTY_STRING(log_config.alert_file)) {
@@ -779,9 +1181,10 @@ static void Alert_Add(const char *title, const char *entry, const char *info)
         if (!pcurr)
             goto out_unlock;
 
-        strcpy(pcurr->title, title);
+        rh_strncpy(pcurr->title, title, sizeof(pcurr->title));
         pcurr->estim_size = strlen(title);
         pcurr->count = 0;
+        pcurr->total = 0;
         pcurr->entries = NULL;
         pcurr->info = NULL;
         pcurr->next = alert_list;
@@ -789,11 +1192,18 @@ static void Alert_Add(const char *title, const char *entry, const char *info)
     }
 
     /* pcurr now points to the appropriate alert type */
-    pcurr->count++;
+    pcurr->total++;
 
     /* total alert count */
     alert_count++;
 
+    /* only count the entries after the max listed entries */
+    if (log_config.alert_samples != 0
+        && pcurr->count >= log_config.alert_samples)
+        goto check_flush;
+
+    pcurr->count++;
+
     /* realloc manual (3): if ptr is NULL, the call is equivalent to
      * malloc(size) */
     pcurr->entries =
@@ -816,8 +1226,15 @@ static void Alert_Add(const char *title, const char *entry, const char *info)
     strcpy(pcurr->info[pcurr->count - 1], info);
     pcurr->estim_size += infolen;
 
+ check_flush:
     if ((log_config.batch_alert_max > 1) &&
         (alert_count >= log_config.batch_alert_max)) {
+        if (log_config.alert_digest_interval > 0) {
+            /* don't make the caller wait for the digest to be sent */
+            digest_flush_now = true;
+            pthread_cond_signal(&digest_cond);
+            goto out_unlock;
+        }
         /* this also unlocks the mutex as soon as it is possible */
         FlushAlerts(true);
         return;
@@ -832,11 +1249,58 @@ void Alert_EndBatching()
     if (alert_batching) {
         P(alert_mutex);
         alert_batching = false;
+        if (log_config.alert_digest_interval > 0) {
+            /* let the digest thread send them */
+            digest_flush_now = true;
+            pthread_cond_signal(&digest_cond);
+            V(alert_mutex);
+            return;
+        }
         /* release the mutex too */
         FlushAlerts(true);
     }
 }
 
+/** periodically send a digest of aggregated alerts */
+static void *alert_digest_thr(void *arg)
+{
+    struct timespec deadline;
+
+    P(alert_mutex);
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        /* the interval can be changed (or reset) by a config reload */
+        deadline.tv_sec += log_config.alert_digest_interval > 0 ?
+            log_config.alert_digest_interval : 1;
+
+        while (!digest_flush_now)
+            if (pthread_cond_timedwait(&digest_cond, &alert_mutex,
+                                       &deadline) == ETIMEDOUT)
+                break;
+        digest_flush_now = false;
+
+        /* this releases the mutex */
+        FlushAlerts(true);
+        P(alert_mutex);
+    }
+    return NULL;
+}
+
+static void alert_digest_start(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, alert_digest_thr, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc)
+        DisplayLog(LVL_CRIT, "Alert", "Failed to start alert digest thread: "
+                   "%s", strerror(rc));
+}
+
 void RaiseEntryAlert(const char *alert_name,    /* alert name (if set) */
                      const char *alert_string,  /* alert description */
                      const char *entry_path,    /* entry path */
@@ -844,10 +1308,13 @@ void RaiseEntryAlert(const char *alert_name,    /* alert name (if set) */
 {   /* alert related attributes */
     char title[1024];
 
+    if (log_config.alert_digest_interval > 0)
+        pthread_once(&digest_once, alert_digest_start);
+
     /* lockless check (not a big problem if some alerts are sent without
      * being batched).
      */
-    if (alert_batching) {
+    if (alert_batching || log_config.alert_digest_interval > 0) {
         if (alert_name && !EMPTY_STRING(alert_name))
             strcpy(title, alert_name);
         else {
@@ -891,6 +1358,28 @@ void RaiseAlert(const char *title, const char *format, ...)
 
     /* send alert mail, if an address was specified in config file */
     if (!EMPTY_STRING(log_config.alert_mail)) {
+        bool allowed;
+
+        P(alert_mutex);
+        allowed = alert_mail_allowed();
+        V(alert_mutex);
+
+        if (!allowed && log_config.alert_digest_interval > 0) {
+            /* defer it to the next digest */
+            va_start(args, format);
+            vsnprintf(mail, MAX_MAIL_LEN, format, args);
+            va_end(args);
+
+            pthread_once(&digest_once, alert_digest_start);
+            Alert_Add(title, mail, "");
+            return;
+        } else if (!allowed) {
+            DisplayLog(LVL_MAJOR, "Alert", "Max number of alert mails per "
+                       "hour reached (%u): alert '%s' not sent by mail",
+                       log_config.alert_mail_max, title);
+            goto alert_file;
+        }
+
         localtime_r(&now, &date);
         written = snprintf(mail, MAX_MAIL_LEN,
                            "===== %s =====\n"
@@ -912,6 +1401,7 @@ void RaiseAlert(const char *title, const char *format, ...)
         SendMail(log_config.alert_mail, title2, mail);
     }
 
+ alert_file:
     if (!EMPTY_STRING(log_config.alert_file)) {
         display_line_log_(&alert, "ALERT", "%s", title);
         va_start(args, format);
@@ -924,10 +1414,16 @@ void RaiseAlert(const char *title, const char *format, ...)
 
 }   /* DisplayAlert */
 
+/* Interval between stat dumps (seconds) */
+unsigned int StatsInterval(void)
+{
+    return log_config.stats_interval > 0 ? log_config.stats_interval : 1;
+}
+
 /* Wait for next stat deadline */
 void WaitStatsInterval(void)
 {
-    rh_sleep(log_config.stats_interval > 0 ? log_config.stats_interval : 1);
+    rh_sleep(StatsInterval());
 }
 
 /* ---------------- Config management routines -------------------- */
@@ -954,12 +1450,16 @@ static void log_cfg_set_default(void *module_config)
     conf->syslog_priority = LOG_INFO;
 
     conf->batch_alert_max = 1;  /* no batching */
+    conf->alert_digest_interval = 0;
+    conf->alert_samples = 0;
+    conf->alert_mail_max = 0;
     conf->alert_show_attrs = false;
 
     conf->stats_interval = 900; /* 15min */
 
     conf->log_process = 0;
     conf->log_host = 0;
+    conf->async_log = false;
 }
 
 static void log_cfg_write_default(FILE *output)
@@ -974,9 +1474,13 @@ static void log_cfg_write_default(FILE *output)
     print_line(output, 1, "syslog_facility:   local1.info");
     print_line(output, 1, "stats_interval :   15min");
     print_line(output, 1, "batch_alert_max:   1 (no batching)");
+    print_line(output, 1, "alert_digest_interval: 0 (no digest)");
+    print_line(output, 1, "alert_samples:     0 (unlimited)");
+    print_line(output, 1, "alert_mail_max:    0 (unlimited)");
     print_line(output, 1, "alert_show_attrs: no");
     print_line(output, 1, "log_procname: no");
     print_line(output, 1, "log_hostname: no");
+    print_line(output, 1, "async_log: no");
     print_end_block(output, 0);
 }
 
@@ -1014,6 +1518,20 @@ static void log_cfg_write_template(FILE *output)
                "# 0: unlimited batch size, 1: no batching (1 alert per file),");
     print_line(output, 1, "# N>1: batch N alerts per digest");
     print_line(output, 1, "batch_alert_max = 5000 ;");
+    print_line(output, 1,
+               "# Aggregate all entry alerts, and send a digest every hour");
+    print_line(output, 1,
+               "# (alerts don't wait for the end of a scan or policy run)");
+    print_line(output, 1, "#alert_digest_interval = 1h ;");
+    print_line(output, 1,
+               "# Only list the 100 first entries of each alert in a digest");
+    print_line(output, 1, "#alert_samples = 100 ;");
+    print_line(output, 1,
+               "# Max number of alert mails per hour (other alerts are "
+               "deferred");
+    print_line(output, 1, "# to the next digest if alert_digest_interval is "
+               "set)");
+    print_line(output, 1, "#alert_mail_max = 10 ;");
     print_line(output, 1,
                "# Give the detail of entry attributes for each alert?");
     print_line(output, 1, "alert_show_attrs = no ;");
@@ -1022,6 +1540,11 @@ static void log_cfg_write_template(FILE *output)
     print_line(output, 1, "log_procname = yes;");
     print_line(output, 1, "# whether the host name appears in the log line");
     print_line(output, 1, "log_hostname = yes;");
+    fprintf(output, "\n");
+    print_line(output, 1, "# write the log from a background thread (lines are "
+               "dropped");
+    print_line(output, 1, "# and counted if it can't keep up)");
+    print_line(output, 1, "#async_log = yes;");
     print_end_block(output, 0);
 }
 
@@ -1037,7 +1560,9 @@ static int log_cfg_read(config_file_t config, void *module_config,
     static const char * const allowed_params[] = {
         "debug_level", "log_file", "report_file",
         "alert_file", "alert_mail", "stats_interval", "batch_alert_max",
+        "alert_digest_interval", "alert_samples", "alert_mail_max",
         "alert_show_attrs", "syslog_facility", "log_procname", "log_hostname",
+        "async_log",
 #ifdef HAVE_CHANGELOGS
         "changelogs_file",
 #endif
@@ -1073,12 +1598,21 @@ static int log_cfg_read(config_file_t config, void *module_config,
         ,
         {"batch_alert_max", PT_INT, PFLG_POSITIVE, &conf->batch_alert_max, 0}
         ,
+        {"alert_digest_interval", PT_DURATION, PFLG_POSITIVE,
+         &conf->alert_digest_interval, 0}
+        ,
+        {"alert_samples", PT_INT, PFLG_POSITIVE, &conf->alert_samples, 0}
+        ,
+        {"alert_mail_max", PT_INT, PFLG_POSITIVE, &conf->alert_mail_max, 0}
+        ,
         {"alert_show_attrs", PT_BOOL, 0, &conf->alert_show_attrs, 0}
         ,
         {"log_procname", PT_BOOL, 0, &conf->log_process, 0}
         ,
         {"log_hostname", PT_BOOL, 0, &conf->log_host, 0}
         ,
+        {"async_log", PT_BOOL, 0, &conf->async_log, 0}
+        ,
 
         {NULL, 0, 0, NULL, 0}
     };
@@ -1232,6 +1766,36 @@ static int log_cfg_reload(log_config_t *conf)
         V(alert_mutex);
     }
 
+    if (conf->alert_digest_interval != log_config.alert_digest_interval) {
+        DisplayLog(LVL_MAJOR, "LogConfig",
+                   RBH_LOG_CONFIG_BLOCK "::alert_digest_interval modified: "
+                   "'%" PRI_TT "'->'%" PRI_TT "'",
+                   log_config.alert_digest_interval,
+                   conf->alert_digest_interval);
+        P(alert_mutex);
+        log_config.alert_digest_interval = conf->alert_digest_interval;
+        /* send pending alerts with the previous setting */
+        digest_flush_now = true;
+        pthread_cond_signal(&digest_cond);
+        V(alert_mutex);
+    }
+
+    if (conf->alert_samples != log_config.alert_samples) {
+        DisplayLog(LVL_MAJOR, "LogConfig",
+                   RBH_LOG_CONFIG_BLOCK "::alert_samples modified: "
+                   "'%u'->'%u'", log_config.alert_samples,
+                   conf->alert_samples);
+        log_config.alert_samples = conf->alert_samples;
+    }
+
+    if (conf->alert_mail_max != log_config.alert_mail_max) {
+        DisplayLog(LVL_MAJOR, "LogConfig",
+                   RBH_LOG_CONFIG_BLOCK "::alert_mail_max modified: "
+                   "'%u'->'%u'", log_config.alert_mail_max,
+                   conf->alert_mail_max);
+        log_config.alert_mail_max = conf->alert_mail_max;
+    }
+
     if (conf->log_process != log_config.log_process) {
         DisplayLog(LVL_MAJOR, "LogConfig",
                    RBH_LOG_CONFIG_BLOCK "::log_procname modified: '%s'->'%s'",
@@ -1247,6 +1811,16 @@ static int log_cfg_reload(log_config_t *conf)
         log_config.log_host = conf->log_host;
     }
 
+    if (conf->async_log != log_config.async_log) {
+        DisplayLog(LVL_MAJOR, "LogConfig",
+                   RBH_LOG_CONFIG_BLOCK "::async_log modified: '%s'->'%s'",
+                   bool2str(log_config.async_log), bool2str(conf->async_log));
+        log_config.async_log = conf->async_log;
+        /* write pending lines before the next synchronous ones */
+        if (!log_config.async_log)
+            FlushLogs();
+    }
+
     rbh_adjust_log_level_external();
     return 0;
 }
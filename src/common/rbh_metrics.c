@@ -0,0 +1,722 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Metrics registry and HTTP endpoint.
+ *
+ * At each scrape, all collectors are called with the registry lock held.
+ * Samples are gathered by family (so that collectors of several instances,
+ * e.g. one per policy, can emit samples of the same family), then the
+ * families are formatted in emission order.
+ * Requests are served one at a time by a single thread: scrapes are rare.
+ * Profiling requests ("GET /profile?seconds=N") are answered by a separate
+ * thread at the end of the profiling.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_metrics.h"
+#include "rbh_cfg_helpers.h"
+#include "rbh_hist.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "rbh_prof.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define METRICS_CONFIG_BLOCK "Metrics"
+#define METRICS_TAG "Metrics"
+#define METRICS_PREFIX "robinhood_"
+
+/* max size of a request header */
+#define METRICS_REQ_MAX 4096
+/* timeout to receive a request, or to send the response (sec) */
+#define METRICS_IO_TIMEOUT 5
+/* max duration of a profiling request (sec) */
+#define METRICS_PROF_MAX 600
+
+metrics_config_t metrics_config;
+
+struct collector {
+    metrics_collect_fn  fn;
+    void               *arg;
+};
+
+static pthread_mutex_t  collectors_lock = PTHREAD_MUTEX_INITIALIZER;
+static GArray          *collectors = NULL;
+
+struct metrics_family {
+    char           *name;
+    metric_type_e   type;
+    char           *help;
+    GString        *text;   /* samples in Prometheus format */
+    GString        *json;   /* samples in JSON */
+};
+
+struct metrics_out {
+    GPtrArray               *families;
+    struct metrics_family   *current;
+    /* if set, samples are passed to it instead of being formatted */
+    metrics_sample_fn        sample_cb;
+    void                    *sample_arg;
+};
+
+int metrics_register(metrics_collect_fn fn, void *arg)
+{
+    struct collector c = {.fn = fn, .arg = arg };
+
+    P(collectors_lock);
+    if (collectors == NULL)
+        collectors = g_array_new(FALSE, FALSE, sizeof(struct collector));
+    g_array_append_val(collectors, c);
+    V(collectors_lock);
+    return 0;
+}
+
+void metrics_unregister(metrics_collect_fn fn, void *arg)
+{
+    unsigned int i;
+
+    P(collectors_lock);
+    for (i = 0; collectors != NULL && i < collectors->len; i++) {
+        struct collector *c = &g_array_index(collectors, struct collector, i);
+
+        if (c->fn == fn && c->arg == arg) {
+            g_array_remove_index(collectors, i);
+            break;
+        }
+    }
+    V(collectors_lock);
+}
+
+static const char *metric_type2str(metric_type_e type)
+{
+    switch (type) {
+    case METRIC_COUNTER:
+        return "counter";
+    case METRIC_GAUGE:
+        return "gauge";
+    case METRIC_HISTOGRAM:
+        return "histogram";
+    }
+    return "untyped";
+}
+
+void metrics_family(metrics_out_t *out, const char *name, metric_type_e type,
+                    const char *help)
+{
+    struct metrics_family *f;
+    unsigned int i;
+
+    for (i = 0; i < out->families->len; i++) {
+        f = g_ptr_array_index(out->families, i);
+        if (!strcmp(f->name, name)) {
+            out->current = f;
+            return;
+        }
+    }
+
+    f = g_new0(struct metrics_family, 1);
+    f->name = g_strdup(name);
+    f->type = type;
+    f->help = g_strdup(help);
+    f->text = g_string_new(NULL);
+    f->json = g_string_new(NULL);
+    g_ptr_array_add(out->families, f);
+    out->current = f;
+}
+
+static void family_free(struct metrics_family *f)
+{
+    g_free(f->name);
+    g_free(f->help);
+    g_string_free(f->text, TRUE);
+    g_string_free(f->json, TRUE);
+    g_free(f);
+}
+
+/** append a string, escaped for a label value (json=false)
+ * or a JSON string (json=true) */
+static void append_escaped(GString *str, const char *s, bool json)
+{
+    for (; *s != '\0'; s++) {
+        switch (*s) {
+        case '\\':
+            g_string_append(str, "\\\\");
+            break;
+        case '"':
+            g_string_append(str, "\\\"");
+            break;
+        case '\n':
+            g_string_append(str, "\\n");
+            break;
+        default:
+            if (json && (unsigned char)*s < 0x20)
+                g_string_append_printf(str, "\\u%04x", *s);
+            else
+                g_string_append_c(str, *s);
+        }
+    }
+}
+
+static void append_double(GString *str, double val)
+{
+    /* exact for integers up to 10^15 */
+    g_string_append_printf(str, "%.15g", val);
+}
+
+/** append "{name="value",...[,le="<le>"]}" (nothing if no label) */
+static void append_labels(GString *str, const char *const *labels,
+                          const char *le)
+{
+    const char *const *l;
+    bool first = true;
+
+    if ((labels == NULL || labels[0] == NULL) && le == NULL)
+        return;
+
+    g_string_append_c(str, '{');
+    for (l = labels; l != NULL && l[0] != NULL && l[1] != NULL; l += 2) {
+        g_string_append_printf(str, "%s%s=\"", first ? "" : ",", l[0]);
+        append_escaped(str, l[1], false);
+        g_string_append_c(str, '"');
+        first = false;
+    }
+    if (le != NULL)
+        g_string_append_printf(str, "%sle=\"%s\"", first ? "" : ",", le);
+    g_string_append_c(str, '}');
+}
+
+/** start a JSON sample: {"labels":{...}, */
+static void json_sample_start(struct metrics_family *f,
+                              const char *const *labels)
+{
+    const char *const *l;
+
+    g_string_append_printf(f->json, "%s{\"labels\":{",
+                           f->json->len > 0 ? "," : "");
+    for (l = labels; l != NULL && l[0] != NULL && l[1] != NULL; l += 2) {
+        g_string_append_printf(f->json, "%s\"", l == labels ? "" : ",");
+        append_escaped(f->json, l[0], true);
+        g_string_append(f->json, "\":\"");
+        append_escaped(f->json, l[1], true);
+        g_string_append_c(f->json, '"');
+    }
+    g_string_append(f->json, "},");
+}
+
+void metrics_value(metrics_out_t *out, const char *const *labels,
+                   double value)
+{
+    struct metrics_family *f = out->current;
+
+    if (f == NULL)
+        return;
+
+    if (out->sample_cb != NULL) {
+        GString *key = g_string_new(f->name);
+
+        append_labels(key, labels, NULL);
+        out->sample_cb(key->str, f->type, value, out->sample_arg);
+        g_string_free(key, TRUE);
+        return;
+    }
+
+    g_string_append_printf(f->text, METRICS_PREFIX "%s", f->name);
+    append_labels(f->text, labels, NULL);
+    g_string_append_c(f->text, ' ');
+    append_double(f->text, value);
+    g_string_append_c(f->text, '\n');
+
+    json_sample_start(f, labels);
+    g_string_append(f->json, "\"value\":");
+    append_double(f->json, value);
+    g_string_append_c(f->json, '}');
+}
+
+void metrics_hist(metrics_out_t *out, const char *const *labels,
+                  const volatile unsigned long long *hist,
+                  unsigned long long sum_usec)
+{
+    struct metrics_family *f = out->current;
+    unsigned long long count = 0;
+    unsigned long long estim = 0;
+    char le[64];
+    unsigned int b;
+
+    if (f == NULL || out->sample_cb != NULL)
+        return;
+
+    json_sample_start(f, labels);
+    g_string_append(f->json, "\"buckets\":{");
+
+    /* export one bucket per power of 2 of microseconds */
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        unsigned long long val = hist[b];
+
+        count += val;
+        estim += val * hist_bucket_max(b);
+
+        if (b % HIST_SUB != HIST_SUB - 1 || b == HIST_BUCKETS - 1)
+            continue;
+
+        snprintf(le, sizeof(le), "%g", hist_bucket_max(b) / 1000000.0);
+        g_string_append_printf(f->text, METRICS_PREFIX "%s_bucket", f->name);
+        append_labels(f->text, labels, le);
+        g_string_append_printf(f->text, " %llu\n", count);
+
+        g_string_append_printf(f->json, "%s\"%s\":%llu",
+                               b == HIST_SUB - 1 ? "" : ",", le, count);
+    }
+
+    if (sum_usec == 0)
+        sum_usec = estim;
+
+    g_string_append_printf(f->text, METRICS_PREFIX "%s_bucket", f->name);
+    append_labels(f->text, labels, "+Inf");
+    g_string_append_printf(f->text, " %llu\n", count);
+    g_string_append_printf(f->text, METRICS_PREFIX "%s_sum", f->name);
+    append_labels(f->text, labels, NULL);
+    g_string_append_printf(f->text, " %g\n", sum_usec / 1000000.0);
+    g_string_append_printf(f->text, METRICS_PREFIX "%s_count", f->name);
+    append_labels(f->text, labels, NULL);
+    g_string_append_printf(f->text, " %llu\n", count);
+
+    g_string_append_printf(f->json, ",\"+Inf\":%llu},\"sum\":%g,"
+                           "\"count\":%llu}", count, sum_usec / 1000000.0,
+                           count);
+}
+
+/** built-in collector: memory accounting per subsystem (Memory.h) */
+static void memory_collect(metrics_out_t *out, void *arg)
+{
+    long long bytes[MEM_TAG_COUNT];
+    long long count[MEM_TAG_COUNT];
+    int i;
+
+    for (i = 0; i < MEM_TAG_COUNT; i++)
+        mem_tag_stats(i, &bytes[i], &count[i]);
+
+    metrics_family(out, "memory_bytes", METRIC_GAUGE,
+                   "Memory used by each subsystem");
+    for (i = 0; i < MEM_TAG_COUNT; i++) {
+        const char *labels[] = { "subsystem", mem_tag_name(i), NULL };
+
+        metrics_value(out, labels, bytes[i]);
+    }
+
+    metrics_family(out, "memory_objects", METRIC_GAUGE,
+                   "Objects allocated by each subsystem");
+    for (i = 0; i < MEM_TAG_COUNT; i++) {
+        const char *labels[] = { "subsystem", mem_tag_name(i), NULL };
+
+        metrics_value(out, labels, count[i]);
+    }
+}
+
+/** call all collectors (collectors_lock must be held) */
+static void collectors_call(metrics_out_t *out)
+{
+    unsigned int i;
+
+    memory_collect(out, NULL);
+    for (i = 0; collectors != NULL && i < collectors->len; i++) {
+        struct collector *c = &g_array_index(collectors, struct collector, i);
+
+        out->current = NULL;
+        c->fn(out, c->arg);
+    }
+}
+
+void metrics_foreach(metrics_sample_fn cb, void *arg)
+{
+    metrics_out_t out = {.families = g_ptr_array_new(), .current = NULL,
+                         .sample_cb = cb, .sample_arg = arg };
+    unsigned int i;
+
+    P(collectors_lock);
+    collectors_call(&out);
+    V(collectors_lock);
+
+    for (i = 0; i < out.families->len; i++)
+        family_free(g_ptr_array_index(out.families, i));
+    g_ptr_array_free(out.families, TRUE);
+}
+
+/** call all collectors and format their output */
+static GString *metrics_collect(bool json)
+{
+    metrics_out_t out = {.families = g_ptr_array_new(), .current = NULL };
+    GString *str = g_string_new(NULL);
+    unsigned int i;
+
+    P(collectors_lock);
+    collectors_call(&out);
+    V(collectors_lock);
+
+    if (json)
+        g_string_append_c(str, '{');
+
+    for (i = 0; i < out.families->len; i++) {
+        struct metrics_family *f = g_ptr_array_index(out.families, i);
+
+        if (json) {
+            g_string_append_printf(str, "%s\n\"" METRICS_PREFIX "%s\":"
+                                   "{\"type\":\"%s\",\"help\":\"",
+                                   i > 0 ? "," : "", f->name,
+                                   metric_type2str(f->type));
+            append_escaped(str, f->help, true);
+            g_string_append_printf(str, "\",\"samples\":[%s]}", f->json->str);
+        } else {
+            g_string_append_printf(str, "# HELP " METRICS_PREFIX "%s %s\n"
+                                   "# TYPE " METRICS_PREFIX "%s %s\n%s",
+                                   f->name, f->help, f->name,
+                                   metric_type2str(f->type), f->text->str);
+        }
+        family_free(f);
+    }
+    g_ptr_array_free(out.families, TRUE);
+
+    if (json)
+        g_string_append(str, "\n}\n");
+
+    return str;
+}
+
+/* ==== HTTP endpoint ==== */
+
+static void send_response(int fd, const char *status, const char *type,
+                          const char *body, size_t len)
+{
+    char hdr[512];
+    int  hlen;
+
+    hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %zu\r\n"
+                    "Connection: close\r\n\r\n", status, type, len);
+    if (rh_write_all(fd, hdr, hlen) == 0)
+        rh_write_all(fd, body, len);
+}
+
+struct prof_request {
+    int           fd;
+    unsigned int  seconds;
+};
+
+/** run a profiling requested by "GET /profile?seconds=N" */
+static void *prof_request_thr(void *arg)
+{
+    struct prof_request *pr = arg;
+    char   *buf = NULL;
+    size_t  size = 0;
+    FILE   *out;
+    int     rc;
+
+    /* the response is sent after the profiling */
+    out = open_memstream(&buf, &size);
+    if (out == NULL) {
+        send_response(pr->fd, "500 Internal Server Error", "text/plain",
+                      "Out of memory\n", 14);
+        goto out;
+    }
+    rc = prof_run(pr->seconds, out);
+    fclose(out);
+
+    if (rc == EBUSY)
+        send_response(pr->fd, "409 Conflict", "text/plain",
+                      "A profiling is already running\n", 31);
+    else if (rc)
+        send_response(pr->fd, "500 Internal Server Error", "text/plain",
+                      "Failed to start profiling\n", 26);
+    else
+        send_response(pr->fd, "200 OK", "text/plain", buf, size);
+
+ out:
+    free(buf);
+    close(pr->fd);
+    MemFree(pr);
+    return NULL;
+}
+
+/** Start a profiling request in a separate thread, so that scrapes are
+ * still served during the profiling.
+ * @return true if the thread took ownership of fd. */
+static bool start_prof_request(int fd, const char *query)
+{
+    struct prof_request *pr;
+    const char *sec;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    pr = MemAlloc(sizeof(*pr));
+    if (pr == NULL)
+        goto err;
+    pr->fd = fd;
+    pr->seconds = PROF_DEFAULT_DURATION;
+    if (query != NULL && (sec = strstr(query, "seconds=")) != NULL) {
+        pr->seconds = strtoul(sec + strlen("seconds="), NULL, 10);
+        if (pr->seconds == 0)
+            pr->seconds = PROF_DEFAULT_DURATION;
+        else if (pr->seconds > METRICS_PROF_MAX)
+            pr->seconds = METRICS_PROF_MAX;
+    }
+
+    /* the response is only sent at the end of the profiling */
+    {
+        struct timeval timeout = {.tv_sec = pr->seconds + METRICS_IO_TIMEOUT };
+
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, prof_request_thr, pr);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+        MemFree(pr);
+        goto err;
+    }
+    return true;
+
+ err:
+    send_response(fd, "500 Internal Server Error", "text/plain",
+                  "Failed to start profiling\n", 26);
+    return false;
+}
+
+/**
+ * Read the request header, and answer it.
+ * @return true if the connection was handed over to another thread.
+ */
+static bool handle_request(int fd)
+{
+    char     req[METRICS_REQ_MAX];
+    size_t   len = 0;
+    char    *path, *end, *query = NULL;
+    GString *body;
+    bool     json;
+
+    /* read until the end of the header (we don't need the body) */
+    while (len < sizeof(req) - 1) {
+        ssize_t rc = read(fd, req + len, sizeof(req) - 1 - len);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            break;
+        len += rc;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+            break;
+    }
+    req[len] = '\0';
+
+    if (strncmp(req, "GET ", 4) != 0) {
+        send_response(fd, "405 Method Not Allowed", "text/plain",
+                      "Only GET is supported\n", 22);
+        return false;
+    }
+
+    path = req + 4;
+    end = strpbrk(path, " ?\r\n");
+    if (end != NULL) {
+        if (*end == '?') {
+            query = end + 1;
+            query[strcspn(query, " \r\n")] = '\0';
+        }
+        *end = '\0';
+    }
+
+    if (!strcmp(path, "/metrics") || !strcmp(path, "/"))
+        json = false;
+    else if (!strcmp(path, "/metrics.json"))
+        json = true;
+    else if (!strcmp(path, "/profile"))
+        return start_prof_request(fd, query);
+    else {
+        send_response(fd, "404 Not Found", "text/plain",
+                      "Unknown path (expected /metrics, /metrics.json or "
+                      "/profile)\n", 60);
+        return false;
+    }
+
+    body = metrics_collect(json);
+    send_response(fd, "200 OK", json ? "application/json" :
+                  "text/plain; version=0.0.4", body->str, body->len);
+    g_string_free(body, TRUE);
+    return false;
+}
+
+static void *metrics_thr(void *arg)
+{
+    int sock = (long)arg;
+    struct timeval timeout = {.tv_sec = METRICS_IO_TIMEOUT };
+
+    for (;;) {
+        int fd = accept(sock, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                DisplayLog(LVL_MAJOR, METRICS_TAG, "accept() failed: %s",
+                           strerror(errno));
+            continue;
+        }
+
+        /* don't let a stuck client block the endpoint */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if (!handle_request(fd))
+            close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int sock, rc;
+
+    if (EMPTY_STRING(metrics_config.listen))
+        return 0;
+
+    sock = rh_listen(metrics_config.listen);
+    if (sock < 0) {
+        DisplayLog(LVL_CRIT, METRICS_TAG, "Failed to listen on '%s': %s",
+                   metrics_config.listen, strerror(-sock));
+        return -sock;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, metrics_thr, (void *)(long)sock);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, METRICS_TAG, "Failed to start metrics thread: "
+                   "%s", strerror(rc));
+        close(sock);
+        return rc;
+    }
+
+    DisplayLog(LVL_EVENT, METRICS_TAG, "Serving metrics on '%s'",
+               metrics_config.listen);
+    return 0;
+}
+
+/* ==== configuration ==== */
+
+static void metrics_cfg_set_default(void *module_config)
+{
+    metrics_config_t *conf = (metrics_config_t *)module_config;
+
+    conf->listen[0] = '\0';
+}
+
+static void metrics_cfg_write_default(FILE *output)
+{
+    print_begin_block(output, 0, METRICS_CONFIG_BLOCK, NULL);
+    print_line(output, 1, "listen : \"\" (disabled)");
+    print_end_block(output, 0);
+}
+
+static void metrics_cfg_write_template(FILE *output)
+{
+    print_begin_block(output, 0, METRICS_CONFIG_BLOCK, NULL);
+    print_line(output, 1, "# serve metrics of the daemon (GET /metrics for "
+               "Prometheus,");
+    print_line(output, 1, "# GET /metrics.json for JSON) on a local port "
+               "(\"[host:]port\")");
+    print_line(output, 1, "# or on a Unix socket (absolute path)");
+    print_line(output, 1, "# GET /profile?seconds=N returns a CPU profile of "
+               "the daemon (folded stacks)");
+    print_line(output, 1, "#listen = 9421 ;");
+    print_line(output, 1, "#listen = \"/var/run/robinhood/metrics.sock\" ;");
+    print_end_block(output, 0);
+}
+
+static int metrics_cfg_read(config_file_t config, void *module_config,
+                            char *msg_out)
+{
+    metrics_config_t *conf = (metrics_config_t *)module_config;
+    config_item_t     block;
+    int               rc;
+
+    static const char * const allowed_params[] = {
+        "listen", NULL
+    };
+    const cfg_param_t cfg_params[] = {
+        {"listen", PT_STRING, PFLG_NO_WILDCARDS, conf->listen,
+         sizeof(conf->listen)}
+        ,
+        END_OF_PARAMS
+    };
+
+    rc = get_cfg_block(config, METRICS_CONFIG_BLOCK, &block, msg_out);
+    if (rc)
+        return rc == ENOENT ? 0 : rc;   /* not mandatory */
+
+    rc = read_scalar_params(block, METRICS_CONFIG_BLOCK, cfg_params, msg_out);
+    if (rc)
+        return rc;
+
+    CheckUnknownParameters(block, METRICS_CONFIG_BLOCK, allowed_params);
+    return 0;
+}
+
+static int metrics_cfg_set(void *module_config, bool reload)
+{
+    metrics_config_t *conf = (metrics_config_t *)module_config;
+
+    if (!reload) {
+        metrics_config = *conf;
+        return 0;
+    }
+
+    if (strcmp(conf->listen, metrics_config.listen))
+        DisplayLog(LVL_MAJOR, METRICS_TAG, METRICS_CONFIG_BLOCK
+                   "::listen changed in config file, but cannot be modified "
+                   "dynamically");
+    return 0;
+}
+
+static void *metrics_cfg_new(void)
+{
+    return calloc(1, sizeof(metrics_config_t));
+}
+
+static void metrics_cfg_free(void *cfg)
+{
+    if (cfg != NULL)
+        free(cfg);
+}
+
+mod_cfg_funcs_t metrics_cfg_hdlr = {
+    .module_name = "metrics",
+    .new = metrics_cfg_new,
+    .free = metrics_cfg_free,
+    .set_default = metrics_cfg_set_default,
+    .read = metrics_cfg_read,
+    .set_config = metrics_cfg_set,
+    .write_default = metrics_cfg_write_default,
+    .write_template = metrics_cfg_write_template
+};
@@ -22,6 +22,7 @@
 #include "xplatform_print.h"
 #include "uidgidcache.h"
 #include "status_manager.h"
+#include "rbh_fidpath.h"
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -38,6 +39,9 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <string.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #ifndef HAVE_GETMNTENT_R
 #include "mntent_compat.h"
@@ -2473,7 +2477,19 @@ void path_check_update(const entry_id_t *p_id,
 
     /* if fullpath is in the policy, get the fullpath */
     if (attr_mask.std & ATTR_MASK_fullpath) {
-        rc = Lustre_GetFullPath(p_id, ATTR(p_attrs, fullpath), RBH_PATH_MAX);
+        /* build it from the path of the parent, if parent and name are
+         * known */
+        if (ATTR_MASK_TEST(p_attrs, parent_id)
+            && ATTR_MASK_TEST(p_attrs, name)) {
+            bool is_dir = ATTR_MASK_TEST(p_attrs, type)
+                          && !strcmp(ATTR(p_attrs, type), STR_TYPE_DIR);
+
+            rc = fidpath_child_path(&ATTR(p_attrs, parent_id),
+                                    ATTR(p_attrs, name), is_dir ? p_id : NULL,
+                                    ATTR(p_attrs, fullpath), RBH_PATH_MAX);
+        } else
+            rc = Lustre_GetFullPath(p_id, ATTR(p_attrs, fullpath),
+                                    RBH_PATH_MAX);
         if (rc == 0)
             ATTR_MASK_SET(p_attrs, fullpath);
         else if (rc != -ENOENT)
@@ -2514,7 +2530,8 @@ int set_uid_val(const char *username, db_type_u *val)
         struct passwd *result;
         char buff[4096];
 
-        if (getpwnam_r(username, &pw, buff, sizeof(buff), &result) == 0) {
+        if (getpwnam_r(username, &pw, buff, sizeof(buff), &result) == 0
+            && result != NULL) {
             val->val_int = pw.pw_uid;
             return 0;
         } else {
@@ -2570,7 +2587,8 @@ int set_gid_val(const char *groupname, db_type_u *val)
         struct group *result;
         char buff[4096];
 
-        if (getgrnam_r(groupname, &grp, buff, sizeof(buff), &result) == 0) {
+        if (getgrnam_r(groupname, &grp, buff, sizeof(buff), &result) == 0
+            && result != NULL) {
             val->val_int = grp.gr_gid;
             return 0;
         } else {
@@ -2608,3 +2626,201 @@ const char *id_as_str(db_type_u *val)
     sprintf(buf, "%d", val->val_int);
     return buf;
 }
+
+const char *uid2name(uid_t uid, char *buf, size_t buf_sz)
+{
+    const struct passwd *pw = GetPwUid(uid);
+
+    if (pw != NULL)
+        return pw->pw_name;
+
+    snprintf(buf, buf_sz, "%d", (int)uid);
+    return buf;
+}
+
+const char *gid2name(gid_t gid, char *buf, size_t buf_sz)
+{
+    const struct group *gr = GetGrGid(gid);
+
+    if (gr != NULL)
+        return gr->gr_name;
+
+    snprintf(buf, buf_sz, "%d", (int)gid);
+    return buf;
+}
+
+int rh_write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t rc = write(fd, p, len);
+
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+int rh_read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t rc = read(fd, p + done, len - done);
+
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (rc == 0)
+            return done == 0 ? -ENODATA : -EPIPE;
+        done += rc;
+    }
+    return 0;
+}
+
+/** fill a Unix socket address (absolute path) */
+static int unix_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return -ENAMETOOLONG;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/** resolve "[host:]port" (host defaults to localhost) */
+static int tcp_addr(const char *addr_str, int flags, struct addrinfo **res)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM, .ai_flags = flags };
+    char host[RBH_PATH_MAX];
+    const char *port;
+    char *sep;
+    int rc;
+
+    rh_strncpy(host, addr_str, sizeof(host));
+    sep = strrchr(host, ':');
+    if (sep != NULL) {
+        *sep = '\0';
+        port = sep + 1;
+    } else {
+        port = host;
+    }
+
+    rc = getaddrinfo(sep != NULL && !EMPTY_STRING(host) ? host : "localhost",
+                     port, &hints, res);
+    if (rc) {
+        DisplayLog(LVL_CRIT, __func__, "Cannot resolve '%s': %s",
+                   addr_str, gai_strerror(rc));
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int rh_listen(const char *addr_str)
+{
+    struct addrinfo *res, *ai;
+    int sock = -EADDRNOTAVAIL;
+    int rc, one = 1;
+
+    if (addr_str[0] == '/') {
+        struct sockaddr_un addr;
+
+        rc = unix_addr(addr_str, &addr);
+        if (rc)
+            return rc;
+
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+            return -errno;
+
+        /* remove the socket of a previous run */
+        unlink(addr_str);
+
+        if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))
+            || listen(sock, 16)) {
+            rc = -errno;
+            close(sock);
+            return rc;
+        }
+        return sock;
+    }
+
+    rc = tcp_addr(addr_str, AI_PASSIVE, &res);
+    if (rc)
+        return rc;
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            sock = -errno;
+            continue;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(sock, ai->ai_addr, ai->ai_addrlen) == 0
+            && listen(sock, 16) == 0)
+            break;
+
+        rc = -errno;
+        close(sock);
+        sock = rc;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+int rh_connect(const char *addr_str)
+{
+    struct addrinfo *res, *ai;
+    int sock = -EADDRNOTAVAIL;
+    int rc;
+
+    if (addr_str[0] == '/') {
+        struct sockaddr_un addr;
+
+        rc = unix_addr(addr_str, &addr);
+        if (rc)
+            return rc;
+
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+            return -errno;
+
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+            rc = -errno;
+            close(sock);
+            return rc;
+        }
+        return sock;
+    }
+
+    rc = tcp_addr(addr_str, 0, &res);
+    if (rc)
+        return rc;
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            sock = -errno;
+            continue;
+        }
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+
+        rc = -errno;
+        close(sock);
+        sock = rc;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
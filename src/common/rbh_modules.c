@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <glib.h>
 
 /**
  * Logging domain tag
@@ -356,3 +357,20 @@ action_scheduler_t *module_get_scheduler(const char *name)
 
     return mod->mod_ops.mod_get_scheduler(name);
 }
+
+/** output of the last function action run by the thread */
+static __thread char *action_output = NULL;
+
+void module_action_output_set(const char *str)
+{
+    g_free(action_output);
+    action_output = g_strdup(str);
+}
+
+char *module_action_output_take(void)
+{
+    char *out = action_output;
+
+    action_output = NULL;
+    return out;
+}
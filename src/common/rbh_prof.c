@@ -0,0 +1,424 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Sampling profiler.
+ *
+ * An ITIMER_PROF timer delivers SIGPROF to the threads consuming CPU.
+ * The signal handler takes a backtrace and accounts it in a fixed-size
+ * open addressing table, without locking nor allocating: slots are claimed
+ * by compare-and-swap, and samples are dropped when the table is full.
+ * Symbols are only resolved when dumping.
+ * Frames of static functions are only named if the binary exports its
+ * symbols (-rdynamic), else they are printed as "module+offset", which
+ * can be resolved by addr2line.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_prof.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <execinfo.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define PROF_TAG "Profiler"
+
+/* sampling frequency (not a round number, to avoid lockstep with
+ * periodic tasks) */
+#define PROF_FREQ       97
+#define PROF_MAX_DEPTH  48
+/* frames of the signal handler and the signal trampoline */
+#define PROF_SKIP       2
+/* max distinct stacks (power of 2) */
+#define PROF_SLOTS      8192
+#define PROF_MAX_PROBE  64
+
+enum slot_state {
+    SLOT_FREE = 0,
+    SLOT_FILLING,
+    SLOT_READY
+};
+
+struct prof_slot {
+    volatile int             state;
+    unsigned int             hash;
+    unsigned short           role;
+    unsigned short           depth;
+    const char              *detail;
+    void                    *pc[PROF_MAX_DEPTH];
+    volatile unsigned long   count;
+};
+
+static const char *role_names[PROF_ROLE_COUNT] = {
+    [PROF_ROLE_OTHER]    = "other",
+    [PROF_ROLE_SCAN]     = "scan",
+    [PROF_ROLE_PIPELINE] = "pipeline",
+    [PROF_ROLE_POLICY]   = "policy",
+    [PROF_ROLE_CHGLOG]   = "chglog",
+};
+
+static __thread prof_role_e thr_role = PROF_ROLE_OTHER;
+static __thread const char *thr_detail = NULL;
+
+static struct prof_slot *slots = NULL;
+static volatile bool sampling = false;
+static volatile unsigned long samples = 0;
+static volatile unsigned long dropped = 0;
+
+/* a profiling session runs from prof_start() to prof_dump() */
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prof_cond = PTHREAD_COND_INITIALIZER;
+static bool session = false;
+
+void prof_set_role(prof_role_e role, const char *detail)
+{
+    thr_role = role;
+    thr_detail = detail;
+}
+
+void prof_set_detail(const char *detail)
+{
+    thr_detail = detail;
+}
+
+static unsigned int stack_hash(prof_role_e role, const char *detail,
+                               void *const *pc, int depth)
+{
+    /* FNV-1a on pointers */
+    unsigned long h = 2166136261UL ^ role;
+    int i;
+
+    h = (h ^ (unsigned long)detail) * 16777619UL;
+    for (i = 0; i < depth; i++)
+        h = (h ^ (unsigned long)pc[i]) * 16777619UL;
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static void prof_handler(int sig, siginfo_t *info, void *uc)
+{
+    void *pc[PROF_MAX_DEPTH + PROF_SKIP];
+    int saved_errno = errno;
+    int depth, probe;
+    unsigned int hash;
+    prof_role_e role = thr_role;
+    const char *detail = thr_detail;
+
+    if (!sampling)
+        goto out;
+
+    depth = backtrace(pc, PROF_MAX_DEPTH + PROF_SKIP) - PROF_SKIP;
+    if (depth <= 0)
+        goto out;
+
+    hash = stack_hash(role, detail, pc + PROF_SKIP, depth);
+    __sync_fetch_and_add(&samples, 1);
+
+    for (probe = 0; probe < PROF_MAX_PROBE; probe++) {
+        struct prof_slot *s = &slots[(hash + probe) & (PROF_SLOTS - 1)];
+
+        if (s->state == SLOT_READY) {
+            if (s->hash == hash && s->role == role && s->detail == detail
+                && s->depth == depth
+                && !memcmp(s->pc, pc + PROF_SKIP, depth * sizeof(void *))) {
+                __sync_fetch_and_add(&s->count, 1);
+                goto out;
+            }
+        } else if (s->state == SLOT_FREE
+                   && __sync_bool_compare_and_swap(&s->state, SLOT_FREE,
+                                                   SLOT_FILLING)) {
+            s->hash = hash;
+            s->role = role;
+            s->detail = detail;
+            s->depth = depth;
+            memcpy(s->pc, pc + PROF_SKIP, depth * sizeof(void *));
+            s->count = 1;
+            __sync_synchronize();
+            s->state = SLOT_READY;
+            goto out;
+        }
+        /* else: slot being filled by another thread, try the next one */
+    }
+    __sync_fetch_and_add(&dropped, 1);
+
+ out:
+    errno = saved_errno;
+}
+
+static int set_timer(bool on)
+{
+    struct itimerval it;
+
+    memset(&it, 0, sizeof(it));
+    if (on) {
+        it.it_interval.tv_usec = 1000000 / PROF_FREQ;
+        it.it_value = it.it_interval;
+    }
+    return setitimer(ITIMER_PROF, &it, NULL) ? errno : 0;
+}
+
+int prof_start(void)
+{
+    static bool handler_set = false;
+    void *dummy[4];
+    int rc;
+
+    P(prof_lock);
+    if (session) {
+        V(prof_lock);
+        return EBUSY;
+    }
+
+    if (slots == NULL) {
+        slots = calloc(PROF_SLOTS, sizeof(*slots));
+        if (slots == NULL) {
+            V(prof_lock);
+            return ENOMEM;
+        }
+    } else
+        memset(slots, 0, PROF_SLOTS * sizeof(*slots));
+    samples = 0;
+    dropped = 0;
+
+    if (!handler_set) {
+        struct sigaction act;
+
+        /* backtrace() loads libgcc at first call: don't do it in the
+         * signal handler */
+        backtrace(dummy, 4);
+
+        /* The handler is never uninstalled: the default action of
+         * SIGPROF would terminate the process if a late signal arrives. */
+        memset(&act, 0, sizeof(act));
+        act.sa_sigaction = prof_handler;
+        act.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&act.sa_mask);
+        if (sigaction(SIGPROF, &act, NULL)) {
+            rc = errno;
+            V(prof_lock);
+            return rc;
+        }
+        handler_set = true;
+    }
+
+    sampling = true;
+    rc = set_timer(true);
+    if (rc) {
+        sampling = false;
+        V(prof_lock);
+        return rc;
+    }
+    session = true;
+    V(prof_lock);
+
+    DisplayLog(LVL_EVENT, PROF_TAG, "Profiling started (%u Hz)", PROF_FREQ);
+    return 0;
+}
+
+void prof_stop(void)
+{
+    P(prof_lock);
+    if (sampling) {
+        set_timer(false);
+        sampling = false;
+        pthread_cond_broadcast(&prof_cond);
+        DisplayLog(LVL_EVENT, PROF_TAG, "Profiling stopped: %lu samples "
+                   "(%lu dropped)", samples, dropped);
+    }
+    V(prof_lock);
+}
+
+/**
+ * Wait for the given duration, or until sampling is stopped by
+ * another thread (e.g. SIGUSR2), then stop sampling.
+ */
+static void prof_wait(unsigned int seconds)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+
+    P(prof_lock);
+    while (sampling) {
+        if (pthread_cond_timedwait(&prof_cond, &prof_lock, &deadline)
+            == ETIMEDOUT)
+            break;
+    }
+    V(prof_lock);
+
+    prof_stop();
+}
+
+/** append the name of a frame, from a backtrace_symbols() string
+ * ("module(func+0x12) [0x...]" or "module(+0x1234) [0x...]") */
+static void print_frame(FILE *out, const char *sym)
+{
+    const char *open = strchr(sym, '(');
+    const char *plus, *close;
+    const char *module;
+
+    if (open == NULL) {
+        fputs(sym, out);
+        return;
+    }
+    close = strchr(open, ')');
+    plus = strchr(open, '+');
+    if (close == NULL)
+        close = open + strlen(open);
+    if (plus == NULL || plus > close)
+        plus = close;
+
+    if (plus > open + 1) {
+        /* function name */
+        fwrite(open + 1, 1, plus - open - 1, out);
+        return;
+    }
+
+    /* no symbol: print basename(module)+offset */
+    module = sym;
+    for (plus = sym; plus < open; plus++)
+        if (*plus == '/')
+            module = plus + 1;
+    fwrite(module, 1, open - module, out);
+    fwrite(open + 1, 1, close - open - 1, out);
+}
+
+void prof_dump(FILE *out)
+{
+    unsigned int i;
+    int j;
+
+    P(prof_lock);
+    if (!session || slots == NULL) {
+        V(prof_lock);
+        return;
+    }
+    if (sampling) {
+        set_timer(false);
+        sampling = false;
+    }
+
+    for (i = 0; i < PROF_SLOTS; i++) {
+        struct prof_slot *s = &slots[i];
+        char **syms;
+
+        if (s->state != SLOT_READY)
+            continue;
+
+        fputs(role_names[s->role < PROF_ROLE_COUNT ? s->role : 0], out);
+        if (s->detail != NULL)
+            fprintf(out, ";%s", s->detail);
+
+        syms = backtrace_symbols(s->pc, s->depth);
+        /* outermost frame first */
+        for (j = s->depth - 1; j >= 0; j--) {
+            fputc(';', out);
+            if (syms != NULL)
+                print_frame(out, syms[j]);
+            else
+                fprintf(out, "%p", s->pc[j]);
+        }
+        free(syms);
+        fprintf(out, " %lu\n", s->count);
+    }
+    session = false;
+    V(prof_lock);
+}
+
+struct prof_async_arg {
+    unsigned int seconds;
+    char file[RBH_PATH_MAX];
+};
+
+static void *prof_async_thr(void *arg)
+{
+    struct prof_async_arg *pa = arg;
+    FILE *out;
+
+    prof_wait(pa->seconds);
+
+    out = fopen(pa->file, "w");
+    if (out == NULL) {
+        DisplayLog(LVL_CRIT, PROF_TAG, "Failed to open '%s' for writing: "
+                   "%s", pa->file, strerror(errno));
+        /* end the session anyway */
+        out = fopen("/dev/null", "w");
+    }
+    if (out != NULL) {
+        prof_dump(out);
+        fclose(out);
+    }
+    DisplayLog(LVL_EVENT, PROF_TAG, "Profile written to '%s'", pa->file);
+    free(pa);
+    return NULL;
+}
+
+int prof_run_async(unsigned int seconds, const char *file)
+{
+    struct prof_async_arg *pa;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    pa = malloc(sizeof(*pa));
+    if (pa == NULL)
+        return ENOMEM;
+    pa->seconds = seconds;
+    rh_strncpy(pa->file, file, sizeof(pa->file));
+
+    rc = prof_start();
+    if (rc) {
+        free(pa);
+        return rc;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, prof_async_thr, pa);
+    pthread_attr_destroy(&attr);
+    if (rc) {
+        prof_stop();
+        /* end the session */
+        P(prof_lock);
+        session = false;
+        V(prof_lock);
+        free(pa);
+    }
+    return rc;
+}
+
+int prof_run(unsigned int seconds, FILE *out)
+{
+    int rc = prof_start();
+
+    if (rc)
+        return rc;
+    prof_wait(seconds);
+    prof_dump(out);
+    return 0;
+}
+
+bool prof_running(void)
+{
+    return sampling;
+}
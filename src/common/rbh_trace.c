@@ -0,0 +1,200 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_trace.c
+ * \brief Sampled tracing of the processing of changelog records.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_trace.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define TRACE_TAG "Trace"
+
+struct trace_span {
+    const char     *name;
+    struct timeval  start;
+    struct timeval  end;
+};
+
+struct rbh_trace {
+    char            name[128];
+    char            cat[32];
+    uint64_t        id;
+    unsigned int    refcount;
+    unsigned int    count;      /* number of spans */
+    unsigned int    dropped;    /* spans beyond TRACE_MAX_SPANS */
+    struct trace_span spans[TRACE_MAX_SPANS];
+};
+
+static FILE *trace_file = NULL;
+static volatile unsigned int trace_ratio = 0;
+/* protects trace file, and contents of traces */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int trace_init(const char *file, unsigned int ratio)
+{
+    FILE *f;
+    long pos;
+
+    f = fopen(file, "a");
+    if (f == NULL) {
+        int rc = errno;
+
+        DisplayLog(LVL_CRIT, TRACE_TAG, "Cannot open trace file '%s': %s",
+                   file, strerror(rc));
+        return rc;
+    }
+
+    /* a new file starts with the opening of the JSON array
+     * (the closing bracket is optional in Chrome trace format) */
+    pos = ftell(f);
+    if (pos == 0)
+        fprintf(f, "[\n");
+
+    P(trace_lock);
+    if (trace_file != NULL)
+        fclose(trace_file);
+    trace_file = f;
+    V(trace_lock);
+
+    trace_set_ratio(ratio);
+    return 0;
+}
+
+void trace_set_ratio(unsigned int ratio)
+{
+    trace_ratio = ratio;
+    if (ratio > 0 && trace_file != NULL)
+        DisplayLog(LVL_EVENT, TRACE_TAG, "Tracing 1 record out of %u", ratio);
+}
+
+void trace_close(void)
+{
+    P(trace_lock);
+    trace_ratio = 0;
+    if (trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    V(trace_lock);
+}
+
+bool trace_sampled(uint64_t seq)
+{
+    unsigned int ratio = trace_ratio;
+
+    return ratio > 0 && trace_file != NULL && (seq % ratio) == 0;
+}
+
+rbh_trace_t *trace_new(const char *name, uint64_t id, const char *cat)
+{
+    rbh_trace_t *trace = MemCalloc(1, sizeof(*trace));
+
+    if (trace == NULL)
+        return NULL;
+
+    rh_strncpy(trace->name, name, sizeof(trace->name));
+    rh_strncpy(trace->cat, cat, sizeof(trace->cat));
+    trace->id = id;
+    trace->refcount = 1;
+    return trace;
+}
+
+void trace_span(rbh_trace_t *trace, const char *name,
+                const struct timeval *start, const struct timeval *end)
+{
+    P(trace_lock);
+    if (trace->count < TRACE_MAX_SPANS) {
+        struct trace_span *span = &trace->spans[trace->count++];
+
+        span->name = name;
+        span->start = *start;
+        span->end = *end;
+    } else {
+        trace->dropped++;
+    }
+    V(trace_lock);
+}
+
+void trace_get(rbh_trace_t *trace)
+{
+    __sync_fetch_and_add(&trace->refcount, 1);
+}
+
+static inline unsigned long long tv_usec(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+/** write a "complete" event */
+static void write_event(const rbh_trace_t *trace, const char *name,
+                        unsigned long long start, unsigned long long end)
+{
+    fprintf(trace_file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%llu},\n",
+            name, trace->cat, start, end >= start ? end - start : 0,
+            (unsigned int)getpid(), (unsigned long long)trace->id);
+}
+
+/** write the events of a trace (trace_lock must be held) */
+static void trace_write(const rbh_trace_t *trace)
+{
+    unsigned long long start = 0, end = 0;
+    unsigned int i;
+
+    if (trace_file == NULL || trace->count == 0)
+        return;
+
+    /* the whole trace, containing the spans */
+    for (i = 0; i < trace->count; i++) {
+        unsigned long long s = tv_usec(&trace->spans[i].start);
+        unsigned long long e = tv_usec(&trace->spans[i].end);
+
+        if (start == 0 || s < start)
+            start = s;
+        if (e > end)
+            end = e;
+    }
+    write_event(trace, trace->name, start, end);
+
+    for (i = 0; i < trace->count; i++)
+        write_event(trace, trace->spans[i].name,
+                    tv_usec(&trace->spans[i].start),
+                    tv_usec(&trace->spans[i].end));
+
+    if (trace->dropped > 0)
+        DisplayLog(LVL_DEBUG, TRACE_TAG, "%u spans dropped for trace %s",
+                   trace->dropped, trace->name);
+    fflush(trace_file);
+}
+
+void trace_put(rbh_trace_t *trace)
+{
+    if (__sync_sub_and_fetch(&trace->refcount, 1) > 0)
+        return;
+
+    P(trace_lock);
+    trace_write(trace);
+    V(trace_lock);
+    MemFree(trace);
+}
@@ -22,6 +22,15 @@
  *
  * Cache user and groups relative information.
  *
+ * Lookups take no lock: each cache is an open addressing hash table of
+ * pointers to entries, that writers (serialized by a mutex) only change
+ * by publishing new pointers. Entries and tables that may still be read
+ * are never freed: a replaced entry results from a renamed user/group or
+ * a resolved unknown id, and old tables are at most the size of the
+ * current one.
+ * Failed lookups are cached too (negative entries), and entries expire:
+ * the first thread that gets an expired entry resolves it again, while
+ * other threads keep using the former value.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -32,15 +41,20 @@
 #include "RW_Lock.h"
 #include "rbh_logs.h"
 #include "Memory.h"
+#include "rbh_intern.h"
 
 #if HAVE_STRING_H
 #   include <string.h>
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
-
-#include <glib.h>
+#include <pthread.h>
 
 /* -------------- parameters ------------ */
 
@@ -50,29 +64,62 @@ size_t alt_groups_sz;
 /* init buffer size for group members for a group */
 size_t group_memb_sz;
 
+/* lifetime of cached names (seconds) */
+#define UIDGID_TTL      3600
+/* lifetime of failed lookups (seconds) */
+#define UIDGID_NEG_TTL  300
+/* initial number of hash table slots (power of 2) */
+#define UIDGID_INIT_SLOTS 1024
+
 #define LOGTAG  "UidGidCache"
 
 /* -------------- cache and hashtables management ------------ */
 
-typedef struct pw_cacheent__ {
-    struct passwd pw;
-} pw_cacheent_t;
-
-typedef struct gr_cacheent__ {
-    struct group gr;
-} gr_cacheent_t;
+typedef struct id_cacheent__ {
+    union {
+        struct passwd pw;
+        struct group  gr;
+    } u;
+    unsigned int    id;
+    bool            found;      /* false for a negative entry */
+    const char     *name;       /* pw_name or gr_name */
+    volatile time_t expire;
+    volatile int    refreshing; /* a thread is resolving it again */
+} id_cacheent_t;
+
+struct id_table {
+    unsigned int           mask;    /* slot count - 1 */
+    id_cacheent_t *volatile slots[];
+};
+
+/** resolve an id: fill the entry.
+ * @return 0 if found, ENOENT if the id does not exist, else an error */
+typedef int (*resolve_func_t)(unsigned int id, id_cacheent_t *ent);
+
+struct id_cache {
+    const char               *what;     /* for logs */
+    resolve_func_t            resolve;
+    pthread_mutex_t           lock;     /* serializes writers */
+    struct id_table *volatile table;
+    unsigned int              count;    /* used slots */
+};
+
+static int pw_resolve(unsigned int id, id_cacheent_t *ent);
+static int gr_resolve(unsigned int id, id_cacheent_t *ent);
 
 /* cache of PW entries */
-static struct {
-    rw_lock_t lock;
-    GHashTable *cache;
-} pw_hash;
+static struct id_cache pw_cache = {
+    .what = "user",
+    .resolve = pw_resolve,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /* cache of group entries */
-static struct {
-    rw_lock_t lock;
-    GHashTable *cache;
-} gr_hash;
+static struct id_cache gr_cache = {
+    .what = "group",
+    .resolve = gr_resolve,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /* stats about the cache */
 unsigned int pw_nb_set = 0;
@@ -80,224 +127,445 @@ unsigned int pw_nb_get = 0;
 unsigned int gr_nb_set = 0;
 unsigned int gr_nb_get = 0;
 
-/* ------------ exported functions ------------ */
+static inline unsigned int id_hash(unsigned int id)
+{
+    /* Knuth's multiplicative hash */
+    return id * 2654435761U;
+}
 
-/* Initialization of pwent and grent caches */
-int InitUidGid_Cache(void)
+static struct id_table *table_new(unsigned int slots)
 {
-    long res;
+    struct id_table *t;
 
-    /* initialize locks on hash table slots */
-    rw_lock_init(&pw_hash.lock);
-    pw_hash.cache = g_hash_table_new(NULL, NULL);
+    t = calloc(1, sizeof(*t) + slots * sizeof(t->slots[0]));
+    if (t != NULL)
+        t->mask = slots - 1;
+    return t;
+}
 
-    rw_lock_init(&gr_hash.lock);
-    gr_hash.cache = g_hash_table_new(NULL, NULL);
+/** @return the entry of id, or NULL */
+static id_cacheent_t *table_lookup(const struct id_table *t, unsigned int id)
+{
+    unsigned int i;
 
-    /* Try to size the memory needed to get the strings for getpwuid_r
-     * and getgrgid_r. */
-    res = sysconf(_SC_GETPW_R_SIZE_MAX);
-    if (res == -1 || res > 4096)
-        alt_groups_sz = 4096;
-    else
-        alt_groups_sz = res;
+    /* tables are never full */
+    for (i = id_hash(id) & t->mask;; i = (i + 1) & t->mask) {
+        id_cacheent_t *ent = t->slots[i];
 
-    res = sysconf(_SC_GETGR_R_SIZE_MAX);
-    if (res == -1 || res > 4096)
-        group_memb_sz = 4096;
-    else
-        group_memb_sz = res;
+        if (ent == NULL || ent->id == id)
+            return ent;
+    }
+}
+
+/** set the entry of an id, called with cache lock.
+ * @return false if the entry is new in the table. */
+static bool table_set(struct id_table *t, id_cacheent_t *ent)
+{
+    unsigned int i;
+
+    for (i = id_hash(ent->id) & t->mask;; i = (i + 1) & t->mask) {
+        id_cacheent_t *curr = t->slots[i];
+
+        if (curr == NULL || curr->id == ent->id) {
+            /* make the entry contents visible before the entry */
+            __sync_synchronize();
+            t->slots[i] = ent;
+            return curr != NULL;
+        }
+    }
+}
+
+/** double the size of a cache table, called with cache lock */
+static void cache_grow(struct id_cache *c)
+{
+    struct id_table *old = c->table;
+    struct id_table *new;
+    unsigned int i;
+
+    new = table_new(2 * (old->mask + 1));
+    if (new == NULL)
+        /* keep the current table, with a higher load */
+        return;
+
+    for (i = 0; i <= old->mask; i++)
+        if (old->slots[i] != NULL)
+            table_set(new, old->slots[i]);
+
+    __sync_synchronize();
+    c->table = new;
+    /* the old table may be in use by readers: it is not freed */
+}
 
+/** insert or replace an entry, called with cache lock */
+static void cache_set(struct id_cache *c, id_cacheent_t *ent)
+{
+    if (!table_set(c->table, ent)) {
+        c->count++;
+        /* keep a load factor below 1/2 */
+        if (2 * c->count > c->table->mask + 1)
+            cache_grow(c);
+    }
+}
+
+static void ent_free(id_cacheent_t *ent)
+{
+    /* names are interned: they are not freed */
+    free(ent);
+}
+
+/** check if a new resolution of an entry has the same result */
+static bool ent_same(const id_cacheent_t *e1, const id_cacheent_t *e2)
+{
+    if (e1->found != e2->found)
+        return false;
+    /* interned names */
+    return !e1->found || e1->name == e2->name;
+}
+
+/** resolve an id to a new entry (NULL on error, except not found) */
+static id_cacheent_t *ent_resolve(struct id_cache *c, unsigned int id)
+{
+    id_cacheent_t *ent;
+    int rc;
+
+    ent = calloc(1, sizeof(*ent));
+    if (ent == NULL)
+        return NULL;
+
+    ent->id = id;
+    rc = c->resolve(id, ent);
+    if (rc == 0) {
+        ent->found = true;
+        ent->expire = time(NULL) + UIDGID_TTL;
+    } else if (rc == ENOENT) {
+        ent->found = false;
+        ent->expire = time(NULL) + UIDGID_NEG_TTL;
+    } else {
+        free(ent);
+        return NULL;
+    }
+    return ent;
+}
+
+/** resolve an expired entry again */
+static id_cacheent_t *ent_refresh(struct id_cache *c, id_cacheent_t *ent)
+{
+    id_cacheent_t *new = ent_resolve(c, ent->id);
+
+    if (new == NULL || ent_same(ent, new)) {
+        /* keep the current entry, and retry later on error */
+        ent->expire = time(NULL) + (new == NULL ? UIDGID_NEG_TTL :
+                                    (ent->found ? UIDGID_TTL :
+                                     UIDGID_NEG_TTL));
+        __sync_synchronize();
+        ent->refreshing = 0;
+        if (new != NULL)
+            ent_free(new);
+        return ent;
+    }
+
+    DisplayLog(LVL_DEBUG, LOGTAG, "%s %u changed: %s -> %s", c->what,
+               ent->id, ent->found ? ent->name : "(none)",
+               new->found ? new->name : "(none)");
+
+    P(c->lock);
+    cache_set(c, new);
+    V(c->lock);
+    /* the former entry may be in use by readers: it is not freed */
+    return new;
+}
+
+/** get the entry of an id (NULL on error) */
+static id_cacheent_t *cache_get(struct id_cache *c, unsigned int id,
+                                unsigned int *nb_get, unsigned int *nb_set)
+{
+    id_cacheent_t *ent, *curr;
+
+    ent = table_lookup(c->table, id);
+    if (ent != NULL) {
+        if (ent->found)
+            (*nb_get)++;
+
+        if (time(NULL) < ent->expire
+            || !__sync_bool_compare_and_swap(&ent->refreshing, 0, 1))
+            /* valid, or another thread is refreshing it */
+            return ent;
+
+        return ent_refresh(c, ent);
+    }
+
+    ent = ent_resolve(c, id);
+    if (ent == NULL)
+        return NULL;
+
+    /* insert it to hash table */
+    P(c->lock);
+
+    /* Another thread may have inserted it in the meantime. Check
+     * again. */
+    curr = table_lookup(c->table, id);
+    if (curr != NULL) {
+        ent_free(ent);
+        ent = curr;
+        if (ent->found)
+            (*nb_get)++;
+    } else {
+        cache_set(c, ent);
+        if (ent->found)
+            (*nb_set)++;
+    }
+    V(c->lock);
+
+    return ent;
+}
+
+/* -------------- system lookups ------------ */
+
+/** error codes of get*id_r that mean the id was not found */
+static inline bool not_found(int rc)
+{
+    return rc == 0 || rc == ENOENT || rc == ESRCH || rc == EBADF
+        || rc == EPERM;
+}
+
+/** keep the uid, gid and the name of a passwd entry */
+static int pw_set(id_cacheent_t *ent, const struct passwd *pw)
+{
+    ent->u.pw = *pw;
+
+    /* We only care about the name */
+    ent->u.pw.pw_name = (char *)str_intern(pw->pw_name);
+    if (ent->u.pw.pw_name == NULL)
+        return ENOMEM;
+    ent->name = ent->u.pw.pw_name;
+
+    ent->u.pw.pw_passwd = NULL;
+    ent->u.pw.pw_gecos = NULL;
+    ent->u.pw.pw_dir = NULL;
+    ent->u.pw.pw_shell = NULL;
     return 0;
 }
 
-/* get user name for the given uid */
-const struct passwd *GetPwUid(uid_t owner)
+/** keep the gid and the name of a group entry */
+static int gr_set(id_cacheent_t *ent, const struct group *gr)
 {
+    ent->u.gr = *gr;
+
+    /* We only care about the name */
+    ent->u.gr.gr_name = (char *)str_intern(gr->gr_name);
+    if (ent->u.gr.gr_name == NULL)
+        return ENOMEM;
+    ent->name = ent->u.gr.gr_name;
+
+    ent->u.gr.gr_passwd = NULL;
+    ent->u.gr.gr_mem = NULL;
+    return 0;
+}
+
+static int pw_resolve(unsigned int id, id_cacheent_t *ent)
+{
+    struct passwd  pw;
     struct passwd *result;
-    pw_cacheent_t *p_pwcacheent;
-    pw_cacheent_t *entry2;
-    int            rc;
     char          *buffer;
-    int            buf_size;
-
-    /* is the entry in the cache? */
-    P_r(&pw_hash.lock);
-    p_pwcacheent =
-        g_hash_table_lookup(pw_hash.cache, (void *)(uintptr_t) owner);
-    V_r(&pw_hash.lock);
-
-    if (p_pwcacheent)
-        pw_nb_get++;
-
-    /* if no, allocate a pw cache entry
-     * and ask the system to fill it */
-    if (p_pwcacheent == NULL) {
-        /* entry allocation */
-        p_pwcacheent = calloc(1, sizeof(pw_cacheent_t));
-        if (p_pwcacheent == NULL)
-            return NULL;
-
-        buf_size = alt_groups_sz;
-        buffer = malloc(buf_size);
-        if (buffer == NULL)
-            goto out_free;
+    size_t         buf_size = alt_groups_sz;
+    int            rc;
+
+    buffer = malloc(buf_size);
+    if (buffer == NULL)
+        return ENOMEM;
 
  retry:
-        rc = getpwuid_r(owner, &p_pwcacheent->pw, buffer, buf_size, &result);
-        if (rc != 0 || result == NULL) {
-            /* try with larger buff */
-            if (rc == ERANGE) {
-                buf_size *= 2;
-                DisplayLog(LVL_FULL, LOGTAG,
-                           "got ERANGE error from getpwuid_r: trying with buf_size=%u",
-                           buf_size);
-                buffer = realloc(buffer, buf_size);
-                if (buffer == NULL)
-                    goto out_free;
-                else
-                    goto retry;
+    rc = getpwuid_r(id, &pw, buffer, buf_size, &result);
+    if (rc != 0 || result == NULL) {
+        /* try with larger buff */
+        if (rc == ERANGE) {
+            char *new_buf;
+
+            buf_size *= 2;
+            DisplayLog(LVL_FULL, LOGTAG,
+                       "got ERANGE error from getpwuid_r: trying with buf_size=%zu",
+                       buf_size);
+            new_buf = realloc(buffer, buf_size);
+            if (new_buf == NULL) {
+                rc = ENOMEM;
+                goto out_free;
             }
-            if (rc != 0 && rc != ENOENT && rc != ESRCH &&
-                rc != EBADF && rc != EPERM)
-                DisplayLog(LVL_CRIT, LOGTAG, "ERROR %d in getpwuid_r: %s",
-                           rc, strerror(rc));
-            goto out_free;
+            buffer = new_buf;
+            goto retry;
         }
-
-        /* We only care about the name */
-        p_pwcacheent->pw.pw_name = strdup(p_pwcacheent->pw.pw_name);
-        if (p_pwcacheent->pw.pw_name == NULL)
-            goto out_free;
-
-        p_pwcacheent->pw.pw_passwd = NULL;
-        p_pwcacheent->pw.pw_gecos = NULL;
-        p_pwcacheent->pw.pw_dir = NULL;
-        p_pwcacheent->pw.pw_shell = NULL;
-
-        free(buffer);
-
-        /* insert it to hash table */
-        P_w(&pw_hash.lock);
-
-        /* Another thread may have inserted it in the meantime. Check
-         * again. */
-        entry2 = g_hash_table_lookup(pw_hash.cache, (void *)(uintptr_t) owner);
-        if (entry2) {
-            free(p_pwcacheent->pw.pw_name);
-            free(p_pwcacheent);
-            p_pwcacheent = entry2;
-            pw_nb_get++;
+        if (not_found(rc)) {
+            rc = ENOENT;
         } else {
-            g_hash_table_insert(pw_hash.cache,
-                                (void *)(uintptr_t) p_pwcacheent->pw.pw_uid,
-                                p_pwcacheent);
-            pw_nb_set++;
+            DisplayLog(LVL_CRIT, LOGTAG, "ERROR %d in getpwuid_r: %s",
+                       rc, strerror(rc));
         }
-        V_w(&pw_hash.lock);
+        goto out_free;
     }
 
-    return &p_pwcacheent->pw;
+    rc = pw_set(ent, &pw);
 
  out_free:
-    if (p_pwcacheent != NULL) {
-        free(buffer);
-        free(p_pwcacheent);
-    }
-    return NULL;
+    free(buffer);
+    return rc;
 }
 
-const struct group *GetGrGid(gid_t grid)
+static int gr_resolve(unsigned int id, id_cacheent_t *ent)
 {
+    struct group   gr;
     struct group  *result;
-    gr_cacheent_t *p_grcacheent;
-    gr_cacheent_t *entry2;
-    int            rc;
     char          *buffer;
-    int            buf_size;
+    size_t         buf_size = group_memb_sz;
+    int            rc;
 
-    /* is the entry in the cache? */
-    P_r(&gr_hash.lock);
-    p_grcacheent = g_hash_table_lookup(gr_hash.cache, (void *)(uintptr_t) grid);
-    V_r(&gr_hash.lock);
+    buffer = malloc(buf_size);
+    if (buffer == NULL)
+        return ENOMEM;
 
-    if (p_grcacheent)
-        gr_nb_get++;
+ retry:
+    rc = getgrgid_r(id, &gr, buffer, buf_size, &result);
+    if (rc != 0 || result == NULL) {
+        /* try with larger buff */
+        if (rc == ERANGE) {
+            char *new_buf;
+
+            buf_size *= 2;
+            DisplayLog(LVL_FULL, LOGTAG,
+                       "got ERANGE error from getgrgid_r: trying with buf_size=%zu",
+                       buf_size);
+            new_buf = realloc(buffer, buf_size);
+            if (new_buf == NULL) {
+                rc = ENOMEM;
+                goto out_free;
+            }
+            buffer = new_buf;
+            goto retry;
+        }
+        if (not_found(rc)) {
+            /* gid not found */
+            rc = ENOENT;
+        } else {
+            DisplayLog(LVL_CRIT, LOGTAG, "ERROR %d in getgrgid_r : %s",
+                       rc, strerror(rc));
+        }
+        goto out_free;
+    }
 
-    /* if no, allocate a gr cache entry
-     * and ask the system to fill it */
-    if (p_grcacheent == NULL) {
-        /* entry allocation */
-        p_grcacheent = calloc(1, sizeof(gr_cacheent_t));
-        if (p_grcacheent == NULL)
-            return NULL;
+    rc = gr_set(ent, &gr);
 
-        buf_size = group_memb_sz;
-        buffer = malloc(buf_size);
-        if (buffer == NULL)
-            goto out_free;
+ out_free:
+    free(buffer);
+    return rc;
+}
 
- retry:
-        rc = getgrgid_r(grid, &p_grcacheent->gr, buffer, buf_size, &result);
-        if (rc != 0 || result == NULL) {
-            /* try with larger buff */
-            if (rc == ERANGE) {
-                buf_size *= 2;
-                DisplayLog(LVL_FULL, LOGTAG,
-                           "got ERANGE error from getgrgid_r: trying with buf_size=%u",
-                           buf_size);
-                buffer = realloc(buffer, buf_size);
-                if (buffer == NULL)
-                    goto out_free;
-                else
-                    goto retry;
-            }
+/* ------------ exported functions ------------ */
 
-            if (rc != 0 && rc != ENOENT && rc != ESRCH &&
-                rc != EBADF && rc != EPERM)
-                DisplayLog(LVL_CRIT, LOGTAG, "ERROR %d in getgrgid_r : %s",
-                           rc, strerror(rc));
+/* Initialization of pwent and grent caches */
+int InitUidGid_Cache(void)
+{
+    long res;
 
-            /* gid not found */
-            goto out_free;
-        }
+    pw_cache.table = table_new(UIDGID_INIT_SLOTS);
+    gr_cache.table = table_new(UIDGID_INIT_SLOTS);
+    if (pw_cache.table == NULL || gr_cache.table == NULL)
+        return ENOMEM;
 
-        /* We only care about the name */
-        p_grcacheent->gr.gr_name = strdup(p_grcacheent->gr.gr_name);
-        if (p_grcacheent->gr.gr_name == NULL)
-            goto out_free;
+    /* Try to size the memory needed to get the strings for getpwuid_r
+     * and getgrgid_r. */
+    res = sysconf(_SC_GETPW_R_SIZE_MAX);
+    if (res == -1 || res > 4096)
+        alt_groups_sz = 4096;
+    else
+        alt_groups_sz = res;
 
-        p_grcacheent->gr.gr_passwd = NULL;
-        p_grcacheent->gr.gr_mem = NULL;
+    res = sysconf(_SC_GETGR_R_SIZE_MAX);
+    if (res == -1 || res > 4096)
+        group_memb_sz = 4096;
+    else
+        group_memb_sz = res;
 
-        free(buffer);
+    return 0;
+}
 
-        /* insert it to hash table */
-        P_w(&gr_hash.lock);
+/** add an enumerated entry, if it is not already cached */
+static void prefetch_add(struct id_cache *c, id_cacheent_t *ent,
+                         unsigned int *nb_set)
+{
+    ent->found = true;
+    ent->expire = time(NULL) + UIDGID_TTL;
+
+    P(c->lock);
+    if (table_lookup(c->table, ent->id) != NULL) {
+        ent_free(ent);
+    } else {
+        cache_set(c, ent);
+        (*nb_set)++;
+    }
+    V(c->lock);
+}
 
-        /* Another thread may have inserted it in the meantime. Check
-         * again. */
-        entry2 = g_hash_table_lookup(gr_hash.cache, (void *)(uintptr_t) grid);
-        if (entry2) {
-            free(p_grcacheent->gr.gr_name);
-            free(p_grcacheent);
-            p_grcacheent = entry2;
-            gr_nb_get++;
-        } else {
-            g_hash_table_insert(gr_hash.cache,
-                                (void *)(uintptr_t) p_grcacheent->gr.gr_gid,
-                                p_grcacheent);
-            gr_nb_set++;
+void UidGidCache_Prefetch(void)
+{
+    struct passwd *pw;
+    struct group  *gr;
+    unsigned int   nb_pw = 0, nb_gr = 0;
+
+    /* enumeration functions are not reentrant: this is only called by
+     * the main thread (at startup, and periodically by standby daemons) */
+    setpwent();
+    while ((pw = getpwent()) != NULL) {
+        id_cacheent_t *ent = calloc(1, sizeof(*ent));
+
+        if (ent == NULL)
+            break;
+        ent->id = pw->pw_uid;
+        if (pw_set(ent, pw)) {
+            free(ent);
+            break;
+        }
+        prefetch_add(&pw_cache, ent, &pw_nb_set);
+        nb_pw++;
+    }
+    endpwent();
+
+    setgrent();
+    while ((gr = getgrent()) != NULL) {
+        id_cacheent_t *ent = calloc(1, sizeof(*ent));
+
+        if (ent == NULL)
+            break;
+        ent->id = gr->gr_gid;
+        if (gr_set(ent, gr)) {
+            free(ent);
+            break;
         }
-        V_w(&gr_hash.lock);
+        prefetch_add(&gr_cache, ent, &gr_nb_set);
+        nb_gr++;
     }
+    endgrent();
 
-    return &p_grcacheent->gr;
+    DisplayLog(LVL_VERB, LOGTAG, "Prefetched %u users and %u groups",
+               nb_pw, nb_gr);
+}
 
- out_free:
-    if (p_grcacheent != NULL) {
-        free(buffer);
-        free(p_grcacheent);
-    }
-    return NULL;
+/* get user name for the given uid */
+const struct passwd *GetPwUid(uid_t owner)
+{
+    id_cacheent_t *ent;
+
+    ent = cache_get(&pw_cache, owner, &pw_nb_get, &pw_nb_set);
+    if (ent == NULL || !ent->found)
+        return NULL;
+
+    return &ent->u.pw;
+}
+
+const struct group *GetGrGid(gid_t grid)
+{
+    id_cacheent_t *ent;
+
+    ent = cache_get(&gr_cache, grid, &gr_nb_get, &gr_nb_set);
+    if (ent == NULL || !ent->found)
+        return NULL;
+
+    return &ent->u.gr;
 }
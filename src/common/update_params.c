@@ -41,6 +41,7 @@ static void set_default_update_params(void *module_config)
     params->path.period_max = 3600;
 #endif
     params->fileclass.when = UPDT_ALWAYS;
+    params->refresh_rate = 0;
 }
 
 static void write_default_update_params(FILE *output)
@@ -51,6 +52,7 @@ static void write_default_update_params(FILE *output)
     print_line(output, 1, "path_update      : on_event_periodic(0,1h);");
 #endif
     print_line(output, 1, "fileclass_update : always;");
+    print_line(output, 1, "refresh_rate     : 0 (disabled);");
     print_end_block(output, 0);
 }
 
@@ -76,6 +78,11 @@ static void write_update_params_template(FILE *output)
 #endif
     print_line(output, 1, "# File classes matching");
     print_line(output, 1, "fileclass_update = always ;");
+    fprintf(output, "\n");
+    print_line(output, 1, "# Daemon mode: max number of entries per second whose");
+    print_line(output, 1, "# periodic update is due, refreshed between scans");
+    print_line(output, 1, "# (0 = only refresh entries when they are scanned)");
+    print_line(output, 1, "#refresh_rate = 1000 ;");
 
     print_end_block(output, 0);
 }
@@ -177,6 +184,7 @@ static int read_update_params(config_file_t config, void *module_config,
     char             tmpstr[1024];
     char           **options = NULL;
     unsigned int     nb_options = 0;
+    int              intval;
     config_item_t    updt_block;
 
     static const char *update_allow[] = {
@@ -185,6 +193,7 @@ static int read_update_params(config_file_t config, void *module_config,
         "path_update",
 #endif
         "fileclass_update",
+        "refresh_rate",
         NULL
     };
 
@@ -255,6 +264,13 @@ static int read_update_params(config_file_t config, void *module_config,
         }
     }
 
+    rc = GetIntParam(updt_block, UPDT_PARAMS_BLOCK, "refresh_rate",
+                     PFLG_POSITIVE, &intval, NULL, NULL, msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    if (rc != ENOENT)
+        params->refresh_rate = intval;
+
     CheckUnknownParameters(updt_block, UPDT_PARAMS_BLOCK, update_allow);
     return 0;
 }
@@ -296,6 +312,13 @@ static int reload_update_params(void *module_config)
         updt_params.fileclass = params->fileclass;
     }
 
+    if (updt_params.refresh_rate != params->refresh_rate) {
+        DisplayLog(LVL_EVENT, TAG,
+                   UPDT_PARAMS_BLOCK "::refresh_rate updated: %u->%u",
+                   updt_params.refresh_rate, params->refresh_rate);
+        updt_params.refresh_rate = params->refresh_rate;
+    }
+
     return 0;
 }
 
@@ -377,6 +400,21 @@ bool need_fileclass_update(const attr_set_t *p_attrs)
     return -1;
 }
 
+bool fileclass_attrs_changed(const attr_set_t *p_db_attrs,
+                             const attr_set_t *p_new_attrs,
+                             const attr_mask_t *depends)
+{
+    attr_mask_t changed;
+    attr_mask_t tmp;
+
+    changed = ListMgr_WhatDiff(p_new_attrs, p_db_attrs);
+    tmp = attr_mask_and_not(&p_new_attrs->attr_mask, &p_db_attrs->attr_mask);
+    changed = attr_mask_or(&changed, &tmp);
+    changed = attr_mask_and(&changed, depends);
+
+    return !attr_mask_is_null(changed);
+}
+
 /**
  *  Check if path or md needs to be updated
  *  \param p_allow_event [out] if set to TRUE, the path
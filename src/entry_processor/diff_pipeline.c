@@ -23,6 +23,7 @@
 #include "rbh_misc.h"
 #include "entry_processor.h"
 #include "entry_proc_tools.h"
+#include "diff_recov.h"
 #include "Memory.h"
 #include "status_manager.h"
 #include <errno.h>
@@ -1009,184 +1010,6 @@ static void no_tag_cb(const entry_id_t *p_id)
         printf("--"DFID"\n", PFID(p_id));
 }
 
-#ifdef _HSM_LITE
-static int hsm_recover(lmgr_t * lmgr,
-                       entry_id_t *p_id,
-                       attr_set_t *p_oldattr)
-{
-    recov_status_t st;
-    entry_id_t new_id;
-    attr_set_t new_attrs;
-    int rc;
-    const char * status_str;
-
-    /* try to recover from backend */
-
-    /** FIXME use undelete function from a status manager */
-    st = RS_ERROR;
-    //st = rbhext_recover(p_id, p_oldattr, &new_id, &new_attrs, NULL);
-    switch (st)
-    {
-        case RS_FILE_OK:
-        case RS_FILE_EMPTY:
-        case RS_NON_FILE:
-        case RS_FILE_DELTA:
-
-            attr_mask_unset_readonly(&new_attrs.attr_mask);
-            rc = ListMgr_Replace(lmgr, p_id, p_oldattr, &new_id, &new_attrs,
-                                 true, true);
-            if (rc)
-            {
-                DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to replace entry "
-                           DFID" with "DFID" (%s) in DB.",
-                           PFID(p_id), PFID(&new_id), ATTR(&new_attrs, fullpath));
-                goto clean_entry;
-            }
-
-            status_str = "?";
-            if (st == RS_FILE_OK)
-                status_str = "up-to-date file";
-            else if (st == RS_FILE_EMPTY)
-                status_str = "empty file";
-            else if (st == RS_FILE_DELTA)
-                status_str = "old file data";
-            else if (st == RS_NON_FILE)
-                status_str = "non-file";
-
-            DisplayReport("%s successfully recovered (%s)", ATTR(&new_attrs, fullpath), status_str);
-            return 0;
-
-        case RS_NOBACKUP:
-            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "No backup available for entry '%s'",
-                       ATTR(p_oldattr, fullpath));
-            goto clean_entry;
-        case RS_ERROR:
-        default:
-            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to restore entry '%s' (status=%d)",
-                       ATTR(p_oldattr, fullpath), st);
-            goto clean_entry;
-    }
-
-clean_entry:
-    /* clean new entry (inconsistent) */
-    if (!strcmp(ATTR(p_oldattr, type), STR_TYPE_DIR))
-        rc = rmdir(ATTR(p_oldattr, fullpath));
-    else
-        rc = unlink(ATTR(p_oldattr, fullpath));
-    if (rc)
-        DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "cleanup: unlink/rmdir failed: %s",
-                   strerror(errno));
-
-    /* failure */
-    return -1;
-}
-#endif
-
-static int std_recover(lmgr_t * lmgr,
-                       entry_id_t *p_id,
-                       attr_set_t *p_oldattr)
-{
-    entry_id_t new_id;
-    attr_set_t new_attrs;
-    int rc;
-
-    rc = create_from_attrs(p_oldattr, &new_attrs, &new_id, false, false);
-    if (rc)
-    {
-        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to create entry '%s' (status=%d)",
-                       ATTR(p_oldattr, fullpath), rc);
-        goto clean_entry;
-    }
-
-#ifdef _LUSTRE
-#ifndef _MDT_SPECIFIC_LOVEA
-    if (diff_arg->lovea_file)
-    {
-        if (!ATTR_MASK_TEST(&new_attrs, fullpath))
-        {
-            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Fullpath needed to write into lovea_file");
-        }
-        else
-        {
-            /* associate old stripe objects to new object id */
-            char buff[4096];
-            ssize_t sz = BuildLovEA(&new_id, p_oldattr, buff, 4096);
-            if (sz > 0)
-            {
-                int i;
-                char output[4096];
-                char relpath[RBH_PATH_MAX];
-                char * curr = output;
-
-                if (relative_path(ATTR(&new_attrs, fullpath), global_config.fs_path,
-                              relpath) == 0)
-                {
-
-                    /* write as a single line to avoid mixing them */
-                    curr += sprintf(curr, "%s ", relpath);
-
-                    /* write output for set_lovea tool */
-                    for (i = 0 ; i < sz; i++ )
-                        curr += sprintf(curr, "%02hhx", buff[i]);
-                    sprintf(curr, "\n");
-
-                    fprintf(diff_arg->lovea_file, "%s", output);
-
-                    /* XXX overwrite stripe info in new attrs? */
-        //            ATTR(&new_attrs, stripe_info) = ATTR(p_oldattr, stripe_info);
-        //            ATTR(&new_attrs, stripe_items) = ATTR(p_oldattr, stripe_items);
-                }
-            }
-        }
-    }
-    if (diff_arg->fid_remap_file)
-    {
-        /* print for each stripe: ost index, stripe_number, object id, old fid, new fid */
-        if (ATTR_MASK_TEST(p_oldattr, stripe_items))
-        {
-            int i;
-            stripe_items_t *pstripe = &ATTR(p_oldattr, stripe_items);
-            for (i = 0; i < pstripe->count; i++)
-            {
-                fprintf(diff_arg->fid_remap_file, "%u %u %"PRIu64" "DFID" "DFID"\n",
-                        pstripe->stripe[i].ost_idx, i,
-                        pstripe->stripe[i].obj_id,
-                        PFID(p_id), PFID(&new_id));
-            }
-        }
-    }
-#endif
-#endif
-
-    /* insert the new entry to the DB */
-    attr_mask_unset_readonly(&new_attrs.attr_mask);
-    rc = ListMgr_Replace(lmgr, p_id, p_oldattr, &new_id, &new_attrs,
-                         true, true);
-    if (rc)
-    {
-        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to replace entry "
-                   DFID" with "DFID" (%s) in DB.",
-                   PFID(p_id), PFID(&new_id), ATTR(&new_attrs, fullpath));
-        goto clean_entry;
-    }
-
-    return 0;
-
-clean_entry:
-    /* clean new entry (inconsistent) */
-    if (!strcmp(ATTR(p_oldattr, type), STR_TYPE_DIR))
-        rc = rmdir(ATTR(p_oldattr, fullpath));
-    else
-        rc = unlink(ATTR(p_oldattr, fullpath));
-    if (rc)
-        DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "cleanup: unlink/rmdir failed: %s",
-                   strerror(errno));
-
-    /* failure */
-    return -1;
-}
-
-
 static int EntryProc_report_rm(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
 {
     int            rc;
@@ -1258,6 +1081,16 @@ static int EntryProc_report_rm(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
             struct lmgr_iterator_t *it;
             entry_id_t id;
             attr_set_t attrs;
+            recov_sched_t *sched = NULL;
+
+            if ((diff_arg->apply == APPLY_FS)
+                && !(pipeline_flags & RUNFLG_DRY_RUN))
+            {
+                sched = recov_sched_new(diff_arg->recov_threads);
+                if (sched == NULL)
+                    DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                               "Error: cannot allocate recovery scheduler");
+            }
 
             it = ListMgr_ListUntagged(lmgr, diff_arg->db_tag, NULL);
 
@@ -1296,25 +1129,22 @@ static int EntryProc_report_rm(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
                         /* create or recover it (even without HSM mode) */
 #ifdef _HSM_LITE
                         if (diff_arg->recov_from_backend)
-                        {
                             /* try to recover the entry from the backend */
                             DisplayReport("%srecover(%s)",
                                           (pipeline_flags & RUNFLG_DRY_RUN)?"(dry-run) ":"",
                                           ATTR(&attrs, fullpath));
-                            /** FIXME use undelete function from status manager */
-                            if (!(pipeline_flags & RUNFLG_DRY_RUN))
-                                hsm_recover(lmgr, &id, &attrs);
-                        }
                         else
 #endif
-                        {
                             /* create the file with no stripe and generate lovea information to be set on MDT */
                             DisplayReport("%screate(%s)",
                                           (pipeline_flags & RUNFLG_DRY_RUN)?"(dry-run) ":"",
                                           ATTR(&attrs, fullpath));
-                            if (!(pipeline_flags & RUNFLG_DRY_RUN))
-                                std_recover(lmgr, &id, &attrs);
-                        }
+
+                        /* directories are created first, other entries
+                         * in a second pass */
+                        if (sched != NULL && ATTR_MASK_TEST(&attrs, type)
+                            && !strcmp(ATTR(&attrs, type), STR_TYPE_DIR))
+                            recov_sched_add_dir(sched, &id, &attrs);
                     }
                     else /* apply=db */
                     {
@@ -1331,8 +1161,42 @@ static int EntryProc_report_rm(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
                 }
 
                 ListMgr_CloseIterator( it );
+
+                if (sched != NULL)
+                {
+                    recov_sched_create_dirs(sched);
+
+                    /* now that all directories exist, create the other
+                     * entries */
+                    it = ListMgr_ListUntagged(lmgr, diff_arg->db_tag, NULL);
+                    if (it == NULL)
+                    {
+                        DisplayLog( LVL_CRIT, ENTRYPROC_TAG,
+                                    "Error: ListMgr_ListUntagged operation failed." );
+                    }
+                    else
+                    {
+                        attrs.attr_mask = getattr_mask;
+                        while ((rc = ListMgr_GetNext(it, &id, &attrs))
+                               == DB_SUCCESS)
+                        {
+                            if (!ATTR_MASK_TEST(&attrs, type)
+                                || strcmp(ATTR(&attrs, type), STR_TYPE_DIR))
+                                recov_sched_add_entry(sched, &id, &attrs);
+
+                            ListMgr_FreeAttrs(&attrs);
+                            attrs.attr_mask = getattr_mask;
+                        }
+                        ListMgr_CloseIterator(it);
+                    }
+
+                    recov_sched_finish(sched);
+                }
             }
 
+            if (sched != NULL)
+                recov_sched_free(sched);
+
             /* can now destroy the tag */
             rc = ListMgr_DestroyTag(lmgr, diff_arg->db_tag);
             if (rc)
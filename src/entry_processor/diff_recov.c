@@ -0,0 +1,552 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Parallel recreation of the entries missing in the filesystem
+ * (see diff_recov.h).
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "diff_recov.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "entry_processor.h"
+#include "entry_proc_tools.h"
+#include "Memory.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+
+#define diff_arg ((diff_arg_t*)entry_proc_arg)
+
+/* lovea/fid_remap output of a worker is written above this size */
+#define RECOV_OUTPUT_FLUSH  (64 * 1024)
+
+typedef struct recov_item {
+    entry_id_t   id;        /* id in DB */
+    entry_id_t   new_id;    /* id of the created entry */
+    attr_set_t   attrs;     /* attributes in DB */
+    unsigned int depth;
+    bool         created;
+} recov_item_t;
+
+struct recov_sched {
+    unsigned int     nb_threads;
+    GPtrArray       *dirs;
+    GPtrArray       *batch;
+
+    /* protects lovea_file and fid_remap_file */
+    pthread_mutex_t  out_lock;
+
+    /* stats */
+    unsigned int     nb_dirs;
+    unsigned int     nb_entries;
+    unsigned int     nb_errors;
+    time_t           start;
+};
+
+typedef void (*recov_func_t)(lmgr_t *lmgr, recov_item_t *item,
+                             GString *lovea, GString *remap);
+
+/** a step of the recovery run by all threads */
+typedef struct recov_phase {
+    recov_sched_t   *sched;
+    recov_item_t   **items;
+    unsigned int     count;
+    unsigned int     next;  /* next item to be processed */
+    recov_func_t     func;
+} recov_phase_t;
+
+typedef struct recov_worker {
+    pthread_t        thread_id;
+    recov_phase_t   *phase;
+    GString         *lovea;
+    GString         *remap;
+} recov_worker_t;
+
+static void recov_item_free(gpointer ptr)
+{
+    recov_item_t *item = ptr;
+
+    ListMgr_FreeAttrs(&item->attrs);
+    MemFree(item);
+}
+
+static unsigned int path_depth(const attr_set_t *p_attrs)
+{
+    const char *c;
+    unsigned int depth = 0;
+
+    if (!ATTR_MASK_TEST(p_attrs, fullpath))
+        return 0;
+
+    for (c = ATTR(p_attrs, fullpath); *c != '\0'; c++)
+        if (*c == '/')
+            depth++;
+    return depth;
+}
+
+/** write the output of a worker */
+static void recov_output_flush(recov_sched_t *sched, GString *lovea,
+                               GString *remap)
+{
+    if (lovea->len == 0 && remap->len == 0)
+        return;
+
+    P(sched->out_lock);
+    if (lovea->len > 0 && diff_arg->lovea_file)
+        fwrite(lovea->str, 1, lovea->len, diff_arg->lovea_file);
+    if (remap->len > 0 && diff_arg->fid_remap_file)
+        fwrite(remap->str, 1, remap->len, diff_arg->fid_remap_file);
+    V(sched->out_lock);
+
+    g_string_truncate(lovea, 0);
+    g_string_truncate(remap, 0);
+}
+
+/** clean a new entry (inconsistent) */
+static void clean_new_entry(const attr_set_t *p_oldattr)
+{
+    int rc;
+
+    if (!strcmp(ATTR(p_oldattr, type), STR_TYPE_DIR))
+        rc = rmdir(ATTR(p_oldattr, fullpath));
+    else
+        rc = unlink(ATTR(p_oldattr, fullpath));
+    if (rc)
+        DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "cleanup: unlink/rmdir failed: %s",
+                   strerror(errno));
+}
+
+#ifdef _HSM_LITE
+static int hsm_recover(lmgr_t * lmgr,
+                       entry_id_t *p_id,
+                       attr_set_t *p_oldattr,
+                       entry_id_t *p_new_id)
+{
+    recov_status_t st;
+    attr_set_t new_attrs;
+    int rc;
+    const char * status_str;
+
+    /* try to recover from backend */
+
+    /** FIXME use undelete function from a status manager */
+    st = RS_ERROR;
+    //st = rbhext_recover(p_id, p_oldattr, p_new_id, &new_attrs, NULL);
+    switch (st)
+    {
+        case RS_FILE_OK:
+        case RS_FILE_EMPTY:
+        case RS_NON_FILE:
+        case RS_FILE_DELTA:
+
+            attr_mask_unset_readonly(&new_attrs.attr_mask);
+            rc = ListMgr_Replace(lmgr, p_id, p_oldattr, p_new_id, &new_attrs,
+                                 true, true);
+            if (rc)
+            {
+                DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to replace entry "
+                           DFID" with "DFID" (%s) in DB.",
+                           PFID(p_id), PFID(p_new_id), ATTR(&new_attrs, fullpath));
+                goto clean_entry;
+            }
+
+            status_str = "?";
+            if (st == RS_FILE_OK)
+                status_str = "up-to-date file";
+            else if (st == RS_FILE_EMPTY)
+                status_str = "empty file";
+            else if (st == RS_FILE_DELTA)
+                status_str = "old file data";
+            else if (st == RS_NON_FILE)
+                status_str = "non-file";
+
+            DisplayReport("%s successfully recovered (%s)", ATTR(&new_attrs, fullpath), status_str);
+            return 0;
+
+        case RS_NOBACKUP:
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "No backup available for entry '%s'",
+                       ATTR(p_oldattr, fullpath));
+            goto clean_entry;
+        case RS_ERROR:
+        default:
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to restore entry '%s' (status=%d)",
+                       ATTR(p_oldattr, fullpath), st);
+            goto clean_entry;
+    }
+
+clean_entry:
+    clean_new_entry(p_oldattr);
+    /* failure */
+    return -1;
+}
+#endif
+
+static int std_recover(lmgr_t * lmgr,
+                       entry_id_t *p_id,
+                       attr_set_t *p_oldattr,
+                       entry_id_t *p_new_id,
+                       GString *lovea, GString *remap)
+{
+    attr_set_t new_attrs;
+    int rc;
+
+    rc = create_from_attrs(p_oldattr, &new_attrs, p_new_id, false, false);
+    if (rc)
+    {
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to create entry '%s' (status=%d)",
+                       ATTR(p_oldattr, fullpath), rc);
+        goto clean_entry;
+    }
+
+#ifdef _LUSTRE
+#ifndef _MDT_SPECIFIC_LOVEA
+    if (diff_arg->lovea_file)
+    {
+        if (!ATTR_MASK_TEST(&new_attrs, fullpath))
+        {
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Fullpath needed to write into lovea_file");
+        }
+        else
+        {
+            /* associate old stripe objects to new object id */
+            char buff[4096];
+            ssize_t sz = BuildLovEA(p_new_id, p_oldattr, buff, 4096);
+            if (sz > 0)
+            {
+                int i;
+                char relpath[RBH_PATH_MAX];
+
+                if (relative_path(ATTR(&new_attrs, fullpath), global_config.fs_path,
+                              relpath) == 0)
+                {
+                    /* output for set_lovea tool */
+                    g_string_append_printf(lovea, "%s ", relpath);
+                    for (i = 0 ; i < sz; i++ )
+                        g_string_append_printf(lovea, "%02hhx", buff[i]);
+                    g_string_append_c(lovea, '\n');
+                }
+            }
+        }
+    }
+    if (diff_arg->fid_remap_file)
+    {
+        /* print for each stripe: ost index, stripe_number, object id, old fid, new fid */
+        if (ATTR_MASK_TEST(p_oldattr, stripe_items))
+        {
+            int i;
+            stripe_items_t *pstripe = &ATTR(p_oldattr, stripe_items);
+            for (i = 0; i < pstripe->count; i++)
+            {
+                g_string_append_printf(remap, "%u %u %"PRIu64" "DFID" "DFID"\n",
+                                       pstripe->stripe[i].ost_idx, i,
+                                       pstripe->stripe[i].obj_id,
+                                       PFID(p_id), PFID(p_new_id));
+            }
+        }
+    }
+#endif
+#endif
+
+    /* directory times are restored once their contents is created:
+     * store the final ones in the DB */
+    if (!strcmp(ATTR(p_oldattr, type), STR_TYPE_DIR))
+    {
+        if (ATTR_MASK_TEST(p_oldattr, last_mod))
+            ATTR(&new_attrs, last_mod) = ATTR(p_oldattr, last_mod);
+        if (ATTR_MASK_TEST(p_oldattr, last_access))
+            ATTR(&new_attrs, last_access) = ATTR(p_oldattr, last_access);
+    }
+
+    /* insert the new entry to the DB */
+    attr_mask_unset_readonly(&new_attrs.attr_mask);
+    rc = ListMgr_Replace(lmgr, p_id, p_oldattr, p_new_id, &new_attrs,
+                         true, true);
+    if (rc)
+    {
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Failed to replace entry "
+                   DFID" with "DFID" (%s) in DB.",
+                   PFID(p_id), PFID(p_new_id), ATTR(&new_attrs, fullpath));
+        ListMgr_FreeAttrs(&new_attrs);
+        goto clean_entry;
+    }
+
+    ListMgr_FreeAttrs(&new_attrs);
+    return 0;
+
+clean_entry:
+    clean_new_entry(p_oldattr);
+    /* failure */
+    return -1;
+}
+
+/** create an entry (recov_func_t) */
+static void recov_create(lmgr_t *lmgr, recov_item_t *item,
+                         GString *lovea, GString *remap)
+{
+    int rc;
+
+#ifdef _HSM_LITE
+    if (diff_arg->recov_from_backend)
+        /** FIXME use undelete function from status manager */
+        rc = hsm_recover(lmgr, &item->id, &item->attrs, &item->new_id);
+    else
+#endif
+        /* create the file with no stripe and generate lovea information
+         * to be set on MDT */
+        rc = std_recover(lmgr, &item->id, &item->attrs, &item->new_id,
+                         lovea, remap);
+
+    item->created = (rc == 0);
+}
+
+/** restore the times of a created directory (recov_func_t) */
+static void recov_dir_times(lmgr_t *lmgr, recov_item_t *item,
+                            GString *lovea, GString *remap)
+{
+    attr_mask_t mask = {.std = ATTR_MASK_last_access | ATTR_MASK_last_mod};
+
+    if (!item->created)
+        return;
+
+    if (ApplyAttrs(&item->new_id, &item->attrs, &item->attrs, mask, false))
+        DisplayLog(LVL_MAJOR, ENTRYPROC_TAG, "Failed to restore times of "
+                   "directory '%s'", ATTR(&item->attrs, fullpath));
+}
+
+static void *recov_worker_thr(void *arg)
+{
+    recov_worker_t *w = arg;
+    recov_phase_t  *phase = w->phase;
+    lmgr_t         *lmgr = NULL;
+    unsigned int    i;
+
+    if (phase->func != recov_dir_times) {
+        lmgr = ListMgr_Checkout();
+        if (lmgr == NULL) {
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                       "Recovery thread could not connect to the database");
+            return NULL;
+        }
+    }
+
+    while ((i = __sync_fetch_and_add(&phase->next, 1)) < phase->count) {
+        recov_item_t *item = phase->items[i];
+
+        phase->func(lmgr, item, w->lovea, w->remap);
+
+        if (phase->func == recov_create && !item->created)
+            __sync_fetch_and_add(&phase->sched->nb_errors, 1);
+
+        if (w->lovea->len + w->remap->len >= RECOV_OUTPUT_FLUSH)
+            recov_output_flush(phase->sched, w->lovea, w->remap);
+    }
+
+    recov_output_flush(phase->sched, w->lovea, w->remap);
+    if (lmgr != NULL)
+        ListMgr_Release(lmgr);
+    return NULL;
+}
+
+/** run func on the items, using all recovery threads */
+static void recov_run(recov_sched_t *sched, recov_item_t **items,
+                      unsigned int count, recov_func_t func)
+{
+    recov_phase_t   phase = {
+        .sched = sched,
+        .items = items,
+        .count = count,
+        .next = 0,
+        .func = func,
+    };
+    recov_worker_t *workers;
+    unsigned int    nb, i, started = 0;
+
+    if (count == 0)
+        return;
+
+    nb = MIN(sched->nb_threads, count);
+    workers = MemCalloc(nb, sizeof(*workers));
+    if (workers == NULL) {
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                   "Cannot allocate recovery threads");
+        return;
+    }
+
+    for (i = 0; i < nb; i++) {
+        workers[i].phase = &phase;
+        workers[i].lovea = g_string_new(NULL);
+        workers[i].remap = g_string_new(NULL);
+
+        if (pthread_create(&workers[i].thread_id, NULL, recov_worker_thr,
+                           &workers[i]) != 0) {
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                       "Error %d creating recovery thread: %s", errno,
+                       strerror(errno));
+            g_string_free(workers[i].lovea, TRUE);
+            g_string_free(workers[i].remap, TRUE);
+            break;
+        }
+        started++;
+    }
+
+    /* no thread: do it in the current one */
+    if (started == 0) {
+        recov_worker_t w = {.phase = &phase};
+
+        w.lovea = g_string_new(NULL);
+        w.remap = g_string_new(NULL);
+        recov_worker_thr(&w);
+        g_string_free(w.lovea, TRUE);
+        g_string_free(w.remap, TRUE);
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread_id, NULL);
+        g_string_free(workers[i].lovea, TRUE);
+        g_string_free(workers[i].remap, TRUE);
+    }
+    MemFree(workers);
+
+    P(sched->out_lock);
+    if (diff_arg->lovea_file)
+        fflush(diff_arg->lovea_file);
+    if (diff_arg->fid_remap_file)
+        fflush(diff_arg->fid_remap_file);
+    V(sched->out_lock);
+}
+
+recov_sched_t *recov_sched_new(unsigned int nb_threads)
+{
+    recov_sched_t *sched = MemCalloc(1, sizeof(*sched));
+
+    if (sched == NULL)
+        return NULL;
+
+    sched->nb_threads = nb_threads ? nb_threads : RECOV_DEFAULT_THREADS;
+    sched->dirs = g_ptr_array_new_with_free_func(recov_item_free);
+    sched->batch = g_ptr_array_new_with_free_func(recov_item_free);
+    pthread_mutex_init(&sched->out_lock, NULL);
+    sched->start = time(NULL);
+    return sched;
+}
+
+static recov_item_t *recov_item_new(const entry_id_t *p_id,
+                                    attr_set_t *p_attrs)
+{
+    recov_item_t *item = MemAlloc(sizeof(*item));
+
+    if (item == NULL)
+        return NULL;
+
+    item->id = *p_id;
+    /* take the ownership of attribute contents */
+    item->attrs = *p_attrs;
+    memset(p_attrs, 0, sizeof(*p_attrs));
+    item->depth = path_depth(&item->attrs);
+    item->created = false;
+    return item;
+}
+
+int recov_sched_add_dir(recov_sched_t *sched, const entry_id_t *p_id,
+                        attr_set_t *p_attrs)
+{
+    recov_item_t *item = recov_item_new(p_id, p_attrs);
+
+    if (item == NULL)
+        return -ENOMEM;
+
+    g_ptr_array_add(sched->dirs, item);
+    return 0;
+}
+
+static gint depth_cmp(gconstpointer a, gconstpointer b)
+{
+    const recov_item_t *i1 = *(const recov_item_t **)a;
+    const recov_item_t *i2 = *(const recov_item_t **)b;
+
+    return (gint)i1->depth - (gint)i2->depth;
+}
+
+void recov_sched_create_dirs(recov_sched_t *sched)
+{
+    recov_item_t **items;
+    unsigned int   first, last;
+
+    g_ptr_array_sort(sched->dirs, depth_cmp);
+    items = (recov_item_t **)sched->dirs->pdata;
+
+    /* the parents of a level are created by the previous one */
+    for (first = 0; first < sched->dirs->len; first = last) {
+        for (last = first; last < sched->dirs->len
+             && items[last]->depth == items[first]->depth; last++)
+            ;
+        DisplayLog(LVL_VERB, ENTRYPROC_TAG, "Creating %u directories "
+                   "of depth %u", last - first, items[first]->depth);
+        recov_run(sched, items + first, last - first, recov_create);
+    }
+    sched->nb_dirs = sched->dirs->len;
+}
+
+/** create the entries of the current batch */
+static void recov_batch_run(recov_sched_t *sched)
+{
+    recov_run(sched, (recov_item_t **)sched->batch->pdata, sched->batch->len,
+              recov_create);
+    sched->nb_entries += sched->batch->len;
+    g_ptr_array_set_size(sched->batch, 0);
+}
+
+int recov_sched_add_entry(recov_sched_t *sched, const entry_id_t *p_id,
+                          attr_set_t *p_attrs)
+{
+    recov_item_t *item = recov_item_new(p_id, p_attrs);
+
+    if (item == NULL)
+        return -ENOMEM;
+
+    g_ptr_array_add(sched->batch, item);
+    if (sched->batch->len >= RECOV_BATCH)
+        recov_batch_run(sched);
+    return 0;
+}
+
+void recov_sched_finish(recov_sched_t *sched)
+{
+    recov_batch_run(sched);
+
+    /* the creation of their contents changed the times of directories */
+    recov_run(sched, (recov_item_t **)sched->dirs->pdata, sched->dirs->len,
+              recov_dir_times);
+    g_ptr_array_set_size(sched->dirs, 0);
+
+    DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "Recovery: %u directories and %u "
+               "other entries processed in %lds, %u errors", sched->nb_dirs,
+               sched->nb_entries, (long)(time(NULL) - sched->start),
+               sched->nb_errors);
+}
+
+void recov_sched_free(recov_sched_t *sched)
+{
+    g_ptr_array_free(sched->dirs, TRUE);
+    g_ptr_array_free(sched->batch, TRUE);
+    pthread_mutex_destroy(&sched->out_lock);
+    MemFree(sched);
+}
@@ -0,0 +1,64 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Parallel recreation of the entries missing in the filesystem
+ * (rbh-diff --apply=fs).
+ *
+ * Directories are created first, one depth level at a time (the entries
+ * of a level are created in parallel). Other entries are then created in
+ * parallel by batches. The times of directories are restored at the end,
+ * once their contents have been created.
+ */
+#ifndef _DIFF_RECOV_H
+#define _DIFF_RECOV_H
+
+#include "list_mgr.h"
+
+/* default number of recovery threads */
+#define RECOV_DEFAULT_THREADS   8
+/* number of non-directory entries created per batch */
+#define RECOV_BATCH             4096
+
+typedef struct recov_sched recov_sched_t;
+
+/** @param nb_threads  number of recovery threads (0 for the default) */
+recov_sched_t *recov_sched_new(unsigned int nb_threads);
+
+/**
+ * Schedule the recreation of a directory.
+ * The scheduler takes the ownership of attrs contents.
+ */
+int recov_sched_add_dir(recov_sched_t *sched, const entry_id_t *p_id,
+                        attr_set_t *p_attrs);
+
+/** Create the scheduled directories, by increasing depth. */
+void recov_sched_create_dirs(recov_sched_t *sched);
+
+/**
+ * Schedule the recreation of a non-directory entry
+ * (created when a batch is full). The scheduler takes the ownership of
+ * attrs contents.
+ */
+int recov_sched_add_entry(recov_sched_t *sched, const entry_id_t *p_id,
+                          attr_set_t *p_attrs);
+
+/**
+ * Create the remaining entries, restore directory times
+ * and flush lovea/fid_remap files.
+ */
+void recov_sched_finish(recov_sched_t *sched);
+
+void recov_sched_free(recov_sched_t *sched);
+
+#endif
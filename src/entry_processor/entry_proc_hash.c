@@ -13,8 +13,12 @@
  */
 
 /* A file ID (or Lustre FID) hash table. The hash table consists in a
- * fixed number of bucket, keyed on the ID, containing a linked list
- * of operation entries.
+ * number of bucket, keyed on the ID, containing a linked list
+ * of operation entries. It can be resized by its (single) user.
+ *
+ * Constraint tables (used by the pipeline for id and parent/name
+ * constraints) are striped open-addressing tables, which grow with the
+ * number of distinct keys.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -30,6 +34,8 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 
 /** Creates and return a new hash table */
 struct id_hash *id_hash_init(const unsigned int hash_size, bool use_lock)
@@ -43,6 +49,7 @@ struct id_hash *id_hash_init(const unsigned int hash_size, bool use_lock)
     if (!hash) {
         DisplayLog(LVL_MAJOR, "Entry_Hash",
                    "Can't allocate new hash table with %d slots", hash_size);
+        return NULL;
     }
 
     for (i = 0; i < hash_size; i++) {
@@ -59,6 +66,37 @@ struct id_hash *id_hash_init(const unsigned int hash_size, bool use_lock)
     return hash;
 }
 
+struct id_hash *id_hash_resize(struct id_hash *id_hash,
+                               unsigned int hash_size)
+{
+    struct id_hash *new_hash;
+    unsigned int i;
+
+    new_hash = id_hash_init(hash_size, false);
+    if (!new_hash)
+        return NULL;
+
+    for (i = 0; i < id_hash->hash_size; i++) {
+        struct id_hash_slot *slot = &id_hash->slot[i];
+
+        /* keep the order of operations in each slot */
+        while (!rh_list_empty(&slot->list)) {
+            entry_proc_op_t *op = rh_list_first_entry(&slot->list,
+                                                      entry_proc_op_t,
+                                                      id_hash_list);
+            struct id_hash_slot *new_slot = get_hash_slot(new_hash,
+                                                          &op->entry_id);
+
+            rh_list_del(&op->id_hash_list);
+            rh_list_add_tail(&op->id_hash_list, &new_slot->list);
+            new_slot->count++;
+        }
+    }
+
+    MemFree(id_hash);
+    return new_hash;
+}
+
 void id_hash_stats(struct id_hash *id_hash, const char *log_str)
 {
     unsigned int i, total, min, max;
@@ -128,3 +166,373 @@ void id_hash_dump(struct id_hash *id_hash, bool parent)
         V(slot->lock);
     }
 }
+
+/* ------------ Open-addressing constraint tables --------------- */
+
+/* number of lock stripes of a constraint table */
+#define CONSTRAINT_STRIPES  64
+/* grow (or rehash) a stripe when used+deleted slots exceed this ratio */
+#define CONSTRAINT_MAX_LOAD(_size)  ((_size) / 10 * 7)
+
+/* marks a deleted slot (the probe sequence must go on) */
+#define SLOT_DELETED    ((entry_proc_op_t *)1)
+
+static inline bool slot_is_set(const struct constraint_slot *slot)
+{
+    return slot->first != NULL && slot->first != SLOT_DELETED;
+}
+
+static inline struct rh_list_head *op_link(const struct constraint_hash *h,
+                                           entry_proc_op_t *p_op)
+{
+    return h->by_name ? &p_op->name_hash_list : &p_op->id_hash_list;
+}
+
+static inline entry_proc_op_t *link_op(const struct constraint_hash *h,
+                                       struct rh_list_head *l)
+{
+    return h->by_name ? rh_list_entry(l, entry_proc_op_t, name_hash_list)
+        : rh_list_entry(l, entry_proc_op_t, id_hash_list);
+}
+
+static inline bool op_is_registered(const struct constraint_hash *h,
+                                    const entry_proc_op_t *p_op)
+{
+    return h->by_name ? p_op->name_is_referenced : p_op->id_is_referenced;
+}
+
+/** hash of the key of an operation */
+static inline uint64_t op_hash(const struct constraint_hash *h,
+                               const entry_proc_op_t *p_op)
+{
+    /* registered operations use the hash they were registered with, as
+     * their attributes may have changed since */
+    if (op_is_registered(h, p_op))
+        return h->by_name ? p_op->name_hash_key : p_op->id_hash_key;
+
+    if (h->by_name)
+        return __hash64(id_hash64(&ATTR(&p_op->fs_attrs, parent_id))
+                        ^ g_str_hash(ATTR(&p_op->fs_attrs, name)));
+    return id_hash64(&p_op->entry_id);
+}
+
+static inline bool op_key_equal(const struct constraint_hash *h,
+                                const entry_proc_op_t *op1,
+                                const entry_proc_op_t *op2)
+{
+    if (h->by_name)
+        return entry_id_equal(&ATTR(&op1->fs_attrs, parent_id),
+                              &ATTR(&op2->fs_attrs, parent_id))
+            && !strcmp(ATTR(&op1->fs_attrs, name), ATTR(&op2->fs_attrs, name));
+    return entry_id_equal(&op1->entry_id, &op2->entry_id);
+}
+
+/** test if p_op is in the list of operations of the given slot */
+static bool slot_has_op(const struct constraint_hash *h,
+                        const struct constraint_slot *slot,
+                        const entry_proc_op_t *p_op)
+{
+    struct rh_list_head *start = op_link(h, slot->first);
+    struct rh_list_head *l = start;
+
+    do {
+        if (link_op(h, l) == p_op)
+            return true;
+        l = l->next;
+    } while (l != start);
+
+    return false;
+}
+
+static inline struct constraint_stripe *get_stripe(struct constraint_hash *h,
+                                                   uint64_t hash)
+{
+    return &h->stripe[(hash >> 32) & (h->nb_stripes - 1)];
+}
+
+static int stripe_alloc(struct constraint_stripe *s, unsigned int size)
+{
+    s->slots = MemCalloc(size, sizeof(struct constraint_slot));
+    if (!s->slots)
+        return ENOMEM;
+    s->size = size;
+    s->used = 0;
+    s->deleted = 0;
+    return 0;
+}
+
+/**
+ * Look for the slot of the key of p_op in a stripe (stripe lock must be held).
+ * If p_op is registered, this is the slot it is registered in.
+ * @param[out] p_free  the slot to be used to insert this key (optional).
+ * @return the slot of the key, NULL if it is not registered.
+ */
+static struct constraint_slot *stripe_lookup(const struct constraint_hash *h,
+                                             struct constraint_stripe *s,
+                                             uint64_t hash,
+                                             const entry_proc_op_t *p_op,
+                                             struct constraint_slot **p_free)
+{
+    unsigned int mask = s->size - 1;
+    unsigned int idx = hash & mask;
+    unsigned int n;
+    struct constraint_slot *free_slot = NULL;
+    struct constraint_slot *found = NULL;
+
+    for (n = 0; n < s->size; n++) {
+        struct constraint_slot *slot = &s->slots[(idx + n) & mask];
+
+        if (slot->first == NULL) {
+            if (free_slot == NULL)
+                free_slot = slot;
+            break;
+        }
+        if (slot->first == SLOT_DELETED) {
+            if (free_slot == NULL)
+                free_slot = slot;
+            continue;
+        }
+        if (slot->hash == hash
+            && (op_is_registered(h, p_op) ? slot_has_op(h, slot, p_op)
+                : op_key_equal(h, slot->first, p_op))) {
+            found = slot;
+            break;
+        }
+    }
+
+    s->lookups++;
+    s->probes += n + 1;
+    if (n + 1 > s->max_probes)
+        s->max_probes = n + 1;
+
+    if (p_free)
+        *p_free = free_slot;
+    return found;
+}
+
+/**
+ * Rehash a stripe to a new array of slots, to drop deleted slots, and grow it
+ * if more than half of the slots are in use. (stripe lock must be held)
+ */
+static void stripe_rehash(struct constraint_stripe *s)
+{
+    struct constraint_slot *old_slots = s->slots;
+    unsigned int old_size = s->size;
+    unsigned int used = s->used;
+    unsigned int new_size = old_size;
+    unsigned int i;
+
+    if (used >= old_size / 2)
+        new_size = old_size * 2;
+
+    if (stripe_alloc(s, new_size)) {
+        DisplayLog(LVL_MAJOR, "Entry_Hash", "Can't allocate %u constraint "
+                   "slots: keeping current size (%u)", new_size, old_size);
+        s->slots = old_slots;
+        s->size = old_size;
+        s->used = used;
+        /* lookup would never end on a full table */
+        if (s->used + s->deleted >= old_size)
+            RBH_BUG("constraint hash table is full");
+        return;
+    }
+
+    for (i = 0; i < old_size; i++) {
+        unsigned int idx;
+
+        if (!slot_is_set(&old_slots[i]))
+            continue;
+
+        idx = old_slots[i].hash & (new_size - 1);
+        while (s->slots[idx].first != NULL)
+            idx = (idx + 1) & (new_size - 1);
+        s->slots[idx] = old_slots[i];
+        s->used++;
+    }
+    MemFree(old_slots);
+}
+
+struct constraint_hash *constraint_hash_init(unsigned int size, bool by_name)
+{
+    struct constraint_hash *h;
+    unsigned int i, stripe_size = 16;
+
+    h = MemCalloc(1, sizeof(struct constraint_hash)
+                  + CONSTRAINT_STRIPES * sizeof(struct constraint_stripe));
+    if (!h) {
+        DisplayLog(LVL_MAJOR, "Entry_Hash",
+                   "Can't allocate new constraint hash table");
+        return NULL;
+    }
+
+    h->by_name = by_name;
+    h->nb_stripes = CONSTRAINT_STRIPES;
+
+    while (stripe_size * CONSTRAINT_STRIPES < size)
+        stripe_size *= 2;
+
+    for (i = 0; i < h->nb_stripes; i++) {
+        struct constraint_stripe *s = &h->stripe[i];
+
+        pthread_mutex_init(&s->lock, NULL);
+        if (stripe_alloc(s, stripe_size)) {
+            DisplayLog(LVL_MAJOR, "Entry_Hash",
+                       "Can't allocate new constraint hash table with %u "
+                       "slots", stripe_size * CONSTRAINT_STRIPES);
+            return NULL;
+        }
+    }
+    return h;
+}
+
+void constraint_hash_insert(struct constraint_hash *h, entry_proc_op_t *p_op,
+                            bool at_head)
+{
+    uint64_t hash = op_hash(h, p_op);
+    struct constraint_stripe *s = get_stripe(h, hash);
+    struct constraint_slot *slot, *free_slot;
+
+    if (op_is_registered(h, p_op))
+        RBH_BUG("Operation is already registered in constraint hash");
+
+    if (h->by_name)
+        p_op->name_hash_key = hash;
+    else
+        p_op->id_hash_key = hash;
+
+    P(s->lock);
+    slot = stripe_lookup(h, s, hash, p_op, &free_slot);
+    if (slot) {
+        /* same key: insert it at the end of the circular list (just before
+         * the first) */
+        rh_list_add_tail(op_link(h, p_op), op_link(h, slot->first));
+        if (at_head)
+            slot->first = p_op;
+    } else {
+        if (free_slot->first == SLOT_DELETED)
+            s->deleted--;
+        free_slot->hash = hash;
+        free_slot->first = p_op;
+        rh_list_init(op_link(h, p_op));
+        s->used++;
+
+        if (s->used + s->deleted > CONSTRAINT_MAX_LOAD(s->size))
+            stripe_rehash(s);
+    }
+    s->count++;
+    V(s->lock);
+}
+
+int constraint_hash_first(struct constraint_hash *h, entry_proc_op_t *p_op,
+                          entry_proc_op_t **p_first)
+{
+    uint64_t hash = op_hash(h, p_op);
+    struct constraint_stripe *s = get_stripe(h, hash);
+    struct constraint_slot *slot;
+    int rc;
+
+    P(s->lock);
+    slot = stripe_lookup(h, s, hash, p_op, NULL);
+    if (slot == NULL)
+        rc = -1;
+    else if (slot->first == p_op)
+        rc = 1;
+    else {
+        rc = 0;
+        if (p_first)
+            *p_first = slot->first;
+    }
+    V(s->lock);
+
+    return rc;
+}
+
+void constraint_hash_remove(struct constraint_hash *h, entry_proc_op_t *p_op)
+{
+    uint64_t hash = op_hash(h, p_op);
+    struct constraint_stripe *s = get_stripe(h, hash);
+    struct constraint_slot *slot;
+    struct rh_list_head *l = op_link(h, p_op);
+
+    P(s->lock);
+    slot = stripe_lookup(h, s, hash, p_op, NULL);
+    if (slot == NULL) {
+        V(s->lock);
+        RBH_BUG("Registered operation was not found in constraint hash");
+    }
+
+    if (slot->first == p_op) {
+        if (rh_list_empty(l)) {
+            /* last operation with this key */
+            slot->first = SLOT_DELETED;
+            s->used--;
+            s->deleted++;
+        } else {
+            slot->first = link_op(h, l->next);
+        }
+    }
+    rh_list_del(l);
+    s->count--;
+    V(s->lock);
+}
+
+void constraint_hash_stats(struct constraint_hash *h, const char *log_str)
+{
+    unsigned int i, total = 0, keys = 0, slots = 0, deleted = 0,
+        max_probes = 0;
+    unsigned long long lookups = 0, probes = 0;
+
+    /* no lock, just for information */
+    for (i = 0; i < h->nb_stripes; i++) {
+        const struct constraint_stripe *s = &h->stripe[i];
+
+        total += s->count;
+        keys += s->used;
+        deleted += s->deleted;
+        slots += s->size;
+        lookups += s->lookups;
+        probes += s->probes;
+        if (s->max_probes > max_probes)
+            max_probes = s->max_probes;
+    }
+
+    DisplayLog(LVL_MAJOR, "STATS",
+               "%s: %u (keys=%u, occupancy=%.1f%% of %u slots, deleted=%u, "
+               "probes avg=%.2f/max=%u)", log_str, total, keys,
+               slots ? 100.0 * keys / slots : 0.0, slots, deleted,
+               lookups ? (double)probes / lookups : 0.0, max_probes);
+}
+
+void constraint_hash_dump(struct constraint_hash *h)
+{
+    unsigned int i, j;
+    entry_proc_op_t *op;
+
+    /* dump all values */
+    printf("==\n");
+    for (i = 0; i < h->nb_stripes; i++) {
+        struct constraint_stripe *s = &h->stripe[i];
+
+        P(s->lock);
+        for (j = 0; j < s->size; j++) {
+            struct rh_list_head *l;
+
+            if (!slot_is_set(&s->slots[j]))
+                continue;
+
+            op = s->slots[j].first;
+            l = op_link(h, op);
+            do {
+                if (!h->by_name)
+                    printf("[%u/%u] " DFID "\n", i, j, PFID(&op->entry_id));
+                else
+                    printf("[%u/%u] " DFID "/%s:" DFID "\n", i, j,
+                           PFID(&ATTR(&op->fs_attrs, parent_id)),
+                           ATTR(&op->fs_attrs, name), PFID(&op->entry_id));
+                l = l->next;
+                op = link_op(h, l);
+            } while (op != s->slots[j].first);
+        }
+        V(s->lock);
+    }
+}
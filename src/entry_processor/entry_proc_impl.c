@@ -23,13 +23,41 @@
 #include "Memory.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
+#include "rbh_hist.h"
+#include "rbh_metrics.h"
+#include "rbh_prof.h"
+#include "rbh_affinity.h"
 #include "list.h"
+#include "entry_proc_hash.h"
 #include <semaphore.h>
 #include <pthread.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 static sem_t pipeline_token;
+/* number of tokens of pipeline_token (max_pending_operations) */
+static unsigned int pipeline_tokens = 0;
+/* tokens to be taken back after max_pending_operations was decreased:
+ * released tokens pay this debt before being posted again */
+static volatile unsigned int pipeline_token_debt = 0;
+
+/* Backpressure: producers are asked to slow down when the number of pending
+ * operations reaches the high watermark, until it gets under the low
+ * watermark. The state only changes under bp_lock, but it is read without
+ * lock by producers. */
+static volatile unsigned int nb_pending_ops = 0;
+static volatile bool bp_congested = false;
+static unsigned int bp_high = 0;
+static unsigned int bp_low = 0;
+static pthread_mutex_t bp_lock = PTHREAD_MUTEX_INITIALIZER;
+static backpressure_cb_t bp_cb = NULL;
+static void *bp_cb_arg = NULL;
+static unsigned long long bp_nb_congested = 0; /**< times congestion
+                                                 * started */
+static struct timeval bp_start;   /**< start of current congestion */
+static struct timeval bp_total;   /**< total time spent congested */
 
 /* each stage of the pipeline consist of the following information: */
 typedef struct __list_by_stage__ {
@@ -50,8 +78,22 @@ typedef struct __list_by_stage__ {
                                              * processing entries at this
                                              * stage */
     pthread_mutex_t stage_mutex;
+    unsigned long long nb_locks;        /**< number of times the stage
+                                         * lock was taken */
+    unsigned long long nb_lock_waits;   /**< number of times it was already
+                                         * held by another thread */
 } list_by_stage_t;
 
+/** lock a stage and account lock contention */
+static inline void stage_lock(list_by_stage_t *pl)
+{
+    if (pthread_mutex_trylock(&pl->stage_mutex) != 0) {
+        P(pl->stage_mutex);
+        pl->nb_lock_waits++;
+    }
+    pl->nb_locks++;
+}
+
 /* Note1: nb_current_entries + nb_unprocessed_entries + nb_processed_entries
  *         = nb entries at a given step */
 /* stages mutex must always be taken from lower stage to upper to avoid
@@ -65,9 +107,13 @@ pipeline_descr_t entry_proc_descr = { 0 };
 
 void *entry_proc_arg = NULL;
 
-static pthread_mutex_t work_avail_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t work_avail_cond = PTHREAD_COND_INITIALIZER;
-unsigned int nb_waiting_threads = 0;
+/* Idle workers sleep on this semaphore. Producers only post it when
+ * nb_waiting_threads is not 0, so there is no global lock on the hot path.
+ * A worker registers as waiter, then checks the stages again before
+ * sleeping: this way, no wakeup can be lost (an extra token only results
+ * in a spurious scan of the stages). */
+static sem_t work_avail_sem;
+static volatile unsigned int nb_waiting_threads = 0;
 
 /* termination mecanism  */
 static pthread_mutex_t terminate_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -76,8 +122,153 @@ static pthread_cond_t terminate_cond = PTHREAD_COND_INITIALIZER;
 static enum { NONE = 0, FLUSH = 1, BREAK = 2 } terminate_flag = NONE;
 static int nb_finished_threads = 0;
 
+/** release a pipeline token */
+static inline void pipeline_token_release(void)
+{
+    unsigned int debt;
+
+    while ((debt = pipeline_token_debt) > 0)
+        if (__sync_bool_compare_and_swap(&pipeline_token_debt, debt,
+                                         debt - 1))
+            return;
+    sem_post(&pipeline_token);
+}
+
+/** set the count of pipeline tokens (called with workers_lock) */
+static void pipeline_tokens_set(unsigned int count)
+{
+    unsigned int debt;
+
+    while (pipeline_tokens < count) {
+        /* cancel the debt first */
+        debt = pipeline_token_debt;
+        if (debt > 0) {
+            if (!__sync_bool_compare_and_swap(&pipeline_token_debt, debt,
+                                              debt - 1))
+                continue;
+        } else
+            sem_post(&pipeline_token);
+        pipeline_tokens++;
+    }
+    while (pipeline_tokens > count) {
+        /* take free tokens, else they will be taken when released */
+        if (sem_trywait(&pipeline_token) != 0)
+            __sync_fetch_and_add(&pipeline_token_debt, 1);
+        pipeline_tokens--;
+    }
+}
+
+/** set backpressure watermarks from the configuration */
+static void bp_set_watermarks(void)
+{
+    P(bp_lock);
+    bp_high = entry_proc_conf.high_watermark;
+    if (bp_high == 0)
+        bp_high = entry_proc_conf.max_pending_operations * 9 / 10;
+    bp_low = entry_proc_conf.low_watermark;
+    if (bp_low == 0 || bp_low >= bp_high)
+        bp_low = bp_high * 7 / 9;
+    V(bp_lock);
+}
+
+/** update backpressure state according to the new count of pending ops */
+static void bp_update(unsigned int pending)
+{
+    struct timeval now, diff;
+
+    /* fast path: no state change */
+    if (bp_high == 0 || (bp_congested ? pending > bp_low : pending < bp_high))
+        return;
+
+    P(bp_lock);
+    /* check again with the up to date value */
+    pending = nb_pending_ops;
+    if (!bp_congested && pending >= bp_high) {
+        bp_congested = true;
+        bp_nb_congested++;
+        gettimeofday(&bp_start, NULL);
+        DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "Pipeline congested: %u "
+                   "pending operations (high watermark: %u)", pending,
+                   bp_high);
+    } else if (bp_congested && pending <= bp_low) {
+        bp_congested = false;
+        gettimeofday(&now, NULL);
+        timersub(&now, &bp_start, &diff);
+        timeradd(&bp_total, &diff, &bp_total);
+        DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "Pipeline recovered: %u "
+                   "pending operations (low watermark: %u)", pending, bp_low);
+    } else {
+        V(bp_lock);
+        return;
+    }
+
+    if (bp_cb != NULL)
+        bp_cb(bp_congested, bp_cb_arg);
+    V(bp_lock);
+}
+
+void EntryProcessor_SetBackpressureCb(backpressure_cb_t cb, void *arg)
+{
+    P(bp_lock);
+    bp_cb = cb;
+    bp_cb_arg = arg;
+    V(bp_lock);
+}
+
+bool EntryProcessor_Congested(void)
+{
+    return bp_congested;
+}
+
+unsigned int EntryProcessor_Credits(void)
+{
+    unsigned int pending = nb_pending_ops;
+
+    if (bp_high == 0)
+        return UINT_MAX;
+    if (bp_congested || pending >= bp_high)
+        return 0;
+    return bp_high - pending;
+}
+
+/** wake up one idle worker, if any */
+static inline void wake_up_worker(void)
+{
+    /* full barrier: make pipeline changes visible before reading
+     * the waiter count */
+    __sync_synchronize();
+    if (nb_waiting_threads > 0)
+        sem_post(&work_avail_sem);
+}
+
+/** wake up to 'count' waiting workers */
+static inline void wake_up_workers(unsigned int count)
+{
+    unsigned int i, nb_waiting;
+
+    __sync_synchronize();
+    nb_waiting = nb_waiting_threads;
+    for (i = 0; i < count && i < nb_waiting; i++)
+        sem_post(&work_avail_sem);
+}
+
+/** lockless check of the number of entries waiting at a given stage */
+static inline unsigned int stage_waiting_hint(const list_by_stage_t *pl)
+{
+    return *(volatile const unsigned int *)&pl->nb_unprocessed_entries;
+}
+
+/** lockless check of the number of entries at a given stage */
+static inline unsigned int stage_count_hint(const list_by_stage_t *pl)
+{
+    const volatile list_by_stage_t *vpl = pl;
+
+    return vpl->nb_current_entries + vpl->nb_unprocessed_entries
+        + vpl->nb_processed_entries;
+}
+
 /* forward declarations */
-static entry_proc_op_t **EntryProcessor_GetNextOp(int *count);
+static entry_proc_op_t **EntryProcessor_GetNextOp(int *count, lmgr_t *lmgr);
 static void print_op_stats(entry_proc_op_t *p_op, unsigned int stage,
                            const char *what);
 
@@ -87,7 +278,188 @@ typedef struct worker_info__ {
     lmgr_t lmgr;
 } worker_info_t;
 
-static worker_info_t *worker_params = NULL;
+/* Workers are allocated one by one, as the pool can grow on config reload.
+ * Workers with an index over nb_workers_active are parked: they wait on
+ * workers_cond, after processing their current operations. */
+static worker_info_t **worker_params = NULL;
+static unsigned int nb_workers_started = 0;
+static volatile unsigned int nb_workers_active = 0;
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+
+/* ==== stage latency histograms ====
+ * Each thread running pipeline steps owns a histogram per stage of the
+ * time operations waited in the stage before being processed, and of the
+ * time spent processing them. They are only written by their owner thread,
+ * so no lock nor atomic is needed on the fast path. The stats dump sums
+ * them without locking (values may be slightly outdated).
+ * Buckets are those of rbh_hist.h.
+ */
+
+typedef struct stage_hist {
+    unsigned long long wait[HIST_BUCKETS];
+    unsigned long long proc[HIST_BUCKETS];
+} stage_hist_t;
+
+/* one set of stage histograms per initial worker and shard thread,
+ * plus a shared one for other threads (and workers started later) */
+static stage_hist_t *stage_hists = NULL;
+static unsigned int  stage_hist_slots = 0;
+static unsigned int  stage_hist_workers = 0;
+/* histograms of the current thread (NULL for the shared slot) */
+static __thread stage_hist_t *my_stage_hists = NULL;
+
+/* throughput computed at last stats dump (ops/sec) */
+static double *stage_rate = NULL;
+static unsigned long long *stage_rate_last = NULL;
+static struct timeval stage_rate_time;
+
+static int stage_hists_init(unsigned int nb_workers, unsigned int nb_shards)
+{
+    unsigned int stages = entry_proc_descr.stage_count;
+
+    /* + 1 for shared slot */
+    stage_hist_workers = nb_workers;
+    stage_hist_slots = nb_workers + nb_shards + 1;
+    stage_hists = MemCalloc(stage_hist_slots * stages, sizeof(stage_hist_t));
+    stage_rate = MemCalloc(stages, sizeof(double));
+    stage_rate_last = MemCalloc(stages, sizeof(unsigned long long));
+    if (!stage_hists || !stage_rate || !stage_rate_last)
+        return ENOMEM;
+
+    gettimeofday(&stage_rate_time, NULL);
+    return 0;
+}
+
+/** attach the calling thread to its own histogram slot */
+static void stage_hists_attach(unsigned int slot)
+{
+    if (stage_hists != NULL && slot < stage_hist_slots - 1)
+        my_stage_hists = &stage_hists[slot * entry_proc_descr.stage_count];
+}
+
+/**
+ * Account a wait or processing time for the given stage.
+ * @param proc true for processing time, false for wait time.
+ */
+static void stage_hist_add(unsigned int stage, bool proc,
+                           const struct timeval *diff)
+{
+    unsigned int b;
+    stage_hist_t *h;
+
+    if (stage_hists == NULL || stage >= entry_proc_descr.stage_count)
+        return;
+
+    b = hist_bucket(tv2usec(diff));
+
+    if (my_stage_hists != NULL) {
+        h = &my_stage_hists[stage];
+        if (proc)
+            h->proc[b]++;
+        else
+            h->wait[b]++;
+    } else {
+        /* shared slot */
+        h = &stage_hists[(stage_hist_slots - 1) * entry_proc_descr.stage_count
+                         + stage];
+        __sync_fetch_and_add(proc ? &h->proc[b] : &h->wait[b], 1);
+    }
+}
+
+/** account the wait time of operations that start being processed */
+static void stage_hist_add_wait(entry_proc_op_t **ops, unsigned int count,
+                                const struct timeval *start)
+{
+    struct timeval diff;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!timerisset(&ops[i]->stage_enter_time))
+            continue;
+        timersub(start, &ops[i]->stage_enter_time, &diff);
+        stage_hist_add(ops[i]->pipeline_stage, false, &diff);
+    }
+}
+
+/** sum the histograms of all threads for the given stage */
+static void stage_hist_sum(unsigned int stage, stage_hist_t *sum)
+{
+    unsigned int i, b;
+
+    memset(sum, 0, sizeof(*sum));
+    if (stage_hists == NULL)
+        return;
+
+    for (i = 0; i < stage_hist_slots; i++) {
+        const volatile stage_hist_t *h =
+            &stage_hists[i * entry_proc_descr.stage_count + stage];
+
+        for (b = 0; b < HIST_BUCKETS; b++) {
+            sum->wait[b] += h->wait[b];
+            sum->proc[b] += h->proc[b];
+        }
+    }
+}
+
+static void pipeline_metrics_collect(metrics_out_t *out, void *arg);
+
+/** update per-stage throughput, since the last call */
+static void stage_rate_update(void)
+{
+    struct timeval now, diff;
+    double elapsed;
+    unsigned int i;
+
+    if (stage_rate == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &stage_rate_time, &diff);
+    elapsed = diff.tv_sec + 1E-6 * diff.tv_usec;
+    if (elapsed <= 0.0)
+        return;
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        unsigned long long total = pipeline[i].total_processed;
+
+        stage_rate[i] = (total - stage_rate_last[i]) / elapsed;
+        stage_rate_last[i] = total;
+    }
+    stage_rate_time = now;
+}
+
+/* ==== sharded DB apply ====
+ * If db_apply_shards is set, pipeline workers don't run the DB_APPLY step
+ * by themselves: they dispatch operations to dedicated threads by hash of
+ * their entry id. Each shard thread has its own DB connection and builds
+ * its own batches. As a shard queue is FIFO, operations on the same id are
+ * always applied in pipeline order.
+ */
+typedef struct apply_shard_t {
+    unsigned int     index;
+    pthread_t        thread_id;
+    lmgr_t           lmgr;
+
+    pthread_mutex_t  lock;
+    pthread_cond_t   not_empty;
+    pthread_cond_t   not_full;
+    /* queue of pending operations (ring buffer) */
+    entry_proc_op_t **ring;
+    unsigned int     ring_size;
+    unsigned int     head;  /* next op to be processed */
+    unsigned int     count; /* ops in queue */
+
+    /* stats */
+    unsigned long long nb_ops;
+    unsigned long long nb_batches;
+} apply_shard_t;
+
+static apply_shard_t *apply_shards = NULL;
+static unsigned int nb_apply_shards = 0;
+static bool apply_shards_stop = false;
+
+static void *apply_shard_thr(void *arg);
 
 #ifdef _DEBUG_ENTRYPROC
 static void dump_entry_op(entry_proc_op_t *p_op)
@@ -116,6 +488,224 @@ static void dump_entry_op(entry_proc_op_t *p_op)
 }
 #endif
 
+/** start DB apply shard threads */
+static int apply_shards_init(unsigned int nb_shards)
+{
+    int i;
+    /* leave room for at least 2 full batches per shard */
+    unsigned int ring_size = MAX2(2 * entry_proc_conf.max_batch_size, 1024);
+
+    apply_shards = MemCalloc(nb_shards, sizeof(apply_shard_t));
+    if (!apply_shards)
+        return ENOMEM;
+
+    for (i = 0; i < nb_shards; i++) {
+        apply_shard_t *shard = &apply_shards[i];
+
+        shard->index = i;
+        shard->ring_size = ring_size;
+        shard->ring = MemCalloc(ring_size, sizeof(entry_proc_op_t *));
+        if (!shard->ring)
+            return ENOMEM;
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->not_empty, NULL);
+        pthread_cond_init(&shard->not_full, NULL);
+    }
+    nb_apply_shards = nb_shards;
+
+    for (i = 0; i < nb_shards; i++) {
+        if (pthread_create(&apply_shards[i].thread_id, NULL, apply_shard_thr,
+                           &apply_shards[i]) != 0) {
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                       "Error: Could not start DB apply thread");
+            return errno;
+        }
+    }
+    return 0;
+}
+
+/** stop DB apply shard threads (once pipeline workers have terminated) */
+static void apply_shards_terminate(void)
+{
+    int i;
+
+    if (nb_apply_shards == 0)
+        return;
+
+    for (i = 0; i < nb_apply_shards; i++) {
+        P(apply_shards[i].lock);
+        apply_shards_stop = true;
+        pthread_cond_broadcast(&apply_shards[i].not_empty);
+        pthread_cond_broadcast(&apply_shards[i].not_full);
+        V(apply_shards[i].lock);
+    }
+    for (i = 0; i < nb_apply_shards; i++)
+        pthread_join(apply_shards[i].thread_id, NULL);
+}
+
+/** queue an operation to a shard */
+static void apply_shard_push(apply_shard_t *shard, entry_proc_op_t *p_op)
+{
+    P(shard->lock);
+    while (shard->count >= shard->ring_size && !apply_shards_stop)
+        pthread_cond_wait(&shard->not_full, &shard->lock);
+
+    /* in BREAK mode, the op is just dropped (as in pipeline lists) */
+    if (!apply_shards_stop) {
+        shard->ring[(shard->head + shard->count) % shard->ring_size] = p_op;
+        shard->count++;
+        pthread_cond_signal(&shard->not_empty);
+    }
+    V(shard->lock);
+}
+
+/**
+ * Dispatch operations to DB apply shards.
+ * Operations with no id (special operations) are kept in the list.
+ * @return the number of operations left in the list.
+ */
+static int apply_shards_dispatch(entry_proc_op_t **list_op, int count)
+{
+    list_by_stage_t *pl = &pipeline[list_op[0]->pipeline_stage];
+    int i, left = 0;
+
+    for (i = 0; i < count; i++) {
+        if (!list_op[i]->entry_id_is_set) {
+            list_op[left++] = list_op[i];
+            continue;
+        }
+        list_op[i]->sharded = 1;
+        apply_shard_push(&apply_shards[hash_id(&list_op[i]->entry_id,
+                                               nb_apply_shards)], list_op[i]);
+    }
+
+    if (left == 0) {
+        /* this worker is no longer processing this stage */
+        stage_lock(pl);
+        pl->nb_threads--;
+        V(pl->stage_mutex);
+        /* dispatching may unblock a thread-limited stage */
+        wake_up_worker();
+    }
+    return left;
+}
+
+/* DB apply shard thread */
+static void *apply_shard_thr(void *arg)
+{
+    apply_shard_t *shard = arg;
+    const pipeline_stage_t *stage_info =
+        &entry_proc_pipeline[entry_proc_descr.DB_APPLY];
+    entry_proc_op_t **batch;
+    /* a sort window may gather more operations than a DB batch */
+    unsigned int max_batch = MAX3(entry_proc_conf.max_batch_size,
+                                  entry_proc_conf.db_apply_sort_window, 1);
+    int rc;
+
+    DisplayLog(LVL_FULL, ENTRYPROC_TAG, "Starting DB apply thread #%u",
+               shard->index);
+    prof_set_role(PROF_ROLE_PIPELINE, stage_info->stage_name);
+    affinity_set_thread(entry_proc_conf.cpu_affinity, "DB apply");
+
+    /* shard histograms are after worker ones */
+    stage_hists_attach(stage_hist_workers + shard->index);
+
+    rc = ListMgr_InitAccess(&shard->lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                   "DB apply thread #%u could not connect to ListMgr. Exiting.",
+                   shard->index);
+        exit(1);
+    }
+
+    batch = MemCalloc(max_batch, sizeof(entry_proc_op_t *));
+    if (!batch) {
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Cannot allocate batch array");
+        exit(1);
+    }
+
+    for (;;) {
+        unsigned int count;
+        attr_mask_t batch_mask;
+
+        P(shard->lock);
+        if (shard->count == 0 && !apply_shards_stop) {
+            /* don't make ticket holders wait while we are idle */
+            V(shard->lock);
+            ListMgr_FlushCommit(&shard->lmgr, true);
+            P(shard->lock);
+        }
+        while (shard->count == 0 && !apply_shards_stop)
+            pthread_cond_wait(&shard->not_empty, &shard->lock);
+
+        if (shard->count == 0 || terminate_flag == BREAK) {
+            /* terminating */
+            V(shard->lock);
+            break;
+        }
+
+        /* build a batch of consecutive batchable operations */
+        batch[0] = shard->ring[shard->head];
+        count = 1;
+        batch_mask = batch[0]->fs_attrs.attr_mask;
+
+        if (stage_info->stage_batch_function != NULL
+            && stage_info->test_batchable != NULL) {
+            unsigned int limit = MIN2(db_apply_window(), max_batch);
+
+            while (count < limit && count < shard->count) {
+                entry_proc_op_t *next =
+                    shard->ring[(shard->head + count) % shard->ring_size];
+
+                if (!stage_info->test_batchable(batch[0], next, &batch_mask))
+                    break;
+                batch[count++] = next;
+            }
+        }
+        shard->head = (shard->head + count) % shard->ring_size;
+        shard->count -= count;
+        shard->nb_ops += count;
+        if (count > 1)
+            shard->nb_batches++;
+        pthread_cond_broadcast(&shard->not_full);
+        V(shard->lock);
+
+        gettimeofday(&batch[0]->timestamp.start_processing_time, NULL);
+        stage_hist_add_wait(batch, count,
+                            &batch[0]->timestamp.start_processing_time);
+        if (count == 1 && stage_info->stage_function != NULL)
+            stage_info->stage_function(batch[0], &shard->lmgr);
+        else
+            stage_info->stage_batch_function(batch, count, &shard->lmgr);
+
+        /* commit the group transaction if it exceeds the max delay */
+        ListMgr_FlushCommit(&shard->lmgr, false);
+    }
+
+    MemFree(batch);
+    ListMgr_CloseAccess(&shard->lmgr);
+
+    DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "DB apply thread #%u terminated",
+               shard->index);
+    return NULL;
+}
+
+/** wait while this worker is out of the active pool */
+static void worker_park(worker_info_t *myinfo)
+{
+    /* don't keep a pending transaction while parked */
+    ListMgr_FlushCommit(&myinfo->lmgr, true);
+
+    DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "Pipeline worker thread #%u parked",
+               myinfo->index);
+    P(workers_lock);
+    while (myinfo->index >= nb_workers_active && !terminate_flag)
+        pthread_cond_wait(&workers_cond, &workers_lock);
+    V(workers_lock);
+    DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "Pipeline worker thread #%u resumed",
+               myinfo->index);
+}
+
 /* worker thread for pipeline */
 static void *entry_proc_worker_thr(void *arg)
 {
@@ -126,6 +716,11 @@ static void *entry_proc_worker_thr(void *arg)
 
     DisplayLog(LVL_FULL, ENTRYPROC_TAG, "Starting pipeline worker thread #%u",
                myinfo->index);
+    prof_set_role(PROF_ROLE_PIPELINE, NULL);
+    affinity_set_thread(entry_proc_conf.cpu_affinity, "pipeline");
+
+    if (myinfo->index < stage_hist_workers)
+        stage_hists_attach(myinfo->index);
 
     /* create connection to database */
     rc = ListMgr_InitAccess(&myinfo->lmgr);
@@ -136,10 +731,30 @@ static void *entry_proc_worker_thr(void *arg)
         exit(1);
     }
 
-    while ((list_op = EntryProcessor_GetNextOp(&count)) != NULL) {
-        const pipeline_stage_t *stage_info =
-            &entry_proc_pipeline[list_op[0]->pipeline_stage];
-        if (count == 1) {
+    for (;;) {
+        const pipeline_stage_t *stage_info;
+
+        /* the pool was shrunk: wait until it grows again */
+        if (myinfo->index >= nb_workers_active && !terminate_flag)
+            worker_park(myinfo);
+
+        list_op = EntryProcessor_GetNextOp(&count, &myinfo->lmgr);
+        if (list_op == NULL)
+            break;
+
+        stage_info = &entry_proc_pipeline[list_op[0]->pipeline_stage];
+
+        /* account profiling samples to the current stage */
+        prof_set_detail(stage_info->stage_name);
+
+        if (nb_apply_shards > 0
+            && list_op[0]->pipeline_stage == entry_proc_descr.DB_APPLY)
+            /* run sharded ops asynchronously, run others in place */
+            count = apply_shards_dispatch(list_op, count);
+
+        if (count == 0) {
+            /* all operations have been dispatched */
+        } else if (count == 1) {
             /* preferably call single entry function, if it exists */
             if (stage_info->stage_function)
                 stage_info->stage_function(list_op[0], &myinfo->lmgr);
@@ -161,6 +776,10 @@ static void *entry_proc_worker_thr(void *arg)
             RBH_BUG("Empty operation list returned");
 
         MemFree(list_op);
+
+        /* commit the group transaction if it exceeds the max delay
+         * (e.g. if this worker no longer processes DB operations) */
+        ListMgr_FlushCommit(&myinfo->lmgr, false);
     }
 
     if (!terminate_flag)
@@ -187,7 +806,10 @@ static void *entry_proc_worker_thr(void *arg)
 
 }
 
-#ifdef _BENCH_PIPELINE
+/* ==== synthetic pipeline for benchmarking ====
+ * All its stages just acknowledge operations to the next stage. If it has
+ * more than 2 stages, the second one has an id constraint.
+ */
 static pipeline_descr_t bench_pipeline_descr = { 0 };   /* to be set */
 
 static pipeline_stage_t *bench_pipeline = NULL; /* to be allocated */
@@ -217,7 +839,7 @@ static int mk_bench_pipeline(unsigned int stages)
         return -ENOMEM;
     for (i = 0; i < stages; i++) {
         bench_pipeline[i].stage_index = i;
-        bench_pipeline[i].stage_name = "stage_bench";
+        bench_pipeline[i].stage_name = g_strdup_printf("STAGE_BENCH%u", i);
         bench_pipeline[i].stage_function = EntryProc_noop;
         bench_pipeline[i].stage_batch_function = NULL;
         bench_pipeline[i].test_batchable = NULL;
@@ -231,7 +853,83 @@ static int mk_bench_pipeline(unsigned int stages)
     }
     return 0;
 }
-#endif
+
+/**
+ * Start workers up to the given count, called with workers_lock.
+ * @return 0 on success, an error code if a worker can't be started.
+ */
+static int workers_start(unsigned int count)
+{
+    worker_info_t **new_list;
+    worker_info_t *w;
+    int rc;
+
+    if (count <= nb_workers_started)
+        return 0;
+
+    new_list = MemRealloc(worker_params, count * sizeof(*worker_params));
+    if (new_list == NULL)
+        return ENOMEM;
+    worker_params = new_list;
+
+    while (nb_workers_started < count) {
+        w = MemCalloc(1, sizeof(*w));
+        if (w == NULL)
+            return ENOMEM;
+        w->index = nb_workers_started;
+
+        rc = pthread_create(&w->thread_id, NULL, entry_proc_worker_thr, w);
+        if (rc != 0) {
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                       "Error: Could not start worker thread: %s",
+                       strerror(rc));
+            MemFree(w);
+            return rc;
+        }
+        worker_params[nb_workers_started] = w;
+        nb_workers_started++;
+    }
+    return 0;
+}
+
+void EntryProcessor_Reconfig(void)
+{
+    unsigned int count = entry_proc_conf.nb_thread;
+
+    P(workers_lock);
+    /* not started, or terminating */
+    if (nb_workers_started == 0 || terminate_flag) {
+        V(workers_lock);
+        return;
+    }
+
+    if (count != nb_workers_active) {
+        if (workers_start(count) != 0)
+            DisplayLog(LVL_MAJOR, ENTRYPROC_TAG, "Could not start all "
+                       "pipeline workers: running %u out of %u",
+                       nb_workers_started, count);
+        count = MIN2(count, nb_workers_started);
+
+        DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "Pipeline workers: %u -> %u",
+                   nb_workers_active, count);
+        nb_workers_active = count;
+        /* resume workers, parked ones check their index */
+        pthread_cond_broadcast(&workers_cond);
+    }
+
+    if (pipeline_tokens != 0
+        && pipeline_tokens != entry_proc_conf.max_pending_operations) {
+        DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "Max pending operations: "
+                   "%u -> %u", pipeline_tokens,
+                   entry_proc_conf.max_pending_operations);
+        pipeline_tokens_set(entry_proc_conf.max_pending_operations);
+    }
+    V(workers_lock);
+
+    bp_set_watermarks();
+    /* state may change with the new watermarks */
+    bp_update(nb_pending_ops);
+}
 
 /**
  *  Initialize entry processor pipeline
@@ -243,16 +941,6 @@ int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg)
     pipeline_flags = flags;
     entry_proc_arg = arg;
 
-#ifdef _BENCH_PIPELINE
-    int rc;
-
-    /* in this case, arg points to stage count */
-    rc = mk_bench_pipeline(*((int *)arg));
-    if (rc)
-        return rc;
-    entry_proc_pipeline = bench_pipeline;   /* pointer */
-    entry_proc_descr = bench_pipeline_descr;    /* full copy */
-#else
     switch (flavor) {
     case STD_PIPELINE:
         entry_proc_pipeline = std_pipeline; /* pointer */
@@ -264,11 +952,21 @@ int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg)
         entry_proc_descr = diff_pipeline_descr; /* full copy */
         /* arg is a diff_arg */
         break;
+    case BENCH_PIPELINE:
+    {
+        /* in this case, arg points to stage count */
+        int rc = mk_bench_pipeline(*((int *)arg));
+
+        if (rc)
+            return rc;
+        entry_proc_pipeline = bench_pipeline;   /* pointer */
+        entry_proc_descr = bench_pipeline_descr;    /* full copy */
+        break;
+    }
     default:
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Pipeline flavor not supported");
         return EINVAL;
     }
-#endif
 
     DisplayLog(LVL_FULL, "EntryProc_Config", "nb_threads=%u",
                entry_proc_conf.nb_thread);
@@ -300,8 +998,16 @@ int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg)
     }
 
     /* If a limit of pending operations is specified, initialize a token */
-    if (entry_proc_conf.max_pending_operations > 0)
+    if (entry_proc_conf.max_pending_operations > 0) {
         sem_init(&pipeline_token, 0, entry_proc_conf.max_pending_operations);
+        pipeline_tokens = entry_proc_conf.max_pending_operations;
+    }
+
+    sem_init(&work_avail_sem, 0, 0);
+
+    /* set backpressure watermarks */
+    bp_set_watermarks();
+    timerclear(&bp_total);
 
     for (i = 0; i < entry_proc_descr.stage_count; i++) {
         memset(&pipeline[i], 0, sizeof(*pipeline));
@@ -319,25 +1025,29 @@ int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg)
     if (id_constraint_init())
         return -1;
 
-    /* start workers */
-
-    worker_params =
-        (worker_info_t *) MemCalloc(entry_proc_conf.nb_thread,
-                                    sizeof(worker_info_t));
-    if (!worker_params)
+    /* per-thread latency histograms */
+    if (stage_hists_init(entry_proc_conf.nb_thread,
+                         entry_proc_conf.db_apply_shards))
         return ENOMEM;
 
-    for (i = 0; i < entry_proc_conf.nb_thread; i++) {
-        worker_params[i].index = i;
-        if (pthread_create(&worker_params[i].thread_id,
-                           NULL, entry_proc_worker_thr, &worker_params[i]) != 0)
-        {
-            DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
-                       "Error: Could not start worker thread");
-            return errno;
-        }
+    metrics_register(pipeline_metrics_collect, NULL);
+
+    /* start DB apply shards (if configured) */
+    if (entry_proc_conf.db_apply_shards > 0) {
+        int rc = apply_shards_init(entry_proc_conf.db_apply_shards);
+
+        if (rc)
+            return rc;
     }
 
+    /* start workers */
+    P(workers_lock);
+    nb_workers_active = entry_proc_conf.nb_thread;
+    i = workers_start(entry_proc_conf.nb_thread);
+    V(workers_lock);
+    if (i)
+        return i;
+
 #ifdef _DEBUG_ENTRYPROC
     EntryProcessor_DumpCurrentStages();
 #endif
@@ -359,6 +1069,8 @@ void EntryProcessor_Push(entry_proc_op_t *p_entry)
     if (entry_proc_conf.max_pending_operations > 0)
         sem_wait(&pipeline_token);
 
+    bp_update(__sync_add_and_fetch(&nb_pending_ops, 1));
+
     /* We must always insert it in the first stage, to keep
      * the good ordering of entries.
      * Except if all stages between stage0 and insert_stage are empty
@@ -371,7 +1083,7 @@ void EntryProcessor_Push(entry_proc_op_t *p_entry)
 
     /* take all locks for stage0 to insert_stage or first non empty stage */
     for (i = 0; i <= p_entry->pipeline_stage; i++) {
-        P(pipeline[i].stage_mutex);
+        stage_lock(&pipeline[i]);
 
         if (!rh_list_empty(&pipeline[i].entries)) {
             insert_stage = i;
@@ -399,6 +1111,7 @@ void EntryProcessor_Push(entry_proc_op_t *p_entry)
 #endif
 
     /* insert entry */
+    gettimeofday(&p_entry->stage_enter_time, NULL);
     rh_list_add_tail(&p_entry->list, &pipeline[insert_stage].entries);
 
     if (insert_stage < p_entry->pipeline_stage)
@@ -412,13 +1125,91 @@ void EntryProcessor_Push(entry_proc_op_t *p_entry)
 
     /* there is a new entry to be processed ! (signal only if threads
      * are waiting) */
-    P(work_avail_lock);
-    if (nb_waiting_threads > 0)
-        pthread_cond_signal(&work_avail_cond);
-    V(work_avail_lock);
+    wake_up_worker();
 
 }   /* EntryProcessor_Push */
 
+/**
+ * Insert a group of operations with the same push stage
+ * (tokens must have been taken).
+ */
+static void push_group(entry_proc_op_t **ops, unsigned int count)
+{
+    unsigned int i, j;
+    unsigned int push_stage = ops[0]->pipeline_stage;
+    unsigned int insert_stage = push_stage;
+    bool id_constraint;
+    struct timeval now;
+
+    /* same as EntryProcessor_Push(), but locks are taken once */
+    for (i = 0; i <= push_stage; i++) {
+        stage_lock(&pipeline[i]);
+
+        if (!rh_list_empty(&pipeline[i].entries)) {
+            insert_stage = i;
+            break;
+        }
+    }
+
+    id_constraint = !!(entry_proc_pipeline[insert_stage].stage_flags
+                       & STAGE_FLAG_ID_CONSTRAINT);
+    gettimeofday(&now, NULL);
+
+    for (j = 0; j < count; j++) {
+        entry_proc_op_t *p_entry = ops[j];
+
+        if (id_constraint && p_entry->entry_id_is_set)
+            id_constraint_register(p_entry, false);
+
+        p_entry->stage_enter_time = now;
+        rh_list_add_tail(&p_entry->list, &pipeline[insert_stage].entries);
+    }
+
+    if (insert_stage < push_stage)
+        pipeline[insert_stage].nb_processed_entries += count;
+    else
+        pipeline[insert_stage].nb_unprocessed_entries += count;
+
+    for (i = 0; i <= insert_stage; i++)
+        V(pipeline[i].stage_mutex);
+}
+
+/**
+ * Add several operations to the queue, in the given order.
+ * Stage locks are taken once for each series of consecutive operations
+ * with the same pipeline stage.
+ */
+void EntryProcessor_PushBatch(entry_proc_op_t **ops, unsigned int count)
+{
+    unsigned int first, last, i;
+    unsigned int chunk = count;
+
+    /* don't wait for more tokens than the pipeline can give */
+    if (entry_proc_conf.max_pending_operations > 0)
+        chunk = MIN2(count, entry_proc_conf.max_pending_operations);
+
+    for (first = 0; first < count; first += chunk) {
+        unsigned int n = MIN2(chunk, count - first);
+        unsigned int start;
+
+        if (entry_proc_conf.max_pending_operations > 0)
+            for (i = 0; i < n; i++)
+                sem_wait(&pipeline_token);
+
+        bp_update(__sync_add_and_fetch(&nb_pending_ops, n));
+
+        for (start = first; start < first + n; start = last) {
+            for (last = start + 1; last < first + n
+                 && ops[last]->pipeline_stage == ops[start]->pipeline_stage;
+                 last++)
+                ;
+            push_group(&ops[start], last - start);
+        }
+
+        wake_up_workers(n);
+    }
+}
+
 /*
  * Move terminated operations to next stage.
  * The source stage is locked.
@@ -483,7 +1274,7 @@ static int move_stage_entries(const unsigned int source_stage_index)
     /* take all locks from next stage to insert_stage
      * or first non-empty stage */
     for (i = source_stage_index + 1; i <= pipeline_stage_min; i++) {
-        P(pipeline[i].stage_mutex);
+        stage_lock(&pipeline[i]);
 
         /* make sure this stage has correctly been flushed */
         if (!rh_list_empty(&pipeline[i].entries))
@@ -564,6 +1355,69 @@ static int move_stage_entries(const unsigned int source_stage_index)
     return count;
 }   /* move_stage_entries */
 
+/**
+ * Build the list of operations to be processed by a worker thread:
+ * the given first operation, followed by the next entries of the stage
+ * that can be batched with it, if the stage supports batching.
+ * Must be called with the stage lock held.
+ * @param[out] op_count the number of operations in the list.
+ */
+static entry_proc_op_t **build_batch(unsigned int i, entry_proc_op_t *p_curr,
+                                     int *op_count)
+{
+    list_by_stage_t *pl = &pipeline[i];
+    entry_proc_op_t **listop;
+    bool batchable = (entry_proc_conf.max_batch_size > 1
+                      && entry_proc_pipeline[i].test_batchable != NULL
+                      && entry_proc_pipeline[i].stage_batch_function != NULL);
+    /* a sort window may gather more DB operations than a DB batch */
+    unsigned int alloc = (i == entry_proc_descr.DB_APPLY) ?
+        MAX2(entry_proc_conf.max_batch_size,
+             entry_proc_conf.db_apply_sort_window) :
+        entry_proc_conf.max_batch_size;
+
+    listop = MemCalloc(batchable ? alloc : 1, sizeof(entry_proc_op_t *));
+    if (!listop)
+        return NULL;
+    listop[0] = p_curr;
+    *op_count = 1;
+
+    /* check if this stage is batchable */
+    if (batchable) {
+        entry_proc_op_t *p_next;
+        attr_mask_t batch_mask = p_curr->fs_attrs.attr_mask;
+        /* DB apply batch size is tuned at runtime */
+        unsigned int max_batch =
+            (i == entry_proc_descr.DB_APPLY) ?
+            MIN2(db_apply_window(), alloc) :
+            entry_proc_conf.max_batch_size;
+
+        rh_list_for_each_entry_after(p_next, &pl->entries, p_curr, list) {
+            if (*op_count >= max_batch)
+                break;
+            else if (p_next->being_processed
+                     || (p_next->pipeline_stage != i))
+                /* entry is already beeing processed or is at
+                 * a different stage */
+                break;
+
+            if (entry_proc_pipeline[i].
+                test_batchable(p_curr, p_next, &batch_mask)) {
+                pl->nb_unprocessed_entries--;
+                pl->nb_current_entries++;
+                p_next->being_processed = 1;
+
+                listop[*op_count] = p_next;
+                (*op_count)++;
+            } else
+                /* stop at first non-batchable entry */
+                break;
+        }
+    }
+
+    return listop;
+}
+
 /**
  * Return an entry to be processed.
  * This entry is tagged "being_processed" and stage info is updated.
@@ -585,8 +1439,21 @@ static entry_proc_op_t **next_work_avail(bool *p_empty, int *op_count)
     for (i = entry_proc_descr.stage_count - 1; i >= 0; i--) {
         list_by_stage_t *pl = &pipeline[i];
 
+        /* Don't lock stages with no waiting entries: only account
+         * their entries (the value may be slightly outdated, which is
+         * the same as checking it just before another thread
+         * modifies it). */
+        if (stage_waiting_hint(pl) == 0) {
+            unsigned int cnt = stage_count_hint(pl);
+
+            tot_entries += cnt;
+            if (cnt > 0)
+                *p_empty = false;
+            continue;
+        }
+
         /* entries have not been processed at this stage. */
-        P(pl->stage_mutex);
+        stage_lock(pl);
 
         /* Accumulate the number of entries in the upper stages. */
         tot_entries +=
@@ -656,14 +1523,12 @@ static entry_proc_op_t **next_work_avail(bool *p_empty, int *op_count)
                     pl->nb_threads++;
                     p_curr->being_processed = 1;
 
+                    /* following entries can be batched with this one,
+                     * as long as they are in order */
+                    entry_proc_op_t **listop = build_batch(i, p_curr, op_count);
+
                     V(pl->stage_mutex);
 
-                    entry_proc_op_t **listop =
-                        MemAlloc(sizeof(entry_proc_op_t *));
-                    if (listop) {
-                        *listop = p_curr;
-                        *op_count = 1;
-                    }
                     return listop;
                 }
             }
@@ -764,44 +1629,7 @@ static entry_proc_op_t **next_work_avail(bool *p_empty, int *op_count)
                 pl->nb_threads++;
                 p_curr->being_processed = 1;
 
-                entry_proc_op_t **listop =
-                    MemCalloc(entry_proc_conf.max_batch_size,
-                              sizeof(entry_proc_op_t *));
-                if (!listop)
-                    return NULL;
-                listop[0] = p_curr;
-                *op_count = 1;
-
-                /* check if this stage is batchable */
-                if (entry_proc_conf.max_batch_size > 1
-                    && entry_proc_pipeline[i].test_batchable != NULL
-                    && entry_proc_pipeline[i].stage_batch_function != NULL) {
-                    entry_proc_op_t *p_next;
-                    attr_mask_t batch_mask = p_curr->fs_attrs.attr_mask;
-
-                    rh_list_for_each_entry_after(p_next, &pl->entries, p_curr,
-                                                 list) {
-                        if (*op_count >= entry_proc_conf.max_batch_size)
-                            break;
-                        else if (p_next->being_processed
-                                 || (p_next->pipeline_stage != i))
-                            /* entry is already beeing processed or is at
-                             * a different stage */
-                            break;
-
-                        if (entry_proc_pipeline[i].
-                            test_batchable(p_curr, p_next, &batch_mask)) {
-                            pl->nb_unprocessed_entries--;
-                            pl->nb_current_entries++;
-                            p_next->being_processed = 1;
-
-                            listop[*op_count] = p_next;
-                            (*op_count)++;
-                        } else
-                            /* stop at first non-batchable entry */
-                            break;
-                    }
-                }
+                entry_proc_op_t **listop = build_batch(i, p_curr, op_count);
 
                 V(pl->stage_mutex);
 
@@ -832,53 +1660,298 @@ static entry_proc_op_t **next_work_avail(bool *p_empty, int *op_count)
 /**
  * This function returns the next operation to be processed
  * according to pipeline stage/ordering constrains.
+ * @param lmgr connection of the worker, whose pending group transaction
+ *             is committed before the worker sleeps.
  */
-static entry_proc_op_t **EntryProcessor_GetNextOp(int *count)
+static entry_proc_op_t **EntryProcessor_GetNextOp(int *count, lmgr_t *lmgr)
 {
     bool is_empty;
     entry_proc_op_t **list_op;
     int i;
     *count = 0;
 
-    P(work_avail_lock);
-    nb_waiting_threads++;
-
     while ((list_op = next_work_avail(&is_empty, count)) == NULL) {
         if ((terminate_flag == BREAK)
             || ((terminate_flag == FLUSH) && is_empty)) {
-            nb_waiting_threads--;
-
             /* maybe other threads can also terminate ? */
-            if (nb_waiting_threads > 0)
-                pthread_cond_signal(&work_avail_cond);
-
-            V(work_avail_lock);
-
+            wake_up_worker();
             return NULL;
         }
+
+        /* register as a waiter, then check again before sleeping,
+         * in case some work arrived in the meantime */
+        __sync_fetch_and_add(&nb_waiting_threads, 1);
+
+        list_op = next_work_avail(&is_empty, count);
+        if (list_op == NULL && terminate_flag != BREAK
+            && !(terminate_flag == FLUSH && is_empty)) {
 #ifdef _DEBUG_ENTRYPROC
-        DisplayLog(LVL_FULL, ENTRYPROC_TAG, "Thread %#lx: no work available",
-                   pthread_self());
+            DisplayLog(LVL_FULL, ENTRYPROC_TAG,
+                       "Thread %#lx: no work available", pthread_self());
 #endif
-        pthread_cond_wait(&work_avail_cond, &work_avail_lock);
-    }
+            /* don't make ticket holders wait while we are idle */
+            ListMgr_FlushCommit(lmgr, true);
+            while (sem_wait(&work_avail_sem) != 0 && errno == EINTR)
+                ;
+        }
+        __sync_fetch_and_sub(&nb_waiting_threads, 1);
 
-    nb_waiting_threads--;
+        if (list_op != NULL)
+            break;
+    }
 
     /* maybe other entries can be processed after this one ? */
-    if (nb_waiting_threads > 0)
-        pthread_cond_signal(&work_avail_cond);
-
-    V(work_avail_lock);
+    wake_up_worker();
 
     gettimeofday(&(list_op[0]->timestamp.start_processing_time), NULL);
     for (i = 1; i < *count; i++)
         list_op[i]->timestamp.start_processing_time =
             list_op[0]->timestamp.start_processing_time;
+    stage_hist_add_wait(list_op, *count,
+                        &list_op[0]->timestamp.start_processing_time);
 
     return list_op;
 }
 
+/* ================ Pool of pipeline operations ================
+ * Operations are big structures (they embed 2 attribute sets, including
+ * path and name buffers), allocated by producer threads and released by
+ * pipeline workers. To avoid a malloc/free for each of them, released
+ * operations are kept in a per-thread cache, which is refilled from
+ * (or flushed to) a global pool by batches of OP_CACHE_BATCH ops.
+ * There is one global pool per NUMA node: a thread cache uses the pool of
+ * the node it was running on when it was last refilled.
+ * Pools are extended by chunks of OP_POOL_CHUNK operations, that are
+ * never freed, and are first touched by the allocating thread so they
+ * are placed on its node.
+ */
+#define OP_POOL_CHUNK   256 /**< number of ops allocated at once */
+#define OP_CACHE_MAX    128 /**< max ops in a per-thread cache */
+#define OP_CACHE_BATCH  (OP_CACHE_MAX / 2)  /**< refill/flush count */
+
+/* free operations are chained through their 'list' field */
+#define op_next(_op) ((_op)->list.next)
+#define op_from_link(_l) rh_list_entry((_l), entry_proc_op_t, list)
+
+typedef struct op_cache_t {
+    struct rh_list_head *first;
+    unsigned int count;
+    /* number of gets served by the cache, not yet reported
+     * to the global stats */
+    unsigned int hits;
+    /* NUMA node of the pool the cache is refilled from */
+    unsigned int node;
+} op_cache_t;
+
+static __thread op_cache_t op_cache = { NULL, 0, 0, 0 };
+static pthread_key_t op_cache_key;
+static pthread_once_t op_cache_once = PTHREAD_ONCE_INIT;
+
+struct op_pool_stats_t {
+    unsigned long long cache_hits;  /**< gets from a per-thread cache */
+    unsigned long long pool_hits;   /**< gets after a global pool refill */
+    unsigned long long misses;      /**< gets after allocating a new chunk */
+    unsigned long long resident;    /**< number of ops allocated */
+};
+
+typedef struct op_node_pool_t {
+    pthread_mutex_t lock;
+    struct rh_list_head *first;
+    unsigned int free;
+    struct op_pool_stats_t stats;
+} op_node_pool_t;
+
+static op_node_pool_t op_pools[AFFINITY_MAX_NODES];
+static unsigned int op_pool_count = 1;
+
+/** move the content of a thread cache to its node pool.
+ * The pool lock must be held. */
+static void op_cache_flush_locked(op_cache_t *cache, unsigned int count)
+{
+    op_node_pool_t *pool = &op_pools[cache->node];
+
+    while (count > 0 && cache->first != NULL) {
+        struct rh_list_head *l = cache->first;
+
+        cache->first = l->next;
+        cache->count--;
+        count--;
+
+        l->next = pool->first;
+        pool->first = l;
+        pool->free++;
+    }
+    pool->stats.cache_hits += cache->hits;
+    cache->hits = 0;
+}
+
+/** give back the cache of an exiting thread */
+static void op_cache_destructor(void *arg)
+{
+    op_cache_t *cache = arg;
+
+    P(op_pools[cache->node].lock);
+    op_cache_flush_locked(cache, cache->count);
+    V(op_pools[cache->node].lock);
+}
+
+static void op_cache_key_init(void)
+{
+    unsigned int i;
+
+    op_pool_count = MIN2(numa_node_count(), AFFINITY_MAX_NODES);
+    for (i = 0; i < op_pool_count; i++)
+        pthread_mutex_init(&op_pools[i].lock, NULL);
+
+    pthread_key_create(&op_cache_key, op_cache_destructor);
+}
+
+/** refill the calling thread's cache.
+ * @return 0 on success, -ENOMEM on allocation failure.
+ */
+static int op_cache_refill(op_cache_t *cache)
+{
+    op_node_pool_t *pool;
+    bool allocated = false;
+
+    pthread_once(&op_cache_once, op_cache_key_init);
+    if (cache->count == 0) {
+        /* register the cache so it is released at thread exit */
+        if (pthread_getspecific(op_cache_key) == NULL)
+            pthread_setspecific(op_cache_key, cache);
+        /* the thread may have moved since the last refill */
+        if (op_pool_count > 1)
+            cache->node = numa_current_node() % op_pool_count;
+    }
+    pool = &op_pools[cache->node];
+
+    P(pool->lock);
+    if (pool->free == 0) {
+        entry_proc_op_t *chunk;
+        int i;
+
+        /* allocated under the lock: chunks are rare, and this avoids
+         * over-allocating when several threads are starving */
+        chunk = MemAllocTag(MEM_TAG_PIPELINE,
+                            OP_POOL_CHUNK * sizeof(entry_proc_op_t));
+        if (chunk == NULL) {
+            V(pool->lock);
+            return -ENOMEM;
+        }
+        /* first touch from this thread, to get local memory */
+        if (op_pool_count > 1)
+            memset(chunk, 0, OP_POOL_CHUNK * sizeof(entry_proc_op_t));
+
+        for (i = 0; i < OP_POOL_CHUNK; i++) {
+            op_next(&chunk[i]) = pool->first;
+            pool->first = &chunk[i].list;
+        }
+        pool->free += OP_POOL_CHUNK;
+        pool->stats.resident += OP_POOL_CHUNK;
+        allocated = true;
+    }
+
+    while (cache->count < OP_CACHE_BATCH && pool->first != NULL) {
+        struct rh_list_head *l = pool->first;
+
+        pool->first = l->next;
+        pool->free--;
+
+        l->next = cache->first;
+        cache->first = l;
+        cache->count++;
+    }
+
+    if (allocated)
+        pool->stats.misses++;
+    else
+        pool->stats.pool_hits++;
+    pool->stats.cache_hits += cache->hits;
+    cache->hits = 0;
+    V(pool->lock);
+
+    return 0;
+}
+
+/** get an operation structure from the pool (not initialized) */
+static entry_proc_op_t *op_pool_get(void)
+{
+    op_cache_t *cache = &op_cache;
+    struct rh_list_head *l;
+
+    if (cache->first == NULL) {
+        /* the first op after a refill is not a cache hit */
+        if (op_cache_refill(cache))
+            return NULL;
+    } else {
+        cache->hits++;
+    }
+
+    l = cache->first;
+    cache->first = l->next;
+    cache->count--;
+
+    return op_from_link(l);
+}
+
+/** put an operation structure back to the pool */
+static void op_pool_put(entry_proc_op_t *p_op)
+{
+    op_cache_t *cache = &op_cache;
+
+    op_next(p_op) = cache->first;
+    cache->first = &p_op->list;
+    cache->count++;
+
+    if (cache->count > OP_CACHE_MAX) {
+        /* the cache is registered (and pools initialized) by the
+         * first refill of the thread */
+        pthread_once(&op_cache_once, op_cache_key_init);
+        P(op_pools[cache->node].lock);
+        op_cache_flush_locked(cache, OP_CACHE_BATCH);
+        V(op_pools[cache->node].lock);
+    }
+}
+
+/** display pool statistics */
+static void op_pool_stats_dump(void)
+{
+    struct op_pool_stats_t st = { 0 };
+    unsigned int nfree = 0;
+    unsigned long long total;
+    unsigned int i;
+
+    pthread_once(&op_cache_once, op_cache_key_init);
+
+    for (i = 0; i < op_pool_count; i++) {
+        op_node_pool_t *pool = &op_pools[i];
+
+        P(pool->lock);
+        st.cache_hits += pool->stats.cache_hits;
+        st.pool_hits += pool->stats.pool_hits;
+        st.misses += pool->stats.misses;
+        st.resident += pool->stats.resident;
+        nfree += pool->free;
+
+        if (op_pool_count > 1)
+            DisplayLog(LVL_MAJOR, "STATS", "Op pool node %u: resident=%llu "
+                       "ops, free=%u", i, pool->stats.resident, pool->free);
+        V(pool->lock);
+    }
+
+    total = st.cache_hits + st.pool_hits + st.misses;
+
+    DisplayLog(LVL_MAJOR, "STATS", "Op pool: resident=%llu ops (%.1f MB), "
+               "free in global pool=%u, hit rate: thread cache=%.2f%%, "
+               "global pool=%.2f%%, new chunks=%llu",
+               st.resident,
+               (double)(st.resident * sizeof(entry_proc_op_t)) / 1048576.0,
+               nfree,
+               total ? 100.0 * (double)st.cache_hits / (double)total : 0.0,
+               total ? 100.0 * (double)st.pool_hits / (double)total : 0.0,
+               st.misses);
+}
+
 /**
  * Release an entry op.
  */
@@ -895,27 +1968,52 @@ void EntryProcessor_Release(entry_proc_op_t *p_op)
     ListMgr_FreeAttrs(&p_op->fs_attrs);
     ListMgr_FreeAttrs(&p_op->db_attrs);
 
-    /* free the memory */
-    MemFree(p_op);
+    if (p_op->trace != NULL) {
+        trace_put(p_op->trace);
+        p_op->trace = NULL;
+    }
+
+    /* give the structure back to the pool */
+    op_pool_put(p_op);
+}
+
+/** add the wait and processing spans of a traced operation in a stage */
+static void trace_stage(entry_proc_op_t *op, unsigned int stage,
+                        const struct timeval *start, const struct timeval *end)
+{
+    if (timerisset(&op->stage_enter_time)
+        && timercmp(&op->stage_enter_time, start, <))
+        trace_span(op->trace, "pipeline wait", &op->stage_enter_time, start);
+    trace_span(op->trace, entry_proc_pipeline[stage].stage_name, start, end);
 }
 
 /**
  * Acknownledge a batch of operations.
+ * @param next_stages if not NULL, the next stage of each operation
+ *                    (-1 to remove it), instead of next_stage and remove.
  */
-int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
-                                    unsigned int next_stage, bool remove)
+static int acknowledge_ops(entry_proc_op_t **ops, unsigned int count,
+                           unsigned int next_stage, bool remove,
+                           const int *next_stages)
 {
     const unsigned int curr_stage = ops[0]->pipeline_stage;
     list_by_stage_t *pl = &pipeline[curr_stage];
     int nb_moved;
     struct timeval now, diff;
     int i;
+    bool any_removed = false;
 
     gettimeofday(&now, NULL);
     timersub(&now, &ops[0]->timestamp.start_processing_time, &diff);
+    stage_hist_add(curr_stage, true, &diff);
+
+    for (i = 0; i < count; i++)
+        if (ops[i]->trace != NULL)
+            trace_stage(ops[i], curr_stage,
+                        &ops[0]->timestamp.start_processing_time, &now);
 
     /* lock current stage */
-    P(pl->stage_mutex);
+    stage_lock(pl);
 
     /* update stats */
     pl->nb_processed_entries += count;
@@ -926,10 +2024,17 @@ int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
         pl->nb_batches++;
         pl->total_batched_entries += count;
     }
-    pl->nb_threads--;
+    /* the pipeline worker has already released sharded ops */
+    if (!ops[0]->sharded)
+        pl->nb_threads--;
     timeradd(&diff, &pl->total_processing_time, &pl->total_processing_time);
 
     for (i = 0; i < count; i++) {
+        if (next_stages != NULL) {
+            remove = (next_stages[i] < 0);
+            next_stage = next_stages[i];
+        }
+
         /* sanity check */
         if ((!remove) && (ops[i]->pipeline_stage >= next_stage)) {
             DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "CRITICAL: entry is already"
@@ -942,10 +2047,13 @@ int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
 
         /* update their status */
         ops[i]->being_processed = 0;
+        ops[i]->sharded = 0;
         ops[i]->pipeline_stage = next_stage;
+        ops[i]->stage_enter_time = now;
 
         /* remove the entry, if it must be */
         if (remove) {
+            any_removed = true;
             /* update stage info. */
             pl->nb_processed_entries--;
             rh_list_del_init(&ops[i]->list);
@@ -972,20 +2080,21 @@ int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
      * so it must have been moved.
      */
     /* @TODO check configuration for max_thread_count */
-    if (remove || (nb_moved > 0)
-        || (entry_proc_pipeline[curr_stage].max_thread_count != 0)) {
-        P(work_avail_lock);
-        if (nb_waiting_threads > 0)
-            pthread_cond_signal(&work_avail_cond);
-        V(work_avail_lock);
-    }
+    if (any_removed || (nb_moved > 0)
+        || (entry_proc_pipeline[curr_stage].max_thread_count != 0))
+        wake_up_worker();
 
     /* free entry resources if asked */
-    if (remove) {
+    if (any_removed) {
         for (i = 0; i < count; i++) {
+            if (next_stages != NULL && next_stages[i] >= 0)
+                continue;
+
             /* If a limit of pending operations is specified, release a token */
             if (entry_proc_conf.max_pending_operations > 0)
-                sem_post(&pipeline_token);
+                pipeline_token_release();
+
+            bp_update(__sync_sub_and_fetch(&nb_pending_ops, 1));
 
             EntryProcessor_Release(ops[i]);
         }
@@ -994,6 +2103,24 @@ int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
     return 0;
 }
 
+/**
+ * Acknownledge a batch of operations.
+ */
+int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **ops, unsigned int count,
+                                    unsigned int next_stage, bool remove)
+{
+    return acknowledge_ops(ops, count, next_stage, remove, NULL);
+}
+
+/**
+ * Acknownledge a batch of operations, each of them going to its own stage.
+ */
+int EntryProcessor_AcknowledgeEach(entry_proc_op_t **ops, unsigned int count,
+                                   const int *next_stages)
+{
+    return acknowledge_ops(ops, count, 0, false, next_stages);
+}
+
 /**
  * Advise that the entry is ready for next step of the pipeline.
  * @param next_stage The next stage to be performed for this entry
@@ -1047,6 +2174,54 @@ static void print_op_stats(entry_proc_op_t *p_op, unsigned int stage,
                    entry_status_str(p_op, stage));
 }
 
+/** export pipeline stats to the metrics endpoint */
+static void pipeline_metrics_collect(metrics_out_t *out, void *arg)
+{
+    stage_hist_t sum;
+    unsigned int i;
+
+    if (!entry_proc_pipeline)
+        return;
+
+    metrics_family(out, "pipeline_pending_ops", METRIC_GAUGE,
+                   "Operations pending in the entry processor pipeline");
+    metrics_value(out, NULL, nb_pending_ops);
+    metrics_family(out, "pipeline_idle_threads", METRIC_GAUGE,
+                   "Idle entry processor threads");
+    metrics_value(out, NULL, nb_waiting_threads);
+    metrics_family(out, "pipeline_congestions_total", METRIC_COUNTER,
+                   "Times the pipeline reached its high watermark");
+    metrics_value(out, NULL, bp_nb_congested);
+
+    /* no locks here, as for the stats dump */
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        const list_by_stage_t *st = &pipeline[i];
+        const char *labels[] = { "stage",
+                                 strchr(entry_proc_pipeline[i].stage_name,
+                                        '_') + 1, NULL };
+
+        metrics_family(out, "pipeline_stage_waiting", METRIC_GAUGE,
+                       "Operations waiting in a pipeline stage");
+        metrics_value(out, labels, st->nb_unprocessed_entries);
+        metrics_family(out, "pipeline_stage_current", METRIC_GAUGE,
+                       "Operations being processed in a pipeline stage");
+        metrics_value(out, labels, st->nb_current_entries);
+        metrics_family(out, "pipeline_stage_processed_total", METRIC_COUNTER,
+                       "Operations processed by a pipeline stage");
+        metrics_value(out, labels, st->total_processed);
+
+        stage_hist_sum(i, &sum);
+        metrics_family(out, "pipeline_stage_wait_seconds", METRIC_HISTOGRAM,
+                       "Time operations waited before a pipeline stage");
+        metrics_hist(out, labels, sum.wait, 0);
+        metrics_family(out, "pipeline_stage_processing_seconds",
+                       METRIC_HISTOGRAM,
+                       "Time spent processing operations in a stage");
+        metrics_hist(out, labels, sum.proc,
+                     tv2usec(&st->total_processing_time));
+    }
+}
+
 void EntryProcessor_DumpCurrentStages(void)
 {
     unsigned int i;
@@ -1064,6 +2239,30 @@ void EntryProcessor_DumpCurrentStages(void)
         DisplayLog(LVL_MAJOR, "STATS",
                    "==== EntryProcessor Pipeline Stats ===");
         DisplayLog(LVL_MAJOR, "STATS", "Idle threads: %u", nb_waiting_threads);
+        if (!EMPTY_STRING(entry_proc_conf.cpu_affinity)) {
+            char descr[256];
+
+            affinity_describe(entry_proc_conf.cpu_affinity, descr,
+                              sizeof(descr));
+            DisplayLog(LVL_MAJOR, "STATS", "Thread affinity: %s (%s)",
+                       entry_proc_conf.cpu_affinity, descr);
+        }
+        if (bp_high != 0) {
+            struct timeval total = bp_total;
+
+            if (bp_congested) {
+                struct timeval now, diff;
+
+                gettimeofday(&now, NULL);
+                timersub(&now, &bp_start, &diff);
+                timeradd(&total, &diff, &total);
+            }
+            DisplayLog(LVL_MAJOR, "STATS", "Backpressure: %s (%u pending ops, "
+                       "watermarks: %u/%u), congested %llu times, "
+                       "for %.1fs total", bp_congested ? "congested" : "ok",
+                       nb_pending_ops, bp_low, bp_high, bp_nb_congested,
+                       total.tv_sec + 1E-6 * total.tv_usec);
+        }
 
         id_constraint_stats();
 
@@ -1106,16 +2305,50 @@ void EntryProcessor_DumpCurrentStages(void)
                 is_pending_op = true;
         }
         nb_get = nb_ins = nb_upd = nb_rm = 0;
-        for (i = 0; i < entry_proc_conf.nb_thread; i++) {
-            if (worker_params) {
-                nb_get += worker_params[i].lmgr.nbop[OPIDX_GET];
-                nb_ins += worker_params[i].lmgr.nbop[OPIDX_INSERT];
-                nb_upd += worker_params[i].lmgr.nbop[OPIDX_UPDATE];
-                nb_rm += worker_params[i].lmgr.nbop[OPIDX_RM];
-            }
+        P(workers_lock);
+        for (i = 0; i < nb_workers_started; i++) {
+            nb_get += worker_params[i]->lmgr.nbop[OPIDX_GET];
+            nb_ins += worker_params[i]->lmgr.nbop[OPIDX_INSERT];
+            nb_upd += worker_params[i]->lmgr.nbop[OPIDX_UPDATE];
+            nb_rm += worker_params[i]->lmgr.nbop[OPIDX_RM];
+        }
+        V(workers_lock);
+        for (i = 0; i < nb_apply_shards; i++) {
+            nb_get += apply_shards[i].lmgr.nbop[OPIDX_GET];
+            nb_ins += apply_shards[i].lmgr.nbop[OPIDX_INSERT];
+            nb_upd += apply_shards[i].lmgr.nbop[OPIDX_UPDATE];
+            nb_rm += apply_shards[i].lmgr.nbop[OPIDX_RM];
         }
         DisplayLog(LVL_MAJOR, "STATS", "DB ops: get=%u/ins=%u/upd=%u/rm=%u",
                    nb_get, nb_ins, nb_upd, nb_rm);
+        for (i = 0; i < nb_apply_shards; i++)
+            DisplayLog(LVL_MAJOR, "STATS", "DB apply shard #%u: queued=%u, "
+                       "ops=%llu, batches=%llu", i, apply_shards[i].count,
+                       apply_shards[i].nb_ops, apply_shards[i].nb_batches);
+        op_pool_stats_dump();
+        db_batch_size_stats();
+
+        stage_rate_update();
+        DisplayLog(LVL_MAJOR, "STATS", "%-18s |  ops/s | wait ms (p50/p90/p99) |"
+                   " proc ms (p50/p90/p99) | lock contention", "Stage latency");
+        for (i = 0; i < entry_proc_descr.stage_count; i++) {
+            stage_hist_t sum;
+
+            stage_hist_sum(i, &sum);
+            DisplayLog(LVL_MAJOR, "STATS", "%2u: %-14s | %6.1f | %6.2f/%6.2f/%6.2f | "
+                       "%6.2f/%6.2f/%6.2f | %.2f%% of %llu", i,
+                       strchr(entry_proc_pipeline[i].stage_name, '_') + 1,
+                       stage_rate ? stage_rate[i] : 0.0,
+                       hist_percentile(sum.wait, 50.0),
+                       hist_percentile(sum.wait, 90.0),
+                       hist_percentile(sum.wait, 99.0),
+                       hist_percentile(sum.proc, 50.0),
+                       hist_percentile(sum.proc, 90.0),
+                       hist_percentile(sum.proc, 99.0),
+                       pipeline[i].nb_locks ? 100.0 * pipeline[i].nb_lock_waits
+                           / pipeline[i].nb_locks : 0.0,
+                       pipeline[i].nb_locks);
+        }
     }
 
     if (TestDisplayLevel(LVL_EVENT)) {
@@ -1146,16 +2379,58 @@ void EntryProcessor_DumpCurrentStages(void)
     }
 }
 
+/**
+ * Store stage throughput and latency percentiles in DB, as
+ * <ENTRYPROC_STATS_PREFIX>_<stage> variables.
+ * Throughput is the one computed at the last stats dump.
+ */
+void EntryProcessor_StoreStats(lmgr_t *lmgr)
+{
+    unsigned int i;
+    char varname[256];
+    char value[MAX_VAR_LEN];
+
+    if (!entry_proc_pipeline || !stage_hists)
+        return; /* not initialized */
+
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        stage_hist_t sum;
+
+        stage_hist_sum(i, &sum);
+
+        snprintf(varname, sizeof(varname), "%s_%s", ENTRYPROC_STATS_PREFIX,
+                 strchr(entry_proc_pipeline[i].stage_name, '_') + 1);
+        snprintf(value, sizeof(value), "total=%llu,ops_sec=%.1f,"
+                 "wait_ms=%.2f/%.2f/%.2f,proc_ms=%.2f/%.2f/%.2f",
+                 pipeline[i].total_processed, stage_rate[i],
+                 hist_percentile(sum.wait, 50.0),
+                 hist_percentile(sum.wait, 90.0),
+                 hist_percentile(sum.wait, 99.0),
+                 hist_percentile(sum.proc, 50.0),
+                 hist_percentile(sum.proc, 90.0),
+                 hist_percentile(sum.proc, 99.0));
+
+        if (ListMgr_SetVar(lmgr, varname, value))
+            DisplayLog(LVL_MAJOR, ENTRYPROC_TAG,
+                       "Failed to store stats for stage %s",
+                       entry_proc_pipeline[i].stage_name);
+    }
+
+    sketch_store(lmgr);
+}
+
 entry_proc_op_t *EntryProcessor_Get(void)
 {
     /* allocate a new pipeline entry */
     entry_proc_op_t *p_entry;
 
-    p_entry = (entry_proc_op_t *) MemCalloc(1, sizeof(entry_proc_op_t));
+    p_entry = op_pool_get();
 
     if (!p_entry)
         return NULL;
 
+    memset(p_entry, 0, sizeof(*p_entry));
+
     /* nothing is set */
     ATTR_MASK_INIT(&p_entry->db_attrs);
     ATTR_MASK_INIT(&p_entry->fs_attrs);
@@ -1186,6 +2461,8 @@ static unsigned int count_nb_ops(void)
  */
 int EntryProcessor_Terminate(bool flush_ops)
 {
+    int i;
+    unsigned int nb_workers;
 
     P(terminate_lock);
 
@@ -1201,26 +2478,35 @@ int EntryProcessor_Terminate(bool flush_ops)
     DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "EntryProcessor shutdown mode: %s",
                terminate_flag == BREAK ? "BREAK" : "FLUSH");
 
-    /* force idle thread to wake up */
-    pthread_cond_broadcast(&work_avail_cond);
+    /* resume parked workers */
+    P(workers_lock);
+    pthread_cond_broadcast(&workers_cond);
+    nb_workers = nb_workers_started;
+    V(workers_lock);
+
+    /* force idle threads to wake up */
+    for (i = 0; i < nb_workers; i++)
+        sem_post(&work_avail_sem);
 
     /* wait for all workers to process all pipeline entries and terminate */
-    while (nb_finished_threads < entry_proc_conf.nb_thread) {
+    while (nb_finished_threads < nb_workers) {
         if (terminate_flag == FLUSH)
             DisplayLog(LVL_VERB, ENTRYPROC_TAG,
                        "Waiting for entry processor pipeline flush: still %u operations to be done, %u threads running",
-                       count_nb_ops(),
-                       entry_proc_conf.nb_thread - nb_finished_threads);
+                       count_nb_ops(), nb_workers - nb_finished_threads);
         else if (terminate_flag == BREAK)
             DisplayLog(LVL_VERB, ENTRYPROC_TAG,
                        "Waiting for current operations to end: still %u threads running",
-                       entry_proc_conf.nb_thread - nb_finished_threads);
+                       nb_workers - nb_finished_threads);
 
         pthread_cond_wait(&terminate_cond, &terminate_lock);
     }
 
     V(terminate_lock);
 
+    /* all sharded ops are done (FLUSH) or must be dropped (BREAK) */
+    apply_shards_terminate();
+
     DisplayLog(LVL_EVENT, ENTRYPROC_TAG, "Pipeline successfully flushed");
 
     EntryProcessor_DumpCurrentStages();
@@ -1232,9 +2518,24 @@ int EntryProcessor_Terminate(bool flush_ops)
  * A stage was blocked waiting for an operation to get its FID. This
  * is now done, so unblock the stage.
  */
+void EntryProcessor_ForEachPending(void (*cb)(entry_proc_op_t *op, void *arg),
+                                   void *arg)
+{
+    entry_proc_op_t *p_curr;
+    int i;
+
+    /* workers and shards are stopped: ops are only in stage lists */
+    for (i = 0; i < entry_proc_descr.stage_count; i++) {
+        stage_lock(&pipeline[i]);
+        rh_list_for_each_entry(p_curr, &pipeline[i].entries, list)
+            cb(p_curr, arg);
+        V(pipeline[i].stage_mutex);
+    }
+}
+
 void EntryProcessor_Unblock(int stage)
 {
-    P(pipeline[stage].stage_mutex);
+    stage_lock(&pipeline[stage]);
 
     /* and unset the block. */
     entry_proc_pipeline[stage].stage_flags &= ~STAGE_FLAG_FORCE_SEQ;
@@ -0,0 +1,318 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Top-K sketches of files (largest files, least recently accessed files),
+ * updated by the DB operations of the pipeline and stored in DB with
+ * the stats, for 'rbh-report --approx'.
+ * Each sketch is a heap whose root is the worst kept item, plus the set of
+ * its ids to update or remove entries that are already in the heap.
+ * Sketches survive restarts: the stored sketch is merged at first store.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "entry_proc_tools.h"
+#include "list_mgr.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+
+/* number of entries kept in each sketch */
+#define SKETCH_K    1000
+
+/* topk_add flags */
+#define SK_INSERT   0x1     /* insert the entry if it is not in the sketch */
+#define SK_UPDATE   0x2     /* update the entry if it is in the sketch */
+
+struct sketch_item {
+    entry_id_t  id;
+    uint64_t    val;
+};
+
+struct topk {
+    const char         *name;
+    bool                largest;  /* keep the largest values (else lowest) */
+    pthread_mutex_t     lock;
+    struct sketch_item  items[SKETCH_K];
+    unsigned int        count;
+    GHashTable         *members;  /* ids in items */
+    bool                loaded;   /* the stored sketch has been merged */
+};
+
+enum {
+    SKETCH_SIZE,
+    SKETCH_ATIME,
+    SKETCH_COUNT
+};
+
+static struct topk sketches[SKETCH_COUNT] = {
+    [SKETCH_SIZE] = {.name = SKETCH_NAME_SIZE, .largest = true,
+                     .lock = PTHREAD_MUTEX_INITIALIZER},
+    [SKETCH_ATIME] = {.name = SKETCH_NAME_ATIME, .largest = false,
+                      .lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+static guint id_hash(gconstpointer k)
+{
+    const entry_id_t *id = k;
+
+#ifdef FID_PK
+    return (guint)(id->f_seq ^ (id->f_seq >> 32) ^ id->f_oid);
+#else
+    return (guint)(id->fs_key ^ (id->fs_key >> 32) ^ id->inode);
+#endif
+}
+
+static gboolean id_equal(gconstpointer k1, gconstpointer k2)
+{
+    return entry_id_equal((const entry_id_t *)k1, (const entry_id_t *)k2);
+}
+
+static inline bool better(const struct topk *t, uint64_t a, uint64_t b)
+{
+    return t->largest ? a > b : a < b;
+}
+
+static inline void item_swap(struct topk *t, unsigned int i, unsigned int j)
+{
+    struct sketch_item tmp = t->items[i];
+
+    t->items[i] = t->items[j];
+    t->items[j] = tmp;
+}
+
+static void sift_up(struct topk *t, unsigned int i)
+{
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
+
+        if (!better(t, t->items[parent].val, t->items[i].val))
+            break;
+        item_swap(t, i, parent);
+        i = parent;
+    }
+}
+
+static void sift_down(struct topk *t, unsigned int i)
+{
+    for (;;) {
+        unsigned int worst = i;
+        unsigned int l = 2 * i + 1;
+        unsigned int r = l + 1;
+
+        if (l < t->count && better(t, t->items[worst].val, t->items[l].val))
+            worst = l;
+        if (r < t->count && better(t, t->items[worst].val, t->items[r].val))
+            worst = r;
+        if (worst == i)
+            return;
+        item_swap(t, i, worst);
+        i = worst;
+    }
+}
+
+/** index of a member of the sketch */
+static unsigned int item_index(const struct topk *t, const entry_id_t *id)
+{
+    unsigned int i;
+
+    for (i = 0; i < t->count; i++)
+        if (entry_id_equal(&t->items[i].id, id))
+            break;
+    return i;
+}
+
+static void member_add(struct topk *t, const entry_id_t *id)
+{
+    entry_id_t *key = g_new(entry_id_t, 1);
+
+    *key = *id;
+    g_hash_table_insert(t->members, key, key);
+}
+
+/** called with t->lock */
+static void topk_add(struct topk *t, const entry_id_t *id, uint64_t val,
+                     int flags)
+{
+    if (t->members == NULL)
+        t->members = g_hash_table_new_full(id_hash, id_equal, g_free, NULL);
+
+    if (g_hash_table_lookup(t->members, id) != NULL) {
+        unsigned int i;
+
+        if (!(flags & SK_UPDATE))
+            return;
+
+        i = item_index(t, id);
+        if (i == t->count)
+            return;
+
+        t->items[i].val = val;
+        /* the value may move either way */
+        sift_up(t, i);
+        sift_down(t, i);
+        return;
+    }
+
+    if (!(flags & SK_INSERT))
+        return;
+
+    if (t->count < SKETCH_K) {
+        t->items[t->count].id = *id;
+        t->items[t->count].val = val;
+        t->count++;
+        sift_up(t, t->count - 1);
+    } else if (better(t, val, t->items[0].val)) {
+        g_hash_table_remove(t->members, &t->items[0].id);
+        t->items[0].id = *id;
+        t->items[0].val = val;
+        sift_down(t, 0);
+    } else
+        return;
+
+    member_add(t, id);
+}
+
+static void topk_remove(struct topk *t, const entry_id_t *id)
+{
+    unsigned int i;
+
+    P(t->lock);
+    if (t->members == NULL || !g_hash_table_remove(t->members, id))
+        goto out;
+
+    i = item_index(t, id);
+    if (i == t->count)
+        goto out;
+
+    t->count--;
+    if (i < t->count) {
+        t->items[i] = t->items[t->count];
+        sift_up(t, i);
+        sift_down(t, i);
+    }
+ out:
+    V(t->lock);
+}
+
+void sketch_update(const entry_id_t *p_id, const attr_set_t *p_attrs)
+{
+    int flags = SK_UPDATE;
+
+    if (ATTR_MASK_TEST(p_attrs, type)) {
+        if (strcmp(ATTR(p_attrs, type), STR_TYPE_FILE) != 0)
+            return;
+        flags |= SK_INSERT;
+    }
+    /* else, only update entries that are known to be files */
+
+    if (ATTR_MASK_TEST(p_attrs, size)) {
+        P(sketches[SKETCH_SIZE].lock);
+        topk_add(&sketches[SKETCH_SIZE], p_id, ATTR(p_attrs, size), flags);
+        V(sketches[SKETCH_SIZE].lock);
+    }
+    if (ATTR_MASK_TEST(p_attrs, last_access)) {
+        P(sketches[SKETCH_ATIME].lock);
+        topk_add(&sketches[SKETCH_ATIME], p_id, ATTR(p_attrs, last_access),
+                 flags);
+        V(sketches[SKETCH_ATIME].lock);
+    }
+}
+
+void sketch_remove(const entry_id_t *p_id)
+{
+    int i;
+
+    for (i = 0; i < SKETCH_COUNT; i++)
+        topk_remove(&sketches[i], p_id);
+}
+
+/** merge the sketch stored by a previous run */
+static void sketch_load(struct topk *t, lmgr_t *lmgr)
+{
+    entry_id_t *ids = NULL;
+    uint64_t *vals = NULL;
+    unsigned int i, count = 0;
+    int rc;
+
+    rc = ListMgr_GetSketch(lmgr, t->name, t->largest, &ids, &vals, &count);
+    if (rc == DB_NOT_EXISTS) {
+        t->loaded = true;
+        return;
+    } else if (rc) {
+        DisplayLog(LVL_MAJOR, ENTRYPROC_TAG, "Failed to load sketch %s: "
+                   "%s (%d)", t->name, lmgr_err2str(rc), rc);
+        return;
+    }
+
+    P(t->lock);
+    /* entries updated since startup have a more recent value */
+    for (i = 0; i < count; i++)
+        topk_add(t, &ids[i], vals[i], SK_INSERT);
+    t->loaded = true;
+    V(t->lock);
+
+    if (ids != NULL)
+        MemFree(ids);
+    if (vals != NULL)
+        MemFree(vals);
+}
+
+void sketch_store(lmgr_t *lmgr)
+{
+    entry_id_t *ids;
+    uint64_t *vals;
+    unsigned int i, count;
+    int s, rc;
+
+    ids = MemAlloc(SKETCH_K * sizeof(*ids));
+    vals = MemAlloc(SKETCH_K * sizeof(*vals));
+    if (ids == NULL || vals == NULL)
+        goto out;
+
+    for (s = 0; s < SKETCH_COUNT; s++) {
+        struct topk *t = &sketches[s];
+
+        if (!t->loaded)
+            sketch_load(t, lmgr);
+
+        P(t->lock);
+        count = t->count;
+        for (i = 0; i < count; i++) {
+            ids[i] = t->items[i].id;
+            vals[i] = t->items[i].val;
+        }
+        V(t->lock);
+
+        /* don't overwrite the stored sketch if it could not be merged */
+        if (!t->loaded || count == 0)
+            continue;
+
+        rc = ListMgr_StoreSketch(lmgr, t->name, ids, vals, count);
+        if (rc)
+            DisplayLog(LVL_MAJOR, ENTRYPROC_TAG, "Failed to store sketch %s: "
+                       "%s (%d)", t->name, lmgr_err2str(rc), rc);
+    }
+
+ out:
+    if (ids != NULL)
+        MemFree(ids);
+    if (vals != NULL)
+        MemFree(vals);
+}
@@ -25,6 +25,7 @@
 #include "rbh_logs.h"
 #include "rbh_cfg_helpers.h"
 #include "rbh_misc.h"
+#include "rbh_affinity.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,18 +34,18 @@
 entry_proc_config_t entry_proc_conf;
 int pipeline_flags = 0;
 
-/* default max pending operation is 10k */
-#define ID_HASH_SIZE 16007
+/* default max pending operation is 10k (tables grow as needed) */
+#define ID_HASH_SIZE 16384
 /* hash table for storing references to ids */
-static struct id_hash *id_hash;
+static struct constraint_hash *id_hash;
 /* hash table for storing references to parent_id/name */
-static struct id_hash *name_hash;
+static struct constraint_hash *name_hash;
 
 /** initialize id constraint manager */
 int id_constraint_init(void)
 {
-    id_hash = id_hash_init(ID_HASH_SIZE, true);
-    name_hash = id_hash_init(ID_HASH_SIZE, true);
+    id_hash = constraint_hash_init(ID_HASH_SIZE, false);
+    name_hash = constraint_hash_init(ID_HASH_SIZE, true);
     /* exiting the process releases hash resources */
     return (id_hash == NULL || name_hash == NULL) ? -1 : 0;
 }
@@ -58,42 +59,18 @@ int id_constraint_init(void)
  */
 int id_constraint_register(entry_proc_op_t *p_op, int at_head)
 {
-    struct id_hash_slot *slot;
-
     if (!p_op->entry_id_is_set)
         return ID_MISSING;
 
-    /* compute id hash value */
-    slot = get_hash_slot(id_hash, &p_op->entry_id);
-
-    P(slot->lock);
-
-    if (at_head)
-        rh_list_add(&p_op->id_hash_list, &slot->list);
-    else
-        rh_list_add_tail(&p_op->id_hash_list, &slot->list);
-
-    slot->count++;
+    constraint_hash_insert(id_hash, p_op, at_head);
     p_op->id_is_referenced = 1;
 
-    V(slot->lock);
-
     /* also lock parent_id/name */
-    if (ATTR_MASK_TEST(&p_op->fs_attrs, parent_id) &&
+    if (!p_op->name_is_referenced &&
+        ATTR_MASK_TEST(&p_op->fs_attrs, parent_id) &&
         ATTR_MASK_TEST(&p_op->fs_attrs, name)) {
-        slot = get_name_hash_slot(name_hash, &ATTR(&p_op->fs_attrs, parent_id),
-                                  ATTR(&p_op->fs_attrs, name));
-        P(slot->lock);
-
-        if (at_head)
-            rh_list_add(&p_op->name_hash_list, &slot->list);
-        else
-            rh_list_add_tail(&p_op->name_hash_list, &slot->list);
-
-        slot->count++;
+        constraint_hash_insert(name_hash, p_op, at_head);
         p_op->name_is_referenced = 1;
-
-        V(slot->lock);
     }
 
     return ID_OK;
@@ -113,35 +90,19 @@ int id_constraint_register(entry_proc_op_t *p_op, int at_head)
  */
 bool id_constraint_is_first_op(entry_proc_op_t *p_op_in)
 {
-    entry_proc_op_t *op;
-    struct id_hash_slot *slot;
-    int is_first = -1;  /* not set */
-
-    /* compute id hash value */
-    slot = get_hash_slot(id_hash, &p_op_in->entry_id);
-
-    P(slot->lock);
-    rh_list_for_each_entry(op, &slot->list, id_hash_list) {
-        if (entry_id_equal(&p_op_in->entry_id, &op->entry_id)) {
-            /* found an operation with the given id */
-            if (op == p_op_in)
-                is_first = 1;
-            else {
-                is_first = 0;
-                DisplayLog(LVL_FULL, "IdConstraint",
-                           "Pending operation with the same id: " DFID
-                           " (%s). next op: %s", PFID(&op->entry_id),
-                           op_name(op), op_name(p_op_in));
-            }
-            break;
-        }
-    }
-    V(slot->lock);
-
-    if (is_first == 0)
+    entry_proc_op_t *op = NULL;
+    int is_first;   /* -1: not set */
+
+    is_first = constraint_hash_first(id_hash, p_op_in, &op);
+    if (is_first == 0) {
+        DisplayLog(LVL_FULL, "IdConstraint",
+                   "Pending operation with the same id: " DFID
+                   " (%s). next op: %s", PFID(&op->entry_id),
+                   op_name(op), op_name(p_op_in));
         /* for sure, there is another operation on the same id before
          * this one */
         return false;
+    }
 
     /* sanity check: registered operation was not found??? */
     if ((is_first == -1) && (p_op_in->id_is_referenced))
@@ -151,31 +112,23 @@ bool id_constraint_is_first_op(entry_proc_op_t *p_op_in)
      * Additional check of parent/name constraint: */
     if (ATTR_MASK_TEST(&p_op_in->fs_attrs, parent_id) &&
         ATTR_MASK_TEST(&p_op_in->fs_attrs, name)) {
-        slot =
-            get_name_hash_slot(name_hash, &ATTR(&p_op_in->fs_attrs, parent_id),
-                               ATTR(&p_op_in->fs_attrs, name));
-        P(slot->lock);
-        rh_list_for_each_entry(op, &slot->list, name_hash_list) {
-            if (entry_id_equal
-                (&ATTR(&p_op_in->fs_attrs, parent_id),
-                 &ATTR(&op->fs_attrs, parent_id))
-                && !strcmp(ATTR(&p_op_in->fs_attrs, name),
-                           ATTR(&op->fs_attrs, name))) {
-                if (op == p_op_in)
-                    is_first = 1;
-                else {
-                    is_first = 0;
-                    DisplayLog(LVL_FULL, "IdConstraint",
-                               "Pending operation with the same parent/name: "
-                               DFID "/%s (%s). next op: %s",
-                               PFID(&ATTR(&p_op_in->fs_attrs, parent_id)),
-                               ATTR(&p_op_in->fs_attrs, name), op_name(op),
-                               op_name(p_op_in));
-                }
-                break;
-            }
+        switch (constraint_hash_first(name_hash, p_op_in, &op)) {
+        case 1:
+            is_first = 1;
+            break;
+        case 0:
+            is_first = 0;
+            DisplayLog(LVL_FULL, "IdConstraint",
+                       "Pending operation with the same parent/name: "
+                       DFID "/%s (%s). next op: %s",
+                       PFID(&ATTR(&p_op_in->fs_attrs, parent_id)),
+                       ATTR(&p_op_in->fs_attrs, name), op_name(op),
+                       op_name(p_op_in));
+            break;
+        default:
+            /* not found: keep the result of id check */
+            break;
         }
-        V(slot->lock);
     }
 
     /* if is_first = 0 => not first */
@@ -189,39 +142,22 @@ bool id_constraint_is_first_op(entry_proc_op_t *p_op_in)
  */
 int id_constraint_unregister(entry_proc_op_t *p_op)
 {
-    struct id_hash_slot *slot;
-
     if (!p_op->entry_id_is_set)
         return ID_MISSING;
 
     if (!p_op->id_is_referenced)
         return ID_NOT_EXISTS;
 
-    slot = get_hash_slot(id_hash, &p_op->entry_id);
-
     /* Remove the entry */
-    P(slot->lock);
-
-    rh_list_del(&p_op->id_hash_list);
+    constraint_hash_remove(id_hash, p_op);
     p_op->id_is_referenced = 0;
-    slot->count--;
-
-    V(slot->lock);
 
     if (p_op->name_is_referenced) {
         if (ATTR_MASK_TEST(&p_op->fs_attrs, parent_id) &&
             ATTR_MASK_TEST(&p_op->fs_attrs, name)) {
-            slot =
-                get_name_hash_slot(name_hash, &ATTR(&p_op->fs_attrs, parent_id),
-                                   ATTR(&p_op->fs_attrs, name));
             /* Remove the entry */
-            P(slot->lock);
-
-            rh_list_del(&p_op->name_hash_list);
+            constraint_hash_remove(name_hash, p_op);
             p_op->name_is_referenced = 0;
-            slot->count--;
-
-            V(slot->lock);
         } else {
             DisplayLog(LVL_MAJOR, "IdConstraint", "WARNING: cannot unregister "
                        "entry with no parent/name but with a registered name!");
@@ -233,14 +169,131 @@ int id_constraint_unregister(entry_proc_op_t *p_op)
 
 void id_constraint_stats(void)
 {
-    id_hash_stats(id_hash, "Id constraints count");
-    id_hash_stats(name_hash, "Name constraints count");
+    constraint_hash_stats(id_hash, "Id constraints count");
+    constraint_hash_stats(name_hash, "Name constraints count");
 }
 
 void id_constraint_dump(void)
 {
-    id_hash_dump(id_hash, false);
-    id_hash_dump(name_hash, true);
+    constraint_hash_dump(id_hash);
+    constraint_hash_dump(name_hash);
+}
+
+/* ------------ Adaptive DB batch size --------------- */
+
+/* latency histogram: bucket i counts batches with latency in
+ * [2^(i-1), 2^i[ microseconds */
+#define LAT_BUCKETS 32
+
+static unsigned int batch_size_cur = 0; /* 0 = not initialized */
+static pthread_mutex_t batch_size_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long batch_lat_hist[LAT_BUCKETS];
+static unsigned long long batch_lat_count = 0;
+
+unsigned int db_batch_size_current(void)
+{
+    unsigned int cur = batch_size_cur;
+
+    if (cur == 0 || entry_proc_conf.batch_target_latency_ms == 0
+        || cur > entry_proc_conf.max_batch_size)
+        return entry_proc_conf.max_batch_size;
+    return cur;
+}
+
+unsigned int db_apply_window(void)
+{
+    unsigned int cur = db_batch_size_current();
+
+    if (entry_proc_conf.db_apply_sort)
+        return MAX2(cur, entry_proc_conf.db_apply_sort_window);
+    return cur;
+}
+
+static inline unsigned int lat_bucket(unsigned long long usec)
+{
+    unsigned int b = 0;
+
+    while (usec > 0 && b < LAT_BUCKETS - 1) {
+        usec >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void db_batch_size_feedback(unsigned int count, const struct timeval *latency)
+{
+    unsigned long long usec = latency->tv_sec * 1000000ULL + latency->tv_usec;
+    unsigned long long target =
+        entry_proc_conf.batch_target_latency_ms * 1000ULL;
+    unsigned int cur;
+
+    P(batch_size_lock);
+    batch_lat_hist[lat_bucket(usec)]++;
+    batch_lat_count++;
+
+    if (target == 0) {
+        V(batch_size_lock);
+        return;
+    }
+
+    cur = db_batch_size_current();
+    if (usec > target) {
+        /* too slow: decrease multiplicatively, proportionally
+         * to the latency excess (at most by half) */
+        unsigned int next = (unsigned int)((cur * target) / usec);
+
+        cur = MAX2(MAX2(next, cur / 2), 1);
+    } else if (count >= cur && usec < target / 2) {
+        /* a full batch was fast: increase by 1/8 */
+        cur = MIN2(cur + cur / 8 + 1, entry_proc_conf.max_batch_size);
+    }
+    batch_size_cur = cur;
+    V(batch_size_lock);
+}
+
+/* returns the latency (us) for the given percentile (0-100) */
+static unsigned long long lat_percentile(const unsigned long long *hist,
+                                         unsigned long long total,
+                                         unsigned int pct)
+{
+    unsigned long long sum = 0;
+    unsigned long long thr = (total * pct + 99) / 100;
+    unsigned int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum >= thr && sum > 0)
+            /* upper bound of the bucket */
+            return i == 0 ? 0 : (1ULL << i);
+    }
+    return 1ULL << (LAT_BUCKETS - 1);
+}
+
+void db_batch_size_stats(void)
+{
+    unsigned long long hist[LAT_BUCKETS];
+    unsigned long long total;
+
+    P(batch_size_lock);
+    memcpy(hist, batch_lat_hist, sizeof(hist));
+    total = batch_lat_count;
+    V(batch_size_lock);
+
+    if (entry_proc_conf.batch_target_latency_ms != 0)
+        DisplayLog(LVL_MAJOR, "STATS", "DB batch size: current=%u, max=%u, "
+                   "target latency=%ums", db_batch_size_current(),
+                   entry_proc_conf.max_batch_size,
+                   entry_proc_conf.batch_target_latency_ms);
+    else
+        DisplayLog(LVL_MAJOR, "STATS", "DB batch size: %u (fixed)",
+                   entry_proc_conf.max_batch_size);
+
+    if (total > 0)
+        DisplayLog(LVL_MAJOR, "STATS", "DB batch latency (%llu batches): "
+                   "p50 < %.2fms, p90 < %.2fms, p99 < %.2fms", total,
+                   lat_percentile(hist, total, 50) / 1000.0,
+                   lat_percentile(hist, total, 90) / 1000.0,
+                   lat_percentile(hist, total, 99) / 1000.0);
 }
 
 /* ------------ Config management functions --------------- */
@@ -256,10 +309,17 @@ static void entry_proc_cfg_set_default(void *module_config)
         conf->nb_thread = 16;
     else
         conf->nb_thread = 10;
+    conf->cpu_affinity[0] = '\0';
 
     /* for efficient batching of 1000 ops */
     conf->max_pending_operations = 10000;
+    conf->high_watermark = 0;
+    conf->low_watermark = 0;
     conf->max_batch_size = 1000;
+    conf->db_apply_shards = 0;
+    conf->batch_target_latency_ms = 200;
+    conf->db_apply_sort = false;
+    conf->db_apply_sort_window = 0;
     conf->match_classes = true;
 
     conf->detect_fake_mtime = false;
@@ -274,8 +334,15 @@ static void entry_proc_cfg_write_default(FILE *output)
     else
         print_line(output, 1, "nb_threads             :  10");
 
+    print_line(output, 1, "cpu_affinity           :  \"\" (any CPU)");
     print_line(output, 1, "max_pending_operations :  10000");
+    print_line(output, 1, "high_watermark         :  0 (90% of max_pending_operations)");
+    print_line(output, 1, "low_watermark          :  0 (70% of max_pending_operations)");
     print_line(output, 1, "max_batch_size         :  1000");
+    print_line(output, 1, "db_apply_shards        :  0 (disabled)");
+    print_line(output, 1, "batch_target_latency_ms:  200");
+    print_line(output, 1, "db_apply_sort          :  no");
+    print_line(output, 1, "db_apply_sort_window   :  0 (batch size)");
     print_line(output, 1, "match_classes          :  yes");
     print_line(output, 1, "detect_fake_mtime      :  no");
     print_end_block(output, 0);
@@ -423,17 +490,28 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
 
     /* buffer to store arg names */
     char *pipeline_names = NULL;
-    /* max size is max pipeline steps (<10) + other args (<6) */
-#define MAX_ENTRYPROC_ARGS 16
+    /* max size is max pipeline steps (<10) + other args (<10) */
+#define MAX_ENTRYPROC_ARGS 24
     char *entry_proc_allowed[MAX_ENTRYPROC_ARGS] = { 0 };
 
     const cfg_param_t cfg_params[] = {
         {"nb_threads", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL, &conf->nb_thread,
          0},
+        {"cpu_affinity", PT_STRING, PFLG_NO_WILDCARDS, conf->cpu_affinity,
+         sizeof(conf->cpu_affinity)},
         {"max_pending_operations", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->max_pending_operations, 0},
+        {"high_watermark", PT_INT, PFLG_POSITIVE, &conf->high_watermark, 0},
+        {"low_watermark", PT_INT, PFLG_POSITIVE, &conf->low_watermark, 0},
         {"max_batch_size", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->max_batch_size, 0},
+        {"db_apply_shards", PT_INT, PFLG_POSITIVE, &conf->db_apply_shards,
+         0},
+        {"batch_target_latency_ms", PT_INT, PFLG_POSITIVE,
+         &conf->batch_target_latency_ms, 0},
+        {"db_apply_sort", PT_BOOL, 0, &conf->db_apply_sort, 0},
+        {"db_apply_sort_window", PT_INT, PFLG_POSITIVE,
+         &conf->db_apply_sort_window, 0},
         {"match_classes", PT_BOOL, 0, &conf->match_classes, 0},
         {"detect_fake_mtime", PT_BOOL, 0, &conf->detect_fake_mtime, 0},
 
@@ -464,6 +542,36 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
                    ENTRYPROC_CONFIG_BLOCK " should have at least 2 threads to "
                    "avoid pipeline step starvation!");
 
+    if (affinity_check(conf->cpu_affinity)) {
+        sprintf(msg_out, "Invalid value for cpu_affinity: '%s' (expected: "
+                "CPU list like '0-7,16-23', or 'node:<list>')",
+                conf->cpu_affinity);
+        return EINVAL;
+    }
+
+    if (conf->high_watermark != 0
+        && conf->low_watermark >= conf->high_watermark) {
+        sprintf(msg_out, "Wrong value for 'low_watermark': it must be lower "
+                "than high_watermark (%u)", conf->high_watermark);
+        return EINVAL;
+    }
+    if (conf->high_watermark > conf->max_pending_operations)
+        DisplayLog(LVL_MAJOR, "EntryProc_Config", "WARNING: "
+                   ENTRYPROC_CONFIG_BLOCK "::high_watermark (%u) is over "
+                   "max_pending_operations (%u): producers will block "
+                   "before slowing down.", conf->high_watermark,
+                   conf->max_pending_operations);
+
+    /* same restriction as parallelizing DB_APPLY (see below) */
+    if (!lmgr_parallel_batches() && (conf->max_batch_size != 1)
+        && (conf->db_apply_shards > 1)) {
+        sprintf(msg_out, "Wrong value for 'db_apply_shards': Parallelizing "
+                "batched DB operations is not allowed when accounting is ON.\n"
+                "Disable accounting (accounting = no) or disable batching "
+                "(max_batch_size=1) to shard this stage.");
+        return EINVAL;
+    }
+
     /* look for '<stage>_thread_max' parameters (for all pipelines) */
 
     /* Set default pipeline config according to EntryProc config
@@ -506,8 +614,15 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
 
     next_idx = 0;
     entry_proc_allowed[next_idx++] = "nb_threads";
+    entry_proc_allowed[next_idx++] = "cpu_affinity";
     entry_proc_allowed[next_idx++] = "max_pending_operations";
+    entry_proc_allowed[next_idx++] = "high_watermark";
+    entry_proc_allowed[next_idx++] = "low_watermark";
     entry_proc_allowed[next_idx++] = "max_batch_size";
+    entry_proc_allowed[next_idx++] = "db_apply_shards";
+    entry_proc_allowed[next_idx++] = "batch_target_latency_ms";
+    entry_proc_allowed[next_idx++] = "db_apply_sort";
+    entry_proc_allowed[next_idx++] = "db_apply_sort_window";
     entry_proc_allowed[next_idx++] = "match_classes";
     entry_proc_allowed[next_idx++] = "detect_fake_mtime";
 
@@ -531,15 +646,45 @@ static int entry_proc_cfg_read(config_file_t config, void *module_config,
 
 static int entry_proc_cfg_reload(entry_proc_config_t *conf)
 {
-    if (conf->nb_thread != entry_proc_conf.nb_thread)
+    /* thread count, max pending operations and watermarks are applied
+     * to the running pipeline by EntryProcessor_Reconfig() */
+    if (conf->nb_thread != entry_proc_conf.nb_thread) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK "::nb_threads updated: '%u'->'%u'",
+                   entry_proc_conf.nb_thread, conf->nb_thread);
+        entry_proc_conf.nb_thread = conf->nb_thread;
+    }
+
+    if (conf->max_pending_operations != entry_proc_conf.max_pending_operations) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::max_pending_operations updated: '%u'->'%u'",
+                   entry_proc_conf.max_pending_operations,
+                   conf->max_pending_operations);
+        entry_proc_conf.max_pending_operations = conf->max_pending_operations;
+    }
+
+    if (conf->high_watermark != entry_proc_conf.high_watermark
+        || conf->low_watermark != entry_proc_conf.low_watermark) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::high_watermark/low_watermark updated: '%u/%u'->'%u/%u'",
+                   entry_proc_conf.high_watermark,
+                   entry_proc_conf.low_watermark, conf->high_watermark,
+                   conf->low_watermark);
+        entry_proc_conf.high_watermark = conf->high_watermark;
+        entry_proc_conf.low_watermark = conf->low_watermark;
+    }
+
+    if (conf->db_apply_shards != entry_proc_conf.db_apply_shards)
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
                    ENTRYPROC_CONFIG_BLOCK
-                   "::nb_threads changed in config file, but cannot be modified dynamically");
+                   "::db_apply_shards changed in config file, but cannot be modified dynamically");
 
-    if (conf->max_pending_operations != entry_proc_conf.max_pending_operations)
+    if (strcmp(conf->cpu_affinity, entry_proc_conf.cpu_affinity))
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
                    ENTRYPROC_CONFIG_BLOCK
-                   "::max_pending_operations changed in config file, but cannot be modified dynamically");
+                   "::cpu_affinity changed in config file, but cannot be modified dynamically");
 
     if (conf->max_batch_size != entry_proc_conf.max_batch_size) {
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
@@ -549,6 +694,30 @@ static int entry_proc_cfg_reload(entry_proc_config_t *conf)
         entry_proc_conf.max_batch_size = conf->max_batch_size;
     }
 
+    if (conf->batch_target_latency_ms
+        != entry_proc_conf.batch_target_latency_ms) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::batch_target_latency_ms updated: '%u'->'%u'",
+                   entry_proc_conf.batch_target_latency_ms,
+                   conf->batch_target_latency_ms);
+        entry_proc_conf.batch_target_latency_ms =
+            conf->batch_target_latency_ms;
+    }
+
+    if (conf->db_apply_sort != entry_proc_conf.db_apply_sort) {
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK "::db_apply_sort updated: '%s'->'%s'",
+                   bool2str(entry_proc_conf.db_apply_sort),
+                   bool2str(conf->db_apply_sort));
+        entry_proc_conf.db_apply_sort = conf->db_apply_sort;
+    }
+
+    if (conf->db_apply_sort_window != entry_proc_conf.db_apply_sort_window)
+        DisplayLog(LVL_MAJOR, "EntryProc_Config",
+                   ENTRYPROC_CONFIG_BLOCK
+                   "::db_apply_sort_window changed in config file, but cannot be modified dynamically");
+
     if (conf->match_classes != entry_proc_conf.match_classes) {
         DisplayLog(LVL_MAJOR, "EntryProc_Config",
                    ENTRYPROC_CONFIG_BLOCK "::match_classes updated: '%s'->'%s'",
@@ -595,6 +764,9 @@ static void entry_proc_cfg_write_template(FILE *output)
     print_line(output, 1,
                "# nbr of worker threads for processing pipeline tasks");
     print_line(output, 1, "nb_threads = 16 ;");
+    print_line(output, 1,
+               "# bind pipeline threads to CPUs (e.g. \"0-7\") or NUMA nodes (\"node:0\")");
+    print_line(output, 1, "# cpu_affinity = \"node:0\" ;");
     fprintf(output, "\n");
     print_line(output, 1,
                "# Max number of operations in the Entry Processor pipeline.");
@@ -607,10 +779,40 @@ static void entry_proc_cfg_write_template(FILE *output)
 #else
     print_line(output, 1, "max_pending_operations = 10000 ;");
 #endif
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Info collectors are asked to slow down when the number of");
+    print_line(output, 1,
+               "# pending operations reaches high_watermark, until it gets");
+    print_line(output, 1,
+               "# under low_watermark (0=90% and 70% of max_pending_operations)");
+    print_line(output, 1, "# high_watermark = 9000 ;");
+    print_line(output, 1, "# low_watermark = 7000 ;");
     fprintf(output, "\n");
     print_line(output, 1, "# max batched DB operations (1=no batching)");
     print_line(output, 1, "max_batch_size = 1000;");
     fprintf(output, "\n");
+    print_line(output, 1,
+               "# Batch size is tuned at runtime (up to max_batch_size)");
+    print_line(output, 1,
+               "# so that applying a batch takes about this time (0=fixed size)");
+    print_line(output, 1, "batch_target_latency_ms = 200;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Sort DB batches in the order of the primary key (entry id),");
+    print_line(output, 1,
+               "# and optionally sort a larger window of consecutive operations");
+    print_line(output, 1, "# (applied by batches of the current batch size)");
+    print_line(output, 1, "# db_apply_sort = yes;");
+    print_line(output, 1, "# db_apply_sort_window = 10000;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Number of dedicated DB apply threads, each one with its own");
+    print_line(output, 1,
+               "# DB connection. Operations are routed to them by entry id");
+    print_line(output, 1, "# (0=disabled: DB ops are run by pipeline threads)");
+    print_line(output, 1, "# db_apply_shards = 4;");
+    fprintf(output, "\n");
 
     print_line(output, 1,
                "# Optionnaly specify a maximum thread count for each stage of the pipeline:");
@@ -21,8 +21,28 @@
 
 typedef struct entry_proc_config_t {
     unsigned int nb_thread;
+    /** CPUs or NUMA nodes of pipeline and DB apply threads
+     * (see rbh_affinity.h) */
+    char cpu_affinity[256];
     unsigned int max_pending_operations;
+    /** producers are asked to slow down when the number of pending
+     * operations reaches the high watermark, until it gets under the
+     * low watermark (0 = a ratio of max_pending_operations) */
+    unsigned int high_watermark;
+    unsigned int low_watermark;
     unsigned int max_batch_size;
+    /** number of dedicated DB apply threads (0 = no sharding) */
+    unsigned int db_apply_shards;
+    /** target latency of DB batches, in milliseconds
+     * (0 = always use max_batch_size) */
+    unsigned int batch_target_latency_ms;
+    /** sort DB batches in the order of the entries primary key,
+     * so consecutive inserts hit neighbouring pages of the DB index */
+    bool db_apply_sort;
+    /** when sorting, number of consecutive DB operations gathered and
+     * sorted together (applied by batches of the current DB batch size)
+     * (0 = sort each batch) */
+    unsigned int db_apply_sort_window;
 
     bool match_classes;
 
@@ -65,6 +85,34 @@ void id_constraint_stats(void);
 /* dump all values */
 void id_constraint_dump(void);
 
+/** current limit for the size of DB batches */
+unsigned int db_batch_size_current(void);
+
+/**
+ * Report the latency of a DB batch, and adjust the batch size limit
+ * toward the target latency.
+ * @param count    number of operations in the batch.
+ * @param latency  time to apply the batch.
+ */
+void db_batch_size_feedback(unsigned int count, const struct timeval *latency);
+
+/**
+ * Max number of operations gathered by the DB apply stage: the current DB
+ * batch size, or the sort window if it is larger.
+ */
+unsigned int db_apply_window(void);
+
+/** display stats about DB batch size and latency */
+void db_batch_size_stats(void);
+
+/* top-K sketches of files (see entry_proc_sketch.c) */
+/** account the attributes of an entry written to the DB */
+void sketch_update(const entry_id_t *p_id, const attr_set_t *p_attrs);
+/** forget a removed entry */
+void sketch_remove(const entry_id_t *p_id);
+/** store sketches in DB */
+void sketch_store(lmgr_t *lmgr);
+
 void time2human_helper(time_t t, const char *attr_name, char *str,
                        size_t size, const struct entry_proc_op_t *p_op);
 
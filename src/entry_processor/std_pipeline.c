@@ -27,28 +27,41 @@
 #include "policy_rules.h"
 #include "update_params.h"
 #include "status_manager.h"
+#include "policy_candidates.h"
+#include "policy_tracker.h"
+#include "rbh_fidpath.h"
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #define ERR_MISSING(_err) (((_err)==ENOENT)||((_err)==ESTALE))
 
 #define diff_mask *((attr_mask_t*)entry_proc_arg)
 
+/* path attributes of fileclass definitions, only retrieved when fileclass
+ * matching reads them */
+#define LAZY_PATH_MASK (ATTR_MASK_fullpath | ATTR_MASK_name | ATTR_MASK_depth)
+
 /* forward declaration of EntryProc functions of pipeline */
 static int  EntryProc_get_fid( struct entry_proc_op_t *, lmgr_t * );
 static int  EntryProc_get_info_db( struct entry_proc_op_t *, lmgr_t * );
+static int  EntryProc_get_info_db_batch(struct entry_proc_op_t **, int, lmgr_t *);
 static int  EntryProc_get_info_fs( struct entry_proc_op_t *, lmgr_t * );
 static int  EntryProc_pre_apply(struct entry_proc_op_t *, lmgr_t *);
 static int  EntryProc_db_apply(struct entry_proc_op_t *, lmgr_t *);
 static int  EntryProc_db_batch_apply(struct entry_proc_op_t **, int, lmgr_t *);
 #ifdef HAVE_CHANGELOGS
 static int  EntryProc_chglog_clr( struct entry_proc_op_t *, lmgr_t * );
+static int  EntryProc_chglog_clr_batch(struct entry_proc_op_t **, int, lmgr_t *);
+static bool chglog_clr_is_batchable(struct entry_proc_op_t *, struct entry_proc_op_t *, attr_mask_t *);
 #endif
 static int  EntryProc_rm_old_entries( struct entry_proc_op_t *, lmgr_t * );
 
 /* forward declaration to check batchable operations for db_apply stage */
 static bool dbop_is_batchable(struct entry_proc_op_t *, struct entry_proc_op_t *, attr_mask_t *);
+/* forward declaration to check batchable operations for get_info_db stage */
+static bool dbget_is_batchable(struct entry_proc_op_t *, struct entry_proc_op_t *, attr_mask_t *);
 
 /** pipeline stages */
 enum {
@@ -80,7 +93,8 @@ const pipeline_descr_t std_pipeline_descr =
 pipeline_stage_t std_pipeline[] = {
     {STAGE_GET_FID, "STAGE_GET_FID", EntryProc_get_fid, NULL, NULL,
      STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC, 0},
-    {STAGE_GET_INFO_DB, "STAGE_GET_INFO_DB", EntryProc_get_info_db, NULL, NULL,
+    {STAGE_GET_INFO_DB, "STAGE_GET_INFO_DB", EntryProc_get_info_db,
+        EntryProc_get_info_db_batch, dbget_is_batchable, /* batched ops management */
      STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC | STAGE_FLAG_ID_CONSTRAINT, 0},
     {STAGE_GET_INFO_FS, "STAGE_GET_INFO_FS", EntryProc_get_info_fs, NULL, NULL,
      STAGE_FLAG_PARALLEL | STAGE_FLAG_SYNC, 0},
@@ -100,7 +114,8 @@ pipeline_stage_t std_pipeline[] = {
 #ifdef HAVE_CHANGELOGS
     /* only 1 thread here because committing records must be sequential
      * (in the same order as changelog) */
-    {STAGE_CHGLOG_CLR, "STAGE_CHGLOG_CLR", EntryProc_chglog_clr, NULL, NULL, /* XXX could be batched? */
+    {STAGE_CHGLOG_CLR, "STAGE_CHGLOG_CLR", EntryProc_chglog_clr,
+        EntryProc_chglog_clr_batch, chglog_clr_is_batchable,
      STAGE_FLAG_SEQUENTIAL | STAGE_FLAG_SYNC, 1},
 
      /* acknowledging records must be sequential,
@@ -241,6 +256,9 @@ static int EntryProc_FillFromLogRec(struct entry_proc_op_t *p_op,
     CL_REC_TYPE *logrec = p_op->extra_info.log_record.p_log_rec;
     attr_mask_t status_mask_need = null_mask;
     proc_action_e rec_action = PROC_ACT_NONE;
+    /* this record, and the ones the reader merged into it */
+    uint32_t rec_types = (1 << logrec->cr_type)
+                         | p_op->extra_info.log_record.merged_types;
 
     /* if this is a CREATE record, we know that its status is NEW. */
     if (logrec->cr_type == CL_CREATE)
@@ -338,7 +356,7 @@ static int EntryProc_FillFromLogRec(struct entry_proc_op_t *p_op,
         check_path_info(p_op, "UNLINK");
     }
 #ifdef HAVE_CL_LAYOUT
-    else if (logrec->cr_type == CL_LAYOUT)
+    if (rec_types & (1 << CL_LAYOUT))
     {
         attr_mask_set_index(&p_op->fs_attr_need, ATTR_INDEX_stripe_info);
         attr_mask_set_index(&p_op->fs_attr_need, ATTR_INDEX_stripe_items);
@@ -355,17 +373,16 @@ static int EntryProc_FillFromLogRec(struct entry_proc_op_t *p_op,
         }
 
         /* get the new attributes, in case of a SATTR, HSM... */
-        if (allow_md_updt && ((logrec->cr_type == CL_MTIME)
-                              || (logrec->cr_type == CL_CTIME)
-                              || (logrec->cr_type == CL_CLOSE)
-                              || (logrec->cr_type == CL_TRUNC)
-                              || (logrec->cr_type == CL_HSM)
-                              || (logrec->cr_type == CL_SETATTR)))
+        if (allow_md_updt && (rec_types & (1 << CL_MTIME | 1 << CL_CTIME
+                                           | 1 << CL_CLOSE | 1 << CL_TRUNC
+                                           | 1 << CL_HSM | 1 << CL_SETATTR)))
         {
             DisplayLog(LVL_DEBUG, ENTRYPROC_TAG,
-                       "Getattr needed because this is a %s event, and "
+                       "Getattr needed because this is a %s event%s, and "
                        "metadata has not been recently updated.",
-                       changelog_type2str(logrec->cr_type));
+                       changelog_type2str(logrec->cr_type),
+                       p_op->extra_info.log_record.merged_types ?
+                            " (with merged records)" : "");
 
             p_op->fs_attr_need.std |= POSIX_ATTR_MASK;
         }
@@ -388,6 +405,28 @@ static int EntryProc_FillFromLogRec(struct entry_proc_op_t *p_op,
     /* call changelog callback for policies with a matching scope */
     run_all_cl_cb(logrec, &p_op->entry_id, &p_op->db_attrs, &p_op->fs_attrs,
                   &status_mask_need, cl_cb_status_mask, &rec_action);
+
+    /* policies must also be notified of the records merged into this one */
+    if (p_op->extra_info.log_record.merged_types != 0)
+    {
+        CL_REC_TYPE merged_rec = *logrec;
+        unsigned int t;
+
+        for (t = 0; t < CL_LAST; t++)
+        {
+            proc_action_e merged_action = PROC_ACT_NONE;
+
+            if (!(p_op->extra_info.log_record.merged_types & (1 << t)))
+                continue;
+
+            merged_rec.cr_type = t;
+            run_all_cl_cb(&merged_rec, &p_op->entry_id, &p_op->db_attrs,
+                          &p_op->fs_attrs, &status_mask_need,
+                          cl_cb_status_mask, &merged_action);
+            if (merged_action > rec_action)
+                rec_action = merged_action;
+        }
+    }
     p_op->fs_attr_need = attr_mask_or(&p_op->fs_attr_need, &status_mask_need);
 
     /* process the value of rec_action */
@@ -750,21 +789,30 @@ static bool is_lustre_special(const struct entry_proc_op_t *p_op)
 }
 
 
+/** what must be retrieved from the DB at GET_INFO_DB stage */
+typedef enum {
+    DBGET_NONE,     /**< nothing: the stage is over for this operation */
+    DBGET_ATTRS,    /**< get db_attrs.attr_mask attributes */
+    DBGET_EXISTS,   /**< only check if the entry exists */
+    DBGET_NEW,      /**< new entry: known not to be in DB */
+} dbget_e;
+
 /**
- * check if the entry exists in the database and what info
- * must be retrieved.
+ * First part of GET_INFO_DB stage: determine what info must be
+ * retrieved from the database.
+ * @param[out] next_stage next stage for the operation (-1 = drop),
+ *                        if DBGET_NONE is returned.
  */
-int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
+static dbget_e get_info_db_prepare(struct entry_proc_op_t *p_op,
+                                   lmgr_t *lmgr, int *next_stage)
 {
-    int      rc = 0;
-    int      next_stage = -1; /* -1 = skip */
     attr_mask_t attr_allow_cached = null_mask;
     attr_mask_t attr_need_fresh = null_mask;
     uint32_t status_scope = 0; /* status mask */
     attr_mask_t tmp;
 
-    const pipeline_stage_t *stage_info =
-        &entry_proc_pipeline[p_op->pipeline_stage];
+    /* -1 = drop the entry */
+    *next_stage = -1;
 
     /* always ignore root */
     if (p_op->entry_id_is_set &&
@@ -772,15 +820,13 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
     {
         DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "Ignoring record for root directory");
         /* drop the entry */
-        next_stage = -1;
-        goto next_step;
+        return DBGET_NONE;
     }
 
     /* ignore special files */
     if (is_lustre_special(p_op)) {
         /* drop the entry */
-        next_stage = -1;
-        goto next_step;
+        return DBGET_NONE;
     }
 
 #ifdef HAVE_CHANGELOGS
@@ -788,6 +834,7 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
     if ( p_op->extra_info.is_changelog_record )
     {
         obj_type_t type_clue = TYPE_NONE;
+        int        rc;
 
         CL_REC_TYPE *logrec = p_op->extra_info.log_record.p_log_rec;
 
@@ -816,8 +863,11 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
              * it now from the NAMES table, given the parent FID and the
              * filename. */
             p_op->get_fid_from_db = 0;
+            /* the changelog reader has set the name from the record
+             * (it may be a view of another record, with no name) */
             rc = ListMgr_Get_FID_from_Path(lmgr, &logrec->cr_pfid,
-                                           rh_get_cl_cr_name(logrec),
+                                           ATTR_MASK_TEST(&p_op->fs_attrs, name)
+                                             ? ATTR(&p_op->fs_attrs, name) : "",
                                            &p_op->entry_id);
 
             if (!rc)
@@ -841,8 +891,7 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
                 /* Not found. Skip the entry */
                 DisplayLog( LVL_FULL, ENTRYPROC_TAG,
                             "Warning: parent/filename for UNLINK not found" );
-                next_stage = -1;
-                goto next_step;
+                return DBGET_NONE;
             }
         }
 
@@ -863,7 +912,7 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
          * and if it is not provided in logrec
          */
         if ((updt_params.path.when != UPDT_ALWAYS)
-            && (logrec->cr_namelen == 0))
+            && !ATTR_MASK_TEST(&p_op->fs_attrs, path_update))
             attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_path_update);
 
 #if 0 /* XXX not to be done systematically: only on specific events? (CL_LAYOUT...) */
@@ -884,10 +933,14 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
 
         if (entry_proc_conf.match_classes)
         {
-            if (updt_params.fileclass.when != UPDT_ALWAYS)
-                attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_class_update);
+            /* previous fileclass is kept if its attributes didn't change */
+            attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_class_update);
+            attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_fileclass);
 
+            /* path attributes are only retrieved if fileclass matching
+             * reads them (see get_lazy_path()) */
             tmp = attr_mask_and_not(&policies.global_fileset_mask, &p_op->fs_attrs.attr_mask);
+            tmp.std &= ~LAZY_PATH_MASK;
             p_op->db_attr_need = attr_mask_or(&p_op->db_attr_need, &tmp);
         }
 
@@ -913,9 +966,19 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
         if ((logrec->cr_type == CL_EXT)
              && (p_op->db_attr_need.std & ATTR_MASK_fullpath))
         {
-            rc = Lustre_GetFullPath(&p_op->entry_id,
-                                    ATTR(&p_op->fs_attrs, fullpath),
-                                    sizeof(ATTR(&p_op->fs_attrs, fullpath)));
+            /* the record has the new parent and name */
+            if (ATTR_MASK_TEST(&p_op->fs_attrs, parent_id)
+                && ATTR_MASK_TEST(&p_op->fs_attrs, name))
+                rc = fidpath_child_path(&ATTR(&p_op->fs_attrs, parent_id),
+                                        ATTR(&p_op->fs_attrs, name), NULL,
+                                        ATTR(&p_op->fs_attrs, fullpath),
+                                        sizeof(ATTR(&p_op->fs_attrs,
+                                                    fullpath)));
+            else
+                rc = Lustre_GetFullPath(&p_op->entry_id,
+                                        ATTR(&p_op->fs_attrs, fullpath),
+                                        sizeof(ATTR(&p_op->fs_attrs,
+                                                    fullpath)));
             if (rc == 0)
             {
                 ATTR_MASK_SET(&p_op->fs_attrs, fullpath);
@@ -923,52 +986,13 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
             }
         }
 
+        /* a created entry has nothing in DB yet */
+        if (p_op->db_new_entry)
+            return DBGET_NEW;
+
         /* attributes to be retrieved */
         p_op->db_attrs.attr_mask = p_op->db_attr_need;
-
-        rc = ListMgr_Get( lmgr, &p_op->entry_id, &p_op->db_attrs );
-
-        if (rc == DB_SUCCESS )
-        {
-            p_op->db_exists = 1;
-            /* attr mask has been set by ListMgr_Get */
-        }
-        else if (rc == DB_NOT_EXISTS )
-        {
-            p_op->db_exists = 0;
-            /* no attrs from DB */
-            ATTR_MASK_INIT( &p_op->db_attrs );
-        }
-        else
-        {
-            /* ERROR */
-            DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
-                       "Error %d retrieving entry "DFID" from DB: %s.", rc,
-                       PFID(&p_op->entry_id), lmgr_err2str(rc));
-            p_op->db_exists = 0;
-            /* no attrs from DB */
-            ATTR_MASK_INIT( &p_op->db_attrs );
-        }
-
-        /* Retrieve info from the log record, and decide what info must be
-         * retrieved from filesystem. */
-        next_stage = EntryProc_ProcessLogRec( p_op );
-
-        /* Note: this check must be done after processing log record,
-         * because it can determine if status is needed */
-        tmp = attrs_for_status_mask(p_op->fs_attr_need.status, true);
-        p_op->fs_attr_need = attr_mask_or(&p_op->fs_attr_need, &tmp);
-
-        char tmp_buf[RBH_NAME_MAX];
-        DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "RECORD: %s "DFID" %#x %s => "
-                   "getstripe=%u, getattr=%u, getpath=%u, readlink=%u"
-                   ", getstatus(%s)",
-                   changelog_type2str(logrec->cr_type), PFID(&p_op->entry_id),
-                   logrec->cr_flags & CLF_FLAGMASK,
-                   logrec->cr_namelen ? rh_get_cl_cr_name(logrec) : "<null>",
-                   NEED_GETSTRIPE(p_op)?1:0, NEED_GETATTR(p_op)?1:0,
-                   NEED_GETPATH(p_op)?1:0, NEED_READLINK(p_op)?1:0,
-                   name_status_mask(p_op->fs_attr_need.status, tmp_buf, sizeof(tmp_buf)));
+        return DBGET_ATTRS;
     }
     else /* entry from FS scan */
     {
@@ -979,8 +1003,7 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
             DisplayLog( LVL_CRIT, ENTRYPROC_TAG,
                         "Error: missing info from FS scan" );
             /* skip the entry */
-            next_stage = -1;
-            goto next_step;
+            return DBGET_NONE;
         }
 
         /* check if entry is in policies scope */
@@ -1023,50 +1046,111 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
 
         if (entry_proc_conf.match_classes)
         {
-            if (updt_params.fileclass.when != UPDT_ALWAYS)
-                attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_class_update);
+            /* previous fileclass is kept if its attributes didn't change */
+            attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_class_update);
+            attr_mask_set_index(&p_op->db_attr_need, ATTR_INDEX_fileclass);
 
             tmp = attr_mask_and_not(&policies.global_fileset_mask,
                                     &p_op->fs_attrs.attr_mask);
             p_op->db_attr_need = attr_mask_or(&p_op->db_attr_need, &tmp);
         }
 
+        /* get status for all policies */
+        p_op->fs_attr_need.status |= all_status_mask();
+        tmp = attr_mask_and_not(&attr_need_fresh, &p_op->fs_attrs.attr_mask);
+        p_op->fs_attr_need = attr_mask_or(&p_op->fs_attr_need, &tmp);
+
         if (!attr_mask_is_null(p_op->db_attr_need))
         {
             p_op->db_attrs.attr_mask = p_op->db_attr_need;
-            rc = ListMgr_Get(lmgr, &p_op->entry_id, &p_op->db_attrs);
-
-            if (rc == DB_SUCCESS)
-            {
-                p_op->db_exists = 1;
-                tmp = attr_mask_and_not(&p_op->db_attr_need, &p_op->db_attrs.attr_mask);
-                p_op->fs_attr_need = attr_mask_or(&p_op->fs_attr_need, &tmp);
-            }
-            else if (rc == DB_NOT_EXISTS )
-            {
-                p_op->db_exists = 0;
-                ATTR_MASK_INIT( &p_op->db_attrs );
-            }
-            else
-            {
-                /* ERROR */
-                DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
-                           "Error %d retrieving entry "DFID" from DB: %s.", rc,
-                           PFID(&p_op->entry_id), lmgr_err2str(rc));
-                p_op->db_exists = 0;
-                ATTR_MASK_INIT( &p_op->db_attrs );
-            }
+            return DBGET_ATTRS;
         }
         else
+            return DBGET_EXISTS;
+#ifdef HAVE_CHANGELOGS
+    }
+#endif
+}
+
+/**
+ * Process the result of DB request for GET_INFO_DB stage.
+ * @param rc status of ListMgr_Get().
+ */
+static void get_info_db_set_result(struct entry_proc_op_t *p_op, int rc)
+{
+    if (rc == DB_SUCCESS)
+    {
+        p_op->db_exists = 1;
+        /* attr mask has been set by ListMgr_Get */
+#ifdef HAVE_CHANGELOGS
+        if (!p_op->extra_info.is_changelog_record)
+#endif
         {
-            p_op->db_exists = ListMgr_Exists( lmgr, &p_op->entry_id );
+            /* entry from scan: get missing attributes from filesystem */
+            attr_mask_t tmp = attr_mask_and_not(&p_op->db_attr_need,
+                                                &p_op->db_attrs.attr_mask);
+
+            p_op->fs_attr_need = attr_mask_or(&p_op->fs_attr_need, &tmp);
         }
+    }
+    else if (rc == DB_NOT_EXISTS )
+    {
+        p_op->db_exists = 0;
+        /* no attrs from DB */
+        ATTR_MASK_INIT( &p_op->db_attrs );
+    }
+    else
+    {
+        /* ERROR */
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG,
+                   "Error %d retrieving entry "DFID" from DB: %s.", rc,
+                   PFID(&p_op->entry_id), lmgr_err2str(rc));
+        p_op->db_exists = 0;
+        /* no attrs from DB */
+        ATTR_MASK_INIT( &p_op->db_attrs );
+    }
+}
 
-        /* get status for all policies */
-        p_op->fs_attr_need.status |= all_status_mask();
-        tmp = attr_mask_and_not(&attr_need_fresh, &p_op->fs_attrs.attr_mask);
+/**
+ * Last part of GET_INFO_DB stage, once DB attributes are known:
+ * decide what info must be retrieved from the filesystem.
+ * @return the next stage for the operation (-1 = drop).
+ */
+static int get_info_db_finish(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+{
+    int      next_stage = -1; /* -1 = skip */
+
+#ifdef HAVE_CHANGELOGS
+    /* is this a changelog record? */
+    if ( p_op->extra_info.is_changelog_record )
+    {
+        CL_REC_TYPE *logrec = p_op->extra_info.log_record.p_log_rec;
+        attr_mask_t  tmp;
+
+        /* Retrieve info from the log record, and decide what info must be
+         * retrieved from filesystem. */
+        next_stage = EntryProc_ProcessLogRec( p_op );
+
+        /* Note: this check must be done after processing log record,
+         * because it can determine if status is needed */
+        tmp = attrs_for_status_mask(p_op->fs_attr_need.status, true);
         p_op->fs_attr_need = attr_mask_or(&p_op->fs_attr_need, &tmp);
 
+        char tmp_buf[RBH_NAME_MAX];
+        DisplayLog(LVL_DEBUG, ENTRYPROC_TAG, "RECORD: %s "DFID" %#x %s => "
+                   "getstripe=%u, getattr=%u, getpath=%u, readlink=%u"
+                   ", getstatus(%s)",
+                   changelog_type2str(logrec->cr_type), PFID(&p_op->entry_id),
+                   logrec->cr_flags & CLF_FLAGMASK,
+                   ATTR_MASK_TEST(&p_op->fs_attrs, name) ?
+                        ATTR(&p_op->fs_attrs, name) : "<null>",
+                   NEED_GETSTRIPE(p_op)?1:0, NEED_GETATTR(p_op)?1:0,
+                   NEED_GETPATH(p_op)?1:0, NEED_READLINK(p_op)?1:0,
+                   name_status_mask(p_op->fs_attr_need.status, tmp_buf, sizeof(tmp_buf)));
+    }
+    else /* entry from FS scan */
+    {
+#endif
         if ( !p_op->db_exists )
         {
             /* new entry */
@@ -1163,7 +1247,39 @@ int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
         next_stage = STAGE_PRE_APPLY;
     #endif
 
-next_step:
+    return next_stage;
+}
+
+/**
+ * check if the entry exists in the database and what info
+ * must be retrieved.
+ */
+int EntryProc_get_info_db( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
+{
+    int      rc = 0;
+    int      next_stage = -1; /* -1 = skip */
+    const pipeline_stage_t *stage_info =
+        &entry_proc_pipeline[p_op->pipeline_stage];
+
+    switch (get_info_db_prepare(p_op, lmgr, &next_stage))
+    {
+    case DBGET_NONE:
+        break;
+    case DBGET_ATTRS:
+        rc = ListMgr_Get(lmgr, &p_op->entry_id, &p_op->db_attrs);
+        get_info_db_set_result(p_op, rc);
+        next_stage = get_info_db_finish(p_op, lmgr);
+        break;
+    case DBGET_EXISTS:
+        p_op->db_exists = ListMgr_Exists(lmgr, &p_op->entry_id);
+        next_stage = get_info_db_finish(p_op, lmgr);
+        break;
+    case DBGET_NEW:
+        get_info_db_set_result(p_op, DB_NOT_EXISTS);
+        next_stage = get_info_db_finish(p_op, lmgr);
+        break;
+    }
+
     if ( next_stage == -1 )
         /* drop the entry */
         rc = EntryProcessor_Acknowledge(p_op, -1, true);
@@ -1178,6 +1294,107 @@ next_step:
     return rc;
 }
 
+/**
+ * Batched version of GET_INFO_DB stage: retrieve DB attributes
+ * of all entries in a single request.
+ */
+int EntryProc_get_info_db_batch(struct entry_proc_op_t **ops, int count,
+                                lmgr_t *lmgr)
+{
+    int              i, j, n, rc;
+    const pipeline_stage_t *stage_info =
+        &entry_proc_pipeline[ops[0]->pipeline_stage];
+    int             *next_stages = NULL;
+    int             *rcs = NULL;
+    dbget_e         *dbget = NULL;
+    const entry_id_t **ids = NULL;
+    attr_set_t     **attrs = NULL;
+
+    next_stages = MemCalloc(count, sizeof(*next_stages));
+    rcs = MemCalloc(count, sizeof(*rcs));
+    dbget = MemCalloc(count, sizeof(*dbget));
+    ids = MemCalloc(count, sizeof(*ids));
+    attrs = MemCalloc(count, sizeof(*attrs));
+    if (!next_stages || !rcs || !dbget || !ids || !attrs)
+    {
+        rc = -ENOMEM;
+        goto out_free;
+    }
+
+    for (i = 0, n = 0; i < count; i++)
+    {
+        dbget[i] = get_info_db_prepare(ops[i], lmgr, &next_stages[i]);
+        if (dbget[i] == DBGET_NONE || dbget[i] == DBGET_NEW)
+            continue;
+
+        if (dbget[i] == DBGET_EXISTS)
+            ops[i]->db_attrs.attr_mask = null_mask;
+        ids[n] = &ops[i]->entry_id;
+        attrs[n] = &ops[i]->db_attrs;
+        n++;
+    }
+
+    rc = (n > 0) ? ListMgr_BatchGet(lmgr, n, ids, attrs, rcs) : 0;
+    if (rc)
+        DisplayLog(LVL_MAJOR, ENTRYPROC_TAG, "Error %d retrieving a batch of %d "
+                   "entries from DB: %s. Retrying them one by one.", rc, n,
+                   lmgr_err2str(rc));
+
+    for (i = 0, j = 0; i < count; i++)
+    {
+        if (dbget[i] == DBGET_NONE)
+            continue;
+
+        if (dbget[i] == DBGET_NEW) {
+            get_info_db_set_result(ops[i], DB_NOT_EXISTS);
+            next_stages[i] = get_info_db_finish(ops[i], lmgr);
+            continue;
+        }
+
+        if (dbget[i] == DBGET_ATTRS)
+        {
+            if (rc) /* batch request failed */
+            {
+                ops[i]->db_attrs.attr_mask = ops[i]->db_attr_need;
+                rcs[j] = ListMgr_Get(lmgr, &ops[i]->entry_id,
+                                     &ops[i]->db_attrs);
+            }
+            get_info_db_set_result(ops[i], rcs[j]);
+        }
+        else if (rc)
+            ops[i]->db_exists = ListMgr_Exists(lmgr, &ops[i]->entry_id);
+        else
+            ops[i]->db_exists = (rcs[j] == DB_SUCCESS);
+        j++;
+
+        next_stages[i] = get_info_db_finish(ops[i], lmgr);
+    }
+
+    rc = EntryProcessor_AcknowledgeEach(ops, count, next_stages);
+    if (rc)
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d acknowledging stage %s.",
+                   rc, stage_info->stage_name);
+
+out_free:
+    MemFree(attrs);
+    MemFree(ids);
+    MemFree(dbget);
+    MemFree(rcs);
+    MemFree(next_stages);
+    return rc;
+}
+
+/** check if 2 operations can be batched in GET_INFO_DB stage */
+static bool dbget_is_batchable(struct entry_proc_op_t *first,
+                               struct entry_proc_op_t *next,
+                               attr_mask_t *full_attr_mask)
+{
+    /* operations with no id are special, and the id constraint
+     * of this stage must also be enforced for batched operations */
+    return first->entry_id_is_set && next->entry_id_is_set
+        && id_constraint_is_first_op(next);
+}
+
 /** skip_record a record by acknowledging current operation */
 static int skip_record(struct entry_proc_op_t *p_op)
 {
@@ -1277,7 +1494,128 @@ static int rm_record(struct entry_proc_op_t *p_op)
 #endif
 
 
+#if defined(HAVE_CHANGELOGS) && defined(_LUSTRE) && defined(_HAVE_FID)
+/**
+ * When the attributes of a regular file are needed together with its stripe
+ * or status, open it once by FID: attributes, layout and HSM state are then
+ * got from the same handle, instead of separate lookups by path.
+ * Only done for known regular files (opening other entries may have side
+ * effects, e.g. on devices).
+ * @return the file descriptor, or -1 to get information by path.
+ */
+static int open_for_info_fs(struct entry_proc_op_t *p_op)
+{
+    attr_mask_t need = attr_mask_and_not(&p_op->fs_attr_need,
+                                         &p_op->fs_attrs.attr_mask);
+    char path[RBH_PATH_MAX];
+
+    if (!p_op->extra_info.is_changelog_record
+        || !(need.std & POSIX_ATTR_MASK)
+        || !((need.std & (ATTR_MASK_stripe_info | ATTR_MASK_stripe_items))
+             || need.status != 0))
+        return -1;
+
+#ifdef _MDS_STAT_SUPPORT
+    if (global_config.direct_mds_stat)
+        return -1;
+#endif
+
+    /* created files are regular files */
+    if (p_op->extra_info.log_record.p_log_rec->cr_type != CL_CREATE
+        && !(ATTR_FSorDB_TEST(p_op, type)
+             && !strcmp(ATTR_FSorDB(p_op, type), STR_TYPE_FILE)))
+        return -1;
+
+    BuildFidPath(&p_op->entry_id, path);
+    /* on error, let the path-based calls report it */
+    return open(path, O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_NOCTTY);
+}
+#endif
+
+static int get_info_fs(struct entry_proc_op_t *p_op, lmgr_t *lmgr,
+                       int entry_fd);
+
 int EntryProc_get_info_fs( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
+{
+#if defined(HAVE_CHANGELOGS) && defined(_LUSTRE) && defined(_HAVE_FID)
+    entry_id_t id = p_op->entry_id;
+    int fd = open_for_info_fs(p_op);
+    int rc;
+
+    if (fd < 0)
+        return get_info_fs(p_op, lmgr, -1);
+
+    /* status managers query it on the same handle */
+    Lustre_SetEntryFd(&id, fd);
+    /* p_op must not be used after this call (acknowledged) */
+    rc = get_info_fs(p_op, lmgr, fd);
+    Lustre_SetEntryFd(NULL, -1);
+    close(fd);
+    return rc;
+#else
+    return get_info_fs(p_op, lmgr, -1);
+#endif
+}
+
+/**
+ * Retrieve the path attributes that fileclass matching is about to read
+ * (fileclasses whose previous result can't be reused), so that most
+ * records don't need a path lookup.
+ * The path is built from the parent and name of the record if they are
+ * known, else read from the DB, else resolved in the filesystem.
+ */
+static void get_lazy_path(struct entry_proc_op_t *p_op, lmgr_t *lmgr)
+{
+    attr_mask_t need = match_classes_mask(&p_op->fs_attrs, &p_op->db_attrs);
+
+    need.std &= LAZY_PATH_MASK;
+    /* depth is generated from fullpath */
+    if (need.std & ATTR_MASK_depth)
+        need.std |= ATTR_MASK_fullpath;
+    need = attr_mask_and_not(&need, &p_op->fs_attrs.attr_mask);
+    need = attr_mask_and_not(&need, &p_op->db_attrs.attr_mask);
+    if (attr_mask_is_null(need))
+        return;
+
+    /* the DB may have an older path (e.g. before a rename) */
+    if (p_op->db_exists && !(ATTR_MASK_TEST(&p_op->fs_attrs, parent_id)
+                             && ATTR_MASK_TEST(&p_op->fs_attrs, name)))
+    {
+        attr_set_t  path_attrs = ATTR_SET_INIT;
+        attr_mask_t ignored = null_mask;
+
+        path_attrs.attr_mask = need;
+        if (ListMgr_Get(lmgr, &p_op->entry_id, &path_attrs) == DB_SUCCESS)
+        {
+            /* only keep a consistent path */
+            check_fullpath(&path_attrs, &p_op->entry_id, &ignored);
+            ListMgr_MergeAttrSets(&p_op->db_attrs, &path_attrs, false);
+        }
+        ListMgr_FreeAttrs(&path_attrs);
+
+        need = attr_mask_and_not(&need, &p_op->db_attrs.attr_mask);
+        if (attr_mask_is_null(need))
+            return;
+    }
+
+#ifdef _HAVE_FID
+    {
+        char path[RBH_PATH_MAX];
+
+        BuildFidPath(&p_op->entry_id, path);
+        path_check_update(&p_op->entry_id, path, &p_op->fs_attrs, need);
+    }
+#endif
+    if (need.std & ATTR_MASK_depth)
+        ListMgr_GenerateFields(&p_op->fs_attrs, need);
+}
+
+/**
+ * Get missing entry information from the filesystem.
+ * @param entry_fd  descriptor of the open entry, or -1.
+ */
+static int get_info_fs(struct entry_proc_op_t *p_op, lmgr_t *lmgr,
+                       int entry_fd)
 {
     int            rc;
     char tmp_buf[RBH_NAME_MAX];
@@ -1320,7 +1658,12 @@ int EntryProc_get_info_fs( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
            rc = lustre_mds_stat_by_fid( &p_op->entry_id, &entry_md );
        else
 #endif
-       if ( lstat( path, &entry_md ) != 0 )
+       if (entry_fd >= 0)
+       {
+           if (fstat(entry_fd, &entry_md) != 0)
+               rc = errno;
+       }
+       else if ( lstat( path, &entry_md ) != 0 )
           rc = errno;
 
         /* get entry attributes */
@@ -1380,9 +1723,14 @@ int EntryProc_get_info_fs( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
     if (NEED_GETSTRIPE(p_op))
     {
         /* get entry stripe */
-        rc = File_GetStripeByPath( path,
-                                   &ATTR( &p_op->fs_attrs, stripe_info ),
-                                   &ATTR( &p_op->fs_attrs, stripe_items ) );
+        if (entry_fd >= 0)
+            rc = File_GetStripeByFd(entry_fd,
+                                    &ATTR(&p_op->fs_attrs, stripe_info),
+                                    &ATTR(&p_op->fs_attrs, stripe_items));
+        else
+            rc = File_GetStripeByPath( path,
+                                       &ATTR( &p_op->fs_attrs, stripe_info ),
+                                       &ATTR( &p_op->fs_attrs, stripe_items ) );
         if (rc)
         {
             ATTR_MASK_UNSET( &p_op->fs_attrs, stripe_info );
@@ -1487,9 +1835,11 @@ int EntryProc_get_info_fs( struct entry_proc_op_t *p_op, lmgr_t * lmgr )
         return skip_record(p_op);
 
     /* match fileclasses if specified in config */
-    /* FIXME: check fileclass update parameters */
-    if (entry_proc_conf.match_classes)
+    if (entry_proc_conf.match_classes && need_fileclass_update(&p_op->db_attrs))
+    {
+        get_lazy_path(p_op, lmgr);
         match_classes(&p_op->entry_id, &p_op->fs_attrs, &p_op->db_attrs);
+    }
 
     /* go to next step */
     rc = EntryProcessor_Acknowledge(p_op, STAGE_PRE_APPLY, false);
@@ -1523,6 +1873,48 @@ static bool dbop_is_batchable(struct entry_proc_op_t *first,
         return false;
 }
 
+/** update candidate indexes and action trackers of policies
+ * with the new entry state */
+static void update_candidates(struct entry_proc_op_t *p_op)
+{
+    attr_set_t  merged_attrs = ATTR_SET_INIT; /* attrs from FS+DB */
+    attr_mask_t cand_mask;
+    attr_mask_t track_mask;
+
+    switch (p_op->db_op_type)
+    {
+    case OP_TYPE_UPDATE:
+        /* only changed attributes are left in fs_attrs */
+        cand_mask = candidates_attr_mask();
+        track_mask = tracker_attr_mask();
+        cand_mask = attr_mask_or(&cand_mask, &track_mask);
+        if (attr_mask_is_null(attr_mask_and(&p_op->fs_attrs.attr_mask,
+                                            &cand_mask)))
+            return;
+        /* fall through */
+    case OP_TYPE_INSERT:
+        ATTR_MASK_INIT(&merged_attrs);
+        ListMgr_MergeAttrSets(&merged_attrs, &p_op->fs_attrs, 1);
+        ListMgr_MergeAttrSets(&merged_attrs, &p_op->db_attrs, 0);
+
+        candidates_update(&p_op->entry_id, &merged_attrs);
+        tracker_update(&p_op->entry_id, &merged_attrs);
+
+        /* free allocated structs in merged attributes */
+        ListMgr_FreeAttrs(&merged_attrs);
+        break;
+
+    case OP_TYPE_REMOVE_LAST:
+    case OP_TYPE_SOFT_REMOVE:
+        candidates_remove(&p_op->entry_id);
+        tracker_remove(&p_op->entry_id);
+        break;
+
+    default:
+        break;
+    }
+}
+
 /** operation cleaning before the db_apply step */
 int EntryProc_pre_apply(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
 {
@@ -1641,6 +2033,9 @@ int EntryProc_pre_apply(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
                 printf("--"DFID"\n", PFID(&p_op->entry_id));
         }
     }
+    if (candidates_any() || tracker_any())
+        update_candidates(p_op);
+
     attr_mask_unset_readonly(&p_op->fs_attrs.attr_mask);
 
     rc = EntryProcessor_Acknowledge(p_op, STAGE_DB_APPLY, false);
@@ -1685,7 +2080,10 @@ int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
 
     case OP_TYPE_INSERT:
         DisplayLog(LVL_FULL, ENTRYPROC_TAG, "Insert("DFID")", PFID(&p_op->entry_id));
-        rc = ListMgr_Insert(lmgr, &p_op->entry_id, &p_op->fs_attrs, false);
+        /* new entries from changelogs may already be in DB if records
+         * are read again */
+        rc = ListMgr_Insert(lmgr, &p_op->entry_id, &p_op->fs_attrs,
+                            p_op->db_new_entry);
         break;
 
     case OP_TYPE_UPDATE:
@@ -1735,12 +2133,20 @@ int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
     if (rc)
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d performing database operation: %s.",
                    rc, lmgr_err2str(rc));
+    else if (p_op->db_op_type == OP_TYPE_INSERT
+             || p_op->db_op_type == OP_TYPE_UPDATE)
+        sketch_update(&p_op->entry_id, &p_op->fs_attrs);
+    else if (p_op->db_op_type == OP_TYPE_REMOVE_LAST
+             || p_op->db_op_type == OP_TYPE_SOFT_REMOVE)
+        sketch_remove(&p_op->entry_id);
 
     /* Acknowledge the operation if there is a callback */
 #ifdef HAVE_CHANGELOGS
-    if (p_op->callback_func != NULL)
+    if (p_op->callback_func != NULL) {
+        /* the callback must wait for the operation to be committed */
+        ListMgr_GetCommitTicket(lmgr, &p_op->commit_ticket);
         rc = EntryProcessor_Acknowledge(p_op, STAGE_CHGLOG_CLR, false);
-    else
+    } else
 #endif
         rc = EntryProcessor_Acknowledge(p_op, -1, true);
 
@@ -1751,6 +2157,48 @@ int EntryProc_db_apply(struct entry_proc_op_t *p_op, lmgr_t * lmgr)
     return rc;
 }
 
+/**
+ * Insert or update a batch of entries, in chunks of the current DB batch size
+ * (the batch may be larger when a sort window is configured).
+ * When db_apply_sort is enabled, entries are sorted by primary key first.
+ * @return the first error, after trying all chunks.
+ */
+static int db_batch_insert(lmgr_t *lmgr, entry_id_t **ids, attr_set_t **attrs,
+                           unsigned int count, bool update_if_exists)
+{
+    unsigned int chunk = MAX2(db_batch_size_current(), 1);
+    unsigned int i;
+    int rc = 0;
+
+    if (entry_proc_conf.db_apply_sort) {
+        /* only ids and attrs are reordered: ops are still acknowledged
+         * in their original order */
+        rc = ListMgr_SortByPK(ids, attrs, count);
+        if (rc)
+            /* not fatal: insert unsorted */
+            DisplayLog(LVL_MAJOR, ENTRYPROC_TAG,
+                       "Could not sort DB batch: %s", lmgr_err2str(rc));
+        rc = 0;
+    }
+
+    for (i = 0; i < count; i += chunk) {
+        unsigned int n = MIN2(chunk, count - i);
+        struct timeval t0, t1, lat;
+        int rc2;
+
+        gettimeofday(&t0, NULL);
+        rc2 = ListMgr_BatchInsert(lmgr, ids + i, attrs + i, n,
+                                  update_if_exists);
+        gettimeofday(&t1, NULL);
+        timersub(&t1, &t0, &lat);
+        db_batch_size_feedback(n, &lat);
+
+        if (rc2 && !rc)
+            rc = rc2;
+    }
+    return rc;
+}
+
 /**
  * Perform a batch of operations on the database.
  */
@@ -1761,6 +2209,7 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
     const pipeline_stage_t *stage_info = &entry_proc_pipeline[ops[0]->pipeline_stage];
     entry_id_t **ids = NULL;
     attr_set_t **attrs = NULL;
+    bool update_if_exists = false;
 
     /* allocate arrays of ids and attrs */
     ids = MemCalloc(count, sizeof(*ids));
@@ -1776,6 +2225,9 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
     {
         ids[i] = &ops[i]->entry_id;
         attrs[i] = &ops[i]->fs_attrs;
+        /* entries not looked up in DB may already exist */
+        if (ops[i]->db_new_entry)
+            update_if_exists = true;
     }
 
     /* insert to DB */
@@ -1790,12 +2242,12 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
     case OP_TYPE_INSERT:
         DisplayLog(LVL_FULL, ENTRYPROC_TAG, "BatchInsert(%u ops: "DFID"...)",
                    count, PFID(ids[0]));
-        rc = ListMgr_BatchInsert(lmgr, ids, attrs, count, false);
+        rc = db_batch_insert(lmgr, ids, attrs, count, update_if_exists);
         break;
     case OP_TYPE_UPDATE:
         DisplayLog(LVL_FULL, ENTRYPROC_TAG, "BatchUpdate(%u ops: "DFID"...)",
                    count, PFID(ids[0]));
-        rc = ListMgr_BatchInsert(lmgr, ids, attrs, count, true);
+        rc = db_batch_insert(lmgr, ids, attrs, count, true);
         break;
     default:
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Unexpected operation for batch op: %d",
@@ -1806,12 +2258,18 @@ int EntryProc_db_batch_apply(struct entry_proc_op_t **ops, int count,
     if (rc)
         DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d performing batch database operation: %s.",
                    rc, lmgr_err2str(rc));
+    else if (ops[0]->db_op_type != OP_TYPE_NONE)
+        for (i = 0; i < count; i++)
+            sketch_update(ids[i], attrs[i]);
 
     /* Acknowledge the operation if there is a callback */
 #ifdef HAVE_CHANGELOGS
-    if (ops[0]->callback_func != NULL)
+    if (ops[0]->callback_func != NULL) {
+        /* the callbacks must wait for the operations to be committed */
+        for (i = 0; i < count; i++)
+            ListMgr_GetCommitTicket(lmgr, &ops[i]->commit_ticket);
         rc = EntryProcessor_AcknowledgeBatch(ops, count, STAGE_CHGLOG_CLR, false);
-    else
+    } else
 #endif
         rc = EntryProcessor_AcknowledgeBatch(ops, count, -1, true);
 
@@ -1839,6 +2297,12 @@ int            EntryProc_chglog_clr( struct entry_proc_op_t * p_op, lmgr_t * lmg
 
     if ( p_op->callback_func )
     {
+        /* make sure the operation is committed */
+        rc = ListMgr_WaitTicket(lmgr, &p_op->commit_ticket);
+        if (rc)
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d committing pending operations: %s",
+                       rc, lmgr_err2str(rc));
+
         /* if operation was committed, Perform callback to info collector */
         rc = p_op->callback_func( lmgr, p_op, p_op->callback_param );
 
@@ -1855,6 +2319,109 @@ int            EntryProc_chglog_clr( struct entry_proc_op_t * p_op, lmgr_t * lmg
 
     return rc;
 }
+
+/**
+ * Batched version of CHGLOG_CLR stage.
+ * Records of a given reader are committed in order, so acknowledging the
+ * last record of each reader in the batch also acknowledges all the
+ * previous ones: the callback is only called once per reader.
+ */
+static int EntryProc_chglog_clr_batch(struct entry_proc_op_t **ops, int count,
+                                      lmgr_t *lmgr)
+{
+    int            i, j, rc;
+    int            nb_seen = 0;
+    const pipeline_stage_t *stage_info =
+        &entry_proc_pipeline[ops[0]->pipeline_stage];
+    bool          *last = NULL;
+    void         **seen = NULL;
+
+    /* make sure all the operations are committed, as acknowledging
+     * a record also acknowledges the previous ones */
+    for (i = 0; i < count; i++)
+    {
+        if (!ops[i]->callback_func)
+            continue;
+        rc = ListMgr_WaitTicket(lmgr, &ops[i]->commit_ticket);
+        if (rc)
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d committing pending operations: %s",
+                       rc, lmgr_err2str(rc));
+    }
+
+    last = MemCalloc(count, sizeof(*last));
+    seen = MemCalloc(count, sizeof(*seen));
+    if (!last || !seen)
+    {
+        /* fallback to the per-record behavior */
+        for (i = 0; i < count; i++)
+            if (ops[i]->callback_func)
+                ops[i]->callback_func(lmgr, ops[i], ops[i]->callback_param);
+        goto ack;
+    }
+
+    /* find the last record of each reader */
+    for (i = count - 1; i >= 0; i--)
+    {
+        if (!ops[i]->callback_func)
+            continue;
+
+        if (!ops[i]->extra_info.is_changelog_record)
+        {
+            /* not a changelog record: always call its callback */
+            last[i] = true;
+            continue;
+        }
+
+        for (j = 0; j < nb_seen; j++)
+            if (seen[j] == ops[i]->callback_param)
+                break;
+
+        if (j == nb_seen)
+        {
+            seen[nb_seen++] = ops[i]->callback_param;
+            last[i] = true;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (ops[i]->extra_info.is_changelog_record)
+            DisplayLog(LVL_FULL, ENTRYPROC_TAG, "stage %s - record #%llu - id="DFID,
+                       stage_info->stage_name,
+                       ops[i]->extra_info.log_record.p_log_rec->cr_index,
+                       PFID(&ops[i]->entry_id));
+
+        if (!last[i])
+            continue;
+
+        /* if operation was committed, Perform callback to info collector */
+        rc = ops[i]->callback_func(lmgr, ops[i], ops[i]->callback_param);
+        if (rc)
+            DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d performing callback at stage %s.", rc,
+                       stage_info->stage_name);
+    }
+
+ack:
+    MemFree(seen);
+    MemFree(last);
+
+    /* Acknowledge the operations and remove them from pipeline */
+    rc = EntryProcessor_AcknowledgeBatch(ops, count, -1, true);
+    if (rc)
+        DisplayLog(LVL_CRIT, ENTRYPROC_TAG, "Error %d acknowledging stage %s.", rc,
+                   stage_info->stage_name);
+
+    return rc;
+}
+
+/** Any operation can be batched in CHGLOG_CLR stage, as long as
+ * they are in order (which is guaranteed for a sequential stage). */
+static bool chglog_clr_is_batchable(struct entry_proc_op_t *first,
+                                    struct entry_proc_op_t *next,
+                                    attr_mask_t *full_attr_mask)
+{
+    return true;
+}
 #endif
 
 static void mass_rm_cb(const entry_id_t *p_id)
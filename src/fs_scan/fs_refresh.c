@@ -0,0 +1,319 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Background refresh of outdated entries (db_update_params::refresh_rate).
+ *
+ * With periodic update parameters (md_update, path_update or
+ * fileclass_update), entries that have not been updated for longer than the
+ * period are listed from the DB and pushed to the pipeline, at most
+ * refresh_rate entries per second. This keeps the DB fresh between
+ * (less frequent) full scans.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fs_scan.h"
+#include "entry_processor.h"
+#include "update_params.h"
+#include "rbh_misc.h"
+#include "rbh_logs.h"
+#include "rbh_basename.h"
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define REFRESH_TAG "Refresh"
+
+/* entries listed per DB request */
+#define REFRESH_BATCH   1000
+/* delay between two passes over outdated entries (and to check if
+ * refresh_rate was changed when disabled) */
+#define REFRESH_IDLE    60
+
+static pthread_t     refresh_thr;
+static bool          refresh_started = false;
+static volatile bool refresh_stop = false;
+
+/* stats */
+static unsigned long long refresh_pushed = 0;
+static unsigned long long refresh_missing = 0;
+static unsigned long long refresh_errors = 0;
+static time_t             refresh_last_pass = 0;
+
+/** a criterion of outdated entries */
+typedef struct refresh_crit {
+    const char  *what;
+    unsigned int attr_index;
+    const updt_param_item_t *param;
+} refresh_crit_t;
+
+static const refresh_crit_t refresh_crits[] = {
+    {"metadata", ATTR_INDEX_md_update, &updt_params.md},
+#ifdef _HAVE_FID
+    {"path", ATTR_INDEX_path_update, &updt_params.path},
+#endif
+    {"fileclass", ATTR_INDEX_class_update, &updt_params.fileclass},
+};
+
+#define REFRESH_CRIT_COUNT  (sizeof(refresh_crits) / sizeof(refresh_crits[0]))
+
+/** refresh period of a criterion (0 if it is not periodic) */
+static time_t crit_period(const refresh_crit_t *crit)
+{
+    if (crit->param->when == UPDT_PERIODIC
+        || crit->param->when == UPDT_ON_EVENT_PERIODIC)
+        return crit->param->period_max;
+    return 0;
+}
+
+/** push an entry to the pipeline, with fresh POSIX attributes and path */
+static int refresh_entry(const entry_id_t *p_id, const attr_set_t *p_db_attrs)
+{
+    entry_proc_op_t *op;
+    struct stat      st;
+    char             path[RBH_PATH_MAX];
+#ifdef _HAVE_FID
+    int              rc;
+
+    /* the path may have changed */
+    rc = Lustre_GetFullPath(p_id, path, sizeof(path));
+    if (rc)
+        return rc;
+#else
+    if (!ATTR_MASK_TEST(p_db_attrs, fullpath))
+        return -EINVAL;
+    rh_strncpy(path, ATTR(p_db_attrs, fullpath), sizeof(path));
+#endif
+
+    if (lstat(path, &st))
+        return -errno;
+
+#ifndef _HAVE_FID
+    /* the path is now used by another entry */
+    if (st.st_ino != p_id->inode)
+        return -ESTALE;
+#endif
+
+    op = EntryProcessor_Get();
+    if (!op) {
+        DisplayLog(LVL_CRIT, REFRESH_TAG,
+                   "CRITICAL ERROR: Failed to allocate a new op");
+        return -ENOMEM;
+    }
+
+    ATTR_MASK_INIT(&op->fs_attrs);
+    op->entry_id = *p_id;
+    op->entry_id_is_set = 1;
+    op->pipeline_stage = entry_proc_descr.GET_INFO_DB;
+
+    ATTR_MASK_SET(&op->fs_attrs, name);
+    rh_strncpy(ATTR(&op->fs_attrs, name), rh_basename(path), RBH_NAME_MAX);
+    ATTR_MASK_SET(&op->fs_attrs, fullpath);
+    rh_strncpy(ATTR(&op->fs_attrs, fullpath), path,
+               sizeof(ATTR(&op->fs_attrs, fullpath)));
+    stat2rbh_attrs(&st, &op->fs_attrs, true);
+
+    ATTR_MASK_SET(&op->fs_attrs, md_update);
+    ATTR_MASK_SET(&op->fs_attrs, path_update);
+    ATTR(&op->fs_attrs, md_update) = ATTR(&op->fs_attrs, path_update)
+        = coarse_time();
+
+    op->extra_info_is_set = 0;
+    EntryProcessor_Push(op);
+    return 0;
+}
+
+/** wait for the rate budget of the current second and pipeline room */
+static void refresh_throttle(struct timeval *window, unsigned int *count)
+{
+    unsigned int   rate = updt_params.refresh_rate;
+    struct timeval now, elapsed;
+
+    while (!refresh_stop && EntryProcessor_Congested())
+        rh_usleep(100000);
+
+    if (rate == 0 || ++(*count) < rate)
+        return;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, window, &elapsed);
+    if (elapsed.tv_sec == 0)
+        rh_usleep(1000000 - elapsed.tv_usec);
+
+    gettimeofday(window, NULL);
+    *count = 0;
+}
+
+/** refresh the entries that are outdated for a criterion */
+static void refresh_pass(lmgr_t *lmgr, const refresh_crit_t *crit,
+                         time_t period)
+{
+    lmgr_filter_t     filter;
+    filter_value_t    fv;
+    lmgr_sort_type_t  sort;
+    lmgr_iter_opt_t   opt = LMGR_ITER_OPT_INIT;
+    lmgr_iter_pos_t   pos = {.set = false};
+    struct timeval    window;
+    unsigned int      count = 0;
+    unsigned long long pushed = 0;
+    attr_mask_t       mask = {.std = ATTR_MASK_fullpath};
+
+    lmgr_simple_filter_init(&filter);
+    fv.value.val_uint = time(NULL) - period;
+    lmgr_simple_filter_add(&filter, crit->attr_index, LESSTHAN_STRICT, fv, 0);
+
+    /* the oldest first; continue after the last listed entry, so entries
+     * that can't be refreshed are not listed again */
+    sort.attr_index = crit->attr_index;
+    sort.order = SORT_ASC;
+    opt.list_count_max = REFRESH_BATCH;
+    opt.after = &pos;
+
+    gettimeofday(&window, NULL);
+
+    while (!refresh_stop && updt_params.refresh_rate > 0) {
+        struct lmgr_iterator_t *it;
+        entry_id_t   id;
+        attr_set_t   attrs = ATTR_SET_INIT;
+        unsigned int listed = 0;
+        int          rc;
+
+        it = ListMgr_Iterator(lmgr, &filter, &sort, &opt);
+        if (it == NULL) {
+            DisplayLog(LVL_CRIT, REFRESH_TAG,
+                       "Error listing entries with outdated %s", crit->what);
+            break;
+        }
+
+        attrs.attr_mask = mask;
+        while (!refresh_stop
+               && (rc = ListMgr_GetNext(it, &id, &attrs)) == DB_SUCCESS) {
+            listed++;
+
+            rc = refresh_entry(&id, &attrs);
+            if (rc == 0) {
+                pushed++;
+                refresh_pushed++;
+            } else if (abs(rc) == ENOENT || abs(rc) == ESTALE) {
+                /* removed: cleaned by the next scan */
+                refresh_missing++;
+            } else {
+                DisplayLog(LVL_DEBUG, REFRESH_TAG, "Cannot refresh entry "
+                           DFID ": %s", PFID(&id), strerror(abs(rc)));
+                refresh_errors++;
+            }
+
+            ListMgr_FreeAttrs(&attrs);
+            attrs.attr_mask = mask;
+
+            refresh_throttle(&window, &count);
+        }
+
+        ListMgr_IterPosition(it, &pos);
+        ListMgr_CloseIterator(it);
+
+        /* end of the list */
+        if (listed < REFRESH_BATCH || !pos.set)
+            break;
+    }
+
+    lmgr_simple_filter_free(&filter);
+
+    if (pushed > 0)
+        DisplayLog(LVL_EVENT, REFRESH_TAG, "%llu entries with outdated %s "
+                   "refreshed", pushed, crit->what);
+}
+
+static void *refresh_thr_main(void *arg)
+{
+    lmgr_t lmgr;
+
+    if (ListMgr_InitAccess(&lmgr) != DB_SUCCESS) {
+        DisplayLog(LVL_CRIT, REFRESH_TAG,
+                   "Could not connect to the database: background refresh "
+                   "is disabled");
+        return NULL;
+    }
+
+    while (!refresh_stop) {
+        unsigned int i;
+
+        for (i = 0; i < REFRESH_CRIT_COUNT && !refresh_stop
+             && updt_params.refresh_rate > 0; i++) {
+            time_t period = crit_period(&refresh_crits[i]);
+
+            if (period > 0)
+                refresh_pass(&lmgr, &refresh_crits[i], period);
+        }
+        if (updt_params.refresh_rate > 0)
+            refresh_last_pass = time(NULL);
+
+        rh_intr_sleep(REFRESH_IDLE, refresh_stop);
+    }
+
+    ListMgr_CloseAccess(&lmgr);
+    return NULL;
+}
+
+int Robinhood_StartRefresh(void)
+{
+    int rc;
+
+    refresh_stop = false;
+    rc = pthread_create(&refresh_thr, NULL, refresh_thr_main, NULL);
+    if (rc) {
+        DisplayLog(LVL_CRIT, REFRESH_TAG,
+                   "Error %d creating background refresh thread: %s", rc,
+                   strerror(rc));
+        return rc;
+    }
+    refresh_started = true;
+    return 0;
+}
+
+void Robinhood_StopRefresh(void)
+{
+    if (!refresh_started)
+        return;
+
+    refresh_stop = true;
+    pthread_join(refresh_thr, NULL);
+    refresh_started = false;
+}
+
+void Robinhood_DumpRefreshStats(void)
+{
+    char tmp_buff[256];
+    struct tm paramtm;
+
+    if (!refresh_started || updt_params.refresh_rate == 0)
+        return;
+
+    DisplayLog(LVL_MAJOR, "STATS", "background refresh: %u entries/sec max",
+               updt_params.refresh_rate);
+    DisplayLog(LVL_MAJOR, "STATS", "     refreshed  : %llu entries (%llu "
+               "missing, %llu errors)", refresh_pushed, refresh_missing,
+               refresh_errors);
+    if (refresh_last_pass != 0) {
+        strftime(tmp_buff, sizeof(tmp_buff), "%Y/%m/%d %T",
+                 localtime_r(&refresh_last_pass, &paramtm));
+        DisplayLog(LVL_MAJOR, "STATS", "     last pass  : %s", tmp_buff);
+    }
+}
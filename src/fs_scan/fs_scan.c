@@ -28,8 +28,14 @@
 
 #include "task_stack_mngmt.h"
 #include "task_tree_mngmt.h"
+#include "statahead.h"
+#include "scan_backend.h"
+#include "scan_throttle.h"
+#include "scan_progress.h"
 #include "xplatform_print.h"
 #include "rbh_basename.h"
+#include "rbh_prof.h"
+#include "rbh_affinity.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -54,6 +60,11 @@ const char *partial_scan_root = NULL;
 
 static bool is_lustre_fs = false;
 static bool is_first_scan = false;
+/* entries of the first scan are bulk loaded to the DB */
+static bool bulk_load = false;
+
+/* number of operations pushed at once to the pipeline */
+#define SCAN_PUSH_BATCH     256
 
 /* information about scanning thread */
 
@@ -64,6 +75,8 @@ typedef struct thread_scan_info__ {
 
     /* NULL if no task is running */
     robinhood_task_t *current_task;
+    /* the current task holds a thread slot of its MDT */
+    bool mdt_slot;
 
     /* flag for forcing thread scan to stop */
     bool force_stop;
@@ -76,6 +89,16 @@ typedef struct thread_scan_info__ {
     struct timeval time_consumed;
     struct timeval last_processing_time;
 
+    /* current backoff delay when the pipeline is congested (usec) */
+    unsigned int backoff_usec;
+
+    /* buffer for reading directories (NULL until first used) */
+    char *dirent_buf;
+
+    /* operations waiting to be pushed to the pipeline */
+    entry_proc_op_t *push_ops[SCAN_PUSH_BATCH];
+    unsigned int nb_push_ops;
+
 } thread_scan_info_t;
 
 /**
@@ -87,9 +110,16 @@ static thread_scan_info_t *thread_list = NULL;
 
 static dev_t fsdev; /* for STAY_IN_FS mode */
 
+/* accessors to the namespace (the filesystem by default) */
+static const struct scan_backend posix_backend;
+static const struct scan_backend *scan_backend = &posix_backend;
+
 /* stack of scan tasks */
 static task_stack_t tasks_stack;
 
+/* number of MDTs tasks are queued for (1 = no MDT-aware scheduling) */
+static unsigned int scan_mdt_count = 1;
+
 /* pointer to mother task (NULL if no scan is running) */
 robinhood_task_t *root_task = NULL;
 
@@ -97,12 +127,24 @@ robinhood_task_t *root_task = NULL;
 static time_t last_scan_time = 0;
 static unsigned int last_duration = 0;
 static bool last_scan_complete = false;
+/* a directory could not be read (GC was disabled) */
+static bool scan_dir_error = false;
 static time_t scan_start_time = 0;
 
 static struct timeval accurate_start_time = { 0, 0 };
 
 static unsigned int nb_hang_total = 0;
 
+/* number of directories not read because they are unchanged
+ * (incremental scan) */
+static unsigned int nb_dirs_skipped = 0;
+
+/* last time the progress of the scan was saved */
+static time_t last_checkpoint = 0;
+
+/* DB connection of scan threads (for incremental scans) */
+static __thread lmgr_t *scan_lmgr = NULL;
+
 /* used for adaptive scan interval */
 static double usage_max = 50.0; /* default: 50% */
 static time_t scan_interval = 0;
@@ -121,6 +163,13 @@ static pthread_cond_t special_db_op_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t special_db_op_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool waiting_db_op = false;
 
+/* scan progress is saved for full scans only */
+static inline bool checkpoint_enabled(void)
+{
+    return !EMPTY_STRING(fs_scan_config.scan_checkpoint_file)
+        && partial_scan_root == NULL;
+}
+
 static inline void set_db_wait_flag(void)
 {
     P(special_db_op_lock);
@@ -204,6 +253,7 @@ static void ResetScanStats(bool do_lock)
         timerclear(&thread_list[i].time_consumed);
         timerclear(&thread_list[i].last_processing_time);
     }
+    nb_dirs_skipped = 0;
 
     if (do_lock)
         V(lock_scan);
@@ -291,6 +341,108 @@ static bool ignore_entry(char *fullpath, char *name, unsigned int depth,
     return (rc != POLICY_NO_MATCH);
 }
 
+/* ------------ Distributed scan --------------- */
+
+/* The namespace above scan_shard_depth is read by all instances, but its
+ * entries are only pushed by instance 0. Directories at scan_shard_depth
+ * are distributed between instances according to a hash of their path
+ * (relative to the filesystem root), and each instance scans the subtrees
+ * it owns. */
+
+static inline bool scan_is_sharded(void)
+{
+    /* partial scans can only be distributed if they don't clean old entries
+     * (e.g. for rbh-diff --jobs) */
+    return fs_scan_config.scan_shards > 1
+        && (partial_scan_root == NULL || fsscan_nogc);
+}
+
+/** test if this instance owns the subtree of the given directory */
+static bool shard_owns_dir(const char *path)
+{
+    const char *rel = path;
+    size_t len = strlen(global_config.fs_path);
+
+    if (!strncmp(path, global_config.fs_path, len))
+        rel = path + len;
+    while (*rel == '/')
+        rel++;
+
+    return (g_str_hash(rel) % fs_scan_config.scan_shards)
+        == fs_scan_config.scan_shard_index;
+}
+
+/**
+ * Distributed scan: test if an entry of a directory must be skipped
+ * by this instance.
+ */
+static bool shard_skip_entry(const robinhood_task_t *parent, const char *path,
+                             bool is_dir)
+{
+    if (!scan_is_sharded() || parent->depth >= fs_scan_config.scan_shard_depth)
+        return false;
+
+    if (!is_dir)
+        /* entries above shard depth are pushed by instance 0 */
+        return fs_scan_config.scan_shard_index != 0;
+
+    if (parent->depth + 1 == fs_scan_config.scan_shard_depth)
+        return !shard_owns_dir(path);
+
+    /* directories above shard depth are read by all instances */
+    return false;
+}
+
+/**
+ * Distributed scan: this instance terminated its part of the scan.
+ * Determine if all instances completed their scan since the last cleaning
+ * of old entries. In this case, this instance must clean them.
+ * @param[out] gc_time  entries not updated since this time must be removed
+ *                      (start time of the oldest scan of all instances).
+ */
+static bool shard_scan_gc(lmgr_t *lmgr, bool scan_complete, time_t end,
+                          time_t *gc_time)
+{
+    char varname[128];
+    char value[MAX_VAR_LEN];
+    unsigned long start_i, end_i, last_gc = 0;
+    char status[128];
+    unsigned int i;
+
+    /* store the status of this instance */
+    snprintf(varname, sizeof(varname), "%s_%u", SCAN_SHARD_PREFIX,
+             fs_scan_config.scan_shard_index);
+    snprintf(value, sizeof(value), "%lu:%lu:%s",
+             (unsigned long)scan_start_time, (unsigned long)end,
+             scan_complete ? SCAN_STATUS_DONE : SCAN_STATUS_INCOMPLETE);
+    if (ListMgr_SetVar(lmgr, varname, value) != DB_SUCCESS || !scan_complete)
+        return false;
+
+    if (ListMgr_GetVar(lmgr, SCAN_SHARDS_LAST_GC, value, sizeof(value))
+        == DB_SUCCESS)
+        last_gc = strtoul(value, NULL, 10);
+
+    *gc_time = scan_start_time;
+    for (i = 0; i < fs_scan_config.scan_shards; i++) {
+        snprintf(varname, sizeof(varname), "%s_%u", SCAN_SHARD_PREFIX, i);
+        if (ListMgr_GetVar(lmgr, varname, value, sizeof(value)) != DB_SUCCESS
+            || sscanf(value, "%lu:%lu:%127s", &start_i, &end_i, status) != 3
+            || strcmp(status, SCAN_STATUS_DONE) != 0
+            || start_i <= last_gc) {
+            DisplayLog(LVL_EVENT, FSSCAN_TAG, "Scan instance #%u did not "
+                       "complete a scan yet: not cleaning old entries", i);
+            return false;
+        }
+        if (start_i < *gc_time)
+            *gc_time = start_i;
+    }
+
+    /* next cleaning will wait for scans starting after this one */
+    snprintf(value, sizeof(value), "%lu", (unsigned long)end);
+    ListMgr_SetVar(lmgr, SCAN_SHARDS_LAST_GC, value);
+    return true;
+}
+
 /* Terminate a filesystem scan (called by the thread
  * that terminates the last task of scan, and merge
  * itself to the mother task).
@@ -298,12 +450,25 @@ static bool ignore_entry(char *fullpath, char *name, unsigned int depth,
  * been updated during the scan.
  * It also updates scan dates and root task.
  */
+/** DB variable for entry counts of subtrees (one per scan instance) */
+static const char *subtree_counts_var(char *buf, size_t size)
+{
+    if (!scan_is_sharded())
+        return SCAN_SUBTREE_COUNTS;
+
+    snprintf(buf, size, "%s_%u", SCAN_SUBTREE_COUNTS,
+             fs_scan_config.scan_shard_index);
+    return buf;
+}
+
 static int TerminateScan(int scan_complete, time_t end)
 {
     char timestamp[128];
     char tmp[1024];
     lmgr_t lmgr;
     bool no_db = false;
+    bool shard_gc = false;
+    time_t gc_time = scan_start_time;
 
     if (ListMgr_InitAccess(&lmgr) != DB_SUCCESS) {
         no_db = true;
@@ -331,6 +496,15 @@ static int TerminateScan(int scan_complete, time_t end)
                            scan_complete ? SCAN_STATUS_DONE :
                            SCAN_STATUS_INCOMPLETE);
 
+        /* distributed scan: old entries are cleaned once all instances
+         * completed their scan */
+        if (scan_is_sharded() && !fsscan_nogc)
+            shard_gc = shard_scan_gc(&lmgr, scan_complete, end, &gc_time);
+
+        /* subtree counts, to estimate the progress of the next scan */
+        if (scan_complete && !partial_scan_root)
+            ScanProgress_Save(&lmgr, subtree_counts_var(tmp, sizeof(tmp)));
+
         /* no other DB actions, close the connection */
         ListMgr_CloseAccess(&lmgr);
     }
@@ -359,7 +533,10 @@ static int TerminateScan(int scan_complete, time_t end)
 
         /* if this is an initial scan, don't rm old entries
          * (but flush pipeline still) */
-        if (fsscan_nogc || (is_first_scan && !partial_scan_root)) {
+        if (fsscan_nogc || (is_first_scan && !partial_scan_root)
+            /* changelogs are trusted for removed entries */
+            || fs_scan_config.incremental_scan == INCR_SCAN_CHANGELOG
+            || (scan_is_sharded() && !shard_gc)) {
             op->gc_entries = 0;
             op->gc_names = 0;
             op->callback_param = (void *)"End of flush";
@@ -378,7 +555,7 @@ static int TerminateScan(int scan_complete, time_t end)
 
             /* set the timestamp of scan in (md_update attribute) */
             ATTR_MASK_SET(&op->fs_attrs, md_update);
-            ATTR(&op->fs_attrs, md_update) = scan_start_time;
+            ATTR(&op->fs_attrs, md_update) = gc_time;
         }
 
         /* set root (if partial scan) */
@@ -399,6 +576,18 @@ static int TerminateScan(int scan_complete, time_t end)
 #endif
     }
 
+    /* load the remaining entries of the first scan (entries that are
+     * still in the pipeline of an incomplete scan are inserted as usual) */
+    if (bulk_load) {
+        if (ListMgr_InitAccess(&lmgr) == DB_SUCCESS) {
+            ListMgr_BulkLoadEnd(&lmgr);
+            ListMgr_CloseAccess(&lmgr);
+        } else
+            DisplayLog(LVL_CRIT, FSSCAN_TAG, "Failed to connect to the DB: "
+                       "cannot end bulk load");
+        bulk_load = false;
+    }
+
     /* take a lock on scan info */
     P(lock_scan);
 
@@ -415,6 +604,13 @@ static int TerminateScan(int scan_complete, time_t end)
 
     root_task = NULL;
 
+    /* the scan no longer needs to be resumed */
+    if (scan_complete && checkpoint_enabled()
+        && unlink(fs_scan_config.scan_checkpoint_file) && errno != ENOENT)
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to remove scan checkpoint "
+                   "%s: %s", fs_scan_config.scan_checkpoint_file,
+                   strerror(errno));
+
     /* release the lock */
     V(lock_scan);
 
@@ -484,7 +680,7 @@ static int RecursiveTaskTermination(thread_scan_info_t *p_info,
     robinhood_task_t *current_task = p_task;
 
     /* notify of current action (for watchdog) */
-    p_info->last_action = time(NULL);
+    p_info->last_action = coarse_time();
 
     /* tag itself as terminated */
     bool_termine = FlagTaskAsFinished(current_task);
@@ -498,6 +694,10 @@ static int RecursiveTaskTermination(thread_scan_info_t *p_info,
                        "%s is finished and has no child left => merging to the parent task",
                        current_task->path);
 
+            /* top-level directory (not a batch of it): subtree done */
+            if (current_task->depth == 1 && current_task->batch_names == NULL)
+                ScanProgress_Done(current_task->subtree);
+
             /* No chance that another thread has a lock on the current task,
              * because all the children tasks are terminated.
              * We are the last thread to handle it.
@@ -556,7 +756,7 @@ static int RecursiveTaskTermination(thread_scan_info_t *p_info,
             p_info->current_task = maman;
 
             /* notify of current activity (for watchdog) */
-            p_info->last_action = time(NULL);
+            p_info->last_action = coarse_time();
 
             /* free the task */
             DisplayLog(LVL_FULL, FSSCAN_TAG, "Freeing task %s",
@@ -583,7 +783,7 @@ static int RecursiveTaskTermination(thread_scan_info_t *p_info,
     }
 
     /* notify of current activity (for watchdog) */
-    p_info->last_action = time(NULL);
+    p_info->last_action = coarse_time();
 
     return 0;
 
@@ -736,11 +936,29 @@ static void check_dir_error(int rc)
         /* If we cannot read the directory, we must avoid dropping all
          * its entries from the DB => Switch to NO_GC mode. */
         fsscan_flags |= RUNFLG_NO_GC;
+        scan_dir_error = true;
         DisplayLog(LVL_CRIT, FSSCAN_TAG,
                    "Disabling GC because the namespace can't be fully scanned");
     }
 }
 
+/** set the MDT of a directory task, for MDT-aware scheduling */
+static void task_set_mdt(robinhood_task_t *p_task,
+                         const robinhood_task_t *parent)
+{
+    /* default: same MDT as the parent directory */
+    p_task->mdt_index = parent->mdt_index;
+
+#if defined(_HAVE_FID) && defined(HAVE_LLAPI_GET_MDT_INDEX_BY_FID)
+    if (scan_mdt_count > 1) {
+        int idx = Lustre_GetMDTIndex(&p_task->dir_id);
+
+        if (idx >= 0)
+            p_task->mdt_index = idx;
+    }
+#endif
+}
+
 static int create_child_task(const char *childpath, struct stat *inode,
                              robinhood_task_t *parent)
 {
@@ -756,15 +974,25 @@ static int create_child_task(const char *childpath, struct stat *inode,
     }
 
     p_task->parent_task = parent;
-    rh_strncpy(p_task->path, childpath, RBH_PATH_MAX);
+
+    /* only store the name: the path is built when the task is processed */
+    if ((rc = SetTaskName(p_task, rh_basename(childpath))) != 0)
+        goto out_free;
 
     /* set parent id */
-    if ((rc = path2id(childpath, &p_task->dir_id, inode)) != 0)
+    if ((rc = scan_backend->entry_id(-1, NULL, childpath, inode,
+                                     &p_task->dir_id)) != 0)
         goto out_free;
 
-    p_task->dir_md = *inode;
+    TaskSetStat(p_task, inode);
     p_task->depth = parent->depth + 1;
     p_task->task_finished = false;
+    task_set_mdt(p_task, parent);
+
+    if (parent->depth == 0)
+        p_task->subtree = ScanProgress_Subtree(p_task->name);
+    else
+        p_task->subtree = parent->subtree;
 
     /* add the task to the parent's subtask list */
     AddChildTask(parent, p_task);
@@ -778,6 +1006,29 @@ static int create_child_task(const char *childpath, struct stat *inode,
     return rc;
 }
 
+/** push the pending operations of a scan thread to the pipeline */
+static void scan_push_flush(thread_scan_info_t *p_info)
+{
+    unsigned int count = p_info->nb_push_ops;
+
+    if (count == 0)
+        return;
+
+    /* reset first: if the thread is terminated while pushing,
+     * its recovery thread must not push them again */
+    p_info->nb_push_ops = 0;
+    EntryProcessor_PushBatch(p_info->push_ops, count);
+}
+
+/** queue an operation, to be pushed to the pipeline with the next ones */
+static inline void scan_push_op(thread_scan_info_t *p_info,
+                                entry_proc_op_t *op)
+{
+    p_info->push_ops[p_info->nb_push_ops++] = op;
+    if (p_info->nb_push_ops >= SCAN_PUSH_BATCH)
+        scan_push_flush(p_info);
+}
+
 static int stat_entry(const char *path, const char *name, int parentfd,
                       struct stat *inode)
 {
@@ -804,10 +1055,89 @@ static int stat_entry(const char *path, const char *name, int parentfd,
     return 0;
 }
 
-/* process a filesystem entry */
+static int posix_entry_id(int parentfd, const char *name, const char *path,
+                          const struct stat *st, entry_id_t *id)
+{
+#if defined(_HAVE_FID) && !defined(_NO_AT_FUNC)
+    if (parentfd != -1) {
+        /* get fid from fd, using openat on parent fd */
+        int fd = openat_noatime(parentfd, name, false);
+        int rc;
+
+        if (fd < 0) {
+            rc = -errno;
+            DisplayLog(LVL_DEBUG, FSSCAN_TAG,
+                       "openat failed on <parent_fd=%d>/%s: %s", parentfd,
+                       name, strerror(-rc));
+            return rc;
+        }
+        rc = Lustre_GetFidByFd(fd, id);
+        if (rc)
+            DisplayLog(LVL_DEBUG, FSSCAN_TAG,
+                       "fd2fid failed on <parent_fd=%d>/%s: %s", parentfd,
+                       name, strerror(errno));
+        close(fd);
+        return rc;
+    }
+#endif
+    return path2id(path, id, st);
+}
+
+#ifndef _NO_AT_FUNC
+static int posix_dir_open(const char *path)
+{
+    return open_noatime(path, true);
+}
+
+static int posix_getdents(int fd, char *buf, size_t size)
+{
+    return syscall(SYS_getdents64, fd, buf, size);
+}
+#endif
+
+/* default backend: read the namespace from the filesystem */
+static const struct scan_backend posix_backend = {
+    .name = "posix",
+#ifndef _NO_AT_FUNC
+    .dir_open = posix_dir_open,
+    .getdents = posix_getdents,
+    .dir_close = close,
+#endif
+    .stat_entry = stat_entry,
+    .entry_id = posix_entry_id,
+    .real_fs = true,
+};
+
+int FSScan_SetBackend(const struct scan_backend *backend)
+{
+    if (backend == NULL)
+        backend = &posix_backend;
+#ifdef _NO_AT_FUNC
+    /* directories are read by readdir() */
+    else if (backend != &posix_backend)
+        return ENOTSUP;
+#endif
+    scan_backend = backend;
+
+    /* resumed and incremental scans access the filesystem by path */
+    if (!backend->real_fs) {
+        fs_scan_config.incremental_scan = INCR_SCAN_NONE;
+        fs_scan_config.scan_checkpoint_file[0] = '\0';
+    }
+    DisplayLog(LVL_EVENT, FSSCAN_TAG, "Using scan backend '%s'",
+               backend->name);
+    return 0;
+}
+
+/** process a filesystem entry
+ * @param known_md  entry attributes if they were already retrieved
+ *                  by stat-ahead (NULL else).
+ * @param known_rc  status of the stat-ahead for this entry.
+ */
 static int process_one_entry(thread_scan_info_t *p_info,
                              robinhood_task_t *p_task,
-                             char *entry_name, int parentfd)
+                             char *entry_name, int parentfd,
+                             const struct stat *known_md, int known_rc)
 {
     char entry_path[RBH_PATH_MAX];
     struct stat inode;
@@ -819,7 +1149,19 @@ static int process_one_entry(thread_scan_info_t *p_info,
 
     /* retrieve information about the entry (to know if it's a directory
      * or something else) */
-    rc = stat_entry(entry_path, entry_name, parentfd, &inode);
+    if (known_md != NULL) {
+        rc = known_rc;
+        if (rc == 0)
+            inode = *known_md;
+    } else {
+        struct timeval t0;
+
+        ScanThrottle_Acquire(1);
+        gettimeofday(&t0, NULL);
+        rc = scan_backend->stat_entry(entry_path, entry_name, parentfd,
+                                      &inode);
+        ScanThrottle_Record(1, &t0);
+    }
     if (rc) {
 #ifdef _LUSTRE
         if (is_lustre_fs && (rc == -ESHUTDOWN)) {
@@ -850,6 +1192,9 @@ static int process_one_entry(thread_scan_info_t *p_info,
     if (check_entry_dev(inode.st_dev, &fsdev, entry_path, false))
         return 0;   /* not considered as an error */
 
+    if (shard_skip_entry(p_task, entry_path, S_ISDIR(inode.st_mode)))
+        return 0;   /* handled by another scan instance */
+
     /* Push all entries except dirs to the pipeline.
      * Note: directories are pushed in Thr_scan(), after the closedir() call.
      */
@@ -904,15 +1249,15 @@ static int process_one_entry(thread_scan_info_t *p_info,
 #endif
             /* set update time  */
             ATTR_MASK_SET(&op->fs_attrs, md_update);
-            ATTR(&op->fs_attrs, md_update) = time(NULL);
+            ATTR(&op->fs_attrs, md_update) = coarse_time();
         } else {
             /* must still set it to avoid the entry to be impacted by
              * scan final GC */
             ATTR_MASK_SET(&op->fs_attrs, md_update);
-            ATTR(&op->fs_attrs, md_update) = time(NULL);
+            ATTR(&op->fs_attrs, md_update) = coarse_time();
         }
         ATTR_MASK_SET(&op->fs_attrs, path_update);
-        ATTR(&op->fs_attrs, path_update) = time(NULL);
+        ATTR(&op->fs_attrs, path_update) = coarse_time();
 
         /* Set entry id */
 #ifndef _HAVE_FID
@@ -926,23 +1271,11 @@ static int process_one_entry(thread_scan_info_t *p_info,
 #else
         op->entry_id_is_set = 0;
 #ifndef _NO_AT_FUNC
-        /* get fid from fd, using openat on parent fd */
-        int fd = openat_noatime(parentfd, entry_name, false);
-        if (fd < 0)
-            DisplayLog(LVL_DEBUG, FSSCAN_TAG,
-                       "openat failed on <parent_fd=%d>/%s: %s", parentfd,
-                       entry_name, strerror(errno));
-        else {
-            rc = Lustre_GetFidByFd(fd, &op->entry_id);
-            if (rc)
-                DisplayLog(LVL_DEBUG, FSSCAN_TAG,
-                           "fd2fid failed on <parent_fd=%d>/%s: %s", parentfd,
-                           entry_name, strerror(errno));
-            else {
-                op->entry_id_is_set = 1;
-                op->pipeline_stage = entry_proc_descr.GET_INFO_DB;
-            }
-            close(fd);
+        /* get fid from the parent directory (else, in GET_ID stage) */
+        if (scan_backend->entry_id(parentfd, entry_name, entry_path, &inode,
+                                   &op->entry_id) == 0) {
+            op->entry_id_is_set = 1;
+            op->pipeline_stage = entry_proc_descr.GET_INFO_DB;
         }
 #endif
 #endif
@@ -955,9 +1288,10 @@ static int process_one_entry(thread_scan_info_t *p_info,
          * (have_llapi_fswap_layouts) so scanning must update file stripe
          * information.
          */
-        if (no_md || S_ISREG(inode.st_mode))
+        if (scan_backend->real_fs && (no_md || S_ISREG(inode.st_mode)))
 #else
-        if ((no_md || S_ISREG(inode.st_mode)) && is_first_scan)
+        if (scan_backend->real_fs && (no_md || S_ISREG(inode.st_mode))
+            && is_first_scan)
 #endif
         {
             /* Fetch the stripes information now. This is faster than
@@ -988,7 +1322,7 @@ static int process_one_entry(thread_scan_info_t *p_info,
 
 #ifndef _BENCH_SCAN
         /* Push entry to the pipeline */
-        EntryProcessor_Push(op);
+        scan_push_op(p_info, op);
 #else
         EntryProcessor_Release(op);
 #endif
@@ -1000,7 +1334,9 @@ static int process_one_entry(thread_scan_info_t *p_info,
 
 /* directory specific types and accessors */
 #ifndef _NO_AT_FUNC
-#define GETDENTS_BUF_SZ 4096
+/* getdents buffer size: grows from min to max for big directories */
+#define DIRENT_BUF_MIN  4096
+#define DIRENT_BUF_MAX  (256 * 1024)
 #define DIR_T int
 #define DIR_FD(_d) (_d)
 #define DIR_ERR(_d) ((_d) < 0)
@@ -1012,10 +1348,333 @@ static int process_one_entry(thread_scan_info_t *p_info,
 #define OPENDIR_STR "opendir"
 #endif
 
+/* bounds of the scan backoff delay when the pipeline is congested (usec) */
+#define SCAN_BACKOFF_MIN    1000
+#define SCAN_BACKOFF_MAX    100000
+
+/**
+ * Slow down directory reading while the entry processor pipeline is
+ * congested, rather than blocking hard in EntryProcessor_Push().
+ * The delay doubles for each entry read in congested state,
+ * and it is reset when the pipeline recovers.
+ */
+static void scan_backoff(thread_scan_info_t *p_info)
+{
+    if (!EntryProcessor_Congested()) {
+        p_info->backoff_usec = 0;
+        return;
+    }
+
+    if (p_info->backoff_usec == 0)
+        p_info->backoff_usec = SCAN_BACKOFF_MIN;
+    else if (p_info->backoff_usec < SCAN_BACKOFF_MAX)
+        p_info->backoff_usec = MIN2(2 * p_info->backoff_usec,
+                                    SCAN_BACKOFF_MAX);
+
+    rh_usleep(p_info->backoff_usec);
+
+    /* notify current activity (for watchdog) */
+    p_info->last_action = coarse_time();
+}
+
+/* batch of directory entries to be handed off to another scan thread */
+struct dir_batch {
+    char           *names;
+    size_t          len;
+    size_t          size;
+    unsigned int    count;
+};
+
+/**
+ * Huge directory split: create a task to process a batch of entries
+ * of the current directory. It is a child of the directory task,
+ * with the same path, id and depth.
+ */
+static int flush_dir_batch(robinhood_task_t *p_task, struct dir_batch *batch)
+{
+    robinhood_task_t *p_batch;
+
+    if (batch->count == 0)
+        return 0;
+
+    p_batch = CreateTask();
+    if (p_batch == NULL) {
+        DisplayLog(LVL_CRIT, FSSCAN_TAG,
+                   "CRITICAL ERROR: task creation failed");
+        return -ENOMEM;
+    }
+
+    if (SetTaskPath(p_batch, p_task->path)) {
+        FreeTask(p_batch);
+        return -ENOMEM;
+    }
+    p_batch->parent_task = p_task;
+    p_batch->dir_id = p_task->dir_id;
+    p_batch->dir_md = p_task->dir_md;
+    p_batch->depth = p_task->depth;
+    p_batch->mdt_index = p_task->mdt_index;
+    p_batch->subtree = p_task->subtree;
+    p_batch->task_finished = false;
+    p_batch->batch_names = batch->names;
+    p_batch->batch_count = batch->count;
+
+    DisplayLog(LVL_FULL, FSSCAN_TAG, "Handing off a batch of %u entries of "
+               "%s", batch->count, p_task->path);
+
+    memset(batch, 0, sizeof(*batch));
+
+    AddChildTask(p_task, p_batch);
+    InsertTask_to_Stack(&tasks_stack, p_batch);
+    return 0;
+}
+
+/** is the entry at the given index processed by the reading thread? */
+static inline bool entry_is_inline(unsigned int index)
+{
+    return fs_scan_config.dir_split_threshold == 0
+        || index <= fs_scan_config.dir_split_threshold;
+}
+
+/* attributes of the next entries of a directory, stated ahead */
+struct sa_buf {
+    char           *names[STATAHEAD_MAX];
+    struct stat     st[STATAHEAD_MAX];
+    int             rc[STATAHEAD_MAX];
+    unsigned int    count;
+    unsigned int    next;
+};
+
+static struct sa_buf *sa_buf_alloc(void)
+{
+    struct sa_buf *sab;
+
+    if (!StatAhead_Enabled())
+        return NULL;
+
+    /* if allocation fails, entries are just stated one by one */
+    sab = MemAlloc(sizeof(*sab));
+    if (sab != NULL) {
+        sab->count = 0;
+        sab->next = 0;
+    }
+    return sab;
+}
+
+/**
+ * Get stated-ahead attributes of the given entry, if any.
+ * @param name must be the pointer passed to the stat-ahead batch.
+ */
+static inline const struct stat *sa_buf_get(struct sa_buf *sab,
+                                            const char *name, int *rc)
+{
+    if (sab == NULL || sab->next >= sab->count
+        || sab->names[sab->next] != name)
+        return NULL;
+
+    *rc = sab->rc[sab->next];
+    return &sab->st[sab->next++];
+}
+
+#ifndef _NO_AT_FUNC
+/**
+ * Stat ahead the entries to be processed inline, starting at the
+ * given position of a getdents buffer.
+ * @param index index of the last entry read before this position.
+ */
+static void sa_buf_fill_dirents(struct sa_buf *sab, robinhood_task_t *p_task,
+                                int dirfd, char *buf, off_t pos, off_t end,
+                                unsigned int index)
+{
+    struct timeval t0;
+
+    sab->count = 0;
+    sab->next = 0;
+
+    while (pos < end && sab->count < STATAHEAD_MAX) {
+        struct dirent64 *dp = (struct dirent64 *)(buf + pos);
+
+        pos += dp->d_reclen;
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+        if (!entry_is_inline(++index))
+            break;
+        sab->names[sab->count++] = dp->d_name;
+    }
+
+    if (sab->count == 0)
+        return;
+
+    ScanThrottle_Acquire(sab->count);
+    gettimeofday(&t0, NULL);
+    StatAhead_Batch(dirfd, p_task->path, sab->names, sab->count,
+                    sab->st, sab->rc);
+    ScanThrottle_Record(sab->count, &t0);
+}
+#endif
+
+/**
+ * Process an entry read from a directory, or hand it off to
+ * another scan thread if the directory is huge.
+ * @param index index of the entry in the directory (starting from 1)
+ * @param md, md_rc  attributes of the entry if it was stated ahead.
+ * @return 1 if the entry was handed off, a negative error code on error,
+ *         0 else.
+ */
+static int handle_dir_entry(thread_scan_info_t *p_info,
+                            robinhood_task_t *p_task, char *name,
+                            int parentfd, unsigned int index,
+                            struct dir_batch *batch,
+                            const struct stat *md, int md_rc)
+{
+    size_t len;
+
+    if (entry_is_inline(index)) {
+        scan_backoff(p_info);
+        return process_one_entry(p_info, p_task, name, parentfd,
+                                 md, md_rc) ? -1 : 0;
+    }
+
+    len = strlen(name) + 1;
+    if (batch->len + len > batch->size) {
+        size_t size = MAX2(2 * batch->size, 64 * 1024);
+        char *names = MemRealloc(batch->names, size);
+
+        if (names == NULL)
+            return -ENOMEM;
+        batch->names = names;
+        batch->size = size;
+    }
+    memcpy(batch->names + batch->len, name, len);
+    batch->len += len;
+    batch->count++;
+
+    if (batch->count >= fs_scan_config.dir_batch_size
+        && flush_dir_batch(p_task, batch))
+        return -ENOMEM;
+
+    return 1;
+}
+
+/** process the batch of entries handed off by a huge directory */
+static int process_dir_batch(robinhood_task_t *p_task,
+                             thread_scan_info_t *p_info,
+                             unsigned int *nb_entries,
+                             unsigned int *nb_errors)
+{
+    const char *name = p_task->batch_names;
+    struct sa_buf *sab;
+    int parentfd = -1;
+    unsigned int i;
+
+#ifndef _NO_AT_FUNC
+    parentfd = scan_backend->dir_open(p_task->path);
+    if (parentfd < 0) {
+        int rc = -errno;
+
+        DisplayLog(LVL_CRIT, FSSCAN_TAG, OPENDIR_STR " failed on %s (%s)",
+                   p_task->path, strerror(-rc));
+        (*nb_errors)++;
+        check_dir_error(rc);
+        return rc;
+    }
+#endif
+
+    sab = sa_buf_alloc();
+
+    for (i = 0; i < p_task->batch_count; i++) {
+        char entry_name[RBH_NAME_MAX + 1];
+        const struct stat *md;
+        int md_rc = 0;
+
+        if (p_info->force_stop) {
+            DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
+                       "cancelling directory scan operation "
+                       "(in '%s')", p_task->path);
+            if (parentfd >= 0)
+                scan_backend->dir_close(parentfd);
+            if (sab != NULL)
+                MemFree(sab);
+            return -ECANCELED;
+        }
+
+        /* stat ahead the next entries of the batch */
+        if (sab != NULL && sab->next >= sab->count) {
+            const char *next = name;
+            struct timeval t0;
+            unsigned int j;
+
+            sab->count = MIN2(p_task->batch_count - i, STATAHEAD_MAX);
+            sab->next = 0;
+            for (j = 0; j < sab->count; j++) {
+                sab->names[j] = (char *)next;
+                next += strlen(next) + 1;
+            }
+            ScanThrottle_Acquire(sab->count);
+            gettimeofday(&t0, NULL);
+            StatAhead_Batch(parentfd, p_task->path, sab->names, sab->count,
+                            sab->st, sab->rc);
+            ScanThrottle_Record(sab->count, &t0);
+        }
+        md = sa_buf_get(sab, name, &md_rc);
+
+        p_info->last_action = coarse_time();
+        (*nb_entries)++;
+
+        rh_strncpy(entry_name, name, sizeof(entry_name));
+        name += strlen(name) + 1;
+
+        scan_backoff(p_info);
+
+        if (process_one_entry(p_info, p_task, entry_name, parentfd,
+                              md, md_rc))
+            (*nb_errors)++;
+    }
+
+    if (parentfd >= 0)
+        scan_backend->dir_close(parentfd);
+    if (sab != NULL)
+        MemFree(sab);
+    return 0;
+}
+
+#ifndef _NO_AT_FUNC
+/** read a chunk of directory entries (accounted by the scan throttle) */
+static int read_dirents(int fd, char *buf, size_t size)
+{
+    struct timeval t0;
+    int rc, err;
+
+    ScanThrottle_Acquire(1);
+    gettimeofday(&t0, NULL);
+    rc = scan_backend->getdents(fd, buf, size);
+    err = errno;
+    ScanThrottle_Record(1, &t0);
+    errno = err;
+
+    return rc;
+}
+
+/**
+ * Initial size of the getdents buffer for a directory:
+ * the size of the directory itself, if it is known.
+ */
+static size_t dirent_buf_hint(const robinhood_task_t *p_task)
+{
+    struct stat dir_md;
+    size_t size = DIRENT_BUF_MIN;
+
+    TaskGetStat(p_task, &dir_md);
+    while (size < dir_md.st_size && size < DIRENT_BUF_MAX)
+        size <<= 1;
+
+    return size;
+}
+#endif
+
 static inline DIR_T dir_open(const char *path)
 {
 #ifndef _NO_AT_FUNC
-    return open_noatime(path, true);
+    return scan_backend->dir_open(path);
 #else
     return opendir(path);
 #endif
@@ -1023,12 +1682,16 @@ static inline DIR_T dir_open(const char *path)
 
 static int process_one_dir(robinhood_task_t *p_task,
                            thread_scan_info_t *p_info,
-                           unsigned int *nb_entries, unsigned int *nb_errors)
+                           unsigned int *nb_entries, unsigned int *nb_errors,
+                           unsigned int *nb_handed_off)
 {
+    struct dir_batch batch = { NULL, 0, 0, 0 };
     DIR_T dirp;
 #ifndef _NO_AT_FUNC
-    char dirent_buf[GETDENTS_BUF_SZ];
-    struct dirent64 *direntry = NULL;
+    char local_buf[DIRENT_BUF_MIN];
+    char *dirent_buf;
+    size_t buf_size;
+    struct sa_buf *sab;
 #else
     struct dirent direntry;
     struct dirent *cookie_rep;
@@ -1038,7 +1701,7 @@ static int process_one_dir(robinhood_task_t *p_task,
     (*nb_entries) = 0;
 
     /* hearbeat before opendir */
-    p_info->last_action = time(NULL);
+    p_info->last_action = coarse_time();
 
     dirp = dir_open(p_task->path);
     if (DIR_ERR(dirp)) {
@@ -1053,40 +1716,93 @@ static int process_one_dir(robinhood_task_t *p_task,
     }
 
     /* hearbeat before first readdir */
-    p_info->last_action = time(NULL);
+    p_info->last_action = coarse_time();
 
 #ifndef _NO_AT_FUNC
-    /* scan directory entries by chunk of 4k */
-    direntry = (struct dirent64 *)dirent_buf;
-    while ((rc = syscall(SYS_getdents64, dirp, direntry, GETDENTS_BUF_SZ))
-                    > 0) {
+    sab = sa_buf_alloc();
+
+    /* the thread buffer is allocated at first use. If it can't be,
+     * use a small one on the stack */
+    if (p_info->dirent_buf == NULL)
+        p_info->dirent_buf = MemAlloc(DIRENT_BUF_MAX);
+    if (p_info->dirent_buf != NULL) {
+        dirent_buf = p_info->dirent_buf;
+        buf_size = dirent_buf_hint(p_task);
+    } else {
+        dirent_buf = local_buf;
+        buf_size = sizeof(local_buf);
+    }
+
+    /* scan directory entries by chunks. The size of chunks increases
+     * while they are full, to save syscalls on big directories. */
+    while ((rc = read_dirents(dirp, dirent_buf, buf_size)) > 0) {
         off_t bytepos;
         struct dirent64 *dp;
 
         /* notify current activity */
-        p_info->last_action = time(NULL);
+        p_info->last_action = coarse_time();
+
+        /* the chunk was full (no room for a max size entry) */
+        if (dirent_buf != local_buf && buf_size < DIRENT_BUF_MAX
+            && rc + sizeof(struct dirent64) > buf_size)
+            buf_size <<= 1;
+
+        if (sab != NULL)
+            sa_buf_fill_dirents(sab, p_task, DIR_FD(dirp), dirent_buf,
+                                0, rc, *nb_entries);
 
         for (bytepos = 0; bytepos < rc;) {
+            const struct stat *md;
+            int md_rc = 0;
+
             dp = (struct dirent64 *)(dirent_buf + bytepos);
-            bytepos += dp->d_reclen;
 
             /* break ASAP if requested */
             if (p_info->force_stop) {
                 DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
                            "cancelling directory scan operation "
                            "(in '%s')", p_task->path);
+                scan_backend->dir_close(dirp);
+                if (batch.names != NULL)
+                    MemFree(batch.names);
+                if (sab != NULL)
+                    MemFree(sab);
                 return -ECANCELED;
             }
 
-            if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
+                bytepos += dp->d_reclen;
                 continue;
+            }
 
+            /* the chunk has more entries than a stat-ahead batch */
+            if (sab != NULL && sab->next >= sab->count
+                && sab->count == STATAHEAD_MAX
+                && entry_is_inline(*nb_entries + 1))
+                sa_buf_fill_dirents(sab, p_task, DIR_FD(dirp), dirent_buf,
+                                    bytepos, rc, *nb_entries);
+
+            bytepos += dp->d_reclen;
             (*nb_entries)++;
 
+            md = sa_buf_get(sab, dp->d_name, &md_rc);
+
             /* Handle filesystem entry. */
-            if (process_one_entry(p_info, p_task, dp->d_name, DIR_FD(dirp)))
+            switch (handle_dir_entry(p_info, p_task, dp->d_name,
+                                     DIR_FD(dirp), *nb_entries, &batch,
+                                     md, md_rc)) {
+            case 0:
+                break;
+            case 1:
+                (*nb_handed_off)++;
+                break;
+            default:
                 (*nb_errors)++;
+            }
         }
+
+        /* push operations for the whole chunk at once */
+        scan_push_flush(p_info);
     }
     /* rc == 0 => end of dir */
     if (rc < 0) {
@@ -1096,14 +1812,16 @@ static int process_one_dir(robinhood_task_t *p_task,
         (*nb_errors)++;
     }
     if (rc != EBADF)
-        close(dirp);
+        scan_backend->dir_close(dirp);
+    if (sab != NULL)
+        MemFree(sab);
 #else
     /* read entries one by one */
     while (1) {
         rc = readdir_r(dirp, &direntry, &cookie_rep);
 
         /* notify current activity (for watchdog) */
-        p_info->last_action = time(NULL);
+        p_info->last_action = coarse_time();
 
         if ((rc == 0) && (cookie_rep == NULL))
             /* end of directory */
@@ -1112,6 +1830,8 @@ static int process_one_dir(robinhood_task_t *p_task,
             DisplayLog(LVL_EVENT, FSSCAN_TAG, "Stop requested: "
                        "cancelling directory scan operation (in '%s')",
                        p_task->path);
+            if (batch.names != NULL)
+                MemFree(batch.names);
             return -ECANCELED;
         } else if (rc != 0) {
             DisplayLog(LVL_CRIT, FSSCAN_TAG, "ERROR reading directory %s (%s)",
@@ -1131,22 +1851,179 @@ static int process_one_dir(robinhood_task_t *p_task,
 #endif
 
         /* Handle filesystem entry. */
-        if (process_one_entry(p_info, p_task, direntry.d_name, dirfd(dirp)))
+        switch (handle_dir_entry(p_info, p_task, direntry.d_name,
+                                 dirfd(dirp), *nb_entries, &batch,
+                                 NULL, 0)) {
+        case 0:
+            break;
+        case 1:
+            (*nb_handed_off)++;
+            break;
+        default:
             (*nb_errors)++;
+        }
 
     }   /* end of dir */
 
     if (rc != EBADF)
         closedir(dirp);
 #endif
+
+    /* hand off the remaining entries */
+    if (flush_dir_batch(p_task, &batch)) {
+        (*nb_errors)++;
+        if (batch.names != NULL)
+            MemFree(batch.names);
+    }
     return rc;
 }
 
+/** get the DB connection of the current scan thread */
+static lmgr_t *get_scan_lmgr(void)
+{
+    if (scan_lmgr != NULL)
+        return scan_lmgr;
+
+    scan_lmgr = MemAlloc(sizeof(lmgr_t));
+    if (scan_lmgr == NULL)
+        return NULL;
+
+    if (ListMgr_InitAccess(scan_lmgr) != DB_SUCCESS) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG,
+                   "Could not connect to database: incremental scan disabled "
+                   "for this thread");
+        MemFree(scan_lmgr);
+        scan_lmgr = NULL;
+    }
+    return scan_lmgr;
+}
+
+/**
+ * Incremental scan: check if a directory has not changed since last scan,
+ * by comparing its mtime and ctime with the ones stored in DB.
+ */
+static bool dir_unchanged(robinhood_task_t *p_task, lmgr_t *lmgr)
+{
+    attr_set_t attrs;
+    bool unchanged = false;
+
+    ATTR_MASK_INIT(&attrs);
+    ATTR_MASK_SET(&attrs, last_mod);
+    ATTR_MASK_SET(&attrs, last_mdchange);
+
+    if (ListMgr_Get(lmgr, &p_task->dir_id, &attrs) != DB_SUCCESS)
+        return false;
+
+    if (ATTR_MASK_TEST(&attrs, last_mod) && ATTR_MASK_TEST(&attrs, last_mdchange)
+        && ATTR(&attrs, last_mod) == p_task->dir_md.mtime
+        && ATTR(&attrs, last_mdchange) == p_task->dir_md.ctime)
+        unchanged = true;
+
+    ListMgr_FreeAttrs(&attrs);
+    return unchanged;
+}
+
+/**
+ * Incremental scan: handle an unchanged directory without reading it.
+ * Its entries are marked as seen in DB, and in dir_mtime mode,
+ * its sub-directories (known from DB) are scanned.
+ */
+static int skip_unchanged_dir(robinhood_task_t *p_task,
+                              thread_scan_info_t *p_info, lmgr_t *lmgr,
+                              unsigned int *nb_errors)
+{
+    lmgr_filter_t filter;
+    filter_value_t fv;
+    wagon_t parent;
+    wagon_t *child_ids = NULL;
+    attr_set_t *child_attrs = NULL;
+    unsigned int child_count = 0;
+    unsigned int i;
+    int rc;
+
+    __sync_fetch_and_add(&nb_dirs_skipped, 1);
+
+    /* changelogs are trusted for the whole subtree */
+    if (fs_scan_config.incremental_scan == INCR_SCAN_CHANGELOG)
+        return 0;
+
+    /* mark the entries of this directory as seen */
+    rc = ListMgr_TouchChildren(lmgr, &p_task->dir_id, scan_start_time);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to update entries of "
+                   "unchanged directory %s (error %d)", p_task->path, rc);
+        (*nb_errors)++;
+        return -EIO;
+    }
+
+    /* sub-directories may have changed: get them from DB */
+    parent.id = p_task->dir_id;
+    parent.fullname = p_task->path;
+
+    lmgr_simple_filter_init(&filter);
+    fv.value.val_str = STR_TYPE_DIR;
+    lmgr_simple_filter_add(&filter, ATTR_INDEX_type, EQUAL, fv, 0);
+
+    rc = ListMgr_GetChild(lmgr, &filter, &parent, 1, null_mask, &child_ids,
+                          &child_attrs, &child_count);
+    lmgr_simple_filter_free(&filter);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to list sub-directories of "
+                   "%s from DB (error %d)", p_task->path, rc);
+        (*nb_errors)++;
+        return -EIO;
+    }
+
+    for (i = 0; i < child_count && !p_info->force_stop; i++) {
+        struct stat inode;
+
+        p_info->last_action = coarse_time();
+
+        if (lstat(child_ids[i].fullname, &inode) != 0) {
+            rc = -errno;
+            /* removed since last scan: this is not an error, and it will be
+             * cleaned at the end of the scan */
+            if (rc != -ENOENT) {
+                DisplayLog(LVL_MAJOR, FSSCAN_TAG, "stat failed on %s (%s)",
+                           child_ids[i].fullname, strerror(-rc));
+                (*nb_errors)++;
+            }
+            continue;
+        }
+        if (!S_ISDIR(inode.st_mode)
+            || check_entry_dev(inode.st_dev, &fsdev, child_ids[i].fullname,
+                               false))
+            continue;
+
+        if (ignore_entry(child_ids[i].fullname, ATTR(&child_attrs[i], name),
+                         p_task->depth, &inode)
+            || shard_skip_entry(p_task, child_ids[i].fullname, true))
+            continue;
+
+        if (create_child_task(child_ids[i].fullname, &inode, p_task))
+            (*nb_errors)++;
+    }
+
+    for (i = 0; i < child_count; i++) {
+        free(child_ids[i].fullname);
+        if (child_attrs)
+            ListMgr_FreeAttrs(&child_attrs[i]);
+    }
+    MemFree(child_ids);
+    if (child_attrs)
+        MemFree(child_attrs);
+
+    return p_info->force_stop ? -ECANCELED : 0;
+}
+
 static int process_one_task(robinhood_task_t *p_task,
                             thread_scan_info_t *p_info,
                             unsigned int *nb_entries, unsigned int *nb_errors)
 {
     int rc;
+    bool skipped = false;
+    unsigned int dircount = 0;
+    unsigned int nb_handed_off = 0;
 #ifdef _BENCH_DB
     /* to map entry_id_t to an integer  we can increment */
     struct id_map {
@@ -1161,23 +2038,30 @@ static int process_one_task(robinhood_task_t *p_task,
     /* if this is the root task, check that the filesystem is still mounted */
     if (p_task->parent_task == NULL) {
         /* retrieve filesystem device id */
-        if (stat(p_task->path, &p_task->dir_md)) {
+        struct stat root_md;
+
+        if (stat(p_task->path, &root_md)) {
             DisplayLog(LVL_CRIT, FSSCAN_TAG,
                        "stat failed on %s (%s)", p_task->path, strerror(errno));
             DisplayLog(LVL_CRIT, FSSCAN_TAG,
                        "Error accessing filesystem: exiting");
             Exit(1);
         }
-        if (check_entry_dev(p_task->dir_md.st_dev, &fsdev, p_task->path, true))
-            p_task->dir_md.st_dev = fsdev;  /* just updated */
+        if (check_entry_dev(root_md.st_dev, &fsdev, p_task->path, true))
+            root_md.st_dev = fsdev;  /* just updated */
 
-        rc = path2id(p_task->path, &p_task->dir_id, &p_task->dir_md);
+        TaskSetStat(p_task, &root_md);
+        rc = path2id(p_task->path, &p_task->dir_id, &root_md);
         if (rc) {
             (*nb_errors)++;
             return rc;
         }
     }
 
+    /* batch of entries handed off by a huge directory */
+    if (p_task->batch_names != NULL)
+        return process_dir_batch(p_task, p_info, nb_entries, nb_errors);
+
     /* As long as the current task path is (strictly)
      * upper than partial scan root: just lookup, no readdir */
      if (partial_scan_root && (strlen(p_task->path)
@@ -1210,7 +2094,7 @@ static int process_one_task(robinhood_task_t *p_task,
         DisplayLog(LVL_FULL, FSSCAN_TAG, "Partial scan: processing '%s' in %s",
                    name, p_task->path);
 
-        rc = process_one_entry(p_info, p_task, name, -1);
+        rc = process_one_entry(p_info, p_task, name, -1, NULL, 0);
         if (rc) {
             (*nb_errors)++;
             return rc;
@@ -1222,8 +2106,25 @@ static int process_one_task(robinhood_task_t *p_task,
     else if (p_task->depth == 0)
 #endif
     {
-        /* read the directory and process each entry */
-        rc = process_one_dir(p_task, p_info, nb_entries, nb_errors);
+        lmgr_t *lmgr;
+
+        /* incremental scan: don't read unchanged directories */
+        if (fs_scan_config.incremental_scan != INCR_SCAN_NONE
+            && !is_first_scan && (lmgr = get_scan_lmgr()) != NULL
+            && dir_unchanged(p_task, lmgr)) {
+            DisplayLog(LVL_FULL, FSSCAN_TAG, "%s is unchanged since last scan: "
+                       "skipping it", p_task->path);
+            skipped = true;
+            rc = skip_unchanged_dir(p_task, p_info, lmgr, nb_errors);
+        } else {
+            /* read the directory and process each entry */
+            rc = process_one_dir(p_task, p_info, nb_entries, nb_errors,
+                                 &nb_handed_off);
+
+            /* handed off entries are accounted by the tasks handling them */
+            dircount = *nb_entries;
+            *nb_entries -= nb_handed_off;
+        }
         if (rc)
             return rc;
     }
@@ -1231,7 +2132,11 @@ static int process_one_task(robinhood_task_t *p_task,
     int i;
 #endif
 
-    if (p_task->depth > 0)
+    /* directories above shard depth are pushed by scan instance 0 */
+    if (p_task->depth > 0
+        && !(scan_is_sharded()
+             && p_task->depth < fs_scan_config.scan_shard_depth
+             && fs_scan_config.scan_shard_index != 0))
 #ifdef _BENCH_DB
         for (i = 1; i < 100000 && !p_info->force_stop; i++)
 #endif
@@ -1240,6 +2145,7 @@ static int process_one_task(robinhood_task_t *p_task,
              * on it, and possibly purge it if it is empty for a long time.
              */
             entry_proc_op_t *op;
+            struct stat dir_md;
 
             op = EntryProcessor_Get();
             if (!op) {
@@ -1296,15 +2202,19 @@ static int process_one_task(robinhood_task_t *p_task,
             /* depth(/tmp/toto) = 0 */
             ATTR(&op->fs_attrs, depth) = p_task->depth - 1;
 
-            ATTR_MASK_SET(&op->fs_attrs, dircount);
-            ATTR(&op->fs_attrs, dircount) = *nb_entries;
+            /* entry count is unknown if the directory was not read */
+            if (!skipped) {
+                ATTR_MASK_SET(&op->fs_attrs, dircount);
+                ATTR(&op->fs_attrs, dircount) = dircount;
+            }
 
 #ifndef _BENCH_PIPELINE
+            TaskGetStat(p_task, &dir_md);
 #if defined(_LUSTRE) && defined(_MDS_STAT_SUPPORT)
-            stat2rbh_attrs(&p_task->dir_md, &op->fs_attrs,
+            stat2rbh_attrs(&dir_md, &op->fs_attrs,
                            !(is_lustre_fs && global_config.direct_mds_stat));
 #else
-            stat2rbh_attrs(&p_task->dir_md, &op->fs_attrs, true);
+            stat2rbh_attrs(&dir_md, &op->fs_attrs, true);
 #endif
 #endif
 
@@ -1335,7 +2245,7 @@ static int process_one_task(robinhood_task_t *p_task,
             ATTR_MASK_SET(&op->fs_attrs, md_update);
             ATTR_MASK_SET(&op->fs_attrs, path_update);
             ATTR(&op->fs_attrs, md_update) = ATTR(&op->fs_attrs, path_update)
-                = time(NULL);
+                = coarse_time();
 
             op->extra_info_is_set = 0;
 
@@ -1367,6 +2277,12 @@ static void *Thr_scan(void *arg_thread)
     unsigned int nb_entries = 0;
     unsigned int nb_errors = 0;
 
+    prof_set_role(PROF_ROLE_SCAN, NULL);
+    affinity_set_thread(fs_scan_config.cpu_affinity, "scan");
+
+    /* get tasks from (and push child tasks to) this thread's deque */
+    SetTaskStackWorker(p_info->index);
+
     /* Initialize buddy management */
 #ifdef _BUDDY_MALLOC
     if (BuddyInit(&buddy_config)) {
@@ -1386,8 +2302,11 @@ static void *Thr_scan(void *arg_thread)
         p_task = GetTask_from_Stack(&tasks_stack);
 
         /* skip it if the thread was requested to stop */
-        if (p_info->force_stop)
+        if (p_info->force_stop) {
+            if (p_task != NULL)
+                TaskDone_in_Stack(&tasks_stack, p_task);
             break;
+        }
 
         /* ERROR if NULL */
         if (p_task == NULL) {
@@ -1396,9 +2315,18 @@ static void *Thr_scan(void *arg_thread)
             Exit(1);
         }
 
+        /* the path of the task is only built when it is processed */
+        if (BuildTaskPath(p_task) != 0) {
+            DisplayLog(LVL_CRIT, FSSCAN_TAG,
+                       "CRITICAL ERROR: failed to build path of task '%s'",
+                       p_task->name);
+            Exit(1);
+        }
+
         /* update thread info */
         p_info->current_task = p_task;
-        p_info->last_action = time(NULL);
+        p_info->mdt_slot = true;
+        p_info->last_action = coarse_time();
 
         /* initialize error counters for current task */
         nb_entries = 0;
@@ -1412,6 +2340,11 @@ static void *Thr_scan(void *arg_thread)
         gettimeofday(&start_dir, NULL);
 
         task_rc = process_one_task(p_task, p_info, &nb_entries, &nb_errors);
+        /* let another thread work on this MDT */
+        p_info->mdt_slot = false;
+        TaskDone_in_Stack(&tasks_stack, p_task);
+        scan_push_flush(p_info);
+        ScanProgress_Add(p_task->subtree, nb_entries);
 
         gettimeofday(&end_dir, NULL);
         timersub(&end_dir, &start_dir, &diff);
@@ -1468,6 +2401,7 @@ int Robinhood_InitScanModule(void)
 {
     int st;
     int rc, i;
+    statahead_mode_e sa_mode;
 
     /* fill-in be structures with zeros */
     memset(&tasks_stack, 0, sizeof(tasks_stack));
@@ -1478,9 +2412,29 @@ int Robinhood_InitScanModule(void)
     if (fs_scan_config.nb_prealloc_tasks > 0)
         SetNbPreallocTasks(fs_scan_config.nb_prealloc_tasks);
 
+    /* MDT-aware scheduling */
+    scan_mdt_count = 1;
+    if (fs_scan_config.mdt_max_threads > 0
+        && !strcmp(global_config.fs_type, "lustre")) {
+#if defined(_HAVE_FID) && defined(HAVE_LLAPI_GET_MDT_INDEX_BY_FID)
+        if (Lustre_GetMDTCount(&scan_mdt_count) != 0)
+            scan_mdt_count = 1;
+        if (scan_mdt_count > 1)
+            DisplayLog(LVL_MAJOR, FSSCAN_TAG, "MDT-aware scan scheduling: "
+                       "%u MDTs, max %u threads per MDT", scan_mdt_count,
+                       fs_scan_config.mdt_max_threads);
+#else
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "WARNING: mdt_max_threads is set,"
+                   " but this version of Lustre cannot get the MDT of a "
+                   "directory: ignored");
+#endif
+    }
+
     /* initializing task stack */
 
-    st = InitTaskStack(&tasks_stack);
+    st = InitTaskStack(&tasks_stack, fs_scan_config.nb_threads_scan,
+                       scan_mdt_count,
+                       scan_mdt_count > 1 ? fs_scan_config.mdt_max_threads : 0);
     if (st)
         return st;
 
@@ -1493,6 +2447,19 @@ int Robinhood_InitScanModule(void)
     if (!strcmp(global_config.fs_type, "lustre"))
         is_lustre_fs = true;
 
+    sa_mode = fs_scan_config.stat_ahead;
+    /* io_uring requests are issued to the filesystem */
+    if (sa_mode == STATAHEAD_IO_URING && !scan_backend->real_fs) {
+        DisplayLog(LVL_EVENT, FSSCAN_TAG, "Scan backend '%s' doesn't "
+                   "support io_uring stat-ahead: using threads",
+                   scan_backend->name);
+        sa_mode = STATAHEAD_THREADS;
+    }
+    rc = StatAhead_Init(sa_mode, fs_scan_config.stat_ahead_threads,
+                        scan_backend->stat_entry);
+    if (rc)
+        return rc;
+
     /* initializing thread attrs */
 
     pthread_attr_init(&thread_attrs);
@@ -1585,6 +2552,394 @@ void Robinhood_StopScanModule(void)
  * @param partial_root NULL for full scan; subdir path for partial scan
  * @retval EBUSY if a scan is already running.
  */
+/* ------------ Scan checkpoints --------------- */
+
+#define CHECKPOINT_MAGIC "robinhood scan checkpoint v1"
+
+/* checkpoint waiting for pipeline flush */
+struct scan_checkpoint {
+    time_t       start_time;
+    GString     *content;
+};
+
+/**
+ * List the directories that still have to be read: tasks that are not
+ * finished are fully listed (their sub-tasks will be created again
+ * when resuming), and sub-tasks of finished tasks are recursively listed.
+ * Tasks can't be removed from the tree while their parent is locked.
+ * @return -1 if a path can't be saved
+ */
+static int checkpoint_walk(robinhood_task_t *p_task, GString *list,
+                           unsigned int *count)
+{
+    robinhood_task_t *p_child;
+    char path[RBH_PATH_MAX];
+    int rc = 0;
+
+    pthread_spin_lock(&p_task->child_list_lock);
+    if (!p_task->task_finished) {
+        if (TaskFullPath(p_task, path, sizeof(path)) != 0) {
+            DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Can't get path of directory "
+                       "'%s' for scan checkpoint", p_task->name);
+            rc = -1;
+        } else if (strchr(path, '\n') != NULL) {
+            DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Can't save directory with "
+                       "newline in its name '%s' in scan checkpoint", path);
+            rc = -1;
+        } else {
+            g_string_append(list, path);
+            g_string_append_c(list, '\n');
+            (*count)++;
+        }
+    } else {
+        for (p_child = p_task->child_list; p_child != NULL && rc == 0;
+             p_child = p_child->next_child)
+            rc = checkpoint_walk(p_child, list, count);
+    }
+    pthread_spin_unlock(&p_task->child_list_lock);
+
+    return rc;
+}
+
+/** Write the checkpoint file once all previous operations are in DB */
+static int checkpoint_callback(lmgr_t *lmgr, struct entry_proc_op_t *p_op,
+                               void *arg)
+{
+    struct scan_checkpoint *ckpt = arg;
+    char tmp[RBH_PATH_MAX + 8];
+    FILE *f;
+    int rc = 0;
+
+    /* don't write it if the scan terminated in the meantime */
+    P(lock_scan);
+    if (root_task == NULL || scan_start_time != ckpt->start_time)
+        goto out_unlock;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", fs_scan_config.scan_checkpoint_file);
+
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        rc = -errno;
+        goto out;
+    }
+    if (fputs(ckpt->content->str, f) < 0)
+        rc = -errno;
+    if (fclose(f) && rc == 0)
+        rc = -errno;
+    if (rc == 0 && rename(tmp, fs_scan_config.scan_checkpoint_file))
+        rc = -errno;
+
+ out:
+    if (rc)
+        DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Failed to write scan checkpoint "
+                   "%s: %s", fs_scan_config.scan_checkpoint_file,
+                   strerror(-rc));
+    else
+        DisplayLog(LVL_EVENT, FSSCAN_TAG, "Scan checkpoint saved to %s",
+                   fs_scan_config.scan_checkpoint_file);
+
+ out_unlock:
+    V(lock_scan);
+    g_string_free(ckpt->content, TRUE);
+    MemFree(ckpt);
+    return rc;
+}
+
+/**
+ * Save the progress of the current scan, if it's time.
+ * The list of pending directories is written when all operations that were
+ * pushed before are committed to the database.
+ * @return 0 if a scan is running, ENOENT else.
+ */
+int Robinhood_CheckpointScan(void)
+{
+    entry_proc_op_t *op;
+    struct scan_checkpoint *ckpt;
+    unsigned int count = 0;
+    int rc;
+
+    P(lock_scan);
+    if (root_task == NULL) {
+        V(lock_scan);
+        return ENOENT;
+    }
+    if (!checkpoint_enabled() || time(NULL) - last_checkpoint
+            < fs_scan_config.scan_checkpoint_interval) {
+        V(lock_scan);
+        return 0;
+    }
+    last_checkpoint = time(NULL);
+
+    ckpt = MemAlloc(sizeof(*ckpt));
+    ckpt->start_time = scan_start_time;
+    ckpt->content = g_string_new(NULL);
+    g_string_printf(ckpt->content, CHECKPOINT_MAGIC "\nfs_path=%s\nstart_time=%lu\n"
+                    "first_scan=%d\n", global_config.fs_path,
+                    (unsigned long)scan_start_time, is_first_scan ? 1 : 0);
+    rc = checkpoint_walk(root_task, ckpt->content, &count);
+    V(lock_scan);
+
+    if (rc || count == 0)
+        goto free_ckpt;
+
+    op = EntryProcessor_Get();
+    if (!op) {
+        DisplayLog(LVL_CRIT, FSSCAN_TAG,
+                   "CRITICAL ERROR: Failed to allocate a new op");
+        goto free_ckpt;
+    }
+
+    DisplayLog(LVL_DEBUG, FSSCAN_TAG, "Saving scan checkpoint: %u pending "
+               "directories", count);
+
+    /* special op to wait for pipeline flush (no cleaning) */
+    op->pipeline_stage = entry_proc_descr.GC_OLDENT;
+    op->callback_func = checkpoint_callback;
+    op->callback_param = ckpt;
+    op->gc_entries = 0;
+    op->gc_names = 0;
+    ATTR_MASK_INIT(&op->fs_attrs);
+
+#ifndef _BENCH_SCAN
+    EntryProcessor_Push(op);
+    return 0;
+#else
+    EntryProcessor_Release(op);
+#endif
+
+ free_ckpt:
+    g_string_free(ckpt->content, TRUE);
+    MemFree(ckpt);
+    return 0;
+}
+
+static inline char *strip_newline(char *line)
+{
+    line[strcspn(line, "\n")] = '\0';
+    return line;
+}
+
+/** read a "<key>=<value>" line of checkpoint header */
+static int read_checkpoint_header(FILE *f, const char *key, char *value,
+                                  size_t size)
+{
+    char line[RBH_PATH_MAX + 64];
+    size_t len = strlen(key);
+
+    if (fgets(line, sizeof(line), f) == NULL)
+        return -EINVAL;
+    strip_newline(line);
+    if (strncmp(line, key, len) || line[len] != '=')
+        return -EINVAL;
+    rh_strncpy(value, line + len + 1, size);
+    return 0;
+}
+
+/**
+ * Get the task of a directory when resuming a scan.
+ * Tasks for its parent directories are created if they don't exist.
+ * They are considered as finished, as their content was already read.
+ */
+static robinhood_task_t *resume_get_task(GHashTable *tasks,
+                                         robinhood_task_t *root,
+                                         const char *path, bool finished)
+{
+    robinhood_task_t *p_task, *p_parent;
+    char parent_path[RBH_PATH_MAX];
+    struct stat md;
+    char *last_slash;
+
+    /* a pending directory covers its whole subtree, and it may be listed
+     * several times (batches of a huge directory) */
+    p_task = g_hash_table_lookup(tasks, path);
+    if (p_task != NULL)
+        return (finished && p_task->task_finished) ? p_task : NULL;
+
+    rh_strncpy(parent_path, path, sizeof(parent_path));
+    last_slash = strrchr(parent_path, '/');
+    if (last_slash == NULL)
+        return NULL;
+    *last_slash = '\0';
+
+    if (!strcmp(parent_path, root->path))
+        p_parent = root;
+    else if (strlen(parent_path) <= strlen(root->path))
+        return NULL;
+    else
+        p_parent = resume_get_task(tasks, root, parent_path, true);
+    if (p_parent == NULL)
+        return NULL;
+
+    if (lstat(path, &md) || !S_ISDIR(md.st_mode)) {
+        DisplayLog(LVL_EVENT, FSSCAN_TAG, "Cannot resume scan of '%s': "
+                   "not a directory anymore", path);
+        return NULL;
+    }
+
+    p_task = CreateTask();
+    if (p_task == NULL)
+        return NULL;
+
+    if (SetTaskName(p_task, rh_basename(path)) || SetTaskPath(p_task, path)
+        || path2id(path, &p_task->dir_id, &md)) {
+        FreeTask(p_task);
+        return NULL;
+    }
+    TaskSetStat(p_task, &md);
+    p_task->depth = p_parent->depth + 1;
+    p_task->task_finished = finished;
+    task_set_mdt(p_task, p_parent);
+
+    AddChildTask(p_parent, p_task);
+    g_hash_table_insert(tasks, p_task->path, p_task);
+    return p_task;
+}
+
+/**
+ * Remove tasks of parent directories that have no longer any sub-task
+ * (pending directory that disappeared).
+ */
+static void resume_prune(robinhood_task_t *p_task)
+{
+    robinhood_task_t *p_child, *p_next;
+
+    for (p_child = p_task->child_list; p_child != NULL; p_child = p_next) {
+        p_next = p_child->next_child;
+        if (!p_child->task_finished)
+            continue;
+
+        resume_prune(p_child);
+        if (p_child->child_list == NULL) {
+            RemoveChildTask(p_task, p_child);
+            FreeTask(p_child);
+        }
+    }
+}
+
+static gint cmp_paths(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/** set the subtree of a resumed task (and of its parents) */
+static struct scan_subtree *task_subtree(robinhood_task_t *p_task)
+{
+    if (p_task->depth == 0 || p_task->subtree != NULL)
+        return p_task->subtree;
+
+    if (p_task->depth == 1)
+        p_task->subtree = ScanProgress_Subtree(p_task->name);
+    else
+        p_task->subtree = task_subtree(p_task->parent_task);
+
+    return p_task->subtree;
+}
+
+/**
+ * Load the checkpoint of an interrupted scan, and build the tree of
+ * tasks to resume it.
+ * @param[out] pending  allocated array of tasks to be inserted in stack
+ * @return number of pending tasks, or a negative error code.
+ */
+static int load_checkpoint(robinhood_task_t *root, time_t *start_time,
+                           bool *first_scan, robinhood_task_t ***pending)
+{
+    char line[RBH_PATH_MAX + 64];
+    char value[RBH_PATH_MAX];
+    struct stat root_md;
+    GHashTable *tasks;
+    GPtrArray *paths;
+    unsigned int i;
+    FILE *f;
+    int count = 0, size = 0;
+    int rc;
+
+    f = fopen(fs_scan_config.scan_checkpoint_file, "r");
+    if (f == NULL)
+        return -errno;
+
+    if (fgets(line, sizeof(line), f) == NULL
+        || strcmp(strip_newline(line), CHECKPOINT_MAGIC)
+        || read_checkpoint_header(f, "fs_path", value, sizeof(value))
+        || strcmp(value, global_config.fs_path)) {
+        fclose(f);
+        return -EINVAL;
+    }
+
+    if (read_checkpoint_header(f, "start_time", value, sizeof(value))) {
+        fclose(f);
+        return -EINVAL;
+    }
+    *start_time = strtoul(value, NULL, 10);
+
+    if (read_checkpoint_header(f, "first_scan", value, sizeof(value))) {
+        fclose(f);
+        return -EINVAL;
+    }
+    *first_scan = (atoi(value) != 0);
+
+    /* the root directory is always read (for device and id) */
+    if (stat(root->path, &root_md)) {
+        rc = -errno;
+        fclose(f);
+        return rc;
+    }
+    if (check_entry_dev(root_md.st_dev, &fsdev, root->path, true))
+        root_md.st_dev = fsdev;
+    TaskSetStat(root, &root_md);
+    rc = path2id(root->path, &root->dir_id, &root_md);
+    if (rc) {
+        fclose(f);
+        return rc;
+    }
+    root->task_finished = true;
+
+    tasks = g_hash_table_new(g_str_hash, g_str_equal);
+    *pending = NULL;
+
+    /* sort paths, so parent directories are listed before their
+     * children */
+    paths = g_ptr_array_new_with_free_func(g_free);
+    while (fgets(line, sizeof(line), f) != NULL)
+        g_ptr_array_add(paths, g_strdup(strip_newline(line)));
+    fclose(f);
+    g_ptr_array_sort(paths, cmp_paths);
+
+    for (i = 0; i < paths->len; i++) {
+        const char *path = g_ptr_array_index(paths, i);
+        robinhood_task_t *p_task;
+
+        if (!strcmp(path, root->path))
+            /* the whole scan must be done again */
+            break;
+
+        p_task = resume_get_task(tasks, root, path, false);
+        if (p_task == NULL)
+            continue;
+
+        if (count >= size) {
+            size = size ? 2 * size : 256;
+            *pending = MemRealloc(*pending, size * sizeof(robinhood_task_t *));
+        }
+        (*pending)[count++] = p_task;
+    }
+    g_ptr_array_free(paths, TRUE);
+    g_hash_table_destroy(tasks);
+
+    resume_prune(root);
+
+    if (count == 0) {
+        /* nothing to resume: start from the root
+         * (no task is left in the tree after pruning) */
+        root->task_finished = false;
+        if (*pending)
+            MemFree(*pending);
+        *pending = NULL;
+        return 0;
+    }
+    return count;
+}
+
 static int StartScan(void)
 {
     robinhood_task_t *p_parent_task;
@@ -1593,6 +2948,10 @@ static int StartScan(void)
     lmgr_t lmgr;
     int no_db = 0;
     uint64_t count = 0LL;
+    robinhood_task_t **pending = NULL;
+    int nb_pending = 0;
+    bool resume_first_scan = false;
+    time_t resume_start = 0;
     int rc;
 
     /* Lock scanning status */
@@ -1634,14 +2993,50 @@ static int StartScan(void)
     }
 
     /* always start at the root to get info about parent dirs */
-    strcpy(p_parent_task->path, global_config.fs_path);
+    if (SetTaskName(p_parent_task, global_config.fs_path)
+        || BuildTaskPath(p_parent_task)) {
+        FreeTask(p_parent_task);
+        V(lock_scan);
+        DisplayLog(LVL_CRIT, FSSCAN_TAG, "ERROR setting path of scan task "
+                   "for %s", global_config.fs_path);
+        return -1;
+    }
     p_parent_task->depth = 0;
     p_parent_task->task_finished = false;
 
     /* set the mother task, and remember start time */
     root_task = p_parent_task;
-    scan_start_time = time(NULL);
+    scan_start_time = coarse_time();
     gettimeofday(&accurate_start_time, NULL);
+    last_checkpoint = scan_start_time;
+
+    /* resume an interrupted scan (only for the first scan) */
+    if (fsscan_flags & RUNFLG_RESUME) {
+        fsscan_flags &= ~RUNFLG_RESUME;
+
+        if (!checkpoint_enabled())
+            DisplayLog(LVL_MAJOR, FSSCAN_TAG, "WARNING: no scan checkpoint "
+                       "for %s scan: starting a new scan", partial_scan_root ?
+                       "partial" : "this");
+        else {
+            nb_pending = load_checkpoint(p_parent_task, &resume_start,
+                                         &resume_first_scan, &pending);
+            if (nb_pending < 0) {
+                DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Cannot resume scan from "
+                           "checkpoint %s: %s. Starting a new scan.",
+                           fs_scan_config.scan_checkpoint_file,
+                           strerror(-nb_pending));
+                nb_pending = 0;
+            } else if (nb_pending > 0) {
+                /* old entries are the ones not seen since the beginning
+                 * of the interrupted scan */
+                scan_start_time = resume_start;
+                DisplayLog(LVL_MAJOR, FSSCAN_TAG, "Resuming scan started "
+                           "at %lu: %d directories to be scanned",
+                           (unsigned long)resume_start, nb_pending);
+            }
+        }
+    }
 
     if (ListMgr_InitAccess(&lmgr) != DB_SUCCESS) {
         no_db = 1;
@@ -1649,7 +3044,7 @@ static int StartScan(void)
                    "WARNING: won't be able to update scan stats");
     }
 
-    if (!no_db) {
+    if (!no_db && nb_pending == 0) {
         /* archive previous scan start/end time */
         if (ListMgr_GetVar
             (&lmgr, LAST_SCAN_START_TIME, timestamp,
@@ -1659,7 +3054,9 @@ static int StartScan(void)
             (&lmgr, LAST_SCAN_END_TIME, timestamp,
              sizeof(timestamp)) == DB_SUCCESS)
             ListMgr_SetVar(&lmgr, PREV_SCAN_END_TIME, timestamp);
+    }
 
+    if (!no_db) {
         /* store current scan start time and status in db */
         sprintf(timestamp, "%lu", (unsigned long)scan_start_time);
         ListMgr_SetVar(&lmgr, LAST_SCAN_START_TIME, timestamp);
@@ -1671,12 +3068,19 @@ static int StartScan(void)
 
         /* check if it is the first scan (avoid RM_OLD_ENTRIES in this case) */
         is_first_scan = false;
-        rc = ListMgr_EntryCount(&lmgr, &count);
-
-        if ((rc == DB_SUCCESS) && (count == 0)) {
+        if (nb_pending > 0)
+            /* DB is partially filled by the interrupted scan */
+            is_first_scan = resume_first_scan;
+        else if (((rc = ListMgr_EntryCount(&lmgr, &count)) == DB_SUCCESS)
+                 && (count == 0)) {
             is_first_scan = true;
             DisplayLog(LVL_EVENT, FSSCAN_TAG,
                        "Notice: this is the first scan (DB is empty)");
+
+            /* other scan instances may be inserting entries too */
+            if (!scan_is_sharded()
+                && ListMgr_BulkLoadStart(&lmgr) == DB_SUCCESS)
+                bulk_load = true;
         } else if (rc)
             DisplayLog(LVL_MAJOR, FSSCAN_TAG,
                        "Failed to retrieve entry count from DB: error %d", rc);
@@ -1685,8 +3089,22 @@ static int StartScan(void)
                        "%" PRIu64 " entries in DB before starting the scan",
                        count);
 
+        /* expected entries: the ones in DB, shared between instances */
+        if (nb_pending > 0 && ListMgr_EntryCount(&lmgr, &count) != DB_SUCCESS)
+            count = 0;
+        ScanProgress_Start(&lmgr, subtree_counts_var(value, sizeof(value)),
+                           partial_scan_root ? 0 :
+                           count / fs_scan_config.scan_shards);
+        sprintf(value, "%" PRIu64, ScanProgress_Expected());
+        ListMgr_SetVar(&lmgr, LAST_SCAN_EXPECTED, value);
+
         ListMgr_CloseAccess(&lmgr);
-    }
+    } else
+        ScanProgress_Start(NULL, NULL, 0);
+
+    /* resumed tasks: set their subtree */
+    for (rc = 0; rc < nb_pending; rc++)
+        task_subtree(pending[rc]);
 
     /* reset threads stats */
     ResetScanStats(false);
@@ -1697,8 +3115,16 @@ static int StartScan(void)
     /* start batching alerts */
     Alert_StartBatching();
 
-    /* insert first task in stack */
-    InsertTask_to_Stack(&tasks_stack, p_parent_task);
+    if (nb_pending > 0) {
+        int i;
+
+        /* insert pending tasks of the interrupted scan */
+        for (i = 0; i < nb_pending; i++)
+            InsertTask_to_Stack(&tasks_stack, pending[i]);
+        MemFree(pending);
+    } else
+        /* insert first task in stack */
+        InsertTask_to_Stack(&tasks_stack, p_parent_task);
 
     /* indicates that a scan started in logs */
     FlushLogs();
@@ -1717,7 +3143,8 @@ static void *Thr_scan_recovery(void *arg_thread)
 
     thread_scan_info_t *p_info = (thread_scan_info_t *) arg_thread;
 
-    p_info->last_action = time(NULL);
+    prof_set_role(PROF_ROLE_SCAN, "recovery");
+    p_info->last_action = coarse_time();
 
     /* Initialize buddy management */
 #ifdef _BUDDY_MALLOC
@@ -1728,6 +3155,15 @@ static void *Thr_scan_recovery(void *arg_thread)
     }
 #endif
 
+    /* push the operations queued by the terminated thread */
+    scan_push_flush(p_info);
+
+    /* release the MDT slot of the terminated thread */
+    if (p_info->mdt_slot) {
+        p_info->mdt_slot = false;
+        TaskDone_in_Stack(&tasks_stack, p_info->current_task);
+    }
+
     /* terminate and free current task */
     st = RecursiveTaskTermination(p_info, p_info->current_task, false);
 
@@ -1987,12 +3423,28 @@ int Robinhood_CheckScanDeadlines(void)
             Exit(1);
         }
 
+        /* save scan progress */
+        Robinhood_CheckpointScan();
     }
     /* scan is running */
     return 0;
 
 }
 
+/**
+ * Test if the last scan was complete and all its directories could be read
+ * (so entries that were not seen can be removed).
+ */
+bool Robinhood_ScanAllowsGC(void)
+{
+    bool rc;
+
+    P(lock_scan);
+    rc = last_scan_complete && !scan_dir_error;
+    V(lock_scan);
+    return rc;
+}
+
 /**
  * Retrieve some statistics about current and terminated audits.
  * (called by the statistic collector)
@@ -2001,6 +3453,8 @@ int Robinhood_CheckScanDeadlines(void)
  */
 void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
 {
+    task_mem_stat_t mem_stats;
+
     /* lock scan info */
     P(lock_scan);
 
@@ -2008,6 +3462,17 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
     p_stats->last_duration = last_duration;
     p_stats->scan_complete = last_scan_complete;
     p_stats->current_scan_interval = scan_interval;
+    TaskStack_Stats(&tasks_stack, &p_stats->tasks_handled,
+                    &p_stats->tasks_stolen);
+    p_stats->dirs_skipped = nb_dirs_skipped;
+
+    p_stats->throttled = ScanThrottle_Enabled();
+    ScanThrottle_Stats(&p_stats->throttle_rate, &p_stats->throttle_latency_ms);
+
+    TasksMemInfo(&mem_stats);
+    p_stats->tasks_allocated = mem_stats.pool.nb_prealloc;
+    p_stats->tasks_mem = mem_stats.total_mem;
+    p_stats->tasks_full_mem = mem_stats.full_mem;
 
     if (root_task != NULL) {
         unsigned int i;
@@ -2058,6 +3523,22 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
         else
             p_stats->curr_ms_per_entry = 0.0;
 
+        /* progress and ETA, from the average speed since the beginning */
+        p_stats->expected_entries = ScanProgress_Expected();
+        p_stats->progress = 0.0;
+        p_stats->eta = 0;
+        if (p_stats->expected_entries > 0 && p_stats->scanned_entries > 0) {
+            time_t now = time(NULL);
+
+            p_stats->progress = MIN2(100.0, 100.0 * p_stats->scanned_entries
+                                     / p_stats->expected_entries);
+            if (p_stats->scanned_entries < p_stats->expected_entries
+                && now > scan_start_time)
+                p_stats->eta = now + (time_t)((double)(now - scan_start_time)
+                    * (p_stats->expected_entries - p_stats->scanned_entries)
+                    / p_stats->scanned_entries);
+        }
+
     } else {
         p_stats->scan_running = false;
         p_stats->start_time = 0;
@@ -2066,6 +3547,9 @@ void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats)
         p_stats->error_count = 0;
         p_stats->avg_ms_per_entry = 0.0;
         p_stats->curr_ms_per_entry = 0.0;
+        p_stats->expected_entries = 0;
+        p_stats->progress = 0.0;
+        p_stats->eta = 0;
     }
 
     p_stats->nb_hang = nb_hang_total;
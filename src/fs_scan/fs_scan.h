@@ -52,6 +52,32 @@ typedef struct robinhood_fsscan_stat__ {
     double          avg_ms_per_entry;
     double          curr_ms_per_entry;
 
+    /* task scheduling */
+    unsigned long long tasks_handled;
+    unsigned long long tasks_stolen;
+
+    /* incremental scan: directories not read */
+    unsigned int    dirs_skipped;
+
+    /* progress of the current scan, compared to the previous one:
+     * expected entries (0 if unknown), percentage and estimated
+     * end time (0 if unknown) */
+    uint64_t        expected_entries;
+    double          progress;
+    time_t          eta;
+
+    /* scan throttling: current budget (ops/sec, 0 = unlimited)
+     * and average latency of scan operations */
+    bool            throttled;
+    double          throttle_rate;
+    double          throttle_latency_ms;
+
+    /* memory used by scan tasks, and memory they would use
+     * with embedded full paths */
+    unsigned int    tasks_allocated;
+    uint64_t        tasks_mem;
+    uint64_t        tasks_full_mem;
+
 } robinhood_fsscan_stat_t;
 
 /**
@@ -84,6 +110,13 @@ void wait_scan_finished(void);
  */
 int Robinhood_CheckScanDeadlines(void);
 
+/**
+ * Save the progress of the current scan if it's time
+ * (see scan_checkpoint_interval).
+ * Return ENOENT if no scan is running.
+ */
+int Robinhood_CheckpointScan(void);
+
 /**
  * Retrieve some statistics about current and terminated audits.
  * (called by the statistic collector)
@@ -92,4 +125,21 @@ int Robinhood_CheckScanDeadlines(void);
  */
 void Robinhood_StatsScan(robinhood_fsscan_stat_t *p_stats);
 
+/**
+ * Test if the last scan was complete and all its directories could be read.
+ */
+bool Robinhood_ScanAllowsGC(void);
+
+/**
+ * Start refreshing outdated entries in background
+ * (see db_update_params::refresh_rate).
+ */
+int Robinhood_StartRefresh(void);
+
+/** Stop the background refresh and wait for its termination. */
+void Robinhood_StopRefresh(void);
+
+/** Dump background refresh stats to the log. */
+void Robinhood_DumpRefreshStats(void);
+
 #endif
@@ -24,42 +24,79 @@
 #include "rbh_misc.h"
 #include "rbh_logs.h"
 #include "rbh_cfg_helpers.h"
+#include "rbh_metrics.h"
+#include "rbh_affinity.h"
+#include "rbh_evloop.h"
+#include "scan_progress.h"
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
+#include <inttypes.h>
 
-static pthread_t scan_starter_thread;
-static pthread_attr_t starter_attr;
+static int scan_spooler_timer = 0;
 static bool terminate = false;
 
-/* Scan starter thread */
-static void *scan_starter(void *arg)
+/* Scan spooler (event loop timer) */
+static unsigned int scan_spooler(void *arg)
 {
+    static bool started = false;
     int rc;
 
-    DisplayLog(LVL_VERB, FSSCAN_TAG, "Launching FS Scan starter thread");
+    if (terminate)
+        return 0;
 
-    if (fsscan_flags & RUNFLG_ONCE) {
+    if (!started || !(fsscan_flags & RUNFLG_ONCE)) {
+        started = true;
         rc = Robinhood_CheckScanDeadlines();
         if (rc)
             DisplayLog(LVL_CRIT, FSSCAN_TAG, "Error %d checking FS Scan status",
                        rc);
-        pthread_exit(NULL);
-        return NULL;
+
+        /* one-shot mode: save the progress of the scan until it ends */
+        if ((fsscan_flags & RUNFLG_ONCE)
+            && EMPTY_STRING(fs_scan_config.scan_checkpoint_file))
+            return 0;
+    } else if (Robinhood_CheckpointScan() != 0) {
+        /* the scan ended */
+        return 0;
     }
 
-    /* not a one-shot mode */
-    while (!terminate) {
-        rc = Robinhood_CheckScanDeadlines();
-        if (rc)
-            DisplayLog(LVL_CRIT, FSSCAN_TAG, "Error %d checking FS Scan status",
-                       rc);
+    /* next check */
+    return 1000 * fs_scan_config.spooler_check_interval;
+}
 
-        /* attente de la boucle suivante */
-        rh_sleep(fs_scan_config.spooler_check_interval);
-    }
+/** export scan stats to the metrics endpoint */
+static void fsscan_metrics_collect(metrics_out_t *out, void *arg)
+{
+    robinhood_fsscan_stat_t stats;
+
+    Robinhood_StatsScan(&stats);
 
-    return NULL;
+    metrics_family(out, "scan_running", METRIC_GAUGE,
+                   "Whether a filesystem scan is running");
+    metrics_value(out, NULL, stats.scan_running ? 1 : 0);
+    metrics_family(out, "scan_last_end_time", METRIC_GAUGE,
+                   "End time of the last scan (seconds since the Epoch)");
+    metrics_value(out, NULL, stats.last_fsscan_time);
+    metrics_family(out, "scan_last_duration_seconds", METRIC_GAUGE,
+                   "Duration of the last scan");
+    metrics_value(out, NULL, stats.last_duration);
+    metrics_family(out, "scan_last_complete", METRIC_GAUGE,
+                   "Whether the last scan completed");
+    metrics_value(out, NULL, stats.scan_complete ? 1 : 0);
+    metrics_family(out, "scan_entries", METRIC_GAUGE,
+                   "Entries scanned by the current scan");
+    metrics_value(out, NULL, stats.scanned_entries);
+    metrics_family(out, "scan_errors", METRIC_GAUGE,
+                   "Errors of the current scan");
+    metrics_value(out, NULL, stats.error_count);
+    metrics_family(out, "scan_progress_ratio", METRIC_GAUGE,
+                   "Progress of the current scan, compared to the previous "
+                   "one (0 to 1)");
+    metrics_value(out, NULL, stats.progress / 100.0);
+    metrics_family(out, "scan_tasks_memory_bytes", METRIC_GAUGE,
+                   "Memory used by scan tasks");
+    metrics_value(out, NULL, stats.tasks_mem);
 }
 
 /** Start FS Scan info collector */
@@ -86,18 +123,45 @@ int FSScan_Start(run_flags_t flags, const char *partial_root)
     if (rc)
         return rc;
 
-    /* start a background thread */
+    metrics_register(fsscan_metrics_collect, NULL);
 
-    pthread_attr_init(&starter_attr);
-    pthread_attr_setscope(&starter_attr, PTHREAD_SCOPE_SYSTEM);
+    /* check scan deadlines periodically (first check immediately) */
+    rc = evloop_timer_add(0, EVLOOP_OFFLOAD, scan_spooler, NULL);
+    if (rc < 0)
+        return -rc;
+    scan_spooler_timer = rc;
 
-    if (pthread_create(&scan_starter_thread, &starter_attr, scan_starter,
-                       NULL))
-        return errno;
+    /* daemon mode: refresh outdated entries between scans */
+    if (!(flags & RUNFLG_ONCE) && partial_root == NULL) {
+        rc = Robinhood_StartRefresh();
+        if (rc)
+            return rc;
+    }
 
+    DisplayLog(LVL_VERB, FSSCAN_TAG, "FS Scan spooler started");
     return 0;
 }
 
+void FSScan_SetShard(unsigned int index, unsigned int count,
+                     unsigned int depth)
+{
+    fs_scan_config.scan_shards = count;
+    fs_scan_config.scan_shard_index = index;
+    fs_scan_config.scan_shard_depth = depth;
+}
+
+unsigned int FSScan_SetThreads(unsigned int count)
+{
+    if (count > 0)
+        fs_scan_config.nb_threads_scan = count;
+    return fs_scan_config.nb_threads_scan;
+}
+
+bool FSScan_Complete(void)
+{
+    return Robinhood_ScanAllowsGC();
+}
+
 /** Wait for scan termination */
 void FSScan_Wait(void)
 {
@@ -109,9 +173,42 @@ void FSScan_Terminate(void)
 {   /* @TODO */
     terminate = true;
 
+    /* wait for a running check */
+    if (scan_spooler_timer > 0)
+        evloop_timer_remove(scan_spooler_timer);
+
+    Robinhood_StopRefresh();
     Robinhood_StopScanModule();
 }
 
+/* max number of subtrees displayed in stats */
+#define STATS_SUBTREES  10
+
+/** store the progress of the subtrees being scanned */
+static void store_pending_subtrees(lmgr_t *lmgr)
+{
+    scan_subtree_stat_t tab[STATS_SUBTREES];
+    char value[MAX_VAR_LEN];
+    unsigned int i, count;
+    size_t len = 0;
+
+    count = ScanProgress_Pending(tab, STATS_SUBTREES);
+
+    value[0] = '\0';
+    for (i = 0; i < count; i++) {
+        int n = snprintf(value + len, sizeof(value) - len,
+                         "%" PRIu64 ":%" PRIu64 ":%s/",
+                         tab[i].scanned, tab[i].expected, tab[i].name);
+
+        if (n < 0 || len + n >= sizeof(value)) {
+            value[len] = '\0';
+            break;
+        }
+        len += n;
+    }
+    ListMgr_SetVar(lmgr, LAST_SCAN_SUBTREES, value);
+}
+
 /** Store FS Scan into database */
 void FSScan_StoreStats(lmgr_t *lmgr)
 {
@@ -140,6 +237,7 @@ void FSScan_StoreStats(lmgr_t *lmgr)
             sprintf(tmp_buff, "%.2f", stats.curr_ms_per_entry);
             ListMgr_SetVar(lmgr, LAST_SCAN_CURMSPE, tmp_buff);
         }
+        store_pending_subtrees(lmgr);
     }
     sprintf(tmp_buff, "%u", stats.nb_hang);
     ListMgr_SetVar(lmgr, LAST_SCAN_TIMEOUTS, tmp_buff);
@@ -222,12 +320,85 @@ void FSScan_DumpStats(void)
                                                                   start_time),
                            stats.avg_ms_per_entry);
         }
+
+        if (stats.expected_entries > 0) {
+            scan_subtree_stat_t tab[STATS_SUBTREES];
+            unsigned int i, count;
+
+            if (stats.eta > now) {
+                strftime(tmp_buff, 256, "%Y/%m/%d %T",
+                         localtime_r(&stats.eta, &paramtm));
+                FormatDurationFloat(tmp_buff2, 256, stats.eta - now);
+                DisplayLog(LVL_MAJOR, "STATS",
+                           "     estimate   : %.1f%% of %" PRIu64
+                           " entries, ETA: %s (in %s)", stats.progress,
+                           stats.expected_entries, tmp_buff, tmp_buff2);
+            } else
+                DisplayLog(LVL_MAJOR, "STATS",
+                           "     estimate   : %.1f%% of %" PRIu64
+                           " entries", stats.progress,
+                           stats.expected_entries);
+
+            count = ScanProgress_Pending(tab, STATS_SUBTREES);
+            for (i = 0; i < count; i++) {
+                if (tab[i].expected > 0)
+                    DisplayLog(LVL_MAJOR, "STATS",
+                               "     subtree %-20s: %" PRIu64 "/%" PRIu64
+                               " entries (%.1f%%)", tab[i].name,
+                               tab[i].scanned, tab[i].expected,
+                               MIN2(100.0, 100.0 * tab[i].scanned
+                                    / tab[i].expected));
+                else
+                    DisplayLog(LVL_MAJOR, "STATS",
+                               "     subtree %-20s: %" PRIu64
+                               " entries (new)", tab[i].name, tab[i].scanned);
+            }
+        }
     }
 
     if (stats.nb_hang > 0)
         DisplayLog(LVL_MAJOR, "STATS", "scan operation timeouts = %u",
                    stats.nb_hang);
 
+    if (stats.throttled) {
+        if (stats.throttle_rate > 0.0)
+            snprintf(tmp_buff, sizeof(tmp_buff), "%.0f ops/sec",
+                     stats.throttle_rate);
+        else
+            strcpy(tmp_buff, "unlimited");
+
+        DisplayLog(LVL_MAJOR, "STATS",
+                   "scan rate budget = %s (op latency: %.2f ms, target: %u ms)",
+                   tmp_buff, stats.throttle_latency_ms,
+                   fs_scan_config.scan_target_latency);
+    }
+
+    if (!EMPTY_STRING(fs_scan_config.cpu_affinity)) {
+        affinity_describe(fs_scan_config.cpu_affinity, tmp_buff,
+                          sizeof(tmp_buff));
+        DisplayLog(LVL_MAJOR, "STATS", "scan thread affinity = %s (%s)",
+                   fs_scan_config.cpu_affinity, tmp_buff);
+    }
+
+    if (stats.dirs_skipped > 0)
+        DisplayLog(LVL_MAJOR, "STATS", "unchanged directories not read = %u",
+                   stats.dirs_skipped);
+
+    if (stats.tasks_allocated > 0) {
+        FormatFileSize(tmp_buff, 256, stats.tasks_mem);
+        FormatFileSize(tmp_buff2, 256, stats.tasks_full_mem - stats.tasks_mem);
+        DisplayLog(LVL_MAJOR, "STATS", "task memory = %s for %u tasks "
+                   "(%s saved by compact tasks)", tmp_buff,
+                   stats.tasks_allocated, tmp_buff2);
+    }
+
+    if (stats.tasks_handled > 0)
+        DisplayLog(LVL_MAJOR, "STATS", "directory tasks = %llu (%.1f%% stolen "
+                   "by idle threads)", stats.tasks_handled,
+                   100.0 * stats.tasks_stolen / stats.tasks_handled);
+
+    Robinhood_DumpRefreshStats();
+
 }
 
 /* ------------ Config management functions --------------- */
@@ -254,8 +425,25 @@ static void fs_scan_cfg_set_default(void *module_config)
 #endif
     conf->scan_retry_delay = HOUR;
     conf->nb_threads_scan = 2;
+    conf->cpu_affinity[0] = '\0';
     conf->scan_op_timeout = 0;
     conf->exit_on_timeout = false;
+    conf->incremental_scan = INCR_SCAN_NONE;
+    conf->dir_split_threshold = 0;
+    conf->dir_batch_size = 10000;
+    conf->mdt_max_threads = 0;
+    conf->stat_ahead = STATAHEAD_NONE;
+    conf->stat_ahead_threads = 4;
+    conf->scan_max_rate = 0;
+    conf->scan_min_rate = 100;
+    conf->scan_target_latency = 0;
+    conf->scan_rate_schedule = NULL;
+    conf->scan_rate_schedule_count = 0;
+    conf->scan_shards = 1;
+    conf->scan_shard_index = 0;
+    conf->scan_shard_depth = 1;
+    conf->scan_checkpoint_file[0] = '\0';
+    conf->scan_checkpoint_interval = 10 * MINUTE;
     conf->spooler_check_interval = MINUTE;
     conf->nb_prealloc_tasks = 256;
 
@@ -276,8 +464,24 @@ static void fs_scan_cfg_write_default(FILE *output)
 #endif
     print_line(output, 1, "scan_retry_delay       :    1h");
     print_line(output, 1, "nb_threads_scan        :     2");
+    print_line(output, 1, "cpu_affinity           :    \"\" (any CPU)");
     print_line(output, 1, "scan_op_timeout        :     0 (disabled)");
     print_line(output, 1, "exit_on_timeout        :    no");
+    print_line(output, 1, "incremental_scan       :    no");
+    print_line(output, 1, "dir_split_threshold    :     0 (disabled)");
+    print_line(output, 1, "dir_batch_size         : 10000");
+    print_line(output, 1, "mdt_max_threads        :     0 (disabled)");
+    print_line(output, 1, "stat_ahead             :    no");
+    print_line(output, 1, "stat_ahead_threads     :     4");
+    print_line(output, 1, "scan_max_rate          :     0 (unlimited)");
+    print_line(output, 1, "scan_min_rate          :   100");
+    print_line(output, 1, "scan_target_latency    :     0 (disabled)");
+    print_line(output, 1, "scan_rate_schedule     :    \"\" (none)");
+    print_line(output, 1, "scan_shards            :     1 (not distributed)");
+    print_line(output, 1, "scan_shard_index       :     0");
+    print_line(output, 1, "scan_shard_depth       :     1");
+    print_line(output, 1, "scan_checkpoint_file   :    \"\" (disabled)");
+    print_line(output, 1, "scan_checkpoint_interval : 10min");
     print_line(output, 1, "spooler_check_interval :  1min");
     print_line(output, 1, "nb_prealloc_tasks      :   256");
     print_line(output, 1, "ignore                 :  NONE");
@@ -292,6 +496,97 @@ static void fs_scan_cfg_write_default(FILE *output)
                  }\
             } while (0)
 
+static const char *incr_scan2str(incr_scan_mode_e mode)
+{
+    switch (mode) {
+    case INCR_SCAN_NONE:
+        return "no";
+    case INCR_SCAN_DIR_MTIME:
+        return "dir_mtime";
+    case INCR_SCAN_CHANGELOG:
+        return "changelog";
+    }
+    return "?";
+}
+
+static const char *stat_ahead2str(statahead_mode_e mode)
+{
+    switch (mode) {
+    case STATAHEAD_NONE:
+        return "no";
+    case STATAHEAD_THREADS:
+        return "threads";
+    case STATAHEAD_IO_URING:
+        return "io_uring";
+    }
+    return "?";
+}
+
+/**
+ * Parse a list of time-of-day rate profiles:
+ * "HH:MM-HH:MM=<max_rate>[, ...]" (max_rate=0 for unlimited).
+ */
+static int parse_rate_schedule(const char *str, scan_rate_slot_t **p_slots,
+                               unsigned int *p_count, char *msg_out)
+{
+    char *buf, *tok, *saveptr = NULL;
+    scan_rate_slot_t *slots = NULL;
+    unsigned int count = 0;
+
+    buf = strdup(str);
+    if (buf == NULL)
+        return ENOMEM;
+
+    for (tok = strtok_r(buf, ",", &saveptr); tok != NULL;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        unsigned int h1, m1, h2, m2, rate;
+        scan_rate_slot_t *tmp;
+        char extra;
+
+        if (sscanf(tok, " %u:%u - %u:%u = %u %c", &h1, &m1, &h2, &m2,
+                   &rate, &extra) != 5
+            || h1 > 24 || h2 > 24 || m1 > 59 || m2 > 59
+            || h1 * 60 + m1 > 24 * 60 || h2 * 60 + m2 > 24 * 60) {
+            sprintf(msg_out, "Invalid item in scan_rate_schedule: '%s' "
+                    "(expected: HH:MM-HH:MM=<ops/sec>)", tok);
+            goto err;
+        }
+
+        tmp = realloc(slots, (count + 1) * sizeof(*slots));
+        if (tmp == NULL) {
+            strcpy(msg_out, "Cannot allocate memory");
+            goto err;
+        }
+        slots = tmp;
+        slots[count].start = h1 * 60 + m1;
+        slots[count].end = h2 * 60 + m2;
+        slots[count].max_rate = rate;
+        count++;
+    }
+
+    free(buf);
+    *p_slots = slots;
+    *p_count = count;
+    return 0;
+
+ err:
+    free(buf);
+    free(slots);
+    return EINVAL;
+}
+
+static bool rate_schedule_cmp(const fs_scan_config_t *c1,
+                              const fs_scan_config_t *c2)
+{
+    if (c1->scan_rate_schedule_count != c2->scan_rate_schedule_count)
+        return true;
+    if (c1->scan_rate_schedule_count == 0)
+        return false;
+    return memcmp(c1->scan_rate_schedule, c2->scan_rate_schedule,
+                  c1->scan_rate_schedule_count
+                  * sizeof(scan_rate_slot_t)) != 0;
+}
+
 static int fs_scan_cfg_read(config_file_t config, void *module_config,
                             char *msg_out)
 {
@@ -300,23 +595,57 @@ static int fs_scan_cfg_read(config_file_t config, void *module_config,
     bool scan_intl_set = false;
     time_t scan_intl = 0;
     config_item_t fsscan_block;
+    char tmpstr[128];
+    char schedstr[1024];
 
     static const char *fsscan_allowed[] = {
         "scan_interval", "min_scan_interval", "max_scan_interval",
-        "scan_retry_delay", "nb_threads_scan", "scan_op_timeout",
+        "scan_retry_delay", "nb_threads_scan", "cpu_affinity",
+        "scan_op_timeout",
         "exit_on_timeout", "spooler_check_interval", "nb_prealloc_tasks",
-        "completion_command",
+        "completion_command", "incremental_scan", "dir_split_threshold",
+        "dir_batch_size", "mdt_max_threads", "stat_ahead",
+        "stat_ahead_threads",
+        "scan_max_rate", "scan_min_rate", "scan_target_latency",
+        "scan_rate_schedule", "scan_shards",
+        "scan_shard_index", "scan_shard_depth", "scan_checkpoint_file",
+        "scan_checkpoint_interval",
         IGNORE_BLOCK, NULL
     };
 
     const cfg_param_t cfg_params[] = {
         {"nb_threads_scan", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->nb_threads_scan, 0},
+        {"cpu_affinity", PT_STRING, PFLG_NO_WILDCARDS, conf->cpu_affinity,
+         sizeof(conf->cpu_affinity)},
         {"scan_retry_delay", PT_DURATION, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->scan_retry_delay, 0},
         {"scan_op_timeout", PT_DURATION, PFLG_POSITIVE, &conf->scan_op_timeout,
          0},
         {"exit_on_timeout", PT_BOOL, 0, &conf->exit_on_timeout, 0},
+        {"dir_split_threshold", PT_INT, PFLG_POSITIVE,
+         &conf->dir_split_threshold, 0},
+        {"dir_batch_size", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->dir_batch_size, 0},
+        {"mdt_max_threads", PT_INT, PFLG_POSITIVE, &conf->mdt_max_threads, 0},
+        {"stat_ahead_threads", PT_INT, PFLG_POSITIVE,
+         &conf->stat_ahead_threads, 0},
+        {"scan_max_rate", PT_INT, PFLG_POSITIVE, &conf->scan_max_rate, 0},
+        {"scan_min_rate", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->scan_min_rate, 0},
+        {"scan_target_latency", PT_INT, PFLG_POSITIVE,
+         &conf->scan_target_latency, 0},
+        {"scan_shards", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->scan_shards, 0},
+        {"scan_shard_index", PT_INT, PFLG_POSITIVE, &conf->scan_shard_index,
+         0},
+        {"scan_shard_depth", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->scan_shard_depth, 0},
+        {"scan_checkpoint_file", PT_STRING, PFLG_ABSOLUTE_PATH
+         | PFLG_NO_WILDCARDS, conf->scan_checkpoint_file,
+         sizeof(conf->scan_checkpoint_file)},
+        {"scan_checkpoint_interval", PT_DURATION,
+         PFLG_POSITIVE | PFLG_NOT_NULL, &conf->scan_checkpoint_interval, 0},
         {"spooler_check_interval", PT_DURATION, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->spooler_check_interval, 0},
         {"nb_prealloc_tasks", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
@@ -338,6 +667,19 @@ static int fs_scan_cfg_read(config_file_t config, void *module_config,
     if (rc)
         return rc;
 
+    if (affinity_check(conf->cpu_affinity)) {
+        sprintf(msg_out, "Invalid value for cpu_affinity: '%s' (expected: "
+                "CPU list like '0-7,16-23', or 'node:<list>')",
+                conf->cpu_affinity);
+        return EINVAL;
+    }
+
+    if (conf->scan_shard_index >= conf->scan_shards) {
+        sprintf(msg_out, "scan_shard_index (%u) must be lower than "
+                "scan_shards (%u)", conf->scan_shard_index, conf->scan_shards);
+        return EINVAL;
+    }
+
     /* parameters with specific management */
     rc = GetDurationParam(fsscan_block, FSSCAN_CONFIG_BLOCK,
                           "min_scan_interval", PFLG_POSITIVE | PFLG_NOT_NULL,
@@ -370,6 +712,63 @@ static int fs_scan_cfg_read(config_file_t config, void *module_config,
         conf->max_scan_interval = scan_intl;
     }
 
+    rc = GetStringParam(fsscan_block, FSSCAN_CONFIG_BLOCK, "incremental_scan",
+                        PFLG_NO_WILDCARDS, tmpstr, sizeof(tmpstr), NULL, NULL,
+                        msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    else if (rc == 0) {
+        if (!strcasecmp(tmpstr, "no") || !strcasecmp(tmpstr, "none"))
+            conf->incremental_scan = INCR_SCAN_NONE;
+        else if (!strcasecmp(tmpstr, "dir_mtime")
+                 || !strcasecmp(tmpstr, "yes"))
+            conf->incremental_scan = INCR_SCAN_DIR_MTIME;
+        else if (!strcasecmp(tmpstr, "changelog")) {
+#ifndef HAVE_CHANGELOGS
+            strcpy(msg_out, "incremental_scan = changelog requires "
+                   "changelog support");
+            return EINVAL;
+#else
+            conf->incremental_scan = INCR_SCAN_CHANGELOG;
+#endif
+        } else {
+            sprintf(msg_out, "Invalid value for incremental_scan: '%s' "
+                    "(expected: no, dir_mtime or changelog)", tmpstr);
+            return EINVAL;
+        }
+    }
+
+    rc = GetStringParam(fsscan_block, FSSCAN_CONFIG_BLOCK, "stat_ahead",
+                        PFLG_NO_WILDCARDS, tmpstr, sizeof(tmpstr), NULL, NULL,
+                        msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    else if (rc == 0) {
+        if (!strcasecmp(tmpstr, "no") || !strcasecmp(tmpstr, "none"))
+            conf->stat_ahead = STATAHEAD_NONE;
+        else if (!strcasecmp(tmpstr, "threads"))
+            conf->stat_ahead = STATAHEAD_THREADS;
+        else if (!strcasecmp(tmpstr, "io_uring"))
+            conf->stat_ahead = STATAHEAD_IO_URING;
+        else {
+            sprintf(msg_out, "Invalid value for stat_ahead: '%s' "
+                    "(expected: no, threads or io_uring)", tmpstr);
+            return EINVAL;
+        }
+    }
+
+    rc = GetStringParam(fsscan_block, FSSCAN_CONFIG_BLOCK,
+                        "scan_rate_schedule", PFLG_NO_WILDCARDS, schedstr,
+                        sizeof(schedstr), NULL, NULL, msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    else if (rc == 0) {
+        rc = parse_rate_schedule(schedstr, &conf->scan_rate_schedule,
+                                 &conf->scan_rate_schedule_count, msg_out);
+        if (rc)
+            return rc;
+    }
+
     /* Find and parse "ignore" blocks */
     for (blc_index = 0; blc_index < rh_config_GetNbItems(fsscan_block);
          blc_index++) {
@@ -511,6 +910,62 @@ static int fs_scan_cfg_reload(fs_scan_config_t *conf)
         fs_scan_config.exit_on_timeout = conf->exit_on_timeout;
     }
 
+    if (conf->incremental_scan != fs_scan_config.incremental_scan) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::incremental_scan updated: %s->%s",
+                   incr_scan2str(fs_scan_config.incremental_scan),
+                   incr_scan2str(conf->incremental_scan));
+        fs_scan_config.incremental_scan = conf->incremental_scan;
+    }
+
+    if (conf->scan_checkpoint_interval
+        != fs_scan_config.scan_checkpoint_interval) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::scan_checkpoint_interval updated: %ld->%ld",
+                   fs_scan_config.scan_checkpoint_interval,
+                   conf->scan_checkpoint_interval);
+        fs_scan_config.scan_checkpoint_interval =
+            conf->scan_checkpoint_interval;
+    }
+
+    if (conf->dir_split_threshold != fs_scan_config.dir_split_threshold) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::dir_split_threshold updated: %u->%u",
+                   fs_scan_config.dir_split_threshold,
+                   conf->dir_split_threshold);
+        fs_scan_config.dir_split_threshold = conf->dir_split_threshold;
+    }
+
+    if (conf->dir_batch_size != fs_scan_config.dir_batch_size) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::dir_batch_size updated: %u->%u",
+                   fs_scan_config.dir_batch_size, conf->dir_batch_size);
+        fs_scan_config.dir_batch_size = conf->dir_batch_size;
+    }
+
+    if (conf->scan_max_rate != fs_scan_config.scan_max_rate) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::scan_max_rate updated: %u->%u",
+                   fs_scan_config.scan_max_rate, conf->scan_max_rate);
+        fs_scan_config.scan_max_rate = conf->scan_max_rate;
+    }
+
+    if (conf->scan_min_rate != fs_scan_config.scan_min_rate) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::scan_min_rate updated: %u->%u",
+                   fs_scan_config.scan_min_rate, conf->scan_min_rate);
+        fs_scan_config.scan_min_rate = conf->scan_min_rate;
+    }
+
+    if (conf->scan_target_latency != fs_scan_config.scan_target_latency) {
+        DisplayLog(LVL_EVENT, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK "::scan_target_latency updated: %u->%u",
+                   fs_scan_config.scan_target_latency,
+                   conf->scan_target_latency);
+        fs_scan_config.scan_target_latency = conf->scan_target_latency;
+    }
+
     if (conf->spooler_check_interval != fs_scan_config.spooler_check_interval) {
         DisplayLog(LVL_EVENT, "FS_Scan_Config",
                    FSSCAN_CONFIG_BLOCK
@@ -531,11 +986,46 @@ static int fs_scan_cfg_reload(fs_scan_config_t *conf)
 
     /* Parameters that canNOT be modified dynamically */
 
+    if (rate_schedule_cmp(conf, &fs_scan_config))
+        DisplayLog(LVL_MAJOR, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::scan_rate_schedule changed in config file, but cannot be modified dynamically");
+
     if (conf->nb_threads_scan != fs_scan_config.nb_threads_scan)
         DisplayLog(LVL_MAJOR, "FS_Scan_Config",
                    FSSCAN_CONFIG_BLOCK
                    "::nb_threads_scan changed in config file, but cannot be modified dynamically");
 
+    if (strcmp(conf->cpu_affinity, fs_scan_config.cpu_affinity))
+        DisplayLog(LVL_MAJOR, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::cpu_affinity changed in config file, but cannot be modified dynamically");
+
+    if (conf->scan_shards != fs_scan_config.scan_shards
+        || conf->scan_shard_index != fs_scan_config.scan_shard_index
+        || conf->scan_shard_depth != fs_scan_config.scan_shard_depth)
+        DisplayLog(LVL_MAJOR, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::scan_shard* parameters changed in config file, but cannot be modified dynamically");
+
+    if (conf->mdt_max_threads != fs_scan_config.mdt_max_threads)
+        DisplayLog(LVL_MAJOR, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::mdt_max_threads changed in config file, but cannot be modified dynamically");
+
+    if (conf->stat_ahead != fs_scan_config.stat_ahead
+        || conf->stat_ahead_threads != fs_scan_config.stat_ahead_threads)
+        DisplayLog(LVL_MAJOR, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::stat_ahead parameters changed in config file, but cannot be modified dynamically (current: %s, %u threads)",
+                   stat_ahead2str(fs_scan_config.stat_ahead),
+                   fs_scan_config.stat_ahead_threads);
+
+    if (strcmp(conf->scan_checkpoint_file, fs_scan_config.scan_checkpoint_file))
+        DisplayLog(LVL_MAJOR, "FS_Scan_Config",
+                   FSSCAN_CONFIG_BLOCK
+                   "::scan_checkpoint_file changed in config file, but cannot be modified dynamically");
+
     if (conf->nb_prealloc_tasks != fs_scan_config.nb_prealloc_tasks)
         DisplayLog(LVL_MAJOR, "FS_Scan_Config",
                    FSSCAN_CONFIG_BLOCK
@@ -585,6 +1075,9 @@ static void fs_scan_cfg_write_template(FILE *output)
     print_line(output, 1,
                "# number of threads used for scanning the filesystem");
     print_line(output, 1, "nb_threads_scan        =     2 ;");
+    print_line(output, 1,
+               "# bind scan threads to CPUs (e.g. \"0-7\") or NUMA nodes (\"node:0\")");
+    print_line(output, 1, "#cpu_affinity           =    \"node:0\" ;");
     fprintf(output, "\n");
     print_line(output, 1,
                "# when a scan fails, this is the delay before retrying");
@@ -594,6 +1087,72 @@ static void fs_scan_cfg_write_template(FILE *output)
     print_line(output, 1, "scan_op_timeout        =    1h ;");
     print_line(output, 1, "# exit if operation timeout is reached?");
     print_line(output, 1, "exit_on_timeout        =    yes ;");
+    print_line(output, 1,
+               "# don't read directories whose mtime/ctime did not change since");
+    print_line(output, 1,
+               "# last scan (dir_mtime). Their entries are only marked as seen,");
+    print_line(output, 1,
+               "# so file changes that don't modify them are missed.");
+#ifdef HAVE_CHANGELOGS
+    print_line(output, 1,
+               "# 'changelog' also skips their subtrees, and relies on changelogs");
+    print_line(output, 1,
+               "# for entry updates and removals (no cleaning of old entries).");
+    print_line(output, 1, "#incremental_scan       =    changelog ;");
+#else
+    print_line(output, 1, "#incremental_scan       =    dir_mtime ;");
+#endif
+    print_line(output, 1,
+               "# split huge directories: entries after the first");
+    print_line(output, 1,
+               "# dir_split_threshold ones are processed by other scan threads");
+    print_line(output, 1, "# (by batches of dir_batch_size entries)");
+    print_line(output, 1, "#dir_split_threshold    =  100000 ;");
+    print_line(output, 1, "#dir_batch_size         =   10000 ;");
+    print_line(output, 1,
+               "# DNE: queue directories by MDT, and limit the number of scan");
+    print_line(output, 1,
+               "# threads working on each MDT, so a busy MDT does not hold");
+    print_line(output, 1, "# all the scan threads (0 = disabled)");
+    print_line(output, 1, "#mdt_max_threads        =     4 ;");
+    print_line(output, 1,
+               "# stat entries read from a directory asynchronously, to hide");
+    print_line(output, 1,
+               "# the latency of each stat (no, threads or io_uring).");
+    print_line(output, 1,
+               "# stat_ahead_threads helper threads are started (also used");
+    print_line(output, 1, "# as a fallback when io_uring is unavailable).");
+    print_line(output, 1, "#stat_ahead             =    io_uring ;");
+    print_line(output, 1, "#stat_ahead_threads     =     4 ;");
+    print_line(output, 1,
+               "# limit the rate of scan operations (readdir, stat), and adapt");
+    print_line(output, 1,
+               "# it to keep their latency close to scan_target_latency (ms)");
+    print_line(output, 1, "#scan_max_rate          =  5000 ;");
+    print_line(output, 1, "#scan_min_rate          =   100 ;");
+    print_line(output, 1, "#scan_target_latency    =     5 ;");
+    print_line(output, 1,
+               "# max rate for time-of-day ranges (0 = unlimited)");
+    print_line(output, 1,
+               "#scan_rate_schedule     =    \"08:00-20:00=1000, 20:00-08:00=0\" ;");
+    print_line(output, 1,
+               "# distribute the scan between several robinhood instances");
+    print_line(output, 1,
+               "# (sharing the same database). Directories at scan_shard_depth");
+    print_line(output, 1,
+               "# are distributed between instances according to their path.");
+    print_line(output, 1,
+               "# Old entries are cleaned when all instances completed a scan.");
+    print_line(output, 1, "#scan_shards            =     4 ;");
+    print_line(output, 1, "#scan_shard_index       =     0 ;");
+    print_line(output, 1, "#scan_shard_depth       =     1 ;");
+    print_line(output, 1,
+               "# periodically save the progress of scans, so an interrupted");
+    print_line(output, 1,
+               "# scan can be resumed (see --resume option)");
+    print_line(output, 1,
+               "#scan_checkpoint_file   =    \"/var/lib/robinhood/scan.ckpt\" ;");
+    print_line(output, 1, "#scan_checkpoint_interval = 10min ;");
     print_line(output, 1, "# external command called on scan termination");
     print_line(output, 1,
                "# special arguments can be specified: {cfg} = config file path,");
@@ -632,6 +1191,7 @@ static void fs_scan_cfg_free(void *cfg)
         /* free conf structure */
         if (conf->ignore_list != NULL)
             free_ignore(conf->ignore_list, conf->ignore_count);
+        free(conf->scan_rate_schedule);
     }
 }
 
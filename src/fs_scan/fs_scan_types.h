@@ -24,20 +24,54 @@
 #include <sys/stat.h>
 #include <stdbool.h>
 
+/* attributes of a directory to be scanned
+ * (the subset of struct stat that is needed to update it in DB) */
+typedef struct task_stat__ {
+    mode_t          mode;
+    uid_t           uid;
+    gid_t           gid;
+    unsigned int    nlink;
+    off_t           size;
+    blkcnt_t        blocks;
+    time_t          atime;
+    time_t          mtime;
+    time_t          ctime;
+} task_stat_t;
+
+/* chunk of memory holding task names */
+struct task_name_chunk;
+
 /* a scanning task */
 
 typedef struct robinhood_task__ {
-    /* absolute path of the directory to be read */
-    char            path[RBH_PATH_MAX];
+    /* name of the directory to be read, relative to its parent
+     * (absolute path for the root task). Allocated in a name chunk. */
+    char                   *name;
+    struct task_name_chunk *name_chunk;
+
+    /* absolute path of the directory to be read.
+     * NULL until the task is processed (see BuildTaskPath). */
+    char           *path;
 
     /* the relative depth of the directory to be read */
     unsigned int    depth;
 
+    /* index of the MDT holding the directory (MDT-aware scheduling) */
+    unsigned int    mdt_index;
+
     /* id of this directory */
     entry_id_t      dir_id;
 
     /* metadatas of this directory */
-    struct stat     dir_md;
+    task_stat_t     dir_md;
+
+    /* top-level directory this task belongs to (progress accounting) */
+    struct scan_subtree *subtree;
+
+    /* huge directory split: names of the directory entries to be
+     * processed by this task (NULL if the task reads the directory) */
+    char           *batch_names;
+    unsigned int    batch_count;
 
     /* parent task */
     struct robinhood_task__ *parent_task;
@@ -78,19 +112,61 @@ typedef struct robinhood_task__ {
  */
 #define MAX_TASK_DEPTH  255
 
-/* A stack of tasks ordered by depth,
- * handled by 'task_stack_mngmt' routines.
+/* A deque of tasks ordered by depth, owned by a scan thread.
+ * The owner takes the deepest tasks (depth first scan), while other
+ * threads steal the shallowest ones (which are likely to generate
+ * more work).
  */
-typedef struct tasks_stack__ {
-    pthread_mutex_t     stack_lock; /* lock on the stack */
-    sem_t               sem_tasks;  /* token for available tasks */
+typedef struct task_deque__ {
+    pthread_mutex_t     deque_lock;
 
-    /* Indicates the depth for the first task available */
+    /* number of tasks in the deque */
+    unsigned int        count;
+
+    /* depth of the shallowest and deepest tasks available */
+    unsigned int        min_task_depth;
     unsigned int        max_task_depth;
 
     /* list of tasks, ordered by depth */
     robinhood_task_t   *tasks_at_depth[MAX_TASK_DEPTH + 1];
 
+    /* stats: tasks taken by the owner / stolen by other threads */
+    unsigned long long  nb_local;
+    unsigned long long  nb_stolen;
+
+} task_deque_t;
+
+/* A work-stealing stack of tasks, with one deque per scan thread,
+ * handled by 'task_stack_mngmt' routines.
+ * With MDT-aware scheduling, there is one set of deques per MDT, and the
+ * number of threads processing tasks of each MDT can be limited.
+ */
+typedef struct tasks_stack__ {
+    /* deques per MDT */
+    unsigned int        nb_deques;
+    /* deques of MDT i are deques[i * nb_deques] to
+     * deques[(i + 1) * nb_deques - 1] */
+    task_deque_t       *deques;
+
+    /* per-MDT task queues */
+    unsigned int        nb_mdts;
+    /* max threads processing tasks of a MDT (0 = unlimited) */
+    unsigned int        mdt_max_threads;
+    /* tasks available for each MDT */
+    volatile unsigned int *mdt_tasks;
+    /* threads processing a task of each MDT */
+    volatile unsigned int *mdt_running;
+
+    /* total number of tasks available */
+    volatile unsigned int nb_tasks;
+    /* number of threads waiting for a task */
+    volatile unsigned int nb_idle;
+    /* idle threads wait for this semaphore */
+    sem_t               sem_tasks;
+
+    /* target deque for tasks inserted by other threads */
+    unsigned int        next_deque;
+
 } task_stack_t;
 
 #endif
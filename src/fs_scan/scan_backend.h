@@ -0,0 +1,58 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Directory and attribute accessors used by the scan to read the namespace.
+ * The default backend issues system calls to the filesystem. Others are
+ * used for benchmarking (e.g. a synthetic tree in memory).
+ *
+ * The filesystem root itself is always accessed by system calls
+ * (device id, root id), as well as the paths of resumed or incremental
+ * scans.
+ */
+
+#ifndef _SCAN_BACKEND_H
+#define _SCAN_BACKEND_H
+
+#include "fs_scan_main.h"
+#include "statahead.h"
+#include <stddef.h>
+
+struct scan_backend {
+    const char *name;
+
+    /** open a directory for reading.
+     * @return a handle >= 0, or -1 and set errno */
+    int (*dir_open)(const char *path);
+
+    /** read directory entries to buf, as linux_dirent64 records.
+     * @return the number of bytes read, 0 at end of directory,
+     *         or -1 and set errno */
+    int (*getdents)(int dirfd, char *buf, size_t size);
+
+    /** close a directory handle */
+    int (*dir_close)(int dirfd);
+
+    /** get attributes of a directory entry, relative to the parent
+     * handle (by path if parentfd is -1). @return 0 or -errno */
+    stat_func_t stat_entry;
+
+    /** get the id of an entry from its parent handle and name (or from
+     * its path if parentfd is -1). @return 0 or a non-zero error code */
+    int (*entry_id)(int parentfd, const char *name, const char *path,
+                    const struct stat *st, entry_id_t *id);
+
+    /** entries can be accessed by the filesystem API
+     * (e.g. Lustre stripes) */
+    bool real_fs;
+};
+
+#endif
@@ -0,0 +1,288 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2007, 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Scan progress per subtree.
+ *
+ * Entries scanned are accounted to the top-level directory they belong to.
+ * At the end of a complete scan, the entry counts of the biggest subtrees
+ * are saved in a DB variable (as a list of "<count>:<name>/"),
+ * to estimate the progress of the next scan.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "scan_progress.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#define PROGRESS_TAG "ScanProgress"
+
+struct scan_subtree {
+    char           *name;
+    uint64_t        scanned;    /* atomic */
+    uint64_t        expected;   /* entry count from the previous scan */
+    bool            started;
+    bool            done;
+};
+
+static pthread_mutex_t prog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* name -> struct scan_subtree */
+static GHashTable *subtrees = NULL;
+
+static uint64_t expected_total = 0;
+
+static void subtree_free(gpointer p)
+{
+    struct scan_subtree *subtree = p;
+
+    g_free(subtree->name);
+    MemFree(subtree);
+}
+
+/* (prog_lock must be held) */
+static struct scan_subtree *subtree_new(const char *name)
+{
+    struct scan_subtree *subtree = MemAlloc(sizeof(*subtree));
+
+    if (subtree == NULL)
+        return NULL;
+
+    subtree->name = g_strdup(name);
+    subtree->scanned = 0;
+    subtree->expected = 0;
+    subtree->started = false;
+    subtree->done = false;
+    g_hash_table_insert(subtrees, subtree->name, subtree);
+    return subtree;
+}
+
+/** parse the entry counts saved by the previous scan */
+static void load_counts(const char *varname, const char *value)
+{
+    const char *curr = value;
+
+    while (*curr != '\0') {
+        char name[RBH_NAME_MAX + 1];
+        struct scan_subtree *subtree;
+        const char *end;
+        char *colon;
+        uint64_t count;
+        size_t len;
+
+        count = strtoull(curr, &colon, 10);
+        end = strchr(curr, '/');
+        if (*colon != ':' || end == NULL || end <= colon) {
+            DisplayLog(LVL_MAJOR, PROGRESS_TAG, "Invalid value of DB "
+                       "variable %s: '%s'", varname, value);
+            return;
+        }
+
+        len = MIN2(end - colon - 1, RBH_NAME_MAX);
+        memcpy(name, colon + 1, len);
+        name[len] = '\0';
+
+        subtree = subtree_new(name);
+        if (subtree != NULL)
+            subtree->expected = count;
+
+        curr = end + 1;
+    }
+}
+
+void ScanProgress_Start(lmgr_t *lmgr, const char *varname, uint64_t expected)
+{
+    char value[MAX_VAR_LEN];
+
+    P(prog_lock);
+    /* tasks of the previous scan have been freed */
+    if (subtrees != NULL)
+        g_hash_table_destroy(subtrees);
+    subtrees = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                     subtree_free);
+    expected_total = expected;
+
+    if (lmgr != NULL && ListMgr_GetVar(lmgr, varname, value,
+                                       sizeof(value)) == DB_SUCCESS)
+        load_counts(varname, value);
+    V(prog_lock);
+}
+
+/* sort by decreasing entry count */
+static gint cmp_scanned(gconstpointer a, gconstpointer b)
+{
+    const struct scan_subtree *s1 = *(struct scan_subtree * const *)a;
+    const struct scan_subtree *s2 = *(struct scan_subtree * const *)b;
+
+    if (s1->scanned == s2->scanned)
+        return 0;
+    return (s1->scanned > s2->scanned) ? -1 : 1;
+}
+
+void ScanProgress_Save(lmgr_t *lmgr, const char *varname)
+{
+    char value[MAX_VAR_LEN];
+    GHashTableIter iter;
+    gpointer key, val;
+    GPtrArray *list;
+    size_t len = 0;
+    unsigned int i;
+
+    P(prog_lock);
+    if (subtrees == NULL) {
+        V(prog_lock);
+        return;
+    }
+
+    list = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, subtrees);
+    while (g_hash_table_iter_next(&iter, &key, &val)) {
+        struct scan_subtree *subtree = val;
+
+        if (subtree->started)
+            g_ptr_array_add(list, subtree);
+    }
+
+    /* the biggest subtrees are the useful ones to estimate progress */
+    g_ptr_array_sort(list, cmp_scanned);
+
+    value[0] = '\0';
+    for (i = 0; i < list->len; i++) {
+        struct scan_subtree *subtree = g_ptr_array_index(list, i);
+        int n;
+
+        n = snprintf(value + len, sizeof(value) - len, "%" PRIu64 ":%s/",
+                     subtree->scanned, subtree->name);
+        if (n < 0 || len + n >= sizeof(value)) {
+            /* does not fit: truncate after the previous item */
+            value[len] = '\0';
+            break;
+        }
+        len += n;
+    }
+    g_ptr_array_free(list, TRUE);
+    V(prog_lock);
+
+    ListMgr_SetVar(lmgr, varname, value);
+}
+
+struct scan_subtree *ScanProgress_Subtree(const char *name)
+{
+    struct scan_subtree *subtree;
+
+    P(prog_lock);
+    if (subtrees == NULL) {
+        V(prog_lock);
+        return NULL;
+    }
+
+    subtree = g_hash_table_lookup(subtrees, name);
+    if (subtree == NULL)
+        subtree = subtree_new(name);
+    if (subtree != NULL)
+        subtree->started = true;
+    V(prog_lock);
+
+    return subtree;
+}
+
+void ScanProgress_Add(struct scan_subtree *subtree, unsigned int nb_entries)
+{
+    if (subtree != NULL)
+        __sync_fetch_and_add(&subtree->scanned, nb_entries);
+}
+
+void ScanProgress_Done(struct scan_subtree *subtree)
+{
+    if (subtree == NULL)
+        return;
+
+    P(prog_lock);
+    subtree->done = true;
+    V(prog_lock);
+
+    DisplayLog(LVL_FULL, PROGRESS_TAG, "Subtree '%s' scanned: %" PRIu64
+               " entries (%" PRIu64 " in previous scan)", subtree->name,
+               subtree->scanned, subtree->expected);
+}
+
+uint64_t ScanProgress_Expected(void)
+{
+    return expected_total;
+}
+
+static inline uint64_t remaining(const struct scan_subtree *subtree)
+{
+    return (subtree->expected > subtree->scanned) ?
+        subtree->expected - subtree->scanned : 0;
+}
+
+/* sort by decreasing remaining entries, then by entry count */
+static gint cmp_remaining(gconstpointer a, gconstpointer b)
+{
+    const struct scan_subtree *s1 = *(struct scan_subtree * const *)a;
+    const struct scan_subtree *s2 = *(struct scan_subtree * const *)b;
+    uint64_t r1 = remaining(s1);
+    uint64_t r2 = remaining(s2);
+
+    if (r1 != r2)
+        return (r1 > r2) ? -1 : 1;
+    return cmp_scanned(a, b);
+}
+
+unsigned int ScanProgress_Pending(scan_subtree_stat_t *tab, unsigned int max)
+{
+    GHashTableIter iter;
+    gpointer key, val;
+    GPtrArray *list;
+    unsigned int i, count;
+
+    P(prog_lock);
+    if (subtrees == NULL) {
+        V(prog_lock);
+        return 0;
+    }
+
+    list = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, subtrees);
+    while (g_hash_table_iter_next(&iter, &key, &val)) {
+        struct scan_subtree *subtree = val;
+
+        if (subtree->started && !subtree->done)
+            g_ptr_array_add(list, subtree);
+    }
+    g_ptr_array_sort(list, cmp_remaining);
+
+    count = MIN2(list->len, max);
+    for (i = 0; i < count; i++) {
+        struct scan_subtree *subtree = g_ptr_array_index(list, i);
+
+        rh_strncpy(tab[i].name, subtree->name, sizeof(tab[i].name));
+        tab[i].scanned = subtree->scanned;
+        tab[i].expected = subtree->expected;
+    }
+    g_ptr_array_free(list, TRUE);
+    V(prog_lock);
+
+    return count;
+}
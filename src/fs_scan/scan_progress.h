@@ -0,0 +1,69 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2007, 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Scan progress per top-level directory (subtree), compared to the
+ * entry counts of the previous scan.
+ */
+
+#ifndef _SCAN_PROGRESS_H
+#define _SCAN_PROGRESS_H
+
+#include "list_mgr.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* progress of a subtree (opaque) */
+struct scan_subtree;
+
+typedef struct scan_subtree_stat {
+    char            name[RBH_NAME_MAX + 1];
+    uint64_t        scanned;
+    uint64_t        expected;   /* 0 if unknown */
+} scan_subtree_stat_t;
+
+/**
+ * Reset progress information at the beginning of a scan.
+ * @param expected  expected number of entries for the whole scan
+ *                  (0 if unknown).
+ * Entry counts of the previous scan are loaded from the given DB
+ * variable (if lmgr is not NULL).
+ */
+void ScanProgress_Start(lmgr_t *lmgr, const char *varname, uint64_t expected);
+
+/**
+ * Save the entry counts of subtrees in a DB variable at the end
+ * of a scan, so they can be used by the next scan.
+ */
+void ScanProgress_Save(lmgr_t *lmgr, const char *varname);
+
+/** get (or create) the subtree of the given top-level directory */
+struct scan_subtree *ScanProgress_Subtree(const char *name);
+
+/** account entries scanned in a subtree (NULL for the root directory) */
+void ScanProgress_Add(struct scan_subtree *subtree, unsigned int nb_entries);
+
+/** mark the scan of a subtree as complete */
+void ScanProgress_Done(struct scan_subtree *subtree);
+
+/** expected number of entries for the whole scan (0 if unknown) */
+uint64_t ScanProgress_Expected(void);
+
+/**
+ * Get the subtrees being scanned that have the most remaining entries
+ * (by decreasing number of remaining entries).
+ * @return the number of subtrees filled in.
+ */
+unsigned int ScanProgress_Pending(scan_subtree_stat_t *tab, unsigned int max);
+
+#endif
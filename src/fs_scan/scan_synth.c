@@ -0,0 +1,385 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Synthetic scan backend: a namespace generated in memory, to benchmark
+ * the scan and the pipeline independently of the storage.
+ *
+ * The tree is regular: each directory above the max depth has 'width'
+ * sub-directories "dir.<i>", and all directories have 'files' files
+ * "file.<j>". Entries are identified by the path of their directory,
+ * so nothing is stored, whatever the size of the tree.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fs_scan_main.h"
+#include "fs_scan.h"
+#include "scan_backend.h"
+#include "global_config.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYNTH_TAG "ScanSynth"
+
+#define SYNTH_DIR_PREFIX    "dir."
+#define SYNTH_FILE_PREFIX   "file."
+
+/* first inode number of synthetic entries */
+#define SYNTH_INO_BASE      1024ULL
+/* max number of entries of the tree */
+#define SYNTH_MAX_ENTRIES   (1ULL << 40)
+/* max number of directories open at once */
+#define SYNTH_MAX_HANDLES   4096
+
+static synth_tree_params_t synth;
+/* number of directories (including root) */
+static unsigned long long synth_dirs;
+static dev_t synth_dev;
+static time_t synth_time;
+
+/* open directory handles: a scan thread only reads its own directory,
+ * so the lock only protects handle allocation */
+struct synth_dir {
+    unsigned long long node;    /* directory number (0 for root) */
+    unsigned int depth;
+    unsigned int pos;           /* next entry to be read */
+    bool used;
+};
+
+static struct synth_dir handles[SYNTH_MAX_HANDLES];
+static pthread_mutex_t handle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned long long ScanSynth_DirCount(const synth_tree_params_t *params)
+{
+    unsigned long long count = 1, level = 1;
+    unsigned int i;
+
+    for (i = 0; i < params->depth; i++) {
+        level *= params->width;
+        count += level;
+        if (level > SYNTH_MAX_ENTRIES || count > SYNTH_MAX_ENTRIES)
+            return 0;
+    }
+    return count;
+}
+
+/** parse an entry name "<prefix><index>". @return -1 if it doesn't match */
+static long long parse_index(const char *name, const char *prefix,
+                             unsigned int max, const char **end)
+{
+    size_t len = strlen(prefix);
+    unsigned long idx;
+    char *next;
+
+    if (strncmp(name, prefix, len) || name[len] < '0' || name[len] > '9')
+        return -1;
+    idx = strtoul(name + len, &next, 10);
+    if (idx >= max)
+        return -1;
+    if (end != NULL)
+        *end = next;
+    else if (*next != '\0')
+        return -1;
+    return idx;
+}
+
+/** get the directory number and depth from a path */
+static int synth_lookup(const char *path, unsigned long long *node,
+                        unsigned int *depth)
+{
+    size_t len = strlen(global_config.fs_path);
+    const char *curr;
+
+    if (strncmp(path, global_config.fs_path, len)
+        || (path[len] != '/' && path[len] != '\0'))
+        return -ENOENT;
+
+    *node = 0;
+    *depth = 0;
+    for (curr = path + len; *curr == '/';) {
+        long long idx;
+
+        if (*depth >= synth.depth)
+            return -ENOENT;
+        idx = parse_index(curr + 1, SYNTH_DIR_PREFIX, synth.width, &curr);
+        if (idx < 0 || (*curr != '/' && *curr != '\0'))
+            return -ENOENT;
+
+        *node = *node * synth.width + idx + 1;
+        (*depth)++;
+    }
+    return *curr == '\0' ? 0 : -ENOENT;
+}
+
+static void synth_fill_stat(unsigned long long ino, bool dir,
+                            struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_dev = synth_dev;
+    st->st_ino = ino;
+    st->st_uid = ino % 137;
+    st->st_gid = st->st_uid / 8;
+    st->st_blksize = 4096;
+    if (dir) {
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2 + synth.width;
+        /* like a real directory, grows with its entries */
+        st->st_size = 4096 + 32ULL * (synth.width + synth.files);
+    } else {
+        st->st_mode = S_IFREG | 0644;
+        st->st_nlink = 1;
+        st->st_size = (ino % 1024) * 4096;
+    }
+    st->st_blocks = st->st_size / 512;
+    st->st_atime = synth_time - (ino % 86400);
+    st->st_mtime = st->st_atime;
+    st->st_ctime = st->st_atime;
+}
+
+/** stat an entry of the given directory */
+static int synth_stat_child(unsigned long long node, unsigned int depth,
+                            const char *name, struct stat *st)
+{
+    long long idx;
+
+    if (depth < synth.depth) {
+        idx = parse_index(name, SYNTH_DIR_PREFIX, synth.width, NULL);
+        if (idx >= 0) {
+            synth_fill_stat(SYNTH_INO_BASE + node * synth.width + idx + 1,
+                            true, st);
+            return 0;
+        }
+    }
+
+    idx = parse_index(name, SYNTH_FILE_PREFIX, synth.files, NULL);
+    if (idx < 0)
+        return -ENOENT;
+
+    synth_fill_stat(SYNTH_INO_BASE + synth_dirs + node * synth.files + idx,
+                    false, st);
+    return 0;
+}
+
+static struct synth_dir *synth_handle(int fd)
+{
+    if (fd < 0 || fd >= SYNTH_MAX_HANDLES || !handles[fd].used)
+        return NULL;
+    return &handles[fd];
+}
+
+static int synth_dir_open(const char *path)
+{
+    unsigned long long node;
+    unsigned int depth;
+    int fd, rc;
+
+    rc = synth_lookup(path, &node, &depth);
+    if (rc) {
+        errno = -rc;
+        return -1;
+    }
+
+    P(handle_lock);
+    for (fd = 0; fd < SYNTH_MAX_HANDLES; fd++)
+        if (!handles[fd].used)
+            break;
+    if (fd == SYNTH_MAX_HANDLES) {
+        V(handle_lock);
+        errno = EMFILE;
+        return -1;
+    }
+    handles[fd].node = node;
+    handles[fd].depth = depth;
+    handles[fd].pos = 0;
+    handles[fd].used = true;
+    V(handle_lock);
+
+    return fd;
+}
+
+static int synth_dir_close(int fd)
+{
+    struct synth_dir *h = synth_handle(fd);
+
+    if (h == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    P(handle_lock);
+    h->used = false;
+    V(handle_lock);
+    return 0;
+}
+
+/** the entries of a directory are: ".", "..", sub-directories, files */
+static int synth_getdents(int fd, char *buf, size_t size)
+{
+    struct synth_dir *h = synth_handle(fd);
+    unsigned int nb_dirs, nb_entries;
+    size_t off = 0;
+
+    if (h == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    nb_dirs = h->depth < synth.depth ? synth.width : 0;
+    nb_entries = 2 + nb_dirs + synth.files;
+
+    while (h->pos < nb_entries) {
+        struct dirent64 *dp = (struct dirent64 *)(buf + off);
+        char name[32];
+        unsigned long long ino;
+        unsigned char type;
+        size_t reclen;
+
+        if (h->pos < 2) {
+            strcpy(name, h->pos == 0 ? "." : "..");
+            ino = SYNTH_INO_BASE + h->node;
+            type = DT_DIR;
+        } else if (h->pos < 2 + nb_dirs) {
+            sprintf(name, SYNTH_DIR_PREFIX "%u", h->pos - 2);
+            ino = SYNTH_INO_BASE + h->node * synth.width + h->pos - 1;
+            type = DT_DIR;
+        } else {
+            sprintf(name, SYNTH_FILE_PREFIX "%u", h->pos - 2 - nb_dirs);
+            ino = SYNTH_INO_BASE + synth_dirs + h->node * synth.files
+                  + h->pos - 2 - nb_dirs;
+            type = DT_REG;
+        }
+
+        /* records are 8 bytes aligned */
+        reclen = (offsetof(struct dirent64, d_name) + strlen(name) + 8) & ~7;
+        if (off + reclen > size)
+            break;
+
+        dp->d_ino = ino;
+        dp->d_off = h->pos + 1;
+        dp->d_reclen = reclen;
+        dp->d_type = type;
+        strcpy(dp->d_name, name);
+
+        off += reclen;
+        h->pos++;
+    }
+
+    if (off == 0 && h->pos < nb_entries) {
+        /* buffer too small */
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (off > 0 && synth.readdir_usec > 0)
+        usleep(synth.readdir_usec);
+
+    return off;
+}
+
+static int synth_stat(const char *path, const char *name, int parentfd,
+                      struct stat *inode)
+{
+    unsigned long long node;
+    unsigned int depth;
+    int rc;
+
+    if (synth.stat_usec > 0)
+        usleep(synth.stat_usec);
+
+    if (parentfd != -1) {
+        struct synth_dir *h = synth_handle(parentfd);
+
+        if (h == NULL)
+            return -EBADF;
+        return synth_stat_child(h->node, h->depth, name, inode);
+    } else {
+        char parent[RBH_PATH_MAX];
+        char *last_slash;
+
+        rh_strncpy(parent, path, sizeof(parent));
+        last_slash = strrchr(parent, '/');
+        if (last_slash == NULL)
+            return -ENOENT;
+        *last_slash = '\0';
+
+        rc = synth_lookup(parent, &node, &depth);
+        if (rc)
+            return rc;
+        return synth_stat_child(node, depth, last_slash + 1, inode);
+    }
+}
+
+static int synth_entry_id(int parentfd, const char *name, const char *path,
+                          const struct stat *st, entry_id_t *id)
+{
+    if (st == NULL)
+        return -EINVAL;
+
+    memset(id, 0, sizeof(*id));
+#ifdef _HAVE_FID
+    /* use a sequence that is not used by real entries */
+    id->f_seq = 0x2FFF00000ULL + ((unsigned long long)st->st_ino >> 32);
+    id->f_oid = (uint32_t)st->st_ino;
+    id->f_ver = 0;
+#else
+    id->inode = st->st_ino;
+    id->fs_key = get_fskey();
+    id->validator = st->st_ctime;
+#endif
+    return 0;
+}
+
+static const struct scan_backend synth_backend = {
+    .name = "synthetic",
+    .dir_open = synth_dir_open,
+    .getdents = synth_getdents,
+    .dir_close = synth_dir_close,
+    .stat_entry = synth_stat,
+    .entry_id = synth_entry_id,
+    .real_fs = false,
+};
+
+const struct scan_backend *ScanSynth_Backend(const synth_tree_params_t *
+                                             params)
+{
+    unsigned long long dirs = ScanSynth_DirCount(params);
+
+    if (dirs == 0 || (params->depth > 0 && params->width == 0)
+        || dirs * (1ULL + params->files) > SYNTH_MAX_ENTRIES) {
+        DisplayLog(LVL_CRIT, SYNTH_TAG, "Synthetic tree is too large "
+                   "(depth=%u, width=%u, files=%u): max %llu entries",
+                   params->depth, params->width, params->files,
+                   SYNTH_MAX_ENTRIES);
+        return NULL;
+    }
+
+    synth = *params;
+    synth_dirs = dirs;
+    synth_dev = get_fsdev();
+    synth_time = time(NULL);
+
+    DisplayLog(LVL_EVENT, SYNTH_TAG, "Synthetic tree under %s: depth=%u, "
+               "width=%u, files/dir=%u (%llu directories, %llu files)",
+               global_config.fs_path, synth.depth, synth.width, synth.files,
+               synth_dirs, synth_dirs * synth.files);
+
+    return &synth_backend;
+}
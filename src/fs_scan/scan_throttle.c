@@ -0,0 +1,227 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2007, 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Adaptive throttling of scan operations.
+ *
+ * All scan threads share a budget of operations per second, enforced
+ * by a token bucket. Every second, the budget is adjusted according to
+ * the latency of the operations, compared to scan_target_latency:
+ * it is decreased multiplicatively when the latency is above the target,
+ * and increased when it is below. The budget always stays between
+ * scan_min_rate and the max rate of the current time-of-day profile
+ * (scan_rate_schedule), or scan_max_rate out of the profiles.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fs_scan.h"
+#include "scan_throttle.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define THROTTLE_TAG "ScanThrottle"
+
+/* interval between 2 budget adjustments (usec) */
+#define THROTTLE_PERIOD     1000000
+/* tolerance around the target latency */
+#define THROTTLE_HIGH       1.1
+#define THROTTLE_LOW        0.9
+/* budget variation factors */
+#define THROTTLE_DECREASE   0.75
+#define THROTTLE_INCREASE   1.1
+/* the bucket holds at most 100ms worth of operations */
+#define THROTTLE_BURST      0.1
+
+static pthread_mutex_t th_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* current budget (ops/sec, 0 = unlimited) */
+static double th_rate = 0.0;
+static double th_tokens = 0.0;
+static struct timeval th_last_refill = { 0, 0 };
+
+/* measurements of the current period */
+static struct timeval th_period_start = { 0, 0 };
+static unsigned long long th_lat_sum = 0;   /* usec */
+static unsigned int th_lat_count = 0;
+static unsigned int th_ops = 0;
+
+/* average latency of operations (ms) */
+static double th_latency = 0.0;
+
+static inline double tv_diff_usec(const struct timeval *end,
+                                  const struct timeval *start)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000.0
+        + (end->tv_usec - start->tv_usec);
+}
+
+bool ScanThrottle_Enabled(void)
+{
+    return fs_scan_config.scan_max_rate != 0
+        || fs_scan_config.scan_target_latency != 0
+        || fs_scan_config.scan_rate_schedule_count != 0;
+}
+
+/** max rate at the given time of day (0 = unlimited) */
+static unsigned int rate_ceiling(time_t now)
+{
+    struct tm date;
+    unsigned int i, minute;
+
+    if (fs_scan_config.scan_rate_schedule_count == 0)
+        return fs_scan_config.scan_max_rate;
+
+    localtime_r(&now, &date);
+    minute = date.tm_hour * 60 + date.tm_min;
+
+    for (i = 0; i < fs_scan_config.scan_rate_schedule_count; i++) {
+        const scan_rate_slot_t *slot = &fs_scan_config.scan_rate_schedule[i];
+        bool match;
+
+        if (slot->start <= slot->end)
+            match = (minute >= slot->start && minute < slot->end);
+        else    /* range over midnight */
+            match = (minute >= slot->start || minute < slot->end);
+
+        if (match)
+            return slot->max_rate;
+    }
+    return fs_scan_config.scan_max_rate;
+}
+
+/** adjust the budget at the end of a period (th_lock must be held) */
+static void throttle_adjust(const struct timeval *now)
+{
+    double elapsed = tv_diff_usec(now, &th_period_start);
+    double observed, rate = th_rate;
+    unsigned int ceiling = rate_ceiling(now->tv_sec);
+    unsigned int target = fs_scan_config.scan_target_latency;
+
+    observed = (elapsed > 0) ? (1000000.0 * th_ops / elapsed) : 0.0;
+
+    if (th_lat_count > 0) {
+        double lat = (double)th_lat_sum / th_lat_count / 1000.0;
+
+        th_latency = (th_latency == 0.0) ? lat : 0.7 * th_latency + 0.3 * lat;
+
+        if (target != 0) {
+            if (lat > THROTTLE_HIGH * target) {
+                /* start from the current rate if there was no limit */
+                rate = ((rate == 0.0) ? observed : rate) * THROTTLE_DECREASE;
+            } else if (lat < THROTTLE_LOW * target && rate != 0.0) {
+                /* don't increase a budget that is not reached */
+                if (rate < 2.0 * observed)
+                    rate *= THROTTLE_INCREASE;
+            }
+        }
+    }
+
+    if (target == 0)
+        rate = ceiling;
+    else {
+        if (rate != 0.0 && rate < fs_scan_config.scan_min_rate)
+            rate = fs_scan_config.scan_min_rate;
+        if (ceiling != 0 && (rate == 0.0 || rate > ceiling))
+            rate = ceiling;
+    }
+
+    if ((unsigned int)rate != (unsigned int)th_rate)
+        DisplayLog(LVL_DEBUG, THROTTLE_TAG, "Scan rate budget: %.0f -> %.0f "
+                   "ops/sec (latency=%.2fms, observed rate=%.0f ops/sec)",
+                   th_rate, rate, th_latency, observed);
+    th_rate = rate;
+
+    th_period_start = *now;
+    th_lat_sum = 0;
+    th_lat_count = 0;
+    th_ops = 0;
+}
+
+/* (th_lock must be held) */
+static void throttle_check_period(const struct timeval *now)
+{
+    if (th_period_start.tv_sec == 0) {
+        th_period_start = *now;
+        /* initial budget */
+        th_rate = rate_ceiling(now->tv_sec);
+        return;
+    }
+    if (tv_diff_usec(now, &th_period_start) >= THROTTLE_PERIOD)
+        throttle_adjust(now);
+}
+
+void ScanThrottle_Acquire(unsigned int nb_ops)
+{
+    struct timeval now;
+    double wait_usec = 0.0;
+
+    if (!ScanThrottle_Enabled())
+        return;
+
+    gettimeofday(&now, NULL);
+
+    pthread_mutex_lock(&th_lock);
+    throttle_check_period(&now);
+
+    if (th_rate != 0.0) {
+        double burst = MAX2(1.0, th_rate * THROTTLE_BURST);
+
+        if (th_last_refill.tv_sec != 0)
+            th_tokens += th_rate * tv_diff_usec(&now, &th_last_refill)
+                / 1000000.0;
+        if (th_tokens > burst)
+            th_tokens = burst;
+        th_last_refill = now;
+
+        /* reserve the tokens, and wait for the deficit to be refilled */
+        th_tokens -= nb_ops;
+        if (th_tokens < 0.0)
+            wait_usec = -th_tokens * 1000000.0 / th_rate;
+    } else
+        th_last_refill = now;
+    pthread_mutex_unlock(&th_lock);
+
+    if (wait_usec >= 1.0)
+        rh_usleep((useconds_t)wait_usec);
+}
+
+void ScanThrottle_Record(unsigned int nb_ops, const struct timeval *start)
+{
+    struct timeval now;
+
+    if (!ScanThrottle_Enabled())
+        return;
+
+    gettimeofday(&now, NULL);
+
+    pthread_mutex_lock(&th_lock);
+    th_lat_sum += (unsigned long long)MAX2(0.0, tv_diff_usec(&now, start));
+    th_lat_count++;
+    th_ops += nb_ops;
+    throttle_check_period(&now);
+    pthread_mutex_unlock(&th_lock);
+}
+
+void ScanThrottle_Stats(double *rate, double *latency_ms)
+{
+    pthread_mutex_lock(&th_lock);
+    *rate = th_rate;
+    *latency_ms = th_latency;
+    pthread_mutex_unlock(&th_lock);
+}
@@ -0,0 +1,46 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2007, 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Adaptive throttling of the filesystem operations issued by scans
+ * (readdir, stat), driven by their latency.
+ */
+
+#ifndef _SCAN_THROTTLE_H
+#define _SCAN_THROTTLE_H
+
+#include <sys/time.h>
+#include <stdbool.h>
+
+/**
+ * Wait until nb_ops operations are allowed by the current rate budget.
+ * Returns immediately if throttling is disabled.
+ */
+void ScanThrottle_Acquire(unsigned int nb_ops);
+
+/**
+ * Account nb_ops operations issued concurrently at 'start'
+ * (they are considered as a single latency sample).
+ */
+void ScanThrottle_Record(unsigned int nb_ops, const struct timeval *start);
+
+/** is scan throttling configured? */
+bool ScanThrottle_Enabled(void);
+
+/**
+ * Get the current rate budget (ops/sec, 0 = unlimited)
+ * and the average latency of operations (ms).
+ */
+void ScanThrottle_Stats(double *rate, double *latency_ms);
+
+#endif
@@ -0,0 +1,359 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2007, 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Asynchronous stat of directory entries (stat-ahead).
+ *
+ * Entries read by a getdents call are stated in flight at once, to hide
+ * the latency of each stat (e.g. a MDS RPC on Lustre):
+ * - with io_uring, a scan thread submits a statx request per entry
+ *   in its own ring, and waits for all completions;
+ * - with helper threads, the batch is queued, and helper threads
+ *   stat its entries with the scan thread.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "fs_scan.h"
+#include "statahead.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+#include "rbh_prof.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/sysmacros.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define SA_TAG "StatAhead"
+
+static statahead_mode_e sa_mode = STATAHEAD_NONE;
+static stat_func_t sa_stat_func = NULL;
+
+/* ------------ helper threads --------------- */
+
+/* a batch of entries to be stated */
+struct sa_job {
+    int             parentfd;
+    const char     *dirpath;
+    char          **names;
+    unsigned int    count;
+    struct stat    *st;
+    int            *rc;
+
+    /* next entry to be stated (atomic) */
+    unsigned int    next;
+
+    /* protected by sa_lock: */
+    unsigned int    done;       /* number of stated entries */
+    unsigned int    users;      /* helper threads working on it */
+    bool            queued;
+    struct sa_job  *next_job;
+};
+
+static pthread_mutex_t sa_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sa_cond_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sa_cond_done = PTHREAD_COND_INITIALIZER;
+static struct sa_job *sa_queue = NULL;
+
+/* remove a job from the queue (sa_lock must be held) */
+static void sa_dequeue(struct sa_job *job)
+{
+    struct sa_job **p;
+
+    if (!job->queued)
+        return;
+
+    for (p = &sa_queue; *p != NULL; p = &(*p)->next_job) {
+        if (*p == job) {
+            *p = job->next_job;
+            break;
+        }
+    }
+    job->queued = false;
+}
+
+/* stat entries of a job until they are all claimed.
+ * @return the number of entries stated by the caller */
+static unsigned int sa_run(struct sa_job *job)
+{
+    unsigned int i, n = 0;
+    char path[RBH_PATH_MAX];
+
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+        snprintf(path, sizeof(path), "%s/%s", job->dirpath, job->names[i]);
+        job->rc[i] = sa_stat_func(path, job->names[i], job->parentfd,
+                                  &job->st[i]);
+        n++;
+    }
+    return n;
+}
+
+static void *sa_helper_thr(void *arg)
+{
+    struct sa_job *job;
+    unsigned int n;
+
+    prof_set_role(PROF_ROLE_SCAN, "statahead");
+
+    pthread_mutex_lock(&sa_lock);
+    for (;;) {
+        while (sa_queue == NULL)
+            pthread_cond_wait(&sa_cond_work, &sa_lock);
+
+        job = sa_queue;
+        job->users++;
+        pthread_mutex_unlock(&sa_lock);
+
+        n = sa_run(job);
+
+        pthread_mutex_lock(&sa_lock);
+        /* all entries are claimed */
+        sa_dequeue(job);
+        job->done += n;
+        job->users--;
+        if (job->users == 0 && job->done == job->count)
+            pthread_cond_broadcast(&sa_cond_done);
+    }
+    return NULL;
+}
+
+static void sa_threads_batch(int parentfd, const char *dirpath, char **names,
+                             unsigned int count, struct stat *st, int *rc)
+{
+    struct sa_job job = {
+        .parentfd = parentfd,
+        .dirpath = dirpath,
+        .names = names,
+        .count = count,
+        .st = st,
+        .rc = rc,
+        .next = 0,
+        .done = 0,
+        .users = 0,
+        .queued = true,
+        .next_job = NULL,
+    };
+    struct sa_job **p;
+    unsigned int n;
+
+    pthread_mutex_lock(&sa_lock);
+    for (p = &sa_queue; *p != NULL; p = &(*p)->next_job)
+        ;
+    *p = &job;
+    pthread_cond_broadcast(&sa_cond_work);
+    pthread_mutex_unlock(&sa_lock);
+
+    /* the scan thread also works on its batch */
+    n = sa_run(&job);
+
+    pthread_mutex_lock(&sa_lock);
+    sa_dequeue(&job);
+    job.done += n;
+    while (job.done < job.count || job.users > 0)
+        pthread_cond_wait(&sa_cond_done, &sa_lock);
+    pthread_mutex_unlock(&sa_lock);
+}
+
+static int sa_threads_init(unsigned int nb_threads)
+{
+    pthread_attr_t attr;
+    pthread_t thr;
+    unsigned int i;
+    int rc;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (i = 0; i < nb_threads; i++) {
+        rc = pthread_create(&thr, &attr, sa_helper_thr, NULL);
+        if (rc) {
+            DisplayLog(LVL_CRIT, SA_TAG, "ERROR %d creating stat-ahead "
+                       "thread: %s", rc, strerror(rc));
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* ------------ io_uring --------------- */
+
+#ifdef HAVE_LIBURING
+/* ring of the current scan thread */
+static __thread struct io_uring *sa_ring = NULL;
+static __thread bool sa_ring_failed = false;
+
+static void statx2stat(const struct statx *stx, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size = stx->stx_size;
+    st->st_blksize = stx->stx_blksize;
+    st->st_blocks = stx->stx_blocks;
+    st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+static struct io_uring *get_ring(void)
+{
+    int rc;
+
+    if (sa_ring != NULL || sa_ring_failed)
+        return sa_ring;
+
+    sa_ring = MemAlloc(sizeof(*sa_ring));
+    if (sa_ring == NULL)
+        goto failed;
+
+    rc = io_uring_queue_init(STATAHEAD_MAX, sa_ring, 0);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, SA_TAG, "Failed to initialize io_uring: %s. "
+                   "Using synchronous stat.", strerror(-rc));
+        MemFree(sa_ring);
+        sa_ring = NULL;
+        goto failed;
+    }
+    return sa_ring;
+
+ failed:
+    sa_ring_failed = true;
+    return NULL;
+}
+
+/** @return 0 if the batch was handled, -1 to fall back to sync stat */
+static int sa_uring_batch(int parentfd, char **names, unsigned int count,
+                          struct stat *st, int *rc)
+{
+    struct statx stx[STATAHEAD_MAX];
+    struct io_uring *ring;
+    struct io_uring_cqe *cqe;
+    unsigned int i, nb_done;
+    int err;
+
+    if (parentfd < 0 || (ring = get_ring()) == NULL)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+        if (sqe == NULL)
+            return -1;
+        io_uring_prep_statx(sqe, parentfd, names[i],
+                            AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                            STATX_BASIC_STATS, &stx[i]);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+    }
+
+    err = io_uring_submit(ring);
+    if (err < 0) {
+        DisplayLog(LVL_MAJOR, SA_TAG, "io_uring_submit failed: %s",
+                   strerror(-err));
+        /* disable io_uring for this thread */
+        io_uring_queue_exit(ring);
+        MemFree(ring);
+        sa_ring = NULL;
+        sa_ring_failed = true;
+        return -1;
+    }
+
+    nb_done = 0;
+    while (nb_done < count) {
+        err = io_uring_wait_cqe(ring, &cqe);
+        if (err == -EINTR)
+            continue;
+        if (err < 0) {
+            /* in-flight requests use the caller's buffers: can't return */
+            DisplayLog(LVL_CRIT, SA_TAG, "io_uring_wait_cqe failed: %s",
+                       strerror(-err));
+            Exit(1);
+        }
+        i = (uintptr_t)io_uring_cqe_get_data(cqe);
+        rc[i] = cqe->res;
+        if (cqe->res == 0)
+            statx2stat(&stx[i], &st[i]);
+        io_uring_cqe_seen(ring, cqe);
+        nb_done++;
+    }
+    return 0;
+}
+#endif
+
+/* ------------ Interface --------------- */
+
+int StatAhead_Init(statahead_mode_e mode, unsigned int nb_threads,
+                   stat_func_t stat_func)
+{
+    sa_stat_func = stat_func;
+
+#ifndef HAVE_LIBURING
+    if (mode == STATAHEAD_IO_URING) {
+        DisplayLog(LVL_MAJOR, SA_TAG, "io_uring support is not available: "
+                   "using stat-ahead threads instead");
+        mode = STATAHEAD_THREADS;
+    }
+#endif
+
+    /* io_uring mode also needs threads for the fallback */
+    if (mode != STATAHEAD_NONE && nb_threads > 0) {
+        int rc = sa_threads_init(nb_threads);
+
+        if (rc)
+            return rc;
+    }
+
+    sa_mode = mode;
+    if (mode != STATAHEAD_NONE)
+        DisplayLog(LVL_VERB, SA_TAG, "Stat-ahead enabled (%s, %u threads)",
+                   mode == STATAHEAD_IO_URING ? "io_uring" : "threads",
+                   nb_threads);
+    return 0;
+}
+
+bool StatAhead_Enabled(void)
+{
+    return sa_mode != STATAHEAD_NONE;
+}
+
+void StatAhead_Batch(int parentfd, const char *dirpath, char **names,
+                     unsigned int count, struct stat *st, int *rc)
+{
+    if (count == 0)
+        return;
+
+#ifdef HAVE_LIBURING
+    if (sa_mode == STATAHEAD_IO_URING
+        && sa_uring_batch(parentfd, names, count, st, rc) == 0)
+        return;
+#endif
+
+    sa_threads_batch(parentfd, dirpath, names, count, st, rc);
+}
@@ -0,0 +1,50 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2007, 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Asynchronous stat of directory entries (stat-ahead),
+ * using io_uring or a pool of helper threads.
+ */
+
+#ifndef _STATAHEAD_H
+#define _STATAHEAD_H
+
+#include "fs_scan_main.h"
+#include <sys/stat.h>
+#include <stdbool.h>
+
+/* max number of entries in a stat-ahead batch */
+#define STATAHEAD_MAX   256
+
+/* function to stat a directory entry (returns 0 or -errno) */
+typedef int (*stat_func_t) (const char *path, const char *name,
+                            int parentfd, struct stat *inode);
+
+/* initialize the stat-ahead engine */
+int StatAhead_Init(statahead_mode_e mode, unsigned int nb_threads,
+                   stat_func_t stat_func);
+
+/* is stat-ahead enabled? */
+bool StatAhead_Enabled(void);
+
+/**
+ * Stat a batch of entries of a directory (at most STATAHEAD_MAX).
+ * @param parentfd  fd of the directory (-1 if unknown)
+ * @param dirpath   path of the directory
+ * @param[out] st   attributes of entries
+ * @param[out] rc   status of each stat (0 or -errno)
+ */
+void StatAhead_Batch(int parentfd, const char *dirpath, char **names,
+                     unsigned int count, struct stat *st, int *rc);
+
+#endif
@@ -14,6 +14,8 @@
 /**
  * Module for managing FS scan tasks as a stack
  * with priorities on entry depth.
+ * On DNE filesystems, tasks can be queued by MDT, so the scan threads are
+ * balanced between MDTs, and a busy MDT does not hold all the threads.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -24,107 +26,348 @@
 #include "task_stack_mngmt.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
+#include "Memory.h"
+
+/* index of the deque owned by the current thread (-1 if none) */
+static __thread int my_deque = -1;
 
 /* Initialize a stack of tasks */
-int InitTaskStack(task_stack_t *p_stack)
+int InitTaskStack(task_stack_t *p_stack, unsigned int nb_workers,
+                  unsigned int nb_mdts, unsigned int mdt_max_threads)
 {
-    unsigned int index;
+    unsigned int i, index;
     int rc;
 
-    /* initialize each level of the priority stack */
-    for (index = 0; index <= MAX_TASK_DEPTH; index++) {
-        p_stack->tasks_at_depth[index] = NULL;
+    if (nb_workers == 0)
+        nb_workers = 1;
+    if (nb_mdts == 0)
+        nb_mdts = 1;
+
+    p_stack->deques = MemCalloc(nb_workers * nb_mdts, sizeof(task_deque_t));
+    if (!p_stack->deques)
+        return ENOMEM;
+    p_stack->nb_deques = nb_workers;
+
+    p_stack->mdt_tasks = MemCalloc(nb_mdts, sizeof(unsigned int));
+    p_stack->mdt_running = MemCalloc(nb_mdts, sizeof(unsigned int));
+    if (!p_stack->mdt_tasks || !p_stack->mdt_running) {
+        rc = ENOMEM;
+        goto free_all;
     }
+    p_stack->nb_mdts = nb_mdts;
+    p_stack->mdt_max_threads = mdt_max_threads;
 
-    /* no task waiting for now */
-    p_stack->max_task_depth = 0;
+    for (i = 0; i < nb_workers * nb_mdts; i++) {
+        task_deque_t *dq = &p_stack->deques[i];
 
-    /* initialize the lock and the semaphore for accessing the list */
-    pthread_mutex_init(&p_stack->stack_lock, NULL);
+        /* initialize each level of the priority stack */
+        for (index = 0; index <= MAX_TASK_DEPTH; index++)
+            dq->tasks_at_depth[index] = NULL;
 
-    /* initially, no task available: sem=0 */
+        /* no task waiting for now */
+        dq->count = 0;
+        dq->min_task_depth = 0;
+        dq->max_task_depth = 0;
+
+        pthread_mutex_init(&dq->deque_lock, NULL);
+    }
+
+    p_stack->nb_tasks = 0;
+    p_stack->nb_idle = 0;
+    p_stack->next_deque = 0;
+
+    /* initially, no thread to wake up: sem=0 */
     if ((rc = sem_init(&p_stack->sem_tasks, 0, 0))) {
-        pthread_mutex_destroy(&p_stack->stack_lock);
         DisplayLog(LVL_CRIT, FSSCAN_TAG, "ERROR initializing semaphore");
-        return rc;
+        goto free_all;
     }
 
     return 0;
 
+ free_all:
+    MemFree(p_stack->deques);
+    p_stack->deques = NULL;
+    if (p_stack->mdt_tasks)
+        MemFree((void *)p_stack->mdt_tasks);
+    if (p_stack->mdt_running)
+        MemFree((void *)p_stack->mdt_running);
+    p_stack->mdt_tasks = p_stack->mdt_running = NULL;
+    return rc;
+}
+
+/* set the deque owned by the calling thread */
+void SetTaskStackWorker(unsigned int index)
+{
+    my_deque = index;
 }
 
 /* insert a task in the stack */
 void InsertTask_to_Stack(task_stack_t *p_stack, robinhood_task_t *p_task)
 {
     unsigned int prof = p_task->depth;
+    unsigned int mdt = p_task->mdt_index % p_stack->nb_mdts;
+    task_deque_t *dq;
 
     /* don't distinguish priorities over a given depth */
     if (prof > MAX_TASK_DEPTH)
         prof = MAX_TASK_DEPTH;
 
-    /* take the lock on stack */
-    P(p_stack->stack_lock);
+    /* insert to the deque of the current thread, or spread them
+     * if the caller is not a scan thread */
+    if (my_deque >= 0)
+        dq = &p_stack->deques[mdt * p_stack->nb_deques
+                              + my_deque % p_stack->nb_deques];
+    else
+        dq = &p_stack->deques[mdt * p_stack->nb_deques
+                              + __sync_fetch_and_add(&p_stack->next_deque, 1)
+                              % p_stack->nb_deques];
+
+    /* take the lock on the deque */
+    P(dq->deque_lock);
 
     /* insert the task at the good depth */
-    p_task->next_task = p_stack->tasks_at_depth[prof];
-    p_stack->tasks_at_depth[prof] = p_task;
+    p_task->next_task = dq->tasks_at_depth[prof];
+    dq->tasks_at_depth[prof] = p_task;
 
-    /* update max_task_depth, if needed */
-    if (prof > p_stack->max_task_depth)
-        p_stack->max_task_depth = prof;
+    /* update min/max_task_depth, if needed */
+    if (dq->count == 0) {
+        dq->min_task_depth = prof;
+        dq->max_task_depth = prof;
+    } else if (prof > dq->max_task_depth)
+        dq->max_task_depth = prof;
+    else if (prof < dq->min_task_depth)
+        dq->min_task_depth = prof;
+    dq->count++;
 
-    /* release the stack lock */
-    V(p_stack->stack_lock);
+    /* release the deque lock */
+    V(dq->deque_lock);
 
-    /* unblock waiting worker threads */
-    sem_post_safe(&p_stack->sem_tasks);
+    /* Unblock a waiting worker thread, if any.
+     * A worker registers as idle before checking nb_tasks,
+     * so no wakeup can be lost. */
+    __sync_fetch_and_add(&p_stack->mdt_tasks[mdt], 1);
+    __sync_fetch_and_add(&p_stack->nb_tasks, 1);
+    if (p_stack->nb_idle > 0)
+        sem_post_safe(&p_stack->sem_tasks);
 
 }
 
-/* take a task (blocking until there is a task in the stack) */
-robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack)
+/* Take a task from a deque: the deepest one if 'deepest' is true,
+ * else the shallowest. Return NULL if the deque is empty. */
+static robinhood_task_t *take_from_deque(task_deque_t *dq, bool deepest)
 {
     robinhood_task_t *p_task;
+    unsigned int depth;
     int index;
 
-    /* wait for a task */
-    sem_wait_safe(&p_stack->sem_tasks);
+    /* cheap check without lock */
+    if (dq->count == 0)
+        return NULL;
 
-    /* lock the stack */
-    P(p_stack->stack_lock);
+    P(dq->deque_lock);
 
-    /* The scan is a 'depth first' scan: directly go to the highest depth. */
-    p_task = p_stack->tasks_at_depth[p_stack->max_task_depth];
+    if (dq->count == 0) {
+        V(dq->deque_lock);
+        return NULL;
+    }
+
+    depth = deepest ? dq->max_task_depth : dq->min_task_depth;
+    p_task = dq->tasks_at_depth[depth];
 
     /* sanity check */
     if (p_task == NULL) {
-        V(p_stack->stack_lock);
+        V(dq->deque_lock);
         DisplayLog(LVL_CRIT, FSSCAN_TAG, "UNEXPECTED ERROR: NO TASK FOUND");
         return NULL;
     }
 
     /* update the list for this depth */
-    p_stack->tasks_at_depth[p_stack->max_task_depth] = p_task->next_task;
+    dq->tasks_at_depth[depth] = p_task->next_task;
+    dq->count--;
+    if (deepest)
+        dq->nb_local++;
+    else
+        dq->nb_stolen++;
 
-    /* if the list at current depth is empty, we need to
-     * update max_task_depth.
+    /* if the list at this depth is empty, we need to
+     * update min/max_task_depth.
      */
-    if (p_task->next_task == NULL) {
-        for (index = p_stack->max_task_depth; index >= 0; index--) {
-            if (p_stack->tasks_at_depth[index] != NULL) {
-                p_stack->max_task_depth = index;
-                break;
+    if (dq->count == 0) {
+        dq->min_task_depth = 0;
+        dq->max_task_depth = 0;
+    } else if (p_task->next_task == NULL) {
+        if (deepest) {
+            for (index = depth; index >= (int)dq->min_task_depth; index--) {
+                if (dq->tasks_at_depth[index] != NULL) {
+                    dq->max_task_depth = index;
+                    break;
+                }
+            }
+        } else {
+            for (index = depth; index <= (int)dq->max_task_depth; index++) {
+                if (dq->tasks_at_depth[index] != NULL) {
+                    dq->min_task_depth = index;
+                    break;
+                }
             }
         }
-        /* no item found */
-        if (index < 0)
-            p_stack->max_task_depth = 0;
     }
 
-    /* unlock the stack */
-    V(p_stack->stack_lock);
+    /* unlock the deque */
+    V(dq->deque_lock);
+
+    return p_task;
+}
+
+/* take a task of the given MDT from the local deque,
+ * or steal one from another thread */
+static robinhood_task_t *try_get_mdt_task(task_stack_t *p_stack,
+                                          unsigned int mdt)
+{
+    task_deque_t *deques = &p_stack->deques[mdt * p_stack->nb_deques];
+    robinhood_task_t *p_task;
+    unsigned int i, self;
+
+    self = (my_deque >= 0) ? (my_deque % p_stack->nb_deques) : 0;
+
+    /* The scan is a 'depth first' scan: directly go to the highest depth. */
+    p_task = take_from_deque(&deques[self], true);
+    if (p_task)
+        goto found;
+
+    /* steal the shallowest task of the next non-empty deque */
+    for (i = 1; i < p_stack->nb_deques; i++) {
+        p_task = take_from_deque(&deques[(self + i) % p_stack->nb_deques],
+                                 false);
+        if (p_task)
+            goto found;
+    }
+    return NULL;
 
-    /* returns pointer to the task */
+ found:
+    __sync_fetch_and_sub(&p_stack->mdt_tasks[mdt], 1);
+    __sync_fetch_and_sub(&p_stack->nb_tasks, 1);
     return p_task;
+}
 
+/* reserve a thread slot for a MDT, if it is under its limit */
+static bool mdt_reserve(task_stack_t *p_stack, unsigned int mdt)
+{
+    unsigned int running;
+
+    if (p_stack->mdt_max_threads == 0) {
+        __sync_fetch_and_add(&p_stack->mdt_running[mdt], 1);
+        return true;
+    }
+
+    do {
+        running = p_stack->mdt_running[mdt];
+        if (running >= p_stack->mdt_max_threads)
+            return false;
+    } while (!__sync_bool_compare_and_swap(&p_stack->mdt_running[mdt],
+                                           running, running + 1));
+    return true;
+}
+
+/* choose the MDT with available tasks that has the fewest threads
+ * working on it, and under its thread limit. Return -1 if none. */
+static int pick_mdt(task_stack_t *p_stack)
+{
+    unsigned int i, mdt, start;
+    int best = -1;
+
+    /* spread threads on MDTs with the same load */
+    start = (my_deque >= 0) ? my_deque : 0;
+
+    for (i = 0; i < p_stack->nb_mdts; i++) {
+        mdt = (start + i) % p_stack->nb_mdts;
+
+        if (p_stack->mdt_tasks[mdt] == 0)
+            continue;
+        if (p_stack->mdt_max_threads != 0
+            && p_stack->mdt_running[mdt] >= p_stack->mdt_max_threads)
+            continue;
+        if (best < 0
+            || p_stack->mdt_running[mdt] < p_stack->mdt_running[best])
+            best = mdt;
+    }
+    return best;
+}
+
+/* take a task of the least loaded MDT */
+static robinhood_task_t *try_get_task(task_stack_t *p_stack)
+{
+    robinhood_task_t *p_task;
+    unsigned int i;
+    int mdt;
+
+    /* retry if the chosen MDT was emptied or filled concurrently */
+    for (i = 0; i < p_stack->nb_mdts; i++) {
+        mdt = pick_mdt(p_stack);
+        if (mdt < 0)
+            return NULL;
+
+        if (!mdt_reserve(p_stack, mdt))
+            continue;
+
+        p_task = try_get_mdt_task(p_stack, mdt);
+        if (p_task)
+            return p_task;
+
+        __sync_fetch_and_sub(&p_stack->mdt_running[mdt], 1);
+    }
+    return NULL;
+}
+
+/* take a task (blocking until there is a task in the stack) */
+robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack)
+{
+    robinhood_task_t *p_task;
+
+    for (;;) {
+        p_task = try_get_task(p_stack);
+        if (p_task)
+            return p_task;
+
+        /* register as idle, then check again before sleeping
+         * (tasks may be available for MDTs at their thread limit:
+         * TaskDone_in_Stack() wakes up idle threads) */
+        __sync_fetch_and_add(&p_stack->nb_idle, 1);
+        p_task = try_get_task(p_stack);
+        if (p_task == NULL)
+            sem_wait_safe(&p_stack->sem_tasks);
+        __sync_fetch_and_sub(&p_stack->nb_idle, 1);
+
+        if (p_task)
+            return p_task;
+    }
+}
+
+/* release the thread slot of a processed task */
+void TaskDone_in_Stack(task_stack_t *p_stack, robinhood_task_t *p_task)
+{
+    __sync_fetch_and_sub(&p_stack->mdt_running[p_task->mdt_index
+                                               % p_stack->nb_mdts], 1);
+
+    /* tasks may have been waiting for this MDT to be less busy */
+    if (p_stack->mdt_max_threads != 0 && p_stack->nb_idle > 0
+        && p_stack->nb_tasks > 0)
+        sem_post_safe(&p_stack->sem_tasks);
+}
+
+/* get task handling statistics */
+void TaskStack_Stats(task_stack_t *p_stack, unsigned long long *p_handled,
+                     unsigned long long *p_stolen)
+{
+    unsigned int i;
+
+    *p_handled = 0;
+    *p_stolen = 0;
+
+    /* no lock, just for information */
+    for (i = 0; i < p_stack->nb_deques * p_stack->nb_mdts; i++) {
+        *p_handled += p_stack->deques[i].nb_local
+                      + p_stack->deques[i].nb_stolen;
+        *p_stolen += p_stack->deques[i].nb_stolen;
+    }
 }
@@ -21,8 +21,13 @@
 
 #include "fs_scan_types.h"
 
-/* initialize a task stack */
-int InitTaskStack(task_stack_t *p_stack);
+/* initialize a task stack, with one deque per worker thread and per MDT,
+ * and a limit of threads working on the tasks of each MDT (0 = unlimited) */
+int InitTaskStack(task_stack_t *p_stack, unsigned int nb_workers,
+                  unsigned int nb_mdts, unsigned int mdt_max_threads);
+
+/* set the deque owned by the calling worker thread */
+void SetTaskStackWorker(unsigned int index);
 
 /* insert a task in the stack */
 void InsertTask_to_Stack(task_stack_t *p_stack, robinhood_task_t *p_task);
@@ -30,4 +35,12 @@ void InsertTask_to_Stack(task_stack_t *p_stack, robinhood_task_t *p_task);
 /* take a task in the stack (block until there is a task available) */
 robinhood_task_t *GetTask_from_Stack(task_stack_t *p_stack);
 
+/* indicate that a task taken from the stack has been processed */
+void TaskDone_in_Stack(task_stack_t *p_stack, robinhood_task_t *p_task);
+
+/* get task handling statistics (tasks taken from the stack, and
+ * tasks stolen from another thread's deque) */
+void TaskStack_Stats(task_stack_t *p_stack, unsigned long long *p_handled,
+                     unsigned long long *p_stolen);
+
 #endif
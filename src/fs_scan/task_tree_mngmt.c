@@ -24,6 +24,7 @@
 #include "task_tree_mngmt.h"
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 #define sP(_lock_)  pthread_spin_lock(&(_lock_))
 #define sV(_lock_)  pthread_spin_unlock(&(_lock_))
@@ -38,15 +39,185 @@ static pthread_mutex_t mutex_spool = PTHREAD_MUTEX_INITIALIZER;
 static robinhood_task_t *tasks_pool = NULL;
 static mem_stat_t stat_mem_tach = { 0, 0 };
 
+/* Task names are allocated in chunks, which are freed
+ * when all the names they contain are released.
+ */
+#define NAME_CHUNK_SIZE (64 * 1024)
+
+struct task_name_chunk {
+    unsigned int    used;       /* bytes allocated in the chunk */
+    unsigned int    refcount;   /* names still in use */
+    char            data[0];
+};
+
+static pthread_mutex_t mutex_names = PTHREAD_MUTEX_INITIALIZER;
+static struct task_name_chunk *current_chunk = NULL;
+static size_t chunk_mem = 0;
+static size_t name_mem = 0;
+
+/* memory allocated for the paths of running tasks */
+static size_t path_mem = 0;
+
 /* Set chunk size for preallocation mechanism */
 void SetNbPreallocTasks(size_t nb_prealloc)
 {
     nb_tasks_prealloc = nb_prealloc;
 }
 
-void TasksMemInfo(mem_stat_t *p_mem_stat)
+void TasksMemInfo(task_mem_stat_t *p_mem_stat)
+{
+    p_mem_stat->pool = stat_mem_tach;
+    p_mem_stat->task_size = sizeof(robinhood_task_t);
+
+    pthread_mutex_lock(&mutex_names);
+    p_mem_stat->chunk_mem = chunk_mem;
+    p_mem_stat->name_mem = name_mem;
+    pthread_mutex_unlock(&mutex_names);
+    p_mem_stat->path_mem = path_mem;
+
+    p_mem_stat->total_mem = stat_mem_tach.nb_prealloc * sizeof(robinhood_task_t)
+        + p_mem_stat->chunk_mem + p_mem_stat->path_mem;
+    /* tasks embedding a full path and a struct stat */
+    p_mem_stat->full_mem = stat_mem_tach.nb_prealloc
+        * (sizeof(robinhood_task_t) - sizeof(char *) * 3 - sizeof(task_stat_t)
+           + RBH_PATH_MAX + sizeof(struct stat));
+}
+
+/* release a name allocated in a chunk (mutex_names must be locked) */
+static void release_name(struct task_name_chunk *chunk, size_t len)
+{
+    name_mem -= len;
+    chunk->refcount--;
+    if (chunk->refcount == 0 && chunk != current_chunk) {
+        chunk_mem -= sizeof(*chunk) + NAME_CHUNK_SIZE;
+        MemFreeTag(chunk);
+    }
+}
+
+/* Set the name of a task (relative to its parent task) */
+int SetTaskName(robinhood_task_t *p_task, const char *name)
 {
-    *p_mem_stat = stat_mem_tach;
+    size_t len = strlen(name) + 1;
+
+    if (len > NAME_CHUNK_SIZE)
+        return -ENAMETOOLONG;
+
+    pthread_mutex_lock(&mutex_names);
+    if (p_task->name != NULL)
+        release_name(p_task->name_chunk, strlen(p_task->name) + 1);
+
+    if (current_chunk == NULL || current_chunk->used + len > NAME_CHUNK_SIZE) {
+        struct task_name_chunk *chunk;
+
+        chunk = MemAllocTag(MEM_TAG_SCAN, sizeof(*chunk) + NAME_CHUNK_SIZE);
+        if (chunk == NULL) {
+            pthread_mutex_unlock(&mutex_names);
+            p_task->name = NULL;
+            return -ENOMEM;
+        }
+        chunk->used = 0;
+        chunk->refcount = 0;
+        chunk_mem += sizeof(*chunk) + NAME_CHUNK_SIZE;
+
+        /* the previous chunk is freed when its last name is released */
+        if (current_chunk != NULL && current_chunk->refcount == 0) {
+            chunk_mem -= sizeof(*current_chunk) + NAME_CHUNK_SIZE;
+            MemFreeTag(current_chunk);
+        }
+        current_chunk = chunk;
+    }
+
+    p_task->name = current_chunk->data + current_chunk->used;
+    p_task->name_chunk = current_chunk;
+    current_chunk->used += len;
+    current_chunk->refcount++;
+    name_mem += len;
+    pthread_mutex_unlock(&mutex_names);
+
+    memcpy(p_task->name, name, len);
+    return 0;
+}
+
+/* Get the absolute path of a task
+ * (its parent path must be known if the task is not running yet) */
+int TaskFullPath(const robinhood_task_t *p_task, char *buff, size_t size)
+{
+    int len;
+
+    if (p_task->path != NULL)
+        len = snprintf(buff, size, "%s", p_task->path);
+    else if (p_task->parent_task == NULL)
+        len = snprintf(buff, size, "%s", p_task->name);
+    else if (p_task->parent_task->path != NULL)
+        len = snprintf(buff, size, "%s/%s", p_task->parent_task->path,
+                       p_task->name);
+    else
+        return -EINVAL;
+
+    return ((size_t)len >= size) ? -ENAMETOOLONG : 0;
+}
+
+/* Set the path of a task */
+int SetTaskPath(robinhood_task_t *p_task, const char *path)
+{
+    size_t len = strlen(path) + 1;
+
+    if (p_task->path != NULL) {
+        __sync_fetch_and_sub(&path_mem, strlen(p_task->path) + 1);
+        MemFreeTag(p_task->path);
+    }
+
+    p_task->path = MemAllocTag(MEM_TAG_SCAN, len);
+    if (p_task->path == NULL)
+        return -ENOMEM;
+    memcpy(p_task->path, path, len);
+    __sync_fetch_and_add(&path_mem, len);
+    return 0;
+}
+
+/* Build the path of a task that is about to be processed */
+int BuildTaskPath(robinhood_task_t *p_task)
+{
+    char path[RBH_PATH_MAX];
+    int rc;
+
+    if (p_task->path != NULL)
+        return 0;
+
+    rc = TaskFullPath(p_task, path, sizeof(path));
+    if (rc)
+        return rc;
+
+    return SetTaskPath(p_task, path);
+}
+
+/* Set the attributes of a task directory */
+void TaskSetStat(robinhood_task_t *p_task, const struct stat *p_inode)
+{
+    p_task->dir_md.mode = p_inode->st_mode;
+    p_task->dir_md.uid = p_inode->st_uid;
+    p_task->dir_md.gid = p_inode->st_gid;
+    p_task->dir_md.nlink = p_inode->st_nlink;
+    p_task->dir_md.size = p_inode->st_size;
+    p_task->dir_md.blocks = p_inode->st_blocks;
+    p_task->dir_md.atime = p_inode->st_atime;
+    p_task->dir_md.mtime = p_inode->st_mtime;
+    p_task->dir_md.ctime = p_inode->st_ctime;
+}
+
+/* Get the attributes of a task directory as a struct stat */
+void TaskGetStat(const robinhood_task_t *p_task, struct stat *p_inode)
+{
+    memset(p_inode, 0, sizeof(*p_inode));
+    p_inode->st_mode = p_task->dir_md.mode;
+    p_inode->st_uid = p_task->dir_md.uid;
+    p_inode->st_gid = p_task->dir_md.gid;
+    p_inode->st_nlink = p_task->dir_md.nlink;
+    p_inode->st_size = p_task->dir_md.size;
+    p_inode->st_blocks = p_task->dir_md.blocks;
+    p_inode->st_atime = p_task->dir_md.atime;
+    p_inode->st_mtime = p_task->dir_md.mtime;
+    p_inode->st_ctime = p_task->dir_md.ctime;
 }
 
 /* Allocate and initialize a size structure */
@@ -73,6 +244,18 @@ int FreeTask(robinhood_task_t *p_task)
 {
     pthread_spin_destroy(&p_task->child_list_lock);
 
+    if (p_task->name != NULL) {
+        pthread_mutex_lock(&mutex_names);
+        release_name(p_task->name_chunk, strlen(p_task->name) + 1);
+        pthread_mutex_unlock(&mutex_names);
+    }
+    if (p_task->path != NULL) {
+        __sync_fetch_and_sub(&path_mem, strlen(p_task->path) + 1);
+        MemFreeTag(p_task->path);
+    }
+    if (p_task->batch_names != NULL)
+        MemFree(p_task->batch_names);
+
     /* put it back to the allocation pool */
     RELEASE_PREALLOC(p_task, tasks_pool, next_task, mutex_spool, stat_mem_tach);
 
@@ -56,6 +56,36 @@ bool FlagTaskAsFinished(robinhood_task_t *p_task);
  */
 bool TestTaskTermination(robinhood_task_t *p_task);
 
-void TasksMemInfo(mem_stat_t *p_mem_stat);
+/* Set the name of a task (relative to its parent task,
+ * absolute path for the root task) */
+int SetTaskName(robinhood_task_t *p_task, const char *name);
+
+/* Set the absolute path of a task */
+int SetTaskPath(robinhood_task_t *p_task, const char *path);
+
+/* Build the absolute path of a task from its parent's path,
+ * before processing it */
+int BuildTaskPath(robinhood_task_t *p_task);
+
+/* Write the absolute path of a task to a buffer, without setting it */
+int TaskFullPath(const robinhood_task_t *p_task, char *buff, size_t size);
+
+/* Set/get the attributes of the directory of a task */
+void TaskSetStat(robinhood_task_t *p_task, const struct stat *p_inode);
+void TaskGetStat(const robinhood_task_t *p_task, struct stat *p_inode);
+
+/** memory used by scan tasks */
+typedef struct task_mem_stat_t {
+    mem_stat_t  pool;       /**< preallocated/used task structures */
+    size_t      task_size;  /**< size of a task structure */
+    size_t      chunk_mem;  /**< memory allocated for task names */
+    size_t      name_mem;   /**< memory used by task names */
+    size_t      path_mem;   /**< memory used by paths of running tasks */
+    size_t      total_mem;  /**< total memory used for tasks */
+    size_t      full_mem;   /**< memory tasks would use if they embedded
+                                 their full path and struct stat */
+} task_mem_stat_t;
+
+void TasksMemInfo(task_mem_stat_t *p_mem_stat);
 
 #endif
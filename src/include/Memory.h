@@ -46,6 +46,42 @@
 
 #endif
 
+/**
+ * Tagged allocations: memory accounting per subsystem, to know which one
+ * the memory is used by. Tagged blocks have a small header, so they must
+ * be released by MemFreeTag().
+ */
+typedef enum {
+    MEM_TAG_PIPELINE,   /**< entry processor operations */
+    MEM_TAG_CHGLOG,     /**< changelog records being processed */
+    MEM_TAG_POLICY,     /**< policy run queues */
+    MEM_TAG_DBRESULT,   /**< DB result buffers */
+    MEM_TAG_SCAN,       /**< scan task names and paths */
+    MEM_TAG_COUNT
+} mem_tag_t;
+
+void *mem_alloc_tag(mem_tag_t tag, size_t size, int zero);
+void mem_free_tag(void *ptr);
+
+#define MemAllocTag(_t, _s)       mem_alloc_tag((_t), (_s), 0)
+#define MemCallocTag(_t, _n, _s)  mem_alloc_tag((_t), (size_t)(_n) * (_s), 1)
+#define MemFreeTag(_p)            mem_free_tag(_p)
+
+/**
+ * Account memory of a subsystem that is not allocated by MemAllocTag
+ * (e.g. allocated by an external library). Negative values release it.
+ */
+void mem_account(mem_tag_t tag, long long bytes, long long count);
+
+/** get the current amount of memory of a subsystem (all threads) */
+void mem_tag_stats(mem_tag_t tag, long long *bytes, long long *count);
+
+/** name of a subsystem */
+const char *mem_tag_name(mem_tag_t tag);
+
+/** dump memory accounting to the log */
+void mem_dump_stats(void);
+
 /** memory pool stats */
 typedef struct mem_stat_t {
     unsigned int nb_prealloc;
@@ -37,16 +37,12 @@
 #endif
 #endif
 
-/* Type representing the lock itself */
+/** Type representing the lock itself.
+ * Readers don't serialize on a mutex: the lock is a pthread rwlock,
+ * with writer preference (as the former implementation) when available.
+ */
 typedef struct _RW_LOCK {
-    unsigned int    nbr_active;
-    unsigned int    nbr_waiting;
-    unsigned int    nbw_active;
-    unsigned int    nbw_waiting;
-    pthread_mutex_t mutexProtect;
-    pthread_cond_t  condWrite;
-    pthread_cond_t  condRead;
-    pthread_mutex_t mcond;
+    pthread_rwlock_t lock;
 } rw_lock_t;
 
 int rw_lock_init(rw_lock_t *plock);
@@ -55,6 +51,8 @@ int P_w(rw_lock_t *plock);
 int V_w(rw_lock_t *plock);
 int P_r(rw_lock_t *plock);
 int V_r(rw_lock_t *plock);
+/** Turn a write lock into a read lock.
+ * Note: this is not atomic, a writer may take the lock in between. */
 int rw_lock_downgrade(rw_lock_t *plock);
 
 #endif /* _RW_LOCK */
@@ -61,6 +61,54 @@ typedef struct chglog_reader_config_t {
      * internal queue have aged. */
     time_t queue_check_interval;
 
+    /* Tune the max age of queued operations between queue_min_age and
+     * queue_max_age, according to the pipeline load. */
+    bool queue_auto_tune;
+    time_t queue_min_age;
+
+    /* Number of threads parsing and coalescing records of each MDT
+     * (records are dispatched to them by fid). */
+    unsigned int parsing_threads;
+
+    /* relative weight of priority lanes: number of ops pushed from each
+     * lane in a round */
+    unsigned int namespace_lane_weight;
+    unsigned int attrs_lane_weight;
+
+    /* Spool directory: if set, records are drained from the MDT to
+     * local spool files, and replayed from them (empty = disabled). */
+    char spool_dir[RBH_PATH_MAX];
+    /* max size of the spool of each MDT (bytes) */
+    unsigned long long spool_max_size;
+
+    /* State directory: if set, the records of the operations that are
+     * not committed when the daemon is stopped are saved there, and
+     * processed again at restart without re-reading them from the MDT
+     * (empty = disabled). */
+    char state_dir[RBH_PATH_MAX];
+
+    /* Fan-out: if set, records read from the MDTs are also published on
+     * this socket ("/path" or "[host:]port") to other robinhood instances
+     * (empty = disabled). */
+    char publish[RBH_PATH_MAX];
+    /* ids of the subscribers the records are kept for (comma-separated):
+     * MDT changelogs are only cleared up to the records they all
+     * acknowledged. */
+    char subscribers[RBH_PATH_MAX];
+    /* number of recent records of each MDT kept in memory for the
+     * subscribers (older ones are read again from the MDT). */
+    unsigned int publish_buffer;
+    /* If set, records are received from a publisher on this socket,
+     * instead of reading MDT changelogs. The reader_id of each MDT
+     * identifies this instance to the publisher (empty = disabled). */
+    char subscribe[RBH_PATH_MAX];
+
+    /* Sampled tracing: 1 record out of trace_sample_rate is traced from
+     * the MDT to its changelog clear, to trace_file (Chrome trace event
+     * format). trace_sample_rate = 0 disables tracing. */
+    char trace_file[RBH_PATH_MAX];
+    unsigned int trace_sample_rate;
+
     /* Options suported by the MDS. LU-543 and LU-1331 are related to
      * events in changelog, where a rename is overriding a destination
      * file. */
@@ -69,6 +117,15 @@ typedef struct chglog_reader_config_t {
 
 } chglog_reader_config_t;
 
+/**
+ * Replay the records of a capture file through the changelog reader and
+ * the pipeline, instead of reading MDT changelogs (benchmarking).
+ * Must be called before cl_reader_start().
+ * \param realtime  feed records at the pace they were generated
+ *                  (else, as fast as possible).
+ */
+void cl_reader_set_replay(const char *file, bool realtime);
+
 /** start ChangeLog Readers
  * \param mdt_index -1 for all
  */
@@ -89,6 +146,14 @@ int cl_reader_dump_stats(void);
 /** store changelog stats to db */
 int cl_reader_store_stats(lmgr_t *lmgr);
 
+/**
+ * Standby mode: report the progress of the active changelog reader,
+ * from the last committed records it saves in the DB.
+ * Must not be called after cl_reader_start().
+ * \param mdt_index -1 for all
+ */
+int cl_reader_follow(lmgr_t *lmgr, int mdt_index);
+
 /** config handlers */
 extern mod_cfg_funcs_t cl_reader_cfg_hdlr;
 
@@ -46,6 +46,15 @@ typedef struct db_config_t {
     char socket[RBH_PATH_MAX];
     char engine[1024];
     char tokudb_compression[50];
+    /* spool directory for bulk loading of initial scans (disabled if empty) */
+    char bulk_load_dir[RBH_PATH_MAX];
+    /* servers the entry tables are sharded on (disabled if empty) */
+    char shards[1024];
+    /* upper bounds of the id ranges entry tables are partitioned by
+     * (disabled if empty) */
+    char id_partitions[1024];
+    /* rm_time range of SOFT_RM partitions (disabled if 0) */
+    time_t softrm_partition_time;
 } db_config_t;
 
 #elif defined(_SQLITE)
@@ -66,6 +75,9 @@ typedef struct result_handle_t {
 typedef struct db_config_t {
     char         filepath[RBH_PATH_MAX];
     unsigned int retry_delay_microsec;  /* retry time when busy */
+    bool         wal;                   /* write-ahead logging */
+    char         synchronous[16];       /* sync mode of the DB file */
+    unsigned long long mmap_size;       /* max size of memory-mapped I/O */
 } db_config_t;
 
 #else
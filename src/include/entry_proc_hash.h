@@ -40,12 +40,85 @@ struct id_hash {
  */
 struct id_hash *id_hash_init(const unsigned int hash_size, bool use_lock);
 
+/**
+ * Move the operations of a hash table (linked by their id_hash_list) to a
+ * new table with hash_size slots, and free the old table.
+ * The table must not be accessed concurrently (slot locks are not used).
+ * @return the new hash table, or NULL if it can't be allocated (the old
+ *         table is kept unchanged).
+ */
+struct id_hash *id_hash_resize(struct id_hash *id_hash,
+                               unsigned int hash_size);
+
 /* display stats about the hash */
 void id_hash_stats(struct id_hash *id_hash, const char *log_str);
 
 /* dump all values in the hash */
 void id_hash_dump(struct id_hash *id_hash, bool parent);
 
+/* A constraint table slot: references the first operation for a given key
+ * (id or parent/name). Next operations with the same key are linked to it
+ * in pipeline order, through their hash list (a circular list with no
+ * head, so slots can be moved when the table is resized). */
+struct constraint_slot {
+    uint64_t             hash;
+    entry_proc_op_t     *first; /* NULL: free slot */
+};
+
+/* A constraint table stripe: an open-addressing table (linear probing)
+ * with its own lock. */
+struct constraint_stripe {
+    pthread_mutex_t          lock;
+    unsigned int             size;  /* number of slots (power of 2) */
+    unsigned int             used;  /* slots in use (= distinct keys) */
+    unsigned int             deleted;   /* deleted slots */
+    unsigned int             count; /* number of operations */
+    struct constraint_slot  *slots;
+
+    /* probe stats */
+    unsigned long long       lookups;
+    unsigned long long       probes;
+    unsigned int             max_probes;
+};
+
+/* A constraint table, keyed on entry id or on parent id/name. */
+struct constraint_hash {
+    bool                     by_name;
+    unsigned int             nb_stripes;    /* power of 2 */
+    struct constraint_stripe stripe[];
+};
+
+/**
+ * Creates a new constraint table.
+ * @param size     initial number of slots (rounded to a power of 2).
+ * @param by_name  key is parent_id/name instead of entry id.
+ * @return the new table.
+ */
+struct constraint_hash *constraint_hash_init(unsigned int size, bool by_name);
+
+/** register an operation, at the head or at the tail of operations with
+ * the same key */
+void constraint_hash_insert(struct constraint_hash *h, entry_proc_op_t *p_op,
+                            bool at_head);
+
+/**
+ * Look for the first registered operation with the same key as p_op.
+ * @retval 1   p_op is the first.
+ * @retval 0   another operation is the first (returned in *p_first).
+ * @retval -1  no operation is registered with this key.
+ */
+int constraint_hash_first(struct constraint_hash *h, entry_proc_op_t *p_op,
+                          entry_proc_op_t **p_first);
+
+/** unregister an operation */
+void constraint_hash_remove(struct constraint_hash *h, entry_proc_op_t *p_op);
+
+/* display stats about the table */
+void constraint_hash_stats(struct constraint_hash *h, const char *log_str);
+
+/* dump all values in the table */
+void constraint_hash_dump(struct constraint_hash *h);
+
 /**
  * Murmur3 uint64 finalizer
  * from: https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp
@@ -28,6 +28,7 @@
 #include "list.h"
 #include "config_parsing.h"
 #include "rbh_boolexpr.h"
+#include "rbh_trace.h"
 #include <stdint.h>
 #include "list_mgr.h"
 
@@ -151,15 +152,25 @@ typedef struct entry_proc_op_t {
      * (extended records/CLF_RENAME_LAST). */
     unsigned int    check_if_last_entry:1;
 
+    /* for changelog create records only: the entry was just created,
+     * so it is not looked up in DB (it is inserted or updated if it
+     * already exists, e.g. when records are read again after a restart). */
+    unsigned int    db_new_entry:1;
+
     /* for pipeline flush: indicate if not seen entries must be cleaned */
     unsigned int    gc_entries:1;
     /* for pipeline flush: indicate if not seen paths must be cleaned
      * (preserve entries). Used for partial scans. */
     unsigned int    gc_names:1;
 
+    /* the operation has been dispatched to a DB apply shard */
+    unsigned int    sharded:1;
+
     operation_type_e db_op_type;
     callback_func_t callback_func;
     void           *callback_param;
+    /* transaction of the DB operation (group commit) */
+    lmgr_ticket_t   commit_ticket;
 
     /* === Entry information === */
     entry_id_t      entry_id;
@@ -183,6 +194,11 @@ typedef struct entry_proc_op_t {
         time_t      changelog_inserted;  /* used by changelog reader */
         struct      timeval start_processing_time;   /* used by pipeline */
     } timestamp;
+    /* time the operation reached its current stage (for wait stats) */
+    struct timeval  stage_enter_time;
+
+    /* sampled trace of the operation (NULL if not traced) */
+    rbh_trace_t    *trace;
 
     /* double chained list for pipeline */
     struct rh_list_head list;
@@ -194,6 +210,10 @@ typedef struct entry_proc_op_t {
      */
     struct rh_list_head name_hash_list;
 
+    /* hash keys the operation was registered with (in constraint tables) */
+    uint64_t        id_hash_key;
+    uint64_t        name_hash_key;
+
 } entry_proc_op_t;
 
 /* test attribute from filesystem, or else from DB */
@@ -227,17 +247,61 @@ extern mod_cfg_funcs_t entry_proc_cfg_hdlr;
  */
 int EntryProcessor_Init(pipeline_flavor_e flavor, run_flags_t flags, void *arg);
 
+/**
+ * Apply the reloaded configuration to the running pipeline:
+ * number of workers (extra workers are parked after their current
+ * operations), max pending operations and watermarks.
+ */
+void EntryProcessor_Reconfig(void);
+
 /**
  * Terminate EntryProcessor
  * \param flush_ops: wait the queue to be flushed
  */
 int EntryProcessor_Terminate(bool flush_ops);
 
+/**
+ * Call a function for each operation left in the pipeline.
+ * Must only be called once EntryProcessor_Terminate(false) returned,
+ * e.g. to save the operations that were dropped.
+ */
+void EntryProcessor_ForEachPending(void (*cb)(entry_proc_op_t *op, void *arg),
+                                   void *arg);
+
 /**
  * This function adds a new operation to the queue
  */
 void EntryProcessor_Push(entry_proc_op_t *p_entry);
 
+/**
+ * Add several operations to the queue, in the given order,
+ * taking pipeline locks once for the whole batch.
+ */
+void EntryProcessor_PushBatch(entry_proc_op_t **ops, unsigned int count);
+
+/**
+ * Backpressure callback: called when the pipeline becomes congested
+ * (pending operations reached the high watermark) or recovers (pending
+ * operations went back under the low watermark).
+ * It is called with an internal lock held, so it must not block.
+ */
+typedef void (*backpressure_cb_t) (bool congested, void *arg);
+
+/** Register a backpressure callback (NULL to unregister). */
+void EntryProcessor_SetBackpressureCb(backpressure_cb_t cb, void *arg);
+
+/**
+ * Indicate if the pipeline is congested. Producers should slow down
+ * (or coalesce operations) instead of pushing more.
+ */
+bool EntryProcessor_Congested(void);
+
+/**
+ * Number of operations that can be pushed before the pipeline gets
+ * congested (0 if it is congested).
+ */
+unsigned int EntryProcessor_Credits(void);
+
 /**
  * Advise that the entry is ready for next step of the pipeline.
  * @param next_stage The next stage to be performed for this entry
@@ -251,6 +315,14 @@ int EntryProcessor_Acknowledge(entry_proc_op_t *p_op,
 int EntryProcessor_AcknowledgeBatch(entry_proc_op_t **p_op, unsigned int count,
                                     unsigned int next_stage, bool remove);
 
+/**
+ * Acknowledge a batch of operations that go to different stages.
+ * @param next_stages next stage of each operation (-1 to remove it
+ *        from pipeline).
+ */
+int EntryProcessor_AcknowledgeEach(entry_proc_op_t **p_op, unsigned int count,
+                                   const int *next_stages);
+
 /**
  * Set entry id.
  */
@@ -279,6 +351,11 @@ void EntryProcessor_Release(entry_proc_op_t *p_op);
  */
 void EntryProcessor_DumpCurrentStages(void);
 
+/**
+ * Store pipeline stage statistics in DB
+ */
+void EntryProcessor_StoreStats(lmgr_t *lmgr);
+
 /**
  * Unblock processing in a stage.
  */
@@ -44,16 +44,127 @@ void FSScan_DumpStats(void);
 /** store scan stats in db */
 void FSScan_StoreStats(lmgr_t *lmgr);
 
+/**
+ * Only scan the index-th of count shards of the namespace (overrides
+ * scan_shards configuration). Must be called before FSScan_Start().
+ * @param depth  depth of the directories distributed between shards.
+ */
+void FSScan_SetShard(unsigned int index, unsigned int count,
+                     unsigned int depth);
+
+/**
+ * Override the number of scan threads of the configuration (if count > 0).
+ * Must be called before FSScan_Start().
+ * @return the number of scan threads.
+ */
+unsigned int FSScan_SetThreads(unsigned int count);
+
+/** test if the last scan was complete (old entries can be cleaned) */
+bool FSScan_Complete(void);
+
+struct scan_backend;
+
+/**
+ * Read the namespace with the given backend instead of the filesystem
+ * (NULL for the default). Must be called before FSScan_Start().
+ * Incremental scans and checkpoints are disabled for other backends.
+ * @return 0 on success, ENOTSUP if the backend can't be used.
+ */
+int FSScan_SetBackend(const struct scan_backend *backend);
+
+/** parameters of a synthetic namespace, generated in memory */
+typedef struct synth_tree_params {
+    unsigned int    depth;          /**< depth of the directory tree */
+    unsigned int    width;          /**< sub-directories per directory */
+    unsigned int    files;          /**< files per directory */
+    unsigned int    readdir_usec;   /**< simulated latency of getdents */
+    unsigned int    stat_usec;      /**< simulated latency of stat */
+} synth_tree_params_t;
+
+/**
+ * Get a scan backend generating a synthetic namespace under the
+ * filesystem root (for benchmarking the scan).
+ * @return NULL if parameters are invalid (tree too large).
+ */
+const struct scan_backend *ScanSynth_Backend(const synth_tree_params_t *
+                                             params);
+
+/** number of directories of the synthetic namespace (including root) */
+unsigned long long ScanSynth_DirCount(const synth_tree_params_t *params);
+
 /** Configuration of the FS scan Module */
+/** incremental scan modes */
+typedef enum {
+    INCR_SCAN_NONE = 0,     /**< read all directories */
+    INCR_SCAN_DIR_MTIME,    /**< don't read directories whose mtime and
+                                 ctime have not changed since last scan */
+    INCR_SCAN_CHANGELOG,    /**< also skip the subtrees of these
+                                 directories: changelogs are trusted for
+                                 their content */
+} incr_scan_mode_e;
+
+/** stat-ahead modes */
+typedef enum {
+    STATAHEAD_NONE = 0,     /**< entries are stated one by one */
+    STATAHEAD_THREADS,      /**< entries are stated by helper threads */
+    STATAHEAD_IO_URING,     /**< statx requests are submitted to io_uring */
+} statahead_mode_e;
+
+/** time-of-day profile for scan throttling */
+typedef struct scan_rate_slot_t {
+    unsigned int    start;      /**< minutes since midnight */
+    unsigned int    end;        /**< minutes since midnight (excluded) */
+    unsigned int    max_rate;   /**< ops/sec (0 = unlimited) */
+} scan_rate_slot_t;
+
 typedef struct fs_scan_config_t {
     /* scan options */
 
     unsigned int    nb_threads_scan;
+    /** CPUs or NUMA nodes of scan threads (see rbh_affinity.h) */
+    char            cpu_affinity[256];
     time_t          min_scan_interval;
     time_t          max_scan_interval;
     time_t          scan_retry_delay;
     time_t          scan_op_timeout;
     bool            exit_on_timeout;
+    incr_scan_mode_e incremental_scan;
+
+    /** huge directories: entries after the first dir_split_threshold ones
+     * are handed off to other scan threads by batches of dir_batch_size
+     * (0 = disabled) */
+    unsigned int    dir_split_threshold;
+    unsigned int    dir_batch_size;
+
+    /** DNE: max scan threads working on the directories of each MDT
+     * (0 = no MDT-aware scheduling) */
+    unsigned int    mdt_max_threads;
+
+    /** asynchronous stat of the entries read by each getdents call */
+    statahead_mode_e stat_ahead;
+    unsigned int    stat_ahead_threads;
+
+    /** throttling of scan operations: max rate (ops/sec, 0 = unlimited),
+     * min rate for adaptation, target latency of operations (ms,
+     * 0 = no adaptation), and time-of-day max rates */
+    unsigned int    scan_max_rate;
+    unsigned int    scan_min_rate;
+    unsigned int    scan_target_latency;
+    scan_rate_slot_t *scan_rate_schedule;
+    unsigned int    scan_rate_schedule_count;
+
+    /** distributed scan: number of robinhood instances sharing the scan
+     * (1 = not distributed), index of this instance, and depth of the
+     * directories that are distributed between instances */
+    unsigned int    scan_shards;
+    unsigned int    scan_shard_index;
+    unsigned int    scan_shard_depth;
+
+    /** file where progress of the current scan is saved, so it can be
+     * resumed after a restart (empty = no checkpoint), and interval
+     * between checkpoints */
+    char            scan_checkpoint_file[RBH_PATH_MAX];
+    time_t          scan_checkpoint_interval;
 
     /**
      * interval of the spooler (checks for audits to be launched,
@@ -56,6 +56,11 @@ typedef struct global_config_t {
     bool    direct_mds_stat;
 #endif
 
+#ifdef _HAVE_FID
+    /** max directories in the FID to path cache (0 to disable it) */
+    unsigned int fid_path_cache_size;
+#endif
+
 } global_config_t;
 
 /** global config structure available to all modules */
@@ -182,6 +182,10 @@ typedef struct lmgr_t {
     db_conn_t       conn;
     unsigned int    last_commit;   /*< 0 if last operation was committed */
     bool            force_commit;  /*< force commit on next operation */
+    unsigned long long tx_seq;     /*< sequence of the current transaction */
+    unsigned long long committed_seq; /*< last committed transaction
+                                           (protected by commit lock) */
+    struct timeval  tx_start;      /*< start of the current group transaction */
     unsigned int    retry_delay;   /*< current retry delay */
     unsigned int    retry_count;   /*< nbr of retries */
     struct timeval  first_error; /*< time of first retried error */
@@ -191,6 +195,19 @@ typedef struct lmgr_t {
     /* operation statistics */
     unsigned int    nbop[OPCOUNT];
 
+    /* prepared statements of the connection */
+    GHashTable     *stmt_cache;
+
+    /* bulk load files of the connection */
+    struct bulk_spool *bulk;
+
+    /* accounting deltas of the current transaction */
+    GHashTable     *acct_deltas;
+    /* directory aggregate deltas of the current transaction */
+    GHashTable     *dir_deltas;
+    /* OST aggregate deltas of the current transaction */
+    GHashTable     *ost_deltas;
+
 } lmgr_t;
 
 /** List manager configuration */
@@ -198,11 +215,49 @@ typedef struct lmgr_config_t {
     db_config_t     db_config;
     unsigned int    commit_behavior;   /* 0: autocommit, 1: commit every
                             transaction, <n>: commit every <n> transactions */
+    bool            commit_group;      /* group commit (tickets, delay) */
+    unsigned int    commit_max_delay;  /* group commit: max delay (ms) */
     time_t connect_retry_min;   /* min retry delay when connection is lost */
     time_t connect_retry_max;   /* max retry delay when connection is lost */
 
+    unsigned int attr_cache_size;  /* max entries in attr cache (0: disabled) */
+    time_t attr_cache_ttl;         /* max time an entry stays in attr cache */
+    unsigned int path_cache_size;  /* max directories in path cache
+                                      (0: disabled) */
+    unsigned int pool_size;        /* max connections in the connection
+                                      pool (0: unlimited) */
+
+    unsigned int mass_rm_batch;    /* entries per transaction in mass
+                                      removals (0: single transaction) */
+    unsigned int dir_list_chunk;   /* directories listed per request
+                                      when scrubbing the namespace */
+
+    bool   query_stats;            /* account query times by template */
+    double slow_query_time;        /* log queries longer than this (sec) */
+    time_t report_snapshot_interval; /* refresh interval of report
+                                        snapshots (0: disabled) */
+    time_t ost_history_interval;   /* OST usage sampling interval
+                                      (0: disabled, Lustre only) */
+    time_t ost_history_retention;  /* age of the oldest OST usage samples
+                                      (0: unlimited) */
+    time_t summary_interval;       /* refresh interval of the summary
+                                      tables of the web GUI (0: disabled) */
+    time_t summary_history_retention; /* age of the oldest filesystem
+                                         usage samples (0: unlimited) */
+    bool   stats_history;          /* store daemon stats as time series */
+
     /** enable accounting */
     bool            acct;
+    /** maintain accounting by aggregated deltas instead of triggers */
+    bool            acct_deltas;
+    /** maintain per-directory usage aggregates */
+    bool            dir_agg;
+    /** maintain per-OST usage aggregates (Lustre only) */
+    bool            ost_agg;
+    /** store stripe items as a packed blob (Lustre only) */
+    bool            compact_stripes;
+    /** index reversed names to match name suffixes */
+    bool            name_suffix_index;
 } lmgr_config_t;
 
 /** config handlers */
@@ -213,6 +268,27 @@ extern mod_cfg_funcs_t lmgr_cfg_hdlr;
  */
 bool lmgr_parallel_batches(void);
 
+/** refresh interval of report snapshots (0 if they are disabled) */
+time_t lmgr_report_snapshot_interval(void);
+
+/** interval of OST usage history samples (0 if it is disabled) */
+time_t lmgr_ost_history_interval(void);
+/** retention of OST usage history (0: unlimited) */
+time_t lmgr_ost_history_retention(void);
+
+/** refresh interval of the summary tables (0 if they are disabled) */
+time_t lmgr_summary_interval(void);
+/** retention of the filesystem usage history (0: unlimited) */
+time_t lmgr_summary_history_retention(void);
+
+/** are daemon stats stored as time series? */
+bool lmgr_stats_history(void);
+
+/** number of directories to list per ListMgr_GetChild() request
+ * when scrubbing the namespace.
+ */
+unsigned int lmgr_dir_list_chunk(void);
+
 /** Container to associate an ID with its pathname. */
 typedef struct wagon {
     entry_id_t   id;
@@ -225,6 +301,14 @@ struct lmgr_report_t;
 struct lmgr_profile_t;
 struct lmgr_rm_list_t;
 
+/** Position in the sort order of an iterator (see ListMgr_IterPosition) */
+typedef struct lmgr_iter_pos_t {
+    bool         set;
+    bool         sort_null;         /* sort value is NULL */
+    char         sort_val[1024];    /* sort value, as returned by the DB */
+    entry_id_t   id;                /* id of the entry (sort tie-breaker) */
+} lmgr_iter_pos_t;
+
 /** Options for iterators */
 typedef struct lmgr_iter_opt_t {
     unsigned int list_count_max;    /* max entries to be returned by iterator or
@@ -232,10 +316,29 @@ typedef struct lmgr_iter_opt_t {
     unsigned int force_no_acct:1;   /* don't use acct table for reports */
     unsigned int allow_no_attr:1;   /* allow returning entries if no attr is
                                        available */
+    unsigned int stream:1;          /* iterator: read entries from the DB as
+                                       they are returned (dedicated
+                                       connection), instead of loading the
+                                       whole list in memory */
+    unsigned int snapshot:1;        /* report: read results from a snapshot
+                                       of the report, if available (see
+                                       ListMgr_RefreshSnapshots) */
+    /* iterator: only return entries after this position of the sort order */
+    const lmgr_iter_pos_t *after;
+    /* iterator: only return the shard_index-th of shard_count subsets of
+     * entries (by hash of their id), to list entries in parallel.
+     * Only supported when sorting on a main or annex field. */
+    unsigned int shard_count;
+    unsigned int shard_index;
+    /* iterator: skip entries with a valid ignore mark of this policy
+     * (see ListMgr_SetIgnoreMarks) */
+    const char  *skip_marked;
 } lmgr_iter_opt_t;
 
 #define LMGR_ITER_OPT_INIT {.list_count_max = 0, .force_no_acct = 0, \
-                            .allow_no_attr = 0}
+                            .allow_no_attr = 0, .stream = 0, .after = NULL, \
+                            .shard_count = 0, .shard_index = 0, \
+                            .skip_marked = NULL}
 
 typedef struct attr_mask {
     uint32_t std;     /**< standard attribute mask */
@@ -361,6 +464,18 @@ static inline void ATTR_MASK_INIT(attr_set_t *p_set)
     memset(&p_set->attr_mask, 0, sizeof(p_set->attr_mask));
 }
 
+/**
+ * Reset an attribute set before filling it, without clearing its values:
+ * only the mask and the pointers to allocated arrays are reset.
+ * Must not be used on a set holding allocated values (see ListMgr_FreeAttrs).
+ */
+static inline void ATTR_SET_CLEAR(attr_set_t *p_set)
+{
+    ATTR_MASK_INIT(p_set);
+    p_set->attr_values.sm_status = NULL;
+    p_set->attr_values.sm_info = NULL;
+}
+
 /** callback function for 'attrs_for_each'
  * the iteration stops if callback function returns < 0
  */
@@ -376,6 +491,13 @@ int attrs_for_each(attr_cb_t func, void *args);
  */
 int attr_index_iter(unsigned int init, int *cookie);
 
+/** iterator on the attribute indexes set in a mask (faster than testing
+ * each index returned by attr_index_iter on sparse masks).
+ * @param cookie must initially store 0.
+ * @return next index set in mask, -1 when the loop ends.
+ */
+int attr_mask_index_iter(const attr_mask_t *mask, int *cookie);
+
 extern unsigned int sm_inst_count;  /* defined in 'status_manager.c' */
 extern unsigned int sm_attr_count;  /* defined in 'status_manager.c' */
 
@@ -592,6 +714,13 @@ enum lmgr_init_flags {
     LIF_ALTER_NODISP = (1 << 2), /**< INTERNAL USE ONLY */
 };
 
+/**
+ * Declare an attribute entries are listed by (sorted iterators continued
+ * after a given entry). An index on (attr, id) is created for it
+ * by ListMgr_Init(). Must be called before ListMgr_Init().
+ */
+void ListMgr_AddSortIndex(unsigned int attr_index);
+
 /** Initialize the List Manager */
 int ListMgr_Init(enum lmgr_init_flags flags);
 
@@ -601,6 +730,25 @@ int ListMgr_InitAccess(lmgr_t *p_mgr);
 /** Close a connection to the database */
 int ListMgr_CloseAccess(lmgr_t *p_mgr);
 
+/**
+ * Get a connection from the shared connection pool, for occasional
+ * DB operations (e.g. policy actions, stats). A new connection is opened
+ * when none is idle, unless the pool is full (connection_pool_size):
+ * then the caller waits for a connection to be released.
+ * @return NULL if the connection failed.
+ */
+lmgr_t *ListMgr_Checkout(void);
+
+/** Give a connection back to the pool (its transaction is committed). */
+void ListMgr_Release(lmgr_t *p_mgr);
+
+/** Close idle connections of the pool. */
+void ListMgr_PoolClose(void);
+
+/** Drop the attribute and path caches of the process (e.g. when the DB was
+ * modified by another process). */
+void ListMgr_InvalidateCaches(void);
+
 /**
  * Set force commit behavior.
  * Default is false;
@@ -614,6 +762,39 @@ void ListMgr_ForceCommitFlag(lmgr_t *p_mgr, bool force_commit);
  */
 bool ListMgr_GetCommitStatus(lmgr_t *p_mgr);
 
+/**
+ * Commit ticket, used in group commit mode to know when the transaction
+ * of an operation has been committed (possibly by another thread).
+ */
+typedef struct lmgr_ticket_t {
+    lmgr_t             *lmgr; /*< connection of the transaction (NULL if none) */
+    unsigned long long  seq;  /*< sequence of the transaction */
+} lmgr_ticket_t;
+
+/**
+ * Get a ticket for the last operation performed on a connection.
+ * The ticket is empty if the operation is already committed,
+ * or if group commit is disabled.
+ */
+void ListMgr_GetCommitTicket(lmgr_t *p_mgr, lmgr_ticket_t *p_ticket);
+
+/**
+ * Wait for the transaction of a ticket to complete (committed, or rolled
+ * back on error). The pending transaction of the calling thread is committed
+ * first, so threads waiting for each other's tickets cannot deadlock.
+ * @param p_mgr connection of the calling thread.
+ * @return DB_SUCCESS, or the error committing the caller's transaction.
+ */
+int ListMgr_WaitTicket(lmgr_t *p_mgr, const lmgr_ticket_t *p_ticket);
+
+/**
+ * In group commit mode, commit the pending transaction of a connection
+ * if it is older than the max commit delay (or if force is true).
+ * To be called by threads that are about to wait, or that are not
+ * performing database operations.
+ */
+int ListMgr_FlushCommit(lmgr_t *p_mgr, bool force);
+
 /**
  * Tests if this entry exists in the database.
  * @param p_mgr pointer to a DB connection
@@ -648,9 +829,40 @@ int ListMgr_SetStripe(lmgr_t *p_mgr, const entry_id_t *p_id,
 #endif
 
 /**
- * Retrieves an entry from database.
+ * Retrieves an entry from database (or from the attribute cache, if enabled).
+ * Cache hits are accounted by caller function.
  */
-int ListMgr_Get(lmgr_t *p_mgr, const entry_id_t *p_id, attr_set_t *p_info);
+int _ListMgr_Get(lmgr_t *p_mgr, const entry_id_t *p_id, attr_set_t *p_info,
+                 const char *caller);
+#define ListMgr_Get(_m, _id, _i) _ListMgr_Get(_m, _id, _i, __func__)
+
+/** Dump hit ratios of the attribute cache (by ListMgr_Get() caller). */
+void ListMgr_CacheDumpStats(void);
+
+/** Dump the usage of the directory path cache. */
+void ListMgr_PathCacheDumpStats(void);
+
+/** Dump the usage of the connection pool. */
+void ListMgr_PoolDumpStats(void);
+
+/** Dump the most expensive DB queries (by template and by caller). */
+void ListMgr_QueryDumpStats(void);
+
+/**
+ * Retrieves a set of entries from database, using a single request
+ * for main, annex and names tables.
+ * @param p_ids    array of entry ids.
+ * @param p_infos  array of attribute sets. As for ListMgr_Get(),
+ *                 p_infos[i]->attr_mask indicates the attributes
+ *                 to be retrieved for entry i (null mask: only check
+ *                 if the entry exists).
+ * @param rcs      output array: status for each entry
+ *                 (DB_SUCCESS or DB_NOT_EXISTS).
+ * @return DB_SUCCESS or the status of the failed request.
+ */
+int ListMgr_BatchGet(lmgr_t *p_mgr, unsigned int count,
+                     const entry_id_t **p_ids, attr_set_t **p_infos,
+                     int *rcs);
 
 /**
  * Retrieve the FID from the database given the parent FID and the
@@ -676,6 +888,27 @@ int ListMgr_Insert(lmgr_t *p_mgr, entry_id_t *p_id,
 int ListMgr_BatchInsert(lmgr_t *p_mgr, entry_id_t **p_ids,
                         attr_set_t **p_attrs, unsigned int count,
                         bool update_if_exists);
+/**
+ * Sort a batch of entries (ids and attrs arrays in the same order)
+ * in the order of their primary key in the database.
+ */
+int ListMgr_SortByPK(entry_id_t **p_ids, attr_set_t **p_attrs,
+                     unsigned int count);
+
+/**
+ * Enter bulk load mode (for the initial scan of an empty DB):
+ * new entries are spooled to files and loaded by large batches,
+ * and the accounting table is computed once at the end.
+ * Entries are only visible in DB once they are loaded.
+ * @return DB_NOT_SUPPORTED if bulk load is not enabled.
+ */
+int ListMgr_BulkLoadStart(lmgr_t *p_mgr);
+
+/**
+ * Load all the spooled entries, compute accounting and leave
+ * bulk load mode.
+ */
+int ListMgr_BulkLoadEnd(lmgr_t *p_mgr);
 
 /**
  * Modifies an existing entry in the database.
@@ -683,6 +916,15 @@ int ListMgr_BatchInsert(lmgr_t *p_mgr, entry_id_t **p_ids,
 int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
                    const attr_set_t *p_update_set);
 
+/**
+ * Modifies a set of existing entries in the database, in a single
+ * transaction, with a single request per table.
+ * @param p_ids    array of entry ids (each id must appear only once).
+ * @param p_attrs  array of attributes to be updated for each entry.
+ */
+int ListMgr_BatchUpdate(lmgr_t *p_mgr, unsigned int count,
+                        const entry_id_t **p_ids, const attr_set_t **p_attrs);
+
 /**
  * Applies a modification to all entries that match the specified filter.
  */
@@ -698,6 +940,15 @@ typedef void (*rm_cb_func_t) (const entry_id_t *);
 int ListMgr_Remove(lmgr_t *p_mgr, const entry_id_t *p_id,
                    const attr_set_t *p_attr_set, bool last);
 
+/**
+ * Removes a set of names from the database, in a single transaction.
+ * @param p_attrs  array of attributes of each entry (as in ListMgr_Remove).
+ * @param last     for each entry, remove the entry itself.
+ */
+int ListMgr_BatchRemove(lmgr_t *p_mgr, unsigned int count,
+                        const entry_id_t **p_ids, const attr_set_t **p_attrs,
+                        const bool *last);
+
 /**
  * Removes all entries that match the specified filter.
  */
@@ -711,6 +962,14 @@ int ListMgr_Replace(lmgr_t *p_mgr, entry_id_t *old_id, attr_set_t *old_attrs,
                     entry_id_t *new_id, attr_set_t *new_attrs,
                     bool src_is_last, bool update_target_if_exists);
 
+/**
+ * Replace a set of entries (as in ListMgr_Replace), in a single transaction.
+ */
+int ListMgr_BatchReplace(lmgr_t *p_mgr, unsigned int count,
+                         entry_id_t **old_ids, attr_set_t **old_attrs,
+                         entry_id_t **new_ids, attr_set_t **new_attrs,
+                         bool src_is_last, bool update_target_if_exists);
+
 /**
  * Soft Rm functions.
  * \addtogroup SOFT_RM_FUNCTIONS
@@ -736,6 +995,32 @@ int ListMgr_MassSoftRemove(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
  */
 int ListMgr_SoftRemove_Discard(lmgr_t *p_mgr, const entry_id_t *p_id);
 
+/**
+ * Definitely remove a set of entries from the delayed removal table,
+ * with a single request.
+ */
+int ListMgr_SoftRemove_BatchDiscard(lmgr_t *p_mgr, unsigned int count,
+                                    const entry_id_t **p_ids);
+
+/**
+ * Definitely remove the entries removed in [min_rm_time, max_rm_time[
+ * from the delayed removal table, by batches of entries (mass_rm_batch,
+ * or 10000 entries).
+ * \param[out] p_count number of discarded entries (may be NULL).
+ */
+int ListMgr_SoftRemove_DiscardRange(lmgr_t *p_mgr, time_t min_rm_time,
+                                    time_t max_rm_time,
+                                    unsigned long long *p_count);
+
+/**
+ * Definitely remove the entries removed before max_rm_time from the
+ * delayed removal table. If it is partitioned by rm_time
+ * (softrm_partition_time), expired partitions are dropped first.
+ * \param[out] p_count number of discarded entries (may be NULL).
+ */
+int ListMgr_SoftRemove_Expire(lmgr_t *p_mgr, time_t max_rm_time,
+                              unsigned long long *p_count);
+
 /**
  * Initialize a list of items removed 'softly', sorted by expiration time.
  * Selecting 'expired' entries is done using an rm_time criteria in p_filter
@@ -763,7 +1048,9 @@ int ListMgr_GetRmEntry(lmgr_t *p_mgr, const entry_id_t *p_id,
 /** @} */
 
 /**
- * Create a (persitent) table to tag entries.
+ * Create a tag to list the entries that are not tagged.
+ * With a diff_gen field in ENTRIES, this allocates a new generation
+ * (nothing is copied). Else, this creates a table with the ids of the set.
  * \param filter indicate this applies to a restricted set of entries.
  * \param reset indicate if the table is cleaned in case it already exists.
  */
@@ -778,7 +1065,9 @@ int ListMgr_DestroyTag(lmgr_t *p_mgr, const char *tag_name);
 int ListMgr_TagEntry(lmgr_t *p_mgr, const char *tag_name,
                      const entry_id_t *p_id);
 /**
- * Return an iterator on non-tagged entries (in the set specified by CreateTag filter)
+ * Return an iterator on non-tagged entries (in the set specified by CreateTag filter).
+ * With a diff_gen field, entries updated since the tag was created are not
+ * listed, and the set can only be listed by the process that created the tag.
  */
 struct lmgr_iterator_t *ListMgr_ListUntagged(lmgr_t *p_mgr,
                                              const char *tag_name,
@@ -876,6 +1165,15 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
 int ListMgr_GetNext(struct lmgr_iterator_t *p_iter,
                     entry_id_t *p_id, attr_set_t *p_info);
 
+/**
+ * Get the position of the last entry returned by a sorted iterator,
+ * to continue the iteration after it (using lmgr_iter_opt_t::after).
+ * pos->set is false if the position can't be determined (no entry returned,
+ * or sort order not supported).
+ */
+void ListMgr_IterPosition(const struct lmgr_iterator_t *p_iter,
+                          lmgr_iter_pos_t *pos);
+
 /**
  * Release iterator resources.
  */
@@ -897,6 +1195,7 @@ void ListMgr_CloseIterator(struct lmgr_iterator_t *p_iter);
  * \param child_attr_list   [out] array of child attrs
  * \param child_count       [out] number of returned children
  *
+ * With several parents, children are returned grouped by parent.
  * ListMgr_FreeAttrs() must be called on each child attribute
  * and child_id_list and child_attr_list must be freed with MemFree()
  */
@@ -906,6 +1205,64 @@ int ListMgr_GetChild(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
                      wagon_t **child, attr_set_t **child_attr_list,
                      unsigned int *child_count);
 
+/** usage of a directory subtree, for a given entry type */
+typedef struct dir_agg_t {
+    char        type[16];
+    uint64_t    count;
+    uint64_t    size;
+    uint64_t    blocks;
+} dir_agg_t;
+
+/**
+ * Get the usage of all the entries under a directory, by entry type
+ * (the directory itself is not included).
+ * \param agg_tab   [out]    array of usage by type
+ * \param p_count   [in,out] size of the array / number of returned types
+ * 
+etval DB_NOT_SUPPORTED if directory aggregates are not maintained
+ */
+int ListMgr_GetDirAgg(lmgr_t *p_mgr, const entry_id_t *p_id,
+                      dir_agg_t *agg_tab, unsigned int *p_count);
+
+#ifdef _LUSTRE
+/** width of last access buckets of OST aggregates (seconds) */
+#define OST_AGG_BUCKET  86400
+
+/** usage of the files on an OST, for a last access bucket */
+typedef struct ost_agg_t {
+    unsigned int ost_index;
+    unsigned int bucket;    /**< last_access / OST_AGG_BUCKET */
+    uint64_t     count;
+    uint64_t     size;
+    uint64_t     blocks;
+} ost_agg_t;
+
+/**
+ * Get the usage of an OST by last access bucket (sorted by bucket),
+ * or the total usage of each OST if ost_index is -1 (bucket is 0).
+ * The output array is allocated by the call, and must be freed by MemFree().
+ * \retval DB_NOT_SUPPORTED if OST aggregates are not maintained
+ */
+int ListMgr_GetOSTAgg(lmgr_t *p_mgr, int ost_index, ost_agg_t **p_tab,
+                      unsigned int *p_count);
+
+/**
+ * Get the last access time before which the files of an OST account
+ * for the given number of blocks.
+ * \retval DB_NOT_EXISTS if all files of the OST are needed.
+ * \retval DB_NOT_SUPPORTED if OST aggregates are not maintained
+ */
+int ListMgr_OSTAggBound(lmgr_t *p_mgr, unsigned int ost_index,
+                        uint64_t blocks, unsigned int *p_bound);
+#endif
+
+/**
+ * Set md_update and path_update of all children of a directory,
+ * to mark them as seen without scanning them.
+ */
+int ListMgr_TouchChildren(lmgr_t *p_mgr, const entry_id_t *parent_id,
+                          time_t update_time);
+
 /** @} */
 
 /**
@@ -1008,6 +1365,146 @@ int ListMgr_GetNextReportItem(struct lmgr_report_t *p_iter,
  */
 void ListMgr_CloseReport(struct lmgr_report_t *p_iter);
 
+/** sketches of files maintained by the pipeline */
+#define SKETCH_NAME_SIZE    "top_size"      /**< largest files */
+#define SKETCH_NAME_ATIME   "oldest_access" /**< least recently accessed */
+
+/**
+ * Store a top-K sketch of entries (replacing its previous contents).
+ * \param name     name of the sketch.
+ * \param values   value of each entry (e.g. size).
+ */
+int ListMgr_StoreSketch(lmgr_t *p_mgr, const char *name,
+                        const entry_id_t *ids, const uint64_t *values,
+                        unsigned int count);
+
+/**
+ * Load a top-K sketch of entries, sorted by value.
+ * Output arrays are allocated by the call, and must be freed by MemFree().
+ * \retval DB_NOT_EXISTS if no sketch was ever stored.
+ */
+int ListMgr_GetSketch(lmgr_t *p_mgr, const char *name, bool desc,
+                      entry_id_t **p_ids, uint64_t **p_values,
+                      unsigned int *p_count);
+
+#ifdef _LUSTRE
+/** OST usage sample (in bytes) */
+typedef struct ost_usage_sample {
+    unsigned int ost_index;
+    uint64_t     size;
+    uint64_t     used;
+    uint64_t     avail;
+} ost_usage_sample_t;
+
+/**
+ * Store a sample of OST usage in the history, and drop the samples older
+ * than ost_history_retention.
+ */
+int ListMgr_StoreOSTUsage(lmgr_t *p_mgr, time_t when,
+                          const ost_usage_sample_t *samples,
+                          unsigned int count);
+
+/**
+ * Load the usage history of an OST since the given time, sorted by time.
+ * Output arrays are allocated by the call, and must be freed by MemFree().
+ * \retval DB_NOT_EXISTS if no history was ever stored.
+ */
+int ListMgr_GetOSTUsageHistory(lmgr_t *p_mgr, unsigned int ost_index,
+                               time_t since, time_t **p_times,
+                               ost_usage_sample_t **p_samples,
+                               unsigned int *p_count);
+#endif
+
+/** resolutions of the stats history */
+typedef enum {
+    STAT_RES_MINUTE = 0,
+    STAT_RES_HOUR,
+    STAT_RES_DAY,
+    STAT_RES_COUNT
+} stat_res_e;
+
+/** aggregate of the samples of a series in a time bucket */
+typedef struct stat_point {
+    time_t       time;      /**< start of the bucket */
+    unsigned int count;     /**< number of samples */
+    double       sum;
+    double       min;
+    double       max;
+    double       last;      /**< value of the latest sample */
+} stat_point_t;
+
+/** a sample of a series */
+typedef struct stat_sample {
+    const char *name;
+    double      value;
+} stat_sample_t;
+
+/**
+ * Add samples to the stats history: each sample is accounted in the
+ * minute, hour and day buckets of its series. Minute buckets are dropped
+ * after 2 days, hour buckets after 90 days.
+ */
+int ListMgr_StoreStatSamples(lmgr_t *p_mgr, time_t when,
+                             const stat_sample_t *samples,
+                             unsigned int count);
+
+/**
+ * List the series of the stats history matching a SQL LIKE pattern
+ * (NULL for all). The output array and its strings are allocated by the
+ * call, and must be freed by MemFree().
+ * \retval DB_NOT_EXISTS if no sample was ever stored.
+ */
+int ListMgr_GetStatNames(lmgr_t *p_mgr, const char *pattern,
+                         char ***p_names, unsigned int *p_count);
+
+/**
+ * Load the history of a series at the given resolution since the given
+ * time, sorted by time. The output array is allocated by the call,
+ * and must be freed by MemFree().
+ * \retval DB_NOT_EXISTS if no sample was ever stored.
+ */
+int ListMgr_GetStatHistory(lmgr_t *p_mgr, const char *name, stat_res_e res,
+                           time_t since, stat_point_t **p_points,
+                           unsigned int *p_count);
+
+/** ignore mark of an entry for a policy */
+typedef struct lmgr_ignore_mark {
+    entry_id_t   id;
+    time_t       until;     /**< the entry can't be eligible before */
+    unsigned int md_update; /**< md_update of the entry when it was checked */
+} lmgr_ignore_mark_t;
+
+/**
+ * Prepare the ignore marks of a policy before a run: drop all its marks if
+ * its rules signature changed since the last run, else the expired ones.
+ */
+int ListMgr_CheckIgnoreMarks(lmgr_t *p_mgr, const char *policy,
+                             const char *rules_sig);
+
+/**
+ * Set (or replace) the ignore marks of entries for a policy.
+ * Entries with a valid mark are not listed by iterators with the
+ * skip_marked option.
+ */
+int ListMgr_SetIgnoreMarks(lmgr_t *p_mgr, const char *policy,
+                           const lmgr_ignore_mark_t *marks,
+                           unsigned int count);
+
+/**
+ * Refresh the report snapshots older than report_snapshot_interval,
+ * and drop the ones that are no longer used.
+ * Snapshots are created by the first ListMgr_Report() call with the
+ * 'snapshot' option.
+ */
+int ListMgr_RefreshSnapshots(lmgr_t *p_mgr);
+
+/**
+ * Rebuild the summary tables of the web GUI (user, group, type and status
+ * aggregates of ACCT_STAT), and append the filesystem totals to their
+ * history. Refresh times are recorded in the SUMMARY_INFO table.
+ */
+int ListMgr_RefreshSummaries(lmgr_t *p_mgr);
+
 /**
  * Get the number of entries in DB.
  */
@@ -1062,6 +1559,8 @@ void ListMgr_CloseProfile(struct lmgr_profile_t *p_iter);
 #define CURR_POLICY_START_SUFFIX   "_start_current"  /* start of current run */
 #define CURR_POLICY_TRIGGER_SUFFIX "_trigger_current" /* trigger of current run
                                                        */
+#define LAST_POLICY_LATENCY_SUFFIX "_action_latency" /* average action time
+                                                      of last run (usec) */
 
 #define FS_PATH_VAR         "FS_Path"
 #define USAGE_MAX_VAR       "MaxUsage"
@@ -1081,9 +1580,20 @@ void ListMgr_CloseProfile(struct lmgr_profile_t *p_iter);
 #define LAST_SCAN_CURMSPE     "LastScanCurMsPerEntry"
 #define LAST_SCAN_NB_THREADS  "LastScanNbThreads"
 
+#define LAST_SCAN_EXPECTED    "LastScanExpectedEntries"
+#define LAST_SCAN_SUBTREES    "LastScanPendingSubtrees" /* list of
+                                     <scanned>:<expected>:<name>/ */
+#define SCAN_SUBTREE_COUNTS   "ScanSubtreeCounts" /* list of <count>:<name>/
+                                                     from the last scan */
+
 #define PREV_SCAN_START_TIME  "PrevScanStartTime"
 #define PREV_SCAN_END_TIME    "PrevScanEndTime"
 
+// Distributed scan
+#define SCAN_SHARD_PREFIX     "ScanShard" /* variable is <prefix>_<index>,
+                                             value is <start>:<end>:<status> */
+#define SCAN_SHARDS_LAST_GC   "ScanShardsLastGC"
+
 #define SCAN_STATUS_DONE       "done"
 #define SCAN_STATUS_RUNNING    "running"
 #define SCAN_STATUS_ABORTED    "aborted"
@@ -1101,6 +1611,16 @@ void ListMgr_CloseProfile(struct lmgr_profile_t *p_iter);
 #define CL_DIFF_PREFIX        "ChangelogDiff"  /* variable is
                                                   <prefix>_<event_name> */
 
+// Entry processor statistics
+#define ENTRYPROC_STATS_PREFIX "EntryProcStats" /* variable is
+                                                   <prefix>_<stage_name> */
+
+// Policy run statistics
+#define POLICY_STATS_PREFIX    "PolicyStats" /* variables are <prefix>_<policy>
+                                                and <prefix>_<policy>_<rule> */
+#define POLICY_CKPT_PREFIX     "PolicyRunCkpt" /* variable is
+                                                  <prefix>_<policy> */
+
 #define MAX_VAR_LEN     1024
 /**
  *  Gets variable value.
@@ -1114,6 +1634,15 @@ int ListMgr_GetVar(lmgr_t *p_mgr, const char *varname, char *value,
  */
 int ListMgr_SetVar(lmgr_t *p_mgr, const char *varname, const char *value);
 
+/**
+ *  Atomically sets variable value if its current value is the expected one.
+ *  @param expected NULL if the variable is expected not to exist.
+ *  @param value    NULL to delete the variable.
+ *  @return DB_OUT_OF_DATE if the current value is not the expected one.
+ */
+int ListMgr_TestAndSetVar(lmgr_t *p_mgr, const char *varname,
+                          const char *expected, const char *value);
+
 /** @} */
 
 /**
@@ -1184,7 +1713,11 @@ struct sm_instance;
 struct time_modifier;
 
 /**
- * Convert simple expressions to ListMgr filter (append filter).
+ * Convert boolean expressions to ListMgr filter (append filter).
+ * The expression is converted to an AND of OR-clauses. The resulting filter
+ * may match more entries than the expression: conditions that can't be
+ * exactly expressed in SQL are considered as TRUE, so entries must still be
+ * matched against the expression.
  * Imbrications of AND and OR filters produced by
  * convert_boolexpr_to_simple_filter() are only supported by listmgr_iterators.
  * Callers that use convert_boolexpr_to_simple_filter() must take care not using
@@ -1231,6 +1764,28 @@ int lmgr_range2list(const char *set, db_type_e type, value_list_t *p_list);
 void ListMgr_MergeAttrSets(attr_set_t *p_target_attrset,
                            const attr_set_t *p_source_attrset, bool update);
 
+/**
+ * Packed attribute set: only stores the set attributes, with strings at
+ * their actual length. Suited to keep many entries in memory (e.g. in
+ * queues), but values can only be accessed by unpacking it.
+ */
+typedef struct attr_pack attr_pack_t;
+
+/** pack an attribute set (allocated, free with ListMgr_FreePackedAttrs) */
+attr_pack_t *ListMgr_PackAttrs(const attr_set_t *p_attrs);
+
+/**
+ * Unpack an attribute set. The target is overwritten (its previous
+ * contents is not freed). Free it with ListMgr_FreeAttrs().
+ * @return 0 on success, -ENOMEM on allocation failure.
+ */
+int ListMgr_UnpackAttrs(const attr_pack_t *pack, attr_set_t *p_attrs);
+
+/** mask of the attributes in a packed set */
+const attr_mask_t *ListMgr_PackedMask(const attr_pack_t *pack);
+
+void ListMgr_FreePackedAttrs(attr_pack_t *pack);
+
 /** return the mask of attributes that differ */
 attr_mask_t ListMgr_WhatDiff(const attr_set_t *p_tgt,
                              const attr_set_t *p_src);
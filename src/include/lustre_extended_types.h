@@ -120,6 +120,8 @@ struct obd_statfs {
  * one changelog record.
  *
  * rh_get_cl_cr_name(): return a pointer to cr_name
+ *
+ * rh_cl_rec_size(): size of a record, including its names
  */
 
 #if HAVE_DECL_CLF_RENAME
@@ -137,6 +139,11 @@ static inline char *rh_get_cl_cr_name(const struct changelog_rec *rec)
     return changelog_rec_name((struct changelog_rec *)rec);
 }
 
+static inline size_t rh_cl_rec_size(const struct changelog_rec *rec)
+{
+    return changelog_rec_size((struct changelog_rec *)rec) + rec->cr_namelen;
+}
+
 /* This doesn't make sense anymore but it is still defined by Lustre
  * 2.7. */
 #undef HAVE_CHANGELOG_EXTEND_REC
@@ -158,6 +165,11 @@ static inline char *rh_get_cl_cr_name(const struct changelog_ext_rec *rec)
     return (char *)rec->cr_name;
 }
 
+static inline size_t rh_cl_rec_size(const struct changelog_ext_rec *rec)
+{
+    return sizeof(*rec) + rec->cr_namelen;
+}
+
 #else
 /* Lustre 2.1 to 2.2 */
 #define CL_REC_TYPE struct changelog_rec
@@ -172,6 +184,11 @@ static inline char *rh_get_cl_cr_name(const struct changelog_rec *rec)
     return (char *)rec->cr_name;
 }
 
+static inline size_t rh_cl_rec_size(const struct changelog_rec *rec)
+{
+    return sizeof(*rec) + rec->cr_namelen;
+}
+
 #endif
 
 #endif /* HAVE_CHANGELOGS */
@@ -24,6 +24,24 @@
 typedef struct changelog_record {
     CL_REC_TYPE  *p_log_rec;
     char         *mdt;
+    /* rank of the operation in the push order of its reader thread */
+    unsigned long long push_seq;
+    /* time the operation was pushed to the pipeline */
+    struct timeval push_time;
+    /* mask of the record types that have been merged into this one */
+    uint32_t      merged_types;
+    /* queue (priority lane) of the op in the changelog reader */
+    unsigned int  lane:1;
+
+    /* Record view: ops derived from another record (e.g. the unlink of
+     * a rename target) just have their own record header, and reference
+     * the name in the original record. p_log_rec points to this header.
+     * The name is only valid until the op is pushed to the pipeline
+     * (its name attribute is set from it). */
+    unsigned int  is_view:1;
+    CL_REC_TYPE   view;
+    const char   *view_name;
+    unsigned int  view_namelen;
 } changelog_record_t;
 #endif
 
@@ -52,6 +70,7 @@ extern const pipeline_descr_t diff_pipeline_descr;
 typedef enum {
     STD_PIPELINE,
     DIFF_PIPELINE,
+    BENCH_PIPELINE, /* no-op stages, for benchmarking (arg is stage count) */
 } pipeline_flavor_e;
 
 /* specific argument for diff pipeline (accessible as entry_proc_arg) */
@@ -61,6 +80,8 @@ typedef struct _diff_arg {
     const char     *db_tag;
     FILE           *lovea_file;
     FILE           *fid_remap_file;
+    /** number of threads recreating entries (apply=fs) */
+    unsigned int    recov_threads;
     unsigned int    recov_from_backend:1;
 } diff_arg_t;
 
@@ -0,0 +1,113 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  policy_candidates.h
+ * \brief In-memory index of the entries in policy scopes.
+ *
+ * The index of a policy is loaded from the DB when the policy module starts,
+ * then kept up to date by the entry processor and by policy actions.
+ * It may contain entries that no longer match the scope (e.g. if it was not
+ * possible to determine it), so policy runs must still check candidates.
+ */
+#ifndef _POLICY_CANDIDATES_H
+#define _POLICY_CANDIDATES_H
+
+#include "policy_run.h"
+#include "status_manager.h"
+
+/** candidate of a policy run */
+struct candidate {
+    entry_id_t  id;
+    int         sort_key;
+};
+
+/**
+ * Value of the sort attribute of policy runs for an entry.
+ * @return -1 if the entry has no such attribute.
+ */
+static inline int attr_sort_key(unsigned int sort_attr,
+                                const attr_set_t *p_attrs)
+{
+    if (sort_attr == LRU_ATTR_NONE)
+        return -1;
+
+    if (!attr_mask_test_index(&p_attrs->attr_mask, sort_attr))
+        return -1;
+
+    if (is_sm_info(sort_attr)) {
+        unsigned int idx = attr2sminfo_index(sort_attr);
+
+        return *((unsigned int *)p_attrs->attr_values.sm_info[idx]);
+    }
+
+    switch (sort_attr) {
+    case ATTR_INDEX_creation_time:
+        return ATTR(p_attrs, creation_time);
+    case ATTR_INDEX_last_mod:
+        return ATTR(p_attrs, last_mod);
+    case ATTR_INDEX_last_access:
+        return ATTR(p_attrs, last_access);
+    case ATTR_INDEX_rm_time:
+        return ATTR(p_attrs, rm_time);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Create the candidate index of a policy, if it is enabled in its run
+ * configuration. This must be called before the entry processor starts.
+ * @param pol_idx index in policies.policy_list.
+ */
+int candidates_init(unsigned int pol_idx);
+
+/** indicate if a policy has a candidate index */
+bool candidates_enabled(unsigned int pol_idx);
+
+/** indicate if any policy has a candidate index */
+bool candidates_any(void);
+
+/** attributes that can change the candidates of indexed policies */
+attr_mask_t candidates_attr_mask(void);
+
+/** update indexes according to the new attributes of an entry */
+void candidates_update(const entry_id_t *id, const attr_set_t *attrs);
+
+/** remove an entry from all indexes (e.g. after its last unlink) */
+void candidates_remove(const entry_id_t *id);
+
+/** remove an entry from the index of a policy */
+void candidates_drop(unsigned int pol_idx, const entry_id_t *id);
+
+/**
+ * Add an entry loaded from the DB to the index of a policy.
+ * The entry is not modified if it is already indexed, as newer
+ * information comes from the entry processor.
+ */
+int candidates_load(unsigned int pol_idx, const entry_id_t *id, int sort_key);
+
+/** the whole DB was loaded to the index of a policy:
+ * it can be used for policy runs */
+void candidates_load_done(unsigned int pol_idx);
+
+/**
+ * Get the indexed candidates of a policy, in sort order.
+ * @param[out] list   Array of candidates, to be released with MemFree().
+ * @param[out] count  Number of candidates in list.
+ * @retval ENODATA if the index is not available (not loaded...).
+ */
+int candidates_get(unsigned int pol_idx, struct candidate **list,
+                   unsigned int *count);
+
+#endif
@@ -25,11 +25,17 @@
 #include "rbh_params.h"
 #include <sys/time.h>
 
+/** boolean expression compiled for matching (see compile_bool_expr()) */
+typedef struct bool_prog bool_prog_t;
+/** path conditions of all policies (see policy_patterns.h) */
+typedef struct path_matcher path_matcher_t;
+
 /** whitelist item is just a boolean expression */
 typedef struct whitelist_item_t {
     bool_node_t     bool_expr;
     attr_mask_t     attr_mask; /**< summary of attributes involved in boolean
                                     expression */
+    bool_prog_t    *prog;      /**< compiled bool_expr */
 } whitelist_item_t;
 
 #define POLICY_NAME_LEN  128
@@ -47,12 +53,16 @@ typedef struct fileset_item_t {
     bool_node_t definition;
     /** summary of attributes involved in boolean expression */
     attr_mask_t attr_mask;
+    /** compiled definition */
+    bool_prog_t *prog;
 
     /* user tunable */
     unsigned int matchable:1;   /* is the fileset matchable or is it a temporary
                                  * fileset to build another one? */
     /* flags for internal management */
     unsigned int used_in_policy:1;  /* is the fileset referenced in a policy? */
+    unsigned int stable:1;  /* does the definition only depend on attribute
+                             * values (not on current time, xattrs...)? */
 
     /* action parameters for policies (merged with parameters from "policy" and
      * "rule", and overrides them).
@@ -91,7 +101,8 @@ typedef enum {
     ACTION_UNSET, /**< not set */
     ACTION_NONE,  /**< explicit noop */
     ACTION_FUNCTION,
-    ACTION_COMMAND
+    ACTION_COMMAND,
+    ACTION_COPROC   /**< request to a co-process helper */
 } action_type_e;
 
 struct action_func_info {
@@ -99,11 +110,17 @@ struct action_func_info {
     char *name;
 };
 
+struct action_coproc_info {
+    struct coproc *coproc;
+    char *request;  /**< request template, with placeholders */
+};
+
 typedef struct policy_action {
     action_type_e type;
     union {
         char **command;
         struct action_func_info func;
+        struct action_coproc_info coproc;
     } action_u; /* command for ACTION_COMMAND,
                  * function for ACTION_FUNCTION, ... */
 } policy_action_t;
@@ -117,6 +134,8 @@ typedef struct rule_item_t {
 
     /** condition for purging/migrating files */
     bool_node_t condition;
+    /** compiled condition */
+    bool_prog_t *prog;
 
     /** if specified, overrides policy defaults */
     policy_action_t action;
@@ -205,6 +224,13 @@ typedef struct policies_t {
     unsigned int        fileset_count;
     attr_mask_t         global_fileset_mask;    /**< mask for all filesets */
 
+    /* path and tree conditions of compiled expressions */
+    path_matcher_t     *path_matcher;
+
+    /* fileclasses matched before this time may refer to older
+     * definitions */
+    time_t              load_time;
+
     /* is there any policy that manages deleted entries? */
     unsigned int        manage_deleted:1;
 
@@ -228,6 +254,13 @@ static inline bool has_deletion_policy(void)
 int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
                   const attr_set_t *p_attrs_cached);
 
+/**
+ * Attributes match_classes() will read for the given entry: those of the
+ * filesets whose previous result can't be reused.
+ */
+attr_mask_t match_classes_mask(const attr_set_t *p_attrs_new,
+                               const attr_set_t *p_attrs_cached);
+
 /* return values for matching */
 typedef enum {
     POLICY_MATCH = 0,
@@ -314,6 +347,38 @@ policy_match_t entry_matches(const entry_id_t *p_entry_id,
                              const time_modifier_t *p_pol_mod,
                              const struct sm_instance *smi);
 
+/**
+ * Check if entry matches a boolean expression, using its compiled program
+ * if not NULL, as policy matching does. Warnings about missing attributes
+ * are not displayed.
+ */
+policy_match_t entry_matches_compiled(const entry_id_t *p_entry_id,
+                                      const attr_set_t *p_entry_attr,
+                                      const bool_node_t *p_node,
+                                      const bool_prog_t *prog,
+                                      const time_modifier_t *p_pol_mod,
+                                      const struct sm_instance *smi);
+
+/**
+ * Set the time reference of the policy evaluations of the current thread,
+ * so that all the checks of a pass compare entry ages to the same "now".
+ * 0 restores the default (read the clock at each evaluation).
+ */
+void policy_eval_set_time(time_t now);
+
+/**
+ * Compile a boolean expression to a flat program, that is faster to evaluate
+ * than the expression tree. The expression must not be modified or freed
+ * while the program is used.
+ * @param matcher  If not NULL, path and tree conditions are registered
+ *                 in this matcher. It must be policies.path_matcher when
+ *                 the program is evaluated.
+ * @return NULL on error (the expression tree must be used instead).
+ */
+bool_prog_t *compile_bool_expr(const bool_node_t *expr,
+                               path_matcher_t *matcher);
+void free_bool_prog(bool_prog_t *prog);
+
 /* read an action params block from config */
 int read_action_params(config_item_t param_block, action_params_t *params,
                        attr_mask_t *mask, char *msg_out);
@@ -79,6 +79,10 @@ typedef struct trigger_item_t {
     unsigned int        max_action_nbr;
     ull_t               max_action_vol;
 
+    /** rate limits of runs from this trigger (0 = unlimited) */
+    double              max_action_rate;
+    ull_t               max_volume_rate;
+
     trigger_value_type_t hw_type;
     threshold_u         hw_u;
 
@@ -141,18 +145,51 @@ static inline char *trigger2str(const trigger_item_t *trig)
 
 typedef struct policy_run_config_t {
     unsigned int        nb_threads;
+    /** bounds of the worker pool in adaptive mode (enabled if max != 0).
+     * nb_threads is then the initial pool size. */
+    unsigned int        nb_threads_min;
+    unsigned int        nb_threads_max;
+    /** CPUs or NUMA nodes of the workers (see rbh_affinity.h) */
+    char                cpu_affinity[256];
     unsigned int        queue_size;
     unsigned int        db_request_limit;
+    /** nbr of parallel DB requests to list candidates */
+    unsigned int        db_list_shards;
+    /** max nbr of OSTs of an OST trigger processed in a single run */
+    unsigned int        max_parallel_osts;
+    /** select the first candidates in sort order in memory,
+     * instead of sorting all of them in the DB */
+    bool                topk_sort;
+    /** max nbr of candidates kept in memory by topk_sort */
+    unsigned int        topk_max_entries;
+    /** maintain the entries in policy scope in memory, from the entry
+     * processor updates, instead of listing them from the DB */
+    bool                candidate_index;
+    /** the index is dropped beyond this nbr of entries */
+    unsigned int        candidate_index_max;
+    /** max nbr of command actions running in the background
+     * (0 = workers wait for their commands) */
+    unsigned int        max_async_actions;
 
     unsigned int        max_action_nbr; /**< can also be specified in each
                                              trigger */
     ull_t               max_action_vol; /**< can also be specified in each
                                              trigger */
+    /** max rate of actions (actions/sec, 0 = unlimited) */
+    double              max_action_rate;
+    /** max volume rate of actions (bytes/sec, 0 = unlimited) */
+    ull_t               max_volume_rate;
+    /** time of day window where rate limits apply (minutes since
+     * midnight). Always enforced if start == end. */
+    int                 rate_limit_start;
+    int                 rate_limit_end;
     trigger_item_t     *trigger_list;
     unsigned int        trigger_count;
 
     time_t              check_action_status_delay;
     time_t              action_timeout;
+    /** keep outstanding actions in memory, and only check the overdue ones */
+    bool                track_actions;
 
     /** interval for reporting progress of current policy run */
     time_t              report_interval;
@@ -188,6 +225,15 @@ typedef struct policy_run_config_t {
     bool                check_action_status_on_startup;
     bool                recheck_ignored_entries;
 
+    /** persist the time until which whitelisted and non-matching entries
+     * can't be eligible, to skip them in next runs: max validity of these
+     * marks (0 = disabled) */
+    time_t              ignore_mark_max_validity;
+
+    /** policies of deleted entries: entries removed for longer than this
+     * are discarded without applying the policy (0 = never) */
+    time_t              deleted_expiration;
+
     /** report policy actions in report file? */
     bool                report_actions;
 
@@ -209,6 +255,15 @@ static inline void counters_add(counters_t *dst, const counters_t *src)
     dst->targeted += src->targeted;
 }
 
+/** subtract counters */
+static inline void counters_sub(counters_t *dst, const counters_t *src)
+{
+    dst->count -= src->count;
+    dst->vol -= src->vol;
+    dst->blocks -= src->blocks;
+    dst->targeted -= src->targeted;
+}
+
 /** test if a counter is zero */
 static inline bool counter_is_set(const counters_t *c)
 {
@@ -274,6 +329,11 @@ typedef struct trigger_status__ {
     ull_t               last_count;
 } trigger_info_t;
 
+struct worker_pool;
+struct rate_limiter;
+struct async_actions;
+struct policy_metrics;
+
 /* policy runtime information */
 typedef struct policy_info_t {
     policy_descr_t         *descr;        /**< point to policy descriptor */
@@ -282,6 +342,15 @@ typedef struct policy_info_t {
                                                          trigger */
     entry_queue_t           queue;        /**< processing queue */
     pthread_t              *threads;      /**< worker threads array (size in config) */
+    struct worker_pool     *pool;         /**< active workers and their
+                                               adaptive sizing */
+    struct rate_limiter    *rate;         /**< policy rate limits */
+    struct rate_limiter    *run_rate;     /**< rate limits of the current run
+                                               (from trigger) */
+    struct async_actions   *async;        /**< command actions in flight
+                                               (if max_async_actions != 0) */
+    struct policy_metrics  *metrics;      /**< live counters and latency
+                                               histograms */
     pthread_t               trigger_thr;  /**< trigger checker thread */
     lmgr_t                  lmgr;         /**< db connexion for triggers */
     trigger_info_t         *trigger_info; /**< stats about policy triggers */
@@ -293,7 +362,16 @@ typedef struct policy_info_t {
     time_t                  gcd_interval; /**< gcd of check intervals
                                                (gcd(policy triggers)) */
     run_flags_t             flags;        /**< from policy_opt */
+    /** cumulated time and count of actions in the current run */
+    unsigned long long      action_usec;
+    unsigned long long      action_count;
+    /** progress of the interrupted run the current run resumes */
+    action_summary_t        resumed;
     unsigned int            aborted:1;    /**< abort status */
+    unsigned int            checkpoint:1; /**< the current run has a
+                                               checkpoint in DB */
+    unsigned int            marks:1;      /**< ignore marks are set and
+                                               used by the current run */
     volatile unsigned int   waiting:1;    /**< a thread is already trying to
                                                join the trigger thread */
 } policy_info_t;
@@ -378,10 +456,27 @@ int policy_module_start(policy_info_t *policy, /* out */
 int policy_module_stop(policy_info_t *policy);
 int policy_module_wait(policy_info_t *policy);
 void policy_module_dump_stats(policy_info_t *policy);
+/** store policy stats in the DB vars table */
+void policy_module_store_stats(policy_info_t *policy, lmgr_t *lmgr);
 
 /* update trigger intervals,
  * update gcd_interval
  */
 void policy_module_update_check_interval(policy_info_t *policy);
 
+/* apply reloaded config to a running policy:
+ * resize its worker pool and queue, update gcd_interval
+ */
+void policy_module_reload(policy_info_t *policy);
+
+/* only check triggers (as --check-thresholds), or switch back to policy
+ * runs when triggers are reached (e.g. on standby takeover)
+ */
+void policy_module_set_check_only(policy_info_t *policy, bool enable);
+
+#ifdef _LUSTRE
+/** store the current usage of OSTs in the DB history */
+int usage_store_ost_history(lmgr_t *lmgr);
+#endif
+
 #endif
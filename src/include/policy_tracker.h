@@ -0,0 +1,82 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  policy_tracker.h
+ * \brief In-memory tracking of outstanding policy actions.
+ *
+ * The tracker of a policy holds the entries whose status is the
+ * 'status_current' of the policy, with the time they must be checked at
+ * (action_timeout after the action started, or check_actions_interval if
+ * there is no timeout). Entries leave the tracker as soon as a new status
+ * is reported for them (by actions, scans or changelogs), so periodic
+ * action checks only query the status of overdue entries.
+ */
+#ifndef _POLICY_TRACKER_H
+#define _POLICY_TRACKER_H
+
+#include "policy_run.h"
+#include "status_manager.h"
+
+/**
+ * Create the action tracker of a policy, if it is enabled in its run
+ * configuration. This must be called before the entry processor starts.
+ * @param pol_idx index in policies.policy_list.
+ */
+int tracker_init(unsigned int pol_idx);
+
+/** indicate if a policy has an action tracker */
+bool tracker_enabled(unsigned int pol_idx);
+
+/** indicate if any policy has an action tracker */
+bool tracker_any(void);
+
+/** status attributes of tracked policies */
+attr_mask_t tracker_attr_mask(void);
+
+/**
+ * Track an entry that has the current status of a policy.
+ * @param start time the action started: the entry is due at
+ *              start + action_timeout.
+ */
+void tracker_add(unsigned int pol_idx, const entry_id_t *id, time_t start);
+
+/**
+ * Update trackers according to the new attributes of an entry:
+ * entries that get the current status of a policy are tracked from now,
+ * entries that get another status are no longer tracked.
+ */
+void tracker_update(const entry_id_t *id, const attr_set_t *attrs);
+
+/** stop tracking an entry in all policies (e.g. after its last unlink) */
+void tracker_remove(const entry_id_t *id);
+
+/** all outstanding actions of a policy were loaded from the DB */
+void tracker_load_done(unsigned int pol_idx);
+
+/** indicate if the tracker of a policy was loaded and can be used */
+bool tracker_loaded(unsigned int pol_idx);
+
+/**
+ * Get the entries of a policy that are due at the given time.
+ * They are no longer tracked: the caller checks them and tracks them again
+ * if their action is still running.
+ * @param[out] list   Array of entry ids, to be released with MemFree().
+ * @param[out] count  Number of entries in list.
+ * @param[out] total  Number of tracked entries, before the call.
+ * If memory is short, the list may only hold the first due entries.
+ */
+int tracker_get_due(unsigned int pol_idx, time_t now, entry_id_t **list,
+                    unsigned int *count, unsigned int *total);
+
+#endif
@@ -24,21 +24,33 @@
 #ifndef _QUEUE_MNGMT_H
 #define _QUEUE_MNGMT_H
 
+/** slot of the ring buffer */
+struct queue_slot {
+    /* sequence number of the slot (see queue.c) */
+    volatile unsigned long  seq;
+    void                   *entry;
+};
+
+/* number of counter sets for acknowledgements: each worker thread
+ * updates its own set, they are aggregated by RetrieveQueueStats() */
+#define QUEUE_STAT_SLOTS 64
+
 typedef struct entry_queue_t {
-    /* cyclic array of entries */
-    void          **queue;
+    /* ring of entries (array_size is a power of 2) */
+    struct queue_slot *slots;
 
     /* size and indexes */
     unsigned int    array_size;
     unsigned int    queue_size;
-    unsigned int    first_index;
-    unsigned int    last_index;
-
-    /* mutex for accessing the queue */
-    pthread_mutex_t queue_lock;
+    /* next positions to be read and written (not modulo array_size) */
+    volatile unsigned long head;
+    volatile unsigned long tail;
 
     /* token for free slots */
     sem_t           sem_empty;
+    /* free slot tokens to be taken back after the queue size was
+     * decreased (see Queue_Resize) */
+    volatile unsigned int empty_debt;
     /* token for filled slots */
     sem_t           sem_full;
 
@@ -49,18 +61,25 @@ typedef struct entry_queue_t {
     time_t          last_ack;
 
     /* idle threads */
-    unsigned int    nb_thr_waiting;
+    volatile unsigned int nb_thr_waiting;
 
-    /* array of status count */
+    /* arrays of status count (QUEUE_STAT_SLOTS x status_stride) */
     unsigned int   *status_array;
     unsigned int    status_count;
+    unsigned int    status_stride;
 
-    /* special fields for counting feedback info */
+    /* special fields for counting feedback info
+     * (QUEUE_STAT_SLOTS x feedback_stride) */
     unsigned long long *feedback_array;
     unsigned int    feedback_count;
+    unsigned int    feedback_stride;
 
 } entry_queue_t;
 
+/* the ring of a queue is allocated for this times its initial size,
+ * so the queue can grow online */
+#define QUEUE_MAX_GROWTH 4
+
 /**
  * Queue initialization.
  * @param queue_size: buffer size (over this count, inserts are blocking).
@@ -70,6 +89,14 @@ typedef struct entry_queue_t {
 int CreateQueue(entry_queue_t *p_queue, unsigned int queue_size,
                 unsigned int max_status, unsigned int feedback_count);
 
+/**
+ * Change the size of a queue, without losing its entries.
+ * The size can be increased up to QUEUE_MAX_GROWTH times the initial size.
+ * When it is decreased, inserts block until the queue is under the new size.
+ * @return the size actually set.
+ */
+unsigned int Queue_Resize(entry_queue_t *p_queue, unsigned int queue_size);
+
 /**
  * Reset status info
  */
@@ -86,6 +113,13 @@ void Reset_Feedback(entry_queue_t *p_queue, unsigned int feedback_index);
  */
 int Queue_Insert(entry_queue_t *p_queue, void *entry);
 
+/**
+ * Insert several entries to the queue.
+ * Can be blocking if the queue is full.
+ */
+int Queue_InsertBatch(entry_queue_t *p_queue, void **entries,
+                      unsigned int count);
+
 /**
  * Get an entry from the queue.
  * The call is blocking until there is an element available
@@ -93,6 +127,21 @@ int Queue_Insert(entry_queue_t *p_queue, void *entry);
  */
 int Queue_Get(entry_queue_t *p_queue, void **p_ptr);
 
+/**
+ * Get up to 'max' entries from the queue.
+ * The call is blocking until there is at least one element available
+ * in the queue.
+ * \param[out] p_count number of retrieved entries.
+ */
+int Queue_GetBatch(entry_queue_t *p_queue, void **entries, unsigned int max,
+                   unsigned int *p_count);
+
+/**
+ * Get an entry from the queue, without blocking.
+ * \retval EAGAIN if there is no element available in the queue.
+ */
+int Queue_TryGet(entry_queue_t *p_queue, void **p_ptr);
+
 /**
  * Acknwoledge when an entry has been handled.
  * Indicates the status and optionnal feedback info (as unsigned long long
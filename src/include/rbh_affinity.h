@@ -0,0 +1,55 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_affinity.h
+ * \brief CPU and NUMA placement of thread groups.
+ *
+ * Affinities are given as strings in configuration (cpu_affinity
+ * parameter of thread groups): a list of CPUs and CPU ranges
+ * (e.g. "0-7,16-23"), or a list of NUMA nodes prefixed by "node:"
+ * (e.g. "node:0"). NUMA topology is read from sysfs.
+ */
+#ifndef _RBH_AFFINITY_H
+#define _RBH_AFFINITY_H
+
+#include <stddef.h>
+
+/** max NUMA nodes taken into account */
+#define AFFINITY_MAX_NODES 64
+
+/**
+ * Check an affinity string.
+ * @return 0 if it is valid (or empty), else EINVAL.
+ */
+int affinity_check(const char *str);
+
+/**
+ * Bind the calling thread to the given affinity (nothing is done
+ * if str is empty). Errors are logged with the given thread group name.
+ */
+int affinity_set_thread(const char *str, const char *group);
+
+/** number of NUMA nodes (1 if the system is not NUMA) */
+unsigned int numa_node_count(void);
+
+/** NUMA node of the CPU the calling thread is running on */
+unsigned int numa_current_node(void);
+
+/**
+ * Describe the CPUs of an affinity string, and their NUMA nodes
+ * (e.g. "cpus 0-7 (node 0)").
+ */
+void affinity_describe(const char *str, char *buf, size_t size);
+
+#endif
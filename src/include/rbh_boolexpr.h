@@ -170,6 +170,9 @@ typedef struct compare_triplet_t {
                                                       manager specific attr */
     compare_direction_t op;
     compare_value_t     val;
+    const char         *status; /**< for status criteria: val.str in the
+                                     status manager dictionary (NULL for
+                                     empty status, see get_status_str) */
 } compare_triplet_t;
 
 /** Type of boolean expression: unary, binary or criteria */
@@ -92,6 +92,10 @@ typedef enum run_flags {
     RUNFLG_NO_GC        = (1 << 5),  /* don't clean orphan entries after scan */
     RUNFLG_FORCE_RUN    = (1 << 6),  /* force running policy even if no scan was
                                         complete */
+    RUNFLG_RESUME       = (1 << 7),  /* resume an interrupted scan from its
+                                        checkpoint */
+    RUNFLG_SIMULATE     = (1 << 8),  /* only estimate policy runs from DB
+                                        contents */
 } run_flags_t;
 
 /* Config module masks:
@@ -0,0 +1,60 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_digest.h
+ * \brief Incremental digests of file contents.
+ *
+ * Digests are computed on the fly by copy actions, and printed as
+ * "<type>:<hex value>" (e.g. "crc32c:e3069283").
+ */
+#ifndef _RBH_DIGEST_H
+#define _RBH_DIGEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    DIGEST_NONE = 0,
+    DIGEST_CRC32C,  /**< CRC32 Castagnoli (SSE4.2 accelerated if available) */
+    DIGEST_SHA256,
+} digest_type_e;
+
+/** max length of a printed digest, including the final '\\0' */
+#define DIGEST_STR_MAX  (sizeof("sha256:") + 64)
+
+struct rbh_digest {
+    digest_type_e type;
+    union {
+        uint32_t crc;
+        struct {
+            uint32_t state[8];
+            uint64_t length;
+            uint8_t  block[64];
+            size_t   used;
+        } sha;
+    } u;
+};
+
+/** @return the digest type of the given name, or DIGEST_NONE. */
+digest_type_e str2digest_type(const char *str);
+
+const char *digest_type2str(digest_type_e type);
+
+void digest_init(struct rbh_digest *d, digest_type_e type);
+void digest_update(struct rbh_digest *d, const void *buf, size_t len);
+
+/** print the digest as "<type>:<hex>" to a buffer of DIGEST_STR_MAX bytes */
+void digest_final(struct rbh_digest *d, char *out);
+
+#endif
@@ -0,0 +1,68 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_evloop.h
+ * \brief Shared event loop for timers, child processes and I/O.
+ *
+ * A single thread runs a GLib main loop, on which modules register their
+ * periodic tasks and watchers (external commands, see rbh_cmd.c) instead
+ * of running their own sleeping threads. Callbacks run in the loop thread
+ * and must not block. Timers flagged EVLOOP_OFFLOAD may block: they are run
+ * by helper threads, that are started on demand and exit when idle.
+ */
+#ifndef _RBH_EVLOOP_H
+#define _RBH_EVLOOP_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+/**
+ * Timer callback.
+ * @return the delay before the next call (in milliseconds), 0 to remove
+ *         the timer.
+ */
+typedef unsigned int (*evloop_timer_cb_t)(void *arg);
+
+/** the timer callback may block */
+#define EVLOOP_OFFLOAD  0x1
+
+/**
+ * Get the context of the shared loop, to attach sources to it.
+ * The loop is started at the first call.
+ * @return NULL if the loop could not be started.
+ */
+GMainContext *evloop_context(void);
+
+/** is the calling thread the loop thread? */
+bool evloop_is_current(void);
+
+/**
+ * Register a timer, first called after the given delay.
+ * Delays in whole seconds are rounded so that the timers expiring in the
+ * same second are run in a single wakeup.
+ * @return timer id (> 0), or a negative error code.
+ */
+int evloop_timer_add(unsigned int delay_ms, int flags, evloop_timer_cb_t cb,
+                     void *arg);
+
+/**
+ * Unregister a timer. When this returns, its callback is not running
+ * anymore (unless it is called from the callback itself).
+ */
+void evloop_timer_remove(int id);
+
+/** log statistics about the loop */
+void evloop_dump_stats(void);
+
+#endif
@@ -0,0 +1,59 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_fidpath.h
+ * \brief Cache of directory paths, to resolve entry paths from their parent
+ *        FID and name without calling fid2path.
+ *
+ * The cache is shared by all threads of the process. Its size is set by
+ * General::fid_path_cache_size (0 disables it).
+ */
+#ifndef _RBH_FIDPATH_H
+#define _RBH_FIDPATH_H
+
+#include "list_mgr.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef _HAVE_FID
+
+/**
+ * Get the absolute path of a directory.
+ * The path is taken from the cache, else it is resolved by walking the
+ * linkEA of the directory up to a cached ancestor, and cached.
+ * @return 0 on success, a negative error code else.
+ */
+int fidpath_dir_lookup(const entry_id_t *dir_id, char *path, size_t size);
+
+/**
+ * Build the path of an entry from its parent and name.
+ * If the entry is a directory (child_dir != NULL), it is cached.
+ * @return 0 on success, a negative error code else.
+ */
+int fidpath_child_path(const entry_id_t *parent_id, const char *name,
+                       const entry_id_t *child_dir, char *path, size_t size);
+
+/**
+ * The given entry has been renamed or removed: drop its path, and the paths
+ * of its descendants, from the cache.
+ */
+void fidpath_invalidate(const entry_id_t *p_id);
+
+/** log cache statistics */
+void fidpath_dump_stats(void);
+
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_hist.h
+ * \brief Latency histograms.
+ *
+ * Buckets are log-linear (HDR-like): each power of 2 of microseconds
+ * is split into HIST_SUB sub-buckets. A histogram is an array of
+ * HIST_BUCKETS counters.
+ */
+#ifndef _RBH_HIST_H
+#define _RBH_HIST_H
+
+#include "rbh_misc.h"
+#include <sys/time.h>
+
+#define HIST_SUB_BITS   2
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    (32 * HIST_SUB)
+
+static inline unsigned int hist_bucket(unsigned long long usec)
+{
+    unsigned int log2, b;
+
+    if (usec < HIST_SUB)
+        return usec;
+
+    log2 = 63 - __builtin_clzll(usec);
+    b = (log2 - HIST_SUB_BITS + 1) * HIST_SUB
+        + ((usec >> (log2 - HIST_SUB_BITS)) & (HIST_SUB - 1));
+
+    return MIN2(b, HIST_BUCKETS - 1);
+}
+
+/** upper bound of a bucket, in microseconds */
+static inline unsigned long long hist_bucket_max(unsigned int b)
+{
+    unsigned int log2;
+
+    if (b < HIST_SUB)
+        return b;
+
+    log2 = b / HIST_SUB + HIST_SUB_BITS - 1;
+    return (((unsigned long long)(HIST_SUB + b % HIST_SUB + 1))
+            << (log2 - HIST_SUB_BITS)) - 1;
+}
+
+static inline unsigned long long tv2usec(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+/** @return the given percentile of a histogram in milliseconds */
+static inline double hist_percentile(const unsigned long long *hist,
+                                     double pct)
+{
+    unsigned long long total = 0, acc = 0, rank;
+    unsigned int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++)
+        total += hist[b];
+    if (total == 0)
+        return 0.0;
+
+    rank = (unsigned long long)(pct * total / 100.0);
+    if (rank >= total)
+        rank = total - 1;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        acc += hist[b];
+        if (acc > rank)
+            break;
+    }
+    return hist_bucket_max(MIN2(b, HIST_BUCKETS - 1)) / 1000.0;
+}
+
+#endif
@@ -0,0 +1,42 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_intern.h
+ * \brief Process-wide table of interned strings.
+ *
+ * Interning is meant for low-cardinality values (user and group names,
+ * fileclass ids...): each distinct string is stored once, so interned
+ * strings can be compared by pointer and used as keys of pointer-based
+ * caches. Interned strings are never freed.
+ */
+#ifndef _RBH_INTERN_H
+#define _RBH_INTERN_H
+
+#include <stdbool.h>
+
+/**
+ * Get the interned copy of a string (it is added if it is not yet).
+ * Lookups of already interned strings don't take any lock.
+ * Interned strings are aligned on 8 bytes.
+ * @return the interned string, NULL on allocation failure.
+ */
+const char *str_intern(const char *str);
+
+/** Get the interned copy of a string, NULL if it is not interned. */
+const char *str_intern_lookup(const char *str);
+
+/** number of interned strings */
+unsigned int str_intern_count(void);
+
+#endif
@@ -59,12 +59,24 @@ typedef struct log_config__ {
      */
     int         batch_alert_max;
 
+    /* alert aggregation: if not 0, entry alerts are always batched, and
+     * delivered as a digest by a background thread at this interval */
+    time_t      alert_digest_interval;
+    /* max number of entries listed for each alert in a digest
+     * (0=unlimited). Other entries are only counted. */
+    unsigned int alert_samples;
+    /* max number of alert mails per hour (0=unlimited) */
+    unsigned int alert_mail_max;
+
     time_t      stats_interval;
 
     /* display entry attributes for each entry in alert reports */
     bool        alert_show_attrs;
     bool        log_process;  /* display process name in the log line header */
     bool        log_host;     /* display hostname in the log line header */
+    /* log lines are written by a background thread, and dropped if it
+     * can't keep up */
+    bool        async_log;
 
 } log_config_t;
 
@@ -92,10 +104,26 @@ void force_debug_level(log_level level);
  */
 void force_log_file(const char *file);
 
+/**
+ * Highest log level compiled in: log calls of higher levels are removed at
+ * compile time (e.g. 50 to remove LVL_FULL traces from release builds).
+ */
+#ifndef RBH_LOG_MAX_LEVEL
+#define RBH_LOG_MAX_LEVEL   100
+#endif
+
+/** level check done before evaluating the arguments of a log call */
+#define LOG_LEVEL_ENABLED(_lvl) \
+    ((_lvl) <= RBH_LOG_MAX_LEVEL && \
+     __builtin_expect(log_config.debug_level >= (_lvl), 0))
+
 /**
  * Indicates if traces of the given level are to be displayed.
  */
-int TestDisplayLevel(log_level level);
+static inline int TestDisplayLevel(log_level level)
+{
+    return LOG_LEVEL_ENABLED(level);
+}
 
 /* Open log and report files,
  * Returns -1 and sets error in case of an error.
@@ -131,7 +159,7 @@ void vDisplayLogFn(log_level debug_level, const char *tag, const char *format,
  */
 #define DisplayLog(dbg_level, tag, ...) \
     do { \
-        if (log_config.debug_level >= (dbg_level)) \
+        if (LOG_LEVEL_ENABLED(dbg_level)) \
             DisplayLogFn((dbg_level), (tag), __VA_ARGS__); \
     } while (0)
 
@@ -140,7 +168,7 @@ void vDisplayLogFn(log_level debug_level, const char *tag, const char *format,
  */
 #define vDisplayLog(dbg_level, tag, format, args) \
     do { \
-        if (log_config.debug_level >= (dbg_level)) \
+        if (LOG_LEVEL_ENABLED(dbg_level)) \
             vDisplayLogFn((dbg_level), (tag), (format), args); \
     } while (0)
 
@@ -176,5 +204,7 @@ void Alert_EndBatching(void);
 
 /* Wait for next stat deadline */
 void WaitStatsInterval(void);
+/* Interval between stat dumps (seconds) */
+unsigned int StatsInterval(void);
 
 #endif
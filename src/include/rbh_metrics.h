@@ -0,0 +1,99 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_metrics.h
+ * \brief Daemon metrics, served over HTTP for monitoring tools.
+ *
+ * Modules register collectors, which are called when the metrics are
+ * scraped and emit the current values of their counters, gauges and
+ * histograms. Metrics are served on a local TCP port or Unix socket
+ * (see the Metrics config block), in Prometheus text exposition format
+ * ("GET /metrics") or as JSON ("GET /metrics.json"). A CPU profile can also
+ * be requested ("GET /profile?seconds=N", see rbh_prof.h).
+ */
+#ifndef _RBH_METRICS_H
+#define _RBH_METRICS_H
+
+#include "rbh_cfg.h"
+#include "rbh_const.h"
+#include <stdbool.h>
+
+typedef enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+} metric_type_e;
+
+typedef struct metrics_out metrics_out_t;
+
+/** collector callback: emits the metrics of a module */
+typedef void (*metrics_collect_fn)(metrics_out_t *out, void *arg);
+
+/** register a collector (called at each scrape, until unregistered) */
+int metrics_register(metrics_collect_fn fn, void *arg);
+/** unregister a collector (waits for a running scrape to end) */
+void metrics_unregister(metrics_collect_fn fn, void *arg);
+
+/**
+ * Start a metric family: the following samples belong to it.
+ * The name is prefixed by "robinhood_". Several collectors can emit
+ * samples of the same family (e.g. with different labels).
+ */
+void metrics_family(metrics_out_t *out, const char *name, metric_type_e type,
+                    const char *help);
+
+/**
+ * Emit a counter or gauge sample of the current family.
+ * @param labels NULL-terminated list of label names and values
+ *               (name1, value1, name2, value2, ..., NULL), or NULL.
+ */
+void metrics_value(metrics_out_t *out, const char *const *labels,
+                   double value);
+
+/**
+ * Emit a histogram sample of the current family, from a rbh_hist.h
+ * histogram of microseconds (exported in seconds).
+ * @param sum_usec  sum of the accounted values (or 0 to estimate it from
+ *                  the buckets).
+ */
+void metrics_hist(metrics_out_t *out, const char *const *labels,
+                  const volatile unsigned long long *hist,
+                  unsigned long long sum_usec);
+
+/**
+ * sample callback of metrics_foreach()
+ * @param key  "family{label="value",...}" (without the "robinhood_" prefix)
+ */
+typedef void (*metrics_sample_fn)(const char *key, metric_type_e type,
+                                  double value, void *arg);
+
+/**
+ * Call all collectors, and pass each counter and gauge sample to the
+ * callback (histograms are skipped).
+ */
+void metrics_foreach(metrics_sample_fn cb, void *arg);
+
+/** Start serving metrics (if Metrics::listen is set) */
+int metrics_start(void);
+
+/** config handlers */
+typedef struct metrics_config_t {
+    /** "[host:]port" or the path of a Unix socket (empty to disable) */
+    char    listen[RBH_PATH_MAX];
+} metrics_config_t;
+
+extern metrics_config_t metrics_config;
+extern mod_cfg_funcs_t metrics_cfg_hdlr;
+
+#endif
@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <glib.h>
 #include <semaphore.h>
+#include <time.h>
 #include "rbh_logs.h"
 
 /* displaying FID */
@@ -235,6 +236,14 @@ int File_GetStripeByPath(const char *entry_path, stripe_info_t *p_stripe_info,
 int File_GetStripeByDirFd(int dirfd, const char *fname,
                           stripe_info_t *p_stripe_info,
                           stripe_items_t *p_stripe_items);
+/** Retrieve stripe info of an open file (no RPC, the layout is got at
+ * open time) */
+int File_GetStripeByFd(int fd, stripe_info_t *p_stripe_info,
+                       stripe_items_t *p_stripe_items);
+/** Decode stripe info from a raw LOV EA (e.g. read from a MDT dump) */
+int File_GetStripeByLovEA(const void *lovea, size_t len,
+                          stripe_info_t *p_stripe_info,
+                          stripe_items_t *p_stripe_items);
 /**
  * check if a file has data on the given OST.
  */
@@ -248,6 +257,17 @@ blkcnt_t BlocksOnOST(blkcnt_t blocks, unsigned int ost_index,
                      const stripe_info_t *sinfo,
                      const stripe_items_t *sitems);
 
+/**
+ * compute the number of blocks of a file on each of its OSTs,
+ * in a single pass over its layout.
+ * @param[out] stripe_blocks  blocks on sitems->stripe[i].ost_idx, for each
+ *                            stripe i (sinfo->stripe_count items).
+ * @return the number of stripes set in stripe_blocks.
+ */
+unsigned int BlocksByOST(blkcnt_t blocks, const stripe_info_t *sinfo,
+                         const stripe_items_t *sitems,
+                         blkcnt_t *stripe_blocks);
+
 #ifdef HAVE_LLAPI_GETPOOL_INFO
 /** Create a file with the given stripe information */
 int CreateStriped(const char *path, const stripe_info_t *old_stripe,
@@ -268,6 +288,15 @@ void path_check_update(const entry_id_t *p_id,
                        const char *fid_path, attr_set_t *p_attrs,
                        attr_mask_t attr_mask);
 
+/**
+ * Register the file descriptor of the entry being processed by the
+ * current thread (fd = -1 to unregister it), so that its information
+ * can be queried on the same handle.
+ */
+void Lustre_SetEntryFd(const entry_id_t *p_id, int fd);
+/** @return the registered descriptor of the entry, or -1 */
+int Lustre_GetEntryFd(const entry_id_t *p_id);
+
 #define FID_IS_ZERO(_pf) (((_pf)->f_seq == 0) && ((_pf)->f_oid == 0))
 
 #endif
@@ -291,7 +320,26 @@ static inline unsigned int cltime2nsec(uint64_t cltime)
 int Get_OST_usage(const char *fs_path, unsigned int ost_index,
                   struct statfs *ost_statfs);
 
+/** usage of an OST */
+typedef struct ost_usage {
+    int             rc;     /**< error getting the usage of this OST
+                                 (e.g. EAGAIN for a gap in OST indexes) */
+    struct statfs   stfs;
+} ost_usage_t;
+
+/**
+ * Retrieve the usage of all OSTs, by concurrent requests.
+ * @param[out] p_table  usage of each OST index (to be freed by MemFree()).
+ * @param[out] p_count  number of OST indexes.
+ */
+int Get_all_OST_usage(const char *fs_path, ost_usage_t **p_table,
+                      unsigned int *p_count);
+
 #ifdef HAVE_LLAPI_GETPOOL_INFO
+/** Retrieve the OST indexes of a pool (to be freed by MemFree()) */
+int Get_pool_members(const char *poolname, unsigned int **p_indexes,
+                     unsigned int *p_count);
+
 /** Retrieve pool usage info */
 int Get_pool_usage(const char *poolname, struct statfs *pool_statfs);
 #endif
@@ -302,6 +350,14 @@ int lustre_mds_stat(const char *fullpath, int parentfd, struct stat *inode);
 int lustre_mds_stat_by_fid(const entry_id_t *p_id, struct stat *inode);
 #endif
 
+#if defined(_HAVE_FID) && defined(HAVE_LLAPI_GET_MDT_INDEX_BY_FID)
+/** Get the number of MDTs of the filesystem */
+int Lustre_GetMDTCount(unsigned int *count);
+/** Get the index of the MDT holding an entry
+ * @return the MDT index, or a negative error code */
+int Lustre_GetMDTIndex(const entry_id_t *p_id);
+#endif
+
 #ifndef _MDT_SPECIFIC_LOVEA
 /**
  * build LOVEA buffer from stripe information
@@ -421,6 +477,23 @@ unsigned int gcd(unsigned int x, unsigned int y);
  */
 void rh_sleep(unsigned int seconds);
 
+/**
+ * Current time, for hot paths that only need a second granularity
+ * (e.g. per-entry timestamps and age checks).
+ * The coarse clock is read from the vDSO, without syscall nor hardware
+ * clock access (its resolution is the kernel tick).
+ */
+static inline time_t coarse_time(void)
+{
+#ifdef CLOCK_REALTIME_COARSE
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0)
+        return ts.tv_sec;
+#endif
+    return time(NULL);
+}
+
 /* signal safe semaphore ops with error logging */
 /* man (3) sem_wait/sem_post: on error, the value of the semaphore is left
  * unchanged */
@@ -453,6 +526,23 @@ static inline void sem_post_safe(sem_t *sem)
 
 #define rh_usleep(_usec) usleep(_usec)
 
+/**
+ * Write/read exactly len bytes (retrying on EINTR and short transfers).
+ * @return 0 on success, -errno on error. rh_read_all() returns -ENODATA
+ *         if the end of file is reached before any byte is read, and
+ *         -EPIPE if it is reached in the middle.
+ */
+int rh_write_all(int fd, const void *buf, size_t len);
+int rh_read_all(int fd, void *buf, size_t len);
+
+/**
+ * Listen on / connect to a stream socket: an absolute path for a Unix
+ * socket, else "[host:]port" (host defaults to localhost).
+ * @return the socket fd, -errno on error.
+ */
+int rh_listen(const char *addr);
+int rh_connect(const char *addr);
+
 /** replace a pattern in a string with another sub-string
  * \param str_in_out must be large enough to receive
  *  the resulting string, and cannot exceed 1024.
@@ -493,6 +583,58 @@ int cb_stderr_to_log(void *arg, char *line, size_t size, int stream);
  */
 int execute_shell_command(char **cmd, parse_cb_t cb_func, void *cb_arg);
 
+/**
+ * Completion callback of an asynchronous command.
+ * \param[in] rc  command status, as returned by execute_shell_command().
+ */
+typedef void (*cmd_done_cb_t) (void *udata, int rc);
+
+/**
+ * Start a shell command and return without waiting for it.
+ * Commands are watched by the shared event loop (see rbh_evloop.h): it
+ * calls cb_func for each output line, then done_cb when the command
+ * terminated.
+ * done_cb is not called if the command could not be started.
+ */
+int execute_shell_command_async(char **cmd, parse_cb_t cb_func, void *cb_arg,
+                                cmd_done_cb_t done_cb, void *done_arg);
+
+/**
+ * Co-process helper: a long-lived command that receives requests on its
+ * stdin, and sends a reply for each of them on its stdout:
+ *    request: "<id> <request>\n"
+ *    reply:   "<id> <status>[ <output>]\n"
+ * status is 0 on success. Replies can be sent in any order, so the helper
+ * can process several requests at once. Its stderr is redirected to the log.
+ * The helper is started by the first request, and restarted by the next one
+ * if it terminates (pending requests then fail with -EPIPE).
+ */
+struct coproc;
+
+/**
+ * Get the co-process helper for a command line (it is not started yet).
+ * Helpers are shared by all callers of the same command line.
+ * Global placeholders ({cfg}, {fspath}...) are replaced when it starts.
+ */
+struct coproc *coproc_get(char **cmd);
+
+/**
+ * Send a request to a helper and wait for its reply.
+ * \param[in,out] out  initialized GString to collect the output of the
+ *                     reply (NULL to ignore it).
+ * 
+eturn the status of the reply, or a negative error code.
+ */
+int coproc_call(struct coproc *cp, const char *request, GString *out);
+
+/**
+ * Send a request to a helper without waiting for its reply.
+ * done_cb is called by the reader thread of the helper (and is not called
+ * if the request could not be sent).
+ */
+int coproc_call_async(struct coproc *cp, const char *request,
+                      cmd_done_cb_t done_cb, void *done_arg);
+
 /**
  * Quote an argument for shell commande line.
  * The caller must free the returned string. */
@@ -537,6 +679,21 @@ char *subst_params(const char *str_in,
                    const struct sm_instance *smi,
                    bool quote, bool strict_braces);
 
+/**
+ * Same as subst_params(), without allocating the result.
+ * Strings are parsed once and cached by the calling thread.
+ * @return str_in if it has no placeholder, else a buffer of the calling
+ *         thread, that is valid until its next call to subst_params*().
+ */
+const char *subst_params_r(const char *str_in,
+                           const char *str_descr,
+                           const entry_id_t *p_id,
+                           const attr_set_t *p_attrs,
+                           const action_params_t *params,
+                           const char **subst_array,
+                           const struct sm_instance *smi,
+                           bool quote, bool strict_braces);
+
 /**
  * Replace special parameters {cfg}, {fspath}, ... in the given string.
  * Result is formated as argc/argv for shell by the function in cmd_out,
@@ -593,4 +750,11 @@ int set_uid_val(const char *username, db_type_u *val);
 int set_gid_val(const char *groupname, db_type_u *val);
 const char *id_as_str(db_type_u *val);
 
+/**
+ * Name of a user or group id for display (uid_gid_as_numbers mode),
+ * or the id if it can't be resolved (then written to buf).
+ */
+const char *uid2name(uid_t uid, char *buf, size_t buf_sz);
+const char *gid2name(gid_t gid, char *buf, size_t buf_sz);
+
 #endif
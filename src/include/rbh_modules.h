@@ -91,6 +91,23 @@ action_func_t module_get_action(const char *name);
  */
 action_scheduler_t *module_get_scheduler(const char *name);
 
+/**
+ * Unlike commands, function actions have no output stream. They can
+ * report a short result (e.g. the digest of copied data) to the caller of
+ * the action with this function. The output is attached to the calling
+ * thread, and replaces any previous one.
+ *
+ * \param[in] str  The output string (copied).
+ */
+void module_action_output_set(const char *str);
+
+/**
+ * Get and reset the output of the last function action run by the thread.
+ *
+ * \return The output, to be released with g_free(), or NULL if none was set.
+ */
+char *module_action_output_take(void);
+
 /**
  * Release resources associated to robinhood dynamic modules.
  *
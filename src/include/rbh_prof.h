@@ -0,0 +1,78 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_prof.h
+ * \brief Built-in sampling profiler.
+ *
+ * When enabled, the process is sampled on CPU time (SIGPROF) and the
+ * call stacks are aggregated by thread role. The result is written in
+ * "folded stacks" format (one line per distinct stack: "frame;frame;... N"),
+ * as consumed by flamegraph.pl, speedscope or 'perf script' tooling.
+ * Profiling is switched at runtime, by SIGUSR2 or by the metrics endpoint
+ * ("GET /profile?seconds=N").
+ */
+#ifndef _RBH_PROF_H
+#define _RBH_PROF_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/** role of a thread, used as the root frame of its stacks */
+typedef enum {
+    PROF_ROLE_OTHER = 0,
+    PROF_ROLE_SCAN,
+    PROF_ROLE_PIPELINE,
+    PROF_ROLE_POLICY,
+    PROF_ROLE_CHGLOG,
+    PROF_ROLE_COUNT
+} prof_role_e;
+
+/** default profiling duration, when not specified (sec) */
+#define PROF_DEFAULT_DURATION 60
+
+/**
+ * Set the role of the current thread.
+ * @param detail optional static string giving more details about the
+ *               current task (e.g. pipeline stage), or NULL.
+ */
+void prof_set_role(prof_role_e role, const char *detail);
+
+/** update the detail of the current thread role (static string or NULL) */
+void prof_set_detail(const char *detail);
+
+/** start sampling. Returns EBUSY if a profiling is already running. */
+int prof_start(void);
+
+/** stop sampling (the collected stacks are kept until prof_dump()) */
+void prof_stop(void);
+
+/** tell if sampling is running */
+bool prof_running(void);
+
+/** write the collected stacks in folded format, and reset them */
+void prof_dump(FILE *out);
+
+/**
+ * Profile for the given duration in background, then write the result
+ * to the given file. Returns EBUSY if a profiling is already running.
+ */
+int prof_run_async(unsigned int seconds, const char *file);
+
+/**
+ * Profile for the given duration (or until prof_stop() is called),
+ * then write the result to the given stream.
+ */
+int prof_run(unsigned int seconds, FILE *out);
+
+#endif
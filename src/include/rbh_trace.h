@@ -0,0 +1,71 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_trace.h
+ * \brief Sampled tracing of the processing of changelog records.
+ *
+ * A trace is a list of timed spans (time in the reader, in each pipeline
+ * stage, until the record is cleared...). Traces are written to a file
+ * when they are released, in Chrome trace event format (JSON array of
+ * complete events, one row per trace), that can be loaded in
+ * chrome://tracing or Perfetto.
+ */
+#ifndef _RBH_TRACE_H
+#define _RBH_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/* max number of spans in a trace (the following ones are dropped) */
+#define TRACE_MAX_SPANS 32
+
+typedef struct rbh_trace rbh_trace_t;
+
+/**
+ * Open the trace file (appended to if it exists).
+ * @param ratio  trace 1 item out of ratio (0 to disable tracing).
+ */
+int trace_init(const char *file, unsigned int ratio);
+
+/** change the sampling ratio (0 to disable tracing) */
+void trace_set_ratio(unsigned int ratio);
+
+/** close the trace file */
+void trace_close(void);
+
+/** is the item with the given sequence number to be traced? */
+bool trace_sampled(uint64_t seq);
+
+/**
+ * Create a trace, with a reference held by the caller.
+ * @param name  name of the trace (e.g. record type and fid)
+ * @param id    identifier of the traced item (e.g. record index)
+ * @param cat   category of the item (e.g. MDT name)
+ */
+rbh_trace_t *trace_new(const char *name, uint64_t id, const char *cat);
+
+/**
+ * Add a span to the trace (thread safe).
+ * @param name  static string (it is only written when the trace is released)
+ */
+void trace_span(rbh_trace_t *trace, const char *name,
+                const struct timeval *start, const struct timeval *end);
+
+/** take a reference on the trace */
+void trace_get(rbh_trace_t *trace);
+
+/** release a reference: the trace is written when the last one is
+ * released */
+void trace_put(rbh_trace_t *trace);
+
+#endif
@@ -298,6 +298,31 @@ int smi_init_all(run_flags_t flags);
  */
 const char *get_status_str(const status_manager_t *sm, const char *in_str);
 
+/**
+ * Statuses in attr_set_t always point to the strings of the status
+ * manager dictionary (status_enum), as returned by get_status_str()
+ * (the DB stores them as ENUMs of the same dictionary). So they are
+ * compared by address, and a status is encoded by its index in the
+ * dictionary.
+ * @return the index of status in sm->status_enum, -1 if it is not part
+ *         of the dictionary.
+ */
+static inline int status_index(const status_manager_t *sm, const char *status)
+{
+    int i;
+
+    for (i = 0; i < sm->status_count; i++)
+        if (sm->status_enum[i] == status)
+            return i;
+    return -1;
+}
+
+/** compare 2 statuses of the same status manager (NULL for no status) */
+static inline bool status_eq(const char *st1, const char *st2)
+{
+    return st1 == st2;
+}
+
 /** return the list of allowed statuses for a status manager
  * (to be displayed in command help).
  * @param[in]     sm   status manager to query for its status list
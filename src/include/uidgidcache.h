@@ -34,6 +34,13 @@
 
 int InitUidGid_Cache(void);
 
+/** Load all the users and groups that can be enumerated
+ * (getpwent/getgrent), keeping the ones already cached. Enumeration
+ * functions are not reentrant: only one thread may call it. */
+void UidGidCache_Prefetch(void);
+
+/* Only the ids and the names are set in returned entries.
+ * Names are interned strings (see rbh_intern.h). */
 const struct passwd *GetPwUid(uid_t owner);
 const struct group *GetGrGid(gid_t gid);
 
@@ -59,6 +59,9 @@ typedef struct updt_params_t {
     updt_param_item_t   path;
 #endif
     updt_param_item_t   fileclass; /* only never/always/periodic allowed */
+    /** max entries/sec refreshed in background when their periodic update
+     * is due (0 = no background refresh) */
+    unsigned int        refresh_rate;
 } updt_params_t;
 
 /**
@@ -66,6 +69,16 @@ typedef struct updt_params_t {
  */
 bool need_fileclass_update(const attr_set_t *p_attrs);
 
+/**
+ * Check if some attributes changed between the DB and new attributes.
+ * New attributes that are not known in DB are considered as changed.
+ * \param depends  attributes to be checked
+ *                 (e.g. the attributes a fileclass definition reads)
+ */
+bool fileclass_attrs_changed(const attr_set_t *p_db_attrs,
+                             const attr_set_t *p_new_attrs,
+                             const attr_mask_t *depends);
+
 /**
  *  Check if path or metadata needs to be updated
  *  \param p_allow_event [out] if set to true, the path
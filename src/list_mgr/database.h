@@ -15,6 +15,7 @@
 #define _GENERIC_DB_H
 
 #include "list_mgr.h"
+#include <sys/time.h>
 
 #define MAIN_TABLE	        "ENTRIES"
 #define DNAMES_TABLE        "NAMES"
@@ -28,11 +29,20 @@
 #define ACCT_TRIGGER_UPDATE "ACCT_ENTRY_UPDATE"
 #define ACCT_TRIGGER_DELETE "ACCT_ENTRY_DELETE"
 #define ACCT_FIELD_COUNT    "count"
+#define DIRAGG_TABLE        "DIR_AGG"
+#define OSTAGG_TABLE        "OST_AGG"
 #define ACCT_DEFAULT_OWNER  "unknown"
 #define ACCT_DEFAULT_GROUP  "unknown"
 #define SZRANGE_FUNC        "sz_range"
 #define ONE_PATH_FUNC       "one_path"
 #define THIS_PATH_FUNC      "this_path"
+/* reversed names, to match name suffixes by index (name_suffix_index) */
+#define RNAME_FIELD         "rname"
+#define RNAME_INDEX         "rname_index"
+/* generation of the last diff that saw an entry (see listmgr_tags.c) */
+#define DIFF_GEN_FIELD      "diff_gen"
+#define DIFF_GEN_INDEX      "diff_gen_index"
+#define DIFF_GEN_DEF        DIFF_GEN_FIELD" INT UNSIGNED NOT NULL DEFAULT 0"
 
 /* for HSM flavors only */
 #define  RECOV_TABLE     "RECOVERY"
@@ -67,12 +77,37 @@ int            db_close_conn( db_conn_t * conn );
 
 /* -------------------- SQL queries/result management ---------------- */
 
-/* execute sql directive (optionnaly with returned result) */
-int            db_exec_sql( db_conn_t * conn, const char *query, result_handle_t * p_result );
+/* execute sql directive (optionnaly with returned result).
+ * Query times are accounted by caller function. */
+int            _db_exec_sql(db_conn_t *conn, const char *query,
+                            result_handle_t *p_result, const char *caller);
+#define db_exec_sql(_c, _q, _r) _db_exec_sql(_c, _q, _r, __func__)
 
 /* like db_exec_sql, but expects duplicate key or no such table errors */
-int            db_exec_sql_quiet( db_conn_t * conn, const char *query,
-                                  result_handle_t * p_result );
+int            _db_exec_sql_quiet(db_conn_t *conn, const char *query,
+                                  result_handle_t *p_result,
+                                  const char *caller);
+#define db_exec_sql_quiet(_c, _q, _r) _db_exec_sql_quiet(_c, _q, _r, __func__)
+
+/* like db_exec_sql, but records are read from the server while they are
+ * fetched by db_next_record(). No other request can be issued on the
+ * connection until the result is freed. */
+int            _db_exec_sql_stream(db_conn_t *conn, const char *query,
+                                   result_handle_t *p_result,
+                                   const char *caller);
+#define db_exec_sql_stream(_c, _q, _r) _db_exec_sql_stream(_c, _q, _r, __func__)
+
+/* account the time of a query started at 'start'
+ * (and log it if it is slow) */
+void           db_query_stats_add(const char *query, const char *caller,
+                                  const struct timeval *start);
+
+/* check if the end of a streamed result is due to an error */
+int            db_stream_status(db_conn_t *conn);
+
+/* release a streamed result and close its connection
+ * (without reading the remaining records) */
+int            db_stream_close(db_conn_t *conn, result_handle_t *p_result);
 
 /* get the next record from result */
 int            db_next_record( db_conn_t * conn,
@@ -88,6 +123,68 @@ int            db_result_free( db_conn_t * conn, result_handle_t * p_result );
 /* indicate if the error is retryable (transaction must be restarted) */
 bool db_is_retryable(int db_err);
 
+/* -------------------- Prepared statements ---------------- */
+
+/* a prepared statement (opaque) */
+typedef struct db_stmt db_stmt_t;
+
+/* a statement parameter: DB_TEXT, DB_ENUM_FTYPE or any integer type
+ * (a DB_TEXT parameter with a NULL string is NULL) */
+typedef struct db_param {
+    db_type_e  type;
+    db_type_u  value;
+} db_param_t;
+
+/* prepare a statement, with '?' placeholders for its parameters */
+int db_stmt_prepare(db_conn_t *conn, const char *query, db_stmt_t **p_stmt);
+
+/* execute a prepared statement with the given parameters
+ * (values are sent as is: strings must not be escaped) */
+int db_stmt_exec(db_conn_t *conn, db_stmt_t *stmt, const db_param_t *params,
+                 unsigned int count);
+
+/* get the next result row of the last execution, as strings
+ * (valid until the next call) */
+int db_stmt_fetch(db_conn_t *conn, db_stmt_t *stmt, char *outtab[],
+                  unsigned int outtabsize);
+
+/* integer types can be fetched in binary form by db_stmt_fetch_values() */
+static inline bool db_is_int_type(db_type_e type)
+{
+    switch (type)
+    {
+        case DB_INT:
+        case DB_UINT:
+        case DB_SHORT:
+        case DB_USHORT:
+        case DB_BIGINT:
+        case DB_BIGUINT:
+        case DB_BOOL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* set the types of the result columns of a prepared statement, before its
+ * first execution. Columns of integer types are then fetched in binary form
+ * by db_stmt_fetch_values() (no text conversion). Other columns are fetched
+ * as strings. db_stmt_fetch() cannot be used on such a statement. */
+int db_stmt_result_types(db_conn_t *conn, db_stmt_t *stmt,
+                         const db_type_e *types, unsigned int count);
+
+/* get the next result row of the last execution: integer columns are set
+ * in the matching field of values[i], other columns in values[i].val_str
+ * (valid until the next call). nulls[i] indicates NULL values. */
+int db_stmt_fetch_values(db_conn_t *conn, db_stmt_t *stmt, db_type_u *values,
+                         bool *nulls, unsigned int count);
+
+/* release the result of the last execution */
+void db_stmt_free_result(db_conn_t *conn, db_stmt_t *stmt);
+
+/* release a prepared statement */
+void db_stmt_close(db_conn_t *conn, db_stmt_t *stmt);
+
 typedef enum {DBOBJ_TABLE, DBOBJ_TRIGGER, DBOBJ_FUNCTION, DBOBJ_PROC, DBOBJ_INDEX} db_object_e;
 
 static inline const char *dbobj2str(db_object_e ot)
@@ -109,7 +206,8 @@ int            db_drop_component( db_conn_t * conn, db_object_e obj_type, const
 
 /**
  * check a component exists in the database
- * \param arg depends on the object type: src table for triggers, NULL for others.
+ * \param arg depends on the object type: src table for triggers and indexes,
+ *            NULL for others.
  */
 int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name, const char *arg);
 
@@ -118,6 +216,18 @@ int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
 int            db_create_trigger( db_conn_t * conn, const char *name, const char *event,
                                const char *table, const char *body );
 
+/**
+ * Load rows from a client-side file into a table (rows replace existing
+ * ones with the same primary key).
+ * The file holds tab-separated values, one row per line
+ * (special characters are escaped by '\\', NULL values are written as \N).
+ * @param columns  list of columns (or @variables) of the file.
+ * @param set      optional SET clause (NULL if none).
+ * @return DB_NOT_SUPPORTED if the database does not support this feature.
+ */
+int db_load_file(db_conn_t *conn, const char *path, const char *table,
+                 const char *columns, const char *set);
+
 /* -------------------- miscellaneous routines ---------------- */
 
 /* escape a string in a SQL request */
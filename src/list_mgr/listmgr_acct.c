@@ -0,0 +1,421 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Accounting by aggregated deltas (accounting_deltas = yes).
+ * Instead of triggers updating ACCT_STAT for each modified row, the list
+ * manager reads the accounting values of the modified entries before and
+ * after their modification (in the same transaction), and sums the
+ * differences by accounting key. The deltas of a transaction are written
+ * to ACCT_STAT when it is committed, by one request per key.
+ * Directory and OST aggregate deltas (listmgr_diragg.c, listmgr_ostagg.c)
+ * are collected and flushed by the same functions.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+/* fields of ACCT_STAT primary key, and accounted values */
+static const char **pk_names = NULL;
+static unsigned int nb_pk = 0;
+static const char **val_names = NULL;
+static unsigned int nb_val = 0;
+
+/* deltas of a key: values, count, size ranges */
+#define NB_DELTAS (nb_val + 1 + SZ_PROFIL_COUNT)
+
+struct acct_delta {
+    char       *key;     /* SQL values of the key fields: "'v1','v2',..." */
+    long long   d[];
+};
+
+static inline bool deltas_enabled(void)
+{
+    return lmgr_config.acct && lmgr_config.acct_deltas;
+}
+
+static const char **mask2names(const attr_mask_t *mask, unsigned int *count)
+{
+    const char **names;
+    int i, cookie;
+
+    *count = 0;
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        if (attr_mask_test_index(mask, i))
+            (*count)++;
+    }
+
+    names = MemCalloc(*count, sizeof(*names));
+    if (names == NULL)
+        return NULL;
+
+    *count = 0;
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        if (attr_mask_test_index(mask, i))
+            names[(*count)++] = field_name(i);
+    }
+    return names;
+}
+
+int listmgr_acct_init(void)
+{
+    if (!deltas_enabled() || pk_names != NULL)
+        return DB_SUCCESS;
+
+    pk_names = mask2names(&acct_pk_attr_set, &nb_pk);
+    val_names = mask2names(&acct_attr_set, &nb_val);
+    if (pk_names == NULL || val_names == NULL)
+        return DB_NO_MEMORY;
+
+    DisplayLog(LVL_VERB, LISTMGR_TAG, "Accounting is maintained by "
+               "aggregated deltas (no trigger)");
+    return DB_SUCCESS;
+}
+
+static void delta_free(gpointer p)
+{
+    struct acct_delta *delta = p;
+
+    g_free(delta->key);
+    MemFree(delta);
+}
+
+static struct acct_delta *delta_get(lmgr_t *p_mgr, GString *key)
+{
+    struct acct_delta *delta;
+
+    if (p_mgr->acct_deltas == NULL)
+        p_mgr->acct_deltas = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   NULL, delta_free);
+
+    delta = g_hash_table_lookup(p_mgr->acct_deltas, key->str);
+    if (delta != NULL)
+        return delta;
+
+    delta = MemCalloc(1, sizeof(*delta) + NB_DELTAS * sizeof(long long));
+    if (delta == NULL)
+        return NULL;
+    delta->key = g_strdup(key->str);
+    g_hash_table_insert(p_mgr->acct_deltas, delta->key, delta);
+    return delta;
+}
+
+/**
+ * Add (sign=1) or subtract (sign=-1) the accounting values of the
+ * entries matching a condition on the accounting source table.
+ */
+static int add_deltas(lmgr_t *p_mgr, const char *where, int sign)
+{
+    GString        *req, *key;
+    result_handle_t result;
+    char          **field_tab;
+    unsigned int    nb_fields = nb_pk + NB_DELTAS;
+    int             i, rc;
+
+    field_tab = MemCalloc(nb_fields, sizeof(char *));
+    if (field_tab == NULL)
+        return DB_NO_MEMORY;
+
+    /* same values as in populate_acct_table() */
+    req = g_string_new("SELECT ");
+    attrmask2fieldlist(req, acct_pk_attr_set, T_ACCT, "", "", 0);
+    attrmask2fieldlist(req, acct_attr_set, T_ACCT, "SUM(", ")",
+                       AOF_LEADING_SEP);
+    g_string_append(req, ",COUNT(id),SUM(size=0)");
+    for (i = 1; i < SZ_PROFIL_COUNT-1; i++) /* 1 to 8 */
+        g_string_append_printf(req, ",SUM("SZRANGE_FUNC"(size)=%u)", i-1);
+    g_string_append_printf(req, ",SUM("SZRANGE_FUNC"(size)>=%u)", i-1);
+    g_string_append_printf(req, " FROM %s WHERE %s GROUP BY ",
+                           listmgr_acct_src_table(), where);
+    attrmask2fieldlist(req, acct_pk_attr_set, T_ACCT, "", "", 0);
+#ifdef _MYSQL
+    /* the accounted values are those that are modified */
+    g_string_append(req, " FOR UPDATE");
+#endif
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    if (rc)
+        goto free_str;
+
+    key = g_string_new(NULL);
+    while ((rc = db_next_record(&p_mgr->conn, &result, field_tab, nb_fields))
+           == DB_SUCCESS)
+    {
+        struct acct_delta *delta;
+
+        g_string_truncate(key, 0);
+        for (i = 0; i < nb_pk; i++)
+        {
+            if (i > 0)
+                g_string_append_c(key, ',');
+
+            if (field_tab[i] == NULL)
+                g_string_append(key, "NULL");
+            else
+            {
+                /* escaped string can be up to 2*orig_len+1 */
+                size_t len = 2 * strlen(field_tab[i]) + 1;
+                char  *escaped = MemAlloc(len);
+
+                if (escaped == NULL)
+                {
+                    rc = DB_NO_MEMORY;
+                    break;
+                }
+                db_escape_string(&p_mgr->conn, escaped, len, field_tab[i]);
+                g_string_append_printf(key, "'%s'", escaped);
+                MemFree(escaped);
+            }
+        }
+        if (rc)
+            break;
+
+        delta = delta_get(p_mgr, key);
+        if (delta == NULL)
+        {
+            rc = DB_NO_MEMORY;
+            break;
+        }
+
+        for (i = 0; i < NB_DELTAS; i++)
+        {
+            if (field_tab[nb_pk + i] != NULL)
+                delta->d[i] += sign * strtoll(field_tab[nb_pk + i], NULL, 10);
+        }
+    }
+    db_result_free(&p_mgr->conn, &result);
+    g_string_free(key, TRUE);
+
+    if (rc == DB_END_OF_LIST)
+        rc = DB_SUCCESS;
+
+free_str:
+    g_string_free(req, TRUE);
+    MemFree(field_tab);
+    return rc;
+}
+
+int listmgr_acct_delta(lmgr_t *p_mgr, pktype *pklist, unsigned int count,
+                       int sign)
+{
+    GString *where;
+    int      i, rc;
+
+    if ((!deltas_enabled() && !lmgr_config.dir_agg && !lmgr_config.ost_agg)
+        || count == 0)
+        return DB_SUCCESS;
+
+    where = g_string_new("id IN (");
+    for (i = 0; i < count; i++)
+        g_string_append_printf(where, "%s"DPK, i == 0 ? "" : ",", pklist[i]);
+    g_string_append_c(where, ')');
+
+    rc = listmgr_acct_delta_where(p_mgr, where->str, sign);
+    g_string_free(where, TRUE);
+    return rc;
+}
+
+int listmgr_acct_delta_where(lmgr_t *p_mgr, const char *where, int sign)
+{
+    int rc;
+
+    if (deltas_enabled())
+    {
+        rc = add_deltas(p_mgr, where, sign);
+        if (rc)
+            return rc;
+    }
+
+    /* the same entries contribute to the aggregates of their parents */
+    rc = listmgr_diragg_delta(p_mgr, where, sign);
+#ifdef _LUSTRE
+    /* ...and of their OSTs */
+    if (rc == DB_SUCCESS)
+        rc = listmgr_ostagg_delta(p_mgr, where, sign);
+#endif
+    return rc;
+}
+
+static inline const char *delta_field(unsigned int i)
+{
+    if (i < nb_val)
+        return val_names[i];
+    else if (i == nb_val)
+        return ACCT_FIELD_COUNT;
+    else
+        return sz_field[i - nb_val - 1];
+}
+
+/* insert or increment the accounting of several keys */
+static int flush_positive(lmgr_t *p_mgr, GString *req, unsigned int *nb_keys)
+{
+    int i, rc;
+
+    if (*nb_keys == 0)
+        return DB_SUCCESS;
+
+    g_string_append(req, " ON DUPLICATE KEY UPDATE ");
+    for (i = 0; i < NB_DELTAS; i++)
+        g_string_append_printf(req, "%s%s=%s+VALUES(%s)", i == 0 ? "" : ",",
+                               delta_field(i), delta_field(i), delta_field(i));
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    *nb_keys = 0;
+    return rc;
+}
+
+static int acct_flush(lmgr_t *p_mgr)
+{
+    GString     *ins, *upd;
+    GList       *keys, *l;
+    unsigned int nb_ins = 0;
+    int          i, rc = DB_SUCCESS;
+
+    if (p_mgr->acct_deltas == NULL
+        || g_hash_table_size(p_mgr->acct_deltas) == 0)
+        return DB_SUCCESS;
+
+    /* all connections update keys in the same order (avoid deadlocks) */
+    keys = g_list_sort(g_hash_table_get_keys(p_mgr->acct_deltas),
+                       (GCompareFunc)strcmp);
+
+    ins = g_string_new(NULL);
+    upd = g_string_new(NULL);
+
+    for (l = keys; l != NULL; l = l->next)
+    {
+        struct acct_delta *delta = g_hash_table_lookup(p_mgr->acct_deltas,
+                                                       l->data);
+        bool null = true, negative = false;
+
+        for (i = 0; i < NB_DELTAS; i++)
+        {
+            if (delta->d[i] != 0)
+                null = false;
+            if (delta->d[i] < 0)
+                negative = true;
+        }
+        /* e.g. entry updated without changing its accounting */
+        if (null)
+            continue;
+
+        if (!negative)
+        {
+            if (nb_ins == 0)
+            {
+                g_string_assign(ins, "INSERT INTO "ACCT_TABLE"(");
+                for (i = 0; i < nb_pk; i++)
+                    g_string_append_printf(ins, "%s%s", i == 0 ? "" : ",",
+                                           pk_names[i]);
+                for (i = 0; i < NB_DELTAS; i++)
+                    g_string_append_printf(ins, ",%s", delta_field(i));
+                g_string_append(ins, ") VALUES ");
+            }
+            g_string_append_printf(ins, "%s(%s", nb_ins == 0 ? "" : ",",
+                                   delta->key);
+            for (i = 0; i < NB_DELTAS; i++)
+                g_string_append_printf(ins, ",%lld", delta->d[i]);
+            g_string_append_c(ins, ')');
+            nb_ins++;
+            continue;
+        }
+
+        /* keep the update order */
+        rc = flush_positive(p_mgr, ins, &nb_ins);
+        if (rc)
+            break;
+
+        /* like the delete trigger: no-op if the key is not accounted */
+        g_string_assign(upd, "UPDATE "ACCT_TABLE" SET ");
+        for (i = 0; i < NB_DELTAS; i++)
+            g_string_append_printf(upd, "%s%s=CAST(%s as SIGNED)+(%lld)",
+                                   i == 0 ? "" : ",", delta_field(i),
+                                   delta_field(i), delta->d[i]);
+        g_string_append(upd, " WHERE (");
+        for (i = 0; i < nb_pk; i++)
+            g_string_append_printf(upd, "%s%s", i == 0 ? "" : ",",
+                                   pk_names[i]);
+        g_string_append_printf(upd, ")=(%s)", delta->key);
+
+        rc = db_exec_sql(&p_mgr->conn, upd->str, NULL);
+        if (rc)
+            break;
+    }
+    if (rc == DB_SUCCESS)
+        rc = flush_positive(p_mgr, ins, &nb_ins);
+
+    g_list_free(keys);
+    g_string_free(ins, TRUE);
+    g_string_free(upd, TRUE);
+
+    /* on error, the transaction is aborted: deltas are obsolete */
+    g_hash_table_remove_all(p_mgr->acct_deltas);
+    return rc;
+}
+
+int listmgr_acct_flush(lmgr_t *p_mgr)
+{
+    int rc;
+
+    rc = acct_flush(p_mgr);
+    if (rc == DB_SUCCESS)
+        rc = listmgr_diragg_flush(p_mgr);
+    else
+        listmgr_diragg_discard(p_mgr);
+#ifdef _LUSTRE
+    if (rc == DB_SUCCESS)
+        rc = listmgr_ostagg_flush(p_mgr);
+    else
+        listmgr_ostagg_discard(p_mgr);
+#endif
+    return rc;
+}
+
+void listmgr_acct_discard(lmgr_t *p_mgr)
+{
+    if (p_mgr->acct_deltas != NULL)
+        g_hash_table_remove_all(p_mgr->acct_deltas);
+    listmgr_diragg_discard(p_mgr);
+#ifdef _LUSTRE
+    listmgr_ostagg_discard(p_mgr);
+#endif
+}
+
+void listmgr_acct_close(lmgr_t *p_mgr)
+{
+    if (p_mgr->acct_deltas != NULL)
+    {
+        g_hash_table_destroy(p_mgr->acct_deltas);
+        p_mgr->acct_deltas = NULL;
+    }
+    listmgr_diragg_close(p_mgr);
+#ifdef _LUSTRE
+    listmgr_ostagg_close(p_mgr);
+#endif
+}
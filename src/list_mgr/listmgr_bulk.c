@@ -0,0 +1,463 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Bulk load mode for the initial scan of an empty database.
+ *
+ * Inserted entries are spooled to files (one per connection, table and
+ * attribute mask), which are loaded by large LOAD DATA requests.
+ * Accounting triggers are dropped during the bulk load: the accounting
+ * table is computed once at the end, then triggers are re-created.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "listmgr_stripe.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/* rows of a spool file before it is loaded */
+#define BULK_LOAD_ROWS  100000
+
+/* spool file for a given table and attribute mask */
+struct bulk_file {
+    table_enum          table;
+    attr_mask_t         mask;
+    char                path[RBH_PATH_MAX];
+    FILE               *stream;
+    /* rows written to the file (the file is pending load if it is
+     * closed with rows) */
+    unsigned int        rows;
+    struct bulk_file   *next;
+};
+
+/* spool files of a connection */
+struct bulk_spool {
+    pthread_mutex_t     lock;
+    unsigned int        id;
+    unsigned int        file_seq;
+    struct bulk_file   *files;
+    struct bulk_spool  *next;
+};
+
+/* protects the list of spools and the bulk load state */
+static pthread_mutex_t bulk_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bulk_spool *spools = NULL;
+static unsigned int spool_seq = 0;
+static bool bulk_active = false;
+
+/* bulk load stats */
+static unsigned long long loaded_rows = 0;
+static struct timeval     bulk_start;
+
+static const char *bulk_dir(void)
+{
+#ifdef _MYSQL
+    return lmgr_config.db_config.bulk_load_dir;
+#else
+    return "";
+#endif
+}
+
+/** build the list of columns of a spool file, and the SET clause to
+ * load it (empty if none) */
+static void file_columns(const struct bulk_file *f, GString *cols,
+                         GString *set)
+{
+    switch (f->table)
+    {
+#ifdef _LUSTRE
+        case T_STRIPE_INFO:
+            if (lmgr_config.compact_stripes)
+            {
+                g_string_assign(cols, STRIPE_INFO_LOAD_COMPACT_FIELDS);
+                g_string_assign(set, STRIPE_INFO_LOAD_COMPACT_SET);
+            }
+            else
+                g_string_assign(cols, STRIPE_INFO_FIELDS);
+            return;
+        case T_STRIPE_ITEMS:
+            if (lmgr_config.compact_stripes)
+                g_string_assign(cols, STRIPE_OSTS_FIELDS);
+            else
+            {
+                g_string_assign(cols, STRIPE_ITEMS_LOAD_FIELDS);
+                g_string_assign(set, STRIPE_ITEMS_LOAD_SET);
+            }
+            return;
+#endif
+        default:
+            g_string_assign(cols, "id");
+            attrmask2fieldlist(cols, f->mask, f->table, "", "",
+                               AOF_LEADING_SEP);
+            if (f->table == T_DNAMES)
+                g_string_assign(set, "pkn="HNAME_DEF);
+    }
+}
+
+/** load a closed spool file */
+static int file_load(lmgr_t *p_mgr, struct bulk_file *f)
+{
+    GString *cols = g_string_new(NULL);
+    GString *set = g_string_new(NULL);
+    int      rc;
+
+    file_columns(f, cols, set);
+
+    rc = db_load_file(&p_mgr->conn, f->path, table2name(f->table), cols->str,
+                      set->len > 0 ? set->str : NULL);
+    g_string_free(cols, TRUE);
+    g_string_free(set, TRUE);
+
+    if (rc == DB_SUCCESS)
+    {
+        DisplayLog(LVL_FULL, LISTMGR_TAG, "%u rows loaded from %s to %s",
+                   f->rows, f->path, table2name(f->table));
+        __sync_fetch_and_add(&loaded_rows, f->rows);
+        if (unlink(f->path))
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to remove %s: %s",
+                       f->path, strerror(errno));
+        f->rows = 0;
+    }
+    else if (db_is_retryable(rc))
+    {
+        /* keep it pending */
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Failed to load %s to %s: "
+                   "will retry later", f->path, table2name(f->table));
+    }
+    else
+    {
+        char errmsg[1024];
+
+        /* keep the file for manual recovery */
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to load %s to %s: "
+                   "Error: %s. %u rows are left in this file.", f->path,
+                   table2name(f->table), db_errmsg(&p_mgr->conn, errmsg,
+                                                   sizeof(errmsg)), f->rows);
+        f->rows = 0;
+    }
+    return rc;
+}
+
+/** close and load a spool file (spool lock must be held) */
+static int file_flush(lmgr_t *p_mgr, struct bulk_file *f)
+{
+    if (f->stream != NULL)
+    {
+        if (fclose(f->stream) != 0)
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write %s: %s",
+                       f->path, strerror(errno));
+        f->stream = NULL;
+    }
+
+    if (f->rows == 0)
+        return DB_SUCCESS;
+
+    return file_load(p_mgr, f);
+}
+
+/** load all the files of a spool (spool lock must be held) */
+static int spool_flush(lmgr_t *p_mgr, struct bulk_spool *spool)
+{
+    struct bulk_file *f;
+    int rc = DB_SUCCESS;
+
+    for (f = spool->files; f != NULL; f = f->next)
+    {
+        int rc2 = file_flush(p_mgr, f);
+
+        if (rc2 != DB_SUCCESS && rc == DB_SUCCESS)
+            rc = rc2;
+    }
+    return rc;
+}
+
+static void spool_free(struct bulk_spool *spool)
+{
+    while (spool->files != NULL)
+    {
+        struct bulk_file *f = spool->files;
+
+        spool->files = f->next;
+        MemFree(f);
+    }
+    pthread_mutex_destroy(&spool->lock);
+    MemFree(spool);
+}
+
+struct bulk_spool *listmgr_bulk_begin(lmgr_t *p_mgr)
+{
+    struct bulk_spool *spool;
+
+    /* fast path */
+    if (!bulk_active)
+        return NULL;
+
+    if (p_mgr->bulk == NULL)
+    {
+        spool = MemCalloc(1, sizeof(*spool));
+        if (spool == NULL)
+            return NULL;
+        pthread_mutex_init(&spool->lock, NULL);
+
+        P(bulk_lock);
+        spool->id = spool_seq++;
+        spool->next = spools;
+        spools = spool;
+        V(bulk_lock);
+
+        p_mgr->bulk = spool;
+    }
+
+    P(p_mgr->bulk->lock);
+    /* bulk load may have ended in the meantime */
+    if (!bulk_active)
+    {
+        V(p_mgr->bulk->lock);
+        return NULL;
+    }
+    return p_mgr->bulk;
+}
+
+void listmgr_bulk_end(struct bulk_spool *spool)
+{
+    V(spool->lock);
+}
+
+/** get the spool file for the given table and mask */
+static struct bulk_file *spool_file(struct bulk_spool *spool, table_enum table,
+                                    attr_mask_t mask)
+{
+    struct bulk_file *f;
+
+    for (f = spool->files; f != NULL; f = f->next)
+        if (f->table == table && attr_mask_equal(&f->mask, &mask))
+            return f;
+
+    f = MemCalloc(1, sizeof(*f));
+    if (f == NULL)
+        return NULL;
+    f->table = table;
+    f->mask = mask;
+    f->next = spool->files;
+    spool->files = f;
+    return f;
+}
+
+int listmgr_bulk_append(lmgr_t *p_mgr, struct bulk_spool *spool,
+                        table_enum table, attr_mask_t mask,
+                        const GString *rows, unsigned int nb_rows)
+{
+    struct bulk_file *f;
+    int rc;
+
+    if (nb_rows == 0)
+        return DB_SUCCESS;
+
+    f = spool_file(spool, table, mask);
+    if (f == NULL)
+        return DB_NO_MEMORY;
+
+    /* a previous load failed */
+    if (f->stream == NULL && f->rows > 0)
+    {
+        rc = file_load(p_mgr, f);
+        if (rc)
+            return rc;
+    }
+
+    if (f->stream == NULL)
+    {
+        snprintf(f->path, sizeof(f->path), "%s/rbh_bulk.%d.%u.%u.%s",
+                 bulk_dir(), getpid(), spool->id, spool->file_seq++,
+                 table2name(f->table));
+        f->stream = fopen(f->path, "w");
+        if (f->stream == NULL)
+        {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to create bulk load "
+                       "file %s: %s", f->path, strerror(errno));
+            return DB_REQUEST_FAILED;
+        }
+    }
+
+    if (fwrite(rows->str, 1, rows->len, f->stream) != rows->len)
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to write to %s: %s",
+                   f->path, strerror(errno));
+        return DB_REQUEST_FAILED;
+    }
+    f->rows += nb_rows;
+
+    if (f->rows >= BULK_LOAD_ROWS)
+        return file_flush(p_mgr, f);
+
+    return DB_SUCCESS;
+}
+
+void listmgr_bulk_close(lmgr_t *p_mgr)
+{
+    struct bulk_spool *spool = p_mgr->bulk;
+    struct bulk_spool **pp;
+
+    if (spool == NULL)
+        return;
+
+    P(bulk_lock);
+    for (pp = &spools; *pp != NULL; pp = &(*pp)->next)
+    {
+        if (*pp == spool)
+        {
+            *pp = spool->next;
+            break;
+        }
+    }
+    V(bulk_lock);
+
+    /* load remaining entries */
+    P(spool->lock);
+    spool_flush(p_mgr, spool);
+    V(spool->lock);
+
+    spool_free(spool);
+    p_mgr->bulk = NULL;
+}
+
+int ListMgr_BulkLoadStart(lmgr_t *p_mgr)
+{
+    int rc;
+
+    if (EMPTY_STRING(bulk_dir()))
+        return DB_NOT_SUPPORTED;
+
+    if (access(bulk_dir(), W_OK | X_OK))
+    {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Cannot write to bulk load "
+                   "directory %s: %s. Bulk load is disabled.", bulk_dir(),
+                   strerror(errno));
+        return DB_NOT_SUPPORTED;
+    }
+
+    P(bulk_lock);
+    if (bulk_active)
+    {
+        V(bulk_lock);
+        return DB_SUCCESS;
+    }
+
+    /* accounting is computed at the end of the bulk load */
+    rc = listmgr_acct_triggers_drop(&p_mgr->conn);
+    if (rc)
+    {
+        V(bulk_lock);
+        return rc;
+    }
+
+    loaded_rows = 0;
+    gettimeofday(&bulk_start, NULL);
+    bulk_active = true;
+    V(bulk_lock);
+
+    DisplayLog(LVL_EVENT, LISTMGR_TAG, "Initial scan: bulk loading entries "
+               "(spool directory: %s)", bulk_dir());
+    return DB_SUCCESS;
+}
+
+/** load the spooled entries of all connections (bulk_lock must be held) */
+static int flush_all(lmgr_t *p_mgr)
+{
+    struct bulk_spool *spool;
+    int rc = DB_SUCCESS;
+
+    for (spool = spools; spool != NULL; spool = spool->next)
+    {
+        int rc2;
+
+        P(spool->lock);
+        rc2 = spool_flush(p_mgr, spool);
+        V(spool->lock);
+
+        if (rc2 != DB_SUCCESS && rc == DB_SUCCESS)
+            rc = rc2;
+    }
+    return rc;
+}
+
+int ListMgr_BulkLoadEnd(lmgr_t *p_mgr)
+{
+    struct timeval now, dur;
+    char tmp[128];
+    int rc, rc2;
+
+    P(bulk_lock);
+    if (!bulk_active)
+    {
+        V(bulk_lock);
+        return DB_SUCCESS;
+    }
+
+    /* entries inserted meanwhile are still spooled */
+    rc = flush_all(p_mgr);
+
+    if (lmgr_config.acct_deltas || lmgr_config.dir_agg || lmgr_config.ost_agg)
+    {
+        /* no trigger: load the entries spooled until the end of bulk mode
+         * before computing the accounting (entries inserted after that
+         * are accounted by deltas). Directory and OST aggregates are
+         * maintained by deltas in any case. */
+        bulk_active = false;
+        rc2 = flush_all(p_mgr);
+        if (rc2 != DB_SUCCESS && rc == DB_SUCCESS)
+            rc = rc2;
+
+        rc2 = listmgr_acct_rebuild(&p_mgr->conn);
+        if (rc2 != DB_SUCCESS && rc == DB_SUCCESS)
+            rc = rc2;
+    }
+    else
+    {
+        /* compute the accounting of loaded entries and restore triggers */
+        rc2 = listmgr_acct_rebuild(&p_mgr->conn);
+        if (rc2 != DB_SUCCESS && rc == DB_SUCCESS)
+            rc = rc2;
+
+        bulk_active = false;
+
+        /* load the entries spooled until the end of bulk mode
+         * (accounted by triggers) */
+        rc2 = flush_all(p_mgr);
+        if (rc2 != DB_SUCCESS && rc == DB_SUCCESS)
+            rc = rc2;
+    }
+    V(bulk_lock);
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &bulk_start, &dur);
+    DisplayLog(LVL_EVENT, LISTMGR_TAG, "Bulk load ended: %llu rows loaded "
+               "in %s", loaded_rows,
+               FormatDurationFloat(tmp, sizeof(tmp), dur.tv_sec));
+    return rc;
+}
@@ -0,0 +1,305 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Read-through cache of entry attributes, in front of ListMgr_Get().
+ * The cache is shared by all the connections of the process. It is bounded
+ * (LRU), entries expire after attr_cache_ttl, and they are invalidated by
+ * the list manager functions that modify them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+#include "list.h"
+
+#include <glib.h>
+#include <pthread.h>
+
+/* slots of invalidation counters: an entry read from the DB is not cached
+ * if it was invalidated during the request */
+#define INVAL_SLOTS 1024
+/* max number of callers with hit/miss stats */
+#define MAX_CALLERS 32
+
+struct cache_entry {
+    struct rh_list_head lru;
+    entry_id_t          id;
+    /* attributes asked to the DB (set in attrs, or known as unset) */
+    attr_mask_t         known;
+    attr_set_t          attrs;
+    time_t              insert_time;
+};
+
+struct caller_stats {
+    const char         *caller;
+    unsigned long long  hits;
+    unsigned long long  misses;
+};
+
+static pthread_mutex_t      cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable          *cache_hash = NULL;
+static struct rh_list_head  cache_lru;  /* head: most recently used */
+static unsigned int         cache_count = 0;
+
+static unsigned long long   inval_all_gen = 0;
+static unsigned long long   inval_gen[INVAL_SLOTS];
+
+static struct caller_stats  callers[MAX_CALLERS];
+static unsigned int         nb_callers = 0;
+static struct caller_stats  other_callers = {.caller = "(others)"};
+
+/* fields that can change without the entry being updated */
+#define NOT_CACHEABLE_STD  ATTR_MASK_fullpath
+
+static guint id_hash(gconstpointer k)
+{
+    const entry_id_t *id = k;
+
+#ifdef FID_PK
+    return (guint)(id->f_seq ^ (id->f_seq >> 32) ^ id->f_oid);
+#else
+    return (guint)(id->fs_key ^ (id->fs_key >> 32) ^ id->inode);
+#endif
+}
+
+static gboolean id_equal(gconstpointer k1, gconstpointer k2)
+{
+    return entry_id_equal((const entry_id_t *)k1, (const entry_id_t *)k2);
+}
+
+static inline unsigned int inval_slot(const entry_id_t *p_id)
+{
+    return id_hash(p_id) % INVAL_SLOTS;
+}
+
+static inline unsigned long long inval_counter(const entry_id_t *p_id)
+{
+    return inval_all_gen + inval_gen[inval_slot(p_id)];
+}
+
+void listmgr_cache_init(void)
+{
+    if (lmgr_config.attr_cache_size == 0 || cache_hash != NULL)
+        return;
+
+    rh_list_init(&cache_lru);
+    cache_hash = g_hash_table_new(id_hash, id_equal);
+}
+
+static void entry_drop(struct cache_entry *entry)
+{
+    g_hash_table_remove(cache_hash, &entry->id);
+    rh_list_del(&entry->lru);
+    ListMgr_FreeAttrs(&entry->attrs);
+    MemFree(entry);
+    cache_count--;
+}
+
+/* must be called with cache_lock held */
+static void account(const char *caller, bool hit)
+{
+    struct caller_stats *stats = &other_callers;
+    int i;
+
+    for (i = 0; i < nb_callers; i++) {
+        if (callers[i].caller == caller) {
+            stats = &callers[i];
+            break;
+        }
+    }
+    if (i == nb_callers && nb_callers < MAX_CALLERS) {
+        stats = &callers[nb_callers++];
+        stats->caller = caller;
+    }
+
+    if (hit)
+        stats->hits++;
+    else
+        stats->misses++;
+}
+
+bool listmgr_cache_get(const entry_id_t *p_id, const attr_mask_t *req,
+                       attr_set_t *p_info, unsigned long long *p_counter,
+                       const char *caller)
+{
+    struct cache_entry *entry;
+    attr_set_t view;
+    attr_mask_t missing;
+    bool hit = false;
+
+    if (cache_hash == NULL)
+        return false;
+
+    P(cache_lock);
+    *p_counter = inval_counter(p_id);
+
+    if ((req->std & NOT_CACHEABLE_STD) || dirattr_fields(*req))
+        goto out;
+
+    entry = g_hash_table_lookup(cache_hash, p_id);
+    if (entry == NULL)
+        goto out;
+
+    if (time(NULL) - entry->insert_time > lmgr_config.attr_cache_ttl) {
+        entry_drop(entry);
+        goto out;
+    }
+
+    missing = attr_mask_and_not(req, &entry->known);
+    if (!attr_mask_is_null(missing))
+        goto out;
+
+    /* same as listmgr_get_by_pk(): the output set is reset */
+    memset(&p_info->attr_values, 0, sizeof(entry_info_t));
+    ATTR_MASK_INIT(p_info);
+
+    /* only copy asked attributes */
+    view = entry->attrs;
+    view.attr_mask = attr_mask_and(&entry->attrs.attr_mask, req);
+    ListMgr_MergeAttrSets(p_info, &view, true);
+
+    rh_list_del(&entry->lru);
+    rh_list_add(&entry->lru, &cache_lru);
+    hit = true;
+
+out:
+    account(caller, hit);
+    V(cache_lock);
+    return hit;
+}
+
+void listmgr_cache_put(const entry_id_t *p_id, const attr_mask_t *req,
+                       const attr_set_t *p_info, unsigned long long counter)
+{
+    struct cache_entry *entry;
+    attr_set_t view;
+    attr_mask_t known = *req;
+
+    if (cache_hash == NULL)
+        return;
+
+    known.std &= ~NOT_CACHEABLE_STD;
+    known = attr_mask_and_not(&known, &dir_attr_set);
+
+    P(cache_lock);
+    /* the entry was modified while it was read from the DB */
+    if (inval_counter(p_id) != counter)
+        goto out;
+
+    entry = g_hash_table_lookup(cache_hash, p_id);
+    if (entry == NULL) {
+        entry = MemCalloc(1, sizeof(*entry));
+        if (entry == NULL)
+            goto out;
+        entry->id = *p_id;
+        entry->insert_time = time(NULL);
+        g_hash_table_insert(cache_hash, &entry->id, entry);
+        cache_count++;
+    } else {
+        rh_list_del(&entry->lru);
+    }
+    rh_list_add(&entry->lru, &cache_lru);
+
+    /* keep the first insert time: the TTL bounds the age of all the
+     * cached attributes of the entry */
+    view = *p_info;
+    view.attr_mask = attr_mask_and(&p_info->attr_mask, &known);
+    ListMgr_MergeAttrSets(&entry->attrs, &view, true);
+    entry->known = attr_mask_or(&entry->known, &known);
+
+    /* evict least recently used entries */
+    while (cache_count > lmgr_config.attr_cache_size)
+        entry_drop(rh_list_last_entry(&cache_lru, struct cache_entry, lru));
+
+out:
+    V(cache_lock);
+}
+
+void listmgr_cache_invalidate(const entry_id_t *p_id)
+{
+    struct cache_entry *entry;
+
+    if (cache_hash == NULL)
+        return;
+
+    P(cache_lock);
+    inval_gen[inval_slot(p_id)]++;
+    entry = g_hash_table_lookup(cache_hash, p_id);
+    if (entry != NULL)
+        entry_drop(entry);
+    V(cache_lock);
+}
+
+void listmgr_cache_invalidate_all(void)
+{
+    if (cache_hash == NULL)
+        return;
+
+    P(cache_lock);
+    inval_all_gen++;
+    while (!rh_list_empty(&cache_lru))
+        entry_drop(rh_list_first_entry(&cache_lru, struct cache_entry, lru));
+    V(cache_lock);
+}
+
+void ListMgr_InvalidateCaches(void)
+{
+    listmgr_cache_invalidate_all();
+    listmgr_path_invalidate_all();
+}
+
+static void dump_caller(const struct caller_stats *stats)
+{
+    unsigned long long total = stats->hits + stats->misses;
+
+    DisplayLog(LVL_MAJOR, "STATS", "    %-28s: %llu gets, hit ratio: %.1f%%",
+               stats->caller, total,
+               total ? 100.0 * stats->hits / total : 0.0);
+}
+
+void ListMgr_CacheDumpStats(void)
+{
+    unsigned long long hits = 0, misses = 0;
+    int i;
+
+    if (cache_hash == NULL)
+        return;
+
+    P(cache_lock);
+    for (i = 0; i < nb_callers; i++) {
+        hits += callers[i].hits;
+        misses += callers[i].misses;
+    }
+    hits += other_callers.hits;
+    misses += other_callers.misses;
+
+    DisplayLog(LVL_MAJOR, "STATS", "Attribute cache: %u/%u entries, "
+               "hit ratio: %.1f%% (%llu/%llu)", cache_count,
+               lmgr_config.attr_cache_size,
+               hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+               hits, hits + misses);
+    for (i = 0; i < nb_callers; i++)
+        dump_caller(&callers[i]);
+    if (other_callers.hits + other_callers.misses > 0)
+        dump_caller(&other_callers);
+    V(cache_lock);
+}
@@ -18,6 +18,7 @@
 
 #include "list_mgr.h"
 #include "listmgr_common.h"
+#include "listmgr_internal.h"
 #include "database.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
@@ -25,6 +26,8 @@
 #include "listmgr_stripe.h"
 #include "xplatform_print.h"
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 void printdbtype(db_conn_t *pconn, GString *str, db_type_e type,
                  const db_type_u *value_ptr)
@@ -707,22 +710,24 @@ int attrmask2fieldcomparison(GString *str, attr_mask_t attr_mask,
     return nbfields;
 }
 
-static void print_attr_value(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
-                             unsigned int attr_index)
+/**
+ * Get the DB type and value of an attribute.
+ * @param tmp buffer for values that must be converted (separated lists).
+ */
+static db_type_e attr_value(const attr_set_t *p_set, unsigned int attr_index,
+                            db_type_u *typeu, char *tmp, size_t tmp_size)
 {
-    char tmp[1024];
-    db_type_u typeu;
     db_type_e t;
 
     if (attr_index < ATTR_COUNT)
     {
-        assign_union(&typeu, field_infos[attr_index].db_type,
+        assign_union(typeu, field_infos[attr_index].db_type,
                      attr_address_const(p_set, attr_index));
 
         if (is_sepdlist(attr_index))
         {
-            separated_list2db(typeu.val_str, tmp, sizeof(tmp));
-            typeu.val_str = tmp;
+            separated_list2db(typeu->val_str, tmp, tmp_size);
+            typeu->val_str = tmp;
         }
         t = field_infos[attr_index].db_type;
     }
@@ -730,7 +735,7 @@ static void print_attr_value(lmgr_t *p_mgr, GString *str, const attr_set_t *p_se
     {
         unsigned int status_idx = attr2status_index(attr_index);
 
-        assign_union(&typeu, DB_TEXT, p_set->attr_values.sm_status[status_idx]);
+        assign_union(typeu, DB_TEXT, p_set->attr_values.sm_status[status_idx]);
         t = DB_TEXT;
     }
     else if (is_sm_info_field(attr_index))
@@ -738,14 +743,84 @@ static void print_attr_value(lmgr_t *p_mgr, GString *str, const attr_set_t *p_se
         unsigned int info_idx = attr2sminfo_index(attr_index);
 
         t = sm_attr_info[info_idx].def->db_type;
-        assign_union(&typeu, t, (char *)p_set->attr_values.sm_info[info_idx]);
+        assign_union(typeu, t, (char *)p_set->attr_values.sm_info[info_idx]);
     }
     else
         RBH_BUG("Attribute index is not in a valid range");
 
+    return t;
+}
+
+static void print_attr_value(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
+                             unsigned int attr_index)
+{
+    char tmp[1024];
+    db_type_u typeu;
+    db_type_e t;
+
+    t = attr_value(p_set, attr_index, &typeu, tmp, sizeof(tmp));
     printdbtype(&p_mgr->conn, str, t, &typeu);
 }
 
+int attrset2params(const attr_set_t *p_set, table_enum table,
+                   db_param_t *params, unsigned int max,
+                   GStringChunk **p_chunk)
+{
+    int            i, cookie;
+    unsigned int   nbfields = 0;
+
+    if ((table == T_STRIPE_INFO) || (table == T_STRIPE_ITEMS))
+        return -DB_NOT_SUPPORTED;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        char tmp[1024];
+        db_param_t *param;
+
+        if (!attr_mask_test_index(&p_set->attr_mask, i) || !match_table(table, i))
+            continue;
+
+        if (nbfields >= max)
+            return -DB_BUFFER_TOO_SMALL;
+        param = &params[nbfields];
+
+        param->type = attr_value(p_set, i, &param->value, tmp, sizeof(tmp));
+
+        switch (param->type)
+        {
+            case DB_ID:
+            {
+                DEF_PK(pk);
+
+                entry_id2pk(&param->value.val_id, PTR_PK(pk));
+                if (*p_chunk == NULL)
+                    *p_chunk = g_string_chunk_new(256);
+                param->value.val_str = g_string_chunk_insert(*p_chunk, pk);
+                param->type = DB_TEXT;
+                break;
+            }
+            case DB_UIDGID:
+                param->type = global_config.uid_gid_as_numbers ? DB_INT
+                                                               : DB_TEXT;
+                break;
+            case DB_TEXT:
+                /* converted value */
+                if (param->value.val_str == tmp)
+                {
+                    if (*p_chunk == NULL)
+                        *p_chunk = g_string_chunk_new(256);
+                    param->value.val_str = g_string_chunk_insert(*p_chunk, tmp);
+                }
+                break;
+            default:
+                break;
+        }
+        nbfields++;
+    }
+    return nbfields;
+}
+
 
 
 /**
@@ -780,6 +855,87 @@ int attrset2valuelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
     return nbfields;
 }
 
+/** append a string to a bulk load row, escaping special characters */
+static void append_load_str(GString *str, const char *val)
+{
+    const char *c;
+
+    if (val == NULL)
+    {
+        g_string_append(str, "\\N");
+        return;
+    }
+
+    for (c = val; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+            case '\\': g_string_append(str, "\\\\"); break;
+            case '\t': g_string_append(str, "\\t"); break;
+            case '\n': g_string_append(str, "\\n"); break;
+            default: g_string_append_c(str, *c);
+        }
+    }
+}
+
+/** append a value to a bulk load row */
+void printdbtype_load(GString *str, db_type_e type, const db_type_u *value_ptr)
+{
+    switch (type)
+    {
+        case DB_ID:
+        {
+            DEF_PK(tmpstr);
+
+            entry_id2pk(&value_ptr->val_id, tmpstr);
+            g_string_append(str, tmpstr);
+            break;
+        }
+        case DB_UIDGID:
+            if (global_config.uid_gid_as_numbers) {
+                g_string_append_printf(str, "%d", value_ptr->val_int);
+                break;
+            }
+            /* UID/GID is TEXT. Fall throught ... */
+        case DB_TEXT:
+        case DB_ENUM_FTYPE:
+            append_load_str(str, value_ptr->val_str);
+            break;
+        case DB_BOOL:
+            g_string_append(str, value_ptr->val_bool ? "1" : "0");
+            break;
+        default:
+            /* numeric values are printed the same way in SQL requests */
+            printdbtype(NULL, str, type, value_ptr);
+    }
+}
+
+int attrset2loadrow(GString *str, const attr_set_t *p_set, table_enum table)
+{
+    int            i, cookie;
+    unsigned int   nbfields = 0;
+
+    if ((table == T_STRIPE_INFO) || (table == T_STRIPE_ITEMS))
+        return -DB_NOT_SUPPORTED;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        char tmp[1024];
+        db_type_u typeu;
+        db_type_e t;
+
+        if (!attr_mask_test_index(&p_set->attr_mask, i) || !match_table(table, i))
+            continue;
+
+        t = attr_value(p_set, i, &typeu, tmp, sizeof(tmp));
+        g_string_append_c(str, '\t');
+        printdbtype_load(str, t, &typeu);
+        nbfields++;
+    }
+    return nbfields;
+}
+
 /**
  * @param table T_MAIN, T_ANNEX
  * @return nbr of fields
@@ -810,6 +966,8 @@ int attrset2updatelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
 
             if (generic_value)
                 g_string_append_printf(str, "VALUES(%s)", field_name(i));
+            else if (flags & AOF_PARAM)
+                g_string_append(str, "?");
             else
                 print_attr_value(p_mgr, str, p_set, i);
 
@@ -819,6 +977,46 @@ int attrset2updatelist(lmgr_t *p_mgr, GString *str, const attr_set_t *p_set,
     return nbfields;
 }
 
+int attrsets2caselist(lmgr_t *p_mgr, GString *str, const pktype *pks,
+                      const attr_set_t **p_sets, unsigned int count,
+                      table_enum table)
+{
+    int            i, cookie;
+    unsigned int   j, nbfields = 0;
+    attr_mask_t    all = null_mask;
+
+    if ((table == T_STRIPE_INFO) || (table == T_STRIPE_ITEMS))
+        return -DB_NOT_SUPPORTED;
+
+    for (j = 0; j < count; j++)
+        all = attr_mask_or(&all, &p_sets[j]->attr_mask);
+
+    if (check_read_only_fields(&all))
+        return -DB_READ_ONLY_ATTR;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        if (!attr_mask_test_index(&all, i) || !match_table(table, i))
+            continue;
+
+        if (nbfields > 0)
+            g_string_append(str, ",");
+
+        g_string_append_printf(str, "%s=CASE id", field_name(i));
+        for (j = 0; j < count; j++)
+        {
+            if (!attr_mask_test_index(&p_sets[j]->attr_mask, i))
+                continue;
+            g_string_append_printf(str, " WHEN "DPK" THEN ", pks[j]);
+            print_attr_value(p_mgr, str, p_sets[j], i);
+        }
+        g_string_append_printf(str, " ELSE %s END", field_name(i));
+        nbfields++;
+    }
+    return nbfields;
+}
+
 int fullpath_attr2db(const char *attr, char *db)
 {
     DEF_PK(root_pk);
@@ -874,6 +1072,53 @@ void fullpath_db2attr(const char *db, char *attr)
         sprintf(attr, "%s/%s", global_config.fs_path, c);
 }
 
+/** set an attribute from a value read from the DB */
+static void db2attr(table_enum table, int i, db_type_u typeu,
+                    attr_set_t *p_set)
+{
+    if ((i == ATTR_INDEX_fullpath) && (table != T_SOFTRM))
+    {
+        /* special case for fullpath which must be converted from relative to aboslute */
+        /* fullpath already includes root for SOFT_RM table */
+        fullpath_db2attr(typeu.val_str, ATTR(p_set, fullpath));
+    }
+    else if (is_status_field(i))
+    {
+        unsigned int status_idx = attr2status_index(i);
+
+        /* allocate status array */
+        sm_status_ensure_alloc(&p_set->attr_values.sm_status);
+        /* get the matching status from status enum */
+        p_set->attr_values.sm_status[status_idx] =
+            get_status_str(get_sm_instance(status_idx)->sm, typeu.val_str);
+
+        /* status = '' => not set */
+        if (p_set->attr_values.sm_status[status_idx] == NULL)
+            attr_mask_unset_index(&p_set->attr_mask, i);
+    }
+    else if (is_sm_info_field(i))
+    {
+        unsigned int info_idx = attr2sminfo_index(i);
+
+        /* allocate info array */
+        sm_info_ensure_alloc(&p_set->attr_values.sm_info);
+
+        /* allocate a copy of the value */
+        p_set->attr_values.sm_info[info_idx] =
+            dup_value(field_type(i), typeu);
+
+        /* status = '' => not set */
+        if (p_set->attr_values.sm_info[info_idx] == NULL)
+            attr_mask_unset_index(&p_set->attr_mask, i);
+    }
+    else if (is_sepdlist(i))
+        separated_db2list(typeu.val_str, attr_address(p_set, i),
+                          field_infos[i].db_type_size+1); /* C size is db_type_size+1 */
+    else
+        union_get_value(attr_address(p_set, i), field_infos[i].db_type,
+                        &typeu);
+}
+
 int result2attrset( table_enum table, char **result_tab,
                     unsigned int res_count, attr_set_t * p_set )
 {
@@ -938,52 +1183,112 @@ int result2attrset( table_enum table, char **result_tab,
                 continue;
             }
 
-            if ((i == ATTR_INDEX_fullpath) && (table != T_SOFTRM))
-            {
-                /* special case for fullpath which must be converted from relative to aboslute */
-                /* fullpath already includes root for SOFT_RM table */
-                fullpath_db2attr(typeu.val_str, ATTR(p_set, fullpath));
-            }
-            else if (is_status_field(i))
-            {
-                unsigned int status_idx = attr2status_index(i);
+            db2attr(table, i, typeu, p_set);
+            nbfields++;
+        }
+    }
+    return 0;
 
-                /* allocate status array */
-                sm_status_ensure_alloc(&p_set->attr_values.sm_status);
-                /* get the matching status from status enum */
-                p_set->attr_values.sm_status[status_idx] =
-                    get_status_str(get_sm_instance(status_idx)->sm, typeu.val_str);
+}
 
-                /* status = '' => not set */
-                if (p_set->attr_values.sm_status[status_idx] == NULL)
-                    attr_mask_unset_index(&p_set->attr_mask, i);
-            }
-            else if (is_sm_info_field(i))
-            {
-                unsigned int info_idx = attr2sminfo_index(i);
+/** type of the result column of a field in DB requests */
+static inline db_type_e result_type(int i)
+{
+    /* these are processed as strings */
+    if (is_status_field(i) || is_sepdlist(i) || i == ATTR_INDEX_fullpath)
+        return DB_TEXT;
+    return db_is_int_type(field_type(i)) ? field_type(i) : DB_TEXT;
+}
 
-                /* allocate info array */
-                sm_info_ensure_alloc(&p_set->attr_values.sm_info);
+int attrmask2types(attr_mask_t attr_mask, table_enum table, db_type_e *types,
+                   unsigned int count)
+{
+    int            i, cookie;
+    unsigned int   nbfields = 0;
 
-                /* allocate a copy of the value */
-                p_set->attr_values.sm_info[info_idx] =
-                    dup_value(field_type(i), typeu);
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        if (!attr_mask_test_index(&attr_mask, i) || !match_table(table, i))
+            continue;
+#ifdef _LUSTRE
+        if (i < ATTR_COUNT && field_infos[i].db_type == DB_STRIPE_INFO)
+        {
+            if (nbfields + 3 > count)
+                return -DB_BUFFER_TOO_SMALL;
+            /* stripe count, stripe size and pool_name */
+            types[nbfields++] = DB_UINT;
+            types[nbfields++] = DB_UINT;
+            types[nbfields++] = DB_TEXT;
+            continue;
+        }
+#endif
+        if (nbfields >= count)
+            return -DB_BUFFER_TOO_SMALL;
+        types[nbfields++] = result_type(i);
+    }
+    return nbfields;
+}
 
-                /* status = '' => not set */
-                if (p_set->attr_values.sm_info[info_idx] == NULL)
-                    attr_mask_unset_index(&p_set->attr_mask, i);
-            }
-            else if (is_sepdlist(i))
-                separated_db2list(typeu.val_str, attr_address(p_set, i),
-                                  field_infos[i].db_type_size+1); /* C size is db_type_size+1 */
+int values2attrset(table_enum table, const db_type_u *values,
+                   const bool *nulls, unsigned int count, attr_set_t *p_set)
+{
+    int            i, cookie;
+    unsigned int   nbfields = 0;
+    db_type_u      typeu;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        if (!attr_mask_test_index(&p_set->attr_mask, i) || !match_table(table, i))
+            continue;
+
+        if (nbfields >= count)
+            return DB_BUFFER_TOO_SMALL;
+
+#ifdef _LUSTRE
+        if (i < ATTR_COUNT && field_infos[i].db_type == DB_STRIPE_INFO)
+        {
+            if (nbfields + 3 > count)
+                return DB_BUFFER_TOO_SMALL;
+            if (nulls[nbfields] || nulls[nbfields+1] || nulls[nbfields+2])
+                attr_mask_unset_index(&p_set->attr_mask, i);
             else
-                union_get_value(attr_address(p_set, i), field_infos[i].db_type,
-                                &typeu);
+            {
+                ATTR(p_set, stripe_info).stripe_count = values[nbfields].val_uint;
+                ATTR(p_set, stripe_info).stripe_size = values[nbfields+1].val_uint;
+                rh_strncpy(ATTR(p_set, stripe_info).pool_name,
+                           values[nbfields+2].val_str, MAX_POOL_LEN);
+            }
+            nbfields += 3;
+            continue;
+        }
+#endif
+        if (nulls[nbfields])
+        {
+            attr_mask_unset_index(&p_set->attr_mask, i);
             nbfields++;
+            continue;
         }
+
+        if (result_type(i) != DB_TEXT)
+            typeu = values[nbfields];
+        else if (!parsedbtype((char *)values[nbfields].val_str, field_type(i),
+                              &typeu))
+        {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                       "Error: cannot parse field value '%s' (position %u) for %s",
+                       values[nbfields].val_str, nbfields, field_name(i));
+            RBH_BUG("DB value cannot be parsed: DB may be corrupted");
+            attr_mask_unset_index(&p_set->attr_mask, i);
+            nbfields++;
+            continue;
+        }
+
+        db2attr(table, i, typeu, p_set);
+        nbfields++;
     }
     return 0;
-
 }
 
 char          *compar2str( filter_comparator_t compar )
@@ -1269,6 +1574,59 @@ static void attr2filter_field(GString *str, table_enum table,
     }
 }
 
+/**
+ * Get the condition on reversed names (NAMES.rname) which is implied by a
+ * name or path condition, so it can be resolved by index: a name or the
+ * last component of a path that ends with a given suffix (LIKE patterns
+ * like '%.h5', as converted from '*.h5' by convert_regexp()) or that is
+ * equal to a given string.
+ * @param[out] out  pattern for rname (LIKE) or value (EQUAL).
+ * @return false if the condition does not restrict the name by its end.
+ */
+static bool rname_condition(filter_comparator_t comp, const char *value,
+                            bool is_path, char *out, size_t out_sz)
+{
+    const char *last = value;
+    bool        suffix = false;
+    size_t      len, i;
+
+    if (comp != LIKE && (comp != EQUAL || is_path))
+        return false;
+
+    if (is_path) {
+        last = strrchr(value, '/');
+        if (last != NULL)
+            last++;
+        else if (value[0] == '%')
+            last = value;
+        else
+            /* relative path pattern: can't tell the name */
+            return false;
+    }
+
+    /* leading '%' only */
+    if (comp == LIKE) {
+        while (*last == '%') {
+            suffix = true;
+            last++;
+        }
+        if (strpbrk(last, "%\\") != NULL)
+            return false;
+    }
+
+    len = strlen(last);
+    if (len == 0 || len + 2 > out_sz)
+        return false;
+
+    /* '_' matches a single byte in both directions */
+    for (i = 0; i < len; i++)
+        out[i] = last[len - 1 - i];
+    if (suffix)
+        out[len++] = '%';
+    out[len] = '\0';
+    return true;
+}
+
 int filter2str(lmgr_t *p_mgr, GString *str, const lmgr_filter_t *p_filter,
                table_enum table, attrset_op_flag_e flags)
 {
@@ -1285,6 +1643,8 @@ int filter2str(lmgr_t *p_mgr, GString *str, const lmgr_filter_t *p_filter,
         {
             unsigned int   index = p_filter->filter_simple.filter_index[i];
             bool case_sensitive = true;
+            bool rname_path = false;
+            char rname[RBH_NAME_MAX + 1];
             bool match =  match_table(table, index)
                          || ((table == T_STRIPE_ITEMS) && (index < ATTR_COUNT)
                               && (field_infos[index].db_type == DB_STRIPE_ITEMS))
@@ -1349,6 +1709,39 @@ int filter2str(lmgr_t *p_mgr, GString *str, const lmgr_filter_t *p_filter,
                 }
             }
 
+            /* name and path conditions imply a condition on reversed names,
+             * which is resolved by index */
+            if ((match || table == T_NONE) && case_sensitive
+                && listmgr_name_index_enabled()
+                && (index == ATTR_INDEX_name
+                    || (index == ATTR_INDEX_fullpath && table != T_SOFTRM
+                        && table != T_TMP_SOFTRM))
+                && rname_condition(p_filter->filter_simple.filter_compar[i],
+                                   p_filter->filter_simple.filter_value[i].value.val_str,
+                                   index == ATTR_INDEX_fullpath, rname,
+                                   sizeof(rname)))
+            {
+                if (index == ATTR_INDEX_fullpath)
+                {
+                    /* the path condition is still checked */
+                    rname_path = true;
+                    g_string_append(str, "(");
+                }
+                if (prefix_table)
+                    g_string_append(str, DNAMES_TABLE".");
+                g_string_append(str, RNAME_FIELD);
+                g_string_append(str, compar2str(p_filter->filter_simple.filter_compar[i]));
+                typeu.val_str = rname;
+                printdbtype(&p_mgr->conn, str, DB_TEXT, &typeu);
+
+                if (!rname_path)
+                {
+                    nbfields++;
+                    goto close_cond;
+                }
+                g_string_append(str, " AND ");
+            }
+
             /* append field name or function call */
             attr2filter_field(str, table, index, prefix_table);
 
@@ -1445,6 +1838,10 @@ int filter2str(lmgr_t *p_mgr, GString *str, const lmgr_filter_t *p_filter,
                 nbfields++;
             }
 
+            if (rname_path)
+                g_string_append(str, ")");
+
+        close_cond:
             if (match || table == T_NONE)
             {
 
@@ -1665,6 +2062,40 @@ void append_size_range_fields(GString *str, bool leading_comma,
                                prefix, sz_field[i]);
 }
 
+/* group commit: signal the completion of connection transactions */
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  commit_cond = PTHREAD_COND_INITIALIZER;
+
+/** mark the current transaction of a connection as completed,
+ * and wake up the threads waiting for it. */
+static void tx_completed(lmgr_t *p_mgr)
+{
+    p_mgr->last_commit = 0;
+
+    if (!lmgr_config.commit_group)
+        return;
+
+    P(commit_lock);
+    p_mgr->committed_seq = p_mgr->tx_seq;
+    pthread_cond_broadcast(&commit_cond);
+    V(commit_lock);
+    p_mgr->tx_seq++;
+}
+
+/** check if the current group transaction exceeds the max commit delay */
+static bool tx_delay_expired(lmgr_t *p_mgr)
+{
+    struct timeval now, age;
+
+    if (!lmgr_config.commit_group)
+        return false;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &p_mgr->tx_start, &age);
+    return (age.tv_sec * 1000 + age.tv_usec / 1000
+            >= lmgr_config.commit_max_delay);
+}
+
 /* those functions are used for begin/commit/rollback */
 int _lmgr_begin(lmgr_t *p_mgr, int behavior)
 {
@@ -1684,6 +2115,8 @@ int _lmgr_begin(lmgr_t *p_mgr, int behavior)
             rc = db_exec_sql(&p_mgr->conn, "BEGIN", NULL);
             if (rc)
                 return rc;
+            if (lmgr_config.commit_group)
+                gettimeofday(&p_mgr->tx_start, NULL);
         }
 
         /* increment current op */
@@ -1694,6 +2127,8 @@ int _lmgr_begin(lmgr_t *p_mgr, int behavior)
 
 void _lmgr_rollback(lmgr_t * p_mgr, int behavior)
 {
+    listmgr_acct_discard(p_mgr);
+
     if (behavior == 0)
         return;
     else
@@ -1701,29 +2136,43 @@ void _lmgr_rollback(lmgr_t * p_mgr, int behavior)
         /* we must rollback all operations since the last commit, to keep database into persistent state */
         db_exec_sql(&p_mgr->conn, "ROLLBACK", NULL);
 
-        p_mgr->last_commit = 0;
+        /* don't let ticket holders wait for a transaction that
+         * no longer exists */
+        tx_completed(p_mgr);
     }
 }
 
 int _lmgr_commit(lmgr_t * p_mgr, int behavior)
 {
     if (behavior == 0)
-        return DB_SUCCESS;
+        return listmgr_acct_flush(p_mgr);
     else if (behavior == 1)
+    {
+        int rc = listmgr_acct_flush(p_mgr);
+
+        if (rc)
+            return rc;
         return db_exec_sql(&p_mgr->conn, "COMMIT", NULL);
+    }
     else
     {
-        /* if the transaction count is reached:
+        /* if the transaction count (or the max group delay) is reached:
          * commit operations and result transaction count
          */
-        if ((p_mgr->last_commit % behavior == 0) || p_mgr->force_commit)
+        if ((p_mgr->last_commit % behavior == 0) || p_mgr->force_commit
+            || tx_delay_expired(p_mgr))
         {
             int            rc;
+
+            /* accounting deltas of the whole group */
+            rc = listmgr_acct_flush(p_mgr);
+            if (rc)
+                return rc;
             rc = db_exec_sql(&p_mgr->conn, "COMMIT", NULL);
             if (rc)
                 return rc;
 
-            p_mgr->last_commit = 0;
+            tx_completed(p_mgr);
         }
     }
     return DB_SUCCESS;
@@ -1753,17 +2202,70 @@ int _lmgr_flush_commit(lmgr_t *p_mgr, int behavior)
     int            rc;
     if ((behavior > 1) && (p_mgr->last_commit != 0))
     {
+        rc = listmgr_acct_flush(p_mgr);
+        if (rc)
+            return rc;
         rc = db_exec_sql(&p_mgr->conn, "COMMIT", NULL);
         if (rc)
             return rc;
 
-        p_mgr->last_commit = 0;
+        tx_completed(p_mgr);
         return DB_SUCCESS;
     }
     else
         return DB_SUCCESS;
 }
 
+void ListMgr_GetCommitTicket(lmgr_t *p_mgr, lmgr_ticket_t *p_ticket)
+{
+    if (lmgr_config.commit_group && p_mgr->last_commit != 0)
+    {
+        p_ticket->lmgr = p_mgr;
+        p_ticket->seq = p_mgr->tx_seq;
+    }
+    else
+    {
+        p_ticket->lmgr = NULL;
+        p_ticket->seq = 0;
+    }
+}
+
+int ListMgr_WaitTicket(lmgr_t *p_mgr, const lmgr_ticket_t *p_ticket)
+{
+    int rc;
+
+    if (p_ticket->lmgr == NULL)
+        return DB_SUCCESS;
+
+    /* the ticket may be ours, and a thread we wait for may wait for us */
+    rc = lmgr_flush_commit(p_mgr);
+    if (rc)
+        return rc;
+
+    if (p_ticket->lmgr == p_mgr)
+        return DB_SUCCESS;
+
+    /* the owner commits when it reaches the group size or delay,
+     * or when it becomes idle */
+    P(commit_lock);
+    while (p_ticket->lmgr->committed_seq < p_ticket->seq)
+        pthread_cond_wait(&commit_cond, &commit_lock);
+    V(commit_lock);
+
+    return DB_SUCCESS;
+}
+
+int ListMgr_FlushCommit(lmgr_t *p_mgr, bool force)
+{
+    if (!lmgr_config.commit_group || p_mgr->last_commit == 0)
+        return DB_SUCCESS;
+
+    if (!force && !tx_delay_expired(p_mgr))
+        return DB_SUCCESS;
+
+    return lmgr_flush_commit(p_mgr);
+}
+
 int lmgr_table_count(db_conn_t *pconn, const char *table, uint64_t *count)
 {
     char            *str_count = NULL;
@@ -1802,11 +2304,12 @@ void ListMgr_MergeAttrSets(attr_set_t *p_target_attrset, const attr_set_t *p_sou
     int            i, cookie;
     db_type_u      typeu;
 
-    cookie = -1;
-    while ((i = attr_index_iter(0, &cookie)) != -1)
+    /* only iterate on the attributes set in source */
+    cookie = 0;
+    while ((i = attr_mask_index_iter(&p_source_attrset->attr_mask,
+                                     &cookie)) != -1)
     {
-        if ((update || !attr_mask_test_index(&p_target_attrset->attr_mask, i))
-             && attr_mask_test_index(&p_source_attrset->attr_mask, i))
+        if (update || !attr_mask_test_index(&p_target_attrset->attr_mask, i))
         {
             /* status attr */
             if (is_status_field(i))
@@ -1897,6 +2400,267 @@ void ListMgr_FreeAttrs(attr_set_t *p_set)
     sm_info_free(&p_set->attr_values.sm_info);
 }
 
+/* Packed attribute set: the mask, followed by the values of the set
+ * attributes in index order. Strings are stored with their actual length. */
+struct attr_pack {
+    attr_mask_t     mask;
+    unsigned int    size;   /* size of data */
+    char            data[];
+};
+
+/** size of a value in a packed attribute set */
+static size_t packed_value_size(db_type_e type, const db_type_u *val)
+{
+    switch (type) {
+    case DB_ID:
+        return sizeof(entry_id_t);
+    case DB_ENUM_FTYPE:
+    case DB_TEXT:
+        return strlen(val->val_str) + 1;
+    case DB_UIDGID:
+        if (global_config.uid_gid_as_numbers)
+            return sizeof(int);
+        else
+            return strlen(val->val_str) + 1;
+    case DB_INT:
+    case DB_UINT:
+        return sizeof(int);
+    case DB_SHORT:
+    case DB_USHORT:
+        return sizeof(short);
+    case DB_BIGINT:
+    case DB_BIGUINT:
+        return sizeof(long long);
+    case DB_BOOL:
+        return sizeof(bool);
+    case DB_STRIPE_INFO:
+    case DB_STRIPE_ITEMS:
+        RBH_BUG("Unsupported DB type");
+    }
+    UNREACHED();
+}
+
+/** write a value to a packed attribute set.
+ * @return the size written */
+static size_t pack_value(char *data, db_type_e type, const db_type_u *val)
+{
+    size_t sz = packed_value_size(type, val);
+
+    if (type == DB_TEXT || type == DB_ENUM_FTYPE
+        || (type == DB_UIDGID && !global_config.uid_gid_as_numbers))
+        memcpy(data, val->val_str, sz);
+    else
+        /* numeric union members are located at the start of the union */
+        memcpy(data, val, sz);
+    return sz;
+}
+
+/** read a value from a packed attribute set.
+ * Strings are not copied: they point to the packed data.
+ * @return the size read */
+static size_t unpack_value(const char *data, db_type_e type, db_type_u *val)
+{
+    if (type == DB_TEXT || type == DB_ENUM_FTYPE
+        || (type == DB_UIDGID && !global_config.uid_gid_as_numbers)) {
+        val->val_str = data;
+        return strlen(data) + 1;
+    }
+    memcpy(val, data, packed_value_size(type, NULL));
+    return packed_value_size(type, NULL);
+}
+
+/** @return the size of an attribute in a packed attribute set */
+static size_t attr_pack_size(const attr_set_t *p_attrs, int i)
+{
+    db_type_u typeu;
+
+#ifdef _LUSTRE
+    if (field_infos[i].db_type == DB_STRIPE_INFO)
+        return sizeof(stripe_info_t);
+    if (field_infos[i].db_type == DB_STRIPE_ITEMS) {
+        const stripe_items_t *items = attr_address_const(p_attrs, i);
+
+        return sizeof(items->count) + items->count * sizeof(stripe_item_t);
+    }
+#endif
+    if (is_status_field(i))
+        /* status values are static strings: store the pointer */
+        return sizeof(const char *);
+
+    if (is_sm_info_field(i))
+        assign_union(&typeu, field_type(i),
+                     p_attrs->attr_values.sm_info[attr2sminfo_index(i)]);
+    else
+        assign_union(&typeu, field_infos[i].db_type,
+                     attr_address_const(p_attrs, i));
+
+    return packed_value_size(field_type(i), &typeu);
+}
+
+attr_pack_t *ListMgr_PackAttrs(const attr_set_t *p_attrs)
+{
+    attr_pack_t *pack;
+    attr_mask_t  mask = p_attrs->attr_mask;
+    size_t       size = 0;
+    char        *curr;
+    int          i, cookie;
+    db_type_u    typeu;
+
+    /* drop inconsistent bits, the same way as ListMgr_MergeAttrSets()
+     * would fail on them */
+    if (p_attrs->attr_values.sm_status == NULL)
+        mask.status = 0;
+    if (p_attrs->attr_values.sm_info == NULL)
+        mask.sm_info = 0;
+
+    cookie = 0;
+    while ((i = attr_mask_index_iter(&mask, &cookie)) != -1) {
+        if (is_sm_info_field(i)
+            && p_attrs->attr_values.sm_info[attr2sminfo_index(i)] == NULL) {
+            attr_mask_unset_index(&mask, i);
+            continue;
+        }
+        size += attr_pack_size(p_attrs, i);
+    }
+
+    pack = MemAlloc(sizeof(*pack) + size);
+    if (pack == NULL)
+        return NULL;
+    pack->mask = mask;
+    pack->size = size;
+
+    curr = pack->data;
+    cookie = 0;
+    while ((i = attr_mask_index_iter(&mask, &cookie)) != -1) {
+#ifdef _LUSTRE
+        if (field_infos[i].db_type == DB_STRIPE_INFO) {
+            memcpy(curr, attr_address_const(p_attrs, i),
+                   sizeof(stripe_info_t));
+            curr += sizeof(stripe_info_t);
+            continue;
+        }
+        if (field_infos[i].db_type == DB_STRIPE_ITEMS) {
+            const stripe_items_t *items = attr_address_const(p_attrs, i);
+
+            memcpy(curr, &items->count, sizeof(items->count));
+            curr += sizeof(items->count);
+            if (items->count > 0) {
+                memcpy(curr, items->stripe,
+                       items->count * sizeof(stripe_item_t));
+                curr += items->count * sizeof(stripe_item_t);
+            }
+            continue;
+        }
+#endif
+        if (is_status_field(i)) {
+            memcpy(curr,
+                   &p_attrs->attr_values.sm_status[attr2status_index(i)],
+                   sizeof(const char *));
+            curr += sizeof(const char *);
+            continue;
+        }
+
+        if (is_sm_info_field(i))
+            assign_union(&typeu, field_type(i),
+                         p_attrs->attr_values.sm_info[attr2sminfo_index(i)]);
+        else
+            assign_union(&typeu, field_infos[i].db_type,
+                         attr_address_const(p_attrs, i));
+
+        curr += pack_value(curr, field_type(i), &typeu);
+    }
+    assert(curr == pack->data + size);
+
+    return pack;
+}
+
+int ListMgr_UnpackAttrs(const attr_pack_t *pack, attr_set_t *p_attrs)
+{
+    const char  *curr = pack->data;
+    int          i, cookie;
+    db_type_u    typeu;
+
+    /* only reset what the values depend on (no memset of the values) */
+    ATTR_SET_CLEAR(p_attrs);
+
+    if (pack->mask.status != 0) {
+        sm_status_ensure_alloc(&p_attrs->attr_values.sm_status);
+        if (p_attrs->attr_values.sm_status == NULL)
+            goto nomem;
+    }
+    if (pack->mask.sm_info != 0) {
+        sm_info_ensure_alloc(&p_attrs->attr_values.sm_info);
+        if (p_attrs->attr_values.sm_info == NULL)
+            goto nomem;
+    }
+
+    cookie = 0;
+    while ((i = attr_mask_index_iter(&pack->mask, &cookie)) != -1) {
+#ifdef _LUSTRE
+        if (field_infos[i].db_type == DB_STRIPE_INFO) {
+            memcpy(attr_address(p_attrs, i), curr, sizeof(stripe_info_t));
+            curr += sizeof(stripe_info_t);
+            attr_mask_set_index(&p_attrs->attr_mask, i);
+            continue;
+        }
+        if (field_infos[i].db_type == DB_STRIPE_ITEMS) {
+            stripe_items_t *items = attr_address(p_attrs, i);
+
+            memcpy(&items->count, curr, sizeof(items->count));
+            curr += sizeof(items->count);
+            items->stripe = NULL;
+            if (items->count > 0) {
+                items->stripe = MemAlloc(items->count * sizeof(stripe_item_t));
+                if (items->stripe == NULL)
+                    goto nomem;
+                memcpy(items->stripe, curr,
+                       items->count * sizeof(stripe_item_t));
+                curr += items->count * sizeof(stripe_item_t);
+            }
+            attr_mask_set_index(&p_attrs->attr_mask, i);
+            continue;
+        }
+#endif
+        if (is_status_field(i)) {
+            memcpy(&p_attrs->attr_values.sm_status[attr2status_index(i)],
+                   curr, sizeof(const char *));
+            curr += sizeof(const char *);
+            attr_mask_set_index(&p_attrs->attr_mask, i);
+            continue;
+        }
+
+        curr += unpack_value(curr, field_type(i), &typeu);
+
+        if (is_sm_info_field(i)) {
+            void *val = dup_value(field_type(i), typeu);
+
+            if (val == NULL)
+                goto nomem;
+            p_attrs->attr_values.sm_info[attr2sminfo_index(i)] = val;
+        } else
+            union_get_value(attr_address(p_attrs, i), field_infos[i].db_type,
+                            &typeu);
+
+        attr_mask_set_index(&p_attrs->attr_mask, i);
+    }
+    return 0;
+
+nomem:
+    ListMgr_FreeAttrs(p_attrs);
+    ATTR_SET_CLEAR(p_attrs);
+    return -ENOMEM;
+}
+
+void ListMgr_FreePackedAttrs(attr_pack_t *pack)
+{
+    MemFree(pack);
+}
+
+const attr_mask_t *ListMgr_PackedMask(const attr_pack_t *pack)
+{
+    return &pack->mask;
+}
+
 /** return the mask of attributes that differ */
 attr_mask_t ListMgr_WhatDiff(const attr_set_t *p_tgt, const attr_set_t *p_src)
 {
@@ -2106,6 +2870,9 @@ int _lmgr_delayed_retry(lmgr_t *lmgr, int errcode, const char *func, int line)
         return 0;
     }
 
+    /* the transaction is aborted: so are its accounting deltas */
+    listmgr_acct_discard(lmgr);
+
     /* transaction is about to be restarted,
      * sleep for a given time */
     if (lmgr->retry_delay == 0)
@@ -2222,6 +2989,44 @@ int attr_index_iter(unsigned int init, int *cookie)
     return *cookie;
 }
 
+int attr_mask_index_iter(const attr_mask_t *mask, int *cookie)
+{
+    uint64_t bits;
+    int      pos;
+
+    assert(cookie != NULL);
+
+    /* cookie is the next bit position to check:
+     * [0-31] std, [32-63] status, [64-127] sm_info */
+    while ((pos = *cookie) < 128)
+    {
+        if (pos < 32)
+            bits = mask->std >> pos;
+        else if (pos < 64)
+            bits = mask->status >> (pos - 32);
+        else
+            bits = mask->sm_info >> (pos - 64);
+
+        if (bits == 0)
+        {
+            /* go to the next word */
+            *cookie = (pos < 32) ? 32 : ((pos < 64) ? 64 : 128);
+            continue;
+        }
+
+        pos += __builtin_ctzll(bits);
+        *cookie = pos + 1;
+
+        if (pos < 32)
+            return pos;
+        else if (pos < 64)
+            return ATTR_INDEX_FLG_STATUS | (pos - 32);
+        else
+            return ATTR_INDEX_FLG_SMINFO | (pos - 64);
+    }
+    return -1;
+}
+
 /** unset read-only attributes from mask */
 void attr_mask_unset_readonly(attr_mask_t *mask)
 {
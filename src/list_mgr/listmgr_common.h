@@ -296,6 +296,34 @@ static inline bool is_acct_pk(unsigned int attr_index)
     return attr_mask_test_index(&acct_pk_attr_set, attr_index);
 }
 
+/** indicate if there are accounting fields (values or keys) in attr_mask */
+static inline bool acct_fields(attr_mask_t attr_mask)
+{
+    return !attr_mask_is_null(attr_mask_and(&attr_mask, &acct_attr_set))
+        || !attr_mask_is_null(attr_mask_and(&attr_mask, &acct_pk_attr_set));
+}
+
+/** indicate if attr_mask contains fields of the directory aggregates */
+static inline bool diragg_fields(attr_mask_t attr_mask)
+{
+    return lmgr_config.dir_agg
+        && (attr_mask.std & (ATTR_MASK_type | ATTR_MASK_size | ATTR_MASK_blocks
+                             | ATTR_MASK_parent_id | ATTR_MASK_name));
+}
+
+/** indicate if attr_mask contains fields of the OST aggregates */
+static inline bool ostagg_fields(attr_mask_t attr_mask)
+{
+#ifdef _LUSTRE
+    return lmgr_config.ost_agg
+        && (attr_mask.std & (ATTR_MASK_type | ATTR_MASK_size | ATTR_MASK_blocks
+                             | ATTR_MASK_last_access | ATTR_MASK_stripe_info
+                             | ATTR_MASK_stripe_items));
+#else
+    return false;
+#endif
+}
+
 /**
  * indicate if the field is part of the SOFTRM table
  * /!\ Can only be used after init_attrset_masks() has been called
@@ -413,6 +441,9 @@ static inline bool is_recov_field(unsigned int attr_index)
 void printdbtype(db_conn_t *pconn, GString *str, db_type_e type,
                  const db_type_u *value_ptr);
 
+/** printing a value to a bulk load file (see db_load_file()) */
+void printdbtype_load(GString *str, db_type_e type, const db_type_u *value_ptr);
+
 /** parse a value from DB */
 int  parsedbtype(char *instr, db_type_e type, db_type_u *value_out);
 
@@ -469,6 +500,8 @@ typedef enum {
                                    "on duplicate key ..." statement) */
     AOF_PREFIX      = (1 << 2), /* prefix field name with table name */
     AOF_SKIP_NAME   = (1 << 3), /* skip name record */
+    AOF_PARAM       = (1 << 4), /* '?' placeholders instead of values
+                                   (for prepared statements) */
 } attrset_op_flag_e;
 
 int            attrmask2fieldlist(GString *str, attr_mask_t attr_mask,
@@ -490,6 +523,101 @@ int            attrset2valuelist(lmgr_t *p_mgr, GString *str,
 int            attrset2updatelist(lmgr_t * p_mgr, GString *str,
                                   const attr_set_t * p_set, table_enum table,
                                   attrset_op_flag_e flags);
+/**
+ * Build the update list of several entries in a single statement:
+ * "f=CASE id WHEN <pk1> THEN <v1> ... ELSE f END,..." for each field of
+ * the table that is set in any of the attribute sets.
+ * @return nbr of fields, or a negative error code.
+ */
+int            attrsets2caselist(lmgr_t *p_mgr, GString *str,
+                                 const pktype *pks,
+                                 const attr_set_t **p_sets,
+                                 unsigned int count, table_enum table);
+
+/**
+ * Append attribute values to a row of a bulk load file
+ * (each value is preceded by a tab).
+ * @return nbr of fields, or a negative error code.
+ */
+int            attrset2loadrow(GString *str, const attr_set_t *p_set,
+                               table_enum table);
+
+/**
+ * Set prepared statement parameters from attribute values, in the same
+ * order as attrset2updatelist().
+ * @param p_chunk  converted values are stored in this chunk (created if
+ *                 needed, to be freed by the caller).
+ * @return nbr of parameters, or a negative error code.
+ */
+int            attrset2params(const attr_set_t *p_set, table_enum table,
+                              db_param_t *params, unsigned int max,
+                              GStringChunk **p_chunk);
+
+/* Cache of prepared statements of a connection, for frequent requests.
+ * Statements are identified by their kind and the attribute mask they
+ * are built from. */
+typedef enum {
+    STMT_EXISTS,        /* check if an entry exists */
+    STMT_GET,           /* get main, annex and names attributes */
+    STMT_UPDATE_MAIN,   /* update main table attributes */
+    STMT_UPDATE_ANNEX,  /* update annex table attributes */
+} lmgr_stmt_e;
+
+void lmgr_stmt_cache_init(lmgr_t *p_mgr);
+void lmgr_stmt_cache_free(lmgr_t *p_mgr);
+
+/** get a statement from the cache (NULL if it is not prepared yet) */
+db_stmt_t *lmgr_stmt_lookup(lmgr_t *p_mgr, lmgr_stmt_e kind,
+                            const attr_mask_t *mask);
+
+/** prepare a statement and add it to the cache */
+int lmgr_stmt_prepare(lmgr_t *p_mgr, lmgr_stmt_e kind, const attr_mask_t *mask,
+                      const char *query, db_stmt_t **p_stmt);
+
+/** same as lmgr_stmt_prepare(), with the types of result columns
+ * (see db_stmt_result_types()) */
+int lmgr_stmt_prepare_typed(lmgr_t *p_mgr, lmgr_stmt_e kind,
+                            const attr_mask_t *mask, const char *query,
+                            const db_type_e *types, unsigned int type_count,
+                            db_stmt_t **p_stmt);
+
+/**
+ * Run a query that is not cached (e.g. with a list of literal values),
+ * to get its results in binary form (see db_stmt_result_types()).
+ * The statement must be released by db_stmt_close().
+ */
+int lmgr_query_typed(lmgr_t *p_mgr, const char *query,
+                     const db_type_e *types, unsigned int type_count,
+                     db_stmt_t **p_stmt);
+
+/**
+ * Execute a cached statement. On connection errors, all the cached
+ * statements are released (they are no longer valid), so they are
+ * prepared again when the request is retried.
+ */
+int lmgr_stmt_exec(lmgr_t *p_mgr, db_stmt_t *stmt, const db_param_t *params,
+                   unsigned int count);
+
+/* bulk load (see listmgr_bulk.c) */
+/**
+ * Get the spool of a connection to append rows, if the bulk load mode
+ * is active. Must be released by listmgr_bulk_end().
+ * @return NULL if entries must be inserted by SQL requests.
+ */
+struct bulk_spool *listmgr_bulk_begin(lmgr_t *p_mgr);
+void listmgr_bulk_end(struct bulk_spool *spool);
+
+/**
+ * Append rows to the spool file of a table (rows are formatted as
+ * described for db_load_file()).
+ * @param mask  attribute mask of the rows (for main, names and annex tables).
+ */
+int listmgr_bulk_append(lmgr_t *p_mgr, struct bulk_spool *spool,
+                        table_enum table, attr_mask_t mask,
+                        const GString *rows, unsigned int nb_rows);
+
+/** load entries spooled by a connection and release its spool */
+void listmgr_bulk_close(lmgr_t *p_mgr);
 
 char          *compar2str(filter_comparator_t compar);
 
@@ -541,6 +669,19 @@ void append_size_range_fields(GString *str, bool leading_comma,
 int            result2attrset( table_enum table, char **result_tab,
                                unsigned int res_count, attr_set_t * p_set );
 
+/**
+ * Get the types of the result columns for the fields of a table,
+ * in the same order as attrmask2fieldlist(), to fetch integers
+ * in binary form (see db_stmt_result_types()).
+ * @return nbr of columns, or a negative error code.
+ */
+int            attrmask2types(attr_mask_t attr_mask, table_enum table,
+                              db_type_e *types, unsigned int count);
+/** same as result2attrset(), from values got by db_stmt_fetch_values() */
+int            values2attrset(table_enum table, const db_type_u *values,
+                              const bool *nulls, unsigned int count,
+                              attr_set_t *p_set);
+
 /* return the attr string for a dirattr */
 const char * dirattr2str(unsigned int attr_index);
 
@@ -37,8 +37,24 @@ static void lmgr_cfg_set_default(void *module_config)
     lmgr_config_t *conf = (lmgr_config_t *) module_config;
 
     conf->commit_behavior = 1;  /* transaction */
+    conf->commit_group = false;
+    conf->commit_max_delay = 0;
     conf->connect_retry_min = 1;
     conf->connect_retry_max = 30;
+    conf->attr_cache_size = 0;  /* disabled */
+    conf->attr_cache_ttl = 10;
+    conf->path_cache_size = 0;  /* disabled */
+    conf->pool_size = 0;        /* unlimited */
+    conf->mass_rm_batch = 0;    /* single transaction */
+    conf->dir_list_chunk = 100;
+    conf->query_stats = true;
+    conf->slow_query_time = 5.0;
+    conf->report_snapshot_interval = 0;   /* disabled */
+    conf->ost_history_interval = 3600;
+    conf->ost_history_retention = 30 * 86400;
+    conf->summary_interval = 0;   /* disabled */
+    conf->summary_history_retention = 365 * 86400;
+    conf->stats_history = true;
 
 #ifdef _MYSQL
     strcpy(conf->db_config.server, "localhost");
@@ -55,12 +71,24 @@ static void lmgr_cfg_set_default(void *module_config)
      * no compression, as zlib compression appears to slow database
      * inserts when used by robinhood. */
     strcpy(conf->db_config.tokudb_compression, "tokudb_uncompressed");
+    conf->db_config.bulk_load_dir[0] = '\0';
+    conf->db_config.shards[0] = '\0';
+    conf->db_config.id_partitions[0] = '\0';
+    conf->db_config.softrm_partition_time = 0;
 #elif defined(_SQLITE)
     strcpy(conf->db_config.filepath, "/var/robinhood/robinhood_sqlite_db");
     conf->db_config.retry_delay_microsec = 1000;    /* 1ms */
+    conf->db_config.wal = true;
+    strcpy(conf->db_config.synchronous, "NORMAL");
+    conf->db_config.mmap_size = 256LL * 1024 * 1024;   /* 256MB */
 #endif
 
     conf->acct = true;
+    conf->acct_deltas = false;
+    conf->dir_agg = false;
+    conf->ost_agg = false;
+    conf->compact_stripes = false;
+    conf->name_suffix_index = false;
 }
 
 static void lmgr_cfg_write_default(FILE *output)
@@ -69,7 +97,30 @@ static void lmgr_cfg_write_default(FILE *output)
     print_line(output, 1, "commit_behavior             : transaction");
     print_line(output, 1, "connect_retry_interval_min  : 1s");
     print_line(output, 1, "connect_retry_interval_max  : 30s");
+    print_line(output, 1, "attr_cache_size             : 0 (disabled)");
+    print_line(output, 1, "attr_cache_ttl              : 10s");
+    print_line(output, 1, "path_cache_size             : 0 (disabled)");
+    print_line(output, 1, "connection_pool_size        : 0 (unlimited)");
+    print_line(output, 1, "mass_remove_batch           : 0 (single transaction)");
+    print_line(output, 1, "dir_list_chunk              : 100");
+    print_line(output, 1, "query_stats                 : yes");
+    print_line(output, 1, "slow_query_time             : 5.0 (sec)");
+    print_line(output, 1, "report_snapshot_interval    : 0 (disabled)");
+    print_line(output, 1, "summary_interval            : 0 (disabled)");
+    print_line(output, 1, "summary_history_retention   : 365d");
+    print_line(output, 1, "stats_history               : yes");
+#ifdef _LUSTRE
+    print_line(output, 1, "ost_history_interval        : 1h");
+    print_line(output, 1, "ost_history_retention       : 30d");
+#endif
     print_line(output, 1, "accounting  : enabled");
+    print_line(output, 1, "accounting_deltas           : no");
+    print_line(output, 1, "dir_aggregates              : no");
+#ifdef _LUSTRE
+    print_line(output, 1, "ost_aggregates              : no");
+#endif
+    print_line(output, 1, "compact_stripes             : no");
+    print_line(output, 1, "name_suffix_index           : no");
     fprintf(output, "\n");
 
 #ifdef _MYSQL
@@ -81,12 +132,19 @@ static void lmgr_cfg_write_default(FILE *output)
     print_line(output, 2, "port    :   (MySQL default)");
     print_line(output, 2, "socket  :   NONE");
     print_line(output, 2, "engine  :   InnoDB");
+    print_line(output, 2, "bulk_load_dir : NONE");
+    print_line(output, 2, "shards  :   NONE");
+    print_line(output, 2, "id_partitions : NONE");
+    print_line(output, 2, "softrm_partition_time : 0 (disabled)");
     print_end_block(output, 1);
 #elif defined(_SQLITE)
     print_begin_block(output, 1, SQLITE_CONFIG_BLOCK, NULL);
     print_line(output, 2,
                "db_file              :  \"/var/robinhood/robinhood_sqlite_db\"");
     print_line(output, 2, "retry_delay_microsec :  1000 (1 millisec)");
+    print_line(output, 2, "wal                  :  yes");
+    print_line(output, 2, "synchronous          :  NORMAL");
+    print_line(output, 2, "mmap_size            :  256MB");
     print_end_block(output, 1);
 #endif
 
@@ -107,7 +165,14 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
 
     static const char *lmgr_allowed[] = {
         "commit_behavior", "connect_retry_interval_min",
-        "connect_retry_interval_max", "accounting",
+        "connect_retry_interval_max", "accounting", "accounting_deltas",
+        "dir_aggregates", "ost_aggregates", "compact_stripes",
+        "name_suffix_index",
+        "attr_cache_size", "attr_cache_ttl", "path_cache_size", "connection_pool_size",
+        "mass_remove_batch", "dir_list_chunk", "query_stats", "slow_query_time",
+        "report_snapshot_interval", "ost_history_interval",
+        "ost_history_retention", "summary_interval",
+        "summary_history_retention", "stats_history",
         MYSQL_CONFIG_BLOCK, SQLITE_CONFIG_BLOCK,
         "user_acct", "group_acct",  /* deprecated => accounting */
         NULL
@@ -119,13 +184,45 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
         {"connect_retry_interval_max", PT_DURATION, PFLG_POSITIVE |
          PFLG_NOT_NULL, &conf->connect_retry_max, 0},
         {"accounting", PT_BOOL, 0, &conf->acct, 0},
+        {"accounting_deltas", PT_BOOL, 0, &conf->acct_deltas, 0},
+        {"dir_aggregates", PT_BOOL, 0, &conf->dir_agg, 0},
+        {"ost_aggregates", PT_BOOL, 0, &conf->ost_agg, 0},
+        {"compact_stripes", PT_BOOL, 0, &conf->compact_stripes, 0},
+        {"name_suffix_index", PT_BOOL, 0, &conf->name_suffix_index, 0},
+        {"attr_cache_size", PT_INT, PFLG_POSITIVE,
+         (int *)&conf->attr_cache_size, 0},
+        {"attr_cache_ttl", PT_DURATION, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->attr_cache_ttl, 0},
+        {"path_cache_size", PT_INT, PFLG_POSITIVE,
+         (int *)&conf->path_cache_size, 0},
+        {"connection_pool_size", PT_INT, PFLG_POSITIVE,
+         (int *)&conf->pool_size, 0},
+        {"mass_remove_batch", PT_INT, PFLG_POSITIVE,
+         (int *)&conf->mass_rm_batch, 0},
+        {"dir_list_chunk", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         (int *)&conf->dir_list_chunk, 0},
+        {"query_stats", PT_BOOL, 0, &conf->query_stats, 0},
+        {"slow_query_time", PT_FLOAT, PFLG_POSITIVE, &conf->slow_query_time,
+         0},
+        {"report_snapshot_interval", PT_DURATION, PFLG_POSITIVE,
+         &conf->report_snapshot_interval, 0},
+        {"ost_history_interval", PT_DURATION, PFLG_POSITIVE,
+         &conf->ost_history_interval, 0},
+        {"ost_history_retention", PT_DURATION, PFLG_POSITIVE,
+         &conf->ost_history_retention, 0},
+        {"summary_interval", PT_DURATION, PFLG_POSITIVE,
+         &conf->summary_interval, 0},
+        {"summary_history_retention", PT_DURATION, PFLG_POSITIVE,
+         &conf->summary_history_retention, 0},
+        {"stats_history", PT_BOOL, 0, &conf->stats_history, 0},
         END_OF_PARAMS
     };
 
 #ifdef _MYSQL
     static const char *db_allowed[] = {
         "server", "db", "user", "password", "password_file", "port", "socket",
-        "engine", "tokudb_compression", NULL
+        "engine", "tokudb_compression", "bulk_load_dir", "shards",
+        "id_partitions", "softrm_partition_time", NULL
     };
 
     const cfg_param_t db_params[] = {
@@ -150,11 +247,24 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
          conf->db_config.tokudb_compression,
          sizeof(conf->db_config.tokudb_compression)}
         ,
+        {"bulk_load_dir", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_NO_WILDCARDS,
+         conf->db_config.bulk_load_dir, sizeof(conf->db_config.bulk_load_dir)}
+        ,
+        {"shards", PT_STRING, PFLG_NO_WILDCARDS,
+         conf->db_config.shards, sizeof(conf->db_config.shards)}
+        ,
+        {"id_partitions", PT_STRING, PFLG_NO_WILDCARDS,
+         conf->db_config.id_partitions,
+         sizeof(conf->db_config.id_partitions)}
+        ,
+        {"softrm_partition_time", PT_DURATION, PFLG_POSITIVE,
+         &conf->db_config.softrm_partition_time, 0}
+        ,
         END_OF_PARAMS
     };
 #elif defined(_SQLITE)
     static const char *db_allowed[] = {
-        "db_file", "retry_delay_microsec",
+        "db_file", "retry_delay_microsec", "wal", "synchronous", "mmap_size",
         NULL
     };
     const cfg_param_t db_params[] = {
@@ -163,6 +273,10 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
         ,
         {"retry_delay_microsec", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          (int *)&conf->db_config.retry_delay_microsec, 0},
+        {"wal", PT_BOOL, 0, &conf->db_config.wal, 0},
+        {"synchronous", PT_STRING, PFLG_NO_WILDCARDS,
+         conf->db_config.synchronous, sizeof(conf->db_config.synchronous)},
+        {"mmap_size", PT_SIZE, 0, &conf->db_config.mmap_size, 0},
         END_OF_PARAMS
     };
 #endif
@@ -202,10 +316,39 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
                        "::commit_behavior = periodic\" must be a positive integer. Eg: commit_behavior = periodic(1000)");
                 return EINVAL;
             }
+        } else if (!strcasecmp(tmpstr, "group")) {
+            if ((nb_options < 1) || (nb_options > 2) || !options
+                || !options[0]) {
+                strcpy(msg_out,
+                       "1 or 2 arguments are expected for group commit behavior. Eg: commit_behavior = group(1000,100)");
+                return EINVAL;
+            }
+
+            conf->commit_behavior = atoi(options[0]);
+            if (conf->commit_behavior == 0) {
+                strcpy(msg_out,
+                       "The first argument for \"" LMGR_CONFIG_BLOCK
+                       "::commit_behavior = group\" must be a positive integer. Eg: commit_behavior = group(1000,100)");
+                return EINVAL;
+            }
+            /* max delay in milliseconds (default: 1s) */
+            conf->commit_max_delay = 1000;
+            if (nb_options == 2) {
+                conf->commit_max_delay = atoi(options[1]);
+                if (conf->commit_max_delay == 0) {
+                    strcpy(msg_out,
+                           "The second argument for \"" LMGR_CONFIG_BLOCK
+                           "::commit_behavior = group\" must be a positive integer (milliseconds). Eg: commit_behavior = group(1000,100)");
+                    return EINVAL;
+                }
+            }
+            /* a group of 1 operation is a simple transaction */
+            conf->commit_group = (conf->commit_behavior > 1);
         } else {
             sprintf(msg_out,
                     "Invalid commit behavior '%s' (expected: autocommit, "
-                    "transaction, periodic(<count>))", tmpstr);
+                    "transaction, periodic(<count>), "
+                    "group(<count>[,<max_delay_ms>]))", tmpstr);
             return EINVAL;
         }
     }
@@ -292,6 +435,16 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
         rh_strncpy(conf->db_config.password, tmpstr, 256);
     }
 
+    /* bounds are inserted as is in table definitions */
+    if (strspn(conf->db_config.id_partitions, "0123456789abcdefABCDEFx:, ")
+        != strlen(conf->db_config.id_partitions)) {
+        sprintf(msg_out, "Invalid value for " MYSQL_CONFIG_BLOCK
+                "::id_partitions: '%s' (comma-separated list of ids "
+                "expected, e.g. \"0x200010000,0x200020000\")",
+                conf->db_config.id_partitions);
+        return EINVAL;
+    }
+
     CheckUnknownParameters(db_block, MYSQL_CONFIG_BLOCK, db_allowed);
 
 #elif defined(_SQLITE)
@@ -305,6 +458,15 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
     if (rc)
         return rc;
 
+    if (strcasecmp(conf->db_config.synchronous, "OFF")
+        && strcasecmp(conf->db_config.synchronous, "NORMAL")
+        && strcasecmp(conf->db_config.synchronous, "FULL")) {
+        sprintf(msg_out, "Invalid value for " SQLITE_CONFIG_BLOCK
+                "::synchronous: '%s' (OFF, NORMAL or FULL expected)",
+                conf->db_config.synchronous);
+        return EINVAL;
+    }
+
     CheckUnknownParameters(db_block, SQLITE_CONFIG_BLOCK, db_allowed);
 #endif
 
@@ -313,16 +475,147 @@ static int lmgr_cfg_read(config_file_t config, void *module_config,
 
 static int lmgr_cfg_reload(lmgr_config_t *conf)
 {
-    if (conf->commit_behavior != lmgr_config.commit_behavior)
+    if (conf->commit_behavior != lmgr_config.commit_behavior
+        || conf->commit_group != lmgr_config.commit_group
+        || conf->commit_max_delay != lmgr_config.commit_max_delay)
         DisplayLog(LVL_MAJOR, TAG,
                    LMGR_CONFIG_BLOCK
                    "::commit_behavior changed in config file, but cannot be modified dynamically");
 
+    if (conf->attr_cache_size != lmgr_config.attr_cache_size)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::attr_cache_size changed in config file, but cannot be modified dynamically");
+
+    if (conf->attr_cache_ttl != lmgr_config.attr_cache_ttl) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::attr_cache_ttl updated: %ld->%ld",
+                   lmgr_config.attr_cache_ttl, conf->attr_cache_ttl);
+        lmgr_config.attr_cache_ttl = conf->attr_cache_ttl;
+    }
+
+    if (conf->path_cache_size != lmgr_config.path_cache_size)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::path_cache_size changed in config file, but cannot be modified dynamically");
+
+    if (conf->pool_size != lmgr_config.pool_size) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::connection_pool_size updated: %u->%u",
+                   lmgr_config.pool_size, conf->pool_size);
+        lmgr_config.pool_size = conf->pool_size;
+    }
+
+    if (conf->mass_rm_batch != lmgr_config.mass_rm_batch) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::mass_remove_batch updated: %u->%u",
+                   lmgr_config.mass_rm_batch, conf->mass_rm_batch);
+        lmgr_config.mass_rm_batch = conf->mass_rm_batch;
+    }
+
+    if (conf->dir_list_chunk != lmgr_config.dir_list_chunk) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::dir_list_chunk updated: %u->%u",
+                   lmgr_config.dir_list_chunk, conf->dir_list_chunk);
+        lmgr_config.dir_list_chunk = conf->dir_list_chunk;
+    }
+
+    if (conf->query_stats != lmgr_config.query_stats) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::query_stats updated: %s->%s",
+                   bool2str(lmgr_config.query_stats),
+                   bool2str(conf->query_stats));
+        lmgr_config.query_stats = conf->query_stats;
+    }
+
+    if (conf->slow_query_time != lmgr_config.slow_query_time) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::slow_query_time updated: %.3f->%.3f",
+                   lmgr_config.slow_query_time, conf->slow_query_time);
+        lmgr_config.slow_query_time = conf->slow_query_time;
+    }
+
+    if (conf->report_snapshot_interval
+        != lmgr_config.report_snapshot_interval) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::report_snapshot_interval updated: "
+                   "%ld->%ld", lmgr_config.report_snapshot_interval,
+                   conf->report_snapshot_interval);
+        lmgr_config.report_snapshot_interval = conf->report_snapshot_interval;
+    }
+
+    if (conf->ost_history_interval != lmgr_config.ost_history_interval) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::ost_history_interval updated: "
+                   "%ld->%ld", lmgr_config.ost_history_interval,
+                   conf->ost_history_interval);
+        lmgr_config.ost_history_interval = conf->ost_history_interval;
+    }
+
+    if (conf->ost_history_retention != lmgr_config.ost_history_retention) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::ost_history_retention updated: "
+                   "%ld->%ld", lmgr_config.ost_history_retention,
+                   conf->ost_history_retention);
+        lmgr_config.ost_history_retention = conf->ost_history_retention;
+    }
+
+    if (conf->summary_interval != lmgr_config.summary_interval) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::summary_interval updated: "
+                   "%ld->%ld", lmgr_config.summary_interval,
+                   conf->summary_interval);
+        lmgr_config.summary_interval = conf->summary_interval;
+    }
+
+    if (conf->summary_history_retention
+        != lmgr_config.summary_history_retention) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::summary_history_retention updated: "
+                   "%ld->%ld", lmgr_config.summary_history_retention,
+                   conf->summary_history_retention);
+        lmgr_config.summary_history_retention =
+            conf->summary_history_retention;
+    }
+
+    if (conf->stats_history != lmgr_config.stats_history) {
+        DisplayLog(LVL_EVENT, TAG,
+                   LMGR_CONFIG_BLOCK "::stats_history updated: %s->%s",
+                   bool2str(lmgr_config.stats_history),
+                   bool2str(conf->stats_history));
+        lmgr_config.stats_history = conf->stats_history;
+    }
+
     if (conf->acct != lmgr_config.acct)
         DisplayLog(LVL_MAJOR, TAG,
                    LMGR_CONFIG_BLOCK
                    "::accounting changed in config file, but cannot be modified dynamically");
 
+    if (conf->acct_deltas != lmgr_config.acct_deltas)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::accounting_deltas changed in config file, but cannot be modified dynamically");
+
+    if (conf->dir_agg != lmgr_config.dir_agg)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::dir_aggregates changed in config file, but cannot be modified dynamically");
+
+    if (conf->ost_agg != lmgr_config.ost_agg)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::ost_aggregates changed in config file, but cannot be modified dynamically");
+
+    if (conf->compact_stripes != lmgr_config.compact_stripes)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::compact_stripes changed in config file, but cannot be modified dynamically");
+
+    if (conf->name_suffix_index != lmgr_config.name_suffix_index)
+        DisplayLog(LVL_MAJOR, TAG,
+                   LMGR_CONFIG_BLOCK
+                   "::name_suffix_index changed in config file, but cannot be modified dynamically");
+
     if (conf->connect_retry_min != lmgr_config.connect_retry_min) {
         DisplayLog(LVL_EVENT, TAG,
                    LMGR_CONFIG_BLOCK
@@ -356,6 +649,22 @@ static int lmgr_cfg_reload(lmgr_config_t *conf)
         DisplayLog(LVL_MAJOR, TAG,
                    MYSQL_CONFIG_BLOCK
                    "::password changed in config file, but cannot be modified dynamically");
+    if (strcmp(conf->db_config.bulk_load_dir,
+               lmgr_config.db_config.bulk_load_dir))
+        DisplayLog(LVL_MAJOR, TAG,
+                   MYSQL_CONFIG_BLOCK
+                   "::bulk_load_dir changed in config file, but cannot be modified dynamically");
+    if (strcmp(conf->db_config.shards, lmgr_config.db_config.shards))
+        DisplayLog(LVL_MAJOR, TAG,
+                   MYSQL_CONFIG_BLOCK
+                   "::shards changed in config file, but cannot be modified dynamically");
+    if (strcmp(conf->db_config.id_partitions,
+               lmgr_config.db_config.id_partitions)
+        || conf->db_config.softrm_partition_time
+           != lmgr_config.db_config.softrm_partition_time)
+        DisplayLog(LVL_MAJOR, TAG,
+                   MYSQL_CONFIG_BLOCK
+                   "::id_partitions or softrm_partition_time changed in config file, but cannot be modified dynamically");
 #elif defined(_SQLITE)
     if (strcmp(conf->db_config.filepath, lmgr_config.db_config.filepath))
         DisplayLog(LVL_MAJOR, TAG,
@@ -371,6 +680,19 @@ static int lmgr_cfg_reload(lmgr_config_t *conf)
         lmgr_config.db_config.retry_delay_microsec =
             conf->db_config.retry_delay_microsec;
     }
+    if (conf->db_config.wal != lmgr_config.db_config.wal)
+        DisplayLog(LVL_MAJOR, TAG,
+                   SQLITE_CONFIG_BLOCK
+                   "::wal changed in config file, but cannot be modified dynamically");
+    if (strcasecmp(conf->db_config.synchronous,
+                   lmgr_config.db_config.synchronous))
+        DisplayLog(LVL_MAJOR, TAG,
+                   SQLITE_CONFIG_BLOCK
+                   "::synchronous changed in config file, but cannot be modified dynamically");
+    if (conf->db_config.mmap_size != lmgr_config.db_config.mmap_size)
+        DisplayLog(LVL_MAJOR, TAG,
+                   SQLITE_CONFIG_BLOCK
+                   "::mmap_size changed in config file, but cannot be modified dynamically");
 #endif
 
     return 0;
@@ -399,6 +721,10 @@ static void lmgr_cfg_write_template(FILE *output)
                "# - \"transaction\": manage operations in transactions (best consistency, lower performance)");
     print_line(output, 1,
                "# - \"periodic(<nb_transaction>)\": periodically commit (every <n> transactions).");
+    print_line(output, 1,
+               "# - \"group(<nb_transaction>[,<max_delay_ms>])\": commit every <n> transactions, or after <max_delay_ms> milliseconds");
+    print_line(output, 1,
+               "#   (default: 1000). Changelog records are only cleared once their transaction is committed.");
     print_line(output, 1, "commit_behavior = transaction ;");
     fprintf(output, "\n");
     print_line(output, 1,
@@ -407,11 +733,102 @@ static void lmgr_cfg_write_template(FILE *output)
                "# Then this time is multiplied by 2 until reaching connect_retry_interval_max");
     print_line(output, 1, "connect_retry_interval_min = 1 ;");
     print_line(output, 1, "connect_retry_interval_max = 30 ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Number of entries to keep in an in-memory cache of entry attributes");
+    print_line(output, 1,
+               "# (0 to disable), and max time to keep an entry in this cache.");
+    print_line(output, 1, "# attr_cache_size = 100000 ;");
+    print_line(output, 1, "# attr_cache_ttl = 10s ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Number of directory paths to keep in memory (0 to disable).");
+    print_line(output, 1,
+               "# Full paths are then built from parent and name of entries,");
+    print_line(output, 1,
+               "# instead of being computed by the database.");
+    print_line(output, 1, "# path_cache_size = 100000 ;");
+    print_line(output, 1,
+               "# Max DB connections shared by policy workers and stats threads");
+    print_line(output, 1, "# (0 = unlimited: as many as concurrent operations).");
+    print_line(output, 1, "# connection_pool_size = 8 ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Remove entries by batches of <n> entries (1 transaction per batch)");
+    print_line(output, 1,
+               "# at the end of scans, instead of a single huge transaction (0).");
+    print_line(output, 1, "# mass_remove_batch = 10000 ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Number of directories listed per request by rbh-find and rbh-du");
+    print_line(output, 1, "# dir_list_chunk = 100 ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Account DB query times by query template (dumped with stats),");
+    print_line(output, 1,
+               "# and log queries longer than slow_query_time (in seconds, 0 to disable).");
+    print_line(output, 1, "# query_stats = yes ;");
+    print_line(output, 1, "# slow_query_time = 5.0 ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Serve user, group, class and status reports of rbh-report from");
+    print_line(output, 1,
+               "# snapshots, refreshed by the daemon at this interval (0 to disable).");
+    print_line(output, 1, "# report_snapshot_interval = 5min ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Maintain the summary tables of the web GUI at this interval");
+    print_line(output, 1,
+               "# (0 to disable), with a history of filesystem usage.");
+    print_line(output, 1, "# summary_interval = 10min ;");
+    print_line(output, 1, "# summary_history_retention = 365d ;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# Store daemon stats as time series at each stats_interval,");
+    print_line(output, 1,
+               "# with minute, hour and day rollups (see rbh-report --trend).");
+    print_line(output, 1, "# stats_history = yes ;");
+    fprintf(output, "\n");
+#ifdef _LUSTRE
+    print_line(output, 1,
+               "# Record OST usage at this interval (0 to disable), for rbh-report");
+    print_line(output, 1,
+               "# --ost-history, and drop the samples older than the retention.");
+    print_line(output, 1, "# ost_history_interval = 1h ;");
+    print_line(output, 1, "# ost_history_retention = 30d ;");
+    fprintf(output, "\n");
+#endif
 
     print_line(output, 1,
                "# disable the following options if you are not interested in");
     print_line(output, 1, "# user or group stats (to speed up scan)");
     print_line(output, 1, "accounting  = enabled ;");
+    print_line(output, 1,
+               "# Maintain accounting by aggregating the changes of each transaction,");
+    print_line(output, 1,
+               "# instead of DB triggers (less contention on the accounting table).");
+    print_line(output, 1, "# accounting_deltas = yes ;");
+    print_line(output, 1,
+               "# Maintain the usage of each directory subtree (by entry type),");
+    print_line(output, 1, "# so rbh-du does not have to scan the namespace.");
+    print_line(output, 1, "# dir_aggregates = yes ;");
+#ifdef _LUSTRE
+    print_line(output, 1,
+               "# Maintain the usage of each OST by last access day, so OST");
+    print_line(output, 1,
+               "# policy runs and rbh-report --ost-usage don't join stripe tables.");
+    print_line(output, 1, "# ost_aggregates = yes ;");
+#endif
+    print_line(output, 1,
+               "# Store the stripe objects of each file as a single packed value.");
+    print_line(output, 1,
+               "# Only OST indexes are kept in a separate table, to filter by OST.");
+    print_line(output, 1, "# compact_stripes = yes ;");
+    print_line(output, 1,
+               "# Index reversed entry names, so name patterns like '*.h5' don't scan");
+    print_line(output, 1,
+               "# the whole NAMES table (index created by 'robinhood --alter-db').");
+    print_line(output, 1, "# name_suffix_index = yes ;");
     fprintf(output, "\n");
 #ifdef _MYSQL
     print_begin_block(output, 1, MYSQL_CONFIG_BLOCK, NULL);
@@ -422,11 +839,30 @@ static void lmgr_cfg_write_template(FILE *output)
     print_line(output, 2, "# port   = 3306 ;");
     print_line(output, 2, "# socket = \"/tmp/mysql.sock\" ;");
     print_line(output, 2, "engine = InnoDB ;");
+    print_line(output, 2, "# Spool directory to bulk load entries of the initial scan");
+    print_line(output, 2, "# of an empty DB (requires local_infile on the server).");
+    print_line(output, 2, "# bulk_load_dir = \"/var/tmp/robinhood\" ;");
+    print_line(output, 2, "# Distribute entries on several MySQL servers, declared");
+    print_line(output, 2, "# on this server with CREATE SERVER (requires the Spider");
+    print_line(output, 2, "# engine). Entry tables must exist on each shard.");
+    print_line(output, 2, "# shards = \"shard1,shard2,shard3\" ;");
+    print_line(output, 2, "# Partition entry tables by ranges of ids (upper bounds");
+    print_line(output, 2, "# of the FID sequence ranges), and SOFT_RM by rm_time.");
+    print_line(output, 2, "# Only applies when tables are created.");
+    print_line(output, 2, "# id_partitions = \"0x200010000,0x200020000\" ;");
+    print_line(output, 2, "# softrm_partition_time = 30d ;");
     print_end_block(output, 1);
 #elif defined(_SQLITE)
     print_begin_block(output, 1, SQLITE_CONFIG_BLOCK, NULL);
     print_line(output, 2, "db_file = \"/var/robinhood/robinhood_sqlite_db\" ;");
     print_line(output, 2, "retry_delay_microsec = 1000 ;");
+    print_line(output, 2, "# Write-ahead logging: readers (e.g. rbh-report)");
+    print_line(output, 2, "# don't block the daemon, and don't wait for it.");
+    print_line(output, 2, "wal = yes ;");
+    print_line(output, 2, "# OFF, NORMAL or FULL (FULL is only needed without WAL");
+    print_line(output, 2, "# to survive a power failure)");
+    print_line(output, 2, "synchronous = NORMAL ;");
+    print_line(output, 2, "mmap_size = 256MB ;");
     print_end_block(output, 1);
 #endif
 
@@ -457,5 +893,42 @@ mod_cfg_funcs_t lmgr_cfg_hdlr = {
 
 bool lmgr_parallel_batches(void)
 {
-    return !lmgr_config.acct;
+    /* accounting deltas are applied in the same order by all threads */
+    return !lmgr_config.acct || lmgr_config.acct_deltas;
+}
+
+time_t lmgr_report_snapshot_interval(void)
+{
+    return lmgr_config.report_snapshot_interval;
+}
+
+time_t lmgr_ost_history_interval(void)
+{
+    return lmgr_config.ost_history_interval;
+}
+
+time_t lmgr_ost_history_retention(void)
+{
+    return lmgr_config.ost_history_retention;
+}
+
+time_t lmgr_summary_interval(void)
+{
+    return lmgr_config.summary_interval;
+}
+
+time_t lmgr_summary_history_retention(void)
+{
+    return lmgr_config.summary_history_retention;
+}
+
+bool lmgr_stats_history(void)
+{
+    return lmgr_config.stats_history;
+}
+
+unsigned int lmgr_dir_list_chunk(void)
+{
+    /* at least 1, e.g. if the config was not loaded */
+    return lmgr_config.dir_list_chunk > 0 ? lmgr_config.dir_list_chunk : 1;
 }
@@ -0,0 +1,547 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Per-directory usage aggregates (dir_aggregates = yes).
+ * DIR_AGG contains, for each directory and entry type, the count, size
+ * and blocks of all the entries of its subtree (the directory excluded).
+ * Like the accounting deltas, the contribution of modified entries to
+ * their parent is read before and after their modification (for a
+ * directory, it includes its own aggregates, so a moved subtree is
+ * accounted to its new ancestors). At commit time, the deltas of the
+ * transaction are propagated to all the ancestors, one level at a time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+/* values of each (directory, type) */
+#define NB_VALS     3
+static const char *val_names[NB_VALS] = {ACCT_FIELD_COUNT, "size", "blocks"};
+
+/* bound the propagation in case of a loop in the namespace */
+#define MAX_DEPTH   1024
+/* rows per request when writing aggregates */
+#define FLUSH_ROWS  1000
+
+/* ancestor table used to populate DIR_AGG */
+#define DIRAGG_ANC_TABLE DIRAGG_TABLE"_ANC"
+
+struct dir_delta {
+    char       *key;    /* SQL values of the key: "'pk','type'" */
+    char       *pk;
+    char       *type;
+    long long   d[NB_VALS];
+};
+
+static void delta_free(gpointer p)
+{
+    struct dir_delta *delta = p;
+
+    g_free(delta->key);
+    g_free(delta->pk);
+    g_free(delta->type);
+    MemFree(delta);
+}
+
+static GHashTable *delta_hash_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, NULL, delta_free);
+}
+
+/** add values to the delta of a (directory, type) */
+static int delta_add(GHashTable *hash, const char *pk, const char *type,
+                     const long long *d)
+{
+    struct dir_delta *delta;
+    char *key;
+    int i;
+
+    key = g_strdup_printf(DPK",'%s'", pk, type);
+    delta = g_hash_table_lookup(hash, key);
+    if (delta == NULL)
+    {
+        delta = MemCalloc(1, sizeof(*delta));
+        if (delta == NULL)
+        {
+            g_free(key);
+            return DB_NO_MEMORY;
+        }
+        delta->key = key;
+        delta->pk = g_strdup(pk);
+        delta->type = g_strdup(type);
+        g_hash_table_insert(hash, delta->key, delta);
+    }
+    else
+        g_free(key);
+
+    for (i = 0; i < NB_VALS; i++)
+        delta->d[i] += d[i];
+    return DB_SUCCESS;
+}
+
+int listmgr_diragg_delta(lmgr_t *p_mgr, const char *where, int sign)
+{
+    GString        *req;
+    result_handle_t result;
+    char           *res[2 + NB_VALS];
+    int             i, rc;
+
+    if (!lmgr_config.dir_agg)
+        return DB_SUCCESS;
+
+    if (p_mgr->dir_deltas == NULL)
+        p_mgr->dir_deltas = delta_hash_new();
+
+    /* contribution of the entries to their parents: the entries themselves
+     * and the subtree of directories */
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT n.parent_id,e.type,COUNT(*),SUM(e.size),"
+                    "SUM(e.blocks) FROM "MAIN_TABLE" e JOIN "DNAMES_TABLE" n"
+                    " ON e.id=n.id WHERE e.id IN (SELECT id FROM "MAIN_TABLE
+                    " WHERE %s) GROUP BY n.parent_id,e.type"
+                    " UNION ALL SELECT n.parent_id,a.type,SUM(a.%s),"
+                    "SUM(a.size),SUM(a.blocks) FROM "DIRAGG_TABLE" a JOIN "
+                    DNAMES_TABLE" n ON a.id=n.id WHERE a.id IN (SELECT id FROM "
+                    MAIN_TABLE" WHERE %s) GROUP BY n.parent_id,a.type",
+                    where, ACCT_FIELD_COUNT, where);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 2 + NB_VALS))
+           == DB_SUCCESS)
+    {
+        long long d[NB_VALS];
+
+        if (res[0] == NULL || res[1] == NULL)
+            continue;
+
+        for (i = 0; i < NB_VALS; i++)
+            d[i] = res[2 + i] ? sign * strtoll(res[2 + i], NULL, 10) : 0;
+
+        rc = delta_add(p_mgr->dir_deltas, res[0], res[1], d);
+        if (rc)
+            break;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc == DB_END_OF_LIST)
+        rc = DB_SUCCESS;
+    return rc;
+}
+
+static void parent_list_free(gpointer p)
+{
+    GSList *l;
+
+    for (l = p; l != NULL; l = l->next)
+        g_free(l->data);
+    g_slist_free(p);
+}
+
+/** get the parents of the directories of a set of deltas */
+static int get_parents(lmgr_t *p_mgr, GHashTable *level, GHashTable *parents)
+{
+    GHashTableIter  iter;
+    gpointer        value;
+    GString        *req;
+    result_handle_t result;
+    char           *res[2];
+    bool            first = true;
+    int             rc;
+
+    req = g_string_new("SELECT id,parent_id FROM "DNAMES_TABLE" WHERE id IN (");
+    g_hash_table_iter_init(&iter, level);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        struct dir_delta *delta = value;
+
+        /* query each directory once */
+        if (g_hash_table_lookup_extended(parents, delta->pk, NULL, NULL))
+            continue;
+        g_hash_table_insert(parents, g_strdup(delta->pk), NULL);
+
+        g_string_append_printf(req, "%s"DPK, first ? "" : ",", delta->pk);
+        first = false;
+    }
+    g_string_append_c(req, ')');
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 2)) == DB_SUCCESS)
+    {
+        gpointer key, list;
+
+        /* stop at the root (or at entries that are their own parent) */
+        if (res[0] == NULL || res[1] == NULL || !strcmp(res[0], res[1]))
+            continue;
+
+        if (!g_hash_table_lookup_extended(parents, res[0], &key, &list))
+            continue;
+        /* the list is extended: don't free it */
+        g_hash_table_steal(parents, key);
+        g_hash_table_insert(parents, key,
+                            g_slist_prepend(list, g_strdup(res[1])));
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc == DB_END_OF_LIST)
+        rc = DB_SUCCESS;
+    return rc;
+}
+
+/** add the deltas of a level to the parent level */
+static int propagate(GHashTable *level, GHashTable *parents, GHashTable *next)
+{
+    GHashTableIter  iter;
+    gpointer        value;
+    int             rc;
+
+    g_hash_table_iter_init(&iter, level);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        struct dir_delta *delta = value;
+        GSList *l;
+
+        for (l = g_hash_table_lookup(parents, delta->pk); l != NULL;
+             l = l->next)
+        {
+            rc = delta_add(next, l->data, delta->type, delta->d);
+            if (rc)
+                return rc;
+        }
+    }
+    return DB_SUCCESS;
+}
+
+static gboolean is_null_delta(gpointer key, gpointer value, gpointer udata)
+{
+    struct dir_delta *delta = value;
+    int i;
+
+    for (i = 0; i < NB_VALS; i++)
+        if (delta->d[i] != 0)
+            return FALSE;
+    return TRUE;
+}
+
+static int merge_deltas(GHashTable *totals, GHashTable *level)
+{
+    GHashTableIter  iter;
+    gpointer        value;
+    int             rc;
+
+    g_hash_table_iter_init(&iter, level);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        struct dir_delta *delta = value;
+
+        rc = delta_add(totals, delta->pk, delta->type, delta->d);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
+static int flush_rows(lmgr_t *p_mgr, GString *req, unsigned int *nb_rows)
+{
+    int i, rc;
+
+    if (*nb_rows == 0)
+        return DB_SUCCESS;
+
+    g_string_append(req, " ON DUPLICATE KEY UPDATE ");
+    for (i = 0; i < NB_VALS; i++)
+        g_string_append_printf(req, "%s%s=%s+VALUES(%s)", i == 0 ? "" : ",",
+                               val_names[i], val_names[i], val_names[i]);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    *nb_rows = 0;
+    return rc;
+}
+
+/** write the aggregated deltas to DIR_AGG */
+static int write_totals(lmgr_t *p_mgr, GHashTable *totals)
+{
+    GList       *keys, *l;
+    GString     *ins, *empty;
+    unsigned int nb_rows = 0;
+    int          i, rc = DB_SUCCESS;
+
+    /* all connections update keys in the same order (avoid deadlocks) */
+    keys = g_list_sort(g_hash_table_get_keys(totals), (GCompareFunc)strcmp);
+
+    ins = g_string_new(NULL);
+    empty = g_string_new(NULL);
+
+    for (l = keys; l != NULL; l = l->next)
+    {
+        struct dir_delta *delta = g_hash_table_lookup(totals, l->data);
+        bool null = true;
+
+        for (i = 0; i < NB_VALS; i++)
+            if (delta->d[i] != 0)
+                null = false;
+        if (null)
+            continue;
+
+        if (nb_rows == 0)
+        {
+            g_string_assign(ins, "INSERT INTO "DIRAGG_TABLE"(id,type");
+            for (i = 0; i < NB_VALS; i++)
+                g_string_append_printf(ins, ",%s", val_names[i]);
+            g_string_append(ins, ") VALUES ");
+        }
+        g_string_append_printf(ins, "%s(%s", nb_rows == 0 ? "" : ",",
+                               delta->key);
+        for (i = 0; i < NB_VALS; i++)
+            g_string_append_printf(ins, ",%lld", delta->d[i]);
+        g_string_append_c(ins, ')');
+
+        /* rows that may become empty */
+        if (delta->d[0] < 0)
+            g_string_append_printf(empty, "%s"DPK, empty->len == 0 ? "" : ",",
+                                   delta->pk);
+
+        if (++nb_rows >= FLUSH_ROWS)
+        {
+            rc = flush_rows(p_mgr, ins, &nb_rows);
+            if (rc)
+                goto out;
+        }
+    }
+    rc = flush_rows(p_mgr, ins, &nb_rows);
+    if (rc || empty->len == 0)
+        goto out;
+
+    /* no longer any entry of this type in the subtree */
+    g_string_prepend(empty, "DELETE FROM "DIRAGG_TABLE" WHERE "
+                     ACCT_FIELD_COUNT"<=0 AND id IN (");
+    g_string_append_c(empty, ')');
+    rc = db_exec_sql(&p_mgr->conn, empty->str, NULL);
+
+out:
+    g_list_free(keys);
+    g_string_free(ins, TRUE);
+    g_string_free(empty, TRUE);
+    return rc;
+}
+
+int listmgr_diragg_flush(lmgr_t *p_mgr)
+{
+    GHashTable *totals, *level, *next, *parents;
+    int         depth, rc = DB_SUCCESS;
+
+    if (p_mgr->dir_deltas == NULL
+        || g_hash_table_size(p_mgr->dir_deltas) == 0)
+        return DB_SUCCESS;
+
+    /* the deltas of the transaction are the first level
+     * (e.g. entries updated without changing their aggregates are null) */
+    level = p_mgr->dir_deltas;
+    p_mgr->dir_deltas = NULL;
+    g_hash_table_foreach_remove(level, is_null_delta, NULL);
+
+    totals = delta_hash_new();
+    rc = merge_deltas(totals, level);
+
+    for (depth = 0; rc == DB_SUCCESS && g_hash_table_size(level) > 0;
+         depth++)
+    {
+        if (depth >= MAX_DEPTH)
+        {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Directory aggregates: max "
+                       "depth %d reached (loop in the namespace?)", MAX_DEPTH);
+            break;
+        }
+
+        parents = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        parent_list_free);
+        next = delta_hash_new();
+
+        rc = get_parents(p_mgr, level, parents);
+        if (rc == DB_SUCCESS)
+            rc = propagate(level, parents, next);
+        if (rc == DB_SUCCESS)
+            rc = merge_deltas(totals, next);
+
+        g_hash_table_destroy(parents);
+        g_hash_table_destroy(level);
+        level = next;
+    }
+    g_hash_table_destroy(level);
+
+    if (rc == DB_SUCCESS)
+        rc = write_totals(p_mgr, totals);
+
+    g_hash_table_destroy(totals);
+    return rc;
+}
+
+void listmgr_diragg_discard(lmgr_t *p_mgr)
+{
+    if (p_mgr->dir_deltas != NULL)
+        g_hash_table_remove_all(p_mgr->dir_deltas);
+}
+
+void listmgr_diragg_close(lmgr_t *p_mgr)
+{
+    if (p_mgr->dir_deltas != NULL)
+    {
+        g_hash_table_destroy(p_mgr->dir_deltas);
+        p_mgr->dir_deltas = NULL;
+    }
+}
+
+int listmgr_diragg_rebuild(db_conn_t *pconn)
+{
+    GString        *req;
+    result_handle_t result;
+    int             depth, rc;
+    bool            more = true;
+
+    if (!lmgr_config.dir_agg)
+        return DB_SUCCESS;
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Computing directory aggregates "
+               "from existing DB contents. This can take a while...");
+    FlushLogs();
+
+    req = g_string_new(NULL);
+
+    rc = db_exec_sql(pconn, "DELETE FROM "DIRAGG_TABLE, NULL);
+    if (rc)
+        goto free_str;
+
+    /* (entry, ancestor) pairs, built one level at a time */
+    rc = db_exec_sql(pconn, "DROP TABLE IF EXISTS "DIRAGG_ANC_TABLE, NULL);
+    if (rc)
+        goto free_str;
+    rc = db_exec_sql(pconn, "CREATE TABLE "DIRAGG_ANC_TABLE" (id "PK_TYPE
+                     ", anc "PK_TYPE", depth INT, INDEX(depth))", NULL);
+    if (rc)
+        goto free_str;
+    rc = db_exec_sql(pconn, "INSERT INTO "DIRAGG_ANC_TABLE" SELECT id,"
+                     "parent_id,0 FROM "DNAMES_TABLE" WHERE parent_id<>id",
+                     NULL);
+    if (rc)
+        goto drop_anc;
+
+    for (depth = 0; more && depth < MAX_DEPTH; depth++)
+    {
+        g_string_printf(req, "INSERT INTO "DIRAGG_ANC_TABLE" SELECT a.id,"
+                        "n.parent_id,%d FROM "DIRAGG_ANC_TABLE" a JOIN "
+                        DNAMES_TABLE" n ON a.anc=n.id WHERE a.depth=%d"
+                        " AND n.parent_id<>n.id", depth + 1, depth);
+        rc = db_exec_sql(pconn, req->str, NULL);
+        if (rc)
+            goto drop_anc;
+
+        g_string_printf(req, "SELECT 1 FROM "DIRAGG_ANC_TABLE" WHERE depth=%d"
+                        " LIMIT 1", depth + 1);
+        rc = db_exec_sql(pconn, req->str, &result);
+        if (rc)
+            goto drop_anc;
+        more = (db_result_nb_records(pconn, &result) > 0);
+        db_result_free(pconn, &result);
+    }
+
+    g_string_printf(req, "INSERT INTO "DIRAGG_TABLE"(id,type,%s,size,blocks)"
+                    " SELECT a.anc,e.type,COUNT(*),SUM(e.size),SUM(e.blocks)"
+                    " FROM "DIRAGG_ANC_TABLE" a JOIN "MAIN_TABLE" e"
+                    " ON a.id=e.id GROUP BY a.anc,e.type", ACCT_FIELD_COUNT);
+    rc = db_exec_sql(pconn, req->str, NULL);
+
+drop_anc:
+    if (rc)
+    {
+        char err_buf[1024];
+
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to compute directory "
+                   "aggregates: Error: %s",
+                   db_errmsg(pconn, err_buf, sizeof(err_buf)));
+    }
+    db_exec_sql(pconn, "DROP TABLE IF EXISTS "DIRAGG_ANC_TABLE, NULL);
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_GetDirAgg(lmgr_t *p_mgr, const entry_id_t *p_id,
+                      dir_agg_t *agg_tab, unsigned int *p_count)
+{
+    GString        *req;
+    result_handle_t result;
+    char           *res[1 + NB_VALS];
+    unsigned int    n = 0;
+    int             rc;
+    DEF_PK(pk);
+
+    if (!lmgr_config.dir_agg)
+        return DB_NOT_SUPPORTED;
+
+    entry_id2pk(p_id, PTR_PK(pk));
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT type,%s,size,blocks FROM "DIRAGG_TABLE
+                    " WHERE id="DPK, ACCT_FIELD_COUNT, pk);
+
+retry:
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    while (n < *p_count
+           && (rc = db_next_record(&p_mgr->conn, &result, res, 1 + NB_VALS))
+                == DB_SUCCESS)
+    {
+        if (res[0] == NULL)
+            continue;
+
+        rh_strncpy(agg_tab[n].type, res[0], sizeof(agg_tab[n].type));
+        agg_tab[n].count = res[1] ? strtoull(res[1], NULL, 10) : 0;
+        agg_tab[n].size = res[2] ? strtoull(res[2], NULL, 10) : 0;
+        agg_tab[n].blocks = res[3] ? strtoull(res[3], NULL, 10) : 0;
+        n++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc == DB_END_OF_LIST)
+        rc = DB_SUCCESS;
+    *p_count = n;
+
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
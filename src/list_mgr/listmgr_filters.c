@@ -310,55 +310,6 @@ int lmgr_simple_filter_free( lmgr_filter_t * p_filter )
     return 0;
 }
 
-/* is it a simple 'AND' expression ? */
-static bool is_simple_expr(bool_node_t *boolexpr, int depth, bool_op_t op_ctx)
-{
-    switch (boolexpr->node_type)
-    {
-        case NODE_UNARY_EXPR:
-            if (boolexpr->content_u.bool_expr.bool_op != BOOL_NOT)
-            {
-                /* Error */
-                DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid unary operator %d in %s()",
-                            boolexpr->content_u.bool_expr.bool_op, __FUNCTION__);
-                return false;
-            }
-            /* only accept 'NOT condition', but reject 'NOT (cond AND cond)' */
-            return  (boolexpr->content_u.bool_expr.expr1->node_type == NODE_CONDITION);
-
-        case NODE_BINARY_EXPR:
-            if (depth > 1)
-                return false;
-            else if (boolexpr->content_u.bool_expr.bool_op != BOOL_AND
-                && boolexpr->content_u.bool_expr.bool_op != BOOL_OR)
-                return false;
-
-            /* bool operation context unchanged? */
-            if (boolexpr->content_u.bool_expr.bool_op == op_ctx)
-                return (is_simple_expr(boolexpr->content_u.bool_expr.expr1, depth, op_ctx)
-                        && is_simple_expr(boolexpr->content_u.bool_expr.expr2, depth, op_ctx));
-            else
-                return (is_simple_expr(boolexpr->content_u.bool_expr.expr1, depth + 1,
-                            boolexpr->content_u.bool_expr.bool_op)
-                        && is_simple_expr(boolexpr->content_u.bool_expr.expr2, depth + 1,
-                            boolexpr->content_u.bool_expr.bool_op));
-
-        case NODE_CONDITION:
-            /* If attribute is in DB, it can be filtered
-             * If attribute is not in DB, we ignore it and get all entries (~ AND true)
-             */
-            return true;
-
-        case NODE_CONSTANT:
-            return true;
-
-        default:
-            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid boolean expression in %s()",
-                       __FUNCTION__);
-            return false;
-    }
-}
-
 static bool allow_null(unsigned int attr_index, const filter_comparator_t *comp,
                        const filter_value_t *val)
 {
@@ -392,115 +343,360 @@ static bool allow_null(unsigned int attr_index, const filter_comparator_t *comp,
     return true; /* allow, by default */
 }
 
-/* Extract simple pieces of expressions and append them to filter.
- * The resulting filter is expected to return a larger set than the actual condition.
- * Ignore conflicting criteria.
- * \param expr_flag indicate if BEGIN/END parenthesing is needed
- * \param depth indicate the current parenthesing depth
- * \param op_ctx indicate the current operation context: e.g. AND for 'x and y and z'
+/* comparator of NOT (x <comp> val), to decide about NULL values */
+static filter_comparator_t negate_comparator(filter_comparator_t comp)
+{
+    switch (comp)
+    {
+        case EQUAL:    return NOTEQUAL;
+        case NOTEQUAL: return EQUAL;
+        case LIKE:     return UNLIKE;
+        case UNLIKE:   return LIKE;
+        case ILIKE:    return IUNLIKE;
+        case IUNLIKE:  return ILIKE;
+        default:       return comp;
+    }
+}
+
+/*
+ * Boolean expressions are converted to a conjunctive normal form (an AND of
+ * OR-clauses) which maps to the BEGIN/OR/END flags of simple filters.
+ * The resulting filter is expected to return a larger set than the actual
+ * condition (entries are matched again by the caller): conditions that can't
+ * be exactly expressed in SQL are considered as TRUE, which drops the whole
+ * clause they belong to. Likewise, clauses over the limits below are dropped.
  */
-static int append_simple_expr(bool_node_t *boolexpr, lmgr_filter_t *filter,
-                              const sm_instance_t *smi,
-                              const time_modifier_t *time_mod, int expr_flag,
-                              int depth, bool_op_t op_ctx)
+#define CNF_MAX_CLAUSES  32
+#define CNF_MAX_LITERALS 8
+
+struct cnf_literal {
+    const compare_triplet_t *cond;
+    bool                     negate;
+    /* can only be filtered as a single condition, not in an OR clause */
+    bool                     single;
+};
+
+struct cnf_clause {
+    unsigned int       count;
+    struct cnf_literal lits[CNF_MAX_LITERALS];
+};
+
+struct cnf_expr {
+    bool               is_false; /* the expression is always false */
+    unsigned int       count;    /* 0 clause and !is_false => always true */
+    struct cnf_clause *clauses;
+};
+
+static void cnf_free(struct cnf_expr *cnf)
+{
+    if (cnf->clauses != NULL)
+        MemFree(cnf->clauses);
+    cnf->clauses = NULL;
+    cnf->count = 0;
+}
+
+static int cnf_alloc(struct cnf_expr *cnf)
+{
+    cnf->is_false = false;
+    cnf->count = 0;
+    cnf->clauses = MemCalloc(CNF_MAX_CLAUSES, sizeof(struct cnf_clause));
+    return (cnf->clauses == NULL) ? DB_NO_MEMORY : DB_SUCCESS;
+}
+
+/* does a LIKE pattern exactly match the same strings as the policy glob? */
+static bool like_is_exact(const compare_triplet_t *cond, const char *pattern)
+{
+    const char *c;
+
+    for (c = pattern; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+            /* no SQL equivalent for brackets and escapes,
+             * and '%', '_' are wildcards in SQL */
+            case '[':
+            case '\\':
+            case '%':
+            case '_':
+                return false;
+
+            case '*':
+                /* 'tree' conditions end with a '*' matching any level */
+                if (cond->crit == CRITERIA_TREE && c[1] == '\0')
+                    break;
+                /* fall through */
+            case '?':
+                /* '/' is matched by SQL wildcards, not by path globs */
+                if (cond->crit == CRITERIA_TREE || cond->crit == CRITERIA_PATH)
+                    return false;
+                break;
+        }
+    }
+    return true;
+}
+
+/* can the condition be filtered in DB, with the given polarity? */
+static bool literal_supported(const compare_triplet_t *cond, bool negate,
+                              bool *single, const sm_instance_t *smi,
+                              const time_modifier_t *time_mod)
 {
-    int                 rc, new_depth;
     unsigned int        index = ATTR_INDEX_FLG_UNSPEC;
-    int                 flag = 0;
     filter_comparator_t comp;
     filter_value_t      val;
     bool                must_free;
+    bool                ok = true;
     attr_mask_t         tmp;
 
+    if (criteria2filter(cond, &index, &comp, &val, &must_free, smi, time_mod)
+        || (index & ATTR_INDEX_FLG_UNSPEC))
+        return false;
+
+    /* test readonly fields */
+    tmp = null_mask;
+    attr_mask_set_index(&tmp, index);
+    if (readonly_fields(tmp))
+        ok = false;
+    else if (comp == LIKE || comp == ILIKE || comp == UNLIKE || comp == IUNLIKE)
+    {
+        bool neg = (negate != (comp == UNLIKE || comp == IUNLIKE));
+
+        /* a positive pattern can be larger than the glob (e.g. '[ab]' -> '_')
+         * but not a negative one */
+        if (val.value.val_str == NULL)
+            ok = false;
+        else if (neg)
+            ok = like_is_exact(cond, val.value.val_str);
+        else
+            ok = (strchr(val.value.val_str, '\\') == NULL);
+    }
+
+    /* these are not part of the main WHERE clause of requests */
+    *single = is_dirattr(index) || is_gen_field(index);
+
+    if (must_free)
+        MemFree((char *)val.value.val_str);
+    return ok;
+}
+
+/* AND of 2 expressions: concatenate clauses */
+static void cnf_and(struct cnf_expr *a, struct cnf_expr *b)
+{
+    unsigned int i;
+
+    if (b->is_false)
+        a->is_false = true;
+    if (a->is_false)
+    {
+        a->count = 0;
+        return;
+    }
+
+    for (i = 0; i < b->count && a->count < CNF_MAX_CLAUSES; i++)
+        a->clauses[a->count++] = b->clauses[i];
+}
+
+/* OR of 2 expressions: distribute clauses of b over clauses of a */
+static int cnf_or(struct cnf_expr *a, struct cnf_expr *b)
+{
+    struct cnf_expr res;
+    unsigned int i, j, k;
+    int rc;
+
+    if (a->is_false)
+    {
+        struct cnf_expr tmp = *a;
+
+        *a = *b;
+        *b = tmp;
+        return DB_SUCCESS;
+    }
+    if (b->is_false)
+        return DB_SUCCESS;
+
+    /* x OR TRUE = TRUE */
+    if (a->count == 0 || b->count == 0)
+    {
+        a->count = 0;
+        return DB_SUCCESS;
+    }
+
+    rc = cnf_alloc(&res);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < a->count; i++)
+    {
+        for (j = 0; j < b->count && res.count < CNF_MAX_CLAUSES; j++)
+        {
+            const struct cnf_clause *ca = &a->clauses[i];
+            const struct cnf_clause *cb = &b->clauses[j];
+            struct cnf_clause *c = &res.clauses[res.count];
+            bool drop = false;
+
+            /* too large clause: drop it (AND TRUE) */
+            if (ca->count + cb->count > CNF_MAX_LITERALS)
+                continue;
+
+            c->count = 0;
+            for (k = 0; k < ca->count; k++)
+                c->lits[c->count++] = ca->lits[k];
+            for (k = 0; k < cb->count; k++)
+                c->lits[c->count++] = cb->lits[k];
+
+            for (k = 0; k < c->count; k++)
+                if (c->lits[k].single)
+                    drop = true;
+
+            if (!drop)
+                res.count++;
+        }
+    }
+
+    cnf_free(a);
+    *a = res;
+    return DB_SUCCESS;
+}
+
+/* convert an expression (or its negation) to a CNF */
+static int boolexpr2cnf(bool_node_t *boolexpr, bool negate,
+                        struct cnf_expr *cnf, const sm_instance_t *smi,
+                        const time_modifier_t *time_mod)
+{
+    struct cnf_expr cnf2;
+    bool_op_t op;
+    bool single;
+    int rc;
+
+    rc = cnf_alloc(cnf);
+    if (rc)
+        return rc;
+
     switch (boolexpr->node_type)
     {
+        case NODE_CONSTANT:
+            cnf->is_false = (!boolexpr->content_u.constant != negate);
+            return DB_SUCCESS;
+
+        case NODE_CONDITION:
+            /* If attribute is in DB, it can be filtered
+             * If attribute is not in DB, we ignore it and get all entries
+             * (~ TRUE)
+             */
+            if (literal_supported(boolexpr->content_u.condition, negate,
+                                  &single, smi, time_mod))
+            {
+                cnf->clauses[0].count = 1;
+                cnf->clauses[0].lits[0].cond = boolexpr->content_u.condition;
+                cnf->clauses[0].lits[0].negate = negate;
+                cnf->clauses[0].lits[0].single = single;
+                cnf->count = 1;
+            }
+            return DB_SUCCESS;
+
         case NODE_UNARY_EXPR:
             if (boolexpr->content_u.bool_expr.bool_op != BOOL_NOT)
             {
                 DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid unary operator %d in %s()",
                             boolexpr->content_u.bool_expr.bool_op, __FUNCTION__);
-                return DB_INVALID_ARG;
+                rc = DB_INVALID_ARG;
+                break;
             }
+            cnf_free(cnf);
+            return boolexpr2cnf(boolexpr->content_u.bool_expr.expr1, !negate,
+                                cnf, smi, time_mod);
 
-            return append_simple_expr(boolexpr->content_u.bool_expr.expr1,
-                               filter, smi, time_mod,
-                               expr_flag | FILTER_FLAG_NOT_BEGIN
-                               | FILTER_FLAG_NOT_END, depth + 1, op_ctx);
-#if 0
-            /* XXX is it possible to append a binary expr with parenthesing? e.g. NOT (x AND y) */
-            if (boolexpr->content_u.bool_expr.expr1->node_type == NODE_BINARY_EXPR)
+        case NODE_BINARY_EXPR:
+            op = boolexpr->content_u.bool_expr.bool_op;
+            if (op != BOOL_AND && op != BOOL_OR)
             {
-                append_simple_expr(boolexpr->content_u.bool_expr.expr1,
-                                   filter, smi, time_mod,
-                                   flag | FILTER_FLAG_NOT_BEGIN
-                                        | FILTER_FLAG_NOT_END,
-                                   depth + 1, BOOL_AND);
-                /* in case of error, do nothing (equivalent to 'AND TRUE') */
-                return 0;
+                DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid binary operator %d in %s()",
+                            op, __FUNCTION__);
+                rc = DB_INVALID_ARG;
+                break;
             }
-            else if (boolexpr->content_u.bool_expr.expr1->node_type != NODE_CONDITION)
-                /* do nothing (equivalent to 'AND TRUE') */
-                return 0;
-
-            /* get info about condition */
-            rc = criteria2filter(boolexpr->content_u.bool_expr.expr1->content_u.condition,
-                                 &index, &comp, &val, &must_free, smi, time_mod);
+            /* NOT (x AND y) = NOT x OR NOT y, and conversely */
+            if (negate)
+                op = (op == BOOL_AND) ? BOOL_OR : BOOL_AND;
 
-            if (rc != 0 || (index & ATTR_INDEX_FLG_UNSPEC))
-                /* do nothing (equivalent to 'AND TRUE') */
-                return 0;
-
-            flag = FILTER_FLAG_NOT;
+            cnf_free(cnf);
+            rc = boolexpr2cnf(boolexpr->content_u.bool_expr.expr1, negate,
+                              cnf, smi, time_mod);
+            if (rc)
+                return rc;
+            rc = boolexpr2cnf(boolexpr->content_u.bool_expr.expr2, negate,
+                              &cnf2, smi, time_mod);
+            if (rc)
+                break;
 
-            if ((expr_flag & FILTER_FLAG_ALLOW_NULL) || allow_null(index, &comp, &val))
-                flag |= FILTER_FLAG_ALLOW_NULL;
-            if (must_free)
-                flag |= FILTER_FLAG_ALLOC_STR;
+            if (op == BOOL_AND)
+                cnf_and(cnf, &cnf2);
+            else
+                rc = cnf_or(cnf, &cnf2);
+            cnf_free(&cnf2);
+            break;
 
-            /* propagate parenthesing flag + OR (NOT?) */
-            flag |= (expr_flag & (FILTER_FLAG_BEGIN | FILTER_FLAG_END
-                                  | FILTER_FLAG_OR));
+        default:
+            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid boolean expression %#x in %s()",
+                        boolexpr->node_type, __FUNCTION__);
+            rc = DB_INVALID_ARG;
+    }
 
-            /* @TODO support FILTER_FLAG_ALLOC_LIST */
+    if (rc)
+        cnf_free(cnf);
+    return rc;
+}
 
-            /* add condition to filter */
-            DisplayLog(LVL_FULL, LISTMGR_TAG, "Appending filter on \"%s\", flags=%#X",
-                       field_name(index), flag);
+/* append the clauses of a CNF to a filter */
+static int append_cnf(const struct cnf_expr *cnf, lmgr_filter_t *filter,
+                      const sm_instance_t *smi,
+                      const time_modifier_t *time_mod, int expr_flag)
+{
+    unsigned int i, j;
+    int rc;
 
-            return lmgr_simple_filter_add(filter, index, comp, val, flag);
-#endif
+    for (i = 0; i < cnf->count; i++)
+    {
+        const struct cnf_clause *clause = &cnf->clauses[i];
 
-         case NODE_CONDITION:
-            /* If attribute is in DB, it can be filtered
-             * If attribute is not in DB, we ignore it and get all entries (~ AND TRUE)
-             */
-            /* get info about condition */
-            rc = criteria2filter(boolexpr->content_u.condition,
-                                 &index, &comp, &val, &must_free,
+        for (j = 0; j < clause->count; j++)
+        {
+            const struct cnf_literal *lit = &clause->lits[j];
+            unsigned int        index = ATTR_INDEX_FLG_UNSPEC;
+            filter_comparator_t comp, null_comp;
+            filter_value_t      val;
+            bool                must_free;
+            int                 flag = 0;
+
+            rc = criteria2filter(lit->cond, &index, &comp, &val, &must_free,
                                  smi, time_mod);
-
             if (rc != 0 || (index & ATTR_INDEX_FLG_UNSPEC))
-                /* do nothing (equivalent to 'AND TRUE') */
-                return 0;
+                /* checked by literal_supported() */
+                return DB_INVALID_ARG;
 
-            /* test readonly fields */
-            tmp = null_mask;
-            attr_mask_set_index(&tmp, index);
-            if (readonly_fields(tmp))
-                /* do nothing (equivalent to 'AND TRUE') */
-                return 0;
+            null_comp = comp;
+            if (lit->negate)
+            {
+                flag |= FILTER_FLAG_NOT;
+                null_comp = negate_comparator(comp);
+            }
 
             if ((expr_flag & FILTER_FLAG_ALLOW_NULL)
-                || allow_null(index, &comp, &val))
+                || allow_null(index, &null_comp, &val))
                 flag |= FILTER_FLAG_ALLOW_NULL;
 
             if (must_free)
                 flag |= FILTER_FLAG_ALLOC_STR;
 
-            /* propagate parenthesing flag + OR (NOT?) */
-            flag |= (expr_flag & (FILTER_FLAG_BEGIN | FILTER_FLAG_END
-                                  | FILTER_FLAG_NOT_BEGIN | FILTER_FLAG_OR
-                                  | FILTER_FLAG_NOT_END));
+            /* (x OR y OR z) */
+            if (clause->count > 1)
+            {
+                if (j == 0)
+                    flag |= FILTER_FLAG_BEGIN;
+                else
+                    flag |= FILTER_FLAG_OR;
+                if (j == clause->count - 1)
+                    flag |= FILTER_FLAG_END;
+            }
 
             /* @TODO support FILTER_FLAG_ALLOC_LIST */
 
@@ -508,106 +704,47 @@ static int append_simple_expr(bool_node_t *boolexpr, lmgr_filter_t *filter,
             DisplayLog(LVL_FULL, LISTMGR_TAG, "Appending filter on \"%s\", flags=%#X",
                        field_name(index), flag);
 
-            return lmgr_simple_filter_add(filter, index, comp, val, flag);
-
-        case NODE_BINARY_EXPR:
-        {
-            int flag1, flag2;
-
-            /* ensures there are no 2 levels of parenthesing */
-            if (depth > 1)
-                return DB_INVALID_ARG;
-            else if (boolexpr->content_u.bool_expr.bool_op != BOOL_AND
-                && boolexpr->content_u.bool_expr.bool_op != BOOL_OR)
-                return DB_INVALID_ARG;
-
-            flag1 = (op_ctx == BOOL_OR)?FILTER_FLAG_OR:0;
-            /* x OR y? */
-            flag2 = (boolexpr->content_u.bool_expr.bool_op == BOOL_OR)?
-                        FILTER_FLAG_OR:0;
-            if (boolexpr->content_u.bool_expr.bool_op == op_ctx)
-            {
-                new_depth = depth;
-                /* propagate BEGIN/END flags */
-                flag1 |= expr_flag & (FILTER_FLAG_BEGIN
-                                      | FILTER_FLAG_NOT_BEGIN);
-                flag2 |= expr_flag & (FILTER_FLAG_END
-                                      | FILTER_FLAG_NOT_END);
-            }
-            else
-            {
-                new_depth = depth + 1;
-                /* new level of parenthesing */
-                /* propagate NOT_BEGIN/NOT_END flags */
-                flag1 |= FILTER_FLAG_BEGIN | (expr_flag & FILTER_FLAG_NOT_BEGIN);
-                flag2 |= FILTER_FLAG_END | (expr_flag & FILTER_FLAG_NOT_END);
-            }
-
-            rc = append_simple_expr(boolexpr->content_u.bool_expr.expr1,
-                                    filter, smi, time_mod, flag1, new_depth,
-                                    boolexpr->content_u.bool_expr.bool_op);
-            if (rc) return rc;
-            rc = append_simple_expr(boolexpr->content_u.bool_expr.expr2,
-                                    filter, smi, time_mod, flag2, new_depth,
-                                    boolexpr->content_u.bool_expr.bool_op);
-            return rc;
+            rc = lmgr_simple_filter_add(filter, index, comp, val, flag);
+            if (rc)
+                return rc;
         }
-
-        case NODE_CONSTANT:
-            if (boolexpr->content_u.constant)
-            {
-                return 0; /* 'and true' */
-            }
-            else
-            {
-                /* no sense, abort the query */
-                DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Building DB request which is always false?!");
-                return DB_INVALID_ARG;
-            }
-
-        default:
-            DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid boolean expression %#x in %s()",
-                        boolexpr->node_type, __FUNCTION__);
-            return DB_INVALID_ARG;
     }
+    return DB_SUCCESS;
 }
 
-/** Convert simple expressions to ListMgr filter (append filter) */
+/** Convert boolean expressions to ListMgr filter (append filter) */
 int convert_boolexpr_to_simple_filter(bool_node_t *boolexpr, lmgr_filter_t *filter,
                                       const sm_instance_t *smi,
                                       const time_modifier_t *time_mod,
                                       enum filter_flags flags)
 {
-    if (!is_simple_expr(boolexpr, 0, BOOL_AND))
-        return DB_INVALID_ARG;
+    struct cnf_expr cnf;
+    unsigned int prev_nb;
+    int rc;
 
-    /* create a boolexpr as 'NOT ( <expr> )' */
-    if (flags & FILTER_FLAG_NOT)
-    {
-        bool_node_t notexpr;
-        int prev_nb, rc;
-
-        notexpr.node_type = NODE_UNARY_EXPR;
-        notexpr.content_u.bool_expr.bool_op = BOOL_NOT;
-        notexpr.content_u.bool_expr.expr1 = boolexpr;
-        notexpr.content_u.bool_expr.owner = 0;
-
-        /* add all or nothing => save filter count before */
-        prev_nb = filter->filter_simple.filter_count;
-
-        /* default filter context is AND */
-        rc = append_simple_expr(&notexpr, filter, smi, time_mod,
-                                flags & ~FILTER_FLAG_NOT, 0, BOOL_AND);
-        if (rc)
-            filter->filter_simple.filter_count = prev_nb;
+    /* FILTER_FLAG_NOT means 'NOT ( <expr> )' */
+    rc = boolexpr2cnf(boolexpr, flags & FILTER_FLAG_NOT, &cnf, smi, time_mod);
+    if (rc)
         return rc;
+
+    if (cnf.is_false)
+    {
+        /* no sense, abort the query */
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Building DB request which is always false?!");
+        cnf_free(&cnf);
+        return DB_INVALID_ARG;
     }
 
-    /* default filter context is AND */
-    return append_simple_expr(boolexpr, filter, smi, time_mod, flags,
-                              0, BOOL_AND);
-}
+    /* add all or nothing => save filter count before */
+    prev_nb = filter->filter_simple.filter_count;
 
+    rc = append_cnf(&cnf, filter, smi, time_mod, flags & FILTER_FLAG_ALLOW_NULL);
+    if (rc)
+        filter->filter_simple.filter_count = prev_nb;
+
+    cnf_free(&cnf);
+    return rc;
+}
 
 /** Set a complex filter structure */
 int lmgr_set_filter_expression( lmgr_filter_t * p_filter, struct bool_node_t *boolexpr )
@@ -26,47 +26,63 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "Memory.h"
 
 
+/**
+ * Check if an entry exists in the main table.
+ * @return 1 if it exists, 0 if not, a DB error code on error.
+ */
+static int exists_by_pk(lmgr_t *p_mgr, PK_ARG_T pk)
+{
+    db_stmt_t      *stmt;
+    db_param_t      param;
+    char           *str_id = NULL;
+    int             rc;
+
+    stmt = lmgr_stmt_lookup(p_mgr, STMT_EXISTS, &null_mask);
+    if (stmt == NULL)
+    {
+        rc = lmgr_stmt_prepare(p_mgr, STMT_EXISTS, &null_mask,
+                               "SELECT id FROM " MAIN_TABLE " WHERE id=?",
+                               &stmt);
+        if (rc)
+            return rc;
+    }
+
+    param.type = PK_DB_TYPE;
+    param.value.val_str = pk;
+    rc = lmgr_stmt_exec(p_mgr, stmt, &param, 1);
+    if (rc)
+        return rc;
+
+    rc = db_stmt_fetch(&p_mgr->conn, stmt, &str_id, 1);
+    if (rc == DB_SUCCESS)
+        rc = 1;
+    else if (rc == DB_END_OF_LIST)
+        rc = 0;
+
+    db_stmt_free_result(&p_mgr->conn, stmt);
+    return rc;
+}
+
 int ListMgr_Exists(lmgr_t *p_mgr, const entry_id_t *p_id)
 {
-    GString        *req;
     int             rc;
-    result_handle_t result;
-    char           *str_count = NULL;
     DEF_PK(pk);
 
     /* retrieve primary key */
     entry_id2pk(p_id, PTR_PK(pk));
 
-    /* verify it exists in main table */
-    req = g_string_new("SELECT id FROM " MAIN_TABLE " WHERE id=");
-    g_string_append_printf(req, DPK, pk);
-
 retry:
-    /* execute the request (must return negative value on error) */
-    rc = -db_exec_sql(&p_mgr->conn, req->str, &result);
-    if (lmgr_delayed_retry(p_mgr, -rc))
+    rc = exists_by_pk(p_mgr, pk);
+    if (rc == 0 || rc == 1)
+        return rc;
+    if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
-    else if (rc)
-        goto free_str;
 
-    rc = db_next_record(&p_mgr->conn, &result, &str_count, 1);
-    if (rc == 0)
-        rc = 1; /* return 1 if entry exists */
-    else if (rc != DB_END_OF_LIST)
-    {
-        if (lmgr_delayed_retry(p_mgr, -rc))
-            goto retry;
-    }
-    else
-        rc = 0;
-
-    db_result_free(&p_mgr->conn, &result);
-
-free_str:
-    g_string_free(req, TRUE);
-    return rc;
+    /* must return negative value on error */
+    return -rc;
 }
 
 /** retrieve directory attributes (nbr of entries, avg size of entries)*/
@@ -206,63 +222,102 @@ static void clean_std_table_bits(attr_mask_t *p_mask)
 }
 
 /**
- *  Retrieve entry attributes from its primary key
+ * Retrieve attributes that are not in main, annex and names tables
+ * (stripe info and directory attributes).
+ * @param[in,out] checkmain set to false if the entry was found
+ *                          in stripe tables.
  */
-int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
+static int get_stripe_and_dirattrs(lmgr_t *p_mgr, PK_ARG_T pk,
+                                   attr_set_t *p_info, bool *checkmain)
 {
-    int             rc;
-    char           *first_table = NULL;
-    GString        *req, *from;
-    /* attribute count is up to 1 per bit (8 per byte).
-     * x2 for bullet proofing */
-    char           *result_tab[2*8*sizeof(p_info->attr_mask)];
-    result_handle_t result;
-    bool            checkmain   = true;
-    int             main_count  = 0,
-                    annex_count = 0,
-                    name_count  = 0;
-    attr_mask_t     gen = gen_fields(p_info->attr_mask);
+#ifdef _LUSTRE
+    int rc;
+#endif
 
-    if (p_info == NULL)
-        return 0;
+    /* remove stripe info if it is not a file */
+    if (stripe_fields(p_info->attr_mask) && ATTR_MASK_TEST(p_info, type)
+        && strcmp(ATTR(p_info, type), STR_TYPE_FILE) != 0)
+    {
+        p_info->attr_mask = attr_mask_and_not(&p_info->attr_mask, &stripe_attr_set);
+    }
 
-    /* init entry info */
-    memset(&p_info->attr_values, 0, sizeof(entry_info_t));
-    req = g_string_new("SELECT ");
-    from = g_string_new(" FROM ");
+    /* get stripe info if asked */
+#ifdef _LUSTRE
+    if (stripe_fields(p_info->attr_mask))
+    {
+        rc = get_stripe_info(p_mgr, pk, &ATTR(p_info, stripe_info),
+                             ATTR_MASK_TEST(p_info, stripe_items)?
+                                &ATTR(p_info, stripe_items) : NULL);
+        if (rc == DB_ATTR_MISSING || rc == DB_NOT_EXISTS)
+        {
+            /* stripe info is in std mask */
+            p_info->attr_mask.std &= ~ATTR_MASK_stripe_info;
 
-    /* retrieve source info for generated fields (only about std fields)*/
-    add_source_fields_for_gen(&p_info->attr_mask.std);
+            if (ATTR_MASK_TEST(p_info, stripe_items))
+                p_info->attr_mask.std &= ~ATTR_MASK_stripe_items;
+        }
+        else if (rc)
+            return rc;
+        else
+            *checkmain = false; /* entry exists */
+    }
+#else
+    /* POSIX: always clean stripe bits */
+    p_info->attr_mask = attr_mask_and_not(&p_info->attr_mask, &stripe_attr_set);
+#endif
 
-    /* don't get fields that are not in main, names, annex, stripe...
-     * This allows the caller to set all bits 'on' to get everything.
-     * Note: this also clear generated fields. They will be restored after.
-     */
-    supported_bits_only(&p_info->attr_mask);
+    /* special field dircount */
+    if (dirattr_fields(p_info->attr_mask))
+    {
+        if (listmgr_get_dirattrs(p_mgr, pk, p_info))
+        {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "listmgr_get_dirattrs failed for "DPK, pk);
+            p_info->attr_mask = attr_mask_and_not(&p_info->attr_mask, &dir_attr_set);
+        }
+    }
+    return DB_SUCCESS;
+}
 
-    /* get info from main table (if asked) */
-    main_count = attrmask2fieldlist(req, p_info->attr_mask, T_MAIN, "", "", 0);
-    if (main_count < 0)
+/** number of fields of an attribute mask in the given table */
+static int table_field_count(attr_mask_t attr_mask, table_enum table)
+{
+    int i, cookie;
+    int nbfields = 0;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
     {
-        rc = -main_count;
-        goto free_str;
+        if (attr_mask_test_index(&attr_mask, i) && match_table(table, i))
+            nbfields++;
     }
-    else if (main_count > 0)
+    return nbfields;
+}
+
+/** build the request to get main, annex and names attributes of an entry */
+static int build_get_request(GString *req, attr_mask_t attr_mask,
+                             int main_count, int annex_count, int name_count)
+{
+    const char *first_table = NULL;
+    GString    *from = g_string_new(" FROM ");
+    int         rc;
+
+    g_string_assign(req, "SELECT ");
+
+    if (main_count > 0)
     {
-        checkmain = false;
+        rc = attrmask2fieldlist(req, attr_mask, T_MAIN, "", "", 0);
+        if (rc < 0)
+            goto out;
         first_table = MAIN_TABLE;
         g_string_append(from, MAIN_TABLE);
     }
 
-    annex_count = attrmask2fieldlist(req, p_info->attr_mask, T_ANNEX, "", "",
-                                     first_table != NULL ? AOF_LEADING_SEP : 0);
-    if (annex_count < 0)
-    {
-        rc = -annex_count;
-        goto free_str;
-    }
-    else if (annex_count > 0)
+    if (annex_count > 0)
     {
+        rc = attrmask2fieldlist(req, attr_mask, T_ANNEX, "", "",
+                                first_table != NULL ? AOF_LEADING_SEP : 0);
+        if (rc < 0)
+            goto out;
         if (first_table != NULL)
             g_string_append_printf(from, " LEFT JOIN "ANNEX_TABLE" ON %s.id="
                                    ANNEX_TABLE".id", first_table);
@@ -273,15 +328,12 @@ int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
         }
     }
 
-    name_count = attrmask2fieldlist(req, p_info->attr_mask, T_DNAMES, "", "",
-                                    first_table != NULL ? AOF_LEADING_SEP : 0);
-    if (name_count < 0)
-    {
-        rc = -name_count;
-        goto free_str;
-    }
-    else if (name_count > 0)
+    if (name_count > 0)
     {
+        rc = attrmask2fieldlist(req, attr_mask, T_DNAMES, "", "",
+                                first_table != NULL ? AOF_LEADING_SEP : 0);
+        if (rc < 0)
+            goto out;
         if (first_table)
             /* it's OK to JOIN with NAMES table here even if there are multiple paths,
              * as we only take one result record. The important thing is to return
@@ -295,19 +347,125 @@ int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
         }
     }
 
-    if (first_table != NULL)
+    g_string_append_printf(req, "%s WHERE %s.id=?", from->str, first_table);
+    rc = 0;
+out:
+    g_string_free(from, TRUE);
+    return rc < 0 ? -rc : 0;
+}
+
+/**
+ *  Retrieve entry attributes from its primary key
+ */
+/** prepare a STMT_GET statement, with integer results in binary form */
+/** types of the result columns of get requests (main, annex, names)
+ * @return the column count, or a negative error code */
+static int get_result_types(attr_mask_t mask, db_type_e *types,
+                            unsigned int size)
+{
+    const table_enum tables[] = {T_MAIN, T_ANNEX, T_DNAMES};
+    unsigned int count = 0, t;
+    int rc;
+
+    for (t = 0; t < sizeof(tables)/sizeof(tables[0]); t++)
+    {
+        rc = attrmask2types(mask, tables[t], types + count, size - count);
+        if (rc < 0)
+            return rc;
+        count += rc;
+    }
+    return count;
+}
+
+static int prepare_get_stmt(lmgr_t *p_mgr, attr_mask_t *p_mask,
+                            const char *query, db_stmt_t **p_stmt)
+{
+    db_type_e types[2*8*sizeof(*p_mask)];
+    int count;
+
+    count = get_result_types(*p_mask, types, sizeof(types)/sizeof(types[0]));
+    if (count < 0)
+        return -count;
+    return lmgr_stmt_prepare_typed(p_mgr, STMT_GET, p_mask, query, types,
+                                   count, p_stmt);
+}
+
+int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
+{
+    int             rc;
+    /* attribute count is up to 1 per bit (8 per byte).
+     * x2 for bullet proofing */
+    db_type_u       values[2*8*sizeof(p_info->attr_mask)];
+    bool            nulls[2*8*sizeof(p_info->attr_mask)];
+    db_stmt_t      *stmt;
+    db_param_t      param;
+    bool            checkmain   = true;
+    int             main_count  = 0,
+                    annex_count = 0,
+                    name_count  = 0;
+    attr_mask_t     gen = gen_fields(p_info->attr_mask);
+    bool            resolve_path = false;
+
+    if (p_info == NULL)
+        return 0;
+
+    /* init entry info */
+    memset(&p_info->attr_values, 0, sizeof(entry_info_t));
+
+    /* retrieve source info for generated fields (only about std fields)*/
+    add_source_fields_for_gen(&p_info->attr_mask.std);
+
+    /* don't get fields that are not in main, names, annex, stripe...
+     * This allows the caller to set all bits 'on' to get everything.
+     * Note: this also clear generated fields. They will be restored after.
+     */
+    supported_bits_only(&p_info->attr_mask);
+
+    /* resolve fullpath from parent_id and name, with the path cache */
+    if (listmgr_path_enabled()
+        && attr_mask_test_index(&p_info->attr_mask, ATTR_INDEX_fullpath))
+    {
+        resolve_path = true;
+        attr_mask_unset_index(&p_info->attr_mask, ATTR_INDEX_fullpath);
+        attr_mask_set_index(&p_info->attr_mask, ATTR_INDEX_parent_id);
+        attr_mask_set_index(&p_info->attr_mask, ATTR_INDEX_name);
+    }
+
+    /* get info from main, annex and names tables (if asked) */
+    main_count = table_field_count(p_info->attr_mask, T_MAIN);
+    annex_count = table_field_count(p_info->attr_mask, T_ANNEX);
+    name_count = table_field_count(p_info->attr_mask, T_DNAMES);
+    if (main_count > 0)
+        checkmain = false;
+
+    if (main_count + annex_count + name_count > 0)
     {
         int shift = 0;
 
-        g_string_append_printf(req, "%s WHERE %s.id="DPK, from->str,
-                               first_table, pk);
+        /* the request only depends on the attribute mask */
+        stmt = lmgr_stmt_lookup(p_mgr, STMT_GET, &p_info->attr_mask);
+        if (stmt == NULL)
+        {
+            GString *req = g_string_new(NULL);
+
+            rc = build_get_request(req, p_info->attr_mask, main_count,
+                                   annex_count, name_count);
+            if (rc == 0)
+                rc = prepare_get_stmt(p_mgr, &p_info->attr_mask, req->str,
+                                      &stmt);
+            g_string_free(req, TRUE);
+            if (rc)
+                return rc;
+        }
 
-        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+        param.type = PK_DB_TYPE;
+        param.value.val_str = pk;
+        rc = lmgr_stmt_exec(p_mgr, stmt, &param, 1);
         if (rc)
-            goto free_str;
+            return rc;
 
-        rc = db_next_record(&p_mgr->conn, &result, result_tab,
-                            main_count + annex_count + name_count);
+        rc = db_stmt_fetch_values(&p_mgr->conn, stmt, values, nulls,
+                                  main_count + annex_count + name_count);
         /* END_OF_LIST means it does not exist */
         if (rc == DB_END_OF_LIST)
         {
@@ -325,91 +483,52 @@ int listmgr_get_by_pk( lmgr_t * p_mgr, PK_ARG_T pk, attr_set_t * p_info )
         /* set info from result */
         if (main_count)
         {
-            rc = result2attrset(T_MAIN, result_tab + shift, main_count, p_info);
+            rc = values2attrset(T_MAIN, values + shift, nulls + shift,
+                                main_count, p_info);
             shift += main_count;
             if (rc)
                 goto free_res;
         }
         if (annex_count)
         {
-            rc = result2attrset(T_ANNEX, result_tab + shift, annex_count,
-                                p_info);
+            rc = values2attrset(T_ANNEX, values + shift, nulls + shift,
+                                annex_count, p_info);
             shift += annex_count;
             if (rc)
                 goto free_res;
         }
         if (name_count)
         {
-            rc = result2attrset(T_DNAMES, result_tab + shift, name_count,
-                                p_info);
+            rc = values2attrset(T_DNAMES, values + shift, nulls + shift,
+                                name_count, p_info);
             shift += name_count;
             if (rc)
                 goto free_res;
         }
 
 next_table:
-        db_result_free(&p_mgr->conn, &result);
+        db_stmt_free_result(&p_mgr->conn, stmt);
     }
 
-    /* remove stripe info if it is not a file */
-    if (stripe_fields(p_info->attr_mask) && ATTR_MASK_TEST(p_info, type)
-        && strcmp(ATTR(p_info, type), STR_TYPE_FILE) != 0)
+    if (resolve_path)
     {
-        p_info->attr_mask = attr_mask_and_not(&p_info->attr_mask, &stripe_attr_set);
-    }
-
-    /* get stripe info if asked */
-#ifdef _LUSTRE
-    if (stripe_fields(p_info->attr_mask))
-    {
-        rc = get_stripe_info(p_mgr, pk, &ATTR(p_info, stripe_info),
-                             ATTR_MASK_TEST(p_info, stripe_items)?
-                                &ATTR(p_info, stripe_items) : NULL);
-        if (rc == DB_ATTR_MISSING || rc == DB_NOT_EXISTS)
-        {
-            /* stripe info is in std mask */
-            p_info->attr_mask.std &= ~ATTR_MASK_stripe_info;
-
-            if (ATTR_MASK_TEST(p_info, stripe_items))
-                p_info->attr_mask.std &= ~ATTR_MASK_stripe_items;
-        }
-        else if (rc)
-            goto free_str;
-        else
-            checkmain = false; /* entry exists */
+        rc = listmgr_path_resolve(p_mgr, p_info);
+        if (rc)
+            return rc;
     }
-#else
-    /* POSIX: always clean stripe bits */
-    p_info->attr_mask = attr_mask_and_not(&p_info->attr_mask, &stripe_attr_set);
-#endif
 
-    /* special field dircount */
-    if (dirattr_fields(p_info->attr_mask))
-    {
-        if (listmgr_get_dirattrs(p_mgr, pk, p_info))
-        {
-            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "listmgr_get_dirattrs failed for "DPK, pk);
-            p_info->attr_mask = attr_mask_and_not(&p_info->attr_mask, &dir_attr_set);
-        }
-    }
+    rc = get_stripe_and_dirattrs(p_mgr, pk, p_info, &checkmain);
+    if (rc)
+        return rc;
 
     if (checkmain)
     {
         /* verify it exists in main table */
-        g_string_printf(req, "SELECT id FROM " MAIN_TABLE " WHERE id="DPK, pk);
-
-        /* execute the request */
-        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
-        if (rc)
-            goto free_str;
-
-        rc = db_next_record(&p_mgr->conn, &result, result_tab, 1);
-        db_result_free(&p_mgr->conn, &result);
-        if (rc)
-        {
-            rc = DB_NOT_EXISTS;
-            goto free_str;
-        }
+        rc = exists_by_pk(p_mgr, pk);
+        if (rc == 0)
+            return DB_NOT_EXISTS;
+        else if (rc != 1)
+            return rc;
     }
 
     /* restore generated fields in attr mask */
@@ -420,33 +539,254 @@ next_table:
     /* update operation stats */
     p_mgr->nbop[OPIDX_GET]++;
 
-    rc = DB_SUCCESS;
-    goto free_str;
+    return DB_SUCCESS;
 
   free_res:
-    db_result_free(&p_mgr->conn, &result);
-  free_str:
-    g_string_free(req, TRUE);
-    g_string_free(from, TRUE);
+    db_stmt_free_result(&p_mgr->conn, stmt);
     return rc;
 } /* listmgr_get_by_pk */
 
 
 
-int ListMgr_Get( lmgr_t * p_mgr, const entry_id_t * p_id, attr_set_t * p_info )
+int _ListMgr_Get(lmgr_t *p_mgr, const entry_id_t *p_id, attr_set_t *p_info,
+                 const char *caller)
 {
     int rc;
+    attr_mask_t req = null_mask, gen;
+    unsigned long long counter = 0;
     DEF_PK(pk);
 
+    if (p_info != NULL)
+    {
+        /* same mask as the one actually asked to the DB */
+        req = p_info->attr_mask;
+        gen = gen_fields(req);
+        add_source_fields_for_gen(&req.std);
+        supported_bits_only(&req);
+
+        if (listmgr_cache_get(p_id, &req, p_info, &counter, caller))
+        {
+            p_info->attr_mask = attr_mask_or(&p_info->attr_mask, &gen);
+            generate_fields(p_info);
+            return DB_SUCCESS;
+        }
+    }
+
     entry_id2pk(p_id, PTR_PK(pk));
 retry:
     rc = listmgr_get_by_pk(p_mgr, pk, p_info);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
+
+    if (rc == DB_SUCCESS && p_info != NULL)
+        listmgr_cache_put(p_id, &req, p_info, counter);
     return rc;
 }
 
 
+/** build and run the request for ListMgr_BatchGet() */
+static int listmgr_batch_get(lmgr_t *p_mgr, unsigned int count,
+                             const entry_id_t **p_ids, attr_set_t **p_infos,
+                             int *rcs)
+{
+    int             rc, i;
+    GString        *req;
+    GHashTable     *pk_idx;
+    pktype         *pks;
+    attr_mask_t    *asked, *gens;
+    attr_mask_t     all = null_mask;
+    int             main_count, annex_count, name_count;
+    /* attribute count is up to 1 per bit (8 per byte).
+     * x2 for bullet proofing, +1 for id */
+    db_type_u       values[2*8*sizeof(attr_mask_t) + 1];
+    bool            nulls[2*8*sizeof(attr_mask_t) + 1];
+    db_type_e       types[2*8*sizeof(attr_mask_t) + 1];
+    int             type_count;
+    db_stmt_t      *stmt;
+
+    pks = MemCalloc(count, sizeof(*pks));
+    asked = MemCalloc(count, sizeof(*asked));
+    gens = MemCalloc(count, sizeof(*gens));
+    if (pks == NULL || asked == NULL || gens == NULL)
+    {
+        rc = DB_NO_MEMORY;
+        goto free_arrays;
+    }
+    pk_idx = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (i = 0; i < count; i++)
+    {
+        attr_mask_t mask = p_infos[i]->attr_mask;
+
+        entry_id2pk(p_ids[i], PTR_PK(pks[i]));
+        gens[i] = gen_fields(mask);
+        /* in case the same id is asked twice, the first wins */
+        if (g_hash_table_lookup(pk_idx, pks[i]) == NULL)
+            g_hash_table_insert(pk_idx, pks[i], GINT_TO_POINTER(i + 1));
+
+        add_source_fields_for_gen(&mask.std);
+        supported_bits_only(&mask);
+        asked[i] = mask;
+        all = attr_mask_or(&all, &mask);
+
+        rcs[i] = DB_NOT_EXISTS;
+    }
+
+    /* always use MAIN as the first table, as it determines
+     * if the entry exists */
+    req = g_string_new("SELECT "MAIN_TABLE".id");
+    main_count = attrmask2fieldlist(req, all, T_MAIN, "", "", AOF_LEADING_SEP);
+    annex_count = attrmask2fieldlist(req, all, T_ANNEX, "", "",
+                                     AOF_LEADING_SEP);
+    name_count = attrmask2fieldlist(req, all, T_DNAMES, "", "",
+                                    AOF_LEADING_SEP);
+    if (main_count < 0 || annex_count < 0 || name_count < 0)
+    {
+        rc = -MIN3(main_count, annex_count, name_count);
+        goto free_str;
+    }
+    g_string_append(req, " FROM "MAIN_TABLE);
+    if (annex_count > 0)
+        g_string_append(req, " LEFT JOIN "ANNEX_TABLE" ON "MAIN_TABLE".id="
+                        ANNEX_TABLE".id");
+    if (name_count > 0)
+        g_string_append(req, " LEFT JOIN "DNAMES_TABLE" ON "MAIN_TABLE".id="
+                        DNAMES_TABLE".id");
+    g_string_append(req, " WHERE "MAIN_TABLE".id IN (");
+    for (i = 0; i < count; i++)
+        g_string_append_printf(req, "%s"DPK, i == 0 ? "" : ",", pks[i]);
+    g_string_append(req, ")");
+
+    /* integer attributes are fetched in binary form */
+    types[0] = DB_TEXT;
+    type_count = get_result_types(all, types + 1,
+                                  sizeof(types)/sizeof(types[0]) - 1);
+    if (type_count < 0)
+    {
+        rc = -type_count;
+        goto free_str;
+    }
+    type_count++;
+
+    rc = lmgr_query_typed(p_mgr, req->str, types, type_count, &stmt);
+    if (rc)
+        goto free_str;
+
+    while ((rc = db_stmt_fetch_values(&p_mgr->conn, stmt, values, nulls,
+                                      type_count)) == DB_SUCCESS)
+    {
+        int shift = 1;
+        attr_set_t *p_info;
+
+        if (nulls[0])
+            continue;
+        i = GPOINTER_TO_INT(g_hash_table_lookup(pk_idx, values[0].val_str))
+            - 1;
+        /* unexpected id, or several records for the same id (hardlinks) */
+        if (i < 0 || rcs[i] == DB_SUCCESS)
+            continue;
+
+        p_info = p_infos[i];
+        memset(&p_info->attr_values, 0, sizeof(entry_info_t));
+        /* parse all the fields of the request, then only keep asked ones */
+        p_info->attr_mask = all;
+
+        if (main_count)
+        {
+            rc = values2attrset(T_MAIN, values + shift, nulls + shift,
+                                main_count, p_info);
+            shift += main_count;
+            if (rc)
+                goto free_res;
+        }
+        if (annex_count)
+        {
+            rc = values2attrset(T_ANNEX, values + shift, nulls + shift,
+                                annex_count, p_info);
+            shift += annex_count;
+            if (rc)
+                goto free_res;
+        }
+        if (name_count)
+        {
+            rc = values2attrset(T_DNAMES, values + shift, nulls + shift,
+                                name_count, p_info);
+            if (rc)
+                goto free_res;
+        }
+        /* only keep asked attributes */
+        p_info->attr_mask = attr_mask_and(&p_info->attr_mask, &asked[i]);
+        rcs[i] = DB_SUCCESS;
+    }
+    if (rc != DB_END_OF_LIST)
+        goto free_res;
+    db_stmt_close(&p_mgr->conn, stmt);
+
+    /* attributes from other tables, and generated fields */
+    for (i = 0; i < count; i++)
+    {
+        attr_set_t *p_info = p_infos[i];
+        bool unused = true;
+
+        if (rcs[i] != DB_SUCCESS)
+        {
+            ATTR_MASK_INIT(p_info);
+            continue;
+        }
+
+        rc = get_stripe_and_dirattrs(p_mgr, pks[i], p_info, &unused);
+        if (rc)
+            goto free_str;
+
+        p_info->attr_mask = attr_mask_or(&p_info->attr_mask, &gens[i]);
+        generate_fields(p_info);
+
+        p_mgr->nbop[OPIDX_GET]++;
+    }
+    rc = DB_SUCCESS;
+    goto free_str;
+
+free_res:
+    db_stmt_close(&p_mgr->conn, stmt);
+free_str:
+    g_string_free(req, TRUE);
+    g_hash_table_destroy(pk_idx);
+free_arrays:
+    MemFree(gens);
+    MemFree(asked);
+    MemFree(pks);
+    return rc;
+}
+
+int ListMgr_BatchGet(lmgr_t *p_mgr, unsigned int count,
+                     const entry_id_t **p_ids, attr_set_t **p_infos,
+                     int *rcs)
+{
+    int rc, i;
+    attr_mask_t *masks;
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    /* save asked masks in case of retry */
+    masks = MemCalloc(count, sizeof(*masks));
+    if (masks == NULL)
+        return DB_NO_MEMORY;
+    for (i = 0; i < count; i++)
+        masks[i] = p_infos[i]->attr_mask;
+
+retry:
+    rc = listmgr_batch_get(p_mgr, count, p_ids, p_infos, rcs);
+    if (lmgr_delayed_retry(p_mgr, rc))
+    {
+        for (i = 0; i < count; i++)
+            p_infos[i]->attr_mask = masks[i];
+        goto retry;
+    }
+    MemFree(masks);
+    return rc;
+}
+
 /* Retrieve the FID from the database given the parent FID and the file name. */
 int ListMgr_Get_FID_from_Path( lmgr_t * p_mgr, const entry_id_t * parent_fid,
                                const char *name, entry_id_t * fid)
@@ -23,6 +23,9 @@
 #include "rbh_logs.h"
 #include "rbh_misc.h"
 #include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
 #include <pwd.h>
 #include <grp.h>
 
@@ -33,6 +36,11 @@ static enum lmgr_init_flags init_flags;
 #define alter_db    (!!(init_flags & LIF_ALTER_DB))
 #define alter_no_display (!!(init_flags & LIF_ALTER_NODISP))
 
+/* NAMES has a reversed name index */
+static bool name_index_ready = false;
+/* ENTRIES has an indexed diff generation */
+static bool diff_gen_ready = false;
+
 #define MAX_DB_FIELDS 64
 
 /** append SQL type of a status field */
@@ -498,6 +506,153 @@ static int check_field_type(int attr_index, const char* val)
     return rc;
 }
 
+/**
+ * Get the stored value of a user or group for the target uid_gid_as_numbers
+ * mode: the numeric id of a name (or the default if it can't be resolved),
+ * the name of a numeric id (or the number if it can't be resolved).
+ */
+static void uidgid_convert_value(int attr_index, const char *in, char *out,
+                                 size_t out_sz)
+{
+    char  buff[4096];
+    char *endptr;
+    long  id;
+
+    errno = 0;
+    id = strtol(in, &endptr, 10);
+
+    if (global_config.uid_gid_as_numbers) {
+        if (attr_index == ATTR_INDEX_uid) {
+            struct passwd pw;
+            struct passwd *p_pw;
+
+            if (getpwnam_r(in, &pw, buff, sizeof(buff), &p_pw) == 0
+                && p_pw != NULL)
+                id = pw.pw_uid;
+            else
+                id = default_uid.val_int;
+        } else {
+            struct group gr;
+            struct group *p_gr;
+
+            if (getgrnam_r(in, &gr, buff, sizeof(buff), &p_gr) == 0
+                && p_gr != NULL)
+                id = gr.gr_gid;
+            else
+                id = default_gid.val_int;
+        }
+        snprintf(out, out_sz, "%ld", id);
+        return;
+    }
+
+    rh_strncpy(out, in, out_sz);
+    if (errno != 0 || endptr == in || *endptr != '\0')
+        return;
+
+    if (attr_index == ATTR_INDEX_uid) {
+        struct passwd pw;
+        struct passwd *p_pw;
+
+        if (getpwuid_r(id, &pw, buff, sizeof(buff), &p_pw) == 0
+            && p_pw != NULL)
+            rh_strncpy(out, pw.pw_name, out_sz);
+    } else {
+        struct group gr;
+        struct group *p_gr;
+
+        if (getgrgid_r(id, &gr, buff, sizeof(buff), &p_gr) == 0
+            && p_gr != NULL)
+            rh_strncpy(out, gr.gr_name, out_sz);
+    }
+}
+
+/**
+ * Rewrite the values of a user or group field for the target mode,
+ * while the column is textual (before switching it to INT, or after
+ * switching it from INT). Values are converted one distinct name (or id)
+ * at a time, so the table is not locked for the whole conversion, and
+ * the table is listed again until no value remains to be converted
+ * (e.g. inserted meanwhile).
+ */
+static int uidgid_convert_values(db_conn_t *pconn, const char *t_name,
+                                 int attr_index)
+{
+    const char     *f_name = field_name(attr_index);
+    GString        *query = g_string_new(NULL);
+    GString        *req = g_string_new(NULL);
+    GPtrArray      *values = g_ptr_array_new();
+    result_handle_t result;
+    char           *res;
+    char            conv[RBH_LOGIN_MAX];
+    char            esc_in[2 * RBH_LOGIN_MAX];
+    char            esc_out[2 * RBH_LOGIN_MAX];
+    unsigned long long total = 0;
+    unsigned int    i;
+    int             rc;
+
+    /* numeric values are already converted (to numbers),
+     * or must be resolved (to names) */
+    g_string_printf(query, "SELECT DISTINCT %s FROM %s WHERE %s %sREGEXP "
+                    "'^-?[0-9]+$'", f_name, t_name, f_name,
+                    global_config.uid_gid_as_numbers ? "NOT " : "");
+
+    for (;;) {
+        rc = db_exec_sql(pconn, query->str, &result);
+        if (rc)
+            goto out;
+
+        while (db_next_record(pconn, &result, &res, 1) == DB_SUCCESS) {
+            if (res != NULL)
+                g_ptr_array_add(values, g_strdup(res));
+        }
+        db_result_free(pconn, &result);
+
+        if (values->len == 0)
+            break;
+
+        for (i = 0; i < values->len; i++) {
+            const char *in = g_ptr_array_index(values, i);
+
+            uidgid_convert_value(attr_index, in, conv, sizeof(conv));
+            /* unknown id: kept as a number */
+            if (!strcmp(conv, in))
+                continue;
+
+            db_escape_string(pconn, esc_in, sizeof(esc_in), in);
+            db_escape_string(pconn, esc_out, sizeof(esc_out), conv);
+            g_string_printf(req, "UPDATE %s SET %s='%s' WHERE %s='%s'",
+                            t_name, f_name, esc_out, f_name, esc_in);
+            rc = db_exec_sql(pconn, req->str, NULL);
+            if (rc)
+                goto out;
+            total++;
+        }
+
+        for (i = 0; i < values->len; i++)
+            g_free(g_ptr_array_index(values, i));
+        g_ptr_array_set_size(values, 0);
+
+        /* names are all converted to numbers, so the table can be listed
+         * again for names inserted meanwhile. Unknown ids remain numbers:
+         * a single pass is done in the reverse direction. */
+        if (!global_config.uid_gid_as_numbers)
+            break;
+    }
+
+    DisplayLog(LVL_EVENT, LISTMGR_TAG, "%s.%s: %llu distinct values "
+               "converted to %s", t_name, f_name, total,
+               global_config.uid_gid_as_numbers ? "numeric ids" : "names");
+    rc = DB_SUCCESS;
+
+out:
+    for (i = 0; i < values->len; i++)
+        g_free(g_ptr_array_index(values, i));
+    g_ptr_array_free(values, TRUE);
+    g_string_free(req, TRUE);
+    g_string_free(query, TRUE);
+    return rc;
+}
+
 /** change field type and set its default */
 static int change_field_type(db_conn_t *pconn, table_enum table, int attr_index)
 {
@@ -521,6 +676,14 @@ static int change_field_type(db_conn_t *pconn, table_enum table, int attr_index)
     DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Converting type of '%s.%s'...",
                table2name(table), field_name(attr_index));
 
+    /* names must be converted to ids before the column becomes numeric */
+    if (field_type(attr_index) == DB_UIDGID
+        && global_config.uid_gid_as_numbers) {
+        rc = uidgid_convert_values(pconn, t_name, attr_index);
+        if (rc)
+            goto free_str;
+    }
+
     g_string_printf(query, "ALTER TABLE %s MODIFY COLUMN %s ",
                     t_name, f_name);
 
@@ -541,6 +704,18 @@ static int change_field_type(db_conn_t *pconn, table_enum table, int attr_index)
     }
 
     rc = db_exec_sql(pconn, query->str, NULL);
+    if (rc)
+        goto free_str;
+
+    /* ids are resolved to names once the column is textual */
+    if (field_type(attr_index) == DB_UIDGID
+        && !global_config.uid_gid_as_numbers) {
+        rc = uidgid_convert_values(pconn, t_name, attr_index);
+        if (rc)
+            goto free_str;
+    }
+
+free_str:
     g_string_free(query, TRUE);
     if (rc)
     {
@@ -1375,6 +1550,76 @@ static int run_create_index(db_conn_t *pconn, const char *table_name,
     return DB_SUCCESS;
 }
 
+/* attributes of MAIN_TABLE the entries are listed by (policy runs) */
+#define MAX_SORT_INDEXES 16
+static unsigned int sort_attrs[MAX_SORT_INDEXES];
+static unsigned int sort_attr_count = 0;
+
+void ListMgr_AddSortIndex(unsigned int attr_index)
+{
+    int i;
+
+    if (!is_main_field(attr_index) || is_funcattr(attr_index))
+        return;
+
+    for (i = 0; i < sort_attr_count; i++)
+        if (sort_attrs[i] == attr_index)
+            return;
+
+    if (sort_attr_count >= MAX_SORT_INDEXES)
+    {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Too many sort attributes: "
+                   "no index on (%s,id)", field_name(attr_index));
+        return;
+    }
+    sort_attrs[sort_attr_count++] = attr_index;
+}
+
+/** create the (sort attr, id) index for keyset pagination */
+static int create_sort_index(db_conn_t *pconn, unsigned int attr_index)
+{
+    char request[1024];
+
+    snprintf(request, sizeof(request), "CREATE INDEX %s_id_index ON "
+             MAIN_TABLE "(%s,id)", field_name(attr_index),
+             field_name(attr_index));
+    return run_create_index(pconn, MAIN_TABLE, field_name(attr_index),
+                            request);
+}
+
+/** check (sort attr, id) indexes of MAIN_TABLE */
+static int check_sort_indexes(db_conn_t *pconn)
+{
+    char name[256];
+    int  i, rc;
+
+    for (i = 0; i < sort_attr_count; i++)
+    {
+        snprintf(name, sizeof(name), "%s_id_index", field_name(sort_attrs[i]));
+
+        rc = db_check_component(pconn, DBOBJ_INDEX, name, MAIN_TABLE);
+        if (rc != DB_NOT_EXISTS)
+            return rc;
+
+        /* index creation may take a while on a large table */
+        if (!alter_db)
+        {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Index on "MAIN_TABLE"(%s,id) "
+                       "is missing: sorted listing of entries may be slow."
+                       " => Run 'robinhood --alter-db' to create it.",
+                       field_name(sort_attrs[i]));
+            continue;
+        }
+
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Creating index on "
+                   MAIN_TABLE"(%s,id)", field_name(sort_attrs[i]));
+        rc = create_sort_index(pconn, sort_attrs[i]);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
 static void append_engine(GString *request)
 {
 #ifdef _MYSQL
@@ -1386,6 +1631,100 @@ static void append_engine(GString *request)
 #endif
 }
 
+#ifdef _MYSQL
+/**
+ * Partition a table of entries by ranges of ids. Ids start with the FID
+ * sequence (or the device id), so entries created in the same period are
+ * in the same partition. The server prunes the partitions that cannot
+ * match a condition on id.
+ */
+static void append_id_partitions(GString *request)
+{
+    char *bounds, *bound, *next = NULL;
+    int   i = 0;
+
+    if (EMPTY_STRING(lmgr_config.db_config.id_partitions))
+        return;
+
+    g_string_append(request, " PARTITION BY RANGE COLUMNS(id) (");
+
+    bounds = g_strdup(lmgr_config.db_config.id_partitions);
+    for (bound = strtok_r(bounds, ", ", &next); bound != NULL;
+         bound = strtok_r(NULL, ", ", &next), i++)
+        g_string_append_printf(request, "PARTITION p%d VALUES LESS THAN "
+                               "('%s'),", i, bound);
+    g_free(bounds);
+
+    g_string_append(request, "PARTITION pmax VALUES LESS THAN (MAXVALUE))");
+}
+
+/* number of rm_time partitions of SOFT_RM, after its creation */
+#define SOFTRM_PARTITIONS 24
+
+/**
+ * Partition SOFT_RM by ranges of rm_time, so that removal of old entries
+ * (undelete, hsm_remove) only reads a few partitions. Entries removed after
+ * the last range go to a MAXVALUE partition, which can be split later with
+ * ALTER TABLE ... REORGANIZE PARTITION.
+ */
+static void append_softrm_partitions(GString *request)
+{
+    time_t step = lmgr_config.db_config.softrm_partition_time;
+    time_t bound;
+    int    i;
+
+    if (step == 0)
+        return;
+
+    bound = (time(NULL) / step + 1) * step;
+
+    g_string_append(request, " PARTITION BY RANGE(rm_time) (");
+    for (i = 0; i < SOFTRM_PARTITIONS; i++, bound += step)
+        g_string_append_printf(request, "PARTITION p%lu VALUES LESS THAN "
+                               "(%lu),", (unsigned long)bound,
+                               (unsigned long)bound);
+    g_string_append(request, "PARTITION pmax VALUES LESS THAN (MAXVALUE))");
+}
+#endif
+
+/**
+ * Engine of the tables of entries. When they are sharded, they are Spider
+ * tables partitioned by a hash of their key, each partition being stored
+ * in the table of the same name on a shard server.
+ */
+static void append_engine_sharded(GString *request, const char *table,
+                                  const char *key)
+{
+#ifdef _MYSQL
+    char *shards, *srv, *next = NULL;
+    int   i = 0;
+
+    if (EMPTY_STRING(lmgr_config.db_config.shards))
+    {
+        append_engine(request);
+        /* range partitions only apply to tables indexed by entry id */
+        if (!strcmp(key, "id"))
+            append_id_partitions(request);
+        return;
+    }
+
+    g_string_append_printf(request, " ENGINE=SPIDER COMMENT='wrapper "
+                           "\"mysql\", table \"%s\"' PARTITION BY KEY(%s) (",
+                           table, key);
+
+    shards = g_strdup(lmgr_config.db_config.shards);
+    for (srv = strtok_r(shards, ", ", &next); srv != NULL;
+         srv = strtok_r(NULL, ", ", &next), i++)
+        g_string_append_printf(request, "%sPARTITION pt%d COMMENT='srv \"%s\"'",
+                               i == 0 ? "" : ",", i, srv);
+    g_free(shards);
+
+    g_string_append_c(request, ')');
+#else
+    append_engine(request);
+#endif
+}
+
 static int create_table_vars(db_conn_t *pconn, bool *affects_trig)
 {
     int      rc;
@@ -1455,6 +1794,12 @@ static int check_table_main(db_conn_t *pconn, bool *affects_trig)
             }
         }
 
+        /* diff generation (see check_diff_gen()) */
+        if (curr_field_index < MAX_DB_FIELDS
+            && fieldtab[curr_field_index] != NULL
+            && !strcmp(fieldtab[curr_field_index], DIFF_GEN_FIELD))
+            curr_field_index++;
+
         rc = drop_extra_fields(pconn, curr_field_index, T_MAIN, fieldtab);
         if (rc)
             return rc;
@@ -1481,10 +1826,11 @@ static int create_table_main(db_conn_t *pconn, bool *affects_trig)
         if (is_main_field(i) && !is_funcattr(i))
             append_field_def(pconn, i, request, 0);
     }
+    g_string_append(request, ", "DIFF_GEN_DEF);
 
     /* end of field list (null terminated) */
     g_string_append(request, ")");
-    append_engine(request);
+    append_engine_sharded(request, MAIN_TABLE, "id");
 
     rc = run_create_table(pconn, MAIN_TABLE, request->str);
     if (rc)
@@ -1503,6 +1849,20 @@ static int create_table_main(db_conn_t *pconn, bool *affects_trig)
                 goto free_str;
         }
     }
+
+    for (i = 0; i < sort_attr_count; i++)
+    {
+        rc = create_sort_index(pconn, sort_attrs[i]);
+        if (rc)
+            goto free_str;
+    }
+
+    rc = run_create_index(pconn, MAIN_TABLE, DIFF_GEN_FIELD,
+                          "CREATE INDEX "DIFF_GEN_INDEX" ON "MAIN_TABLE
+                          "("DIFF_GEN_FIELD")");
+    if (rc)
+        goto free_str;
+    diff_gen_ready = true;
     rc = DB_SUCCESS;
 
 free_str:
@@ -1510,6 +1870,138 @@ free_str:
     return rc;
 }
 
+bool listmgr_diff_gen_enabled(void)
+{
+    return diff_gen_ready;
+}
+
+/**
+ * Check the diff generation of entries, and add it to an existing
+ * ENTRIES table with --alter-db. Without it, diff tags are tables of
+ * entry ids.
+ */
+static int check_diff_gen(db_conn_t *pconn)
+{
+    char   timestr[256] = "";
+    char   t[128];
+    time_t estimated;
+    int    rc;
+
+    rc = db_check_component(pconn, DBOBJ_INDEX, DIFF_GEN_INDEX, MAIN_TABLE);
+    if (rc == DB_SUCCESS) {
+        diff_gen_ready = true;
+        return DB_SUCCESS;
+    }
+    if (rc != DB_NOT_EXISTS)
+        return rc;
+
+    if (report_only)
+        return DB_SUCCESS;
+
+    /* adding a column may take a while on a large table */
+    if (!alter_db) {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Field "MAIN_TABLE"."
+                   DIFF_GEN_FIELD" is missing: rbh-diff will copy entry ids "
+                   "to a tag table. => Run 'robinhood --alter-db' to add it.");
+        return DB_SUCCESS;
+    }
+
+    estimated = estimated_time(pconn, MAIN_TABLE, 68000);
+    if (estimated > 0)
+        snprintf(timestr, sizeof(timestr), " (estim. duration: ~%s)",
+                 FormatDurationFloat(t, sizeof(t), estimated));
+
+    DisplayLog(LVL_EVENT, LISTMGR_TAG, "Adding field "MAIN_TABLE"."
+               DIFF_GEN_FIELD"%s", timestr);
+
+    rc = db_exec_sql(pconn, "ALTER TABLE "MAIN_TABLE" ADD COLUMN "
+                     DIFF_GEN_DEF", ADD INDEX "DIFF_GEN_INDEX" ("
+                     DIFF_GEN_FIELD")", NULL);
+    if (rc) {
+        char buff[1024];
+
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to add field "
+                   DIFF_GEN_FIELD": Error: %s",
+                   db_errmsg(pconn, buff, sizeof(buff)));
+        return rc;
+    }
+    diff_gen_ready = true;
+    return DB_SUCCESS;
+}
+
+bool listmgr_name_index_enabled(void)
+{
+    return name_index_ready;
+}
+
+/**
+ * Reversed names are a generated column of NAMES, so they are maintained
+ * by the DB engine and not by list_mgr requests.
+ */
+static void append_rname_def(GString *request)
+{
+    g_string_append(request, RNAME_FIELD" ");
+    append_sql_type(request, DB_TEXT, field_size(ATTR_INDEX_name));
+    g_string_append(request, " AS (REVERSE(name)) VIRTUAL");
+}
+
+/**
+ * Check the reversed name index (name_suffix_index), and add it to an
+ * existing NAMES table with --alter-db.
+ */
+static int check_name_index(db_conn_t *pconn)
+{
+    GString *request;
+    char     timestr[256] = "";
+    char     t[128];
+    time_t   estimated;
+    int      rc;
+
+    rc = db_check_component(pconn, DBOBJ_INDEX, RNAME_INDEX, DNAMES_TABLE);
+    if (rc == DB_SUCCESS) {
+        /* also used by tools, whatever their configuration */
+        name_index_ready = true;
+        return DB_SUCCESS;
+    }
+    if (rc != DB_NOT_EXISTS)
+        return rc;
+
+    if (!lmgr_config.name_suffix_index || report_only)
+        return DB_SUCCESS;
+
+    /* index creation may take a while on a large table */
+    if (!alter_db) {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Reversed name index on "
+                   DNAMES_TABLE" is missing: name suffix searches will scan "
+                   "the table. => Run 'robinhood --alter-db' to create it.");
+        return DB_SUCCESS;
+    }
+
+    estimated = estimated_time(pconn, DNAMES_TABLE, 60000);
+    if (estimated > 0)
+        snprintf(timestr, sizeof(timestr), " (estim. duration: ~%s)",
+                 FormatDurationFloat(t, sizeof(t), estimated));
+
+    DisplayLog(LVL_EVENT, LISTMGR_TAG, "Creating reversed name index on "
+               DNAMES_TABLE"%s", timestr);
+
+    request = g_string_new("ALTER TABLE "DNAMES_TABLE" ADD COLUMN ");
+    append_rname_def(request);
+    g_string_append(request, ", ADD INDEX "RNAME_INDEX" ("RNAME_FIELD")");
+
+    rc = db_exec_sql(pconn, request->str, NULL);
+    g_string_free(request, TRUE);
+    if (rc) {
+        char buff[1024];
+
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to create reversed name "
+                   "index: Error: %s", db_errmsg(pconn, buff, sizeof(buff)));
+        return rc;
+    }
+    name_index_ready = true;
+    return DB_SUCCESS;
+}
+
 static int check_table_dnames(db_conn_t *pconn, bool *affects_trig)
 {
     char  strbuf[4096];
@@ -1538,6 +2030,11 @@ static int check_table_dnames(db_conn_t *pconn, bool *affects_trig)
                     return DB_BAD_SCHEMA;
             }
         }
+        /* generated column of reversed names (see check_name_index()) */
+        if (curr_field_index < MAX_DB_FIELDS
+            && fieldtab[curr_field_index] != NULL
+            && !strcmp(fieldtab[curr_field_index], RNAME_FIELD))
+            curr_field_index++;
         /* is there any extra field ? */
         if (has_extra_field(curr_field_index, DNAMES_TABLE, fieldtab, true))
             return DB_BAD_SCHEMA;
@@ -1567,8 +2064,12 @@ static int create_table_dnames(db_conn_t *pconn, bool *affects_trig)
             append_field_def(pconn, i, request, 0);
         }
     }
+    if (lmgr_config.name_suffix_index) {
+        g_string_append(request, ", ");
+        append_rname_def(request);
+    }
     g_string_append(request, ")");
-    append_engine(request);
+    append_engine_sharded(request, DNAMES_TABLE, "pkn");
 
     rc = run_create_table(pconn, DNAMES_TABLE, request->str);
     if (rc)
@@ -1591,6 +2092,14 @@ static int create_table_dnames(db_conn_t *pconn, bool *affects_trig)
     /* this index is needed to build the fullpath of entries */
     rc = run_create_index(pconn, DNAMES_TABLE, "id",
                       "CREATE INDEX id_index ON "DNAMES_TABLE"(id)");
+    if (rc || !lmgr_config.name_suffix_index)
+        goto free_str;
+
+    rc = run_create_index(pconn, DNAMES_TABLE, RNAME_FIELD,
+                          "CREATE INDEX "RNAME_INDEX" ON "DNAMES_TABLE
+                          "("RNAME_FIELD")");
+    if (rc == DB_SUCCESS)
+        name_index_ready = true;
 free_str:
     g_string_free(request, TRUE);
     return rc;
@@ -1660,7 +2169,7 @@ static int create_table_annex(db_conn_t *pconn, bool *affects_trig)
         }
     }
     g_string_append(request, ")");
-    append_engine(request);
+    append_engine_sharded(request, ANNEX_TABLE, "id");
 
     rc = run_create_table(pconn, ANNEX_TABLE, request->str);
     if (rc)
@@ -1735,6 +2244,10 @@ static int check_table_stripe_info(db_conn_t *pconn, bool *affects_trig)
             return DB_BAD_SCHEMA;
         if (check_field_name("pool_name", &curr_field_index, STRIPE_INFO_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
+        if (lmgr_config.compact_stripes
+            && check_field_name("items", &curr_field_index, STRIPE_INFO_TABLE,
+                                fieldtab))
+            return DB_BAD_SCHEMA;
         /* is there any extra field ? */
         if (has_extra_field(curr_field_index, STRIPE_INFO_TABLE, fieldtab, true))
             return DB_BAD_SCHEMA;
@@ -1757,9 +2270,9 @@ static int create_table_stripe_info(db_conn_t *pconn, bool *affects_trig)
     g_string_printf(request, "CREATE TABLE " STRIPE_INFO_TABLE
             " (id "PK_TYPE" PRIMARY KEY, validator INT, "
             "stripe_count INT UNSIGNED, stripe_size INT UNSIGNED, "
-            "pool_name VARBINARY(%u))",
-            MAX_POOL_LEN - 1);
-    append_engine(request);
+            "pool_name VARBINARY(%u)%s)",
+            MAX_POOL_LEN - 1, lmgr_config.compact_stripes ? ", items MEDIUMBLOB" : "");
+    append_engine_sharded(request, STRIPE_INFO_TABLE, "id");
 
     rc = run_create_table(pconn, STRIPE_INFO_TABLE, request->str);
     g_string_free(request, TRUE);
@@ -1782,11 +2295,14 @@ static int check_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
         /* check index */
         if (check_field_name("id", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
-        if (check_field_name("stripe_index", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
+        /* with compact stripes, this is just an index of OSTs */
+        if (!lmgr_config.compact_stripes
+            && check_field_name("stripe_index", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
         if (check_field_name("ostidx", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
-        if (check_field_name("details", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
+        if (!lmgr_config.compact_stripes
+            && check_field_name("details", &curr_field_index, STRIPE_ITEMS_TABLE, fieldtab))
             return DB_BAD_SCHEMA;
 
         /* is there any extra field ? */
@@ -1808,11 +2324,17 @@ static int create_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
     int  rc;
 
     request = g_string_new(NULL);
-    g_string_printf(request, "CREATE TABLE "STRIPE_ITEMS_TABLE
-                    " (id "PK_TYPE", stripe_index INT UNSIGNED, "
-                    "ostidx INT UNSIGNED, details BINARY(%u))",
-                    STRIPE_DETAIL_SZ);
-    append_engine(request);
+    if (lmgr_config.compact_stripes)
+        /* one row per OST of each file, clustered by OST */
+        g_string_printf(request, "CREATE TABLE "STRIPE_ITEMS_TABLE
+                        " (id "PK_TYPE", ostidx INT UNSIGNED, "
+                        "PRIMARY KEY (ostidx, id))");
+    else
+        g_string_printf(request, "CREATE TABLE "STRIPE_ITEMS_TABLE
+                        " (id "PK_TYPE", stripe_index INT UNSIGNED, "
+                        "ostidx INT UNSIGNED, details BINARY(%u))",
+                        STRIPE_DETAIL_SZ);
+    append_engine_sharded(request, STRIPE_ITEMS_TABLE, "id");
 
     rc = run_create_table(pconn, STRIPE_ITEMS_TABLE, request->str);
     g_string_free(request, TRUE);
@@ -1821,7 +2343,7 @@ static int create_table_stripe_items(db_conn_t *pconn, bool *affects_trig)
 
     rc = run_create_index(pconn, STRIPE_ITEMS_TABLE, "id",
                           "CREATE INDEX id_index ON "STRIPE_ITEMS_TABLE"(id)");
-    if (rc)
+    if (rc || lmgr_config.compact_stripes)
         return rc;
 
     rc = run_create_index(pconn, STRIPE_ITEMS_TABLE, "ostidx",
@@ -2105,6 +2627,226 @@ free_str:
     return rc;
 }
 
+static int check_table_diragg(db_conn_t *pconn, bool *affects_trig)
+{
+    char  strbuf[4096];
+    char *fieldtab[MAX_DB_FIELDS];
+    int   rc, curr_index = 0;
+
+    rc = db_list_table_info(pconn, DIRAGG_TABLE, fieldtab, NULL, NULL,
+                            MAX_DB_FIELDS, strbuf, sizeof(strbuf));
+    if (rc == DB_SUCCESS)
+    {
+        /* not maintained: drop it, else it may become inconsistent */
+        if (!lmgr_config.dir_agg)
+        {
+            if (report_only)
+                return DB_SUCCESS;
+
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Directory aggregates are "
+                       "disabled: dropping table "DIRAGG_TABLE);
+            rc = db_drop_component(pconn, DBOBJ_TABLE, DIRAGG_TABLE);
+            if (rc != DB_SUCCESS)
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Failed to drop table: Error: %s",
+                           db_errmsg(pconn, strbuf, sizeof(strbuf)));
+            return rc;
+        }
+
+        if (check_field_name("id", &curr_index, DIRAGG_TABLE, fieldtab)
+            || check_field_name("type", &curr_index, DIRAGG_TABLE, fieldtab)
+            || check_field_name(ACCT_FIELD_COUNT, &curr_index, DIRAGG_TABLE,
+                                fieldtab)
+            || check_field_name("size", &curr_index, DIRAGG_TABLE, fieldtab)
+            || check_field_name("blocks", &curr_index, DIRAGG_TABLE, fieldtab)
+            || has_extra_field(curr_index, DIRAGG_TABLE, fieldtab, true))
+        {
+            if (report_only)
+            {
+                lmgr_config.dir_agg = false;
+                return DB_SUCCESS;
+            }
+            /* the table is computed from the other tables: rebuild it */
+            rc = db_drop_component(pconn, DBOBJ_TABLE, DIRAGG_TABLE);
+            if (rc != DB_SUCCESS)
+            {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Failed to drop table: Error: %s",
+                           db_errmsg(pconn, strbuf, sizeof(strbuf)));
+                return rc;
+            }
+            return DB_NOT_EXISTS;
+        }
+    }
+    else if (rc == DB_NOT_EXISTS)
+    {
+        if (!lmgr_config.dir_agg)
+            return DB_SUCCESS;
+
+        if (report_only)
+        {
+            /* report only: fall back to namespace scans */
+            DisplayLog(LVL_VERB, LISTMGR_TAG, "Directory aggregates not available");
+            lmgr_config.dir_agg = false;
+            return DB_SUCCESS;
+        }
+    }
+    else
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Error checking database schema: %s",
+                   db_errmsg(pconn, strbuf, sizeof(strbuf)));
+    }
+    return rc;
+}
+
+static int create_table_diragg(db_conn_t *pconn, bool *affects_trig)
+{
+    GString *request;
+    int      rc;
+
+    if (!lmgr_config.dir_agg)
+        return DB_SUCCESS;
+
+    /* values are signed, as deltas are applied in any order */
+    request = g_string_new("CREATE TABLE "DIRAGG_TABLE" (id "PK_TYPE);
+    append_field_def(pconn, ATTR_INDEX_type, request, false);
+    g_string_append(request, ", "ACCT_FIELD_COUNT" BIGINT DEFAULT 0,"
+                    " size BIGINT DEFAULT 0, blocks BIGINT DEFAULT 0,"
+                    " PRIMARY KEY (id, type))");
+    append_engine(request);
+
+    rc = run_create_table(pconn, DIRAGG_TABLE, request->str);
+    g_string_free(request, TRUE);
+    if (rc)
+        return rc;
+
+    /* now populate it */
+    rc = listmgr_diragg_rebuild(pconn);
+    if (rc)
+    {
+        char err_buf[1024];
+
+        /* if the table exists, it must be populated */
+        if (db_drop_component(pconn, DBOBJ_TABLE, DIRAGG_TABLE))
+            DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                       "Failed to drop table: Error: %s",
+                       db_errmsg(pconn, err_buf, sizeof(err_buf)));
+    }
+    return rc;
+}
+
+#ifdef _LUSTRE
+static int check_table_ostagg(db_conn_t *pconn, bool *affects_trig)
+{
+    char  strbuf[4096];
+    char *fieldtab[MAX_DB_FIELDS];
+    int   rc, curr_index = 0;
+
+    rc = db_list_table_info(pconn, OSTAGG_TABLE, fieldtab, NULL, NULL,
+                            MAX_DB_FIELDS, strbuf, sizeof(strbuf));
+    if (rc == DB_SUCCESS)
+    {
+        /* not maintained: drop it, else it may become inconsistent */
+        if (!lmgr_config.ost_agg)
+        {
+            if (report_only)
+                return DB_SUCCESS;
+
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "OST aggregates are "
+                       "disabled: dropping table "OSTAGG_TABLE);
+            rc = db_drop_component(pconn, DBOBJ_TABLE, OSTAGG_TABLE);
+            if (rc != DB_SUCCESS)
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Failed to drop table: Error: %s",
+                           db_errmsg(pconn, strbuf, sizeof(strbuf)));
+            return rc;
+        }
+
+        if (check_field_name("ost_idx", &curr_index, OSTAGG_TABLE, fieldtab)
+            || check_field_name("bucket", &curr_index, OSTAGG_TABLE, fieldtab)
+            || check_field_name(ACCT_FIELD_COUNT, &curr_index, OSTAGG_TABLE,
+                                fieldtab)
+            || check_field_name("size", &curr_index, OSTAGG_TABLE, fieldtab)
+            || check_field_name("blocks", &curr_index, OSTAGG_TABLE, fieldtab)
+            || has_extra_field(curr_index, OSTAGG_TABLE, fieldtab, true))
+        {
+            if (report_only)
+            {
+                lmgr_config.ost_agg = false;
+                return DB_SUCCESS;
+            }
+            /* the table is computed from the other tables: rebuild it */
+            rc = db_drop_component(pconn, DBOBJ_TABLE, OSTAGG_TABLE);
+            if (rc != DB_SUCCESS)
+            {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Failed to drop table: Error: %s",
+                           db_errmsg(pconn, strbuf, sizeof(strbuf)));
+                return rc;
+            }
+            return DB_NOT_EXISTS;
+        }
+    }
+    else if (rc == DB_NOT_EXISTS)
+    {
+        if (!lmgr_config.ost_agg)
+            return DB_SUCCESS;
+
+        if (report_only)
+        {
+            /* report only: fall back to stripe tables */
+            DisplayLog(LVL_VERB, LISTMGR_TAG, "OST aggregates not available");
+            lmgr_config.ost_agg = false;
+            return DB_SUCCESS;
+        }
+    }
+    else
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Error checking database schema: %s",
+                   db_errmsg(pconn, strbuf, sizeof(strbuf)));
+    }
+    return rc;
+}
+
+static int create_table_ostagg(db_conn_t *pconn, bool *affects_trig)
+{
+    GString *request;
+    int      rc;
+
+    if (!lmgr_config.ost_agg)
+        return DB_SUCCESS;
+
+    /* values are signed, as deltas are applied in any order */
+    request = g_string_new("CREATE TABLE "OSTAGG_TABLE" (ost_idx INT UNSIGNED"
+                           ", bucket INT UNSIGNED, "ACCT_FIELD_COUNT
+                           " BIGINT DEFAULT 0, size BIGINT DEFAULT 0,"
+                           " blocks BIGINT DEFAULT 0,"
+                           " PRIMARY KEY (ost_idx, bucket))");
+    append_engine(request);
+
+    rc = run_create_table(pconn, OSTAGG_TABLE, request->str);
+    g_string_free(request, TRUE);
+    if (rc)
+        return rc;
+
+    /* now populate it */
+    rc = listmgr_ostagg_rebuild(pconn);
+    if (rc)
+    {
+        char err_buf[1024];
+
+        /* if the table exists, it must be populated */
+        if (db_drop_component(pconn, DBOBJ_TABLE, OSTAGG_TABLE))
+            DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                       "Failed to drop table: Error: %s",
+                       db_errmsg(pconn, err_buf, sizeof(err_buf)));
+    }
+    return rc;
+}
+#endif
+
 static int check_table_softrm(db_conn_t *pconn, bool *affects_trig)
 {
     int rc, cookie;
@@ -2183,7 +2925,14 @@ static int create_table_softrm(db_conn_t *pconn, bool *affects_trig)
     GString *request;
     int      rc, i, cookie;
 
-    request = g_string_new("CREATE TABLE "SOFT_RM_TABLE" (id "PK_TYPE" PRIMARY KEY");
+#ifdef _MYSQL
+    /* the partitioning column must be part of the primary key */
+    if (lmgr_config.db_config.softrm_partition_time != 0)
+        request = g_string_new("CREATE TABLE "SOFT_RM_TABLE" (id "PK_TYPE);
+    else
+#endif
+        request = g_string_new("CREATE TABLE "SOFT_RM_TABLE" (id "PK_TYPE
+                               " PRIMARY KEY");
 
     cookie = -1;
     while ((i = attr_index_iter(0, &cookie)) != -1)
@@ -2191,8 +2940,15 @@ static int create_table_softrm(db_conn_t *pconn, bool *affects_trig)
         if (is_softrm_field(i))
             append_field_def(pconn, i, request, 0);
     }
+#ifdef _MYSQL
+    if (lmgr_config.db_config.softrm_partition_time != 0)
+        g_string_append(request, ", PRIMARY KEY (id, rm_time)");
+#endif
     g_string_append(request, ")");
     append_engine(request);
+#ifdef _MYSQL
+    append_softrm_partitions(request);
+#endif
 
     rc = run_create_table(pconn, SOFT_RM_TABLE, request->str);
     if (rc)
@@ -2221,6 +2977,8 @@ free_str:
 
 #define VERSION_VAR_FUNC    "VersionFunctionSet"
 #define VERSION_VAR_TRIG    "VersionTriggerSet"
+/* set while accounting triggers are dropped for a bulk load */
+#define BULK_LOAD_VAR       "BulkLoadAcct"
 
 #define FUNCTIONSET_VERSION    "1.5"
 #define TRIGGERSET_VERSION     "1.4"
@@ -2340,9 +3098,9 @@ static int check_trig_acct_insert(db_conn_t *pconn, bool *affects_trig)
     int rc;
     char strbuf[4096];
 
-    if (!lmgr_config.acct)
+    if (!lmgr_config.acct || lmgr_config.acct_deltas)
     {
-        /* no acct: must delete trigger */
+        /* no acct (or acct by deltas): must delete trigger */
         if (!report_only)
         {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping trigger %s",
@@ -2373,9 +3131,9 @@ static int check_trig_acct_delete(db_conn_t *pconn, bool *affects_trig)
 {
     int rc;
     char strbuf[4096];
-    if (!lmgr_config.acct)
+    if (!lmgr_config.acct || lmgr_config.acct_deltas)
     {
-        /* no acct: must delete trigger */
+        /* no acct (or acct by deltas): must delete trigger */
         if (!report_only)
         {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping trigger %s",
@@ -2406,9 +3164,9 @@ static int check_trig_acct_update(db_conn_t *pconn, bool *affects_trig)
 {
     int rc;
     char strbuf[4096];
-    if (!lmgr_config.acct)
+    if (!lmgr_config.acct || lmgr_config.acct_deltas)
     {
-        /* no acct: must delete trigger */
+        /* no acct (or acct by deltas): must delete trigger */
         if (!report_only)
         {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping trigger %s",
@@ -2658,6 +3416,90 @@ free_str:
     return rc;
 }
 
+/** accounting triggers (in creation order) */
+static const struct {
+    const char *name;
+    int (*create)(db_conn_t *, bool *);
+} acct_triggers[] = {
+    {ACCT_TRIGGER_INSERT, create_trig_acct_insert},
+    {ACCT_TRIGGER_DELETE, create_trig_acct_delete},
+    {ACCT_TRIGGER_UPDATE, create_trig_acct_update},
+};
+
+const char *listmgr_acct_src_table(void)
+{
+    return acct_info_table;
+}
+
+int listmgr_acct_triggers_drop(db_conn_t *pconn)
+{
+    int  i, rc;
+    char err_buf[1024];
+
+    if (!lmgr_config.acct && !lmgr_config.dir_agg && !lmgr_config.ost_agg)
+        return DB_SUCCESS;
+
+    /* so the accounting is rebuilt if the bulk load is interrupted */
+    rc = lmgr_set_var(pconn, BULK_LOAD_VAR, "1");
+    if (rc || !lmgr_config.acct)
+        return rc;
+
+    for (i = 0; i < sizeof(acct_triggers)/sizeof(acct_triggers[0]); i++)
+    {
+        rc = db_drop_component(pconn, DBOBJ_TRIGGER, acct_triggers[i].name);
+        if (rc != DB_SUCCESS && rc != DB_TRG_NOT_EXISTS)
+        {
+            DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                       "Failed to drop %s trigger: Error: %s",
+                       acct_triggers[i].name,
+                       db_errmsg(pconn, err_buf, sizeof(err_buf)));
+            return rc;
+        }
+    }
+    return DB_SUCCESS;
+}
+
+int listmgr_acct_rebuild(db_conn_t *pconn)
+{
+    int  i, rc;
+    bool dummy;
+
+    if (!lmgr_config.acct && !lmgr_config.dir_agg && !lmgr_config.ost_agg)
+        return DB_SUCCESS;
+
+    /* directory aggregates are not maintained during bulk loads either */
+    rc = listmgr_diragg_rebuild(pconn);
+    if (rc)
+        return rc;
+#ifdef _LUSTRE
+    rc = listmgr_ostagg_rebuild(pconn);
+    if (rc)
+        return rc;
+#endif
+    if (!lmgr_config.acct)
+        return lmgr_set_var(pconn, BULK_LOAD_VAR, NULL);
+
+    rc = db_exec_sql(pconn, "DELETE FROM "ACCT_TABLE, NULL);
+    if (rc)
+        return rc;
+
+    rc = populate_acct_table(pconn);
+    if (rc)
+        return rc;
+
+    /* accounting by deltas: no trigger to restore */
+    if (lmgr_config.acct_deltas)
+        return lmgr_set_var(pconn, BULK_LOAD_VAR, NULL);
+
+    for (i = 0; i < sizeof(acct_triggers)/sizeof(acct_triggers[0]); i++)
+    {
+        rc = acct_triggers[i].create(pconn, &dummy);
+        if (rc)
+            return rc;
+    }
+    return lmgr_set_var(pconn, BULK_LOAD_VAR, NULL);
+}
+
 static int check_func_szrange(db_conn_t *pconn, bool *affects_trig)
 {
     /* XXX /!\ do not modify the code of DB functions
@@ -2835,11 +3677,14 @@ static const dbobj_descr_t  o_list[] = {
     {DBOBJ_FUNCTION, SZRANGE_FUNC,  check_func_szrange, create_func_szrange},
 
     {DBOBJ_TABLE, ACCT_TABLE,    check_table_acct,    create_table_acct},
+    {DBOBJ_TABLE, DIRAGG_TABLE,  check_table_diragg,  create_table_diragg},
 #ifdef _LUSTRE
     {DBOBJ_TABLE, STRIPE_INFO_TABLE,  check_table_stripe_info,
                                       create_table_stripe_info},
     {DBOBJ_TABLE, STRIPE_ITEMS_TABLE, check_table_stripe_items,
                                       create_table_stripe_items},
+    /* computed from the stripe tables */
+    {DBOBJ_TABLE, OSTAGG_TABLE,  check_table_ostagg,  create_table_ostagg},
 #endif
     {DBOBJ_TABLE, SOFT_RM_TABLE, check_table_softrm, create_table_softrm},
 
@@ -2860,6 +3705,57 @@ static const dbobj_descr_t  o_list[] = {
 };
 
 
+/* fingerprint of the schema, once it has been fully checked */
+#define SCHEMA_FINGERPRINT_VAR "SchemaFingerprint"
+
+/**
+ * Compute the fingerprint of the expected schema: a hash of all that is
+ * verified by the checks of o_list (fields of each table with their type
+ * and default value, accounting settings, functions and triggers versions).
+ * Sort indexes depend on the policies run by the daemon: they are always
+ * checked. The program version is included, as checks may change between
+ * versions.
+ */
+static void schema_fingerprint(db_conn_t *pconn, char *out, size_t size)
+{
+    GString *str;
+    uint64_t h = 14695981039346656037ULL;   /* FNV-1a */
+    const char *c;
+    int i, cookie;
+
+    str = g_string_new(PACKAGE_VERSION "/" FUNCTIONSET_VERSION "/"
+                       TRIGGERSET_VERSION);
+#ifdef _LUSTRE
+    g_string_append(str, "/lustre");
+#endif
+    g_string_append_printf(str, "/acct=%d,%d,%d,%d/acct_src=%s",
+                           lmgr_config.acct, lmgr_config.acct_deltas,
+                           lmgr_config.dir_agg, lmgr_config.ost_agg,
+                           acct_info_table);
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1)
+    {
+        g_string_append_printf(str, "/%d:%c%c%c%c%c%c%c%c", i,
+                               is_main_field(i) ? 'm' : '-',
+                               is_annex_field(i) ? 'a' : '-',
+                               is_names_field(i) ? 'n' : '-',
+                               is_stripe_field(i) ? 's' : '-',
+                               is_acct_field(i) ? 'c' : '-',
+                               is_acct_pk(i) ? 'k' : '-',
+                               is_softrm_field(i) ? 'r' : '-',
+                               is_indexed_field(i) ? 'i' : '-');
+        if (!is_funcattr(i))
+            append_field_def(pconn, i, str, false);
+    }
+
+    for (c = str->str; *c != '\0'; c++)
+        h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+    g_string_free(str, TRUE);
+
+    snprintf(out, size, "%016"PRIx64, h);
+}
+
 /**
  * Initialize the database access module and
  * check and create the schema.
@@ -2872,6 +3768,9 @@ int ListMgr_Init(enum lmgr_init_flags flags)
     bool create_all_functions = false;
     bool create_all_triggers = false;
     bool dummy;
+    bool schema_ok = true;
+    char strbuf[128];
+    char fingerprint[32];
 
     /* store the parameter as a global variable */
     init_flags = flags;
@@ -2881,14 +3780,35 @@ int ListMgr_Init(enum lmgr_init_flags flags)
 
     init_default_field_values();
 
+    listmgr_cache_init();
+    listmgr_path_init();
+
     /* determine source tables for accounting */
     acct_info_table = acct_table();
 
+    rc = listmgr_acct_init();
+    if (rc)
+        return rc;
+
     /* create a database access */
     rc = db_connect(&conn);
     if (rc)
         return rc;
 
+    /* The detailed checks below take many queries: skip them if the
+     * schema was already checked with the same expectations.
+     * --alter-db always runs them. */
+    schema_fingerprint(&conn, fingerprint, sizeof(fingerprint));
+    if (!alter_db
+        && lmgr_get_var(&conn, SCHEMA_FINGERPRINT_VAR, strbuf,
+                        sizeof(strbuf)) == DB_SUCCESS
+        && strcmp(strbuf, fingerprint) == 0)
+    {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Database schema matches "
+                   "fingerprint %s: skipping schema checks", fingerprint);
+        goto schema_checked;
+    }
+
     /* check if tables exist, and check their schema */
     DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Checking database schema");
 
@@ -2918,9 +3838,12 @@ int ListMgr_Init(enum lmgr_init_flags flags)
                 break;
             case DB_NOT_EXISTS:
                 if (report_only)
+                {
                     DisplayLog(LVL_MAJOR, LISTMGR_TAG, "WARNING: %s %s"
                                " does not exist", dbobj2str(o->o_type),
                                o->o_name);
+                    schema_ok = false;
+                }
                 else
                 {
                     DisplayLog(LVL_EVENT, LISTMGR_TAG, "%s %s does not exist (or wrong version):"
@@ -2933,8 +3856,11 @@ int ListMgr_Init(enum lmgr_init_flags flags)
 
             case DB_NEED_ALTER:
                 if (report_only)
+                {
                     DisplayLog(LVL_MAJOR, LISTMGR_TAG, "WARNING: ALTER required on %s %s",
                                dbobj2str(o->o_type), o->o_name);
+                    schema_ok = false;
+                }
                 else
                     goto close_conn;
                 break;
@@ -2958,6 +3884,43 @@ int ListMgr_Init(enum lmgr_init_flags flags)
             goto close_conn;
     }
 
+    /* only the daemon and tools that can fix the schema save its
+     * fingerprint */
+    if (schema_ok && !report_only
+        && lmgr_set_var(&conn, SCHEMA_FINGERPRINT_VAR, fingerprint)
+            != DB_SUCCESS)
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to save schema "
+                   "fingerprint");
+
+schema_checked:
+    if (!report_only)
+    {
+        rc = check_sort_indexes(&conn);
+        if (rc)
+            goto close_conn;
+    }
+
+    rc = check_name_index(&conn);
+    if (rc)
+        goto close_conn;
+
+    rc = check_diff_gen(&conn);
+    if (rc)
+        goto close_conn;
+
+    /* accounting of an interrupted bulk load */
+    if ((lmgr_config.acct || lmgr_config.dir_agg || lmgr_config.ost_agg)
+        && !report_only
+        && lmgr_get_var(&conn, BULK_LOAD_VAR, strbuf, sizeof(strbuf))
+            == DB_SUCCESS)
+    {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Previous bulk load was "
+                   "interrupted: rebuilding accounting table");
+        rc = listmgr_acct_rebuild(&conn);
+        if (rc)
+            goto close_conn;
+    }
+
     rc = DB_SUCCESS;
 
 close_conn:
@@ -2992,6 +3955,9 @@ int ListMgr_InitAccess( lmgr_t * p_mgr )
 
     p_mgr->last_commit = 0;
     p_mgr->force_commit = false;
+    p_mgr->tx_seq = 1;
+    p_mgr->committed_seq = 0;
+    timerclear(&p_mgr->tx_start);
     p_mgr->retry_delay = 0;
     p_mgr->retry_count = 0;
     timerclear(&p_mgr->first_error);
@@ -2999,6 +3965,10 @@ int ListMgr_InitAccess( lmgr_t * p_mgr )
     for (i = 0; i < OPCOUNT; i++)
         p_mgr->nbop[i] = 0;
 
+    lmgr_stmt_cache_init(p_mgr);
+    p_mgr->bulk = NULL;
+    p_mgr->acct_deltas = NULL;
+
     return 0;
 }
 
@@ -3010,6 +3980,14 @@ int ListMgr_CloseAccess( lmgr_t * p_mgr )
     /* force to commit queued requests */
     rc = lmgr_flush_commit( p_mgr );
 
+    /* load entries spooled by this connection */
+    listmgr_bulk_close(p_mgr);
+
+    listmgr_acct_close(p_mgr);
+
+    /* statements must be released before the connection is closed */
+    lmgr_stmt_cache_free(p_mgr);
+
     /* close connexion */
     db_close_conn( &p_mgr->conn );
 
@@ -159,6 +159,110 @@ free_str:
     return rc;
 }
 
+#ifdef _LUSTRE
+/** spool stripe information of a batch of entries */
+static int bulk_insert_stripe(lmgr_t *p_mgr, struct bulk_spool *spool,
+                              entry_id_t **p_ids, pktype *pklist,
+                              attr_set_t **p_attrs, unsigned int count)
+{
+    GString *info_rows, *items_rows;
+    unsigned int nb_info, nb_items;
+    int *validators;
+    int i, rc;
+
+    validators = (int*)MemCalloc(count, sizeof(int));
+    if (!validators)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < count; i++)
+#ifdef HAVE_LLAPI_FSWAP_LAYOUTS
+        validators[i] = ATTR_MASK_TEST(p_attrs[i], stripe_info)?
+                            ATTR(p_attrs[i],stripe_info).validator:VALID_NOSTRIPE;
+#else
+        validators[i] = VALID(p_ids[i]);
+#endif
+
+    info_rows = g_string_new(NULL);
+    items_rows = g_string_new(NULL);
+
+    rc = stripe_load_rows(pklist, validators, p_attrs, count, info_rows,
+                          &nb_info, items_rows, &nb_items);
+    if (rc == DB_SUCCESS)
+        rc = listmgr_bulk_append(p_mgr, spool, T_STRIPE_INFO, null_mask,
+                                 info_rows,
+                                 nb_info);
+    if (rc == DB_SUCCESS)
+        rc = listmgr_bulk_append(p_mgr, spool, T_STRIPE_ITEMS, null_mask,
+                                 items_rows, nb_items);
+
+    g_string_free(info_rows, TRUE);
+    g_string_free(items_rows, TRUE);
+    MemFree(validators);
+    return rc;
+}
+#endif
+
+/**
+ * Spool a batch of new entries, if the bulk load mode is active.
+ * @return DB_NOT_SUPPORTED if entries must be inserted by SQL requests.
+ */
+static int bulk_insert(lmgr_t *p_mgr, entry_id_t **p_ids, pktype *pklist,
+                       attr_set_t **p_attrs, unsigned int count,
+                       attr_mask_t full_mask)
+{
+    static const table_enum tables[] = {T_MAIN, T_DNAMES, T_ANNEX};
+    struct bulk_spool *spool;
+    GString *rows;
+    int i, t, rc = DB_SUCCESS;
+
+    spool = listmgr_bulk_begin(p_mgr);
+    if (spool == NULL)
+        return DB_NOT_SUPPORTED;
+
+    rows = g_string_new(NULL);
+
+    for (t = 0; t < sizeof(tables)/sizeof(tables[0]); t++)
+    {
+        unsigned int nb_rows = 0;
+
+        if (tables[t] == T_DNAMES
+            && (!attr_mask_test_index(&full_mask, ATTR_INDEX_name)
+                || !attr_mask_test_index(&full_mask, ATTR_INDEX_parent_id)))
+        {
+            /* name information is missing in all entries */
+            no_name_warning(pklist[0], p_attrs[0], count);
+            continue;
+        }
+
+        g_string_truncate(rows, 0);
+        for (i = 0; i < count; i++)
+        {
+            if (!entry_filter(tables[t], true, pklist[i], p_attrs[i]))
+                continue;
+
+            g_string_append(rows, pklist[i]);
+            attrset2loadrow(rows, p_attrs[i], tables[t]);
+            g_string_append_c(rows, '\n');
+            nb_rows++;
+        }
+
+        rc = listmgr_bulk_append(p_mgr, spool, tables[t], full_mask, rows,
+                                 nb_rows);
+        if (rc)
+            goto out;
+    }
+
+#ifdef _LUSTRE
+    if (stripe_fields(full_mask))
+        rc = bulk_insert_stripe(p_mgr, spool, p_ids, pklist, p_attrs, count);
+#endif
+
+out:
+    g_string_free(rows, TRUE);
+    listmgr_bulk_end(spool);
+    return rc;
+}
+
 int listmgr_batch_insert_no_tx(lmgr_t * p_mgr, entry_id_t **p_ids,
                                attr_set_t **p_attrs,
                                unsigned int count,
@@ -190,6 +294,22 @@ int listmgr_batch_insert_no_tx(lmgr_t * p_mgr, entry_id_t **p_ids,
         entry_id2pk(p_ids[i], PTR_PK(pklist[i])); /* The same for all tables? */
     }
 
+    /* initial scan: new entries are loaded by large batches */
+    if (!update_if_exists)
+    {
+        rc = bulk_insert(p_mgr, p_ids, pklist, p_attrs, count, full_mask);
+        if (rc != DB_NOT_SUPPORTED)
+            goto out_free;
+        rc = 0;
+    }
+    else
+    {
+        /* accounting deltas: subtract the values of existing entries */
+        rc = listmgr_acct_delta(p_mgr, pklist, count, -1);
+        if (rc)
+            goto out_free;
+    }
+
     rc = run_batch_insert(p_mgr, full_mask, pklist, p_attrs,
                           count, T_MAIN, update_if_exists,
                           true, NULL, NULL);
@@ -251,7 +371,18 @@ int listmgr_batch_insert_no_tx(lmgr_t * p_mgr, entry_id_t **p_ids,
     }
 #endif
 
+    /* accounting deltas: add the new values (OST aggregates depend on the
+     * stripes) */
+    rc = listmgr_acct_delta(p_mgr, pklist, count, 1);
+
 out_free:
+    for (i = 0; i < count; i++)
+    {
+        listmgr_cache_invalidate(p_ids[i]);
+        /* new entries have no cached path */
+        if (update_if_exists && ATTR_MASK_TEST(p_attrs[i], name))
+            listmgr_path_invalidate(p_ids[i]);
+    }
     MemFree(pklist);
     return rc;
 }
@@ -356,3 +487,49 @@ retry:
     }
     return rc;
 }
+
+struct pk_sort_item {
+    pktype       pk;
+    entry_id_t  *id;
+    attr_set_t  *attrs;
+};
+
+static int pk_sort_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct pk_sort_item *)a)->pk,
+                  ((const struct pk_sort_item *)b)->pk);
+}
+
+/**
+ * Sort a batch of entries in the order of their primary key,
+ * so they are inserted close to each other in the DB index.
+ */
+int ListMgr_SortByPK(entry_id_t **p_ids, attr_set_t **p_attrs,
+                     unsigned int count)
+{
+    struct pk_sort_item *items;
+    unsigned int i;
+
+    if (count < 2)
+        return DB_SUCCESS;
+
+    items = MemAlloc(count * sizeof(*items));
+    if (items == NULL)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < count; i++) {
+        entry_id2pk(p_ids[i], PTR_PK(items[i].pk));
+        items[i].id = p_ids[i];
+        items[i].attrs = p_attrs[i];
+    }
+
+    qsort(items, count, sizeof(*items), pk_sort_cmp);
+
+    for (i = 0; i < count; i++) {
+        p_ids[i] = items[i].id;
+        p_attrs[i] = items[i].attrs;
+    }
+
+    MemFree(items);
+    return DB_SUCCESS;
+}
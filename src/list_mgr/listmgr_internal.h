@@ -87,11 +87,116 @@ int listmgr_batch_insert_no_tx(lmgr_t *p_mgr, entry_id_t **p_ids,
 int listmgr_remove_no_tx(lmgr_t *p_mgr, const entry_id_t *p_id,
                          const attr_set_t *p_attr_set, bool last);
 
+/** drop accounting triggers, before a bulk load */
+int listmgr_acct_triggers_drop(db_conn_t *pconn);
+/** compute the accounting table from scratch and re-create its triggers */
+int listmgr_acct_rebuild(db_conn_t *pconn);
+
+/** source table of accounting information */
+const char *listmgr_acct_src_table(void);
+
+/* accounting by aggregated deltas (see listmgr_acct.c) */
+int listmgr_acct_init(void);
+/**
+ * Add (sign=1) or subtract (sign=-1) the current accounting values of
+ * the given entries to the deltas of the current transaction.
+ */
+int listmgr_acct_delta(lmgr_t *p_mgr, pktype *pklist, unsigned int count,
+                       int sign);
+/** same as listmgr_acct_delta() for entries matching a SQL condition */
+int listmgr_acct_delta_where(lmgr_t *p_mgr, const char *where, int sign);
+/** write the deltas of the current transaction to the accounting table */
+int listmgr_acct_flush(lmgr_t *p_mgr);
+/** forget the deltas of an aborted transaction */
+void listmgr_acct_discard(lmgr_t *p_mgr);
+void listmgr_acct_close(lmgr_t *p_mgr);
+
+/* directory aggregates (see listmgr_diragg.c).
+ * Deltas are collected and flushed along with accounting deltas. */
+/** add (sign=1) or subtract (sign=-1) the contribution of the entries
+ * matching a SQL condition on the main table to their parent directories */
+int listmgr_diragg_delta(lmgr_t *p_mgr, const char *where, int sign);
+/** propagate the deltas of the current transaction to all ancestors */
+int listmgr_diragg_flush(lmgr_t *p_mgr);
+void listmgr_diragg_discard(lmgr_t *p_mgr);
+void listmgr_diragg_close(lmgr_t *p_mgr);
+/** compute the aggregates of all directories from DB contents */
+int listmgr_diragg_rebuild(db_conn_t *pconn);
+
+#ifdef _LUSTRE
+/* OST aggregates (see listmgr_ostagg.c).
+ * Deltas are collected and flushed along with accounting deltas. */
+/** add (sign=1) or subtract (sign=-1) the contribution of the entries
+ * matching a SQL condition on the main table to their OSTs */
+int listmgr_ostagg_delta(lmgr_t *p_mgr, const char *where, int sign);
+/** write the deltas of the current transaction */
+int listmgr_ostagg_flush(lmgr_t *p_mgr);
+void listmgr_ostagg_discard(lmgr_t *p_mgr);
+void listmgr_ostagg_close(lmgr_t *p_mgr);
+/** compute the aggregates of all OSTs from DB contents */
+int listmgr_ostagg_rebuild(db_conn_t *pconn);
+#endif
+
+/* report snapshots (see listmgr_snapshot.c) */
+/**
+ * Read the results of a report query from its snapshot, creating or
+ * rebuilding the snapshot if needed.
+ * @param query     report query, without ORDER BY and LIMIT clauses.
+ * @retval DB_NOT_SUPPORTED if snapshots are disabled.
+ */
+int listmgr_snapshot_open(lmgr_t *p_mgr, const char *query,
+                          const char *order_by, unsigned int limit,
+                          result_handle_t *p_result);
+
+/* attribute cache (see listmgr_cache.c) */
+void listmgr_cache_init(void);
+/**
+ * Get the attributes of an entry from the cache.
+ * @param req       mask of asked attributes (only supported DB fields).
+ * @param p_counter invalidation counter, to be passed to listmgr_cache_put().
+ * @return true on cache hit.
+ */
+bool listmgr_cache_get(const entry_id_t *p_id, const attr_mask_t *req,
+                       attr_set_t *p_info, unsigned long long *p_counter,
+                       const char *caller);
+/** add attributes read from the DB to the cache */
+void listmgr_cache_put(const entry_id_t *p_id, const attr_mask_t *req,
+                       const attr_set_t *p_info, unsigned long long counter);
+/** to be called when an entry is modified */
+void listmgr_cache_invalidate(const entry_id_t *p_id);
+/** to be called when several entries are modified */
+void listmgr_cache_invalidate_all(void);
+
+/* path cache (see listmgr_path.c) */
+void listmgr_path_init(void);
+/** @return true if full paths are resolved by listmgr_path_resolve() */
+bool listmgr_path_enabled(void);
+/** set fullpath in an attribute set from its parent_id and name */
+int listmgr_path_resolve(lmgr_t *p_mgr, attr_set_t *p_set);
+/** to be called when the name or the parent of an entry changes */
+void listmgr_path_invalidate(const entry_id_t *p_id);
+void listmgr_path_invalidate_all(void);
+
+/** @return true if NAMES has a reversed name index (see name_suffix_index) */
+bool listmgr_name_index_enabled(void);
+/** @return true if entries record the last diff that saw them
+ *  (else, diff tags are tables of ids) */
+bool listmgr_diff_gen_enabled(void);
+
+/** append the condition on the ignore marks of a policy for entries of the
+ *  given table (iterator skip_marked option) */
+void append_ignore_marks_cond(lmgr_t *p_mgr, GString *str, const char *table,
+                              const char *policy);
+
 typedef struct lmgr_iterator_t {
     lmgr_t          *p_mgr;
     lmgr_iter_opt_t  opt;
     result_handle_t  select_result;
     unsigned int     opt_is_set:1;
+    unsigned int     stream:1;
+    unsigned int     keyset:1;     /* the sort value is also selected */
+    db_conn_t        stream_conn;  /* connection of the streamed result */
+    lmgr_iter_pos_t  pos;          /* last returned entry */
 } lmgr_iterator_t;
 
 #ifdef _LUSTRE
@@ -121,4 +226,22 @@ static inline int buf2hex(char *out, size_t out_sz, const unsigned char *in,
     return (int)(dst - out);
 }
 
+/** convert an hex string to a buffer; returns the size of the output */
+static inline int hex2buf(unsigned char *out, size_t out_sz, const char *in)
+{
+    size_t i, len = strlen(in);
+
+    if (len % 2 != 0 || out_sz < len / 2)
+        return -1;
+
+    for (i = 0; i < len / 2; i++) {
+        unsigned int byte;
+
+        if (sscanf(in + 2 * i, "%2x", &byte) != 1)
+            return -1;
+        out[i] = byte;
+    }
+    return (int)(len / 2);
+}
+
 #endif
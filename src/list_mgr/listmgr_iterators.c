@@ -174,7 +174,8 @@ static inline bool do_sort(table_enum t_sort, unsigned int sort_dirattr)
 }
 
 static int select_all_request(lmgr_t *p_mgr, GString *req, table_enum sort_table,
-                              unsigned int sort_dirattr, bool distinct)
+                              unsigned int sort_dirattr, bool distinct,
+                              const char *sort_sel)
 {
     if (!do_sort(sort_table, sort_dirattr))
     {
@@ -183,8 +184,8 @@ static int select_all_request(lmgr_t *p_mgr, GString *req, table_enum sort_table
     }
     else if (sort_table != T_NONE)
     {
-        g_string_printf(req, "SELECT %s FROM %s", distinct?"DISTINCT(id)":"id",
-                        table2name(sort_table));
+        g_string_printf(req, "SELECT %s%s FROM %s", distinct?"DISTINCT(id)":"id",
+                        sort_sel, table2name(sort_table));
     }
     else if ((sort_dirattr & ATTR_INDEX_FLG_UNSPEC) == 0)
     {
@@ -198,6 +199,122 @@ static int select_all_request(lmgr_t *p_mgr, GString *req, table_enum sort_table
     return DB_SUCCESS;
 }
 
+/* max time a streamed result can wait for the client (seconds) */
+#define STREAM_WRITE_TIMEOUT "86400"
+
+/** append the value of an iterator position to a request */
+static int append_sort_val(lmgr_t *p_mgr, GString *str, unsigned int attr_index,
+                           const char *val)
+{
+    char *escaped;
+    int   len;
+
+    switch (field_infos[attr_index].db_type)
+    {
+        case DB_INT:
+        case DB_UINT:
+        case DB_SHORT:
+        case DB_USHORT:
+        case DB_BIGINT:
+        case DB_BIGUINT:
+        case DB_BOOL:
+            /* compare numbers as numbers */
+            if (val[strspn(val, "-0123456789")] == '\0')
+            {
+                g_string_append(str, val);
+                return DB_SUCCESS;
+            }
+            break;
+        default:
+            break;
+    }
+
+    len = 2 * strlen(val) + 1;
+    escaped = MemAlloc(len);
+    if (escaped == NULL)
+        return DB_NO_MEMORY;
+    db_escape_string(&p_mgr->conn, escaped, len, val);
+    g_string_append_printf(str, "'%s'", escaped);
+    MemFree(escaped);
+    return DB_SUCCESS;
+}
+
+/**
+ * Build the condition to select entries after the given position,
+ * in the iterator sort order (sort value, id).
+ * NULL sort values come first in ascending order.
+ */
+static int append_after_cond(lmgr_t *p_mgr, GString *str, const char *table,
+                             const lmgr_sort_type_t *p_sort_type,
+                             const lmgr_iter_pos_t *pos)
+{
+    const char *field = field_name(p_sort_type->attr_index);
+    bool        asc = (p_sort_type->order == SORT_ASC);
+    DEF_PK(pk);
+    int         rc;
+
+    entry_id2pk(&pos->id, PTR_PK(pk));
+
+    if (pos->sort_null)
+    {
+        g_string_printf(str, "((%s.%s IS NULL AND %s.id%s"DPK")",
+                        table, field, table, asc ? ">" : "<", pk);
+        if (asc)
+            g_string_append_printf(str, " OR %s.%s IS NOT NULL", table,
+                                   field);
+        g_string_append_c(str, ')');
+        return DB_SUCCESS;
+    }
+
+    g_string_printf(str, "(%s.%s%s", table, field, asc ? ">" : "<");
+    rc = append_sort_val(p_mgr, str, p_sort_type->attr_index, pos->sort_val);
+    if (rc)
+        return rc;
+    g_string_append_printf(str, " OR (%s.%s=", table, field);
+    rc = append_sort_val(p_mgr, str, p_sort_type->attr_index, pos->sort_val);
+    if (rc)
+        return rc;
+    g_string_append_printf(str, " AND %s.id%s"DPK")", table, asc ? ">" : "<",
+                           pk);
+    if (!asc)
+        g_string_append_printf(str, " OR %s.%s IS NULL", table, field);
+    g_string_append_c(str, ')');
+    return DB_SUCCESS;
+}
+
+/** add the condition of the skip_marked option to the extra conditions
+ *  of an iterator request */
+static void add_marks_cond(lmgr_t *p_mgr, GString **cond, const char *table,
+                           const lmgr_iter_opt_t *p_opt)
+{
+    if (p_opt == NULL || p_opt->skip_marked == NULL)
+        return;
+
+    if (table == NULL)
+    {
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Ignore marks are not supported "
+                   "for this sort order: listing all entries");
+        return;
+    }
+
+    if (*cond == NULL)
+        *cond = g_string_new(NULL);
+    else
+        g_string_append(*cond, " AND ");
+    append_ignore_marks_cond(p_mgr, *cond, table, p_opt->skip_marked);
+}
+
+/** table of the ids selected by select_all_request (NULL if none) */
+static const char *select_all_table(table_enum sort_table,
+                                    unsigned int sort_dirattr)
+{
+    if (!do_sort(sort_table, sort_dirattr))
+        return MAIN_TABLE;
+    else if (sort_table != T_NONE)
+        return table2name(sort_table);
+    return NULL;
+}
+
 /** get an iterator on a list of entries */
 struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
                                          const lmgr_filter_t *p_filter,
@@ -214,10 +331,13 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     bool                distinct = false;
     table_enum          query_tab = T_NONE;
 
+    bool                keyset;
     GString            *from = NULL;
     GString            *where = NULL;
     GString            *req = NULL;
     GString            *filter_dir = NULL;
+    GString            *sort_sel = NULL;
+    GString            *after = NULL;
 
     /* Iterator only select a sorted list of ids.
      * Entry attributes are retrieved afterward in ListMgr_GetNext() call.
@@ -226,15 +346,73 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
     /* is there a sort order? */
     check_sort(p_sort_type, &sort_table, &sort_dirattr, &distinct);
 
+    /* Keyset continuation: when sorting on a field of the main or annex
+     * table, the sort value is selected with the id, so the iteration can
+     * be continued after a given (sort value, id). */
+    keyset = (sort_table == T_MAIN || sort_table == T_ANNEX);
+
+    sort_sel = g_string_new(NULL);
+    if (keyset)
+    {
+        g_string_printf(sort_sel, ",%s.%s", table2name(sort_table),
+                        field_name(p_sort_type->attr_index));
+
+        if (p_opt != NULL && p_opt->after != NULL && p_opt->after->set)
+        {
+            after = g_string_new(NULL);
+            rc = append_after_cond(p_mgr, after, table2name(sort_table),
+                                   p_sort_type, p_opt->after);
+            if (rc)
+                goto free_str;
+        }
+
+        if (p_opt != NULL && p_opt->shard_count > 1)
+        {
+#ifdef _MYSQL
+            if (after == NULL)
+                after = g_string_new(NULL);
+            else
+                g_string_append(after, " AND ");
+            g_string_append_printf(after, "CRC32(%s.id)%%%u=%u",
+                                   table2name(sort_table), p_opt->shard_count,
+                                   p_opt->shard_index);
+#else
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Iterator shards are not "
+                       "supported with "DB_ENGINE_NAME);
+            goto free_str;
+#endif
+        }
+    }
+    else
+    {
+        if (p_opt != NULL && p_opt->after != NULL && p_opt->after->set)
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Iterator continuation is not "
+                       "supported for this sort order: starting from the "
+                       "beginning");
+
+        /* returning all entries in each shard would list them twice */
+        if (p_opt != NULL && p_opt->shard_count > 1)
+        {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Iterator shards are not "
+                       "supported for this sort order");
+            goto free_str;
+        }
+    }
+
     /* initialize the request */
     req = g_string_new(NULL);
 
     if (no_filter(p_filter))
     {
         /* no filter is specified: build a select request with no criteria */
-        rc = select_all_request(p_mgr, req, sort_table, sort_dirattr, distinct);
+        rc = select_all_request(p_mgr, req, sort_table, sort_dirattr, distinct,
+                                sort_sel->str);
         if (rc)
             goto free_str;
+        add_marks_cond(p_mgr, &after,
+                       select_all_table(sort_table, sort_dirattr), p_opt);
+        if (after != NULL)
+            g_string_append_printf(req, " WHERE %s", after->str);
     }
     else /* analyse filter contents */
     {
@@ -255,9 +433,14 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
         /* finally, there was no filter */
         if (nbft == 0 && filter_dir_type == FILTERDIR_NONE)
         {
-            rc = select_all_request(p_mgr, req, sort_table, sort_dirattr, distinct);
+            rc = select_all_request(p_mgr, req, sort_table, sort_dirattr,
+                                    distinct, sort_sel->str);
             if (rc)
                 goto free_str;
+            add_marks_cond(p_mgr, &after,
+                           select_all_table(sort_table, sort_dirattr), p_opt);
+            if (after != NULL)
+                g_string_append_printf(req, " WHERE %s", after->str);
         }
         else
         {
@@ -286,7 +469,15 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
                 g_string_printf(req, "SELECT %s.id AS id",
                                 table2name(query_tab));
 
-            g_string_append_printf(req, " FROM %s WHERE %s", from->str, where->str);
+            g_string_append(req, sort_sel->str);
+
+            add_marks_cond(p_mgr, &after, table2name(query_tab), p_opt);
+            if (after != NULL)
+                g_string_append_printf(req, " FROM %s WHERE (%s) AND %s",
+                                       from->str, where->str, after->str);
+            else
+                g_string_append_printf(req, " FROM %s WHERE %s", from->str,
+                                       where->str);
         }
     }
 
@@ -331,6 +522,12 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
             g_string_append(req, "ASC");
         else
             g_string_append(req, "DESC");
+
+        /* entries with the same sort value are sorted by id */
+        if (keyset)
+            g_string_append_printf(req, ",%s.id %s", table2name(sort_table),
+                                   p_sort_type->order == SORT_ASC ?
+                                        "ASC" : "DESC");
     }
 
     /* iterator opt */
@@ -338,22 +535,51 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
         g_string_append_printf(req, " LIMIT %u", p_opt->list_count_max);
 
     /* allocate a new iterator */
-    it = (lmgr_iterator_t *) MemAlloc(sizeof(lmgr_iterator_t));
+    it = (lmgr_iterator_t *) MemCalloc(1, sizeof(lmgr_iterator_t));
+    if (it == NULL)
+        goto free_str;
     it->p_mgr = p_mgr;
     if (p_opt)
     {
         it->opt = *p_opt;
+        it->opt.after = NULL;
+        it->opt.skip_marked = NULL;
         it->opt_is_set = 1;
     }
     else
     {
         it->opt_is_set = 0;
     }
+    it->keyset = keyset;
 
     /* execute request */
-    rc = db_exec_sql(&p_mgr->conn, req->str, &it->select_result);
-    if (rc)
-        goto free_it;
+    if (p_opt && p_opt->stream)
+    {
+        /* records are read while entry attributes are queried on the main
+         * connection: use a dedicated connection for the result */
+        rc = db_connect(&it->stream_conn);
+        if (rc)
+            goto free_it;
+        it->stream = 1;
+#ifdef _MYSQL
+        /* the iteration may be slow (e.g. policy queue full): don't let
+         * the server abort the result transfer */
+        rc = db_exec_sql(&it->stream_conn, "SET SESSION net_write_timeout="
+                         STREAM_WRITE_TIMEOUT, NULL);
+        if (rc)
+            goto close_conn;
+#endif
+        rc = db_exec_sql_stream(&it->stream_conn, req->str,
+                                &it->select_result);
+        if (rc)
+            goto close_conn;
+    }
+    else
+    {
+        rc = db_exec_sql(&p_mgr->conn, req->str, &it->select_result);
+        if (rc)
+            goto free_it;
+    }
 
     if (filter_dir != NULL)
         g_string_free(filter_dir, TRUE);
@@ -363,12 +589,16 @@ struct lmgr_iterator_t *ListMgr_Iterator(lmgr_t *p_mgr,
         g_string_free(where, TRUE);
     if (req != NULL)
         g_string_free(req, TRUE);
+    g_string_free(sort_sel, TRUE);
+    if (after != NULL)
+        g_string_free(after, TRUE);
 
     return it;
 
+close_conn:
+    db_close_conn(&it->stream_conn);
 free_it:
-    if (it != NULL)
-        MemFree(it);
+    MemFree(it);
 free_str:
     if (filter_dir != NULL)
         g_string_free(filter_dir, TRUE);
@@ -378,15 +608,46 @@ free_str:
         g_string_free(where, TRUE);
     if (req != NULL)
         g_string_free(req, TRUE);
+    g_string_free(sort_sel, TRUE);
+    if (after != NULL)
+        g_string_free(after, TRUE);
     return NULL;
 }
 
 
 
+/** connection of the iterator result */
+static inline db_conn_t *iter_conn(struct lmgr_iterator_t *p_iter)
+{
+    return p_iter->stream ? &p_iter->stream_conn : &p_iter->p_mgr->conn;
+}
+
+/** save the position of the last entry read by the iterator */
+static void set_iter_pos(struct lmgr_iterator_t *p_iter, const entry_id_t *p_id,
+                         const char *sort_val)
+{
+    lmgr_iter_pos_t *pos = &p_iter->pos;
+
+    pos->id = *p_id;
+    pos->sort_null = (sort_val == NULL);
+    if (sort_val == NULL)
+        pos->sort_val[0] = '\0';
+    else if (strlen(sort_val) >= sizeof(pos->sort_val))
+    {
+        /* can't continue after this entry */
+        pos->set = false;
+        return;
+    }
+    else
+        strcpy(pos->sort_val, sort_val);
+    pos->set = true;
+}
+
 int ListMgr_GetNext( struct lmgr_iterator_t *p_iter, entry_id_t * p_id, attr_set_t * p_info )
 {
     int            rc = 0;
-    /* can contain id+dirattr+dirattr_sort in case of directory listing */
+    /* can contain id+dirattr+dirattr_sort in case of directory listing
+     * (or id+sort value) */
     char          *idstr[3];
     DEF_PK(pk);
 
@@ -397,8 +658,16 @@ int ListMgr_GetNext( struct lmgr_iterator_t *p_iter, entry_id_t * p_id, attr_set
         entry_disappeared = false;
 
         idstr[0] = idstr[1] = idstr[2] = NULL;
-        rc = db_next_record( &p_iter->p_mgr->conn, &p_iter->select_result, idstr, 3 );
+        rc = db_next_record(iter_conn(p_iter), &p_iter->select_result, idstr, 3);
+
+        /* the end of a streamed result may be a network error */
+        if (rc == DB_END_OF_LIST && p_iter->stream)
+        {
+            int rc2 = db_stream_status(iter_conn(p_iter));
 
+            if (rc2)
+                return rc2;
+        }
         if ( rc )
             return rc;
         if ( idstr[0] == NULL )
@@ -410,6 +679,9 @@ int ListMgr_GetNext( struct lmgr_iterator_t *p_iter, entry_id_t * p_id, attr_set
         else if (rc)
             return rc;
 
+        if (p_iter->keyset)
+            set_iter_pos(p_iter, p_id, idstr[1]);
+
         rc = listmgr_get_by_pk( p_iter->p_mgr, pk, p_info );
 
         if ( rc == DB_NOT_EXISTS )
@@ -444,8 +716,17 @@ int ListMgr_GetNext( struct lmgr_iterator_t *p_iter, entry_id_t * p_id, attr_set
 }
 
 
+void ListMgr_IterPosition(const struct lmgr_iterator_t *p_iter,
+                          lmgr_iter_pos_t *pos)
+{
+    *pos = p_iter->pos;
+}
+
 void ListMgr_CloseIterator( struct lmgr_iterator_t *p_iter )
 {
-    db_result_free( &p_iter->p_mgr->conn, &p_iter->select_result );
+    if (p_iter->stream)
+        db_stream_close(&p_iter->stream_conn, &p_iter->select_result);
+    else
+        db_result_free(&p_iter->p_mgr->conn, &p_iter->select_result);
     MemFree( p_iter );
 }
@@ -0,0 +1,189 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Ignore marks of policy runs (policy run parameter ignore_mark_max_validity).
+ *
+ * When a policy run finds an entry is whitelisted or matches no rule, it
+ * records the time until which the entry can't become eligible, with the
+ * md_update of the entry at this time. Iterators with the skip_marked option
+ * don't list the entries with a mark in the future, as long as their
+ * md_update is unchanged and none of their names was updated since the mark
+ * was set: any refresh of the entry (scan, changelog, background refresh)
+ * invalidates its marks. The marks of a policy are dropped when its rules
+ * change (signature of the rules stored in VARS).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MARKS_TABLE     "POLICY_MARKS"
+/* marks per INSERT request */
+#define MARKS_ROWS      1000
+/* variable holding the rules signature of a policy marks */
+#define MARKS_VAR_PREFIX "IgnoreMarks"
+/* max length of a policy name */
+#define MARKS_POLICY_LEN    255
+
+static int marks_table_create(db_conn_t *pconn)
+{
+    return db_exec_sql(pconn, "CREATE TABLE IF NOT EXISTS " MARKS_TABLE
+                       " (policy VARCHAR(255) NOT NULL,"
+                       " id " PK_TYPE " NOT NULL,"
+                       " ignore_until INT UNSIGNED NOT NULL,"
+                       " md_update INT UNSIGNED NOT NULL,"
+                       " set_time INT UNSIGNED NOT NULL,"
+                       " PRIMARY KEY (policy, id),"
+                       " KEY (policy, ignore_until))", NULL);
+}
+
+int ListMgr_CheckIgnoreMarks(lmgr_t *p_mgr, const char *policy,
+                             const char *rules_sig)
+{
+    GString *req;
+    char     esc[2 * MARKS_POLICY_LEN + 1];
+    char     varname[MARKS_POLICY_LEN + 32];
+    char     value[MAX_VAR_LEN];
+    bool     changed;
+    int      rc;
+
+    if (strlen(policy) > MARKS_POLICY_LEN)
+        return DB_INVALID_ARG;
+
+    db_escape_string(&p_mgr->conn, esc, sizeof(esc), policy);
+    snprintf(varname, sizeof(varname), MARKS_VAR_PREFIX "_%s", policy);
+    req = g_string_new(NULL);
+
+retry:
+    rc = marks_table_create(&p_mgr->conn);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    rc = ListMgr_GetVar(p_mgr, varname, value, sizeof(value));
+    if (rc == DB_NOT_EXISTS) {
+        changed = true;
+    } else if (rc == DB_SUCCESS) {
+        changed = (strcmp(value, rules_sig) != 0);
+    } else {
+        goto free_str;
+    }
+
+    if (changed) {
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Rules of policy '%s' changed: "
+                   "dropping its ignore marks", policy);
+        g_string_printf(req, "DELETE FROM " MARKS_TABLE " WHERE policy='%s'",
+                        esc);
+    } else {
+        /* expired marks */
+        g_string_printf(req, "DELETE FROM " MARKS_TABLE " WHERE policy='%s'"
+                        " AND ignore_until<=%lu", esc,
+                        (unsigned long)time(NULL));
+    }
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    if (changed)
+        rc = ListMgr_SetVar(p_mgr, varname, rules_sig);
+
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_SetIgnoreMarks(lmgr_t *p_mgr, const char *policy,
+                           const lmgr_ignore_mark_t *marks,
+                           unsigned int count)
+{
+    GString     *req;
+    char         esc[2 * MARKS_POLICY_LEN + 1];
+    unsigned int i, n;
+    time_t       now = time(NULL);
+    int          rc = DB_SUCCESS;
+    DEF_PK(pk);
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    db_escape_string(&p_mgr->conn, esc, sizeof(esc), policy);
+    req = g_string_new(NULL);
+
+    for (i = 0, n = 0; i <= count; i++) {
+        /* flush full requests, and the last one */
+        if (n > 0 && (n == MARKS_ROWS || i == count)) {
+            g_string_append(req, " ON DUPLICATE KEY UPDATE"
+                            " ignore_until=VALUES(ignore_until),"
+                            " md_update=VALUES(md_update),"
+                            " set_time=VALUES(set_time)");
+retry:
+            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+            if (lmgr_delayed_retry(p_mgr, rc))
+                goto retry;
+            else if (rc)
+                break;
+            n = 0;
+        }
+        if (i == count)
+            break;
+
+        if (n == 0)
+            g_string_assign(req, "INSERT INTO " MARKS_TABLE
+                            " (policy,id,ignore_until,md_update,set_time)"
+                            " VALUES ");
+        else
+            g_string_append_c(req, ',');
+
+        entry_id2pk(&marks[i].id, PTR_PK(pk));
+        g_string_append_printf(req, "('%s'," DPK ",%lu,%u,%lu)", esc, pk,
+                               (unsigned long)marks[i].until,
+                               marks[i].md_update, (unsigned long)now);
+    }
+
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+void append_ignore_marks_cond(lmgr_t *p_mgr, GString *str, const char *table,
+                              const char *policy)
+{
+    char esc[2 * MARKS_POLICY_LEN + 1];
+
+    db_escape_string(&p_mgr->conn, esc, sizeof(esc), policy);
+
+    g_string_append_printf(str, "NOT EXISTS (SELECT 1 FROM " MARKS_TABLE
+                           " pm JOIN " MAIN_TABLE " pe ON pe.id=pm.id"
+                           " WHERE pm.policy='%s' AND pm.id=%s.id"
+                           " AND pm.ignore_until>%lu"
+                           " AND pe.md_update=pm.md_update"
+                           " AND NOT EXISTS (SELECT 1 FROM " DNAMES_TABLE
+                           " pn WHERE pn.id=pm.id"
+                           " AND pn.path_update>pm.set_time))",
+                           esc, table, (unsigned long)time(NULL));
+}
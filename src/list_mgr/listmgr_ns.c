@@ -91,20 +91,16 @@ int ListMgr_GetChild(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
     struct field_count filter_cnt = {0};
     table_enum         query_tab = T_DNAMES;
     bool               distinct = false;
-
-    /* XXX: querying children from several parent cannot work, since
-     * we need to get the paths of the children. Or we could do a
-     * lookup into parent_list to find the right one. In the meantime,
-     * try not to mess up the code. */
-    if (unlikely(parent_count != 1))
-        RBH_BUG("cannot get children for several parent simultaneously");
+    unsigned int       parent_idx = 0;
+    pktype            *parent_pks = NULL;
 
     /* always request for name to build fullpath in wagon */
     attr_mask_set_index(&attr_mask, ATTR_INDEX_name);
 
-    /* request is always on the DNAMES table (which contains [parent_id, id] relationship */
+    /* request is always on the DNAMES table (which contains [parent_id, id] relationship.
+     * parent_id is used to match each child to its parent (to build its path) */
 
-    req = g_string_new("SELECT "DNAMES_TABLE".id");
+    req = g_string_new("SELECT "DNAMES_TABLE".id,"DNAMES_TABLE".parent_id");
 
     /* append fields for all tables */
     if (!attr_mask_is_null(attr_mask))
@@ -174,8 +170,22 @@ int ListMgr_GetChild(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
     filter_from(p_mgr, &filter_cnt, from, &query_tab, &distinct,
                 AOF_LEADING_SEP | AOF_SKIP_NAME);
 
-    /* build the whole request */
+    /* build the whole request: children are grouped by parent */
     g_string_append_printf(req, " FROM %s WHERE %s", from->str, where->str);
+    if (parent_count > 1)
+        g_string_append(req, " ORDER BY "DNAMES_TABLE".parent_id");
+
+    if (parent_count > 1)
+    {
+        parent_pks = MemCalloc(parent_count, sizeof(pktype));
+        if (parent_pks == NULL)
+        {
+            rc = DB_NO_MEMORY;
+            goto free_str;
+        }
+        for (i = 0; i < parent_count; i++)
+            entry_id2pk(&parent_list[i].id, PTR_PK(parent_pks[i]));
+    }
 
 retry:
     rc = db_exec_sql(&p_mgr->conn, req->str, &result);
@@ -205,9 +215,12 @@ retry:
         }
     }
 
-    /* Allocate a string long enough to contain the parent path and a
-     * child name. */
-    path_len = strlen(parent_list[0].fullname) + RBH_NAME_MAX + 2;
+    /* Allocate a string long enough to contain the longest parent path
+     * and a child name. */
+    path_len = 0;
+    for (i = 0; i < parent_count; i++)
+        path_len = MAX(path_len, strlen(parent_list[i].fullname));
+    path_len += RBH_NAME_MAX + 2;
     path = malloc(path_len);
     if (!path) {
         DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Can't alloc enough memory (%d bytes)",
@@ -230,14 +243,14 @@ retry:
         /* copy attributes to array */
         if (child_attr_list)
         {
-            unsigned int shift = 1; /* first was NAMES.id */
+            unsigned int shift = 2; /* first were NAMES.id, NAMES.parent_id */
 
             (*child_attr_list)[i].attr_mask = attr_mask;
 
             /* first id, then dnames attrs, then main attrs, then annex attrs */
             if (field_cnt.nb_names > 0)
             {
-                /* shift of 1 for id */
+                /* shift of 2 for id, parent_id */
                 rc = result2attrset(T_DNAMES, res + shift, field_cnt.nb_names, &((*child_attr_list)[i]));
                 if (rc)
                     goto array_free;
@@ -247,7 +260,6 @@ retry:
             if (field_cnt.nb_main > 0)
             {
                 /* first id, then main attrs, then annex attrs */
-                /* shift of 1 for id */
                 rc = result2attrset(T_MAIN, res + shift, field_cnt.nb_main, &((*child_attr_list)[i]));
                 if (rc)
                     goto array_free;
@@ -278,8 +290,27 @@ retry:
 
             generate_fields(&((*child_attr_list)[i]));
 
+            /* children are grouped by parent: start from the last match */
+            if (parent_count > 1 && res[1] != NULL
+                && strcmp(res[1], parent_pks[parent_idx]))
+            {
+                unsigned int j;
+
+                for (j = 0; j < parent_count; j++)
+                    if (!strcmp(res[1], parent_pks[j]))
+                        break;
+                if (unlikely(j == parent_count))
+                {
+                    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Unexpected parent_id "DPK
+                               " for child "DPK" in %s()", res[1], res[0], __func__);
+                    rc = DB_REQUEST_FAILED;
+                    goto array_free;
+                }
+                parent_idx = j;
+            }
+
             /* Note: path is properly sized already to not overflow. */
-            snprintf(path, path_len, "%s/%s", parent_list[0].fullname,
+            snprintf(path, path_len, "%s/%s", parent_list[parent_idx].fullname,
                      (*child_attr_list)[i].attr_values.name);
             (*child_id_list)[i].fullname = strdup(path);
         }
@@ -287,6 +318,8 @@ retry:
 
     if (path)
         free(path);
+    if (parent_pks)
+        MemFree(parent_pks);
 
     db_result_free(&p_mgr->conn, &result);
     g_string_free(req, TRUE);
@@ -305,6 +338,8 @@ array_free:
     MemFree(*child_id_list);
     *child_id_list = NULL;
 free_str:
+    if (parent_pks)
+        MemFree(parent_pks);
     if (req != NULL)
         g_string_free(req, TRUE);
     if (from != NULL)
@@ -313,3 +348,58 @@ free_str:
         g_string_free(where, TRUE);
     return rc;
 }
+
+/**
+ * Set md_update and path_update of all children of a given directory,
+ * without changing other attributes (used by incremental scans to mark
+ * the entries of unchanged directories as seen).
+ */
+int ListMgr_TouchChildren(lmgr_t *p_mgr, const entry_id_t *parent_id,
+                          time_t update_time)
+{
+    GString *req;
+    int      rc;
+    DEF_PK(pk);
+
+    entry_id2pk(parent_id, PTR_PK(pk));
+    req = g_string_new(NULL);
+
+retry:
+    rc = lmgr_begin(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    g_string_printf(req, "UPDATE "MAIN_TABLE" SET md_update=%lu WHERE id IN "
+                    "(SELECT id FROM "DNAMES_TABLE" WHERE parent_id="DPK")",
+                    (unsigned long)update_time, pk);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    g_string_printf(req, "UPDATE "DNAMES_TABLE" SET path_update=%lu "
+                    "WHERE parent_id="DPK, (unsigned long)update_time, pk);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    rc = lmgr_commit(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    if (rc == DB_SUCCESS)
+        p_mgr->nbop[OPIDX_UPDATE]++;
+    goto free_str;
+
+rollback:
+    lmgr_rollback(p_mgr);
+free_str:
+    /* children are not known here */
+    listmgr_cache_invalidate_all();
+    g_string_free(req, TRUE);
+    return rc;
+}
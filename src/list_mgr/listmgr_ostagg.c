@@ -0,0 +1,377 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Per-OST usage aggregates (ost_aggregates = yes).
+ * OST_AGG contains, for each OST and last access bucket (days since the
+ * epoch), the count, size and blocks of the files striped on the OST.
+ * The size and blocks of a file are shared equally between its stripes.
+ * As for directory aggregates, the contribution of modified entries is
+ * read before and after their modification, and the deltas of the
+ * transaction are written when it is committed (with MySQL syntax).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+/* values of each (OST, bucket) */
+#define NB_VALS     3
+static const char *val_names[NB_VALS] = {ACCT_FIELD_COUNT, "size", "blocks"};
+
+/* rows per request when writing aggregates */
+#define FLUSH_ROWS  1000
+
+/* share of the entries on each of their OSTs, grouped by (OST, bucket) */
+#define OSTAGG_SELECT "SELECT s.ostidx,e.last_access DIV %u AS bucket," \
+    "COUNT(*),SUM(e.size DIV GREATEST(i.stripe_count,1)),"                  \
+    "SUM(e.blocks DIV GREATEST(i.stripe_count,1)) FROM "MAIN_TABLE" e JOIN " \
+    STRIPE_INFO_TABLE" i ON e.id=i.id JOIN "STRIPE_ITEMS_TABLE" s"          \
+    " ON e.id=s.id WHERE e.type='"STR_TYPE_FILE"'"
+
+struct ost_delta {
+    char       *key;    /* SQL values of the key: "ost,bucket" */
+    long long   d[NB_VALS];
+};
+
+static void delta_free(gpointer p)
+{
+    struct ost_delta *delta = p;
+
+    g_free(delta->key);
+    MemFree(delta);
+}
+
+/** add values to the delta of an (OST, bucket) */
+static int delta_add(GHashTable *hash, const char *ost, const char *bucket,
+                     const long long *d)
+{
+    struct ost_delta *delta;
+    char *key;
+    int i;
+
+    key = g_strdup_printf("%s,%s", ost, bucket);
+    delta = g_hash_table_lookup(hash, key);
+    if (delta == NULL)
+    {
+        delta = MemCalloc(1, sizeof(*delta));
+        if (delta == NULL)
+        {
+            g_free(key);
+            return DB_NO_MEMORY;
+        }
+        delta->key = key;
+        g_hash_table_insert(hash, delta->key, delta);
+    }
+    else
+        g_free(key);
+
+    for (i = 0; i < NB_VALS; i++)
+        delta->d[i] += d[i];
+    return DB_SUCCESS;
+}
+
+int listmgr_ostagg_delta(lmgr_t *p_mgr, const char *where, int sign)
+{
+    GString        *req;
+    result_handle_t result;
+    char           *res[2 + NB_VALS];
+    int             i, rc;
+
+    if (!lmgr_config.ost_agg)
+        return DB_SUCCESS;
+
+    if (p_mgr->ost_deltas == NULL)
+        p_mgr->ost_deltas = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  NULL, delta_free);
+
+    req = g_string_new(NULL);
+    g_string_printf(req, OSTAGG_SELECT" AND e.id IN (SELECT id FROM "
+                    MAIN_TABLE" WHERE %s) GROUP BY s.ostidx,bucket",
+                    OST_AGG_BUCKET, where);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 2 + NB_VALS))
+           == DB_SUCCESS)
+    {
+        long long d[NB_VALS];
+
+        if (res[0] == NULL)
+            continue;
+
+        for (i = 0; i < NB_VALS; i++)
+            d[i] = res[2 + i] ? sign * strtoll(res[2 + i], NULL, 10) : 0;
+
+        /* entries never accessed are in bucket 0 */
+        rc = delta_add(p_mgr->ost_deltas, res[0], res[1] ? res[1] : "0", d);
+        if (rc)
+            break;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc == DB_END_OF_LIST)
+        rc = DB_SUCCESS;
+    return rc;
+}
+
+static int flush_rows(lmgr_t *p_mgr, GString *req, unsigned int *nb_rows)
+{
+    int i, rc;
+
+    if (*nb_rows == 0)
+        return DB_SUCCESS;
+
+    g_string_append(req, " ON DUPLICATE KEY UPDATE ");
+    for (i = 0; i < NB_VALS; i++)
+        g_string_append_printf(req, "%s%s=%s+VALUES(%s)", i == 0 ? "" : ",",
+                               val_names[i], val_names[i], val_names[i]);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    *nb_rows = 0;
+    return rc;
+}
+
+int listmgr_ostagg_flush(lmgr_t *p_mgr)
+{
+    GList       *keys, *l;
+    GString     *ins;
+    unsigned int nb_rows = 0;
+    bool         empty = false;
+    int          i, rc = DB_SUCCESS;
+
+    if (p_mgr->ost_deltas == NULL
+        || g_hash_table_size(p_mgr->ost_deltas) == 0)
+        return DB_SUCCESS;
+
+    /* all connections update keys in the same order (avoid deadlocks) */
+    keys = g_list_sort(g_hash_table_get_keys(p_mgr->ost_deltas),
+                       (GCompareFunc)strcmp);
+
+    ins = g_string_new(NULL);
+
+    for (l = keys; l != NULL; l = l->next)
+    {
+        struct ost_delta *delta = g_hash_table_lookup(p_mgr->ost_deltas,
+                                                      l->data);
+        bool null = true;
+
+        for (i = 0; i < NB_VALS; i++)
+            if (delta->d[i] != 0)
+                null = false;
+        /* e.g. entry updated without changing its aggregates */
+        if (null)
+            continue;
+
+        if (nb_rows == 0)
+        {
+            g_string_assign(ins, "INSERT INTO "OSTAGG_TABLE"(ost_idx,bucket");
+            for (i = 0; i < NB_VALS; i++)
+                g_string_append_printf(ins, ",%s", val_names[i]);
+            g_string_append(ins, ") VALUES ");
+        }
+        g_string_append_printf(ins, "%s(%s", nb_rows == 0 ? "" : ",",
+                               delta->key);
+        for (i = 0; i < NB_VALS; i++)
+            g_string_append_printf(ins, ",%lld", delta->d[i]);
+        g_string_append_c(ins, ')');
+
+        /* rows that may become empty */
+        if (delta->d[0] < 0)
+            empty = true;
+
+        if (++nb_rows >= FLUSH_ROWS)
+        {
+            rc = flush_rows(p_mgr, ins, &nb_rows);
+            if (rc)
+                goto out;
+        }
+    }
+    rc = flush_rows(p_mgr, ins, &nb_rows);
+    if (rc == DB_SUCCESS && empty)
+        rc = db_exec_sql(&p_mgr->conn, "DELETE FROM "OSTAGG_TABLE" WHERE "
+                         ACCT_FIELD_COUNT"<=0", NULL);
+
+out:
+    g_list_free(keys);
+    g_string_free(ins, TRUE);
+    /* on error, the transaction is aborted: deltas are obsolete */
+    g_hash_table_remove_all(p_mgr->ost_deltas);
+    return rc;
+}
+
+void listmgr_ostagg_discard(lmgr_t *p_mgr)
+{
+    if (p_mgr->ost_deltas != NULL)
+        g_hash_table_remove_all(p_mgr->ost_deltas);
+}
+
+void listmgr_ostagg_close(lmgr_t *p_mgr)
+{
+    if (p_mgr->ost_deltas != NULL)
+    {
+        g_hash_table_destroy(p_mgr->ost_deltas);
+        p_mgr->ost_deltas = NULL;
+    }
+}
+
+int listmgr_ostagg_rebuild(db_conn_t *pconn)
+{
+    GString *req;
+    int      rc;
+
+    if (!lmgr_config.ost_agg)
+        return DB_SUCCESS;
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Computing OST aggregates "
+               "from existing DB contents. This can take a while...");
+    FlushLogs();
+
+    rc = db_exec_sql(pconn, "DELETE FROM "OSTAGG_TABLE, NULL);
+    if (rc)
+        return rc;
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "INSERT INTO "OSTAGG_TABLE"(ost_idx,bucket,%s,size,"
+                    "blocks) "OSTAGG_SELECT" GROUP BY s.ostidx,bucket",
+                    ACCT_FIELD_COUNT, OST_AGG_BUCKET);
+    rc = db_exec_sql(pconn, req->str, NULL);
+    if (rc)
+    {
+        char err_buf[1024];
+
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Failed to compute OST "
+                   "aggregates: Error: %s",
+                   db_errmsg(pconn, err_buf, sizeof(err_buf)));
+    }
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_GetOSTAgg(lmgr_t *p_mgr, int ost_index, ost_agg_t **p_tab,
+                      unsigned int *p_count)
+{
+    result_handle_t result;
+    char            req[512];
+    char           *res[2 + NB_VALS];
+    ost_agg_t      *tab = NULL;
+    unsigned int    n = 0, max = 0;
+    int             rc;
+
+    if (!lmgr_config.ost_agg)
+        return DB_NOT_SUPPORTED;
+
+    if (ost_index >= 0)
+        snprintf(req, sizeof(req), "SELECT ost_idx,bucket,%s,size,blocks"
+                 " FROM "OSTAGG_TABLE" WHERE ost_idx=%d ORDER BY bucket",
+                 ACCT_FIELD_COUNT, ost_index);
+    else
+        snprintf(req, sizeof(req), "SELECT ost_idx,0,SUM(%s),SUM(size),"
+                 "SUM(blocks) FROM "OSTAGG_TABLE" GROUP BY ost_idx"
+                 " ORDER BY ost_idx", ACCT_FIELD_COUNT);
+
+retry:
+    rc = db_exec_sql(&p_mgr->conn, req, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 2 + NB_VALS))
+           == DB_SUCCESS)
+    {
+        if (res[0] == NULL || res[1] == NULL)
+            continue;
+
+        if (n == max)
+        {
+            unsigned int new_max = max ? 2 * max : 256;
+            ost_agg_t *new_tab = MemRealloc(tab, new_max * sizeof(*tab));
+
+            if (new_tab == NULL)
+            {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            tab = new_tab;
+            max = new_max;
+        }
+
+        tab[n].ost_index = strtoul(res[0], NULL, 10);
+        tab[n].bucket = strtoul(res[1], NULL, 10);
+        tab[n].count = res[2] ? strtoull(res[2], NULL, 10) : 0;
+        tab[n].size = res[3] ? strtoull(res[3], NULL, 10) : 0;
+        tab[n].blocks = res[4] ? strtoull(res[4], NULL, 10) : 0;
+        n++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc != DB_END_OF_LIST)
+    {
+        if (tab != NULL)
+            MemFree(tab);
+        return rc;
+    }
+
+    *p_tab = tab;
+    *p_count = n;
+    return DB_SUCCESS;
+}
+
+int ListMgr_OSTAggBound(lmgr_t *p_mgr, unsigned int ost_index,
+                        uint64_t blocks, unsigned int *p_bound)
+{
+    ost_agg_t   *tab = NULL;
+    unsigned int i, n = 0;
+    uint64_t     sum = 0;
+    int          rc;
+
+    rc = ListMgr_GetOSTAgg(p_mgr, ost_index, &tab, &n);
+    if (rc)
+        return rc;
+
+    rc = DB_NOT_EXISTS;
+    for (i = 0; i < n; i++)
+    {
+        sum += tab[i].blocks;
+        if (sum >= blocks)
+        {
+            /* no bound if it includes the most recent files */
+            if (i < n - 1)
+            {
+                *p_bound = (tab[i].bucket + 1) * OST_AGG_BUCKET;
+                rc = DB_SUCCESS;
+            }
+            break;
+        }
+    }
+
+    if (tab != NULL)
+        MemFree(tab);
+    return rc;
+}
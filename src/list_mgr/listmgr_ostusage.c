@@ -0,0 +1,191 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * History of OST usage, sampled by the daemon every ost_history_interval.
+ * Samples are stored in the OST_USAGE_HISTORY table, as
+ * (time, ost_idx, size, used, avail), and pruned after
+ * ost_history_retention.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#define OSTHIST_TABLE   "OST_USAGE_HISTORY"
+/* rows per INSERT request */
+#define OSTHIST_ROWS    500
+
+static int osthist_table_create(db_conn_t *pconn)
+{
+    return db_exec_sql(pconn, "CREATE TABLE IF NOT EXISTS " OSTHIST_TABLE
+                       " (time INT UNSIGNED NOT NULL,"
+                       " ost_idx INT UNSIGNED NOT NULL,"
+                       " size BIGINT UNSIGNED, used BIGINT UNSIGNED,"
+                       " avail BIGINT UNSIGNED,"
+                       " PRIMARY KEY (ost_idx, time))", NULL);
+}
+
+int ListMgr_StoreOSTUsage(lmgr_t *p_mgr, time_t when,
+                          const ost_usage_sample_t *samples,
+                          unsigned int count)
+{
+    GString     *req;
+    time_t       retention = lmgr_ost_history_retention();
+    unsigned int i;
+    int          rc;
+
+    req = g_string_new(NULL);
+
+retry:
+    rc = osthist_table_create(&p_mgr->conn);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    rc = lmgr_begin(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    /* replace samples taken in the same second */
+    g_string_printf(req, "DELETE FROM " OSTHIST_TABLE " WHERE time=%lu",
+                    (unsigned long)when);
+    if (retention > 0 && when > retention)
+        g_string_append_printf(req, " OR time<%lu",
+                               (unsigned long)(when - retention));
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    for (i = 0; i < count; i++) {
+        if (i % OSTHIST_ROWS == 0)
+            g_string_assign(req, "INSERT INTO " OSTHIST_TABLE
+                            " (time,ost_idx,size,used,avail) VALUES ");
+        else
+            g_string_append_c(req, ',');
+
+        g_string_append_printf(req, "(%lu,%u,%"PRIu64",%"PRIu64",%"PRIu64")",
+                               (unsigned long)when, samples[i].ost_index,
+                               samples[i].size, samples[i].used,
+                               samples[i].avail);
+
+        if (i % OSTHIST_ROWS == OSTHIST_ROWS - 1 || i == count - 1) {
+            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+            if (lmgr_delayed_retry(p_mgr, rc))
+                goto retry;
+            else if (rc)
+                goto rollback;
+        }
+    }
+
+    rc = lmgr_commit(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    goto free_str;
+
+rollback:
+    lmgr_rollback(p_mgr);
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_GetOSTUsageHistory(lmgr_t *p_mgr, unsigned int ost_index,
+                               time_t since, time_t **p_times,
+                               ost_usage_sample_t **p_samples,
+                               unsigned int *p_count)
+{
+    result_handle_t     result;
+    char                req[256];
+    char               *res[4];
+    time_t             *times = NULL;
+    ost_usage_sample_t *samples = NULL;
+    unsigned int        n = 0, max = 0;
+    int                 rc;
+
+    snprintf(req, sizeof(req), "SELECT time,size,used,avail FROM "
+             OSTHIST_TABLE " WHERE ost_idx=%u AND time>=%lu ORDER BY time",
+             ost_index, (unsigned long)since);
+
+retry:
+    /* the table does not exist if no sample was stored */
+    rc = db_exec_sql_quiet(&p_mgr->conn, req, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 4))
+           == DB_SUCCESS) {
+        if (res[0] == NULL || res[1] == NULL || res[2] == NULL
+            || res[3] == NULL)
+            continue;
+
+        if (n == max) {
+            unsigned int new_max = max ? 2 * max : 256;
+            time_t *new_times = MemRealloc(times, new_max * sizeof(*times));
+            ost_usage_sample_t *new_samples;
+
+            if (new_times == NULL) {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            times = new_times;
+            new_samples = MemRealloc(samples, new_max * sizeof(*samples));
+            if (new_samples == NULL) {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            samples = new_samples;
+            max = new_max;
+        }
+
+        times[n] = strtoul(res[0], NULL, 10);
+        samples[n].ost_index = ost_index;
+        samples[n].size = strtoull(res[1], NULL, 10);
+        samples[n].used = strtoull(res[2], NULL, 10);
+        samples[n].avail = strtoull(res[3], NULL, 10);
+        n++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc != DB_END_OF_LIST) {
+        if (times != NULL)
+            MemFree(times);
+        if (samples != NULL)
+            MemFree(samples);
+        return rc;
+    }
+
+    *p_times = times;
+    *p_samples = samples;
+    *p_count = n;
+    return DB_SUCCESS;
+}
@@ -0,0 +1,311 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Client side resolution of full paths, from parent_id and name, with a
+ * cache of directory paths. This avoids calling the recursive this_path()
+ * DB function for each entry, which walks the NAMES table up to the root.
+ *
+ * The cache maps directory ids to their path in DB format ("<root_pk>/a/b").
+ * Only complete paths are cached, and the parent of a cached directory is
+ * always cached (or is the root): when a directory is renamed or removed,
+ * its children can only be cached if it is cached too. So the whole cache
+ * is dropped when a cached directory is modified, and when it is full.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+
+/* max depth of a path (protection against loops in the namespace) */
+#define MAX_DEPTH   1024
+
+static pthread_mutex_t      path_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable          *path_hash = NULL;
+/* incremented when the cache is dropped or an entry is modified:
+ * the paths read from the DB are not cached if it changed meanwhile */
+static unsigned long long   path_gen = 0;
+
+static unsigned long long   path_hits = 0;
+static unsigned long long   path_misses = 0;
+
+void listmgr_path_init(void)
+{
+    if (lmgr_config.path_cache_size == 0 || path_hash != NULL)
+        return;
+
+    path_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+bool listmgr_path_enabled(void)
+{
+    return path_hash != NULL;
+}
+
+static bool cache_lookup(const char *pk, char *path, size_t size)
+{
+    const char *cached;
+
+    P(path_lock);
+    cached = g_hash_table_lookup(path_hash, pk);
+    if (cached != NULL)
+    {
+        rh_strncpy(path, cached, size);
+        path_hits++;
+    }
+    else
+        path_misses++;
+    V(path_lock);
+
+    return cached != NULL;
+}
+
+/** @return false if the path was not inserted */
+static bool cache_insert(const char *pk, const char *path,
+                         unsigned long long gen)
+{
+    bool inserted = false;
+
+    P(path_lock);
+    if (path_gen != gen)
+        goto out;
+
+    /* start over: the inserted entry would not have its parent cached */
+    if (g_hash_table_size(path_hash) >= lmgr_config.path_cache_size)
+    {
+        g_hash_table_remove_all(path_hash);
+        path_gen++;
+        goto out;
+    }
+
+    g_hash_table_insert(path_hash, g_strdup(pk), g_strdup(path));
+    inserted = true;
+out:
+    V(path_lock);
+    return inserted;
+}
+
+/** get the most recent parent and name of an entry */
+static int get_name(lmgr_t *p_mgr, const char *pk, char *parent_pk,
+                    char **name)
+{
+    char           *res[2];
+    result_handle_t result;
+    GString        *req;
+    int             rc;
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT parent_id,name FROM "DNAMES_TABLE" WHERE id="
+                    DPK" ORDER BY path_update DESC LIMIT 1", pk);
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    rc = db_next_record(&p_mgr->conn, &result, res, 2);
+    if (rc == DB_END_OF_LIST)
+        rc = DB_NOT_EXISTS;
+    else if (rc == DB_SUCCESS)
+    {
+        if (res[0] == NULL || res[1] == NULL)
+            rc = DB_NOT_EXISTS;
+        else
+        {
+            rh_strncpy(parent_pk, res[0], PK_LEN);
+            *name = strdup(res[1]);
+            if (*name == NULL)
+                rc = DB_NO_MEMORY;
+        }
+    }
+    db_result_free(&p_mgr->conn, &result);
+    return rc;
+}
+
+/**
+ * Get the path of a directory in DB format, like this_path():
+ * the walk stops at the first ancestor with no name in the DB.
+ */
+static int dir_path(lmgr_t *p_mgr, const char *dir_pk, char *path,
+                    size_t size)
+{
+    char              **pks;
+    char              **names;
+    unsigned int        depth = 0, i;
+    unsigned long long  gen;
+    bool                complete = true;
+    int                 rc = DB_SUCCESS;
+    DEF_PK(cur);
+    DEF_PK(parent);
+    DEF_PK(root_pk);
+
+    P(path_lock);
+    gen = path_gen;
+    V(path_lock);
+
+    if (cache_lookup(dir_pk, path, size))
+        return DB_SUCCESS;
+
+    pks = MemCalloc(MAX_DEPTH, sizeof(*pks));
+    names = MemCalloc(MAX_DEPTH, sizeof(*names));
+    if (pks == NULL || names == NULL)
+    {
+        rc = DB_NO_MEMORY;
+        goto out;
+    }
+
+    entry_id2pk(get_root_id(), PTR_PK(root_pk));
+    rh_strncpy(cur, dir_pk, sizeof(cur));
+
+    for (;;)
+    {
+        if (depth > 0 && cache_lookup(cur, path, size))
+            break;
+
+        if (depth >= MAX_DEPTH)
+        {
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Path of "DPK" is deeper than "
+                       "%u levels: loop in namespace?", dir_pk, MAX_DEPTH);
+            rc = DB_REQUEST_FAILED;
+            goto out;
+        }
+
+        rc = get_name(p_mgr, cur, parent, &names[depth]);
+        if (rc == DB_NOT_EXISTS)
+        {
+            /* incomplete paths are returned as is, but not cached */
+            rh_strncpy(path, cur, size);
+            complete = !strcmp(cur, root_pk);
+            rc = DB_SUCCESS;
+            break;
+        }
+        else if (rc)
+            goto out;
+
+        pks[depth] = strdup(cur);
+        if (pks[depth] == NULL)
+        {
+            rc = DB_NO_MEMORY;
+            goto out;
+        }
+        depth++;
+        rh_strncpy(cur, parent, sizeof(cur));
+    }
+
+    /* build the path from the top, and cache each level */
+    for (i = depth; i > 0; i--)
+    {
+        size_t len = strlen(path);
+
+        if (len + strlen(names[i-1]) + 2 > size)
+        {
+            rc = DB_BUFFER_TOO_SMALL;
+            goto out;
+        }
+        sprintf(path + len, "/%s", names[i-1]);
+
+        if (complete)
+            complete = cache_insert(pks[i-1], path, gen);
+    }
+
+out:
+    for (i = 0; i < MAX_DEPTH && pks != NULL && names != NULL; i++)
+    {
+        if (pks[i] == NULL && names[i] == NULL)
+            break;
+        free(pks[i]);
+        free(names[i]);
+    }
+    MemFree(pks);
+    MemFree(names);
+    return rc;
+}
+
+int listmgr_path_resolve(lmgr_t *p_mgr, attr_set_t *p_set)
+{
+    char path[RBH_PATH_MAX];
+    size_t len;
+    int rc;
+    DEF_PK(parent_pk);
+
+    if (!ATTR_MASK_TEST(p_set, parent_id) || !ATTR_MASK_TEST(p_set, name))
+        return DB_SUCCESS;
+
+    entry_id2pk(&ATTR(p_set, parent_id), PTR_PK(parent_pk));
+    rc = dir_path(p_mgr, parent_pk, path, sizeof(path));
+    if (rc)
+        return rc;
+
+    len = strlen(path);
+    if (len + strlen(ATTR(p_set, name)) + 2 > sizeof(path))
+        return DB_BUFFER_TOO_SMALL;
+    sprintf(path + len, "/%s", ATTR(p_set, name));
+
+    fullpath_db2attr(path, ATTR(p_set, fullpath));
+    ATTR_MASK_SET(p_set, fullpath);
+    return DB_SUCCESS;
+}
+
+void listmgr_path_invalidate(const entry_id_t *p_id)
+{
+    DEF_PK(pk);
+
+    if (path_hash == NULL)
+        return;
+
+    entry_id2pk(p_id, PTR_PK(pk));
+
+    P(path_lock);
+    path_gen++;
+    if (g_hash_table_lookup(path_hash, pk) != NULL)
+        g_hash_table_remove_all(path_hash);
+    V(path_lock);
+}
+
+void listmgr_path_invalidate_all(void)
+{
+    if (path_hash == NULL)
+        return;
+
+    P(path_lock);
+    path_gen++;
+    g_hash_table_remove_all(path_hash);
+    V(path_lock);
+}
+
+void ListMgr_PathCacheDumpStats(void)
+{
+    unsigned long long total;
+
+    if (path_hash == NULL)
+        return;
+
+    P(path_lock);
+    total = path_hits + path_misses;
+    DisplayLog(LVL_MAJOR, "STATS", "Path cache: %u/%u directories, "
+               "hit ratio: %.1f%% (%llu/%llu)", g_hash_table_size(path_hash),
+               lmgr_config.path_cache_size,
+               total ? 100.0 * path_hits / total : 0.0, path_hits, total);
+    V(path_lock);
+}
@@ -0,0 +1,183 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Pool of DB connections shared by threads that only access the DB from
+ * time to time (policy workers, stats...). Instead of holding a connection
+ * for their whole life, they check one out for each operation.
+ * Connections are opened on demand, so the pool grows up to the max
+ * number of concurrent operations (or connection_pool_size).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_cond = PTHREAD_COND_INITIALIZER;
+static GSList         *pool_idle = NULL;
+/* connections opened by the pool (idle or checked out) */
+static unsigned int    pool_count = 0;
+static unsigned int    pool_busy = 0;
+
+static unsigned int       pool_peak = 0;
+static unsigned long long pool_checkouts = 0;
+static unsigned long long pool_waits = 0;
+static unsigned long long pool_wait_usec = 0;
+static unsigned long long pool_max_wait_usec = 0;
+static unsigned long long pool_errors = 0;
+
+lmgr_t *ListMgr_Checkout(void)
+{
+    lmgr_t         *p_mgr = NULL;
+    struct timeval  start, end;
+    bool            waited = false;
+
+    P(pool_lock);
+    while (pool_idle == NULL && lmgr_config.pool_size != 0
+           && pool_count >= lmgr_config.pool_size)
+    {
+        if (!waited)
+        {
+            gettimeofday(&start, NULL);
+            waited = true;
+        }
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+
+    if (waited)
+    {
+        unsigned long long usec;
+
+        gettimeofday(&end, NULL);
+        usec = (end.tv_sec - start.tv_sec) * 1000000ULL
+               + end.tv_usec - start.tv_usec;
+        pool_waits++;
+        pool_wait_usec += usec;
+        if (usec > pool_max_wait_usec)
+            pool_max_wait_usec = usec;
+    }
+
+    if (pool_idle != NULL)
+    {
+        p_mgr = pool_idle->data;
+        pool_idle = g_slist_delete_link(pool_idle, pool_idle);
+    }
+    /* reserve a slot for the new connection */
+    else
+        pool_count++;
+
+    pool_busy++;
+    if (pool_busy > pool_peak)
+        pool_peak = pool_busy;
+    pool_checkouts++;
+    V(pool_lock);
+
+    if (p_mgr != NULL)
+        return p_mgr;
+
+    /* connect out of the lock */
+    p_mgr = MemAlloc(sizeof(*p_mgr));
+    if (p_mgr != NULL && ListMgr_InitAccess(p_mgr) != DB_SUCCESS)
+    {
+        MemFree(p_mgr);
+        p_mgr = NULL;
+    }
+
+    if (p_mgr == NULL)
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Could not open a connection for the connection pool");
+        P(pool_lock);
+        pool_count--;
+        pool_busy--;
+        pool_errors++;
+        pthread_cond_signal(&pool_cond);
+        V(pool_lock);
+    }
+    return p_mgr;
+}
+
+void ListMgr_Release(lmgr_t *p_mgr)
+{
+    bool close_it;
+
+    /* don't leave a pending transaction to the next user */
+    ListMgr_FlushCommit(p_mgr, true);
+
+    P(pool_lock);
+    pool_busy--;
+    /* the pool was shrunk */
+    close_it = (lmgr_config.pool_size != 0
+                && pool_count > lmgr_config.pool_size);
+    if (close_it)
+        pool_count--;
+    else
+        pool_idle = g_slist_prepend(pool_idle, p_mgr);
+    pthread_cond_signal(&pool_cond);
+    V(pool_lock);
+
+    if (close_it)
+    {
+        ListMgr_CloseAccess(p_mgr);
+        MemFree(p_mgr);
+    }
+}
+
+void ListMgr_PoolClose(void)
+{
+    GSList *idle, *l;
+
+    P(pool_lock);
+    idle = pool_idle;
+    pool_idle = NULL;
+    pool_count -= g_slist_length(idle);
+    V(pool_lock);
+
+    for (l = idle; l != NULL; l = l->next)
+    {
+        ListMgr_CloseAccess(l->data);
+        MemFree(l->data);
+    }
+    g_slist_free(idle);
+}
+
+void ListMgr_PoolDumpStats(void)
+{
+    P(pool_lock);
+    if (pool_checkouts > 0)
+    {
+        DisplayLog(LVL_MAJOR, "STATS", "Connection pool: %u connections "
+                   "(%u in use, peak: %u, max: %u), %llu checkouts, "
+                   "%llu errors", pool_count, pool_busy, pool_peak,
+                   lmgr_config.pool_size, pool_checkouts, pool_errors);
+        if (pool_waits > 0)
+            DisplayLog(LVL_MAJOR, "STATS", "Connection pool: %llu waits, "
+                       "avg: %.2fms, max: %.2fms", pool_waits,
+                       pool_wait_usec / (1000.0 * pool_waits),
+                       pool_max_wait_usec / 1000.0);
+    }
+    V(pool_lock);
+}
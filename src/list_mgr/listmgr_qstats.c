@@ -0,0 +1,276 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Statistics of DB query times, by query template (the SQL request with
+ * its literals replaced by '?') and by caller function.
+ * Query times are accounted in power-of-2 buckets (in microseconds),
+ * to estimate their distribution.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <sys/time.h>
+
+/* max length of a query template */
+#define TEMPLATE_MAX    256
+/* max number of distinct templates and callers */
+#define MAX_TEMPLATES   256
+#define MAX_CALLERS     64
+/* query time buckets: [2^(i-1), 2^i[ microseconds */
+#define TIME_BUCKETS    32
+/* number of templates and callers in stats dumps */
+#define DUMP_TOP        10
+
+struct query_stats {
+    const char         *name;
+    unsigned long long  count;
+    unsigned long long  total_usec;
+    unsigned long long  max_usec;
+    unsigned long long  buckets[TIME_BUCKETS];
+};
+
+static pthread_mutex_t    stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable        *templates = NULL;
+static unsigned int       nb_templates = 0;
+static struct query_stats other_templates = {.name = "(others)"};
+static GHashTable        *callers = NULL;
+static unsigned int       nb_callers = 0;
+static struct query_stats other_callers = {.name = "(others)"};
+
+/**
+ * Build the template of a query: strings and numbers are replaced
+ * by '?', and lists of values are reduced to a single value.
+ */
+static void query_template(const char *query, char *tmpl, size_t size)
+{
+    const char *c = query;
+    size_t      len = 0;
+
+    while (*c != '\0' && len < size - 1)
+    {
+        bool literal = false;
+
+        if (*c == '\'' || *c == '"')
+        {
+            char quote = *c;
+
+            for (c++; *c != '\0' && *c != quote; c++)
+                if (*c == '\\' && c[1] != '\0')
+                    c++;
+            if (*c != '\0')
+                c++;
+            literal = true;
+        }
+        else if ((isdigit(*c) || (*c == '-' && isdigit(c[1])))
+                 && (len == 0 || !(isalnum(tmpl[len-1]) || tmpl[len-1] == '_'
+                                   || tmpl[len-1] == '.')))
+        {
+            for (c++; isalnum(*c) || *c == '.'; c++)
+                ;
+            literal = true;
+        }
+
+        if (literal)
+        {
+            /* "?,?" -> "?" */
+            if (len >= 2 && tmpl[len-1] == ',' && tmpl[len-2] == '?')
+                len--;
+            else if (len >= 3 && tmpl[len-1] == ' ' && tmpl[len-2] == ','
+                     && tmpl[len-3] == '?')
+                len -= 2;
+            else
+                tmpl[len++] = '?';
+            continue;
+        }
+
+        /* collapse spaces */
+        if (isspace(*c))
+        {
+            if (len > 0 && tmpl[len-1] != ' ')
+                tmpl[len++] = ' ';
+            c++;
+            continue;
+        }
+        tmpl[len++] = *c++;
+    }
+    tmpl[len] = '\0';
+
+    /* multi-row values: "(?,?),(?,?)" -> "(?,?)" */
+    for (c = strstr(tmpl, "),("); c != NULL; c = strstr(c, "),("))
+    {
+        char  *next = (char *)c + 2;
+        char  *start = memrchr(tmpl, '(', c - tmpl);
+
+        if (start != NULL && !strncmp(start, next, c - start + 1))
+            memmove(next - 1, next + (c - start + 1),
+                    strlen(next + (c - start + 1)) + 1);
+        else
+            c++;
+    }
+}
+
+/* must be called with stats_lock held */
+static struct query_stats *stats_get(GHashTable **p_hash, unsigned int *p_nb,
+                                     unsigned int max, struct query_stats *other,
+                                     const char *name)
+{
+    struct query_stats *stats;
+
+    if (*p_hash == NULL)
+        *p_hash = g_hash_table_new(g_str_hash, g_str_equal);
+
+    stats = g_hash_table_lookup(*p_hash, name);
+    if (stats != NULL)
+        return stats;
+
+    if (*p_nb >= max)
+        return other;
+
+    stats = MemCalloc(1, sizeof(*stats));
+    if (stats == NULL)
+        return other;
+    stats->name = strdup(name);
+    if (stats->name == NULL) {
+        MemFree(stats);
+        return other;
+    }
+    g_hash_table_insert(*p_hash, (char *)stats->name, stats);
+    (*p_nb)++;
+    return stats;
+}
+
+static void stats_add(struct query_stats *stats, unsigned long long usec)
+{
+    unsigned int b = 0;
+
+    while (b < TIME_BUCKETS - 1 && (1ULL << b) <= usec)
+        b++;
+
+    stats->count++;
+    stats->total_usec += usec;
+    if (usec > stats->max_usec)
+        stats->max_usec = usec;
+    stats->buckets[b]++;
+}
+
+void db_query_stats_add(const char *query, const char *caller,
+                        const struct timeval *start)
+{
+    struct timeval end;
+    unsigned long long usec;
+    char tmpl[TEMPLATE_MAX];
+
+    if (!lmgr_config.query_stats && lmgr_config.slow_query_time <= 0.0)
+        return;
+
+    gettimeofday(&end, NULL);
+    usec = (end.tv_sec - start->tv_sec) * 1000000ULL
+           + end.tv_usec - start->tv_usec;
+
+    if (lmgr_config.slow_query_time > 0.0
+        && usec >= lmgr_config.slow_query_time * 1000000.0)
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Slow query (%.3fs) in %s(): %s",
+                   usec / 1000000.0, caller, query);
+
+    if (!lmgr_config.query_stats)
+        return;
+
+    query_template(query, tmpl, sizeof(tmpl));
+
+    P(stats_lock);
+    stats_add(stats_get(&templates, &nb_templates, MAX_TEMPLATES,
+                        &other_templates, tmpl), usec);
+    stats_add(stats_get(&callers, &nb_callers, MAX_CALLERS, &other_callers,
+                        caller), usec);
+    V(stats_lock);
+}
+
+/** estimate a percentile (upper bound of its bucket) */
+static unsigned long long percentile_usec(const struct query_stats *stats,
+                                          unsigned int pct)
+{
+    unsigned long long seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < TIME_BUCKETS; b++) {
+        seen += stats->buckets[b];
+        if (seen * 100 >= stats->count * pct)
+            break;
+    }
+    /* the last bucket is not bounded */
+    if (b >= TIME_BUCKETS - 1)
+        return stats->max_usec;
+    return MIN(1ULL << b, stats->max_usec);
+}
+
+/* sort stats by decreasing total time */
+static gint cmp_total(gconstpointer a, gconstpointer b)
+{
+    const struct query_stats *sa = a;
+    const struct query_stats *sb = b;
+
+    if (sa->total_usec == sb->total_usec)
+        return 0;
+    return sa->total_usec > sb->total_usec ? -1 : 1;
+}
+
+static void dump_stats(const char *title, GHashTable *hash,
+                       const struct query_stats *other)
+{
+    GList *list, *l;
+    unsigned int i;
+
+    list = g_list_sort(g_hash_table_get_values(hash), cmp_total);
+    if (other->count > 0)
+        list = g_list_insert_sorted(list, (gpointer)other, cmp_total);
+
+    DisplayLog(LVL_MAJOR, "STATS", "%s (top %u by total time):", title,
+               DUMP_TOP);
+    for (l = list, i = 0; l != NULL && i < DUMP_TOP; l = l->next, i++) {
+        const struct query_stats *stats = l->data;
+
+        DisplayLog(LVL_MAJOR, "STATS", "    %llu req, total: %.3fs, "
+                   "avg: %.2fms, p99: %.2fms, max: %.2fms: %s", stats->count,
+                   stats->total_usec / 1000000.0,
+                   stats->total_usec / (1000.0 * stats->count),
+                   percentile_usec(stats, 99) / 1000.0,
+                   stats->max_usec / 1000.0, stats->name);
+    }
+    g_list_free(list);
+}
+
+void ListMgr_QueryDumpStats(void)
+{
+    if (!lmgr_config.query_stats)
+        return;
+
+    P(stats_lock);
+    if (templates != NULL && callers != NULL) {
+        dump_stats("DB queries by template", templates, &other_templates);
+        dump_stats("DB queries by caller", callers, &other_callers);
+    }
+    V(stats_lock);
+}
@@ -29,22 +29,109 @@
 #include <pthread.h>
 
 
+/** commit the current batch of a mass removal, and start a new one */
+static int batch_commit(lmgr_t *p_mgr)
+{
+    int rc;
+
+    rc = lmgr_commit(p_mgr);
+    if (rc)
+        return rc;
+    return lmgr_begin(p_mgr);
+}
+
+/** delete names matching a filter by batches of names, in pkn order */
+static int clean_names_batch(lmgr_t *p_mgr, const char *filter,
+                             unsigned int batch)
+{
+    GString        *req, *del;
+    result_handle_t result;
+    char           *field_tab[1];
+    char            last[64] = "";
+    unsigned long long total = 0;
+    unsigned int    nb;
+    int             rc;
+
+    req = g_string_new(NULL);
+    del = g_string_new(NULL);
+
+    do
+    {
+        /* pkn is a hex string */
+        g_string_printf(req, "SELECT pkn FROM "DNAMES_TABLE" WHERE (%s)",
+                        filter);
+        if (!EMPTY_STRING(last))
+            g_string_append_printf(req, " AND pkn>'%s'", last);
+        g_string_append_printf(req, " ORDER BY pkn LIMIT %u", batch);
+
+        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+        if (rc)
+            goto out;
+
+        g_string_assign(del, "DELETE FROM "DNAMES_TABLE" WHERE pkn IN (");
+        nb = 0;
+        while ((rc = db_next_record(&p_mgr->conn, &result, field_tab, 1))
+               == DB_SUCCESS && field_tab[0] != NULL)
+        {
+            g_string_append_printf(del, "%s'%s'", nb == 0 ? "" : ",",
+                                   field_tab[0]);
+            rh_strncpy(last, field_tab[0], sizeof(last));
+            nb++;
+        }
+        db_result_free(&p_mgr->conn, &result);
+
+        if (rc != DB_SUCCESS && rc != DB_END_OF_LIST)
+            goto out;
+        rc = DB_SUCCESS;
+        if (nb == 0)
+            break;
+
+        g_string_append_c(del, ')');
+        rc = db_exec_sql(&p_mgr->conn, del->str, NULL);
+        if (rc)
+            goto out;
+
+        rc = batch_commit(p_mgr);
+        if (rc)
+            goto out;
+
+        total += nb;
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Mass removal: %llu names removed",
+                   total);
+    } while (nb == batch);
+
+out:
+    g_string_free(req, TRUE);
+    g_string_free(del, TRUE);
+    return rc;
+}
+
 static int clean_names(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
-                       unsigned int *nb_filter_names)
+                       unsigned int *nb_filter_names, unsigned int batch)
 {
     int      rc = DB_SUCCESS;
+    GString *filter;
     GString *req;
 
-    req = g_string_new("DELETE FROM "DNAMES_TABLE" WHERE ");
-    *nb_filter_names = filter2str(p_mgr, req, p_filter, T_DNAMES, 0);
+    filter = g_string_new(NULL);
+    *nb_filter_names = filter2str(p_mgr, filter, p_filter, T_DNAMES, 0);
 
     if (*nb_filter_names == 0)
         goto out;
 
+    if (batch > 0)
+    {
+        rc = clean_names_batch(p_mgr, filter->str, batch);
+        goto out;
+    }
+
     DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Direct deletion in "DNAMES_TABLE" table");
+    req = g_string_new(NULL);
+    g_string_printf(req, "DELETE FROM "DNAMES_TABLE" WHERE %s", filter->str);
     rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
-out:
     g_string_free(req, TRUE);
+out:
+    g_string_free(filter, TRUE);
     return rc;
 }
 
@@ -122,6 +209,11 @@ int listmgr_remove_no_tx(lmgr_t *p_mgr, const entry_id_t *p_id,
 
     if (last)
     {
+        /* accounting deltas: subtract the values of the entry */
+        rc = listmgr_acct_delta(p_mgr, (pktype *)pk, 1, -1);
+        if (rc)
+            goto out;
+
         /* remove from all tables except from NAMES (handled at the end of this function) */
         rc = listmgr_remove_single(p_mgr, pk, T_DNAMES);
         if (rc)
@@ -131,6 +223,12 @@ int listmgr_remove_no_tx(lmgr_t *p_mgr, const entry_id_t *p_id,
     {
         /* XXX else update attributes according to attributes contents? */
 
+        /* the entry is no longer accounted in the removed parent */
+        g_string_printf(req, "id="DPK, pk);
+        rc = listmgr_diragg_delta(p_mgr, req->str, -1);
+        if (rc)
+            goto out;
+
         /* Since we're removing one entry but not the file, decrement nlink. */
         g_string_printf(req, "UPDATE "MAIN_TABLE" SET nlink=nlink-1 WHERE "
                         "id="DPK" AND nlink>0", pk);
@@ -163,7 +261,7 @@ int listmgr_remove_no_tx(lmgr_t *p_mgr, const entry_id_t *p_id,
 
         rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
         if (rc)
-            return rc;
+            goto out;
     }
     else if (!p_attr_set || !ATTR_MASK_TEST(p_attr_set, parent_id) || !ATTR_MASK_TEST(p_attr_set, name))
     {
@@ -174,7 +272,16 @@ int listmgr_remove_no_tx(lmgr_t *p_mgr, const entry_id_t *p_id,
                     p_attr_set && !ATTR_MASK_TEST(p_attr_set, name) ? " name" : "");
     }
 
+    /* contribution of the remaining names */
+    if (!last)
+    {
+        g_string_printf(req, "id="DPK, pk);
+        rc = listmgr_diragg_delta(p_mgr, req->str, 1);
+    }
+
 out:
+    listmgr_cache_invalidate(p_id);
+    listmgr_path_invalidate(p_id);
     g_string_free(req, TRUE);
     return rc;
 }
@@ -210,6 +317,44 @@ retry:
     return rc;
 }
 
+int ListMgr_BatchRemove(lmgr_t *p_mgr, unsigned int count,
+                        const entry_id_t **p_ids, const attr_set_t **p_attrs,
+                        const bool *last)
+{
+    unsigned int i;
+    int rc;
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    /* all removals in a single transaction */
+retry:
+    rc = lmgr_begin(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    for (i = 0; i < count; i++)
+    {
+        rc = listmgr_remove_no_tx(p_mgr, p_ids[i], p_attrs[i], last[i]);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+        {
+            lmgr_rollback(p_mgr);
+            return rc;
+        }
+    }
+
+    rc = lmgr_commit(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    if (!rc)
+         p_mgr->nbop[OPIDX_RM] += count;
+    return rc;
+}
+
 /**
  * Insert all entries to soft rm table.
  * @TODO check how it behaves with millions/billion entries.
@@ -244,6 +389,11 @@ static int listmgr_rm_all(lmgr_t * p_mgr)
 {
     int rc;
 
+    /* accounting deltas: subtract all entries */
+    rc = listmgr_acct_delta_where(p_mgr, "1", -1);
+    if (rc)
+        return rc;
+
     /* stripes are only managed for lustre filesystems */
 #ifdef _LUSTRE
     rc = db_exec_sql(&p_mgr->conn, "DELETE FROM " STRIPE_ITEMS_TABLE, NULL);
@@ -460,12 +610,151 @@ static int create_tmp_table_rm(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
 
 #define MAX_SOFTRM_FIELDS 128 /* id + std attributes + status + sminfo */
 
+/** soft remove or remove a single entry listed in the temporary table */
+static int rm_tmp_entry(lmgr_t *p_mgr, const entry_id_t *p_id, PK_ARG_T pk,
+                        char **fields, unsigned int nb_fields, bool soft_rm,
+                        time_t rm_time, attr_mask_t mask_no_rmtime,
+                        table_enum exclude_tab)
+{
+    int rc;
+
+    if (soft_rm)
+    {
+        attr_set_t old_attrs = ATTR_SET_INIT;
+
+        old_attrs.attr_mask = mask_no_rmtime;
+
+        /* parse result attributes + set rm_time for listmgr_softrm_single */
+        rc = result2attrset(T_TMP_SOFTRM, fields, nb_fields, &old_attrs);
+        if (rc)
+            return rc;
+
+        ATTR_MASK_SET(&old_attrs, rm_time);
+        ATTR(&old_attrs, rm_time) = rm_time;
+
+        /* insert into softrm table */
+        rc = listmgr_softrm_single(p_mgr, p_id, &old_attrs);
+        ListMgr_FreeAttrs(&old_attrs);
+        if (rc)
+            return rc;
+    }
+
+    /* delete all entries related to this id (except from query table if we did
+     * a direct deletion in it) */
+    return listmgr_remove_single(p_mgr, pk, exclude_tab);
+}
+
+/**
+ * Remove the entries listed in the temporary table by batches,
+ * with a commit after each batch.
+ */
+static int rm_tmp_entries_batch(lmgr_t *p_mgr, const char *tmp_table_name,
+                                bool soft_rm, time_t rm_time,
+                                attr_mask_t mask_no_rmtime,
+                                rm_cb_func_t cb_func, unsigned int *rm_count,
+                                unsigned int batch)
+{
+    GString        *req;
+    result_handle_t result;
+    char          **rows = NULL;
+    pktype         *pks = NULL;
+    entry_id_t     *ids = NULL;
+    unsigned int    nb = 1; /* at least 1 field for id */
+    unsigned int    nb_rec, i;
+    int             total, rc;
+
+    req = g_string_new("SELECT id");
+    if (soft_rm)
+        nb += attrmask2fieldlist(req, mask_no_rmtime, T_TMP_SOFTRM,
+                                 "", "", AOF_LEADING_SEP);
+    g_string_append_printf(req, " FROM %s", tmp_table_name);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    g_string_free(req, TRUE);
+    if (rc)
+        return rc;
+
+    total = db_result_nb_records(&p_mgr->conn, &result);
+    DisplayLog(LVL_EVENT, LISTMGR_TAG, "Mass removal: %d entries to be "
+               "removed, by batches of %u", total, batch);
+
+    rows = MemCalloc(batch * nb, sizeof(*rows));
+    pks = MemCalloc(batch, sizeof(*pks));
+    ids = MemCalloc(batch, sizeof(*ids));
+    if (rows == NULL || pks == NULL || ids == NULL)
+    {
+        rc = DB_NO_MEMORY;
+        goto out;
+    }
+
+    *rm_count = 0;
+    do
+    {
+        /* read the next batch (records are stored by the client) */
+        for (nb_rec = 0; nb_rec < batch; nb_rec++)
+        {
+            char **rec = &rows[nb_rec * nb];
+
+            rc = db_next_record(&p_mgr->conn, &result, rec, nb);
+            if (rc == DB_SUCCESS && rec[0] == NULL)
+                rc = DB_END_OF_LIST;
+            if (rc)
+                break;
+
+            rc = parse_entry_id(p_mgr, rec[0], PTR_PK(pks[nb_rec]),
+                                &ids[nb_rec]);
+            if (rc)
+                goto out;
+        }
+        if (rc != DB_SUCCESS && rc != DB_END_OF_LIST)
+            goto out;
+        if (nb_rec == 0)
+        {
+            rc = DB_SUCCESS;
+            break;
+        }
+
+        rc = listmgr_acct_delta(p_mgr, pks, nb_rec, -1);
+        if (rc)
+            goto out;
+
+        for (i = 0; i < nb_rec; i++)
+        {
+            rc = rm_tmp_entry(p_mgr, &ids[i], pks[i], &rows[i * nb + 1],
+                              nb - 1, soft_rm, rm_time, mask_no_rmtime,
+                              T_NONE);
+            if (rc)
+                goto out;
+        }
+
+        rc = batch_commit(p_mgr);
+        if (rc)
+            goto out;
+
+        /* entries are only reported once their removal is committed */
+        if (cb_func)
+            for (i = 0; i < nb_rec; i++)
+                cb_func(&ids[i]);
+
+        *rm_count += nb_rec;
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Mass removal: %u/%d entries "
+                   "removed", *rm_count, total);
+    } while (nb_rec == batch);
+
+out:
+    db_result_free(&p_mgr->conn, &result);
+    MemFree(rows);
+    MemFree(pks);
+    MemFree(ids);
+    return rc;
+}
+
 /** Perform removal or soft removal for all entries matching a filter
  * (no transaction management).
  */
 static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
                                      bool soft_rm, time_t rm_time, rm_cb_func_t cb_func,
-                                     unsigned int *rm_count)
+                                     unsigned int *rm_count, unsigned int batch)
 {
     struct field_count counts = {0};
     table_enum          query_tab;
@@ -506,7 +795,7 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
          * 1) clean names if there is a filter on them.
          * 2) clean related entries in other tables if there is no remaining path.
          */
-        rc = clean_names(p_mgr, p_filter, &counts.nb_names);
+        rc = clean_names(p_mgr, p_filter, &counts.nb_names, batch);
         if (rc)
             return rc;
     }
@@ -533,7 +822,7 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
 
         /* filter is only on names table */
         if (soft_rm)
-            rc = clean_names(p_mgr, p_filter, &counts.nb_names);
+            rc = clean_names(p_mgr, p_filter, &counts.nb_names, batch);
         /* else (no softrm): name cleaning has been done at the beginning of the function */
         else
             rc = 0;
@@ -565,8 +854,24 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
     if (rc)
         goto free_str;
 
+    /* bounded transactions: remove entries by batches */
+    if (batch > 0)
+    {
+        rc = rm_tmp_entries_batch(p_mgr, tmp_table_name, soft_rm, rm_time,
+                                  mask_no_rmtime, cb_func, rm_count, batch);
+        if (rc)
+            goto drop_tmp;
+        goto end_removal;
+    }
+
     req = g_string_new(NULL);
 
+    /* accounting deltas: subtract all the entries to be removed */
+    g_string_printf(req, "id IN (SELECT id FROM %s)", tmp_table_name);
+    rc = listmgr_acct_delta_where(p_mgr, req->str, -1);
+    if (rc)
+        goto drop_tmp;
+
     /* If the filter is only a single table, entries can be directly deleted in it. */
     /* NOTE: can't delete directly in stripe_items with the select criteria. */
     if ((nb_field_tables(&counts) == 1) && (query_tab != T_STRIPE_ITEMS))
@@ -580,7 +885,7 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
 
         rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
         if (rc)
-            goto free_str;
+            goto drop_tmp;
     }
 
     /* do the cleaning in other tables */
@@ -601,7 +906,7 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
 
     rc = db_exec_sql(&p_mgr->conn, req->str, &result);
     if (rc)
-        goto free_str;
+        goto drop_tmp;
 
     DisplayLog(LVL_DEBUG, LISTMGR_TAG,
                "%d identifiers to be removed from all tables",
@@ -620,30 +925,9 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
         if (rc)
             goto free_res;
 
-        if (soft_rm)
-        {
-            attr_set_t old_attrs = ATTR_SET_INIT;
-
-            old_attrs.attr_mask = mask_no_rmtime;
-
-            /* parse result attributes + set rm_time for listmgr_softrm_single */
-            rc = result2attrset(T_TMP_SOFTRM, field_tab + 1,  nb - 1, &old_attrs);
-            if (rc)
-                goto free_res;
-
-            ATTR_MASK_SET(&old_attrs, rm_time);
-            ATTR(&old_attrs, rm_time) = rm_time;
-
-            /* insert into softrm table */
-            rc = listmgr_softrm_single(p_mgr, &id, &old_attrs);
-            ListMgr_FreeAttrs(&old_attrs);
-            if (rc)
-                goto free_res;
-        }
-
-        /* delete all entries related to this id (except from query table if we did
-         * a direct deletion in it) */
-        rc = listmgr_remove_single(p_mgr, pk, direct_del ? query_tab : T_NONE);
+        rc = rm_tmp_entry(p_mgr, &id, pk, field_tab + 1, nb - 1, soft_rm,
+                          rm_time, mask_no_rmtime,
+                          direct_del ? query_tab : T_NONE);
         if (rc)
             goto free_res;
 
@@ -656,11 +940,12 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
     db_result_free(&p_mgr->conn, &result);
 
     if ((rc != 0) && (rc != DB_END_OF_LIST))
-        goto free_str;
+        goto drop_tmp;
 
     DisplayLog(LVL_DEBUG, LISTMGR_TAG,
                "End of indirect removal: %u identifiers removed", *rm_count);
 
+end_removal:
     /* drop tmp table */
     rc = db_drop_component(&p_mgr->conn, DBOBJ_TABLE, tmp_table_name);
     if (rc)
@@ -668,13 +953,16 @@ static int listmgr_mass_remove_no_tx(lmgr_t *p_mgr, const lmgr_filter_t *p_filte
 
     /* Condition on names only (partial scan cleans not found names). */
     if (soft_rm && filter_names)
-        rc = clean_names(p_mgr, p_filter, &counts.nb_names);
+        rc = clean_names(p_mgr, p_filter, &counts.nb_names, batch);
     /* else, it has been done at the beginning of the function */
 
     goto free_str;
 
 free_res:
     db_result_free(&p_mgr->conn, &result);
+drop_tmp:
+    /* the table would remain until the connection is closed */
+    db_drop_component(&p_mgr->conn, DBOBJ_TABLE, tmp_table_name);
 
 free_str:
     if (from != NULL)
@@ -705,7 +993,8 @@ retry:
     else if (rc)
         return rc;
 
-    rc = listmgr_mass_remove_no_tx(p_mgr, p_filter, soft_rm, rm_time, cb_func, &rmcount);
+    rc = listmgr_mass_remove_no_tx(p_mgr, p_filter, soft_rm, rm_time, cb_func,
+                                   &rmcount, lmgr_config.mass_rm_batch);
 
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
@@ -729,15 +1018,25 @@ rollback:
 int ListMgr_MassRemove(lmgr_t * p_mgr, const lmgr_filter_t * p_filter,
                         rm_cb_func_t cb_func)
 {
+    int rc;
+
     /* not a soft rm */
-    return listmgr_mass_remove(p_mgr, p_filter, false, 0, cb_func);
+    rc = listmgr_mass_remove(p_mgr, p_filter, false, 0, cb_func);
+    listmgr_cache_invalidate_all();
+    listmgr_path_invalidate_all();
+    return rc;
 }
 
 int ListMgr_MassSoftRemove(lmgr_t *p_mgr, const lmgr_filter_t *p_filter,
                            time_t rm_time, rm_cb_func_t cb_func)
 {
+    int rc;
+
     /* soft rm */
-    return listmgr_mass_remove(p_mgr, p_filter, true, rm_time, cb_func);
+    rc = listmgr_mass_remove(p_mgr, p_filter, true, rm_time, cb_func);
+    listmgr_cache_invalidate_all();
+    listmgr_path_invalidate_all();
+    return rc;
 }
 
 /**
@@ -1037,3 +1336,214 @@ int ListMgr_SoftRemove_Discard(lmgr_t * p_mgr, const entry_id_t * p_id)
     g_string_free(req, TRUE);
     return rc;
 }
+
+int ListMgr_SoftRemove_BatchDiscard(lmgr_t *p_mgr, unsigned int count,
+                                    const entry_id_t **p_ids)
+{
+    unsigned int i;
+    int          rc;
+    GString     *req;
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    /* a single request for all entries */
+    req = g_string_new("DELETE FROM "SOFT_RM_TABLE" WHERE id IN (");
+    for (i = 0; i < count; i++)
+        g_string_append_printf(req, "%s'"DFID_NOBRACE"'", i == 0 ? "" : ",",
+                               PFID(p_ids[i]));
+    g_string_append(req, ")");
+
+    do {
+        rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    } while(lmgr_delayed_retry(p_mgr, rc));
+
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+/* default number of entries discarded per request, in ranged discards */
+#define SOFTRM_DISCARD_BATCH 10000
+
+/** discard the entries removed in [min_rm_time, max_rm_time[, by batches
+ * of entries, in rm_time order */
+static int softrm_discard_range(lmgr_t *p_mgr, time_t min_rm_time,
+                                time_t max_rm_time, unsigned int batch,
+                                unsigned long long *p_count)
+{
+    GString        *req, *del;
+    result_handle_t result;
+    char           *field_tab[1];
+    unsigned int    nb;
+    int             rc;
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT id FROM "SOFT_RM_TABLE" WHERE rm_time>=%lu"
+                    " AND rm_time<%lu ORDER BY rm_time LIMIT %u",
+                    (unsigned long)min_rm_time, (unsigned long)max_rm_time,
+                    batch);
+    del = g_string_new(NULL);
+
+    for (;;)
+    {
+        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            continue;
+        else if (rc)
+            goto out;
+
+        g_string_assign(del, "DELETE FROM "SOFT_RM_TABLE" WHERE id IN (");
+        nb = 0;
+        while ((rc = db_next_record(&p_mgr->conn, &result, field_tab, 1))
+               == DB_SUCCESS && field_tab[0] != NULL)
+        {
+            g_string_append_printf(del, "%s'%s'", nb == 0 ? "" : ",",
+                                   field_tab[0]);
+            nb++;
+        }
+        db_result_free(&p_mgr->conn, &result);
+
+        if (rc != DB_SUCCESS && rc != DB_END_OF_LIST)
+            goto out;
+        rc = DB_SUCCESS;
+        if (nb == 0)
+            break;
+
+        /* the listed entries are selected again if the request fails */
+        g_string_append_c(del, ')');
+        rc = db_exec_sql(&p_mgr->conn, del->str, NULL);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            continue;
+        else if (rc)
+            goto out;
+
+        *p_count += nb;
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%llu entries discarded from "
+                   SOFT_RM_TABLE, *p_count);
+        if (nb < batch)
+            break;
+    }
+
+out:
+    g_string_free(req, TRUE);
+    g_string_free(del, TRUE);
+    return rc;
+}
+
+int ListMgr_SoftRemove_DiscardRange(lmgr_t *p_mgr, time_t min_rm_time,
+                                    time_t max_rm_time,
+                                    unsigned long long *p_count)
+{
+    unsigned int batch = lmgr_config.mass_rm_batch;
+    unsigned long long count = 0;
+    int rc;
+
+    if (batch == 0)
+        batch = SOFTRM_DISCARD_BATCH;
+
+    rc = softrm_discard_range(p_mgr, min_rm_time, max_rm_time, batch,
+                              &count);
+    if (p_count != NULL)
+        *p_count = count;
+    return rc;
+}
+
+#ifdef _MYSQL
+/**
+ * Drop the rm_time partitions of SOFT_RM that only contain entries removed
+ * before max_rm_time (see softrm_partition_time).
+ */
+static int softrm_drop_partitions(lmgr_t *p_mgr, time_t max_rm_time,
+                                  unsigned long long *p_count)
+{
+    GString        *req;
+    result_handle_t result;
+    char           *field_tab[2];
+    GSList         *names = NULL, *l;
+    int             rc;
+
+    req = g_string_new("SELECT PARTITION_NAME,PARTITION_DESCRIPTION FROM "
+                       "INFORMATION_SCHEMA.PARTITIONS WHERE "
+                       "TABLE_SCHEMA=DATABASE() AND TABLE_NAME='"
+                       SOFT_RM_TABLE"' AND PARTITION_NAME IS NOT NULL");
+    do {
+        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    } while (lmgr_delayed_retry(p_mgr, rc));
+    if (rc)
+        goto out;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, field_tab, 2))
+           == DB_SUCCESS)
+    {
+        long long bound;
+
+        if (field_tab[0] == NULL || field_tab[1] == NULL)
+            continue;
+        /* MAXVALUE partition is never dropped */
+        bound = str2bigint(field_tab[1]);
+        if (bound > 0 && bound <= max_rm_time)
+            names = g_slist_prepend(names, g_strdup(field_tab[0]));
+    }
+    db_result_free(&p_mgr->conn, &result);
+    if (rc != DB_END_OF_LIST)
+        goto out;
+    rc = DB_SUCCESS;
+
+    for (l = names; l != NULL; l = l->next)
+    {
+        const char *name = l->data;
+        char *count_str = NULL;
+
+        g_string_printf(req, "SELECT COUNT(*) FROM "SOFT_RM_TABLE
+                        " PARTITION (%s)", name);
+        rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+        if (rc)
+            goto out;
+        if (db_next_record(&p_mgr->conn, &result, &count_str, 1) == DB_SUCCESS
+            && count_str != NULL)
+            *p_count += str2bigint(count_str);
+        db_result_free(&p_mgr->conn, &result);
+
+        g_string_printf(req, "ALTER TABLE "SOFT_RM_TABLE" DROP PARTITION %s",
+                        name);
+        rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+        if (rc)
+            goto out;
+
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Partition %s of "SOFT_RM_TABLE
+                   " dropped", name);
+    }
+
+out:
+    for (l = names; l != NULL; l = l->next)
+        g_free(l->data);
+    g_slist_free(names);
+    g_string_free(req, TRUE);
+    return rc;
+}
+#endif
+
+int ListMgr_SoftRemove_Expire(lmgr_t *p_mgr, time_t max_rm_time,
+                              unsigned long long *p_count)
+{
+    unsigned long long count = 0;
+    unsigned long long dropped = 0;
+    int rc = DB_SUCCESS;
+
+#ifdef _MYSQL
+    if (lmgr_config.db_config.softrm_partition_time != 0)
+    {
+        rc = softrm_drop_partitions(p_mgr, max_rm_time, &dropped);
+        /* not fatal: remaining entries are discarded by batches */
+        if (rc)
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to drop expired "
+                       "partitions of "SOFT_RM_TABLE": %s (%d)",
+                       lmgr_err2str(rc), rc);
+    }
+#endif
+
+    rc = ListMgr_SoftRemove_DiscardRange(p_mgr, 0, max_rm_time, &count);
+    if (p_count != NULL)
+        *p_count = count + dropped;
+    return rc;
+}
@@ -566,6 +566,19 @@ struct lmgr_report_t *ListMgr_Report(lmgr_t *p_mgr,
     if (!GSTRING_EMPTY(having))
         g_string_append_printf(req, " HAVING %s", having->str);
 
+    if (opt.snapshot)
+    {
+        rc = listmgr_snapshot_open(p_mgr, req->str, order_by->str,
+                                   opt.list_count_max,
+                                   &p_report->select_result);
+        if (rc == DB_SUCCESS)
+            goto free_str;
+
+        if (rc != DB_NOT_SUPPORTED)
+            DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Cannot use report snapshot "
+                       "(%s): running the request", lmgr_err2str(rc));
+    }
+
     if (!GSTRING_EMPTY(order_by))
         g_string_append_printf(req, " ORDER BY %s", order_by->str);
 
@@ -587,7 +600,7 @@ retry:
     /* if the ACCT table does exist, switch to standard mode */
     if (use_acct_table && (rc == DB_NOT_EXISTS))
     {
-        lmgr_iter_opt_t new_opt;
+        lmgr_iter_opt_t new_opt = LMGR_ITER_OPT_INIT;
 
         if (p_opt != NULL)
             new_opt = *p_opt;
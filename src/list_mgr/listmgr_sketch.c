@@ -0,0 +1,178 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Storage of the top-K sketches maintained by the daemon pipeline.
+ * Sketch items are stored in the SKETCHES table, as (sketch, id, value).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#define SKETCH_TABLE    "SKETCHES"
+/* rows per INSERT request */
+#define SKETCH_ROWS     500
+
+static int sketch_table_create(db_conn_t *pconn)
+{
+    return db_exec_sql(pconn, "CREATE TABLE IF NOT EXISTS " SKETCH_TABLE
+                       " (sketch VARCHAR(32) NOT NULL, id " PK_TYPE " NOT NULL,"
+                       " value BIGINT UNSIGNED, PRIMARY KEY (sketch, id))",
+                       NULL);
+}
+
+int ListMgr_StoreSketch(lmgr_t *p_mgr, const char *name,
+                        const entry_id_t *ids, const uint64_t *values,
+                        unsigned int count)
+{
+    GString     *req;
+    unsigned int i;
+    int          rc;
+    DEF_PK(pk);
+
+    req = g_string_new(NULL);
+
+retry:
+    rc = sketch_table_create(&p_mgr->conn);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    rc = lmgr_begin(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    g_string_printf(req, "DELETE FROM " SKETCH_TABLE " WHERE sketch='%s'",
+                    name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    for (i = 0; i < count; i++) {
+        if (i % SKETCH_ROWS == 0)
+            g_string_assign(req, "INSERT INTO " SKETCH_TABLE
+                            " (sketch,id,value) VALUES ");
+        else
+            g_string_append_c(req, ',');
+
+        entry_id2pk(&ids[i], PTR_PK(pk));
+        g_string_append_printf(req, "('%s',"DPK",%"PRIu64")", name, pk,
+                               values[i]);
+
+        if (i % SKETCH_ROWS == SKETCH_ROWS - 1 || i == count - 1) {
+            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+            if (lmgr_delayed_retry(p_mgr, rc))
+                goto retry;
+            else if (rc)
+                goto rollback;
+        }
+    }
+
+    rc = lmgr_commit(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    goto free_str;
+
+rollback:
+    lmgr_rollback(p_mgr);
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_GetSketch(lmgr_t *p_mgr, const char *name, bool desc,
+                      entry_id_t **p_ids, uint64_t **p_values,
+                      unsigned int *p_count)
+{
+    result_handle_t result;
+    char            req[256];
+    char           *res[2];
+    entry_id_t     *ids = NULL;
+    uint64_t       *values = NULL;
+    unsigned int    n = 0, max = 0;
+    int             rc;
+
+    snprintf(req, sizeof(req), "SELECT id,value FROM " SKETCH_TABLE
+             " WHERE sketch='%s' ORDER BY value %s", name,
+             desc ? "DESC" : "ASC");
+
+retry:
+    /* the table does not exist if no sketch was stored */
+    rc = db_exec_sql_quiet(&p_mgr->conn, req, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 2))
+           == DB_SUCCESS) {
+        if (res[0] == NULL || res[1] == NULL)
+            continue;
+
+        if (n == max) {
+            unsigned int new_max = max ? 2 * max : 256;
+            entry_id_t *new_ids = MemRealloc(ids, new_max * sizeof(*ids));
+            uint64_t *new_vals;
+
+            if (new_ids == NULL) {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            ids = new_ids;
+            new_vals = MemRealloc(values, new_max * sizeof(*values));
+            if (new_vals == NULL) {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            values = new_vals;
+            max = new_max;
+        }
+
+        if (pk2entry_id(p_mgr, res[0], &ids[n]))
+            continue;
+        values[n] = strtoull(res[1], NULL, 10);
+        n++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc != DB_END_OF_LIST) {
+        if (ids != NULL)
+            MemFree(ids);
+        if (values != NULL)
+            MemFree(values);
+        return rc;
+    }
+
+    *p_ids = ids;
+    *p_values = values;
+    *p_count = n;
+    return DB_SUCCESS;
+}
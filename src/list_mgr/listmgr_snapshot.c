@@ -0,0 +1,338 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Report snapshots (report_snapshot_interval > 0).
+ * The results of a report query (without its ORDER BY and LIMIT clauses)
+ * are materialized in a SNAP_<hash> table, registered in REPORT_SNAPSHOTS
+ * with the query and the time of its last refresh.
+ * A snapshot is created by the first report that asks for it, then it is
+ * refreshed by the daemon (ListMgr_RefreshSnapshots). Readers rebuild it
+ * themselves if it was not refreshed for 2 intervals (e.g. no daemon).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define SNAP_TABLE      "REPORT_SNAPSHOTS"
+#define SNAP_PREFIX     "SNAP_"
+/* length of snapshot table names */
+#define SNAP_NAME_LEN   (sizeof(SNAP_PREFIX) + 16)
+/* snapshots that were not read for this time are dropped */
+#define SNAP_UNUSED_MAX 86400
+
+struct snapshot {
+    char   *name;
+    char   *query;
+    time_t  last_update;
+    time_t  last_access;
+};
+
+/** snapshot table name, from a hash (64 bits FNV-1a) of its query */
+static void snap_name(const char *query, char *name)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const unsigned char *c;
+
+    for (c = (const unsigned char *)query; *c != '\0'; c++) {
+        h ^= *c;
+        h *= 0x100000001b3ULL;
+    }
+    sprintf(name, SNAP_PREFIX "%016" PRIx64, h);
+}
+
+static int snap_table_create(db_conn_t *pconn)
+{
+    return db_exec_sql(pconn, "CREATE TABLE IF NOT EXISTS " SNAP_TABLE
+                       " (name VARCHAR(32) PRIMARY KEY, query TEXT NOT NULL,"
+                       " last_update INT UNSIGNED NOT NULL,"
+                       " last_access INT UNSIGNED NOT NULL)", NULL);
+}
+
+/**
+ * Get the time of the last refresh of a snapshot.
+ * @retval DB_NOT_EXISTS if the snapshot does not exist.
+ * @retval DB_NOT_SUPPORTED if another query has the same hash.
+ */
+static int snap_lookup(db_conn_t *pconn, const char *name, const char *query,
+                       time_t *last_update)
+{
+    result_handle_t result;
+    char *res[2] = {NULL, NULL};
+    char req[256];
+    int rc;
+
+    snprintf(req, sizeof(req), "SELECT query,last_update FROM " SNAP_TABLE
+             " WHERE name='%s'", name);
+
+    /* the table may not exist yet */
+    rc = db_exec_sql_quiet(pconn, req, &result);
+    if (rc)
+        return rc;
+
+    rc = db_next_record(pconn, &result, res, 2);
+    if (rc == DB_END_OF_LIST)
+        rc = DB_NOT_EXISTS;
+    else if (rc == DB_SUCCESS) {
+        if (res[0] == NULL || res[1] == NULL)
+            rc = DB_REQUEST_FAILED;
+        else if (strcmp(res[0], query) != 0)
+            rc = DB_NOT_SUPPORTED;
+        else
+            *last_update = strtoul(res[1], NULL, 10);
+    }
+
+    db_result_free(pconn, &result);
+    return rc;
+}
+
+/**
+ * (Re)build a snapshot table from its query and register it.
+ * The new table is built aside, so readers see the previous one meanwhile.
+ * @param access  the snapshot is built for a reader.
+ */
+static int snap_build(lmgr_t *p_mgr, const char *name, const char *query,
+                      bool access)
+{
+    GString *req;
+    char    *escaped;
+    size_t   len = 2 * strlen(query) + 1;
+    time_t   now = time(NULL);
+    int      rc;
+
+    escaped = MemAlloc(len);
+    if (escaped == NULL)
+        return DB_NO_MEMORY;
+
+    req = g_string_new(NULL);
+
+    g_string_printf(req, "DROP TABLE IF EXISTS %s_NEW", name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    /* quiet: the accounting table may not exist */
+    g_string_printf(req, "CREATE TABLE %s_NEW AS %s", name, query);
+    rc = db_exec_sql_quiet(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "DROP TABLE IF EXISTS %s", name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "ALTER TABLE %s_NEW RENAME TO %s", name, name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    rc = db_escape_string(&p_mgr->conn, escaped, len, query);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "INSERT INTO " SNAP_TABLE
+                    " (name,query,last_update,last_access) VALUES"
+                    " ('%s','%s',%lu,%lu) ON DUPLICATE KEY UPDATE"
+                    " last_update=%lu", name, escaped, now, now, now);
+    if (access)
+        g_string_append_printf(req, ",last_access=%lu", now);
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+
+ out:
+    g_string_free(req, TRUE);
+    MemFree(escaped);
+    return rc;
+}
+
+static int snap_drop(lmgr_t *p_mgr, const char *name)
+{
+    char req[256];
+    int rc;
+
+    rc = db_drop_component(&p_mgr->conn, DBOBJ_TABLE, name);
+    if (rc && rc != DB_NOT_EXISTS)
+        return rc;
+
+    snprintf(req, sizeof(req), "DELETE FROM " SNAP_TABLE " WHERE name='%s'",
+             name);
+    return db_exec_sql(&p_mgr->conn, req, NULL);
+}
+
+int listmgr_snapshot_open(lmgr_t *p_mgr, const char *query,
+                          const char *order_by, unsigned int limit,
+                          result_handle_t *p_result)
+{
+    time_t   interval = lmgr_report_snapshot_interval();
+    time_t   last_update = 0;
+    char     name[SNAP_NAME_LEN];
+    GString *req;
+    int      rc;
+
+    if (interval == 0)
+        return DB_NOT_SUPPORTED;
+
+    snap_name(query, name);
+
+    rc = snap_lookup(&p_mgr->conn, name, query, &last_update);
+    if (rc == DB_NOT_EXISTS) {
+        rc = snap_table_create(&p_mgr->conn);
+        if (rc == DB_SUCCESS)
+            rc = snap_build(p_mgr, name, query, true);
+    } else if (rc == DB_SUCCESS) {
+        if (time(NULL) - last_update > 2 * interval) {
+            DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Snapshot %s is outdated: "
+                       "rebuilding it", name);
+            rc = snap_build(p_mgr, name, query, true);
+        } else {
+            char upd[256];
+
+            snprintf(upd, sizeof(upd), "UPDATE " SNAP_TABLE
+                     " SET last_access=%lu WHERE name='%s'", time(NULL),
+                     name);
+            /* not critical */
+            db_exec_sql(&p_mgr->conn, upd, NULL);
+        }
+    }
+    if (rc)
+        return rc;
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT * FROM %s", name);
+    if (order_by != NULL && order_by[0] != '\0')
+        g_string_append_printf(req, " ORDER BY %s", order_by);
+    if (limit > 0)
+        g_string_append_printf(req, " LIMIT %u", limit);
+
+    rc = db_exec_sql_quiet(&p_mgr->conn, req->str, p_result);
+    g_string_free(req, TRUE);
+
+    if (rc == DB_SUCCESS)
+        DisplayLog(LVL_VERB, LISTMGR_TAG, "Report read from snapshot %s "
+                   "(updated %lds ago)", name,
+                   last_update ? time(NULL) - last_update : 0);
+    return rc;
+}
+
+static void snapshot_free(gpointer p)
+{
+    struct snapshot *snap = p;
+
+    g_free(snap->name);
+    g_free(snap->query);
+    g_free(snap);
+}
+
+/** load the list of snapshots */
+static int snap_list(lmgr_t *p_mgr, GPtrArray *list)
+{
+    result_handle_t result;
+    char *res[4];
+    int rc;
+
+    rc = db_exec_sql_quiet(&p_mgr->conn, "SELECT name,query,last_update,"
+                           "last_access FROM " SNAP_TABLE, &result);
+    if (rc)
+        return rc;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, res, 4))
+           == DB_SUCCESS) {
+        struct snapshot *snap;
+
+        if (res[0] == NULL || res[1] == NULL)
+            continue;
+
+        snap = g_new0(struct snapshot, 1);
+        snap->name = g_strdup(res[0]);
+        snap->query = g_strdup(res[1]);
+        snap->last_update = res[2] ? strtoul(res[2], NULL, 10) : 0;
+        snap->last_access = res[3] ? strtoul(res[3], NULL, 10) : 0;
+        g_ptr_array_add(list, snap);
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    return rc == DB_END_OF_LIST ? DB_SUCCESS : rc;
+}
+
+int ListMgr_RefreshSnapshots(lmgr_t *p_mgr)
+{
+    time_t       interval = lmgr_report_snapshot_interval();
+    time_t       now;
+    GPtrArray   *list;
+    unsigned int i, nb_refresh = 0, nb_drop = 0;
+    int          rc;
+
+    if (interval == 0)
+        return DB_SUCCESS;
+
+    list = g_ptr_array_new_with_free_func(snapshot_free);
+
+ retry:
+    rc = snap_list(p_mgr, list);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    if (rc) {
+        /* no snapshot yet */
+        if (rc == DB_NOT_EXISTS)
+            rc = DB_SUCCESS;
+        goto out;
+    }
+
+    now = time(NULL);
+    for (i = 0; i < list->len; i++) {
+        struct snapshot *snap = g_ptr_array_index(list, i);
+
+        if (now - snap->last_access > SNAP_UNUSED_MAX) {
+            DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Dropping unused snapshot %s",
+                       snap->name);
+            rc = snap_drop(p_mgr, snap->name);
+            if (rc == DB_SUCCESS)
+                nb_drop++;
+        } else if (now - snap->last_update >= interval) {
+            rc = snap_build(p_mgr, snap->name, snap->query, false);
+            if (rc == DB_SUCCESS)
+                nb_refresh++;
+        } else
+            continue;
+
+        if (rc)
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Failed to update report "
+                       "snapshot %s: %s (%d)", snap->name, lmgr_err2str(rc),
+                       rc);
+    }
+
+    if (nb_refresh > 0 || nb_drop > 0)
+        DisplayLog(LVL_EVENT, LISTMGR_TAG, "Report snapshots: %u refreshed, "
+                   "%u dropped", nb_refresh, nb_drop);
+    rc = DB_SUCCESS;
+
+ out:
+    g_ptr_array_free(list, TRUE);
+    return rc;
+}
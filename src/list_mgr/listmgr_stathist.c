@@ -0,0 +1,302 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * History of daemon stats (stats_history = yes), written at each
+ * stats_interval. The STATS_HISTORY table holds one row per
+ * (series, resolution, bucket), with the count, sum, min, max and latest
+ * value of the samples in the bucket: each sample updates its minute, hour
+ * and day buckets, so that trends over a long period are read from a few
+ * rows. Minute buckets are pruned after STATHIST_MINUTE_RETENTION, hour
+ * buckets after STATHIST_HOUR_RETENTION, and day buckets are kept.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define STATHIST_TABLE  "STATS_HISTORY"
+/* samples per INSERT request (3 rows each) */
+#define STATHIST_ROWS   200
+/* max length of a series name */
+#define STATHIST_NAME_LEN   255
+
+/* accounting of a sample in existing buckets */
+#define STATHIST_UPSERT " ON DUPLICATE KEY UPDATE samples=samples+1," \
+    " sum_val=sum_val+VALUES(sum_val)," \
+    " min_val=LEAST(min_val,VALUES(min_val))," \
+    " max_val=GREATEST(max_val,VALUES(max_val))," \
+    " last_val=VALUES(last_val)"
+
+#define STATHIST_MINUTE_RETENTION   (2 * 86400)
+#define STATHIST_HOUR_RETENTION     (90 * 86400)
+
+/* bucket duration for each resolution */
+static const time_t res_duration[STAT_RES_COUNT] = { 60, 3600, 86400 };
+
+static int stathist_table_create(db_conn_t *pconn)
+{
+    return db_exec_sql(pconn, "CREATE TABLE IF NOT EXISTS " STATHIST_TABLE
+                       " (name VARCHAR(255) NOT NULL,"
+                       " res TINYINT UNSIGNED NOT NULL,"
+                       " time INT UNSIGNED NOT NULL,"
+                       " samples INT UNSIGNED, sum_val DOUBLE,"
+                       " min_val DOUBLE, max_val DOUBLE, last_val DOUBLE,"
+                       " PRIMARY KEY (name, res, time),"
+                       " KEY (res, time))", NULL);
+}
+
+int ListMgr_StoreStatSamples(lmgr_t *p_mgr, time_t when,
+                             const stat_sample_t *samples,
+                             unsigned int count)
+{
+    GString     *req;
+    char         name[2 * STATHIST_NAME_LEN + 1];
+    unsigned int i, n;
+    int          r;
+    int          rc;
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    req = g_string_new(NULL);
+
+retry:
+    rc = stathist_table_create(&p_mgr->conn);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    rc = lmgr_begin(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    g_string_printf(req, "DELETE FROM " STATHIST_TABLE " WHERE"
+                    " (res=%u AND time<%lu) OR (res=%u AND time<%lu)",
+                    STAT_RES_MINUTE,
+                    (unsigned long)(when - STATHIST_MINUTE_RETENTION),
+                    STAT_RES_HOUR,
+                    (unsigned long)(when - STATHIST_HOUR_RETENTION));
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    for (i = 0, n = 0; i <= count; i++) {
+        /* flush full requests, and the last one */
+        if (n > 0 && (n == STATHIST_ROWS || i == count)) {
+            g_string_append(req, STATHIST_UPSERT);
+            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+            if (lmgr_delayed_retry(p_mgr, rc))
+                goto retry;
+            else if (rc)
+                goto rollback;
+            n = 0;
+        }
+        if (i == count)
+            break;
+
+        /* NaN and infinity can't be stored */
+        if (!isfinite(samples[i].value)
+            || strlen(samples[i].name) > STATHIST_NAME_LEN)
+            continue;
+
+        if (n == 0)
+            g_string_assign(req, "INSERT INTO " STATHIST_TABLE
+                            " (name,res,time,samples,sum_val,min_val,"
+                            "max_val,last_val) VALUES ");
+        else
+            g_string_append_c(req, ',');
+
+        db_escape_string(&p_mgr->conn, name, sizeof(name), samples[i].name);
+        for (r = 0; r < STAT_RES_COUNT; r++) {
+            g_string_append_printf(req, "%s('%s',%d,%lu,1,%.17g,%.17g,%.17g,"
+                                   "%.17g)", r > 0 ? "," : "", name, r,
+                                   (unsigned long)(when
+                                                   - when % res_duration[r]),
+                                   samples[i].value, samples[i].value,
+                                   samples[i].value, samples[i].value);
+        }
+        n++;
+    }
+
+    rc = lmgr_commit(p_mgr);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    goto free_str;
+
+rollback:
+    lmgr_rollback(p_mgr);
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_GetStatNames(lmgr_t *p_mgr, const char *pattern,
+                         char ***p_names, unsigned int *p_count)
+{
+    result_handle_t result;
+    GString        *req;
+    char           *res;
+    char          **names = NULL;
+    unsigned int    n = 0, max = 0;
+    int             rc;
+
+    req = g_string_new("SELECT DISTINCT name FROM " STATHIST_TABLE);
+    if (pattern != NULL) {
+        char esc[2 * STATHIST_NAME_LEN + 1];
+
+        db_escape_string(&p_mgr->conn, esc, sizeof(esc), pattern);
+        g_string_append_printf(req, " WHERE name LIKE '%s'", esc);
+    }
+    g_string_append(req, " ORDER BY name");
+
+retry:
+    /* the table does not exist if no sample was stored */
+    rc = db_exec_sql_quiet(&p_mgr->conn, req->str, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, &res, 1))
+           == DB_SUCCESS) {
+        if (res == NULL)
+            continue;
+
+        if (n == max) {
+            unsigned int new_max = max ? 2 * max : 64;
+            char **new_names = MemRealloc(names, new_max * sizeof(*names));
+
+            if (new_names == NULL) {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            names = new_names;
+            max = new_max;
+        }
+
+        names[n] = MemAlloc(strlen(res) + 1);
+        if (names[n] == NULL) {
+            rc = DB_NO_MEMORY;
+            break;
+        }
+        strcpy(names[n], res);
+        n++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc != DB_END_OF_LIST) {
+        while (n > 0)
+            MemFree(names[--n]);
+        if (names != NULL)
+            MemFree(names);
+        goto free_str;
+    }
+
+    *p_names = names;
+    *p_count = n;
+    rc = DB_SUCCESS;
+
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_GetStatHistory(lmgr_t *p_mgr, const char *name, stat_res_e res,
+                           time_t since, stat_point_t **p_points,
+                           unsigned int *p_count)
+{
+    result_handle_t result;
+    GString        *req;
+    char            esc[2 * STATHIST_NAME_LEN + 1];
+    char           *row[6];
+    stat_point_t   *points = NULL;
+    unsigned int    n = 0, max = 0;
+    int             rc;
+
+    db_escape_string(&p_mgr->conn, esc, sizeof(esc), name);
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT time,samples,sum_val,min_val,max_val,"
+                    "last_val FROM " STATHIST_TABLE " WHERE name='%s'"
+                    " AND res=%u AND time>=%lu ORDER BY time", esc, res,
+                    (unsigned long)since);
+
+retry:
+    /* the table does not exist if no sample was stored */
+    rc = db_exec_sql_quiet(&p_mgr->conn, req->str, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto free_str;
+
+    while ((rc = db_next_record(&p_mgr->conn, &result, row, 6))
+           == DB_SUCCESS) {
+        if (row[0] == NULL || row[1] == NULL || row[2] == NULL
+            || row[3] == NULL || row[4] == NULL || row[5] == NULL)
+            continue;
+
+        if (n == max) {
+            unsigned int new_max = max ? 2 * max : 256;
+            stat_point_t *new_points = MemRealloc(points,
+                                                  new_max * sizeof(*points));
+
+            if (new_points == NULL) {
+                rc = DB_NO_MEMORY;
+                break;
+            }
+            points = new_points;
+            max = new_max;
+        }
+
+        points[n].time = strtoul(row[0], NULL, 10);
+        points[n].count = strtoul(row[1], NULL, 10);
+        points[n].sum = strtod(row[2], NULL);
+        points[n].min = strtod(row[3], NULL);
+        points[n].max = strtod(row[4], NULL);
+        points[n].last = strtod(row[5], NULL);
+        n++;
+    }
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc != DB_END_OF_LIST) {
+        if (points != NULL)
+            MemFree(points);
+        goto free_str;
+    }
+
+    *p_points = points;
+    *p_count = n;
+    rc = DB_SUCCESS;
+
+free_str:
+    g_string_free(req, TRUE);
+    return rc;
+}
@@ -0,0 +1,182 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Per-connection cache of prepared statements.
+ *
+ * The SQL text of frequent requests (get, update...) only depends on the
+ * attribute mask of the request. They are prepared once per connection
+ * and attribute mask, then executed with binary parameters, which saves
+ * building, escaping and parsing the request for each entry.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "Memory.h"
+
+#include <glib.h>
+
+/* max number of statements per connection (the cache is flushed when
+ * it is full) */
+#define STMT_CACHE_MAX 256
+
+struct stmt_key {
+    lmgr_stmt_e kind;
+    attr_mask_t mask;
+};
+
+static guint stmt_key_hash(gconstpointer k)
+{
+    const struct stmt_key *key = k;
+
+    return key->kind ^ (key->mask.std * 31) ^ (key->mask.status * 131)
+        ^ (guint)(key->mask.sm_info ^ (key->mask.sm_info >> 32));
+}
+
+static gboolean stmt_key_equal(gconstpointer k1, gconstpointer k2)
+{
+    const struct stmt_key *key1 = k1;
+    const struct stmt_key *key2 = k2;
+
+    return key1->kind == key2->kind
+        && key1->mask.std == key2->mask.std
+        && key1->mask.status == key2->mask.status
+        && key1->mask.sm_info == key2->mask.sm_info;
+}
+
+static void stmt_key_free(gpointer k)
+{
+    MemFree(k);
+}
+
+void lmgr_stmt_cache_init(lmgr_t *p_mgr)
+{
+    p_mgr->stmt_cache = g_hash_table_new_full(stmt_key_hash, stmt_key_equal,
+                                              stmt_key_free, NULL);
+}
+
+/* release all the statements of the cache */
+static void stmt_cache_flush(lmgr_t *p_mgr)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, p_mgr->stmt_cache);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        db_stmt_close(&p_mgr->conn, value);
+
+    g_hash_table_remove_all(p_mgr->stmt_cache);
+}
+
+void lmgr_stmt_cache_free(lmgr_t *p_mgr)
+{
+    if (p_mgr->stmt_cache == NULL)
+        return;
+
+    stmt_cache_flush(p_mgr);
+    g_hash_table_destroy(p_mgr->stmt_cache);
+    p_mgr->stmt_cache = NULL;
+}
+
+db_stmt_t *lmgr_stmt_lookup(lmgr_t *p_mgr, lmgr_stmt_e kind,
+                            const attr_mask_t *mask)
+{
+    struct stmt_key key = {.kind = kind, .mask = *mask};
+
+    return g_hash_table_lookup(p_mgr->stmt_cache, &key);
+}
+
+int lmgr_stmt_prepare(lmgr_t *p_mgr, lmgr_stmt_e kind, const attr_mask_t *mask,
+                      const char *query, db_stmt_t **p_stmt)
+{
+    return lmgr_stmt_prepare_typed(p_mgr, kind, mask, query, NULL, 0, p_stmt);
+}
+
+int lmgr_stmt_prepare_typed(lmgr_t *p_mgr, lmgr_stmt_e kind,
+                            const attr_mask_t *mask, const char *query,
+                            const db_type_e *types, unsigned int type_count,
+                            db_stmt_t **p_stmt)
+{
+    struct stmt_key *key;
+    int rc;
+
+    key = MemAlloc(sizeof(*key));
+    if (!key)
+        return DB_NO_MEMORY;
+    key->kind = kind;
+    key->mask = *mask;
+
+    rc = db_stmt_prepare(&p_mgr->conn, query, p_stmt);
+    if (rc)
+    {
+        MemFree(key);
+        return rc;
+    }
+
+    if (types != NULL)
+    {
+        rc = db_stmt_result_types(&p_mgr->conn, *p_stmt, types, type_count);
+        if (rc)
+        {
+            db_stmt_close(&p_mgr->conn, *p_stmt);
+            MemFree(key);
+            return rc;
+        }
+    }
+
+    if (g_hash_table_size(p_mgr->stmt_cache) >= STMT_CACHE_MAX)
+    {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Prepared statement cache is "
+                   "full (%u statements): flushing it", STMT_CACHE_MAX);
+        stmt_cache_flush(p_mgr);
+    }
+    g_hash_table_insert(p_mgr->stmt_cache, key, *p_stmt);
+    return DB_SUCCESS;
+}
+
+int lmgr_query_typed(lmgr_t *p_mgr, const char *query,
+                     const db_type_e *types, unsigned int type_count,
+                     db_stmt_t **p_stmt)
+{
+    int rc;
+
+    rc = db_stmt_prepare(&p_mgr->conn, query, p_stmt);
+    if (rc)
+        return rc;
+
+    rc = db_stmt_result_types(&p_mgr->conn, *p_stmt, types, type_count);
+    if (rc == DB_SUCCESS)
+        rc = db_stmt_exec(&p_mgr->conn, *p_stmt, NULL, 0);
+    if (rc)
+        db_stmt_close(&p_mgr->conn, *p_stmt);
+    return rc;
+}
+
+int lmgr_stmt_exec(lmgr_t *p_mgr, db_stmt_t *stmt, const db_param_t *params,
+                   unsigned int count)
+{
+    int rc;
+
+    rc = db_stmt_exec(&p_mgr->conn, stmt, params, count);
+    if (rc == DB_CONNECT_FAILED)
+        /* statements don't survive a reconnection */
+        stmt_cache_flush(p_mgr);
+    return rc;
+}
@@ -25,13 +25,83 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define STRIPE_INFO_FIELDS "id,validator,stripe_count,stripe_size,pool_name"
 #define STRIPE_INFO_SET_VALUES "validator=VALUES(validator),"       \
                                "stripe_count=VALUES(stripe_count)," \
                                "stripe_size=VALUES(stripe_size),"   \
                                "pool_name=VALUES(pool_name)"
 
-#define STRIPE_ITEMS_FIELDS "id,stripe_index,ostidx,details"
+/* with compact stripes, info may be inserted without stripe items
+ * (and conversely): keep the current values */
+#define STRIPE_INFO_COMPACT_SET_VALUES                          \
+        "validator=VALUES(validator),"                          \
+        "stripe_count=IFNULL(VALUES(stripe_count),stripe_count)," \
+        "stripe_size=IFNULL(VALUES(stripe_size),stripe_size),"  \
+        "pool_name=IFNULL(VALUES(pool_name),pool_name),"        \
+        "items=IFNULL(VALUES(items),items)"
+
+/**
+ * Append the packed stripe items of an entry (in hex), for SQL requests
+ * (as x'...') or for bulk loading.
+ */
+static void append_packed_items(GString *str, const stripe_items_t *p_items,
+                                bool load)
+{
+    size_t  size;
+    char   *buff;
+
+    if (p_items == NULL || p_items->count == 0 || p_items->stripe == NULL) {
+        g_string_append(str, load ? "\\N" : "NULL");
+        return;
+    }
+
+    size = p_items->count * sizeof(stripe_item_t);
+    buff = MemAlloc(2 * size + 1);
+    if (buff == NULL) {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Cannot allocate memory to pack stripe items");
+        g_string_append(str, load ? "\\N" : "NULL");
+        return;
+    }
+    buf2hex(buff, 2 * size + 1, (unsigned char *)p_items->stripe, size);
+    g_string_append_printf(str, load ? "%s" : "x'%s'", buff);
+    MemFree(buff);
+}
+
+/** unpack the stripe items of an entry, from hex */
+static int unpack_items(const char *hex, stripe_items_t *p_items)
+{
+    size_t size = strlen(hex) / 2;
+
+    p_items->count = size / sizeof(stripe_item_t);
+    p_items->stripe = NULL;
+    if (p_items->count == 0)
+        return DB_SUCCESS;
+
+    p_items->stripe = MemAlloc(p_items->count * sizeof(stripe_item_t));
+    if (p_items->stripe == NULL)
+        return DB_NO_MEMORY;
+
+    if (size % sizeof(stripe_item_t) != 0
+        || hex2buf((unsigned char *)p_items->stripe,
+                   p_items->count * sizeof(stripe_item_t), hex) < 0) {
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Invalid packed stripe items "
+                   "(%zu bytes)", size);
+        free_stripe_items(p_items);
+        return DB_ATTR_MISSING;
+    }
+    return DB_SUCCESS;
+}
+
+/** OSTs are indexed once per entry, even if it has several stripes on it */
+static bool ost_listed(const stripe_items_t *p_items, int s)
+{
+    int i;
+
+    for (i = 0; i < s; i++)
+        if (p_items->stripe[i].ost_idx == p_items->stripe[s].ost_idx)
+            return true;
+    return false;
+}
 
 int update_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, int validator,
                        const stripe_info_t *p_stripe,
@@ -88,32 +158,55 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
     int i, rc = 0;
     int total_si;
     GString *req = g_string_new("");
+    bool compact = lmgr_config.compact_stripes;
     attr_mask_t tmp_mask = { ATTR_MASK_stripe_info, 0, 0LL };
 
+    /* compact stripe items are stored in STRIPE_INFO */
+    if (compact)
+        tmp_mask.std |= ATTR_MASK_stripe_items;
+
     if (!attr_mask_is_null(sum_masks(p_attrs, count, tmp_mask))) {
         /* build batch request for STRIPE_INFO table */
-        g_string_assign(req, "INSERT INTO " STRIPE_INFO_TABLE " ("
-                        STRIPE_INFO_FIELDS ") VALUES ");
+        g_string_assign(req, "INSERT INTO " STRIPE_INFO_TABLE " (");
+        g_string_append(req, compact ? STRIPE_INFO_COMPACT_FIELDS
+                                     : STRIPE_INFO_FIELDS);
+        g_string_append(req, ") VALUES ");
 
         first = true;
         for (i = 0; i < count; i++) {
+            bool has_info = ATTR_MASK_TEST(p_attrs[i], stripe_info);
+            bool has_items = ATTR_MASK_TEST(p_attrs[i], stripe_items);
+
             /* no request if the entry has no stripe info */
-            if (!ATTR_MASK_TEST(p_attrs[i], stripe_info))
+            if (!has_info && !(compact && has_items))
                 continue;
 
-            g_string_append_printf(req, "%s(" DPK ",%d,%u,%u,'%s')",
-                                   first ? "" : ",", pklist[i], validators[i],
+            g_string_append_printf(req, "%s(" DPK ",%d,", first ? "" : ",",
+                                   pklist[i], validators[i]);
+            if (has_info)
+                g_string_append_printf(req, "%u,%u,'%s'",
                                    ATTR(p_attrs[i], stripe_info).stripe_count,
                                    (unsigned int)ATTR(p_attrs[i],
                                                       stripe_info).stripe_size,
                                    ATTR(p_attrs[i], stripe_info).pool_name);
+            else
+                g_string_append(req, "NULL,NULL,NULL");
+
+            if (compact) {
+                g_string_append_c(req, ',');
+                append_packed_items(req, has_items ?
+                                    &ATTR(p_attrs[i], stripe_items) : NULL,
+                                    false);
+            }
+            g_string_append_c(req, ')');
             first = false;
         }
 
         if (update_if_exists)
             /* append "on duplicate key ..." */
-            g_string_append(req,
-                            " ON DUPLICATE KEY UPDATE " STRIPE_INFO_SET_VALUES);
+            g_string_append(req, compact ?
+                " ON DUPLICATE KEY UPDATE " STRIPE_INFO_COMPACT_SET_VALUES :
+                " ON DUPLICATE KEY UPDATE " STRIPE_INFO_SET_VALUES);
 
         if (!first) {   /* do nothing if no entry had stripe info */
             rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
@@ -152,8 +245,9 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
 
     total_si = 0;
     first = true;
-    g_string_assign(req, "INSERT INTO " STRIPE_ITEMS_TABLE
-                    " (" STRIPE_ITEMS_FIELDS ") VALUES ");
+    g_string_assign(req, "INSERT INTO " STRIPE_ITEMS_TABLE " (");
+    g_string_append(req, compact ? STRIPE_OSTS_FIELDS : STRIPE_ITEMS_FIELDS);
+    g_string_append(req, ") VALUES ");
 
     /* loop on all entries and all stripe items */
     for (i = 0; i < count; i++) {
@@ -168,6 +262,17 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
         for (s = 0; s < p_items->count; s++) {
             char buff[2 * STRIPE_DETAIL_SZ + 1];
 
+            if (compact) {
+                if (ost_listed(p_items, s))
+                    continue;
+                g_string_append_printf(req, "%s(" DPK ",%u)",
+                                       first ? "" : ",", pklist[i],
+                                       p_items->stripe[s].ost_idx);
+                total_si++;
+                first = false;
+                continue;
+            }
+
             total_si++;
             if (buf2hex
                 (buff, sizeof(buff),
@@ -193,29 +298,99 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
     return rc;
 }
 
+int stripe_load_rows(pktype *pklist, int *validators, attr_set_t **p_attrs,
+                     unsigned int count, GString *info_rows,
+                     unsigned int *nb_info, GString *items_rows,
+                     unsigned int *nb_items)
+{
+    int i;
+
+    *nb_info = *nb_items = 0;
+
+    for (i = 0; i < count; i++) {
+        const stripe_items_t *p_items;
+        db_type_u pool;
+        int s;
+
+        if (ATTR_MASK_TEST(p_attrs[i], stripe_info)) {
+            g_string_append_printf(info_rows, "%s\t%d\t%u\t%u\t", pklist[i],
+                                   validators[i],
+                                   ATTR(p_attrs[i], stripe_info).stripe_count,
+                                   (unsigned int)ATTR(p_attrs[i],
+                                                      stripe_info).stripe_size);
+            pool.val_str = ATTR(p_attrs[i], stripe_info).pool_name;
+            printdbtype_load(info_rows, DB_TEXT, &pool);
+            if (lmgr_config.compact_stripes) {
+                g_string_append_c(info_rows, '\t');
+                append_packed_items(info_rows,
+                                    ATTR_MASK_TEST(p_attrs[i], stripe_items) ?
+                                    &ATTR(p_attrs[i], stripe_items) : NULL,
+                                    true);
+            }
+            g_string_append_c(info_rows, '\n');
+            (*nb_info)++;
+        }
+
+        if (!ATTR_MASK_TEST(p_attrs[i], stripe_items))
+            continue;
+
+        p_items = &ATTR(p_attrs[i], stripe_items);
+        for (s = 0; s < p_items->count; s++) {
+            char buff[2 * STRIPE_DETAIL_SZ + 1];
+
+            if (lmgr_config.compact_stripes) {
+                if (ost_listed(p_items, s))
+                    continue;
+                g_string_append_printf(items_rows, "%s\t%u\n", pklist[i],
+                                       p_items->stripe[s].ost_idx);
+                (*nb_items)++;
+                continue;
+            }
+
+            if (buf2hex
+                (buff, sizeof(buff),
+                 (unsigned char *)(&p_items->stripe[s].ost_gen),
+                 STRIPE_DETAIL_SZ) < 0) {
+                DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                           "Buffer too small to store details stripe info");
+                memset(buff, 0, sizeof(buff));
+            }
+            g_string_append_printf(items_rows, "%s\t%u\t%u\t%s\n", pklist[i],
+                                   s, p_items->stripe[s].ost_idx, buff);
+            (*nb_items)++;
+        }
+    }
+    return DB_SUCCESS;
+}
+
 int get_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, stripe_info_t *p_stripe_info,
                     stripe_items_t *p_items)
 {
 /* stripe_count, stripe_size, pool_name, validator => 4 */
 #define STRIPE_INFO_COUNT 4
-    char *res[STRIPE_INFO_COUNT];
+    /* + packed items */
+    char *res[STRIPE_INFO_COUNT + 1];
     result_handle_t result;
     int i;
     int rc = DB_SUCCESS;
     GString *req;
+    bool compact = lmgr_config.compact_stripes;
 
     /* retrieve basic stripe info */
     req =
         g_string_new
-        ("SELECT stripe_count, stripe_size, pool_name,validator FROM "
-         STRIPE_INFO_TABLE " WHERE id=");
-    g_string_append_printf(req, DPK, pk);
+        ("SELECT stripe_count, stripe_size, pool_name,validator");
+    if (compact)
+        g_string_append(req, ",HEX(items)");
+    g_string_append_printf(req, " FROM " STRIPE_INFO_TABLE " WHERE id=" DPK,
+                           pk);
 
     rc = db_exec_sql(&p_mgr->conn, req->str, &result);
     if (rc)
         goto out;
 
-    rc = db_next_record(&p_mgr->conn, &result, res, STRIPE_INFO_COUNT);
+    rc = db_next_record(&p_mgr->conn, &result, res,
+                        compact ? STRIPE_INFO_COUNT + 1 : STRIPE_INFO_COUNT);
 
     if (rc == DB_END_OF_LIST)
         rc = DB_NOT_EXISTS;
@@ -238,6 +413,17 @@ int get_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, stripe_info_t *p_stripe_info,
     p_stripe_info->validator = atoi(res[3]);
 #endif
 
+    if (compact) {
+        if (p_items) {
+            rc = unpack_items(res[STRIPE_INFO_COUNT] ?
+                              res[STRIPE_INFO_COUNT] : "", p_items);
+            if (rc)
+                goto res_free;
+        }
+        /* a single query is needed */
+        goto res_free;
+    }
+
     db_result_free(&p_mgr->conn, &result);
 
     if (p_items) {
@@ -429,10 +615,34 @@ int ListMgr_SetStripe(lmgr_t *p_mgr, const entry_id_t *p_id,
 
     entry_id2pk(p_id, PTR_PK(pk));
  retry:
-    rc = insert_stripe_info(p_mgr, pk, validator, p_stripe_info, p_stripe_items,
-                            true);
+    if (lmgr_config.ost_agg) {
+        char where[128];
+
+        /* move the entry contribution to its new OSTs */
+        snprintf(where, sizeof(where), "id="DPK, pk);
+
+        rc = lmgr_begin(p_mgr);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            return rc;
+
+        rc = listmgr_ostagg_delta(p_mgr, where, -1);
+        if (rc == DB_SUCCESS)
+            rc = insert_stripe_info(p_mgr, pk, validator, p_stripe_info,
+                                    p_stripe_items, true);
+        if (rc == DB_SUCCESS)
+            rc = listmgr_ostagg_delta(p_mgr, where, 1);
+        if (rc == DB_SUCCESS)
+            rc = lmgr_commit(p_mgr);
+        else
+            lmgr_rollback(p_mgr);
+    } else
+        rc = insert_stripe_info(p_mgr, pk, validator, p_stripe_info,
+                                p_stripe_items, true);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
 
+    listmgr_cache_invalidate(p_id);
     return rc;
 }
@@ -18,6 +18,20 @@
 #ifndef _LISTMGR_STRIPE_H
 #define _LISTMGR_STRIPE_H
 
+#define STRIPE_INFO_FIELDS "id,validator,stripe_count,stripe_size,pool_name"
+#define STRIPE_ITEMS_FIELDS "id,stripe_index,ostidx,details"
+
+/* to bulk load stripe items: details are written in hex */
+#define STRIPE_ITEMS_LOAD_FIELDS "id,stripe_index,ostidx,@details"
+#define STRIPE_ITEMS_LOAD_SET    "details=UNHEX(@details)"
+
+/* with compact stripes: stripe items are packed in STRIPE_INFO.items,
+ * and STRIPE_ITEMS only has the OSTs of each entry */
+#define STRIPE_INFO_COMPACT_FIELDS STRIPE_INFO_FIELDS ",items"
+#define STRIPE_INFO_LOAD_COMPACT_FIELDS STRIPE_INFO_FIELDS ",@items"
+#define STRIPE_INFO_LOAD_COMPACT_SET    "items=UNHEX(@items)"
+#define STRIPE_OSTS_FIELDS "id,ostidx"
+
 int insert_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk,
                        int validator, const stripe_info_t *p_stripe,
                        const stripe_items_t *p_items, bool update_if_exists);
@@ -28,6 +42,15 @@ int batch_insert_stripe_info(lmgr_t *p_mgr, pktype *pklist, int *validators,
                              attr_set_t **p_attrs, unsigned int count,
                              bool update_if_exists);
 
+/**
+ * Build the rows to bulk load stripe information of a batch of entries
+ * (see db_load_file()).
+ */
+int stripe_load_rows(pktype *pklist, int *validators, attr_set_t **p_attrs,
+                     unsigned int count, GString *info_rows,
+                     unsigned int *nb_info, GString *items_rows,
+                     unsigned int *nb_items);
+
 int get_stripe_info(lmgr_t *p_mgr, PK_ARG_T pk, stripe_info_t *p_stripe,
                     stripe_items_t *p_items);
 
@@ -0,0 +1,296 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2008, 2009 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Summary tables (summary_interval > 0), for the web GUI.
+ * The daemon periodically materializes small aggregates of ACCT_STAT:
+ * count, volume and size profile by user (SUMMARY_USER), by group
+ * (SUMMARY_GROUP) and by type (SUMMARY_TYPE), count and volume by policy
+ * status (SUMMARY_STATUS), and appends the filesystem totals to
+ * SUMMARY_FS_HISTORY (pruned after summary_history_retention).
+ * SUMMARY_INFO holds the time of the last refresh of each table and the
+ * refresh interval, so readers can fall back to ACCT_STAT when a summary
+ * is outdated (e.g. no daemon running).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "listmgr_common.h"
+#include "listmgr_internal.h"
+#include "database.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+
+#include <glib.h>
+#include <time.h>
+
+#define SUMMARY_INFO_TABLE      "SUMMARY_INFO"
+#define SUMMARY_HISTORY_TABLE   "SUMMARY_FS_HISTORY"
+#define SUMMARY_STATUS_TABLE    "SUMMARY_STATUS"
+
+/* summaries by a key of ACCT_STAT */
+static const struct summary_def {
+    const char *name;
+    const char *key;
+} summaries[] = {
+    {"SUMMARY_USER", "uid"},
+    {"SUMMARY_GROUP", "gid"},
+    {"SUMMARY_TYPE", "type"},
+};
+
+static int info_table_create(db_conn_t *pconn)
+{
+    return db_exec_sql(pconn, "CREATE TABLE IF NOT EXISTS " SUMMARY_INFO_TABLE
+                       " (name VARCHAR(32) PRIMARY KEY,"
+                       " last_update INT UNSIGNED NOT NULL,"
+                       " refresh_interval INT UNSIGNED NOT NULL)", NULL);
+}
+
+/** register the refresh of a summary table */
+static int info_update(lmgr_t *p_mgr, const char *name, time_t now)
+{
+    char req[512];
+
+    snprintf(req, sizeof(req), "INSERT INTO " SUMMARY_INFO_TABLE
+             " (name,last_update,refresh_interval) VALUES ('%s',%lu,%lu)"
+             " ON DUPLICATE KEY UPDATE last_update=VALUES(last_update),"
+             " refresh_interval=VALUES(refresh_interval)", name,
+             (unsigned long)now, (unsigned long)lmgr_summary_interval());
+    return db_exec_sql(&p_mgr->conn, req, NULL);
+}
+
+/** summed values of ACCT_STAT: "SUM(count) AS count, SUM(size) AS size..." */
+static void append_sums(GString *req)
+{
+    int i, cookie;
+
+    g_string_append(req, "SUM(" ACCT_FIELD_COUNT ") AS " ACCT_FIELD_COUNT);
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (is_acct_field(i))
+            g_string_append_printf(req, ",SUM(%s) AS %s", field_name(i),
+                                   field_name(i));
+    }
+    for (i = 0; i < SZ_PROFIL_COUNT; i++)
+        g_string_append_printf(req, ",SUM(%s) AS %s", sz_field[i],
+                               sz_field[i]);
+}
+
+/**
+ * (Re)build a summary table from a query.
+ * The new table is built aside, so readers see the previous one meanwhile.
+ */
+static int summary_build(lmgr_t *p_mgr, const char *name, const char *query,
+                         const char *pk, time_t now)
+{
+    GString *req = g_string_new(NULL);
+    int      rc;
+
+    g_string_printf(req, "DROP TABLE IF EXISTS %s_NEW", name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "CREATE TABLE %s_NEW AS %s", name, query);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    /* readers look up rows by key */
+    g_string_printf(req, "ALTER TABLE %s_NEW ADD PRIMARY KEY (%s)", name, pk);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "DROP TABLE IF EXISTS %s", name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "ALTER TABLE %s_NEW RENAME TO %s", name, name);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    rc = info_update(p_mgr, name, now);
+
+ out:
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+/** summary of a key of ACCT_STAT (user, group, type) */
+static int summary_by_key(lmgr_t *p_mgr, const struct summary_def *def,
+                          time_t now)
+{
+    GString *query = g_string_new(NULL);
+    int      rc;
+
+    g_string_printf(query, "SELECT %s,", def->key);
+    append_sums(query);
+    g_string_append_printf(query, " FROM " ACCT_TABLE " GROUP BY %s",
+                           def->key);
+
+    rc = summary_build(p_mgr, def->name, query->str, def->key, now);
+    g_string_free(query, TRUE);
+    return rc;
+}
+
+/**
+ * Count and volume by policy status: one row per (status field, status),
+ * with an empty status for entries that have none.
+ */
+static int summary_by_status(lmgr_t *p_mgr, time_t now)
+{
+    GString *query = g_string_new(NULL);
+    int      i, cookie;
+    int      rc;
+
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (!is_acct_pk(i) || !is_status_field(i))
+            continue;
+
+        if (query->len > 0)
+            g_string_append(query, " UNION ALL ");
+        g_string_append_printf(query, "SELECT CAST('%s' AS CHAR(64)) AS field,"
+                               " CAST(IFNULL(%s,'') AS CHAR(64)) AS status,",
+                               field_name(i), field_name(i));
+        append_sums(query);
+        g_string_append_printf(query, " FROM " ACCT_TABLE " GROUP BY %s",
+                               field_name(i));
+    }
+
+    /* no status in accounting */
+    if (query->len == 0)
+        rc = DB_SUCCESS;
+    else
+        rc = summary_build(p_mgr, SUMMARY_STATUS_TABLE, query->str,
+                           "field,status", now);
+
+    g_string_free(query, TRUE);
+    return rc;
+}
+
+/** append the filesystem totals to the history, and prune it */
+static int summary_history(lmgr_t *p_mgr, time_t now)
+{
+    time_t   retention = lmgr_summary_history_retention();
+    GString *req = g_string_new(NULL);
+    GString *fields = g_string_new(ACCT_FIELD_COUNT);
+    int      i, cookie;
+    int      rc;
+
+    g_string_assign(req, "CREATE TABLE IF NOT EXISTS " SUMMARY_HISTORY_TABLE
+                    " (time INT UNSIGNED NOT NULL PRIMARY KEY,"
+                    " " ACCT_FIELD_COUNT " BIGINT UNSIGNED");
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (is_acct_field(i)) {
+            g_string_append_printf(req, ", %s BIGINT UNSIGNED",
+                                   field_name(i));
+            g_string_append_printf(fields, ",%s", field_name(i));
+        }
+    }
+    g_string_append(req, ")");
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    /* replace samples taken in the same second */
+    g_string_printf(req, "DELETE FROM " SUMMARY_HISTORY_TABLE
+                    " WHERE time=%lu", (unsigned long)now);
+    if (retention > 0 && now > retention)
+        g_string_append_printf(req, " OR time<%lu",
+                               (unsigned long)(now - retention));
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    g_string_printf(req, "INSERT INTO " SUMMARY_HISTORY_TABLE
+                    " (time,%s) SELECT %lu,", fields->str,
+                    (unsigned long)now);
+    g_string_append(req, "IFNULL(SUM(" ACCT_FIELD_COUNT "),0)");
+    cookie = -1;
+    while ((i = attr_index_iter(0, &cookie)) != -1) {
+        if (is_acct_field(i))
+            g_string_append_printf(req, ",IFNULL(SUM(%s),0)", field_name(i));
+    }
+    g_string_append(req, " FROM " ACCT_TABLE);
+    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    if (rc)
+        goto out;
+
+    rc = info_update(p_mgr, SUMMARY_HISTORY_TABLE, now);
+
+ out:
+    g_string_free(fields, TRUE);
+    g_string_free(req, TRUE);
+    return rc;
+}
+
+int ListMgr_RefreshSummaries(lmgr_t *p_mgr)
+{
+    static bool no_acct_warned = false;
+    time_t       now;
+    unsigned int i;
+    int          rc;
+
+    if (lmgr_summary_interval() == 0)
+        return DB_SUCCESS;
+
+    if (!lmgr_config.acct) {
+        if (!no_acct_warned)
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Summary tables require "
+                       "accounting: summary_interval is ignored");
+        no_acct_warned = true;
+        return DB_SUCCESS;
+    }
+
+ retry:
+    now = time(NULL);
+    rc = info_table_create(&p_mgr->conn);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    for (i = 0; i < G_N_ELEMENTS(summaries); i++) {
+        rc = summary_by_key(p_mgr, &summaries[i], now);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            return rc;
+    }
+
+    rc = summary_by_status(p_mgr, now);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    rc = summary_history(p_mgr, now);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        return rc;
+
+    DisplayLog(LVL_VERB, LISTMGR_TAG, "Summary tables refreshed in %lds",
+               (long)(time(NULL) - now));
+    return DB_SUCCESS;
+}
@@ -11,6 +11,20 @@
  * knowledge of the CeCILL license (http://www.cecill.info) and that you
  * accept its terms.
  */
+/**
+ * Tags of entries, to list the entries of a set that were not seen
+ * (rbh-diff).
+ *
+ * If ENTRIES has a diff_gen field (see check_diff_gen()), a tag is a
+ * generation number: tagging an entry sets its diff_gen to the generation
+ * of the tag, and untagged entries are the ones with an older generation
+ * (an index range), so nothing has to be copied nor cleaned. Entries whose
+ * metadata were updated since the tag was created (e.g. by a running
+ * daemon) are not listed as untagged.
+ * Else, a tag is a TAG_<name> table with a copy of the ids of the set, that
+ * are removed from it when they are tagged.
+ */
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -18,14 +32,343 @@
 #include "list_mgr.h"
 #include "database.h"
 #include "listmgr_common.h"
+#include "listmgr_internal.h"
 #include "listmgr_stripe.h"
 #include "rbh_logs.h"
+#include "rbh_misc.h"
 #include "Memory.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* last allocated generation */
+#define DIFF_GEN_VAR    "DiffGeneration"
+/* variable of a tag is <prefix>_<tag_name> (value is <gen>:<start>) */
+#define DIFF_TAG_PREFIX "DiffTag"
+
+/** a tag of this process */
+typedef struct gen_tag {
+    char           *name;
+    unsigned int    gen;
+    time_t          start;
+    /* ids of the tagged set (NULL for all entries) */
+    char           *set_query;
+    struct gen_tag *next;
+} gen_tag_t;
+
+static gen_tag_t      *gen_tags = NULL;
+static pthread_mutex_t gen_tags_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Build the request that selects the ids of the set to be tagged.
+ * @return NULL for all entries.
+ */
+static GString *tag_set_query(lmgr_t *p_mgr, lmgr_filter_t *p_filter)
+{
+    GString         *req;
+    GString         *from;
+    GString         *where;
+    table_enum       query_tab = T_NONE;
+    bool             distinct = false;
+    struct field_count fcnt = {0};
+
+    if (no_filter(p_filter))
+        return NULL;
+
+    where = g_string_new(NULL);
+    filter_where(p_mgr, p_filter, &fcnt, where, 0);
+
+    /* finally, no filter */
+    if (nb_field_tables(&fcnt) == 0)
+    {
+        g_string_free(where, TRUE);
+        return NULL;
+    }
+
+    /* build the FROM clause */
+    from = g_string_new(NULL);
+    filter_from(p_mgr, &fcnt, from, &query_tab, &distinct, 0);
+
+    req = g_string_new(NULL);
+    if (distinct)
+        g_string_printf(req, "SELECT DISTINCT(%s.id) AS id",
+                        table2name(query_tab));
+    else
+        g_string_printf(req, "SELECT %s.id AS id", table2name(query_tab));
+
+    g_string_append_printf(req, " FROM %s WHERE %s", from->str, where->str);
+
+    g_string_free(from, TRUE);
+    g_string_free(where, TRUE);
+    return req;
+}
+
+/** get a tag of this process (the caller must hold gen_tags_lock) */
+static gen_tag_t *gen_tag_find(const char *tag_name)
+{
+    gen_tag_t *t;
+
+    for (t = gen_tags; t != NULL; t = t->next)
+        if (!strcmp(t->name, tag_name))
+            return t;
+    return NULL;
+}
+
+static void gen_tag_free(gen_tag_t *t)
+{
+    MemFree(t->name);
+    if (t->set_query != NULL)
+        MemFree(t->set_query);
+    MemFree(t);
+}
+
+/** register a tag in this process (takes the ownership of set_query) */
+static int gen_tag_register(const char *tag_name, unsigned int gen,
+                            time_t start, char *set_query)
+{
+    gen_tag_t *t = MemCalloc(1, sizeof(*t));
+
+    if (t == NULL)
+        return DB_NO_MEMORY;
+
+    t->name = MemAlloc(strlen(tag_name) + 1);
+    if (t->name == NULL)
+    {
+        MemFree(t);
+        return DB_NO_MEMORY;
+    }
+    strcpy(t->name, tag_name);
+    t->gen = gen;
+    t->start = start;
+    t->set_query = set_query;
+
+    P(gen_tags_lock);
+    t->next = gen_tags;
+    gen_tags = t;
+    V(gen_tags_lock);
+    return DB_SUCCESS;
+}
+
+/**
+ * Get the generation of a tag. Tags of other processes are read from
+ * the DB (their set is unknown: set_query is NULL).
+ */
+static int gen_tag_get(lmgr_t *p_mgr, const char *tag_name, unsigned int *gen,
+                       time_t *start, GString **set_query)
+{
+    char         varname[MAX_VAR_LEN];
+    char         value[MAX_VAR_LEN];
+    unsigned long s;
+    gen_tag_t   *t;
+    int          rc;
+
+    P(gen_tags_lock);
+    t = gen_tag_find(tag_name);
+    if (t != NULL)
+    {
+        *gen = t->gen;
+        *start = t->start;
+        if (set_query != NULL)
+            *set_query = t->set_query ? g_string_new(t->set_query) : NULL;
+        V(gen_tags_lock);
+        return DB_SUCCESS;
+    }
+    V(gen_tags_lock);
+
+    snprintf(varname, sizeof(varname), DIFF_TAG_PREFIX"_%s", tag_name);
+    rc = ListMgr_GetVar(p_mgr, varname, value, sizeof(value));
+    if (rc)
+        return rc;
+
+    if (sscanf(value, "%u:%lu", gen, &s) != 2)
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "Invalid value for %s: '%s'",
+                   varname, value);
+        return DB_INVALID_ARG;
+    }
+    *start = s;
+    if (set_query != NULL)
+        *set_query = NULL;
+    return DB_SUCCESS;
+}
+
+/** allocate a new generation */
+static int new_generation(lmgr_t *p_mgr, unsigned int *gen)
+{
+    char cur[MAX_VAR_LEN];
+    char next[MAX_VAR_LEN];
+    int  rc;
+
+    for (;;)
+    {
+        bool exists;
+
+        rc = ListMgr_GetVar(p_mgr, DIFF_GEN_VAR, cur, sizeof(cur));
+        if (rc != DB_SUCCESS && rc != DB_NOT_EXISTS)
+            return rc;
+        exists = (rc == DB_SUCCESS);
+
+        *gen = exists ? strtoul(cur, NULL, 10) + 1 : 1;
+        snprintf(next, sizeof(next), "%u", *gen);
+
+        /* another process allocated a generation meanwhile */
+        rc = ListMgr_TestAndSetVar(p_mgr, DIFF_GEN_VAR, exists ? cur : NULL,
+                                   next);
+        if (rc != DB_OUT_OF_DATE)
+            return rc;
+    }
+}
+
+static int gen_create_tag(lmgr_t *p_mgr, const char *tag_name,
+                          lmgr_filter_t *p_filter)
+{
+    char         varname[MAX_VAR_LEN];
+    char         value[MAX_VAR_LEN];
+    unsigned int gen;
+    time_t       start;
+    GString     *set_query;
+    int          rc;
+
+    rc = new_generation(p_mgr, &gen);
+    if (rc)
+        return rc;
+
+    /* entries updated from now are considered as seen */
+    start = time(NULL);
+
+    snprintf(varname, sizeof(varname), DIFF_TAG_PREFIX"_%s", tag_name);
+    snprintf(value, sizeof(value), "%u:%lu", gen, (unsigned long)start);
+    rc = ListMgr_SetVar(p_mgr, varname, value);
+    if (rc)
+        return rc;
+
+    set_query = tag_set_query(p_mgr, p_filter);
+    rc = gen_tag_register(tag_name, gen, start,
+                          set_query ? g_string_free(set_query, FALSE) : NULL);
+    if (rc)
+        ListMgr_SetVar(p_mgr, varname, NULL);
+
+    DisplayLog(LVL_DEBUG, LISTMGR_TAG, "Tag '%s' uses generation %u",
+               tag_name, gen);
+    return rc;
+}
+
+static int gen_destroy_tag(lmgr_t *p_mgr, const char *tag_name)
+{
+    char        varname[MAX_VAR_LEN];
+    gen_tag_t **pt;
+    gen_tag_t  *t = NULL;
+
+    P(gen_tags_lock);
+    for (pt = &gen_tags; *pt != NULL; pt = &(*pt)->next)
+    {
+        if (!strcmp((*pt)->name, tag_name))
+        {
+            t = *pt;
+            *pt = t->next;
+            break;
+        }
+    }
+    V(gen_tags_lock);
+
+    if (t != NULL)
+        gen_tag_free(t);
+
+    /* tagged entries keep their generation: nothing to clean */
+    snprintf(varname, sizeof(varname), DIFF_TAG_PREFIX"_%s", tag_name);
+    return ListMgr_SetVar(p_mgr, varname, NULL);
+}
+
+static int gen_tag_entry(lmgr_t *p_mgr, const char *tag_name,
+                         const entry_id_t *p_id)
+{
+    char         request[1024];
+    unsigned int gen;
+    time_t       start;
+    int          rc;
+    DEF_PK(pk);
+
+    rc = gen_tag_get(p_mgr, tag_name, &gen, &start, NULL);
+    if (rc)
+        return rc;
+
+    entry_id2pk(p_id, PTR_PK(pk));
+    snprintf(request, sizeof(request), "UPDATE "MAIN_TABLE" SET "
+             DIFF_GEN_FIELD"=%u WHERE id="DPK, gen, pk);
+
+retry:
+    rc = db_exec_sql(&p_mgr->conn, request, NULL);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    return rc;
+}
+
+static struct lmgr_iterator_t *gen_list_untagged(lmgr_t *p_mgr,
+                                                 const char *tag_name,
+                                                 const lmgr_iter_opt_t *p_opt)
+{
+    GString         *req;
+    GString         *set_query;
+    unsigned int     gen;
+    time_t           start;
+    struct lmgr_iterator_t *it;
+    int              rc;
+
+    rc = gen_tag_get(p_mgr, tag_name, &gen, &start, &set_query);
+    if (rc)
+        return NULL;
+
+    req = g_string_new(NULL);
+    if (set_query == NULL)
+        g_string_printf(req, "SELECT id FROM "MAIN_TABLE" e WHERE ");
+    else
+        g_string_printf(req, "SELECT e.id FROM "MAIN_TABLE" e JOIN (%s) s"
+                        " ON e.id=s.id WHERE ", set_query->str);
+
+    g_string_append_printf(req, "e."DIFF_GEN_FIELD"<%u AND (e.md_update IS "
+                           "NULL OR e.md_update<%lu)", gen,
+                           (unsigned long)start);
+
+    if (p_opt && (p_opt->list_count_max > 0))
+        g_string_append_printf(req, " LIMIT %u", p_opt->list_count_max);
+
+    /* allocate a new iterator */
+    it = (lmgr_iterator_t *) MemCalloc(1, sizeof(lmgr_iterator_t));
+    if (it == NULL)
+        goto free_str;
+    it->p_mgr = p_mgr;
+    if (p_opt)
+    {
+        it->opt = *p_opt;
+        it->opt_is_set = 1;
+    }
+    else
+    {
+        it->opt_is_set = 0;
+    }
+
+    /* execute request */
+retry:
+    rc = db_exec_sql(&p_mgr->conn, req->str, &it->select_result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+    {
+        MemFree(it);
+        it = NULL;
+    }
+
+free_str:
+    g_string_free(req, TRUE);
+    if (set_query != NULL)
+        g_string_free(set_query, TRUE);
+    return it;
+}
 
 /**
- * Create a (persitent) table to tag entries.
+ * Create a tag to list the entries that are not tagged.
  * \param filter indicate this applies to a restricted set of entries.
  * \param reset indicate if the table is cleaned in case it already exists.
  */
@@ -33,49 +376,27 @@ int ListMgr_CreateTag(lmgr_t * p_mgr, const char *tag_name,
                       lmgr_filter_t * p_filter, bool reset)
 {
     GString         *req = NULL;
-    GString         *from = NULL;
-    GString         *where = NULL;
-    table_enum       query_tab = T_NONE;
-    bool             distinct = false;
+    GString         *set_query;
     int              rc;
-    struct field_count fcnt = {0};
+
+    if (listmgr_diff_gen_enabled())
+        return gen_create_tag(p_mgr, tag_name, p_filter);
 
     /* create table statement */
     req = g_string_new("CREATE TABLE ");
     g_string_append_printf(req, "TAG_%s (id "PK_TYPE" PRIMARY KEY) AS ",
                            tag_name);
 
-    /* now build the SELECT clause */
-    if (no_filter(p_filter))
+    set_query = tag_set_query(p_mgr, p_filter);
+    if (set_query == NULL)
     {
         /* no filter, create a table with all ids */
         g_string_append(req, "SELECT id FROM "MAIN_TABLE);
     }
     else
     {
-        where = g_string_new(NULL);
-        filter_where(p_mgr, p_filter, &fcnt, where, 0);
-
-        if (nb_field_tables(&fcnt) == 0)
-        {
-            /* finally, no filter */
-            g_string_append(req, "SELECT id FROM "MAIN_TABLE);
-        }
-        else
-        {
-            /* build the FROM clause */
-            from = g_string_new(NULL);
-            filter_from(p_mgr, &fcnt, from, &query_tab, &distinct, 0);
-
-            if (distinct)
-                g_string_printf(req, "SELECT DISTINCT(%s.id) AS id",
-                                table2name(query_tab));
-            else
-                g_string_printf(req, "SELECT %s.id AS id",
-                                table2name(query_tab));
-
-            g_string_append_printf(req, "FROM %s WHERE %s", from->str, where->str);
-        }
+        g_string_append(req, set_query->str);
+        g_string_free(set_query, TRUE);
     }
 
 retry:
@@ -103,12 +424,7 @@ retry:
 rollback:
     lmgr_rollback(p_mgr);
 free_str:
-    if (req != NULL)
-        g_string_free(req, TRUE);
-    if (from != NULL)
-        g_string_free(from, TRUE);
-    if (where != NULL)
-        g_string_free(where, TRUE);
+    g_string_free(req, TRUE);
     return rc;
 }
 
@@ -116,6 +432,10 @@ free_str:
 int ListMgr_DestroyTag(lmgr_t * p_mgr, const char *tag_name)
 {
     char tabname[1024];
+
+    if (listmgr_diff_gen_enabled())
+        return gen_destroy_tag(p_mgr, tag_name);
+
     snprintf(tabname, 1024, "TAG_%s", tag_name);
 
     return db_drop_component( &p_mgr->conn, DBOBJ_TABLE, tabname );
@@ -130,6 +450,9 @@ int ListMgr_TagEntry(lmgr_t * p_mgr, const char *tag_name, const entry_id_t * p_
     int            rc;
     DEF_PK(pk);
 
+    if (listmgr_diff_gen_enabled())
+        return gen_tag_entry(p_mgr, tag_name, p_id);
+
     /* We want the remove operation to be atomic */
 retry:
     rc = lmgr_begin(p_mgr);
@@ -168,13 +491,18 @@ struct lmgr_iterator_t *ListMgr_ListUntagged( lmgr_t * p_mgr,
     struct lmgr_iterator_t * it;
     int rc;
 
+    if (listmgr_diff_gen_enabled())
+        return gen_list_untagged(p_mgr, tag_name, p_opt);
+
     query_end += sprintf(query_end, "SELECT id FROM TAG_%s", tag_name);
 
     if (p_opt && (p_opt->list_count_max > 0))
         query_end += sprintf(query_end, " LIMIT %u", p_opt->list_count_max);
 
     /* allocate a new iterator */
-    it = (lmgr_iterator_t *) MemAlloc(sizeof(lmgr_iterator_t));
+    it = (lmgr_iterator_t *) MemCalloc(1, sizeof(lmgr_iterator_t));
+    if (it == NULL)
+        return NULL;
     it->p_mgr = p_mgr;
     if (p_opt)
     {
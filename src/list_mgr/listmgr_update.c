@@ -21,6 +21,7 @@
 #include "listmgr_common.h"
 #include "listmgr_stripe.h"
 #include "rbh_logs.h"
+#include "Memory.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,11 +29,66 @@
 #include <pthread.h>
 
 
+/**
+ * Update the attributes of an entry in main or annex table,
+ * using a prepared statement.
+ */
+static int update_table_stmt(lmgr_t *p_mgr, GString *req,
+                             const attr_set_t *p_update_set, table_enum table,
+                             PK_ARG_T pk)
+{
+    /* 1 param per attribute (x2 for bullet proofing) + id */
+    db_param_t     params[2*8*sizeof(attr_mask_t) + 1];
+    GStringChunk  *chunk = NULL;
+    lmgr_stmt_e    kind = (table == T_MAIN) ? STMT_UPDATE_MAIN
+                                            : STMT_UPDATE_ANNEX;
+    db_stmt_t     *stmt;
+    int            count, rc;
+
+    count = attrset2params(p_update_set, table, params,
+                           sizeof(params)/sizeof(params[0]) - 1, &chunk);
+    if (count <= 0)
+    {
+        rc = -count;
+        goto out;
+    }
+    params[count].type = PK_DB_TYPE;
+    params[count].value.val_str = pk;
+
+    stmt = lmgr_stmt_lookup(p_mgr, kind, &p_update_set->attr_mask);
+    if (stmt == NULL)
+    {
+        g_string_printf(req, "UPDATE %s SET ",
+                        (table == T_MAIN) ? MAIN_TABLE : ANNEX_TABLE);
+        rc = attrset2updatelist(p_mgr, req, p_update_set, table, AOF_PARAM);
+        if (rc < 0)
+        {
+            rc = -rc;
+            goto out;
+        }
+        g_string_append(req, " WHERE id=?");
+
+        rc = lmgr_stmt_prepare(p_mgr, kind, &p_update_set->attr_mask,
+                               req->str, &stmt);
+        if (rc)
+            goto out;
+    }
+
+    rc = lmgr_stmt_exec(p_mgr, stmt, params, count + 1);
+    if (rc == DB_SUCCESS)
+        db_stmt_free_result(&p_mgr->conn, stmt);
+out:
+    if (chunk != NULL)
+        g_string_chunk_free(chunk);
+    return rc;
+}
+
 int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
                    const attr_set_t *p_update_set)
 {
     int            rc;
     GString       *req;
+    bool           acct;
     DEF_PK(pk);
 
     /* read only fields in info mask? */
@@ -45,6 +101,9 @@ int ListMgr_Update(lmgr_t *p_mgr, const entry_id_t *p_id,
     }
 
     entry_id2pk(p_id, PTR_PK(pk));
+    acct = acct_fields(p_update_set->attr_mask)
+           || diragg_fields(p_update_set->attr_mask)
+           || ostagg_fields(p_update_set->attr_mask);
 
     req = g_string_new(NULL);
 
@@ -53,26 +112,24 @@ retry:
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
 
+    /* accounting deltas: subtract previous values */
+    if (acct)
+    {
+        rc = listmgr_acct_delta(p_mgr, (pktype *)pk, 1, -1);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+
     /* update fields in main table */
     if (main_fields(p_update_set->attr_mask))
     {
-        g_string_assign(req, "UPDATE "MAIN_TABLE" SET ");
-
-        rc = attrset2updatelist(p_mgr, req, p_update_set, T_MAIN, 0);
-        if (rc < 0)
-        {
-            rc = -rc;
-            goto free_str;
-        }
-        else if (rc > 0)
-        {
-            g_string_append_printf(req, " WHERE id="DPK, pk);
-            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
-            if (lmgr_delayed_retry(p_mgr, rc))
-                goto retry;
-            else if (rc)
-                goto rollback;
-        }
+        rc = update_table_stmt(p_mgr, req, p_update_set, T_MAIN, pk);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
     }
 
     /* update names table */
@@ -105,22 +162,11 @@ retry:
     /* update annex table */
     if (annex_fields(p_update_set->attr_mask))
     {
-        g_string_assign(req, "UPDATE "ANNEX_TABLE" SET ");
-        rc = attrset2updatelist(p_mgr, req, p_update_set, T_ANNEX, 0);
-        if (rc < 0)
-        {
-            rc = -rc;
-            goto free_str;
-        }
-        else if (rc > 0)
-        {
-            g_string_append_printf(req, " WHERE id="DPK, pk);
-            rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
-            if (lmgr_delayed_retry(p_mgr, rc))
-                goto retry;
-            else if (rc)
-                goto rollback;
-        }
+        rc = update_table_stmt(p_mgr, req, p_update_set, T_ANNEX, pk);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
     }
 
 #ifdef _LUSTRE
@@ -146,6 +192,16 @@ retry:
     }
 #endif
 
+    /* accounting deltas: add new values */
+    if (acct)
+    {
+        rc = listmgr_acct_delta(p_mgr, (pktype *)pk, 1, 1);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+
     rc = lmgr_commit(p_mgr);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
@@ -157,68 +213,338 @@ retry:
 rollback:
     lmgr_rollback(p_mgr);
 free_str:
+    listmgr_cache_invalidate(p_id);
+    if (ATTR_MASK_TEST(p_update_set, name)
+        || ATTR_MASK_TEST(p_update_set, parent_id))
+        listmgr_path_invalidate(p_id);
     g_string_free(req, TRUE);
     return rc;
 }
 
-/** XXX ListMgr_MassUpdate() is not used => dropped in v3.0 */
+static inline bool has_names(const attr_set_t *p_set)
+{
+    return ATTR_MASK_TEST(p_set, name) && ATTR_MASK_TEST(p_set, parent_id);
+}
 
-int ListMgr_Replace(lmgr_t *p_mgr, entry_id_t *old_id, attr_set_t *old_attrs,
-                    entry_id_t *new_id, attr_set_t *new_attrs,
-                    bool src_is_last, bool update_target_if_exists)
+/** the two sets have the same name fields */
+static inline bool same_names(const attr_set_t *p_set1,
+                              const attr_set_t *p_set2)
 {
-    GString *req = NULL;
-    DEF_PK(oldpk);
-    DEF_PK(newpk);
+    attr_mask_t m1 = attr_mask_and(&p_set1->attr_mask, &names_attr_set);
+    attr_mask_t m2 = attr_mask_and(&p_set2->attr_mask, &names_attr_set);
+
+    return attr_mask_equal(&m1, &m2);
+}
+
+/**
+ * Update the main or annex table for a set of entries, in a single request.
+ */
+static int batch_update_table(lmgr_t *p_mgr, GString *req, const pktype *pks,
+                              const attr_set_t **p_attrs, unsigned int count,
+                              table_enum table)
+{
+    unsigned int i;
+    int rc;
+
+    g_string_printf(req, "UPDATE %s SET ",
+                    (table == T_MAIN) ? MAIN_TABLE : ANNEX_TABLE);
+    rc = attrsets2caselist(p_mgr, req, pks, p_attrs, count, table);
+    if (rc <= 0)
+        return -rc;
+
+    g_string_append(req, " WHERE id IN (");
+    for (i = 0; i < count; i++)
+        g_string_append_printf(req, "%s"DPK, i == 0 ? "" : ",", pks[i]);
+    g_string_append_c(req, ')');
+
+    return db_exec_sql(&p_mgr->conn, req->str, NULL);
+}
+
+/**
+ * Insert or update the names of a set of entries:
+ * one request for each distinct set of name fields.
+ */
+static int batch_update_names(lmgr_t *p_mgr, GString *req, const pktype *pks,
+                              const attr_set_t **p_attrs, unsigned int count)
+{
+    unsigned int i, j;
     int rc;
 
+    for (i = 0; i < count; i++)
+    {
+        bool done = false;
+
+        if (!has_names(p_attrs[i]))
+            continue;
+
+        /* already done with a previous entry */
+        for (j = 0; j < i && !done; j++)
+            done = has_names(p_attrs[j]) && same_names(p_attrs[i], p_attrs[j]);
+        if (done)
+            continue;
+
+        g_string_assign(req, "INSERT INTO " DNAMES_TABLE "(id");
+        attrmask2fieldlist(req, p_attrs[i]->attr_mask, T_DNAMES, "", "",
+                           AOF_LEADING_SEP);
+        g_string_append(req, ",pkn) VALUES ");
+
+        for (j = i; j < count; j++)
+        {
+            if (!has_names(p_attrs[j]) || !same_names(p_attrs[i], p_attrs[j]))
+                continue;
+
+            g_string_append_printf(req, "%s("DPK, j == i ? "" : ",", pks[j]);
+            attrset2valuelist(p_mgr, req, p_attrs[j], T_DNAMES,
+                              AOF_LEADING_SEP);
+            g_string_append(req, ","HNAME_DEF")");
+        }
+        g_string_append(req, " ON DUPLICATE KEY UPDATE id=VALUES(id)");
+        attrset2updatelist(p_mgr, req, p_attrs[i], T_DNAMES,
+                           AOF_LEADING_SEP | AOF_GENERIC_VAL);
+
+        rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
+int ListMgr_BatchUpdate(lmgr_t *p_mgr, unsigned int count,
+                        const entry_id_t **p_ids, const attr_set_t **p_attrs)
+{
+    int            rc;
+    unsigned int   i;
+    GString       *req;
+    pktype        *pks;
+    attr_mask_t    all = null_mask;
+    bool           acct;
+
+    if (count == 0)
+        return DB_SUCCESS;
+    else if (count == 1)
+        return ListMgr_Update(p_mgr, p_ids[0], p_attrs[0]);
+
+    for (i = 0; i < count; i++)
+    {
+        /* read only fields in info mask? */
+        if (readonly_fields(p_attrs[i]->attr_mask))
+        {
+            attr_mask_t and = attr_mask_and(&p_attrs[i]->attr_mask,
+                                            &readonly_attr_set);
+            DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Error: trying to update read "
+                       "only values: attr_mask="DMASK, PMASK(&and));
+            return DB_INVALID_ARG;
+        }
+        all = attr_mask_or(&all, &p_attrs[i]->attr_mask);
+    }
+
+    pks = MemCalloc(count, sizeof(pktype));
+    if (pks == NULL)
+        return DB_NO_MEMORY;
+    for (i = 0; i < count; i++)
+        entry_id2pk(p_ids[i], PTR_PK(pks[i]));
+
+    acct = acct_fields(all) || diragg_fields(all) || ostagg_fields(all);
+
+    req = g_string_new(NULL);
+
 retry:
     rc = lmgr_begin(p_mgr);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
-    else if (rc)
-        return rc;
 
-    /* delete the old entry */
-    rc = listmgr_remove_no_tx(p_mgr, old_id, old_attrs, src_is_last);
+    /* accounting deltas: subtract previous values */
+    if (acct)
+    {
+        rc = listmgr_acct_delta(p_mgr, pks, count, -1);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+
+    if (main_fields(all))
+    {
+        rc = batch_update_table(p_mgr, req, pks, p_attrs, count, T_MAIN);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+
+    rc = batch_update_names(p_mgr, req, pks, p_attrs, count);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
     else if (rc)
         goto rollback;
 
-    /* create the new one */
-    rc = listmgr_batch_insert_no_tx(p_mgr, &new_id, &new_attrs, 1,
-                                    update_target_if_exists);
+    if (annex_fields(all))
+    {
+        rc = batch_update_table(p_mgr, req, pks, p_attrs, count, T_ANNEX);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+
+#ifdef _LUSTRE
+    /* stripe changes are rare: one request per entry */
+    for (i = 0; i < count; i++)
+    {
+        const attr_set_t *p_set = p_attrs[i];
+#ifdef HAVE_LLAPI_FSWAP_LAYOUTS
+        int validator;
+#else
+        int validator = VALID(p_ids[i]);
+#endif
+        const stripe_items_t *p_items = NULL;
+
+        if (!ATTR_MASK_TEST(p_set, stripe_info))
+            continue;
+#ifdef HAVE_LLAPI_FSWAP_LAYOUTS
+        validator = ATTR(p_set, stripe_info).validator;
+#endif
+        if (ATTR_MASK_TEST(p_set, stripe_items))
+            p_items = &ATTR(p_set, stripe_items);
+
+        rc = update_stripe_info(p_mgr, pks[i], validator,
+                                &ATTR(p_set, stripe_info), p_items, true);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+#endif
+
+    /* accounting deltas: add new values */
+    if (acct)
+    {
+        rc = listmgr_acct_delta(p_mgr, pks, count, 1);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+
+    rc = lmgr_commit(p_mgr);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
-    else if (rc)
-        goto rollback;
+    if (rc == DB_SUCCESS)
+        p_mgr->nbop[OPIDX_UPDATE] += count;
+
+    goto free_str;
+
+rollback:
+    lmgr_rollback(p_mgr);
+free_str:
+    for (i = 0; i < count; i++)
+    {
+        listmgr_cache_invalidate(p_ids[i]);
+        if (ATTR_MASK_TEST(p_attrs[i], name)
+            || ATTR_MASK_TEST(p_attrs[i], parent_id))
+            listmgr_path_invalidate(p_ids[i]);
+    }
+    g_string_free(req, TRUE);
+    MemFree(pks);
+    return rc;
+}
+
+/** XXX ListMgr_MassUpdate() is not used => dropped in v3.0 */
+
+/** replace an entry, in the current transaction */
+static int listmgr_replace_no_tx(lmgr_t *p_mgr, entry_id_t *old_id,
+                                 attr_set_t *old_attrs, entry_id_t *new_id,
+                                 attr_set_t *new_attrs, bool src_is_last,
+                                 bool update_target_if_exists, GString *req)
+{
+    DEF_PK(oldpk);
+    DEF_PK(newpk);
+    int rc;
+
+    /* delete the old entry */
+    rc = listmgr_remove_no_tx(p_mgr, old_id, old_attrs, src_is_last);
+    if (rc)
+        return rc;
 
-    /* update parent ids in NAMES table */
     entry_id2pk(old_id, PTR_PK(oldpk));
     entry_id2pk(new_id, PTR_PK(newpk));
 
-    req = g_string_new("UPDATE "DNAMES_TABLE);
-    g_string_append_printf(req, " SET parent_id="DPK" WHERE parent_id="DPK,
-                           newpk, oldpk);
-    rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+    /* the children are moved to the new entry, with their aggregates
+     * (before the new entry is accounted to its parent) */
+    if (lmgr_config.dir_agg)
+    {
+        g_string_printf(req, "UPDATE "DIRAGG_TABLE" SET id="DPK" WHERE id="DPK,
+                        newpk, oldpk);
+        rc = db_exec_sql(&p_mgr->conn, req->str, NULL);
+        if (rc)
+            return rc;
+    }
+
+    /* create the new one */
+    rc = listmgr_batch_insert_no_tx(p_mgr, &new_id, &new_attrs, 1,
+                                    update_target_if_exists);
+    if (rc)
+        return rc;
+
+    /* update parent ids in NAMES table */
+    g_string_printf(req, "UPDATE "DNAMES_TABLE" SET parent_id="DPK
+                    " WHERE parent_id="DPK, newpk, oldpk);
+    return db_exec_sql(&p_mgr->conn, req->str, NULL);
+}
+
+int ListMgr_Replace(lmgr_t *p_mgr, entry_id_t *old_id, attr_set_t *old_attrs,
+                    entry_id_t *new_id, attr_set_t *new_attrs,
+                    bool src_is_last, bool update_target_if_exists)
+{
+    return ListMgr_BatchReplace(p_mgr, 1, &old_id, &old_attrs, &new_id,
+                                &new_attrs, src_is_last,
+                                update_target_if_exists);
+}
+
+int ListMgr_BatchReplace(lmgr_t *p_mgr, unsigned int count,
+                         entry_id_t **old_ids, attr_set_t **old_attrs,
+                         entry_id_t **new_ids, attr_set_t **new_attrs,
+                         bool src_is_last, bool update_target_if_exists)
+{
+    GString     *req;
+    unsigned int i;
+    int          rc;
+
+    if (count == 0)
+        return DB_SUCCESS;
+
+    req = g_string_new(NULL);
+
+    /* all replacements in a single transaction */
+retry:
+    rc = lmgr_begin(p_mgr);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
     else if (rc)
-        goto rollback;
+        goto free_str;
+
+    for (i = 0; i < count; i++)
+    {
+        rc = listmgr_replace_no_tx(p_mgr, old_ids[i], old_attrs[i],
+                                   new_ids[i], new_attrs[i], src_is_last,
+                                   update_target_if_exists, req);
+        if (lmgr_delayed_retry(p_mgr, rc))
+            goto retry;
+        else if (rc)
+            goto rollback;
+    }
+    /* children of the old entries are not known here */
+    listmgr_cache_invalidate_all();
+    listmgr_path_invalidate_all();
 
     rc = lmgr_commit(p_mgr);
     if (lmgr_delayed_retry(p_mgr, rc))
         goto retry;
-    else
-    {
-        g_string_free(req, TRUE);
-        return rc;
-    }
+    goto free_str;
 
 rollback:
     lmgr_rollback(p_mgr);
-    if (req != NULL)
-        g_string_free(req, TRUE);
+free_str:
+    g_string_free(req, TRUE);
     return rc;
 }
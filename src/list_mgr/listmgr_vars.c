@@ -23,7 +23,9 @@
 #include "database.h"
 #include "listmgr_common.h"
 #include "rbh_logs.h"
+#include "rbh_misc.h"
 #include <stdio.h>
+#include <string.h>
 
 int lmgr_get_var(db_conn_t *pconn, const char *varname, char *value,
                  int bufsize)
@@ -133,3 +135,71 @@ int ListMgr_SetVar(lmgr_t *p_mgr, const char *varname, const char *value)
         goto retry;
     return rc;
 }
+
+/**
+ *  Set variable value if its current value is the expected one
+ *  (NULL for a variable that doesn't exist). NULL value deletes it.
+ *  @return DB_OUT_OF_DATE if the current value is not the expected one.
+ */
+int ListMgr_TestAndSetVar(lmgr_t *p_mgr, const char *varname,
+                          const char *expected, const char *value)
+{
+    char     current[MAX_VAR_LEN];
+    GString *req;
+    result_handle_t result;
+    char    *str_val = NULL;
+    int      rc;
+
+    req = g_string_new(NULL);
+    g_string_printf(req, "SELECT value FROM " VAR_TABLE " WHERE varname='%s'"
+                    " FOR UPDATE", varname);
+ retry:
+    /* this must be atomic, whatever the commit behavior */
+    rc = _lmgr_begin(p_mgr, 1);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto out;
+
+    rc = db_exec_sql(&p_mgr->conn, req->str, &result);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    rc = db_next_record(&p_mgr->conn, &result, &str_val, 1);
+    if (rc == DB_SUCCESS && str_val != NULL)
+        rh_strncpy(current, str_val, sizeof(current));
+    db_result_free(&p_mgr->conn, &result);
+
+    if (rc == DB_END_OF_LIST) {
+        if (expected != NULL) {
+            rc = DB_OUT_OF_DATE;
+            goto rollback;
+        }
+    } else if (lmgr_delayed_retry(p_mgr, rc)) {
+        goto retry;
+    } else if (rc) {
+        goto rollback;
+    } else if (expected == NULL || strcmp(current, expected) != 0) {
+        rc = DB_OUT_OF_DATE;
+        goto rollback;
+    }
+
+    rc = lmgr_set_var(&p_mgr->conn, varname, value);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    else if (rc)
+        goto rollback;
+
+    rc = _lmgr_commit(p_mgr, 1);
+    if (lmgr_delayed_retry(p_mgr, rc))
+        goto retry;
+    goto out;
+
+ rollback:
+    _lmgr_rollback(p_mgr, 1);
+ out:
+    g_string_free(req, TRUE);
+    return rc;
+}
@@ -135,6 +135,14 @@ int db_connect( db_conn_t * conn )
     conn->reconnect = 1;
 #endif
 
+    /* only allow LOAD DATA LOCAL INFILE if the bulk load mode is enabled */
+    if (!EMPTY_STRING(lmgr_config.db_config.bulk_load_dir))
+    {
+        unsigned int local_infile = 1;
+
+        mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+    }
+
     while(1) {
         /* connect to server */
         if ( !mysql_real_connect
@@ -207,19 +215,25 @@ char          *db_errmsg( db_conn_t * conn, char *errmsg, unsigned int buflen )
     return errmsg;
 }
 
-static int _db_exec_sql(db_conn_t *conn, const char *query,
-                        result_handle_t *p_result, bool quiet)
+static int mysql_exec_sql(db_conn_t *conn, const char *query,
+                          result_handle_t *p_result, bool quiet, bool stream,
+                          const char *caller)
 {
     int            rc;
     int            dberr;
+    struct timeval start;
 #ifdef _DEBUG_DB
     DisplayLog( LVL_FULL, LISTMGR_TAG, "SQL query: %s", query );
 #endif
 
+    gettimeofday(&start, NULL);
     rc = mysql_real_query(conn, query, strlen(query));
     dberr = mysql_errno(conn);
     if (rc)
     {
+        /* e.g. lock wait timeouts */
+        db_query_stats_add(query, caller, &start);
+
         rc = mysql_error_convert(dberr, quiet?0:1);
         if (dberr == ER_DUP_ENTRY)
         {
@@ -250,23 +264,57 @@ static int _db_exec_sql(db_conn_t *conn, const char *query,
         /* fetch results to the client */
         if (p_result)
         {
-            *p_result = mysql_store_result(conn);
-            if (*p_result == NULL)
-                return DB_NOT_EXISTS;
+            if (stream)
+                *p_result = mysql_use_result(conn);
+            else
+                *p_result = mysql_store_result(conn);
         }
+        /* including the transfer of a buffered result */
+        db_query_stats_add(query, caller, &start);
+
+        if (p_result && *p_result == NULL)
+            return DB_NOT_EXISTS;
 
         return DB_SUCCESS;
     }
 }
 
-int db_exec_sql_quiet( db_conn_t * conn, const char *query, result_handle_t * p_result )
+int _db_exec_sql_quiet(db_conn_t *conn, const char *query,
+                       result_handle_t *p_result, const char *caller)
+{
+    return mysql_exec_sql(conn, query, p_result, true, false, caller);
+}
+
+int _db_exec_sql(db_conn_t *conn, const char *query,
+                 result_handle_t *p_result, const char *caller)
+{
+    return mysql_exec_sql(conn, query, p_result, false, false, caller);
+}
+
+int _db_exec_sql_stream(db_conn_t *conn, const char *query,
+                        result_handle_t *p_result, const char *caller)
+{
+    return mysql_exec_sql(conn, query, p_result, false, true, caller);
+}
+
+int db_stream_status(db_conn_t *conn)
 {
-    return _db_exec_sql(conn, query, p_result, true);
+    int dberr = mysql_errno(conn);
+
+    if (dberr == 0)
+        return DB_SUCCESS;
+
+    DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Error reading streamed result: %s",
+               mysql_error(conn));
+    return mysql_error_convert(dberr, 1);
 }
 
-int db_exec_sql( db_conn_t * conn, const char *query, result_handle_t * p_result )
+int db_stream_close(db_conn_t *conn, result_handle_t *p_result)
 {
-    return _db_exec_sql(conn, query, p_result, false);
+    /* mysql_free_result() would read the remaining records:
+     * close the connection first */
+    db_close_conn(conn);
+    return db_result_free(conn, p_result);
 }
 
 
@@ -424,12 +472,12 @@ int            db_drop_component( db_conn_t * conn, db_object_e obj_type, const
     if( mysql_get_server_version(conn) < 50032 )
     {
         sprintf(query, "DROP %s %s ", tname, name);
-        return _db_exec_sql(conn, query, NULL, true);
+        return mysql_exec_sql(conn, query, NULL, true, false, __func__);
     }
     else
     {
         sprintf(query, "DROP %s IF EXISTS %s ", tname, name);
-        return _db_exec_sql(conn, query, NULL, false);
+        return mysql_exec_sql(conn, query, NULL, false, false, __func__);
     }
 }
 
@@ -449,7 +497,7 @@ int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
         sprintf(query, "SELECT EVENT_OBJECT_TABLE FROM INFORMATION_SCHEMA.TRIGGERS WHERE TRIGGER_SCHEMA='%s'"
                 "AND TRIGGER_NAME='%s'", lmgr_config.db_config.db, name);
 
-        rc = _db_exec_sql(conn, query, &result, false);
+        rc = mysql_exec_sql(conn, query, &result, false, false, __func__);
         if ( rc )
             return rc;
 
@@ -499,7 +547,7 @@ int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
         sprintf(query, "SHOW FUNCTION STATUS WHERE DB='%s' AND NAME='%s'",
                 lmgr_config.db_config.db, name);
 
-        rc = _db_exec_sql(conn, query, &result, false);
+        rc = mysql_exec_sql(conn, query, &result, false, false, __func__);
         if ( rc )
             return rc;
 
@@ -528,9 +576,39 @@ int db_check_component(db_conn_t *conn, db_object_e obj_type, const char *name,
         mysql_free_result(result);
         return rc;
     }
+    else if (obj_type == DBOBJ_INDEX)
+    {
+        /* arg: table of the index */
+        sprintf(query, "SELECT COLUMN_NAME FROM INFORMATION_SCHEMA.STATISTICS "
+                "WHERE TABLE_SCHEMA='%s' AND TABLE_NAME='%s' AND INDEX_NAME='%s'",
+                lmgr_config.db_config.db, arg, name);
+
+        rc = mysql_exec_sql(conn, query, &result, false, false, __func__);
+        if ( rc )
+            return rc;
+
+        if (!result)
+        {
+            DisplayLog(LVL_DEBUG, LISTMGR_TAG, "%s does not exist", name);
+            return DB_NOT_EXISTS;
+        }
+
+        /* one row per indexed column */
+        if (mysql_fetch_row(result))
+        {
+            DisplayLog(LVL_FULL, LISTMGR_TAG, "Index %s exists on %s", name,
+                       arg);
+            rc = DB_SUCCESS;
+        }
+        else
+            rc = DB_NOT_EXISTS;
+
+        mysql_free_result(result);
+        return rc;
+    }
     else
     {
-        RBH_BUG("Only triggers are supported for now");
+        RBH_BUG("Only triggers, functions and indexes are supported for now");
     }
 }
 
@@ -544,7 +622,7 @@ int db_create_trigger( db_conn_t * conn, const char *name, const char *event,
 
     g_string_append_printf(request, "%s %s ON %s FOR EACH ROW "
                            "BEGIN %s END", name, event, table, body);
-    rc = _db_exec_sql(conn, request->str, NULL, false);
+    rc = mysql_exec_sql(conn, request->str, NULL, false, false, __func__);
     g_string_free(request, TRUE);
     return rc;
 #else
@@ -555,6 +633,30 @@ int db_create_trigger( db_conn_t * conn, const char *name, const char *event,
 #endif
 }
 
+int db_load_file(db_conn_t *conn, const char *path, const char *table,
+                 const char *columns, const char *set)
+{
+    int      rc;
+    int      len = 2 * strlen(path) + 1;
+    char    *esc_path = MemAlloc(len);
+    GString *request;
+
+    if (!esc_path)
+        return DB_NO_MEMORY;
+    db_escape_string(conn, esc_path, len, path);
+
+    request = g_string_new(NULL);
+    g_string_printf(request, "LOAD DATA LOCAL INFILE '%s' REPLACE INTO TABLE "
+                    "%s (%s)", esc_path, table, columns);
+    if (set != NULL)
+        g_string_append_printf(request, " SET %s", set);
+
+    rc = db_exec_sql(conn, request->str, NULL);
+    g_string_free(request, TRUE);
+    MemFree(esc_path);
+    return rc;
+}
+
 static inline const char * txlvl_str(tx_level_e lvl)
 {
     switch(lvl)
@@ -578,6 +680,426 @@ int db_transaction_level(db_conn_t * conn, what_trans_e what_tx, tx_level_e tx_l
         sprintf(query, "SET SESSION TRANSACTION ISOLATION LEVEL %s",
                 txlvl_str(tx_level));
 
-    return _db_exec_sql(conn, query, NULL, false);
+    return mysql_exec_sql(conn, query, NULL, false, false, __func__);
+}
+
+
+/* -------------------- Prepared statements ---------------- */
+
+/* initial size of result buffers (grown if a value is longer) */
+#define STMT_RESULT_BUF_MIN  256
+#define STMT_RESULT_BUF_MAX  65536
+
+struct db_stmt {
+    MYSQL_STMT     *stmt;
+
+    /* parameters */
+    unsigned int    nb_params;
+    MYSQL_BIND     *params;
+    unsigned long  *param_len;
+    signed char    *param_tiny;    /* storage for booleans */
+
+    /* results (as strings, or binary for integer types) */
+    unsigned int    nb_fields;
+    MYSQL_BIND     *results;
+    char          **result_buf;
+    unsigned long  *result_len;
+    my_bool        *result_null;
+    db_type_e      *result_types;  /* NULL if all results are strings */
+    db_type_u      *result_vals;
+    signed char    *result_tiny;   /* storage for booleans */
+
+    /* statement request (for query stats) */
+    char           *query;
+};
+
+static int stmt_error(MYSQL_STMT *stmt, const char *what)
+{
+    int rc = mysql_error_convert(mysql_stmt_errno(stmt), 1);
+
+    if (!db_is_retryable(rc))
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Error %d %s prepared statement: "
+                   "%s", rc, what, mysql_stmt_error(stmt));
+    return rc;
+}
+
+static void stmt_free(db_stmt_t *s)
+{
+    unsigned int i;
+
+    if (s->result_buf != NULL)
+        for (i = 0; i < s->nb_fields; i++)
+            MemFreeTag(s->result_buf[i]);
+    MemFree(s->result_buf);
+    MemFree(s->result_tiny);
+    MemFree(s->result_vals);
+    MemFree(s->result_types);
+    MemFree(s->result_len);
+    MemFree(s->result_null);
+    MemFree(s->results);
+    MemFree(s->param_tiny);
+    MemFree(s->param_len);
+    MemFree(s->params);
+    MemFree(s->query);
+    MemFree(s);
+}
+
+int db_stmt_prepare(db_conn_t *conn, const char *query, db_stmt_t **p_stmt)
+{
+    db_stmt_t *s;
+    MYSQL_RES *meta;
+    unsigned int i;
+    int rc;
+
+#ifdef _DEBUG_DB
+    DisplayLog(LVL_FULL, LISTMGR_TAG, "SQL prepare: %s", query);
+#endif
+
+    s = MemCalloc(1, sizeof(*s));
+    if (!s)
+        return DB_NO_MEMORY;
+
+    s->stmt = mysql_stmt_init(conn);
+    if (!s->stmt)
+    {
+        MemFree(s);
+        return DB_NO_MEMORY;
+    }
+
+    if (mysql_stmt_prepare(s->stmt, query, strlen(query)))
+    {
+        rc = mysql_error_convert(mysql_stmt_errno(s->stmt), 1);
+        DisplayLog(LVL_MAJOR, LISTMGR_TAG, "Error %d preparing statement '%s': "
+                   "%s", rc, query, mysql_stmt_error(s->stmt));
+        mysql_stmt_close(s->stmt);
+        MemFree(s);
+        return rc;
+    }
+
+    s->query = MemAlloc(strlen(query) + 1);
+    if (!s->query)
+        goto nomem;
+    strcpy(s->query, query);
+
+    s->nb_params = mysql_stmt_param_count(s->stmt);
+    if (s->nb_params > 0)
+    {
+        s->params = MemCalloc(s->nb_params, sizeof(*s->params));
+        s->param_len = MemCalloc(s->nb_params, sizeof(*s->param_len));
+        s->param_tiny = MemCalloc(s->nb_params, sizeof(*s->param_tiny));
+        if (!s->params || !s->param_len || !s->param_tiny)
+            goto nomem;
+    }
+
+    meta = mysql_stmt_result_metadata(s->stmt);
+    if (meta != NULL)
+    {
+        MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+
+        s->nb_fields = mysql_num_fields(meta);
+        s->results = MemCalloc(s->nb_fields, sizeof(*s->results));
+        s->result_buf = MemCalloc(s->nb_fields, sizeof(*s->result_buf));
+        s->result_len = MemCalloc(s->nb_fields, sizeof(*s->result_len));
+        s->result_null = MemCalloc(s->nb_fields, sizeof(*s->result_null));
+        if (!s->results || !s->result_buf || !s->result_len || !s->result_null)
+        {
+            mysql_free_result(meta);
+            goto nomem;
+        }
+
+        for (i = 0; i < s->nb_fields; i++)
+        {
+            unsigned long size = fields[i].length + 1;
+
+            if (size < STMT_RESULT_BUF_MIN)
+                size = STMT_RESULT_BUF_MIN;
+            else if (size > STMT_RESULT_BUF_MAX)
+                size = STMT_RESULT_BUF_MAX;
+
+            s->result_buf[i] = MemAllocTag(MEM_TAG_DBRESULT, size);
+            if (!s->result_buf[i])
+            {
+                mysql_free_result(meta);
+                goto nomem;
+            }
+            s->results[i].buffer_type = MYSQL_TYPE_STRING;
+            s->results[i].buffer = s->result_buf[i];
+            s->results[i].buffer_length = size;
+            s->results[i].length = &s->result_len[i];
+            s->results[i].is_null = &s->result_null[i];
+        }
+        mysql_free_result(meta);
+    }
+
+    *p_stmt = s;
+    return DB_SUCCESS;
+
+nomem:
+    mysql_stmt_close(s->stmt);
+    stmt_free(s);
+    return DB_NO_MEMORY;
 }
 
+int db_stmt_exec(db_conn_t *conn, db_stmt_t *s, const db_param_t *params,
+                 unsigned int count)
+{
+    unsigned int i;
+    struct timeval start;
+
+    if (count != s->nb_params)
+        RBH_BUG("Wrong parameter count for prepared statement");
+
+    for (i = 0; i < count; i++)
+    {
+        MYSQL_BIND *b = &s->params[i];
+        const db_type_u *v = &params[i].value;
+
+        memset(b, 0, sizeof(*b));
+        switch (params[i].type)
+        {
+            case DB_TEXT:
+            case DB_ENUM_FTYPE:
+                if (v->val_str == NULL)
+                {
+                    b->buffer_type = MYSQL_TYPE_NULL;
+                    break;
+                }
+                s->param_len[i] = strlen(v->val_str);
+                b->buffer_type = MYSQL_TYPE_STRING;
+                b->buffer = (char *)v->val_str;
+                b->buffer_length = s->param_len[i];
+                b->length = &s->param_len[i];
+                break;
+            case DB_INT:
+            case DB_UINT:
+                b->buffer_type = MYSQL_TYPE_LONG;
+                b->buffer = (char *)&v->val_int;
+                b->is_unsigned = (params[i].type == DB_UINT);
+                break;
+            case DB_SHORT:
+            case DB_USHORT:
+                b->buffer_type = MYSQL_TYPE_SHORT;
+                b->buffer = (char *)&v->val_short;
+                b->is_unsigned = (params[i].type == DB_USHORT);
+                break;
+            case DB_BIGINT:
+            case DB_BIGUINT:
+                b->buffer_type = MYSQL_TYPE_LONGLONG;
+                b->buffer = (char *)&v->val_bigint;
+                b->is_unsigned = (params[i].type == DB_BIGUINT);
+                break;
+            case DB_BOOL:
+                s->param_tiny[i] = v->val_bool ? 1 : 0;
+                b->buffer_type = MYSQL_TYPE_TINY;
+                b->buffer = (char *)&s->param_tiny[i];
+                break;
+            default:
+                RBH_BUG("Unsupported type for statement parameter");
+        }
+    }
+
+    if (s->nb_params > 0 && mysql_stmt_bind_param(s->stmt, s->params))
+        return stmt_error(s->stmt, "binding parameters of");
+
+    gettimeofday(&start, NULL);
+    if (mysql_stmt_execute(s->stmt))
+    {
+        db_query_stats_add(s->query, "(prepared statement)", &start);
+        return stmt_error(s->stmt, "executing");
+    }
+
+    if (s->nb_fields > 0)
+    {
+        if (mysql_stmt_bind_result(s->stmt, s->results))
+            return stmt_error(s->stmt, "binding results of");
+        /* fetch results to the client */
+        if (mysql_stmt_store_result(s->stmt))
+            return stmt_error(s->stmt, "storing results of");
+    }
+    db_query_stats_add(s->query, "(prepared statement)", &start);
+    return DB_SUCCESS;
+}
+
+int db_stmt_result_types(db_conn_t *conn, db_stmt_t *s,
+                         const db_type_e *types, unsigned int count)
+{
+    unsigned int i;
+
+    if (count != s->nb_fields)
+        RBH_BUG("Wrong result count for prepared statement");
+
+    s->result_types = MemCalloc(count, sizeof(*s->result_types));
+    s->result_vals = MemCalloc(count, sizeof(*s->result_vals));
+    s->result_tiny = MemCalloc(count, sizeof(*s->result_tiny));
+    if (!s->result_types || !s->result_vals || !s->result_tiny)
+        return DB_NO_MEMORY;
+
+    for (i = 0; i < count; i++)
+    {
+        MYSQL_BIND *b = &s->results[i];
+        db_type_u  *v = &s->result_vals[i];
+
+        s->result_types[i] = types[i];
+        if (!db_is_int_type(types[i]))
+            continue;
+
+        switch (types[i])
+        {
+            case DB_INT:
+            case DB_UINT:
+                b->buffer_type = MYSQL_TYPE_LONG;
+                b->buffer = (char *)&v->val_int;
+                break;
+            case DB_SHORT:
+            case DB_USHORT:
+                b->buffer_type = MYSQL_TYPE_SHORT;
+                b->buffer = (char *)&v->val_short;
+                break;
+            case DB_BIGINT:
+            case DB_BIGUINT:
+                b->buffer_type = MYSQL_TYPE_LONGLONG;
+                b->buffer = (char *)&v->val_bigint;
+                break;
+            default: /* DB_BOOL */
+                b->buffer_type = MYSQL_TYPE_TINY;
+                b->buffer = (char *)&s->result_tiny[i];
+                break;
+        }
+        b->buffer_length = 0;
+        b->is_unsigned = (types[i] == DB_UINT || types[i] == DB_USHORT
+                          || types[i] == DB_BIGUINT);
+    }
+    return DB_SUCCESS;
+}
+
+/** fetch the next row of a statement result */
+static int stmt_fetch_row(db_stmt_t *s)
+{
+    int rc = mysql_stmt_fetch(s->stmt);
+
+    if (rc == MYSQL_NO_DATA)
+        return DB_END_OF_LIST;
+    else if (rc == 1)
+        return stmt_error(s->stmt, "fetching results of");
+    return DB_SUCCESS;
+}
+
+/** get a string column of the current row */
+static int stmt_get_str(db_stmt_t *s, unsigned int i, char **p_str)
+{
+    MYSQL_BIND *b = &s->results[i];
+
+    /* value was truncated: grow the buffer and get it again */
+    if (s->result_len[i] >= b->buffer_length)
+    {
+        char *buf = MemAllocTag(MEM_TAG_DBRESULT, s->result_len[i] + 1);
+
+        if (!buf)
+            return DB_NO_MEMORY;
+        MemFreeTag(s->result_buf[i]);
+        s->result_buf[i] = buf;
+        b->buffer = buf;
+        b->buffer_length = s->result_len[i] + 1;
+        if (mysql_stmt_fetch_column(s->stmt, b, i, 0))
+            return stmt_error(s->stmt, "fetching results of");
+        /* new buffers must be bound for the next rows */
+        if (mysql_stmt_bind_result(s->stmt, s->results))
+            return stmt_error(s->stmt, "binding results of");
+    }
+    s->result_buf[i][s->result_len[i]] = '\0';
+    *p_str = s->result_buf[i];
+    return DB_SUCCESS;
+}
+
+int db_stmt_fetch(db_conn_t *conn, db_stmt_t *s, char *outtab[],
+                  unsigned int outtabsize)
+{
+    unsigned int i;
+    int rc;
+
+    if (s->result_types != NULL)
+        RBH_BUG("String fetch of a statement with binary results");
+
+    for (i = 0; i < outtabsize; i++)
+        outtab[i] = NULL;
+
+    if (s->nb_fields > outtabsize)
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Output array too small: size = %u, num_fields = %u",
+                   outtabsize, s->nb_fields);
+        return DB_BUFFER_TOO_SMALL;
+    }
+
+    rc = stmt_fetch_row(s);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < s->nb_fields; i++)
+    {
+        if (s->result_null[i])
+            continue;
+
+        rc = stmt_get_str(s, i, &outtab[i]);
+        if (rc)
+            return rc;
+    }
+    return DB_SUCCESS;
+}
+
+int db_stmt_fetch_values(db_conn_t *conn, db_stmt_t *s, db_type_u *values,
+                         bool *nulls, unsigned int count)
+{
+    unsigned int i;
+    int rc;
+
+    for (i = 0; i < count; i++)
+        nulls[i] = true;
+
+    if (s->nb_fields > count)
+    {
+        DisplayLog(LVL_CRIT, LISTMGR_TAG,
+                   "Output array too small: size = %u, num_fields = %u",
+                   count, s->nb_fields);
+        return DB_BUFFER_TOO_SMALL;
+    }
+
+    rc = stmt_fetch_row(s);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < s->nb_fields; i++)
+    {
+        char *str;
+
+        if (s->result_null[i])
+            continue;
+        nulls[i] = false;
+
+        if (s->result_types != NULL && db_is_int_type(s->result_types[i]))
+        {
+            if (s->result_types[i] == DB_BOOL)
+                values[i].val_bool = (s->result_tiny[i] != 0);
+            else
+                values[i] = s->result_vals[i];
+            continue;
+        }
+
+        rc = stmt_get_str(s, i, &str);
+        if (rc)
+            return rc;
+        values[i].val_str = str;
+    }
+    return DB_SUCCESS;
+}
+
+void db_stmt_free_result(db_conn_t *conn, db_stmt_t *s)
+{
+    mysql_stmt_free_result(s->stmt);
+}
+
+void db_stmt_close(db_conn_t *conn, db_stmt_t *s)
+{
+    mysql_stmt_close(s->stmt);
+    stmt_free(s);
+}
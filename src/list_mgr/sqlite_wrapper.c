@@ -19,6 +19,8 @@
 #include "list_mgr.h"
 #include "database.h"
 #include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
 #include <stdio.h>
 #include <unistd.h>
 
@@ -45,14 +47,24 @@ static int db_is_busy_err(int rc)
     return (rc == SQLITE_BUSY) || (rc == SQLITE_CANTOPEN);
 }
 
-static int set_cache_size(sqlite3 *conn)
+static int set_pragma(sqlite3 *conn, const char *pragma)
 {
     int rc;
     char *errmsg;
 
-    rc = sqlite3_exec(conn, "PRAGMA cache_size=1000000", NULL, NULL, &errmsg);
+    do {
+        rc = sqlite3_exec(conn, pragma, NULL, NULL, &errmsg);
+
+        /* changing the journal mode requires an exclusive lock */
+        if (db_is_busy_err(rc)) {
+            sqlite3_free(errmsg);
+            usleep(lmgr_config.db_config.retry_delay_microsec);
+        }
+    }
+    while (db_is_busy_err(rc));
+
     if (rc != SQLITE_OK) {
-        DisplayLog(LVL_CRIT, LISTMGR_TAG, "SQL error: %s", errmsg);
+        DisplayLog(LVL_CRIT, LISTMGR_TAG, "SQL error: %s: %s", errmsg, pragma);
         sqlite3_free(errmsg);
         return DB_REQUEST_FAILED;
     }
@@ -60,13 +72,47 @@ static int set_cache_size(sqlite3 *conn)
     return DB_SUCCESS;
 }
 
+static int set_pragmas(sqlite3 *conn)
+{
+    char pragma[128];
+    int rc;
+
+    rc = set_pragma(conn, "PRAGMA cache_size=1000000");
+    if (rc)
+        return rc;
+
+    /* WAL: readers don't block the writer, and they are not blocked by it.
+     * The journal mode is persistent: it is kept by the DB file. */
+    if (lmgr_config.db_config.wal) {
+        rc = set_pragma(conn, "PRAGMA journal_mode=WAL");
+        if (rc)
+            return rc;
+    }
+
+    /* NORMAL is safe in WAL mode (the last transactions may be lost
+     * on power failure, but the DB is not corrupted) */
+    snprintf(pragma, sizeof(pragma), "PRAGMA synchronous=%s",
+             lmgr_config.db_config.synchronous);
+    rc = set_pragma(conn, pragma);
+    if (rc)
+        return rc;
+
+    snprintf(pragma, sizeof(pragma), "PRAGMA mmap_size=%llu",
+             lmgr_config.db_config.mmap_size);
+    return set_pragma(conn, pragma);
+}
+
 /* create client connection */
 int db_connect(db_conn_t *conn)
 {
     int rc;
 
-    /* Connect to database */
-    rc = sqlite3_open(lmgr_config.db_config.filepath, conn);
+    /* Connect to database.
+     * Each connection is used by a single thread at once (one per
+     * lmgr_t): no need for SQLite mutexes on it. */
+    rc = sqlite3_open_v2(lmgr_config.db_config.filepath, conn,
+                         SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+                         | SQLITE_OPEN_NOMUTEX, NULL);
     if (rc != 0) {
         if (*conn) {
             DisplayLog(LVL_CRIT, LISTMGR_TAG,
@@ -82,7 +128,12 @@ int db_connect(db_conn_t *conn)
 
     DisplayLog(LVL_FULL, LISTMGR_TAG, "Logged on to database successfully");
 
-    set_cache_size(*conn);
+    rc = set_pragmas(*conn);
+    if (rc) {
+        sqlite3_close(*conn);
+        *conn = NULL;
+        return rc;
+    }
 
     return DB_SUCCESS;
 }
@@ -103,15 +154,19 @@ char *db_errmsg(db_conn_t *conn, char *errmsg, unsigned int buflen)
     return errmsg;
 }
 
-int db_exec_sql(db_conn_t *conn, const char *query, result_handle_t *p_result)
+int _db_exec_sql(db_conn_t *conn, const char *query, result_handle_t *p_result,
+                 const char *caller)
 {
     int rc;
     char *errmsg = NULL;
+    struct timeval start;
 
 #ifdef _DEBUG_DB
     DisplayLog(LVL_FULL, LISTMGR_TAG, "SQL query: %s", query);
 #endif
 
+    gettimeofday(&start, NULL);
+
     if (!p_result) {
         do {
             rc = sqlite3_exec(*conn, query, NULL, NULL, &errmsg);
@@ -121,6 +176,7 @@ int db_exec_sql(db_conn_t *conn, const char *query, result_handle_t *p_result)
 
         }
         while (db_is_busy_err(rc));
+        db_query_stats_add(query, caller, &start);
 
         if (rc != SQLITE_OK) {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG,
@@ -144,6 +200,7 @@ int db_exec_sql(db_conn_t *conn, const char *query, result_handle_t *p_result)
 
         }
         while (db_is_busy_err(rc));
+        db_query_stats_add(query, caller, &start);
 
         if (rc != SQLITE_OK) {
             DisplayLog(LVL_DEBUG, LISTMGR_TAG,
@@ -160,10 +217,28 @@ int db_exec_sql(db_conn_t *conn, const char *query, result_handle_t *p_result)
     return DB_SUCCESS;
 }
 
-int db_exec_sql_quiet(db_conn_t *conn, const char *query,
-                      result_handle_t *p_result)
+int _db_exec_sql_quiet(db_conn_t *conn, const char *query,
+                       result_handle_t *p_result, const char *caller)
 {
-    return db_exec_sql(conn, query, p_result);
+    return _db_exec_sql(conn, query, p_result, caller);
+}
+
+/* results are always fetched at once */
+int _db_exec_sql_stream(db_conn_t *conn, const char *query,
+                        result_handle_t *p_result, const char *caller)
+{
+    return _db_exec_sql(conn, query, p_result, caller);
+}
+
+int db_stream_status(db_conn_t *conn)
+{
+    return DB_SUCCESS;
+}
+
+int db_stream_close(db_conn_t *conn, result_handle_t *p_result)
+{
+    db_result_free(conn, p_result);
+    return db_close_conn(conn);
 }
 
 /* get the next record from result */
@@ -277,3 +352,238 @@ void db_escape_string(db_conn_t *conn, char *str_out, size_t out_size,
     /* using slqite3_snprintf with "%q" format, to escape strings */
     sqlite3_snprintf(out_size, str_out, str_in);
 }
+
+int db_load_file(db_conn_t *conn, const char *path, const char *table,
+                 const char *columns, const char *set)
+{
+    /* no bulk load with SQLite */
+    return DB_NOT_SUPPORTED;
+}
+
+/* -------------------- Prepared statements ---------------- */
+
+struct db_stmt {
+    sqlite3_stmt *stmt;
+    int           step_rc;  /* status of the last step */
+    bool          fetched;  /* the current row has been returned */
+    db_type_e    *result_types;  /* NULL if all results are strings */
+};
+
+int db_stmt_prepare(db_conn_t *conn, const char *query, db_stmt_t **p_stmt)
+{
+    db_stmt_t *s;
+    int rc;
+
+#ifdef _DEBUG_DB
+    DisplayLog(LVL_FULL, LISTMGR_TAG, "SQL prepare: %s", query);
+#endif
+
+    s = MemCalloc(1, sizeof(*s));
+    if (!s)
+        return DB_NO_MEMORY;
+
+    do {
+        rc = sqlite3_prepare_v2(*conn, query, -1, &s->stmt, NULL);
+
+        if (db_is_busy_err(rc))
+            usleep(lmgr_config.db_config.retry_delay_microsec);
+    }
+    while (db_is_busy_err(rc));
+
+    if (rc != SQLITE_OK) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG,
+                   "SQLite prepare failed (%d): %s: %s", rc,
+                   sqlite3_errmsg(*conn), query);
+        MemFree(s);
+        return sqlite_error_convert(rc);
+    }
+
+    *p_stmt = s;
+    return DB_SUCCESS;
+}
+
+int db_stmt_exec(db_conn_t *conn, db_stmt_t *s, const db_param_t *params,
+                 unsigned int count)
+{
+    unsigned int i;
+    int rc = SQLITE_OK;
+    struct timeval start;
+
+    sqlite3_reset(s->stmt);
+    sqlite3_clear_bindings(s->stmt);
+
+    for (i = 0; i < count && rc == SQLITE_OK; i++) {
+        const db_type_u *v = &params[i].value;
+
+        /* parameters are numbered from 1 */
+        switch (params[i].type) {
+        case DB_TEXT:
+        case DB_ENUM_FTYPE:
+            if (v->val_str == NULL)
+                rc = sqlite3_bind_null(s->stmt, i + 1);
+            else
+                rc = sqlite3_bind_text(s->stmt, i + 1, v->val_str, -1,
+                                       SQLITE_STATIC);
+            break;
+        case DB_INT:
+            rc = sqlite3_bind_int(s->stmt, i + 1, v->val_int);
+            break;
+        case DB_UINT:
+            rc = sqlite3_bind_int64(s->stmt, i + 1, v->val_uint);
+            break;
+        case DB_SHORT:
+            rc = sqlite3_bind_int(s->stmt, i + 1, v->val_short);
+            break;
+        case DB_USHORT:
+            rc = sqlite3_bind_int(s->stmt, i + 1, v->val_ushort);
+            break;
+        case DB_BIGINT:
+        case DB_BIGUINT:
+            rc = sqlite3_bind_int64(s->stmt, i + 1, v->val_bigint);
+            break;
+        case DB_BOOL:
+            rc = sqlite3_bind_int(s->stmt, i + 1, v->val_bool ? 1 : 0);
+            break;
+        default:
+            RBH_BUG("Unsupported type for statement parameter");
+        }
+    }
+    if (rc != SQLITE_OK) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG,
+                   "SQLite bind failed (%d): %s", rc, sqlite3_errmsg(*conn));
+        return sqlite_error_convert(rc);
+    }
+
+    gettimeofday(&start, NULL);
+    do {
+        rc = sqlite3_step(s->stmt);
+
+        if (db_is_busy_err(rc)) {
+            sqlite3_reset(s->stmt);
+            usleep(lmgr_config.db_config.retry_delay_microsec);
+        }
+    }
+    while (db_is_busy_err(rc));
+    db_query_stats_add(sqlite3_sql(s->stmt), "(prepared statement)", &start);
+
+    s->step_rc = rc;
+    s->fetched = false;
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        DisplayLog(LVL_DEBUG, LISTMGR_TAG,
+                   "SQLite statement failed (%d): %s", rc,
+                   sqlite3_errmsg(*conn));
+        return sqlite_error_convert(rc);
+    }
+    return DB_SUCCESS;
+}
+
+int db_stmt_result_types(db_conn_t *conn, db_stmt_t *s,
+                         const db_type_e *types, unsigned int count)
+{
+    if (count != sqlite3_column_count(s->stmt))
+        RBH_BUG("Wrong result count for prepared statement");
+
+    s->result_types = MemCalloc(count, sizeof(*s->result_types));
+    if (!s->result_types)
+        return DB_NO_MEMORY;
+    memcpy(s->result_types, types, count * sizeof(*types));
+    return DB_SUCCESS;
+}
+
+/** move to the next row of a statement result */
+static int stmt_next_row(db_stmt_t *s)
+{
+    /* the first row is read by db_stmt_exec() */
+    if (s->fetched && s->step_rc == SQLITE_ROW)
+        s->step_rc = sqlite3_step(s->stmt);
+
+    if (s->step_rc == SQLITE_DONE)
+        return DB_END_OF_LIST;
+    else if (s->step_rc != SQLITE_ROW)
+        return sqlite_error_convert(s->step_rc);
+    return DB_SUCCESS;
+}
+
+int db_stmt_fetch(db_conn_t *conn, db_stmt_t *s, char *outtab[],
+                  unsigned int outtabsize)
+{
+    int i, nb_cols, rc;
+
+    rc = stmt_next_row(s);
+    if (rc)
+        return rc;
+
+    nb_cols = sqlite3_column_count(s->stmt);
+    if (nb_cols > outtabsize)
+        return DB_BUFFER_TOO_SMALL;
+
+    for (i = 0; i < outtabsize; i++)
+        outtab[i] = (i < nb_cols) ?
+            (char *)sqlite3_column_text(s->stmt, i) : NULL;
+    s->fetched = true;
+
+    return DB_SUCCESS;
+}
+
+int db_stmt_fetch_values(db_conn_t *conn, db_stmt_t *s, db_type_u *values,
+                         bool *nulls, unsigned int count)
+{
+    int i, nb_cols, rc;
+
+    rc = stmt_next_row(s);
+    if (rc)
+        return rc;
+
+    nb_cols = sqlite3_column_count(s->stmt);
+    if (nb_cols > count)
+        return DB_BUFFER_TOO_SMALL;
+
+    for (i = 0; i < count; i++)
+    {
+        nulls[i] = (i >= nb_cols
+                    || sqlite3_column_type(s->stmt, i) == SQLITE_NULL);
+        if (nulls[i])
+            continue;
+
+        switch (s->result_types != NULL ? s->result_types[i] : DB_TEXT)
+        {
+            case DB_INT:
+                values[i].val_int = sqlite3_column_int(s->stmt, i);
+                break;
+            case DB_UINT:
+                values[i].val_uint = sqlite3_column_int64(s->stmt, i);
+                break;
+            case DB_SHORT:
+                values[i].val_short = sqlite3_column_int(s->stmt, i);
+                break;
+            case DB_USHORT:
+                values[i].val_ushort = sqlite3_column_int(s->stmt, i);
+                break;
+            case DB_BIGINT:
+            case DB_BIGUINT:
+                values[i].val_bigint = sqlite3_column_int64(s->stmt, i);
+                break;
+            case DB_BOOL:
+                values[i].val_bool = (sqlite3_column_int(s->stmt, i) != 0);
+                break;
+            default:
+                values[i].val_str = (char *)sqlite3_column_text(s->stmt, i);
+        }
+    }
+    s->fetched = true;
+
+    return DB_SUCCESS;
+}
+
+void db_stmt_free_result(db_conn_t *conn, db_stmt_t *s)
+{
+    sqlite3_reset(s->stmt);
+}
+
+void db_stmt_close(db_conn_t *conn, db_stmt_t *s)
+{
+    sqlite3_finalize(s->stmt);
+    MemFree(s->result_types);
+    MemFree(s);
+}
@@ -24,7 +24,10 @@
 #include "xplatform_print.h"
 #include "Memory.h"
 #include "rbh_basename.h"
+#include "rbh_digest.h"
 #include <stdlib.h>
+#include <pthread.h>
+#include <glib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -38,6 +41,7 @@
 #include <fnmatch.h>
 #include <zlib.h>
 #include <sys/sendfile.h>
+#include <dirent.h>
 
 #ifdef HAVE_SHOOK
 #include <shook_svr.h>
@@ -57,6 +61,15 @@
 #define BKL_TAG "backup_cfg"
 #endif
 
+/** how backup_status() checks the backend */
+typedef enum {
+    BK_CHECK_STAT,      /**< lstat() the backend copy of each entry */
+    BK_CHECK_LISTING,   /**< list backend directories once, and answer
+                             from these listings */
+    BK_CHECK_DB,        /**< trust the status and last_archive from DB,
+                             only check the backend if they are unknown */
+} bk_status_check_e;
+
 typedef struct backup_config_t {
     char root[RBH_PATH_MAX];
     char mnt_type[RBH_NAME_MAX];
@@ -74,6 +87,9 @@ typedef struct backup_config_t {
      */
     bool compress;
 
+    /** how to determine entry status from the backend */
+    bk_status_check_e status_check;
+
     /** recovery action */
     policy_action_t recovery_action;
 
@@ -91,6 +107,7 @@ static void backup_cfg_set_default(void *module_config)
     conf->check_mounted = true;
     conf->compress = false;
     conf->copy_timeout = 6 * 3600;  /* 6h */
+    conf->status_check = BK_CHECK_STAT;
 #ifdef HAVE_SHOOK
     strcpy(conf->shook_cfg, "/etc/shook.cfg");
 #endif
@@ -109,6 +126,7 @@ static void backup_cfg_write_default(FILE *output)
     print_line(output, 1, "check_mounted : yes");
     print_line(output, 1, "copy_timeout  : 6h");
     print_line(output, 1, "compress      : no");
+    print_line(output, 1, "status_check  : stat");
 #ifdef HAVE_SHOOK
     print_line(output, 1, "shook_cfg     : \"/etc/shook.cfg\"")
 #endif
@@ -120,6 +138,19 @@ static void backup_cfg_write_default(FILE *output)
 /* forward declaration */
 static status_manager_t backup_sm;
 
+static const char *status_check2str(bk_status_check_e check)
+{
+    switch (check) {
+    case BK_CHECK_STAT:
+        return "stat";
+    case BK_CHECK_LISTING:
+        return "listing";
+    case BK_CHECK_DB:
+        return "db";
+    }
+    return "?";
+}
+
 static int backup_cfg_read(config_file_t config, void *module_config,
                            char *msg_out)
 {
@@ -127,6 +158,7 @@ static int backup_cfg_read(config_file_t config, void *module_config,
     backup_config_t *conf = (backup_config_t *) module_config;
     config_item_t block;
     char tmp[RBH_PATH_MAX];
+    char check[RBH_NAME_MAX] = "";
     char **extra = NULL;
     unsigned int extra_cnt = 0;
     attr_mask_t mask = null_mask;
@@ -143,6 +175,8 @@ static int backup_cfg_read(config_file_t config, void *module_config,
         ,
         {"copy_timeout", PT_DURATION, 0, &conf->copy_timeout, 0}
         ,
+        {"status_check", PT_STRING, 0, check, sizeof(check)}
+        ,
 #ifdef HAVE_SHOOK
         /* shook only */
         {"shook_cfg", PT_STRING, PFLG_ABSOLUTE_PATH | PFLG_NO_WILDCARDS,
@@ -155,7 +189,7 @@ static int backup_cfg_read(config_file_t config, void *module_config,
 
     static const char *allowed_params[] = {
         "root", "mnt_type", "check_mounted", "copy_timeout", "compress",
-        "recovery_action",
+        "status_check", "recovery_action",
 #ifdef HAVE_SHOOK
         "shook_cfg",
 #endif
@@ -173,6 +207,21 @@ static int backup_cfg_read(config_file_t config, void *module_config,
     if (rc)
         return rc;
 
+    if (!EMPTY_STRING(check)) {
+        if (!strcasecmp(check, "stat"))
+            conf->status_check = BK_CHECK_STAT;
+        else if (!strcasecmp(check, "listing"))
+            conf->status_check = BK_CHECK_LISTING;
+        else if (!strcasecmp(check, "db"))
+            conf->status_check = BK_CHECK_DB;
+        else {
+            sprintf(msg_out, "Invalid value for " BACKUP_BLOCK
+                    "::status_check: '%s' (expected stat, listing or db)",
+                    check);
+            return EINVAL;
+        }
+    }
+
     /* read specific params */
     rc = GetStringParam(block, BACKUP_BLOCK, "recovery_action",
                         PFLG_MANDATORY, tmp, sizeof(tmp), &extra,
@@ -203,6 +252,16 @@ static void backup_cfg_write_template(FILE *output)
     print_line(output, 1, "# check if the backend is mounted on startup");
     print_line(output, 1, "check_mounted = yes;");
     print_line(output, 1, "copy_timeout  = 6h;");
+    print_line(output, 1, "# how to check entry status in the backend:");
+    print_line(output, 1, "#   stat:    lstat() each entry in the backend");
+    print_line(output, 1, "#   listing: read each backend directory once, "
+               "and get entry status");
+    print_line(output, 1, "#            from this listing");
+    print_line(output, 1, "#   db:      trust the status and last_archive "
+               "known in the DB");
+    print_line(output, 1, "#            (set it to 'stat' to force a "
+               "refresh)");
+    print_line(output, 1, "status_check  = stat;");
 #ifdef HAVE_SHOOK
     print_line(output, 1, "# shook server configuration");
     print_line(output, 1, "shook_cfg     = \"/etc/shook.cfg\";");
@@ -236,7 +295,7 @@ static int backup_cfg_set(void *cfg, bool reload)
     }
 
     /* reload case */
-    /* only copy timeout can be modified dynamically */
+    /* only copy timeout and status check can be modified dynamically */
     if (new->copy_timeout != config.copy_timeout) {
         DisplayLog(LVL_EVENT, BKL_TAG,
                    BACKUP_BLOCK "::copy_timeout updated: %ld->%ld",
@@ -244,6 +303,14 @@ static int backup_cfg_set(void *cfg, bool reload)
         config.copy_timeout = new->copy_timeout;
     }
 
+    if (new->status_check != config.status_check) {
+        DisplayLog(LVL_EVENT, BKL_TAG,
+                   BACKUP_BLOCK "::status_check updated: %s->%s",
+                   status_check2str(config.status_check),
+                   status_check2str(new->status_check));
+        config.status_check = new->status_check;
+    }
+
     return 0;
 }
 
@@ -296,27 +363,33 @@ static const char *backup_status2str(file_status_t st)
 /** enum of specific attributes */
 enum backup_info_e {
     ATTR_BK_PATH = 0,
-    ATTR_LAST_ARCH
+    ATTR_LAST_ARCH,
+    ATTR_DIGEST
 };
 
 /** size of specific info to be stored in DB:
  * backend_path: full path in backend
  * last_archive: unix epoch
+ * digest: digest of the data of the last archived copy
+ *         (if the 'digest' action parameter is set)
  */
 static sm_info_def_t backup_info[] = {
     [ATTR_BK_PATH] =
         {"backend_path", "bkpath", DB_TEXT, RBH_PATH_MAX - 1, {.val_str = NULL},
          PT_STRING},
     [ATTR_LAST_ARCH] =
-        {"last_archive", "lstarc", DB_UINT, 0, {.val_uint = 0}, PT_DURATION}
+        {"last_archive", "lstarc", DB_UINT, 0, {.val_uint = 0}, PT_DURATION},
+    [ATTR_DIGEST] =
+        {"digest", "digest", DB_TEXT, DIGEST_STR_MAX - 1, {.val_str = NULL},
+         PT_STRING}
 };
 
 /** helper to compare a status */
 static bool status_equal(struct sm_instance *smi, const attr_set_t *attrs,
                          file_status_t status)
 {
-    return !strcmp(STATUS_ATTR(attrs, smi->smi_index),
-                   backup_status2str(status));
+    return status_eq(STATUS_ATTR(attrs, smi->smi_index),
+                     backup_status2str(status));
 }
 
 /** to check backend mount point */
@@ -494,6 +567,100 @@ typedef enum {
 /* trash directory for orphan files */
 #define TRASH_DIR   ".orphans"
 
+/* ---- cache of computed backend paths ----
+ * Building the backend path of a new copy is done for each status check,
+ * copy and rebind. The last computed path of an entry is cached with the
+ * name it was computed from: a cached path is only used if this name did not
+ * change. Entries are also forgotten when a rename record is received.
+ * This is not stored in DB, as backend_path designates the current copy,
+ * which is still needed to move it after a rename.
+ */
+#define BK_PATH_CACHE_MAX   65536
+
+struct bk_path_item {
+    entry_id_t  id;
+    char       *src;    /* fullpath or name the path was built from */
+    bool        zip;
+    char       *bkpath;
+};
+
+static GHashTable *bk_path_cache = NULL;
+static pthread_mutex_t bk_path_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static guint bk_path_hash(gconstpointer key)
+{
+    const unsigned char *c = key;
+    guint h = 2166136261U;
+    size_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < sizeof(entry_id_t); i++)
+        h = (h ^ c[i]) * 16777619U;
+    return h;
+}
+
+static gboolean bk_path_equal(gconstpointer a, gconstpointer b)
+{
+    return entry_id_equal((const entry_id_t *)a, (const entry_id_t *)b);
+}
+
+static void bk_path_item_free(gpointer data)
+{
+    struct bk_path_item *item = data;
+
+    g_free(item->src);
+    g_free(item->bkpath);
+    g_free(item);
+}
+
+/** @return true and set backend_path if a valid path is cached */
+static bool bk_path_lookup(const entry_id_t *id, const char *src, bool zip,
+                           char *backend_path)
+{
+    struct bk_path_item *item;
+    bool found = false;
+
+    P(bk_path_lock);
+    if (bk_path_cache != NULL) {
+        item = g_hash_table_lookup(bk_path_cache, id);
+        if (item != NULL && item->zip == zip && !strcmp(item->src, src)) {
+            strcpy(backend_path, item->bkpath);
+            found = true;
+        }
+    }
+    V(bk_path_lock);
+    return found;
+}
+
+static void bk_path_add(const entry_id_t *id, const char *src, bool zip,
+                        const char *backend_path)
+{
+    struct bk_path_item *item = g_new(struct bk_path_item, 1);
+
+    item->id = *id;
+    item->src = g_strdup(src);
+    item->zip = zip;
+    item->bkpath = g_strdup(backend_path);
+
+    P(bk_path_lock);
+    if (bk_path_cache == NULL)
+        bk_path_cache = g_hash_table_new_full(bk_path_hash, bk_path_equal,
+                                              NULL, bk_path_item_free);
+    else if (g_hash_table_size(bk_path_cache) >= BK_PATH_CACHE_MAX)
+        g_hash_table_remove_all(bk_path_cache);
+
+    g_hash_table_replace(bk_path_cache, &item->id, item);
+    V(bk_path_lock);
+}
+
+static void bk_path_forget(const entry_id_t *id)
+{
+    P(bk_path_lock);
+    if (bk_path_cache != NULL)
+        g_hash_table_remove(bk_path_cache, id);
+    V(bk_path_lock);
+}
+
 /**
  * Build the path of a given entry in the backend.
  */
@@ -570,6 +737,14 @@ static void entry2backend_path(sm_instance_t *smi,
         /* For lookup, if there is a previous path in the backend, use it. */
         strcpy(backend_path, (char *)SMI_INFO(p_attrs_in, smi, ATTR_BK_PATH));
     } else {    /* in any other case, build a path from scratch */
+        const char *src = ATTR_MASK_TEST(p_attrs_in, fullpath) ?
+            ATTR(p_attrs_in, fullpath) : (ATTR_MASK_TEST(p_attrs_in, name) ?
+                                          ATTR(p_attrs_in, name) : "");
+        bool zip = allow_compress
+            && !strcasecmp(ATTR(p_attrs_in, type), STR_TYPE_FILE);
+
+        if (bk_path_lookup(p_id, src, zip, backend_path))
+            return;
 
         /* if the fullpath is available, build human readable path */
         if (ATTR_MASK_TEST(p_attrs_in, fullpath) &&
@@ -618,29 +793,190 @@ static void entry2backend_path(sm_instance_t *smi,
                 (unsigned long long)p_id->inode);
 #endif
         /* check if compression is enabled and if the entry is a file */
-        if (allow_compress
-            && !strcasecmp(ATTR(p_attrs_in, type), STR_TYPE_FILE)) {
+        if (zip) {
             /* append z in this case */
             strcat(backend_path, "z");
         }
+
+        bk_path_add(p_id, src, zip, backend_path);
     }
     return;
 }
 
+/* ---- backend directory listings (status_check = listing) ---- */
+
+/* Listings are kept BK_LIST_TTL seconds. They are dropped before
+ * when this process modifies the directory. */
+#define BK_LIST_TTL         60
+/* max number of entries in all cached listings (the cache is flushed
+ * when it gets full) */
+#define BK_LIST_ENTRIES_MAX 1000000
+
+struct bk_listing {
+    time_t      time;
+    GHashTable *entries;    /* name -> struct stat */
+};
+
+static GHashTable *bk_list_cache = NULL;    /* dir path -> bk_listing */
+static unsigned int bk_list_entries = 0;
+static pthread_mutex_t bk_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void bk_listing_free(gpointer data)
+{
+    struct bk_listing *l = data;
+
+    bk_list_entries -= g_hash_table_size(l->entries);
+    g_hash_table_destroy(l->entries);
+    g_free(l);
+}
+
+/**
+ * Read a backend directory (one readdir() and a lstat() of its entries).
+ * A missing directory results in an empty listing.
+ * @return NULL on other errors.
+ */
+static struct bk_listing *bk_listing_read(const char *dir)
+{
+    struct bk_listing *l;
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL && errno != ENOENT && errno != ENOTDIR && errno != ESTALE)
+        return NULL;
+
+    l = g_new(struct bk_listing, 1);
+    l->time = time(NULL);
+    l->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       g_free);
+    if (d == NULL)
+        return l;
+
+    while ((de = readdir(d)) != NULL) {
+        struct stat *st;
+
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        st = g_new(struct stat, 1);
+        if (fstatat(dirfd(d), de->d_name, st, AT_SYMLINK_NOFOLLOW) != 0) {
+            /* removed in the meantime */
+            g_free(st);
+            continue;
+        }
+        g_hash_table_insert(l->entries, g_strdup(de->d_name), st);
+    }
+    closedir(d);
+    return l;
+}
+
+/** split a backend path into its parent directory and name */
+static const char *bk_split_path(const char *path, char *dir, size_t size)
+{
+    const char *name = strrchr(path, '/');
+
+    if (name == NULL || name - path >= size)
+        return NULL;
+
+    memcpy(dir, path, name - path);
+    dir[name - path] = '\0';
+    return name + 1;
+}
+
+/** lookup an entry in a listing (must be called under bk_list_lock) */
+static int bk_listing_lookup(struct bk_listing *l, const char *name,
+                             struct stat *st)
+{
+    struct stat *found = g_hash_table_lookup(l->entries, name);
+
+    if (found == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    *st = *found;
+    return 0;
+}
+
+/** like lstat(), but answered from the listing of the parent directory */
+static int bk_cached_lstat(const char *path, struct stat *st)
+{
+    char dir[RBH_PATH_MAX];
+    const char *name;
+    struct bk_listing *l;
+    int rc;
+
+    name = bk_split_path(path, dir, sizeof(dir));
+    if (name == NULL)
+        return lstat(path, st);
+
+    P(bk_list_lock);
+    l = bk_list_cache ? g_hash_table_lookup(bk_list_cache, dir) : NULL;
+    if (l != NULL && time(NULL) - l->time < BK_LIST_TTL) {
+        rc = bk_listing_lookup(l, name, st);
+        V(bk_list_lock);
+        return rc;
+    }
+    V(bk_list_lock);
+
+    /* read the directory out of the lock */
+    l = bk_listing_read(dir);
+    if (l == NULL)
+        return lstat(path, st);
+
+    P(bk_list_lock);
+    if (bk_list_cache == NULL)
+        bk_list_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                              bk_listing_free);
+    else if (bk_list_entries + g_hash_table_size(l->entries)
+             > BK_LIST_ENTRIES_MAX)
+        g_hash_table_remove_all(bk_list_cache);
+
+    bk_list_entries += g_hash_table_size(l->entries);
+    g_hash_table_replace(bk_list_cache, g_strdup(dir), l);
+    rc = bk_listing_lookup(l, name, st);
+    V(bk_list_lock);
+
+    return rc;
+}
+
+/** drop the listing of the parent directory of a modified backend entry */
+static void bk_list_forget(const char *path)
+{
+    char dir[RBH_PATH_MAX];
+
+    if (bk_list_cache == NULL
+        || bk_split_path(path, dir, sizeof(dir)) == NULL)
+        return;
+
+    P(bk_list_lock);
+    g_hash_table_remove(bk_list_cache, dir);
+    V(bk_list_lock);
+}
+
+/** lstat() a backend entry for status checking */
+static inline int bk_check_lstat(const char *path, struct stat *st,
+                                 bool cached)
+{
+    if (cached && config.status_check == BK_CHECK_LISTING)
+        return bk_cached_lstat(path, st);
+    return lstat(path, st);
+}
+
 /**
  * Determine if an entry is being archived
+ * \param cached  the answer can come from a directory listing.
  * \retval 0: not archiving
  * \retval <0: error
  * \retval >0: last modification time
  */
-static int entry_is_archiving(const char *backend_path)
+static int entry_is_archiving(const char *backend_path, bool cached)
 {
     char xfer_path[RBH_PATH_MAX];
     struct stat cp_md;
     int rc;
     sprintf(xfer_path, "%s.%s", backend_path, COPY_EXT);
 
-    if (lstat(xfer_path, &cp_md) != 0) {
+    if (bk_check_lstat(xfer_path, &cp_md, cached) != 0) {
         rc = -errno;
         if ((rc == -ENOENT) || (rc == -ESTALE))
             return 0;
@@ -708,11 +1044,11 @@ static int move_orphan(const char *path)
  * 0 if no copy is running
  * 1 if a copy is already running
  * */
-static int check_running_copy(const char *bkpath)
+static int check_running_copy(const char *bkpath, bool cached)
 {
     int rc;
     /* is a copy running for this entry? */
-    rc = entry_is_archiving(bkpath);
+    rc = entry_is_archiving(bkpath, cached);
     if (rc < 0) {
         DisplayLog(LVL_MAJOR, TAG,
                    "Error %d checking if copy is running for %s: %s", rc,
@@ -739,9 +1075,10 @@ static int check_running_copy(const char *bkpath)
  * Get entry info from the backend (like lstat), but also check if the
  * entry is compressed.
  * Prioritarily check the entry with the selected compression on/off.
+ * \param cached  the answer can come from a directory listing.
  */
 static int bk_lstat(const char *bkpath, struct stat *bkmd,
-                    bool check_compressed, bool *compressed)
+                    bool check_compressed, bool *compressed, bool cached)
 {
     char tmp[RBH_PATH_MAX];
     int len = strlen(bkpath);
@@ -749,9 +1086,9 @@ static int bk_lstat(const char *bkpath, struct stat *bkmd,
     *compressed = !!(bkpath[len - 1] == 'z');
 
     if (!check_compressed)  /* not a file, call standard lstat() */
-        return lstat(bkpath, bkmd);
+        return bk_check_lstat(bkpath, bkmd, cached);
 
-    if (!lstat(bkpath, bkmd))
+    if (!bk_check_lstat(bkpath, bkmd, cached))
         return 0;
 
     if ((errno == ENOENT) || (errno == ESTALE)) {
@@ -760,14 +1097,14 @@ static int bk_lstat(const char *bkpath, struct stat *bkmd,
             strcpy(tmp, bkpath);
             tmp[len - 1] = '\0';
 
-            if (lstat(tmp, bkmd) == 0) {
+            if (bk_check_lstat(tmp, bkmd, cached) == 0) {
                 *compressed = 0;
                 return 0;
             }
         } else if (!(*compressed)) {
             /* try with compression */
             sprintf(tmp, "%sz", bkpath);
-            if (lstat(tmp, bkmd) == 0) {
+            if (bk_check_lstat(tmp, bkmd, cached) == 0) {
                 *compressed = true;
                 return 0;
             }
@@ -810,6 +1147,23 @@ static inline int set_last_archive(sm_instance_t *smi, attr_set_t *pattrs,
     return set_uint_info(smi, pattrs, ATTR_LAST_ARCH, (unsigned int)last_arch);
 }
 
+/** helper to set the digest of the archived copy */
+static inline int set_digest(sm_instance_t *smi, attr_set_t *pattrs,
+                             const char *digest)
+{
+    char *info = strndup(digest, DIGEST_STR_MAX - 1);
+    int rc;
+
+    if (info == NULL)
+        return -ENOMEM;
+
+    rc = set_sm_info(smi, pattrs, ATTR_DIGEST, info);
+    if (rc)
+        free(info);
+
+    return rc;
+}
+
 /** return the path to access an entry in the filesystem */
 static int entry_fs_path(const entry_id_t *p_id, const attr_set_t *p_attrs,
                          char *fspath)
@@ -835,10 +1189,13 @@ static int entry_fs_path(const entry_id_t *p_id, const attr_set_t *p_attrs,
  * \param[in] p_id pointer to entry id
  * \param[in] attrs_in pointer to entry attributes
  * \param[out] p_attrs_changed changed/retrieved attributes
+ * \param[in] cached  status can be determined from cached information,
+ *                    according to status_check.
  */
-static int backup_status(struct sm_instance *smi,
-                         const entry_id_t *p_id, const attr_set_t *p_attrs_in,
-                         attr_set_t *p_attrs_changed)
+static int backup_status_ext(struct sm_instance *smi,
+                             const entry_id_t *p_id,
+                             const attr_set_t *p_attrs_in,
+                             attr_set_t *p_attrs_changed, bool cached)
 {
     int rc;
     struct stat bkmd;
@@ -854,10 +1211,6 @@ static int backup_status(struct sm_instance *smi,
         return -EINVAL;
     }
 
-    /* path to lookup the entry in the backend */
-    entry2backend_path(smi, p_id, p_attrs_in, FOR_LOOKUP, bkpath,
-                       config.compress);
-
     /* is the entry has a supported type? */
     entry_type = db2type(ATTR(p_attrs_in, type));
 
@@ -866,6 +1219,10 @@ static int backup_status(struct sm_instance *smi,
                    ATTR(p_attrs_in, type));
         return -ENOTSUP;
     }
+
+    /* path to lookup the entry in the backend */
+    entry2backend_path(smi, p_id, p_attrs_in, FOR_LOOKUP, bkpath,
+                       config.compress);
 #ifdef HAVE_SHOOK
     /* @TODO: ignore shook special entries */
 
@@ -908,9 +1265,23 @@ static int backup_status(struct sm_instance *smi,
     /* else: must compare status with backend */
 #endif
 
+    /* trust the status known in DB, if the entry was archived */
+    if (cached && config.status_check == BK_CHECK_DB
+        && ATTR_MASK_STATUS_TEST(p_attrs_in, smi->smi_index)
+        && (status_equal(smi, p_attrs_in, STATUS_SYNCHRO)
+            || status_equal(smi, p_attrs_in, STATUS_MODIFIED))
+        && ATTR_MASK_INFO_TEST(p_attrs_in, smi, ATTR_LAST_ARCH)) {
+        unsigned int last_arch =
+            *(unsigned int *)SMI_INFO(p_attrs_in, smi, ATTR_LAST_ARCH);
+
+        return set_backup_status(smi, p_attrs_changed,
+                                 ATTR(p_attrs_in, last_mod) > last_arch ?
+                                 STATUS_MODIFIED : STATUS_SYNCHRO);
+    }
+
     if (entry_type == TYPE_FILE) {
         /* is a copy running for this entry? */
-        rc = check_running_copy(bkpath);
+        rc = check_running_copy(bkpath, cached);
         if (rc < 0)
             return rc;
         else if (rc > 0) {  /* current archive */
@@ -920,7 +1291,8 @@ static int backup_status(struct sm_instance *smi,
     }
 
     /* get entry info */
-    if (bk_lstat(bkpath, &bkmd, entry_type == TYPE_FILE, &compressed) != 0) {
+    if (bk_lstat(bkpath, &bkmd, entry_type == TYPE_FILE, &compressed,
+                 cached) != 0) {
         rc = -errno;
         if ((rc != -ENOENT) && (rc != -ESTALE)) {
             DisplayLog(LVL_MAJOR, TAG, "Lookup error for path '%s': %s",
@@ -1033,6 +1405,13 @@ static int backup_status(struct sm_instance *smi,
     /* TODO What about STATUS_REMOVED? */
 }
 
+static int backup_status(struct sm_instance *smi,
+                         const entry_id_t *p_id, const attr_set_t *p_attrs_in,
+                         attr_set_t *p_attrs_changed)
+{
+    return backup_status_ext(smi, p_id, p_attrs_in, p_attrs_changed, true);
+}
+
 /**
  * Function to determine if a deleted entry must be inserted to SOFTRM table
  */
@@ -1111,6 +1490,9 @@ static int backup_cl_cb(struct sm_instance *smi, const CL_REC_TYPE *logrec,
     } else if ((logrec->cr_type == CL_UNLINK)
                && (logrec->cr_flags & CLF_UNLINK_LAST)) {
         *rec_action = backup_softrm_filter(smi, id, attrs);
+    } else if (logrec->cr_type == CL_RENAME || logrec->cr_type == CL_EXT) {
+        /* the backend path of a new copy changes */
+        bk_path_forget(id);
     }
 #ifdef HAVE_SHOOK
     else if (logrec->cr_type == CL_XATTR) {
@@ -1178,6 +1560,75 @@ static int get_orig_dir_md(const char *target_dir, struct stat *st,
         return 0;
 }
 
+/* ---- cache of existing backend directories ----
+ * Archiving many files to the same directories would stat every component
+ * of their backend path for each file. Directories known to exist are
+ * cached, and the cache is flushed when it gets too large.
+ * A directory is forgotten (with its subdirectories) when an operation in
+ * it fails because it no longer exists.
+ */
+#define BK_DIR_CACHE_MAX    65536
+
+static GHashTable *bk_dir_cache = NULL;
+static pthread_mutex_t bk_dir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool bk_dir_known(const char *path)
+{
+    bool known;
+
+    P(bk_dir_lock);
+    known = (bk_dir_cache != NULL
+             && g_hash_table_lookup(bk_dir_cache, path) != NULL);
+    V(bk_dir_lock);
+    return known;
+}
+
+static void bk_dir_add(const char *path)
+{
+    char *key = g_strdup(path);
+
+    P(bk_dir_lock);
+    if (bk_dir_cache == NULL)
+        bk_dir_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             NULL);
+    else if (g_hash_table_size(bk_dir_cache) >= BK_DIR_CACHE_MAX)
+        g_hash_table_remove_all(bk_dir_cache);
+
+    g_hash_table_replace(bk_dir_cache, key, key);
+    V(bk_dir_lock);
+}
+
+/** match a directory and its subdirectories */
+static gboolean bk_dir_match(gpointer key, gpointer value, gpointer udata)
+{
+    const char *dir = udata;
+    size_t len = strlen(dir);
+
+    return !strncmp(key, dir, len)
+        && (((char *)key)[len] == '\0' || ((char *)key)[len] == '/');
+}
+
+/**
+ * Forget the parent directory of a backend entry, if an operation
+ * on this entry failed with the given error.
+ */
+static void bk_dir_invalidate(const char *child_path, int err)
+{
+    char tmp[RBH_PATH_MAX];
+
+    err = abs(err);
+    if (err != ENOENT && err != ENOTDIR)
+        return;
+
+    rh_strncpy(tmp, child_path, sizeof(tmp));
+
+    P(bk_dir_lock);
+    if (bk_dir_cache != NULL)
+        g_hash_table_foreach_remove(bk_dir_cache, bk_dir_match,
+                                    dirname(tmp));
+    V(bk_dir_lock);
+}
+
 /**
  *  Ensure POSIX directory exists
  */
@@ -1229,6 +1680,9 @@ static int mkdir_recurse_clone_attrs(const char *full_path, mode_t default_mode,
         return -EINVAL;
     }
 
+    if (target == TO_BACKEND && bk_dir_known(full_path))
+        return 0;
+
     /* skip first slash */
     curr++;
  relative:
@@ -1245,6 +1699,11 @@ static int mkdir_recurse_clone_attrs(const char *full_path, mode_t default_mode,
         strncpy(path_copy, full_path, path_len);
         path_copy[path_len] = '\0';
 
+        if (target == TO_BACKEND && bk_dir_known(path_copy)) {
+            curr++;
+            continue;
+        }
+
         /* stat dir */
         if (lstat(path_copy, &st) != 0) {
             rc = -errno;
@@ -1285,6 +1744,9 @@ static int mkdir_recurse_clone_attrs(const char *full_path, mode_t default_mode,
             return -ENOTDIR;
         }
 
+        if (target == TO_BACKEND)
+            bk_dir_add(path_copy);
+
         curr++;
     }
 
@@ -1311,6 +1773,9 @@ static int mkdir_recurse_clone_attrs(const char *full_path, mode_t default_mode,
         /* mode is set by mkdir (FIXME but can be cleared by chown) */
     }
 
+    if (target == TO_BACKEND)
+        bk_dir_add(full_path);
+
     return 0;
 }
 
@@ -1372,7 +1837,8 @@ static int copy_action_precheck(sm_instance_t *smi, const entry_id_t *p_id,
     if (!ATTR_MASK_STATUS_TEST(p_attrs, smi->smi_index)) {
         DisplayLog(LVL_DEBUG, TAG, "%s not provided to perform pre-copy checks",
                    smi->db_field);
-        rc = backup_status(smi, p_id, p_attrs, p_attrs);
+        /* the backend must be checked before copying */
+        rc = backup_status_ext(smi, p_id, p_attrs, p_attrs, false);
         if (rc)
             return rc;
     }
@@ -1408,7 +1874,7 @@ static int copy_action_precheck(sm_instance_t *smi, const entry_id_t *p_id,
     } else if (status_equal(smi, p_attrs, STATUS_MODIFIED)
                || status_equal(smi, p_attrs, STATUS_ARCHIVE_RUNNING)) {
         /* check if somebody else is about to copy */
-        rc = check_running_copy(bkpath);
+        rc = check_running_copy(bkpath, false);
         if (rc < 0)
             return rc;
         else if (rc > 0)    /* current archive */
@@ -1462,6 +1928,7 @@ static int backup_symlink(sm_instance_t *smi, attr_set_t *p_attrs,
         /* keep the same status */
         return rc;
     }
+    bk_list_forget(dst);
 
     set_backup_status(smi, p_attrs, STATUS_SYNCHRO);
     set_backend_path(smi, p_attrs, dst);
@@ -1533,6 +2000,7 @@ static int wrap_file_copy(sm_instance_t *smi,
     struct stat info;
     struct attr_save sav = ATTR_SET_INIT;
     action_params_t tmp_params = { 0 };
+    GString *out = NULL;
 
     /* build tmp copy path */
     asprintf(&tmp, "%s.%s", bkpath, COPY_EXT);
@@ -1568,8 +2036,12 @@ static int wrap_file_copy(sm_instance_t *smi,
     rbh_param_set(&tmp_params, TARGET_PATH_PARAM, tmp, true);
     path_replace(&sav, p_attrs, srcpath);
 
+    /* the copy action reports the digest it computed */
+    if (rbh_param_get(&tmp_params, "digest") != NULL)
+        out = g_string_new("");
+
     rc = action_helper(action, "copy", p_id, p_attrs, &tmp_params,
-                       smi, NULL, after, db_cb_fn, db_cb_arg);
+                       smi, out, after, db_cb_fn, db_cb_arg);
 
     /* restore real entry attributes */
     path_restore(&sav, p_attrs);
@@ -1627,6 +2099,7 @@ static int wrap_file_copy(sm_instance_t *smi,
         /* check if the backend path is different */
         if (strcmp(bkpath, bp)) {
             DisplayLog(LVL_DEBUG, TAG, "Removing previous copy %s", bp);
+            bk_list_forget(bp);
             if (unlink(bp)) {
                 rc = -errno;
                 DisplayLog(LVL_DEBUG, TAG,
@@ -1643,13 +2116,16 @@ static int wrap_file_copy(sm_instance_t *smi,
         DisplayLog(LVL_CRIT, TAG,
                    "Failed to finalize transfer: shook_archive_finalize() returned error %d",
                    rc);
-        return rc;
+        goto free_params;
     }
 #endif
 
+    bk_list_forget(bkpath);
     set_backup_status(smi, p_attrs, STATUS_SYNCHRO);
     set_backend_path(smi, p_attrs, bkpath);
     set_last_archive(smi, p_attrs, time(NULL));
+    if (out != NULL && out->len > 0)
+        set_digest(smi, p_attrs, out->str);
 
     /* get and check attributes after the transfer */
     if (lstat(srcpath, &info) != 0) {
@@ -1657,7 +2133,7 @@ static int wrap_file_copy(sm_instance_t *smi,
         DisplayLog(LVL_EVENT, TAG, "Error performing final lstat(%s): %s",
                    srcpath, strerror(-rc));
         set_backup_status(smi, p_attrs, STATUS_UNKNOWN);
-        return rc;
+        goto free_params;
     }
 
     /* check final size/mtime */
@@ -1678,6 +2154,8 @@ static int wrap_file_copy(sm_instance_t *smi,
 
  free_params:
     rbh_params_free(&tmp_params);
+    if (out != NULL)
+        g_string_free(out, TRUE);
  err_out:
     free(tmp);
     return rc;
@@ -1738,6 +2216,10 @@ static int copy_executor(sm_instance_t *smi, const policy_action_t *action,
     else
         rc = -ENOTSUP;
 
+    /* the backend directory may have been removed */
+    if (rc)
+        bk_dir_invalidate(bkpath, rc);
+
     return rc;
 }
 
@@ -1778,6 +2260,7 @@ static int remove_executor(sm_instance_t *smi, const policy_action_t *action,
 
     rc = action_helper(action, "remove", p_id, p_attrs, params, smi, NULL,
                        after, db_cb_fn, db_cb_arg);
+    bk_list_forget(backend_path);
 
     /* restore real entry attributes */
     path_restore(&sav, p_attrs);
@@ -1881,6 +2364,7 @@ static int backup_rebind(sm_instance_t *smi, const char *fs_path,
                    old_bk_path, new_bk_path);
         if (rename(old_bk_path, new_bk_path)) {
             rc = -errno;
+            bk_dir_invalidate(new_bk_path, rc);
 
             /* only retry once if error is EXDEV */
             if (!retry && rc == -EXDEV) {
@@ -2020,7 +2504,7 @@ static recov_status_t recov_file(sm_instance_t *smi, const entry_id_t *p_id,
 
     /* test if this copy exists */
     if (!*stat_done) {
-        if (bk_lstat(backend_path, bk_stat, 1, compressed) != 0) {
+        if (bk_lstat(backend_path, bk_stat, 1, compressed, false) != 0) {
             rc = errno;
             if (rc != ENOENT) {
                 DisplayLog(LVL_MAJOR, TAG, "Cannot stat '%s' in backend: %s",
@@ -2284,7 +2768,7 @@ static recov_status_t backup_recover(struct sm_instance *smi,
     if (!ATTR_MASK_TEST(&attrs_old, type)) {
         const char *type;
 
-        if (bk_lstat(backend_path, &st_bk, 1, &compressed) != 0) {
+        if (bk_lstat(backend_path, &st_bk, 1, &compressed, false) != 0) {
             rc = errno;
             DisplayLog(LVL_MAJOR, TAG, "Cannot restore entry " DFID
                        ": '%s' not found in backend.", PFID(p_old_id),
@@ -2532,6 +3016,7 @@ static recov_status_t backup_recover(struct sm_instance *smi,
                        BKPATH(p_attrs_new, smi));
             if (rename(backend_path, BKPATH(p_attrs_new, smi))) {
                 rc = errno;
+                bk_dir_invalidate(BKPATH(p_attrs_new, smi), rc);
                 DisplayLog(LVL_MAJOR, TAG,
                            "Could not move entry in backend ('%s'->'%s'): %s",
                            backend_path, BKPATH(p_attrs_new, smi),
@@ -2636,8 +3121,10 @@ static status_manager_t backup_sm = {
     /* Previous backup path is also needed.
      * It is only in DB (so it is a cached information). */
     .status_needs_attrs_cached = {.std = ATTR_MASK_type | ATTR_MASK_fullpath,
-                                  /* XXX used last_archive in RBH2.5: */
-                                  .sm_info = GENERIC_INFO_BIT(ATTR_BK_PATH)},
+                                  /* last_archive is used by
+                                   * status_check = db */
+                                  .sm_info = GENERIC_INFO_BIT(ATTR_BK_PATH)
+                                      | GENERIC_INFO_BIT(ATTR_LAST_ARCH)},
 
     /* needs fresh mtime/size information from lustre
      * to determine if the entry changed */
@@ -104,8 +104,8 @@ static int check_executor(struct sm_instance *smi,
      * Functions (defined in modules):
      * o As input, a function action should use 'output' attribute to compare
      *   the result of the last execution.
-     * o As output, a function action can store its result to 'output'
-     *   attribute.
+     * o As output, a function action can report its result with
+     *   module_action_output_set(). It is stored to 'output' attribute.
      * Commands:
      * o As input, a command can retrieve the last output by using '{output}'
      *   placeholder.
@@ -125,8 +125,10 @@ static int check_executor(struct sm_instance *smi,
         set_status_attr(smi, p_attrs, check_status2str(STATUS_OK));
         set_uint_info(smi, p_attrs, ATTR_LAST_SUCCESS, (unsigned int)t);
 
-        /* set output if the action was a successful command */
-        if (action->type == ACTION_COMMAND) {
+        /* set output if the action was a successful command,
+         * or a function that reported an output */
+        if (action->type == ACTION_COMMAND || action->type == ACTION_COPROC
+            || out->len > 0) {
             int rc2;
 
             DisplayLog(LVL_DEBUG, "check_exec", "check command output='%s'",
@@ -118,7 +118,7 @@ static int common_copy(const entry_id_t *p_entry_id, attr_set_t *p_attrs,
     }
 
     rc = builtin_copy(ATTR(p_attrs, fullpath), targetpath,
-                      oflg, !(flags & CP_COPYBACK), flags);
+                      oflg, !(flags & CP_COPYBACK), flags, params);
     *after = PA_UPDATE;
     return rc;
 }
@@ -145,7 +145,8 @@ static int common_sendfile(const entry_id_t *p_entry_id, attr_set_t *p_attrs,
     }
 
     rc = builtin_copy(ATTR(p_attrs, fullpath), targetpath, oflg,
-                      !(flags & CP_COPYBACK), flags | CP_USE_SENDFILE);
+                      !(flags & CP_COPYBACK), flags | CP_USE_SENDFILE,
+                      params);
     *after = PA_UPDATE;
     return rc;
 }
@@ -172,7 +173,7 @@ static int common_gzip(const entry_id_t *p_entry_id, attr_set_t *p_attrs,
     }
 
     rc = builtin_copy(ATTR(p_attrs, fullpath), targetpath, oflg,
-                      !(flags & CP_COPYBACK), flags | CP_COMPRESS);
+                      !(flags & CP_COPYBACK), flags | CP_COMPRESS, params);
     *after = PA_UPDATE;
     return rc;
 }
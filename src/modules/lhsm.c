@@ -31,6 +31,8 @@
 #include <stdbool.h>
 #include <glib.h>
 #include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
 #include <attr/xattr.h>
 #include <uuid/uuid.h>
 
@@ -49,6 +51,15 @@ typedef struct lhsm_config_t {
     char **rebind_cmd;
 
     char uuid_xattr[XATTR_NAME_MAX + 1];
+
+    /** max number of entries sent in a single HSM request
+     * (1 to send one request per entry) */
+    unsigned int action_batch_size;
+    /** max time to wait for more entries to join a request */
+    unsigned int action_batch_delay_ms;
+    /** query the filesystem for entries whose status is already known,
+     * instead of trusting the status built from HSM changelog records */
+    bool refresh_known_status;
 } lhsm_config_t;
 
 /* lhsm config is global as the status manager is shared */
@@ -113,21 +124,270 @@ static int lhsm_init(struct sm_instance *smi, run_flags_t flags)
     return init_action_global_info();
 }
 
+/** Send a multi-item HSM request */
+static int send_hsm_request(enum hsm_user_action action,
+                            unsigned int archive_id, const char *data,
+                            int data_len, const entry_id_t *fids,
+                            unsigned int count)
+{
+    struct hsm_user_request *req;
+    unsigned int i;
+    char *mpath;
+    int rc;
+
+    req = llapi_hsm_user_request_alloc(count, data_len);
+    if (!req) {
+        rc = -errno;
+        DisplayLog(LVL_CRIT, LHSM_TAG, "Cannot create HSM request: %s",
+                   strerror(-rc));
+        return rc;
+    }
+
+    req->hur_request.hr_action = action;
+    req->hur_request.hr_archive_id = archive_id;
+    req->hur_request.hr_flags = 0;
+
+    for (i = 0; i < count; i++) {
+        req->hur_user_item[i].hui_fid = fids[i];
+        req->hur_user_item[i].hui_extent.offset = 0;
+        /* XXX for now, always transfer entire file */
+        req->hur_user_item[i].hui_extent.length = -1LL;
+    }
+
+    req->hur_request.hr_itemcount = count;
+    req->hur_request.hr_data_len = data_len;
+
+    if (data)
+        memcpy(hur_data(req), data, data_len);
+
+    /* make tmp copy as llapi_hsm_request arg is not const */
+    mpath = strdup(get_mount_point(NULL));
+    rc = llapi_hsm_request(mpath, req);
+    free(mpath);
+    free(req);
+
+    if (rc) {
+        if (count == 1)
+            DisplayLog(LVL_CRIT, LHSM_TAG,
+                       "ERROR performing HSM request(%s, root=%s, fid=" DFID
+                       "): %s", hsm_user_action2name(action),
+                       get_mount_point(NULL), PFID(&fids[0]), strerror(-rc));
+        else
+            DisplayLog(LVL_MAJOR, LHSM_TAG,
+                       "ERROR performing HSM request(%s, root=%s, %u items): "
+                       "%s", hsm_user_action2name(action),
+                       get_mount_point(NULL), count, strerror(-rc));
+    }
+    return rc;
+}
+
+/**
+ * Pending multi-item request, filled by concurrent policy workers
+ * with the same action, archive_id and parameters.
+ * The worker that closes the batch (because it is full, or its delay
+ * expired) sends it, while the others wait for the status of their item.
+ */
+struct action_batch {
+    enum hsm_user_action action;
+    unsigned int archive_id;
+    char *data;
+    int data_len;
+
+    entry_id_t *fids;
+    int *status;        /**< status of each item */
+    unsigned int count;
+    unsigned int size;
+
+    bool closed;        /**< no more items can join */
+    bool done;          /**< status are set */
+    unsigned int refs;  /**< workers waiting for this batch */
+    pthread_cond_t cond;
+};
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+/* batches that can still be joined */
+static GList *open_batches = NULL;
+
+static bool batch_is_compatible(const struct action_batch *batch,
+                                enum hsm_user_action action,
+                                unsigned int archive_id, const char *data,
+                                int data_len)
+{
+    if (batch->action != action || batch->archive_id != archive_id
+        || batch->data_len != data_len)
+        return false;
+    if (data_len == 0)
+        return true;
+    return !memcmp(batch->data, data, data_len);
+}
+
+static struct action_batch *batch_new(enum hsm_user_action action,
+                                      unsigned int archive_id,
+                                      const char *data, int data_len,
+                                      unsigned int size)
+{
+    struct action_batch *batch = calloc(1, sizeof(*batch));
+
+    if (batch == NULL)
+        return NULL;
+
+    batch->fids = calloc(size, sizeof(*batch->fids));
+    batch->status = calloc(size, sizeof(*batch->status));
+    if (data_len > 0)
+        batch->data = malloc(data_len);
+
+    if (batch->fids == NULL || batch->status == NULL
+        || (data_len > 0 && batch->data == NULL)) {
+        free(batch->fids);
+        free(batch->status);
+        free(batch->data);
+        free(batch);
+        return NULL;
+    }
+
+    if (data_len > 0)
+        memcpy(batch->data, data, data_len);
+    batch->action = action;
+    batch->archive_id = archive_id;
+    batch->data_len = data_len;
+    batch->size = size;
+    pthread_cond_init(&batch->cond, NULL);
+    return batch;
+}
+
+static void batch_free(struct action_batch *batch)
+{
+    pthread_cond_destroy(&batch->cond);
+    free(batch->fids);
+    free(batch->status);
+    free(batch->data);
+    free(batch);
+}
+
+/** Send a closed batch and set the status of its items. */
+static void batch_flush(struct action_batch *batch)
+{
+    unsigned int i;
+    int rc;
+
+    DisplayLog(LVL_DEBUG, LHSM_TAG, "Sending HSM request (%s, archive_id=%u) "
+               "with %u items", hsm_user_action2name(batch->action),
+               batch->archive_id, batch->count);
+
+    rc = send_hsm_request(batch->action, batch->archive_id, batch->data,
+                          batch->data_len, batch->fids, batch->count);
+
+    if (rc == 0 || batch->count == 1) {
+        for (i = 0; i < batch->count; i++)
+            batch->status[i] = rc;
+        return;
+    }
+
+    /* The request failed as a whole: resubmit each item alone,
+     * so a single bad entry does not make all the others fail. */
+    for (i = 0; i < batch->count; i++)
+        batch->status[i] = send_hsm_request(batch->action, batch->archive_id,
+                                            batch->data, batch->data_len,
+                                            &batch->fids[i], 1);
+}
+
+/** Add an entry to a pending batch and wait for its status. */
+static int batch_action(enum hsm_user_action action, const entry_id_t *p_id,
+                        unsigned int archive_id, const char *data,
+                        int data_len, unsigned int size, unsigned int delay_ms)
+{
+    struct action_batch *batch = NULL;
+    struct timespec deadline;
+    unsigned int idx;
+    bool leader = false;
+    bool flusher = false;
+    GList *l;
+    int rc;
+
+    P(batch_lock);
+    for (l = open_batches; l != NULL; l = l->next) {
+        if (batch_is_compatible(l->data, action, archive_id, data, data_len)) {
+            batch = l->data;
+            break;
+        }
+    }
+
+    if (batch == NULL) {
+        batch = batch_new(action, archive_id, data, data_len, size);
+        if (batch == NULL) {
+            V(batch_lock);
+            /* fallback to a single-item request */
+            return send_hsm_request(action, archive_id, data, data_len,
+                                    p_id, 1);
+        }
+        open_batches = g_list_prepend(open_batches, batch);
+        leader = true;
+    }
+
+    idx = batch->count++;
+    batch->fids[idx] = *p_id;
+    batch->refs++;
+
+    if (batch->count >= batch->size) {
+        /* full: the last worker sends it */
+        batch->closed = true;
+        open_batches = g_list_remove(open_batches, batch);
+        flusher = true;
+    } else if (leader) {
+        /* the first worker sends it when the delay expires */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += delay_ms / 1000;
+        deadline.tv_nsec += (delay_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!batch->closed) {
+            if (pthread_cond_timedwait(&batch->cond, &batch_lock,
+                                       &deadline) == ETIMEDOUT
+                && !batch->closed) {
+                batch->closed = true;
+                open_batches = g_list_remove(open_batches, batch);
+                flusher = true;
+            }
+        }
+    }
+
+    if (flusher) {
+        /* send the request out of the lock */
+        V(batch_lock);
+        batch_flush(batch);
+        P(batch_lock);
+        batch->done = true;
+        pthread_cond_broadcast(&batch->cond);
+    } else {
+        while (!batch->done)
+            pthread_cond_wait(&batch->cond, &batch_lock);
+    }
+
+    rc = batch->status[idx];
+    if (--batch->refs == 0)
+        batch_free(batch);
+    V(batch_lock);
+
+    return rc;
+}
+
 /** Trigger an HSM action */
 static int lhsm_action(enum hsm_user_action action, const entry_id_t *p_id,
                        const attr_set_t *attrs, const action_params_t *params)
 {
-    struct hsm_user_request *req;
     int rc;
-    char *mpath;
     unsigned int archive_id = DEFAULT_ARCHIVE_ID;   /* default */
+    unsigned int batch_size = config.action_batch_size;
     GString *args = NULL;
     const char *data = NULL;
     int data_len = 0;
 
     /* if archive_id is explicitely specified in action parameters, use it */
     rc = get_archive_id(params);
-    if (rc == 0) {
+    if (rc >= 0) {
         archive_id = rc;
     } else if (rc == -ENOENT) {
         /* for HSM_REMOVE, try to get it from previous attrs */
@@ -169,40 +429,12 @@ static int lhsm_action(enum hsm_user_action action, const entry_id_t *p_id,
                "action %s, fid=" DFID ", archive_id=%u, parameters='%s'",
                hsm_user_action2name(action), PFID(p_id), archive_id, args->str);
 
-    req = llapi_hsm_user_request_alloc(1, data_len);
-    if (!req) {
-        rc = -errno;
-        DisplayLog(LVL_CRIT, LHSM_TAG, "Cannot create HSM request: %s",
-                   strerror(-rc));
-        goto free_args;
-    }
-
-    req->hur_request.hr_action = action;
-    req->hur_request.hr_archive_id = archive_id;
-    req->hur_request.hr_flags = 0;
-
-    req->hur_user_item[0].hui_fid = *p_id;
-    req->hur_user_item[0].hui_extent.offset = 0;
-    /* XXX for now, always transfer entire file */
-    req->hur_user_item[0].hui_extent.length = -1LL;
-
-    req->hur_request.hr_itemcount = 1;
-    req->hur_request.hr_data_len = data_len;
-
-    if (data)
-        memcpy(hur_data(req), data, data_len);
-
-    /* make tmp copy as llapi_hsm_request arg is not const */
-    mpath = strdup(get_mount_point(NULL));
-    rc = llapi_hsm_request(mpath, req);
-    free(mpath);
-    free(req);
+    if (batch_size > 1)
+        rc = batch_action(action, p_id, archive_id, data, data_len,
+                          batch_size, config.action_batch_delay_ms);
+    else
+        rc = send_hsm_request(action, archive_id, data, data_len, p_id, 1);
 
-    if (rc)
-        DisplayLog(LVL_CRIT, LHSM_TAG,
-                   "ERROR performing HSM request(%s, root=%s, fid=" DFID
-                   "): %s", hsm_user_action2name(action), get_mount_point(NULL),
-                   PFID(p_id), strerror(-rc));
  free_args:
     g_string_free(args, TRUE);
     return rc;
@@ -360,8 +592,12 @@ static void set_uuid_info(struct sm_instance *smi, const entry_id_t *id,
         free(uuid);
 }
 
-/** get Lustre status and convert it to an internal scalar status */
-static int lhsm_get_status(const char *path, hsm_status_t *p_status,
+/**
+ * get Lustre status and convert it to an internal scalar status
+ * @param fd  if >= 0, the status is queried on this file descriptor
+ *            (path is only used for logging)
+ */
+static int lhsm_get_status(const char *path, int fd, hsm_status_t *p_status,
                            bool *no_release, bool *no_archive,
                            unsigned int *archive_id)
 {
@@ -375,7 +611,10 @@ static int lhsm_get_status(const char *path, hsm_status_t *p_status,
     *archive_id = DEFAULT_ARCHIVE_ID;
 
     /* get status */
-    rc = llapi_hsm_state_get(path, &file_status);
+    if (fd >= 0)
+        rc = llapi_hsm_state_get_fd(fd, &file_status);
+    else
+        rc = llapi_hsm_state_get(path, &file_status);
 
     if ((rc != 0) && (rc != -ENOENT) && (rc != -ESTALE))
         DisplayLog(LVL_DEBUG, LHSM_TAG, "llapi_hsm_state_get(%s)=%d", path, rc);
@@ -450,8 +689,8 @@ static inline int set_lhsm_status(struct sm_instance *smi, attr_set_t *attrs,
     return set_status_attr(smi, attrs, hsm_status2str(status));
 }
 
-/** get the HSM status of an entry */
-static int lhsm_status(struct sm_instance *smi,
+/** get the HSM status of an entry from the filesystem */
+static int lhsm_status_fs(struct sm_instance *smi,
                        const entry_id_t *id, const attr_set_t *attrs,
                        attr_set_t *refreshed_attrs)
 {
@@ -472,7 +711,9 @@ static int lhsm_status(struct sm_instance *smi,
     if (rc)
         goto clean_status;
 
-    rc = lhsm_get_status(fid_path, &st, &no_release, &no_archive, &archive_id);
+    /* use the handle of the entry if it is open */
+    rc = lhsm_get_status(fid_path, Lustre_GetEntryFd(id), &st, &no_release,
+                         &no_archive, &archive_id);
     if (rc)
         goto clean_status;
 
@@ -509,7 +750,26 @@ static int lhsm_status(struct sm_instance *smi,
 static bool status_equal(struct sm_instance *smi, const attr_set_t *attrs,
                          hsm_status_t status)
 {
-    return !strcmp(STATUS_ATTR(attrs, smi->smi_index), hsm_status2str(status));
+    return status_eq(STATUS_ATTR(attrs, smi->smi_index),
+                     hsm_status2str(status));
+}
+
+/**
+ * Get the HSM status of an entry.
+ * HSM changelog records keep the status up to date (see lhsm_cl_cb), so
+ * the filesystem is only queried for entries with an unknown status
+ * (e.g. entries discovered by a scan), unless refresh_known_status is set.
+ */
+static int lhsm_status(struct sm_instance *smi,
+                       const entry_id_t *id, const attr_set_t *attrs,
+                       attr_set_t *refreshed_attrs)
+{
+    if (!config.refresh_known_status
+        && ATTR_MASK_STATUS_TEST(attrs, smi->smi_index)
+        && STATUS_ATTR(attrs, smi->smi_index) != NULL)
+        return 0;
+
+    return lhsm_status_fs(smi, id, attrs, refreshed_attrs);
 }
 
 /** check this is a supported action */
@@ -538,7 +798,7 @@ static int lhsm_action_callback(struct sm_instance *smi,
             set_lhsm_status(smi, attrs, STATUS_ARCHIVE_RUNNING);
         else
             /* (try to) update hsm_status on failure */
-            lhsm_status(smi, id, attrs, attrs);
+            lhsm_status_fs(smi, id, attrs, attrs);
 
         *what_after = PA_UPDATE;
         return 0;
@@ -548,7 +808,7 @@ static int lhsm_action_callback(struct sm_instance *smi,
             set_lhsm_status(smi, attrs, STATUS_RELEASED);
         else
             /* (try to) update hsm_status on failure */
-            lhsm_status(smi, id, attrs, attrs);
+            lhsm_status_fs(smi, id, attrs, attrs);
 
         *what_after = PA_UPDATE;
         return 0;
@@ -664,6 +924,17 @@ static int lhsm_cl_cb(struct sm_instance *smi, const CL_REC_TYPE *logrec,
             break;
 
         case HE_REMOVE:
+            if (hsm_get_cl_error(logrec->cr_flags) == CLF_HSM_SUCCESS) {
+                /* the copy no longer exists in the backend */
+                set_lhsm_status(smi, refreshed_attrs,
+                                (hsm_get_cl_flags(logrec->cr_flags) &
+                                 CLF_HSM_DIRTY) ? STATUS_MODIFIED :
+                                STATUS_NEW);
+                *getit = false;
+            } else
+                *getit = true;
+            break;
+
         case HE_CANCEL:
             /* undetermined status after such an event */
             *getit = true;
@@ -679,10 +950,14 @@ static int lhsm_cl_cb(struct sm_instance *smi, const CL_REC_TYPE *logrec,
     } else if (logrec->cr_type == CL_MTIME || logrec->cr_type == CL_TRUNC ||
                (logrec->cr_type == CL_CLOSE)) {
         /* If file is modified or truncated, need to check its status
-         * (probably modified) EXCEPT if its status is already 'modified' */
+         * (probably modified) EXCEPT if its status is already 'modified'.
+         * Lustre raises a HSM state record when an archived file becomes
+         * dirty, so a known status is only checked if
+         * refresh_known_status is set. */
         if (!ATTR_MASK_STATUS_TEST(attrs, smi->smi_index)
-            || (!status_equal(smi, attrs, STATUS_NEW) &&
-                !status_equal(smi, attrs, STATUS_MODIFIED))) {
+            || (config.refresh_known_status
+                && !status_equal(smi, attrs, STATUS_NEW)
+                && !status_equal(smi, attrs, STATUS_MODIFIED))) {
             DisplayLog(LVL_DEBUG, LHSM_TAG,
                        "Getstatus needed because this is a %s event "
                        "and status is not already 'modified' or 'new': status=%s",
@@ -834,6 +1109,23 @@ static recov_status_t lhsm_undelete(struct sm_instance *smi,
             archive_id = *tmp;
     }
 
+    /* Another status manager recovered it (or the entry was migrated to a
+     * new fid). Just rebind in the backend. */
+    if (already_recovered) {
+        /* the archive copy is bound to the uuid of the file */
+        if (cfg_has_uuid(&config))
+            return RS_FILE_OK;
+
+        rc = lhsm_rebind(p_old_id, p_new_id, p_attrs_new, smi, archive_id);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LHSM_TAG,
+                       "Failed to rebind entry in backend: %s",
+                       rc < 0 ? strerror(-rc) : "command failed");
+            return RS_ERROR;
+        }
+        return RS_FILE_OK;
+    }
+
     rc = sm_attr_get(smi, p_attrs_old_in, "lhsm.uuid", (void **)&uuid,
                      &def, &idx);
     if (rc == 0) {
@@ -886,9 +1178,6 @@ static recov_status_t lhsm_undelete(struct sm_instance *smi,
     }
     stat2rbh_attrs(&entry_stat, p_attrs_new, true);
 
-    /** TODO If another status manager recovered it, just rebind in the
-     * backend. */
-
     if (!cfg_has_uuid(&config)) {
         rc = lhsm_rebind(p_old_id, p_new_id, p_attrs_new, smi, archive_id);
         if (rc) {
@@ -924,12 +1213,18 @@ static void lhsm_cfg_set_default(void *module_config)
         g_strfreev(conf->rebind_cmd);
         conf->rebind_cmd = NULL;
     }
+    conf->action_batch_size = 1;
+    conf->action_batch_delay_ms = 100;
+    conf->refresh_known_status = false;
 }
 
 static void lhsm_cfg_write_default(FILE *output)
 {
     print_begin_block(output, 0, LHSM_BLOCK, NULL);
     print_line(output, 1, "rebind_cmd: " DEFAULT_REBIND_CMD);
+    print_line(output, 1, "action_batch_size    : 1");
+    print_line(output, 1, "action_batch_delay_ms: 100");
+    print_line(output, 1, "refresh_known_status : no");
     print_end_block(output, 0);
 }
 
@@ -947,6 +1242,11 @@ static int lhsm_cfg_read(config_file_t config, void *module_config,
     const cfg_param_t hsm_params[] = {
         /* rebind_cmd can contain wildcards: {fsroot} {oldfid} {newfid}... */
         {"rebind_cmd", PT_CMD, 0, &conf->rebind_cmd, 0},
+        {"action_batch_size", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->action_batch_size, 0},
+        {"action_batch_delay_ms", PT_INT, PFLG_POSITIVE,
+         &conf->action_batch_delay_ms, 0},
+        {"refresh_known_status", PT_BOOL, 0, &conf->refresh_known_status, 0},
         END_OF_PARAMS
     };
 
@@ -961,7 +1261,8 @@ static int lhsm_cfg_read(config_file_t config, void *module_config,
     };
 
     static const char *allowed_params[] = {
-        "rebind_cmd", "uuid", NULL
+        "rebind_cmd", "action_batch_size", "action_batch_delay_ms", "uuid",
+        "refresh_known_status", NULL
     };
 
     /* get lhsm_config block */
@@ -1004,6 +1305,22 @@ static void lhsm_cfg_write_template(FILE *output)
     print_line(output, 1, "rebind_cmd = \"lhsmtool_posix "
                "--archive={archive_id} --hsm_root=/tmp/backend "
                "--rebind {oldfid} {newfid} {fsroot}\"");
+    fprintf(output, "\n");
+    print_line(output, 1, "# send HSM requests with up to 100 entries, "
+               "filled by");
+    print_line(output, 1, "# concurrent policy workers (1 = one request "
+               "per entry)");
+    print_line(output, 1, "action_batch_size = 100;");
+    print_line(output, 1, "# max time to wait for a request to be filled");
+    print_line(output, 1, "action_batch_delay_ms = 100;");
+    fprintf(output, "\n");
+    print_line(output, 1, "# HSM status is maintained from HSM changelog "
+               "records:");
+    print_line(output, 1, "# the filesystem is only queried for entries "
+               "with unknown status.");
+    print_line(output, 1, "# Set this to query it for all entries (e.g. "
+               "after lost records).");
+    print_line(output, 1, "refresh_known_status = no;");
     print_end_block(output, 0);
 }
 
@@ -1033,6 +1350,27 @@ static int lhsm_cfg_set(void *cfg, bool reload)
                    "but cannot be changed dynamically");
     }
 
+    /* used for the next actions */
+    if (new->action_batch_size != config.action_batch_size) {
+        DisplayLog(LVL_EVENT, LHSM_TAG, LHSM_BLOCK
+                   "::action_batch_size updated: %u->%u",
+                   config.action_batch_size, new->action_batch_size);
+        config.action_batch_size = new->action_batch_size;
+    }
+    if (new->action_batch_delay_ms != config.action_batch_delay_ms) {
+        DisplayLog(LVL_EVENT, LHSM_TAG, LHSM_BLOCK
+                   "::action_batch_delay_ms updated: %u->%u",
+                   config.action_batch_delay_ms, new->action_batch_delay_ms);
+        config.action_batch_delay_ms = new->action_batch_delay_ms;
+    }
+    if (new->refresh_known_status != config.refresh_known_status) {
+        DisplayLog(LVL_EVENT, LHSM_TAG, LHSM_BLOCK
+                   "::refresh_known_status updated: %s->%s",
+                   bool2str(config.refresh_known_status),
+                   bool2str(new->refresh_known_status));
+        config.refresh_known_status = new->refresh_known_status;
+    }
+
     return 0;
 }
 
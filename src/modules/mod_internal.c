@@ -22,11 +22,13 @@
 #include "mod_internal.h"
 #include "policy_rules.h"
 #include "status_manager.h"
+#include "rbh_digest.h"
 #include "Memory.h"
 #include <unistd.h>
 #include <utime.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <pthread.h>
 #include <zlib.h>
 
 struct copy_params_t {
@@ -40,6 +42,8 @@ struct copy_params_t {
     {
     "copyback", CP_COPYBACK},   /* revert copy way: tgt->src */
     {
+    "direct_io", CP_DIRECT_IO}, /* bypass the page cache */
+    {
     NULL, 0}
 };
 
@@ -109,7 +113,7 @@ static inline bool uncompress_src(copy_flags_e flags)
 }
 
 static int builtin_copy_standard(const struct copy_info *cp_nfo,
-                                 copy_flags_e flags)
+                                 copy_flags_e flags, struct rbh_digest *dg)
 {
     int srcfd, dstfd;
     struct stat dst_st;
@@ -191,6 +195,10 @@ static int builtin_copy_standard(const struct copy_info *cp_nfo,
             rc = -EAGAIN;
             goto out_free;
         }
+
+        /* digest of uncompressed data */
+        if (dg != NULL)
+            digest_update(dg, io_buff, r);
     } while (r > 0);
 
     if (r < 0) {    /* error */
@@ -251,12 +259,19 @@ static int builtin_copy_sendfile(const struct copy_info *cp_nfo,
     }
 #endif
 
-    rc = sendfile(dstfd, srcfd, NULL, fsize);
-    if (rc) {
-        rc = -errno;
-        DisplayLog(LVL_MAJOR, CP_TAG, "Failed to sendfile(%s->%s): %s",
-                   cp_nfo->src, cp_nfo->dst, strerror(-rc));
-        goto out;
+    /* sendfile() transfers at most 2GB per call */
+    while (fsize > 0) {
+        ssize_t w = sendfile(dstfd, srcfd, NULL, fsize);
+
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            rc = (w < 0) ? -errno : -EAGAIN;
+            DisplayLog(LVL_MAJOR, CP_TAG, "Failed to sendfile(%s->%s): %s",
+                       cp_nfo->src, cp_nfo->dst, strerror(-rc));
+            goto out;
+        }
+        fsize -= w;
     }
 
     rc = flush_data(srcfd, dstfd, flags);
@@ -267,11 +282,975 @@ static int builtin_copy_sendfile(const struct copy_info *cp_nfo,
     return rc;
 }
 
+/* ==== copy engine for uncompressed copies ====
+ * Files are copied with copy_file_range() when the kernel supports it
+ * for the source and destination filesystems (possibly server-side),
+ * else by a reader thread and a writer thread that exchange two
+ * aligned buffers, so reads and writes overlap.
+ * Files over 'stream_threshold' are split into ranges that are copied
+ * by parallel streams.
+ */
+
+/* defaults of copy tuning parameters */
+#define CP_DEFAULT_IO_SIZE          (4 * 1024 * 1024)
+#define CP_DEFAULT_STREAMS          4
+#define CP_DEFAULT_STREAM_THRESHOLD (4ULL * 1024 * 1024 * 1024)
+#define CP_MAX_STREAMS              64
+
+/* alignment of buffers, offsets and IO sizes for direct IO */
+#define CP_DIO_ALIGN                4096
+
+/* max size of a single copy_file_range() call */
+#define CP_CFR_CHUNK                (1024 * 1024 * 1024)
+
+#define ALIGN_UP(_s, _a)            ((((_s) + (_a) - 1) / (_a)) * (_a))
+
+/* blocks of parallel compression */
+#define PGZ_DEFAULT_BLOCK           (1024 * 1024)
+#define PGZ_MIN_BLOCK               (64 * 1024)
+#define PGZ_MAX_BLOCK               (64 * 1024 * 1024)
+
+void params2tuning(const action_params_t *params, struct copy_tuning *tuning)
+{
+    const char *val;
+    uint64_t sz;
+    int n;
+
+    tuning->io_size = 0;
+    tuning->streams = CP_DEFAULT_STREAMS;
+    tuning->stream_threshold = CP_DEFAULT_STREAM_THRESHOLD;
+    tuning->compress_threads = 1;
+    tuning->compress_block = PGZ_DEFAULT_BLOCK;
+
+    if (params == NULL)
+        return;
+
+    val = rbh_param_get(params, "io_size");
+    if (val != NULL) {
+        sz = str2size(val);
+        if (sz == (uint64_t)-1LL || sz == 0)
+            DisplayLog(LVL_MAJOR, CP_TAG, "Invalid value for copy "
+                       "parameter io_size: '%s'", val);
+        else
+            tuning->io_size = sz;
+    }
+
+    val = rbh_param_get(params, "streams");
+    if (val != NULL) {
+        n = str2int(val);
+        if (n <= 0 || n > CP_MAX_STREAMS)
+            DisplayLog(LVL_MAJOR, CP_TAG, "Invalid value for copy "
+                       "parameter streams: '%s' (1 to %u expected)", val,
+                       CP_MAX_STREAMS);
+        else
+            tuning->streams = n;
+    }
+
+    val = rbh_param_get(params, "stream_threshold");
+    if (val != NULL) {
+        sz = str2size(val);
+        if (sz == (uint64_t)-1LL)
+            DisplayLog(LVL_MAJOR, CP_TAG, "Invalid value for copy "
+                       "parameter stream_threshold: '%s'", val);
+        else
+            tuning->stream_threshold = sz;
+    }
+
+    val = rbh_param_get(params, "compress_threads");
+    if (val != NULL) {
+        n = str2int(val);
+        if (n <= 0 || n > CP_MAX_STREAMS)
+            DisplayLog(LVL_MAJOR, CP_TAG, "Invalid value for copy "
+                       "parameter compress_threads: '%s' (1 to %u expected)",
+                       val, CP_MAX_STREAMS);
+        else
+            tuning->compress_threads = n;
+    }
+
+    val = rbh_param_get(params, "compress_block");
+    if (val != NULL) {
+        sz = str2size(val);
+        if (sz == (uint64_t)-1LL || sz < PGZ_MIN_BLOCK || sz > PGZ_MAX_BLOCK)
+            DisplayLog(LVL_MAJOR, CP_TAG, "Invalid value for copy "
+                       "parameter compress_block: '%s' (64KB to 64MB "
+                       "expected)", val);
+        else
+            tuning->compress_block = sz;
+    }
+}
+
+/** buffer exchanged by the reader and the writer of a stream */
+struct io_slot {
+    char    *buff;
+    size_t   len;
+    off_t    offset;
+    bool     full;
+};
+
+/** copy of a range of the source file */
+struct copy_stream {
+    const struct copy_info *cp_nfo;
+    off_t           start;
+    off_t           end;
+    size_t          io_size;
+    bool            direct;
+    /** digest of copied data (single stream copies only) */
+    struct rbh_digest *digest;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    struct io_slot  slots[2];
+    bool            read_done;
+    bool            write_failed;
+    int             read_rc;
+
+    pthread_t       thread;
+    int             rc;
+};
+
+#ifdef HAVE_COPY_FILE_RANGE
+/**
+ * Copy a range with copy_file_range().
+ * @return -ENOTSUP if it is not supported for these files
+ *         (nothing was copied).
+ */
+static int copy_range_cfr(struct copy_stream *s)
+{
+    const struct copy_info *cp_nfo = s->cp_nfo;
+    loff_t off_in = s->start;
+    loff_t off_out = s->start;
+
+    while (off_in < s->end) {
+        ssize_t w;
+
+        w = copy_file_range(cp_nfo->src_fd, &off_in, cp_nfo->dst_fd,
+                            &off_out, MIN2(s->end - off_in, CP_CFR_CHUNK), 0);
+        if (w < 0) {
+            int err = errno;
+
+            if (err == EINTR)
+                continue;
+            if (off_in == s->start
+                && (err == ENOSYS || err == EXDEV || err == EINVAL
+                    || err == EOPNOTSUPP || err == EBADF))
+                return -ENOTSUP;
+
+            DisplayLog(LVL_MAJOR, CP_TAG, "Copy error (%s -> %s): %s",
+                       cp_nfo->src, cp_nfo->dst, strerror(err));
+            return -err;
+        }
+        if (w == 0) {
+            DisplayLog(LVL_MAJOR, CP_TAG, "%s was truncated during copy",
+                       cp_nfo->src);
+            return -EAGAIN;
+        }
+    }
+    return 0;
+}
+#endif
+
+/** read-ahead thread of a stream: fills the free buffer */
+static void *stream_reader(void *arg)
+{
+    struct copy_stream *s = arg;
+    off_t off = s->start;
+    unsigned int i = 0;
+    int rc = 0;
+
+    while (off < s->end) {
+        struct io_slot *slot = &s->slots[i];
+        size_t len = MIN2(s->io_size, s->end - off);
+        ssize_t r;
+        bool stop;
+
+        P(s->lock);
+        while (slot->full && !s->write_failed)
+            pthread_cond_wait(&s->cond, &s->lock);
+        stop = s->write_failed;
+        V(s->lock);
+        if (stop)
+            break;
+
+        /* direct IO sizes must be aligned (the end of file is read
+         * with a short count) */
+        if (s->direct)
+            len = ALIGN_UP(len, CP_DIO_ALIGN);
+
+        do {
+            r = pread(s->cp_nfo->src_fd, slot->buff, len, off);
+        } while (r < 0 && errno == EINTR);
+
+        if (r < 0) {
+            rc = -errno;
+            DisplayLog(LVL_MAJOR, CP_TAG, "Read error on %s: %s",
+                       s->cp_nfo->src, strerror(-rc));
+            break;
+        }
+        if (r == 0) {
+            DisplayLog(LVL_MAJOR, CP_TAG, "%s was truncated during copy",
+                       s->cp_nfo->src);
+            rc = -EAGAIN;
+            break;
+        }
+        /* don't copy past the end of the range */
+        if (off + r > s->end)
+            r = s->end - off;
+
+        P(s->lock);
+        slot->len = r;
+        slot->offset = off;
+        slot->full = true;
+        pthread_cond_broadcast(&s->cond);
+        V(s->lock);
+
+        off += r;
+        i ^= 1;
+    }
+
+    P(s->lock);
+    s->read_rc = rc;
+    s->read_done = true;
+    pthread_cond_broadcast(&s->cond);
+    V(s->lock);
+    return NULL;
+}
+
+/** write a buffer, handling short writes */
+static int write_slot(struct copy_stream *s, const struct io_slot *slot)
+{
+    size_t len = slot->len;
+    size_t done = 0;
+
+    /* pad the end of file for direct IO (truncated afterwards) */
+    if (s->direct && (len % CP_DIO_ALIGN) != 0) {
+        size_t padded = ALIGN_UP(len, CP_DIO_ALIGN);
+
+        memset(slot->buff + len, 0, padded - len);
+        len = padded;
+    }
+
+    while (done < len) {
+        ssize_t w = pwrite(s->cp_nfo->dst_fd, slot->buff + done, len - done,
+                           slot->offset + done);
+
+        if (w < 0) {
+            int err = errno;
+
+            if (err == EINTR)
+                continue;
+            DisplayLog(LVL_MAJOR, CP_TAG, "Copy error (%s -> %s): %s",
+                       s->cp_nfo->src, s->cp_nfo->dst, strerror(err));
+            return -err;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+/** copy a range with double buffering */
+static int copy_range_buffered(struct copy_stream *s)
+{
+    pthread_t reader;
+    unsigned int i;
+    int rc = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (posix_memalign((void **)&s->slots[i].buff, CP_DIO_ALIGN,
+                           ALIGN_UP(s->io_size, CP_DIO_ALIGN)) != 0) {
+            s->slots[i].buff = NULL;
+            rc = -ENOMEM;
+            goto out_free;
+        }
+        s->slots[i].full = false;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    s->read_done = false;
+    s->write_failed = false;
+    s->read_rc = 0;
+
+    if (pthread_create(&reader, NULL, stream_reader, s) != 0) {
+        rc = -errno;
+        goto out_destroy;
+    }
+
+    for (i = 0;; i ^= 1) {
+        struct io_slot *slot = &s->slots[i];
+
+        P(s->lock);
+        while (!slot->full && !s->read_done)
+            pthread_cond_wait(&s->cond, &s->lock);
+        V(s->lock);
+
+        /* the reader stops after filling its last buffer */
+        if (!slot->full)
+            break;
+
+        rc = write_slot(s, slot);
+        /* the reader fills the other buffer meanwhile */
+        if (rc == 0 && s->digest != NULL)
+            digest_update(s->digest, slot->buff, slot->len);
+
+        P(s->lock);
+        slot->full = false;
+        if (rc)
+            s->write_failed = true;
+        pthread_cond_broadcast(&s->cond);
+        V(s->lock);
+
+        if (rc)
+            break;
+    }
+
+    pthread_join(reader, NULL);
+    if (rc == 0)
+        rc = s->read_rc;
+
+ out_destroy:
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+ out_free:
+    for (i = 0; i < 2; i++)
+        free(s->slots[i].buff);
+    return rc;
+}
+
+static int copy_range(struct copy_stream *s)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    /* data must go through user space to compute a digest */
+    if (!s->direct && s->digest == NULL) {
+        int rc = copy_range_cfr(s);
+
+        if (rc != -ENOTSUP)
+            return rc;
+        DisplayLog(LVL_FULL, CP_TAG, "copy_file_range() not supported "
+                   "for %s -> %s: using read/write", s->cp_nfo->src,
+                   s->cp_nfo->dst);
+    }
+#endif
+    return copy_range_buffered(s);
+}
+
+static void *stream_thr(void *arg)
+{
+    struct copy_stream *s = arg;
+
+    s->rc = copy_range(s);
+    return NULL;
+}
+
+static int builtin_copy_engine(const struct copy_info *cp_nfo,
+                               copy_flags_e flags,
+                               const struct copy_tuning *tuning,
+                               struct rbh_digest *dg)
+{
+    off_t fsize = cp_nfo->src_st.st_size;
+    struct copy_stream *streams;
+    struct stat dst_st;
+    unsigned int count = 1, started, i;
+    size_t io_size = tuning->io_size;
+    off_t range;
+    bool direct = !!(flags & CP_DIRECT_IO);
+    int rc = 0;
+
+    if (io_size == 0) {
+        if (fstat(cp_nfo->dst_fd, &dst_st)) {
+            rc = -errno;
+            DisplayLog(LVL_MAJOR, CP_TAG, "Failed to stat %s: %s",
+                       cp_nfo->dst, strerror(-rc));
+            return rc;
+        }
+        io_size = MAX3(CP_DEFAULT_IO_SIZE, cp_nfo->src_st.st_blksize,
+                       dst_st.st_blksize);
+    }
+    io_size = ALIGN_UP(io_size, CP_DIO_ALIGN);
+
+    /* a digest is computed sequentially */
+    if (dg == NULL && fsize >= tuning->stream_threshold
+        && tuning->streams > 1)
+        count = MIN2(tuning->streams, ALIGN_UP(fsize, io_size) / io_size);
+    count = MAX2(count, 1);
+
+    /* ranges are aligned to the IO size */
+    range = ALIGN_UP(ALIGN_UP(fsize, count) / count, io_size);
+
+    DisplayLog(LVL_DEBUG, CP_TAG, "copying %s with %u stream(s), IO size = %"
+               PRI_SZ "%s", cp_nfo->src, count, io_size,
+               direct ? ", direct IO" : "");
+
+#if HAVE_FALLOCATE
+    /* parallel streams write out of order */
+    if (fsize > 0 && fallocate(cp_nfo->dst_fd, 0, 0, fsize) != 0)
+        DisplayLog(LVL_FULL, CP_TAG, "fallocate() failed on %s: %s",
+                   cp_nfo->dst, strerror(errno));
+#endif
+
+    streams = MemCalloc(count, sizeof(*streams));
+    if (streams == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        streams[i].cp_nfo = cp_nfo;
+        streams[i].start = MIN2((off_t)i * range, fsize);
+        streams[i].end = MIN2((off_t)(i + 1) * range, fsize);
+        streams[i].io_size = io_size;
+        streams[i].direct = direct;
+    }
+    streams[0].digest = dg;
+
+    /* the first range is copied by the current thread */
+    for (started = 1; started < count; started++) {
+        if (pthread_create(&streams[started].thread, NULL, stream_thr,
+                           &streams[started]) != 0) {
+            /* copy the remaining ranges in the current thread */
+            DisplayLog(LVL_MAJOR, CP_TAG, "Failed to start copy stream: %s",
+                       strerror(errno));
+            break;
+        }
+    }
+
+    streams[0].rc = copy_range(&streams[0]);
+    for (i = started; i < count; i++)
+        streams[i].rc = copy_range(&streams[i]);
+
+    for (i = 1; i < started; i++)
+        pthread_join(streams[i].thread, NULL);
+
+    for (i = 0; i < count && rc == 0; i++)
+        rc = streams[i].rc;
+    MemFree(streams);
+    if (rc)
+        return rc;
+
+    /* remove the padding of direct IO, or preallocated blocks
+     * if the source shrank */
+    if (ftruncate(cp_nfo->dst_fd, fsize)) {
+        rc = -errno;
+        DisplayLog(LVL_MAJOR, CP_TAG, "Failed to truncate %s: %s",
+                   cp_nfo->dst, strerror(-rc));
+        return rc;
+    }
+
+    return flush_data(cp_nfo->src_fd, cp_nfo->dst_fd, flags);
+}
+
+/* ==== parallel gzip ====
+ * Each block of the source is compressed by a worker thread as a separate
+ * gzip member. Concatenated members are a valid gzip file (gzip -d and
+ * gzread() read them as a single stream).
+ * The header of each member has an extra field 'RB' with the total size
+ * of the member, so members can be located and decompressed in parallel
+ * when the copy is restored. Other gzip files are decompressed by
+ * gzread().
+ */
+
+/* member header: gzip header with FEXTRA, then subfield 'RB' (4 bytes) */
+#define PGZ_HDR_SIZE    20
+/* member trailer: CRC32 and size of uncompressed data */
+#define PGZ_TRL_SIZE    8
+
+/* default threads to decompress (restores get no tuning parameter) */
+#define PGZ_INFLATE_THREADS CP_DEFAULT_STREAMS
+
+typedef enum {
+    BLK_FREE,   /* can be filled by the main thread */
+    BLK_TODO,   /* to be processed by a worker */
+    BLK_BUSY,   /* being processed */
+    BLK_DONE,   /* to be written by the main thread */
+} pgz_state_e;
+
+struct pgz_block {
+    unsigned char  *in;
+    size_t          in_size;  /* allocated */
+    size_t          in_len;
+    unsigned char  *out;
+    size_t          out_size; /* allocated */
+    size_t          out_len;
+    pgz_state_e     state;
+    int             rc;
+};
+
+struct pgz_pool {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    /* ring of blocks, processed in order */
+    struct pgz_block   *blocks;
+    unsigned int        count;
+    unsigned int        next_todo;
+    bool                stop;
+    bool                inflate;
+
+    pthread_t          *threads;
+    unsigned int        started;
+};
+
+static inline void put_le16(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static inline void put_le32(unsigned char *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+        | ((uint32_t)p[3] << 24);
+}
+
+static void pgz_header(unsigned char *p, uint32_t member_size)
+{
+    memset(p, 0, PGZ_HDR_SIZE);
+    p[0] = 0x1f;
+    p[1] = 0x8b;
+    p[2] = Z_DEFLATED;
+    p[3] = 0x04;    /* FEXTRA */
+    /* no mtime (4 bytes), no XFL */
+    p[9] = 3;       /* OS: unix */
+    put_le16(p + 10, 8);    /* XLEN */
+    p[12] = 'R';
+    p[13] = 'B';
+    put_le16(p + 14, 4);
+    put_le32(p + 16, member_size);
+}
+
+/** @return the size of the member, or 0 if it has no 'RB' header */
+static uint32_t pgz_member_size(const unsigned char *p)
+{
+    if (p[0] != 0x1f || p[1] != 0x8b || p[2] != Z_DEFLATED || p[3] != 0x04
+        || p[10] != 8 || p[11] != 0 || p[12] != 'R' || p[13] != 'B'
+        || p[14] != 4 || p[15] != 0)
+        return 0;
+    return get_le32(p + 16);
+}
+
+static int pgz_reserve(unsigned char **buff, size_t *size, size_t needed)
+{
+    unsigned char *tmp;
+
+    if (*size >= needed && *buff != NULL)
+        return 0;
+
+    tmp = MemRealloc(*buff, MAX2(needed, 1));
+    if (tmp == NULL)
+        return -ENOMEM;
+    *buff = tmp;
+    *size = MAX2(needed, 1);
+    return 0;
+}
+
+/** compress blk->in to a gzip member in blk->out */
+static int pgz_deflate(struct pgz_block *blk)
+{
+    z_stream zs;
+    size_t bound;
+    unsigned char *trl;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return -ENOMEM;
+
+    bound = PGZ_HDR_SIZE + deflateBound(&zs, blk->in_len) + PGZ_TRL_SIZE;
+    if (pgz_reserve(&blk->out, &blk->out_size, bound)) {
+        deflateEnd(&zs);
+        return -ENOMEM;
+    }
+
+    zs.next_in = blk->in;
+    zs.avail_in = blk->in_len;
+    zs.next_out = blk->out + PGZ_HDR_SIZE;
+    zs.avail_out = bound - PGZ_HDR_SIZE - PGZ_TRL_SIZE;
+
+    rc = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END)
+        return -EIO;
+
+    blk->out_len = PGZ_HDR_SIZE + zs.total_out + PGZ_TRL_SIZE;
+    pgz_header(blk->out, blk->out_len);
+
+    trl = blk->out + PGZ_HDR_SIZE + zs.total_out;
+    put_le32(trl, crc32(crc32(0L, Z_NULL, 0), blk->in, blk->in_len));
+    put_le32(trl + 4, blk->in_len);
+    return 0;
+}
+
+/** decompress the gzip member in blk->in to blk->out */
+static int pgz_inflate(struct pgz_block *blk)
+{
+    const unsigned char *trl = blk->in + blk->in_len - PGZ_TRL_SIZE;
+    uint32_t isize = get_le32(trl + 4);
+    z_stream zs;
+    int rc;
+
+    if (pgz_reserve(&blk->out, &blk->out_size, isize))
+        return -ENOMEM;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+        return -ENOMEM;
+
+    zs.next_in = blk->in + PGZ_HDR_SIZE;
+    zs.avail_in = blk->in_len - PGZ_HDR_SIZE - PGZ_TRL_SIZE;
+    zs.next_out = blk->out;
+    zs.avail_out = isize;
+
+    rc = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (rc != Z_STREAM_END || zs.total_out != isize)
+        return -EIO;
+
+    if (crc32(crc32(0L, Z_NULL, 0), blk->out, isize) != get_le32(trl))
+        return -EIO;
+
+    blk->out_len = isize;
+    return 0;
+}
+
+static void *pgz_worker(void *arg)
+{
+    struct pgz_pool *pool = arg;
+
+    P(pool->lock);
+    for (;;) {
+        struct pgz_block *blk = &pool->blocks[pool->next_todo % pool->count];
+        int rc;
+
+        while (!pool->stop && blk->state != BLK_TODO) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            blk = &pool->blocks[pool->next_todo % pool->count];
+        }
+        if (pool->stop)
+            break;
+
+        pool->next_todo++;
+        blk->state = BLK_BUSY;
+        V(pool->lock);
+
+        rc = pool->inflate ? pgz_inflate(blk) : pgz_deflate(blk);
+
+        P(pool->lock);
+        blk->rc = rc;
+        blk->state = BLK_DONE;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    V(pool->lock);
+    return NULL;
+}
+
+static void pgz_pool_stop(struct pgz_pool *pool)
+{
+    unsigned int i;
+
+    P(pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    V(pool->lock);
+
+    for (i = 0; i < pool->started; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    if (pool->blocks != NULL) {
+        for (i = 0; i < pool->count; i++) {
+            MemFree(pool->blocks[i].in);
+            MemFree(pool->blocks[i].out);
+        }
+        MemFree(pool->blocks);
+    }
+    MemFree(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+}
+
+static int pgz_pool_start(struct pgz_pool *pool, unsigned int nthreads,
+                          bool inflate)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->inflate = inflate;
+
+    /* 2 blocks per thread, so workers don't wait for IOs */
+    pool->count = 2 * nthreads;
+    pool->blocks = MemCalloc(pool->count, sizeof(*pool->blocks));
+    pool->threads = MemCalloc(nthreads, sizeof(*pool->threads));
+    if (pool->blocks == NULL || pool->threads == NULL) {
+        pgz_pool_stop(pool);
+        return -ENOMEM;
+    }
+
+    for (pool->started = 0; pool->started < nthreads; pool->started++) {
+        if (pthread_create(&pool->threads[pool->started], NULL, pgz_worker,
+                           pool) != 0) {
+            DisplayLog(LVL_MAJOR, CP_TAG, "Failed to start compression "
+                       "thread: %s", strerror(errno));
+            break;
+        }
+    }
+    if (pool->started == 0) {
+        pgz_pool_stop(pool);
+        return -ENOTSUP;
+    }
+    return 0;
+}
+
+/** hand a filled block to workers */
+static void pgz_submit(struct pgz_pool *pool, struct pgz_block *blk)
+{
+    P(pool->lock);
+    blk->state = BLK_TODO;
+    pthread_cond_broadcast(&pool->cond);
+    V(pool->lock);
+}
+
+/** wait for a block to be processed */
+static int pgz_wait(struct pgz_pool *pool, struct pgz_block *blk)
+{
+    P(pool->lock);
+    while (blk->state != BLK_DONE)
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    blk->state = BLK_FREE;
+    V(pool->lock);
+    return blk->rc;
+}
+
+/** @return the read size (less than size at end of file), or -errno */
+static ssize_t read_full(int fd, void *buff, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t r = read(fd, (char *)buff + done, size - done);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -errno;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+static int write_full(int fd, const void *buff, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t w = write(fd, (const char *)buff + done, size - done);
+
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0)
+            return -errno;
+        done += w;
+    }
+    return 0;
+}
+
+/**
+ * Read the next member of a parallel gzip file.
+ * @return 1 if a member was read, 0 at end of file, or a negative error.
+ */
+static int pgz_read_member(const struct copy_info *cp_nfo,
+                           struct pgz_block *blk)
+{
+    unsigned char hdr[PGZ_HDR_SIZE];
+    uint32_t msize;
+    ssize_t r;
+
+    r = read_full(cp_nfo->src_fd, hdr, sizeof(hdr));
+    if (r == 0)
+        return 0;
+    if (r < 0)
+        return r;
+
+    msize = (r == sizeof(hdr)) ? pgz_member_size(hdr) : 0;
+    if (msize < PGZ_HDR_SIZE + PGZ_TRL_SIZE
+        || msize > PGZ_HDR_SIZE + compressBound(PGZ_MAX_BLOCK) + PGZ_TRL_SIZE) {
+        DisplayLog(LVL_MAJOR, CP_TAG, "%s: invalid or truncated compressed "
+                   "block", cp_nfo->src);
+        return -EIO;
+    }
+
+    if (pgz_reserve(&blk->in, &blk->in_size, msize))
+        return -ENOMEM;
+    memcpy(blk->in, hdr, sizeof(hdr));
+
+    r = read_full(cp_nfo->src_fd, blk->in + sizeof(hdr), msize - sizeof(hdr));
+    if (r < 0)
+        return r;
+    if (r != msize - sizeof(hdr)
+        || get_le32(blk->in + msize - 4) > PGZ_MAX_BLOCK) {
+        DisplayLog(LVL_MAJOR, CP_TAG, "%s: invalid or truncated compressed "
+                   "block", cp_nfo->src);
+        return -EIO;
+    }
+
+    blk->in_len = msize;
+    return 1;
+}
+
+/**
+ * Read the next block of the source file.
+ * @return 1 if a block was read, 0 at end of file, or a negative error.
+ */
+static int pgz_read_block(const struct copy_info *cp_nfo,
+                          struct pgz_block *blk, size_t block_size)
+{
+    ssize_t r;
+
+    if (pgz_reserve(&blk->in, &blk->in_size, block_size))
+        return -ENOMEM;
+
+    r = read_full(cp_nfo->src_fd, blk->in, block_size);
+    if (r < 0)
+        return r;
+
+    blk->in_len = r;
+    return r > 0 ? 1 : 0;
+}
+
+/**
+ * Compressed copy of a file using parallel threads.
+ * @return -ENOTSUP if the copy must be done by builtin_copy_standard()
+ *         (nothing was copied).
+ */
+static int builtin_copy_pgzip(const struct copy_info *cp_nfo,
+                              copy_flags_e flags,
+                              const struct copy_tuning *tuning,
+                              struct rbh_digest *dg)
+{
+    bool inflate = compress_src(flags);
+    struct pgz_pool pool;
+    unsigned int head = 0, tail = 0, nthreads;
+    bool eof = false;
+    int rc = 0;
+
+    if (inflate) {
+        unsigned char hdr[PGZ_HDR_SIZE];
+
+        /* only files written by this function can be split */
+        if (pread(cp_nfo->src_fd, hdr, sizeof(hdr), 0) != sizeof(hdr)
+            || pgz_member_size(hdr) == 0)
+            return -ENOTSUP;
+        nthreads = MAX2(tuning->compress_threads, PGZ_INFLATE_THREADS);
+    } else {
+        if (tuning->compress_threads <= 1)
+            return -ENOTSUP;
+        nthreads = tuning->compress_threads;
+    }
+
+    rc = pgz_pool_start(&pool, nthreads, inflate);
+    if (rc)
+        return rc;
+
+    DisplayLog(LVL_DEBUG, CP_TAG, "%s %s with %u threads",
+               inflate ? "decompressing" : "compressing", cp_nfo->src,
+               pool.started);
+
+    while (!eof || tail < head) {
+        struct pgz_block *blk;
+
+        /* read as many blocks as possible, workers process them */
+        while (!eof && head - tail < pool.count) {
+            blk = &pool.blocks[head % pool.count];
+
+            if (inflate)
+                rc = pgz_read_member(cp_nfo, blk);
+            else
+                rc = pgz_read_block(cp_nfo, blk, tuning->compress_block);
+            if (rc < 0)
+                goto out;
+
+            /* an empty file is compressed to an empty member */
+            if (rc == 0 && (inflate || head > 0)) {
+                eof = true;
+                break;
+            }
+            if (!inflate && blk->in_len < tuning->compress_block)
+                eof = true;
+
+            /* digest of uncompressed data */
+            if (dg != NULL && !inflate)
+                digest_update(dg, blk->in, blk->in_len);
+
+            pgz_submit(&pool, blk);
+            head++;
+        }
+
+        if (tail == head)
+            break;
+
+        /* write blocks in order */
+        blk = &pool.blocks[tail % pool.count];
+        rc = pgz_wait(&pool, blk);
+        if (rc) {
+            DisplayLog(LVL_MAJOR, CP_TAG, "%s error (%s -> %s): %s",
+                       inflate ? "Decompression" : "Compression",
+                       cp_nfo->src, cp_nfo->dst, strerror(-rc));
+            goto out;
+        }
+        tail++;
+
+        if (dg != NULL && inflate)
+            digest_update(dg, blk->out, blk->out_len);
+
+        rc = write_full(cp_nfo->dst_fd, blk->out, blk->out_len);
+        if (rc) {
+            DisplayLog(LVL_MAJOR, CP_TAG, "Copy error (%s -> %s): %s",
+                       cp_nfo->src, cp_nfo->dst, strerror(-rc));
+            goto out;
+        }
+    }
+
+    rc = flush_data(cp_nfo->src_fd, cp_nfo->dst_fd, flags);
+
+ out:
+    pgz_pool_stop(&pool);
+    return rc;
+}
+
+/** get the type of digest to compute from the 'digest' parameter */
+static digest_type_e params2digest(const action_params_t *params)
+{
+    const char *val;
+    digest_type_e type;
+
+    if (params == NULL)
+        return DIGEST_NONE;
+
+    val = rbh_param_get(params, "digest");
+    if (val == NULL || val[0] == '\0')
+        return DIGEST_NONE;
+
+    type = str2digest_type(val);
+    if (type == DIGEST_NONE)
+        DisplayLog(LVL_MAJOR, CP_TAG, "Invalid value for copy parameter "
+                   "digest: '%s' (crc32c or sha256 expected)", val);
+    return type;
+}
+
 int builtin_copy(const char *src, const char *dst, int dst_oflags,
-                 bool save_attrs, copy_flags_e flags)
+                 bool save_attrs, copy_flags_e flags,
+                 const action_params_t *params)
 {
     struct copy_info cp_nfo;
+    struct copy_tuning tuning;
+    struct rbh_digest digest;
+    struct rbh_digest *dg = NULL;
+    digest_type_e dg_type;
+    char dg_str[DIGEST_STR_MAX];
     int rc, err_close = 0;
+    int dio_flag = 0;
 
     cp_nfo.src = src;
     cp_nfo.dst = dst;
@@ -280,7 +1259,20 @@ int builtin_copy(const char *src, const char *dst, int dst_oflags,
                "builtin_copy('%s', '%s', oflg=%#x, save_attrs=%d, flags=%#x)",
                src, dst, dst_oflags, save_attrs, flags);
 
-    cp_nfo.src_fd = open(src, O_RDONLY | O_NOATIME);
+    /* direct IO only applies to uncompressed copies */
+    if (flags & CP_COMPRESS)
+        flags &= ~CP_DIRECT_IO;
+    else if (flags & CP_DIRECT_IO)
+        dio_flag = O_DIRECT;
+
+    cp_nfo.src_fd = open(src, O_RDONLY | O_NOATIME | dio_flag);
+    if (cp_nfo.src_fd < 0 && dio_flag != 0 && errno == EINVAL) {
+        DisplayLog(LVL_DEBUG, CP_TAG, "Direct IO is not supported for %s",
+                   src);
+        flags &= ~CP_DIRECT_IO;
+        dio_flag = 0;
+        cp_nfo.src_fd = open(src, O_RDONLY | O_NOATIME);
+    }
     if (cp_nfo.src_fd < 0) {
         rc = -errno;
         DisplayLog(LVL_MAJOR, CP_TAG, "Can't open %s for read: %s", src,
@@ -295,7 +1287,17 @@ int builtin_copy(const char *src, const char *dst, int dst_oflags,
         goto close_src;
     }
 
-    cp_nfo.dst_fd = open(dst, dst_oflags, cp_nfo.src_st.st_mode & 07777);
+    cp_nfo.dst_fd = open(dst, dst_oflags | dio_flag,
+                         cp_nfo.src_st.st_mode & 07777);
+    if (cp_nfo.dst_fd < 0 && dio_flag != 0 && errno == EINVAL) {
+        DisplayLog(LVL_DEBUG, CP_TAG, "Direct IO is not supported for %s",
+                   dst);
+        /* reads and writes must use the same alignment */
+        fcntl(cp_nfo.src_fd, F_SETFL,
+              fcntl(cp_nfo.src_fd, F_GETFL) & ~O_DIRECT);
+        flags &= ~CP_DIRECT_IO;
+        cp_nfo.dst_fd = open(dst, dst_oflags, cp_nfo.src_st.st_mode & 07777);
+    }
     if (cp_nfo.dst_fd < 0) {
         rc = -errno;
         DisplayLog(LVL_MAJOR, CP_TAG, "Can't open %s for write: %s",
@@ -303,12 +1305,30 @@ int builtin_copy(const char *src, const char *dst, int dst_oflags,
         goto close_src;
     }
 
-    if (flags & CP_COMPRESS)
-        rc = builtin_copy_standard(&cp_nfo, flags);
-    else if (flags & CP_USE_SENDFILE)
+    dg_type = params2digest(params);
+    if (dg_type != DIGEST_NONE) {
+        digest_init(&digest, dg_type);
+        dg = &digest;
+    }
+
+    /* sendfile() data does not go through user space: the copy engine
+     * is used instead to compute a digest */
+    params2tuning(params, &tuning);
+
+    if (flags & CP_COMPRESS) {
+        rc = builtin_copy_pgzip(&cp_nfo, flags, &tuning, dg);
+        if (rc == -ENOTSUP)
+            rc = builtin_copy_standard(&cp_nfo, flags, dg);
+    } else if ((flags & CP_USE_SENDFILE) && dg == NULL)
         rc = builtin_copy_sendfile(&cp_nfo, flags);
     else
-        rc = builtin_copy_standard(&cp_nfo, flags);
+        rc = builtin_copy_engine(&cp_nfo, flags, &tuning, dg);
+
+    if (rc == 0 && dg != NULL) {
+        digest_final(dg, dg_str);
+        DisplayLog(LVL_DEBUG, CP_TAG, "%s: %s", src, dg_str);
+        module_action_output_set(dg_str);
+    }
 
     err_close = close(cp_nfo.dst_fd);
     if (err_close && (rc == 0)) {
@@ -398,6 +1418,33 @@ static int run_command(const char *name, char **cmd_in,
     return rc;
 }
 
+/**
+ * Send a request to a co-process helper to perform an action.
+ * @param [in,out] out  Initialized GString to collect the reply output
+ *                      (NULL for no output).
+ */
+static int run_coproc(const char *name,
+                      const struct action_coproc_info *coproc,
+                      const entry_id_t *p_id, const attr_set_t *p_attrs,
+                      const action_params_t *params,
+                      struct sm_instance *smi, GString *out)
+{
+    char *request;
+    int rc;
+
+    request = subst_params(coproc->request, "coproc request", p_id, p_attrs,
+                           params, NULL, smi, true, true);
+    if (request == NULL)
+        return -EINVAL;
+
+    DisplayLog(LVL_DEBUG, __func__, DFID ": %s action: coproc(%s)",
+               PFID(p_id), name, request);
+
+    rc = coproc_call(coproc->coproc, request, out);
+    g_free(request);
+    return rc;
+}
+
 int action_helper(const policy_action_t *action, const char *name,
                   const entry_id_t *p_id, attr_set_t *p_attrs,
                   const action_params_t *params, struct sm_instance *smi,
@@ -412,11 +1459,26 @@ int action_helper(const policy_action_t *action, const char *name,
                          params, smi, out);
         break;
 
+    case ACTION_COPROC:
+        rc = run_coproc(name, &action->action_u.coproc, p_id, p_attrs,
+                        params, smi, out);
+        break;
+
     case ACTION_FUNCTION:
         DisplayLog(LVL_DEBUG, __func__, DFID ": %s action: %s", PFID(p_id),
                    name, action->action_u.func.name);
+        /* drop the output of a previous action */
+        g_free(module_action_output_take());
         rc = action->action_u.func.call(p_id, p_attrs, params, after,
                                         db_cb_fn, db_cb_arg);
+        if (out != NULL) {
+            char *output = module_action_output_take();
+
+            if (output != NULL) {
+                g_string_append(out, output);
+                g_free(output);
+            }
+        }
         break;
 
     case ACTION_NONE:
@@ -28,16 +28,42 @@ typedef enum {
     CP_COMPRESS     = (1 << 0),
     CP_USE_SENDFILE = (1 << 1),
     CP_NO_SYNC      = (1 << 2),
-    CP_COPYBACK     = (1 << 3)  /* retrieve a copy */
+    CP_COPYBACK     = (1 << 3), /* retrieve a copy */
+    CP_DIRECT_IO    = (1 << 4)  /* use O_DIRECT (uncompressed copies) */
 } copy_flags_e;
 
-/** These functions are shared by several modules (namely common & backup). */
+/** tuning of uncompressed copies */
+struct copy_tuning {
+    size_t       io_size;           /**< size of IOs (0 for default) */
+    unsigned int streams;           /**< parallel streams for large files */
+    uint64_t     stream_threshold;  /**< min file size to use parallel
+                                         streams */
+    unsigned int compress_threads;  /**< threads for compressed copies */
+    size_t       compress_block;    /**< size of blocks compressed
+                                         in parallel */
+};
+
+/**
+ * These functions are shared by several modules (namely common & backup).
+ * @param params  action parameters, to get copy tuning (may be NULL).
+ *                If the 'digest' parameter is set (crc32c or sha256), the
+ *                digest of the copied data is computed during the copy and
+ *                reported as the action output (see
+ *                module_action_output_set()).
+ */
 int builtin_copy(const char *src, const char *dst, int dst_oflags,
-                 bool save_attrs, copy_flags_e flags);
+                 bool save_attrs, copy_flags_e flags,
+                 const action_params_t *params);
 
 /** set copy flags from a parameter set */
 copy_flags_e params2flags(const action_params_t *params);
 
+/**
+ * Set copy tuning from parameters 'io_size', 'streams', 'stream_threshold',
+ * 'compress_threads' and 'compress_block'.
+ */
+void params2tuning(const action_params_t *params, struct copy_tuning *tuning);
+
 /** helper to set the entry status for the given SMI */
 static inline int set_status_attr(const sm_instance_t *smi,
                                   attr_set_t *pattrs, const char *str_st)
@@ -49,6 +75,15 @@ static inline int set_status_attr(const sm_instance_t *smi,
         goto clean_status;
     }
 
+    /* statuses are compared by address (see status_eq()) */
+    if (status_index(smi->sm, str_st) == -1) {
+        str_st = get_status_str(smi->sm, str_st);
+        if (str_st == NULL) {
+            rc = -EINVAL;
+            goto clean_status;
+        }
+    }
+
     /* check allocation of sm_status array */
     sm_status_ensure_alloc(&pattrs->attr_values.sm_status);
     if (pattrs->attr_values.sm_status == NULL) {
@@ -112,7 +147,11 @@ static inline int set_uint_info(const sm_instance_t *smi, attr_set_t *pattrs,
     return rc;
 }
 
-/** Helper to run a configurable action. */
+/**
+ * Helper to run a configurable action.
+ * @param out  if not NULL, gets the output of a command, or the output
+ *             reported by a function action.
+ */
 int action_helper(const policy_action_t *action, const char *name,
                   const entry_id_t *p_id, attr_set_t *p_attrs,
                   const action_params_t *params, struct sm_instance *smi,
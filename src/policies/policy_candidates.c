@@ -0,0 +1,318 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Each indexed policy has a hash of the entries in its scope, with the value
+ * of their sort attribute.
+ * Entries are added or removed as the entry processor and policy actions
+ * update them. Entry processor threads only take the lock of an index to
+ * modify it: scopes are matched out of the lock.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "policy_candidates.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define CAND_TAG "CandidateIndex"
+
+struct cand_index {
+    pthread_mutex_t      lock;
+    /** entry_id_t -> struct candidate */
+    GHashTable          *entries;
+    policy_descr_t      *descr;
+    policy_run_config_t *config;
+    /** the DB was loaded to the index */
+    bool                 loaded;
+    /** too many entries: the index was dropped */
+    bool                 dropped;
+};
+
+/* one per policy (NULL if the policy is not indexed) */
+static struct cand_index **cand_indexes = NULL;
+static unsigned int        cand_count = 0;
+static attr_mask_t         cand_mask = { 0 };
+
+static guint cand_id_hash(gconstpointer key)
+{
+    const entry_id_t *id = key;
+
+#ifdef FID_PK
+    return (guint)(id->f_seq ^ id->f_oid);
+#else
+    return (guint)(id->fs_key ^ id->inode);
+#endif
+}
+
+static gboolean cand_id_equal(gconstpointer a, gconstpointer b)
+{
+    return entry_id_equal((const entry_id_t *)a, (const entry_id_t *)b);
+}
+
+int candidates_init(unsigned int pol_idx)
+{
+    struct cand_index *idx;
+    attr_mask_t mask;
+
+    if (pol_idx >= policies.policy_count || pol_idx >= run_cfgs.count)
+        return EINVAL;
+
+    if (!run_cfgs.configs[pol_idx].candidate_index)
+        return 0;
+
+    if (policies.policy_list[pol_idx].manage_deleted) {
+        DisplayLog(LVL_MAJOR, CAND_TAG, "Policy %s applies to removed "
+                   "entries: candidate_index is ignored",
+                   policies.policy_list[pol_idx].name);
+        return 0;
+    }
+
+    if (cand_indexes == NULL) {
+        cand_indexes = MemCalloc(policies.policy_count,
+                                 sizeof(*cand_indexes));
+        if (cand_indexes == NULL)
+            return ENOMEM;
+    }
+    if (cand_indexes[pol_idx] != NULL)
+        return 0;
+
+    idx = MemCalloc(1, sizeof(*idx));
+    if (idx == NULL)
+        return ENOMEM;
+
+    pthread_mutex_init(&idx->lock, NULL);
+    idx->entries = g_hash_table_new_full(cand_id_hash, cand_id_equal,
+                                         NULL, g_free);
+    idx->descr = &policies.policy_list[pol_idx];
+    idx->config = &run_cfgs.configs[pol_idx];
+
+    /* attributes that can change the scope, status or sort order */
+    cand_mask = attr_mask_or(&cand_mask, &idx->descr->scope_mask);
+    mask = smi_needed_attrs(idx->descr->status_mgr, false);
+    cand_mask = attr_mask_or(&cand_mask, &mask);
+    if (idx->config->lru_sort_attr != LRU_ATTR_NONE)
+        attr_mask_set_index(&cand_mask, idx->config->lru_sort_attr);
+
+    cand_indexes[pol_idx] = idx;
+    cand_count++;
+
+    DisplayLog(LVL_VERB, CAND_TAG, "Candidate index enabled for policy %s",
+               idx->descr->name);
+    return 0;
+}
+
+static inline struct cand_index *get_index(unsigned int pol_idx)
+{
+    if (cand_indexes == NULL || pol_idx >= policies.policy_count)
+        return NULL;
+    return cand_indexes[pol_idx];
+}
+
+bool candidates_enabled(unsigned int pol_idx)
+{
+    return get_index(pol_idx) != NULL;
+}
+
+bool candidates_any(void)
+{
+    return cand_count > 0;
+}
+
+attr_mask_t candidates_attr_mask(void)
+{
+    return cand_mask;
+}
+
+/** release all entries of an index, that grew too large */
+static void index_drop(struct cand_index *idx)
+{
+    DisplayLog(LVL_MAJOR, CAND_TAG, "More than %u candidates for policy %s: "
+               "dropping its candidate index (candidate_index_max)",
+               idx->config->candidate_index_max, idx->descr->name);
+    g_hash_table_remove_all(idx->entries);
+    idx->dropped = true;
+}
+
+/** insert or update an entry. Must be called with the index locked. */
+static int index_set(struct cand_index *idx, const entry_id_t *id,
+                     int sort_key, bool update)
+{
+    struct candidate *c;
+
+    if (idx->dropped)
+        return 0;
+
+    c = g_hash_table_lookup(idx->entries, id);
+    if (c != NULL) {
+        if (update)
+            c->sort_key = sort_key;
+        return 0;
+    }
+
+    if (g_hash_table_size(idx->entries) >= idx->config->candidate_index_max) {
+        index_drop(idx);
+        return 0;
+    }
+
+    c = g_new(struct candidate, 1);
+    c->id = *id;
+    c->sort_key = sort_key;
+    g_hash_table_insert(idx->entries, &c->id, c);
+    return 0;
+}
+
+void candidates_update(const entry_id_t *id, const attr_set_t *attrs)
+{
+    unsigned int i;
+
+    if (cand_count == 0)
+        return;
+
+    for (i = 0; i < policies.policy_count; i++) {
+        struct cand_index *idx = cand_indexes[i];
+
+        if (idx == NULL)
+            continue;
+
+        switch (match_scope(idx->descr, id, attrs, false)) {
+        case POLICY_MATCH:
+            P(idx->lock);
+            index_set(idx, id, attr_sort_key(idx->config->lru_sort_attr,
+                                             attrs), true);
+            V(idx->lock);
+            break;
+
+        case POLICY_NO_MATCH:
+            P(idx->lock);
+            g_hash_table_remove(idx->entries, id);
+            V(idx->lock);
+            break;
+
+        default:
+            /* unknown: keep the entry as is,
+             * policy runs will check it */
+            break;
+        }
+    }
+}
+
+void candidates_drop(unsigned int pol_idx, const entry_id_t *id)
+{
+    struct cand_index *idx = get_index(pol_idx);
+
+    if (idx == NULL)
+        return;
+
+    P(idx->lock);
+    g_hash_table_remove(idx->entries, id);
+    V(idx->lock);
+}
+
+void candidates_remove(const entry_id_t *id)
+{
+    unsigned int i;
+
+    if (cand_count == 0)
+        return;
+
+    for (i = 0; i < policies.policy_count; i++)
+        candidates_drop(i, id);
+}
+
+int candidates_load(unsigned int pol_idx, const entry_id_t *id, int sort_key)
+{
+    struct cand_index *idx = get_index(pol_idx);
+    int rc;
+
+    if (idx == NULL)
+        return ENOENT;
+
+    P(idx->lock);
+    rc = index_set(idx, id, sort_key, false);
+    V(idx->lock);
+    return rc;
+}
+
+void candidates_load_done(unsigned int pol_idx)
+{
+    struct cand_index *idx = get_index(pol_idx);
+
+    if (idx == NULL)
+        return;
+
+    P(idx->lock);
+    idx->loaded = true;
+    DisplayLog(LVL_EVENT, CAND_TAG, "Candidate index of policy %s loaded: "
+               "%u entries", idx->descr->name,
+               g_hash_table_size(idx->entries));
+    V(idx->lock);
+}
+
+/* entries with no sort attribute come first, as with ORDER BY */
+static int cand_cmp(const void *a, const void *b)
+{
+    const struct candidate *ca = a;
+    const struct candidate *cb = b;
+
+    if (ca->sort_key < cb->sort_key)
+        return -1;
+    return (ca->sort_key > cb->sort_key) ? 1 : 0;
+}
+
+int candidates_get(unsigned int pol_idx, struct candidate **list,
+                   unsigned int *count)
+{
+    struct cand_index *idx = get_index(pol_idx);
+    GHashTableIter iter;
+    gpointer value;
+    unsigned int i = 0;
+
+    *list = NULL;
+    *count = 0;
+
+    if (idx == NULL)
+        return ENODATA;
+
+    P(idx->lock);
+    if (!idx->loaded || idx->dropped) {
+        V(idx->lock);
+        return ENODATA;
+    }
+
+    *count = g_hash_table_size(idx->entries);
+    if (*count > 0) {
+        *list = MemAlloc(*count * sizeof(**list));
+        if (*list == NULL) {
+            V(idx->lock);
+            *count = 0;
+            return ENOMEM;
+        }
+    }
+
+    g_hash_table_iter_init(&iter, idx->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        (*list)[i++] = *(struct candidate *)value;
+    V(idx->lock);
+
+    if (*count > 1)
+        qsort(*list, *count, sizeof(**list), cand_cmp);
+    return 0;
+}
@@ -20,6 +20,7 @@
 #endif
 
 #include "policy_rules.h"
+#include "policy_patterns.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
 #include "rbh_modules.h"
@@ -27,6 +28,7 @@
 #include "status_manager.h"
 #include <errno.h>
 #include <fnmatch.h>
+#include <time.h>
 
 #define FILESETS_SECTION      "Filesets"
 #define FILESET_BLOCK         "FileClass"
@@ -131,6 +133,7 @@ static void free_whitelist(whitelist_item_t *p_items, unsigned int count)
 
     /* free boolean expressions */
     for (i = 0; i < count; i++) {
+        free_bool_prog(p_items[i].prog);
         FreeBoolExpr(&p_items[i].bool_expr, false);
     }
 
@@ -195,6 +198,55 @@ int parse_policy_action(const char *name, const char *value,
             }
             *mask = attr_mask_or(mask, &m);
         }
+    } else if (!strcasecmp(value, "coproc")) {
+        attr_mask_t m;
+        bool error = false;
+        GError *err_desc = NULL;
+        char **cmd;
+        int i;
+
+        /* co-process helper: helper command line and request template */
+        if (extra_cnt != 2) {
+            sprintf(msg_out,
+                    "2 arguments are expected for coproc. E.g.: %s = "
+                    "coproc(\"myhelper.sh\", \"{fid} {fullpath}\");", name);
+            return EINVAL;
+        }
+        if (!g_shell_parse_argv(extra[0], NULL, &cmd, &err_desc)) {
+            sprintf(msg_out, "Could not parse command %s: %s\n",
+                    extra[0], err_desc->message);
+            g_error_free(err_desc);
+            return EINVAL;
+        }
+
+        /* the helper is shared by all entries */
+        for (i = 0; cmd[i]; i++) {
+            m = params_mask(cmd[i], name, &error);
+            if (error || !attr_mask_is_null(m)) {
+                sprintf(msg_out, "Unexpected parameters in %s coproc command: "
+                        "entry attributes can only be used in the request",
+                        name);
+                g_strfreev(cmd);
+                return EINVAL;
+            }
+        }
+
+        m = params_mask(extra[1], name, &error);
+        if (error) {
+            sprintf(msg_out, "Unexpected parameters in %s coproc request",
+                    name);
+            g_strfreev(cmd);
+            return EINVAL;
+        }
+        *mask = attr_mask_or(mask, &m);
+
+        action->type = ACTION_COPROC;
+        action->action_u.coproc.coproc = coproc_get(cmd);
+        g_strfreev(cmd);
+        action->action_u.coproc.request = strdup(extra[1]);
+        if (action->action_u.coproc.coproc == NULL
+            || action->action_u.coproc.request == NULL)
+            return ENOMEM;
     } else {    /* <module>.<action_name> expected */
 
         if (extra_cnt != 0) {
@@ -1143,6 +1195,8 @@ static inline bool match_policy_action_params(const char *s)
 static void free_fileclass(fileset_item_t *fset)
 {
     /* free fileset definition */
+    free_bool_prog(fset->prog);
+    fset->prog = NULL;
     FreeBoolExpr(&fset->definition, false);
 
     /* free action params */
@@ -1766,6 +1820,10 @@ static void free_policy_action(policy_action_t *action)
     case ACTION_COMMAND:
         g_strfreev(action->action_u.command);
         break;
+    case ACTION_COPROC:
+        /* helpers are shared and kept running */
+        free(action->action_u.coproc.request);
+        break;
     }
 }
 
@@ -1775,6 +1833,7 @@ static void free_rules_list(rule_item_t *items, int count)
 
     for (i = 0; i < count; i++) {
         free(items[i].target_list);
+        free_bool_prog(items[i].prog);
         FreeBoolExpr(&items[i].condition, false);
         free_policy_action(&items[i].action);
         rbh_params_free(&items[i].action_params);
@@ -2073,6 +2132,7 @@ static int set_policies(void *cfg, bool reload)
         return reload_policies(p_policies);
     else {
         policies = *p_policies;
+        policies.load_time = time(NULL);
 
         /* update status manager masks, once they are all loaded */
         smi_update_masks();
@@ -2087,6 +2147,69 @@ static void set_default_policies(void *module_config)
     *pol = policy_initializer;
 }
 
+/** Check if an expression only depends on the values of its attributes,
+ * so its result can be kept as long as they don't change. */
+static bool expr_is_stable(const bool_node_t *node)
+{
+    switch (node->node_type) {
+    case NODE_UNARY_EXPR:
+        return expr_is_stable(node->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        return expr_is_stable(node->content_u.bool_expr.expr1)
+            && expr_is_stable(node->content_u.bool_expr.expr2);
+    case NODE_CONSTANT:
+        return true;
+    case NODE_CONDITION:
+        switch (node->content_u.condition->crit) {
+        /* relative to current time */
+        case CRITERIA_LAST_ACCESS:
+        case CRITERIA_LAST_MOD:
+        case CRITERIA_CREATION:
+        case CRITERIA_LAST_MDCHANGE:
+        case CRITERIA_RMTIME:
+        /* not read from the attribute set */
+        case CRITERIA_XATTR:
+        /* may be durations or depend on a status manager */
+        case CRITERIA_SM_INFO:
+        case CRITERIA_STATUS:
+        case CRITERIA_FILECLASS:
+            return false;
+        default:
+            return true;
+        }
+    }
+    return false;
+}
+
+/** compile the boolean expressions of filesets and policy rules */
+static void compile_policies(policies_t *pol)
+{
+    int i, j;
+
+    /* without a matcher, path conditions are compiled as generic ones */
+    pol->path_matcher = path_matcher_new();
+
+    for (i = 0; i < pol->fileset_count; i++) {
+        fileset_item_t *fset = &pol->fileset_list[i];
+
+        fset->prog = compile_bool_expr(&fset->definition, pol->path_matcher);
+        fset->stable = expr_is_stable(&fset->definition);
+    }
+
+    for (i = 0; i < pol->policy_count; i++) {
+        policy_rules_t *rules = &pol->policy_list[i].rules;
+
+        for (j = 0; j < rules->whitelist_count; j++)
+            rules->whitelist_rules[j].prog =
+                compile_bool_expr(&rules->whitelist_rules[j].bool_expr,
+                                  pol->path_matcher);
+
+        for (j = 0; j < rules->rule_count; j++)
+            rules->rules[j].prog = compile_bool_expr(&rules->rules[j].condition,
+                                                     pol->path_matcher);
+    }
+}
+
 static int read_policies(config_file_t config, void *cfg, char *msg_out)
 {
     policies_t *pol = (policies_t *) cfg;
@@ -2117,6 +2240,7 @@ static int read_policies(config_file_t config, void *cfg, char *msg_out)
             return rc;
     }
 
+    compile_policies(pol);
     return 0;
 }
 
@@ -2187,6 +2311,7 @@ static void policies_cfg_free(void *arg)
     cfg->policy_count = 0;
 
     free_filesets(cfg);
+    path_matcher_free(cfg->path_matcher);
     free(cfg);
 }
 
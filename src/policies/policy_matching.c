@@ -19,6 +19,7 @@
 #endif
 
 #include "policy_rules.h"
+#include "policy_patterns.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
 #include "rbh_cfg.h"
@@ -26,8 +27,11 @@
 #include "xplatform_print.h"
 #include "rbh_boolexpr.h"
 #include "status_manager.h"
+#include "update_params.h"
+#include "rbh_intern.h"
 
 #include <string.h>
+#include <stdint.h>
 #include <libgen.h>
 #include <fnmatch.h>
 #include <sys/types.h>
@@ -275,9 +279,24 @@ static inline time_t time_modify(time_t orig, const time_modifier_t *p_pol_mod)
  * compare a value according to the attr type described in sm_info_def_t.
  * @return a POLICY_* value
  */
+/* time reference of the evaluations of the current thread
+ * (0: read the clock at each evaluation) */
+static __thread time_t eval_time = 0;
+
+void policy_eval_set_time(time_t now)
+{
+    eval_time = now;
+}
+
+static inline time_t eval_now(void)
+{
+    return eval_time != 0 ? eval_time : coarse_time();
+}
+
 static int compare_generic(const sm_info_def_t *def,
                            const compare_triplet_t *p_triplet,
-                           void *val, const time_modifier_t *p_pol_mod)
+                           void *val, const time_modifier_t *p_pol_mod,
+                           time_t now)
 {
     int rc;
 
@@ -331,7 +350,7 @@ static int compare_generic(const sm_info_def_t *def,
 
             /* compare with time enlapsed since date.
              * take time modifiers into account */
-            rc = int_compare(time(NULL) - *((int *)val), p_triplet->op,
+            rc = int_compare(now - *((int *)val), p_triplet->op,
                              time_modify(p_triplet->val.duration, p_pol_mod));
         } else if (def->crit_type == PT_INT) {
             if (val == NULL)
@@ -818,7 +837,8 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
                                      const attr_set_t *p_entry_attr,
                                      const compare_triplet_t *p_triplet,
                                      const time_modifier_t *p_pol_mod,
-                                     const sm_instance_t *smi, int no_warning)
+                                     const sm_instance_t *smi, int no_warning,
+                                     time_t now)
 {
     char tmpbuff[RBH_PATH_MAX];
     char *rep;
@@ -962,7 +982,7 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
         /* last_access is required */
         CHECK_ATTR(p_entry_attr, last_access, no_warning);
 
-        rc = int_compare(time(NULL) - ATTR(p_entry_attr, last_access),
+        rc = int_compare(now - ATTR(p_entry_attr, last_access),
                          p_triplet->op, time_modify(p_triplet->val.duration,
                                                     p_pol_mod));
         return bool2policy_match(rc);
@@ -971,7 +991,7 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
         /* last_mod required */
         CHECK_ATTR(p_entry_attr, last_mod, no_warning);
 
-        rc = int_compare(time(NULL) - ATTR(p_entry_attr, last_mod),
+        rc = int_compare(now - ATTR(p_entry_attr, last_mod),
                          p_triplet->op, time_modify(p_triplet->val.duration,
                                                     p_pol_mod));
         return bool2policy_match(rc);
@@ -980,7 +1000,7 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
         /* creation_time is required */
         CHECK_ATTR(p_entry_attr, creation_time, no_warning);
 
-        rc = int_compare(time(NULL) - ATTR(p_entry_attr, creation_time),
+        rc = int_compare(now - ATTR(p_entry_attr, creation_time),
                          p_triplet->op, time_modify(p_triplet->val.duration,
                                                     p_pol_mod));
         return bool2policy_match(rc);
@@ -991,7 +1011,7 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
         /* last_mdchange (ctime) is required */
         CHECK_ATTR(p_entry_attr, last_mdchange, no_warning);
 
-        rc = int_compare(time(NULL) - ATTR(p_entry_attr, last_mdchange),
+        rc = int_compare(now - ATTR(p_entry_attr, last_mdchange),
                          p_triplet->op, time_modify(p_triplet->val.duration,
                                                     p_pol_mod));
         return bool2policy_match(rc);
@@ -1008,7 +1028,7 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
         /* rm_time is required */
         CHECK_ATTR(p_entry_attr, rm_time, no_warning);
 
-        rc = int_compare(time(NULL) - ATTR(p_entry_attr, rm_time),
+        rc = int_compare(now - ATTR(p_entry_attr, rm_time),
                          p_triplet->op, time_modify(p_triplet->val.duration,
                                                     p_pol_mod));
         return bool2policy_match(rc);
@@ -1101,7 +1121,11 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
             if (!ATTR_MASK_STATUS_TEST(p_entry_attr, smi->smi_index))
                 /* compare with empty string */
                 rc = EMPTY_STRING(p_triplet->val.str);
+            else if (p_triplet->status != NULL)
+                rc = status_eq(p_triplet->status,
+                               STATUS_ATTR(p_entry_attr, smi->smi_index));
             else
+                /* condition not built from config (e.g. command line) */
                 rc = !strcmp(p_triplet->val.str,
                              STATUS_ATTR(p_entry_attr, smi->smi_index));
 
@@ -1123,7 +1147,7 @@ static policy_match_t eval_condition(const entry_id_t *p_entry_id,
             if (rc < 0)
                 val = NULL;
 
-            rc = compare_generic(def, p_triplet, val, p_pol_mod);
+            rc = compare_generic(def, p_triplet, val, p_pol_mod, now);
 
             /* if the retrieved value was NULL and the return is
              * 'missing attr' */
@@ -1223,7 +1247,7 @@ static policy_match_t _entry_matches(const entry_id_t *p_entry_id,
                                      const bool_node_t *p_node,
                                      const time_modifier_t *p_pol_mod,
                                      const sm_instance_t *smi,
-                                     int no_warning)
+                                     int no_warning, time_t now)
 {
     policy_match_t rc;
 
@@ -1239,7 +1263,7 @@ static policy_match_t _entry_matches(const entry_id_t *p_entry_id,
 
         rc = _entry_matches(p_entry_id, p_entry_attr,
                             p_node->content_u.bool_expr.expr1, p_pol_mod,
-                            smi, no_warning);
+                            smi, no_warning, now);
 
         return negate_match(rc);
 
@@ -1247,7 +1271,7 @@ static policy_match_t _entry_matches(const entry_id_t *p_entry_id,
         /* always test the first expression */
         rc = _entry_matches(p_entry_id, p_entry_attr,
                             p_node->content_u.bool_expr.expr1, p_pol_mod,
-                            smi, no_warning);
+                            smi, no_warning, now);
 
         /* in some cases, we can stop here */
         if ((p_node->content_u.bool_expr.bool_op == BOOL_OR)
@@ -1262,7 +1286,7 @@ static policy_match_t _entry_matches(const entry_id_t *p_entry_id,
         /* compute the second expression */
         return _entry_matches(p_entry_id, p_entry_attr,
                               p_node->content_u.bool_expr.expr2,
-                              p_pol_mod, smi, no_warning);
+                              p_pol_mod, smi, no_warning, now);
 
         break;
 
@@ -1270,7 +1294,7 @@ static policy_match_t _entry_matches(const entry_id_t *p_entry_id,
         /* It's now time to test the value ! */
         return eval_condition(p_entry_id, p_entry_attr,
                               p_node->content_u.condition, p_pol_mod, smi,
-                              no_warning);
+                              no_warning, now);
         break;
 
     case NODE_CONSTANT:
@@ -1288,14 +1312,390 @@ policy_match_t entry_matches(const entry_id_t *p_entry_id,
                              const sm_instance_t *smi)
 {
     return _entry_matches(p_entry_id, p_entry_attr, p_node, p_pol_mod, smi,
-                          false);
+                          false, eval_now());
+}
+
+/**
+ * Compiled boolean expressions.
+ *
+ * A program is the flat array of the nodes of an expression in
+ * evaluation order. Each instruction sets the current result, or jumps
+ * over the second operand of a AND (resp. OR) if the first one did not
+ * match (resp. did match), which preserves the short-circuits of the
+ * tree walk. Common criteria are evaluated inline, from their attribute
+ * offset in the attribute set, other ones call eval_condition().
+ * Path and tree conditions are evaluated by the path matcher of policies,
+ * which selects all the patterns that may match a path at once.
+ */
+typedef enum {
+    BOP_CONST,          /**< result is a constant */
+    BOP_COND,           /**< generic condition (eval_condition) */
+    BOP_AGE,            /**< compare duration since a time attribute */
+    BOP_UINT,           /**< compare an unsigned int attribute */
+    BOP_SIZE,           /**< compare a 64 bits attribute */
+    BOP_TYPE,           /**< compare entry type */
+    BOP_PATH,           /**< path or tree pattern (path matcher) */
+    BOP_NAME,           /**< owner or group name pattern */
+    BOP_NOT,            /**< negate the result */
+    BOP_AND,            /**< jump if result is not MATCH */
+    BOP_OR,             /**< jump if result is not NO_MATCH */
+} bool_opcode_e;
+
+struct bool_insn {
+    bool_opcode_e            opcode;
+    /** condition to be evaluated (all opcodes, except CONST, NOT, AND, OR) */
+    const compare_triplet_t *cond;
+    /** index and offset of the compared attribute */
+    unsigned int             attr_index;
+    off_t                    attr_offset;
+    union {
+        bool                 constant;
+        unsigned int         jump;      /**< AND, OR: next instruction */
+        const char          *type;      /**< TYPE: type in DB format */
+        unsigned int         pattern;   /**< PATH: pattern index */
+        volatile uintptr_t  *memo;      /**< NAME: results by name */
+    } arg;
+};
+
+/**
+ * Owner and group names have a low cardinality: the result of name patterns
+ * is memoized by interned name. Each slot stores the interned name pointer
+ * (8 bytes aligned), with the result in its low bit.
+ */
+#define NAME_MEMO_SLOTS 64
+
+struct bool_prog {
+    unsigned int     count;
+    struct bool_insn insn[0];
+};
+
+static int bool_node_count(const bool_node_t *node)
+{
+    int n1, n2;
+
+    switch (node->node_type) {
+    case NODE_UNARY_EXPR:
+        /* BOOL_NOT is the only supported unary operator */
+        if (node->content_u.bool_expr.bool_op != BOOL_NOT)
+            return -1;
+        n1 = bool_node_count(node->content_u.bool_expr.expr1);
+        return n1 < 0 ? -1 : n1 + 1;
+
+    case NODE_BINARY_EXPR:
+        if (node->content_u.bool_expr.bool_op != BOOL_AND
+            && node->content_u.bool_expr.bool_op != BOOL_OR)
+            return -1;
+        n1 = bool_node_count(node->content_u.bool_expr.expr1);
+        n2 = bool_node_count(node->content_u.bool_expr.expr2);
+        return (n1 < 0 || n2 < 0) ? -1 : n1 + n2 + 1;
+
+    case NODE_CONDITION:
+    case NODE_CONSTANT:
+        return 1;
+    }
+    return -1;
+}
+
+/** resolve the attribute compared by common criteria */
+static void compile_condition(const compare_triplet_t *cond,
+                              struct bool_insn *insn, path_matcher_t *matcher)
+{
+    int idx;
+
+    insn->opcode = BOP_COND;
+    insn->cond = cond;
+
+    switch (cond->crit) {
+    case CRITERIA_PATH:
+    case CRITERIA_TREE:
+        if (matcher == NULL)
+            return;
+        idx = path_matcher_add(matcher, cond->val.str,
+                               cond->crit == CRITERIA_TREE ? PATTERN_TREE
+                                                           : PATTERN_PATH,
+                               !!(cond->flags & CMP_FLG_ANY_LEVEL),
+                               !!(cond->flags & CMP_FLG_INSENSITIVE));
+        if (idx < 0)
+            return;
+        insn->opcode = BOP_PATH;
+        insn->arg.pattern = idx;
+        insn->attr_index = ATTR_INDEX_fullpath;
+        break;
+    case CRITERIA_SIZE:
+        insn->opcode = BOP_SIZE;
+        insn->attr_index = ATTR_INDEX_size;
+        break;
+    case CRITERIA_DEPTH:
+        insn->opcode = BOP_UINT;
+        insn->attr_index = ATTR_INDEX_depth;
+        break;
+    case CRITERIA_LAST_ACCESS:
+        insn->opcode = BOP_AGE;
+        insn->attr_index = ATTR_INDEX_last_access;
+        break;
+    case CRITERIA_LAST_MOD:
+        insn->opcode = BOP_AGE;
+        insn->attr_index = ATTR_INDEX_last_mod;
+        break;
+    case CRITERIA_CREATION:
+        insn->opcode = BOP_AGE;
+        insn->attr_index = ATTR_INDEX_creation_time;
+        break;
+    case CRITERIA_LAST_MDCHANGE:
+        insn->opcode = BOP_AGE;
+        insn->attr_index = ATTR_INDEX_last_mdchange;
+        break;
+    case CRITERIA_OWNER:
+    case CRITERIA_GROUP:
+        if (global_config.uid_gid_as_numbers)
+            return;
+        insn->arg.memo = calloc(NAME_MEMO_SLOTS, sizeof(uintptr_t));
+        if (insn->arg.memo == NULL)
+            return;
+        insn->opcode = BOP_NAME;
+        insn->attr_index = (cond->crit == CRITERIA_OWNER) ? ATTR_INDEX_uid
+                                                          : ATTR_INDEX_gid;
+        break;
+    case CRITERIA_TYPE:
+        insn->arg.type = type2db(cond->val.type);
+        /* invalid types are reported by eval_condition */
+        if (insn->arg.type == NULL)
+            return;
+        insn->opcode = BOP_TYPE;
+        insn->attr_index = ATTR_INDEX_type;
+        break;
+    default:
+        return;
+    }
+    insn->attr_offset = field_infos[insn->attr_index].offset;
+}
+
+/** append the instructions of a node to the program */
+static void compile_node(const bool_node_t *node, struct bool_prog *prog,
+                         path_matcher_t *matcher)
+{
+    struct bool_insn *insn;
+    unsigned int jump;
+
+    switch (node->node_type) {
+    case NODE_UNARY_EXPR:
+        compile_node(node->content_u.bool_expr.expr1, prog, matcher);
+        prog->insn[prog->count++].opcode = BOP_NOT;
+        break;
+
+    case NODE_BINARY_EXPR:
+        compile_node(node->content_u.bool_expr.expr1, prog, matcher);
+        jump = prog->count++;
+        prog->insn[jump].opcode =
+            (node->content_u.bool_expr.bool_op == BOOL_AND) ? BOP_AND : BOP_OR;
+        compile_node(node->content_u.bool_expr.expr2, prog, matcher);
+        prog->insn[jump].arg.jump = prog->count;
+        break;
+
+    case NODE_CONDITION:
+        compile_condition(node->content_u.condition,
+                          &prog->insn[prog->count++], matcher);
+        break;
+
+    case NODE_CONSTANT:
+        insn = &prog->insn[prog->count++];
+        insn->opcode = BOP_CONST;
+        insn->arg.constant = node->content_u.constant;
+        break;
+    }
+}
+
+bool_prog_t *compile_bool_expr(const bool_node_t *expr,
+                               path_matcher_t *matcher)
+{
+    struct bool_prog *prog;
+    int count;
+
+    count = bool_node_count(expr);
+    if (count <= 0)
+        return NULL;
+
+    prog = calloc(1, sizeof(*prog) + count * sizeof(struct bool_insn));
+    if (prog == NULL)
+        return NULL;
+
+    compile_node(expr, prog, matcher);
+    return prog;
+}
+
+void free_bool_prog(bool_prog_t *prog)
+{
+    unsigned int i;
+
+    if (prog == NULL)
+        return;
+
+    for (i = 0; i < prog->count; i++)
+        if (prog->insn[i].opcode == BOP_NAME)
+            free((void *)prog->insn[i].arg.memo);
+    free(prog);
+}
+
+#define ATTR_PTR(_p_set, _insn) \
+        ((const char *)&(_p_set)->attr_values + (_insn)->attr_offset)
+
+/** match an owner or group name, memoized by interned name */
+static bool name_match(const struct bool_insn *insn, const char *name)
+{
+    const char *iname = str_intern(name);
+    volatile uintptr_t *slot;
+    uintptr_t val;
+    bool match;
+
+    if (iname == NULL)
+        return TestRegexp(insn->cond->val.str, name,
+                          cmpflg2regexpflg(insn->cond->flags));
+
+    slot = &insn->arg.memo[((uintptr_t)iname >> 3) & (NAME_MEMO_SLOTS - 1)];
+    val = *slot;
+    if ((val & ~(uintptr_t)1) == (uintptr_t)iname)
+        return val & 1;
+
+    match = TestRegexp(insn->cond->val.str, iname,
+                       cmpflg2regexpflg(insn->cond->flags));
+    /* concurrent evaluations may overwrite the slot: a word store
+     * is atomic, and any stored value is valid */
+    *slot = (uintptr_t)iname | match;
+    return match;
+}
+
+static policy_match_t run_bool_prog(const bool_prog_t *prog,
+                                    const entry_id_t *p_entry_id,
+                                    const attr_set_t *p_entry_attr,
+                                    const time_modifier_t *p_pol_mod,
+                                    const sm_instance_t *smi,
+                                    int no_warning, time_t now,
+                                    struct path_match_state *pst)
+{
+    policy_match_t rc = POLICY_ERR;
+    unsigned int pc = 0;
+    bool equal;
+    int match;
+
+    if (!p_entry_id || !p_entry_attr)
+        return POLICY_ERR;
+
+    while (pc < prog->count) {
+        const struct bool_insn *insn = &prog->insn[pc++];
+
+        switch (insn->opcode) {
+        case BOP_CONST:
+            rc = bool2policy_match(insn->arg.constant);
+            continue;
+        case BOP_COND:
+            rc = eval_condition(p_entry_id, p_entry_attr, insn->cond,
+                                p_pol_mod, smi, no_warning, now);
+            continue;
+        case BOP_PATH:
+            if (pst == NULL) {
+                rc = eval_condition(p_entry_id, p_entry_attr, insn->cond,
+                                    p_pol_mod, smi, no_warning, now);
+                continue;
+            }
+            break;
+        case BOP_NOT:
+            rc = negate_match(rc);
+            continue;
+        case BOP_AND:
+            if (rc != POLICY_MATCH)
+                pc = insn->arg.jump;
+            continue;
+        case BOP_OR:
+            if (rc != POLICY_NO_MATCH)
+                pc = insn->arg.jump;
+            continue;
+        default:
+            break;
+        }
+
+        /* inline criteria */
+        if (!attr_mask_test_index(&p_entry_attr->attr_mask,
+                                  insn->attr_index)) {
+            if (!no_warning)
+                DisplayLog(LVL_MAJOR, POLICY_TAG, "Missing attribute '%s' for "
+                           "evaluating boolean expression on " DFID,
+                           field_infos[insn->attr_index].field_name,
+                           PFID(p_entry_id));
+            rc = POLICY_MISSING_ATTR;
+            continue;
+        }
+
+        switch (insn->opcode) {
+        case BOP_AGE:
+            rc = bool2policy_match(int_compare(now -
+                        *(const unsigned int *)ATTR_PTR(p_entry_attr, insn),
+                        insn->cond->op,
+                        time_modify(insn->cond->val.duration, p_pol_mod)));
+            break;
+        case BOP_UINT:
+            rc = bool2policy_match(int_compare(
+                        *(const unsigned int *)ATTR_PTR(p_entry_attr, insn),
+                        insn->cond->op, insn->cond->val.integer));
+            break;
+        case BOP_SIZE:
+            rc = bool2policy_match(size_compare(
+                        *(const uint64_t *)ATTR_PTR(p_entry_attr, insn),
+                        insn->cond->op, insn->cond->val.size));
+            break;
+        case BOP_TYPE:
+            equal = !strcmp(ATTR_PTR(p_entry_attr, insn), insn->arg.type);
+            rc = bool2policy_match(insn->cond->op == COMP_EQUAL ? equal
+                                                                : !equal);
+            break;
+        case BOP_NAME:
+            match = name_match(insn, ((const uidgid_u *)
+                                      ATTR_PTR(p_entry_attr, insn))->txt);
+            if (insn->cond->op == COMP_EQUAL || insn->cond->op == COMP_LIKE)
+                rc = bool2policy_match(match);
+            else
+                rc = bool2policy_match(!match);
+            break;
+        case BOP_PATH:
+            match = path_match_test(pst, ATTR(p_entry_attr, fullpath),
+                                    insn->arg.pattern);
+            if (match < 0)
+                return POLICY_ERR;
+            if (insn->cond->op == COMP_EQUAL || insn->cond->op == COMP_LIKE)
+                rc = bool2policy_match(match);
+            else
+                rc = bool2policy_match(!match);
+            break;
+        default:
+            return POLICY_ERR;
+        }
+    }
+    return rc;
+}
+
+/** match an expression using its compiled program if it has one */
+static policy_match_t expr_matches(const entry_id_t *p_entry_id,
+                                   const attr_set_t *p_entry_attr,
+                                   const bool_node_t *p_node,
+                                   const bool_prog_t *prog,
+                                   const time_modifier_t *p_pol_mod,
+                                   const sm_instance_t *smi,
+                                   int no_warning, time_t now,
+                                   struct path_match_state *pst)
+{
+    if (prog != NULL)
+        return run_bool_prog(prog, p_entry_id, p_entry_attr, p_pol_mod, smi,
+                             no_warning, now, pst);
+
+    return _entry_matches(p_entry_id, p_entry_attr, p_node, p_pol_mod, smi,
+                          no_warning, now);
 }
 
 static policy_match_t _is_whitelisted(const policy_descr_t *policy,
                                       const entry_id_t *p_entry_id,
                                       const attr_set_t *p_entry_attr,
                                       fileset_item_t **fileset,
-                                      bool no_warning)
+                                      bool no_warning, time_t now,
+                                      struct path_match_state *pst)
 {
     unsigned int i, count;
     policy_match_t rc = POLICY_NO_MATCH;
@@ -1312,9 +1712,9 @@ static policy_match_t _is_whitelisted(const policy_descr_t *policy,
     count = policy->rules.whitelist_count;
 
     for (i = 0; i < count; i++) {
-        switch (_entry_matches
-                (p_entry_id, p_entry_attr, &list[i].bool_expr, NULL,
-                 policy->status_mgr, no_warning)) {
+        switch (expr_matches
+                (p_entry_id, p_entry_attr, &list[i].bool_expr, list[i].prog,
+                 NULL, policy->status_mgr, no_warning, now, pst)) {
         case POLICY_MATCH:
             /* TODO remember the entry is ignored for this policy? */
             return POLICY_MATCH;
@@ -1354,9 +1754,10 @@ static policy_match_t _is_whitelisted(const policy_descr_t *policy,
         printf("Checking if entry matches whitelisted fileset %s...\n",
                fs_list[i]->fileset_id);
 #endif
-        switch (_entry_matches
-                (p_entry_id, p_entry_attr, &fs_list[i]->definition, NULL,
-                 policy->status_mgr, no_warning)) {
+        switch (expr_matches
+                (p_entry_id, p_entry_attr, &fs_list[i]->definition,
+                 fs_list[i]->prog, NULL, policy->status_mgr, no_warning,
+                 now, pst)) {
         case POLICY_MATCH:
             {
 #ifdef _DEBUG_POLICIES
@@ -1405,7 +1806,14 @@ policy_match_t is_whitelisted(const policy_descr_t *policy,
                               const attr_set_t *p_entry_attr,
                               fileset_item_t **fileset)
 {
-    return _is_whitelisted(policy, p_entry_id, p_entry_attr, fileset, false);
+    struct path_match_state pst;
+    policy_match_t rc;
+
+    path_match_init(&pst, policies.path_matcher);
+    rc = _is_whitelisted(policy, p_entry_id, p_entry_attr, fileset, false,
+                         eval_now(), &pst);
+    path_match_fini(&pst);
+    return rc;
 }
 
 /** determine if a class is whitelisted for the given policy */
@@ -1425,8 +1833,66 @@ bool class_is_whitelisted(const policy_descr_t *policy, const char *class_id)
     return false;
 }
 
+/** check if a class name is in a fileclass list */
+static bool class_in_list(const char *class_list, const char *class_id)
+{
+    size_t len = strlen(class_id);
+    const char *curr = class_list;
+
+    while ((curr = strstr(curr, class_id)) != NULL) {
+        if ((curr == class_list || curr[-1] == LIST_SEP_CHAR)
+            && (curr[len] == '\0' || curr[len] == LIST_SEP_CHAR))
+            return true;
+        curr += len;
+    }
+    return false;
+}
+
+/**
+ * Get the result of a previous matching, if the fileset definition
+ * only reads attributes that did not change since then.
+ * @return POLICY_MATCH or POLICY_NO_MATCH, or POLICY_ERR if the fileset must
+ *         be matched again.
+ */
+static policy_match_t cached_class_match(const fileset_item_t *fset,
+                                         const attr_set_t *p_attrs_new,
+                                         const attr_set_t *p_attrs_cached)
+{
+    if (p_attrs_cached == NULL || !fset->stable
+        || !ATTR_MASK_TEST(p_attrs_cached, fileclass)
+        || !ATTR_MASK_TEST(p_attrs_cached, class_update)
+        || ATTR(p_attrs_cached, class_update) < policies.load_time)
+        return POLICY_ERR;
+
+    if (fileclass_attrs_changed(p_attrs_cached, p_attrs_new,
+                                &fset->attr_mask))
+        return POLICY_ERR;
+
+    return bool2policy_match(class_in_list(ATTR(p_attrs_cached, fileclass),
+                                           fset->fileset_id));
+}
+
+attr_mask_t match_classes_mask(const attr_set_t *p_attrs_new,
+                               const attr_set_t *p_attrs_cached)
+{
+    attr_mask_t mask = null_mask;
+    unsigned int i;
+
+    for (i = 0; i < policies.fileset_count; i++) {
+        fileset_item_t *fset = &policies.fileset_list[i];
+
+        if (fset->matchable
+            && cached_class_match(fset, p_attrs_new, p_attrs_cached)
+                == POLICY_ERR)
+            mask = attr_mask_or(&mask, &fset->attr_mask);
+    }
+    return mask;
+}
+
 /* Match classes according to p_attrs_cached+p_attrs_new,
  * set the result in p_attrs_new->fileclass.
+ * The previous result for a fileset is kept if none of the attributes
+ * of its definition changed.
  */
 int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
                   const attr_set_t *p_attrs_cached)
@@ -1434,6 +1900,9 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
     unsigned int i;
     int ok = 0;
     int left = sizeof(ATTR(p_attrs_new, fileclass));
+    time_t now = eval_now();
+    struct path_match_state pst;
+    policy_match_t rc;
 
     /* initialize output fileclass */
     char *pcur = ATTR(p_attrs_new, fileclass);
@@ -1446,6 +1915,9 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
     if (p_attrs_cached != NULL)
         ListMgr_MergeAttrSets(&attr_cp, p_attrs_cached, false);
 
+    /* all path conditions are matched against the same path */
+    path_match_init(&pst, policies.path_matcher);
+
     for (i = 0; i < policies.fileset_count; i++) {
         fileset_item_t *fset = &policies.fileset_list[i];
 
@@ -1454,8 +1926,15 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
             continue;
         }
 
-        switch (_entry_matches
-                (id, &attr_cp, &fset->definition, NULL, NULL, true)) {
+        rc = cached_class_match(fset, p_attrs_new, p_attrs_cached);
+        if (rc == POLICY_ERR)
+            rc = expr_matches(id, &attr_cp, &fset->definition, fset->prog,
+                              NULL, NULL, true, now, &pst);
+        else
+            DisplayLog(LVL_FULL, POLICY_TAG, DFID ": fileset '%s' unchanged "
+                       "since last match", PFID(id), fset->fileset_id);
+
+        switch (rc) {
         case POLICY_MATCH:
             ok++;
             if (EMPTY_STRING(ATTR(p_attrs_new, fileclass))) {
@@ -1487,11 +1966,13 @@ int match_classes(const entry_id_t *id, attr_set_t *p_attrs_new,
         }
     }
 
+    path_match_fini(&pst);
+
     /* no fileclass could be matched without an error */
     if (policies.fileset_count != 0 && ok == 0) {
         ATTR_MASK_UNSET(p_attrs_new, fileclass);
     } else {
-        ATTR(p_attrs_new, class_update) = time(NULL);
+        ATTR(p_attrs_new, class_update) = now;
         ATTR_MASK_SET(p_attrs_new, fileclass);
         ATTR_MASK_SET(p_attrs_new, class_update);
     }
@@ -1509,9 +1990,12 @@ rule_item_t *policy_case(const policy_descr_t *policy,
     int count, i, j;
     unsigned int default_index = ATTR_INDEX_FLG_UNSPEC;
     rule_item_t *pol_list;
+    time_t now = eval_now();
+    struct path_match_state pst;
 
     pol_list = policy->rules.rules;
     count = policy->rules.rule_count;
+    path_match_init(&pst, policies.path_matcher);
 
     /* for each policy (except default), check target filesets.
      *   - if a fileset matches, return the associated policy.
@@ -1539,9 +2023,11 @@ rule_item_t *policy_case(const policy_descr_t *policy,
                    pol_list[i].target_list[j]->fileset_id);
 #endif
 
-            switch (entry_matches(p_entry_id, p_entry_attr,
-                                  &pol_list[i].target_list[j]->definition,
-                                  NULL, policy->status_mgr)) {
+            switch (expr_matches(p_entry_id, p_entry_attr,
+                                 &pol_list[i].target_list[j]->definition,
+                                 pol_list[i].target_list[j]->prog,
+                                 NULL, policy->status_mgr, false, now,
+                                 &pst)) {
             case POLICY_MATCH:
                 DisplayLog(LVL_FULL, POLICY_TAG,
                            "Entry " F_ENT_ID
@@ -1551,6 +2037,7 @@ rule_item_t *policy_case(const policy_descr_t *policy,
                            pol_list[i].rule_id);
                 if (pp_fileset)
                     *pp_fileset = pol_list[i].target_list[j];
+                path_match_fini(&pst);
                 return &pol_list[i];
 
             case POLICY_NO_MATCH:
@@ -1576,6 +2063,8 @@ rule_item_t *policy_case(const policy_descr_t *policy,
         }
     }
 
+    path_match_fini(&pst);
+
     /* => entry matches no fileset in any policy */
     if (pp_fileset)
         *pp_fileset = NULL;
@@ -1646,25 +2135,24 @@ rule_item_t *class_policy_case(const policy_descr_t *policy,
     return NULL;
 }
 
-/**
- *  Check if an entry has a chance to be matched in any policy condition.
- */
-policy_match_t policy_match_all(const policy_descr_t *policy,
-                                const entry_id_t *p_entry_id,
-                                const attr_set_t *p_entry_attr,
-                                const time_modifier_t *time_mod,
-                                fileset_item_t **pp_fileset)
+static policy_match_t _policy_match_all(const policy_descr_t *policy,
+                                        const entry_id_t *p_entry_id,
+                                        const attr_set_t *p_entry_attr,
+                                        const time_modifier_t *time_mod,
+                                        fileset_item_t **pp_fileset,
+                                        struct path_match_state *pst)
 {
     bool could_not_match = false;
     int count, i, j;
     int default_index = -1;
     rule_item_t *pol_list;
+    time_t now = eval_now();
 
     /* if it MATCHES any whitelist condition, return NO_MATCH
      * else, it could potentially match a policy, so we must test them.
      */
     switch (_is_whitelisted(policy, p_entry_id, p_entry_attr, pp_fileset,
-            true)) {
+            true, now, pst)) {
     case POLICY_MATCH:
         return POLICY_NO_MATCH;
     case POLICY_MISSING_ATTR:
@@ -1715,9 +2203,11 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
                    pol_list[i].target_list[j]->fileset_id);
 #endif
 
-            switch (_entry_matches(p_entry_id, p_entry_attr,
-                                   &pol_list[i].target_list[j]->definition,
-                                   time_mod, policy->status_mgr, true)) {
+            switch (expr_matches(p_entry_id, p_entry_attr,
+                                 &pol_list[i].target_list[j]->definition,
+                                 pol_list[i].target_list[j]->prog,
+                                 time_mod, policy->status_mgr, true, now,
+                                 pst)) {
             case POLICY_MATCH:
                 DisplayLog(LVL_FULL, POLICY_TAG,
                            "Entry matches target file class '%s' of policy '%s'",
@@ -1778,9 +2268,10 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
          * - if we get NO_MATCH for the condition, this policy cannot be matched.
          * - if we get MISSING_ATTR for the condition, return MISSING_ATTR.
          */
-        switch (_entry_matches(p_entry_id, p_entry_attr,
-                               &pol_list[i].condition, time_mod,
-                               policy->status_mgr, true)) {
+        switch (expr_matches(p_entry_id, p_entry_attr,
+                             &pol_list[i].condition, pol_list[i].prog,
+                             time_mod, policy->status_mgr, true, now,
+                             pst)) {
         case POLICY_NO_MATCH:
             /* the entry cannot match this item */
             break;
@@ -1824,9 +2315,11 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
          * - if we get NO_MATCH for the condition, no policy is matched.
          * - if we get MISSING_ATTR for the condition, return MISSING_ATTR.
          */
-        switch (_entry_matches(p_entry_id, p_entry_attr,
-                               &pol_list[default_index].condition,
-                               time_mod, policy->status_mgr, true)) {
+        switch (expr_matches(p_entry_id, p_entry_attr,
+                             &pol_list[default_index].condition,
+                             pol_list[default_index].prog,
+                             time_mod, policy->status_mgr, true, now,
+                             pst)) {
         case POLICY_NO_MATCH:
             return POLICY_NO_MATCH;
             break;
@@ -1855,10 +2348,47 @@ policy_match_t policy_match_all(const policy_descr_t *policy,
     return POLICY_NO_MATCH;
 }
 
+/**
+ *  Check if an entry has a chance to be matched in any policy condition.
+ */
+policy_match_t policy_match_all(const policy_descr_t *policy,
+                                const entry_id_t *p_entry_id,
+                                const attr_set_t *p_entry_attr,
+                                const time_modifier_t *time_mod,
+                                fileset_item_t **pp_fileset)
+{
+    struct path_match_state pst;
+    policy_match_t rc;
+
+    path_match_init(&pst, policies.path_matcher);
+    rc = _policy_match_all(policy, p_entry_id, p_entry_attr, time_mod,
+                           pp_fileset, &pst);
+    path_match_fini(&pst);
+    return rc;
+}
+
+policy_match_t entry_matches_compiled(const entry_id_t *p_entry_id,
+                                      const attr_set_t *p_entry_attr,
+                                      const bool_node_t *p_node,
+                                      const bool_prog_t *prog,
+                                      const time_modifier_t *p_pol_mod,
+                                      const sm_instance_t *smi)
+{
+    struct path_match_state pst;
+    policy_match_t rc;
+
+    path_match_init(&pst, policies.path_matcher);
+    rc = expr_matches(p_entry_id, p_entry_attr, p_node, prog, p_pol_mod, smi,
+                      true, eval_now(), &pst);
+    path_match_fini(&pst);
+    return rc;
+}
+
 policy_match_t match_scope(const policy_descr_t *pol, const entry_id_t *id,
                            const attr_set_t *attrs, bool warn)
 {
-    return _entry_matches(id, attrs, &pol->scope, NULL, pol->status_mgr, !warn);
+    return _entry_matches(id, attrs, &pol->scope, NULL, pol->status_mgr, !warn,
+                          eval_now());
 }
 
 #define LOG_MATCH(_m, _id, _a, _p) do { \
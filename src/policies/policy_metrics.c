@@ -0,0 +1,382 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Metrics are updated by all policy threads with atomic increments.
+ * The stats dump reads them without locking (values may be slightly
+ * outdated) and computes rates since the previous dump.
+ * Per-rule metrics are indexed by the position of the rule in the policy
+ * rules at startup: rules added by a later reload are not accounted.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "policy_metrics.h"
+#include "run_policies.h"
+#include "rbh_hist.h"
+#include "rbh_logs.h"
+#include "rbh_metrics.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+
+#define tag(_p)             ((_p)->descr->name)
+
+static const char *phase_name[PHASE_COUNT] = {
+    [PHASE_LIST]   = "list",
+    [PHASE_MATCH]  = "match",
+    [PHASE_ACTION] = "action",
+    [PHASE_POST]   = "post",
+};
+
+struct rule_metrics {
+    unsigned long long  ok;
+    unsigned long long  errors;
+    unsigned long long  volume;
+    unsigned long long  hist[HIST_BUCKETS];
+};
+
+struct policy_metrics {
+    unsigned long long   phase_hist[PHASE_COUNT][HIST_BUCKETS];
+    unsigned long long   phase_usec[PHASE_COUNT];
+
+    struct rule_metrics *rules;
+    unsigned int         rule_count;
+
+    /* rates computed at last stats dump (per second) */
+    pthread_mutex_t      rate_lock;
+    struct timeval       rate_time;
+    unsigned long long   last_ok;
+    unsigned long long   last_vol;
+    unsigned long long   last_err;
+    double               ok_rate;
+    double               vol_rate;
+    double               err_rate;
+};
+
+static void policy_metrics_collect(metrics_out_t *out, void *arg);
+
+int policy_metrics_init(policy_info_t *policy)
+{
+    struct policy_metrics *m;
+
+    m = MemCalloc(1, sizeof(*m));
+    if (m == NULL)
+        return ENOMEM;
+
+    m->rule_count = policy->descr->rules.rule_count;
+    if (m->rule_count > 0) {
+        m->rules = MemCalloc(m->rule_count, sizeof(*m->rules));
+        if (m->rules == NULL) {
+            MemFree(m);
+            return ENOMEM;
+        }
+    }
+
+    pthread_mutex_init(&m->rate_lock, NULL);
+    gettimeofday(&m->rate_time, NULL);
+
+    policy->metrics = m;
+    metrics_register(policy_metrics_collect, policy);
+    return 0;
+}
+
+void policy_metrics_add_usec(policy_info_t *policy, policy_phase_e phase,
+                             unsigned long long usec)
+{
+    struct policy_metrics *m = policy->metrics;
+
+    if (m == NULL || phase >= PHASE_COUNT)
+        return;
+
+    __sync_fetch_and_add(&m->phase_hist[phase][hist_bucket(usec)], 1);
+    __sync_fetch_and_add(&m->phase_usec[phase], usec);
+}
+
+void policy_metrics_add(policy_info_t *policy, policy_phase_e phase,
+                        const struct timeval *start)
+{
+    struct timeval now, diff;
+
+    if (policy->metrics == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, start, &diff);
+    policy_metrics_add_usec(policy, phase, tv2usec(&diff));
+}
+
+/** @return the metrics of a rule, or NULL if it is not accounted */
+static struct rule_metrics *get_rule(policy_info_t *policy,
+                                     const rule_item_t *rule)
+{
+    struct policy_metrics *m = policy->metrics;
+    const policy_rules_t *rules = &policy->descr->rules;
+    unsigned int idx;
+
+    if (m == NULL || rule == NULL || rules->rules == NULL
+        || rule < rules->rules || rule >= rules->rules + rules->rule_count)
+        return NULL;
+
+    idx = rule - rules->rules;
+    if (idx >= m->rule_count)
+        return NULL;
+    return &m->rules[idx];
+}
+
+void policy_metrics_rule(policy_info_t *policy, const rule_item_t *rule,
+                         bool success, unsigned long long volume,
+                         unsigned long long action_usec)
+{
+    struct rule_metrics *r = get_rule(policy, rule);
+
+    if (r == NULL)
+        return;
+
+    if (success) {
+        __sync_fetch_and_add(&r->ok, 1);
+        __sync_fetch_and_add(&r->volume, volume);
+    } else
+        __sync_fetch_and_add(&r->errors, 1);
+
+    __sync_fetch_and_add(&r->hist[hist_bucket(action_usec)], 1);
+}
+
+/** copy a histogram updated by other threads */
+static void hist_copy(unsigned long long *dst,
+                      const volatile unsigned long long *src)
+{
+    unsigned int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++)
+        dst[b] = src[b];
+}
+
+static unsigned long long hist_count(const unsigned long long *hist)
+{
+    unsigned long long total = 0;
+    unsigned int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++)
+        total += hist[b];
+    return total;
+}
+
+/** update action rates, since the last call */
+static void rate_update(policy_info_t *policy, unsigned long long ok,
+                        unsigned long long vol, unsigned long long err)
+{
+    struct policy_metrics *m = policy->metrics;
+    struct timeval now, diff;
+    double elapsed;
+
+    gettimeofday(&now, NULL);
+
+    P(m->rate_lock);
+    timersub(&now, &m->rate_time, &diff);
+    elapsed = diff.tv_sec + diff.tv_usec / 1000000.0;
+    if (elapsed > 0.0) {
+        m->ok_rate = (ok - m->last_ok) / elapsed;
+        m->vol_rate = (vol - m->last_vol) / elapsed;
+        m->err_rate = (err - m->last_err) / elapsed;
+    }
+    m->last_ok = ok;
+    m->last_vol = vol;
+    m->last_err = err;
+    m->rate_time = now;
+    V(m->rate_lock);
+}
+
+/** name of the i-th accounted rule */
+static const char *rule_name(policy_info_t *policy, unsigned int i)
+{
+    if (i < policy->descr->rules.rule_count)
+        return policy->descr->rules.rules[i].rule_id;
+    return "?";
+}
+
+void policy_metrics_dump(policy_info_t *policy)
+{
+    struct policy_metrics *m = policy->metrics;
+    unsigned int status_tab[AS_ENUM_COUNT];
+    unsigned long long feedback_tab[AF_ENUM_COUNT];
+    unsigned long long hist[HIST_BUCKETS];
+    unsigned int nb_items, i;
+    char tmp_buff[256];
+
+    if (m == NULL)
+        return;
+
+    RetrieveQueueStats(&policy->queue, NULL, &nb_items, NULL, NULL, NULL,
+                       status_tab, feedback_tab);
+    rate_update(policy, feedback_tab[AF_NBR_OK], feedback_tab[AF_VOL_OK],
+                status_tab[AS_ERROR]);
+
+    DisplayLog(LVL_MAJOR, "STATS", "======= %s policy: metrics ======",
+               tag(policy));
+    DisplayLog(LVL_MAJOR, "STATS", "queue depth        = %u", nb_items);
+    DisplayLog(LVL_MAJOR, "STATS", "action rate        = %.1f/sec, %s/sec, "
+               "%.2f errors/sec", m->ok_rate,
+               FormatFileSize(tmp_buff, sizeof(tmp_buff),
+                              (unsigned long long)m->vol_rate),
+               m->err_rate);
+
+    DisplayLog(LVL_MAJOR, "STATS", "phase  |   count    | total (s) | "
+               "latency ms (p50/p90/p99)");
+    for (i = 0; i < PHASE_COUNT; i++) {
+        hist_copy(hist, m->phase_hist[i]);
+        DisplayLog(LVL_MAJOR, "STATS", "%-6s | %10llu | %9.1f | "
+                   "%.2f/%.2f/%.2f", phase_name[i], hist_count(hist),
+                   m->phase_usec[i] / 1000000.0,
+                   hist_percentile(hist, 50.0), hist_percentile(hist, 90.0),
+                   hist_percentile(hist, 99.0));
+    }
+
+    for (i = 0; i < m->rule_count; i++) {
+        const struct rule_metrics *r = &m->rules[i];
+
+        if (r->ok == 0 && r->errors == 0)
+            continue;
+
+        hist_copy(hist, r->hist);
+        DisplayLog(LVL_MAJOR, "STATS", "rule %-20s: %llu actions, %llu "
+                   "errors, %s, latency ms %.2f/%.2f/%.2f",
+                   rule_name(policy, i), r->ok, r->errors,
+                   FormatFileSize(tmp_buff, sizeof(tmp_buff), r->volume),
+                   hist_percentile(hist, 50.0), hist_percentile(hist, 90.0),
+                   hist_percentile(hist, 99.0));
+    }
+}
+
+/** print latency percentiles of a histogram as "p50/p90/p99" */
+static void print_percentiles(char *buff, size_t size,
+                              const volatile unsigned long long *src)
+{
+    unsigned long long hist[HIST_BUCKETS];
+
+    hist_copy(hist, src);
+    snprintf(buff, size, "%.2f/%.2f/%.2f", hist_percentile(hist, 50.0),
+             hist_percentile(hist, 90.0), hist_percentile(hist, 99.0));
+}
+
+void policy_metrics_store(policy_info_t *policy, lmgr_t *lmgr)
+{
+    struct policy_metrics *m = policy->metrics;
+    unsigned int status_tab[AS_ENUM_COUNT];
+    unsigned long long feedback_tab[AF_ENUM_COUNT];
+    char varname[256];
+    char value[MAX_VAR_LEN];
+    char pct[PHASE_COUNT][64];
+    unsigned int nb_items, i;
+
+    if (m == NULL)
+        return;
+
+    RetrieveQueueStats(&policy->queue, NULL, &nb_items, NULL, NULL, NULL,
+                       status_tab, feedback_tab);
+
+    for (i = 0; i < PHASE_COUNT; i++)
+        print_percentiles(pct[i], sizeof(pct[i]), m->phase_hist[i]);
+
+    snprintf(varname, sizeof(varname), "%s_%s", POLICY_STATS_PREFIX,
+             tag(policy));
+    snprintf(value, sizeof(value), "actions=%llu,errors=%u,volume=%llu,"
+             "queued=%u,actions_sec=%.1f,bytes_sec=%.0f,errors_sec=%.2f,"
+             "list_ms=%s,match_ms=%s,action_ms=%s,post_ms=%s",
+             feedback_tab[AF_NBR_OK], status_tab[AS_ERROR],
+             feedback_tab[AF_VOL_OK], nb_items, m->ok_rate, m->vol_rate,
+             m->err_rate, pct[PHASE_LIST], pct[PHASE_MATCH],
+             pct[PHASE_ACTION], pct[PHASE_POST]);
+
+    if (ListMgr_SetVar(lmgr, varname, value))
+        DisplayLog(LVL_MAJOR, tag(policy),
+                   "Failed to store policy stats in DB (%s)", varname);
+
+    for (i = 0; i < m->rule_count; i++) {
+        const struct rule_metrics *r = &m->rules[i];
+
+        if (r->ok == 0 && r->errors == 0)
+            continue;
+
+        print_percentiles(pct[PHASE_ACTION], sizeof(pct[PHASE_ACTION]),
+                          r->hist);
+
+        snprintf(varname, sizeof(varname), "%s_%s_%s", POLICY_STATS_PREFIX,
+                 tag(policy), rule_name(policy, i));
+        snprintf(value, sizeof(value), "actions=%llu,errors=%llu,volume=%llu,"
+                 "action_ms=%s", r->ok, r->errors, r->volume,
+                 pct[PHASE_ACTION]);
+
+        if (ListMgr_SetVar(lmgr, varname, value))
+            DisplayLog(LVL_MAJOR, tag(policy),
+                       "Failed to store policy stats in DB (%s)", varname);
+    }
+}
+
+/** export policy metrics to the metrics endpoint */
+static void policy_metrics_collect(metrics_out_t *out, void *arg)
+{
+    policy_info_t *policy = arg;
+    struct policy_metrics *m = policy->metrics;
+    unsigned int status_tab[AS_ENUM_COUNT];
+    unsigned long long feedback_tab[AF_ENUM_COUNT];
+    const char *labels[] = { "policy", tag(policy), NULL, NULL, NULL };
+    unsigned int nb_items, i;
+
+    RetrieveQueueStats(&policy->queue, NULL, &nb_items, NULL, NULL, NULL,
+                       status_tab, feedback_tab);
+
+    metrics_family(out, "policy_queue_depth", METRIC_GAUGE,
+                   "Entries queued for policy actions");
+    metrics_value(out, labels, nb_items);
+    metrics_family(out, "policy_actions_total", METRIC_COUNTER,
+                   "Successful policy actions");
+    metrics_value(out, labels, feedback_tab[AF_NBR_OK]);
+    metrics_family(out, "policy_action_bytes_total", METRIC_COUNTER,
+                   "Volume of entries of successful policy actions");
+    metrics_value(out, labels, feedback_tab[AF_VOL_OK]);
+    metrics_family(out, "policy_action_errors_total", METRIC_COUNTER,
+                   "Failed policy actions");
+    metrics_value(out, labels, status_tab[AS_ERROR]);
+
+    metrics_family(out, "policy_phase_seconds", METRIC_HISTOGRAM,
+                   "Duration of the phases of policy runs");
+    labels[2] = "phase";
+    for (i = 0; i < PHASE_COUNT; i++) {
+        labels[3] = phase_name[i];
+        metrics_hist(out, labels, m->phase_hist[i], m->phase_usec[i]);
+    }
+
+    labels[2] = "rule";
+    for (i = 0; i < m->rule_count; i++) {
+        const struct rule_metrics *r = &m->rules[i];
+
+        labels[3] = rule_name(policy, i);
+        metrics_family(out, "policy_rule_actions_total", METRIC_COUNTER,
+                       "Successful policy actions per rule");
+        metrics_value(out, labels, r->ok);
+        metrics_family(out, "policy_rule_action_bytes_total", METRIC_COUNTER,
+                       "Volume of successful policy actions per rule");
+        metrics_value(out, labels, r->volume);
+        metrics_family(out, "policy_rule_action_errors_total", METRIC_COUNTER,
+                       "Failed policy actions per rule");
+        metrics_value(out, labels, r->errors);
+        metrics_family(out, "policy_rule_action_seconds", METRIC_HISTOGRAM,
+                       "Duration of policy actions per rule");
+        metrics_hist(out, labels, r->hist, 0);
+    }
+}
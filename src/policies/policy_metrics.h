@@ -0,0 +1,66 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  policy_metrics.h
+ * \brief Live counters and latency histograms of policy runs.
+ *
+ * Each policy accounts the time spent in the phases of its runs
+ * (DB listing, rule matching, actions, DB updates after actions),
+ * and the actions of each of its rules.
+ */
+#ifndef _POLICY_METRICS_H
+#define _POLICY_METRICS_H
+
+#include "policy_run.h"
+#include <sys/time.h>
+
+typedef enum {
+    PHASE_LIST,     /**< DB requests listing candidates */
+    PHASE_MATCH,    /**< attribute refresh and rule matching */
+    PHASE_ACTION,   /**< policy actions */
+    PHASE_POST,     /**< DB updates after actions */
+    PHASE_COUNT
+} policy_phase_e;
+
+/** allocate the metrics of a policy (policy->metrics) */
+int policy_metrics_init(policy_info_t *policy);
+
+/** account a phase duration, in microseconds */
+void policy_metrics_add_usec(policy_info_t *policy, policy_phase_e phase,
+                             unsigned long long usec);
+
+/** account a phase that started at the given time and ends now */
+void policy_metrics_add(policy_info_t *policy, policy_phase_e phase,
+                        const struct timeval *start);
+
+/**
+ * Account an action for the rule it was applied by.
+ * @param volume       size of the entry, if the action succeeded.
+ * @param action_usec  duration of the action.
+ */
+void policy_metrics_rule(policy_info_t *policy, const rule_item_t *rule,
+                         bool success, unsigned long long volume,
+                         unsigned long long action_usec);
+
+/** display policy metrics in the stats dump and update rates */
+void policy_metrics_dump(policy_info_t *policy);
+
+/**
+ * Store policy metrics in DB, as <POLICY_STATS_PREFIX>_<policy> and
+ * <POLICY_STATS_PREFIX>_<policy>_<rule> variables.
+ * Rates are the ones computed at the last stats dump.
+ */
+void policy_metrics_store(policy_info_t *policy, lmgr_t *lmgr);
+
+#endif
@@ -0,0 +1,318 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Path globs of all policy conditions are registered at config load time,
+ * with the filesystem root already prepended to relative globs.
+ * The literal part of each glob (before the first wildcard) is indexed
+ * in a trie of path components, so a single walk over the path of an entry
+ * selects the globs that may match it. The others can't match and are not
+ * evaluated.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "policy_patterns.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "global_config.h"
+
+#include <glib.h>
+#include <fnmatch.h>
+#include <libgen.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define PATTERN_TAG "Patterns"
+
+/* pattern results in path_match_state */
+enum {
+    RES_NO_MATCH = 0,   /* not a candidate, or tested without match */
+    RES_CANDIDATE,      /* must be tested */
+    RES_MATCH,
+};
+
+struct path_pattern {
+    char           *glob;       /**< glob with the root path */
+    char           *orig;       /**< glob, as written in config */
+    pattern_kind_e  kind;
+    int             fnm_flags;
+    bool            any_level;
+    bool            insensitive;
+};
+
+struct trie_node {
+    GHashTable     *children;   /**< component name -> struct trie_node */
+    GArray         *patterns;   /**< indexes of patterns for this prefix */
+};
+
+struct path_matcher {
+    struct path_pattern *patterns;
+    unsigned int         count;
+    struct trie_node     root;
+};
+
+static void trie_node_free(gpointer data);
+
+static void trie_node_clear(struct trie_node *node)
+{
+    if (node->children != NULL)
+        g_hash_table_destroy(node->children);
+    if (node->patterns != NULL)
+        g_array_free(node->patterns, TRUE);
+}
+
+static void trie_node_free(gpointer data)
+{
+    trie_node_clear(data);
+    free(data);
+}
+
+path_matcher_t *path_matcher_new(void)
+{
+    return calloc(1, sizeof(struct path_matcher));
+}
+
+void path_matcher_free(path_matcher_t *matcher)
+{
+    unsigned int i;
+
+    if (matcher == NULL)
+        return;
+
+    for (i = 0; i < matcher->count; i++) {
+        free(matcher->patterns[i].glob);
+        free(matcher->patterns[i].orig);
+    }
+    free(matcher->patterns);
+    trie_node_clear(&matcher->root);
+    free(matcher);
+}
+
+/** length of the literal prefix of a glob */
+static size_t literal_len(const char *glob)
+{
+    return strcspn(glob, "*?[\\");
+}
+
+/** index a pattern by the complete path components of its literal prefix */
+static int trie_insert(struct trie_node *root, const char *glob,
+                       size_t prefix_len, unsigned int idx)
+{
+    struct trie_node *node = root;
+    const char *curr = glob;
+    const char *end = glob + prefix_len;
+    const char *slash;
+
+    while ((slash = memchr(curr, '/', end - curr)) != NULL) {
+        struct trie_node *child = NULL;
+        char *name = g_strndup(curr, slash - curr);
+
+        if (node->children == NULL)
+            node->children = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, trie_node_free);
+        else
+            child = g_hash_table_lookup(node->children, name);
+
+        if (child == NULL) {
+            child = calloc(1, sizeof(*child));
+            if (child == NULL) {
+                g_free(name);
+                return -ENOMEM;
+            }
+            g_hash_table_insert(node->children, name, child);
+        } else
+            g_free(name);
+
+        node = child;
+        curr = slash + 1;
+    }
+
+    if (node->patterns == NULL)
+        node->patterns = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+    g_array_append_val(node->patterns, idx);
+    return 0;
+}
+
+int path_matcher_add(path_matcher_t *matcher, const char *glob,
+                     pattern_kind_e kind, bool any_level, bool insensitive)
+{
+    struct path_pattern *pat;
+    unsigned int i;
+    void *tmp;
+
+    for (i = 0; i < matcher->count; i++) {
+        pat = &matcher->patterns[i];
+        if (pat->kind == kind && pat->any_level == any_level
+            && pat->insensitive == insensitive && !strcmp(pat->orig, glob))
+            return i;
+    }
+
+    tmp = realloc(matcher->patterns,
+                  (matcher->count + 1) * sizeof(*matcher->patterns));
+    if (tmp == NULL)
+        return -1;
+    matcher->patterns = tmp;
+    pat = &matcher->patterns[matcher->count];
+    memset(pat, 0, sizeof(*pat));
+
+    pat->kind = kind;
+    pat->any_level = any_level;
+    pat->insensitive = insensitive;
+    pat->orig = strdup(glob);
+
+    /* is the glob relative ?
+     * (don't add the root path if expression starts with '**').
+     */
+    if (!IS_ABSOLUTE_PATH(glob) && !(any_level && (glob[0] == '*')))
+        asprintf(&pat->glob, "%s/%s", global_config.fs_path, glob);
+    else
+        pat->glob = strdup(glob);
+
+    if (pat->orig == NULL || pat->glob == NULL) {
+        free(pat->orig);
+        free(pat->glob);
+        return -1;
+    }
+
+    if (!any_level)
+        pat->fnm_flags |= FNM_PATHNAME;
+    if (insensitive)
+        pat->fnm_flags |= FNM_CASEFOLD;
+
+    /* case insensitive patterns are always candidates */
+    if (trie_insert(&matcher->root, pat->glob,
+                    insensitive ? 0 : literal_len(pat->glob),
+                    matcher->count) != 0) {
+        free(pat->orig);
+        free(pat->glob);
+        return -1;
+    }
+
+    DisplayLog(LVL_FULL, PATTERN_TAG, "Pattern #%u: '%s'", matcher->count,
+               pat->glob);
+    return matcher->count++;
+}
+
+void path_match_init(struct path_match_state *state,
+                     const path_matcher_t *matcher)
+{
+    state->matcher = matcher;
+    state->path = NULL;
+    state->parent_set = false;
+    state->results = NULL;
+}
+
+void path_match_fini(struct path_match_state *state)
+{
+    if (state->results != state->static_results)
+        free(state->results);
+    state->results = NULL;
+    state->path = NULL;
+}
+
+static void mark_candidates(unsigned char *results,
+                            const struct trie_node *node)
+{
+    unsigned int i;
+
+    if (node->patterns == NULL)
+        return;
+
+    for (i = 0; i < node->patterns->len; i++)
+        results[g_array_index(node->patterns, unsigned int, i)] =
+            RES_CANDIDATE;
+}
+
+/** select the candidate patterns for the given path */
+static int select_candidates(struct path_match_state *state, const char *path)
+{
+    const path_matcher_t *matcher = state->matcher;
+    const struct trie_node *node = &matcher->root;
+    const char *curr = path;
+    const char *slash;
+    char name[RBH_NAME_MAX + 1];
+
+    if (state->results == NULL) {
+        if (matcher->count <= PATH_MATCH_STATIC_COUNT)
+            state->results = state->static_results;
+        else {
+            state->results = malloc(matcher->count);
+            if (state->results == NULL)
+                return -ENOMEM;
+        }
+    }
+    memset(state->results, RES_NO_MATCH, matcher->count);
+    state->path = path;
+    state->parent_set = false;
+
+    mark_candidates(state->results, node);
+
+    while (node->children != NULL
+           && (slash = strchr(curr, '/')) != NULL) {
+        size_t len = slash - curr;
+
+        if (len > RBH_NAME_MAX)
+            break;
+        memcpy(name, curr, len);
+        name[len] = '\0';
+
+        node = g_hash_table_lookup(node->children, name);
+        if (node == NULL)
+            break;
+
+        mark_candidates(state->results, node);
+        curr = slash + 1;
+    }
+
+    return 0;
+}
+
+int path_match_test(struct path_match_state *state, const char *path,
+                    unsigned int pattern_idx)
+{
+    const struct path_pattern *pat;
+    bool match;
+
+    if (state->matcher == NULL || pattern_idx >= state->matcher->count)
+        return -1;
+
+    if (state->path != path || state->results == NULL) {
+        if (select_candidates(state, path))
+            return -1;
+    }
+
+    if (state->results[pattern_idx] != RES_CANDIDATE)
+        return state->results[pattern_idx] == RES_MATCH;
+
+    pat = &state->matcher->patterns[pattern_idx];
+
+    match = !fnmatch(pat->glob, path, pat->fnm_flags);
+    if (!match && pat->kind == PATTERN_TREE) {
+        /* match the parent directory or one of its ancestors */
+        if (!state->parent_set) {
+            char buff[RBH_PATH_MAX];
+
+            rh_strncpy(buff, path, sizeof(buff));
+            rh_strncpy(state->parent, dirname(buff), sizeof(state->parent));
+            state->parent_set = true;
+        }
+        match = !fnmatch(pat->glob, state->parent,
+                         pat->fnm_flags | FNM_LEADING_DIR);
+    }
+
+    state->results[pattern_idx] = match ? RES_MATCH : RES_NO_MATCH;
+    return match;
+}
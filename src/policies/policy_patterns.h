@@ -0,0 +1,71 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  policy_patterns.h
+ * \brief Combined matching of the path conditions of all policies.
+ */
+#ifndef _POLICY_PATTERNS_H
+#define _POLICY_PATTERNS_H
+
+#include "policy_rules.h"
+
+typedef enum {
+    PATTERN_PATH,   /**< 'path' condition: the glob matches the full path */
+    PATTERN_TREE,   /**< 'tree' condition: the glob matches an ancestor
+                         directory, or the entry itself */
+} pattern_kind_e;
+
+/** allocate an empty matcher */
+path_matcher_t *path_matcher_new(void);
+void path_matcher_free(path_matcher_t *matcher);
+
+/**
+ * Register a path glob, as written in the configuration.
+ * Registering the same pattern twice returns the same index.
+ * @return pattern index, or -1 on error.
+ */
+int path_matcher_add(path_matcher_t *matcher, const char *glob,
+                     pattern_kind_e kind, bool any_level, bool insensitive);
+
+/* results for the first patterns are stored in the state itself */
+#define PATH_MATCH_STATIC_COUNT 512
+
+/** matching state of all patterns against the path of an entry */
+struct path_match_state {
+    const path_matcher_t   *matcher;
+    /** path the results refer to (NULL if none yet) */
+    const char             *path;
+    /** parent directory of path (for tree conditions) */
+    char                    parent[RBH_PATH_MAX];
+    bool                    parent_set;
+    /** one result per pattern */
+    unsigned char          *results;
+    unsigned char           static_results[PATH_MATCH_STATIC_COUNT];
+};
+
+void path_match_init(struct path_match_state *state,
+                     const path_matcher_t *matcher);
+void path_match_fini(struct path_match_state *state);
+
+/**
+ * Test a registered pattern against an entry path.
+ * The first call for a path selects the candidate patterns, by walking the
+ * path once in a trie of the literal part of all patterns. Only candidates
+ * are then checked with fnmatch(), once per path.
+ * @return 1 if the path matches, 0 if it doesn't, -1 on error.
+ */
+int path_match_test(struct path_match_state *state, const char *path,
+                    unsigned int pattern_idx);
+
+#endif
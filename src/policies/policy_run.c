@@ -25,12 +25,18 @@
 #include "xplatform_print.h"
 #include "update_params.h"
 #include "status_manager.h"
+#include "policy_candidates.h"
+#include "policy_tracker.h"
+#include "policy_metrics.h"
+#include "rbh_prof.h"
+#include "rbh_affinity.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 #define CHECK_QUEUE_INTERVAL    1
 
@@ -39,43 +45,98 @@
 #define aborted(_p)         ((_p)->aborted)
 #define no_limit(_p)        ((_p)->flags & RUNFLG_NO_LIMIT)
 #define force_run(_p)       ((_p)->flags & RUNFLG_FORCE_RUN)
+#define simulate(_p)        ((_p)->flags & RUNFLG_SIMULATE)
 #define tag(_p)             ((_p)->descr->name)
+#define policy_index(_p)    ((unsigned int)((_p)->descr - policies.policy_list))
 
 #define TAG "PolicyRun"
 
+struct ost_run;
+
 typedef struct queue_item__ {
     entry_id_t entry_id;
     attr_set_t entry_attr;
     unsigned long targeted;
+    /* set for combined runs on several OSTs */
+    struct ost_run *ost_run;
+    unsigned int ost_pass;
+    counters_t amount;  /* target amount the entry was accounted for */
 } queue_item_t;
 
+/**
+ * Compact form of a candidate while it waits for a worker (in the workers
+ * queue, the top-K heap or OST buffers): only the set attributes are kept.
+ * It is expanded to a queue_item_t when a worker processes it.
+ */
+typedef struct queued_item__ {
+    entry_id_t entry_id;
+    attr_pack_t *attrs;
+    counters_t amount;
+    struct ost_run *ost_run;
+    unsigned int ost_pass;
+} queued_item_t;
+
 /**
  *  alloc a new worker item so it can be pushed to the worker queue.
+ *  On success, the attributes are packed in the item and p_attr_set is freed.
  */
-static queue_item_t *entry2queue_item(entry_id_t *p_entry_id,
-                                      attr_set_t *p_attr_set,
-                                      unsigned long targeted)
+static queued_item_t *entry2queue_item(entry_id_t *p_entry_id,
+                                       attr_set_t *p_attr_set,
+                                       const counters_t *amount)
 {
-    queue_item_t *new_entry;
+    queued_item_t *new_entry;
 
-    new_entry = (queue_item_t *) MemAlloc(sizeof(queue_item_t));
+    new_entry = MemAllocTag(MEM_TAG_POLICY, sizeof(queued_item_t));
     if (!new_entry)
         return NULL;
 
+    new_entry->attrs = ListMgr_PackAttrs(p_attr_set);
+    if (new_entry->attrs == NULL) {
+        MemFreeTag(new_entry);
+        return NULL;
+    }
+    ListMgr_FreeAttrs(p_attr_set);
+
     new_entry->entry_id = *p_entry_id;
-    new_entry->entry_attr = *p_attr_set;
-    new_entry->targeted = targeted;
+    new_entry->amount = *amount;
+    new_entry->ost_run = NULL;
+    new_entry->ost_pass = 0;
 
     return new_entry;
 }
 
+/**
+ * Free a queued item.
+ */
+static void free_queued_item(queued_item_t *q)
+{
+    ListMgr_FreePackedAttrs(q->attrs);
+    MemFreeTag(q);
+}
+
+/**
+ * Expand a queued item to the item processed by workers.
+ * @return 0 on success, -ENOMEM if attributes can't be unpacked
+ *         (p_item attributes are then empty).
+ */
+static int queued2work_item(const queued_item_t *q, queue_item_t *p_item)
+{
+    p_item->entry_id = q->entry_id;
+    p_item->targeted = q->amount.targeted;
+    p_item->amount = q->amount;
+    p_item->ost_run = q->ost_run;
+    p_item->ost_pass = q->ost_pass;
+
+    return ListMgr_UnpackAttrs(q->attrs, &p_item->entry_attr);
+}
+
 /**
  * Free a queue Item (and the resources of its entry_attr).
  */
 static void free_queue_item(queue_item_t *item)
 {
     ListMgr_FreeAttrs(&item->entry_attr);
-    MemFree(item);
+    MemFreeTag(item);
 }
 
 typedef struct subst_args {
@@ -90,23 +151,20 @@ typedef struct subst_args {
 static int subst_one_param(const char *key, const char *val, void *udata)
 {
     subst_args_t *args = (subst_args_t *) udata;
-    gchar *new_val;
-    char *descr = NULL;
-    int rc;
-
-    asprintf(&descr, "parameter %s='%s'", key, val);
-    new_val = subst_params(val, descr, args->id, args->attrs, args->params,
-                           args->subst_array, args->smi, false, false);
-    free(descr);
+    const char *new_val;
+    char descr[256];
 
+    snprintf(descr, sizeof(descr), "parameter %s='%s'", key, val);
+    new_val = subst_params_r(val, descr, args->id, args->attrs, args->params,
+                             args->subst_array, args->smi, false, false);
     if (!new_val)
         return -EINVAL;
 
-    rc = rbh_param_set(args->params, key, new_val, true);
-
-    g_free(new_val);
+    /* no placeholder */
+    if (new_val == val)
+        return 0;
 
-    return rc;
+    return rbh_param_set(args->params, key, new_val, true);
 }
 
 static void set_addl_params(const char *addl_params[], unsigned int size,
@@ -152,6 +210,9 @@ typedef struct entry_policy_info {
     action_params_t params;         /**< action parameters */
     post_action_e   after_action;   /**< what to do after action */
     int             time_save;      /**< reference time for LRU */
+    bool            async;          /**< run command actions without
+                                         waiting for them */
+    unsigned long long action_usec; /**< duration of the action */
 } entry_policy_info_t;
 
 /**
@@ -235,13 +296,295 @@ static int build_action_params(const policy_info_t *policy,
     return rc;
 }
 
-/** Execute a policy action. */
+/** token bucket (tokens may be borrowed: the debt is paid by waiting) */
+struct token_bucket {
+    double          tokens;
+    struct timeval  last;
+};
+
+/** limits on the rate of actions and of their volume */
+struct rate_limiter {
+    pthread_mutex_t     lock;
+    double              action_rate;    /**< actions/sec, 0 = unlimited */
+    ull_t               volume_rate;    /**< bytes/sec, 0 = unlimited */
+    struct token_bucket actions;
+    struct token_bucket volume;
+};
+
+static void rate_limiter_init(struct rate_limiter *rl, double action_rate,
+                              ull_t volume_rate)
+{
+    memset(rl, 0, sizeof(*rl));
+    pthread_mutex_init(&rl->lock, NULL);
+    rl->action_rate = action_rate;
+    rl->volume_rate = volume_rate;
+}
+
+/** set new rates and start with full buckets */
+static void rate_limiter_reset(struct rate_limiter *rl, double action_rate,
+                               ull_t volume_rate)
+{
+    P(rl->lock);
+    rl->action_rate = action_rate;
+    rl->volume_rate = volume_rate;
+    memset(&rl->actions, 0, sizeof(rl->actions));
+    memset(&rl->volume, 0, sizeof(rl->volume));
+    V(rl->lock);
+}
+
+/**
+ * Take tokens from a bucket that allows bursts of 1 second.
+ * @return the time to wait (in usec) to pay the debt.
+ */
+static unsigned long bucket_take(struct token_bucket *b, double rate,
+                                 double cost, const struct timeval *now)
+{
+    double burst = MAX2(rate, 1.0);
+
+    if (b->last.tv_sec == 0)
+        b->tokens = burst;
+    else {
+        double elapsed = (now->tv_sec - b->last.tv_sec)
+                         + (now->tv_usec - b->last.tv_usec) / 1000000.0;
+
+        b->tokens = MIN2(burst, b->tokens + elapsed * rate);
+    }
+    b->last = *now;
+    b->tokens -= cost;
+
+    if (b->tokens >= 0.0)
+        return 0;
+    return (unsigned long)(-b->tokens / rate * 1000000.0);
+}
+
+/** @return the time to wait (in usec) before running an action */
+static unsigned long rate_limiter_take(struct rate_limiter *rl,
+                                       double action_rate, ull_t volume_rate,
+                                       ull_t volume)
+{
+    unsigned long wait = 0;
+    struct timeval now;
+
+    if (action_rate <= 0.0 && volume_rate == 0)
+        return 0;
+
+    gettimeofday(&now, NULL);
+    P(rl->lock);
+    if (action_rate > 0.0)
+        wait = bucket_take(&rl->actions, action_rate, 1.0, &now);
+    if (volume_rate > 0)
+        wait = MAX2(wait, bucket_take(&rl->volume, (double)volume_rate,
+                                      (double)volume, &now));
+    V(rl->lock);
+    return wait;
+}
+
+/** are rate limits enforced at this time of day? */
+static bool rate_limit_scheduled(const policy_run_config_t *cfg)
+{
+    struct tm tm;
+    time_t now = time(NULL);
+    int min;
+
+    if (cfg->rate_limit_start == cfg->rate_limit_end)
+        return true;
+
+    localtime_r(&now, &tm);
+    min = tm.tm_hour * 60 + tm.tm_min;
+
+    if (cfg->rate_limit_start < cfg->rate_limit_end)
+        return min >= cfg->rate_limit_start && min < cfg->rate_limit_end;
+    /* the window spans midnight */
+    return min >= cfg->rate_limit_start || min < cfg->rate_limit_end;
+}
+
+#ifdef _LUSTRE
+static struct rate_limiter *ost_rate_limiter(const queue_item_t *item);
+#endif
+
+/** rate limits of the run (or OST) the entry was listed for */
+static inline struct rate_limiter *item_rate_limiter(policy_info_t *pol,
+                                                     const queue_item_t *item)
+{
+#ifdef _LUSTRE
+    if (item->ost_run != NULL)
+        return ost_rate_limiter(item);
+#endif
+    return pol->run_rate;
+}
+
+/**
+ * Wait for the rate limits of the policy and of the current run
+ * before running an action.
+ */
+static void rate_limit_wait(policy_info_t *pol, entry_policy_info_t *epi)
+{
+    const policy_run_config_t *cfg = pol->config;
+    struct rate_limiter *run_rl = item_rate_limiter(pol, epi->item);
+    unsigned long wait = 0;
+    ull_t volume = 0;
+
+    if (pol->rate == NULL || !rate_limit_scheduled(cfg))
+        return;
+
+    if (ATTR_MASK_TEST(&epi->fresh_attrs, size))
+        volume = ATTR(&epi->fresh_attrs, size);
+
+    wait = rate_limiter_take(pol->rate, cfg->max_action_rate,
+                             cfg->max_volume_rate, volume);
+    if (run_rl != NULL)
+        wait = MAX2(wait, rate_limiter_take(run_rl, run_rl->action_rate,
+                                            run_rl->volume_rate, volume));
+    if (wait == 0)
+        return;
+
+    DisplayLog(LVL_FULL, tag(pol), "Rate limit: waiting %lums before "
+               "action on " DFID, wait / 1000, PFID(&epi->item->entry_id));
+    if (wait >= 1000000)
+        rh_sleep(wait / 1000000);
+    rh_usleep(wait % 1000000);
+}
+
+/** call the action callback of the status manager, if any */
+static void action_callback(policy_info_t *policy, entry_policy_info_t *epi,
+                            int rc)
+{
+    sm_instance_t *smi = policy->descr->status_mgr;
+    int tmp_rc;
+
+    if (smi == NULL || smi->sm->action_cb == NULL)
+        return;
+
+    tmp_rc = smi->sm->action_cb(smi, policy->descr->implements, rc,
+                                &epi->item->entry_id, &epi->fresh_attrs,
+                                &epi->after_action);
+    if (tmp_rc)
+        DisplayLog(LVL_MAJOR, tag(policy),
+                   "Action callback failed for action '%s': rc=%d",
+                   policy->descr->implements ? policy->descr->
+                   implements : "<null>", tmp_rc);
+}
+
+/** action time history, to estimate the duration of simulated runs */
+static void action_time_stats(policy_info_t *policy, entry_policy_info_t *epi,
+                              const struct timeval *t0)
+{
+    struct timeval t1;
+
+    gettimeofday(&t1, NULL);
+    epi->action_usec = (t1.tv_sec - t0->tv_sec) * 1000000ULL
+                       + t1.tv_usec - t0->tv_usec;
+    __sync_fetch_and_add(&policy->action_usec, epi->action_usec);
+    __sync_fetch_and_add(&policy->action_count, 1);
+    policy_metrics_add_usec(policy, PHASE_ACTION, epi->action_usec);
+}
+
+/* forward declaration */
+static void post_action_cb(int action_rc, lmgr_t *lmgr, policy_info_t *pol,
+                           entry_policy_info_t *epi, bool free_item);
+
+/**
+ * Command actions in flight, if max_async_actions is set.
+ * Their completion is handled by the command completion thread.
+ */
+struct async_actions {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    unsigned int        count;
+};
+
+/** an action in flight: owns the entry and its attributes */
+struct async_action {
+    policy_info_t       *pol;
+    entry_policy_info_t  epi;
+    struct timeval       t0;
+};
+
+/** completion of an asynchronous command action */
+static void async_action_done(void *udata, int rc)
+{
+    struct async_action *aa = udata;
+    policy_info_t *pol = aa->pol;
+    lmgr_t *lmgr;
+
+    /* external commands can't set 'after': default to update */
+    aa->epi.after_action = PA_UPDATE;
+    action_callback(pol, &aa->epi, rc);
+    action_time_stats(pol, &aa->epi, &aa->t0);
+
+    lmgr = ListMgr_Checkout();
+    if (lmgr == NULL) {
+        DisplayLog(LVL_CRIT, tag(pol),
+                   "Could not connect to database. Exiting.");
+        exit(DB_CONNECT_FAILED);
+    }
+    post_action_cb(rc, lmgr, pol, &aa->epi, true);
+    ListMgr_Release(lmgr);
+    MemFree(aa);
+
+    P(pol->async->lock);
+    pol->async->count--;
+    pthread_cond_signal(&pol->async->cond);
+    V(pol->async->lock);
+}
+
+/**
+ * Start a command action without waiting for it: either a command (cmd),
+ * or a request to a co-process helper (coproc, request).
+ * On success, the entry is owned by the completion thread.
+ * @return -EINPROGRESS if the action was started.
+ */
+static int async_action_start(policy_info_t *policy, entry_policy_info_t *epi,
+                              char **cmd, struct coproc *coproc,
+                              const char *request, const struct timeval *t0)
+{
+    struct async_actions *async = policy->async;
+    struct async_action *aa;
+    int rc;
+
+    aa = MemAlloc(sizeof(*aa));
+    if (aa == NULL)
+        return -ENOMEM;
+    aa->pol = policy;
+    aa->epi = *epi;
+    aa->t0 = *t0;
+
+    /* limit the number of actions in flight */
+    P(async->lock);
+    while (async->count >= policy->config->max_async_actions)
+        pthread_cond_wait(&async->cond, &async->lock);
+    async->count++;
+    V(async->lock);
+
+    if (coproc != NULL)
+        rc = coproc_call_async(coproc, request, async_action_done, aa);
+    else
+        rc = execute_shell_command_async(cmd, cb_stderr_to_log,
+                                         (void *)LVL_DEBUG, async_action_done,
+                                         aa);
+    if (rc) {
+        MemFree(aa);
+        P(async->lock);
+        async->count--;
+        pthread_cond_signal(&async->cond);
+        V(async->lock);
+        return rc;
+    }
+    return -EINPROGRESS;
+}
+
+/**
+ * Execute a policy action.
+ * @retval -EINPROGRESS if the action is asynchronous and was started:
+ *         the entry is no longer owned by the caller.
+ */
 static int policy_action(policy_info_t *policy, entry_policy_info_t *epi)
 {
     int rc = 0;
     const entry_id_t      *id  = &epi->item->entry_id;
     sm_instance_t         *smi = policy->descr->status_mgr;
     const policy_action_t *actionp = NULL;
+    struct timeval         t0;
 
     /* Get the action from policy rule, if defined.
      * Else, get the default action for the policy. */
@@ -271,6 +614,10 @@ static int policy_action(policy_info_t *policy, entry_policy_info_t *epi)
     if (dry_run(policy))
         return 0;
 
+    rate_limit_wait(policy, epi);
+
+    gettimeofday(&t0, NULL);
+
     /* If the status manager has an 'executor', make it run the action.
      * Else, run directly the action function. */
     if (smi != NULL && smi->sm->executor != NULL) {
@@ -315,15 +662,60 @@ static int policy_action(policy_info_t *policy, entry_policy_info_t *epi)
                         free(log_cmd);
                     }
 
-                    rc = execute_shell_command(cmd, cb_stderr_to_log,
-                                               (void *)LVL_DEBUG);
+                    if (epi->async)
+                        rc = async_action_start(policy, epi, cmd, NULL, NULL,
+                                                &t0);
+                    else
+                        rc = execute_shell_command(cmd, cb_stderr_to_log,
+                                                   (void *)LVL_DEBUG);
                     g_strfreev(cmd);
                     /* @TODO handle other hardlinks to the same entry */
+
+                    /* epi now belongs to the completion thread */
+                    if (rc == -EINPROGRESS)
+                        return rc;
                 }
 
                 /* external commands can't set 'after': default to update */
                 epi->after_action = PA_UPDATE;
 
+                break;
+            }
+        case ACTION_COPROC:    /* request to a co-process helper */
+            {
+                char *request;
+                char const *addl_params[5];
+
+                set_addl_params(addl_params,
+                                sizeof(addl_params) / sizeof(char *),
+                                epi->rule, epi->fileset);
+
+                request = subst_params(actionp->action_u.coproc.request,
+                                       "action coproc request", id,
+                                       &epi->fresh_attrs, &epi->params,
+                                       addl_params, smi, true, true);
+                if (request == NULL) {
+                    rc = -EINVAL;
+                } else {
+                    DisplayLog(LVL_DEBUG, tag(policy),
+                               DFID ": action: coproc(%s)", PFID(id), request);
+
+                    if (epi->async)
+                        rc = async_action_start(policy, epi, NULL,
+                                                actionp->action_u.coproc.coproc,
+                                                request, &t0);
+                    else
+                        rc = coproc_call(actionp->action_u.coproc.coproc,
+                                         request, NULL);
+                    g_free(request);
+
+                    /* epi now belongs to the completion thread */
+                    if (rc == -EINPROGRESS)
+                        return rc;
+                }
+
+                /* helpers can't set 'after': default to update */
+                epi->after_action = PA_UPDATE;
                 break;
             }
         case ACTION_UNSET:
@@ -334,18 +726,10 @@ static int policy_action(policy_info_t *policy, entry_policy_info_t *epi)
 
         /* call action callback if there is no status manager executor to wrap
          * actions */
-        if (smi != NULL && smi->sm->action_cb != NULL) {
-            int tmp_rc = smi->sm->action_cb(smi, policy->descr->implements, rc,
-                                            id, &epi->fresh_attrs,
-                                            &epi->after_action);
-            if (tmp_rc)
-                DisplayLog(LVL_MAJOR, tag(policy),
-                           "Action callback failed for action '%s': rc=%d",
-                           policy->descr->implements ? policy->descr->
-                           implements : "<null>", tmp_rc);
-        }
+        action_callback(policy, epi, rc);
     }
 
+    action_time_stats(policy, epi, &t0);
     return rc;
 }
 
@@ -354,30 +738,7 @@ static int policy_action(policy_info_t *policy, entry_policy_info_t *epi)
  */
 static inline int get_sort_attr(policy_info_t *p, const attr_set_t *p_attrs)
 {
-    if (p->config->lru_sort_attr == LRU_ATTR_NONE)
-        return -1;
-
-    if (!attr_mask_test_index(&p_attrs->attr_mask, p->config->lru_sort_attr))
-        return -1;
-
-    if (is_sm_info(p->config->lru_sort_attr)) {
-        unsigned int idx = attr2sminfo_index(p->config->lru_sort_attr);
-
-        return *((unsigned int *)p_attrs->attr_values.sm_info[idx]);
-    }
-
-    switch (p->config->lru_sort_attr) {
-    case ATTR_INDEX_creation_time:
-        return ATTR(p_attrs, creation_time);
-    case ATTR_INDEX_last_mod:
-        return ATTR(p_attrs, last_mod);
-    case ATTR_INDEX_last_access:
-        return ATTR(p_attrs, last_access);
-    case ATTR_INDEX_rm_time:
-        return ATTR(p_attrs, rm_time);
-    default:
-        return -1;
-    }
+    return attr_sort_key(p->config->lru_sort_attr, p_attrs);
 }
 
 /** set dummy time attributes, to check 'end of list' criteria */
@@ -875,101 +1236,565 @@ static int set_optimization_filters(policy_info_t *policy,
 }
 
 /**
- * report the current policy run progress at regular interval.
+ * Ignore marks (ignore_mark_max_validity): the time until which a
+ * whitelisted or non-matching entry can't become eligible is stored in the
+ * DB, and the entry is not listed again until then (see listmgr_marks.c).
+ * This time is when the first time condition (last_access, last_mod,
+ * last_mdchange, creation) of ignore rules, fileclass definitions or rule
+ * conditions may change for the entry. Marks are not used if these
+ * expressions depend on attributes that change without updating md_update
+ * (status, xattrs, status manager info).
  */
-static void report_progress(policy_info_t *policy,
-                            const unsigned long long *pass_begin,
-                            const unsigned long long *pass_current,
-                            const unsigned int *status_tab_begin,
-                            const unsigned int *status_tab_current)
-{
-    counters_t curr_ctr;
-    unsigned int ack, nb_errors, nb_skipped;
-
-    /* get current pass counters */
-    queue_stats2counters(pass_begin, pass_current, status_tab_begin,
-                         status_tab_current, &curr_ctr, NULL, &ack,
-                         &nb_errors, &nb_skipped);
-    /* add counters of previous passes */
-    counters_add(&curr_ctr, &policy->progress.action_ctr);
-    nb_skipped += policy->progress.skipped;
-    nb_errors += policy->progress.errors;
-
-    /* say hello every runtime interval */
-    if (time(NULL) - policy->progress.last_report >=
-        policy->config->report_interval) {
-        char buf1[128];
-        char buf2[128];
-        char buf3[128];
-        unsigned int spent = time(NULL) - policy->progress.policy_start;
-        if (spent == 0)
-            return;
-        FormatDuration(buf1, 128, spent);
-        FormatFileSize(buf2, 128, curr_ctr.vol);
-        FormatFileSize(buf3, 128, curr_ctr.vol / spent);
 
-        DisplayLog(LVL_EVENT, tag(policy),
-                   "Policy is running (started %s ago): "
-                   "%llu actions succeeded (%.2f/sec); volume: %s (%s/sec); "
-                   "skipped: %u; errors: %u", buf1, curr_ctr.count,
-                   (float)curr_ctr.count / (float)spent, buf2, buf3,
-                   nb_skipped, nb_errors);
-        policy->progress.last_report = time(NULL);
+/** can the result of an expression be kept until md_update changes? */
+static bool expr_markable(const bool_node_t *expr)
+{
+    switch (expr->node_type) {
+    case NODE_CONSTANT:
+        return true;
+    case NODE_UNARY_EXPR:
+        return expr_markable(expr->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        return expr_markable(expr->content_u.bool_expr.expr1)
+            && expr_markable(expr->content_u.bool_expr.expr2);
+    case NODE_CONDITION:
+        switch (expr->content_u.condition->crit) {
+        case CRITERIA_STATUS:
+        case CRITERIA_XATTR:
+        case CRITERIA_SM_INFO:
+        case CRITERIA_RMTIME:
+            return false;
+        default:
+            return true;
+        }
     }
+    return false;
 }
 
 /**
- * Wait until the queue is empty or migrations timed-out.
- * \retval 0 when the queue is empty
- * \retval ETIME on timeout.
+ * Lower the next time the result of an expression may change for an entry.
+ * @param time_min  if not 0, time conditions may be reduced down to
+ *                  this value by a time modifier (pre-maintenance).
  */
-static int wait_queue_empty(policy_info_t *policy,
-                            unsigned int nb_submitted,
-                            const unsigned long long *feedback_init,
-                            const unsigned int *status_tab_init,
-                            unsigned long long *feedback_after,
-                            unsigned int *status_tab_after,
-                            bool long_sleep)
+static void expr_next_change(const bool_node_t *expr, const attr_set_t *attrs,
+                             time_t time_min, time_t now, time_t *next)
 {
-    unsigned int nb_in_queue, nb_action_pending;
+    const compare_triplet_t *cond;
+    time_t t, thr, lo, hi;
 
-    /* Wait for end of policy pass */
-    do {
-        time_t last_push, last_pop, last_ack, last_activity;
+    switch (expr->node_type) {
+    case NODE_CONSTANT:
+        return;
+    case NODE_UNARY_EXPR:
+        expr_next_change(expr->content_u.bool_expr.expr1, attrs, time_min,
+                         now, next);
+        return;
+    case NODE_BINARY_EXPR:
+        expr_next_change(expr->content_u.bool_expr.expr1, attrs, time_min,
+                         now, next);
+        expr_next_change(expr->content_u.bool_expr.expr2, attrs, time_min,
+                         now, next);
+        return;
+    case NODE_CONDITION:
+        break;
+    }
 
-        last_push = last_pop = last_ack = last_activity = 0;
+    cond = expr->content_u.condition;
+    switch (cond->crit) {
+    case CRITERIA_LAST_ACCESS:
+        if (!ATTR_MASK_TEST(attrs, last_access))
+            goto no_mark;
+        t = ATTR(attrs, last_access);
+        break;
+    case CRITERIA_LAST_MOD:
+        if (!ATTR_MASK_TEST(attrs, last_mod))
+            goto no_mark;
+        t = ATTR(attrs, last_mod);
+        break;
+    case CRITERIA_LAST_MDCHANGE:
+        if (!ATTR_MASK_TEST(attrs, last_mdchange))
+            goto no_mark;
+        t = ATTR(attrs, last_mdchange);
+        break;
+    case CRITERIA_CREATION:
+        if (!ATTR_MASK_TEST(attrs, creation_time))
+            goto no_mark;
+        t = ATTR(attrs, creation_time);
+        break;
+    default:
+        /* only depends on attribute values */
+        return;
+    }
 
-        RetrieveQueueStats(&policy->queue, NULL, &nb_in_queue,
-                           &last_push, &last_pop, &last_ack,
-                           status_tab_after, feedback_after);
+    /* the condition compares (now - t) to the threshold: it may change
+     * when the age reaches the threshold, or right after it */
+    thr = cond->val.duration;
+    lo = t + ((time_min != 0 && time_min < thr) ? time_min : thr);
+    hi = t + thr + 1;
+
+    if (lo > now) {
+        if (lo < *next)
+            *next = lo;
+    } else if (hi > now) {
+        /* between the modified and the original threshold: the result
+         * depends on the current time modifier */
+        if (lo < t + thr)
+            goto no_mark;
+        if (hi < *next)
+            *next = hi;
+    }
+    return;
 
-        /* the last time a request was pushed/poped/acknowledged */
-        last_activity = MAX3(last_push, last_pop, last_ack);
+no_mark:
+    *next = now;
+}
 
-        /* nb of operation pending
-           = nb_enqueued - (nb ack after - nb ack before) */
-        nb_action_pending = nb_submitted + ack_count(status_tab_init)
-                            - ack_count(status_tab_after);
+/** does an expression have a condition on fileclass? */
+static bool expr_uses_class(const bool_node_t *expr)
+{
+    switch (expr->node_type) {
+    case NODE_UNARY_EXPR:
+        return expr_uses_class(expr->content_u.bool_expr.expr1);
+    case NODE_BINARY_EXPR:
+        return expr_uses_class(expr->content_u.bool_expr.expr1)
+            || expr_uses_class(expr->content_u.bool_expr.expr2);
+    case NODE_CONDITION:
+        return expr->content_u.condition->crit == CRITERIA_FILECLASS;
+    default:
+        return false;
+    }
+}
 
-        if ((nb_in_queue > 0) || (nb_action_pending > 0)) {
-            /* abort this pass if the last action was done a too long time
-             * ago */
-            if ((policy->config->action_timeout != 0) &&
-                (time(NULL) - last_activity >
-                 policy->config->action_timeout)) {
-                DisplayLog(LVL_MAJOR, tag(policy), "Policy run time-out: "
-                           "%u actions inactive for %us", nb_action_pending,
-                           (unsigned int)(time(NULL) - last_activity));
-                /* don't wait for current actions to end, continue with
-                 * other entries */
-                return ETIME;
-            }
+/** apply a function on the expressions that decide if an entry is ignored
+ *  or doesn't match a rule (@return false if it fails for one of them) */
+static bool policy_exprs_foreach(const policy_info_t *pol,
+                                 bool (*cb)(const bool_node_t *expr,
+                                            bool condition, void *arg),
+                                 void *arg)
+{
+    const policy_rules_t *rules = &pol->descr->rules;
+    bool uses_class = false;
+    unsigned int i, j;
 
-            report_progress(policy, feedback_init, feedback_after,
-                            status_tab_init, status_tab_after);
+    for (i = 0; i < rules->whitelist_count; i++) {
+        if (!cb(&rules->whitelist_rules[i].bool_expr, false, arg))
+            return false;
+        uses_class |= expr_uses_class(&rules->whitelist_rules[i].bool_expr);
+    }
+    for (i = 0; i < rules->ignore_count; i++)
+        if (!cb(&rules->ignore_list[i]->definition, false, arg))
+            return false;
+    for (i = 0; i < rules->rule_count; i++) {
+        for (j = 0; j < rules->rules[i].target_count; j++)
+            if (!cb(&rules->rules[i].target_list[j]->definition, false, arg))
+                return false;
+        if (!cb(&rules->rules[i].condition, true, arg))
+            return false;
+        uses_class |= expr_uses_class(&rules->rules[i].condition);
+    }
 
-            DisplayLog(LVL_DEBUG, tag(policy),
-                       "Waiting for the end of current pass: "
+    /* fileclass conditions depend on all fileclass definitions */
+    if (uses_class) {
+        for (i = 0; i < policies.fileset_count; i++)
+            if (policies.fileset_list[i].matchable
+                && !cb(&policies.fileset_list[i].definition, false, arg))
+                return false;
+    }
+    return true;
+}
+
+static bool markable_cb(const bool_node_t *expr, bool condition, void *arg)
+{
+    return expr_markable(expr);
+}
+
+static bool sig_cb(const bool_node_t *expr, bool condition, void *arg)
+{
+    char buff[4096];
+
+    if (BoolExpr2str((bool_node_t *)expr, buff, sizeof(buff)) < 0)
+        return false;
+    g_string_append_printf((GString *)arg, "%s%s;", condition ? "if:" : "",
+                           buff);
+    return true;
+}
+
+struct next_change_arg {
+    const attr_set_t *attrs;
+    time_t            time_min;
+    time_t            now;
+    time_t            next;
+};
+
+static bool next_change_cb(const bool_node_t *expr, bool condition,
+                           void *arg)
+{
+    struct next_change_arg *nc = arg;
+
+    /* time modifiers only apply to rule conditions */
+    expr_next_change(expr, nc->attrs, condition ? nc->time_min : 0, nc->now,
+                     &nc->next);
+    /* stop as soon as no mark can be set */
+    return nc->next > nc->now;
+}
+
+/** min value of time conditions with a time modifier (0 if none) */
+static time_t marks_time_min(const policy_info_t *pol)
+{
+    /* time modifiers are only set in pre-maintenance windows */
+    if (pol->config->pre_maintenance_window > 0)
+        return pol->config->maint_min_apply_delay;
+    if (pol->time_modifier != NULL)
+        return pol->time_modifier->time_min;
+    return 0;
+}
+
+/**
+ * Prepare the ignore marks of a policy run: check they can be used with
+ * the policy rules, and drop them if the rules changed since the last run.
+ */
+static void marks_init(policy_info_t *pol, lmgr_t *lmgr)
+{
+    GString *sig;
+    uint64_t h = 14695981039346656037ULL;   /* FNV-1a */
+    char hash[32];
+    const char *c;
+    int rc;
+
+    pol->marks = 0;
+
+    if (pol->config->ignore_mark_max_validity == 0
+        || pol->config->recheck_ignored_entries
+        || pol->descr->manage_deleted || ignore_policies(pol))
+        return;
+
+    if (!policy_exprs_foreach(pol, markable_cb, NULL)) {
+        DisplayLog(LVL_VERB, tag(pol), "Ignore marks are not used: policy "
+                   "rules or fileclasses depend on status or extended "
+                   "attributes");
+        return;
+    }
+
+    /* marks are not valid anymore if rules change */
+    sig = g_string_new(NULL);
+    g_string_printf(sig, "maint=%lu,%lu;",
+                    (unsigned long)pol->config->pre_maintenance_window,
+                    (unsigned long)pol->config->maint_min_apply_delay);
+    if (!policy_exprs_foreach(pol, sig_cb, sig)) {
+        g_string_free(sig, TRUE);
+        return;
+    }
+    for (c = sig->str; *c != '\0'; c++) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    g_string_free(sig, TRUE);
+    snprintf(hash, sizeof(hash), "%016" PRIx64, h);
+
+    rc = ListMgr_CheckIgnoreMarks(lmgr, tag(pol), hash);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, tag(pol), "Error %d checking ignore marks: "
+                   "they are not used for this run", rc);
+        return;
+    }
+    pol->marks = 1;
+}
+
+/** skip the entries with a valid ignore mark when listing candidates */
+static inline void marks_iter_opt(const policy_info_t *pol,
+                                  lmgr_iter_opt_t *opt)
+{
+    if (pol->marks)
+        opt->skip_marked = tag(pol);
+}
+
+/**
+ * report the current policy run progress at regular interval.
+ */
+/** argument of a worker thread */
+struct worker_arg {
+    policy_info_t  *pol;
+    unsigned int    idx;
+};
+
+/**
+ * Worker threads of a policy. All threads up to the max pool size are
+ * started, and the ones over the current pool size wait until the pool
+ * grows again (holding no DB connection).
+ * In adaptive mode, the pool size is adjusted by hill climbing on the
+ * throughput of actions: the size keeps changing in the same direction
+ * while throughput improves, and goes back when it drops.
+ */
+struct worker_pool {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    unsigned int        active;     /**< workers allowed to run */
+    unsigned int        min;
+    unsigned int        max;
+    unsigned int        started;    /**< started threads */
+    pthread_t           adapt_thr;
+    bool                adapt_started;
+
+    /* adaptive sizing state */
+    int                 dir;        /**< last change: -1, 0 or 1 */
+    unsigned int        hold;       /**< periods to wait before probing */
+    double              prev_rate;
+    unsigned long long  prev_ack;
+    unsigned long long  prev_errors;
+    unsigned long long  prev_usec;
+    unsigned long long  prev_count;
+    char                decision[256];
+};
+
+/* interval between pool size evaluations */
+#define POOL_ADAPT_INTERVAL 15
+/* stable periods before probing a larger pool again */
+#define POOL_HOLD_PERIODS   4
+/* throughput changes under 5% are not significant */
+#define POOL_RATE_TOLERANCE 0.05
+/* shrink the pool when more than 10% of actions fail */
+#define POOL_MAX_ERROR_RATE 0.1
+
+static inline bool adaptive_pool(const policy_info_t *pol)
+{
+    return pol->pool != NULL && pol->pool->min < pol->pool->max;
+}
+
+/** wait until this worker is part of the pool */
+static void pool_wait_active(struct worker_pool *pool, unsigned int idx)
+{
+    P(pool->lock);
+    while (idx >= pool->active)
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    V(pool->lock);
+}
+
+/** change the pool size (called with pool lock held) */
+static void pool_resize(policy_info_t *pol, int dir, unsigned int size,
+                        const char *reason)
+{
+    struct worker_pool *pool = pol->pool;
+
+    size = MIN2(MAX2(size, pool->min), pool->max);
+    if (size == pool->active) {
+        pool->dir = 0;
+        snprintf(pool->decision, sizeof(pool->decision), "keeping %u "
+                 "workers (%s)", size, reason);
+        return;
+    }
+
+    snprintf(pool->decision, sizeof(pool->decision), "%s to %u workers (%s)",
+             size > pool->active ? "growing" : "shrinking", size, reason);
+    DisplayLog(LVL_VERB, tag(pol), "Worker pool: %s", pool->decision);
+
+    pool->dir = dir;
+    pool->active = size;
+    pthread_cond_broadcast(&pool->cond);
+}
+
+/** evaluate the pool size from the last period statistics */
+static void pool_adapt(policy_info_t *pol, time_t period)
+{
+    struct worker_pool *pool = pol->pool;
+    unsigned int status_tab[AS_ENUM_COUNT];
+    unsigned long long ack, errors, usec, count;
+    unsigned long long d_ack, d_errors, d_count;
+    unsigned int nb_in_queue, step;
+    double rate, latency = 0.0;
+    char reason[128];
+
+    RetrieveQueueStats(&pol->queue, NULL, &nb_in_queue, NULL, NULL, NULL,
+                       status_tab, NULL);
+    ack = ack_count(status_tab);
+    errors = error_count(status_tab);
+    /* action counters are reset at the beginning of each run */
+    usec = pol->action_usec;
+    count = pol->action_count;
+    if (count < pool->prev_count || usec < pool->prev_usec)
+        pool->prev_count = pool->prev_usec = 0;
+
+    d_ack = ack - pool->prev_ack;
+    d_errors = errors - pool->prev_errors;
+    d_count = count - pool->prev_count;
+    if (d_count > 0)
+        latency = (double)(usec - pool->prev_usec) / d_count / 1000.0;
+    rate = (double)(d_ack - d_errors) / period;
+
+    pool->prev_ack = ack;
+    pool->prev_errors = errors;
+    pool->prev_usec = usec;
+    pool->prev_count = count;
+
+    snprintf(reason, sizeof(reason), "%.2f actions/sec, latency %.2fms",
+             rate, latency);
+
+    P(pool->lock);
+    step = MAX2(pool->active / 4, 1);
+
+    if (d_ack > 0 && d_errors > POOL_MAX_ERROR_RATE * d_ack) {
+        /* actions fail or time out: back off */
+        strncat(reason, ", errors", sizeof(reason) - strlen(reason) - 1);
+        pool_resize(pol, -1, pool->active / 2, reason);
+        pool->hold = POOL_HOLD_PERIODS;
+    } else if (nb_in_queue == 0 && d_ack == 0) {
+        /* no work: nothing to measure */
+        pool->dir = 0;
+        snprintf(pool->decision, sizeof(pool->decision), "keeping %u "
+                 "workers (idle)", pool->active);
+    } else if (pool->dir != 0 && rate < pool->prev_rate
+                                        * (1.0 - POOL_RATE_TOLERANCE)) {
+        /* last change made it worse: go back and stay there */
+        strncat(reason, ", throughput decreased",
+                sizeof(reason) - strlen(reason) - 1);
+        pool_resize(pol, -pool->dir, pool->dir > 0 ? pool->active - step
+                    : pool->active + step, reason);
+        pool->dir = 0;
+        pool->hold = POOL_HOLD_PERIODS;
+    } else if (pool->dir != 0 && rate > pool->prev_rate
+                                        * (1.0 + POOL_RATE_TOLERANCE)) {
+        /* last change improved throughput: continue */
+        strncat(reason, ", throughput increased",
+                sizeof(reason) - strlen(reason) - 1);
+        pool_resize(pol, pool->dir, pool->dir > 0 ? pool->active + step
+                    : pool->active - step, reason);
+    } else if (pool->hold > 0) {
+        pool->hold--;
+        pool->dir = 0;
+        snprintf(pool->decision, sizeof(pool->decision), "keeping %u "
+                 "workers (%s)", pool->active, reason);
+    } else if (nb_in_queue > 0) {
+        /* candidates are waiting: probe a larger pool */
+        strncat(reason, ", entries waiting",
+                sizeof(reason) - strlen(reason) - 1);
+        pool_resize(pol, 1, pool->active + step, reason);
+        if (pool->dir == 0)
+            pool->hold = POOL_HOLD_PERIODS;
+    } else {
+        pool->dir = 0;
+        snprintf(pool->decision, sizeof(pool->decision), "keeping %u "
+                 "workers (%s)", pool->active, reason);
+    }
+    pool->prev_rate = rate;
+    V(pool->lock);
+}
+
+static void *thr_pool_adapt(void *arg)
+{
+    policy_info_t *pol = arg;
+
+    for (;;) {
+        rh_sleep(POOL_ADAPT_INTERVAL);
+        /* the pool may have become fixed after a config reload */
+        if (adaptive_pool(pol))
+            pool_adapt(pol, POOL_ADAPT_INTERVAL);
+    }
+    return NULL;
+}
+
+static void report_progress(policy_info_t *policy,
+                            const unsigned long long *pass_begin,
+                            const unsigned long long *pass_current,
+                            const unsigned int *status_tab_begin,
+                            const unsigned int *status_tab_current)
+{
+    counters_t curr_ctr;
+    unsigned int ack, nb_errors, nb_skipped;
+
+    /* get current pass counters */
+    queue_stats2counters(pass_begin, pass_current, status_tab_begin,
+                         status_tab_current, &curr_ctr, NULL, &ack,
+                         &nb_errors, &nb_skipped);
+    /* add counters of previous passes */
+    counters_add(&curr_ctr, &policy->progress.action_ctr);
+    nb_skipped += policy->progress.skipped;
+    nb_errors += policy->progress.errors;
+
+    /* say hello every runtime interval */
+    if (time(NULL) - policy->progress.last_report >=
+        policy->config->report_interval) {
+        char buf1[128];
+        char buf2[128];
+        char buf3[128];
+        unsigned int spent = time(NULL) - policy->progress.policy_start;
+        if (spent == 0)
+            return;
+        FormatDuration(buf1, 128, spent);
+        FormatFileSize(buf2, 128, curr_ctr.vol);
+        FormatFileSize(buf3, 128, curr_ctr.vol / spent);
+
+        DisplayLog(LVL_EVENT, tag(policy),
+                   "Policy is running (started %s ago): "
+                   "%llu actions succeeded (%.2f/sec); volume: %s (%s/sec); "
+                   "skipped: %u; errors: %u", buf1, curr_ctr.count,
+                   (float)curr_ctr.count / (float)spent, buf2, buf3,
+                   nb_skipped, nb_errors);
+
+        if (adaptive_pool(policy)) {
+            struct worker_pool *pool = policy->pool;
+
+            P(pool->lock);
+            DisplayLog(LVL_EVENT, tag(policy), "Worker pool: %u/%u workers "
+                       "(min: %u), last decision: %s", pool->active,
+                       pool->max, pool->min,
+                       pool->decision[0] ? pool->decision : "none");
+            V(pool->lock);
+        }
+        policy->progress.last_report = time(NULL);
+    }
+}
+
+/**
+ * Wait until the queue is empty or migrations timed-out.
+ * \retval 0 when the queue is empty
+ * \retval ETIME on timeout.
+ */
+static int wait_queue_empty(policy_info_t *policy,
+                            unsigned int nb_submitted,
+                            const unsigned long long *feedback_init,
+                            const unsigned int *status_tab_init,
+                            unsigned long long *feedback_after,
+                            unsigned int *status_tab_after,
+                            bool long_sleep)
+{
+    unsigned int nb_in_queue, nb_action_pending;
+
+    /* Wait for end of policy pass */
+    do {
+        time_t last_push, last_pop, last_ack, last_activity;
+
+        last_push = last_pop = last_ack = last_activity = 0;
+
+        RetrieveQueueStats(&policy->queue, NULL, &nb_in_queue,
+                           &last_push, &last_pop, &last_ack,
+                           status_tab_after, feedback_after);
+
+        /* the last time a request was pushed/poped/acknowledged */
+        last_activity = MAX3(last_push, last_pop, last_ack);
+
+        /* nb of operation pending
+           = nb_enqueued - (nb ack after - nb ack before) */
+        nb_action_pending = nb_submitted + ack_count(status_tab_init)
+                            - ack_count(status_tab_after);
+
+        if ((nb_in_queue > 0) || (nb_action_pending > 0)) {
+            /* abort this pass if the last action was done a too long time
+             * ago */
+            if ((policy->config->action_timeout != 0) &&
+                (time(NULL) - last_activity >
+                 policy->config->action_timeout)) {
+                DisplayLog(LVL_MAJOR, tag(policy), "Policy run time-out: "
+                           "%u actions inactive for %us", nb_action_pending,
+                           (unsigned int)(time(NULL) - last_activity));
+                /* don't wait for current actions to end, continue with
+                 * other entries */
+                return ETIME;
+            }
+
+            report_progress(policy, feedback_init, feedback_after,
+                            status_tab_init, status_tab_after);
+
+            DisplayLog(LVL_DEBUG, tag(policy),
+                       "Waiting for the end of current pass: "
                        "still %u entries pending (%u in queue, %u being processed). "
                        "Last action %us ago.",
                        nb_action_pending, nb_in_queue,
@@ -1005,9 +1830,10 @@ static attr_mask_t db_attr_mask(policy_info_t *policy,
     /* needed for posix operations, and for display */
     mask.std |= ATTR_MASK_fullpath;
 
-    /* needed if update params != never */
-    if (updt_params.md.when != UPDT_NEVER &&
-        updt_params.md.when != UPDT_ALWAYS)
+    /* needed if update params != never, and for ignore marks */
+    if ((updt_params.md.when != UPDT_NEVER &&
+         updt_params.md.when != UPDT_ALWAYS)
+        || policy->config->ignore_mark_max_validity > 0)
         mask.std |= ATTR_MASK_md_update;
 
 #ifdef _HAVE_FID
@@ -1255,90 +2081,392 @@ static void init_pass_stats(policy_info_t *pol, counters_t *pushed_ctr,
     memset(status_tab_after, 0, AS_ENUM_COUNT * sizeof(*status_tab_after));
 }
 
-static void update_pass_stats(policy_info_t *pol,
-                              unsigned int *status_tab_before,
-                              unsigned int *status_tab_after,
-                              unsigned long long *feedback_before,
-                              unsigned long long *feedback_after)
+/** add the progress of a pass to a summary */
+static void add_pass_stats(action_summary_t *sum,
+                           unsigned int *status_tab_before,
+                           unsigned int *status_tab_after,
+                           unsigned long long *feedback_before,
+                           unsigned long long *feedback_after)
 {
     /* how much has been processed, errors, skipped... */
-    pol->progress.action_ctr.count += feedback_after[AF_NBR_OK]
+    sum->action_ctr.count += feedback_after[AF_NBR_OK]
         - feedback_before[AF_NBR_OK];
-    pol->progress.action_ctr.vol += feedback_after[AF_VOL_OK]
+    sum->action_ctr.vol += feedback_after[AF_VOL_OK]
         - feedback_before[AF_VOL_OK];
-    pol->progress.action_ctr.blocks += feedback_after[AF_BLOCKS_OK]
+    sum->action_ctr.blocks += feedback_after[AF_BLOCKS_OK]
         - feedback_before[AF_BLOCKS_OK];
-    pol->progress.action_ctr.targeted += feedback_after[AF_TARGETED_OK]
+    sum->action_ctr.targeted += feedback_after[AF_TARGETED_OK]
         - feedback_before[AF_TARGETED_OK];
-    pol->progress.skipped += skipped_count(status_tab_after)
+    sum->skipped += skipped_count(status_tab_after)
         - skipped_count(status_tab_before);
-    pol->progress.errors += error_count(status_tab_after)
+    sum->errors += error_count(status_tab_after)
         - error_count(status_tab_before);
 }
 
+static void update_pass_stats(policy_info_t *pol,
+                              unsigned int *status_tab_before,
+                              unsigned int *status_tab_after,
+                              unsigned long long *feedback_before,
+                              unsigned long long *feedback_after)
+{
+    add_pass_stats(&pol->progress, status_tab_before, status_tab_after,
+                   feedback_before, feedback_after);
+}
+
 /* these types allow generic iteration on std entries or removed entries */
 
-typedef enum { IT_LIST, IT_RMD } it_type_e;
+typedef enum { IT_LIST, IT_RMD, IT_MERGE } it_type_e;
+
+struct merge_iter;
 
 struct policy_iter {
     it_type_e it_type;
     union {
         struct lmgr_iterator_t *std_iter;
         struct lmgr_rm_list_t *rmd_iter;
+        struct merge_iter *merge_iter;
     } it;
+    /* position of the last listed entry (to continue the list after it) */
+    lmgr_iter_pos_t pos;
 };
 
-static inline int iter_next(struct policy_iter *it, entry_id_t *p_id,
-                            attr_set_t *p_attrs)
+/* entries read in advance by each shard listing thread */
+#define SHARD_BUFFER_SIZE 256
+
+struct shard_entry {
+    entry_id_t id;
+    attr_set_t attrs;
+};
+
+/** a subset of candidates, listed by a dedicated thread and connection */
+struct list_shard {
+    struct merge_iter      *merge;
+    pthread_t               thread;
+    bool                    started;
+    lmgr_t                 *lmgr;
+    struct lmgr_iterator_t *it;
+
+    /* circular buffer of listed entries */
+    struct shard_entry      buffer[SHARD_BUFFER_SIZE];
+    unsigned int            first;
+    unsigned int            count;
+    bool                    eol;    /* no more entries to be listed */
+    int                     rc;     /* iterator status at eol */
+};
+
+/**
+ * Candidates listed in parallel by several iterators, each returning
+ * entries of a shard in sort order. The next entry is the first one
+ * of all shards in this order.
+ */
+struct merge_iter {
+    policy_info_t          *pol;
+    attr_mask_t             attr_mask;
+    bool                    sorted;
+    unsigned int            shard_count;
+    struct list_shard      *shards;
+
+    /* protects the buffers of all shards */
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    bool                    stop;
+};
+
+static void *shard_list_thr(void *arg)
 {
-    switch (it->it_type) {
-    case IT_LIST:
-        return ListMgr_GetNext(it->it.std_iter, p_id, p_attrs);
-    case IT_RMD:
-        return ListMgr_GetNextRmEntry(it->it.rmd_iter, p_id, p_attrs);
+    struct list_shard *shard = arg;
+    struct merge_iter *m = shard->merge;
+
+    prof_set_role(PROF_ROLE_POLICY, "list");
+
+    for (;;) {
+        struct shard_entry e;
+        int rc;
+
+        memset(&e, 0, sizeof(e));
+        e.attrs.attr_mask = m->attr_mask;
+        rc = ListMgr_GetNext(shard->it, &e.id, &e.attrs);
+
+        P(m->lock);
+        if (rc != DB_SUCCESS) {
+            shard->eol = true;
+            shard->rc = rc;
+            pthread_cond_broadcast(&m->cond);
+            V(m->lock);
+            break;
+        }
+
+        while (shard->count == SHARD_BUFFER_SIZE && !m->stop)
+            pthread_cond_wait(&m->cond, &m->lock);
+
+        if (m->stop) {
+            V(m->lock);
+            ListMgr_FreeAttrs(&e.attrs);
+            break;
+        }
+
+        shard->buffer[(shard->first + shard->count) % SHARD_BUFFER_SIZE] = e;
+        shard->count++;
+        pthread_cond_broadcast(&m->cond);
+        V(m->lock);
     }
-    return DB_INVALID_ARG;
+    return NULL;
 }
 
-static inline void iter_close(struct policy_iter *it)
+/** choose the shard of the next entry (-1 if there is none).
+ * Must be called with the merge lock held.
+ * @param[out] wait  the next entry is not known yet */
+static int merge_next_shard(struct merge_iter *m, bool *wait)
 {
-    switch (it->it_type) {
-    case IT_LIST:
-        if (it->it.std_iter == NULL)
-            return;
-        ListMgr_CloseIterator(it->it.std_iter);
-        it->it.std_iter = NULL;
-        break;
-    case IT_RMD:
-        if (it->it.rmd_iter == NULL)
-            return;
-        ListMgr_CloseRmList(it->it.rmd_iter);
-        it->it.rmd_iter = NULL;
-        break;
+    unsigned int i;
+    int best = -1;
+    int best_val = 0;
+
+    *wait = false;
+    for (i = 0; i < m->shard_count; i++) {
+        struct list_shard *shard = &m->shards[i];
+        int val;
+
+        if (shard->count == 0) {
+            /* the next entry of this shard may come first */
+            if (!shard->eol && m->sorted)
+                *wait = true;
+            else if (!shard->eol)
+                *wait = (best == -1);
+            continue;
+        }
+        if (!m->sorted) {
+            *wait = false;
+            return i;
+        }
+
+        /* NULL values (-1) come first, as in the DB sort order */
+        val = get_sort_attr(m->pol, &shard->buffer[shard->first].attrs);
+        if (best == -1 || val < best_val) {
+            best = i;
+            best_val = val;
+        }
     }
+    return best;
 }
 
-static inline int iter_open(lmgr_t *lmgr,
-                            it_type_e type,
-                            struct policy_iter *it,
-                            lmgr_filter_t *filter,
-                            const lmgr_sort_type_t *sort_type,
-                            const lmgr_iter_opt_t *opt)
+static int merge_next(struct merge_iter *m, entry_id_t *p_id,
+                      attr_set_t *p_attrs)
 {
-    it->it_type = type;
-    switch (type) {
-    case IT_LIST:
-        it->it.std_iter = ListMgr_Iterator(lmgr, filter, sort_type, opt);
-        if (it->it.std_iter == NULL)
-            return DB_REQUEST_FAILED;
-        break;
+    struct list_shard *shard;
+    unsigned int i;
+    bool wait;
+    int idx;
 
-    case IT_RMD:
-        it->it.rmd_iter = ListMgr_RmList(lmgr, filter, sort_type);
-        if (it->it.rmd_iter == NULL)
-            return DB_REQUEST_FAILED;
-        break;
+    P(m->lock);
+    while ((idx = merge_next_shard(m, &wait)) == -1 || wait) {
+        if (!wait)
+            break;
+        pthread_cond_wait(&m->cond, &m->lock);
     }
+
+    if (idx == -1) {
+        int rc = DB_END_OF_LIST;
+
+        /* report shard errors */
+        for (i = 0; i < m->shard_count; i++)
+            if (m->shards[i].rc != DB_END_OF_LIST)
+                rc = m->shards[i].rc;
+        V(m->lock);
+        return rc;
+    }
+
+    shard = &m->shards[idx];
+    *p_id = shard->buffer[shard->first].id;
+    /* the caller gets the ownership of attribute values */
+    *p_attrs = shard->buffer[shard->first].attrs;
+    shard->first = (shard->first + 1) % SHARD_BUFFER_SIZE;
+    shard->count--;
+    pthread_cond_broadcast(&m->cond);
+    V(m->lock);
+    return DB_SUCCESS;
+}
+
+static void merge_close(struct merge_iter *m)
+{
+    unsigned int i;
+
+    P(m->lock);
+    m->stop = true;
+    pthread_cond_broadcast(&m->cond);
+    V(m->lock);
+
+    for (i = 0; i < m->shard_count; i++) {
+        struct list_shard *shard = &m->shards[i];
+
+        if (shard->started)
+            pthread_join(shard->thread, NULL);
+
+        for (; shard->count > 0; shard->count--) {
+            ListMgr_FreeAttrs(&shard->buffer[shard->first].attrs);
+            shard->first = (shard->first + 1) % SHARD_BUFFER_SIZE;
+        }
+        if (shard->it != NULL)
+            ListMgr_CloseIterator(shard->it);
+        if (shard->lmgr != NULL)
+            ListMgr_Release(shard->lmgr);
+    }
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->lock);
+    MemFree(m->shards);
+    MemFree(m);
+}
+
+static struct merge_iter *merge_open(policy_info_t *pol,
+                                     lmgr_filter_t *filter,
+                                     const lmgr_sort_type_t *sort_type,
+                                     const lmgr_iter_opt_t *opt,
+                                     attr_mask_t attr_mask)
+{
+    struct merge_iter *m;
+    lmgr_iter_opt_t shard_opt = *opt;
+    unsigned int i;
+
+    m = MemCalloc(1, sizeof(*m));
+    if (m == NULL)
+        return NULL;
+    m->shards = MemCalloc(pol->config->db_list_shards, sizeof(*m->shards));
+    if (m->shards == NULL) {
+        MemFree(m);
+        return NULL;
+    }
+    m->pol = pol;
+    m->attr_mask = attr_mask;
+    m->sorted = (sort_type->order != SORT_NONE);
+    m->shard_count = pol->config->db_list_shards;
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+
+    /* each shard streams all its entries */
+    shard_opt.list_count_max = 0;
+    shard_opt.stream = 1;
+    shard_opt.after = NULL;
+    shard_opt.shard_count = m->shard_count;
+
+    for (i = 0; i < m->shard_count; i++) {
+        struct list_shard *shard = &m->shards[i];
+
+        shard->merge = m;
+        shard->lmgr = ListMgr_Checkout();
+        if (shard->lmgr == NULL)
+            goto err;
+
+        shard_opt.shard_index = i;
+        shard->it = ListMgr_Iterator(shard->lmgr, filter, sort_type,
+                                     &shard_opt);
+        if (shard->it == NULL)
+            goto err;
+    }
+
+    for (i = 0; i < m->shard_count; i++) {
+        struct list_shard *shard = &m->shards[i];
+
+        if (pthread_create(&shard->thread, NULL, shard_list_thr, shard) != 0) {
+            DisplayLog(LVL_CRIT, tag(pol), "Error creating listing thread: %s",
+                       strerror(errno));
+            goto err;
+        }
+        shard->started = true;
+    }
+    return m;
+
+err:
+    merge_close(m);
+    return NULL;
+}
+
+static inline int iter_next(struct policy_iter *it, entry_id_t *p_id,
+                            attr_set_t *p_attrs)
+{
+    switch (it->it_type) {
+    case IT_LIST:
+        return ListMgr_GetNext(it->it.std_iter, p_id, p_attrs);
+    case IT_RMD:
+        return ListMgr_GetNextRmEntry(it->it.rmd_iter, p_id, p_attrs);
+    case IT_MERGE:
+        return merge_next(it->it.merge_iter, p_id, p_attrs);
+    }
+    return DB_INVALID_ARG;
+}
+
+static inline void iter_close(struct policy_iter *it)
+{
+    switch (it->it_type) {
+    case IT_LIST:
+        if (it->it.std_iter == NULL)
+            return;
+        ListMgr_IterPosition(it->it.std_iter, &it->pos);
+        ListMgr_CloseIterator(it->it.std_iter);
+        it->it.std_iter = NULL;
+        break;
+    case IT_RMD:
+        if (it->it.rmd_iter == NULL)
+            return;
+        ListMgr_CloseRmList(it->it.rmd_iter);
+        it->it.rmd_iter = NULL;
+        break;
+    case IT_MERGE:
+        if (it->it.merge_iter == NULL)
+            return;
+        merge_close(it->it.merge_iter);
+        it->it.merge_iter = NULL;
+        break;
+    }
+}
+
+static inline int iter_open(policy_info_t *pol,
+                            lmgr_t *lmgr,
+                            it_type_e type,
+                            struct policy_iter *it,
+                            lmgr_filter_t *filter,
+                            const lmgr_sort_type_t *sort_type,
+                            const lmgr_iter_opt_t *opt,
+                            attr_mask_t attr_mask)
+{
+    struct timeval t0;
+
+    gettimeofday(&t0, NULL);
+
+    /* list entries in parallel if configured, else fall back to a single
+     * iterator */
+    if (type != IT_RMD && pol->config->db_list_shards > 1
+        && sort_type->order != SORT_NONE) {
+        it->it_type = IT_MERGE;
+        it->it.merge_iter = merge_open(pol, filter, sort_type, opt,
+                                       attr_mask);
+        if (it->it.merge_iter != NULL) {
+            policy_metrics_add(pol, PHASE_LIST, &t0);
+            return DB_SUCCESS;
+        }
+
+        DisplayLog(LVL_MAJOR, tag(pol), "Could not list candidates with %u "
+                   "parallel requests: using a single request",
+                   pol->config->db_list_shards);
+        type = IT_LIST;
+    }
+
+    it->it_type = type;
+    switch (type) {
+    case IT_LIST:
+    case IT_MERGE:
+        it->it_type = IT_LIST;
+        it->it.std_iter = ListMgr_Iterator(lmgr, filter, sort_type, opt);
+        if (it->it.std_iter == NULL)
+            return DB_REQUEST_FAILED;
+        break;
+
+    case IT_RMD:
+        it->it.rmd_iter = ListMgr_RmList(lmgr, filter, sort_type);
+        if (it->it.rmd_iter == NULL)
+            return DB_REQUEST_FAILED;
+        break;
+    }
+    policy_metrics_add(pol, PHASE_LIST, &t0);
     return DB_SUCCESS;
 }
 
@@ -1350,6 +2478,181 @@ typedef enum {
     PASS_ERROR,
 } pass_status_e;
 
+/* ==== run checkpoints ====
+ * When candidates are listed with several DB requests, a request is only
+ * issued once all entries of the previous one have been processed.
+ * At this point, the sort key and id of the last listed entry are saved in
+ * the DB with the run counters, so a run interrupted by a daemon restart
+ * can continue after this entry, instead of listing all candidates again.
+ */
+#ifdef _HAVE_FID
+#define CKPT_FID_FMT DFID_NOBRACE
+#else
+#define CKPT_FID_FMT "0X" DFID
+#endif
+
+/** checkpoints can only be used when listing with a single iterator,
+ * in the sort order, with several requests */
+static inline bool ckpt_enabled(const policy_info_t *pol)
+{
+    return !pol->descr->manage_deleted && pol->config->db_list_shards <= 1
+        && pol->config->lru_sort_attr != LRU_ATTR_NONE
+        && pol->config->db_request_limit > 0;
+}
+
+static void ckpt_varname(const policy_info_t *pol, char *buff, size_t size)
+{
+    snprintf(buff, size, "%s_%s", POLICY_CKPT_PREFIX, tag(pol));
+}
+
+/** identify the target of a run */
+static void ckpt_target(const policy_param_t *p_param, char *buff,
+                        size_t size)
+{
+    switch (p_param->target) {
+#ifdef _LUSTRE
+    case TGT_OST:
+        snprintf(buff, size, "%d:%d", p_param->target,
+                 p_param->optarg_u.index);
+        break;
+    case TGT_POOL:
+#endif
+    case TGT_USER:
+    case TGT_GROUP:
+    case TGT_CLASS:
+        snprintf(buff, size, "%d:%s", p_param->target,
+                 p_param->optarg_u.name);
+        break;
+    default:
+        snprintf(buff, size, "%d", p_param->target);
+    }
+}
+
+/**
+ * Save the position of a run, after all listed entries were processed.
+ * @param done  progress of the run, including the current pass.
+ */
+static void ckpt_save(policy_info_t *pol, const policy_param_t *p_param,
+                      lmgr_t *lmgr, const action_summary_t *done,
+                      const lmgr_iter_pos_t *pos)
+{
+    const action_summary_t *prev = &pol->resumed;
+    char varname[256];
+    char target[256];
+    char value[MAX_VAR_LEN];
+    int len;
+
+    ckpt_varname(pol, varname, sizeof(varname));
+    ckpt_target(p_param, target, sizeof(target));
+
+    len = snprintf(value, sizeof(value), "target=%s,sort=%u,start=%ld,"
+                   "count=%llu,vol=%llu,skipped=%u,errors=%u,"
+                   "id="CKPT_FID_FMT",null=%d,value=%s", target,
+                   pol->config->lru_sort_attr,
+                   (long)(prev->policy_start ? prev->policy_start :
+                          done->policy_start),
+                   prev->action_ctr.count + done->action_ctr.count,
+                   prev->action_ctr.vol + done->action_ctr.vol,
+                   prev->skipped + done->skipped,
+                   prev->errors + done->errors, PFID(&pos->id),
+                   pos->sort_null ? 1 : 0, pos->sort_val);
+    /* too long sort value: no checkpoint */
+    if (len >= sizeof(value))
+        return;
+
+    if (ListMgr_SetVar(lmgr, varname, value)) {
+        DisplayLog(LVL_MAJOR, tag(pol), "Failed to save run checkpoint "
+                   "in DB (%s)", varname);
+        return;
+    }
+    pol->checkpoint = 1;
+}
+
+/**
+ * Load the checkpoint of an interrupted run with the same target and sort
+ * order, to continue after its last processed entry.
+ * @return true if a checkpoint was loaded.
+ */
+static bool ckpt_load(policy_info_t *pol, const policy_param_t *p_param,
+                      lmgr_t *lmgr, lmgr_iter_pos_t *pos)
+{
+    action_summary_t *prev = &pol->resumed;
+    char varname[256];
+    char target[256];
+    char saved_target[256];
+    char value[MAX_VAR_LEN];
+    char date[128];
+    struct tm stm;
+    unsigned int sort_attr;
+    const char *c;
+    long start;
+    int null, n = 0;
+
+    ckpt_varname(pol, varname, sizeof(varname));
+    if (ListMgr_GetVar(lmgr, varname, value, sizeof(value)) != DB_SUCCESS)
+        return false;
+
+    /* there is a checkpoint: it is replaced or cleared by this run */
+    pol->checkpoint = 1;
+
+    if (sscanf(value, "target=%255[^,],sort=%u,start=%ld,count=%llu,"
+               "vol=%llu,skipped=%u,errors=%u,id=%n", saved_target,
+               &sort_attr, &start, &prev->action_ctr.count,
+               &prev->action_ctr.vol, &prev->skipped, &prev->errors, &n) < 7
+        || n == 0)
+        goto invalid;
+    if (sscanf(value + n, SFID, RFID(&pos->id)) != FID_SCAN_CNT)
+        goto invalid;
+    c = strstr(value + n, ",null=");
+    n = 0;
+    if (c == NULL || sscanf(c, ",null=%d,value=%n", &null, &n) < 1 || n == 0
+        || strlen(c + n) >= sizeof(pos->sort_val))
+        goto invalid;
+
+    ckpt_target(p_param, target, sizeof(target));
+    if (strcmp(target, saved_target) != 0
+        || sort_attr != pol->config->lru_sort_attr) {
+        DisplayLog(LVL_DEBUG, tag(pol), "Ignoring the checkpoint of a run "
+                   "with another target or sort order");
+        memset(prev, 0, sizeof(*prev));
+        return false;
+    }
+
+    strcpy(pos->sort_val, c + n);
+    pos->sort_null = (null != 0);
+    pos->set = true;
+    prev->policy_start = start;
+
+    strftime(date, sizeof(date), "%Y/%m/%d %T",
+             localtime_r(&prev->policy_start, &stm));
+    DisplayLog(LVL_EVENT, tag(pol), "Resuming the run started on %s "
+               "(%llu actions, %llu bytes, %u skipped, %u errors so far)",
+               date, prev->action_ctr.count, prev->action_ctr.vol,
+               prev->skipped, prev->errors);
+    return true;
+
+invalid:
+    DisplayLog(LVL_MAJOR, tag(pol), "Ignoring invalid run checkpoint "
+               "'%s' = '%s'", varname, value);
+    memset(prev, 0, sizeof(*prev));
+    return false;
+}
+
+/** remove the checkpoint of a completed run */
+static void ckpt_clear(policy_info_t *pol, lmgr_t *lmgr)
+{
+    char varname[256];
+
+    if (!pol->checkpoint)
+        return;
+
+    ckpt_varname(pol, varname, sizeof(varname));
+    if (ListMgr_SetVar(lmgr, varname, NULL))
+        DisplayLog(LVL_MAJOR, tag(pol), "Failed to remove run checkpoint "
+                   "from DB (%s)", varname);
+    pol->checkpoint = 0;
+}
+
 /**
 * Get entries from the DB and push them to the workers queue until:
 * - end of list is reached
@@ -1362,7 +2665,7 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
                                         const policy_param_t *p_param,
                                         lmgr_t *lmgr,
                                         struct policy_iter *it,
-                                        const lmgr_iter_opt_t *req_opt,
+                                        lmgr_iter_opt_t *req_opt,
                                         const lmgr_sort_type_t *sort_type,
                                         lmgr_filter_t *filter,
                                         attr_mask_t attr_mask,
@@ -1390,9 +2693,10 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
     /* List entries for policy */
     do {
         counters_t entry_amount;
+        queued_item_t *q_item;
 
         /* reset attr_mask, if it was altered by last ListMgr_GetNext() */
-        memset(&attr_set, 0, sizeof(attr_set_t));
+        ATTR_SET_CLEAR(&attr_set);
         attr_set.attr_mask = attr_mask;
 
         memset(&entry_id, 0, sizeof(entry_id_t));
@@ -1411,8 +2715,9 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
         } else if (rc == DB_END_OF_LIST) {
             *db_total_list_count += *db_current_list_count;
 
-            /* if limit = inifinite => END OF LIST */
-            if ((*db_current_list_count == 0)
+            /* if limit = inifinite => END OF LIST
+             * (parallel listings always return whole results) */
+            if ((*db_current_list_count == 0) || (it->it_type == IT_MERGE)
                 || ((req_opt->list_count_max > 0) &&
                     (*db_current_list_count < req_opt->list_count_max))) {
                 DisplayLog(LVL_FULL, tag(pol), "End of list "
@@ -1456,8 +2761,26 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
             if (rc)
                 return PASS_ERROR;
 
+            /* continue after the last listed entry */
+            if (it->it_type == IT_LIST && it->pos.set) {
+                req_opt->after = &it->pos;
+
+                if (ckpt_enabled(pol)) {
+                    action_summary_t done = pol->progress;
+
+                    add_pass_stats(&done, status_tab_before, status_tab_after,
+                                   feedback_before, feedback_after);
+                    ckpt_save(pol, p_param, lmgr, &done, &it->pos);
+                }
+
+                DisplayLog(LVL_DEBUG, tag(pol),
+                           "Performing new request with a limit of %u entries"
+                           " after the last listed entry and md_update < %ld ",
+                           req_opt->list_count_max,
+                           pol->progress.policy_start);
+            }
             /* filter on <sort_time> */
-            if (pol->config->lru_sort_attr != LRU_ATTR_NONE) {
+            else if (pol->config->lru_sort_attr != LRU_ATTR_NONE) {
                 fval.value.val_int = *last_sort_time;
                 rc = lmgr_simple_filter_add_or_replace(filter,
                                                pol->config->lru_sort_attr,
@@ -1479,8 +2802,8 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
             }
 
             *db_current_list_count = 0;
-            rc = iter_open(lmgr, it->it_type, it, filter, sort_type,
-                           req_opt);
+            rc = iter_open(pol, lmgr, it->it_type, it, filter, sort_type,
+                           req_opt, attr_mask);
             if (rc != DB_SUCCESS) {
                 DisplayLog(LVL_CRIT, tag(pol),
                            "Error %d retrieving list of candidates from "
@@ -1511,11 +2834,16 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
         }
 
         /* Insert candidate to workers queue */
-        rc = Queue_Insert(&pol->queue,
-                          entry2queue_item(&entry_id, &attr_set,
-                                           entry_amount.targeted));
-        if (rc)
+        q_item = entry2queue_item(&entry_id, &attr_set, &entry_amount);
+        if (q_item == NULL) {
+            ListMgr_FreeAttrs(&attr_set);
+            return PASS_ERROR;
+        }
+        rc = Queue_Insert(&pol->queue, q_item);
+        if (rc) {
+            free_queued_item(q_item);
             return PASS_ERROR;
+        }
 
         counters_add(&pushed_ctr, &entry_amount);
 
@@ -1535,231 +2863,1812 @@ static pass_status_e fill_workers_queue(policy_info_t *pol,
     return st;
 }
 
-/* forward declaration */
-static void process_entry(policy_info_t *pol, lmgr_t *lmgr,
-                          queue_item_t *p_item, bool free_item);
-/**
-* Apply policy to a single file.
-*/
-static int single_file_run(policy_info_t *pol, lmgr_t *lmgr,
-                           const policy_param_t *p_param,
-                           action_summary_t *p_summary)
+/** candidate kept in memory by a top-K selection */
+struct topk_entry {
+    int           sort_key;
+    counters_t    amount;
+    queued_item_t *item;
+};
+
+/** max-heap on sort_key: the root is the worst candidate kept so far */
+struct topk_heap {
+    struct topk_entry *entries;
+    unsigned int       count;
+    unsigned int       size;
+    counters_t         sum;     /**< amount of all kept candidates */
+};
+
+/* candidates are kept up to this multiple of the target, as some of them
+ * may not match policy rules, or their action may fail */
+#define TOPK_MARGIN 2
+
+static void topk_sift_up(struct topk_heap *h, unsigned int i)
 {
-    queue_item_t item;
-    int rc;
-    unsigned int status_before[AS_ENUM_COUNT];
-    unsigned int status_after[AS_ENUM_COUNT];
-    unsigned long long feedback_before[AF_ENUM_COUNT];
-    unsigned long long feedback_after[AF_ENUM_COUNT];
+    struct topk_entry e = h->entries[i];
 
-    memset(&item, 0, sizeof(item));
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
 
-    RetrieveQueueStats(&pol->queue, NULL, NULL, NULL, NULL, NULL,
-                       status_before, feedback_before);
+        if (h->entries[parent].sort_key >= e.sort_key)
+            break;
+        h->entries[i] = h->entries[parent];
+        i = parent;
+    }
+    h->entries[i] = e;
+}
 
-    pol->progress.policy_start = pol->progress.last_report = time(NULL);
+static void topk_sift_down(struct topk_heap *h, unsigned int i)
+{
+    struct topk_entry e = h->entries[i];
 
-    /* resolve the fid of the target */
-    rc = path2id(p_param->optarg_u.name, &item.entry_id, NULL);
-    if (rc)
-        return rc;
+    for (;;) {
+        unsigned int child = 2 * i + 1;
 
-    /* needed attributes to apply the policy */
-    item.entry_attr.attr_mask = db_attr_mask(pol, p_param);
+        if (child >= h->count)
+            break;
+        if (child + 1 < h->count
+            && h->entries[child + 1].sort_key > h->entries[child].sort_key)
+            child++;
+        if (h->entries[child].sort_key <= e.sort_key)
+            break;
+        h->entries[i] = h->entries[child];
+        i = child;
+    }
+    h->entries[i] = e;
+}
 
-    /* get fid from DB */
-    rc = ListMgr_Get(lmgr, &item.entry_id, &item.entry_attr);
-    if (rc) {
-        if (rc == DB_NOT_EXISTS)
-            DisplayLog(LVL_MAJOR, tag(pol),
-                       "%s: this entry is not known in database",
-                       p_param->optarg_u.name);
-        /* expect a posix error code */
-        rc = EINVAL;
-        return rc;
+static int topk_push(struct topk_heap *h, const struct topk_entry *e)
+{
+    if (h->count == h->size) {
+        unsigned int size = h->size ? 2 * h->size : 1024;
+        struct topk_entry *tmp;
+
+        tmp = MemRealloc(h->entries, size * sizeof(*h->entries));
+        if (tmp == NULL)
+            return ENOMEM;
+        h->entries = tmp;
+        h->size = size;
     }
+    h->entries[h->count] = *e;
+    counters_add(&h->sum, &e->amount);
+    topk_sift_up(h, h->count++);
+    return 0;
+}
 
-    /* apply the policy to the entry */
-    process_entry(pol, lmgr, &item, false);
+/** remove the worst candidate, and store it after the end of the heap */
+static void topk_pop(struct topk_heap *h, struct topk_entry *e)
+{
+    struct topk_entry root = h->entries[0];
 
-    ListMgr_FreeAttrs(&item.entry_attr);
+    h->count--;
+    counters_sub(&h->sum, &root.amount);
+    if (h->count > 0) {
+        h->entries[0] = h->entries[h->count];
+        topk_sift_down(h, 0);
+    }
+    h->entries[h->count] = root;
+    if (e != NULL)
+        *e = root;
+}
 
-    RetrieveQueueStats(&pol->queue, NULL, NULL, NULL, NULL, NULL,
-                       status_after, feedback_after);
-    update_pass_stats(pol, status_before, status_after,
-                      feedback_before, feedback_after);
+/** free the candidates that were not pushed to the workers */
+static void topk_free(struct topk_heap *h, unsigned int count)
+{
+    unsigned int i;
 
-    if (p_summary)
-        *p_summary = pol->progress;
+    for (i = 0; i < count; i++)
+        if (h->entries[i].item != NULL)
+            free_queued_item(h->entries[i].item);
+    MemFree(h->entries);
+    memset(h, 0, sizeof(*h));
+}
 
-    return 0;
+/**
+ * The top-K selection is only useful if the run has a limit:
+ * else all candidates must be processed anyway.
+ */
+static bool topk_enabled(const policy_info_t *pol,
+                         const policy_param_t *p_param)
+{
+    return pol->config->topk_sort
+        && (pol->config->lru_sort_attr != LRU_ATTR_NONE)
+        && !pol->descr->manage_deleted
+        && !no_limit(pol)
+        && counter_is_set(&p_param->target_ctr);
 }
 
+typedef enum {
+    TOPK_ALL,       /**< all candidates are in the heap */
+    TOPK_PARTIAL,   /**< the heap has the best candidates only */
+    TOPK_OVERFLOW,  /**< too many candidates are needed for the target */
+    TOPK_ABORTED,
+    TOPK_ERROR,
+} topk_status_e;
+
 /**
-* This is called by triggers (or manual policy runs) to run a pass of a policy.
-* @param[in,out] p_pol_info   policy information and resources
-* @param[in]     p_param      parameters of this run (target, limit, ...)
-* @param[out]    p_summary    summary of the policy run
-* @param[in]     lmgr         connection to the database
-*  \return 0 on success, a POSIX error code else, -1 for internal failure.
-*  \retval ENOENT if no file list is available.
-*/
-int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
-               action_summary_t *p_summary, lmgr_t *lmgr)
+ * List candidates without sorting them in the DB, and keep the first ones
+ * in sort order until they are enough to reach the target.
+ */
+static topk_status_e topk_select(policy_info_t *pol,
+                                 const policy_param_t *p_param,
+                                 lmgr_t *lmgr, lmgr_filter_t *filter,
+                                 attr_mask_t attr_mask,
+                                 struct topk_heap *heap)
 {
     struct policy_iter it = { 0 };
-    int rc;
-    pass_status_e st;
-    lmgr_filter_t filter;
-    filter_value_t fval;
     lmgr_sort_type_t sort_type;
-    int last_sort_time = 0;
-    /* XXX first_request_start = policy_start */
-    attr_mask_t attr_mask;
-    unsigned int nb_returned, total_returned;
-
     lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    counters_t bound = p_param->target_ctr;
+    topk_status_e st = TOPK_ALL;
+    unsigned long long listed = 0;
+    int rc;
 
-    if (!p_pol_info)
-        RBH_BUG("p_pol_info argument is NULL");
-    if (!p_param)
-        RBH_BUG("p_param argument is NULL");
+    bound.count *= TOPK_MARGIN;
+    bound.vol *= TOPK_MARGIN;
+    bound.blocks *= TOPK_MARGIN;
+    bound.targeted *= TOPK_MARGIN;
 
-    p_pol_info->time_modifier = p_param->time_mod;
-    p_pol_info->trigger_action_params = p_param->action_params;
+    /* no ORDER BY: the result is streamed as it is read */
+    sort_type.attr_index = pol->config->lru_sort_attr;
+    sort_type.order = SORT_NONE;
+    opt.stream = true;
+    marks_iter_opt(pol, &opt);
 
-    memset(&p_pol_info->progress, 0, sizeof(p_pol_info->progress));
-    if (p_summary)
-        memset(p_summary, 0, sizeof(*p_summary));
+    rc = iter_open(pol, lmgr, IT_LIST, &it, filter, &sort_type, &opt,
+                   attr_mask);
+    if (rc != DB_SUCCESS) {
+        DisplayLog(LVL_CRIT, tag(pol), "Error %d retrieving list of "
+                   "candidates from database.", rc);
+        return TOPK_ERROR;
+    }
 
-    /* XXX previously here: interpreting target type and amount */
+    for (;;) {
+        struct topk_entry e;
+        attr_set_t attr_set;
+        entry_id_t entry_id;
 
-    /* special case: apply policy on a single file */
-    if (p_param->target == TGT_FILE)
+        ATTR_SET_CLEAR(&attr_set);
+        attr_set.attr_mask = attr_mask;
+        memset(&entry_id, 0, sizeof(entry_id));
+
+        rc = iter_next(&it, &entry_id, &attr_set);
+
+        if (aborted(pol)) {
+            if (rc == 0)
+                ListMgr_FreeAttrs(&attr_set);
+            st = TOPK_ABORTED;
+            break;
+        } else if (rc == DB_END_OF_LIST) {
+            break;
+        } else if (rc != 0) {
+            DisplayLog(LVL_CRIT, tag(pol),
+                       "Error %d getting next entry of iterator", rc);
+            st = TOPK_ERROR;
+            break;
+        }
+        listed++;
+
+        /* entries with no sort attribute come first, as with ORDER BY */
+        e.sort_key = get_sort_attr(pol, &attr_set);
+
+        if (entry2tgt_amount(p_param, &attr_set, &e.amount) == -1) {
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "Failed to determine target amount for entry " DFID,
+                       PFID(&entry_id));
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
+
+        /* better candidates are already enough */
+        if (heap->count > 0 && counter_reached_limit(&heap->sum, &bound)
+            && e.sort_key >= heap->entries[0].sort_key) {
+            ListMgr_FreeAttrs(&attr_set);
+            st = TOPK_PARTIAL;
+            continue;
+        }
+
+        e.item = entry2queue_item(&entry_id, &attr_set, &e.amount);
+        if (e.item == NULL) {
+            ListMgr_FreeAttrs(&attr_set);
+            st = TOPK_ERROR;
+            break;
+        }
+        if (topk_push(heap, &e)) {
+            free_queued_item(e.item);
+            st = TOPK_ERROR;
+            break;
+        }
+
+        /* drop the worst candidates the target doesn't need */
+        while (heap->count > 1) {
+            counters_t rest = heap->sum;
+
+            counters_sub(&rest, &heap->entries[0].amount);
+            if (!counter_reached_limit(&rest, &bound))
+                break;
+
+            topk_pop(heap, &e);
+            free_queued_item(e.item);
+            st = TOPK_PARTIAL;
+        }
+
+        if (pol->config->topk_max_entries != 0
+            && heap->count > pol->config->topk_max_entries) {
+            DisplayLog(LVL_MAJOR, tag(pol), "More than %u candidates are "
+                       "needed to reach the target", heap->count - 1);
+            st = TOPK_OVERFLOW;
+            break;
+        }
+    }
+    iter_close(&it);
+
+    DisplayLog(LVL_DEBUG, tag(pol), "%u candidates selected in memory out of "
+               "%llu listed", heap->count, listed);
+    return st;
+}
+
+/**
+ * Select the best candidates in memory, and push them to the workers queue
+ * in sort order.
+ * @retval PASS_EOL if all candidates were processed.
+ * @retval PASS_LIMIT if the limit is reached, or other candidates remain.
+ */
+static pass_status_e topk_fill_queue(policy_info_t *pol,
+                                     const policy_param_t *p_param,
+                                     lmgr_t *lmgr, lmgr_filter_t *filter,
+                                     attr_mask_t attr_mask)
+{
+    struct topk_heap heap = { 0 };
+    pass_status_e st;
+    topk_status_e sel;
+    counters_t pushed_ctr;
+    unsigned int i, n;
+    unsigned long long feedback_before[AF_ENUM_COUNT];
+    unsigned long long feedback_after[AF_ENUM_COUNT];
+    unsigned int status_tab_before[AS_ENUM_COUNT];
+    unsigned int status_tab_after[AS_ENUM_COUNT];
+
+    sel = topk_select(pol, p_param, lmgr, filter, attr_mask, &heap);
+    switch (sel) {
+    case TOPK_ALL:
+        st = PASS_EOL;
+        break;
+    case TOPK_PARTIAL:
+        st = PASS_LIMIT;
+        break;
+    case TOPK_OVERFLOW:
+        /* sort all candidates in the DB */
+        topk_free(&heap, heap.count);
+        return PASS_LIMIT;
+    case TOPK_ABORTED:
+        DisplayLog(LVL_MAJOR, tag(pol),
+                   "Policy run aborted, stop enqueuing requests.");
+        topk_free(&heap, heap.count);
+        return PASS_ABORTED;
+    case TOPK_ERROR:
+    default:
+        topk_free(&heap, heap.count);
+        return PASS_ERROR;
+    }
+
+    /* heap sort: the best candidate ends at index 0 */
+    n = heap.count;
+    while (heap.count > 0)
+        topk_pop(&heap, NULL);
+
+    init_pass_stats(pol, &pushed_ctr, status_tab_before, status_tab_after,
+                    feedback_before, feedback_after);
+
+    for (i = 0; i < n; i++) {
+        if (aborted(pol)) {
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "Policy run aborted, stop enqueuing requests.");
+            st = PASS_ABORTED;
+            break;
+        }
+
+        if (Queue_Insert(&pol->queue, heap.entries[i].item)) {
+            st = PASS_ERROR;
+            break;
+        }
+        heap.entries[i].item = NULL;
+        counters_add(&pushed_ctr, &heap.entries[i].amount);
+
+        if (check_queue_limit(pol, &pushed_ctr, feedback_before,
+                              status_tab_before, &p_param->target_ctr)) {
+            st = PASS_LIMIT;
+            break;
+        }
+    }
+    topk_free(&heap, n);
+
+    wait_queue_empty(pol, pushed_ctr.count, feedback_before,
+                     status_tab_before, feedback_after, status_tab_after,
+                     true);
+
+    update_pass_stats(pol, status_tab_before, status_tab_after,
+                      feedback_before, feedback_after);
+
+    return st;
+}
+
+/**
+ * The candidate index has no filter on targets (user, OST...):
+ * only use it for runs on the whole filesystem.
+ */
+static bool candidates_usable(const policy_info_t *pol,
+                              const policy_param_t *p_param)
+{
+    return p_param->target == TGT_FS
+        && candidates_enabled(policy_index(pol));
+}
+
+/**
+ * Push the candidates of the candidate index to the workers queue,
+ * from list[*next], until the limit of the run is reached.
+ * Their attributes are read from the DB, as the index only has their id.
+ */
+static pass_status_e candidates_pass(policy_info_t *pol,
+                                     const policy_param_t *p_param,
+                                     lmgr_t *lmgr, attr_mask_t attr_mask,
+                                     const struct candidate *list,
+                                     unsigned int count, unsigned int *next)
+{
+    pass_status_e st = PASS_EOL;
+    counters_t pushed_ctr;
+    unsigned long long feedback_before[AF_ENUM_COUNT];
+    unsigned long long feedback_after[AF_ENUM_COUNT];
+    unsigned int status_tab_before[AS_ENUM_COUNT];
+    unsigned int status_tab_after[AS_ENUM_COUNT];
+    int rc;
+
+    init_pass_stats(pol, &pushed_ctr, status_tab_before, status_tab_after,
+                    feedback_before, feedback_after);
+
+    while (*next < count) {
+        entry_id_t id = list[*next].id;
+        attr_set_t attr_set = ATTR_SET_INIT;
+        queued_item_t *item;
+        counters_t amount;
+
+        if (aborted(pol)) {
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "Policy run aborted, stop enqueuing requests.");
+            st = PASS_ABORTED;
+            break;
+        }
+        (*next)++;
+
+        attr_set.attr_mask = attr_mask;
+        rc = ListMgr_Get(lmgr, &id, &attr_set);
+        if (rc == DB_NOT_EXISTS) {
+            /* removed since it was indexed */
+            candidates_drop(policy_index(pol), &id);
+            continue;
+        } else if (rc) {
+            DisplayLog(LVL_MAJOR, tag(pol), "Error %d getting attributes "
+                       "of entry " DFID " from database", rc, PFID(&id));
+            continue;
+        }
+
+        if (entry2tgt_amount(p_param, &attr_set, &amount) == -1) {
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "Failed to determine target amount for entry " DFID,
+                       PFID(&id));
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
+
+        item = entry2queue_item(&id, &attr_set, &amount);
+        if (item == NULL) {
+            ListMgr_FreeAttrs(&attr_set);
+            st = PASS_ERROR;
+            break;
+        }
+        if (Queue_Insert(&pol->queue, item)) {
+            free_queued_item(item);
+            st = PASS_ERROR;
+            break;
+        }
+        counters_add(&pushed_ctr, &amount);
+
+        if (check_queue_limit(pol, &pushed_ctr, feedback_before,
+                              status_tab_before, &p_param->target_ctr)) {
+            st = PASS_LIMIT;
+            break;
+        }
+    }
+
+    wait_queue_empty(pol, pushed_ctr.count, feedback_before,
+                     status_tab_before, feedback_after, status_tab_after,
+                     true);
+
+    update_pass_stats(pol, status_tab_before, status_tab_after,
+                      feedback_before, feedback_after);
+
+    return st;
+}
+
+static inline int pass_status2rc(pass_status_e st)
+{
+    switch (st) {
+    case PASS_EOL:
+    case PASS_LIMIT:
+        return 0;
+    case PASS_ABORTED:
+        return ECANCELED;
+    case PASS_ERROR:
+        return -1;
+    }
+    return -1;
+}
+
+/* forward declaration */
+static void process_entry(policy_info_t *pol, lmgr_t *lmgr,
+                          queue_item_t *p_item, bool free_item);
+/**
+* Apply policy to a single file.
+*/
+static int single_file_run(policy_info_t *pol, lmgr_t *lmgr,
+                           const policy_param_t *p_param,
+                           action_summary_t *p_summary)
+{
+    queue_item_t item;
+    int rc;
+    unsigned int status_before[AS_ENUM_COUNT];
+    unsigned int status_after[AS_ENUM_COUNT];
+    unsigned long long feedback_before[AF_ENUM_COUNT];
+    unsigned long long feedback_after[AF_ENUM_COUNT];
+
+    memset(&item, 0, sizeof(item));
+
+    RetrieveQueueStats(&pol->queue, NULL, NULL, NULL, NULL, NULL,
+                       status_before, feedback_before);
+
+    pol->progress.policy_start = pol->progress.last_report = time(NULL);
+
+    /* resolve the fid of the target */
+    rc = path2id(p_param->optarg_u.name, &item.entry_id, NULL);
+    if (rc)
+        return rc;
+
+    /* needed attributes to apply the policy */
+    item.entry_attr.attr_mask = db_attr_mask(pol, p_param);
+
+    /* get fid from DB */
+    rc = ListMgr_Get(lmgr, &item.entry_id, &item.entry_attr);
+    if (rc) {
+        if (rc == DB_NOT_EXISTS)
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "%s: this entry is not known in database",
+                       p_param->optarg_u.name);
+        /* expect a posix error code */
+        rc = EINVAL;
+        return rc;
+    }
+
+    /* apply the policy to the entry */
+    process_entry(pol, lmgr, &item, false);
+
+    ListMgr_FreeAttrs(&item.entry_attr);
+
+    RetrieveQueueStats(&pol->queue, NULL, NULL, NULL, NULL, NULL,
+                       status_after, feedback_after);
+    update_pass_stats(pol, status_before, status_after,
+                      feedback_before, feedback_after);
+
+    if (p_summary)
+        *p_summary = pol->progress;
+
+    return 0;
+}
+
+/**
+ * Initialize the DB filter of a policy run, with the policy scope.
+ */
+static int init_run_filter(policy_info_t *pol, lmgr_filter_t *filter)
+{
+    filter_value_t fval;
+    int rc;
+
+    rc = lmgr_simple_filter_init(filter);
+    if (rc)
+        return rc;
+
+    /* filter entries in the policy scope */
+    DisplayLog(LVL_FULL, tag(pol), "Converting scope to DB filter...");
+    if (convert_boolexpr_to_simple_filter
+        (&pol->descr->scope, filter, pol->descr->status_mgr,
+         pol->time_modifier,
+         pol->descr->manage_deleted ? FILTER_FLAG_ALLOW_NULL : 0)) {
+        DisplayLog(LVL_DEBUG, tag(pol),
+                   "Could not convert policy scope to simple filter.");
+        DisplayLog(LVL_EVENT, tag(pol),
+                   "Warning: scope definition is too complex and may affect policy run performance");
+    }
+
+    if (!pol->descr->manage_deleted) {
+        /* do not retrieve 'invalid' entries */
+        fval.value.val_bool = false;
+        rc = lmgr_simple_filter_add(filter, ATTR_INDEX_invalid, EQUAL,
+                                    fval, FILTER_FLAG_ALLOW_NULL);
+        if (rc) {
+            lmgr_simple_filter_free(filter);
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/** per-rule counters of a simulated run */
+struct sim_rule_stats {
+    counters_t  ctr;
+    counters_t *tgt_ctr;    /**< one per target fileclass of the rule */
+};
+
+/**
+ * Check an entry against the policy rules, like refresh_match_entry(),
+ * but from its DB attributes only.
+ */
+static action_status_t sim_match_entry(policy_info_t *pol,
+                                       const entry_id_t *p_id,
+                                       const attr_set_t *attrs,
+                                       rule_item_t **rule,
+                                       fileset_item_t **fileset)
+{
+    switch (match_scope(pol->descr, p_id, attrs, false)) {
+    case POLICY_MATCH:
+        break;
+    case POLICY_NO_MATCH:
+        return AS_OUT_OF_SCOPE;
+    default:
+        if (!pol->descr->manage_deleted)
+            return AS_MISSING_MD;
+    }
+
+    if (!ignore_policies(pol)) {
+        switch (is_whitelisted(pol->descr, p_id, attrs, fileset)) {
+        case POLICY_NO_MATCH:
+            break;
+        case POLICY_MATCH:
+            return AS_WHITELISTED;
+        default:
+            return AS_MISSING_MD;
+        }
+    }
+
+    *rule = policy_case(pol->descr, p_id, attrs, fileset);
+    if (*rule == NULL)
+        return AS_NO_POLICY;
+
+    if (ignore_policies(pol))
+        return AS_OK;
+
+    switch (entry_matches(p_id, attrs, &(*rule)->condition,
+                          pol->time_modifier, pol->descr->status_mgr)) {
+    case POLICY_MATCH:
+        return AS_OK;
+    case POLICY_NO_MATCH:
+        /* not eligible now */
+        return AS_WHITELISTED;
+    default:
+        return AS_MISSING_MD;
+    }
+}
+
+static void sim_add_entry(struct sim_rule_stats *stats,
+                          const policy_rules_t *rules,
+                          const rule_item_t *rule,
+                          const fileset_item_t *fileset,
+                          const counters_t *amount)
+{
+    struct sim_rule_stats *rs = &stats[rule - rules->rules];
+    unsigned int i;
+
+    counters_add(&rs->ctr, amount);
+
+    if (fileset == NULL || rs->tgt_ctr == NULL)
+        return;
+
+    for (i = 0; i < rule->target_count; i++) {
+        if (rule->target_list[i] == fileset) {
+            counters_add(&rs->tgt_ctr[i], amount);
+            break;
+        }
+    }
+}
+
+static void sim_print_ctr(const char *tag, const char *what,
+                          const counters_t *ctr)
+{
+    char vol_buff[128];
+
+    FormatFileSize(vol_buff, sizeof(vol_buff), ctr->vol);
+    DisplayLog(LVL_MAJOR, tag, "%s: %llu entries, volume: %s, "
+               "%llu blocks, %llu targeted", what, ctr->count, vol_buff,
+               ctr->blocks, ctr->targeted);
+}
+
+/**
+ * Estimate the duration of a run from the average action time
+ * of the last policy run, and the number of worker threads.
+ */
+static void sim_print_estimate(policy_info_t *pol, lmgr_t *lmgr,
+                               const counters_t *total)
+{
+    char var_name[POLICY_NAME_LEN + 128];
+    char val_buff[256];
+    char time_buff[128];
+    unsigned long long latency;
+    unsigned int nb_threads = MAX2(pol->config->nb_threads, 1);
+    double estimate;
+
+    snprintf(var_name, sizeof(var_name), "%s" LAST_POLICY_LATENCY_SUFFIX,
+             tag(pol));
+    if (ListMgr_GetVar(lmgr, var_name, val_buff, sizeof(val_buff))
+        != DB_SUCCESS) {
+        DisplayLog(LVL_MAJOR, tag(pol), "Simulated run: no action latency "
+                   "history in DB: cannot estimate run duration");
+        return;
+    }
+
+    latency = strtoull(val_buff, NULL, 10);
+    estimate = (double)total->count * latency / nb_threads / USEC_PER_SEC;
+
+    FormatDuration(time_buff, sizeof(time_buff), (time_t)(estimate + 0.5));
+    DisplayLog(LVL_MAJOR, tag(pol), "Simulated run: estimated duration: %s "
+               "(average action time: %.2fms, %u threads)", time_buff,
+               latency / 1000.0, nb_threads);
+}
+
+/**
+ * Simulate a policy run: evaluate policy rules against DB contents only,
+ * with no access to the filesystem, and no entry pushed to the workers
+ * queue. Report the projected volume and count per rule and target
+ * fileclass, and the estimated run duration.
+ */
+static int simulate_run(policy_info_t *pol, const policy_param_t *p_param,
+                        lmgr_t *lmgr, lmgr_filter_t *filter,
+                        attr_mask_t attr_mask)
+{
+    struct policy_iter it = { 0 };
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    lmgr_sort_type_t sort_type;
+    policy_rules_t *rules = &pol->descr->rules;
+    struct sim_rule_stats *stats;
+    unsigned int status_tab[AS_ENUM_COUNT] = { 0 };
+    unsigned long long listed = 0;
+    counters_t total = { 0 };
+    char buff[1024];
+    unsigned int i, j;
+    int rc;
+
+    stats = MemCalloc(MAX2(rules->rule_count, 1), sizeof(*stats));
+    if (stats == NULL)
+        return ENOMEM;
+    for (i = 0; i < rules->rule_count; i++) {
+        if (rules->rules[i].target_count == 0)
+            continue;
+        stats[i].tgt_ctr = MemCalloc(rules->rules[i].target_count,
+                                     sizeof(counters_t));
+        if (stats[i].tgt_ctr == NULL) {
+            rc = ENOMEM;
+            goto free_stats;
+        }
+    }
+
+    /* entries order only matters if the run is limited */
+    sort_type.attr_index = pol->config->lru_sort_attr;
+    if (no_limit(pol) || !counter_is_set(&p_param->target_ctr))
+        sort_type.order = SORT_NONE;
+    else
+        sort_type.order = pol->config->lru_sort_attr == LRU_ATTR_NONE ?
+            SORT_NONE : SORT_ASC;
+
+    /* stream the whole result at once: as no action is done,
+     * entries can't be listed twice */
+    opt.stream = true;
+
+    rc = iter_open(pol, lmgr, pol->descr->manage_deleted ? IT_RMD : IT_LIST,
+                   &it, filter, &sort_type, &opt, attr_mask);
+    if (rc != DB_SUCCESS) {
+        DisplayLog(LVL_CRIT, tag(pol), "Error retrieving list of candidates "
+                   "from database. Simulation cancelled.");
+        goto free_stats;
+    }
+
+    pol->progress.policy_start = time(NULL);
+    /* the simulated run is a snapshot: match all entries as of its start */
+    policy_eval_set_time(pol->progress.policy_start);
+
+    while (no_limit(pol)
+           || !counter_reached_limit(&total, &p_param->target_ctr)) {
+        attr_set_t attr_set = ATTR_SET_INIT;
+        entry_id_t entry_id;
+        rule_item_t *rule = NULL;
+        fileset_item_t *fileset = NULL;
+        counters_t amount;
+        action_status_t st;
+
+        attr_set.attr_mask = attr_mask;
+        memset(&entry_id, 0, sizeof(entry_id));
+
+        rc = iter_next(&it, &entry_id, &attr_set);
+        if (aborted(pol)) {
+            if (rc == 0)
+                ListMgr_FreeAttrs(&attr_set);
+            rc = ECANCELED;
+            break;
+        } else if (rc == DB_END_OF_LIST) {
+            rc = 0;
+            break;
+        } else if (rc != 0) {
+            DisplayLog(LVL_CRIT, tag(pol),
+                       "Error %d getting next entry of iterator", rc);
+            break;
+        }
+        listed++;
+
+        st = sim_match_entry(pol, &entry_id, &attr_set, &rule, &fileset);
+        if (st == AS_OK
+            && entry2tgt_amount(p_param, &attr_set, &amount) == -1)
+            st = AS_MISSING_MD;
+        status_tab[st]++;
+
+        if (st == AS_OK) {
+            counters_add(&total, &amount);
+            sim_add_entry(stats, rules, rule, fileset, &amount);
+        }
+        ListMgr_FreeAttrs(&attr_set);
+    }
+    iter_close(&it);
+    policy_eval_set_time(0);
+
+    FormatDuration(buff, sizeof(buff), time(NULL) - pol->progress.policy_start);
+    DisplayLog(LVL_MAJOR, tag(pol), "Simulated run: %llu entries checked "
+               "in %s", listed, buff);
+    for (i = 0; i < AS_ENUM_COUNT; i++)
+        if (i != AS_OK && status_tab[i] > 0)
+            DisplayLog(LVL_MAJOR, tag(pol), "Simulated run: %u entries "
+                       "skipped (%s)", status_tab[i], action_status_descr[i]);
+
+    for (i = 0; i < rules->rule_count; i++) {
+        rule_item_t *rule = &rules->rules[i];
+
+        if (stats[i].ctr.count == 0)
+            continue;
+
+        snprintf(buff, sizeof(buff), "Simulated run: rule '%s'",
+                 rule->rule_id);
+        sim_print_ctr(tag(pol), buff, &stats[i].ctr);
+
+        for (j = 0; j < rule->target_count; j++) {
+            if (stats[i].tgt_ctr[j].count == 0)
+                continue;
+            snprintf(buff, sizeof(buff), "Simulated run: rule '%s', "
+                     "fileclass '%s'", rule->rule_id,
+                     rule->target_list[j]->fileset_id);
+            sim_print_ctr(tag(pol), buff, &stats[i].tgt_ctr[j]);
+        }
+    }
+    sim_print_ctr(tag(pol), "Simulated run: total", &total);
+    sim_print_estimate(pol, lmgr, &total);
+
+free_stats:
+    for (i = 0; i < rules->rule_count; i++)
+        MemFree(stats[i].tgt_ctr);
+    MemFree(stats);
+    return rc;
+}
+
+#ifdef _LUSTRE
+/* margin on the target of an OST run, for the entries the policy skips */
+#define OST_BOUND_MARGIN 2
+
+/**
+ * Restrict the listing of a run on an OST to its least recently accessed
+ * files, when OST aggregates show they are enough to reach the target.
+ * The other files are listed afterwards if the target is not reached.
+ * @return true if the listing is bounded.
+ */
+static bool set_ost_bound(policy_info_t *pol, const policy_param_t *p_param,
+                          lmgr_t *lmgr, lmgr_filter_t *filter,
+                          unsigned int *bound)
+{
+    filter_value_t fval;
+
+    if (p_param->target != TGT_OST || p_param->target_ctr.targeted == 0
+        || pol->config->lru_sort_attr != ATTR_INDEX_last_access
+        || pol->descr->manage_deleted || simulate(pol)
+        || topk_enabled(pol, p_param))
+        return false;
+
+    if (ListMgr_OSTAggBound(lmgr, p_param->optarg_u.index,
+                            OST_BOUND_MARGIN * p_param->target_ctr.targeted,
+                            bound) != DB_SUCCESS)
+        return false;
+
+    fval.value.val_uint = *bound;
+    if (lmgr_simple_filter_add(filter, ATTR_INDEX_last_access,
+                               LESSTHAN_STRICT, fval, 0))
+        return false;
+
+    DisplayLog(LVL_EVENT, tag(pol), "Listing files of OST #%u with "
+               "last_access < %u first (enough for the target according to "
+               "OST aggregates)", p_param->optarg_u.index, *bound);
+    return true;
+}
+#endif
+
+/**
+* This is called by triggers (or manual policy runs) to run a pass of a policy.
+* @param[in,out] p_pol_info   policy information and resources
+* @param[in]     p_param      parameters of this run (target, limit, ...)
+* @param[out]    p_summary    summary of the policy run
+* @param[in]     lmgr         connection to the database
+*  \return 0 on success, a POSIX error code else, -1 for internal failure.
+*  \retval ENOENT if no file list is available.
+*/
+/**
+ * Discard deleted entries that were removed for longer than
+ * deleted_expiration, by ranges of rm_time, instead of one at a time.
+ */
+static void expire_deleted(policy_info_t *pol, lmgr_t *lmgr)
+{
+    time_t expiration = pol->config->deleted_expiration;
+    time_t now = time(NULL);
+    unsigned long long count = 0;
+    int rc;
+
+    if (!pol->descr->manage_deleted || expiration == 0 || now <= expiration
+        || dry_run(pol) || simulate(pol))
+        return;
+
+    rc = ListMgr_SoftRemove_Expire(lmgr, now - expiration, &count);
+    if (rc)
+        DisplayLog(LVL_CRIT, tag(pol), "Error %d discarding entries removed "
+                   "for more than %lus", rc, (unsigned long)expiration);
+    else if (count > 0)
+        DisplayLog(LVL_MAJOR, tag(pol), "%llu entries removed for more than "
+                   "%lus were discarded (deleted_expiration)", count,
+                   (unsigned long)expiration);
+}
+
+int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
+               action_summary_t *p_summary, lmgr_t *lmgr)
+{
+    struct policy_iter it = { 0 };
+    int rc;
+    pass_status_e st;
+    lmgr_filter_t filter;
+    lmgr_sort_type_t sort_type;
+    int last_sort_time = 0;
+    /* XXX first_request_start = policy_start */
+    attr_mask_t attr_mask;
+    unsigned int nb_returned, total_returned;
+    struct candidate *cand_list;
+    unsigned int cand_count;
+#ifdef _LUSTRE
+    bool bounded;
+    unsigned int bound = 0;
+#endif
+
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+
+    if (!p_pol_info)
+        RBH_BUG("p_pol_info argument is NULL");
+    if (!p_param)
+        RBH_BUG("p_param argument is NULL");
+
+    p_pol_info->time_modifier = p_param->time_mod;
+    p_pol_info->trigger_action_params = p_param->action_params;
+    if (p_pol_info->run_rate != NULL)
+        rate_limiter_reset(p_pol_info->run_rate, p_param->action_rate,
+                           p_param->volume_rate);
+
+    memset(&p_pol_info->progress, 0, sizeof(p_pol_info->progress));
+    memset(&p_pol_info->resumed, 0, sizeof(p_pol_info->resumed));
+    p_pol_info->checkpoint = 0;
+    p_pol_info->action_usec = 0;
+    p_pol_info->action_count = 0;
+    if (p_summary)
+        memset(p_summary, 0, sizeof(*p_summary));
+
+    /* XXX previously here: interpreting target type and amount */
+
+    /* special case: apply policy on a single file */
+    if (p_param->target == TGT_FILE) {
+        if (simulate(p_pol_info)) {
+            DisplayLog(LVL_MAJOR, tag(p_pol_info), "Simulation is not "
+                       "supported for single file targets");
+            return ENOTSUP;
+        }
         return single_file_run(p_pol_info, lmgr, p_param, p_summary);
+    }
+
+    /* Do nothing if no previous scan was done
+     * (except if --force is specified). */
+    rc = check_scan_done(p_pol_info, lmgr);
+    if (rc)
+        return rc;
+
+    /* set attributes to be retrieved from DB */
+    attr_mask = db_attr_mask(p_pol_info, p_param);
+
+    /* sort by last access */
+    // TODO manage random
+    sort_type.attr_index = p_pol_info->config->lru_sort_attr;
+    sort_type.order = p_pol_info->config->lru_sort_attr == LRU_ATTR_NONE ?
+        SORT_NONE : SORT_ASC;
+
+    rc = init_run_filter(p_pol_info, &filter);
+    if (rc)
+        return rc;
+
+    /* set target filter and attr mask */
+    rc = set_target_filter(p_pol_info, p_param, &filter, &attr_mask);
+    if (rc)
+        return rc;
+
+#ifdef _LUSTRE
+    /* before optimization filters, so it is the first filter on
+     * last_access (replaced to list the remaining files) */
+    bounded = set_ost_bound(p_pol_info, p_param, lmgr, &filter, &bound);
+#endif
+
+    /* Flushing messages before performing the long DB sort query */
+    FlushLogs();
+
+    /* add optimisation filters based on policies */
+    if (!ignore_policies(p_pol_info))
+        set_optimization_filters(p_pol_info, &filter);
+
+    if (simulate(p_pol_info)) {
+        p_pol_info->marks = 0;
+        rc = simulate_run(p_pol_info, p_param, lmgr, &filter, attr_mask);
+        lmgr_simple_filter_free(&filter);
+        return rc;
+    }
+
+    /* don't list entries known to be ignored */
+    marks_init(p_pol_info, lmgr);
+    marks_iter_opt(p_pol_info, &opt);
+
+    p_pol_info->progress.policy_start = p_pol_info->progress.last_report
+        = time(NULL);
+
+    /* start alert batching in case the policy trigger alerts */
+    Alert_StartBatching();
+
+    /* continue an interrupted run */
+    if (ckpt_enabled(p_pol_info)
+        && ckpt_load(p_pol_info, p_param, lmgr, &it.pos))
+        opt.after = &it.pos;
+
+    /* candidates maintained in memory: no DB request to list them */
+    if (candidates_usable(p_pol_info, p_param)
+        && candidates_get(policy_index(p_pol_info), &cand_list,
+                          &cand_count) == 0) {
+        unsigned int next = 0;
+
+        DisplayLog(LVL_EVENT, tag(p_pol_info), "%u candidates in the "
+                   "candidate index", cand_count);
+        do {
+            report_progress(p_pol_info, NULL, NULL, NULL, NULL);
+            st = candidates_pass(p_pol_info, p_param, lmgr, attr_mask,
+                                 cand_list, cand_count, &next);
+        } while ((st == PASS_LIMIT) &&
+                 !check_limit(p_pol_info, &p_pol_info->progress.action_ctr,
+                              p_pol_info->progress.errors,
+                              &p_param->target_ctr));
+        MemFree(cand_list);
+        rc = pass_status2rc(st);
+        goto out;
+    }
+
+    /* select the first candidates in memory if the target only needs
+     * a few of them (not when resuming a run: they are before its
+     * checkpoint) */
+    if (opt.after == NULL && topk_enabled(p_pol_info, p_param)) {
+        st = topk_fill_queue(p_pol_info, p_param, lmgr, &filter, attr_mask);
+        if (st != PASS_LIMIT
+            || check_limit(p_pol_info, &p_pol_info->progress.action_ctr,
+                           p_pol_info->progress.errors,
+                           &p_param->target_ctr)) {
+            rc = pass_status2rc(st);
+            goto out;
+        }
+        DisplayLog(LVL_EVENT, tag(p_pol_info), "Target not reached with "
+                   "the candidates selected in memory: listing remaining "
+                   "candidates in %s order", sort_attr_name(p_pol_info));
+    }
+
+    /* Do not retrieve all entries at once, as the result may exceed
+     * the client memory! */
+    opt.list_count_max = p_pol_info->config->db_request_limit;
+    /* no limit: stream the whole result instead of buffering it */
+    opt.stream = (opt.list_count_max == 0);
+    nb_returned = 0;
+    total_returned = 0;
+
+    rc = iter_open(p_pol_info, lmgr,
+                   p_pol_info->descr->manage_deleted ? IT_RMD : IT_LIST,
+                   &it, &filter, &sort_type, &opt, attr_mask);
+    if (rc != DB_SUCCESS) {
+        DisplayLog(LVL_CRIT, tag(p_pol_info),
+                   "Error retrieving list of candidates from database. "
+                   "Policy run cancelled.");
+        goto out;
+    }
+
+#ifdef _LUSTRE
+ list_more:
+#endif
+    /* loop on all policy passes */
+    do {
+        /* check if progress must be reported  */
+        report_progress(p_pol_info, NULL, NULL, NULL, NULL);
+
+        /* feed workers until the specified limit is reached or
+         * end of list is reached */
+        st = fill_workers_queue(p_pol_info, p_param, lmgr, &it, &opt,
+                                &sort_type, &filter, attr_mask,
+                                &last_sort_time, &nb_returned,
+                                &total_returned);
+        rc = pass_status2rc(st);
+
+    /* exit in all cases except pass_limit (double check the limit in this
+     * case): check the real amount of performed actions
+     * (progress.action_ctr) */
+    } while ((st == PASS_LIMIT) &&
+             !check_limit(p_pol_info, &p_pol_info->progress.action_ctr,
+                          p_pol_info->progress.errors,
+                          &p_param->target_ctr));
+
+#ifdef _LUSTRE
+    /* the least recently accessed files were not enough: list the others */
+    if (bounded && st == PASS_EOL
+        && !check_limit(p_pol_info, &p_pol_info->progress.action_ctr,
+                        p_pol_info->progress.errors, &p_param->target_ctr)) {
+        filter_value_t fval;
+
+        bounded = false;
+        iter_close(&it);
+
+        fval.value.val_uint = bound;
+        rc = lmgr_simple_filter_add_or_replace(&filter,
+                                               ATTR_INDEX_last_access,
+                                               MORETHAN, fval,
+                                               FILTER_FLAG_ALLOW_NULL);
+        if (rc)
+            goto out;
+
+        DisplayLog(LVL_EVENT, tag(p_pol_info), "Target not reached with "
+                   "files accessed before %u: listing remaining candidates",
+                   bound);
+        opt.after = NULL;
+        nb_returned = 0;
+        last_sort_time = 0;
+        rc = iter_open(p_pol_info, lmgr, IT_LIST, &it, &filter, &sort_type,
+                       &opt, attr_mask);
+        if (rc != DB_SUCCESS) {
+            DisplayLog(LVL_CRIT, tag(p_pol_info),
+                       "Error retrieving list of candidates from database. "
+                       "Policy run cancelled.");
+            goto out;
+        }
+        goto list_more;
+    }
+#endif
+
+out:
+    lmgr_simple_filter_free(&filter);
+    /* iterator may have been closed in fill_workers_queue() */
+    iter_close(&it);
+
+    /* keep the checkpoint of aborted runs, to resume them */
+    if (rc != ECANCELED)
+        ckpt_clear(p_pol_info, lmgr);
+
+    if (rc == 0)
+        expire_deleted(p_pol_info, lmgr);
+
+    /* flush pending alerts */
+    Alert_EndBatching();
+
+    if (p_summary)
+        *p_summary = p_pol_info->progress;
+
+    return rc;
+}
+
+#ifdef _LUSTRE
+/** state of an OST in a combined run on several OSTs */
+struct ost_pass {
+    const policy_param_t *param;    /**< OST index and limits */
+    action_summary_t     *summary;
+    /** candidates waiting to be pushed to the workers queue */
+    GQueue                buffer;
+    /** buffered or pushed candidates, not acknowledged yet */
+    counters_t            pending;
+    unsigned int          inflight;
+    /** successful actions of candidates assigned to this OST
+     * (targeted: blocks freed on this OST by all actions) */
+    counters_t            done;
+    /** rate limits of this OST target */
+    struct rate_limiter   rate;
+    bool                  reached;
+};
+
+struct ost_run {
+    pthread_mutex_t  lock;
+    struct ost_pass *passes;
+    unsigned int     count;
+    unsigned int     active;    /**< OSTs that did not reach their target */
+    unsigned int     buffered;
+};
+
+/* max candidates buffered per OST, waiting for their turn */
+#define OST_BUFFER_SIZE 1024
+
+static struct rate_limiter *ost_rate_limiter(const queue_item_t *item)
+{
+    return &item->ost_run->passes[item->ost_pass].rate;
+}
+
+static bool entry_on_ost(const attr_set_t *attrs, unsigned int ost_idx)
+{
+    unsigned int i;
+
+    if (!ATTR_MASK_TEST(attrs, stripe_items))
+        return false;
+
+    for (i = 0; i < ATTR(attrs, stripe_items).count; i++)
+        if (ATTR(attrs, stripe_items).stripe[i].ost_idx == ost_idx)
+            return true;
+    return false;
+}
+
+/** the limit of this OST is reached, counting pending actions */
+static bool ost_pass_full(policy_info_t *pol, const struct ost_pass *p)
+{
+    counters_t pot = p->pending;
+
+    if (p->reached)
+        return true;
+    if (no_limit(pol))
+        return false;
+
+    counters_add(&pot, &p->done);
+    return counter_reached_limit(&pot, &p->param->target_ctr);
+}
 
-    /* Do nothing if no previous scan was done
-     * (except if --force is specified). */
-    rc = check_scan_done(p_pol_info, lmgr);
-    if (rc)
-        return rc;
+/** must be called with run->lock held */
+static void ost_pass_check_limit(policy_info_t *pol, struct ost_run *run,
+                                 struct ost_pass *p)
+{
+    if (p->reached || no_limit(pol)
+        || !counter_reached_limit(&p->done, &p->param->target_ctr))
+        return;
 
-    /* set attributes to be retrieved from DB */
-    attr_mask = db_attr_mask(p_pol_info, p_param);
+    p->reached = true;
+    run->active--;
+    DisplayLog(LVL_EVENT, tag(pol), "Target reached for OST #%u",
+               p->param->optarg_u.index);
+}
 
-    /* sort by last access */
-    // TODO manage random
-    sort_type.attr_index = p_pol_info->config->lru_sort_attr;
-    sort_type.order = p_pol_info->config->lru_sort_attr == LRU_ATTR_NONE ?
-        SORT_NONE : SORT_ASC;
+/**
+ * Select the OST a candidate is processed for: among the OSTs of the
+ * entry that need more actions, the one with the less pending candidates.
+ * Candidates of OSTs that already have enough pending actions are skipped
+ * (they will be listed again by the next run, if some actions fail).
+ * @return the index of the OST pass, -1 if no OST needs this entry.
+ */
+static int ost_run_assign(policy_info_t *pol, struct ost_run *run,
+                          const attr_set_t *attrs)
+{
+    unsigned int i;
+    int best = -1;
 
-    rc = lmgr_simple_filter_init(&filter);
-    if (rc)
-        return rc;
+    for (i = 0; i < run->count; i++) {
+        struct ost_pass *p = &run->passes[i];
 
-    /* filter entries in the policy scope */
-    DisplayLog(LVL_FULL, tag(p_pol_info),
-               "Converting scope to DB filter...");
-    if (convert_boolexpr_to_simple_filter
-        (&p_pol_info->descr->scope, &filter, p_pol_info->descr->status_mgr,
-         p_pol_info->time_modifier,
-         p_pol_info->descr->manage_deleted ? FILTER_FLAG_ALLOW_NULL : 0)) {
-        DisplayLog(LVL_DEBUG, tag(p_pol_info),
-                   "Could not convert policy scope to simple filter.");
-        DisplayLog(LVL_EVENT, tag(p_pol_info),
-                   "Warning: scope definition is too complex and may affect policy run performance");
+        if (!entry_on_ost(attrs, p->param->optarg_u.index)
+            || ost_pass_full(pol, p))
+            continue;
+
+        if (best == -1 || p->pending.count < run->passes[best].pending.count)
+            best = i;
     }
+    return best;
+}
 
-    if (!p_pol_info->descr->manage_deleted) {
-        /* do not retrieve 'invalid' entries */
-        fval.value.val_bool = false;
-        rc = lmgr_simple_filter_add(&filter, ATTR_INDEX_invalid, EQUAL,
-                                    fval, FILTER_FLAG_ALLOW_NULL);
-        if (rc)
-            return rc;
+/**
+ * Push buffered candidates to the workers queue, one OST after the other,
+ * so that each OST keeps its share of the workers.
+ * Candidates of OSTs that reached their target are dropped.
+ * @return the number of pushed candidates.
+ */
+static unsigned int ost_run_dispatch(policy_info_t *pol, struct ost_run *run)
+{
+    unsigned int pushed = 0;
+    bool progress;
+
+    do {
+        unsigned int i;
+
+        progress = false;
+        for (i = 0; i < run->count; i++) {
+            struct ost_pass *p = &run->passes[i];
+            unsigned int share;
+            queued_item_t *item;
+
+            P(run->lock);
+            share = MAX2(2 * pol->config->nb_threads / MAX2(run->active, 1),
+                         1);
+            if (g_queue_is_empty(&p->buffer)
+                || (!p->reached && p->inflight >= share)) {
+                V(run->lock);
+                continue;
+            }
+            item = g_queue_pop_head(&p->buffer);
+            run->buffered--;
+
+            if (p->reached) {
+                counters_sub(&p->pending, &item->amount);
+                V(run->lock);
+                free_queued_item(item);
+                progress = true;
+                continue;
+            }
+            p->inflight++;
+            V(run->lock);
+
+            if (Queue_Insert(&pol->queue, item) == 0)
+                pushed++;
+            else {
+                P(run->lock);
+                p->inflight--;
+                counters_sub(&p->pending, &item->amount);
+                p->summary->errors++;
+                V(run->lock);
+                free_queued_item(item);
+            }
+            progress = true;
+        }
+    } while (progress);
+
+    return pushed;
+}
+
+/**
+ * Wait while all the OSTs that did not reach their target have enough
+ * pending actions to reach it (like check_queue_limit() for single runs).
+ * @return the number of OSTs that did not reach their target.
+ */
+static unsigned int ost_run_wait(policy_info_t *pol, struct ost_run *run)
+{
+    for (;;) {
+        unsigned int i, active;
+        bool full = true;
+
+        P(run->lock);
+        active = run->active;
+        for (i = 0; i < run->count && full; i++)
+            full = ost_pass_full(pol, &run->passes[i]);
+        V(run->lock);
+
+        if (!full || active == 0 || aborted(pol))
+            return active;
+
+        ost_run_dispatch(pol, run);
+        rh_usleep(MIN_CHECK_DELAY);
     }
+}
 
-    /* set target filter and attr mask */
-    rc = set_target_filter(p_pol_info, p_param, &filter, &attr_mask);
+/** acknowledge an action of a combined OST run (called by workers) */
+static void ost_run_ack(queue_item_t *item, unsigned int status,
+                        policy_info_t *pol)
+{
+    struct ost_run *run = item->ost_run;
+    struct ost_pass *p;
+    counters_t amount;
+    blkcnt_t *stripe_blocks = NULL;
+    unsigned int i, j, nb_stripes = 0;
+
+    if (run == NULL)
+        return;
+
+    p = &run->passes[item->ost_pass];
+    amount = item->amount;
+
+    /* blocks freed on each OST of the entry, computed once for all passes */
+    if (status == AS_OK && ATTR_MASK_TEST(&item->entry_attr, blocks)
+        && ATTR_MASK_TEST(&item->entry_attr, stripe_info)
+        && ATTR_MASK_TEST(&item->entry_attr, stripe_items)) {
+        const stripe_info_t *sinfo = &ATTR(&item->entry_attr, stripe_info);
+
+        if (sinfo->stripe_count > 0)
+            stripe_blocks = MemCalloc(sinfo->stripe_count,
+                                      sizeof(*stripe_blocks));
+        if (stripe_blocks != NULL)
+            nb_stripes = BlocksByOST(ATTR(&item->entry_attr, blocks), sinfo,
+                                     &ATTR(&item->entry_attr, stripe_items),
+                                     stripe_blocks);
+    }
+
+    P(run->lock);
+    p->inflight--;
+    counters_sub(&p->pending, &amount);
+
+    if (status == AS_OK) {
+        amount.targeted = 0;
+        counters_add(&p->done, &amount);
+        counters_add(&p->summary->action_ctr, &amount);
+
+        /* the action freed blocks on all the OSTs of the entry */
+        for (i = 0; i < run->count; i++) {
+            struct ost_pass *o = &run->passes[i];
+            ull_t blocks = 0;
+
+            for (j = 0; j < nb_stripes; j++)
+                if (ATTR(&item->entry_attr, stripe_items).stripe[j].ost_idx
+                    == o->param->optarg_u.index)
+                    blocks += stripe_blocks[j];
+            if (blocks == 0)
+                continue;
+
+            o->done.targeted += blocks;
+            if (o == p)
+                p->summary->action_ctr.targeted += blocks;
+            ost_pass_check_limit(pol, run, o);
+        }
+        ost_pass_check_limit(pol, run, p);
+    } else if (status >= AS_MISSING_MD && status <= AS_ERROR)
+        p->summary->errors++;
+    else
+        p->summary->skipped++;
+    V(run->lock);
+
+    if (stripe_blocks != NULL)
+        MemFree(stripe_blocks);
+}
+
+/**
+* Run a policy on several OSTs at once: candidates of all the OSTs
+* are listed by a single DB request, and each candidate is assigned to one
+* of its OSTs that didn't reach its target. Workers are shared fairly
+* between OSTs, so they are all drained in parallel.
+* @param[in]  p_params   one per OST (target must be TGT_OST)
+* @param[out] summaries  one per OST
+* @return 0 on success, a POSIX error code else, -1 for internal failure.
+*/
+int run_policy_osts(policy_info_t *pol, const policy_param_t *p_params,
+                    unsigned int count, action_summary_t *summaries,
+                    lmgr_t *lmgr)
+{
+    struct policy_iter it = { 0 };
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    lmgr_sort_type_t sort_type;
+    lmgr_filter_t filter;
+    filter_value_t fval;
+    struct ost_run run;
+    attr_mask_t attr_mask = { 0 };
+    unsigned long long feedback_before[AF_ENUM_COUNT];
+    unsigned long long feedback_after[AF_ENUM_COUNT];
+    unsigned int status_tab_before[AS_ENUM_COUNT];
+    unsigned int status_tab_after[AS_ENUM_COUNT];
+    counters_t pushed_ctr;
+    unsigned int i;
+    int rc;
+
+    if (count == 0)
+        return 0;
+
+    pol->time_modifier = p_params[0].time_mod;
+    pol->trigger_action_params = p_params[0].action_params;
+    memset(&pol->progress, 0, sizeof(pol->progress));
+    pol->action_usec = 0;
+    pol->action_count = 0;
+
+    rc = check_scan_done(pol, lmgr);
     if (rc)
         return rc;
 
-    /* Flushing messages before performing the long DB sort query */
+    memset(&run, 0, sizeof(run));
+    pthread_mutex_init(&run.lock, NULL);
+    run.passes = MemCalloc(count, sizeof(*run.passes));
+    fval.list.values = MemCalloc(count, sizeof(*fval.list.values));
+    fval.list.count = count;
+    if (run.passes == NULL || fval.list.values == NULL) {
+        rc = ENOMEM;
+        goto free_run;
+    }
+    run.count = run.active = count;
+
+    for (i = 0; i < count; i++) {
+        if (p_params[i].target != TGT_OST)
+            RBH_BUG("Only OST targets are expected in run_policy_osts()");
+
+        run.passes[i].param = &p_params[i];
+        run.passes[i].summary = &summaries[i];
+        memset(&summaries[i], 0, sizeof(summaries[i]));
+        g_queue_init(&run.passes[i].buffer);
+        rate_limiter_init(&run.passes[i].rate, p_params[i].action_rate,
+                          p_params[i].volume_rate);
+        fval.list.values[i].val_uint = p_params[i].optarg_u.index;
+        /* all passes need the same attributes */
+        attr_mask = db_attr_mask(pol, &p_params[i]);
+    }
+    attr_mask.std |= ATTR_MASK_stripe_info | ATTR_MASK_stripe_items;
+
+    rc = init_run_filter(pol, &filter);
+    if (rc)
+        goto free_run;
+
+    DisplayLog(LVL_MAJOR, tag(pol), "Starting policy run on %u OSTs", count);
+    rc = lmgr_simple_filter_add(&filter, ATTR_INDEX_stripe_items, IN, fval,
+                                0);
+    if (rc)
+        goto free_filter;
+
     FlushLogs();
 
-    /* add optimisation filters based on policies */
-    if (!ignore_policies(p_pol_info))
-        set_optimization_filters(p_pol_info, &filter);
+    if (!ignore_policies(pol))
+        set_optimization_filters(pol, &filter);
 
-    /* Do not retrieve all entries at once, as the result may exceed
-     * the client memory! */
-    opt.list_count_max = p_pol_info->config->db_request_limit;
-    nb_returned = 0;
-    total_returned = 0;
+    marks_init(pol, lmgr);
+    marks_iter_opt(pol, &opt);
 
-    rc = iter_open(lmgr,
-                   p_pol_info->descr->manage_deleted ? IT_RMD : IT_LIST,
-                   &it, &filter, &sort_type, &opt);
+    sort_type.attr_index = pol->config->lru_sort_attr;
+    sort_type.order = pol->config->lru_sort_attr == LRU_ATTR_NONE ?
+        SORT_NONE : SORT_ASC;
+
+    /* The listing is not restarted after each pass, as for single runs:
+     * stream the whole result. */
+    opt.stream = true;
+
+    rc = iter_open(pol, lmgr, IT_LIST, &it, &filter, &sort_type, &opt,
+                   attr_mask);
     if (rc != DB_SUCCESS) {
-        lmgr_simple_filter_free(&filter);
-        DisplayLog(LVL_CRIT, tag(p_pol_info),
-                   "Error retrieving list of candidates from database. "
-                   "Policy run cancelled.");
-        return rc;
+        DisplayLog(LVL_CRIT, tag(pol), "Error retrieving list of candidates "
+                   "from database. Policy run cancelled.");
+        goto free_filter;
     }
 
-    p_pol_info->progress.policy_start = p_pol_info->progress.last_report
-        = time(NULL);
+    pol->progress.policy_start = pol->progress.last_report = time(NULL);
+    for (i = 0; i < count; i++)
+        summaries[i].policy_start = pol->progress.policy_start;
+
+    init_pass_stats(pol, &pushed_ctr, status_tab_before, status_tab_after,
+                    feedback_before, feedback_after);
 
-    /* start alert batching in case the policy trigger alerts */
     Alert_StartBatching();
 
-    /* loop on all policy passes */
-    do {
-        /* check if progress must be reported  */
-        report_progress(p_pol_info, NULL, NULL, NULL, NULL);
+    for (;;) {
+        attr_set_t attr_set = ATTR_SET_INIT;
+        entry_id_t entry_id;
+        queued_item_t *item;
+        counters_t amount;
+        int idx;
 
-        /* feed workers until the specified limit is reached or
-         * end of list is reached */
-        st = fill_workers_queue(p_pol_info, p_param, lmgr, &it, &opt,
-                                &sort_type, &filter, attr_mask,
-                                &last_sort_time, &nb_returned,
-                                &total_returned);
-        switch (st) {
-        case PASS_EOL:
-            rc = 0;
+        report_progress(pol, NULL, NULL, NULL, NULL);
+
+        /* wait for pending actions if all OSTs may reach their target */
+        if (ost_run_wait(pol, &run) == 0)
             break;
-        case PASS_ABORTED:
+
+        attr_set.attr_mask = attr_mask;
+        memset(&entry_id, 0, sizeof(entry_id));
+
+        rc = iter_next(&it, &entry_id, &attr_set);
+        if (aborted(pol)) {
+            if (rc == 0)
+                ListMgr_FreeAttrs(&attr_set);
+            DisplayLog(LVL_MAJOR, tag(pol),
+                       "Policy run aborted, stop enqueuing requests.");
             rc = ECANCELED;
             break;
-        case PASS_LIMIT:
+        } else if (rc == DB_END_OF_LIST) {
             rc = 0;
             break;
-        case PASS_ERROR:
+        } else if (rc != 0) {
+            DisplayLog(LVL_CRIT, tag(pol),
+                       "Error %d getting next entry of iterator", rc);
             rc = -1;
             break;
         }
 
-    /* exit in all cases except pass_limit (double check the limit in this
-     * case): check the real amount of performed actions
-     * (progress.action_ctr) */
-    } while ((st == PASS_LIMIT) &&
-             !check_limit(p_pol_info, &p_pol_info->progress.action_ctr,
-                          p_pol_info->progress.errors,
-                          &p_param->target_ctr));
+        P(run.lock);
+        idx = ost_run_assign(pol, &run, &attr_set);
+        if (idx == -1) {
+            V(run.lock);
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
 
-    lmgr_simple_filter_free(&filter);
-    /* iterator may have been closed in fill_workers_queue() */
+        if (entry2tgt_amount(&p_params[idx], &attr_set, &amount) == -1) {
+            V(run.lock);
+            ListMgr_FreeAttrs(&attr_set);
+            continue;
+        }
+
+        item = entry2queue_item(&entry_id, &attr_set, &amount);
+        if (item == NULL) {
+            V(run.lock);
+            ListMgr_FreeAttrs(&attr_set);
+            rc = ENOMEM;
+            break;
+        }
+        item->ost_run = &run;
+        item->ost_pass = idx;
+
+        g_queue_push_tail(&run.passes[idx].buffer, item);
+        counters_add(&run.passes[idx].pending, &amount);
+        run.buffered++;
+        V(run.lock);
+        counters_add(&pushed_ctr, &amount);
+
+        ost_run_dispatch(pol, &run);
+
+        /* too many candidates are waiting for their OST to get a worker */
+        while (run.buffered >= OST_BUFFER_SIZE * count && !aborted(pol)) {
+            rh_usleep(MIN_CHECK_DELAY);
+            ost_run_dispatch(pol, &run);
+        }
+    }
     iter_close(&it);
 
-    /* flush pending alerts */
+    /* push remaining candidates, and wait for all actions to be done
+     * before releasing the run */
+    for (;;) {
+        unsigned int pending = 0;
+
+        ost_run_dispatch(pol, &run);
+
+        P(run.lock);
+        for (i = 0; i < count; i++)
+            pending += run.passes[i].inflight
+                       + g_queue_get_length(&run.passes[i].buffer);
+        V(run.lock);
+
+        if (pending == 0)
+            break;
+        rh_usleep(MIN_CHECK_DELAY);
+    }
+
     Alert_EndBatching();
 
-    if (p_summary)
-        *p_summary = p_pol_info->progress;
+    update_pass_stats(pol, status_tab_before, status_tab_after,
+                      feedback_before, feedback_after);
 
+    for (i = 0; i < count; i++)
+        DisplayLog(LVL_DEBUG, tag(pol), "OST #%u: %llu actions, "
+                   "%llu blocks freed%s", p_params[i].optarg_u.index,
+                   run.passes[i].done.count, run.passes[i].done.targeted,
+                   run.passes[i].reached ? " (target reached)" : "");
+
+free_filter:
+    lmgr_simple_filter_free(&filter);
+free_run:
+    MemFree(fval.list.values);
+    for (i = 0; run.passes != NULL && i < count; i++)
+        pthread_mutex_destroy(&run.passes[i].rate.lock);
+    MemFree(run.passes);
+    pthread_mutex_destroy(&run.lock);
     return rc;
 }
+#endif
+
+/* In worker threads, entry updates and removals are written to the DB
+ * by batches. Acknowledgements are delayed until pending operations are
+ * written, so a finished policy run never leaves outdated entries in the DB.
+ * An entry appears at most once in a batch, so the order of operations
+ * doesn't matter. */
+#define UPDATE_BATCH_SIZE   64
+#define UPDATE_BATCH_DELAY  1   /* max delay of a pending update (s) */
+
+struct pending_ack {
+    unsigned int        status;
+    unsigned long long  feedback[AF_ENUM_COUNT];
+};
+
+struct update_batch {
+    lmgr_t             *lmgr;
+    entry_queue_t      *queue;
+    time_t              first;  /* time of the first pending operation */
+    /* pending updates */
+    unsigned int        count;
+    entry_id_t          ids[UPDATE_BATCH_SIZE];
+    attr_set_t          attrs[UPDATE_BATCH_SIZE];
+    /* pending removals (attrs only hold parent and name) */
+    unsigned int        rm_count;
+    entry_id_t          rm_ids[UPDATE_BATCH_SIZE];
+    attr_set_t          rm_attrs[UPDATE_BATCH_SIZE];
+    bool                rm_last[UPDATE_BATCH_SIZE];
+    /* pending discards from the softrm table */
+    unsigned int        discard_count;
+    entry_id_t          discard_ids[UPDATE_BATCH_SIZE];
+    unsigned int        ack_count;
+    struct pending_ack  acks[UPDATE_BATCH_SIZE];
+    /* pending ignore marks */
+    const char         *mark_policy;
+    unsigned int        mark_count;
+    lmgr_ignore_mark_t  marks[UPDATE_BATCH_SIZE];
+};
+
+static __thread struct update_batch *upd_batch = NULL;
+
+/** check if the batch has pending DB operations */
+static inline bool update_batch_pending(const struct update_batch *batch)
+{
+    return batch->count + batch->rm_count + batch->discard_count
+        + batch->mark_count > 0;
+}
+
+static void update_batch_flush(struct update_batch *batch)
+{
+    const entry_id_t *ids[UPDATE_BATCH_SIZE];
+    const attr_set_t *attrs[UPDATE_BATCH_SIZE];
+    unsigned int i;
+    int rc;
+
+    if (batch->count > 0) {
+        for (i = 0; i < batch->count; i++) {
+            ids[i] = &batch->ids[i];
+            attrs[i] = &batch->attrs[i];
+        }
+
+        rc = ListMgr_BatchUpdate(batch->lmgr, batch->count, ids, attrs);
+        if (rc)
+            DisplayLog(LVL_CRIT, TAG, "Error %d updating %u entries in "
+                       "database.", rc, batch->count);
+
+        for (i = 0; i < batch->count; i++)
+            ListMgr_FreeAttrs(&batch->attrs[i]);
+        batch->count = 0;
+    }
+
+    if (batch->rm_count > 0) {
+        for (i = 0; i < batch->rm_count; i++) {
+            ids[i] = &batch->rm_ids[i];
+            attrs[i] = &batch->rm_attrs[i];
+        }
+
+        rc = ListMgr_BatchRemove(batch->lmgr, batch->rm_count, ids, attrs,
+                                 batch->rm_last);
+        if (rc)
+            DisplayLog(LVL_CRIT, TAG, "Error %d removing %u entries from "
+                       "database.", rc, batch->rm_count);
+        batch->rm_count = 0;
+    }
+
+    if (batch->discard_count > 0) {
+        for (i = 0; i < batch->discard_count; i++)
+            ids[i] = &batch->discard_ids[i];
+
+        rc = ListMgr_SoftRemove_BatchDiscard(batch->lmgr,
+                                             batch->discard_count, ids);
+        if (rc)
+            DisplayLog(LVL_CRIT, TAG, "Error %d removing %u entries from "
+                       "database.", rc, batch->discard_count);
+        batch->discard_count = 0;
+    }
+
+    if (batch->mark_count > 0) {
+        rc = ListMgr_SetIgnoreMarks(batch->lmgr, batch->mark_policy,
+                                    batch->marks, batch->mark_count);
+        if (rc)
+            DisplayLog(LVL_CRIT, TAG, "Error %d setting ignore marks of %u "
+                       "entries in database.", rc, batch->mark_count);
+        batch->mark_count = 0;
+    }
+
+    for (i = 0; i < batch->ack_count; i++)
+        Queue_Acknowledge(batch->queue, batch->acks[i].status,
+                          batch->acks[i].feedback, AF_ENUM_COUNT);
+    batch->ack_count = 0;
+}
+
+static bool id_in_list(const entry_id_t *list, unsigned int count,
+                       const entry_id_t *p_entry_id)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        if (entry_id_equal(&list[i], p_entry_id))
+            return true;
+    return false;
+}
+
+/** make room for a new operation on an entry in the batch */
+static void update_batch_prepare(struct update_batch *batch,
+                                 const entry_id_t *p_entry_id)
+{
+    /* an entry must appear only once in a batch */
+    if (id_in_list(batch->ids, batch->count, p_entry_id)
+        || id_in_list(batch->rm_ids, batch->rm_count, p_entry_id)
+        || id_in_list(batch->discard_ids, batch->discard_count, p_entry_id))
+        update_batch_flush(batch);
+
+    if (!update_batch_pending(batch))
+        batch->first = coarse_time();
+}
+
+/** add an update to the batch of the current worker thread */
+static void update_batch_add(struct update_batch *batch,
+                             const entry_id_t *p_entry_id,
+                             const attr_set_t *p_attr_set)
+{
+    update_batch_prepare(batch, p_entry_id);
+
+    batch->ids[batch->count] = *p_entry_id;
+    memset(&batch->attrs[batch->count], 0, sizeof(attr_set_t));
+    ListMgr_MergeAttrSets(&batch->attrs[batch->count], p_attr_set, true);
+    batch->count++;
+
+    if (batch->count >= UPDATE_BATCH_SIZE)
+        update_batch_flush(batch);
+}
+
+/** add a removal to the batch of the current worker thread */
+static void update_batch_rm(struct update_batch *batch,
+                            const entry_id_t *p_entry_id,
+                            const attr_set_t *p_attr_set, bool last)
+{
+    attr_set_t *rm_attrs;
+
+    update_batch_prepare(batch, p_entry_id);
+
+    batch->rm_ids[batch->rm_count] = *p_entry_id;
+    batch->rm_last[batch->rm_count] = last;
+
+    /* only the name to be removed is needed */
+    rm_attrs = &batch->rm_attrs[batch->rm_count];
+    ATTR_MASK_INIT(rm_attrs);
+    if (ATTR_MASK_TEST(p_attr_set, parent_id)) {
+        ATTR_MASK_SET(rm_attrs, parent_id);
+        ATTR(rm_attrs, parent_id) = ATTR(p_attr_set, parent_id);
+    }
+    if (ATTR_MASK_TEST(p_attr_set, name)) {
+        ATTR_MASK_SET(rm_attrs, name);
+        rh_strncpy(ATTR(rm_attrs, name), ATTR(p_attr_set, name),
+                   sizeof(ATTR(rm_attrs, name)));
+    }
+    batch->rm_count++;
+
+    if (batch->rm_count >= UPDATE_BATCH_SIZE)
+        update_batch_flush(batch);
+}
+
+/** add a softrm discard to the batch of the current worker thread */
+static void update_batch_discard(struct update_batch *batch,
+                                 const entry_id_t *p_entry_id)
+{
+    update_batch_prepare(batch, p_entry_id);
+
+    batch->discard_ids[batch->discard_count++] = *p_entry_id;
+
+    if (batch->discard_count >= UPDATE_BATCH_SIZE)
+        update_batch_flush(batch);
+}
+
+/** add an ignore mark to the batch of the current worker thread */
+static void update_batch_mark(struct update_batch *batch, const char *policy,
+                              const lmgr_ignore_mark_t *mark)
+{
+    if (batch->mark_count > 0 && batch->mark_policy != policy)
+        update_batch_flush(batch);
+
+    if (!update_batch_pending(batch))
+        batch->first = coarse_time();
+
+    batch->mark_policy = policy;
+    batch->marks[batch->mark_count++] = *mark;
+
+    if (batch->mark_count >= UPDATE_BATCH_SIZE)
+        update_batch_flush(batch);
+}
 
 #ifndef _HAVE_FID
 /* If entries are accessed by FID, we can always get their status.
@@ -1777,6 +4686,11 @@ static inline int invalidate_entry(const policy_info_t *pol, lmgr_t *lmgr,
     ATTR_MASK_SET(&new_attr_set, invalid);
     ATTR(&new_attr_set, invalid) = true;
 
+    if (upd_batch != NULL && upd_batch->lmgr == lmgr) {
+        update_batch_add(upd_batch, p_entry_id, &new_attr_set);
+        return 0;
+    }
+
     /* update the entry */
     rc = ListMgr_Update(lmgr, p_entry_id, &new_attr_set);
     if (rc)
@@ -1786,6 +4700,27 @@ static inline int invalidate_entry(const policy_info_t *pol, lmgr_t *lmgr,
 }
 #endif
 
+/** acknowledge an entry, after the pending operations are written */
+static void policy_queue_ack(entry_queue_t *queue, unsigned int status,
+                             const unsigned long long *feedback)
+{
+    struct update_batch *batch = upd_batch;
+    struct pending_ack  *ack;
+
+    if (batch != NULL && batch->ack_count >= UPDATE_BATCH_SIZE)
+        update_batch_flush(batch);
+
+    if (batch == NULL || !update_batch_pending(batch)) {
+        Queue_Acknowledge(queue, status, (unsigned long long *)feedback,
+                          AF_ENUM_COUNT);
+        return;
+    }
+
+    ack = &batch->acks[batch->ack_count++];
+    ack->status = status;
+    memcpy(ack->feedback, feedback, sizeof(ack->feedback));
+}
+
 static inline int update_entry(lmgr_t *lmgr, const entry_id_t *p_entry_id,
                                const attr_set_t *p_attr_set)
 {
@@ -1795,6 +4730,11 @@ static inline int update_entry(lmgr_t *lmgr, const entry_id_t *p_entry_id,
     /* update classes according to new attributes */
     match_classes(p_entry_id, &tmp_attrset, NULL);
 
+    /* the new status may change the candidates of policies,
+     * and start or end the tracking of actions */
+    candidates_update(p_entry_id, &tmp_attrset);
+    tracker_update(p_entry_id, &tmp_attrset);
+
     /* /!\ do not update stripe info */
     /* @TODO actually, the best operation would be to update only
      * attributes that changed */
@@ -1807,6 +4747,11 @@ static inline int update_entry(lmgr_t *lmgr, const entry_id_t *p_entry_id,
     /* never update creation time */
     ATTR_MASK_UNSET(&tmp_attrset, creation_time);
 
+    if (upd_batch != NULL && upd_batch->lmgr == lmgr) {
+        update_batch_add(upd_batch, p_entry_id, &tmp_attrset);
+        return 0;
+    }
+
     /* update DB and skip the entry */
     rc = ListMgr_Update(lmgr, p_entry_id, &tmp_attrset);
     if (rc)
@@ -1816,6 +4761,65 @@ static inline int update_entry(lmgr_t *lmgr, const entry_id_t *p_entry_id,
     return rc;
 }
 
+/**
+ * Remember until when an ignored or non-matching entry can't become
+ * eligible, so next runs don't list it again before (if ignore marks
+ * are enabled).
+ */
+static void mark_entry(const policy_info_t *pol, lmgr_t *lmgr,
+                       const entry_id_t *p_entry_id,
+                       const attr_set_t *p_attr_set)
+{
+    struct next_change_arg nc;
+    lmgr_ignore_mark_t mark;
+    int rc;
+
+    /* the mark is only valid while md_update is unchanged */
+    if (!pol->marks || !ATTR_MASK_TEST(p_attr_set, md_update))
+        return;
+
+    nc.attrs = p_attr_set;
+    nc.time_min = marks_time_min(pol);
+    nc.now = time(NULL);
+    nc.next = nc.now + pol->config->ignore_mark_max_validity;
+
+    policy_exprs_foreach(pol, next_change_cb, &nc);
+    if (nc.next <= nc.now)
+        return;
+
+    mark.id = *p_entry_id;
+    mark.until = nc.next;
+    mark.md_update = ATTR(p_attr_set, md_update);
+
+    if (upd_batch != NULL && upd_batch->lmgr == lmgr) {
+        update_batch_mark(upd_batch, tag(pol), &mark);
+        return;
+    }
+
+    rc = ListMgr_SetIgnoreMarks(lmgr, tag(pol), &mark, 1);
+    if (rc)
+        DisplayLog(LVL_CRIT, tag(pol), "Error %d setting ignore mark of "
+                   "entry in database.", rc);
+}
+
+static inline int remove_entry(const policy_info_t *pol, lmgr_t *lmgr,
+                               const entry_id_t *p_entry_id,
+                               const attr_set_t *p_attr_set, bool last)
+{
+    int rc;
+
+    if (upd_batch != NULL && upd_batch->lmgr == lmgr) {
+        update_batch_rm(upd_batch, p_entry_id, p_attr_set, last);
+        return 0;
+    }
+
+    rc = ListMgr_Remove(lmgr, p_entry_id, p_attr_set, last);
+    if (rc)
+        DisplayLog(LVL_CRIT, tag(pol),
+                   "Error %d removing entry from database.", rc);
+    return rc;
+}
+
 #ifdef _HAVE_FID
 /**
 * Check that entry still exists
@@ -1866,7 +4870,7 @@ static int check_entry(const policy_info_t *policy, lmgr_t *lmgr,
 
     /* set update time of the structure */
     ATTR_MASK_SET(new_attr_set, md_update);
-    ATTR(new_attr_set, md_update) = time(NULL);
+    ATTR(new_attr_set, md_update) = coarse_time();
 
     /* get fullpath or name, if they are needed for applying policy */
     if (policy->descr->rules.run_attr_mask.std
@@ -1957,7 +4961,7 @@ static int check_entry(const policy_info_t *policy, lmgr_t *lmgr,
 
     /* set update time of the structure */
     ATTR_MASK_SET(new_attr_set, md_update);
-    ATTR(new_attr_set, md_update) = time(NULL);
+    ATTR(new_attr_set, md_update) = coarse_time();
 
     /* retrieve up-to-date status from status manager if the scope relies
      * on it */
@@ -2073,7 +5077,7 @@ static void log_action_success(const policy_info_t *pol,
             char strtime[256];
 
             FormatDurationFloat(strtime, sizeof(strtime),
-                                time(NULL) - sort_time);
+                                coarse_time() - sort_time);
             g_string_append_printf(str, ", %s %s ago", sort_attr_name(pol),
                                    strtime);
         } else
@@ -2115,8 +5119,15 @@ static void log_action_success(const policy_info_t *pol,
 }
 
 /* acknowledging helper */
-#define policy_ack(_q, _status, _pattrs, _tgt)  do {                 \
+#ifdef _LUSTRE
+#define ost_ack(_pol, _item, _status) ost_run_ack(_item, _status, _pol)
+#else
+#define ost_ack(_pol, _item, _status) do { } while (0)
+#endif
+
+#define policy_ack(_pol, _item, _status, _pattrs)  do {              \
             unsigned long long feedback[AF_ENUM_COUNT];              \
+            unsigned long _tgt = (_item)->targeted;                  \
             memset(feedback, 0, sizeof(feedback));   \
             if (_status == AS_OK) {             \
                 feedback[AF_NBR_OK] = 1;        \
@@ -2133,7 +5144,8 @@ static void log_action_success(const policy_info_t *pol,
                 feedback[AF_BLOCKS_NOK] = ATTR_MASK_TEST(_pattrs, blocks) ? \
                                           ATTR(_pattrs, blocks) : 0; \
             }                                   \
-            Queue_Acknowledge(_q, _status, feedback, AF_ENUM_COUNT); \
+            ost_ack(_pol, _item, _status);      \
+            policy_queue_ack(&(_pol)->queue, _status, feedback); \
        } while (0)
 
 /**
@@ -2143,6 +5155,14 @@ static void log_action_success(const policy_info_t *pol,
 static void post_action_cb(int action_rc, lmgr_t *lmgr, policy_info_t *pol,
                            entry_policy_info_t *epi, bool free_item)
 {
+    struct timeval t0;
+
+    gettimeofday(&t0, NULL);
+    policy_metrics_rule(pol, epi->rule, action_rc == 0,
+                        ATTR_MASK_TEST(&epi->fresh_attrs, size) ?
+                            ATTR(&epi->fresh_attrs, size) : 0,
+                        epi->action_usec);
+
     /* params are no longer needed */
     rbh_params_free(&epi->params);
 
@@ -2161,8 +5181,7 @@ static void post_action_cb(int action_rc, lmgr_t *lmgr, policy_info_t *pol,
         if (!pol->descr->manage_deleted)
             update_entry(lmgr, &epi->item->entry_id, &epi->fresh_attrs);
 
-        policy_ack(&pol->queue, AS_ERROR, &epi->item->entry_attr,
-                   epi->item->targeted);
+        policy_ack(pol, epi->item, AS_ERROR, &epi->item->entry_attr);
     } else {
         bool lastrm;
         int  rc;
@@ -2172,10 +5191,14 @@ static void post_action_cb(int action_rc, lmgr_t *lmgr, policy_info_t *pol,
 
         if (pol->descr->manage_deleted && (epi->after_action == PA_RM_ONE
                                            || epi->after_action == PA_RM_ALL)) {
-            rc = ListMgr_SoftRemove_Discard(lmgr, &epi->item->entry_id);
-            if (rc)
-                DisplayLog(LVL_CRIT, tag(pol),
-                           "Error %d removing entry from database.", rc);
+            if (upd_batch != NULL && upd_batch->lmgr == lmgr)
+                update_batch_discard(upd_batch, &epi->item->entry_id);
+            else {
+                rc = ListMgr_SoftRemove_Discard(lmgr, &epi->item->entry_id);
+                if (rc)
+                    DisplayLog(LVL_CRIT, tag(pol),
+                               "Error %d removing entry from database.", rc);
+            }
         } else {
 
             switch (epi->after_action) {
@@ -2190,30 +5213,30 @@ static void post_action_cb(int action_rc, lmgr_t *lmgr, policy_info_t *pol,
                 lastrm = ATTR_MASK_TEST(&epi->prev_attrs, nlink) ?
                          (ATTR(&epi->prev_attrs, nlink) <= 1) : 0;
 
-                rc = ListMgr_Remove(lmgr, &epi->item->entry_id,
-                    /* must be based on the DB content = old attrs */
-                                    &epi->item->entry_attr, lastrm);
-                if (rc)
-                    DisplayLog(LVL_CRIT, tag(pol),
-                               "Error %d removing entry from database.", rc);
+                /* must be based on the DB content = old attrs */
+                rc = remove_entry(pol, lmgr, &epi->item->entry_id,
+                                  &epi->item->entry_attr, lastrm);
+                if (lastrm) {
+                    candidates_remove(&epi->item->entry_id);
+                    tracker_remove(&epi->item->entry_id);
+                }
                 break;
 
             case PA_RM_ALL:
-                rc = ListMgr_Remove(lmgr, &epi->item->entry_id,
-                     /* must be based on the DB content = old attrs */
-                                    &epi->item->entry_attr, 1);
-                if (rc)
-                    DisplayLog(LVL_CRIT, tag(pol),
-                               "Error %d removing entry from database.", rc);
+                /* must be based on the DB content = old attrs */
+                rc = remove_entry(pol, lmgr, &epi->item->entry_id,
+                                  &epi->item->entry_attr, true);
+                candidates_remove(&epi->item->entry_id);
+                tracker_remove(&epi->item->entry_id);
                 break;
             }
 
         }
 
         /* TODO update targeted info */
-        policy_ack(&pol->queue, AS_OK, &epi->fresh_attrs,
-                   epi->item->targeted);
+        policy_ack(pol, epi->item, AS_OK, &epi->fresh_attrs);
     }
+    policy_metrics_add(pol, PHASE_POST, &t0);
 
     ListMgr_FreeAttrs(&epi->fresh_attrs);
 
@@ -2299,8 +5322,11 @@ static int refresh_match_entry(policy_info_t *pol, lmgr_t *lmgr,
                        epi->fileset ? epi->fileset->fileset_id :
                            "(ignore rule)");
 
-            if (!pol->descr->manage_deleted)
+            if (!pol->descr->manage_deleted) {
                 update_entry(lmgr, &epi->item->entry_id, &epi->fresh_attrs);
+                mark_entry(pol, lmgr, &epi->item->entry_id,
+                           &epi->fresh_attrs);
+            }
 
             return AS_WHITELISTED;
         } else if (match != POLICY_NO_MATCH) {
@@ -2334,8 +5360,10 @@ static int refresh_match_entry(policy_info_t *pol, lmgr_t *lmgr,
         DisplayLog(LVL_DEBUG, tag(pol), "Entry %s matches no policy rule",
                    ATTR(&epi->item->entry_attr, fullpath));
 
-        if (!pol->descr->manage_deleted)
+        if (!pol->descr->manage_deleted) {
             update_entry(lmgr, &epi->item->entry_id, &epi->fresh_attrs);
+            mark_entry(pol, lmgr, &epi->item->entry_id, &epi->fresh_attrs);
+        }
 
         return AS_NO_POLICY;
     }
@@ -2365,8 +5393,10 @@ static int refresh_match_entry(policy_info_t *pol, lmgr_t *lmgr,
                    ATTR(&epi->item->entry_attr, fullpath),
                    epi->rule->rule_id);
 
-        if (!pol->descr->manage_deleted)
+        if (!pol->descr->manage_deleted) {
             update_entry(lmgr, &epi->item->entry_id, &epi->fresh_attrs);
+            mark_entry(pol, lmgr, &epi->item->entry_id, &epi->fresh_attrs);
+        }
 
         return AS_WHITELISTED;
 
@@ -2394,6 +5424,7 @@ static void process_entry(policy_info_t *pol, lmgr_t *lmgr,
                           queue_item_t *p_item, bool free_item)
 {
     entry_policy_info_t epi = {0};
+    struct timeval      t0;
     int                 rc;
 
     epi.item = p_item;
@@ -2402,17 +5433,20 @@ static void process_entry(policy_info_t *pol, lmgr_t *lmgr,
         /* migration aborted by a signal, doesn't submit new migrations */
         DisplayLog(LVL_FULL, tag(pol),
                    "Policy run aborted: skipping pending requests");
-        policy_ack(&pol->queue, AS_ABORT, &p_item->entry_attr,
-                   p_item->targeted);
+        policy_ack(pol, p_item, AS_ABORT, &p_item->entry_attr);
         rc = AS_ABORT;
         goto out_free;
     }
 
-    /* refresh entry info and match policy rules */
+    /* refresh entry info and match policy rules
+     * (scope, whitelist and rules are checked at the same time) */
+    gettimeofday(&t0, NULL);
+    policy_eval_set_time(t0.tv_sec);
     rc = refresh_match_entry(pol, lmgr, &epi);
+    policy_eval_set_time(0);
+    policy_metrics_add(pol, PHASE_MATCH, &t0);
     if (rc != AS_OK) {
-        policy_ack(&pol->queue, rc, &p_item->entry_attr,
-                   p_item->targeted);
+        policy_ack(pol, p_item, rc, &p_item->entry_attr);
         goto out_free;
     }
 
@@ -2429,8 +5463,7 @@ static void process_entry(policy_info_t *pol, lmgr_t *lmgr,
         if (!pol->descr->manage_deleted)
             update_entry(lmgr, &p_item->entry_id, &epi.fresh_attrs);
 
-        policy_ack(&pol->queue, AS_ERROR, &p_item->entry_attr,
-                   p_item->targeted);
+        policy_ack(pol, p_item, AS_ERROR, &p_item->entry_attr);
         goto out_free;
     }
 
@@ -2438,8 +5471,13 @@ static void process_entry(policy_info_t *pol, lmgr_t *lmgr,
     /* @FIXME this only save scalar value, not values in allocated structures */
     epi.prev_attrs = epi.fresh_attrs;
 
+    /* only workers let commands run in the background */
+    epi.async = free_item && pol->async != NULL;
+
     /* apply action to the entry! */
     rc = policy_action(pol, &epi);
+    if (rc == -EINPROGRESS)
+        return;
 
     post_action_cb(rc, lmgr, pol, &epi, free_item);
 
@@ -2452,26 +5490,114 @@ out_free:
         free_queue_item(p_item);
 }
 
+
+/**
+ * Process an entry from the workers queue: the item is expanded and
+ * given to process_entry(), which releases it (possibly after the end of
+ * an asynchronous action).
+ */
+static void process_queued_item(policy_info_t *pol, lmgr_t *lmgr,
+                                queued_item_t *q)
+{
+    queue_item_t *item;
+
+    item = MemAllocTag(MEM_TAG_POLICY, sizeof(queue_item_t));
+    if (item != NULL && queued2work_item(q, item) == 0) {
+        free_queued_item(q);
+        process_entry(pol, lmgr, item, true);
+        return;
+    }
+
+    DisplayLog(LVL_CRIT, tag(pol), "Cannot allocate memory to process "
+               "entry " DFID, PFID(&q->entry_id));
+    /* a failed unpack already released the item attributes */
+    if (item != NULL)
+        MemFreeTag(item);
+
+    /* acknowledge the entry with its accounted amount */
+    {
+        queue_item_t tmp;
+
+        tmp.entry_id = q->entry_id;
+        tmp.targeted = q->amount.targeted;
+        tmp.amount = q->amount;
+        tmp.ost_run = q->ost_run;
+        tmp.ost_pass = q->ost_pass;
+        ATTR_SET_CLEAR(&tmp.entry_attr);
+        policy_ack(pol, &tmp, AS_ERROR, &tmp.entry_attr);
+    }
+    free_queued_item(q);
+}
+
 /**
 *  Main routine of policy thread
 */
 static void *thr_policy_run(void *arg)
 {
     int rc;
-    lmgr_t lmgr;
+    lmgr_t *lmgr = NULL;
     void *p_queue_entry;
-    policy_info_t *pol = (policy_info_t *) arg;
+    struct worker_arg *wa = arg;
+    policy_info_t *pol = wa->pol;
+
+    prof_set_role(PROF_ROLE_POLICY, tag(pol));
+    affinity_set_thread(pol->config->cpu_affinity, tag(pol));
+
+    upd_batch = MemCalloc(1, sizeof(*upd_batch));
+    if (upd_batch != NULL)
+        upd_batch->queue = &pol->queue;
+
+    for (;;) {
+        /* the pool was shrunk: this worker waits until it grows again */
+        if (wa->idx >= pol->pool->active) {
+            if (upd_batch != NULL && update_batch_pending(upd_batch))
+                update_batch_flush(upd_batch);
+            if (lmgr != NULL) {
+                ListMgr_Release(lmgr);
+                lmgr = NULL;
+            }
+            pool_wait_active(pol->pool, wa->idx);
+        }
 
-    rc = ListMgr_InitAccess(&lmgr);
-    if (rc) {
-        DisplayLog(LVL_CRIT, tag(pol),
-                   "Could not connect to database (error %d). Exiting.",
-                   rc);
-        exit(rc);
-    }
+        if (upd_batch != NULL && update_batch_pending(upd_batch)) {
+            if (coarse_time() - upd_batch->first >= UPDATE_BATCH_DELAY)
+                update_batch_flush(upd_batch);
+
+            /* write pending updates before waiting for new entries */
+            rc = Queue_TryGet(&pol->queue, &p_queue_entry);
+            if (rc == EAGAIN) {
+                update_batch_flush(upd_batch);
+                ListMgr_Release(lmgr);
+                lmgr = NULL;
+                rc = Queue_Get(&pol->queue, &p_queue_entry);
+            }
+        } else {
+            /* idle workers don't hold a DB connection */
+            rc = Queue_TryGet(&pol->queue, &p_queue_entry);
+            if (rc == EAGAIN) {
+                if (lmgr != NULL) {
+                    ListMgr_Release(lmgr);
+                    lmgr = NULL;
+                }
+                rc = Queue_Get(&pol->queue, &p_queue_entry);
+            }
+        }
 
-    while (Queue_Get(&pol->queue, &p_queue_entry) == 0)
-        process_entry(pol, &lmgr, (queue_item_t *) p_queue_entry, true);
+        if (rc != 0)
+            break;
+
+        if (lmgr == NULL) {
+            lmgr = ListMgr_Checkout();
+            if (lmgr == NULL) {
+                DisplayLog(LVL_CRIT, tag(pol),
+                           "Could not connect to database. Exiting.");
+                exit(DB_CONNECT_FAILED);
+            }
+            if (upd_batch != NULL)
+                upd_batch->lmgr = lmgr;
+        }
+        process_queued_item(pol, lmgr, p_queue_entry);
+    }
 
     /* Error occurred in queue management... */
     DisplayLog(LVL_CRIT, tag(pol),
@@ -2480,27 +5606,380 @@ static void *thr_policy_run(void *arg)
     return NULL;    /* for avoiding compiler warnings */
 }
 
-int start_worker_threads(policy_info_t *pol)
+/** pool bounds from the policy config (called with pool lock held) */
+static void pool_set_bounds(policy_info_t *pol)
 {
-    unsigned int i;
+    const policy_run_config_t *cfg = pol->config;
+    struct worker_pool *pool = pol->pool;
+
+    if (cfg->nb_threads_max != 0) {
+        pool->min = cfg->nb_threads_min;
+        pool->max = cfg->nb_threads_max;
+        pool->active = MIN2(MAX2(cfg->nb_threads, pool->min), pool->max);
+    } else
+        pool->min = pool->max = pool->active = cfg->nb_threads;
+}
 
-    pol->threads = (pthread_t *) MemCalloc(pol->config->nb_threads,
-                                           sizeof(pthread_t));
-    if (!pol->threads) {
-        DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+/** start the workers up to pool->max (called with pool lock held) */
+static int pool_start_workers(policy_info_t *pol)
+{
+    struct worker_pool *pool = pol->pool;
+    struct worker_arg *args;
+    pthread_t *threads;
+    unsigned int i, count;
+    int rc;
+
+    if (pool->max <= pool->started)
+        return 0;
+    count = pool->max - pool->started;
+
+    /* running workers keep a pointer to their argument:
+     * allocate a new array for the new ones */
+    threads = MemRealloc(pol->threads, pool->max * sizeof(pthread_t));
+    if (!threads)
+        return ENOMEM;
+    pol->threads = threads;
+    args = MemCalloc(count, sizeof(*args));
+    if (!args)
         return ENOMEM;
-    }
 
-    for (i = 0; i < pol->config->nb_threads; i++) {
-        if (pthread_create(&pol->threads[i], NULL, thr_policy_run, pol) !=
-            0) {
-            int rc = errno;
+    for (i = 0; i < count; i++) {
+        args[i].pol = pol;
+        args[i].idx = pool->started;
+        if (pthread_create(&pol->threads[pool->started], NULL,
+                           thr_policy_run, &args[i]) != 0) {
+            rc = errno;
             DisplayLog(LVL_CRIT, tag(pol),
                        "Error %d creating policy threads in %s: %s", rc,
                        __func__, strerror(rc));
+            /* the new slots of the pool are not usable */
+            pool->max = pool->started;
+            pool->active = MIN2(pool->active, pool->max);
+            if (i == 0)
+                MemFree(args);
+            return rc;
+        }
+        pool->started++;
+    }
+
+    if (adaptive_pool(pol) && !pool->adapt_started) {
+        if (pthread_create(&pool->adapt_thr, NULL, thr_pool_adapt, pol) != 0) {
+            rc = errno;
+            DisplayLog(LVL_CRIT, tag(pol),
+                       "Error %d creating worker pool thread in %s: %s", rc,
+                       __func__, strerror(rc));
             return rc;
         }
+        pool->adapt_started = true;
+    }
+    return 0;
+}
+
+int start_worker_threads(policy_info_t *pol)
+{
+    const policy_run_config_t *cfg = pol->config;
+    struct worker_pool *pool;
+    int rc;
+
+    pool = MemCalloc(1, sizeof(*pool));
+    if (!pool) {
+        DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+        return ENOMEM;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pol->pool = pool;
+    pool_set_bounds(pol);
+
+    pol->rate = MemAlloc(sizeof(*pol->rate));
+    pol->run_rate = MemAlloc(sizeof(*pol->run_rate));
+    if (!pol->rate || !pol->run_rate) {
+        DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+        return ENOMEM;
+    }
+    /* policy rates are read from config, as they can be reloaded */
+    rate_limiter_init(pol->rate, 0.0, 0);
+    rate_limiter_init(pol->run_rate, 0.0, 0);
+
+    if (policy_metrics_init(pol)) {
+        DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+        return ENOMEM;
+    }
+
+    if (cfg->max_async_actions != 0) {
+        pol->async = MemCalloc(1, sizeof(*pol->async));
+        if (!pol->async) {
+            DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+            return ENOMEM;
+        }
+        pthread_mutex_init(&pol->async->lock, NULL);
+        pthread_cond_init(&pol->async->cond, NULL);
+        DisplayLog(LVL_VERB, tag(pol), "Up to %u command actions in flight",
+                   cfg->max_async_actions);
+    }
+
+    P(pool->lock);
+    rc = pool_start_workers(pol);
+    V(pool->lock);
+    if (rc == ENOMEM)
+        DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+    if (rc)
+        return rc;
+
+    if (adaptive_pool(pol))
+        DisplayLog(LVL_VERB, tag(pol), "Adaptive worker pool: %u workers "
+                   "(min: %u, max: %u)", pool->active, pool->min, pool->max);
+    return 0;
+}
+
+int policy_pool_reconfig(policy_info_t *pol)
+{
+    struct worker_pool *pool = pol->pool;
+    int rc;
+
+    if (pool == NULL)
+        return 0;
+
+    P(pool->lock);
+    pool_set_bounds(pol);
+    /* threads are never terminated: the extra ones are parked */
+    rc = pool_start_workers(pol);
+    if (rc == ENOMEM)
+        DisplayLog(LVL_CRIT, tag(pol), "Memory error in %s", __func__);
+    pool->dir = 0;
+    pool->hold = POOL_HOLD_PERIODS;
+    pthread_cond_broadcast(&pool->cond);
+    DisplayLog(LVL_EVENT, tag(pol), "Worker pool: %u workers (min: %u, "
+               "max: %u)", pool->active, pool->min, pool->max);
+    V(pool->lock);
+    return rc;
+}
+
+/** load the candidate index of a policy from the entries of its scope */
+static void *thr_candidates_load(void *arg)
+{
+    policy_info_t *pol = arg;
+    struct lmgr_iterator_t *it;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    lmgr_filter_t filter;
+    lmgr_t lmgr;
+    unsigned long long count = 0;
+    int rc;
+
+    prof_set_role(PROF_ROLE_POLICY, "candidates");
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, tag(pol), "Could not connect to database "
+                   "(error %d): candidate index won't be available", rc);
+        return NULL;
+    }
+
+    rc = init_run_filter(pol, &filter);
+    if (rc)
+        goto close;
+
+    opt.stream = true;
+    it = ListMgr_Iterator(&lmgr, &filter, NULL, &opt);
+    if (it == NULL) {
+        DisplayLog(LVL_CRIT, tag(pol), "Error retrieving list of "
+                   "candidates from database: candidate index won't be "
+                   "available");
+        goto free_filter;
+    }
+
+    do {
+        attr_set_t attr_set = ATTR_SET_INIT;
+        entry_id_t entry_id;
+
+        if (pol->config->lru_sort_attr != LRU_ATTR_NONE)
+            attr_mask_set_index(&attr_set.attr_mask,
+                                pol->config->lru_sort_attr);
+
+        rc = ListMgr_GetNext(it, &entry_id, &attr_set);
+        if (rc)
+            break;
+
+        rc = candidates_load(policy_index(pol), &entry_id,
+                             get_sort_attr(pol, &attr_set));
+        ListMgr_FreeAttrs(&attr_set);
+        count++;
+    } while (rc == 0 && !aborted(pol));
+
+    ListMgr_CloseIterator(it);
+
+    if (rc == DB_END_OF_LIST)
+        candidates_load_done(policy_index(pol));
+    else if (!aborted(pol))
+        DisplayLog(LVL_CRIT, tag(pol), "Error %d loading candidate index "
+                   "after %llu entries: it won't be available", rc, count);
+
+free_filter:
+    lmgr_simple_filter_free(&filter);
+close:
+    ListMgr_CloseAccess(&lmgr);
+    return NULL;
+}
+
+int start_candidates_loader(policy_info_t *pol)
+{
+    pthread_t thr;
+    int rc;
+
+    if (!candidates_enabled(policy_index(pol)))
+        return 0;
+
+    DisplayLog(LVL_EVENT, tag(pol), "Loading candidate index from database");
+
+    if (pthread_create(&thr, NULL, thr_candidates_load, pol) != 0) {
+        rc = errno;
+        DisplayLog(LVL_CRIT, tag(pol),
+                   "Error %d creating candidate loader thread in %s: %s", rc,
+                   __func__, strerror(rc));
+        return rc;
+    }
+    pthread_detach(thr);
+    return 0;
+}
+
+/**
+ * Check the status of an entry with an outstanding action, and update it.
+ * @retval true if the status of the entry changed.
+ */
+static bool check_action_entry(policy_info_t *pol, lmgr_t *lmgr,
+                               queue_item_t *q_item)
+{
+    int  smi_index = pol->descr->status_mgr->smi_index;
+    bool changed = false;
+
+    if (ATTR_MASK_TEST(&q_item->entry_attr, fullpath))
+        DisplayLog(LVL_VERB, tag(pol), "Updating status of '%s'...",
+                   ATTR(&q_item->entry_attr, fullpath));
+
+    /* check entry */
+    if (check_entry(pol, lmgr, q_item, &q_item->entry_attr) != AS_OK) {
+        /* try again next time */
+        tracker_add(policy_index(pol), &q_item->entry_id, coarse_time());
+        return false;
+    }
+
+    if (ATTR_MASK_STATUS_TEST(&q_item->entry_attr, smi_index)) {
+        if (!status_eq(STATUS_ATTR(&q_item->entry_attr, smi_index),
+                       pol->descr->status_current)) {
+            DisplayLog(LVL_EVENT, tag(pol),
+                       "status of '%s' changed: now '%s'",
+                       ATTR(&q_item->entry_attr, fullpath),
+                       STATUS_ATTR(&q_item->entry_attr, smi_index));
+            changed = true;
+        } else
+            DisplayLog(LVL_EVENT, tag(pol),
+                       "status of '%s' is still '%s'",
+                       ATTR(&q_item->entry_attr, fullpath),
+                       STATUS_ATTR(&q_item->entry_attr, smi_index));
+    }
+
+    /* update entry status (and its tracking) */
+    update_entry(lmgr, &q_item->entry_id, &q_item->entry_attr);
+    return changed;
+}
+
+/** attributes to check outstanding actions */
+static attr_mask_t current_actions_mask(const policy_info_t *pol)
+{
+    attr_mask_t mask = { 0 };
+    attr_mask_t tmp;
+
+    attr_mask_set_index(&mask, ATTR_INDEX_fullpath);
+    attr_mask_set_index(&mask, ATTR_INDEX_path_update);
+
+    /* Add attrs to match policy scope */
+    mask = attr_mask_or(&mask, &pol->descr->scope_mask);
+
+    /* needed attributes from DB */
+    tmp = attrs_for_status_mask(mask.status, false);
+    return attr_mask_or(&mask, &tmp);
+}
+
+/**
+ * Only check the tracked actions that are overdue.
+ * Their status is first read from the DB, as it may have been updated by
+ * another process.
+ */
+static int check_tracked_actions(policy_info_t *pol, lmgr_t *lmgr,
+                                 unsigned int *p_nb_reset,
+                                 unsigned int *p_nb_total)
+{
+    int          smi_index = pol->descr->status_mgr->smi_index;
+    attr_mask_t  mask = current_actions_mask(pol);
+    entry_id_t  *list;
+    unsigned int count, total, i;
+    unsigned int nb_checked = 0;
+    unsigned int nb_aborted = 0;
+    queue_item_t q_item;
+    time_t       now = time(NULL);
+    int          rc;
+
+    attr_mask_set_index(&mask, ATTR_INDEX_md_update);
+
+    rc = tracker_get_due(policy_index(pol), now, &list, &count, &total);
+    if (rc)
+        return rc;
+
+    DisplayLog(LVL_DEBUG, tag(pol), "%u outstanding actions are overdue "
+               "(%u tracked)", count, total);
+
+    for (i = 0; i < count && !aborted(pol); i++) {
+        memset(&q_item, 0, sizeof(q_item));
+        q_item.entry_id = list[i];
+        q_item.entry_attr.attr_mask = mask;
+
+        rc = ListMgr_Get(lmgr, &list[i], &q_item.entry_attr);
+        if (rc == DB_NOT_EXISTS)
+            continue;
+        if (rc) {
+            DisplayLog(LVL_MAJOR, tag(pol), "Error %d getting entry "
+                       DFID " from database", rc, PFID(&list[i]));
+            tracker_add(policy_index(pol), &list[i], now);
+            continue;
+        }
+
+        /* the status was already updated by another process */
+        if (!ATTR_MASK_STATUS_TEST(&q_item.entry_attr, smi_index)
+            || !status_eq(STATUS_ATTR(&q_item.entry_attr, smi_index),
+                          pol->descr->status_current)) {
+            nb_aborted++;
+            ListMgr_FreeAttrs(&q_item.entry_attr);
+            continue;
+        }
+
+        /* the entry was updated recently: not overdue yet */
+        if (pol->config->action_timeout > 0
+            && ATTR_MASK_TEST(&q_item.entry_attr, md_update)
+            && ATTR(&q_item.entry_attr, md_update)
+                    > now - pol->config->action_timeout) {
+            tracker_add(policy_index(pol), &list[i],
+                        ATTR(&q_item.entry_attr, md_update));
+            ListMgr_FreeAttrs(&q_item.entry_attr);
+            continue;
+        }
+
+        nb_checked++;
+        if (check_action_entry(pol, lmgr, &q_item))
+            nb_aborted++;
+        ListMgr_FreeAttrs(&q_item.entry_attr);
     }
+
+    /* not checked because of abort */
+    for (; i < count; i++)
+        tracker_add(policy_index(pol), &list[i], now);
+
+    MemFree(list);
+
+    if (p_nb_total)
+        *p_nb_total = nb_checked;
+    if (p_nb_reset)
+        *p_nb_reset = nb_aborted;
     return 0;
 }
 
@@ -2511,6 +5990,8 @@ int start_worker_threads(policy_info_t *pol)
 * \param p_nb_total    [OUT] total number of actions checked
 *
 * Note:   the timeout is in pol->config
+* If actions are tracked, the first call lists all outstanding actions
+* from the DB to load the tracker, then only overdue actions are checked.
 */
 int check_current_actions(policy_info_t *pol, lmgr_t *lmgr,
                           unsigned int *p_nb_reset,
@@ -2527,36 +6008,31 @@ int check_current_actions(policy_info_t *pol, lmgr_t *lmgr,
     unsigned int nb_returned = 0;
     unsigned int nb_aborted = 0;
     attr_mask_t attr_mask_sav = { 0 };
-    attr_mask_t tmp;
+    bool load_tracker;
+    time_t now = time(NULL);
 
     /* do nothing if this policy applies to deleted entries */
     if (pol->descr->manage_deleted)
         return 0;
 
-    /* attributes to be retrieved */
-    ATTR_MASK_INIT(&q_item.entry_attr);
-    ATTR_MASK_SET(&q_item.entry_attr, fullpath);
-    ATTR_MASK_SET(&q_item.entry_attr, path_update);
-
-    /* Add attrs to match policy scope */
-    q_item.entry_attr.attr_mask = attr_mask_or(&q_item.entry_attr.attr_mask,
-                                               &pol->descr->scope_mask);
-
-    /* needed attributes from DB */
-    tmp = attrs_for_status_mask(q_item.entry_attr.attr_mask.status, false);
-    q_item.entry_attr.attr_mask =
-        attr_mask_or(&q_item.entry_attr.attr_mask, &tmp);
+    load_tracker = tracker_enabled(policy_index(pol));
+    if (load_tracker && tracker_loaded(policy_index(pol)))
+        return check_tracked_actions(pol, lmgr, p_nb_reset, p_nb_total);
 
-    attr_mask_sav = q_item.entry_attr.attr_mask;
+    /* attributes to be retrieved */
+    attr_mask_sav = current_actions_mask(pol);
+    if (load_tracker)
+        attr_mask_set_index(&attr_mask_sav, ATTR_INDEX_md_update);
 
     rc = lmgr_simple_filter_init(&filter);
     if (rc)
         return rc;
 
     /* if timeout is > 0, only select entries whose last update
-     * is old enough (last_update <= now - timeout) or NULL*/
-    if (pol->config->action_timeout > 0) {
-        fval.value.val_int = time(NULL) - pol->config->action_timeout;
+     * is old enough (last_update <= now - timeout) or NULL.
+     * All entries are listed to load the tracker. */
+    if (pol->config->action_timeout > 0 && !load_tracker) {
+        fval.value.val_int = now - pol->config->action_timeout;
         rc = lmgr_simple_filter_add(&filter, ATTR_INDEX_md_update, LESSTHAN,
                                     fval, FILTER_FLAG_ALLOW_NULL);
         if (rc)
@@ -2594,33 +6070,17 @@ int check_current_actions(policy_info_t *pol, lmgr_t *lmgr,
 
     while ((rc = ListMgr_GetNext(it, &q_item.entry_id, &q_item.entry_attr))
            == DB_SUCCESS) {
-        nb_returned++;
-
-        if (ATTR_MASK_TEST(&q_item.entry_attr, fullpath))
-            DisplayLog(LVL_VERB, tag(pol), "Updating status of '%s'...",
-                       ATTR(&q_item.entry_attr, fullpath));
-
-        /* check entry */
-        if (check_entry(pol, lmgr, &q_item, &q_item.entry_attr) == AS_OK) {
-            int smi_index = pol->descr->status_mgr->smi_index;
-
-            if (ATTR_MASK_STATUS_TEST(&q_item.entry_attr, smi_index)) {
-                if (strcmp(STATUS_ATTR(&q_item.entry_attr, smi_index),
-                           pol->descr->status_current)) {
-                    DisplayLog(LVL_EVENT, tag(pol),
-                               "status of '%s' changed: now '%s'",
-                               ATTR(&q_item.entry_attr, fullpath),
-                               STATUS_ATTR(&q_item.entry_attr, smi_index));
-                    nb_aborted++;
-                } else
-                    DisplayLog(LVL_EVENT, tag(pol),
-                               "status of '%s' is still '%s'",
-                               ATTR(&q_item.entry_attr, fullpath),
-                               STATUS_ATTR(&q_item.entry_attr, smi_index));
-            }
-
-            /* update entry status */
-            update_entry(lmgr, &q_item.entry_id, &q_item.entry_attr);
+        /* not overdue yet: only track it */
+        if (load_tracker && pol->config->action_timeout > 0
+            && ATTR_MASK_TEST(&q_item.entry_attr, md_update)
+            && ATTR(&q_item.entry_attr, md_update)
+                    > now - pol->config->action_timeout) {
+            tracker_add(policy_index(pol), &q_item.entry_id,
+                        ATTR(&q_item.entry_attr, md_update));
+        } else {
+            nb_returned++;
+            if (check_action_entry(pol, lmgr, &q_item))
+                nb_aborted++;
         }
 
         /* reset attr_mask, if it was altered by last ListMgr_GetNext() call */
@@ -2644,5 +6104,8 @@ int check_current_actions(policy_info_t *pol, lmgr_t *lmgr,
         return -1;
     }
 
+    if (load_tracker)
+        tracker_load_done(policy_index(pol));
+
     return 0;
 }
@@ -19,6 +19,7 @@
 #include "rbh_cfg_helpers.h"
 #include "run_policies.h"
 #include "rbh_misc.h"
+#include "rbh_affinity.h"
 #include "Memory.h"
 #include <errno.h>
 
@@ -36,10 +37,24 @@ static int polrun_set_default(const policy_descr_t *pol,
     memset(cfg, 0, sizeof(*cfg));
 
     cfg->nb_threads = 4;
+    cfg->nb_threads_min = 1;
+    cfg->nb_threads_max = 0;   /* fixed pool */
     cfg->queue_size = 4096;
     cfg->db_request_limit = 100000;
+    cfg->db_list_shards = 1;
+    cfg->max_parallel_osts = 1;
+    cfg->topk_sort = false;
+    cfg->topk_max_entries = 1000000;
+    cfg->candidate_index = false;
+    cfg->candidate_index_max = 10000000;
+    cfg->max_async_actions = 0;  /* synchronous */
+    cfg->track_actions = false;
     cfg->max_action_nbr = 0;    /* unlimited */
     cfg->max_action_vol = 0;    /* unlimited */
+    cfg->max_action_rate = 0.0; /* unlimited */
+    cfg->max_volume_rate = 0;   /* unlimited */
+    cfg->rate_limit_start = 0;  /* always */
+    cfg->rate_limit_end = 0;
 
     cfg->trigger_list = NULL;
     cfg->trigger_count = 0;
@@ -65,7 +80,9 @@ static int polrun_set_default(const policy_descr_t *pol,
     cfg->action_timeout = 2 * 3600; /* 2h */
 
     cfg->recheck_ignored_entries = false;
+    cfg->ignore_mark_max_validity = 0;  /* disabled */
     cfg->report_actions = true;
+    cfg->deleted_expiration = 0;    /* never */
 
     return 0;
 }
@@ -105,17 +122,33 @@ static void policy_run_cfg_write_default(FILE *output)
                "lru_sort_attr           : default_lru_sort_attr (from 'define_policy' block)");
     print_line(output, 1, "max_action_count        : 0 (unlimited)");
     print_line(output, 1, "max_action_volume       : 0 (unlimited)");
+    print_line(output, 1, "max_action_rate         : 0 (unlimited)");
+    print_line(output, 1, "max_volume_rate         : 0 (unlimited)");
+    print_line(output, 1, "rate_limit_hours        : always");
     print_line(output, 1, "suspend_error_pct       : disabled (0)");
     print_line(output, 1, "suspend_error_min       : disabled (0)");
     print_line(output, 1, "report_interval         : 10min");
     print_line(output, 1, "check_actions_on_startup: no");
     print_line(output, 1, "check_actions_interval  : 0 (disabled)");
     print_line(output, 1, "action_timeout          : 2h");
+    print_line(output, 1, "track_actions           : no");
     print_line(output, 1, "recheck_ignored_entries : no");
+    print_line(output, 1, "ignore_mark_max_validity: 0 (disabled)");
     print_line(output, 1, "report_actions          : yes");
+    print_line(output, 1, "deleted_expiration      : 0 (never)");
     print_line(output, 1, "nb_threads              : 4");
+    print_line(output, 1, "nb_threads_min          : 1");
+    print_line(output, 1, "nb_threads_max          : 0 (fixed pool)");
+    print_line(output, 1, "cpu_affinity            : \"\" (any CPU)");
     print_line(output, 1, "queue_size              : 4096");
     print_line(output, 1, "db_result_size_max      : 100000");
+    print_line(output, 1, "db_list_shards          : 1");
+    print_line(output, 1, "max_parallel_osts       : 1");
+    print_line(output, 1, "topk_sort               : no");
+    print_line(output, 1, "topk_max_entries        : 1000000");
+    print_line(output, 1, "candidate_index         : no");
+    print_line(output, 1, "candidate_index_max     : 10000000");
+    print_line(output, 1, "max_async_actions       : 0 (synchronous)");
     print_line(output, 1, "pre_maintenance_window  : 0 (disabled)");
     print_line(output, 1, "maint_min_apply_delay   : 30min");
     print_end_block(output, 0);
@@ -136,8 +169,74 @@ static void policy_run_cfg_write_template(FILE *output)
                "# maximum volume of processed files per policy run (default: no limit)");
     print_line(output, 1, "#max_action_volume = 10TB ;");
     fprintf(output, "\n");
+    print_line(output, 1,
+               "# max rate of actions (per second) and of their volume");
+    print_line(output, 1,
+               "# (per second). They can also be set in each trigger block.");
+    print_line(output, 1, "#max_action_rate = 100 ;");
+    print_line(output, 1, "#max_volume_rate = 500MB ;");
+    print_line(output, 1,
+               "# only enforce rate limits in this time window (default: always)");
+    print_line(output, 1, "#rate_limit_hours = \"08:00-20:00\" ;");
+    fprintf(output, "\n");
     print_line(output, 1, "# nbr of threads to execute policy actions");
     print_line(output, 1, "#nb_threads = 8;");
+    print_line(output, 1,
+               "# adjust the number of running threads between these bounds,");
+    print_line(output, 1,
+               "# depending on action throughput, latency and errors");
+    print_line(output, 1, "#nb_threads_min = 2;");
+    print_line(output, 1, "#nb_threads_max = 32;");
+    print_line(output, 1,
+               "# bind workers to CPUs (e.g. \"0-7\") or NUMA nodes (\"node:0\")");
+    print_line(output, 1, "#cpu_affinity = \"node:1\";");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# list candidates with several parallel DB requests, on subsets");
+    print_line(output, 1,
+               "# of entries merged in sort order (requires lru_sort_attr).");
+    print_line(output, 1,
+               "# Each request streams its whole result (db_result_size_max is ignored).");
+    print_line(output, 1, "#db_list_shards = 4;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# drain up to 16 overfull OSTs of an OST trigger in a single run,");
+    print_line(output, 1,
+               "# with workers shared between them (1 = one OST after the other)");
+    print_line(output, 1, "#max_parallel_osts = 16;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# when the run has a limit, select the first candidates in sort order");
+    print_line(output, 1,
+               "# in memory instead of sorting all of them in the DB.");
+    print_line(output, 1,
+               "# Switch back to DB sorting if more than topk_max_entries are needed.");
+    print_line(output, 1, "#topk_sort = yes;");
+    print_line(output, 1, "#topk_max_entries = 1000000;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# keep the entries in policy scope in memory, up to date with");
+    print_line(output, 1,
+               "# scans and changelogs processed by this daemon, so runs of the");
+    print_line(output, 1,
+               "# whole filesystem don't query the DB for their candidates.");
+    print_line(output, 1,
+               "# The index is dropped if it exceeds candidate_index_max entries.");
+    print_line(output, 1, "#candidate_index = yes;");
+    print_line(output, 1, "#candidate_index_max = 10000000;");
+    fprintf(output, "\n");
+    print_line(output, 1,
+               "# workers don't wait for the external commands of actions:");
+    print_line(output, 1,
+               "# up to 1000 commands run in the background, and a single thread");
+    print_line(output, 1,
+               "# handles their completion.");
+    print_line(output, 1,
+               "# For coproc(\"helper\", \"request\") actions, up to 1000 "
+               "requests");
+    print_line(output, 1,
+               "# are sent to the helper before waiting for replies.");
+    print_line(output, 1, "#max_async_actions = 1000;");
     fprintf(output, "\n");
     print_line(output, 1,
                "# suspend current run if 50%% of actions fail (after 100 errors):");
@@ -152,6 +251,13 @@ static void policy_run_cfg_write_template(FILE *output)
     print_line(output, 1,
                "# check the status of previously started actions on startup:");
     print_line(output, 1, "#check_actions_on_startup = yes;");
+    print_line(output, 1,
+               "# keep outstanding actions in memory: statuses reported by actions,");
+    print_line(output, 1,
+               "# scans and changelogs of this process end their tracking, and");
+    print_line(output, 1,
+               "# action checks only query the entries overdue by action_timeout.");
+    print_line(output, 1, "#track_actions = yes;");
     fprintf(output, "\n");
     print_line(output, 1,
                "# When applying policies, recheck entries that were previously");
@@ -162,9 +268,24 @@ static void policy_run_cfg_write_template(FILE *output)
                "# This can significantly slow down policy application.");
     print_line(output, 1, "#recheck_ignored_entries = no;");
     fprintf(output, "\n");
+    print_line(output, 1,
+               "# Remember until when ignored and non-matching entries can't");
+    print_line(output, 1,
+               "# become eligible (e.g. from age conditions), and skip them");
+    print_line(output, 1,
+               "# until then, or until their metadata are refreshed.");
+    print_line(output, 1, "# Marks are valid at most for this duration.");
+    print_line(output, 1, "#ignore_mark_max_validity = 7d;");
+    fprintf(output, "\n");
     print_line(output, 1, "# report actions to report log file?");
     print_line(output, 1, "# report_actions = yes;");
     fprintf(output, "\n");
+    print_line(output, 1,
+               "# policies of deleted entries: give up entries removed for");
+    print_line(output, 1,
+               "# longer than this, and discard them from the softrm table");
+    print_line(output, 1, "#deleted_expiration = 90d;");
+    fprintf(output, "\n");
     print_line(output, 1, "# pre-maintenance feature parameters");
     print_line(output, 1, "# 0 to disable this feature");
     print_line(output, 1, "#pre_maintenance_window = 24h;");
@@ -172,6 +293,7 @@ static void policy_run_cfg_write_template(FILE *output)
     fprintf(output, "\n");
     print_line(output, 1, "# internal/tuning parameters");
     print_line(output, 1, "#queue_size = 4096;");
+    print_line(output, 1, "# 0 = stream all candidates in a single request");
     print_line(output, 1, "#db_result_size_max = 100000;");
     print_line(output, 0, "#}");
     fprintf(output, "\n");
@@ -401,6 +523,25 @@ static int read_threshold_params(config_item_t config_blk,
     return 0;
 }
 
+/**
+ * Parse a time of day window "HH:MM-HH:MM".
+ * @param[out] start,end minutes since midnight.
+ */
+static int parse_time_window(const char *str, int *start, int *end)
+{
+    unsigned int h1, m1, h2, m2;
+    char extra;
+
+    if (sscanf(str, "%u:%u-%u:%u%c", &h1, &m1, &h2, &m2, &extra) != 4)
+        return EINVAL;
+    if (h1 > 24 || h2 > 24 || m1 > 59 || m2 > 59)
+        return EINVAL;
+
+    *start = (h1 * 60 + m1) % (24 * 60);
+    *end = (h2 * 60 + m2) % (24 * 60);
+    return 0;
+}
+
 /** parse a trigger block from configuration and fills a trigger item */
 static int parse_trigger_block(config_item_t config_blk, const char *block_name,
                                trigger_item_t *p_trigger_item, char *msg_out)
@@ -420,6 +561,7 @@ static int parse_trigger_block(config_item_t config_blk, const char *block_name,
         "high_threshold_cnt", "low_threshold_cnt",
         "alert_high", "alert_low", "post_trigger_wait",
         "action_params", "max_action_count", "max_action_volume",
+        "max_action_rate", "max_volume_rate",
         NULL
     };
 
@@ -428,6 +570,10 @@ static int parse_trigger_block(config_item_t config_blk, const char *block_name,
          &p_trigger_item->max_action_nbr, 0},
         {"max_action_volume", PT_SIZE, PFLG_POSITIVE,
          &p_trigger_item->max_action_vol, 0},
+        {"max_action_rate", PT_FLOAT, PFLG_POSITIVE,
+         &p_trigger_item->max_action_rate, 0},
+        {"max_volume_rate", PT_SIZE, PFLG_POSITIVE,
+         &p_trigger_item->max_volume_rate, 0},
         {"check_interval", PT_DURATION,
          PFLG_POSITIVE | PFLG_NOT_NULL | PFLG_MANDATORY,
          &p_trigger_item->check_interval, 0},
@@ -542,12 +688,18 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
     /* parameter for CheckUnknownParams() */
     static const char *allowed[] = {
         "lru_sort_attr", "max_action_count",
-        "max_action_volume", "nb_threads", "suspend_error_pct",
+        "max_action_volume", "max_action_rate", "max_volume_rate",
+        "rate_limit_hours", "nb_threads", "nb_threads_min", "nb_threads_max",
+        "cpu_affinity", "suspend_error_pct",
         "suspend_error_min", "report_interval", "action_timeout",
-        "check_actions_interval", "check_actions_on_startup",
-        "recheck_ignored_entries", "report_actions",
+        "check_actions_interval", "check_actions_on_startup", "track_actions",
+        "recheck_ignored_entries", "ignore_mark_max_validity",
+        "report_actions", "deleted_expiration",
         "pre_maintenance_window", "maint_min_apply_delay", "queue_size",
-        "db_result_size_max", "action_params", "action",
+        "db_result_size_max", "db_list_shards", "max_parallel_osts",
+        "topk_sort", "topk_max_entries", "candidate_index",
+        "candidate_index_max", "max_async_actions",
+        "action_params", "action",
         "recheck_ignored_classes",  /* for compat */
         NULL
     };
@@ -558,8 +710,18 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
          &conf->max_action_nbr, 0},
         {"max_action_volume", PT_SIZE, PFLG_POSITIVE,
          &conf->max_action_vol, 0},
+        {"max_action_rate", PT_FLOAT, PFLG_POSITIVE,
+         &conf->max_action_rate, 0},
+        {"max_volume_rate", PT_SIZE, PFLG_POSITIVE,
+         &conf->max_volume_rate, 0},
         {"nb_threads", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
          &conf->nb_threads, 0},
+        {"nb_threads_min", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->nb_threads_min, 0},
+        {"nb_threads_max", PT_INT, PFLG_POSITIVE,
+         &conf->nb_threads_max, 0},
+        {"cpu_affinity", PT_STRING, PFLG_NO_WILDCARDS, conf->cpu_affinity,
+         sizeof(conf->cpu_affinity)},
         {"suspend_error_pct", PT_FLOAT, PFLG_POSITIVE | PFLG_ALLOW_PCT_SIGN,
          &conf->suspend_error_pct, 0},
         {"suspend_error_min", PT_INT, PFLG_POSITIVE,
@@ -572,9 +734,14 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
          &conf->check_action_status_delay, 0},
         {"check_actions_on_startup", PT_BOOL, 0,
          &conf->check_action_status_on_startup, 0},
+        {"track_actions", PT_BOOL, 0, &conf->track_actions, 0},
         {"recheck_ignored_entries", PT_BOOL, 0,
          &conf->recheck_ignored_entries, 0},
+        {"ignore_mark_max_validity", PT_DURATION, PFLG_POSITIVE,
+         &conf->ignore_mark_max_validity, 0},
         {"report_actions", PT_BOOL, 0, &conf->report_actions, 0},
+        {"deleted_expiration", PT_DURATION, PFLG_POSITIVE,
+         &conf->deleted_expiration, 0},
         {"pre_maintenance_window", PT_DURATION, PFLG_POSITIVE,
          &conf->pre_maintenance_window, 0},
         {"maint_min_apply_delay", PT_DURATION, PFLG_POSITIVE,
@@ -583,6 +750,18 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
          &conf->queue_size, 0},
         {"db_result_size_max", PT_INT, PFLG_POSITIVE,
          &conf->db_request_limit, 0},
+        {"db_list_shards", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->db_list_shards, 0},
+        {"max_parallel_osts", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->max_parallel_osts, 0},
+        {"topk_sort", PT_BOOL, 0, &conf->topk_sort, 0},
+        {"topk_max_entries", PT_INT, PFLG_POSITIVE,
+         &conf->topk_max_entries, 0},
+        {"candidate_index", PT_BOOL, 0, &conf->candidate_index, 0},
+        {"candidate_index_max", PT_INT, PFLG_POSITIVE | PFLG_NOT_NULL,
+         &conf->candidate_index_max, 0},
+        {"max_async_actions", PT_INT, PFLG_POSITIVE,
+         &conf->max_async_actions, 0},
 
         {NULL, 0, 0, NULL, 0}
     };
@@ -606,8 +785,38 @@ static int polrun_read_config(config_file_t config, const char *policy_name,
     if (rc)
         return rc;
 
+    if (conf->nb_threads_max != 0
+        && conf->nb_threads_min > conf->nb_threads_max) {
+        sprintf(msg_out, "%s::nb_threads_min (%u) must not exceed "
+                "nb_threads_max (%u)", block_name, conf->nb_threads_min,
+                conf->nb_threads_max);
+        return EINVAL;
+    }
+
+    if (affinity_check(conf->cpu_affinity)) {
+        sprintf(msg_out, "%s::cpu_affinity: invalid value '%s' (expected: "
+                "CPU list like '0-7,16-23', or 'node:<list>')", block_name,
+                conf->cpu_affinity);
+        return EINVAL;
+    }
+
     /* read specific parameters */
 
+    rc = GetStringParam(param_block, block_name, "rate_limit_hours",
+                        PFLG_NO_WILDCARDS, tmp, sizeof(tmp), NULL, NULL,
+                        msg_out);
+    if ((rc != 0) && (rc != ENOENT))
+        return rc;
+    else if (rc != ENOENT) {
+        rc = parse_time_window(tmp, &conf->rate_limit_start,
+                               &conf->rate_limit_end);
+        if (rc) {
+            sprintf(msg_out, "Invalid value for '%s::rate_limit_hours': "
+                    "'%s' (HH:MM-HH:MM expected)", block_name, tmp);
+            return rc;
+        }
+    }
+
     /* 'lru_sort_attr' overrides 'default_lru_sort_attr' from 'define_policy' */
     rc = GetStringParam(param_block, block_name, "lru_sort_attr",
                         PFLG_NO_WILDCARDS, tmp, sizeof(tmp), NULL, NULL,
@@ -815,6 +1024,22 @@ static void update_triggers(trigger_item_t *trigger_tgt,
             trigger_tgt[i].max_action_vol = trigger_new[i].max_action_vol;
         }
 
+        if (trigger_new[i].max_action_rate != trigger_tgt[i].max_action_rate) {
+            DisplayLog(LVL_EVENT, TAG,
+                       "max_action_rate updated for trigger %s: %.2f/s->%.2f/s",
+                       tname, trigger_tgt[i].max_action_rate,
+                       trigger_new[i].max_action_rate);
+            trigger_tgt[i].max_action_rate = trigger_new[i].max_action_rate;
+        }
+
+        if (trigger_new[i].max_volume_rate != trigger_tgt[i].max_volume_rate) {
+            DisplayLog(LVL_EVENT, TAG,
+                       "max_volume_rate updated for trigger %s: %llu bytes/s->%llu bytes/s",
+                       tname, trigger_tgt[i].max_volume_rate,
+                       trigger_new[i].max_volume_rate);
+            trigger_tgt[i].max_volume_rate = trigger_new[i].max_volume_rate;
+        }
+
         if (trigger_new[i].post_trigger_wait !=
             trigger_tgt[i].post_trigger_wait) {
             DisplayLog(LVL_EVENT, TAG,
@@ -959,12 +1184,6 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
                          bool *recompute_interval)
 {
     /* parameters that can't be modified dynamically */
-    if (cfg_tgt->nb_threads != cfg_new->nb_threads)
-        no_param_updt_msg(blkname, "nb_threads");
-
-    if (cfg_tgt->queue_size != cfg_new->queue_size)
-        no_param_updt_msg(blkname, "queue_size");
-
 // FIXME can change action functions, but not cmd string
 //    if (strcmp(cfg_new->default_action, cfg_tgt->default_action))
 //        no_param_updt_msg(blkname, "default_action");
@@ -974,7 +1193,40 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
     if (cfg_tgt->lru_sort_attr != cfg_new->lru_sort_attr)
         no_param_updt_msg(blkname, "lru_sort_attr");
 
-    /* dynamic parameters */
+    if (cfg_tgt->candidate_index != cfg_new->candidate_index)
+        no_param_updt_msg(blkname, "candidate_index");
+    if (cfg_tgt->candidate_index_max != cfg_new->candidate_index_max)
+        no_param_updt_msg(blkname, "candidate_index_max");
+    if (cfg_tgt->max_async_actions != cfg_new->max_async_actions)
+        no_param_updt_msg(blkname, "max_async_actions");
+    if (cfg_tgt->track_actions != cfg_new->track_actions)
+        no_param_updt_msg(blkname, "track_actions");
+    if (strcmp(cfg_tgt->cpu_affinity, cfg_new->cpu_affinity))
+        no_param_updt_msg(blkname, "cpu_affinity");
+
+    /* dynamic parameters (the pool and queue are resized by
+     * policy_module_reload()) */
+    if (cfg_tgt->nb_threads != cfg_new->nb_threads) {
+        PARAM_UPDT_MSG(blkname, "nb_threads", "%u",
+                       cfg_tgt->nb_threads, cfg_new->nb_threads);
+        cfg_tgt->nb_threads = cfg_new->nb_threads;
+    }
+    if (cfg_tgt->nb_threads_min != cfg_new->nb_threads_min) {
+        PARAM_UPDT_MSG(blkname, "nb_threads_min", "%u",
+                       cfg_tgt->nb_threads_min, cfg_new->nb_threads_min);
+        cfg_tgt->nb_threads_min = cfg_new->nb_threads_min;
+    }
+    if (cfg_tgt->nb_threads_max != cfg_new->nb_threads_max) {
+        PARAM_UPDT_MSG(blkname, "nb_threads_max", "%u",
+                       cfg_tgt->nb_threads_max, cfg_new->nb_threads_max);
+        cfg_tgt->nb_threads_max = cfg_new->nb_threads_max;
+    }
+    if (cfg_tgt->queue_size != cfg_new->queue_size) {
+        PARAM_UPDT_MSG(blkname, "queue_size", "%u",
+                       cfg_tgt->queue_size, cfg_new->queue_size);
+        cfg_tgt->queue_size = cfg_new->queue_size;
+    }
+
     if (cfg_tgt->max_action_nbr != cfg_new->max_action_nbr) {
         PARAM_UPDT_MSG(blkname, "max_action_count", "%u",
                        cfg_tgt->max_action_nbr, cfg_new->max_action_nbr);
@@ -987,6 +1239,31 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
         cfg_tgt->max_action_vol = cfg_new->max_action_vol;
     }
 
+    if (cfg_tgt->max_action_rate != cfg_new->max_action_rate) {
+        PARAM_UPDT_MSG(blkname, "max_action_rate", "%.2f",
+                       cfg_tgt->max_action_rate, cfg_new->max_action_rate);
+        cfg_tgt->max_action_rate = cfg_new->max_action_rate;
+    }
+
+    if (cfg_tgt->max_volume_rate != cfg_new->max_volume_rate) {
+        PARAM_UPDT_MSG(blkname, "max_volume_rate", "%llu",
+                       cfg_tgt->max_volume_rate, cfg_new->max_volume_rate);
+        cfg_tgt->max_volume_rate = cfg_new->max_volume_rate;
+    }
+
+    if (cfg_tgt->rate_limit_start != cfg_new->rate_limit_start
+        || cfg_tgt->rate_limit_end != cfg_new->rate_limit_end) {
+        DisplayLog(LVL_EVENT, TAG, "%s::rate_limit_hours "
+                   "updated: %02d:%02d-%02d:%02d->%02d:%02d-%02d:%02d",
+                   blkname, cfg_tgt->rate_limit_start / 60,
+                   cfg_tgt->rate_limit_start % 60, cfg_tgt->rate_limit_end / 60,
+                   cfg_tgt->rate_limit_end % 60, cfg_new->rate_limit_start / 60,
+                   cfg_new->rate_limit_start % 60, cfg_new->rate_limit_end / 60,
+                   cfg_new->rate_limit_end % 60);
+        cfg_tgt->rate_limit_start = cfg_new->rate_limit_start;
+        cfg_tgt->rate_limit_end = cfg_new->rate_limit_end;
+    }
+
     if (cfg_tgt->suspend_error_pct != cfg_new->suspend_error_pct) {
         PARAM_UPDT_MSG(blkname, "suspend_error_pct", "%.2f%%",
                        cfg_tgt->suspend_error_pct, cfg_new->suspend_error_pct);
@@ -1025,6 +1302,31 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
         cfg_tgt->db_request_limit = cfg_new->db_request_limit;
     }
 
+    if (cfg_tgt->db_list_shards != cfg_new->db_list_shards) {
+        PARAM_UPDT_MSG(blkname, "db_list_shards", "%u",
+                       cfg_tgt->db_list_shards, cfg_new->db_list_shards);
+        cfg_tgt->db_list_shards = cfg_new->db_list_shards;
+    }
+
+    if (cfg_tgt->max_parallel_osts != cfg_new->max_parallel_osts) {
+        PARAM_UPDT_MSG(blkname, "max_parallel_osts", "%u",
+                       cfg_tgt->max_parallel_osts, cfg_new->max_parallel_osts);
+        cfg_tgt->max_parallel_osts = cfg_new->max_parallel_osts;
+    }
+
+    if (cfg_tgt->topk_sort != cfg_new->topk_sort) {
+        PARAM_UPDT_MSG(blkname, "topk_sort", "%s",
+                       bool2str(cfg_tgt->topk_sort),
+                       bool2str(cfg_new->topk_sort));
+        cfg_tgt->topk_sort = cfg_new->topk_sort;
+    }
+
+    if (cfg_tgt->topk_max_entries != cfg_new->topk_max_entries) {
+        PARAM_UPDT_MSG(blkname, "topk_max_entries", "%u",
+                       cfg_tgt->topk_max_entries, cfg_new->topk_max_entries);
+        cfg_tgt->topk_max_entries = cfg_new->topk_max_entries;
+    }
+
     if (cfg_tgt->pre_maintenance_window != cfg_new->pre_maintenance_window) {
         PARAM_UPDT_MSG(blkname, "pre_maintenance_window", "%lu",
                        cfg_tgt->pre_maintenance_window,
@@ -1055,6 +1357,14 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
         cfg_tgt->recheck_ignored_entries = cfg_new->recheck_ignored_entries;
     }
 
+    if (cfg_tgt->ignore_mark_max_validity
+        != cfg_new->ignore_mark_max_validity) {
+        PARAM_UPDT_MSG(blkname, "ignore_mark_max_validity", "%lu",
+                       cfg_tgt->ignore_mark_max_validity,
+                       cfg_new->ignore_mark_max_validity);
+        cfg_tgt->ignore_mark_max_validity = cfg_new->ignore_mark_max_validity;
+    }
+
     if (cfg_tgt->report_actions != cfg_new->report_actions) {
         PARAM_UPDT_MSG(blkname, "report_actions", "%s",
                        bool2str(cfg_tgt->report_actions),
@@ -1062,6 +1372,13 @@ static int polrun_reload(const char *blkname, policy_run_config_t *cfg_tgt,
         cfg_tgt->report_actions = cfg_new->report_actions;
     }
 
+    if (cfg_tgt->deleted_expiration != cfg_new->deleted_expiration) {
+        PARAM_UPDT_MSG(blkname, "deleted_expiration", "%lu",
+                       cfg_tgt->deleted_expiration,
+                       cfg_new->deleted_expiration);
+        cfg_tgt->deleted_expiration = cfg_new->deleted_expiration;
+    }
+
     update_triggers(cfg_tgt->trigger_list, cfg_tgt->trigger_count,
                     cfg_new->trigger_list, cfg_new->trigger_count,
                     recompute_interval);
@@ -1100,10 +1417,8 @@ static int policy_run_cfg_reload(policy_run_config_list_t *conf)
         }
     }
 
-    /* policy runs may not be in the same order as policies and run_cfgs */
-//    FIXME RBHv3
-//    if (chgd && policy_runs.runs != NULL)
-//        policy_module_update_check_interval(&policy_runs.runs[i]);
+    /* trigger intervals, pools and queues of running policies are updated
+     * by policy_module_reload() */
 
     return err;
 }
@@ -0,0 +1,399 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Each tracked policy has a hash of its outstanding actions with their due
+ * time, and a heap of due times to get the overdue entries first.
+ * Entries are not removed from the heap when they leave the hash or when
+ * their due time changes: stale heap items are skipped when they come up,
+ * and the heap is rebuilt from the hash when they are too many.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "policy_tracker.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define TRACK_TAG "ActionTracker"
+
+struct tracked_action {
+    entry_id_t  id;
+    time_t      due;
+};
+
+struct action_tracker {
+    pthread_mutex_t        lock;
+    /** entry_id_t -> struct tracked_action */
+    GHashTable            *entries;
+    /** min-heap of due times (may contain stale items) */
+    struct tracked_action *heap;
+    unsigned int           heap_count;
+    unsigned int           heap_size;
+    policy_descr_t        *descr;
+    policy_run_config_t   *config;
+    unsigned int           smi_index;
+    /** the DB was loaded to the tracker */
+    bool                   loaded;
+};
+
+/* one per policy (NULL if the policy is not tracked) */
+static struct action_tracker **trackers = NULL;
+static unsigned int            tracker_count = 0;
+static attr_mask_t             tracker_mask = { 0 };
+
+static guint track_id_hash(gconstpointer key)
+{
+    const entry_id_t *id = key;
+
+#ifdef FID_PK
+    return (guint)(id->f_seq ^ id->f_oid);
+#else
+    return (guint)(id->fs_key ^ id->inode);
+#endif
+}
+
+static gboolean track_id_equal(gconstpointer a, gconstpointer b)
+{
+    return entry_id_equal((const entry_id_t *)a, (const entry_id_t *)b);
+}
+
+int tracker_init(unsigned int pol_idx)
+{
+    struct action_tracker *t;
+    policy_descr_t *descr;
+
+    if (pol_idx >= policies.policy_count || pol_idx >= run_cfgs.count)
+        return EINVAL;
+
+    if (!run_cfgs.configs[pol_idx].track_actions)
+        return 0;
+
+    descr = &policies.policy_list[pol_idx];
+    if (descr->manage_deleted || descr->status_current == NULL
+        || descr->status_mgr == NULL) {
+        DisplayLog(LVL_MAJOR, TRACK_TAG, "Policy %s has no 'status_current' "
+                   "or applies to removed entries: track_actions is ignored",
+                   descr->name);
+        return 0;
+    }
+
+    if (trackers == NULL) {
+        trackers = MemCalloc(policies.policy_count, sizeof(*trackers));
+        if (trackers == NULL)
+            return ENOMEM;
+    }
+    if (trackers[pol_idx] != NULL)
+        return 0;
+
+    t = MemCalloc(1, sizeof(*t));
+    if (t == NULL)
+        return ENOMEM;
+
+    pthread_mutex_init(&t->lock, NULL);
+    t->entries = g_hash_table_new_full(track_id_hash, track_id_equal,
+                                       NULL, g_free);
+    t->descr = descr;
+    t->config = &run_cfgs.configs[pol_idx];
+    t->smi_index = descr->status_mgr->smi_index;
+
+    tracker_mask.status |= SMI_MASK(t->smi_index);
+
+    trackers[pol_idx] = t;
+    tracker_count++;
+
+    DisplayLog(LVL_VERB, TRACK_TAG, "Action tracking enabled for policy %s",
+               descr->name);
+    return 0;
+}
+
+static inline struct action_tracker *get_tracker(unsigned int pol_idx)
+{
+    if (trackers == NULL || pol_idx >= policies.policy_count)
+        return NULL;
+    return trackers[pol_idx];
+}
+
+bool tracker_enabled(unsigned int pol_idx)
+{
+    return get_tracker(pol_idx) != NULL;
+}
+
+bool tracker_any(void)
+{
+    return tracker_count > 0;
+}
+
+attr_mask_t tracker_attr_mask(void)
+{
+    return tracker_mask;
+}
+
+/* ---- heap of due times ---- */
+
+static inline bool heap_before(const struct tracked_action *a,
+                               const struct tracked_action *b)
+{
+    return a->due < b->due;
+}
+
+static void heap_swap(struct tracked_action *heap, unsigned int i,
+                      unsigned int j)
+{
+    struct tracked_action tmp = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+static void heap_sift_down(struct action_tracker *t, unsigned int i)
+{
+    for (;;) {
+        unsigned int l = 2 * i + 1;
+        unsigned int r = l + 1;
+        unsigned int min = i;
+
+        if (l < t->heap_count && heap_before(&t->heap[l], &t->heap[min]))
+            min = l;
+        if (r < t->heap_count && heap_before(&t->heap[r], &t->heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        heap_swap(t->heap, i, min);
+        i = min;
+    }
+}
+
+static int heap_push(struct action_tracker *t, const struct tracked_action *a)
+{
+    unsigned int i;
+
+    if (t->heap_count == t->heap_size) {
+        unsigned int size = t->heap_size ? 2 * t->heap_size : 1024;
+        struct tracked_action *tmp;
+
+        tmp = realloc(t->heap, size * sizeof(*tmp));
+        if (tmp == NULL)
+            return ENOMEM;
+        t->heap = tmp;
+        t->heap_size = size;
+    }
+
+    i = t->heap_count++;
+    t->heap[i] = *a;
+    while (i > 0 && heap_before(&t->heap[i], &t->heap[(i - 1) / 2])) {
+        heap_swap(t->heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return 0;
+}
+
+static void heap_pop(struct action_tracker *t)
+{
+    t->heap[0] = t->heap[--t->heap_count];
+    heap_sift_down(t, 0);
+}
+
+/** rebuild the heap from the hash, to drop stale items */
+static void heap_rebuild(struct action_tracker *t)
+{
+    GHashTableIter iter;
+    gpointer value;
+    int i;
+
+    t->heap_count = 0;
+    g_hash_table_iter_init(&iter, t->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        t->heap[t->heap_count++] = *(struct tracked_action *)value;
+
+    for (i = t->heap_count / 2 - 1; i >= 0; i--)
+        heap_sift_down(t, i);
+}
+
+/* ---- tracking ---- */
+
+static inline time_t due_time(const struct action_tracker *t, time_t start)
+{
+    if (t->config->action_timeout > 0)
+        return start + t->config->action_timeout;
+    return start + t->config->check_action_status_delay;
+}
+
+/** track an entry. Must be called with the tracker locked. */
+static void track_set(struct action_tracker *t, const entry_id_t *id,
+                      time_t start, bool update)
+{
+    struct tracked_action *a;
+
+    a = g_hash_table_lookup(t->entries, id);
+    if (a != NULL && !update)
+        return;
+
+    if (a == NULL) {
+        a = g_new(struct tracked_action, 1);
+        a->id = *id;
+        g_hash_table_insert(t->entries, &a->id, a);
+    }
+    a->due = due_time(t, start);
+
+    /* the heap holds at most twice the tracked entries */
+    if (t->heap_count >= 2 * g_hash_table_size(t->entries)
+        && t->heap_count >= 1024)
+        heap_rebuild(t);
+
+    if (heap_push(t, a)) {
+        DisplayLog(LVL_CRIT, TRACK_TAG, "Cannot allocate memory to track "
+                   "actions of policy %s", t->descr->name);
+        g_hash_table_remove(t->entries, id);
+    }
+}
+
+void tracker_add(unsigned int pol_idx, const entry_id_t *id, time_t start)
+{
+    struct action_tracker *t = get_tracker(pol_idx);
+
+    if (t == NULL)
+        return;
+
+    P(t->lock);
+    track_set(t, id, start, true);
+    V(t->lock);
+}
+
+void tracker_update(const entry_id_t *id, const attr_set_t *attrs)
+{
+    unsigned int i;
+
+    if (tracker_count == 0)
+        return;
+
+    for (i = 0; i < policies.policy_count; i++) {
+        struct action_tracker *t = trackers[i];
+        const char *status;
+
+        if (t == NULL || !ATTR_MASK_STATUS_TEST(attrs, t->smi_index))
+            continue;
+
+        status = STATUS_ATTR(attrs, t->smi_index);
+
+        P(t->lock);
+        if (status != NULL && status_eq(status, t->descr->status_current))
+            /* keep the due time of already tracked entries */
+            track_set(t, id, time(NULL), false);
+        else
+            g_hash_table_remove(t->entries, id);
+        V(t->lock);
+    }
+}
+
+void tracker_remove(const entry_id_t *id)
+{
+    unsigned int i;
+
+    if (tracker_count == 0)
+        return;
+
+    for (i = 0; i < policies.policy_count; i++) {
+        struct action_tracker *t = trackers[i];
+
+        if (t == NULL)
+            continue;
+
+        P(t->lock);
+        g_hash_table_remove(t->entries, id);
+        V(t->lock);
+    }
+}
+
+void tracker_load_done(unsigned int pol_idx)
+{
+    struct action_tracker *t = get_tracker(pol_idx);
+
+    if (t == NULL)
+        return;
+
+    P(t->lock);
+    t->loaded = true;
+    DisplayLog(LVL_EVENT, TRACK_TAG, "Outstanding actions of policy %s "
+               "loaded: %u entries", t->descr->name,
+               g_hash_table_size(t->entries));
+    V(t->lock);
+}
+
+bool tracker_loaded(unsigned int pol_idx)
+{
+    struct action_tracker *t = get_tracker(pol_idx);
+    bool loaded;
+
+    if (t == NULL)
+        return false;
+
+    P(t->lock);
+    loaded = t->loaded;
+    V(t->lock);
+    return loaded;
+}
+
+int tracker_get_due(unsigned int pol_idx, time_t now, entry_id_t **list,
+                    unsigned int *count, unsigned int *total)
+{
+    struct action_tracker *t = get_tracker(pol_idx);
+    unsigned int size = 0;
+
+    *list = NULL;
+    *count = 0;
+    *total = 0;
+
+    if (t == NULL)
+        return ENOENT;
+
+    P(t->lock);
+    *total = g_hash_table_size(t->entries);
+
+    while (t->heap_count > 0 && t->heap[0].due <= now) {
+        struct tracked_action top = t->heap[0];
+        struct tracked_action *a;
+
+        heap_pop(t);
+
+        /* skip stale items */
+        a = g_hash_table_lookup(t->entries, &top.id);
+        if (a == NULL || a->due != top.due)
+            continue;
+
+        if (*count == size) {
+            entry_id_t *tmp;
+
+            size = size ? 2 * size : 256;
+            tmp = MemRealloc(*list, size * sizeof(**list));
+            if (tmp == NULL) {
+                /* keep this one and the next ones for next time */
+                heap_push(t, a);
+                break;
+            }
+            *list = tmp;
+        }
+        (*list)[(*count)++] = top.id;
+        g_hash_table_remove(t->entries, &top.id);
+    }
+    V(t->lock);
+    return 0;
+}
@@ -23,7 +23,10 @@
 #include "rbh_misc.h"
 #include "policy_run.h"
 #include "run_policies.h"
+#include "policy_usage.h"
+#include "policy_metrics.h"
 #include "queue.h"
+#include "rbh_affinity.h"
 #include "Memory.h"
 #include "xplatform_print.h"
 #include <errno.h>
@@ -42,6 +45,7 @@
 #define is_count_trigger(_t_) ((_t_)->hw_type == COUNT_THRESHOLD)
 #define check_only(_p) ((_p)->flags & RUNFLG_CHECK_ONLY)
 #define one_shot(_p) ((_p)->flags & RUNFLG_ONCE)
+#define simulate(_p) ((_p)->flags & RUNFLG_SIMULATE)
 
 static void update_trigger_status(policy_info_t *pol, int i,
                                   trigger_status_t state)
@@ -370,17 +374,14 @@ static int total_blocks(unsigned long long *total_user_blocks,
 
 static int get_fs_usage(policy_info_t *pol, struct statfs *stfs)
 {
-    char traverse_path[RBH_PATH_MAX];
-
-    snprintf(traverse_path, RBH_PATH_MAX, "%s/.", global_config.fs_path);
+    int err;
 
     if (!CheckFSDevice(pol))
         return ENODEV;
 
-    /* retrieve filesystem usage info */
-    if (statfs(traverse_path, stfs) != 0) {
-        int err = errno;
-
+    /* retrieve filesystem usage info (shared by all triggers) */
+    err = usage_get_fs(stfs);
+    if (err != 0) {
         DisplayLog(LVL_CRIT, tag(pol),
                    "Could not make a 'df' on %s: error %d: %s",
                    global_config.fs_path, err, strerror(err));
@@ -568,17 +569,22 @@ static int get_ost_max(struct statfs *df, trigger_value_type_t tr_type,
     double max_pct = 0.0, curr_pct = 0.0;
     unsigned long long max_vol = 0LL, curr_vol = 0;
     char ostname[128];
+    ost_usage_t *osts;
+    unsigned int ost_count;
 
-    for (ost_index = 0;; ost_index++) {
+    /* whole OST table at once */
+    rc = usage_get_osts(&osts, &ost_count);
+    if (rc)
+        return -rc;
+
+    for (ost_index = 0; ost_index < (int)ost_count; ost_index++) {
         if (ost_list_is_member(excluded, ost_index))
             continue;
 
-        rc = Get_OST_usage(global_config.fs_path, ost_index, &stat_tmp);
-        if (rc == ENODEV)   /* end of OST list */
-            break;
-        else if (rc != 0)
+        if (osts[ost_index].rc != 0)
             /* continue with next OSTs */
             continue;
+        stat_tmp = osts[ost_index].stfs;
 
         snprintf(ostname, sizeof(ostname), "OST #%u", ost_index);
         if (statfs2usage(&stat_tmp, &curr_vol, &curr_pct, &ost_blocks, ostname))
@@ -604,6 +610,7 @@ static int get_ost_max(struct statfs *df, trigger_value_type_t tr_type,
             RBH_BUG("Unexpected OST trigger type");
         }
     }
+    MemFree(osts);
 
     if (ost_max == -1)
         /* none found */
@@ -1007,7 +1014,7 @@ static int trig_target_next(target_iterator_t *it, target_u *tgt,
             /* check listed pools */
             const char *pool = it->trig.list[it->info_u.next_pool_index];
 
-            rc = Get_pool_usage(pool, &stfs);
+            rc = usage_get_pool(pool, &stfs);
             if (rc) {
                 DisplayLog(LVL_CRIT, TAG,
                            "Could not retrieve usage info for pool '%s': %s",
@@ -1211,6 +1218,15 @@ static void store_policy_run_stats(policy_info_t *pol, time_t start,
     snprintf(var_name, sizeof(var_name), "%s" LAST_POLICY_STATUS_SUFFIX,
              tag(pol));
     ListMgr_SetVar(&pol->lmgr, var_name, status_info);
+
+    /* store action latency (to estimate the duration of simulated runs) */
+    if (pol->action_count > 0) {
+        snprintf(var_name, sizeof(var_name), "%s" LAST_POLICY_LATENCY_SUFFIX,
+                 tag(pol));
+        snprintf(val_buff, sizeof(val_buff), "%llu",
+                 pol->action_usec / pol->action_count);
+        ListMgr_SetVar(&pol->lmgr, var_name, val_buff);
+    }
 }
 
 static void store_policy_start_stats(policy_info_t *pol, time_t start,
@@ -1370,6 +1386,55 @@ static void report_policy_run(policy_info_t *pol, policy_param_t *param,
     FlushLogs();
 }
 
+#ifdef _LUSTRE
+/** run a policy on a batch of overfull OSTs of a trigger */
+static void run_ost_batch(policy_info_t *pol, unsigned trigger_index,
+                          policy_param_t *params, unsigned int count)
+{
+    trigger_item_t *trig = &pol->config->trigger_list[trigger_index];
+    action_summary_t *summaries;
+    GString *osts;
+    char *trigger_buff;
+    unsigned int i;
+    int rc;
+
+    if (count == 0)
+        return;
+
+    summaries = MemCalloc(count, sizeof(*summaries));
+    if (summaries == NULL)
+        return;
+
+    osts = g_string_new(NULL);
+    for (i = 0; i < count; i++)
+        g_string_append_printf(osts, "%s#%u", i == 0 ? "" : ",",
+                               params[i].optarg_u.index);
+
+    DisplayLog(LVL_EVENT, tag(pol), "Checking policy rules for OSTs %s",
+               osts->str);
+    update_trigger_status(pol, trigger_index, TRIG_RUNNING);
+
+    /* insert info to DB about current trigger
+     * (for rbh-report --activity) */
+    asprintf(&trigger_buff, "trigger: %s (%s), target: OSTs %s",
+             trigger2str(trig), one_shot(pol) ?
+             "one-shot command" : "daemon", osts->str);
+    store_policy_start_stats(pol, time(NULL), trigger_buff);
+    free(trigger_buff);
+    g_string_free(osts, TRUE);
+
+    rc = run_policy_osts(pol, params, count, summaries, &pol->lmgr);
+    /* usage changed */
+    usage_invalidate();
+
+    for (i = 0; i < count; i++)
+        report_policy_run(pol, &params[i], &summaries[i], &pol->lmgr,
+                          trigger_index, rc);
+
+    MemFree(summaries);
+}
+#endif
+
 /** generic function to check a trigger (TODO to be completed) */
 static int check_trigger(policy_info_t *pol, unsigned trigger_index)
 {
@@ -1380,6 +1445,11 @@ static int check_trigger(policy_info_t *pol, unsigned trigger_index)
     time_modifier_t tmod;
     target_iterator_t it;
     char buff[1024];
+#ifdef _LUSTRE
+    /* overfull OSTs to be processed together */
+    policy_param_t *ost_batch = NULL;
+    unsigned int ost_count = 0;
+#endif
 
     if (!CheckFSDevice(pol))
         return ENODEV;
@@ -1419,6 +1489,28 @@ static int check_trigger(policy_info_t *pol, unsigned trigger_index)
             param.time_mod = &tmod;
 
         param.action_params = &trig->action_params;
+        param.action_rate = trig->max_action_rate;
+        param.volume_rate = trig->max_volume_rate;
+
+#ifdef _LUSTRE
+        if (param.target == TGT_OST && pol->config->max_parallel_osts > 1
+            && !simulate(pol)) {
+            if (ost_batch == NULL) {
+                ost_batch = MemCalloc(pol->config->max_parallel_osts,
+                                      sizeof(*ost_batch));
+                if (ost_batch == NULL) {
+                    rc = ENOMEM;
+                    break;
+                }
+            }
+            ost_batch[ost_count++] = param;
+            if (ost_count >= pol->config->max_parallel_osts) {
+                run_ost_batch(pol, trigger_index, ost_batch, ost_count);
+                ost_count = 0;
+            }
+            continue;
+        }
+#endif
 
         /* run actions! */
         param2targetstr(&param, buff, sizeof(buff));
@@ -1426,6 +1518,17 @@ static int check_trigger(policy_info_t *pol, unsigned trigger_index)
         DisplayLog(LVL_EVENT, tag(pol), "Checking policy rules for %s", buff);
         update_trigger_status(pol, trigger_index, TRIG_RUNNING);
 
+        memset(&summary, 0, sizeof(summary));
+
+        /* simulated runs report their own results, and are not stored */
+        if (simulate(pol)) {
+            rc = run_policy(pol, &param, &summary, &pol->lmgr);
+            usage_invalidate();
+            update_trigger_status(pol, trigger_index,
+                                  rc ? TRIG_CHECK_ERROR : TRIG_OK);
+            continue;
+        }
+
         /* insert info to DB about current trigger
          * (for rbh-report --activity) */
         char *trigger_buff;
@@ -1435,9 +1538,10 @@ static int check_trigger(policy_info_t *pol, unsigned trigger_index)
         store_policy_start_stats(pol, time(NULL), trigger_buff);
         free(trigger_buff);
 
-        memset(&summary, 0, sizeof(summary));
         /* run the policy */
         rc = run_policy(pol, &param, &summary, &pol->lmgr);
+        /* usage changed: next trigger checks must not use the cached one */
+        usage_invalidate();
 
         report_policy_run(pol, &param, &summary, &pol->lmgr, trigger_index, rc);
 
@@ -1452,6 +1556,13 @@ static int check_trigger(policy_info_t *pol, unsigned trigger_index)
     }
     trig_target_end(&it);
 
+#ifdef _LUSTRE
+    /* remaining OSTs */
+    if (!pol->aborted)
+        run_ost_batch(pol, trigger_index, ost_batch, ost_count);
+    MemFree(ost_batch);
+#endif
+
     if (pol->aborted)
         update_trigger_status(pol, trigger_index, TRIG_ABORTED);
     else if (rc != ENOENT && rc != 0)
@@ -1579,6 +1690,14 @@ static int targeted_run(policy_info_t *pol, const policy_opt_t *opt)
         param2targetstr(&param, buff, sizeof(buff));
         DisplayLog(LVL_EVENT, tag(pol), "Checking policy rules for %s", buff);
 
+        memset(&summary, 0, sizeof(summary));
+
+        /* simulated runs report their own results, and are not stored */
+        if (simulate(pol)) {
+            rc = run_policy(pol, &param, &summary, &pol->lmgr);
+            goto out;
+        }
+
         /* insert info to DB about current trigger
          * (for rbh-report --activity) */
         char *trigger_buff;
@@ -1586,7 +1705,6 @@ static int targeted_run(policy_info_t *pol, const policy_opt_t *opt)
         store_policy_start_stats(pol, time(NULL), trigger_buff);
         free(trigger_buff);
 
-        memset(&summary, 0, sizeof(summary));
         /* run the policy */
         rc = run_policy(pol, &param, &summary, &pol->lmgr);
 
@@ -1787,6 +1905,26 @@ void policy_module_update_check_interval(policy_info_t *policy)
                (unsigned int)policy->gcd_interval);
 }
 
+void policy_module_reload(policy_info_t *policy)
+{
+    if (!one_shot(policy))
+        policy_module_update_check_interval(policy);
+
+    Queue_Resize(&policy->queue, policy->config->queue_size);
+    policy_pool_reconfig(policy);
+}
+
+void policy_module_set_check_only(policy_info_t *policy, bool enable)
+{
+    if (enable)
+        policy->flags |= RUNFLG_CHECK_ONLY;
+    else
+        policy->flags &= ~RUNFLG_CHECK_ONLY;
+
+    DisplayLog(LVL_EVENT, tag(policy), "Trigger checks are now %s",
+               enable ? "read-only" : "followed by policy runs");
+}
+
 /**
  * Initialize module and start checker threads
  */
@@ -1834,9 +1972,12 @@ int policy_module_start(policy_info_t *policy, /* out */
                    "Unmatched entries will be ignored.");
 
     /* intervals must only be computed for daemon mode */
-    if (!one_shot(policy))
+    if (!one_shot(policy)) {
         policy_module_update_check_interval(policy);
-    else
+        /* usage is sampled once for the triggers of all policies */
+        if (options->target == TGT_NONE)
+            usage_sampler_start(policy->gcd_interval);
+    } else
         policy->gcd_interval = 1;
 
     /* initialize worker queue */
@@ -1854,6 +1995,13 @@ int policy_module_start(policy_info_t *policy, /* out */
         /* don't care about leaks here, as the program is going to exit */
         return rc;
 
+    /* candidates are only maintained in daemon mode */
+    if (!one_shot(policy)) {
+        rc = start_candidates_loader(policy);
+        if (rc)
+            return rc;
+    }
+
     /**  @TODO take max-count and max-vol parameters into account */
 
     /* Allocate and initialize trigger_info array
@@ -2037,6 +2185,12 @@ void policy_module_dump_stats(policy_info_t *policy)
     DisplayLog(LVL_MAJOR, "STATS", "======= %s policy: action stats ======",
                tag(policy));
     DisplayLog(LVL_MAJOR, "STATS", "idle threads       = %u", nb_waiting);
+    if (!EMPTY_STRING(policy->config->cpu_affinity)) {
+        affinity_describe(policy->config->cpu_affinity, tmp_buff,
+                          sizeof(tmp_buff));
+        DisplayLog(LVL_MAJOR, "STATS", "thread affinity    = %s (%s)",
+                   policy->config->cpu_affinity, tmp_buff);
+    }
     DisplayLog(LVL_MAJOR, "STATS", "queued entries     = %u", nb_items);
     DisplayLog(LVL_MAJOR, "STATS", "action status:");
 
@@ -2075,4 +2229,11 @@ void policy_module_dump_stats(policy_info_t *policy)
     if (last_ack)
         DisplayLog(LVL_MAJOR, "STATS", "last action completed %2d s ago",
                    (int)(now - last_ack));
+
+    policy_metrics_dump(policy);
+}
+
+void policy_module_store_stats(policy_info_t *policy, lmgr_t *lmgr)
+{
+    policy_metrics_store(policy, lmgr);
 }
@@ -0,0 +1,338 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Usage of the filesystem, its OSTs and pools is sampled once per interval
+ * for all triggers of all policies, instead of each trigger making its own
+ * statfs and llapi queries.
+ * A sampler thread refreshes the snapshot at the smallest check interval of
+ * all policies. Readers refresh it themselves if it is too old or was
+ * invalidated (e.g. after a policy run freed space), so a single refresh is
+ * made for concurrent readers.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "policy_usage.h"
+#include "policy_run.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "global_config.h"
+#include "Memory.h"
+
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+
+#define USAGE_TAG "UsageSampler"
+
+/* usage of a single target */
+struct target_usage {
+    int             rc;
+    struct statfs   stfs;
+};
+
+static pthread_mutex_t usage_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* incremented by usage_invalidate() */
+static unsigned long long usage_gen = 1;
+/* generation and time of the current snapshot */
+static unsigned long long snap_gen = 0;
+static time_t             snap_time = 0;
+
+static struct target_usage fs_usage;
+#ifdef _LUSTRE
+static ost_usage_t         *ost_usage = NULL;
+static unsigned int         ost_count = 0;
+/* pool name -> struct target_usage */
+static GHashTable          *pool_usage = NULL;
+#endif
+
+static time_t    sampler_interval = 0;
+static pthread_t sampler_thr;
+
+static void refresh_fs(void)
+{
+    char traverse_path[RBH_PATH_MAX];
+
+    snprintf(traverse_path, RBH_PATH_MAX, "%s/.", global_config.fs_path);
+
+    /* errors are reported by readers */
+    if (statfs(traverse_path, &fs_usage.stfs) != 0)
+        fs_usage.rc = errno;
+    else
+        fs_usage.rc = 0;
+}
+
+#ifdef _LUSTRE
+static void refresh_osts(void)
+{
+    ost_usage_t *table;
+    unsigned int count;
+    int rc;
+
+    /* all OSTs are queried concurrently */
+    rc = Get_all_OST_usage(global_config.fs_path, &table, &count);
+    if (rc) {
+        DisplayLog(LVL_MAJOR, USAGE_TAG, "Failed to retrieve OST usage: %s",
+                   strerror(rc));
+        return;
+    }
+
+    if (ost_usage != NULL)
+        MemFree(ost_usage);
+    ost_usage = table;
+    ost_count = count;
+}
+
+/** sum the usage of pool members from the OST table (no extra request) */
+static void refresh_pool(gpointer key, gpointer value, gpointer udata)
+{
+    struct target_usage *u = value;
+#ifdef HAVE_LLAPI_GETPOOL_INFO
+    unsigned int *indexes;
+    unsigned int i, count;
+
+    memset(&u->stfs, 0, sizeof(u->stfs));
+
+    u->rc = Get_pool_members(key, &indexes, &count);
+    if (u->rc)
+        return;
+
+    for (i = 0; i < count; i++) {
+        const ost_usage_t *ost;
+
+        if (indexes[i] >= ost_count) {
+            u->rc = ENODEV;
+            break;
+        }
+        ost = &ost_usage[indexes[i]];
+        if (ost->rc) {
+            u->rc = ost->rc;
+            break;
+        }
+        u->stfs.f_blocks += ost->stfs.f_blocks;
+        u->stfs.f_bfree += ost->stfs.f_bfree;
+        u->stfs.f_bavail += ost->stfs.f_bavail;
+        u->stfs.f_bsize = ost->stfs.f_bsize;
+    }
+    MemFree(indexes);
+#else
+    u->rc = Get_pool_usage(key, &u->stfs);
+#endif
+}
+#endif
+
+/** refresh the snapshot (called with usage_lock held) */
+static void refresh_snapshot(void)
+{
+    unsigned long long gen = usage_gen;
+
+    refresh_fs();
+#ifdef _LUSTRE
+    refresh_osts();
+    if (pool_usage != NULL)
+        g_hash_table_foreach(pool_usage, refresh_pool, NULL);
+#endif
+    snap_gen = gen;
+    snap_time = time(NULL);
+}
+
+/** refresh the snapshot if needed (called with usage_lock held) */
+static void check_snapshot(void)
+{
+    /* without sampler thread, the snapshot is only reused
+     * for the same second */
+    time_t max_age = 2 * MAX2(sampler_interval, 1);
+
+    if (snap_gen == usage_gen && time(NULL) - snap_time < max_age)
+        return;
+
+    refresh_snapshot();
+}
+
+void usage_invalidate(void)
+{
+    P(usage_lock);
+    usage_gen++;
+    V(usage_lock);
+}
+
+int usage_get_fs(struct statfs *stfs)
+{
+    int rc;
+
+    P(usage_lock);
+    check_snapshot();
+    *stfs = fs_usage.stfs;
+    rc = fs_usage.rc;
+    V(usage_lock);
+
+    return rc;
+}
+
+#ifdef _LUSTRE
+int usage_get_ost(unsigned int ost_index, struct statfs *stfs)
+{
+    int rc;
+
+    P(usage_lock);
+    check_snapshot();
+    if (ost_index >= ost_count)
+        rc = ENODEV;
+    else {
+        *stfs = ost_usage[ost_index].stfs;
+        rc = ost_usage[ost_index].rc;
+    }
+    V(usage_lock);
+
+    return rc;
+}
+
+int usage_get_osts(ost_usage_t **p_table, unsigned int *p_count)
+{
+    int rc = 0;
+
+    P(usage_lock);
+    check_snapshot();
+    *p_count = ost_count;
+    *p_table = MemAlloc(MAX2(ost_count, 1) * sizeof(ost_usage_t));
+    if (*p_table == NULL)
+        rc = ENOMEM;
+    else if (ost_count > 0)
+        memcpy(*p_table, ost_usage, ost_count * sizeof(ost_usage_t));
+    V(usage_lock);
+
+    return rc;
+}
+
+int usage_store_ost_history(lmgr_t *lmgr)
+{
+    ost_usage_sample_t *samples;
+    ost_usage_t *table;
+    unsigned int i, count, n = 0;
+    int rc;
+
+    rc = usage_get_osts(&table, &count);
+    if (rc)
+        return rc;
+
+    samples = MemCalloc(MAX2(count, 1), sizeof(*samples));
+    if (samples == NULL) {
+        MemFree(table);
+        return ENOMEM;
+    }
+
+    /* unavailable OSTs have no sample */
+    for (i = 0; i < count; i++) {
+        const struct statfs *st = &table[i].stfs;
+
+        if (table[i].rc)
+            continue;
+        samples[n].ost_index = i;
+        samples[n].size = (uint64_t)st->f_blocks * st->f_bsize;
+        samples[n].used = (uint64_t)(st->f_blocks - st->f_bfree) * st->f_bsize;
+        samples[n].avail = (uint64_t)st->f_bavail * st->f_bsize;
+        n++;
+    }
+    MemFree(table);
+
+    rc = n > 0 ? ListMgr_StoreOSTUsage(lmgr, time(NULL), samples, n) : 0;
+    MemFree(samples);
+    return rc;
+}
+
+int usage_get_pool(const char *pool, struct statfs *stfs)
+{
+    struct target_usage *u;
+    int rc;
+
+    P(usage_lock);
+    check_snapshot();
+
+    if (pool_usage == NULL)
+        pool_usage = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           g_free);
+
+    u = g_hash_table_lookup(pool_usage, pool);
+    if (u == NULL) {
+        /* first request for this pool: sample it from now */
+        u = g_new0(struct target_usage, 1);
+        g_hash_table_insert(pool_usage, g_strdup(pool), u);
+        refresh_pool((gpointer)pool, u, NULL);
+    }
+    *stfs = u->stfs;
+    rc = u->rc;
+    V(usage_lock);
+
+    return rc;
+}
+#endif
+
+static void *sampler_thr_func(void *arg)
+{
+    for (;;) {
+        time_t interval;
+
+        P(usage_lock);
+        interval = sampler_interval;
+        V(usage_lock);
+
+        rh_sleep(interval);
+
+        P(usage_lock);
+        if (time(NULL) - snap_time >= sampler_interval)
+            refresh_snapshot();
+        V(usage_lock);
+    }
+    return NULL;
+}
+
+int usage_sampler_start(time_t interval)
+{
+    pthread_attr_t attr;
+    bool start;
+    int rc;
+
+    if (interval == 0)
+        return 0;
+
+    P(usage_lock);
+    start = (sampler_interval == 0);
+    if (start || interval < sampler_interval) {
+        DisplayLog(LVL_DEBUG, USAGE_TAG, "Sampling usage every %lus",
+                   (unsigned long)interval);
+        sampler_interval = interval;
+    }
+    V(usage_lock);
+
+    if (!start)
+        return 0;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&sampler_thr, &attr, sampler_thr_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0) {
+        DisplayLog(LVL_CRIT, USAGE_TAG,
+                   "Error %d starting usage sampler thread: %s", rc,
+                   strerror(rc));
+        P(usage_lock);
+        sampler_interval = 0;
+        V(usage_lock);
+    }
+    return rc;
+}
@@ -0,0 +1,68 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  policy_usage.h
+ * \brief Filesystem, OST and pool usage shared by all policy triggers.
+ */
+#ifndef _POLICY_USAGE_H
+#define _POLICY_USAGE_H
+
+#include <sys/types.h>
+#include <time.h>
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/mount.h>
+#else /* Linux */
+#include <sys/vfs.h>
+#endif
+#include "rbh_misc.h"
+
+/**
+ * Start the thread that refreshes the usage snapshot periodically.
+ * It is started once for all policies. If it is already running,
+ * its interval is reduced to the given one if it is smaller.
+ */
+int usage_sampler_start(time_t interval);
+
+/**
+ * Mark the current snapshot as outdated (e.g. after a policy run):
+ * next readers will refresh it.
+ */
+void usage_invalidate(void);
+
+/** Get filesystem usage from the snapshot. */
+int usage_get_fs(struct statfs *stfs);
+
+#ifdef _LUSTRE
+/**
+ * Get OST usage from the snapshot.
+ * @return 0 on success, ENODEV if ost_index is over the max OST index,
+ *         another error code if the OST usage could not be retrieved.
+ */
+int usage_get_ost(unsigned int ost_index, struct statfs *stfs);
+
+/**
+ * Get the usage of all OSTs from the snapshot.
+ * @param[out] p_table  copy of the OST table (to be freed by MemFree()).
+ */
+int usage_get_osts(ost_usage_t **p_table, unsigned int *p_count);
+
+/**
+ * Get pool usage from the snapshot.
+ * Pools are sampled from their first request.
+ */
+int usage_get_pool(const char *pool, struct statfs *stfs);
+#endif
+
+#endif
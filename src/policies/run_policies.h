@@ -91,14 +91,31 @@ typedef struct policy_param_t {
 
     const action_params_t *action_params;
 
+    /** rate limits of the run (from trigger), 0 = unlimited */
+    double action_rate;     /**< actions/sec */
+    ull_t  volume_rate;     /**< bytes/sec */
+
 } policy_param_t;
 
 int run_policy(policy_info_t *p_pol_info, const policy_param_t *p_param,
                action_summary_t *p_summary, lmgr_t *lmgr);
 
+#ifdef _LUSTRE
+/* run a policy on several OSTs in parallel */
+int run_policy_osts(policy_info_t *p_pol_info, const policy_param_t *p_params,
+                    unsigned int count, action_summary_t *summaries,
+                    lmgr_t *lmgr);
+#endif
+
 /* Note: the number of threads is in p_pol_info->config */
 int start_worker_threads(policy_info_t *p_pol_info);
 
+/* apply the pool size from p_pol_info->config (after a config reload) */
+int policy_pool_reconfig(policy_info_t *p_pol_info);
+
+/* load the candidate index of the policy from the DB, in background */
+int start_candidates_loader(policy_info_t *p_pol_info);
+
 /* Note: the timeout is in p_pol_info->config */
 int check_current_actions(policy_info_t *p_pol_info, lmgr_t *lmgr,
                           unsigned int *p_nb_reset, unsigned int *p_nb_total);
@@ -23,6 +23,7 @@
 
 #include <glib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "uidgidcache.h"
 #include "cmd_helpers.h"
@@ -44,8 +45,6 @@ static unsigned int array_len;   /* number of elements in array. */
 static unsigned int array_first; /* index of first valid element in array. */
 #define array_used (array_len-array_first)
 
-#define LS_CHUNK    1  /* TODO - ListMgr_GetChild will get confused if not 1 */
-
 static size_t what_2_power(size_t s)
 {
     size_t c = 1;
@@ -54,12 +53,20 @@ static size_t what_2_power(size_t s)
     return c;
 }
 
-/* Copy the ids and names array. */
+/* Copy the ids and names array.
+ * If transfer is set, the names are moved to the destination array
+ * (the source array must then be freed without its names). */
 static void copy_arrays(const wagon_t *src,
-                        wagon_t *dest, int dst_first, int count)
+                        wagon_t *dest, int dst_first, int count,
+                        bool transfer)
 {
     int src_first = 0;
 
+    if (transfer) {
+        memcpy(&dest[dst_first], src, count * sizeof(wagon_t));
+        return;
+    }
+
     while (count) {
         dest[dst_first].id = src[src_first].id;
         dest[dst_first].fullname = strdup(src[src_first].fullname);
@@ -70,15 +77,17 @@ static void copy_arrays(const wagon_t *src,
     }
 }
 
-/** add a list of ids to the scrubbing array */
-static int add_id_list(const wagon_t *list, unsigned int count)
+/** add a list of ids to the scrubbing array
+ * \param transfer  the array takes ownership of the names of the list.
+ */
+static int add_id_list(const wagon_t *list, unsigned int count, bool transfer)
 {
     /* always add at the beginning to have LIFO behavior */
 
     /* is there enough room before the first item ? */
     if (count <= array_first) {
         /* copy it just before the head (entries must be consecutive) */
-        copy_arrays(list, dir_array, array_first - count, count);
+        copy_arrays(list, dir_array, array_first - count, count, transfer);
 
         array_first -= count;
 
@@ -91,7 +100,7 @@ static int add_id_list(const wagon_t *list, unsigned int count)
     /* is the array empty ? */
     else if ((array_used == 0) && (count <= array_len)) {
         /* copy from the beginning */
-        copy_arrays(list, dir_array, array_len - count, count);
+        copy_arrays(list, dir_array, array_len - count, count, transfer);
         array_first = array_len - count;
 
 #ifdef _DEBUG_ID_LIST
@@ -121,7 +130,7 @@ static int add_id_list(const wagon_t *list, unsigned int count)
         array_len = new_len;
 
         /* Then copy new ids */
-        copy_arrays(list, dir_array, array_first - count, count);
+        copy_arrays(list, dir_array, array_first - count, count, transfer);
         array_first -= count;
 
 #ifdef _DEBUG_ID_LIST
@@ -163,7 +172,7 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
     int i, rc;
     int last_err = 0;
 
-    rc = add_id_list(id_list, id_count);
+    rc = add_id_list(id_list, id_count, false);
     if (rc)
         return rc;
 
@@ -180,12 +189,12 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
 
         /* get a set of entry_ids */
         curr_array = &dir_array[array_first];
-        if (array_used < LS_CHUNK) {
+        if (array_used < lmgr_dir_list_chunk()) {
             /* get all available dirs */
             count = array_used;
         } else {
             /* get a constant chunk */
-            count = LS_CHUNK;
+            count = lmgr_dir_list_chunk();
         }
 
 #ifdef _DEBUG_ID_LIST
@@ -216,9 +225,13 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
         /* can release the list of input ids */
         rbh_scrub_release_list(array_first, count);
 
-        /* copy entry ids before freeing them */
-        /* TODO: we could transfer the pathname instead of strdup() them. */
-        add_id_list(child_ids, res_count);
+        /* move child ids and names to the array */
+        if (add_id_list(child_ids, res_count, true) != 0) {
+            DisplayLog(LVL_CRIT, SCRUB_TAG, "Cannot allocate memory for "
+                       "%u directories", res_count);
+            free_wagon(child_ids, 0, res_count);
+            last_err = -ENOMEM;
+        }
 
         /* attributes no longer needed */
         /* release attrs */
@@ -229,9 +242,8 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
             child_attrs = NULL;
         }
 
-        /* free the returned id array */
+        /* free the returned id array (names now belong to dir_array) */
         if (child_ids) {
-            free_wagon(child_ids, 0, res_count);
             MemFree(child_ids);
             child_ids = NULL;
         }
@@ -241,6 +253,380 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
     return last_err;
 }
 
+/* ---- parallel scrubbing ---- */
+
+/** a directory to be scanned by parallel scrubbing */
+struct scrub_node {
+    wagon_t             dir;
+    attr_set_t          attrs;
+    bool                is_root;    /* no callback for root entries */
+
+    /* output of the directory */
+    char               *out;
+    size_t              out_len;
+    bool                done;
+    bool                emitted;
+
+    /* subdirectories, for ordered output */
+    struct scrub_node  *parent;
+    struct scrub_node **children;
+    unsigned int        child_count;
+    unsigned int        next_child;
+};
+
+struct par_scrub {
+    const struct par_scrub_opt *opt;
+    par_scrub_callback_t cb_func;
+    attr_mask_t         dir_attr_mask;
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+
+    /* frontier of directories to be scanned (LIFO) */
+    struct scrub_node **stack;
+    unsigned int        stack_len;
+    unsigned int        stack_size;
+    /* number of directories being scanned */
+    unsigned int        busy;
+
+    /* next node to be written (ordered output) */
+    struct scrub_node  *cursor;
+
+    int                 last_err;
+};
+
+struct par_scrub_thr {
+    struct par_scrub   *ps;
+    unsigned int        index;
+};
+
+static void scrub_node_free(struct scrub_node *n)
+{
+    free(n->dir.fullname);
+    ListMgr_FreeAttrs(&n->attrs);
+    free(n->out);
+    MemFree(n->children);
+    MemFree(n);
+}
+
+static int scrub_push(struct par_scrub *ps, struct scrub_node *n)
+{
+    if (ps->stack_len == ps->stack_size) {
+        unsigned int new_size = ps->stack_size ? 2 * ps->stack_size : 256;
+        struct scrub_node **s;
+
+        s = MemRealloc(ps->stack, new_size * sizeof(*s));
+        if (s == NULL)
+            return -ENOMEM;
+        ps->stack = s;
+        ps->stack_size = new_size;
+    }
+    ps->stack[ps->stack_len++] = n;
+    return 0;
+}
+
+static void scrub_write(struct par_scrub *ps, struct scrub_node *n)
+{
+    if (n->out_len > 0)
+        fwrite(n->out, 1, n->out_len, ps->opt->output);
+    free(n->out);
+    n->out = NULL;
+    n->out_len = 0;
+    n->emitted = true;
+}
+
+/**
+ * Write the output of nodes in traversal order, as far as they are ready.
+ * Nodes are released once they and their subdirectories are written.
+ * Must be called with ps->lock held.
+ */
+static void scrub_emit_ordered(struct par_scrub *ps)
+{
+    while (ps->cursor != NULL) {
+        struct scrub_node *n = ps->cursor;
+
+        if (!n->emitted) {
+            if (!n->done)
+                return;
+            scrub_write(ps, n);
+        }
+
+        if (n->next_child < n->child_count) {
+            ps->cursor = n->children[n->next_child++];
+            continue;
+        }
+
+        /* the node and all its subdirectories have been written */
+        ps->cursor = n->parent;
+        scrub_node_free(n);
+    }
+}
+
+/** scan a directory: call the callback and list its subdirectories */
+static void scrub_node_process(struct par_scrub *ps, lmgr_t *lmgr,
+                               lmgr_filter_t *filter, struct scrub_node *n,
+                               void *thr_arg)
+{
+    wagon_t *child_ids = NULL;
+    attr_set_t *child_attrs = NULL;
+    unsigned int res_count = 0;
+    FILE *out = NULL;
+    unsigned int i;
+    int rc;
+
+    if (!n->is_root) {
+        if (ps->opt->output != NULL) {
+            out = open_memstream(&n->out, &n->out_len);
+            if (out == NULL) {
+                P(ps->lock);
+                ps->last_err = -errno;
+                V(ps->lock);
+                return;
+            }
+        }
+
+        rc = ps->cb_func(lmgr, &n->dir, &n->attrs, 1, out, thr_arg);
+        if (out != NULL)
+            fclose(out);
+        if (rc) {
+            P(ps->lock);
+            ps->last_err = rc;
+            V(ps->lock);
+        }
+    }
+
+    rc = ListMgr_GetChild(lmgr, filter, &n->dir, 1, ps->dir_attr_mask,
+                          &child_ids, &child_attrs, &res_count);
+    if (rc) {
+        DisplayLog(LVL_CRIT, SCRUB_TAG,
+                   "ListMgr_GetChild() terminated with error %d", rc);
+        P(ps->lock);
+        ps->last_err = rc;
+        V(ps->lock);
+        return;
+    }
+
+    if (res_count > 0) {
+        n->children = MemCalloc(res_count, sizeof(*n->children));
+        if (n->children == NULL)
+            goto free_childs;
+    }
+
+    for (i = 0; i < res_count; i++) {
+        struct scrub_node *c = MemCalloc(1, sizeof(*c));
+
+        if (c == NULL)
+            break;
+
+        /* transfer the ownership of the path and attributes */
+        c->dir = child_ids[i];
+        c->attrs = child_attrs[i];
+        c->parent = n;
+
+        n->children[n->child_count++] = c;
+    }
+
+ free_childs:
+    /* release what has not been transferred */
+    for (i = n->child_count; i < res_count; i++)
+        ListMgr_FreeAttrs(&child_attrs[i]);
+    free_wagon(child_ids, n->child_count, res_count);
+    MemFree(child_ids);
+    MemFree(child_attrs);
+}
+
+static void *scrub_thr(void *arg)
+{
+    struct par_scrub_thr *thr = arg;
+    struct par_scrub *ps = thr->ps;
+    void *thr_arg = ps->opt->thr_args ? ps->opt->thr_args[thr->index] : NULL;
+    lmgr_filter_t filter;
+    filter_value_t fv;
+    lmgr_t lmgr;
+    int rc;
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, SCRUB_TAG,
+                   "Error %d: cannot connect to database", rc);
+        P(ps->lock);
+        ps->last_err = rc;
+        V(ps->lock);
+        return NULL;
+    }
+
+    /* only get subdirs (for scanning) */
+    fv.value.val_str = STR_TYPE_DIR;
+    lmgr_simple_filter_init(&filter);
+    lmgr_simple_filter_add(&filter, ATTR_INDEX_type, EQUAL, fv, 0);
+
+    P(ps->lock);
+    for (;;) {
+        struct scrub_node *n;
+        int i;
+
+        while (ps->stack_len == 0 && ps->busy > 0)
+            pthread_cond_wait(&ps->cond, &ps->lock);
+
+        if (ps->stack_len == 0)
+            /* nothing to be scanned and nothing running: finished */
+            break;
+
+        n = ps->stack[--ps->stack_len];
+        ps->busy++;
+        V(ps->lock);
+
+        scrub_node_process(ps, &lmgr, &filter, n, thr_arg);
+
+        P(ps->lock);
+        ps->busy--;
+        n->done = true;
+
+        /* push in reverse order, to scan them in the listed order */
+        for (i = (int)n->child_count - 1; i >= 0; i--) {
+            if (scrub_push(ps, n->children[i])) {
+                ps->last_err = -ENOMEM;
+                break;
+            }
+        }
+
+        if (ps->opt->ordered && ps->opt->output != NULL) {
+            scrub_emit_ordered(ps);
+        } else {
+            if (ps->opt->output != NULL)
+                scrub_write(ps, n);
+            /* no need to keep the node */
+            for (i = 0; i < n->child_count; i++)
+                n->children[i]->parent = NULL;
+            scrub_node_free(n);
+        }
+        pthread_cond_broadcast(&ps->cond);
+    }
+    pthread_cond_broadcast(&ps->cond);
+    V(ps->lock);
+
+    lmgr_simple_filter_free(&filter);
+    ListMgr_CloseAccess(&lmgr);
+    return NULL;
+}
+
+int rbh_scrub_parallel(const wagon_t *id_list, unsigned int id_count,
+                       attr_mask_t dir_attr_mask, par_scrub_callback_t cb_func,
+                       const struct par_scrub_opt *opt)
+{
+    struct par_scrub ps = {
+        .opt = opt,
+        .cb_func = cb_func,
+        .dir_attr_mask = dir_attr_mask,
+    };
+    struct scrub_node *top;
+    struct par_scrub_thr *thrs;
+    pthread_t *tids;
+    unsigned int i, started = 0;
+    int rc = 0;
+
+    /* virtual parent of the given directories, already written */
+    top = MemCalloc(1, sizeof(*top));
+    if (top == NULL)
+        return -ENOMEM;
+    top->done = top->emitted = true;
+    if (id_count > 0) {
+        top->children = MemCalloc(id_count, sizeof(*top->children));
+        if (top->children == NULL) {
+            MemFree(top);
+            return -ENOMEM;
+        }
+    }
+
+    for (i = 0; i < id_count; i++) {
+        struct scrub_node *n = MemCalloc(1, sizeof(*n));
+
+        if (n == NULL) {
+            rc = -ENOMEM;
+            break;
+        }
+        n->dir.id = id_list[i].id;
+        n->dir.fullname = strdup(id_list[i].fullname);
+        n->is_root = true;
+        n->parent = top;
+        top->children[top->child_count++] = n;
+    }
+
+    for (i = top->child_count; i > 0; i--)
+        if (scrub_push(&ps, top->children[i - 1]))
+            rc = -ENOMEM;
+
+    if (rc) {
+        /* the nodes have not been scanned yet: free them all */
+        for (i = 0; i < top->child_count; i++)
+            scrub_node_free(top->children[i]);
+        top->child_count = 0;
+        scrub_node_free(top);
+        MemFree(ps.stack);
+        return rc;
+    }
+
+    if (opt->ordered && opt->output != NULL) {
+        ps.cursor = top;
+    } else {
+        /* top is not needed */
+        for (i = 0; i < top->child_count; i++)
+            top->children[i]->parent = NULL;
+        scrub_node_free(top);
+    }
+
+    pthread_mutex_init(&ps.lock, NULL);
+    pthread_cond_init(&ps.cond, NULL);
+
+    thrs = MemCalloc(opt->nb_threads, sizeof(*thrs));
+    tids = MemCalloc(opt->nb_threads, sizeof(*tids));
+    if (thrs == NULL || tids == NULL) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < opt->nb_threads; i++) {
+        thrs[i].ps = &ps;
+        thrs[i].index = i;
+        rc = pthread_create(&tids[i], NULL, scrub_thr, &thrs[i]);
+        if (rc) {
+            DisplayLog(LVL_CRIT, SCRUB_TAG, "Failed to start scrubbing "
+                       "thread: %s", strerror(rc));
+            rc = -rc;
+            break;
+        }
+        started++;
+    }
+
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    if (ps.last_err)
+        rc = ps.last_err;
+
+ out:
+    /* directories remain only if no thread could scan them */
+    if (ps.stack_len > 0) {
+        while (ps.stack_len > 0)
+            scrub_node_free(ps.stack[--ps.stack_len]);
+        if (ps.cursor != NULL) {
+            top->child_count = 0;
+            scrub_node_free(top);
+        }
+        if (rc == 0)
+            rc = -EIO;
+    }
+    if (opt->output != NULL)
+        fflush(opt->output);
+
+    MemFree(thrs);
+    MemFree(tids);
+    MemFree(ps.stack);
+    pthread_cond_destroy(&ps.cond);
+    pthread_mutex_destroy(&ps.lock);
+    return rc;
+}
+
 int Path2Id(const char *path, entry_id_t *id)
 {
     int rc;
@@ -561,16 +947,14 @@ const char *attr2str(attr_set_t *attrs, const entry_id_t *id,
 
     case ATTR_INDEX_uid:
         if (global_config.uid_gid_as_numbers) {
-            snprintf(out, out_sz, "%d", ATTR(attrs, uid).num);
-            return out;
+            return uid2name(ATTR(attrs, uid).num, out, out_sz);
         } else {
             return ATTR(attrs, uid).txt;
         }
 
     case ATTR_INDEX_gid:
         if (global_config.uid_gid_as_numbers) {
-            snprintf(out, out_sz, "%d", ATTR(attrs, gid).num);
-            return out;
+            return gid2name(ATTR(attrs, gid).num, out, out_sz);
         } else {
             return ATTR(attrs, gid).txt;
         }
@@ -705,13 +1089,6 @@ static const char *print_res_count(const db_value_t *val, bool csv,
     return out;
 }
 
-static const char *print_res_int(const db_value_t *val, bool csv,
-                                 char *out, size_t out_sz)
-{
-    snprintf(out, out_sz, "%d", val->value_u.val_int);
-    return out;
-}
-
 static const char *print_res_string(const db_value_t *val, bool csv,
                                     char *out, size_t out_sz)
 {
@@ -796,6 +1173,18 @@ static struct attr_display_spec {
         {0, NULL, 0, 0}, /* final element */
 };
 
+static const char *print_res_uid(const db_value_t *val, bool csv,
+                                 char *out, size_t out_sz)
+{
+    return uid2name(val->value_u.val_int, out, out_sz);
+}
+
+static const char *print_res_gid(const db_value_t *val, bool csv,
+                                 char *out, size_t out_sz)
+{
+    return gid2name(val->value_u.val_int, out, out_sz);
+}
+
 static inline struct attr_display_spec *attr_info(int index)
 {
     int i;
@@ -807,11 +1196,13 @@ static inline struct attr_display_spec *attr_info(int index)
 
         if (global_config.uid_gid_as_numbers) {
             /* Change the function to print the UID/GID, as the
-             * argument is a number, not a string. */
+             * argument is a number, not a string: names are resolved
+             * for display. */
             for (i = 0; attr[i].name != NULL; i++)
-                if (attr[i].attr_index == ATTR_INDEX_uid ||
-                    attr[i].attr_index == ATTR_INDEX_gid)
-                    attr[i].result2str = print_res_int;
+                if (attr[i].attr_index == ATTR_INDEX_uid)
+                    attr[i].result2str = print_res_uid;
+                else if (attr[i].attr_index == ATTR_INDEX_gid)
+                    attr[i].result2str = print_res_gid;
         }
     }
 
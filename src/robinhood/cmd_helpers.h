@@ -50,6 +50,38 @@ int rbh_scrub(lmgr_t *p_mgr, const wagon_t *id_list,
               unsigned int id_count, attr_mask_t dir_attr_mask,
               scrub_callback_t cb_func, void *arg);
 
+/** The caller's function to be called by parallel scrubbing threads.
+ * \param lmgr   DB connection of the calling thread.
+ * \param out    output buffer of the directories (NULL if the scrubbing
+ *               has no output).
+ * \param thr_arg per-thread argument.
+ */
+typedef int (*par_scrub_callback_t) (lmgr_t *lmgr, wagon_t *id_list,
+                                     attr_set_t *attr_list,
+                                     unsigned int entry_count, FILE *out,
+                                     void *thr_arg);
+
+struct par_scrub_opt {
+    unsigned int nb_threads;
+    /** output stream (NULL for none) */
+    FILE        *output;
+    /** write the output of directories in traversal order: a directory
+     * is written before its subdirectories, and subdirectories are
+     * written in the order they are listed from the DB.
+     * Else, the output of each directory is written when it is ready. */
+    bool         ordered;
+    /** per-thread arguments (array of nb_threads items), or NULL */
+    void       **thr_args;
+};
+
+/** scan sets of directories with several threads and DB connections.
+ * The callback is not called for the entries of id_list (as rbh_scrub()).
+ * \param cb_func, callback function for each directory
+ */
+int rbh_scrub_parallel(const wagon_t *id_list, unsigned int id_count,
+                       attr_mask_t dir_attr_mask, par_scrub_callback_t cb_func,
+                       const struct par_scrub_opt *opt);
+
 int Path2Id(const char *path, entry_id_t *id);
 
 /** Free the content of a wagon list. */
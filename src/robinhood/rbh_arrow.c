@@ -0,0 +1,721 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * Arrow IPC file format: "ARROW1\0\0", a stream of messages (schema, then
+ * record batches, then an end-of-stream marker), a footer indexing the
+ * record batches, its length and "ARROW1".
+ * Each message is a flatbuffer (see Arrow's Message.fbs and Schema.fbs)
+ * followed by its body. Flatbuffers are built by the small builder below,
+ * which works back to front like the reference implementation.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_arrow.h"
+
+#include <glib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#define ARROW_MAGIC         "ARROW1"
+/* Arrow metadata version V5 */
+#define ARROW_VERSION       4
+
+/* Message header types */
+#define MSG_SCHEMA          1
+#define MSG_RECORD_BATCH    3
+
+/* Type union indexes */
+#define TYPE_INT            2
+#define TYPE_UTF8           5
+#define TYPE_BOOL           6
+#define TYPE_TIMESTAMP      10
+
+#define ALIGN8(_x)  (((_x) + 7) & ~((uint64_t)7))
+
+/* ---- flatbuffer builder ---- */
+
+/* max number of fields of the tables we build */
+#define FB_MAX_FIELDS   8
+
+struct fbb {
+    uint8_t *buf;
+    size_t   cap;
+    size_t   head;      /* bytes used, at the end of buf */
+    size_t   minalign;
+    /* table being built */
+    size_t   obj_end;
+    size_t   fields[FB_MAX_FIELDS];  /* positions of fields (0 if unset) */
+    unsigned int nfields;
+};
+
+/* positions are offsets from the end of the buffer, as the buffer grows
+ * toward its beginning */
+static inline uint8_t *fb_at(struct fbb *b, size_t pos)
+{
+    return b->buf + b->cap - pos;
+}
+
+static void fb_init(struct fbb *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->minalign = 1;
+}
+
+static void fb_free(struct fbb *b)
+{
+    g_free(b->buf);
+}
+
+static void fb_grow(struct fbb *b, size_t n)
+{
+    size_t ncap;
+    uint8_t *nbuf;
+
+    if (b->cap - b->head >= n)
+        return;
+
+    for (ncap = b->cap ? b->cap : 256; ncap - b->head < n; ncap *= 2)
+        ;
+    nbuf = g_malloc(ncap);
+    memcpy(nbuf + ncap - b->head, b->buf + b->cap - b->head, b->head);
+    g_free(b->buf);
+    b->buf = nbuf;
+    b->cap = ncap;
+}
+
+static void fb_pad(struct fbb *b, size_t n)
+{
+    fb_grow(b, n);
+    b->head += n;
+    memset(fb_at(b, b->head), 0, n);
+}
+
+/** align so that 'size' bytes can be written after 'additional' bytes */
+static void fb_prep(struct fbb *b, size_t size, size_t additional)
+{
+    if (size > b->minalign)
+        b->minalign = size;
+    fb_pad(b, (~(b->head + additional) + 1) & (size - 1));
+}
+
+static void fb_push(struct fbb *b, const void *p, size_t n)
+{
+    fb_grow(b, n);
+    b->head += n;
+    memcpy(fb_at(b, b->head), p, n);
+}
+
+/** push a little endian scalar */
+static void fb_push_le(struct fbb *b, uint64_t v, size_t size)
+{
+    uint8_t tmp[8];
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        tmp[i] = v >> (8 * i);
+    fb_push(b, tmp, size);
+}
+
+/** push an offset to an object created before */
+static void fb_push_offset(struct fbb *b, size_t obj)
+{
+    fb_prep(b, 4, 0);
+    fb_push_le(b, b->head + 4 - obj, 4);
+}
+
+static size_t fb_string(struct fbb *b, const char *s)
+{
+    size_t len = strlen(s);
+
+    fb_prep(b, 4, len + 1);
+    fb_pad(b, 1);
+    fb_push(b, s, len);
+    fb_push_le(b, len, 4);
+    return b->head;
+}
+
+/**
+ * Vector of structs: elements must be pushed in reverse order
+ * between start and end.
+ */
+static void fb_start_vector(struct fbb *b, size_t count, size_t elem_size,
+                            size_t align)
+{
+    fb_prep(b, 4, count * elem_size);
+    fb_prep(b, align, count * elem_size);
+}
+
+static size_t fb_end_vector(struct fbb *b, size_t count)
+{
+    fb_push_le(b, count, 4);
+    return b->head;
+}
+
+static size_t fb_offset_vector(struct fbb *b, const size_t *objs,
+                               size_t count)
+{
+    size_t i;
+
+    fb_start_vector(b, count, 4, 4);
+    for (i = count; i > 0; i--)
+        fb_push_offset(b, objs[i - 1]);
+    return fb_end_vector(b, count);
+}
+
+static void fb_start_table(struct fbb *b)
+{
+    memset(b->fields, 0, sizeof(b->fields));
+    b->nfields = 0;
+    b->obj_end = b->head;
+}
+
+static void fb_field_set(struct fbb *b, unsigned int id)
+{
+    b->fields[id] = b->head;
+    if (id + 1 > b->nfields)
+        b->nfields = id + 1;
+}
+
+static void fb_add_scalar(struct fbb *b, unsigned int id, uint64_t v,
+                          size_t size)
+{
+    fb_prep(b, size, 0);
+    fb_push_le(b, v, size);
+    fb_field_set(b, id);
+}
+
+static void fb_add_offset(struct fbb *b, unsigned int id, size_t obj)
+{
+    fb_push_offset(b, obj);
+    fb_field_set(b, id);
+}
+
+static size_t fb_end_table(struct fbb *b)
+{
+    size_t table, vtable;
+    int i;
+
+    /* offset to the vtable, set below */
+    fb_prep(b, 4, 0);
+    fb_push_le(b, 0, 4);
+    table = b->head;
+
+    for (i = b->nfields - 1; i >= 0; i--)
+        fb_push_le(b, b->fields[i] ? table - b->fields[i] : 0, 2);
+    fb_push_le(b, table - b->obj_end, 2);
+    fb_push_le(b, (b->nfields + 2) * 2, 2);
+    vtable = b->head;
+
+    /* the vtable is before the table */
+    {
+        uint32_t soff = vtable - table;
+        uint8_t *p = fb_at(b, table);
+
+        p[0] = soff;
+        p[1] = soff >> 8;
+        p[2] = soff >> 16;
+        p[3] = soff >> 24;
+    }
+    return table;
+}
+
+/** @return the size of the finished buffer, that starts at fb_at(head) */
+static size_t fb_finish(struct fbb *b, size_t root)
+{
+    if (b->minalign < 8)
+        b->minalign = 8;
+    fb_prep(b, b->minalign, 4);
+    fb_push_offset(b, root);
+    return b->head;
+}
+
+/* ---- batches ---- */
+
+struct arrow_col {
+    GByteArray *validity;   /* 1 bit per row */
+    GByteArray *values;     /* int64 values, bits or string data */
+    GByteArray *offsets;    /* utf8: int32 offsets of strings */
+    uint64_t    null_count;
+    bool        set;        /* value of the current row is set */
+};
+
+struct arrow_batch {
+    unsigned int       ncols;
+    const arrow_type_e *types;
+    unsigned int       rows;
+    struct arrow_col  *cols;
+};
+
+struct arrow_block {
+    int64_t offset;
+    int32_t meta_len;
+    int64_t body_len;
+};
+
+struct arrow_writer {
+    FILE           *f;
+    pthread_mutex_t lock;
+    unsigned int    ncols;
+    char          **names;
+    arrow_type_e   *types;
+    uint64_t        pos;    /* bytes written */
+    GArray         *blocks; /* struct arrow_block */
+    int             err;
+};
+
+static void col_reset(struct arrow_col *c, arrow_type_e type)
+{
+    int32_t zero = 0;
+
+    g_byte_array_set_size(c->validity, 0);
+    g_byte_array_set_size(c->values, 0);
+    if (type == ARROW_UTF8) {
+        g_byte_array_set_size(c->offsets, 0);
+        g_byte_array_append(c->offsets, (guint8 *)&zero, sizeof(zero));
+    }
+    c->null_count = 0;
+    c->set = false;
+}
+
+struct arrow_batch *arrow_batch_new(const struct arrow_writer *w)
+{
+    struct arrow_batch *b = g_new0(struct arrow_batch, 1);
+    unsigned int i;
+
+    b->ncols = w->ncols;
+    b->types = w->types;
+    b->cols = g_new0(struct arrow_col, w->ncols);
+
+    for (i = 0; i < b->ncols; i++) {
+        b->cols[i].validity = g_byte_array_new();
+        b->cols[i].values = g_byte_array_new();
+        if (b->types[i] == ARROW_UTF8)
+            b->cols[i].offsets = g_byte_array_new();
+        col_reset(&b->cols[i], b->types[i]);
+    }
+    return b;
+}
+
+void arrow_batch_free(struct arrow_batch *b)
+{
+    unsigned int i;
+
+    for (i = 0; i < b->ncols; i++) {
+        g_byte_array_free(b->cols[i].validity, TRUE);
+        g_byte_array_free(b->cols[i].values, TRUE);
+        if (b->cols[i].offsets != NULL)
+            g_byte_array_free(b->cols[i].offsets, TRUE);
+    }
+    g_free(b->cols);
+    g_free(b);
+}
+
+unsigned int arrow_batch_rows(const struct arrow_batch *b)
+{
+    return b->rows;
+}
+
+/** set the bit of the current row in a bitmap */
+static void set_bit(GByteArray *bits, unsigned int row, bool val)
+{
+    if (row % 8 == 0) {
+        guint8 zero = 0;
+
+        g_byte_array_append(bits, &zero, 1);
+    }
+    if (val)
+        bits->data[row / 8] |= 1 << (row % 8);
+}
+
+static void col_valid(struct arrow_batch *b, unsigned int col, bool valid)
+{
+    struct arrow_col *c = &b->cols[col];
+
+    set_bit(c->validity, b->rows, valid);
+    if (!valid)
+        c->null_count++;
+    c->set = true;
+}
+
+void arrow_batch_set_int(struct arrow_batch *b, unsigned int col, int64_t v)
+{
+    struct arrow_col *c = &b->cols[col];
+
+    if (b->types[col] == ARROW_BOOL)
+        set_bit(c->values, b->rows, v != 0);
+    else
+        g_byte_array_append(c->values, (guint8 *)&v, sizeof(v));
+    col_valid(b, col, true);
+}
+
+void arrow_batch_set_str(struct arrow_batch *b, unsigned int col,
+                         const char *s)
+{
+    struct arrow_col *c = &b->cols[col];
+    int32_t end;
+
+    g_byte_array_append(c->values, (const guint8 *)s, strlen(s));
+    end = c->values->len;
+    g_byte_array_append(c->offsets, (guint8 *)&end, sizeof(end));
+    col_valid(b, col, true);
+}
+
+void arrow_batch_set_null(struct arrow_batch *b, unsigned int col)
+{
+    struct arrow_col *c = &b->cols[col];
+    int64_t zero = 0;
+    int32_t end;
+
+    switch (b->types[col]) {
+    case ARROW_UTF8:
+        end = c->values->len;
+        g_byte_array_append(c->offsets, (guint8 *)&end, sizeof(end));
+        break;
+    case ARROW_BOOL:
+        set_bit(c->values, b->rows, false);
+        break;
+    default:
+        g_byte_array_append(c->values, (guint8 *)&zero, sizeof(zero));
+    }
+    col_valid(b, col, false);
+}
+
+void arrow_batch_end_row(struct arrow_batch *b)
+{
+    unsigned int i;
+
+    for (i = 0; i < b->ncols; i++) {
+        if (!b->cols[i].set)
+            arrow_batch_set_null(b, i);
+        b->cols[i].set = false;
+    }
+    b->rows++;
+}
+
+/* ---- writer ---- */
+
+static void write_raw(struct arrow_writer *w, const void *p, size_t len)
+{
+    if (w->err == 0 && len > 0 && fwrite(p, 1, len, w->f) != len)
+        w->err = errno ? errno : EIO;
+    w->pos += len;
+}
+
+static void write_pad(struct arrow_writer *w, size_t len)
+{
+    static const uint8_t zeros[8] = { 0 };
+
+    write_raw(w, zeros, len);
+}
+
+static void write_le32(struct arrow_writer *w, uint32_t v)
+{
+    uint8_t tmp[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+    write_raw(w, tmp, sizeof(tmp));
+}
+
+/** write an encapsulated message: 0xFFFFFFFF, metadata size, metadata */
+static int32_t write_message(struct arrow_writer *w, struct fbb *b,
+                             size_t size)
+{
+    uint32_t meta_len = ALIGN8(size);
+
+    write_le32(w, 0xFFFFFFFF);
+    write_le32(w, meta_len);
+    write_raw(w, fb_at(b, b->head), size);
+    write_pad(w, meta_len - size);
+    return meta_len + 8;
+}
+
+static size_t fb_type_table(struct fbb *b, arrow_type_e type, uint8_t *id)
+{
+    fb_start_table(b);
+    switch (type) {
+    case ARROW_INT64:
+    case ARROW_UINT64:
+        *id = TYPE_INT;
+        /* bitWidth, is_signed */
+        fb_add_scalar(b, 0, 64, 4);
+        fb_add_scalar(b, 1, type == ARROW_INT64, 1);
+        break;
+    case ARROW_TIMESTAMP:
+        *id = TYPE_TIMESTAMP;
+        /* unit: SECOND */
+        fb_add_scalar(b, 0, 0, 2);
+        break;
+    case ARROW_BOOL:
+        *id = TYPE_BOOL;
+        break;
+    case ARROW_UTF8:
+        *id = TYPE_UTF8;
+        break;
+    }
+    return fb_end_table(b);
+}
+
+static inline bool host_big_endian(void)
+{
+    const uint16_t one = 1;
+
+    return *(const uint8_t *)&one == 0;
+}
+
+static size_t fb_schema(struct fbb *b, const struct arrow_writer *w)
+{
+    size_t *fields = g_new(size_t, w->ncols);
+    size_t vec, schema;
+    unsigned int i;
+
+    for (i = 0; i < w->ncols; i++) {
+        size_t name, type, children;
+        uint8_t type_id = 0;
+
+        name = fb_string(b, w->names[i]);
+        type = fb_type_table(b, w->types[i], &type_id);
+        fb_start_vector(b, 0, 4, 4);
+        children = fb_end_vector(b, 0);
+
+        fb_start_table(b);
+        fb_add_offset(b, 0, name);
+        fb_add_offset(b, 3, type);
+        fb_add_offset(b, 5, children);
+        fb_add_scalar(b, 1, 1, 1);          /* nullable */
+        fb_add_scalar(b, 2, type_id, 1);    /* type_type */
+        fields[i] = fb_end_table(b);
+    }
+    vec = fb_offset_vector(b, fields, w->ncols);
+    g_free(fields);
+
+    fb_start_table(b);
+    fb_add_offset(b, 1, vec);
+    fb_add_scalar(b, 0, host_big_endian() ? 1 : 0, 2);
+    schema = fb_end_table(b);
+    return schema;
+}
+
+static size_t fb_message(struct fbb *b, uint8_t header_type, size_t header,
+                         int64_t body_len)
+{
+    fb_start_table(b);
+    fb_add_scalar(b, 3, body_len, 8);
+    fb_add_offset(b, 2, header);
+    fb_add_scalar(b, 0, ARROW_VERSION, 2);
+    fb_add_scalar(b, 1, header_type, 1);
+    return fb_end_table(b);
+}
+
+struct arrow_writer *arrow_writer_open(FILE *f, unsigned int ncols,
+                                       const char **names,
+                                       const arrow_type_e *types)
+{
+    struct arrow_writer *w = g_new0(struct arrow_writer, 1);
+    struct fbb b;
+    size_t size;
+    unsigned int i;
+
+    w->f = f;
+    pthread_mutex_init(&w->lock, NULL);
+    w->ncols = ncols;
+    w->names = g_new(char *, ncols);
+    w->types = g_new(arrow_type_e, ncols);
+    for (i = 0; i < ncols; i++) {
+        w->names[i] = g_strdup(names[i]);
+        w->types[i] = types[i];
+    }
+    w->blocks = g_array_new(FALSE, FALSE, sizeof(struct arrow_block));
+
+    write_raw(w, ARROW_MAGIC, strlen(ARROW_MAGIC));
+    write_pad(w, 8 - strlen(ARROW_MAGIC));
+
+    fb_init(&b);
+    size = fb_finish(&b, fb_message(&b, MSG_SCHEMA, fb_schema(&b, w), 0));
+    write_message(w, &b, size);
+    fb_free(&b);
+
+    if (w->err) {
+        arrow_writer_close(w);
+        return NULL;
+    }
+    return w;
+}
+
+/** buffers of a column, in the order of the Arrow layout */
+static unsigned int col_buffers(const struct arrow_col *c, unsigned int rows,
+                                arrow_type_e type, const GByteArray **bufs,
+                                uint64_t *lens)
+{
+    unsigned int n = 0;
+
+    /* no validity bitmap if there is no null */
+    bufs[n] = c->validity;
+    lens[n++] = c->null_count ? (rows + 7) / 8 : 0;
+
+    if (type == ARROW_UTF8) {
+        bufs[n] = c->offsets;
+        lens[n++] = c->offsets->len;
+    }
+    bufs[n] = c->values;
+    lens[n++] = c->values->len;
+    return n;
+}
+
+int arrow_write_batch(struct arrow_writer *w, struct arrow_batch *b)
+{
+    const GByteArray *bufs[3];
+    uint64_t lens[3];
+    unsigned int i, j, n, nbufs = 0;
+    uint64_t body_len = 0;
+    uint8_t tmp[24];
+    struct arrow_block block;
+    struct fbb fb;
+    size_t nodes, buffers, size;
+    int rc;
+
+    if (b->rows == 0)
+        return 0;
+
+    for (i = 0; i < b->ncols; i++)
+        nbufs += col_buffers(&b->cols[i], b->rows, b->types[i], bufs, lens);
+
+    fb_init(&fb);
+
+    /* buffers, pushed in reverse order */
+    fb_start_vector(&fb, nbufs, 16, 8);
+    {
+        uint64_t *offs = g_new(uint64_t, nbufs);
+        uint64_t *sizes = g_new(uint64_t, nbufs);
+        unsigned int k = 0;
+
+        for (i = 0; i < b->ncols; i++) {
+            n = col_buffers(&b->cols[i], b->rows, b->types[i], bufs, lens);
+            for (j = 0; j < n; j++, k++) {
+                offs[k] = body_len;
+                sizes[k] = lens[j];
+                body_len += ALIGN8(lens[j]);
+            }
+        }
+        for (k = nbufs; k > 0; k--) {
+            for (j = 0; j < 8; j++) {
+                tmp[j] = offs[k - 1] >> (8 * j);
+                tmp[8 + j] = sizes[k - 1] >> (8 * j);
+            }
+            fb_push(&fb, tmp, 16);
+        }
+        g_free(offs);
+        g_free(sizes);
+    }
+    buffers = fb_end_vector(&fb, nbufs);
+
+    /* field nodes: length, null_count */
+    fb_start_vector(&fb, b->ncols, 16, 8);
+    for (i = b->ncols; i > 0; i--) {
+        for (j = 0; j < 8; j++) {
+            tmp[j] = (uint64_t)b->rows >> (8 * j);
+            tmp[8 + j] = b->cols[i - 1].null_count >> (8 * j);
+        }
+        fb_push(&fb, tmp, 16);
+    }
+    nodes = fb_end_vector(&fb, b->ncols);
+
+    fb_start_table(&fb);
+    fb_add_scalar(&fb, 0, b->rows, 8);
+    fb_add_offset(&fb, 1, nodes);
+    fb_add_offset(&fb, 2, buffers);
+    size = fb_finish(&fb, fb_message(&fb, MSG_RECORD_BATCH,
+                                     fb_end_table(&fb), body_len));
+
+    pthread_mutex_lock(&w->lock);
+    block.offset = w->pos;
+    block.meta_len = write_message(w, &fb, size);
+    block.body_len = body_len;
+
+    for (i = 0; i < b->ncols; i++) {
+        n = col_buffers(&b->cols[i], b->rows, b->types[i], bufs, lens);
+        for (j = 0; j < n; j++) {
+            write_raw(w, bufs[j]->data, lens[j]);
+            write_pad(w, ALIGN8(lens[j]) - lens[j]);
+        }
+    }
+    g_array_append_val(w->blocks, block);
+    rc = w->err;
+    pthread_mutex_unlock(&w->lock);
+
+    fb_free(&fb);
+
+    for (i = 0; i < b->ncols; i++)
+        col_reset(&b->cols[i], b->types[i]);
+    b->rows = 0;
+    return rc;
+}
+
+int arrow_writer_close(struct arrow_writer *w)
+{
+    struct fbb b;
+    size_t schema, blocks, footer, size;
+    unsigned int i, j;
+    int rc;
+
+    /* end of stream */
+    write_le32(w, 0xFFFFFFFF);
+    write_le32(w, 0);
+
+    fb_init(&b);
+    schema = fb_schema(&b, w);
+
+    fb_start_vector(&b, w->blocks->len, 24, 8);
+    for (i = w->blocks->len; i > 0; i--) {
+        const struct arrow_block *blk = &g_array_index(w->blocks,
+                                                       struct arrow_block,
+                                                       i - 1);
+        uint8_t tmp[24] = { 0 };
+
+        for (j = 0; j < 8; j++) {
+            tmp[j] = (uint64_t)blk->offset >> (8 * j);
+            tmp[16 + j] = (uint64_t)blk->body_len >> (8 * j);
+        }
+        for (j = 0; j < 4; j++)
+            tmp[8 + j] = (uint32_t)blk->meta_len >> (8 * j);
+        fb_push(&b, tmp, 24);
+    }
+    blocks = fb_end_vector(&b, w->blocks->len);
+
+    fb_start_table(&b);
+    fb_add_offset(&b, 1, schema);
+    fb_add_offset(&b, 3, blocks);
+    fb_add_scalar(&b, 0, ARROW_VERSION, 2);
+    footer = fb_end_table(&b);
+    size = fb_finish(&b, footer);
+
+    write_raw(w, fb_at(&b, b.head), size);
+    write_le32(w, size);
+    write_raw(w, ARROW_MAGIC, strlen(ARROW_MAGIC));
+    fb_free(&b);
+
+    if (w->err == 0 && fflush(w->f) != 0)
+        w->err = errno;
+    rc = w->err;
+
+    for (i = 0; i < w->ncols; i++)
+        g_free(w->names[i]);
+    g_free(w->names);
+    g_free(w->types);
+    g_array_free(w->blocks, TRUE);
+    pthread_mutex_destroy(&w->lock);
+    g_free(w);
+    return rc;
+}
@@ -0,0 +1,78 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+/**
+ * \file  rbh_arrow.h
+ * \brief Minimal writer of Apache Arrow IPC files (a.k.a. Feather v2).
+ *
+ * Rows are appended to batches (one per thread), which are written
+ * as record batches of the file. Only flat columns of a few types
+ * are supported, without dictionaries or compression.
+ */
+#ifndef _RBH_ARROW_H
+#define _RBH_ARROW_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+typedef enum {
+    ARROW_INT64,
+    ARROW_UINT64,
+    ARROW_TIMESTAMP,    /**< seconds since the Epoch */
+    ARROW_BOOL,
+    ARROW_UTF8,
+} arrow_type_e;
+
+struct arrow_writer;
+struct arrow_batch;
+
+/**
+ * Start writing an Arrow file: write its header and schema.
+ * @param f  output stream (needs not be seekable).
+ * @return NULL on error.
+ */
+struct arrow_writer *arrow_writer_open(FILE *f, unsigned int ncols,
+                                       const char **names,
+                                       const arrow_type_e *types);
+
+/**
+ * Write the file footer and free the writer (the stream is not closed).
+ * @return 0 on success, else an errno value.
+ */
+int arrow_writer_close(struct arrow_writer *w);
+
+/** allocate an empty batch for the writer schema */
+struct arrow_batch *arrow_batch_new(const struct arrow_writer *w);
+void arrow_batch_free(struct arrow_batch *b);
+
+/** number of complete rows in the batch */
+unsigned int arrow_batch_rows(const struct arrow_batch *b);
+
+/* set column values of the current row (ARROW_BOOL takes 0 or 1) */
+void arrow_batch_set_int(struct arrow_batch *b, unsigned int col, int64_t v);
+void arrow_batch_set_str(struct arrow_batch *b, unsigned int col,
+                         const char *s);
+void arrow_batch_set_null(struct arrow_batch *b, unsigned int col);
+
+/** terminate the current row: all its columns must have been set */
+void arrow_batch_end_row(struct arrow_batch *b);
+
+/**
+ * Write the rows of a batch as a record batch of the file, and empty it.
+ * Can be called by several threads with their own batch.
+ * @return 0 on success, else an errno value.
+ */
+int arrow_write_batch(struct arrow_writer *w, struct arrow_batch *b);
+
+#endif
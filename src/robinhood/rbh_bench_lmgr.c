@@ -0,0 +1,670 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file   rbh_bench_lmgr.c
+ * \brief  Benchmark of list manager operations.
+ *
+ * Inserts synthetic entries into the database (one by one or by batches),
+ * then gets, updates, lists (by parent and by iterator) and reports on
+ * them, and finally removes them. Reports the throughput and latency
+ * distribution of each operation, for the DB settings of the configuration
+ * file (commit_behavior, engine, accounting...).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "rbh_hist.h"
+#include "cmd_helpers.h"
+#include "rbh_basename.h"
+#include "Memory.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_TAG   "Bench"
+
+/* number of entries per parent directory */
+#define ENTRIES_PER_DIR 1000
+/* max number of batch sizes */
+#define MAX_BATCH_SIZES 16
+/* number of runs of each report */
+#define REPORT_RUNS     10
+
+static struct option option_tab[] = {
+    /* benchmark options */
+    {"count", required_argument, NULL, 'n'},
+    {"batch-sizes", required_argument, NULL, 'b'},
+    {"seed", required_argument, NULL, 'S'},
+    {"no-cleanup", no_argument, NULL, 'k'},
+
+    /* config file options */
+    {"config-file", required_argument, NULL, 'f'},
+
+    /* log options */
+    {"log-level", required_argument, NULL, 'l'},
+
+    /* miscellaneous options */
+    {"help", no_argument, NULL, 'h'},
+
+    {NULL, 0, NULL, 0}
+};
+
+#define SHORT_OPT_STRING    "n:b:S:kf:l:h"
+
+#define MAX_OPT_LEN 1024
+
+static struct bench_options {
+    unsigned int    count;
+    unsigned int    batch_sizes[MAX_BATCH_SIZES];
+    unsigned int    batch_count;
+    unsigned int    seed;
+    bool            cleanup;
+    char            config_file[MAX_OPT_LEN];
+} options = {
+    .count = 100000,
+    .batch_sizes = {1, 10, 100, 1000},
+    .batch_count = 4,
+    .seed = 1,
+    .cleanup = true,
+    .config_file = "",
+};
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [options]\n"
+    "\n"
+    "Benchmark of database operations. Entries are inserted into the configured\n"
+    "database, and removed at the end: use a scratch database!\n"
+    "\n"
+    _B "Benchmark options:" B_ "\n"
+    "    " _B "-n" B_ " " _U "count" U_ ", " _B "--count=" B_ _U "count" U_ "\n"
+    "        Number of entries inserted for each batch size (default: 100000).\n"
+    "    " _B "-b" B_ " " _U "sizes" U_ ", " _B "--batch-sizes=" B_ _U "sizes" U_ "\n"
+    "        Comma-separated list of insert batch sizes (default: 1,10,100,1000).\n"
+    "        1 means entries are inserted one by one.\n"
+    "    " _B "-S" B_ " " _U "seed" U_ ", " _B "--seed=" B_ _U "seed" U_ "\n"
+    "        Seed of the pseudo-random generator.\n"
+    "    " _B "-k" B_ ", " _B "--no-cleanup" B_ "\n"
+    "        Don't remove the inserted entries at the end.\n"
+    "\n"
+    _B "Config file options:" B_ "\n"
+    "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
+    "        Path to configuration file (or short name).\n"
+    "\n"
+    _B "Miscellaneous options:" B_ "\n"
+    "    " _B "-l" B_ " " _U "level" U_ ", " _B "--log-level=" B_ _U "level" U_ "\n"
+    "        Force the log verbosity level (overides configuration value).\n"
+    "        Allowed values: CRIT, MAJOR, EVENT, VERB, DEBUG, FULL.\n"
+    "    " _B "-h" B_ ", " _B "--help" B_ "\n"
+    "        Display a short help about command line options.\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name);
+}
+
+/** measurement of an operation */
+struct bench_stat {
+    unsigned long long  calls;
+    unsigned long long  entries;
+    unsigned long long  errors;
+    unsigned long long  usec_max;
+    unsigned long long  hist[HIST_BUCKETS];
+    struct timeval      start;
+    double              elapsed;
+};
+
+static void stat_start(struct bench_stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    gettimeofday(&st->start, NULL);
+}
+
+static void stat_end(struct bench_stat *st)
+{
+    struct timeval end, diff;
+
+    gettimeofday(&end, NULL);
+    timersub(&end, &st->start, &diff);
+    st->elapsed = diff.tv_sec + 1E-6 * diff.tv_usec;
+}
+
+/** account a call that processed 'entries' entries */
+static void stat_add(struct bench_stat *st, const struct timeval *t0,
+                     unsigned int entries, int rc)
+{
+    struct timeval t1, diff;
+    unsigned long long usec;
+
+    gettimeofday(&t1, NULL);
+    timersub(&t1, t0, &diff);
+    usec = tv2usec(&diff);
+
+    st->calls++;
+    st->entries += entries;
+    if (rc)
+        st->errors++;
+    if (usec > st->usec_max)
+        st->usec_max = usec;
+    st->hist[hist_bucket(usec)]++;
+}
+
+static void stat_print(const char *what, const struct bench_stat *st)
+{
+    printf("%-22s %9llu %11.1f %11.1f | %8.3f %8.3f %8.3f %9.3f",
+           what, st->calls,
+           st->elapsed > 0.0 ? st->calls / st->elapsed : 0.0,
+           st->elapsed > 0.0 ? st->entries / st->elapsed : 0.0,
+           hist_percentile(st->hist, 50.0), hist_percentile(st->hist, 90.0),
+           hist_percentile(st->hist, 99.0), st->usec_max / 1000.0);
+    if (st->errors)
+        printf("  (%llu errors)", st->errors);
+    printf("\n");
+}
+
+static void print_header(void)
+{
+    printf("%-22s %9s %11s %11s | %8s %8s %8s %9s\n", "operation", "calls",
+           "calls/s", "entries/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+}
+
+/** build a synthetic entry id from a number */
+static void mk_id(unsigned long long n, entry_id_t *id)
+{
+    memset(id, 0, sizeof(*id));
+#ifdef _HAVE_FID
+    /* use a sequence that is not used by real entries */
+    id->f_seq = 0x2FFF00000ULL + (n >> 32);
+    id->f_oid = (uint32_t)n;
+    id->f_ver = 0;
+#else
+    id->inode = n;
+    id->fs_key = get_fskey();
+    id->validator = 1;
+#endif
+}
+
+/* parent ids are put in a different range than entries */
+#define PARENT_NUM(_n)  ((1ULL << 48) + (_n) / ENTRIES_PER_DIR)
+
+/** fill the attributes of a synthetic entry */
+static void mk_attrs(unsigned long long n, attr_set_t *attrs, time_t now)
+{
+    struct stat st;
+
+    ATTR_MASK_INIT(attrs);
+
+    ATTR_MASK_SET(attrs, parent_id);
+    mk_id(PARENT_NUM(n), &ATTR(attrs, parent_id));
+
+    ATTR_MASK_SET(attrs, name);
+    sprintf(ATTR(attrs, name), "file.%llu", n);
+
+    ATTR_MASK_SET(attrs, depth);
+    ATTR(attrs, depth) = 2;
+
+    memset(&st, 0, sizeof(st));
+    st.st_ino = n;
+    st.st_mode = S_IFREG | 0644;
+    st.st_nlink = 1;
+    st.st_uid = n % 137;
+    st.st_gid = (n % 137) / 8;
+    st.st_size = (n % 1024) * 4096;
+    st.st_blocks = st.st_size / 512;
+    st.st_atime = now - (n % 86400);
+    st.st_mtime = st.st_atime;
+    st.st_ctime = st.st_atime;
+    stat2rbh_attrs(&st, attrs, true);
+
+    ATTR_MASK_SET(attrs, md_update);
+    ATTR(attrs, md_update) = now;
+    ATTR_MASK_SET(attrs, path_update);
+    ATTR(attrs, path_update) = now;
+}
+
+/** first entry number of the entries inserted with the i-th batch size */
+static unsigned long long range_start(unsigned int i)
+{
+    return 1 + (unsigned long long)i * options.count;
+}
+
+static void bench_insert(lmgr_t *lmgr, unsigned int batch, unsigned int range,
+                         time_t now)
+{
+    entry_id_t *ids;
+    attr_set_t *attrs;
+    entry_id_t **p_ids;
+    attr_set_t **p_attrs;
+    struct bench_stat st;
+    unsigned long long first = range_start(range);
+    unsigned int i, j;
+    char what[64];
+
+    ids = MemCalloc(batch, sizeof(*ids));
+    attrs = MemCalloc(batch, sizeof(*attrs));
+    p_ids = MemCalloc(batch, sizeof(*p_ids));
+    p_attrs = MemCalloc(batch, sizeof(*p_attrs));
+    if (!ids || !attrs || !p_ids || !p_attrs) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Cannot allocate batch of %u", batch);
+        exit(ENOMEM);
+    }
+    for (j = 0; j < batch; j++) {
+        p_ids[j] = &ids[j];
+        p_attrs[j] = &attrs[j];
+    }
+
+    stat_start(&st);
+    for (i = 0; i < options.count; i += batch) {
+        unsigned int n = MIN2(batch, options.count - i);
+        struct timeval t0;
+        int rc;
+
+        for (j = 0; j < n; j++) {
+            mk_id(first + i + j, &ids[j]);
+            mk_attrs(first + i + j, &attrs[j], now);
+        }
+
+        gettimeofday(&t0, NULL);
+        if (batch == 1)
+            rc = ListMgr_Insert(lmgr, &ids[0], &attrs[0], false);
+        else
+            rc = ListMgr_BatchInsert(lmgr, p_ids, p_attrs, n, false);
+        stat_add(&st, &t0, n, rc);
+    }
+    stat_end(&st);
+
+    snprintf(what, sizeof(what), "insert (batch=%u)", batch);
+    stat_print(what, &st);
+
+    MemFree(p_attrs);
+    MemFree(p_ids);
+    MemFree(attrs);
+    MemFree(ids);
+}
+
+static void bench_get(lmgr_t *lmgr, unsigned int *seed)
+{
+    struct bench_stat st;
+    unsigned int i;
+
+    stat_start(&st);
+    for (i = 0; i < options.count; i++) {
+        entry_id_t id;
+        attr_set_t attrs = ATTR_SET_INIT;
+        struct timeval t0;
+        int rc;
+
+        mk_id(range_start(0) + rand_r(seed) % options.count, &id);
+        attrs.attr_mask.std = ATTR_MASK_size | ATTR_MASK_uid | ATTR_MASK_gid
+            | ATTR_MASK_last_mod | ATTR_MASK_type | ATTR_MASK_fullpath;
+
+        gettimeofday(&t0, NULL);
+        rc = ListMgr_Get(lmgr, &id, &attrs);
+        stat_add(&st, &t0, 1, rc);
+        ListMgr_FreeAttrs(&attrs);
+    }
+    stat_end(&st);
+    stat_print("get", &st);
+}
+
+static void bench_update(lmgr_t *lmgr, unsigned int *seed, time_t now)
+{
+    struct bench_stat st;
+    unsigned int i;
+
+    stat_start(&st);
+    for (i = 0; i < options.count; i++) {
+        entry_id_t id;
+        attr_set_t attrs = ATTR_SET_INIT;
+        struct timeval t0;
+        unsigned long long n;
+        int rc;
+
+        n = range_start(0) + rand_r(seed) % options.count;
+        mk_id(n, &id);
+        ATTR_MASK_SET(&attrs, size);
+        ATTR(&attrs, size) = (n % 1024) * 4096 + i;
+        ATTR_MASK_SET(&attrs, last_mod);
+        ATTR(&attrs, last_mod) = now;
+        ATTR_MASK_SET(&attrs, md_update);
+        ATTR(&attrs, md_update) = now;
+
+        gettimeofday(&t0, NULL);
+        rc = ListMgr_Update(lmgr, &id, &attrs);
+        stat_add(&st, &t0, 1, rc);
+    }
+    stat_end(&st);
+    stat_print("update", &st);
+}
+
+static void bench_getchild(lmgr_t *lmgr)
+{
+    struct bench_stat st;
+    unsigned long long first = range_start(0);
+    unsigned long long p;
+    attr_mask_t mask = { .std = ATTR_MASK_size | ATTR_MASK_type };
+    char name[] = "dir";
+
+    stat_start(&st);
+    for (p = PARENT_NUM(first); p <= PARENT_NUM(first + options.count - 1);
+         p++) {
+        wagon_t parent;
+        wagon_t *child = NULL;
+        attr_set_t *child_attrs = NULL;
+        unsigned int child_count = 0, i;
+        struct timeval t0;
+        int rc;
+
+        mk_id(p, &parent.id);
+        parent.fullname = name;
+
+        gettimeofday(&t0, NULL);
+        rc = ListMgr_GetChild(lmgr, NULL, &parent, 1, mask, &child,
+                              &child_attrs, &child_count);
+        stat_add(&st, &t0, child_count, rc);
+
+        for (i = 0; i < child_count; i++) {
+            free(child[i].fullname);
+            ListMgr_FreeAttrs(&child_attrs[i]);
+        }
+        MemFree(child);
+        MemFree(child_attrs);
+    }
+    stat_end(&st);
+    stat_print("getchild", &st);
+}
+
+static void bench_iterator(lmgr_t *lmgr)
+{
+    struct bench_stat st;
+    struct lmgr_iterator_t *it;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    entry_id_t id;
+    attr_set_t attrs;
+    struct timeval t0;
+    int rc;
+
+    opt.stream = 1;
+
+    stat_start(&st);
+    gettimeofday(&t0, NULL);
+    it = ListMgr_Iterator(lmgr, NULL, NULL, &opt);
+    if (it == NULL) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Error creating iterator");
+        return;
+    }
+    for (;;) {
+        ATTR_MASK_INIT(&attrs);
+        attrs.attr_mask.std = ATTR_MASK_size | ATTR_MASK_uid
+            | ATTR_MASK_last_mod | ATTR_MASK_type;
+
+        rc = ListMgr_GetNext(it, &id, &attrs);
+        if (rc == DB_END_OF_LIST)
+            break;
+        stat_add(&st, &t0, 1, rc);
+        if (rc)
+            break;
+        ListMgr_FreeAttrs(&attrs);
+        gettimeofday(&t0, NULL);
+    }
+    ListMgr_CloseIterator(it);
+    stat_end(&st);
+    stat_print("iterator (per entry)", &st);
+}
+
+/** report by user (as rbh-report --top-users) */
+static void bench_report(lmgr_t *lmgr, bool no_acct)
+{
+    report_field_descr_t fields[] = {
+        {ATTR_INDEX_uid, REPORT_GROUP_BY, SORT_NONE, false, 0, FV_NULL},
+        {ATTR_INDEX_FLG_COUNT, REPORT_COUNT, SORT_DESC, false, 0, FV_NULL},
+        {ATTR_INDEX_size, REPORT_SUM, SORT_NONE, false, 0, FV_NULL},
+    };
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    struct bench_stat st;
+    unsigned int r;
+
+    opt.force_no_acct = no_acct;
+
+    stat_start(&st);
+    for (r = 0; r < REPORT_RUNS; r++) {
+        struct lmgr_report_t *it;
+        db_value_t result[3];
+        unsigned int result_count, lines = 0;
+        struct timeval t0;
+        int rc;
+
+        gettimeofday(&t0, NULL);
+        it = ListMgr_Report(lmgr, fields, 3, NULL, NULL, &opt);
+        if (it == NULL) {
+            stat_add(&st, &t0, 0, -1);
+            continue;
+        }
+        do {
+            result_count = 3;
+            rc = ListMgr_GetNextReportItem(it, result, &result_count, NULL);
+            if (rc == DB_SUCCESS)
+                lines++;
+        } while (rc == DB_SUCCESS);
+        ListMgr_CloseReport(it);
+        stat_add(&st, &t0, lines, rc == DB_END_OF_LIST ? 0 : rc);
+    }
+    stat_end(&st);
+    stat_print(no_acct ? "report (no acct)" : "report", &st);
+}
+
+static void bench_remove(lmgr_t *lmgr, time_t now)
+{
+    struct bench_stat st;
+    unsigned int r, i;
+
+    stat_start(&st);
+    for (r = 0; r < options.batch_count; r++) {
+        for (i = 0; i < options.count; i++) {
+            entry_id_t id;
+            attr_set_t attrs;
+            struct timeval t0;
+            int rc;
+
+            mk_id(range_start(r) + i, &id);
+            mk_attrs(range_start(r) + i, &attrs, now);
+
+            gettimeofday(&t0, NULL);
+            rc = ListMgr_Remove(lmgr, &id, &attrs, true);
+            stat_add(&st, &t0, 1, rc);
+        }
+    }
+    stat_end(&st);
+    stat_print("remove", &st);
+}
+
+static int parse_batch_sizes(char *arg)
+{
+    char *tok, *saveptr = NULL;
+
+    options.batch_count = 0;
+    for (tok = strtok_r(arg, ",", &saveptr); tok != NULL;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        int val = str2int(tok);
+
+        if (val < 1 || options.batch_count >= MAX_BATCH_SIZES)
+            return -1;
+        options.batch_sizes[options.batch_count++] = val;
+    }
+    return options.batch_count > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    int            c, option_index = 0;
+    const char    *bin;
+    char           err_msg[4096];
+    char           badcfg[RBH_PATH_MAX];
+    bool           chgd = false;
+    int            rc;
+    unsigned int   i, seed;
+    lmgr_t         lmgr;
+    time_t         now;
+
+    bin = rh_basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
+                            &option_index)) != -1) {
+        switch (c) {
+        case 'n':
+            options.count = str2int(optarg);
+            if ((int)options.count < 1) {
+                fprintf(stderr, "Invalid argument for --count: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'b':
+            if (parse_batch_sizes(optarg)) {
+                fprintf(stderr, "Invalid argument for --batch-sizes "
+                        "(up to %u positive integers expected)\n",
+                        MAX_BATCH_SIZES);
+                exit(1);
+            }
+            break;
+        case 'S':
+            options.seed = str2int(optarg);
+            break;
+        case 'k':
+            options.cleanup = false;
+            break;
+        case 'f':
+            rh_strncpy(options.config_file, optarg, MAX_OPT_LEN);
+            break;
+        case 'l':
+        {
+            int log_level = str2debuglevel(optarg);
+
+            if (log_level == -1) {
+                fprintf(stderr,
+                        "Unsupported log level '%s'. CRIT, MAJOR, EVENT, VERB, DEBUG or FULL expected.\n",
+                        optarg);
+                exit(1);
+            }
+            force_debug_level(log_level);
+            break;
+        }
+        case 'h':
+            display_help(bin);
+            exit(0);
+            break;
+        case ':':
+        case '?':
+        default:
+            fprintf(stderr, "Run '%s --help' for more details.\n", bin);
+            exit(1);
+            break;
+        }
+    }
+
+    /* check there is no extra arguments */
+    if (optind != argc) {
+        fprintf(stderr, "Error: unexpected argument on command line: %s\n",
+                argv[optind]);
+        exit(1);
+    }
+
+    /* initialize internal resources (glib, llapi, internal resources...) */
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
+    /* get default config file, if not specified */
+    if (SearchConfig(options.config_file, options.config_file, &chgd,
+                     badcfg, MAX_OPT_LEN) != 0) {
+        fprintf(stderr, "No config file (or too many) found matching %s\n",
+                badcfg);
+        exit(2);
+    } else if (chgd) {
+        fprintf(stderr, "Using config file '%s'.\n", options.config_file);
+    }
+
+    if (rbh_cfg_load(0, options.config_file, err_msg)) {
+        fprintf(stderr, "Error reading configuration file '%s': %s\n",
+                options.config_file, err_msg);
+        exit(1);
+    }
+
+    if (!log_config.force_debug_level)
+        log_config.debug_level = LVL_MAJOR;
+
+    /* Set logging to stderr */
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
+
+    rc = InitializeLogs(bin);
+    if (rc) {
+        fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
+                rc, errno, strerror(errno));
+        exit(rc);
+    }
+
+    /* Initialize filesystem access */
+    rc = InitFS();
+    if (rc)
+        exit(rc);
+
+    rc = ListMgr_Init(0);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG,
+                   "Error initializing list manager: %s (%d)", lmgr_err2str(rc),
+                   rc);
+        exit(rc);
+    }
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Error %d: cannot connect to database",
+                   rc);
+        exit(rc);
+    }
+
+    printf("config: %s, %u entries per run\n", options.config_file,
+           options.count);
+    print_header();
+
+    seed = options.seed;
+    now = time(NULL);
+
+    for (i = 0; i < options.batch_count; i++)
+        bench_insert(&lmgr, options.batch_sizes[i], i, now);
+
+    bench_get(&lmgr, &seed);
+    bench_update(&lmgr, &seed, now);
+    bench_getchild(&lmgr);
+    bench_iterator(&lmgr);
+    bench_report(&lmgr, false);
+    bench_report(&lmgr, true);
+
+    if (options.cleanup)
+        bench_remove(&lmgr, now);
+
+    ListMgr_CloseAccess(&lmgr);
+    FlushLogs();
+    return 0;
+}
@@ -0,0 +1,487 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file   rbh_bench_pipeline.c
+ * \brief  Benchmark of the entry processor pipeline.
+ *
+ * Injects synthetic scan-like operations into the pipeline (no-op stages,
+ * or real standard/diff pipeline against a scratch database), then reports
+ * throughput, and per-stage latency and lock contention.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "cmd_helpers.h"
+#include "rbh_basename.h"
+#include "status_manager.h"
+#include "entry_processor.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_TAG   "Bench"
+
+/* number of recently generated ids to pick collisions from */
+#define RECENT_WINDOW   64
+/* number of entries per parent directory */
+#define ENTRIES_PER_DIR 1000
+
+static struct option option_tab[] = {
+    /* benchmark options */
+    {"pipeline", required_argument, NULL, 'p'},
+    {"stages", required_argument, NULL, 's'},
+    {"count", required_argument, NULL, 'n'},
+    {"distrib", required_argument, NULL, 'd'},
+    {"range", required_argument, NULL, 'r'},
+    {"id-collisions", required_argument, NULL, 'c'},
+    {"name-collisions", required_argument, NULL, 'N'},
+    {"seed", required_argument, NULL, 'S'},
+
+    /* config file options */
+    {"config-file", required_argument, NULL, 'f'},
+
+    /* log options */
+    {"log-level", required_argument, NULL, 'l'},
+
+    /* miscellaneous options */
+    {"help", no_argument, NULL, 'h'},
+
+    {NULL, 0, NULL, 0}
+};
+
+#define SHORT_OPT_STRING    "p:s:n:d:r:c:N:S:f:l:h"
+
+#define MAX_OPT_LEN 1024
+
+typedef enum {
+    DISTRIB_SEQ,        /* each op has a new id */
+    DISTRIB_UNIFORM,    /* ids are uniformly distributed in a range */
+} id_distrib_e;
+
+static struct bench_options {
+    pipeline_flavor_e flavor;
+    int             stages;
+    unsigned int    count;
+    id_distrib_e    distrib;
+    unsigned long long range;
+    double          id_collisions;    /* ratio of ops reusing a recent id */
+    double          name_collisions;  /* ratio of ops reusing a recent name */
+    unsigned int    seed;
+    char            config_file[MAX_OPT_LEN];
+} options = {
+    .flavor = BENCH_PIPELINE,
+    .stages = 3,
+    .count = 1000000,
+    .distrib = DISTRIB_SEQ,
+    .range = 1000000,
+    .id_collisions = 0.0,
+    .name_collisions = 0.0,
+    .seed = 1,
+    .config_file = "",
+};
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [options]\n"
+    "\n"
+    _B "Benchmark options:" B_ "\n"
+    "    " _B "-p" B_ " " _U "pipeline" U_ ", " _B "--pipeline=" B_ _U "pipeline" U_ "\n"
+    "        Pipeline to be run: noop (default), std or diff.\n"
+    "        std and diff pipelines update the database: use a scratch one!\n"
+    "    " _B "-s" B_ " " _U "count" U_ ", " _B "--stages=" B_ _U "count" U_ "\n"
+    "        Number of stages of the noop pipeline (default: 3).\n"
+    "    " _B "-n" B_ " " _U "count" U_ ", " _B "--count=" B_ _U "count" U_ "\n"
+    "        Number of operations to be injected (default: 1000000).\n"
+    "    " _B "-d" B_ " " _U "distrib" U_ ", " _B "--distrib=" B_ _U "distrib" U_ "\n"
+    "        Distribution of entry ids: seq (default) or uniform.\n"
+    "    " _B "-r" B_ " " _U "range" U_ ", " _B "--range=" B_ _U "range" U_ "\n"
+    "        Number of distinct ids for uniform distribution (default: 1000000).\n"
+    "    " _B "-c" B_ " " _U "ratio" U_ ", " _B "--id-collisions=" B_ _U "ratio" U_ "\n"
+    "        Ratio of operations reusing a recent entry id (0.0 to 1.0).\n"
+    "    " _B "-N" B_ " " _U "ratio" U_ ", " _B "--name-collisions=" B_ _U "ratio" U_ "\n"
+    "        Ratio of operations reusing a recent parent/name (0.0 to 1.0).\n"
+    "    " _B "-S" B_ " " _U "seed" U_ ", " _B "--seed=" B_ _U "seed" U_ "\n"
+    "        Seed of the pseudo-random generator.\n"
+    "\n"
+    _B "Config file options:" B_ "\n"
+    "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
+    "        Path to configuration file (or short name).\n"
+    "\n"
+    _B "Miscellaneous options:" B_ "\n"
+    "    " _B "-l" B_ " " _U "level" U_ ", " _B "--log-level=" B_ _U "level" U_ "\n"
+    "        Force the log verbosity level (overides configuration value).\n"
+    "        Allowed values: CRIT, MAJOR, EVENT, VERB, DEBUG, FULL.\n"
+    "    " _B "-h" B_ ", " _B "--help" B_ "\n"
+    "        Display a short help about command line options.\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name);
+}
+
+/** build a synthetic entry id from a number */
+static void mk_id(unsigned long long n, entry_id_t *id)
+{
+    memset(id, 0, sizeof(*id));
+#ifdef _HAVE_FID
+    /* use a sequence that is not used by real entries */
+    id->f_seq = 0x2FFF00000ULL + (n >> 32);
+    id->f_oid = (uint32_t)n;
+    id->f_ver = 0;
+#else
+    id->inode = n;
+    id->fs_key = get_fskey();
+    id->validator = 1;
+#endif
+}
+
+/** pick the number of the entry id for the next operation */
+static unsigned long long next_id(unsigned int i, const unsigned long long *recent,
+                                  unsigned int *seed)
+{
+    if (i > 0 && options.id_collisions > 0.0
+        && rand_r(seed) < options.id_collisions * RAND_MAX)
+        return recent[rand_r(seed) % MIN2(i, RECENT_WINDOW)];
+
+    if (options.distrib == DISTRIB_UNIFORM)
+        return 1 + ((unsigned long long)rand_r(seed) * RAND_MAX
+                    + rand_r(seed)) % options.range;
+
+    return i + 1;
+}
+
+/** fill a synthetic scan operation for the given entry */
+static void fill_op(entry_proc_op_t *op, unsigned long long n,
+                    unsigned long long name_n, time_t now)
+{
+    struct stat st;
+    entry_id_t parent;
+
+    op->pipeline_stage = entry_proc_descr.GET_INFO_DB;
+    ATTR_MASK_INIT(&op->fs_attrs);
+
+    mk_id(n, &op->entry_id);
+    op->entry_id_is_set = 1;
+
+    /* parent ids are put in a different range than entries */
+    mk_id((1ULL << 48) + name_n / ENTRIES_PER_DIR, &parent);
+    ATTR_MASK_SET(&op->fs_attrs, parent_id);
+    ATTR(&op->fs_attrs, parent_id) = parent;
+
+    ATTR_MASK_SET(&op->fs_attrs, name);
+    sprintf(ATTR(&op->fs_attrs, name), "file.%llu", name_n);
+
+    ATTR_MASK_SET(&op->fs_attrs, fullpath);
+    sprintf(ATTR(&op->fs_attrs, fullpath), "%s/bench/dir.%llu/file.%llu",
+            global_config.fs_path, name_n / ENTRIES_PER_DIR, name_n);
+
+    ATTR_MASK_SET(&op->fs_attrs, depth);
+    ATTR(&op->fs_attrs, depth) = 2;
+
+    /* generate cyclic owner, group, size, times... */
+    memset(&st, 0, sizeof(st));
+    st.st_ino = n;
+    st.st_mode = S_IFREG | 0644;
+    st.st_nlink = 1;
+    st.st_uid = n % 137;
+    st.st_gid = (n % 137) / 8;
+    st.st_size = (n % 1024) * 4096;
+    st.st_blocks = st.st_size / 512;
+    st.st_atime = now - (n % 86400);
+    st.st_mtime = st.st_atime;
+    st.st_ctime = st.st_atime;
+    stat2rbh_attrs(&st, &op->fs_attrs, true);
+
+    ATTR_MASK_SET(&op->fs_attrs, md_update);
+    ATTR(&op->fs_attrs, md_update) = now;
+    ATTR_MASK_SET(&op->fs_attrs, path_update);
+    ATTR(&op->fs_attrs, path_update) = now;
+}
+
+static int parse_ratio(const char *arg, double *ratio)
+{
+    char *end;
+
+    *ratio = strtod(arg, &end);
+    if (*end != '\0' || *ratio < 0.0 || *ratio > 1.0)
+        return -1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int            c, option_index = 0;
+    const char    *bin;
+    char           err_msg[4096];
+    char           badcfg[RBH_PATH_MAX];
+    bool           chgd = false;
+    int            rc;
+    unsigned int   i, seed;
+    unsigned long long recent[RECENT_WINDOW];
+    unsigned long long recent_names[RECENT_WINDOW];
+    attr_mask_t    diff_mask = null_mask;
+    diff_arg_t     diff_arg;
+    void          *arg;
+    struct timeval start, end, diff;
+    double         elapsed;
+    time_t         now;
+
+    bin = rh_basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
+                            &option_index)) != -1) {
+        switch (c) {
+        case 'p':
+            if (!strcasecmp(optarg, "noop"))
+                options.flavor = BENCH_PIPELINE;
+            else if (!strcasecmp(optarg, "std"))
+                options.flavor = STD_PIPELINE;
+            else if (!strcasecmp(optarg, "diff"))
+                options.flavor = DIFF_PIPELINE;
+            else {
+                fprintf(stderr, "Invalid argument for --pipeline: '%s' "
+                        "(noop, std or diff expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            options.stages = str2int(optarg);
+            if (options.stages < 1) {
+                fprintf(stderr, "Invalid argument for --stages: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            options.count = str2int(optarg);
+            if ((int)options.count < 1) {
+                fprintf(stderr, "Invalid argument for --count: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            if (!strcasecmp(optarg, "seq"))
+                options.distrib = DISTRIB_SEQ;
+            else if (!strcasecmp(optarg, "uniform"))
+                options.distrib = DISTRIB_UNIFORM;
+            else {
+                fprintf(stderr, "Invalid argument for --distrib: '%s' "
+                        "(seq or uniform expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            options.range = str2bigint(optarg);
+            if ((long long)options.range < 1) {
+                fprintf(stderr, "Invalid argument for --range: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            if (parse_ratio(optarg, &options.id_collisions)) {
+                fprintf(stderr, "Invalid argument for --id-collisions: '%s' "
+                        "(0.0 to 1.0 expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'N':
+            if (parse_ratio(optarg, &options.name_collisions)) {
+                fprintf(stderr, "Invalid argument for --name-collisions: '%s' "
+                        "(0.0 to 1.0 expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'S':
+            options.seed = str2int(optarg);
+            break;
+        case 'f':
+            rh_strncpy(options.config_file, optarg, MAX_OPT_LEN);
+            break;
+        case 'l':
+        {
+            int log_level = str2debuglevel(optarg);
+
+            if (log_level == -1) {
+                fprintf(stderr,
+                        "Unsupported log level '%s'. CRIT, MAJOR, EVENT, VERB, DEBUG or FULL expected.\n",
+                        optarg);
+                exit(1);
+            }
+            force_debug_level(log_level);
+            break;
+        }
+        case 'h':
+            display_help(bin);
+            exit(0);
+            break;
+        case ':':
+        case '?':
+        default:
+            fprintf(stderr, "Run '%s --help' for more details.\n", bin);
+            exit(1);
+            break;
+        }
+    }
+
+    /* check there is no extra arguments */
+    if (optind != argc) {
+        fprintf(stderr, "Error: unexpected argument on command line: %s\n",
+                argv[optind]);
+        exit(1);
+    }
+
+    /* initialize internal resources (glib, llapi, internal resources...) */
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
+    /* get default config file, if not specified */
+    if (SearchConfig(options.config_file, options.config_file, &chgd,
+                     badcfg, MAX_OPT_LEN) != 0) {
+        fprintf(stderr, "No config file (or too many) found matching %s\n",
+                badcfg);
+        exit(2);
+    } else if (chgd) {
+        fprintf(stderr, "Using config file '%s'.\n", options.config_file);
+    }
+
+    if (rbh_cfg_load(MODULE_MASK_FS_SCAN | MODULE_MASK_ENTRY_PROCESSOR,
+                     options.config_file, err_msg)) {
+        fprintf(stderr, "Error reading configuration file '%s': %s\n",
+                options.config_file, err_msg);
+        exit(1);
+    }
+
+    /* stats are displayed at MAJOR level */
+    if (!log_config.force_debug_level)
+        log_config.debug_level = LVL_MAJOR;
+
+    /* Set logging to stderr */
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
+
+    rc = InitializeLogs(bin);
+    if (rc) {
+        fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
+                rc, errno, strerror(errno));
+        exit(rc);
+    }
+
+    /* Initialize filesystem access */
+    rc = InitFS();
+    if (rc)
+        exit(rc);
+
+    /* Initialize status managers */
+    rc = smi_init_all(RUNFLG_ONCE);
+    if (rc)
+        exit(rc);
+
+    /* Initialize list manager (all pipeline workers connect to the DB) */
+    rc = ListMgr_Init(0);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG,
+                   "Error initializing list manager: %s (%d)", lmgr_err2str(rc),
+                   rc);
+        exit(rc);
+    }
+
+    switch (options.flavor) {
+    case BENCH_PIPELINE:
+        arg = &options.stages;
+        break;
+    case DIFF_PIPELINE:
+        memset(&diff_arg, 0, sizeof(diff_arg));
+        diff_arg.apply = APPLY_DB;
+        {
+            char tmpstr[] = "all";
+
+            if (parse_diff_mask(tmpstr, &diff_arg.diff_mask, err_msg)) {
+                DisplayLog(LVL_CRIT, BENCH_TAG,
+                           "unexpected error parsing diff mask: %s", err_msg);
+                exit(1);
+            }
+        }
+        diff_arg.diff_mask = translate_all_status_mask(diff_arg.diff_mask);
+        arg = &diff_arg;
+        break;
+    case STD_PIPELINE:
+    default:
+        arg = &diff_mask;
+        break;
+    }
+
+    rc = EntryProcessor_Init(options.flavor, RUNFLG_ONCE, arg);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG,
+                   "Error %d initializing EntryProcessor pipeline", rc);
+        exit(rc);
+    }
+
+    seed = options.seed;
+    now = time(NULL);
+    gettimeofday(&start, NULL);
+
+    for (i = 0; i < options.count; i++) {
+        entry_proc_op_t *op;
+        unsigned long long n, name_n;
+
+        n = next_id(i, recent, &seed);
+
+        /* reuse the name of a recent operation (with a different id) */
+        if (i > 0 && options.name_collisions > 0.0
+            && rand_r(&seed) < options.name_collisions * RAND_MAX)
+            name_n = recent_names[rand_r(&seed) % MIN2(i, RECENT_WINDOW)];
+        else
+            name_n = n;
+
+        recent[i % RECENT_WINDOW] = n;
+        recent_names[i % RECENT_WINDOW] = name_n;
+
+        op = EntryProcessor_Get();
+        if (!op) {
+            DisplayLog(LVL_CRIT, BENCH_TAG,
+                       "CRITICAL ERROR: EntryProcessor_Get failed to allocate a new op");
+            exit(1);
+        }
+        fill_op(op, n, name_n, now);
+        EntryProcessor_Push(op);
+    }
+
+    /* wait for all operations to be processed (dumps stage stats) */
+    EntryProcessor_Terminate(true);
+
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &diff);
+    elapsed = diff.tv_sec + 1E-6 * diff.tv_usec;
+
+    printf("pipeline=%s, operations=%u, elapsed=%.3fs, throughput=%.1f ops/s\n",
+           options.flavor == BENCH_PIPELINE ? "noop" :
+           options.flavor == DIFF_PIPELINE ? "diff" : "std",
+           options.count, elapsed, elapsed > 0.0 ? options.count / elapsed : 0.0);
+
+    FlushLogs();
+    return 0;
+}
@@ -0,0 +1,694 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file   rbh_bench_policy.c
+ * \brief  Benchmark of policy matching.
+ *
+ * Loads the fileclasses and policies of a configuration file, and matches
+ * them against sample entries (synthetic, or read from the database).
+ * Reports the matching speed of match_classes() and policy_match_all(),
+ * of each fileclass and rule, and lists the most expensive conditions.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "cmd_helpers.h"
+#include "rbh_basename.h"
+#include "policy_rules.h"
+#include "Memory.h"
+#include "status_manager.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_TAG   "Bench"
+
+static struct option option_tab[] = {
+    /* benchmark options */
+    {"count", required_argument, NULL, 'n'},
+    {"loops", required_argument, NULL, 'L'},
+    {"from-db", no_argument, NULL, 'D'},
+    {"policy", required_argument, NULL, 'p'},
+    {"top", required_argument, NULL, 't'},
+    {"seed", required_argument, NULL, 'S'},
+
+    /* config file options */
+    {"config-file", required_argument, NULL, 'f'},
+
+    /* log options */
+    {"log-level", required_argument, NULL, 'l'},
+
+    /* miscellaneous options */
+    {"help", no_argument, NULL, 'h'},
+
+    {NULL, 0, NULL, 0}
+};
+
+#define SHORT_OPT_STRING    "n:L:Dp:t:S:f:l:h"
+
+#define MAX_OPT_LEN 1024
+
+static struct bench_options {
+    unsigned int    count;
+    unsigned int    loops;
+    bool            from_db;
+    const char     *policy;
+    unsigned int    top;
+    unsigned int    seed;
+    char            config_file[MAX_OPT_LEN];
+} options = {
+    .count = 100000,
+    .loops = 1,
+    .from_db = false,
+    .policy = NULL,
+    .top = 10,
+    .seed = 1,
+    .config_file = "",
+};
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [options]\n"
+    "\n"
+    _B "Benchmark options:" B_ "\n"
+    "    " _B "-n" B_ " " _U "count" U_ ", " _B "--count=" B_ _U "count" U_ "\n"
+    "        Number of sample entries (default: 100000).\n"
+    "    " _B "-D" B_ ", " _B "--from-db" B_ "\n"
+    "        Read sample entries from the database, instead of generating\n"
+    "        synthetic ones.\n"
+    "    " _B "-L" B_ " " _U "count" U_ ", " _B "--loops=" B_ _U "count" U_ "\n"
+    "        Number of times each measurement is run on all samples (default: 1).\n"
+    "    " _B "-p" B_ " " _U "policy" U_ ", " _B "--policy=" B_ _U "policy" U_ "\n"
+    "        Only benchmark the given policy (default: all).\n"
+    "    " _B "-t" B_ " " _U "count" U_ ", " _B "--top=" B_ _U "count" U_ "\n"
+    "        Number of most expensive conditions to be displayed (default: 10).\n"
+    "    " _B "-S" B_ " " _U "seed" U_ ", " _B "--seed=" B_ _U "seed" U_ "\n"
+    "        Seed of the pseudo-random generator.\n"
+    "\n"
+    _B "Config file options:" B_ "\n"
+    "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
+    "        Path to configuration file (or short name).\n"
+    "\n"
+    _B "Miscellaneous options:" B_ "\n"
+    "    " _B "-l" B_ " " _U "level" U_ ", " _B "--log-level=" B_ _U "level" U_ "\n"
+    "        Force the log verbosity level (overides configuration value).\n"
+    "        Allowed values: CRIT, MAJOR, EVENT, VERB, DEBUG, FULL.\n"
+    "    " _B "-h" B_ ", " _B "--help" B_ "\n"
+    "        Display a short help about command line options.\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name);
+}
+
+/** sample entries */
+static entry_id_t *sample_ids;
+static attr_set_t *sample_attrs;
+static unsigned int sample_count;
+
+/** a condition of the configuration */
+struct bench_cond {
+    char                 origin[256];
+    bool_node_t          node;      /**< the condition alone */
+    const sm_instance_t *smi;
+    double               elapsed;
+    unsigned long long   matches;
+};
+
+static struct bench_cond *conds;
+static unsigned int cond_count;
+static unsigned int cond_alloc;
+
+/** result of a measurement */
+struct bench_result {
+    double              elapsed;
+    unsigned long long  matches;
+    unsigned long long  missing;
+};
+
+static double tv2sec(const struct timeval *tv)
+{
+    return tv->tv_sec + 1E-6 * tv->tv_usec;
+}
+
+static double elapsed_since(const struct timeval *start)
+{
+    struct timeval end, diff;
+
+    gettimeofday(&end, NULL);
+    timersub(&end, start, &diff);
+    return tv2sec(&diff);
+}
+
+static void count_result(policy_match_t rc, struct bench_result *res)
+{
+    if (rc == POLICY_MATCH)
+        res->matches++;
+    else if (rc == POLICY_MISSING_ATTR)
+        res->missing++;
+}
+
+/* file extensions and path components of synthetic entries */
+static const char *extensions[] = { "dat", "log", "tmp", "h5", "nc", "txt",
+                                    "o", "bak", "gz", "core" };
+#define EXT_COUNT   (sizeof(extensions) / sizeof(*extensions))
+
+/** build a synthetic entry */
+static void mk_sample(unsigned int n, entry_id_t *id, attr_set_t *attrs,
+                      time_t now, unsigned int *seed)
+{
+    struct stat st;
+    unsigned int r = rand_r(seed);
+
+    memset(id, 0, sizeof(*id));
+#ifdef _HAVE_FID
+    id->f_seq = 0x2FFF00000ULL;
+    id->f_oid = n + 1;
+#else
+    id->inode = n + 1;
+    id->fs_key = get_fskey();
+    id->validator = 1;
+#endif
+
+    memset(&st, 0, sizeof(st));
+    st.st_ino = n + 1;
+    /* 90% files, 8% directories, 2% symlinks */
+    if (r % 100 < 90)
+        st.st_mode = S_IFREG | 0644;
+    else if (r % 100 < 98)
+        st.st_mode = S_IFDIR | 0755;
+    else
+        st.st_mode = S_IFLNK | 0777;
+    st.st_nlink = 1;
+    st.st_uid = rand_r(seed) % 64;
+    st.st_gid = st.st_uid / 8;
+    /* sizes from a few bytes to a few GB */
+    st.st_size = (1LL << (rand_r(seed) % 32)) + rand_r(seed) % 4096;
+    st.st_blocks = st.st_size / 512;
+    /* times over the last year */
+    st.st_mtime = now - rand_r(seed) % (365 * 86400);
+    st.st_atime = st.st_mtime + rand_r(seed) % (now - st.st_mtime + 1);
+    st.st_ctime = st.st_mtime;
+    stat2rbh_attrs(&st, attrs, true);
+
+    ATTR_MASK_SET(attrs, fullpath);
+    snprintf(ATTR(attrs, fullpath), sizeof(ATTR(attrs, fullpath)),
+             "%s/proj%u/user%u/run%u/file%u.%s", global_config.fs_path,
+             r % 16, st.st_uid, rand_r(seed) % 100, n,
+             extensions[rand_r(seed) % EXT_COUNT]);
+
+    ATTR_MASK_SET(attrs, name);
+    rh_strncpy(ATTR(attrs, name), strrchr(ATTR(attrs, fullpath), '/') + 1,
+               sizeof(ATTR(attrs, name)));
+
+    ATTR_MASK_SET(attrs, depth);
+    ATTR(attrs, depth) = 4;
+
+    ATTR_MASK_SET(attrs, md_update);
+    ATTR(attrs, md_update) = now;
+    ATTR_MASK_SET(attrs, path_update);
+    ATTR(attrs, path_update) = now;
+}
+
+/** attributes needed to match fileclasses and policies */
+static attr_mask_t bench_attr_mask(void)
+{
+    attr_mask_t mask = policies.global_fileset_mask;
+    int i;
+
+    mask.std |= ATTR_MASK_fullpath | ATTR_MASK_name | ATTR_MASK_type;
+
+    for (i = 0; i < policies.policy_count; i++) {
+        mask = attr_mask_or(&mask, &policies.policy_list[i].scope_mask);
+        mask = attr_mask_or(&mask,
+                            &policies.policy_list[i].rules.run_attr_mask);
+    }
+    return mask;
+}
+
+static int load_samples_db(void)
+{
+    lmgr_t lmgr;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    struct lmgr_iterator_t *it;
+    attr_mask_t mask = bench_attr_mask();
+    int rc;
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Error %d: cannot connect to database",
+                   rc);
+        return rc;
+    }
+
+    opt.list_count_max = options.count;
+    opt.allow_no_attr = 1;
+    it = ListMgr_Iterator(&lmgr, NULL, NULL, &opt);
+    if (it == NULL) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Error retrieving entries from DB");
+        ListMgr_CloseAccess(&lmgr);
+        return -1;
+    }
+
+    sample_count = 0;
+    sample_attrs[0].attr_mask = mask;
+    while (sample_count < options.count
+           && ListMgr_GetNext(it, &sample_ids[sample_count],
+                              &sample_attrs[sample_count]) == DB_SUCCESS) {
+        sample_count++;
+        if (sample_count < options.count)
+            sample_attrs[sample_count].attr_mask = mask;
+    }
+
+    ListMgr_CloseIterator(it);
+    ListMgr_CloseAccess(&lmgr);
+    return 0;
+}
+
+static void add_cond(const char *origin, compare_triplet_t *cond,
+                     const sm_instance_t *smi)
+{
+    struct bench_cond *c;
+
+    if (cond_count == cond_alloc) {
+        cond_alloc = cond_alloc ? 2 * cond_alloc : 64;
+        conds = MemRealloc(conds, cond_alloc * sizeof(*conds));
+        if (!conds) {
+            DisplayLog(LVL_CRIT, BENCH_TAG, "Cannot allocate memory");
+            exit(ENOMEM);
+        }
+    }
+    c = &conds[cond_count++];
+    memset(c, 0, sizeof(*c));
+    rh_strncpy(c->origin, origin, sizeof(c->origin));
+    c->node.node_type = NODE_CONDITION;
+    c->node.content_u.condition = cond;
+    c->smi = smi;
+}
+
+/** register all conditions of a boolean expression */
+static void add_expr_conds(const char *origin, const bool_node_t *node,
+                           const sm_instance_t *smi)
+{
+    switch (node->node_type) {
+    case NODE_CONDITION:
+        add_cond(origin, node->content_u.condition, smi);
+        break;
+    case NODE_UNARY_EXPR:
+        add_expr_conds(origin, node->content_u.bool_expr.expr1, smi);
+        break;
+    case NODE_BINARY_EXPR:
+        add_expr_conds(origin, node->content_u.bool_expr.expr1, smi);
+        add_expr_conds(origin, node->content_u.bool_expr.expr2, smi);
+        break;
+    case NODE_CONSTANT:
+        break;
+    }
+}
+
+/** match all samples against an expression */
+static void bench_expr(const bool_node_t *expr, const bool_prog_t *prog,
+                       const sm_instance_t *smi, struct bench_result *res)
+{
+    struct timeval start;
+    unsigned int l, i;
+
+    memset(res, 0, sizeof(*res));
+    gettimeofday(&start, NULL);
+    for (l = 0; l < options.loops; l++)
+        for (i = 0; i < sample_count; i++)
+            count_result(entry_matches_compiled(&sample_ids[i],
+                                                &sample_attrs[i], expr, prog,
+                                                NULL, smi), res);
+    res->elapsed = elapsed_since(&start);
+}
+
+static void print_result(const char *what, const struct bench_result *res)
+{
+    double evals = (double)sample_count * options.loops;
+
+    printf("    %-32s %12.0f /s %9.1f ns %6.2f%% match", what,
+           res->elapsed > 0.0 ? evals / res->elapsed : 0.0,
+           evals > 0.0 ? 1E9 * res->elapsed / evals : 0.0,
+           evals > 0.0 ? 100.0 * res->matches / evals : 0.0);
+    if (res->missing)
+        printf(" (%llu missing attr)", res->missing);
+    printf("\n");
+}
+
+static void bench_fileclasses(void)
+{
+    struct bench_result res;
+    struct timeval start;
+    unsigned int l, i;
+
+    printf("\nFileclasses (%u):\n", policies.fileset_count);
+
+    /* all fileclasses, as matched by the pipeline (no cached class) */
+    memset(&res, 0, sizeof(res));
+    gettimeofday(&start, NULL);
+    for (l = 0; l < options.loops; l++) {
+        for (i = 0; i < sample_count; i++) {
+            attr_set_t attrs = sample_attrs[i];
+
+            match_classes(&sample_ids[i], &attrs, NULL);
+            if (ATTR_MASK_TEST(&attrs, fileclass)
+                && !EMPTY_STRING(ATTR(&attrs, fileclass)))
+                res.matches++;
+        }
+    }
+    res.elapsed = elapsed_since(&start);
+    print_result("match_classes()", &res);
+
+    for (i = 0; i < policies.fileset_count; i++) {
+        fileset_item_t *fset = &policies.fileset_list[i];
+        char origin[256];
+
+        if (!fset->matchable)
+            continue;
+
+        bench_expr(&fset->definition, fset->prog, NULL, &res);
+        print_result(fset->fileset_id, &res);
+
+        snprintf(origin, sizeof(origin), "fileclass %s", fset->fileset_id);
+        add_expr_conds(origin, &fset->definition, NULL);
+    }
+}
+
+static void bench_policy(const policy_descr_t *pol)
+{
+    struct bench_result res;
+    struct timeval start;
+    unsigned int l, i;
+    char origin[256];
+
+    printf("\nPolicy '%s' (%u rules):\n", pol->name, pol->rules.rule_count);
+
+    memset(&res, 0, sizeof(res));
+    gettimeofday(&start, NULL);
+    for (l = 0; l < options.loops; l++)
+        for (i = 0; i < sample_count; i++)
+            count_result(match_scope(pol, &sample_ids[i], &sample_attrs[i],
+                                     false), &res);
+    res.elapsed = elapsed_since(&start);
+    print_result("scope", &res);
+    snprintf(origin, sizeof(origin), "policy %s scope", pol->name);
+    add_expr_conds(origin, &pol->scope, pol->status_mgr);
+
+    memset(&res, 0, sizeof(res));
+    gettimeofday(&start, NULL);
+    for (l = 0; l < options.loops; l++) {
+        for (i = 0; i < sample_count; i++) {
+            fileset_item_t *fset = NULL;
+
+            count_result(policy_match_all(pol, &sample_ids[i],
+                                          &sample_attrs[i], NULL, &fset),
+                         &res);
+        }
+    }
+    res.elapsed = elapsed_since(&start);
+    print_result("policy_match_all()", &res);
+
+    for (i = 0; i < pol->rules.whitelist_count; i++) {
+        whitelist_item_t *wl = &pol->rules.whitelist_rules[i];
+        char what[64];
+
+        snprintf(what, sizeof(what), "ignore #%u", i);
+        bench_expr(&wl->bool_expr, wl->prog, pol->status_mgr, &res);
+        print_result(what, &res);
+
+        snprintf(origin, sizeof(origin), "policy %s ignore #%u", pol->name, i);
+        add_expr_conds(origin, &wl->bool_expr, pol->status_mgr);
+    }
+
+    for (i = 0; i < pol->rules.rule_count; i++) {
+        rule_item_t *rule = &pol->rules.rules[i];
+        char what[RULE_ID_LEN + 8];
+
+        snprintf(what, sizeof(what), "rule %s", rule->rule_id);
+        bench_expr(&rule->condition, rule->prog, pol->status_mgr, &res);
+        print_result(what, &res);
+
+        snprintf(origin, sizeof(origin), "policy %s rule %s", pol->name,
+                 rule->rule_id);
+        add_expr_conds(origin, &rule->condition, pol->status_mgr);
+    }
+}
+
+static int cmp_cond_cost(const void *a, const void *b)
+{
+    const struct bench_cond *c1 = a;
+    const struct bench_cond *c2 = b;
+
+    if (c1->elapsed > c2->elapsed)
+        return -1;
+    if (c1->elapsed < c2->elapsed)
+        return 1;
+    return 0;
+}
+
+/** evaluate each condition alone, and display the most expensive ones */
+static void bench_conditions(void)
+{
+    double evals = (double)sample_count * options.loops;
+    unsigned int c, l, i;
+
+    for (c = 0; c < cond_count; c++) {
+        struct timeval start;
+
+        gettimeofday(&start, NULL);
+        for (l = 0; l < options.loops; l++)
+            for (i = 0; i < sample_count; i++)
+                if (entry_matches_compiled(&sample_ids[i], &sample_attrs[i],
+                                           &conds[c].node, NULL, NULL,
+                                           conds[c].smi) == POLICY_MATCH)
+                    conds[c].matches++;
+        conds[c].elapsed = elapsed_since(&start);
+    }
+
+    qsort(conds, cond_count, sizeof(*conds), cmp_cond_cost);
+
+    printf("\nMost expensive conditions (%u of %u):\n",
+           MIN2(options.top, cond_count), cond_count);
+    for (c = 0; c < cond_count && c < options.top; c++) {
+        char str[1024];
+
+        if (BoolExpr2str(&conds[c].node, str, sizeof(str)) < 0)
+            strcpy(str, "?");
+        printf("    %9.1f ns %6.2f%% match  %-40s (%s)\n",
+               evals > 0.0 ? 1E9 * conds[c].elapsed / evals : 0.0,
+               evals > 0.0 ? 100.0 * conds[c].matches / evals : 0.0,
+               str, conds[c].origin);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int            c, option_index = 0;
+    const char    *bin;
+    char           err_msg[4096];
+    char           badcfg[RBH_PATH_MAX];
+    bool           chgd = false;
+    int            rc, i;
+    unsigned int   seed;
+    time_t         now;
+
+    bin = rh_basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
+                            &option_index)) != -1) {
+        switch (c) {
+        case 'n':
+            options.count = str2int(optarg);
+            if ((int)options.count < 1) {
+                fprintf(stderr, "Invalid argument for --count: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'L':
+            options.loops = str2int(optarg);
+            if ((int)options.loops < 1) {
+                fprintf(stderr, "Invalid argument for --loops: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'D':
+            options.from_db = true;
+            break;
+        case 'p':
+            options.policy = optarg;
+            break;
+        case 't':
+            options.top = str2int(optarg);
+            if ((int)options.top < 0) {
+                fprintf(stderr, "Invalid argument for --top: '%s' "
+                        "(integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'S':
+            options.seed = str2int(optarg);
+            break;
+        case 'f':
+            rh_strncpy(options.config_file, optarg, MAX_OPT_LEN);
+            break;
+        case 'l':
+        {
+            int log_level = str2debuglevel(optarg);
+
+            if (log_level == -1) {
+                fprintf(stderr,
+                        "Unsupported log level '%s'. CRIT, MAJOR, EVENT, VERB, DEBUG or FULL expected.\n",
+                        optarg);
+                exit(1);
+            }
+            force_debug_level(log_level);
+            break;
+        }
+        case 'h':
+            display_help(bin);
+            exit(0);
+            break;
+        case ':':
+        case '?':
+        default:
+            fprintf(stderr, "Run '%s --help' for more details.\n", bin);
+            exit(1);
+            break;
+        }
+    }
+
+    /* check there is no extra arguments */
+    if (optind != argc) {
+        fprintf(stderr, "Error: unexpected argument on command line: %s\n",
+                argv[optind]);
+        exit(1);
+    }
+
+    /* initialize internal resources (glib, llapi, internal resources...) */
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
+    /* get default config file, if not specified */
+    if (SearchConfig(options.config_file, options.config_file, &chgd,
+                     badcfg, MAX_OPT_LEN) != 0) {
+        fprintf(stderr, "No config file (or too many) found matching %s\n",
+                badcfg);
+        exit(2);
+    } else if (chgd) {
+        fprintf(stderr, "Using config file '%s'.\n", options.config_file);
+    }
+
+    /* policies are always loaded */
+    if (rbh_cfg_load(0, options.config_file, err_msg)) {
+        fprintf(stderr, "Error reading configuration file '%s': %s\n",
+                options.config_file, err_msg);
+        exit(1);
+    }
+
+    if (!log_config.force_debug_level)
+        log_config.debug_level = LVL_MAJOR;
+
+    /* Set logging to stderr */
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
+
+    rc = InitializeLogs(bin);
+    if (rc) {
+        fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
+                rc, errno, strerror(errno));
+        exit(rc);
+    }
+
+    if (options.policy != NULL && !policy_exists(options.policy, &i)) {
+        fprintf(stderr, "Error: no policy '%s' in configuration\n",
+                options.policy);
+        exit(EINVAL);
+    }
+
+    /* Initialize status managers (for status conditions) */
+    rc = smi_init_all(RUNFLG_ONCE);
+    if (rc)
+        exit(rc);
+
+    sample_ids = MemCalloc(options.count, sizeof(entry_id_t));
+    sample_attrs = MemCalloc(options.count, sizeof(attr_set_t));
+    if (!sample_ids || !sample_attrs) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Cannot allocate %u samples",
+                   options.count);
+        exit(ENOMEM);
+    }
+
+    now = time(NULL);
+    if (options.from_db) {
+        rc = ListMgr_Init(LIF_REPORT_ONLY);
+        if (rc) {
+            DisplayLog(LVL_CRIT, BENCH_TAG,
+                       "Error initializing list manager: %s (%d)",
+                       lmgr_err2str(rc), rc);
+            exit(rc);
+        }
+        rc = load_samples_db();
+        if (rc)
+            exit(rc);
+    } else {
+        InitFS();
+
+        seed = options.seed;
+        for (sample_count = 0; sample_count < options.count; sample_count++)
+            mk_sample(sample_count, &sample_ids[sample_count],
+                      &sample_attrs[sample_count], now, &seed);
+    }
+
+    /* all evaluations use the same time reference */
+    policy_eval_set_time(now);
+
+    printf("%u %s samples, %u loops\n", sample_count,
+           options.from_db ? "DB" : "synthetic", options.loops);
+    printf("    %-32s %15s %12s %13s\n", "", "matches", "time/eval",
+           "ratio");
+
+    bench_fileclasses();
+
+    for (i = 0; i < policies.policy_count; i++) {
+        if (options.policy != NULL
+            && strcasecmp(options.policy, policies.policy_list[i].name))
+            continue;
+        bench_policy(&policies.policy_list[i]);
+    }
+
+    bench_conditions();
+
+    policy_eval_set_time(0);
+    for (i = 0; i < sample_count; i++)
+        ListMgr_FreeAttrs(&sample_attrs[i]);
+    MemFree(sample_attrs);
+    MemFree(sample_ids);
+    MemFree(conds);
+
+    FlushLogs();
+    return 0;
+}
@@ -0,0 +1,381 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file   rbh_bench_scan.c
+ * \brief  Benchmark of the filesystem scan.
+ *
+ * Scans a synthetic namespace generated in memory (with optional simulated
+ * latency of readdir and stat), through the noop pipeline or the real
+ * standard/diff pipeline, then reports the scan throughput. Running it with
+ * different numbers of scan threads shows the scalability of the scan
+ * scheduler, independently of the storage.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "cmd_helpers.h"
+#include "rbh_basename.h"
+#include "status_manager.h"
+#include "entry_processor.h"
+#include "fs_scan_main.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_TAG   "Bench"
+
+static struct option option_tab[] = {
+    /* benchmark options */
+    {"depth", required_argument, NULL, 'd'},
+    {"width", required_argument, NULL, 'w'},
+    {"files", required_argument, NULL, 'F'},
+    {"threads", required_argument, NULL, 't'},
+    {"readdir-latency", required_argument, NULL, 'R'},
+    {"stat-latency", required_argument, NULL, 'L'},
+    {"pipeline", required_argument, NULL, 'p'},
+    {"stages", required_argument, NULL, 's'},
+
+    /* config file options */
+    {"config-file", required_argument, NULL, 'f'},
+
+    /* log options */
+    {"log-level", required_argument, NULL, 'l'},
+
+    /* miscellaneous options */
+    {"help", no_argument, NULL, 'h'},
+
+    {NULL, 0, NULL, 0}
+};
+
+#define SHORT_OPT_STRING    "d:w:F:t:R:L:p:s:f:l:h"
+
+#define MAX_OPT_LEN 1024
+
+static struct bench_options {
+    synth_tree_params_t tree;
+    unsigned int    threads;    /* 0 = from configuration */
+    pipeline_flavor_e flavor;
+    int             stages;
+    char            config_file[MAX_OPT_LEN];
+} options = {
+    .tree = {
+        .depth = 3,
+        .width = 10,
+        .files = 100,
+        .readdir_usec = 0,
+        .stat_usec = 0,
+    },
+    .threads = 0,
+    .flavor = BENCH_PIPELINE,
+    .stages = 3,
+    .config_file = "",
+};
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [options]\n"
+    "\n"
+    _B "Synthetic namespace options:" B_ "\n"
+    "    " _B "-d" B_ " " _U "depth" U_ ", " _B "--depth=" B_ _U "depth" U_ "\n"
+    "        Depth of the directory tree (default: 3).\n"
+    "    " _B "-w" B_ " " _U "count" U_ ", " _B "--width=" B_ _U "count" U_ "\n"
+    "        Number of sub-directories per directory (default: 10).\n"
+    "    " _B "-F" B_ " " _U "count" U_ ", " _B "--files=" B_ _U "count" U_ "\n"
+    "        Number of files per directory (default: 100).\n"
+    "    " _B "-R" B_ " " _U "usec" U_ ", " _B "--readdir-latency=" B_ _U "usec" U_ "\n"
+    "        Simulated latency of each getdents call (default: 0).\n"
+    "    " _B "-L" B_ " " _U "usec" U_ ", " _B "--stat-latency=" B_ _U "usec" U_ "\n"
+    "        Simulated latency of each stat call (default: 0).\n"
+    "\n"
+    _B "Benchmark options:" B_ "\n"
+    "    " _B "-t" B_ " " _U "count" U_ ", " _B "--threads=" B_ _U "count" U_ "\n"
+    "        Number of scan threads (default: nb_threads_scan from config).\n"
+    "    " _B "-p" B_ " " _U "pipeline" U_ ", " _B "--pipeline=" B_ _U "pipeline" U_ "\n"
+    "        Pipeline to be run: noop (default), std or diff.\n"
+    "        std and diff pipelines update the database: use a scratch one!\n"
+    "    " _B "-s" B_ " " _U "count" U_ ", " _B "--stages=" B_ _U "count" U_ "\n"
+    "        Number of stages of the noop pipeline (default: 3).\n"
+    "\n"
+    _B "Config file options:" B_ "\n"
+    "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
+    "        Path to configuration file (or short name).\n"
+    "\n"
+    _B "Miscellaneous options:" B_ "\n"
+    "    " _B "-l" B_ " " _U "level" U_ ", " _B "--log-level=" B_ _U "level" U_ "\n"
+    "        Force the log verbosity level (overides configuration value).\n"
+    "        Allowed values: CRIT, MAJOR, EVENT, VERB, DEBUG, FULL.\n"
+    "    " _B "-h" B_ ", " _B "--help" B_ "\n"
+    "        Display a short help about command line options.\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name);
+}
+
+/** parse a non-negative integer option */
+static unsigned int parse_uint(const char *opt, const char *arg)
+{
+    int val = str2int(arg);
+
+    if (val < 0) {
+        fprintf(stderr, "Invalid argument for --%s: '%s' "
+                "(non-negative integer expected)\n", opt, arg);
+        exit(1);
+    }
+    return val;
+}
+
+int main(int argc, char **argv)
+{
+    int            c, option_index = 0;
+    const char    *bin;
+    char           err_msg[4096];
+    char           badcfg[RBH_PATH_MAX];
+    bool           chgd = false;
+    int            rc;
+    attr_mask_t    diff_mask = null_mask;
+    diff_arg_t     diff_arg;
+    void          *arg;
+    const struct scan_backend *backend;
+    unsigned long long dirs, files;
+    struct timeval start, end, diff;
+    double         elapsed;
+
+    bin = rh_basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
+                            &option_index)) != -1) {
+        switch (c) {
+        case 'd':
+            options.tree.depth = parse_uint("depth", optarg);
+            break;
+        case 'w':
+            options.tree.width = parse_uint("width", optarg);
+            break;
+        case 'F':
+            options.tree.files = parse_uint("files", optarg);
+            break;
+        case 'R':
+            options.tree.readdir_usec = parse_uint("readdir-latency", optarg);
+            break;
+        case 'L':
+            options.tree.stat_usec = parse_uint("stat-latency", optarg);
+            break;
+        case 't':
+            options.threads = parse_uint("threads", optarg);
+            if (options.threads == 0) {
+                fprintf(stderr, "Invalid argument for --threads: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            if (!strcasecmp(optarg, "noop"))
+                options.flavor = BENCH_PIPELINE;
+            else if (!strcasecmp(optarg, "std"))
+                options.flavor = STD_PIPELINE;
+            else if (!strcasecmp(optarg, "diff"))
+                options.flavor = DIFF_PIPELINE;
+            else {
+                fprintf(stderr, "Invalid argument for --pipeline: '%s' "
+                        "(noop, std or diff expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            options.stages = str2int(optarg);
+            if (options.stages < 1) {
+                fprintf(stderr, "Invalid argument for --stages: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'f':
+            rh_strncpy(options.config_file, optarg, MAX_OPT_LEN);
+            break;
+        case 'l':
+        {
+            int log_level = str2debuglevel(optarg);
+
+            if (log_level == -1) {
+                fprintf(stderr,
+                        "Unsupported log level '%s'. CRIT, MAJOR, EVENT, VERB, DEBUG or FULL expected.\n",
+                        optarg);
+                exit(1);
+            }
+            force_debug_level(log_level);
+            break;
+        }
+        case 'h':
+            display_help(bin);
+            exit(0);
+            break;
+        case ':':
+        case '?':
+        default:
+            fprintf(stderr, "Run '%s --help' for more details.\n", bin);
+            exit(1);
+            break;
+        }
+    }
+
+    /* check there is no extra arguments */
+    if (optind != argc) {
+        fprintf(stderr, "Error: unexpected argument on command line: %s\n",
+                argv[optind]);
+        exit(1);
+    }
+
+    /* initialize internal resources (glib, llapi, internal resources...) */
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
+    /* get default config file, if not specified */
+    if (SearchConfig(options.config_file, options.config_file, &chgd,
+                     badcfg, MAX_OPT_LEN) != 0) {
+        fprintf(stderr, "No config file (or too many) found matching %s\n",
+                badcfg);
+        exit(2);
+    } else if (chgd) {
+        fprintf(stderr, "Using config file '%s'.\n", options.config_file);
+    }
+
+    if (rbh_cfg_load(MODULE_MASK_FS_SCAN | MODULE_MASK_ENTRY_PROCESSOR,
+                     options.config_file, err_msg)) {
+        fprintf(stderr, "Error reading configuration file '%s': %s\n",
+                options.config_file, err_msg);
+        exit(1);
+    }
+
+    options.threads = FSScan_SetThreads(options.threads);
+
+    /* stats are displayed at MAJOR level */
+    if (!log_config.force_debug_level)
+        log_config.debug_level = LVL_MAJOR;
+
+    /* Set logging to stderr */
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
+
+    rc = InitializeLogs(bin);
+    if (rc) {
+        fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
+                rc, errno, strerror(errno));
+        exit(rc);
+    }
+
+    /* Initialize filesystem access (the root of the synthetic namespace
+     * is the filesystem root) */
+    rc = InitFS();
+    if (rc)
+        exit(rc);
+
+    backend = ScanSynth_Backend(&options.tree);
+    if (backend == NULL)
+        exit(EINVAL);
+    rc = FSScan_SetBackend(backend);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG,
+                   "Synthetic scan backend is not supported by this build");
+        exit(rc);
+    }
+
+    /* Initialize status managers */
+    rc = smi_init_all(RUNFLG_ONCE);
+    if (rc)
+        exit(rc);
+
+    /* Initialize list manager (all pipeline workers connect to the DB) */
+    rc = ListMgr_Init(0);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG,
+                   "Error initializing list manager: %s (%d)", lmgr_err2str(rc),
+                   rc);
+        exit(rc);
+    }
+
+    switch (options.flavor) {
+    case BENCH_PIPELINE:
+        arg = &options.stages;
+        break;
+    case DIFF_PIPELINE:
+        memset(&diff_arg, 0, sizeof(diff_arg));
+        diff_arg.apply = APPLY_DB;
+        {
+            char tmpstr[] = "all";
+
+            if (parse_diff_mask(tmpstr, &diff_arg.diff_mask, err_msg)) {
+                DisplayLog(LVL_CRIT, BENCH_TAG,
+                           "unexpected error parsing diff mask: %s", err_msg);
+                exit(1);
+            }
+        }
+        diff_arg.diff_mask = translate_all_status_mask(diff_arg.diff_mask);
+        arg = &diff_arg;
+        break;
+    case STD_PIPELINE:
+    default:
+        arg = &diff_mask;
+        break;
+    }
+
+    rc = EntryProcessor_Init(options.flavor, RUNFLG_ONCE, arg);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG,
+                   "Error %d initializing EntryProcessor pipeline", rc);
+        exit(rc);
+    }
+
+    gettimeofday(&start, NULL);
+
+    rc = FSScan_Start(RUNFLG_ONCE, NULL);
+    if (rc) {
+        DisplayLog(LVL_CRIT, BENCH_TAG, "Error %d initializing FS Scan module",
+                   rc);
+        exit(rc);
+    }
+    FSScan_Wait();
+
+    /* wait for all operations to be processed (dumps stage stats) */
+    EntryProcessor_Terminate(true);
+
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &diff);
+    elapsed = diff.tv_sec + 1E-6 * diff.tv_usec;
+
+    FSScan_DumpStats();
+
+    /* the root is not counted */
+    dirs = ScanSynth_DirCount(&options.tree) - 1;
+    files = (dirs + 1) * options.tree.files;
+
+    printf("pipeline=%s, scan_threads=%u, directories=%llu, files=%llu, "
+           "elapsed=%.3fs, throughput=%.1f entries/s\n",
+           options.flavor == BENCH_PIPELINE ? "noop" :
+           options.flavor == DIFF_PIPELINE ? "diff" : "std",
+           options.threads, dirs, files, elapsed,
+           elapsed > 0.0 ? (dirs + files) / elapsed : 0.0);
+
+    FlushLogs();
+    return 0;
+}
@@ -21,12 +21,20 @@
 #endif
 
 #include "policy_run.h"
+#include "policy_candidates.h"
+#include "policy_tracker.h"
 #include "list_mgr.h"
 #include "rbh_cfg.h"
 #include "rbh_logs.h"
 #include "rbh_misc.h"
 #include "cmd_helpers.h"
 #include "rbh_basename.h"
+#include "uidgidcache.h"
+#include "Memory.h"
+#include "rbh_metrics.h"
+#include "rbh_prof.h"
+#include "rbh_evloop.h"
+#include "rbh_fidpath.h"
 
 /* needed to dump their stats */
 #include "fs_scan_main.h"
@@ -40,6 +48,7 @@
 #include <pthread.h>
 #include <fcntl.h>  /* for open flags */
 #include <signal.h>
+#include <glib.h>
 
 #ifdef _LUSTRE
 #include "lustre_extended_types.h"
@@ -61,6 +70,11 @@ static time_t boot_time;
 #define TGT_USAGE         267
 #define FORCE_ALL         268
 #define ALTER_DB          269
+#define RESUME_SCAN       273
+#define REPLAY_LOG        274
+#define REPLAY_REALTIME   275
+#define SIMULATE          276
+#define STANDBY           277
 
 /* deprecated params */
 #define FORCE_OST_PURGE   270
@@ -110,6 +124,9 @@ static struct option option_tab[] = {
     {"read-log", no_argument, NULL, 'r'},
     {"handle-events", no_argument, NULL, 'r'},  /* for backward compatibility */
 #endif
+    {"replay", required_argument, NULL, REPLAY_LOG},
+    {"replay-realtime", no_argument, NULL, REPLAY_REALTIME},
+    {"standby", no_argument, NULL, STANDBY},
 #endif
     {"run", optional_argument, NULL, RUN_POLICIES},
     {"check-thresholds", optional_argument, NULL, 'C'},
@@ -128,11 +145,13 @@ static struct option option_tab[] = {
 
     /* behavior flags */
     {"dry-run", no_argument, NULL, DRY_RUN},
+    {"simulate", no_argument, NULL, SIMULATE},
     {"one-shot", no_argument, NULL, 'O'},   /* for backward compatibility */
     {"once", no_argument, NULL, 'O'},
     {"detach", no_argument, NULL, 'd'},
     {"no-limit", no_argument, NULL, NO_LIMIT},
     {"no-gc", no_argument, NULL, NO_GC},
+    {"resume", no_argument, NULL, RESUME_SCAN},
     {"alter-db", no_argument, NULL, ALTER_DB},
     {"alterdb", no_argument, NULL, ALTER_DB},
     /* generic policies equivalent for --sync:
@@ -215,6 +234,9 @@ typedef struct rbh_options {
     double         usage_target; /* set -1.0 if not set */
 
     int            mdtidx;
+    char           replay_file[RBH_PATH_MAX];
+    bool           replay_realtime;
+    bool           standby;
     enum lmgr_init_flags db_flags;
 } rbh_options;
 
@@ -254,6 +276,13 @@ static const char *action_help =
     "        Read events from MDT ChangeLog.\n"
     "        If " _U "mdt_idx" U_ " is specified, only read ChangeLogs for the given MDT.\n"
     "        Else, start 1 changelog reader thread per MDT (with DNE).\n"
+    "    " _B "--replay" B_ "=" _U "file" U_ "\n"
+    "        Process the changelog records captured in " _U "file" U_ " (see chglog_capture),\n"
+    "        and report the processing speed and lag (benchmarking).\n"
+    "        Records are replayed at maximum speed, unless " _B "--replay-realtime" B_ " is specified.\n"
+    "    " _B "--standby" B_ "\n"
+    "        With " _B "--read-log" B_ ", wait for the active changelog reader to stop or fail, then take over.\n"
+    "        Meanwhile, trigger thresholds of policies are only checked (see " _B "--check-thresholds" B_ ").\n"
 #endif
     "    " _B "--run" B_ "[=all]\n"
     "        Run all polices (based on triggers).\n"
@@ -299,6 +328,10 @@ static const char *run_help =
     "    " _B "--dry-run" B_ "\n"
     "        Only report policy actions that would be performed without really doing them.\n"
     "        Note: Robinhood DB is impacted as if the reported actions were really done.\n"
+    "    " _B "--simulate" B_ "\n"
+    "        Only evaluate policy rules against DB contents, and report the projected\n"
+    "        count and volume per rule and fileclass, with an estimated run duration.\n"
+    "        Neither the filesystem nor the DB are modified. Implies --once.\n"
     "    " _B "--force-all" B_ "\n"
     "        Force applying a policy to all eligible entries, without considering\n"
     "        policy limits and rule conditions.\n"
@@ -310,7 +343,10 @@ static const char *scan_help =
     "        Garbage collection of entries in DB is a long operation when terminating\n"
     "        a scan. This skips this operation if you don't care about removed\n"
     "        entries (or don't expect entries to be removed).\n"
-    "        This is also recommended for partial scanning (see -scan=dir option).\n";
+    "        This is also recommended for partial scanning (see -scan=dir option).\n"
+    "    " _B "--resume" B_ "\n"
+    "        Resume an interrupted scan from its last checkpoint\n"
+    "        (see FS_Scan::scan_checkpoint_file parameter).\n";
 
 static const char *output_help =
     _B "Output options:" B_ "\n"
@@ -416,11 +452,8 @@ static inline void display_version(const char *bin_name)
     printf("\n");
 }
 
-static pthread_t stat_thread;
 
 /* database connexion for updating stats */
-static lmgr_t   lmgr;
-static bool     lmgr_init = false;
 static char     boot_time_str[256];
 
 static void running_mask2str(int mask, uint64_t pol_mask, char *str)
@@ -463,22 +496,60 @@ static pthread_mutex_t shutdown_mtx = PTHREAD_MUTEX_INITIALIZER;
 static int      terminate_sig = 0;
 static bool     reload_sig = false;
 static bool     dump_sig = false;
+static bool     prof_sig = false;
 
 /** async signal handler */
 static pthread_t sig_thr;
 
+/** metrics_foreach() callback: add a sample to the array */
+static void stats_sample_add(const char *key, metric_type_e type,
+                             double value, void *arg)
+{
+    GArray *samples = arg;
+    stat_sample_t sample = {.name = g_strdup(key), .value = value };
+
+    g_array_append_val(samples, sample);
+}
+
+/** store the current values of metrics in the stats history */
+static void store_stats_history(lmgr_t *lmgr)
+{
+    GArray *samples = g_array_new(FALSE, FALSE, sizeof(stat_sample_t));
+    unsigned int i;
+    int rc;
+
+    metrics_foreach(stats_sample_add, samples);
+
+    rc = ListMgr_StoreStatSamples(lmgr, time(NULL),
+                                  (stat_sample_t *)samples->data,
+                                  samples->len);
+    if (rc)
+        DisplayLog(LVL_MAJOR, "STATS", "Failed to store stats history: %s",
+                   lmgr_err2str(rc));
+
+    for (i = 0; i < samples->len; i++)
+        g_free((char *)g_array_index(samples, stat_sample_t, i).name);
+    g_array_free(samples, TRUE);
+}
+
 /** dump stats of all modules */
-static void dump_stats(lmgr_t *lmgr, const int *module_mask,
-                       const uint64_t *p_policy_mask)
+static void dump_stats(const int *module_mask, const uint64_t *p_policy_mask)
 {
     char   tmp_buff[256];
     struct tm date;
     time_t now;
+    lmgr_t *lmgr;
 
     if (pthread_mutex_trylock(&shutdown_mtx) != 0)
         /* daemon is shutting down, don't dump stats */
         return;
 
+    lmgr = ListMgr_Checkout();
+    if (lmgr == NULL) {
+        pthread_mutex_unlock(&shutdown_mtx);
+        return;
+    }
+
     now = time(NULL);
     strftime(tmp_buff, sizeof(tmp_buff), "%Y/%m/%d %T",
              localtime_r(&now, &date));
@@ -490,6 +561,15 @@ static void dump_stats(lmgr_t *lmgr, const int *module_mask,
     DisplayLog(LVL_MAJOR, "STATS", "Daemon start time: %s", boot_time_str);
     running_mask2str(*module_mask, *p_policy_mask, tmp_buff);
     DisplayLog(LVL_MAJOR, "STATS", "Started modules: %s", tmp_buff);
+    ListMgr_CacheDumpStats();
+    ListMgr_PathCacheDumpStats();
+    ListMgr_QueryDumpStats();
+    ListMgr_PoolDumpStats();
+    mem_dump_stats();
+    evloop_dump_stats();
+#ifdef _HAVE_FID
+    fidpath_dump_stats();
+#endif
 
     if (*module_mask & MODULE_MASK_FS_SCAN) {
         FSScan_DumpStats();
@@ -504,6 +584,7 @@ static void dump_stats(lmgr_t *lmgr, const int *module_mask,
 
     if (*module_mask & MODULE_MASK_ENTRY_PROCESSOR) {
         EntryProcessor_DumpCurrentStages();
+        EntryProcessor_StoreStats(lmgr);
     }
 
     if (*module_mask & MODULE_MASK_POLICY_RUN
@@ -511,38 +592,380 @@ static void dump_stats(lmgr_t *lmgr, const int *module_mask,
         int i;
 
         for (i = 0; i < policy_run_cpt; i++) {
-            if ((*p_policy_mask) & (1LL << i))
+            if ((*p_policy_mask) & (1LL << i)) {
                 policy_module_dump_stats(&policy_run[i]);
+                policy_module_store_stats(&policy_run[i], lmgr);
+            }
         }
     }
 
+    if (lmgr_stats_history())
+        store_stats_history(lmgr);
+
+    ListMgr_Release(lmgr);
     pthread_mutex_unlock(&shutdown_mtx);
 
     /* Flush stats */
     FlushLogs();
 }
 
-static void *stats_thr(void *arg)
+/** periodic stats dump (event loop timer) */
+static unsigned int stats_timer(void *arg)
+{
+    if (terminate_sig)
+        return 0;
+
+    dump_stats(&running_mask, &policy_run_mask);
+    return 1000 * StatsInterval();
+}
+
+/** dump stats at each stats_interval */
+static void start_stats_timer(void)
 {
     struct tm date;
+    int rc;
 
     strftime(boot_time_str, 256, "%Y/%m/%d %T", localtime_r(&boot_time, &date));
 
-    if (!lmgr_init) {
-        if (ListMgr_InitAccess(&lmgr) != DB_SUCCESS)
-            return NULL;
-        lmgr_init = true;
+    rc = evloop_timer_add(1000 * StatsInterval(), EVLOOP_OFFLOAD, stats_timer,
+                          NULL);
+    if (rc < 0)
+        DisplayLog(LVL_CRIT, MAIN_TAG, "Failed to register statistics "
+                   "timer: %s", strerror(-rc));
+    else
+        DisplayLog(LVL_VERB, MAIN_TAG, "Statistics timer started");
+}
+
+/* max delay to take a change of report_snapshot_interval into account */
+#define SNAPSHOT_CHECK_DELAY 60
+
+/** periodically refresh report snapshots (event loop timer) */
+static unsigned int snapshot_timer(void *arg)
+{
+    static time_t last = 0;
+    time_t interval;
+
+    if (terminate_sig)
+        return 0;
+
+    interval = lmgr_report_snapshot_interval();
+    if (interval > 0 && time(NULL) - last >= interval
+        && pthread_mutex_trylock(&shutdown_mtx) == 0) {
+        lmgr_t *lmgr = ListMgr_Checkout();
+
+        if (lmgr != NULL) {
+            int rc = ListMgr_RefreshSnapshots(lmgr);
+
+            if (rc)
+                DisplayLog(LVL_MAJOR, MAIN_TAG, "Failed to refresh "
+                           "report snapshots: %s (%d)", lmgr_err2str(rc),
+                           rc);
+            ListMgr_Release(lmgr);
+        }
+        pthread_mutex_unlock(&shutdown_mtx);
+        last = time(NULL);
     }
 
-    DisplayLog(LVL_VERB, MAIN_TAG, "Statistics thread started");
+    return 1000 * (interval > 0 ? MIN2(interval, SNAPSHOT_CHECK_DELAY)
+                   : SNAPSHOT_CHECK_DELAY);
+}
+
+/** periodically refresh the summary tables of the web GUI
+ * (event loop timer) */
+static unsigned int summary_timer(void *arg)
+{
+    static time_t last = 0;
+    time_t interval;
+
+    if (terminate_sig)
+        return 0;
+
+    interval = lmgr_summary_interval();
+    if (interval > 0 && time(NULL) - last >= interval
+        && pthread_mutex_trylock(&shutdown_mtx) == 0) {
+        lmgr_t *lmgr = ListMgr_Checkout();
 
-    WaitStatsInterval();
-    while (!terminate_sig) {
-        dump_stats(&lmgr, &running_mask, &policy_run_mask);
-        WaitStatsInterval();
+        if (lmgr != NULL) {
+            int rc = ListMgr_RefreshSummaries(lmgr);
+
+            if (rc)
+                DisplayLog(LVL_MAJOR, MAIN_TAG, "Failed to refresh "
+                           "summary tables: %s (%d)", lmgr_err2str(rc), rc);
+            ListMgr_Release(lmgr);
+        }
+        pthread_mutex_unlock(&shutdown_mtx);
+        last = time(NULL);
     }
-    return NULL;
+
+    /* same check delay as report snapshots */
+    return 1000 * (interval > 0 ? MIN2(interval, SNAPSHOT_CHECK_DELAY)
+                   : SNAPSHOT_CHECK_DELAY);
+}
+
+#ifdef _LUSTRE
+/** periodically record OST usage in the DB history (event loop timer) */
+static unsigned int ost_history_timer(void *arg)
+{
+    static time_t last = 0;
+    time_t interval;
+
+    if (terminate_sig)
+        return 0;
+
+    interval = lmgr_ost_history_interval();
+    if (interval > 0 && time(NULL) - last >= interval
+        && pthread_mutex_trylock(&shutdown_mtx) == 0) {
+        lmgr_t *lmgr = ListMgr_Checkout();
+
+        if (lmgr != NULL) {
+            int rc = usage_store_ost_history(lmgr);
+
+            if (rc)
+                DisplayLog(LVL_MAJOR, MAIN_TAG, "Failed to record OST "
+                           "usage history: error %d", rc);
+            ListMgr_Release(lmgr);
+        }
+        pthread_mutex_unlock(&shutdown_mtx);
+        last = time(NULL);
+    }
+
+    /* same check delay as report snapshots */
+    return 1000 * (interval > 0 ? MIN2(interval, SNAPSHOT_CHECK_DELAY)
+                   : SNAPSHOT_CHECK_DELAY);
+}
+#endif
+
+#ifdef HAVE_CHANGELOGS
+/* The daemon reading changelogs holds a lease in the DB, that it renews
+ * periodically. A standby daemon takes it over when it is not renewed.
+ * Lease value is "<host> <pid> <renewal time>" (clocks of the hosts are
+ * assumed to be synchronized). */
+#define CL_LEASE_VAR        "ChangelogLease"
+#define CL_LEASE_RENEW      15
+#define CL_LEASE_TIMEOUT    60
+
+/* standby: delay between lease checks, and between reports of the active
+ * reader progress and refreshes of the uid/gid cache */
+#define STANDBY_CHECK_DELAY     5
+#define STANDBY_FOLLOW_DELAY    60
+#define STANDBY_UIDGID_DELAY    300
+
+static char lease_var[128];
+/* value of the lease held by this process (empty if none) */
+static char lease_value[MAX_VAR_LEN] = "";
+
+static void lease_set_name(int mdt_index)
+{
+    if (mdt_index == -1)
+        rh_strncpy(lease_var, CL_LEASE_VAR, sizeof(lease_var));
+    else
+        snprintf(lease_var, sizeof(lease_var), "%s_%d", CL_LEASE_VAR,
+                 mdt_index);
+}
+
+static void lease_make(char *value, size_t size)
+{
+    char host[256];
+
+    if (gethostname(host, sizeof(host)) != 0)
+        strcpy(host, "localhost");
+    host[sizeof(host) - 1] = '\0';
+
+    snprintf(value, size, "%s %u %lu", host, (unsigned int)getpid(),
+             (unsigned long)time(NULL));
+}
+
+/** is a lease held by a running daemon? */
+static bool lease_alive(const char *value)
+{
+    char          host[256];
+    char          holder[256];
+    unsigned int  pid;
+    unsigned long renewed;
+
+    if (sscanf(value, "%255s %u %lu", holder, &pid, &renewed) != 3)
+        return false;
+
+    /* the holder is known to be dead if it ran on this host */
+    if (gethostname(host, sizeof(host)) == 0
+        && strncmp(host, holder, sizeof(host)) == 0
+        && kill(pid, 0) == -1 && errno == ESRCH)
+        return false;
+
+    return time(NULL) < renewed + CL_LEASE_TIMEOUT;
+}
+
+/**
+ * Take the changelog reader lease if it is free or expired.
+ * @param[out] holder  previous holder of the lease (empty if none).
+ * @return 0 on success, EBUSY if another daemon holds it, else an error.
+ */
+static int lease_acquire(lmgr_t *lmgr, char *holder, size_t size)
+{
+    char current[MAX_VAR_LEN];
+    char value[MAX_VAR_LEN];
+    int  rc;
+
+    holder[0] = '\0';
+
+    rc = ListMgr_GetVar(lmgr, lease_var, current, sizeof(current));
+    if (rc == DB_SUCCESS) {
+        rh_strncpy(holder, current, size);
+        if (lease_alive(current))
+            return EBUSY;
+    } else if (rc != DB_NOT_EXISTS) {
+        DisplayLog(LVL_MAJOR, MAIN_TAG, "Failed to get changelog reader "
+                   "lease '%s': %s (%d)", lease_var, lmgr_err2str(rc), rc);
+        return EIO;
+    }
+
+    lease_make(value, sizeof(value));
+    rc = ListMgr_TestAndSetVar(lmgr, lease_var,
+                               rc == DB_SUCCESS ? current : NULL, value);
+    if (rc == DB_OUT_OF_DATE) {
+        /* another daemon took it meanwhile */
+        return EBUSY;
+    } else if (rc) {
+        DisplayLog(LVL_MAJOR, MAIN_TAG, "Failed to set changelog reader "
+                   "lease '%s': %s (%d)", lease_var, lmgr_err2str(rc), rc);
+        return EIO;
+    }
+
+    rh_strncpy(lease_value, value, sizeof(lease_value));
+    DisplayLog(LVL_EVENT, MAIN_TAG, "Changelog reader lease '%s' acquired",
+               lease_var);
+    return 0;
+}
+
+/** release the changelog reader lease, if it is held */
+static void lease_release(void)
+{
+    lmgr_t *lmgr;
+    int     rc;
+
+    if (EMPTY_STRING(lease_value))
+        return;
+
+    lmgr = ListMgr_Checkout();
+    if (lmgr == NULL)
+        return;
+
+    rc = ListMgr_TestAndSetVar(lmgr, lease_var, lease_value, NULL);
+    if (rc == DB_SUCCESS)
+        DisplayLog(LVL_EVENT, MAIN_TAG, "Changelog reader lease '%s' "
+                   "released", lease_var);
+    ListMgr_Release(lmgr);
+    lease_value[0] = '\0';
+}
+
+/** periodically renew the changelog reader lease (event loop timer) */
+static unsigned int lease_timer(void *arg)
+{
+    char    value[MAX_VAR_LEN];
+    lmgr_t *lmgr;
+    int     rc;
+
+    if (terminate_sig || EMPTY_STRING(lease_value))
+        return 0;
+
+    lmgr = ListMgr_Checkout();
+    if (lmgr == NULL)
+        return 1000 * CL_LEASE_RENEW;
+
+    lease_make(value, sizeof(value));
+    rc = ListMgr_TestAndSetVar(lmgr, lease_var, lease_value, value);
+    ListMgr_Release(lmgr);
+
+    if (rc == DB_SUCCESS) {
+        rh_strncpy(lease_value, value, sizeof(lease_value));
+    } else if (rc == DB_OUT_OF_DATE) {
+        /* a standby daemon took over: 2 processes must not clear the same
+         * changelog */
+        DisplayLog(LVL_CRIT, MAIN_TAG, "Changelog reader lease '%s' was "
+                   "taken over by another daemon: stopping", lease_var);
+        lease_value[0] = '\0';
+        kill(getpid(), SIGTERM);
+        return 0;
+    } else {
+        DisplayLog(LVL_MAJOR, MAIN_TAG, "Failed to renew changelog reader "
+                   "lease '%s': %s (%d)", lease_var, lmgr_err2str(rc), rc);
+    }
+
+    return 1000 * CL_LEASE_RENEW;
+}
+
+/**
+ * Standby mode: follow the progress of the active changelog reader and keep
+ * the uid/gid cache warm, until its lease expires and this process gets it.
+ * Returns with shutdown_mtx locked, to take over before any shutdown.
+ */
+static void standby_wait(void)
+{
+    time_t last_follow = 0;
+    time_t last_uidgid = time(NULL);
+    char   holder[MAX_VAR_LEN] = "";
+
+    DisplayLog(LVL_MAJOR, MAIN_TAG, "Standby: waiting for changelog reader "
+               "lease '%s' to expire", lease_var);
+    FlushLogs();
+
+    for (;;) {
+        lmgr_t *lmgr;
+        int     rc = EBUSY;
+
+        /* don't start anything while the daemon is shutting down */
+        if (terminate_sig || pthread_mutex_trylock(&shutdown_mtx) != 0) {
+            rh_sleep(STANDBY_CHECK_DELAY);
+            continue;
+        }
+
+        lmgr = ListMgr_Checkout();
+        if (lmgr != NULL) {
+            if (time(NULL) - last_follow >= STANDBY_FOLLOW_DELAY) {
+                cl_reader_follow(lmgr, options.mdtidx);
+                last_follow = time(NULL);
+            }
+
+            rc = lease_acquire(lmgr, holder, sizeof(holder));
+            ListMgr_Release(lmgr);
+        }
+
+        if (rc == 0)
+            break;
+        pthread_mutex_unlock(&shutdown_mtx);
+
+        if (!global_config.uid_gid_as_numbers
+            && time(NULL) - last_uidgid >= STANDBY_UIDGID_DELAY) {
+            UidGidCache_Prefetch();
+            last_uidgid = time(NULL);
+        }
+
+        rh_sleep(STANDBY_CHECK_DELAY);
+    }
+
+    DisplayLog(LVL_MAJOR, MAIN_TAG, "Standby: taking over changelog "
+               "reading (previous lease: %s)",
+               EMPTY_STRING(holder) ? "none" : holder);
+}
+
+/** start reading changelogs */
+static void start_cl_reader(void)
+{
+    int rc;
+
+    rc = cl_reader_start(options.flags, options.mdtidx);
+    if (rc) {
+        DisplayLog(LVL_CRIT, MAIN_TAG,
+                   "Error %d initializing ChangeLog Reader", rc);
+        exit(rc);
+    } else
+        DisplayLog(LVL_VERB, MAIN_TAG,
+                   "ChangeLog Reader successfully initialized");
+
+    /* Flush logs now, to have a trace in the logs */
+    FlushLogs();
 }
+#endif
 
 #define SIGHDL_TAG  "SigHdlr"
 
@@ -561,6 +984,44 @@ static void usr_handler(int sig)
     dump_sig = true;
 }
 
+static void prof_handler(int sig)
+{
+    prof_sig = true;
+}
+
+/* where profiles triggered by SIGUSR2 are written */
+#define PROF_OUTPUT_DIR "/tmp"
+
+/** start or stop profiling */
+static void toggle_profiling(void)
+{
+    char file[RBH_PATH_MAX];
+    char date[128];
+    struct tm tm;
+    time_t now;
+    int rc;
+
+    if (prof_running()) {
+        /* the profiling thread writes the result */
+        prof_stop();
+        return;
+    }
+
+    now = time(NULL);
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+    snprintf(file, sizeof(file), PROF_OUTPUT_DIR "/robinhood.%u.%s.folded",
+             (unsigned int)getpid(), date);
+
+    rc = prof_run_async(PROF_DEFAULT_DURATION, file);
+    if (rc)
+        DisplayLog(LVL_MAJOR, SIGHDL_TAG, "Failed to start profiling: %s",
+                   strerror(rc));
+    else
+        DisplayLog(LVL_MAJOR, SIGHDL_TAG, "Profiling for %us (send SIGUSR2 "
+                   "again to stop earlier), output: %s",
+                   PROF_DEFAULT_DURATION, file);
+}
+
 static int action2parsing_mask(int act_mask)
 {
     /* build config parsing mask */
@@ -622,6 +1083,18 @@ static void *signal_handler_thr(void *arg)
         DisplayLog(LVL_VERB, SIGHDL_TAG,
                    "Signal SIGUSR1 (stats dump) is ready to be used");
 
+    memset(&act_sigusr, 0, sizeof(act_sigusr));
+    act_sigusr.sa_flags = 0;
+    act_sigusr.sa_handler = prof_handler;
+    if (sigaction(SIGUSR2, &act_sigusr, NULL) == -1) {
+        DisplayLog(LVL_CRIT, SIGHDL_TAG,
+                   "Error while setting signal handlers for SIGUSR2: %s",
+                   strerror(errno));
+        exit(1);
+    } else
+        DisplayLog(LVL_VERB, SIGHDL_TAG,
+                   "Signal SIGUSR2 (profiling on/off) is ready to be used");
+
     /* signal flag checking loop */
     while (1) {
         /* check for signal every second */
@@ -704,6 +1177,8 @@ static void *signal_handler_thr(void *arg)
                     /* Ack last changelog records. */
                     cl_reader_done();
                 }
+                /* a standby daemon can take over now */
+                lease_release();
 #endif
                 FlushLogs();
             }
@@ -729,10 +1204,7 @@ static void *signal_handler_thr(void *arg)
                 }
             }
 
-            if (lmgr_init) {
-                ListMgr_CloseAccess(&lmgr);
-                lmgr_init = false;
-            }
+            ListMgr_PoolClose();
 
             DisplayLog(LVL_MAJOR, SIGHDL_TAG, "Exiting.");
             FlushLogs();
@@ -746,20 +1218,41 @@ static void *signal_handler_thr(void *arg)
             DisplayLog(LVL_EVENT, RELOAD_TAG,
                        "Reloading configuration from '%s'", config_file_path());
 
+            if (rbh_cfg_reload(parsing_mask) == 0)
+                DisplayLog(LVL_EVENT, RELOAD_TAG,
+                           "Configuration successfully reloaded");
+            else
+                DisplayLog(LVL_CRIT, RELOAD_TAG,
+                           "Error reloading configuration");
+
+            /* apply the new thread counts and queue sizes */
+            if (running_mask & MODULE_MASK_ENTRY_PROCESSOR)
+                EntryProcessor_Reconfig();
+
+            if (running_mask & MODULE_MASK_POLICY_RUN
+                && policy_run_mask != 0LL
+                && policy_run_cpt != 0 && policy_run != NULL) {
+                int i;
+
+                for (i = 0; i < policy_run_cpt; i++)
+                    if (policy_run_mask & (1LL << i))
+                        policy_module_reload(&policy_run[i]);
+            }
+
             reload_sig = false;
             FlushLogs();
         } else if (dump_sig) {
             DisplayLog(LVL_MAJOR, SIGHDL_TAG,
                        "SIGUSR1 received: dumping stats");
 
-            if (!lmgr_init) {
-                if (ListMgr_InitAccess(&lmgr) != DB_SUCCESS)
-                    return NULL;
-                lmgr_init = true;
-            }
-
-            dump_stats(&lmgr, &running_mask, &policy_run_mask);
+            dump_stats(&running_mask, &policy_run_mask);
             dump_sig = false;
+        } else if (prof_sig) {
+            DisplayLog(LVL_MAJOR, SIGHDL_TAG,
+                       "SIGUSR2 received: switching profiling %s",
+                       prof_running() ? "off" : "on");
+            toggle_profiling();
+            prof_sig = false;
         }
     }
 }
@@ -951,6 +1444,20 @@ static int rh_read_parameters(const char *bin, int argc, char **argv,
 #endif
             break;
 
+        case REPLAY_LOG:
+            *action_mask |= ACTION_MASK_HANDLE_EVENTS;
+            opt->flags |= RUNFLG_ONCE;
+            rh_strncpy(opt->replay_file, optarg, sizeof(opt->replay_file));
+            break;
+
+        case REPLAY_REALTIME:
+            opt->replay_realtime = true;
+            break;
+
+        case STANDBY:
+            opt->standby = true;
+            break;
+
         case RUN_POLICIES:
             /* avoid conflicts with check-policies */
             if (opt->flags & RUNFLG_CHECK_ONLY) {
@@ -1035,9 +1542,15 @@ static int rh_read_parameters(const char *bin, int argc, char **argv,
         case NO_GC:
             opt->flags |= RUNFLG_NO_GC;
             break;
+        case RESUME_SCAN:
+            opt->flags |= RUNFLG_RESUME;
+            break;
         case DRY_RUN:
             opt->flags |= RUNFLG_DRY_RUN;
             break;
+        case SIMULATE:
+            opt->flags |= RUNFLG_SIMULATE | RUNFLG_ONCE;
+            break;
         case 'I':
             opt->flags |= RUNFLG_IGNORE_POL;
             break;
@@ -1170,6 +1683,21 @@ static int rh_read_parameters(const char *bin, int argc, char **argv,
         return EINVAL;
     }
 
+    if (opt->replay_realtime && EMPTY_STRING(opt->replay_file)) {
+        fprintf(stderr, "Error: --replay-realtime option only applies to "
+                "--replay\n");
+        return EINVAL;
+    }
+
+    if (opt->standby
+        && (!(*action_mask & ACTION_MASK_HANDLE_EVENTS)
+            || (*action_mask & ACTION_MASK_SCAN)
+            || (opt->flags & RUNFLG_ONCE))) {
+        fprintf(stderr, "Error: --standby option only applies to --read-log "
+                "(with no --scan, --replay or --once)\n");
+        return EINVAL;
+    }
+
     if (!attr_mask_is_null(opt->diff_mask) && (*action_mask != ACTION_MASK_SCAN)
         && (*action_mask != ACTION_MASK_HANDLE_EVENTS)) {
         fprintf(stderr,
@@ -1694,6 +2222,10 @@ int main(int argc, char **argv)
     if (options.pid_file)
         create_pid_file(options.pid_filepath);
 
+    /* uid/gid are stored as names: cache the known users and groups */
+    if (!global_config.uid_gid_as_numbers)
+        UidGidCache_Prefetch();
+
     /* Initialize filesystem access */
     rc = InitFS();
     if (rc)
@@ -1714,6 +2246,20 @@ int main(int argc, char **argv)
         DisplayLog(LVL_VERB, MAIN_TAG,
                    "Signal handler thread started successfully");
 
+    /* serve metrics to monitoring tools (not fatal if it fails) */
+    metrics_start();
+
+    /* index the sort attributes of policy runs */
+    {
+        int i;
+
+        for (i = 0; i < run_cfgs.count; i++) {
+            if (!policies.policy_list[i].manage_deleted
+                && run_cfgs.configs[i].lru_sort_attr != LRU_ATTR_NONE)
+                ListMgr_AddSortIndex(run_cfgs.configs[i].lru_sort_attr);
+        }
+    }
+
     /* Initialize list manager */
     rc = ListMgr_Init(options.db_flags);
     if (rc) {
@@ -1729,7 +2275,59 @@ int main(int argc, char **argv)
 
     if (options.flags & RUNFLG_ONCE) {
         /* used for dumping stats in one shot mode */
-        pthread_create(&stat_thread, NULL, stats_thr, NULL);
+        start_stats_timer();
+    }
+
+    /* candidate indexes and action trackers of policies are kept up to date
+     * by the pipeline of this process: they must exist before it starts */
+    if ((action_mask & ACTION_MASK_RUN_POLICIES)
+        && !(options.flags & RUNFLG_ONCE)) {
+        int i;
+
+        for (i = 0; i < run_count; i++) {
+            unsigned int pol_idx = runs[i].policy_index;
+
+            if (!run_cfgs.configs[pol_idx].candidate_index)
+                continue;
+
+            if (!(action_mask & (ACTION_MASK_SCAN
+                                 | ACTION_MASK_HANDLE_EVENTS))) {
+                DisplayLog(LVL_MAJOR, MAIN_TAG, "Policy %s: candidate_index "
+                           "requires scanning or reading changelogs in the "
+                           "same process: ignored",
+                           policies.policy_list[pol_idx].name);
+                continue;
+            }
+            /* it would miss the changes of the active daemon */
+            if (options.standby) {
+                DisplayLog(LVL_MAJOR, MAIN_TAG, "Policy %s: candidate_index "
+                           "is not supported in standby mode: ignored",
+                           policies.policy_list[pol_idx].name);
+                continue;
+            }
+
+            rc = candidates_init(pol_idx);
+            if (rc) {
+                DisplayLog(LVL_CRIT, MAIN_TAG, "Error %d initializing "
+                           "candidate index of policy %s", rc,
+                           policies.policy_list[pol_idx].name);
+                exit(rc);
+            }
+        }
+
+        /* outstanding actions are tracked by actions of this process,
+         * and by its scans and changelogs, if any */
+        for (i = 0; i < run_count; i++) {
+            unsigned int pol_idx = runs[i].policy_index;
+
+            rc = tracker_init(pol_idx);
+            if (rc) {
+                DisplayLog(LVL_CRIT, MAIN_TAG, "Error %d initializing "
+                           "action tracker of policy %s", rc,
+                           policies.policy_list[pol_idx].name);
+                exit(rc);
+            }
+        }
     }
 
     if (action_mask & (ACTION_MASK_SCAN | ACTION_MASK_HANDLE_EVENTS)) {
@@ -1740,7 +2338,7 @@ int main(int argc, char **argv)
         /* Initialize Pipeline */
 #ifdef _BENCH_PIPELINE
         int nb_stages = 3;
-        rc = EntryProcessor_Init(0, options.flags, &nb_stages);
+        rc = EntryProcessor_Init(BENCH_PIPELINE, options.flags, &nb_stages);
 #else
         rc = EntryProcessor_Init(STD_PIPELINE, options.flags,
                                  &options.diff_mask);
@@ -1789,20 +2387,40 @@ int main(int argc, char **argv)
         }
     }
 #ifdef HAVE_CHANGELOGS
-    if (action_mask & ACTION_MASK_HANDLE_EVENTS) {
+    if ((action_mask & ACTION_MASK_HANDLE_EVENTS)
+        && !(options.flags & RUNFLG_ONCE))
+        lease_set_name(options.mdtidx);
+
+    if (options.standby) {
+        /* changelogs are read after taking over (see below) */
+        running_mask |= MODULE_MASK_ENTRY_PROCESSOR;
+    } else if (action_mask & ACTION_MASK_HANDLE_EVENTS) {
+
+        if (!(options.flags & RUNFLG_ONCE)) {
+            char    holder[MAX_VAR_LEN];
+            lmgr_t *lmgr = ListMgr_Checkout();
+
+            rc = lmgr == NULL ? EIO : lease_acquire(lmgr, holder,
+                                                    sizeof(holder));
+            if (lmgr != NULL)
+                ListMgr_Release(lmgr);
+            if (rc == EBUSY) {
+                DisplayLog(LVL_CRIT, MAIN_TAG, "Changelogs are already read "
+                           "by another daemon (lease '%s': %s). Use "
+                           "--standby to start a standby daemon.", lease_var,
+                           holder);
+                exit(rc);
+            } else if (rc) {
+                DisplayLog(LVL_CRIT, MAIN_TAG, "Cannot get changelog reader "
+                           "lease");
+                exit(rc);
+            }
+        }
 
-        /* Start reading changelogs */
-        rc = cl_reader_start(options.flags, options.mdtidx);
-        if (rc) {
-            DisplayLog(LVL_CRIT, MAIN_TAG,
-                       "Error %d initializing ChangeLog Reader", rc);
-            exit(rc);
-        } else
-            DisplayLog(LVL_VERB, MAIN_TAG,
-                       "ChangeLog Reader successfully initialized");
+        if (!EMPTY_STRING(options.replay_file))
+            cl_reader_set_replay(options.replay_file, options.replay_realtime);
 
-        /* Flush logs now, to have a trace in the logs */
-        FlushLogs();
+        start_cl_reader();
 
         if (options.flags & RUNFLG_ONCE)
             running_mask = MODULE_MASK_EVENT_HDLR | MODULE_MASK_ENTRY_PROCESSOR;
@@ -1844,6 +2462,10 @@ int main(int argc, char **argv)
         for (i = 0; i < run_count; i++) {
             unsigned int pol_idx = runs[i].policy_index;
 
+            /* policy actions are run by the active daemon */
+            if (options.standby)
+                runs[i].run_opt.flags |= RUNFLG_CHECK_ONLY;
+
             rc = policy_module_start(&policy_run[i],
                                      &policies.policy_list[pol_idx],
                                      &run_cfgs.configs[pol_idx],
@@ -1894,10 +2516,55 @@ int main(int argc, char **argv)
         FlushLogs();
 
         /* dump stats periodically */
-        stats_thr(&running_mask);
+        start_stats_timer();
 
-        /* should never return */
-        exit(1);
+#ifdef HAVE_CHANGELOGS
+        if (options.standby) {
+            int i;
+
+            standby_wait();
+
+            /* the active daemon kept changing the DB meanwhile */
+            ListMgr_InvalidateCaches();
+
+            start_cl_reader();
+            running_mask |= MODULE_MASK_EVENT_HDLR;
+
+            for (i = 0; i < policy_run_cpt; i++)
+                if (policy_run_mask & (1LL << i))
+                    policy_module_set_check_only(&policy_run[i], false);
+
+            pthread_mutex_unlock(&shutdown_mtx);
+
+            running_mask2str(running_mask, policy_run_mask, tmpstr);
+            DisplayLog(LVL_MAJOR, MAIN_TAG, "Daemon took over (running "
+                       "modules: %s)", tmpstr);
+            FlushLogs();
+        }
+
+        if (!EMPTY_STRING(lease_value)
+            && evloop_timer_add(1000 * CL_LEASE_RENEW, EVLOOP_OFFLOAD,
+                                lease_timer, NULL) < 0)
+            DisplayLog(LVL_CRIT, MAIN_TAG, "Failed to register changelog "
+                       "reader lease timer");
+#endif
+
+        /* DB maintenance is done by the active daemon only */
+        if (evloop_timer_add(0, EVLOOP_OFFLOAD, snapshot_timer, NULL) < 0)
+            DisplayLog(LVL_CRIT, MAIN_TAG, "Failed to register report "
+                       "snapshot timer");
+        if (evloop_timer_add(0, EVLOOP_OFFLOAD, summary_timer, NULL) < 0)
+            DisplayLog(LVL_CRIT, MAIN_TAG, "Failed to register summary "
+                       "table timer");
+#ifdef _LUSTRE
+        if (evloop_timer_add(0, EVLOOP_OFFLOAD, ost_history_timer, NULL) < 0)
+            DisplayLog(LVL_CRIT, MAIN_TAG, "Failed to register OST usage "
+                       "history timer");
+#endif
+
+        /* the daemon runs until the signal handler exits */
+        for (;;)
+            pause();
     } else {
         DisplayLog(LVL_MAJOR, MAIN_TAG, "All tasks done! Exiting.");
         exit(0);
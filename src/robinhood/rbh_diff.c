@@ -23,6 +23,7 @@
 #include "rbh_misc.h"
 #include "cmd_helpers.h"
 #include "rbh_basename.h"
+#include "Memory.h"
 
 /* needed to dump their stats */
 #include "fs_scan_main.h"
@@ -36,6 +37,7 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/wait.h>
 
 #ifdef _LUSTRE
 #include "lustre_extended_types.h"
@@ -53,6 +55,10 @@
 
 static time_t start_time;
 
+/* long options without short equivalent */
+#define NO_GC_OPT   260
+#define RECOV_THREADS_OPT 261
+
 /* Array of options for getopt_long().
  * Each record consists of: {const char *name, int has_arg, int *flag, int val}
  */
@@ -68,6 +74,12 @@ static struct option option_tab[] = {
     {"diff", required_argument, NULL, 'd'},
     /* dry-run */
     {"dry-run", no_argument, NULL, 'D'},
+    /* parallel diff */
+    {"jobs", required_argument, NULL, 'j'},
+    /* don't report/clean entries missing in the filesystem */
+    {"no-gc", no_argument, NULL, NO_GC_OPT},
+    /* threads recreating entries in the filesystem */
+    {"recov-threads", required_argument, NULL, RECOV_THREADS_OPT},
 #ifdef _HSM_LITE /** FIXME check policies */
     /* recover lost files from backend */
     {"from-backend", no_argument, NULL, 'b'},
@@ -90,7 +102,10 @@ static struct option option_tab[] = {
     {NULL, 0, NULL, 0}
 };
 
-#define SHORT_OPT_STRING    "s:a:d:f:l:hVDbo:"
+#define SHORT_OPT_STRING    "s:a:d:j:f:l:hVDbo:"
+
+/* max number of parallel diff jobs */
+#define MAX_JOBS    256
 
 #define MAX_OPT_LEN 1024
 #define MAX_TYPE_LEN 256
@@ -101,6 +116,7 @@ typedef struct diff_options {
     char           partial_scan_path[RBH_PATH_MAX];
     diff_arg_t     diff_arg;
     char           output_dir[MAX_OPT_LEN];
+    unsigned int   jobs;
 
     /* bit field */
     unsigned int   partial_scan:1;
@@ -111,6 +127,7 @@ static inline void zero_options(struct diff_options *opts)
     /* default value is 0 for most options */
     memset(opts, 0, sizeof(struct diff_options));
     opts->flags = RUNFLG_ONCE;
+    opts->jobs = 1;
     strcpy(opts->output_dir, ".");
 }
 
@@ -146,6 +163,15 @@ static const char *help_string =
     ": revert changes in the filesystem using the database as the reference.\n"
     "    " _B "--dry-run" B_ "\n"
     "        If --apply=fs, display operations on filesystem without performing them.\n"
+    "    " _B "-j" B_ " " _U "count" U_ ", " _B "--jobs" B_ "=" _U "count" U_ "\n"
+    "        Split the diff between " _U "count" U_ " processes, each scanning a subset of\n"
+    "        the subtrees of the scanned directory (output is merged).\n"
+    "    " _B "--no-gc" B_ "\n"
+    "        Don't look for entries that are in the database but no longer in the\n"
+    "        filesystem (saves a full database pass when diffing a subtree).\n"
+    "    " _B "--recov-threads" B_ "=" _U "count" U_ "\n"
+    "        When applying changes to the filesystem (--apply=fs), recreate missing\n"
+    "        entries using " _U "count" U_ " threads (default: 8).\n"
 #ifdef _HSM_LITE
     "    " _B "-b" B_ ", " _B "--from-backend" B_ "\n"
     "        When applying changes to the filesystem (--apply=fs), recover objects from the backend storage\n"
@@ -275,6 +301,8 @@ static void *stats_thr(void *arg)
 
 static int terminate_sig = 0;
 static bool dump_sig = false;
+/* parallel diff: this process is a diff job (the tag belongs to its parent) */
+static bool diff_job = false;
 static pthread_t sig_thr;
 
 #define SIGHDL_TAG  "SigHdlr"
@@ -303,7 +331,8 @@ static void *signal_handler_thr(void *arg)
         DisplayLog(LVL_CRIT, SIGHDL_TAG,
                    "Error while setting signal handlers for SIGTERM and SIGINT: %s",
                    strerror(errno));
-        if (options.diff_arg.db_tag != NULL && ensure_db_access()) {
+        if (!diff_job && options.diff_arg.db_tag != NULL
+            && ensure_db_access()) {
             fprintf(stderr, "Cleaning diff table...\n");
             ListMgr_DestroyTag(&lmgr, options.diff_arg.db_tag);
         }
@@ -319,7 +348,8 @@ static void *signal_handler_thr(void *arg)
         DisplayLog(LVL_CRIT, SIGHDL_TAG,
                    "Error while setting signal handlers for SIGUSR1: %s",
                    strerror(errno));
-        if (options.diff_arg.db_tag != NULL && ensure_db_access()) {
+        if (!diff_job && options.diff_arg.db_tag != NULL
+            && ensure_db_access()) {
             fprintf(stderr, "Cleaning diff table...\n");
             ListMgr_DestroyTag(&lmgr, options.diff_arg.db_tag);
 
@@ -360,7 +390,8 @@ static void *signal_handler_thr(void *arg)
             DisplayLog(LVL_MAJOR, SIGHDL_TAG, "Exiting.");
             FlushLogs();
 
-            if (options.diff_arg.db_tag != NULL && ensure_db_access()) {
+            if (!diff_job && options.diff_arg.db_tag != NULL
+                && ensure_db_access()) {
                 fprintf(stderr, "Cleaning diff table...\n");
                 ListMgr_DestroyTag(&lmgr, options.diff_arg.db_tag);
 
@@ -385,6 +416,279 @@ static void *signal_handler_thr(void *arg)
     }
 }
 
+/**
+ * Scan the filesystem (or the shard set by FSScan_SetShard)
+ * and compare it to the DB.
+ */
+static int run_diff(run_flags_t flags)
+{
+    int rc;
+
+    /* Initialise Pipeline */
+    rc = EntryProcessor_Init(DIFF_PIPELINE, flags, &options.diff_arg);
+    if (rc) {
+        DisplayLog(LVL_CRIT, DIFF_TAG,
+                   "Error %d initializing EntryProcessor pipeline", rc);
+        return rc;
+    } else
+        DisplayLog(LVL_VERB, DIFF_TAG,
+                   "EntryProcessor successfully initialized");
+
+    fprintf(stderr, "Starting scan\n");
+
+    /* Start FS scan */
+    if (options.partial_scan)
+        rc = FSScan_Start(flags, options.partial_scan_path);
+    else
+        rc = FSScan_Start(flags, NULL);
+
+    if (rc) {
+        DisplayLog(LVL_CRIT, DIFF_TAG, "Error %d initializing FS Scan module",
+                   rc);
+        return rc;
+    } else
+        DisplayLog(LVL_VERB, DIFF_TAG,
+                   "FS Scan module successfully initialized");
+
+    /* Flush logs now, to have a trace in the logs */
+    FlushLogs();
+
+    /* both pipeline and scan are now running, can now trap events and
+     * display stats */
+
+    /* create signal handling thread */
+    rc = pthread_create(&sig_thr, NULL, signal_handler_thr, NULL);
+    if (rc) {
+        DisplayLog(LVL_CRIT, DIFF_TAG,
+                   "Error starting signal handler thread: %s", strerror(errno));
+        return rc;
+    } else
+        DisplayLog(LVL_VERB, DIFF_TAG,
+                   "Signal handler thread started successfully");
+
+    pthread_create(&stat_thread, NULL, stats_thr, NULL);
+
+    /* wait for FS scan to end */
+    FSScan_Wait();
+    DisplayLog(LVL_MAJOR, DIFF_TAG, "FS Scan finished");
+
+    /* Pipeline must be flushed */
+    EntryProcessor_Terminate(true);
+
+    fprintf(stderr, "End of scan\n");
+    return 0;
+}
+
+/**
+ * Parallel diff: report (or clean) the entries that were seen by none of
+ * the diff jobs. This is the step the jobs skip (the entries that are
+ * missing in the subtrees of a job may have been seen by another job).
+ * @param gc_time  the entries not updated since this time are obsolete.
+ */
+static int diff_gc(time_t gc_time)
+{
+    entry_proc_op_t *op;
+    int rc;
+
+    rc = EntryProcessor_Init(DIFF_PIPELINE, options.flags, &options.diff_arg);
+    if (rc) {
+        DisplayLog(LVL_CRIT, DIFF_TAG,
+                   "Error %d initializing EntryProcessor pipeline", rc);
+        return rc;
+    }
+
+    op = EntryProcessor_Get();
+    if (!op) {
+        DisplayLog(LVL_CRIT, DIFF_TAG,
+                   "CRITICAL ERROR: Failed to allocate a new op");
+        EntryProcessor_Terminate(false);
+        return ENOMEM;
+    }
+
+    op->pipeline_stage = entry_proc_descr.GC_OLDENT;
+    ATTR_MASK_INIT(&op->fs_attrs);
+
+    /* same as the GC of a single scan */
+    op->gc_names = 1;
+    op->gc_entries = !(options.partial_scan && has_deletion_policy());
+    ATTR_MASK_SET(&op->fs_attrs, md_update);
+    ATTR(&op->fs_attrs, md_update) = gc_time;
+
+    if (options.partial_scan) {
+        ATTR_MASK_SET(&op->fs_attrs, fullpath);
+        rh_strncpy(ATTR(&op->fs_attrs, fullpath), options.partial_scan_path,
+                   sizeof(ATTR(&op->fs_attrs, fullpath)));
+    }
+
+    EntryProcessor_Push(op);
+
+    /* wait for the operation to complete */
+    EntryProcessor_Terminate(true);
+    return 0;
+}
+
+/** depth of the directories to distribute between diff jobs */
+static unsigned int shard_depth(void)
+{
+    const char *c;
+    unsigned int depth = 1;
+
+    if (!options.partial_scan)
+        return depth;
+
+    /* the subdirectories of the scanned directory */
+    c = options.partial_scan_path + strlen(global_config.fs_path);
+    for (; *c != '\0'; c++)
+        if (*c == '/' && c[1] != '/' && c[1] != '\0')
+            depth++;
+    return depth;
+}
+
+/**
+ * Split the diff between options.jobs processes. Each job scans a shard
+ * of the subtrees, tags entries in the shared diff table and writes its
+ * output to a temporary file. Once all jobs are done, outputs are merged
+ * and the entries that were seen by no job are reported.
+ */
+static int parallel_diff(void)
+{
+    struct sigaction act;
+    pid_t       *pids;
+    FILE       **outputs;
+    time_t       gc_time = time(NULL);
+    unsigned int depth = shard_depth();
+    unsigned int i, running = 0;
+    bool         all_ok = true;
+    int          rc = 0;
+
+    pids = MemCalloc(options.jobs, sizeof(*pids));
+    outputs = MemCalloc(options.jobs, sizeof(*outputs));
+    if (pids == NULL || outputs == NULL) {
+        rc = ENOMEM;
+        goto out;
+    }
+
+    /* jobs open their own DB connection */
+    if (lmgr_init) {
+        ListMgr_CloseAccess(&lmgr);
+        lmgr_init = false;
+    }
+
+    /* forward termination signals to the jobs */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = terminate_handler;
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT, &act, NULL);
+
+    fflush(stdout);
+    fflush(stderr);
+    FlushLogs();
+
+    for (i = 0; i < options.jobs; i++) {
+        outputs[i] = tmpfile();
+        if (outputs[i] == NULL) {
+            rc = errno;
+            DisplayLog(LVL_CRIT, DIFF_TAG, "Failed to create a temporary "
+                       "file: %s", strerror(rc));
+            all_ok = false;
+            break;
+        }
+
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            /* diff job */
+            diff_job = true;
+            if (dup2(fileno(outputs[i]), STDOUT_FILENO) < 0)
+                exit(errno);
+
+            FSScan_SetShard(i, options.jobs, depth);
+
+            /* the parent cleans old entries once all jobs are done */
+            rc = run_diff(options.flags | RUNFLG_NO_GC);
+            if (rc == 0 && !FSScan_Complete())
+                rc = EAGAIN;
+            fflush(stdout);
+            exit(rc);
+        } else if (pids[i] < 0) {
+            rc = errno;
+            DisplayLog(LVL_CRIT, DIFF_TAG, "Failed to start diff job #%u: %s",
+                       i, strerror(rc));
+            fclose(outputs[i]);
+            outputs[i] = NULL;
+            all_ok = false;
+            break;
+        }
+        running++;
+    }
+
+    DisplayLog(LVL_EVENT, DIFF_TAG, "%u diff jobs started", running);
+
+    while (running > 0) {
+        int status;
+        pid_t pid = wait(&status);
+
+        if (pid < 0) {
+            if (errno == EINTR) {
+                if (terminate_sig != 0) {
+                    for (i = 0; i < options.jobs; i++)
+                        if (pids[i] > 0)
+                            kill(pids[i], terminate_sig);
+                }
+                continue;
+            }
+            break;
+        }
+        running--;
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            DisplayLog(LVL_CRIT, DIFF_TAG, "Diff job (pid %d) %s %d", pid,
+                       WIFEXITED(status) ? "exited with status" :
+                       "was killed by signal",
+                       WIFEXITED(status) ? WEXITSTATUS(status) :
+                       WTERMSIG(status));
+            all_ok = false;
+        }
+    }
+
+    /* merge outputs in job order */
+    for (i = 0; i < options.jobs; i++) {
+        char buff[65536];
+        size_t sz;
+
+        if (outputs[i] == NULL)
+            continue;
+
+        rewind(outputs[i]);
+        while ((sz = fread(buff, 1, sizeof(buff), outputs[i])) > 0)
+            fwrite(buff, 1, sz, stdout);
+        fclose(outputs[i]);
+    }
+    fflush(stdout);
+
+    if (terminate_sig != 0) {
+        rc = 128 + terminate_sig;
+        goto out;
+    }
+
+    if (!all_ok) {
+        fprintf(stderr, "Some diff jobs failed or were incomplete: "
+                "entries missing in the filesystem are not reported\n");
+        if (rc == 0)
+            rc = 1;
+        goto out;
+    }
+
+    if (!(options.flags & RUNFLG_NO_GC))
+        rc = diff_gc(gc_time);
+
+ out:
+    if (pids != NULL)
+        MemFree(pids);
+    if (outputs != NULL)
+        MemFree(outputs);
+    return rc;
+}
+
 /**
  * Main daemon routine
  */
@@ -444,6 +748,28 @@ int main(int argc, char **argv)
             options.flags |= RUNFLG_DRY_RUN;
             break;
 
+        case 'j':
+            options.jobs = str2int(optarg);
+            if ((int)options.jobs <= 0 || options.jobs > MAX_JOBS) {
+                fprintf(stderr, "Invalid argument for --jobs: '%s' "
+                        "(1 to %u expected)\n", optarg, MAX_JOBS);
+                exit(1);
+            }
+            break;
+
+        case NO_GC_OPT:
+            options.flags |= RUNFLG_NO_GC;
+            break;
+
+        case RECOV_THREADS_OPT:
+            options.diff_arg.recov_threads = str2int(optarg);
+            if ((int)options.diff_arg.recov_threads <= 0) {
+                fprintf(stderr, "Invalid argument for --recov-threads: '%s' "
+                        "(positive integer expected)\n", optarg);
+                exit(1);
+            }
+            break;
+
         case 'f':
             rh_strncpy(options.config_file, optarg, MAX_OPT_LEN);
             break;
@@ -604,8 +930,9 @@ int main(int argc, char **argv)
 
     /* if no DB apply action is specified, can't use md_update field for
      * checking removed entries. So, create a special tag for that. */
-    if ((options.diff_arg.apply != APPLY_DB)
-        || (options.flags & RUNFLG_DRY_RUN)) {
+    if (((options.diff_arg.apply != APPLY_DB)
+         || (options.flags & RUNFLG_DRY_RUN))
+        && !(options.flags & RUNFLG_NO_GC)) {
         fprintf(stderr, "Preparing diff table...\n");
 
         /* create a connexion to the DB. this is safe to use the global lmgr var
@@ -640,18 +967,6 @@ int main(int argc, char **argv)
             exit(rc);
     }
 
-    /* Initialise Pipeline */
-    rc = EntryProcessor_Init(DIFF_PIPELINE, options.flags, &options.diff_arg);
-    if (rc) {
-        DisplayLog(LVL_CRIT, DIFF_TAG,
-                   "Error %d initializing EntryProcessor pipeline", rc);
-        goto clean_tag;
-    } else
-        DisplayLog(LVL_VERB, DIFF_TAG,
-                   "EntryProcessor successfully initialized");
-
-    fprintf(stderr, "Starting scan\n");
-
     /* print header to indicate the content of diff
      * #<diff cmd>
      * ---fs[=/subdir]
@@ -674,44 +989,12 @@ int main(int argc, char **argv)
             printf("+++fs\n");
     }
 
-    /* Start FS scan */
-    if (options.partial_scan)
-        rc = FSScan_Start(options.flags, options.partial_scan_path);
+    if (options.jobs > 1)
+        rc = parallel_diff();
     else
-        rc = FSScan_Start(options.flags, NULL);
-
-    if (rc) {
-        DisplayLog(LVL_CRIT, DIFF_TAG, "Error %d initializing FS Scan module",
-                   rc);
-        goto clean_tag;
-    } else
-        DisplayLog(LVL_VERB, DIFF_TAG,
-                   "FS Scan module successfully initialized");
-
-    /* Flush logs now, to have a trace in the logs */
-    FlushLogs();
-
-    /* both pipeline and scan are now running, can now trap events and
-     * display stats */
-
-    /* create signal handling thread */
-    rc = pthread_create(&sig_thr, NULL, signal_handler_thr, NULL);
-    if (rc) {
-        DisplayLog(LVL_CRIT, DIFF_TAG,
-                   "Error starting signal handler thread: %s", strerror(errno));
+        rc = run_diff(options.flags);
+    if (rc)
         goto clean_tag;
-    } else
-        DisplayLog(LVL_VERB, DIFF_TAG,
-                   "Signal handler thread started successfully");
-
-    pthread_create(&stat_thread, NULL, stats_thr, NULL);
-
-    /* wait for FS scan to end */
-    FSScan_Wait();
-    DisplayLog(LVL_MAJOR, DIFF_TAG, "FS Scan finished");
-
-    /* Pipeline must be flushed */
-    EntryProcessor_Terminate(true);
 
 #ifdef LUSTRE_DUMP_FILES
     /* flush the lovea file */
@@ -727,14 +1010,13 @@ int main(int argc, char **argv)
     }
 #endif
 
-    fprintf(stderr, "End of scan\n");
-
     DisplayLog(LVL_MAJOR, DIFF_TAG, "All tasks done! Exiting.");
     rc = 0;
 
  clean_tag:
     /* destroy the tag before exit */
-    if (options.diff_arg.db_tag != NULL && ensure_db_access()) {
+    if (!diff_job && options.diff_arg.db_tag != NULL
+        && ensure_db_access()) {
         fprintf(stderr, "Cleaning diff table...\n");
         ListMgr_DestroyTag(&lmgr, options.diff_arg.db_tag);
     }
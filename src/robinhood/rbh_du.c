@@ -59,6 +59,9 @@ static struct option option_tab[] = {
     /* log options */
     {"log-level", required_argument, NULL, 'l'},
 
+    /* traversal options */
+    {"threads", required_argument, NULL, 'j'},
+
     /* miscellaneous options */
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'V'},
@@ -67,7 +70,7 @@ static struct option option_tab[] = {
 
 };
 
-#define SHORT_OPT_STRING    "u:g:t:S:scbkmHdf:l:hV"
+#define SHORT_OPT_STRING    "u:g:t:S:scbkmHdf:l:j:hV"
 #define TYPE_HELP "'f' (file), 'd' (dir), 'l' (symlink), 'b' (block), "\
                   "'c' (char), 'p' (named pipe/FIFO), 's' (socket)"
 
@@ -100,6 +103,9 @@ struct du_opt {
     display_unit disp_how;
     unsigned int sum:1;
 
+    /* number of threads for namespace traversal */
+    unsigned int threads;
+
 } prog_options = {
     .disp_what = disp_usage, .disp_how = disp_kilo
 };
@@ -219,6 +225,17 @@ static void print_stats(const char *name, stats_du_t *stats)
     }
 }
 
+/** build a filter on entries of a parent directory */
+static void mk_parent_filter(lmgr_filter_t *filter)
+{
+    lmgr_simple_filter_init(filter);
+
+    /* Do not use 'OR' expression there */
+    if (is_expr)
+        convert_boolexpr_to_simple_filter(&match_expr, filter,
+                                          prog_options.smi, NULL, 0);
+}
+
 /* build filters depending on program options */
 static int mkfilters(void)
 {
@@ -291,7 +308,7 @@ static int mkfilters(void)
 
     /* create DB filters */
     lmgr_simple_filter_init(&entry_filter);
-    lmgr_simple_filter_init(&parent_filter);
+    mk_parent_filter(&parent_filter);
 
     if (is_expr) {
         char expr[RBH_PATH_MAX];
@@ -303,8 +320,6 @@ static int mkfilters(void)
         /* Do not use 'OR' expression there */
         convert_boolexpr_to_simple_filter(&match_expr, &entry_filter,
                                           prog_options.smi, NULL, 0);
-        convert_boolexpr_to_simple_filter(&match_expr, &parent_filter,
-                                          prog_options.smi, NULL, 0);
     }
 
     return 0;
@@ -340,6 +355,8 @@ static const char *help_string =
     _B "Program options:" B_ "\n"
     "    " _B "-f" B_ " " _U "config_file" U_ "\n"
     "    " _B "-l" B_ " " _U "log_level" U_ "\n"
+    "    " _B "-j" B_ " " _U "N" U_ ", " _B "--threads" B_ " " _U "N" U_ "\n"
+    "        Browse the namespace with N threads (and N DB connections).\n"
     "    " _B "-h" B_ ", " _B "--help" B_ "\n"
     "        Display a short help about command line options.\n"
     "    " _B "-V" B_ ", " _B "--version" B_ "\n"
@@ -441,30 +458,28 @@ static report_field_descr_t dir_info[REPCNT] = {
     {ATTR_INDEX_size, REPORT_SUM, SORT_NONE, false, 0, FV_NULL}
 };
 
-/* directory callback */
-static int dircb(wagon_t *id_list, attr_set_t *attr_list,
-                 unsigned int entry_count, void *arg)
+/** sum child entries stats for all directories */
+static int sum_dirs(lmgr_t *p_mgr, lmgr_filter_t *p_filter,
+                    wagon_t *id_list, unsigned int entry_count,
+                    stats_du_t *stats)
 {
-    /* sum child entries stats for all directories */
     int i, rc;
     filter_value_t fv;
     struct lmgr_report_t *it;
     db_value_t result[REPCNT];
     unsigned int result_count;
-    stats_du_t *stats = (stats_du_t *) arg;
 
     /* filter on parent_id */
 
     for (i = 0; i < entry_count; i++) {
         fv.value.val_id = id_list[i].id;
-        rc = lmgr_simple_filter_add_or_replace(&parent_filter,
+        rc = lmgr_simple_filter_add_or_replace(p_filter,
                                                ATTR_INDEX_parent_id,
                                                EQUAL, fv, 0);
         if (rc)
             return rc;
 
-        it = ListMgr_Report(&lmgr, dir_info, REPCNT, NULL, &parent_filter,
-                            NULL);
+        it = ListMgr_Report(p_mgr, dir_info, REPCNT, NULL, p_filter, NULL);
         if (it == NULL)
             return -1;
 
@@ -486,6 +501,103 @@ static int dircb(wagon_t *id_list, attr_set_t *attr_list,
     return 0;
 }
 
+/* directory callback */
+static int dircb(wagon_t *id_list, attr_set_t *attr_list,
+                 unsigned int entry_count, void *arg)
+{
+    return sum_dirs(&lmgr, &parent_filter, id_list, entry_count,
+                    (stats_du_t *) arg);
+}
+
+/** per-thread context of parallel scrubbing */
+struct du_thr {
+    lmgr_filter_t parent_filter;
+    stats_du_t    stats[TYPE_COUNT];
+};
+
+/* directory callback for parallel scrubbing */
+static int dircb_par(lmgr_t *p_mgr, wagon_t *id_list, attr_set_t *attr_list,
+                     unsigned int entry_count, FILE *out, void *thr_arg)
+{
+    struct du_thr *thr = thr_arg;
+
+    return sum_dirs(p_mgr, &thr->parent_filter, id_list, entry_count,
+                    thr->stats);
+}
+
+/** sum the contents of the given directories subtrees */
+static int du_scrub(wagon_t *ids, unsigned int count, stats_du_t *stats)
+{
+    struct par_scrub_opt opt = { 0 };
+    struct du_thr *thrs;
+    void **args;
+    unsigned int i, j;
+    int rc;
+
+    if (prog_options.threads <= 1)
+        return rbh_scrub(&lmgr, ids, count, disp_mask, dircb, stats);
+
+    thrs = MemCalloc(prog_options.threads, sizeof(*thrs));
+    args = MemCalloc(prog_options.threads, sizeof(*args));
+    if (thrs == NULL || args == NULL) {
+        MemFree(thrs);
+        MemFree(args);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < prog_options.threads; i++) {
+        mk_parent_filter(&thrs[i].parent_filter);
+        reset_stats(thrs[i].stats);
+        args[i] = &thrs[i];
+    }
+
+    opt.nb_threads = prog_options.threads;
+    opt.thr_args = args;
+    rc = rbh_scrub_parallel(ids, count, disp_mask, dircb_par, &opt);
+
+    /* merge thread stats */
+    for (i = 0; i < prog_options.threads; i++) {
+        for (j = 0; j < TYPE_COUNT; j++) {
+            stats[j].count += thrs[i].stats[j].count;
+            stats[j].blocks += thrs[i].stats[j].blocks;
+            stats[j].size += thrs[i].stats[j].size;
+        }
+        lmgr_simple_filter_free(&thrs[i].parent_filter);
+    }
+
+    MemFree(thrs);
+    MemFree(args);
+    return rc;
+}
+
+/**
+ * Sum the entries under a directory from the directory aggregates.
+ * \retval false if they cannot be used (not maintained, or filters
+ *         that the aggregates do not distinguish).
+ */
+static bool dir_agg_sum(const entry_id_t *id, stats_du_t *stats)
+{
+    dir_agg_t agg[TYPE_COUNT];
+    unsigned int count = TYPE_COUNT;
+    int i;
+
+    /* aggregates are only maintained by entry type */
+    if (prog_options.match_user || prog_options.match_group
+        || prog_options.match_type || prog_options.match_status)
+        return false;
+
+    if (ListMgr_GetDirAgg(&lmgr, id, agg, &count) != DB_SUCCESS)
+        return false;
+
+    for (i = 0; i < count; i++) {
+        unsigned int idx = db2type(agg[i].type);
+        stats[idx].count += agg[i].count;
+        stats[idx].blocks += agg[i].blocks;
+        stats[idx].size += agg[i].size;
+    }
+    return true;
+}
+
 /**
  * perform du command on the entire FS
  * \param stats array to be filled in
@@ -561,8 +673,9 @@ static int list_content(char **id_list, int id_count)
     int i, rc;
     attr_set_t root_attrs;
     entry_id_t root_id;
-    bool is_id;
+    bool is_id, agg;
     stats_du_t stats[TYPE_COUNT];
+    unsigned int scrub_count = 0;
 
     if (prog_options.sum)
         reset_stats(stats);
@@ -616,9 +729,7 @@ static int list_content(char **id_list, int id_count)
         /* get root attrs to print it (if it matches program options) */
         root_attrs.attr_mask = attr_mask_or(&disp_mask, &query_mask);
         rc = ListMgr_Get(&lmgr, &ids[i].id, &root_attrs);
-        if (rc == 0)
-            dircb(&ids[i], &root_attrs, 1, stats);
-        else {
+        if (rc != 0) {
             DisplayLog(LVL_VERB, DU_TAG, "Notice: no attrs in DB for %s",
                        id_list[i]);
 
@@ -647,9 +758,18 @@ static int list_content(char **id_list, int id_count)
                 }
             }
 
-            dircb(&ids[i], &root_attrs, 1, stats);
+            /* not an error: the entry is summed anyway */
+            rc = 0;
         }
 
+        /* sum the whole subtree at once if possible */
+        agg = dir_agg_sum(&ids[i].id, stats);
+        if (agg)
+            DisplayLog(LVL_DEBUG, DU_TAG, "Optimization: using directory "
+                       "aggregates for %s", id_list[i]);
+        else
+            dircb(&ids[i], &root_attrs, 1, stats);
+
         /* sum root if it matches */
         if (!is_expr || (entry_matches(&ids[i].id, &root_attrs,
                                        &match_expr, NULL,
@@ -662,19 +782,25 @@ static int list_content(char **id_list, int id_count)
 
         if (!prog_options.sum) {
             /* if not group all, run and display stats now */
-            rc = rbh_scrub(&lmgr, &ids[i], 1, disp_mask, dircb, stats);
-
-            if (rc)
-                goto out;
+            if (!agg) {
+                rc = du_scrub(&ids[i], 1, stats);
+                if (rc)
+                    goto out;
+            }
 
             print_stats(ids[i].fullname, stats);
+        } else if (!agg) {
+            /* the subtree remains to be scanned */
+            ids[scrub_count++] = ids[i];
         }
     }
 
     if (prog_options.sum) {
-        rc = rbh_scrub(&lmgr, ids, id_count, disp_mask, dircb, stats);
-        if (rc)
-            goto out;
+        if (scrub_count > 0) {
+            rc = du_scrub(ids, scrub_count, stats);
+            if (rc)
+                goto out;
+        }
         print_stats("total", stats);
     }
 
@@ -765,6 +891,16 @@ int main(int argc, char **argv)
         case 'f':
             rh_strncpy(config_file, optarg, MAX_OPT_LEN);
             break;
+        case 'j':
+            prog_options.threads = str2int(optarg);
+            if (prog_options.threads == (unsigned int)-1
+                || prog_options.threads == 0) {
+                fprintf(stderr,
+                        "invalid thread count '%s': positive integer "
+                        "expected\n", optarg);
+                exit(1);
+            }
+            break;
         case 'l':
         {
             int log_level = str2debuglevel(optarg);
@@ -0,0 +1,729 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009-2016 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Export entry attributes from robinhood DB to a columnar file
+ * (Arrow IPC file format), for offline analytics.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "cmd_helpers.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "rbh_arrow.h"
+#include "Memory.h"
+#include "xplatform_print.h"
+#include "rbh_basename.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define EXPORT_TAG "export"
+
+#define DEFAULT_ATTRS "id,parent_id,name,type,uid,gid,size,blocks,mode,nlink,"\
+                      "creation_time,last_access,last_mod,last_mdchange,"\
+                      "md_update"
+#define DEFAULT_BATCH_SIZE  65536
+#define MAX_THREADS         256
+
+/* pseudo attribute index of the entry id column */
+#define COL_ID  ((unsigned int)-1)
+
+#define SINCE_OPT       260
+#define BATCH_SIZE_OPT  261
+
+static struct option option_tab[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"attrs", required_argument, NULL, 'a'},
+    {"since", required_argument, NULL, SINCE_OPT},
+    {"batch-size", required_argument, NULL, BATCH_SIZE_OPT},
+
+    /* config file options */
+    {"config-file", required_argument, NULL, 'f'},
+
+    /* log options */
+    {"log-level", required_argument, NULL, 'l'},
+
+    /* traversal options */
+    {"threads", required_argument, NULL, 'j'},
+
+    /* miscellaneous options */
+    {"help", no_argument, NULL, 'h'},
+    {"version", no_argument, NULL, 'V'},
+
+    {NULL, 0, NULL, 0}
+
+};
+
+#define SHORT_OPT_STRING    "o:a:f:l:j:hV"
+
+struct column {
+    const char   *name;
+    unsigned int  attr_index;   /* COL_ID for the entry id */
+    arrow_type_e  type;
+};
+
+static struct column *columns;
+static unsigned int col_count;
+static attr_mask_t query_mask;
+
+static lmgr_filter_t filter;
+static bool filter_set;
+
+static struct arrow_writer *writer;
+
+static struct prog_options {
+    const char   *output;
+    const char   *attrs;
+    time_t        since;
+    unsigned int  threads;
+    unsigned int  batch_size;
+} prog_options = {
+    .output = NULL,
+    .attrs = DEFAULT_ATTRS,
+    .since = 0,
+    .threads = 1,
+    .batch_size = DEFAULT_BATCH_SIZE,
+};
+
+struct export_thr {
+    pthread_t     thread;
+    unsigned int  index;
+    uint64_t      count;
+    int           rc;
+};
+
+/** attributes stored as a number of seconds since the Epoch */
+static bool is_time_attr(unsigned int index)
+{
+    return index == ATTR_INDEX_creation_time
+        || index == ATTR_INDEX_last_access
+        || index == ATTR_INDEX_last_mod
+        || index == ATTR_INDEX_last_mdchange
+        || index == ATTR_INDEX_md_update
+        || index == ATTR_INDEX_path_update
+        || index == ATTR_INDEX_class_update
+        || index == ATTR_INDEX_rm_time;
+}
+
+/** get the attribute index and the column type of an attribute name */
+static int attr_column(const char *name, struct column *col)
+{
+    unsigned int i;
+
+    col->name = name;
+
+    if (!strcasecmp(name, "id")) {
+        col->attr_index = COL_ID;
+        col->type = ARROW_UTF8;
+        return 0;
+    }
+
+    for (i = 0; i < sm_inst_count; i++) {
+        if (!strcasecmp(name, get_sm_instance(i)->user_name)) {
+            col->attr_index = i | ATTR_INDEX_FLG_STATUS;
+            col->type = ARROW_UTF8;
+            return 0;
+        }
+    }
+
+    for (i = 0; i < ATTR_COUNT; i++) {
+        if (strcasecmp(name, field_infos[i].field_name))
+            continue;
+
+        if (field_infos[i].flags & DIR_ATTR)
+            return -ENOTSUP;
+
+        col->attr_index = i;
+        if (is_time_attr(i)) {
+            col->type = ARROW_TIMESTAMP;
+            return 0;
+        }
+
+        switch (field_infos[i].db_type) {
+        case DB_ID:
+        case DB_TEXT:
+        case DB_ENUM_FTYPE:
+            col->type = ARROW_UTF8;
+            return 0;
+        case DB_UIDGID:
+            col->type = global_config.uid_gid_as_numbers ? ARROW_INT64 :
+                ARROW_UTF8;
+            return 0;
+        case DB_INT:
+        case DB_UINT:
+        case DB_SHORT:
+        case DB_USHORT:
+        case DB_BIGINT:
+            col->type = ARROW_INT64;
+            return 0;
+        case DB_BIGUINT:
+            col->type = ARROW_UINT64;
+            return 0;
+        case DB_BOOL:
+            col->type = ARROW_BOOL;
+            return 0;
+        default:
+            return -ENOTSUP;
+        }
+    }
+    return -ENOENT;
+}
+
+/** parse the list of exported attributes */
+static int parse_attrs(char *list)
+{
+    char *curr, *saveptr = NULL;
+    unsigned int max = 1;
+    int rc;
+
+    for (curr = list; *curr != '\0'; curr++)
+        if (*curr == ',')
+            max++;
+
+    columns = MemCalloc(max, sizeof(*columns));
+    if (columns == NULL)
+        return -ENOMEM;
+
+    for (curr = strtok_r(list, ",", &saveptr); curr != NULL;
+         curr = strtok_r(NULL, ",", &saveptr)) {
+        struct column *col = &columns[col_count];
+
+        rc = attr_column(curr, col);
+        if (rc == -ENOENT) {
+            fprintf(stderr, "Unknown attribute '%s'\n", curr);
+            return rc;
+        } else if (rc) {
+            fprintf(stderr, "Attribute '%s' cannot be exported\n", curr);
+            return rc;
+        }
+
+        if (col->attr_index != COL_ID)
+            attr_mask_set_index(&query_mask, col->attr_index);
+        col_count++;
+    }
+
+    if (col_count == 0) {
+        fprintf(stderr, "No attribute to export\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/** set the value of a standard attribute */
+static void set_value(struct arrow_batch *b, unsigned int c,
+                      const struct column *col, const attr_set_t *attrs)
+{
+    const field_info_t *fi = &field_infos[col->attr_index];
+    const void *ptr = (const char *)&attrs->attr_values + fi->offset;
+    char buf[128];
+
+    switch (fi->db_type) {
+    case DB_ID:
+        snprintf(buf, sizeof(buf), DFID_NOBRACE,
+                 PFID((const entry_id_t *)ptr));
+        arrow_batch_set_str(b, c, buf);
+        break;
+    case DB_TEXT:
+    case DB_ENUM_FTYPE:
+        arrow_batch_set_str(b, c, ptr);
+        break;
+    case DB_UIDGID:
+        if (global_config.uid_gid_as_numbers)
+            arrow_batch_set_int(b, c, ((const uidgid_u *)ptr)->num);
+        else
+            arrow_batch_set_str(b, c, ((const uidgid_u *)ptr)->txt);
+        break;
+    case DB_INT:
+        arrow_batch_set_int(b, c, *(const int *)ptr);
+        break;
+    case DB_UINT:
+        arrow_batch_set_int(b, c, *(const unsigned int *)ptr);
+        break;
+    case DB_SHORT:
+        arrow_batch_set_int(b, c, *(const short *)ptr);
+        break;
+    case DB_USHORT:
+        arrow_batch_set_int(b, c, *(const unsigned short *)ptr);
+        break;
+    case DB_BIGINT:
+        arrow_batch_set_int(b, c, *(const long long *)ptr);
+        break;
+    case DB_BIGUINT:
+        arrow_batch_set_int(b, c, *(const unsigned long long *)ptr);
+        break;
+    case DB_BOOL:
+        arrow_batch_set_int(b, c, *(const bool *)ptr);
+        break;
+    default:
+        arrow_batch_set_null(b, c);
+    }
+}
+
+static void add_row(struct arrow_batch *b, const entry_id_t *id,
+                    const attr_set_t *attrs)
+{
+    unsigned int c;
+    char buf[128];
+
+    for (c = 0; c < col_count; c++) {
+        const struct column *col = &columns[c];
+
+        if (col->attr_index == COL_ID) {
+            snprintf(buf, sizeof(buf), DFID_NOBRACE, PFID(id));
+            arrow_batch_set_str(b, c, buf);
+        } else if (!attr_mask_test_index(&attrs->attr_mask, col->attr_index))
+            arrow_batch_set_null(b, c);
+        else if (is_status(col->attr_index)) {
+            const char *val =
+                STATUS_ATTR(attrs, attr2status_index(col->attr_index));
+
+            if (val == NULL)
+                arrow_batch_set_null(b, c);
+            else
+                arrow_batch_set_str(b, c, val);
+        } else
+            set_value(b, c, col, attrs);
+    }
+    arrow_batch_end_row(b);
+}
+
+/** export the entries of a shard */
+static void *export_thr(void *arg)
+{
+    struct export_thr *thr = arg;
+    lmgr_t lmgr;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
+    /* shards require a sort on a field of the main table */
+    lmgr_sort_type_t sort = {.attr_index = ATTR_INDEX_md_update,
+                             .order = SORT_ASC};
+    struct lmgr_iterator_t *it;
+    struct arrow_batch *batch;
+    attr_set_t attrs = ATTR_SET_INIT;
+    entry_id_t id;
+    int rc;
+
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, EXPORT_TAG, "Error %d: cannot connect to database",
+                   rc);
+        thr->rc = rc;
+        return NULL;
+    }
+
+    /* the list may not fit in memory: stream it */
+    opt.stream = 1;
+    if (prog_options.threads > 1) {
+        opt.shard_count = prog_options.threads;
+        opt.shard_index = thr->index;
+    }
+
+    it = ListMgr_Iterator(&lmgr, filter_set ? &filter : NULL,
+                          prog_options.threads > 1 ? &sort : NULL, &opt);
+    if (it == NULL) {
+        DisplayLog(LVL_CRIT, EXPORT_TAG,
+                   "ERROR: cannot retrieve entry list from database");
+        thr->rc = -1;
+        goto close;
+    }
+
+    batch = arrow_batch_new(writer);
+
+    attrs.attr_mask = query_mask;
+    while ((rc = ListMgr_GetNext(it, &id, &attrs)) == DB_SUCCESS) {
+        add_row(batch, &id, &attrs);
+        thr->count++;
+
+        ListMgr_FreeAttrs(&attrs);
+        attrs.attr_mask = query_mask;
+
+        if (arrow_batch_rows(batch) >= prog_options.batch_size) {
+            rc = arrow_write_batch(writer, batch);
+            if (rc)
+                break;
+        }
+    }
+
+    if (rc == DB_END_OF_LIST) {
+        rc = arrow_write_batch(writer, batch);
+    } else if (rc == DB_SUCCESS) {
+        /* write error */
+        ListMgr_FreeAttrs(&attrs);
+    } else {
+        DisplayLog(LVL_CRIT, EXPORT_TAG, "ERROR: failed to list entries: "
+                   "%s (%d)", lmgr_err2str(rc), rc);
+        thr->rc = rc;
+        rc = 0;
+    }
+    if (rc) {
+        DisplayLog(LVL_CRIT, EXPORT_TAG, "ERROR: failed to write to %s: %s",
+                   prog_options.output, strerror(rc));
+        thr->rc = rc;
+    }
+
+    arrow_batch_free(batch);
+    ListMgr_CloseIterator(it);
+close:
+    ListMgr_CloseAccess(&lmgr);
+    return NULL;
+}
+
+static int export_entries(FILE *out)
+{
+    struct export_thr *thrs;
+    const char **names;
+    arrow_type_e *types;
+    uint64_t total = 0;
+    unsigned int i, started = 0;
+    int rc = 0;
+
+    names = MemCalloc(col_count, sizeof(*names));
+    types = MemCalloc(col_count, sizeof(*types));
+    thrs = MemCalloc(prog_options.threads, sizeof(*thrs));
+    if (names == NULL || types == NULL || thrs == NULL) {
+        rc = ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < col_count; i++) {
+        names[i] = columns[i].name;
+        types[i] = columns[i].type;
+    }
+
+    writer = arrow_writer_open(out, col_count, names, types);
+    if (writer == NULL) {
+        rc = errno ? errno : EIO;
+        DisplayLog(LVL_CRIT, EXPORT_TAG, "ERROR: failed to write to %s: %s",
+                   prog_options.output, strerror(rc));
+        goto out;
+    }
+
+    for (i = 0; i < prog_options.threads; i++) {
+        thrs[i].index = i;
+        if (pthread_create(&thrs[i].thread, NULL, export_thr, &thrs[i])) {
+            rc = errno;
+            DisplayLog(LVL_CRIT, EXPORT_TAG, "Error creating export thread: "
+                       "%s", strerror(rc));
+            break;
+        }
+        started++;
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(thrs[i].thread, NULL);
+        total += thrs[i].count;
+        if (thrs[i].rc && !rc)
+            rc = thrs[i].rc;
+    }
+
+    i = arrow_writer_close(writer);
+    if (i && !rc) {
+        rc = i;
+        DisplayLog(LVL_CRIT, EXPORT_TAG, "ERROR: failed to write to %s: %s",
+                   prog_options.output, strerror(rc));
+    }
+
+    DisplayLog(LVL_EVENT, EXPORT_TAG, "%"PRIu64" entries exported to %s",
+               total, prog_options.output);
+out:
+    if (names != NULL)
+        MemFree(names);
+    if (types != NULL)
+        MemFree(types);
+    if (thrs != NULL)
+        MemFree(thrs);
+    return rc;
+}
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [options] -o " _U "file" U_ "\n"
+    "\n"
+    "Export entry attributes from robinhood database to an Arrow IPC file\n"
+    "(Feather v2), that can be loaded by pandas, pyarrow, DuckDB, polars...\n"
+    "\n"
+    _B "Export options:" B_ "\n"
+    "    " _B "-o" B_ " " _U "file" U_ ", " _B "--output" B_ "=" _U "file" U_ "\n"
+    "        Output file ('-' for standard output).\n"
+    "    " _B "-a" B_ " " _U "attrs" U_ ", " _B "--attrs" B_ "=" _U "attrs" U_ "\n"
+    "        Comma-separated list of exported attributes ('id', attribute\n"
+    "        names, status names like 'lhsm.status'). Default is:\n"
+    "        " DEFAULT_ATTRS "\n"
+    "    " _B "--since" B_ "=" _U "date" U_ "|" _U "duration" U_ "\n"
+    "        Only export entries updated in DB since the given date\n"
+    "        (yyyymmdd[HH[MM[SS]]]), or for the given duration (e.g. 1d).\n"
+    "    " _B "--batch-size" B_ "=" _U "N" U_ "\n"
+    "        Number of rows per record batch (default: %u).\n"
+    "\n"
+    _B "Program options:" B_ "\n"
+    "    " _B "-f" B_ " " _U "config_file" U_ "\n"
+    "    " _B "-l" B_ " " _U "log_level" U_ "\n"
+    "    " _B "-j" B_ " " _U "N" U_ ", " _B "--threads" B_ " " _U "N" U_ "\n"
+    "        Read the database with N threads (and N DB connections).\n"
+    "    " _B "-h" B_ ", " _B "--help" B_ "\n"
+    "        Display a short help about command line options.\n"
+    "    " _B "-V" B_ ", " _B "--version" B_ "\n"
+    "        Display version info\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name, DEFAULT_BATCH_SIZE);
+}
+
+static inline void display_version(const char *bin_name)
+{
+    printf("\n");
+    printf("Product:         " PACKAGE_NAME " 'export' command\n");
+    printf("Version:         " PACKAGE_VERSION "-" RELEASE "\n");
+    printf("Build:           " COMPIL_DATE "\n");
+    printf("\n");
+    printf("Compilation switches:\n");
+
+/* Access by Fid ? */
+#ifdef _HAVE_FID
+    printf("    Address entries by FID\n");
+#else
+    printf("    Address entries by path\n");
+#endif
+
+    printf("\n");
+#ifdef _LUSTRE
+#ifdef LUSTRE_VERSION
+    printf("Lustre Version: " LUSTRE_VERSION "\n");
+#else
+    printf("Lustre FS support\n");
+#endif
+#else
+    printf("No Lustre support\n");
+#endif
+
+#ifdef _MYSQL
+    printf("Database binding: MySQL\n");
+#elif defined(_SQLITE)
+    printf("Database binding: SQLite\n");
+#else
+#error "No database was specified"
+#endif
+    printf("\n");
+    printf("Report bugs to: <" PACKAGE_BUGREPORT ">\n");
+    printf("\n");
+}
+
+#define MAX_OPT_LEN 1024
+
+/** parse --since argument: a date or a duration */
+static time_t parse_since(const char *arg)
+{
+    time_t t;
+    int d;
+
+    t = str2date(arg);
+    if (t != (time_t)-1)
+        return t;
+
+    d = str2duration(arg);
+    if (d == -1)
+        return (time_t)-1;
+    return time(NULL) - d;
+}
+
+int main(int argc, char **argv)
+{
+    int c, option_index = 0;
+    const char *bin;
+    char config_file[MAX_OPT_LEN] = "";
+    int rc;
+    bool chgd = false;
+    char err_msg[4096];
+    char badcfg[RBH_PATH_MAX];
+    FILE *out;
+
+    bin = rh_basename(argv[0]);
+
+    /* parse command line options */
+    while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
+                            &option_index)) != -1) {
+        switch (c) {
+        case 'o':
+            prog_options.output = optarg;
+            break;
+        case 'a':
+            prog_options.attrs = optarg;
+            break;
+        case SINCE_OPT:
+            prog_options.since = parse_since(optarg);
+            if (prog_options.since == (time_t)-1) {
+                fprintf(stderr, "invalid date or duration '%s': "
+                        "yyyymmdd[HH[MM[SS]]] or duration expected\n", optarg);
+                exit(1);
+            }
+            break;
+        case BATCH_SIZE_OPT:
+            prog_options.batch_size = str2int(optarg);
+            if (prog_options.batch_size == (unsigned int)-1
+                || prog_options.batch_size == 0) {
+                fprintf(stderr,
+                        "invalid batch size '%s': positive integer "
+                        "expected\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'f':
+            rh_strncpy(config_file, optarg, MAX_OPT_LEN);
+            break;
+        case 'j':
+            prog_options.threads = str2int(optarg);
+            if (prog_options.threads == (unsigned int)-1
+                || prog_options.threads == 0
+                || prog_options.threads > MAX_THREADS) {
+                fprintf(stderr,
+                        "invalid thread count '%s': integer between 1 and %u "
+                        "expected\n", optarg, MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'l':
+        {
+            int log_level = str2debuglevel(optarg);
+
+            if (log_level == -1) {
+                fprintf(stderr,
+                        "Unsupported log level '%s'. CRIT, MAJOR, EVENT, VERB, DEBUG or FULL expected.\n",
+                        optarg);
+                exit(1);
+            }
+            force_debug_level(log_level);
+            break;
+        }
+        case 'h':
+            display_help(bin);
+            exit(0);
+            break;
+        case 'V':
+            display_version(bin);
+            exit(0);
+            break;
+        case ':':
+        case '?':
+        default:
+            display_help(bin);
+            exit(1);
+            break;
+        }
+    }
+
+    if (prog_options.output == NULL) {
+        fprintf(stderr, "Missing output file (option -o)\n");
+        display_help(bin);
+        exit(1);
+    }
+
+    /* initialize internal resources (glib, llapi, internal resources...) */
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
+    /* get default config file, if not specified */
+    if (SearchConfig(config_file, config_file, &chgd, badcfg,
+                     MAX_OPT_LEN) != 0) {
+        fprintf(stderr, "No config file (or too many) found matching %s\n",
+                badcfg);
+        exit(2);
+    } else if (chgd) {
+        fprintf(stderr, "Using config file '%s'.\n", config_file);
+    }
+
+    /* only read common config (listmgr, ...) (mask=0) */
+    if (rbh_cfg_load(0, config_file, err_msg)) {
+        fprintf(stderr, "Error reading configuration file '%s': %s\n",
+                config_file, err_msg);
+        exit(1);
+    }
+
+    if (!log_config.force_debug_level)
+        log_config.debug_level = LVL_MAJOR; /* no event message */
+
+    /* Set logging to stderr */
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
+
+    /* Initialize logging */
+    rc = InitializeLogs(bin);
+    if (rc) {
+        fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
+                rc, errno, strerror(errno));
+        exit(rc);
+    }
+
+    /* Initialize list manager (report only) */
+    rc = ListMgr_Init(LIF_REPORT_ONLY);
+    if (rc) {
+        DisplayLog(LVL_CRIT, EXPORT_TAG,
+                   "Error initializing list manager: %s (%d)",
+                   lmgr_err2str(rc), rc);
+        exit(rc);
+    } else
+        DisplayLog(LVL_DEBUG, EXPORT_TAG,
+                   "ListManager successfully initialized");
+
+    /* status names are known after loading the config */
+    rc = parse_attrs(strdup(prog_options.attrs));
+    if (rc)
+        exit(-rc);
+
+    if (prog_options.since != 0) {
+        filter_value_t fv;
+
+        lmgr_simple_filter_init(&filter);
+        fv.value.val_uint = prog_options.since;
+        lmgr_simple_filter_add(&filter, ATTR_INDEX_md_update, MORETHAN, fv, 0);
+        filter_set = true;
+    }
+
+    if (!strcmp(prog_options.output, "-"))
+        out = stdout;
+    else {
+        out = fopen(prog_options.output, "w");
+        if (out == NULL) {
+            rc = errno;
+            DisplayLog(LVL_CRIT, EXPORT_TAG, "Cannot open %s for writing: %s",
+                       prog_options.output, strerror(rc));
+            exit(rc);
+        }
+    }
+
+    rc = export_entries(out);
+
+    if (out != stdout && fclose(out) && !rc) {
+        rc = errno;
+        DisplayLog(LVL_CRIT, EXPORT_TAG, "ERROR: failed to write to %s: %s",
+                   prog_options.output, strerror(rc));
+    }
+
+    if (filter_set)
+        lmgr_simple_filter_free(&filter);
+
+    return rc ? 1 : 0;
+}
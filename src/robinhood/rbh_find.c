@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/wait.h>
 
 #include "rbh_find.h"
 
@@ -44,6 +45,9 @@
 #define LSCLASS_OPT 262
 #define ESCAPED_OPT 263
 #define INAME_OPT   264
+#define UNORDERED_OPT 265
+#define PRINT0_OPT  266
+#define EXEC_JOBS_OPT 267
 
 static struct option option_tab[] = {
     {"user", required_argument, NULL, 'u'},
@@ -73,14 +77,18 @@ static struct option option_tab[] = {
 
     {"ls", no_argument, NULL, 'l'},
     {"print", no_argument, NULL, 'p'},
+    {"print0", no_argument, NULL, PRINT0_OPT},
     {"printf", required_argument, NULL, PRINTF_OPT},
     {"escaped", no_argument, NULL, ESCAPED_OPT},
     {"exec", required_argument, NULL, 'E'},
+    {"exec-jobs", required_argument, NULL, EXEC_JOBS_OPT},
     /* TODO dry-run mode for exec ? */
 
     /* query options */
     {"not", no_argument, NULL, '!'},
     {"nobulk", no_argument, NULL, 'b'},
+    {"threads", required_argument, NULL, 'j'},
+    {"unordered", no_argument, NULL, UNORDERED_OPT},
 
     /* config file options */
     {"config-file", required_argument, NULL, 'f'},
@@ -96,7 +104,7 @@ static struct option option_tab[] = {
 
 };
 
-#define SHORT_OPT_STRING    "lpOu:g:t:s:n:S:o:P:E:A:M:C:m:z:f:d:hV!bUGc:"
+#define SHORT_OPT_STRING    "lpOu:g:t:s:n:S:o:P:E:A:M:C:m:z:f:d:hV!bUGc:j:"
 
 #define TYPE_HELP "'f' (file), 'd' (dir), 'l' (symlink), 'b' (block), "\
                   "'c' (char), 'p' (named pipe/FIFO), 's' (socket)"
@@ -159,7 +167,14 @@ static int mkfilters(bool exclude_dirs)
         compare_value_t val;
 
         if (global_config.uid_gid_as_numbers) {
-            val.integer = atoi(prog_options.user);
+            db_type_u id;
+
+            /* the name is resolved, the filter compares ids */
+            if (set_uid_val(prog_options.user, &id)) {
+                fprintf(stderr, "Invalid user: %s\n", prog_options.user);
+                exit(1);
+            }
+            val.integer = id.val_int;
             if (prog_options.userneg)
                 comp = COMP_DIFF;
             else
@@ -183,7 +198,14 @@ static int mkfilters(bool exclude_dirs)
         compare_value_t val;
 
         if (global_config.uid_gid_as_numbers) {
-            val.integer = atoi(prog_options.group);
+            db_type_u id;
+
+            /* the name is resolved, the filter compares ids */
+            if (set_gid_val(prog_options.group, &id)) {
+                fprintf(stderr, "Invalid group: %s\n", prog_options.group);
+                exit(1);
+            }
+            val.integer = id.val_int;
             if (prog_options.groupneg)
                 comp = COMP_DIFF;
             else
@@ -440,6 +462,8 @@ static const char *help_string =
     "] \t Display status information (optionally: only for the given " _U
     "policy" U_ ").\n" "    " _B "-print" B_
     " \t Display the fullpath of matching entries (this is the default, unless -ls, -lsost or -exec are used).\n"
+    "    " _B "-print0" B_
+    " \t Display the fullpath of matching entries, followed by a null character.\n"
     "    " _B "-printf" B_
     " \t Format string to display the matching entries.\n\n"
     "       The supported escapes and directives are a subset of those of `find`,\n"
@@ -474,18 +498,31 @@ static const char *help_string =
     _B "%%Rm{lhsm.archive_id}" B_ ".\n" "            " _B "%%Ro" B_
     "\t Lustre OSTS\n" "            " _B "%%Rp" B_ "\t Lustre parent FID\n"
     "            " _B "\\\\" B_ "\t Escapes \\\n" "            " _B "\\n" B_
-    "\t Newline\n" "            " _B "\\t" B_ "\t Tab\n" "    " _B "-escaped" B_
+    "\t Newline\n" "            " _B "\\t" B_ "\t Tab\n"
+    "            " _B "\\0" B_ "\t Null character (to separate records)\n"
+    "    " _B "-escaped" B_
     " \t When -printf is used, escape unprintable characters.\n" "\n" _B
     "Actions:" B_ "\n" "    " _B "-exec" B_ " " _U "\"cmd\"" U_ "\n"
     "       Execute the given command for each matching entry. Unlike classical 'find',\n"
     "       cmd must be a single (quoted) shell param, not necessarily terminated with ';'.\n"
     "       '{}' is replaced by the entry path. Example: -exec 'md5sum {}'\n"
+    "       With 'cmd {} +', as many entries as possible are passed to each command.\n"
+    "    " _B "-exec-jobs" B_ " " _U "N" U_ "\n"
+    "       Run up to " _U "N" U_ " batched commands ('-exec cmd {} +') in parallel (default: 1).\n"
     "\n" _B "Behavior:" B_ "\n" "    " _B "-nobulk" B_ "\n"
     "       When running rbh-find on the filesystem root, rbh-find automatically switches\n"
     "       to bulk DB request instead of browsing the namespace from the DB.\n"
     "       This speeds up the query, but this may result in an arbitrary output ordering,\n"
     "       and a single path may be displayed in case of multiple hardlinks.\n"
-    "       Use -nobulk to disable this optimization.\n" "\n" _B
+    "       Use -nobulk to disable this optimization.\n"
+    "    " _B "-j" B_ " " _U "N" U_ ", " _B "-threads" B_ " " _U "N" U_ "\n"
+    "       Browse the namespace with N threads (and N DB connections).\n"
+    "       This does not apply to bulk DB requests (see -nobulk).\n"
+    "    " _B "-unordered" B_ "\n"
+    "       With -j, write the entries of each directory as soon as they are listed.\n"
+    "       By default, the output is written in namespace order (a directory is\n"
+    "       written before its subdirectories).\n"
+    "\n" _B
     "Program options:" B_ "\n" "    " _B "-f" B_ " " _U "config_file" U_ "\n"
     "    " _B "-d" B_ " " _U "log_level" U_ "\n"
     "       CRIT, MAJOR, EVENT, VERB, DEBUG, FULL\n" "    " _B "-h" B_ ", " _B
@@ -780,7 +817,204 @@ static int set_time_filter(char *str, unsigned int multiplier,
     return 0;
 }
 
-static void print_entry(const wagon_t *id, const attr_set_t *attrs)
+/* -exec 'cmd {} +': matching paths are appended to the command line,
+ * which is run once the argument list is full. */
+static struct exec_batch {
+    pthread_mutex_t lock;
+    char          **prefix;     /* arguments before {} */
+    unsigned int    prefix_cnt;
+    char          **suffix;     /* arguments after {} (without '+') */
+    unsigned int    suffix_cnt;
+
+    char          **paths;
+    unsigned int    path_cnt;
+    unsigned int    path_max;
+    size_t          size;       /* size of the current argument list */
+    size_t          max_size;
+
+    unsigned int    running;    /* number of running commands */
+    int             last_err;
+} batch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* max running batched commands (-exec-jobs) */
+static unsigned int exec_jobs = 1;
+
+/** size of an argument in the argument list of a command */
+static inline size_t arg_size(const char *arg)
+{
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+/**
+ * Check if an -exec command ends with "{} +", and prepare batching.
+ * @return true for a batched command.
+ */
+static bool exec_batch_init(char **cmd)
+{
+    extern char **environ;
+    unsigned int argc = g_strv_length(cmd);
+    unsigned int i, brace = argc;
+    long arg_max;
+    size_t fixed = 0;
+
+    if (argc < 3 || strcmp(cmd[argc - 1], "+") != 0)
+        return false;
+
+    for (i = 1; i < argc - 1; i++)
+        if (!strcmp(cmd[i], "{}")) {
+            brace = i;
+            break;
+        }
+    if (brace == argc)
+        return false;
+
+    batch.prefix = cmd;
+    batch.prefix_cnt = brace;
+    batch.suffix = cmd + brace + 1;
+    batch.suffix_cnt = argc - brace - 2;
+
+    for (i = 0; i < argc; i++)
+        if (i != brace && i != argc - 1)
+            fixed += arg_size(cmd[i]);
+
+    /* same margins as xargs: environment and 2kB of headroom */
+    for (i = 0; environ[i] != NULL; i++)
+        fixed += arg_size(environ[i]);
+
+    arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0)
+        arg_max = 128 * 1024;   /* POSIX min is 4kB, Linux min 128kB */
+
+    if (fixed + 2048 + 4096 > arg_max)
+        batch.max_size = 4096;
+    else
+        batch.max_size = arg_max - fixed - 2048;
+
+    return true;
+}
+
+/** wait for a batched command to terminate (called with batch.lock) */
+static void exec_batch_wait(void)
+{
+    int status;
+    pid_t pid;
+
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+        DisplayLog(LVL_MAJOR, FIND_TAG, "waitpid failed: %s",
+                   strerror(errno));
+        batch.running = 0;
+        return;
+    }
+    batch.running--;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        DisplayLog(LVL_DEBUG, FIND_TAG, "Command exited with status %d",
+                   WEXITSTATUS(status));
+        batch.last_err = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        DisplayLog(LVL_MAJOR, FIND_TAG, "Command killed by signal %d",
+                   WTERMSIG(status));
+        batch.last_err = EINTR;
+    }
+}
+
+/** run the command for the current path list (called with batch.lock) */
+static void exec_batch_run(void)
+{
+    GError *err = NULL;
+    char **argv;
+    unsigned int i, n = 0;
+    GPid pid;
+
+    if (batch.path_cnt == 0)
+        return;
+
+    argv = MemCalloc(batch.prefix_cnt + batch.path_cnt + batch.suffix_cnt
+                     + 1, sizeof(char *));
+    if (argv == NULL) {
+        batch.last_err = ENOMEM;
+        goto free_paths;
+    }
+
+    for (i = 0; i < batch.prefix_cnt; i++)
+        argv[n++] = batch.prefix[i];
+    for (i = 0; i < batch.path_cnt; i++)
+        argv[n++] = batch.paths[i];
+    for (i = 0; i < batch.suffix_cnt; i++)
+        argv[n++] = batch.suffix[i];
+    argv[n] = NULL;
+
+    while (batch.running >= exec_jobs)
+        exec_batch_wait();
+
+    /* the command output must come after the previous entries */
+    output_flush();
+    fflush(stdout);
+
+    if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH
+                       | G_SPAWN_DO_NOT_REAP_CHILD
+                       | G_SPAWN_CHILD_INHERITS_STDIN, NULL, NULL, &pid,
+                       &err)) {
+        DisplayLog(LVL_MAJOR, FIND_TAG, "Failed to run '%s': %s", argv[0],
+                   err->message);
+        g_error_free(err);
+        batch.last_err = ENOEXEC;
+    } else
+        batch.running++;
+
+    MemFree(argv);
+
+ free_paths:
+    for (i = 0; i < batch.path_cnt; i++)
+        free(batch.paths[i]);
+    batch.path_cnt = 0;
+    batch.size = 0;
+}
+
+/** add a path to the batched command */
+static void exec_batch_add(const char *path)
+{
+    size_t sz = arg_size(path);
+
+    P(batch.lock);
+    if (batch.path_cnt > 0 && batch.size + sz > batch.max_size)
+        exec_batch_run();
+
+    if (batch.path_cnt == batch.path_max) {
+        unsigned int new_max = batch.path_max ? 2 * batch.path_max : 1024;
+        char **p = MemRealloc(batch.paths, new_max * sizeof(char *));
+
+        if (p == NULL) {
+            batch.last_err = ENOMEM;
+            V(batch.lock);
+            return;
+        }
+        batch.paths = p;
+        batch.path_max = new_max;
+    }
+    batch.paths[batch.path_cnt++] = strdup(path);
+    batch.size += sz;
+    V(batch.lock);
+}
+
+/** run the remaining paths and wait for all commands */
+static int exec_batch_finish(void)
+{
+    P(batch.lock);
+    exec_batch_run();
+    while (batch.running > 0)
+        exec_batch_wait();
+    V(batch.lock);
+
+    MemFree(batch.paths);
+    return batch.last_err;
+}
+
+static void print_entry(FILE *out, const wagon_t *id,
+                        const attr_set_t *attrs)
 {
     char classbuf[1024] = "";
     char statusbuf[1024] = "";
@@ -888,10 +1122,8 @@ static void print_entry(const wagon_t *id, const attr_set_t *attrs)
         mode_string(ATTR(attrs, mode), mode_str);
 
         if (global_config.uid_gid_as_numbers) {
-            sprintf(uid_str, "%d", ATTR(attrs, uid).num);
-            uid = uid_str;
-            sprintf(gid_str, "%d", ATTR(attrs, gid).num);
-            gid = gid_str;
+            uid = uid2name(ATTR(attrs, uid).num, uid_str, sizeof(uid_str));
+            gid = gid2name(ATTR(attrs, gid).num, gid_str, sizeof(gid_str));
         } else {
             uid = ATTR(attrs, uid).txt;
             gid = ATTR(attrs, gid).txt;
@@ -911,17 +1143,18 @@ static void print_entry(const wagon_t *id, const attr_set_t *attrs)
             && ATTR_MASK_TEST(attrs, link))
             /* display: id, type, mode, nlink, (status,) owner, group, size,
              *          mtime, path -> link */
-            printf(DFID " %-4s %s %3u  %-10s %-10s %15" PRIu64
-                   " %20s %s%s%s -> %s\n", PFID(&id->id), type, mode_str,
-                   ATTR(attrs, nlink), uid, gid, ATTR(attrs, size), date_str,
-                   statusbuf, classbuf, id->fullname, ATTR(attrs, link));
+            fprintf(out, DFID " %-4s %s %3u  %-10s %-10s %15" PRIu64
+                    " %20s %s%s%s -> %s\n", PFID(&id->id), type, mode_str,
+                    ATTR(attrs, nlink), uid, gid, ATTR(attrs, size), date_str,
+                    statusbuf, classbuf, id->fullname, ATTR(attrs, link));
         else
             /* display all: id, type, mode, nlink, (status,) owner, group,
              *              size, mtime, path */
-            printf(DFID " %-4s %s %3u  %-10s %-10s %15" PRIu64
-                   " %20s %s%s%s%s\n", PFID(&id->id), type, mode_str,
-                   ATTR(attrs, nlink), uid, gid, ATTR(attrs, size), date_str,
-                   statusbuf, classbuf, id->fullname, osts ? osts->str : "");
+            fprintf(out, DFID " %-4s %s %3u  %-10s %-10s %15" PRIu64
+                    " %20s %s%s%s%s\n", PFID(&id->id), type, mode_str,
+                    ATTR(attrs, nlink), uid, gid, ATTR(attrs, size), date_str,
+                    statusbuf, classbuf, id->fullname,
+                    osts ? osts->str : "");
     } else if (prog_options.lsost || prog_options.lsclass
                || prog_options.lsstatus) {
         /* lsost or lsclass without -ls */
@@ -934,21 +1167,38 @@ static void print_entry(const wagon_t *id, const attr_set_t *attrs)
             type = type2char(ATTR(attrs, type));
 
         /* display: id, type, size, path */
-        printf(DFID " %-4s %15" PRIu64 " %s%s%s%s\n",
-               PFID(&id->id), type, ATTR(attrs, size), statusbuf, classbuf,
-               id->fullname, osts ? osts->str : "");
+        fprintf(out, DFID " %-4s %15" PRIu64 " %s%s%s%s\n",
+                PFID(&id->id), type, ATTR(attrs, size), statusbuf, classbuf,
+                id->fullname, osts ? osts->str : "");
 
     } else if (prog_options.print) {
         /* just display name */
-        if (id->fullname)
-            printf("%s\n", id->fullname);
-        else
-            printf(DFID "\n", PFID(&id->id));
+        const char sep = prog_options.print0 ? '\0' : '\n';
+
+        if (id->fullname) {
+            output_append(out, id->fullname, strlen(id->fullname));
+        } else {
+            char fid_str[RBH_FID_LEN + 2];
+            int len;
+
+            len = snprintf(fid_str, sizeof(fid_str), DFID, PFID(&id->id));
+            output_append(out, fid_str, len);
+        }
+        output_append(out, &sep, 1);
     } else if (prog_options.printf) {
-        printf_entry(printf_chunks, id, attrs);
+        printf_entry(out, printf_chunks, id, attrs);
     }
 
-    if (prog_options.exec) {
+    if (prog_options.exec_batch) {
+        if (id->fullname) {
+            exec_batch_add(id->fullname);
+        } else {
+            char fid_str[RBH_FID_LEN + 2];
+
+            snprintf(fid_str, sizeof(fid_str), DFID, PFID(&id->id));
+            exec_batch_add(fid_str);
+        }
+    } else if (prog_options.exec) {
         const char *vars[] = {
             "", id->fullname,
             NULL, NULL
@@ -959,6 +1209,9 @@ static void print_entry(const wagon_t *id, const attr_set_t *attrs)
         rc = subst_shell_params(prog_options.exec_cmd, "exec option",
                                 &id->id, attrs, NULL, vars, NULL, true, &cmd);
         if (!rc) {
+            /* the command output must come after the previous entries */
+            output_flush();
+            fflush(out);
             /* display both stdout and stderr */
             execute_shell_command(cmd, cb_redirect_all, NULL);
             g_strfreev(cmd);
@@ -968,9 +1221,9 @@ static void print_entry(const wagon_t *id, const attr_set_t *attrs)
         g_string_free(osts, TRUE);
 }
 
-/* directory callback */
-static int dircb(wagon_t *id_list, attr_set_t *attr_list,
-                 unsigned int entry_count, void *dummy)
+/** print matching directories and their child entries */
+static int list_dirs(lmgr_t *p_mgr, FILE *out, wagon_t *id_list,
+                     attr_set_t *attr_list, unsigned int entry_count)
 {
     /* retrieve child entries for all directories */
     int i, rc;
@@ -989,11 +1242,11 @@ static int dircb(wagon_t *id_list, attr_set_t *attr_list,
             /* don't display dirs if no_dir is specified */
             if (!(prog_options.no_dir && ATTR_MASK_TEST(&attr_list[i], type)
                   && !strcasecmp(ATTR(&attr_list[i], type), STR_TYPE_DIR)))
-                print_entry(&id_list[i], &attr_list[i]);
+                print_entry(out, &id_list[i], &attr_list[i]);
         }
 
         if (!prog_options.dir_only) {
-            rc = ListMgr_GetChild(&lmgr, &entry_filter, id_list + i, 1,
+            rc = ListMgr_GetChild(p_mgr, &entry_filter, id_list + i, 1,
                                   attr_mask_or(&disp_mask, &query_mask),
                                   &chids, &chattrs, &chcount);
             if (rc) {
@@ -1007,7 +1260,7 @@ static int dircb(wagon_t *id_list, attr_set_t *attr_list,
                                                &match_expr, NULL,
                                                prog_options.filter_smi)
                                  == POLICY_MATCH))
-                    print_entry(&chids[j], &chattrs[j]);
+                    print_entry(out, &chids[j], &chattrs[j]);
 
                 ListMgr_FreeAttrs(&chattrs[j]);
             }
@@ -1020,6 +1273,25 @@ static int dircb(wagon_t *id_list, attr_set_t *attr_list,
     return 0;
 }
 
+/* directory callback */
+static int dircb(wagon_t *id_list, attr_set_t *attr_list,
+                 unsigned int entry_count, void *dummy)
+{
+    return list_dirs(&lmgr, stdout, id_list, attr_list, entry_count);
+}
+
+/* directory callback for parallel scrubbing */
+static int dircb_par(lmgr_t *p_mgr, wagon_t *id_list, attr_set_t *attr_list,
+                     unsigned int entry_count, FILE *out, void *dummy)
+{
+    int rc;
+
+    rc = list_dirs(p_mgr, out, id_list, attr_list, entry_count);
+    /* out is only valid during the callback */
+    output_flush();
+    return rc;
+}
+
 /**
  *  Get id of root dir
  */
@@ -1043,6 +1315,7 @@ static int list_bulk(void)
     int rc;
     struct stat st;
     struct lmgr_iterator_t *it;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
 
     /* no transversal => no wagon
      * so we need the path from the DB.
@@ -1078,12 +1351,14 @@ static int list_bulk(void)
             wagon_t w;
             w.id = root_id;
             w.fullname = ATTR(&root_attrs, fullpath);
-            print_entry(&w, &root_attrs);
+            print_entry(stdout, &w, &root_attrs);
         }
     }
 
-    /* list all, including dirs */
-    it = ListMgr_Iterator(&lmgr, &entry_filter, NULL, NULL);
+    /* list all, including dirs.
+     * The result may not fit in memory: stream it. */
+    opt.stream = 1;
+    it = ListMgr_Iterator(&lmgr, &entry_filter, NULL, &opt);
     if (!it) {
         DisplayLog(LVL_MAJOR, FIND_TAG,
                    "ERROR: cannot retrieve entry list from database");
@@ -1101,7 +1376,7 @@ static int list_bulk(void)
                 wagon_t w;
                 w.id = id;
                 w.fullname = ATTR(&attrs, fullpath);
-                print_entry(&w, &attrs);
+                print_entry(stdout, &w, &attrs);
             }
             /* don't display non dirs is dir_only is specified */
             else if (!(prog_options.dir_only && ATTR_MASK_TEST(&attrs, type)
@@ -1109,7 +1384,7 @@ static int list_bulk(void)
                 wagon_t w;
                 w.id = id;
                 w.fullname = ATTR(&attrs, fullpath);
-                print_entry(&w, &attrs);
+                print_entry(stdout, &w, &attrs);
             } else
                 /* return entry don't match? */
                 DisplayLog(LVL_DEBUG, FIND_TAG,
@@ -1229,8 +1504,22 @@ static int list_contents(char **id_list, int id_count)
             dircb(&ids[i], &root_attrs, 1, NULL);
         }
 
-        rc = rbh_scrub(&lmgr, &ids[i], 1, attr_mask_or(&disp_mask, &query_mask),
-                       dircb, NULL);
+        if (prog_options.threads > 1) {
+            struct par_scrub_opt opt = {
+                .nb_threads = prog_options.threads,
+                .output = stdout,
+                .ordered = !prog_options.unordered,
+            };
+
+            /* write the entries printed by this thread first */
+            output_flush();
+
+            rc = rbh_scrub_parallel(&ids[i], 1,
+                                    attr_mask_or(&disp_mask, &query_mask),
+                                    dircb_par, &opt);
+        } else
+            rc = rbh_scrub(&lmgr, &ids[i], 1,
+                           attr_mask_or(&disp_mask, &query_mask), dircb, NULL);
     }
 
  out:
@@ -1514,6 +1803,15 @@ int main(int argc, char **argv)
             }
             break;
 
+        case PRINT0_OPT:
+            prog_options.print = 1;
+            prog_options.print0 = 1;
+            if (neg) {
+                fprintf(stderr, "! (-not) unexpected before -print0 option\n");
+                exit(1);
+            }
+            break;
+
         case PRINTF_OPT:
             prog_options.print = 0;
             prog_options.printf = 1;
@@ -1537,9 +1835,21 @@ int main(int argc, char **argv)
                 g_error_free(err_desc);
                 exit(1);
             }
+            prog_options.exec_batch =
+                exec_batch_init(prog_options.exec_cmd);
             prog_options.print = 0;
             break;
 
+        case EXEC_JOBS_OPT:
+            exec_jobs = str2int(optarg);
+            if (exec_jobs == (unsigned int)-1 || exec_jobs == 0) {
+                fprintf(stderr,
+                        "invalid job count '%s': positive integer "
+                        "expected\n", optarg);
+                exit(1);
+            }
+            break;
+
         case 'f':
             rh_strncpy(config_file, optarg, MAX_OPT_LEN);
             if (neg) {
@@ -1569,6 +1879,21 @@ int main(int argc, char **argv)
             prog_options.bulk = force_nobulk;
             break;
 
+        case 'j':
+            prog_options.threads = str2int(optarg);
+            if (prog_options.threads == (unsigned int)-1
+                || prog_options.threads == 0) {
+                fprintf(stderr,
+                        "invalid thread count '%s': positive integer "
+                        "expected\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case UNORDERED_OPT:
+            prog_options.unordered = 1;
+            break;
+
         case 'h':
             display_help(bin);
             exit(0);
@@ -1696,7 +2021,11 @@ int main(int argc, char **argv)
             DisplayLog(LVL_DEBUG, FIND_TAG,
                        "Optimization: switching to bulk DB request mode");
             mkfilters(false);   /* keep dirs */
-            return list_bulk();
+            rc = list_bulk();
+            output_flush();
+            if (prog_options.exec_batch && exec_batch_finish() && !rc)
+                rc = 1;
+            return rc;
         } else {
             char *id = global_config.fs_path;
             mkfilters(true);    /* exclude dirs */
@@ -1707,6 +2036,9 @@ int main(int argc, char **argv)
         mkfilters(true);    /* exclude dirs */
         rc = list_contents(argv + optind, argc - optind);
     }
+    output_flush();
+    if (prog_options.exec_batch && exec_batch_finish() && !rc)
+        rc = 1;
 
     ListMgr_CloseAccess(&lmgr);
 
@@ -63,14 +63,19 @@ struct find_opt {
         force_nobulk
     } bulk;
 
+    /* number of threads for namespace traversal */
+    unsigned int    threads;
+
     /* output flags */
     unsigned int ls:1;
     unsigned int lsost:1;
     unsigned int lsclass:1;
     unsigned int lsstatus:1;
     unsigned int print:1;
+    unsigned int print0:1;
     unsigned int printf:1;
     unsigned int escaped:1;
+    unsigned int unordered:1;
 
     /* condition flags */
     unsigned int match_user:1;
@@ -105,6 +110,7 @@ struct find_opt {
 
     /* actions */
     unsigned int exec:1;
+    unsigned int exec_batch:1;  /* -exec 'cmd {} +' */
 
 };
 extern struct find_opt prog_options;
@@ -113,8 +119,13 @@ const char *type2char(const char *type);
 const char type2onechar(const char *type);
 
 GArray *prepare_printf_format(const char *format);
-void printf_entry(GArray *chunks, const wagon_t *id,
+void printf_entry(FILE *out, GArray *chunks, const wagon_t *id,
                   const attr_set_t *attrs);
 void free_printf_formats(GArray *chunks);
 
+/** append data to the output buffer of the current thread */
+void output_append(FILE *out, const char *data, size_t len);
+/** write the output buffer of the current thread */
+void output_flush(void);
+
 #endif
@@ -56,6 +56,18 @@ struct fchunk {
      * option. */
     GString *time_format;
 
+    /* position of the directive in 'format' */
+    size_t spec_start;
+    size_t spec_end;
+
+    /* Precompiled chunk: literal text before and after the directive
+     * (with "%%" resolved), the directive alone (e.g. "%-20s"), and
+     * whether it has no field width. */
+    GString *pre;
+    GString *spec;
+    GString *post;
+    bool plain;
+
     /* For directives that refer to a status module attribute (for
      * instance "%R{lhsm.archive_id}"). */
     const sm_instance_t *smi;
@@ -70,12 +82,12 @@ struct fchunk {
 
 /* Escape a file name to create a valid string. Valid filenames
  * characters are all except NULL and /. But not everything else is
- * printable. This function returns a statically allocated string
+ * printable. This function returns a per-thread allocated string
  * which will be overwritten by subsequent calls. */
 static const char *escape_name(const char *fullname)
 {
     const unsigned char *src = (const unsigned char *)fullname;
-    static GString *dest;
+    static __thread GString *dest;
 
     if (dest == NULL)
         dest = g_string_sized_new(100);
@@ -238,6 +250,11 @@ static const char *extract_chunk(const char *str, struct fchunk *chunk)
                     g_string_append_c(chunk->format, '\t');
                     break;
 
+                case '0':
+                    /* NUL separated records */
+                    g_string_append_c(chunk->format, '\0');
+                    break;
+
                 case 0:
                     DisplayLog(LVL_CRIT, FIND_TAG,
                                "Error: lone \\ at end of format string");
@@ -278,6 +295,7 @@ static const char *extract_chunk(const char *str, struct fchunk *chunk)
         }
 
         /* Found a new directive */
+        chunk->spec_start = chunk->format->len;
         g_string_append_c(chunk->format, '%');
         str = extract_field_width(str, chunk->format);
         if (str == NULL) {
@@ -322,10 +340,8 @@ static const char *extract_chunk(const char *str, struct fchunk *chunk)
 
         case 'g':
             disp_mask.std |= ATTR_MASK_gid;
-            if (global_config.uid_gid_as_numbers)
-                g_string_append_c(chunk->format, 'd');
-            else
-                g_string_append_c(chunk->format, 's');
+            /* numeric ids are resolved to names */
+            g_string_append_c(chunk->format, 's');
             break;
 
         case 'M':
@@ -361,10 +377,8 @@ static const char *extract_chunk(const char *str, struct fchunk *chunk)
 
         case 'u':
             disp_mask.std |= ATTR_MASK_uid;
-            if (global_config.uid_gid_as_numbers)
-                g_string_append_c(chunk->format, 'd');
-            else
-                g_string_append_c(chunk->format, 's');
+            /* numeric ids are resolved to names */
+            g_string_append_c(chunk->format, 's');
             break;
 
         case 'Y':
@@ -479,6 +493,7 @@ static const char *extract_chunk(const char *str, struct fchunk *chunk)
                        *str);
             return NULL;
         }
+        chunk->spec_end = chunk->format->len;
 
         str++;
     }
@@ -486,83 +501,234 @@ static const char *extract_chunk(const char *str, struct fchunk *chunk)
     return str;
 }
 
-static void printf_date(const struct fchunk *chunk, time_t date)
+/* Append literal text of a format to a string, resolving "%%". */
+static void append_literal(GString *dest, const char *src, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        g_string_append_c(dest, src[i]);
+        if (src[i] == '%' && i + 1 < len && src[i + 1] == '%')
+            i++;
+    }
+}
+
+/* Split a chunk format into its literal parts and its directive. */
+static void compile_chunk(struct fchunk *chunk)
+{
+    const char *fmt = chunk->format->str;
+
+    if (!chunk->directive)
+        chunk->spec_start = chunk->spec_end = chunk->format->len;
+
+    chunk->pre = g_string_sized_new(chunk->spec_start + 1);
+    append_literal(chunk->pre, fmt, chunk->spec_start);
+
+    chunk->spec = g_string_new_len(fmt + chunk->spec_start,
+                                   chunk->spec_end - chunk->spec_start);
+
+    chunk->post = g_string_sized_new(chunk->format->len - chunk->spec_end + 1);
+    append_literal(chunk->post, fmt + chunk->spec_end,
+                   chunk->format->len - chunk->spec_end);
+
+    chunk->plain = chunk->spec->len > 1 && chunk->spec->str[1] != '-'
+        && !isdigit(chunk->spec->str[1]);
+}
+
+/* ---- buffered output ---- */
+
+/* Entries are formatted in a per-thread buffer, which is written
+ * when it gets bigger than OUTPUT_BUF_SIZE or by output_flush(). */
+#define OUTPUT_BUF_SIZE (64 * 1024)
+
+static __thread GString *output_buffer;
+static __thread FILE *output_stream;
+
+void output_flush(void)
+{
+    if (output_buffer == NULL || output_buffer->len == 0)
+        return;
+
+    fwrite(output_buffer->str, 1, output_buffer->len, output_stream);
+    g_string_truncate(output_buffer, 0);
+}
+
+/** get the output buffer of the current thread for the given stream */
+static GString *output_get(FILE *out)
+{
+    if (output_buffer == NULL)
+        output_buffer = g_string_sized_new(OUTPUT_BUF_SIZE);
+    else if (output_stream != out)
+        output_flush();
+
+    output_stream = out;
+    return output_buffer;
+}
+
+static inline void output_check(void)
+{
+    if (output_buffer->len >= OUTPUT_BUF_SIZE)
+        output_flush();
+}
+
+void output_append(FILE *out, const char *data, size_t len)
+{
+    g_string_append_len(output_get(out), data, len);
+    output_check();
+}
+
+static void append_ull(GString *buf, unsigned long long val)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+
+    do {
+        *--p = '0' + val % 10;
+        val /= 10;
+    } while (val);
+
+    g_string_append_len(buf, p, tmp + sizeof(tmp) - p);
+}
+
+static void append_ll(GString *buf, long long val)
+{
+    if (val < 0) {
+        g_string_append_c(buf, '-');
+        append_ull(buf, -(unsigned long long)val);
+    } else
+        append_ull(buf, val);
+}
+
+/* Emitters for the value of a directive. Plain directives (no field
+ * width) are appended directly, without parsing a printf format. */
+
+static inline void emit_str(GString *buf, const struct fchunk *chunk,
+                            const char *val)
+{
+    if (chunk->plain)
+        g_string_append(buf, val);
+    else
+        g_string_append_printf(buf, chunk->spec->str, val);
+}
+
+static inline void emit_uint(GString *buf, const struct fchunk *chunk,
+                             unsigned int val)
+{
+    if (chunk->plain)
+        append_ull(buf, val);
+    else
+        g_string_append_printf(buf, chunk->spec->str, val);
+}
+
+static inline void emit_int(GString *buf, const struct fchunk *chunk, int val)
+{
+    if (chunk->plain)
+        append_ll(buf, val);
+    else
+        g_string_append_printf(buf, chunk->spec->str, val);
+}
+
+/* for "%zu" directives */
+static inline void emit_size(GString *buf, const struct fchunk *chunk,
+                             unsigned long long val)
+{
+    if (chunk->plain)
+        append_ull(buf, val);
+    else
+        g_string_append_printf(buf, chunk->spec->str, (size_t)val);
+}
+
+static inline void emit_char(GString *buf, const struct fchunk *chunk,
+                             char val)
+{
+    if (chunk->plain)
+        g_string_append_c(buf, val);
+    else
+        g_string_append_printf(buf, chunk->spec->str, val);
+}
+
+static void emit_date(GString *buf, const struct fchunk *chunk, time_t date)
 {
     char str[1000];
-    struct tm *tmp;
+    struct tm stm;
     size_t sret;
 
-    tmp = localtime(&date);
-    if (tmp == NULL) {
-        printf("(none)");
+    if (localtime_r(&date, &stm) == NULL) {
+        g_string_append(buf, "(none)");
         return;
     }
 
     if (chunk->time_format)
-        sret = strftime(str, sizeof(str), chunk->time_format->str, tmp);
+        sret = strftime(str, sizeof(str), chunk->time_format->str, &stm);
     else
-        sret = strftime(str, sizeof(str), chunk->format->str, tmp);
+        sret = strftime(str, sizeof(str), chunk->spec->str, &stm);
 
     if (sret >= sizeof(str) - 1) {
         /* Overflow. 1000 bytes should be big enough for that to never
          * happen in any locale. */
-        printf("(date output truncated)");
+        g_string_append(buf, "(date output truncated)");
     } else if (sret == 0) {
         /* According to the man page, a return of 0 is either an error
          * or an empty string. In both cases, don't print anything. */
     } else {
         if (chunk->time_format)
-            printf(chunk->format->str, str);
+            emit_str(buf, chunk, str);
         else
-            printf("%s", str);
+            g_string_append(buf, str);
     }
 }
 
 /**
  * Output the desired information for one file.
  */
-void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
+void printf_entry(FILE *out, GArray *chunks, const wagon_t *id,
+                  const attr_set_t *attrs)
 {
+    GString *buf = output_get(out);
     int i;
 
     for (i = 0; i < chunks->len; i++) {
         struct fchunk *chunk = &g_array_index(chunks, struct fchunk, i);
-        const char *format = chunk->format->str;
+
+        g_string_append_len(buf, chunk->pre->str, chunk->pre->len);
 
         switch (chunk->directive) {
         case 0:
-            printf(format);
             break;
 
         case 'A':
-            printf_date(chunk, ATTR(attrs, last_access));
+            emit_date(buf, chunk, ATTR(attrs, last_access));
             break;
 
         case 'b':
-            printf(format, ATTR(attrs, blocks));
+            emit_size(buf, chunk, ATTR(attrs, blocks));
             break;
 
         case 'C':
-            printf_date(chunk, ATTR(attrs, last_mdchange));
+            emit_date(buf, chunk, ATTR(attrs, last_mdchange));
             break;
 
         case 'd':
-            printf(format, ATTR(attrs, depth));
+            emit_uint(buf, chunk, ATTR(attrs, depth));
             break;
 
         case 'f':
-            printf(format, ATTR(attrs, name));
+            emit_str(buf, chunk, ATTR(attrs, name));
             break;
 
         case 'g':
-            if (global_config.uid_gid_as_numbers)
-                printf(format, ATTR(attrs, gid).num);
-            else
-                printf(format, ATTR(attrs, gid).txt);
+            if (global_config.uid_gid_as_numbers) {
+                char tmp[20];
+
+                emit_str(buf, chunk, gid2name(ATTR(attrs, gid).num, tmp,
+                                              sizeof(tmp)));
+            } else
+                emit_str(buf, chunk, ATTR(attrs, gid).txt);
             break;
 
         case 'm':
-            printf(format, ATTR(attrs, mode));
+            /* octal */
+            g_string_append_printf(buf, chunk->spec->str, ATTR(attrs, mode));
             break;
 
         case 'M':
@@ -572,34 +738,37 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                 mode_str[9] = 0;
                 mode_string(ATTR(attrs, mode), mode_str);
 
-                printf(format, mode_str);
+                emit_str(buf, chunk, mode_str);
             }
             break;
 
         case 'n':
-            printf(format, ATTR(attrs, nlink));
+            emit_uint(buf, chunk, ATTR(attrs, nlink));
             break;
 
         case 'p':
             if (prog_options.escaped)
-                printf(format, escape_name(id->fullname));
+                emit_str(buf, chunk, escape_name(id->fullname));
             else
-                printf(format, id->fullname);
+                emit_str(buf, chunk, id->fullname);
             break;
 
         case 's':
-            printf(format, ATTR(attrs, size));
+            emit_size(buf, chunk, ATTR(attrs, size));
             break;
 
         case 'T':
-            printf_date(chunk, ATTR(attrs, last_mod));
+            emit_date(buf, chunk, ATTR(attrs, last_mod));
             break;
 
         case 'u':
-            if (global_config.uid_gid_as_numbers)
-                printf(format, ATTR(attrs, uid).num);
-            else
-                printf(format, ATTR(attrs, uid).txt);
+            if (global_config.uid_gid_as_numbers) {
+                char tmp[20];
+
+                emit_str(buf, chunk, uid2name(ATTR(attrs, uid).num, tmp,
+                                              sizeof(tmp)));
+            } else
+                emit_str(buf, chunk, ATTR(attrs, uid).txt);
             break;
 
         case 'Y':
@@ -611,7 +780,7 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                 else
                     type = type2char(ATTR(attrs, type));
 
-                printf(format, type);
+                emit_str(buf, chunk, type);
             }
             break;
 
@@ -624,7 +793,7 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                 else
                     type = type2onechar(ATTR(attrs, type));
 
-                printf(format, type);
+                emit_char(buf, chunk, type);
             }
             break;
 
@@ -632,13 +801,13 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
             /* Robinhood specifiers */
             switch (chunk->sub_directive) {
             case 'C':
-                printf_date(chunk, ATTR(attrs, creation_time));
+                emit_date(buf, chunk, ATTR(attrs, creation_time));
                 break;
 
             case 'c':
-                printf(format,
-                       class_format(ATTR_MASK_TEST(attrs, fileclass) ?
-                                    ATTR(attrs, fileclass) : NULL));
+                emit_str(buf, chunk,
+                         class_format(ATTR_MASK_TEST(attrs, fileclass) ?
+                                      ATTR(attrs, fileclass) : NULL));
                 break;
 
             case 'f':
@@ -646,7 +815,7 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                     char fid_str[RBH_FID_LEN];
 
                     sprintf(fid_str, DFID_NOBRACE, PFID(&id->id));
-                    printf(format, fid_str);
+                    emit_str(buf, chunk, fid_str);
                 }
                 break;
 
@@ -655,28 +824,28 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                                         chunk->rel_sm_info_index)) {
                     switch (chunk->def->db_type) {
                     case DB_UINT:
-                        printf(format,
-                               *(unsigned int *)SMI_INFO(attrs, chunk->smi,
-                                                         chunk->
-                                                         rel_sm_info_index));
+                        emit_uint(buf, chunk,
+                                  *(unsigned int *)SMI_INFO(attrs, chunk->smi,
+                                                            chunk->
+                                                            rel_sm_info_index));
                         break;
 
                     case DB_INT:
-                        printf(format,
-                               *(int *)SMI_INFO(attrs, chunk->smi,
-                                                chunk->rel_sm_info_index));
+                        emit_int(buf, chunk,
+                                 *(int *)SMI_INFO(attrs, chunk->smi,
+                                                  chunk->rel_sm_info_index));
                         break;
 
                     case DB_BOOL:
-                        printf(format,
-                               *(bool *)SMI_INFO(attrs, chunk->smi,
-                                                 chunk->rel_sm_info_index));
+                        emit_uint(buf, chunk,
+                                  *(bool *)SMI_INFO(attrs, chunk->smi,
+                                                    chunk->rel_sm_info_index));
                         break;
 
                     case DB_TEXT:
-                        printf(format,
-                               SMI_INFO(attrs, chunk->smi,
-                                        chunk->rel_sm_info_index));
+                        emit_str(buf, chunk,
+                                 SMI_INFO(attrs, chunk->smi,
+                                          chunk->rel_sm_info_index));
                         break;
 
                     default:
@@ -686,11 +855,11 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                     switch (chunk->def->db_type) {
                     case DB_UINT:
                     case DB_INT:
-                        printf(format, 0);
+                        emit_int(buf, chunk, 0);
                         break;
 
                     case DB_TEXT:
-                        printf(format, "[n/a]");
+                        emit_str(buf, chunk, "[n/a]");
                         break;
 
                     default:
@@ -706,7 +875,7 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                     GString *osts = g_string_new("");
 
                     append_stripe_list(osts, &ATTR(attrs, stripe_items), true);
-                    printf(format, osts->str);
+                    emit_str(buf, chunk, osts->str);
                     g_string_free(osts, TRUE);
                 }
                 break;
@@ -717,7 +886,7 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
 
                     sprintf(fid_str, DFID_NOBRACE,
                             PFID(&ATTR(attrs, parent_id)));
-                    printf(format, fid_str);
+                    emit_str(buf, chunk, fid_str);
 
                     break;
                 }
@@ -728,9 +897,9 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
                     unsigned int smi_index = chunk->smi->smi_index;
 
                     if (ATTR_MASK_STATUS_TEST(attrs, smi_index))
-                        printf(format, STATUS_ATTR(attrs, smi_index));
+                        emit_str(buf, chunk, STATUS_ATTR(attrs, smi_index));
                     else
-                        printf(format, "[n/a]");
+                        emit_str(buf, chunk, "[n/a]");
 
                     break;
                 }
@@ -738,7 +907,11 @@ void printf_entry(GArray *chunks, const wagon_t *id, const attr_set_t *attrs)
             }
             break;
         }
+
+        g_string_append_len(buf, chunk->post->str, chunk->post->len);
     }
+
+    output_check();
 }
 
 /**
@@ -754,6 +927,12 @@ void free_printf_formats(GArray *chunks)
         g_string_free(chunk->format, TRUE);
         if (chunk->time_format)
             g_string_free(chunk->time_format, TRUE);
+        if (chunk->pre)
+            g_string_free(chunk->pre, TRUE);
+        if (chunk->spec)
+            g_string_free(chunk->spec, TRUE);
+        if (chunk->post)
+            g_string_free(chunk->post, TRUE);
     }
 
     g_array_unref(chunks);
@@ -774,9 +953,12 @@ GArray *prepare_printf_format(const char *format)
     chunks = g_array_sized_new(FALSE, FALSE, sizeof(struct fchunk), 10);
 
     while (*format) {
+        memset(&chunk, 0, sizeof(chunk));
         chunk.format = g_string_sized_new(50);
 
         format = extract_chunk(format, &chunk);
+        if (format != NULL)
+            compile_chunk(&chunk);
         g_array_append_val(chunks, chunk);
 
         if (format == NULL)
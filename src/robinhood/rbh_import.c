@@ -14,6 +14,13 @@
 
 /**
  * Command for restoring an entry that was accidentally removed from filesystem.
+ *
+ * NOTE: this command is not built (see Makefile.am): it still relies on the
+ * former backend API (backend_ext.h, rbhext_recover). A parallel import
+ * should be written on the current status manager interface, pushing
+ * imported entries to the EntryProcessor pipeline (for batched DB inserts)
+ * from a multi-threaded backend traversal, as rbh-undelete --threads does
+ * for restores.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -0,0 +1,494 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * \file   rbh_load_dump.c
+ * \brief  Populate the database from a dump of MDT inodes.
+ *
+ * Reads a text stream describing the inodes of the MDTs (as produced from
+ * an inode table scan of the MDT devices), and pushes them to the standard
+ * pipeline with all their attributes, so no readdir or stat is issued to
+ * the filesystem. This is much faster than an initial scan of a huge
+ * namespace.
+ *
+ * Each line describes a link of an inode:
+ *   fid mode nlink uid gid size blocks atime mtime ctime parent_fid name [lovea]
+ * - fids are formatted as 0xseq:0xoid:0xver (brackets are optional),
+ * - mode is octal and includes the file type (e.g. 0100644),
+ * - times are epoch seconds,
+ * - name is percent-encoded (e.g. '%20' for a space),
+ *   parent_fid and name are '-' for the filesystem root,
+ * - lovea is the hexadecimal value of the 'lustre.lov' xattr (optional,
+ *   '-' if the entry has no layout).
+ * Inodes with several hard links have one line per link.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "list_mgr.h"
+#include "rbh_cfg.h"
+#include "rbh_logs.h"
+#include "rbh_misc.h"
+#include "cmd_helpers.h"
+#include "rbh_basename.h"
+#include "status_manager.h"
+#include "entry_processor.h"
+#include "Memory.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define LOAD_TAG    "LoadDump"
+
+/* max size of a LOV EA in a dump (hex encoded) */
+#define LOVEA_MAX   65536
+
+static struct option option_tab[] = {
+    /* load options */
+    {"dry-run", no_argument, NULL, 'n'},
+
+    /* config file options */
+    {"config-file", required_argument, NULL, 'f'},
+
+    /* log options */
+    {"log-level", required_argument, NULL, 'l'},
+
+    /* miscellaneous options */
+    {"help", no_argument, NULL, 'h'},
+
+    {NULL, 0, NULL, 0}
+};
+
+#define SHORT_OPT_STRING    "nf:l:h"
+
+#define MAX_OPT_LEN 1024
+
+static struct load_options {
+    bool            dry_run;
+    char            config_file[MAX_OPT_LEN];
+} options = {
+    .dry_run = false,
+    .config_file = "",
+};
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [options] <dump_file>|-\n"
+    "\n"
+    "Populate the database from a dump of MDT inodes ('-' for stdin).\n"
+    "Each line of the dump describes a link of an inode:\n"
+    "    fid mode nlink uid gid size blocks atime mtime ctime parent_fid name [lovea]\n"
+    "mode is octal (including file type), name is percent-encoded,\n"
+    "lovea is the hex value of the lustre.lov xattr ('-' if none).\n"
+    "\n"
+    _B "Load options:" B_ "\n"
+    "    " _B "-n" B_ ", " _B "--dry-run" B_ "\n"
+    "        Only check the dump format, don't update the database.\n"
+    "\n"
+    _B "Config file options:" B_ "\n"
+    "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
+    "        Path to configuration file (or short name).\n"
+    "\n"
+    _B "Miscellaneous options:" B_ "\n"
+    "    " _B "-l" B_ " " _U "level" U_ ", " _B "--log-level=" B_ _U "level" U_ "\n"
+    "        Force the log verbosity level (overides configuration value).\n"
+    "        Allowed values: CRIT, MAJOR, EVENT, VERB, DEBUG, FULL.\n"
+    "    " _B "-h" B_ ", " _B "--help" B_ "\n"
+    "        Display a short help about command line options.\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name);
+}
+
+#ifdef _HAVE_FID
+static int parse_fid(const char *str, entry_id_t *p_id)
+{
+    if (*str == '[')
+        str++;
+    if (sscanf(str, SFID, RFID(p_id)) != FID_SCAN_CNT)
+        return -EINVAL;
+    return 0;
+}
+
+/** decode a percent-encoded name */
+static int decode_name(const char *in, char *out, size_t out_sz)
+{
+    size_t len = 0;
+
+    while (*in != '\0') {
+        if (len + 1 >= out_sz)
+            return -ENAMETOOLONG;
+
+        if (*in == '%') {
+            unsigned int c;
+
+            if (!isxdigit(in[1]) || !isxdigit(in[2])
+                || sscanf(in + 1, "%2x", &c) != 1 || c == 0)
+                return -EINVAL;
+            out[len++] = c;
+            in += 3;
+        } else
+            out[len++] = *(in++);
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+/** decode a hex string, return the number of bytes */
+static ssize_t decode_hex(const char *hex, unsigned char *buff, size_t sz)
+{
+    size_t len = 0;
+
+    /* allow the 0x prefix of 'getfattr -e hex' */
+    if (hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X'))
+        hex += 2;
+
+    while (hex[0] != '\0') {
+        if (len >= sz || !isxdigit(hex[0]) || !isxdigit(hex[1])
+            || sscanf(hex, "%2hhx", &buff[len]) != 1)
+            return -EINVAL;
+        hex += 2;
+        len++;
+    }
+    return len;
+}
+
+/** parse a dump line into a pipeline operation */
+static int parse_line(char *line, entry_proc_op_t *op, time_t now,
+                      unsigned char *lovea)
+{
+    char *field[13];
+    char *saveptr = NULL;
+    char *curr;
+    unsigned int n, nb_fields = 0;
+    struct stat st;
+    unsigned long long v[9];
+    int rc;
+
+    for (curr = strtok_r(line, " \t\n", &saveptr); curr != NULL;
+         curr = strtok_r(NULL, " \t\n", &saveptr)) {
+        if (nb_fields >= 13)
+            return -E2BIG;
+        field[nb_fields++] = curr;
+    }
+    if (nb_fields < 12)
+        return -EINVAL;
+
+    op->pipeline_stage = entry_proc_descr.GET_INFO_DB;
+    ATTR_MASK_INIT(&op->fs_attrs);
+
+    if (parse_fid(field[0], &op->entry_id))
+        return -EINVAL;
+    op->entry_id_is_set = 1;
+    op->extra_info_is_set = 0;
+
+    /* mode (octal), then decimal values */
+    for (n = 1; n <= 9; n++) {
+        char *end;
+
+        v[n - 1] = strtoull(field[n], &end, n == 1 ? 8 : 10);
+        if (*end != '\0')
+            return -EINVAL;
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = v[0];
+    st.st_nlink = v[1];
+    st.st_uid = v[2];
+    st.st_gid = v[3];
+    st.st_size = v[4];
+    st.st_blocks = v[5];
+    st.st_atime = v[6];
+    st.st_mtime = v[7];
+    st.st_ctime = v[8];
+    stat2rbh_attrs(&st, &op->fs_attrs, true);
+
+    ATTR_MASK_SET(&op->fs_attrs, md_update);
+    ATTR(&op->fs_attrs, md_update) = now;
+
+    /* the root has no parent */
+    if (strcmp(field[10], "-") != 0) {
+        if (parse_fid(field[10], &ATTR(&op->fs_attrs, parent_id)))
+            return -EINVAL;
+        ATTR_MASK_SET(&op->fs_attrs, parent_id);
+
+        rc = decode_name(field[11], ATTR(&op->fs_attrs, name),
+                         sizeof(ATTR(&op->fs_attrs, name)));
+        if (rc)
+            return rc;
+        ATTR_MASK_SET(&op->fs_attrs, name);
+
+        ATTR_MASK_SET(&op->fs_attrs, path_update);
+        ATTR(&op->fs_attrs, path_update) = now;
+    }
+
+    /* layout */
+    if (nb_fields == 13 && strcmp(field[12], "-") != 0) {
+        ssize_t len = decode_hex(field[12], lovea, LOVEA_MAX);
+
+        if (len < 0)
+            return len;
+
+        rc = File_GetStripeByLovEA(lovea, len,
+                                   &ATTR(&op->fs_attrs, stripe_info),
+                                   &ATTR(&op->fs_attrs, stripe_items));
+        if (rc)
+            return rc;
+        ATTR_MASK_SET(&op->fs_attrs, stripe_info);
+        ATTR_MASK_SET(&op->fs_attrs, stripe_items);
+    }
+    return 0;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    int            c, option_index = 0;
+    const char    *bin;
+    const char    *input_name;
+#ifdef _HAVE_FID
+    char           err_msg[4096];
+    char           badcfg[RBH_PATH_MAX];
+    bool           chgd = false;
+    int            rc;
+    attr_mask_t    diff_mask = null_mask;
+    FILE          *input;
+    char          *line = NULL;
+    size_t         line_sz = 0;
+    unsigned char *lovea;
+    unsigned long long nb_lines = 0, nb_entries = 0, nb_errors = 0;
+    bool           bulk_load = false;
+    struct timeval start, end, diff;
+    double         elapsed;
+    time_t         now;
+    lmgr_t         lmgr;
+    uint64_t       count = 0;
+#endif
+
+    bin = rh_basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
+                            &option_index)) != -1) {
+        switch (c) {
+        case 'n':
+            options.dry_run = true;
+            break;
+        case 'f':
+            rh_strncpy(options.config_file, optarg, MAX_OPT_LEN);
+            break;
+        case 'l':
+        {
+            int log_level = str2debuglevel(optarg);
+
+            if (log_level == -1) {
+                fprintf(stderr,
+                        "Unsupported log level '%s'. CRIT, MAJOR, EVENT, VERB, DEBUG or FULL expected.\n",
+                        optarg);
+                exit(1);
+            }
+            force_debug_level(log_level);
+            break;
+        }
+        case 'h':
+            display_help(bin);
+            exit(0);
+            break;
+        case ':':
+        case '?':
+        default:
+            fprintf(stderr, "Run '%s --help' for more details.\n", bin);
+            exit(1);
+            break;
+        }
+    }
+
+    /* the dump to be loaded */
+    if (optind != argc - 1) {
+        fprintf(stderr, "Error: a dump file (or '-' for stdin) is expected\n");
+        fprintf(stderr, "Run '%s --help' for more details.\n", bin);
+        exit(1);
+    }
+    input_name = argv[optind];
+
+#ifndef _HAVE_FID
+    fprintf(stderr, "Error: cannot load '%s': %s requires a Lustre "
+            "filesystem with FID support\n", input_name, bin);
+    exit(ENOTSUP);
+#else
+    if (!strcmp(input_name, "-"))
+        input = stdin;
+    else {
+        input = fopen(input_name, "r");
+        if (input == NULL) {
+            rc = errno;
+            fprintf(stderr, "Error opening '%s': %s\n", input_name,
+                    strerror(rc));
+            exit(rc);
+        }
+    }
+
+    lovea = MemAlloc(LOVEA_MAX);
+    if (lovea == NULL)
+        exit(ENOMEM);
+
+    /* initialize internal resources (glib, llapi, internal resources...) */
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
+    /* get default config file, if not specified */
+    if (SearchConfig(options.config_file, options.config_file, &chgd,
+                     badcfg, MAX_OPT_LEN) != 0) {
+        fprintf(stderr, "No config file (or too many) found matching %s\n",
+                badcfg);
+        exit(2);
+    } else if (chgd) {
+        fprintf(stderr, "Using config file '%s'.\n", options.config_file);
+    }
+
+    if (rbh_cfg_load(MODULE_MASK_FS_SCAN | MODULE_MASK_ENTRY_PROCESSOR,
+                     options.config_file, err_msg)) {
+        fprintf(stderr, "Error reading configuration file '%s': %s\n",
+                options.config_file, err_msg);
+        exit(1);
+    }
+
+    /* Set logging to stderr */
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
+
+    rc = InitializeLogs(bin);
+    if (rc) {
+        fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
+                rc, errno, strerror(errno));
+        exit(rc);
+    }
+
+    if (!options.dry_run) {
+        /* Initialize filesystem access */
+        rc = InitFS();
+        if (rc)
+            exit(rc);
+
+        /* Initialize status managers */
+        rc = smi_init_all(RUNFLG_ONCE);
+        if (rc)
+            exit(rc);
+
+        /* Initialize list manager (all pipeline workers connect to the DB) */
+        rc = ListMgr_Init(0);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LOAD_TAG,
+                       "Error initializing list manager: %s (%d)",
+                       lmgr_err2str(rc), rc);
+            exit(rc);
+        }
+
+        rc = ListMgr_InitAccess(&lmgr);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LOAD_TAG,
+                       "Error connecting to the database: %s (%d)",
+                       lmgr_err2str(rc), rc);
+            exit(rc);
+        }
+
+        /* initial population: load entries by bulk */
+        if (ListMgr_EntryCount(&lmgr, &count) == DB_SUCCESS && count == 0
+            && ListMgr_BulkLoadStart(&lmgr) == DB_SUCCESS)
+            bulk_load = true;
+
+        rc = EntryProcessor_Init(STD_PIPELINE, RUNFLG_ONCE, &diff_mask);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LOAD_TAG,
+                       "Error %d initializing EntryProcessor pipeline", rc);
+            exit(rc);
+        }
+    }
+
+    now = time(NULL);
+    gettimeofday(&start, NULL);
+
+    while (getline(&line, &line_sz, input) != -1) {
+        entry_proc_op_t *op;
+        char *curr = line;
+
+        nb_lines++;
+
+        while (isspace(*curr))
+            curr++;
+        if (*curr == '\0' || *curr == '#')
+            continue;
+
+        op = EntryProcessor_Get();
+        if (!op) {
+            DisplayLog(LVL_CRIT, LOAD_TAG,
+                       "CRITICAL ERROR: EntryProcessor_Get failed to allocate a new op");
+            exit(1);
+        }
+
+        rc = parse_line(curr, op, now, lovea);
+        if (rc) {
+            DisplayLog(LVL_MAJOR, LOAD_TAG, "%s:%llu: invalid line: %s",
+                       input_name, nb_lines, strerror(-rc));
+            nb_errors++;
+            EntryProcessor_Release(op);
+            continue;
+        }
+
+        nb_entries++;
+        if (options.dry_run)
+            EntryProcessor_Release(op);
+        else
+            EntryProcessor_Push(op);
+    }
+
+    if (ferror(input)) {
+        DisplayLog(LVL_CRIT, LOAD_TAG, "Error reading %s: %s", input_name,
+                   strerror(errno));
+        nb_errors++;
+    }
+
+    if (!options.dry_run) {
+        /* wait for all operations to be processed */
+        EntryProcessor_Terminate(true);
+
+        if (bulk_load)
+            ListMgr_BulkLoadEnd(&lmgr);
+        ListMgr_CloseAccess(&lmgr);
+    }
+
+    gettimeofday(&end, NULL);
+    timersub(&end, &start, &diff);
+    elapsed = diff.tv_sec + 1E-6 * diff.tv_usec;
+
+    printf("lines=%llu, entries=%llu, errors=%llu, elapsed=%.3fs, "
+           "throughput=%.1f entries/s\n", nb_lines, nb_entries, nb_errors,
+           elapsed, elapsed > 0.0 ? nb_entries / elapsed : 0.0);
+
+    free(line);
+    MemFree(lovea);
+    if (input != stdin)
+        fclose(input);
+
+    FlushLogs();
+    return nb_errors ? 1 : 0;
+#endif
+}
@@ -13,7 +13,11 @@
  */
 
 /**
- * Command for rebinding a backend entry to a new fid.
+ * Command for rebinding entries to a new fid (e.g. after a migration):
+ * the backend copy is bound to the new fid by the status manager, and the
+ * entry is replaced in the database.
+ * In bulk mode, (old, new) pairs are read from a file and processed by
+ * parallel threads, that replace entries in the database by batches.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -25,21 +29,32 @@
 #include "rbh_logs.h"
 #include "rbh_misc.h"
 #include "xplatform_print.h"
-#include "backend_ext.h"
 #include "cmd_helpers.h"
 #include "rbh_basename.h"
+#include "Memory.h"
 
 #include <unistd.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #define LOGTAG "Rebind"
 
 static struct option option_tab[] = {
+    /* bulk mode */
+    {"input", required_argument, NULL, 'i'},
+    {"threads", required_argument, NULL, 't'},
+
+    {"statusmgr", required_argument, NULL, 's'},
+    {"status-mgr", required_argument, NULL, 's'},
+
     /* config file options */
     {"config-file", required_argument, NULL, 'f'},
 
@@ -54,7 +69,14 @@ static struct option option_tab[] = {
 
 };
 
-#define SHORT_OPT_STRING    "f:l:hV"
+#define SHORT_OPT_STRING    "i:t:s:f:l:hV"
+
+/* global variables */
+
+static lmgr_t         lmgr;
+static sm_instance_t *smi = NULL;
+static unsigned int   nb_threads = 1;
+static bool           terminate = false;
 
 /* special character sequences for displaying help */
 
@@ -69,8 +91,22 @@ static struct option option_tab[] = {
 #define U_ "[0m"
 
 static const char *help_string =
-    _B "Usage:" B_ " %s [options] <old_backend_path> <new_fs_path> [new_fid]\n"
-    _B "By default, new_fid is taken as the current fid of new_fs_path but it might be different\n"
+    _B "Usage:" B_ " %s [options] <old_fid> <new_fid|new_path>\n"
+    "       %s [options] --input=<file>\n"
+    "\n"
+    _B "Bulk options:" B_ "\n"
+    "    " _B "-i" B_ " " _U "file" U_ ", " _B "--input=" B_ _U "file" U_ "\n"
+    "        Rebind the entries listed in file (\"-\" for stdin): one\n"
+    "        '<old_fid> <new_fid|new_path>' pair per line.\n"
+    "        Empty lines and lines starting with '#' are ignored.\n"
+    "    " _B "-t" B_ " " _U "count" U_ ", " _B "--threads=" B_ _U "count" U_ "\n"
+    "        Rebind entries with parallel threads (default: 1).\n"
+    "        An interrupted rebind can be run again with the same input:\n"
+    "        entries already rebound are skipped.\n"
+    "\n"
+    _B "Behavior options:" B_ "\n"
+    "    " _B "--status-mgr" B_ _U "statusmgr" U_", " _B "-s" B_ _U "statusmgr" U_"\n"
+    "        Status manager to rebind entries in the backend.\n"
     "\n"
     _B "Config file options:" B_ "\n"
     "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
@@ -87,7 +123,7 @@ static const char *help_string =
 
 static inline void display_help(const char *bin_name)
 {
-    printf(help_string, bin_name);
+    printf(help_string, bin_name, bin_name);
 }
 
 static inline void display_version(const char *bin_name)
@@ -135,69 +171,532 @@ static inline void display_version(const char *bin_name)
     printf("\n");
 }
 
-static inline int rebind_helper(const char *old_backend_path,
-                                const char *new_fs_path,
-                                const char *new_fid_str)
+/* counters */
+static ull_t nb_read = 0;
+static ull_t nb_rebound = 0;
+static ull_t nb_missing = 0;
+static ull_t nb_invalid = 0;
+static ull_t nb_errors = 0;
+static ull_t db_err = 0;
+
+/** an entry to be rebound */
+struct rebind_job {
+    entry_id_t old_id;
+    entry_id_t new_id;
+    char       new_path[RBH_PATH_MAX]; /* empty if new_id was given */
+};
+
+/** DB updates of rebound entries, applied by batches */
+#define REBIND_BATCH_SIZE 256
+
+struct rebind_batch {
+    unsigned int count;
+    entry_id_t   old_ids[REBIND_BATCH_SIZE];
+    entry_id_t   new_ids[REBIND_BATCH_SIZE];
+    attr_set_t   old_attrs[REBIND_BATCH_SIZE];
+    attr_set_t   new_attrs[REBIND_BATCH_SIZE];
+};
+
+/* delay between progress reports (bulk mode) */
+#define REBIND_PROGRESS_DELAY 10
+
+static void rebind_batch_flush(lmgr_t *p_mgr, struct rebind_batch *batch)
 {
+    entry_id_t *old_ids[REBIND_BATCH_SIZE];
+    entry_id_t *new_ids[REBIND_BATCH_SIZE];
+    attr_set_t *old_attrs[REBIND_BATCH_SIZE];
+    attr_set_t *new_attrs[REBIND_BATCH_SIZE];
+    unsigned int i;
     int rc;
-    char rp[RBH_PATH_MAX];
-    char new_backend_path[RBH_PATH_MAX];
-    entry_id_t new_fid;
-    char *tmp;
-
-    /* full path required */
-    tmp = realpath(new_fs_path, NULL);
-    if (tmp == NULL) {
-        rc = -errno;
-        DisplayLog(LVL_CRIT, LOGTAG, "Error in realpath(%s): %s",
-                   new_fs_path, strerror(-rc));
-        return rc;
+
+    if (batch->count == 0)
+        return;
+
+    for (i = 0; i < batch->count; i++) {
+        old_ids[i] = &batch->old_ids[i];
+        new_ids[i] = &batch->new_ids[i];
+        old_attrs[i] = &batch->old_attrs[i];
+        new_attrs[i] = &batch->new_attrs[i];
     }
-    if (strlen(tmp) >= RBH_PATH_MAX) {
-        DisplayLog(LVL_CRIT, LOGTAG, "Path length is too long!");
-        return -ENAMETOOLONG;
+
+    rc = ListMgr_BatchReplace(p_mgr, batch->count, old_ids, old_attrs,
+                              new_ids, new_attrs, true, true);
+    if (rc == DB_SUCCESS) {
+        __sync_fetch_and_add(&nb_rebound, batch->count);
+    } else {
+        /* the whole batch was rolled back: replace entries one by one
+         * to only miss the faulty ones */
+        for (i = 0; i < batch->count; i++) {
+            rc = ListMgr_Replace(p_mgr, old_ids[i], old_attrs[i], new_ids[i],
+                                 new_attrs[i], true, true);
+            if (rc) {
+                __sync_fetch_and_add(&db_err, 1);
+                fprintf(stderr, "ERROR %d replacing " DFID " with " DFID
+                        " in the database\n", rc, PFID(old_ids[i]),
+                        PFID(new_ids[i]));
+            } else {
+                __sync_fetch_and_add(&nb_rebound, 1);
+            }
+        }
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        ListMgr_FreeAttrs(&batch->old_attrs[i]);
+        ListMgr_FreeAttrs(&batch->new_attrs[i]);
     }
-    /* safe because of previous check */
-    strcpy(rp, tmp);
-    /* now can release tmp path */
-    free(tmp);
-
-    if (new_fid_str) {
-        int nb_read;
-
-        /* parse fid */
-        if (new_fid_str[0] == '[')
-            nb_read = sscanf(new_fid_str, "[" SFID "]", RFID(&new_fid));
-        else
-            nb_read = sscanf(new_fid_str, SFID, RFID(&new_fid));
-
-        if (nb_read != FID_SCAN_CNT) {
-            DisplayLog(LVL_CRIT, LOGTAG, "Unexpected format for fid %s",
-                       new_fid_str);
+    batch->count = 0;
+}
+
+/**
+ * Rebind an entry in the backend, and add its DB update to the given batch.
+ */
+static void rebind_helper(lmgr_t *p_mgr, struct rebind_batch *batch,
+                          const struct rebind_job *job)
+{
+    attr_set_t old_attrs = ATTR_SET_INIT;
+    attr_set_t new_attrs = ATTR_SET_INIT;
+    entry_id_t new_id = job->new_id;
+    char path[RBH_PATH_MAX];
+    struct stat st;
+    int rc;
+
+    old_attrs.attr_mask = smi->sm->softrm_table_mask;
+    old_attrs.attr_mask.std |= POSIX_ATTR_MASK | ATTR_MASK_fullpath
+        | ATTR_MASK_name | ATTR_MASK_parent_id;
+
+    rc = ListMgr_Get(p_mgr, &job->old_id, &old_attrs);
+    if (rc == DB_NOT_EXISTS) {
+        /* possibly rebound by a previous run */
+        __sync_fetch_and_add(&nb_missing, 1);
+        printf("Rebinding " DFID "...\t not found in database\n",
+               PFID(&job->old_id));
+        return;
+    } else if (rc) {
+        __sync_fetch_and_add(&db_err, 1);
+        fprintf(stderr, "ERROR %d getting " DFID " from the database\n", rc,
+                PFID(&job->old_id));
+        return;
+    }
+
+    /* current attributes of the new entry */
+    if (!EMPTY_STRING(job->new_path)) {
+        rh_strncpy(path, job->new_path, sizeof(path));
+    } else {
+#ifdef _HAVE_FID
+        rc = Lustre_GetFullPath(&new_id, path, sizeof(path));
+        if (rc) {
+            fprintf(stderr, "ERROR: cannot get the path of " DFID ": %s\n",
+                    PFID(&new_id), strerror(-rc));
+            goto error;
+        }
+#else
+        fprintf(stderr, "ERROR: a path is expected for the new entry\n");
+        goto error;
+#endif
+    }
+
+    if (lstat(path, &st)) {
+        fprintf(stderr, "ERROR: lstat() failed on '%s': %s\n", path,
+                strerror(errno));
+        goto error;
+    }
+    stat2rbh_attrs(&st, &new_attrs, true);
+    ATTR_MASK_SET(&new_attrs, fullpath);
+    rh_strncpy(ATTR(&new_attrs, fullpath), path,
+               sizeof(ATTR(&new_attrs, fullpath)));
+
+    /* only files have a copy in the backend */
+    if (ATTR_MASK_TEST(&old_attrs, type)
+        && !strcmp(ATTR(&old_attrs, type), STR_TYPE_FILE)) {
+        recov_status_t rs;
+
+        rs = smi->sm->undelete_func(smi, &job->old_id, &old_attrs, &new_id,
+                                    &new_attrs, true);
+        if (rs != RS_FILE_OK) {
+            fprintf(stderr, "ERROR: failed to rebind '%s' (" DFID ") to "
+                    DFID " in the backend\n", path, PFID(&job->old_id),
+                    PFID(&new_id));
+            goto error;
+        }
+    }
+
+    printf("Rebinding " DFID "...\t '%s' (" DFID ") rebound\n",
+           PFID(&job->old_id), path, PFID(&new_id));
+
+    /* keep DB information about the entry (status, class...) */
+    ListMgr_MergeAttrSets(&new_attrs, &old_attrs, false);
+    attr_mask_unset_readonly(&new_attrs.attr_mask);
+
+    batch->old_ids[batch->count] = job->old_id;
+    batch->new_ids[batch->count] = new_id;
+    batch->old_attrs[batch->count] = old_attrs;
+    batch->new_attrs[batch->count] = new_attrs;
+    batch->count++;
+    if (batch->count == REBIND_BATCH_SIZE)
+        rebind_batch_flush(p_mgr, batch);
+    return;
+
+error:
+    __sync_fetch_and_add(&nb_errors, 1);
+    ListMgr_FreeAttrs(&old_attrs);
+    ListMgr_FreeAttrs(&new_attrs);
+}
+
+/** parse a fid, with or without brackets */
+static int parse_fid(const char *str, entry_id_t *id)
+{
+    int nb_read;
+
+    if (str[0] == '[')
+        nb_read = sscanf(str, "[" SFID "]", RFID(id));
+    else
+        nb_read = sscanf(str, SFID, RFID(id));
+
+    return (nb_read == FID_SCAN_CNT) ? 0 : -EINVAL;
+}
+
+/**
+ * Build a job from the old fid and the new fid or path.
+ */
+static int rebind_job_init(struct rebind_job *job, const char *old_str,
+                           const char *new_str)
+{
+    int rc;
+
+    if (parse_fid(old_str, &job->old_id)) {
+        fprintf(stderr, "Unexpected format for fid '%s'\n", old_str);
+        return -EINVAL;
+    }
+
+    if (new_str[0] != '/') {
+        job->new_path[0] = '\0';
+        if (parse_fid(new_str, &job->new_id)) {
+            fprintf(stderr, "Unexpected format for fid '%s' (or absolute "
+                    "path expected)\n", new_str);
             return -EINVAL;
         }
+        return 0;
+    }
+
+    if (strlen(new_str) >= sizeof(job->new_path)) {
+        fprintf(stderr, "Path length is too long: %s\n", new_str);
+        return -ENAMETOOLONG;
+    }
+    strcpy(job->new_path, new_str);
+
+    /* get fid for the given file */
+    rc = Path2Id(job->new_path, &job->new_id);
+    if (rc)
+        fprintf(stderr, "Cannot get the fid of '%s': %s\n", job->new_path,
+                strerror(-rc));
+    return rc;
+}
+
+/* ---- bulk rebind ----
+ * The main thread reads (old, new) pairs and queues them to worker threads.
+ * Each worker has its own DB connection and replaces entries by batches.
+ * Rebound entries leave the database under their old id, so an
+ * interrupted rebind can simply be run again.
+ */
+#define REBIND_QUEUE_SIZE 1024
+
+static struct rebind_queue {
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond;
+    struct rebind_job *jobs;    /* ring of REBIND_QUEUE_SIZE jobs */
+    unsigned int       first;
+    unsigned int       count;
+    bool               done;    /* no more jobs will be queued */
+} rebind_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct rebind_worker {
+    pthread_t           thread;
+    lmgr_t              lmgr;
+    struct rebind_batch batch;
+};
+
+static void rebind_queue_push(const struct rebind_job *job)
+{
+    P(rebind_queue.lock);
+    while (rebind_queue.count == REBIND_QUEUE_SIZE)
+        pthread_cond_wait(&rebind_queue.cond, &rebind_queue.lock);
+
+    rebind_queue.jobs[(rebind_queue.first + rebind_queue.count)
+                      % REBIND_QUEUE_SIZE] = *job;
+    rebind_queue.count++;
+    pthread_cond_broadcast(&rebind_queue.cond);
+    V(rebind_queue.lock);
+}
+
+/** @return false when there is no more job */
+static bool rebind_queue_pop(struct rebind_job *job)
+{
+    P(rebind_queue.lock);
+    while (rebind_queue.count == 0 && !rebind_queue.done)
+        pthread_cond_wait(&rebind_queue.cond, &rebind_queue.lock);
+
+    if (rebind_queue.count == 0) {
+        V(rebind_queue.lock);
+        return false;
+    }
+
+    *job = rebind_queue.jobs[rebind_queue.first];
+    rebind_queue.first = (rebind_queue.first + 1) % REBIND_QUEUE_SIZE;
+    rebind_queue.count--;
+    pthread_cond_broadcast(&rebind_queue.cond);
+    V(rebind_queue.lock);
+    return true;
+}
+
+static void *rebind_worker_thr(void *arg)
+{
+    struct rebind_worker *w = arg;
+    struct rebind_job job;
+
+    while (rebind_queue_pop(&job))
+        rebind_helper(&w->lmgr, &w->batch, &job);
+
+    rebind_batch_flush(&w->lmgr, &w->batch);
+    return NULL;
+}
+
+static void rebind_terminate_handler(int sig)
+{
+    terminate = true;
+}
+
+static void display_progress(void)
+{
+    printf("Progress: %llu entries read, %llu rebound, %llu not found, "
+           "%llu errors\n", nb_read, nb_rebound, nb_missing,
+           nb_errors + db_err);
+}
+
+/** read entries from the input file and queue them */
+static int rebind_read_input(FILE *input)
+{
+    char line[2 * RBH_PATH_MAX];
+    unsigned long long lineno = 0;
+    time_t last_report = time(NULL);
+
+    while (!terminate && fgets(line, sizeof(line), input) != NULL) {
+        struct rebind_job job;
+        char *old_str, *new_str, *saveptr;
+
+        lineno++;
+
+        old_str = strtok_r(line, " \t\n", &saveptr);
+        if (old_str == NULL || old_str[0] == '#')
+            continue;
+        /* the path may contain spaces */
+        new_str = strtok_r(NULL, "\n", &saveptr);
+        if (new_str != NULL) {
+            char *end;
+
+            while (isspace(*new_str))
+                new_str++;
+            end = new_str + strlen(new_str);
+            while (end > new_str && isspace(end[-1]))
+                *(--end) = '\0';
+        }
 
-        printf("Binding " DFID " to '%s'...\n", PFID(&new_fid),
-               old_backend_path);
+        if (new_str == NULL || EMPTY_STRING(new_str)
+            || rebind_job_init(&job, old_str, new_str) != 0) {
+            fprintf(stderr, "Line %llu: invalid entry, ignored\n", lineno);
+            nb_invalid++;
+            continue;
+        }
+
+        rebind_queue_push(&job);
+        nb_read++;
+
+        if (time(NULL) - last_report >= REBIND_PROGRESS_DELAY) {
+            display_progress();
+            last_report = time(NULL);
+        }
+    }
+
+    if (ferror(input)) {
+        DisplayLog(LVL_CRIT, LOGTAG, "Error reading input file: %s",
+                   strerror(errno));
+        return -EIO;
+    }
+    return 0;
+}
+
+static int rebind_bulk(const char *input_file)
+{
+    struct rebind_worker *workers;
+    struct sigaction act;
+    unsigned int i, started;
+    FILE *input;
+    int rc;
+
+    if (!strcmp(input_file, "-")) {
+        input = stdin;
     } else {
-        /* get fid for the given file */
-        rc = Path2Id(new_fs_path, &new_fid);
-        if (rc)
+        input = fopen(input_file, "r");
+        if (input == NULL) {
+            rc = -errno;
+            DisplayLog(LVL_CRIT, LOGTAG, "Cannot open '%s': %s", input_file,
+                       strerror(-rc));
             return rc;
+        }
+    }
 
-        printf("Binding '%s' (" DFID ") to '%s'...\n", new_fs_path,
-               PFID(&new_fid), old_backend_path);
+    rebind_queue.jobs = MemCalloc(REBIND_QUEUE_SIZE,
+                                  sizeof(*rebind_queue.jobs));
+    workers = MemCalloc(nb_threads, sizeof(*workers));
+    if (rebind_queue.jobs == NULL || workers == NULL) {
+        rc = -ENOMEM;
+        goto out;
     }
 
-    /* build the new backend path for the entry */
-    rc = rbhext_rebind(rp, old_backend_path, new_backend_path, &new_fid);
-    if (rc) {
-        fprintf(stderr, "rebind failed for '%s': %s\n", rp, strerror(-rc));
+    /* stop reading entries on SIGINT/SIGTERM, and flush pending DB
+     * updates */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = rebind_terminate_handler;
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT, &act, NULL);
+
+    for (started = 0; started < nb_threads; started++) {
+        rc = ListMgr_InitAccess(&workers[started].lmgr);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LOGTAG, "Error %d: cannot connect to "
+                       "database", rc);
+            break;
+        }
+        if (pthread_create(&workers[started].thread, NULL, rebind_worker_thr,
+                           &workers[started]) != 0) {
+            DisplayLog(LVL_CRIT, LOGTAG, "Error starting rebind thread: %s",
+                       strerror(errno));
+            ListMgr_CloseAccess(&workers[started].lmgr);
+            break;
+        }
+    }
+
+    if (started == 0) {
+        rc = -1;
+        goto out;
+    }
+
+    if (started > 1)
+        printf("Rebinding entries with %u threads\n", started);
+
+    rc = rebind_read_input(input);
+
+    /* let workers rebind queued entries and exit */
+    P(rebind_queue.lock);
+    rebind_queue.done = true;
+    pthread_cond_broadcast(&rebind_queue.cond);
+    V(rebind_queue.lock);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ListMgr_CloseAccess(&workers[i].lmgr);
+    }
+
+    if (terminate)
+        printf("\nInterrupted: run the same command again to rebind "
+               "the remaining entries.\n");
+
+    printf("\nrebind summary:\n");
+    printf("\t%9llu entries read\n", nb_read);
+    printf("\t%9llu rebound\n", nb_rebound);
+    printf("\t%9llu not found in database\n", nb_missing);
+    printf("\t%9llu invalid lines\n", nb_invalid);
+    printf("\t%9llu errors\n", nb_errors);
+    printf("\t%9llu DB errors\n", db_err);
+
+ out:
+    MemFree(workers);
+    MemFree(rebind_queue.jobs);
+    if (input != stdin)
+        fclose(input);
+    return rc;
+}
+
+/** rebind a single entry */
+static int rebind_one(const char *old_str, const char *new_str)
+{
+    struct rebind_batch *batch;
+    struct rebind_job job;
+    int rc;
+
+    rc = rebind_job_init(&job, old_str, new_str);
+    if (rc)
         return rc;
-    } else {
-        printf("'%s' successfully rebound to '%s'\n", rp, new_backend_path);
-        return 0;
+
+    batch = MemCalloc(1, sizeof(*batch));
+    if (batch == NULL)
+        return -ENOMEM;
+
+    rebind_helper(&lmgr, batch, &job);
+    rebind_batch_flush(&lmgr, batch);
+    MemFree(batch);
+
+    if (nb_errors > 0 || db_err > 0)
+        return EIO;
+    if (nb_missing > 0)
+        return ENOENT;
+    return 0;
+}
+
+/**
+ * Check if there is a single status manager that supports
+ * undelete (and rebind), and load it.
+ * \retval EINVAL if more than 1 status managers implement 'undelete'.
+ * \retval 0 if a single status manager was found.
+ * \retval ENOENT if no status manager implements undelete.
+ */
+static int load_single_smi(void)
+{
+    int i = 0;
+    sm_instance_t *smi_curr;
+
+    while ((smi_curr = get_sm_instance(i)) != NULL) {
+        if (smi_curr->sm->undelete_func != NULL) {
+            if (smi != NULL) {
+                DisplayLog(LVL_CRIT, LOGTAG,
+                           "ERROR: no status manager specified, but several of "
+                           "them implement 'rebind'");
+                return EINVAL;
+            }
+            smi = smi_curr;
+        }
+        i++;
+    }
+
+    if (smi == NULL) {
+        DisplayLog(LVL_CRIT, LOGTAG,
+                   "ERROR: no status manager implements 'rebind'");
+        return ENOENT;
     }
+
+    return 0;
+}
+
+/** load the Status Manager Instance with the given name */
+static int load_smi(const char *sm_name)
+{
+    int rc;
+    const char *dummy;
+
+    rc = check_status_args(sm_name, NULL, &dummy, &smi);
+    if (rc)
+        return rc;
+
+    if (smi->sm->undelete_func == NULL) {
+        DisplayLog(LVL_CRIT, LOGTAG,
+                   "ERROR: the specified status manager '%s' doesn't "
+                   "implement 'rebind'", sm_name);
+        return EINVAL;
+    }
+
+    return 0;
 }
 
 #define MAX_OPT_LEN 1024
@@ -210,11 +709,12 @@ int main(int argc, char **argv)
     int c, option_index = 0;
     const char *bin;
     char config_file[MAX_OPT_LEN] = "";
+    char input_file[RBH_PATH_MAX] = "";
+    char sm_name[SM_NAME_MAX + 1] = "";
 
     int rc;
     char err_msg[4096];
-    robinhood_config_t config;
-    int chgd = 0;
+    bool chgd = false;
     char badcfg[RBH_PATH_MAX];
 
     bin = rh_basename(argv[0]);
@@ -223,6 +723,29 @@ int main(int argc, char **argv)
     while ((c = getopt_long(argc, argv, SHORT_OPT_STRING, option_tab,
                             &option_index)) != -1) {
         switch (c) {
+        case 'i':
+            rh_strncpy(input_file, optarg, sizeof(input_file));
+            break;
+        case 't':
+        {
+            int n = str2int(optarg);
+
+            if (n <= 0) {
+                fprintf(stderr, "Invalid value '%s' for --threads: "
+                        "positive integer expected\n", optarg);
+                exit(1);
+            }
+            nb_threads = n;
+            break;
+        }
+        case 's':
+            if (!EMPTY_STRING(sm_name))
+                fprintf(stderr,
+                        "WARNING: only a single status manager is expected "
+                        "on command line. '%s' ignored.\n", optarg);
+            else
+                rh_strncpy(sm_name, optarg, sizeof(sm_name));
+            break;
         case 'f':
             rh_strncpy(config_file, optarg, MAX_OPT_LEN);
             break;
@@ -256,17 +779,27 @@ int main(int argc, char **argv)
         }
     }
 
-    /* 2 expected argument: old backend path, new path is FS */
-    if (optind > argc - 2) {
+    /* 2 expected argument: old fid, new fid or path (none in bulk mode) */
+    if (!EMPTY_STRING(input_file)) {
+        if (optind != argc) {
+            fprintf(stderr, "Error: no argument expected with --input.\n");
+            display_help(bin);
+            exit(1);
+        }
+    } else if (optind > argc - 2) {
         fprintf(stderr, "Error: missing arguments on command line.\n");
         display_help(bin);
         exit(1);
-    } else if (optind < argc - 3) {
+    } else if (optind < argc - 2) {
         fprintf(stderr, "Error: too many arguments on command line.\n");
         display_help(bin);
         exit(1);
     }
 
+    rc = rbh_init_internals();
+    if (rc != 0)
+        exit(rc);
+
     /* get default config file, if not specified */
     if (SearchConfig(config_file, config_file, &chgd, badcfg,
                      MAX_OPT_LEN) != 0) {
@@ -277,24 +810,20 @@ int main(int argc, char **argv)
         fprintf(stderr, "Using config file '%s'.\n", config_file);
     }
 
-    rc = rbh_init_internals();
-    if (rc != 0)
-        exit(rc);
-
-    /* only read ListMgr config */
-    if (ReadRobinhoodConfig(0, config_file, err_msg, &config, false)) {
+    /* only read common config */
+    if (rbh_cfg_load(0, config_file, err_msg)) {
         fprintf(stderr, "Error reading configuration file '%s': %s\n",
                 config_file, err_msg);
         exit(1);
     }
 
     /* XXX HOOK: Set logging to stderr */
-    strcpy(config.log_config.log_file, "stderr");
-    strcpy(config.log_config.report_file, "stderr");
-    strcpy(config.log_config.alert_file, "stderr");
+    strcpy(log_config.log_file, "stderr");
+    strcpy(log_config.report_file, "stderr");
+    strcpy(log_config.alert_file, "stderr");
 
     /* Initialize logging */
-    rc = InitializeLogs(bin, &config.log_config);
+    rc = InitializeLogs(bin);
     if (rc) {
         fprintf(stderr, "Error opening log files: rc=%d, errno=%d: %s\n",
                 rc, errno, strerror(errno));
@@ -306,23 +835,45 @@ int main(int argc, char **argv)
     if (rc)
         exit(rc);
 
-    /* Initialize status managers (XXX all or just the one used for rebind?) */
-    rc = smi_init_all(options.flags);
+    /* Initialize status managers */
+    rc = smi_init_all(0);
     if (rc)
         exit(rc);
 
-#ifdef _HSM_LITE
-    rc = Backend_Start(&config.backend_config, 0);
+    /* load the status manager */
+    if (!EMPTY_STRING(sm_name))
+        rc = load_smi(sm_name);
+    else
+        rc = load_single_smi();
+    if (rc)
+        exit(rc);
+
+    /* Initialize list manager */
+    rc = ListMgr_Init(0);
     if (rc) {
-        DisplayLog(LVL_CRIT, LOGTAG, "Error initializing backend");
+        DisplayLog(LVL_CRIT, LOGTAG, "Error initializing list manager: %s (%d)",
+                   lmgr_err2str(rc), rc);
+        exit(rc);
+    }
+    DisplayLog(LVL_DEBUG, LOGTAG, "ListManager successfully initialized");
+
+    if (CheckLastFS() != 0)
         exit(1);
+
+    /* Create database access */
+    rc = ListMgr_InitAccess(&lmgr);
+    if (rc) {
+        DisplayLog(LVL_CRIT, LOGTAG, "Error %d: cannot connect to database",
+                   rc);
+        exit(rc);
     }
-#endif
 
-    if (optind == argc - 2)
-        rc = rebind_helper(argv[optind], argv[optind + 1], NULL);
-    else if (optind == argc - 3)
-        rc = rebind_helper(argv[optind], argv[optind + 1], argv[optind + 2]);
+    if (!EMPTY_STRING(input_file))
+        rc = rebind_bulk(input_file);
+    else
+        rc = rebind_one(argv[optind], argv[optind + 1]);
 
-    return rc;
+    ListMgr_CloseAccess(&lmgr);
+
+    return rc ? 1 : 0;
 }
@@ -29,6 +29,7 @@
 #include "Memory.h"
 #include "entry_processor.h"
 #include "rbh_basename.h"
+#include "rbh_fidpath.h"
 
 #include <unistd.h>
 #include <getopt.h>
@@ -54,6 +55,11 @@
 #define OPT_DUMP_STATUS 259
 #define OPT_CLASS_INFO  260
 #define OPT_STATUS_INFO 261
+#define OPT_OST_HISTORY 262
+#define OPT_OST_USAGE   263
+#define OPT_TREND       264
+#define OPT_TREND_RES   265
+#define OPT_TREND_SINCE 266
 
 #define SET_NEXT_MAINT    300
 #define CLEAR_NEXT_MAINT  301
@@ -67,6 +73,9 @@
 #define OPT_SIZE_PROFILE  330
 #define OPT_BY_SZ_RATIO   331
 
+#define OPT_FRESH         340
+#define OPT_APPROX        341
+
 /* options flags */
 #define OPT_FLAG_CSV        0x0001
 #define OPT_FLAG_NOHEADER   0x0002
@@ -79,6 +88,8 @@
 #define OPT_FLAG_REVERSE        0x0100
 #define OPT_FLAG_SPROF          0x0200
 #define OPT_FLAG_BY_SZRATIO     0x0400
+#define OPT_FLAG_FRESH          0x0800
+#define OPT_FLAG_APPROX         0x1000
 
 #define CSV(_x) !!((_x)&OPT_FLAG_CSV)
 #define NOHEADER(_x) !!((_x)&OPT_FLAG_NOHEADER)
@@ -90,6 +101,8 @@
 #define SORT_BY_SZRATIO(_x) !!((_x)&OPT_FLAG_BY_SZRATIO)
 #define REVERSE(_x) !!((_x)&OPT_FLAG_REVERSE)
 #define SPROF(_x) !!((_x)&OPT_FLAG_SPROF)
+#define FRESH(_x) !!((_x)&OPT_FLAG_FRESH)
+#define APPROX(_x) !!((_x)&OPT_FLAG_APPROX)
 
 static profile_field_descr_t size_profile = {
     .attr_index = ATTR_INDEX_size,
@@ -102,6 +115,9 @@ static struct option option_tab[] = {
 
     /* Stats selectors */
     {"activity", no_argument, NULL, 'a'},
+    {"trend", optional_argument, NULL, OPT_TREND},
+    {"trend-res", required_argument, NULL, OPT_TREND_RES},
+    {"trend-since", required_argument, NULL, OPT_TREND_SINCE},
 
     {"fsinfo", no_argument, NULL, 'i'},
     {"fs-info", no_argument, NULL, 'i'},
@@ -145,6 +161,8 @@ static struct option option_tab[] = {
     {"dump-group", required_argument, NULL, OPT_DUMP_GROUP},
 #ifdef _LUSTRE
     {"dump-ost", required_argument, NULL, OPT_DUMP_OST},
+    {"ost-history", required_argument, NULL, OPT_OST_HISTORY},
+    {"ost-usage", no_argument, NULL, OPT_OST_USAGE},
 #endif
     {"dump-status", required_argument, NULL, OPT_DUMP_STATUS},
 
@@ -182,6 +200,8 @@ static struct option option_tab[] = {
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'V'},
     {"force-no-acct", no_argument, NULL, 'F'},
+    {"fresh", no_argument, NULL, OPT_FRESH},
+    {"approx", no_argument, NULL, OPT_APPROX},
 
     {NULL, 0, NULL, 0}
 
@@ -195,6 +215,15 @@ static const char *stats_help =
     _B "Available stats:" B_ "\n"
     "    " _B "--activity" B_ ", " _B "-a" B_ "\n"
     "        Display stats about daemon activity.\n"
+    "    " _B "--trend" B_ "[=" _U "series" U_ "]\n"
+    "        Display the history of daemon stats matching " _U "series" U_ " (wildcards allowed),\n"
+    "        as recorded by the daemon (see stats_history). Without argument, list the\n"
+    "        available series.\n"
+    "    " _B "--trend-res" B_ " minute|hour|day\n"
+    "        Resolution of the --trend report (default: hour).\n"
+    "    " _B "--trend-since" B_ " " _U "duration" U_ "\n"
+    "        Only display the last " _U "duration" U_ " of the --trend report (e.g. 12h, 30d;\n"
+    "        default: 1d for minutes, 7d for hours, all days).\n"
     "    " _B "--fs-info" B_ ", " _B "-i" B_ "\n"
     "        Display statistics about filesystem contents.\n"
     "    " _B "--class-info" B_ "[=" _U "class_expr" U_ "]\n"
@@ -236,6 +265,11 @@ static const char *stats_help =
 #ifdef _LUSTRE
     "    " _B "--dump-ost" B_ " " _U "ost_index" U_ "|" _U "ost_set" U_ "\n"
     "        Dump all entries on the given OST or set of OSTs (e.g. 3,5-8).\n"
+    "    " _B "--ost-history" B_ " " _U "ost_index" U_ "|" _U "ost_set" U_ "\n"
+    "        Display the usage history of the given OST or set of OSTs,\n"
+    "        as recorded by the daemon (see ost_history_interval).\n"
+    "    " _B "--ost-usage" B_ "\n"
+    "        Display the volume of files on each OST (requires ost_aggregates).\n"
 #endif
     "    " _B "--dump-status" B_ " " _U "status_name" U_ ":" _U "status_value" U_ "\n"
     "        Dump all entries with the given status (e.g. lhsm_status:released).\n";
@@ -291,7 +325,14 @@ static const char *acct_help =
     "    " _B "-S" B_ ", " _B "--split-user-groups" B_ "\n"
     "        Display the report by user AND group\n"
     "    " _B "-F" B_ ", " _B "--force-no-acct" B_ "\n"
-    "        Generate the report without using accounting table (slower)\n";
+    "        Generate the report without using accounting table (slower)\n"
+    "    " _B "--fresh" B_ "\n"
+    "        Query the database, even if a snapshot of the report is available\n"
+    "        (user, group, top-users, class and status reports)\n"
+    "    " _B "--approx" B_ "\n"
+    "        Build --top-size and --oldest-files reports from the sketches of largest\n"
+    "        and least recently accessed files maintained by the daemon (faster,\n"
+    "        but entries that were not processed by the daemon may be missing)\n";
 
 static const char *cfg_help =
     _B "Config file options:" B_ "\n"
@@ -645,6 +686,217 @@ static void display_policy_stats(const char *name, int flags)
     }
 }
 
+/** display the progress of a running scan, and its pending subtrees */
+static void report_scan_progress(int flags, unsigned long long scanned,
+                                 time_t start)
+{
+    char value[1024];
+    char date[128];
+    struct tm t;
+    unsigned long long expected;
+    const char *curr;
+
+    if (getvar_helper(&lmgr, LAST_SCAN_EXPECTED, value, sizeof(value)) != 0)
+        return;
+    expected = strtoull(value, NULL, 10);
+    if (expected == 0)
+        return;
+
+    if (CSV(flags))
+        printf("scan_expected_entries, %llu\n", expected);
+    else
+        printf("            expected:        %llu entries\n", expected);
+
+    if (scanned > 0) {
+        double progress = MIN2(100.0, 100.0 * scanned / expected);
+        time_t now = time(NULL);
+        time_t eta = 0;
+
+        if (scanned < expected && start > 0 && now > start)
+            eta = now + (time_t)((double)(now - start) * (expected - scanned)
+                                 / scanned);
+
+        if (CSV(flags))
+            printf("scan_progress, %.1f%%\n", progress);
+        else
+            printf("        >>> progress:        %.1f%%\n", progress);
+
+        if (eta > 0) {
+            strftime(date, 128, "%Y/%m/%d %T", localtime_r(&eta, &t));
+            if (CSV(flags))
+                printf("scan_eta, %s\n", date);
+            else {
+                char dur[128];
+
+                FormatDuration(dur, sizeof(dur), eta - now);
+                printf("        >>> ETA:             %s (in %s)\n", date, dur);
+            }
+        }
+    }
+
+    /* pending subtrees: <scanned>:<expected>:<name>/ */
+    if (getvar_helper(&lmgr, LAST_SCAN_SUBTREES, value, sizeof(value)) != 0
+        || value[0] == '\0')
+        return;
+
+    if (CSV(flags))
+        printf("%12s, %12s, %s\n", "scanned", "expected", "pending_subtree");
+    else
+        printf("\n         Pending subtrees:\n");
+
+    for (curr = value; *curr != '\0';) {
+        unsigned long long st_scanned, st_expected;
+        char *end;
+        int len;
+
+        st_scanned = strtoull(curr, &end, 10);
+        if (*end != ':')
+            break;
+        st_expected = strtoull(end + 1, &end, 10);
+        if (*end != ':')
+            break;
+        curr = end + 1;
+        end = strchr(curr, '/');
+        if (end == NULL)
+            break;
+        len = end - curr;
+
+        if (CSV(flags))
+            printf("%12llu, %12llu, %.*s\n", st_scanned, st_expected, len,
+                   curr);
+        else if (st_expected > 0)
+            printf("            %-20.*s %llu/%llu entries (%.1f%%)\n", len,
+                   curr, st_scanned, st_expected,
+                   MIN2(100.0, 100.0 * st_scanned / st_expected));
+        else
+            printf("            %-20.*s %llu entries (new)\n", len, curr,
+                   st_scanned);
+
+        curr = end + 1;
+    }
+}
+
+static const char *stat_res2str(stat_res_e res)
+{
+    switch (res) {
+    case STAT_RES_MINUTE:
+        return "minute";
+    case STAT_RES_HOUR:
+        return "hour";
+    case STAT_RES_DAY:
+        return "day";
+    default:
+        return "?";
+    }
+}
+
+/** display the history of the daemon stats series matching a pattern
+ * (list series if pattern is NULL) */
+static void report_trend(const char *pattern, stat_res_e res, time_t since,
+                         int flags)
+{
+    char **names = NULL;
+    char *like = NULL;
+    unsigned int count = 0;
+    unsigned int i, j;
+    int rc;
+
+    if (pattern != NULL) {
+        char *c;
+
+        /* shell wildcards to SQL */
+        like = strdup(pattern);
+        if (like == NULL)
+            return;
+        for (c = like; *c != '\0'; c++) {
+            if (*c == '*')
+                *c = '%';
+            else if (*c == '?')
+                *c = '_';
+        }
+    }
+
+    rc = ListMgr_GetStatNames(&lmgr, like, &names, &count);
+    free(like);
+    if (rc == DB_NOT_EXISTS) {
+        DisplayLog(LVL_MAJOR, REPORT_TAG, "No stats history available: "
+                   "check stats_history");
+        return;
+    } else if (rc) {
+        DisplayLog(LVL_CRIT, REPORT_TAG, "ERROR: could not retrieve "
+                   "stats history: %s", lmgr_err2str(rc));
+        return;
+    }
+
+    if (pattern == NULL) {
+        for (i = 0; i < count; i++) {
+            printf("%s\n", names[i]);
+            MemFree(names[i]);
+        }
+        if (names != NULL)
+            MemFree(names);
+        return;
+    }
+
+    if (count == 0)
+        DisplayLog(LVL_MAJOR, REPORT_TAG, "No stats series matches '%s'",
+                   pattern);
+
+    if (CSV(flags) && !NOHEADER(flags))
+        printf("%s, %19s, %8s, %16s, %16s, %16s, %16s, %16s\n", "series",
+               "time", "samples", "avg", "min", "max", "last", "rate");
+
+    for (i = 0; i < count; i++) {
+        stat_point_t *points = NULL;
+        unsigned int n = 0;
+
+        rc = ListMgr_GetStatHistory(&lmgr, names[i], res, since, &points, &n);
+        if (rc) {
+            DisplayLog(LVL_CRIT, REPORT_TAG, "ERROR: could not retrieve "
+                       "history of %s: %s", names[i], lmgr_err2str(rc));
+            MemFree(names[i]);
+            continue;
+        }
+
+        if (!CSV(flags))
+            printf("\n%s: %u %s(s)\n", names[i], n, stat_res2str(res));
+
+        for (j = 0; j < n; j++) {
+            char date[128];
+            char rate[64] = "";
+            struct tm t;
+            double avg = points[j].count ?
+                points[j].sum / points[j].count : 0.0;
+
+            strftime(date, sizeof(date), "%Y/%m/%d %T",
+                     localtime_r(&points[j].time, &t));
+
+            /* change of the latest value per second (e.g. rate of a
+             * counter) */
+            if (j > 0 && points[j].time > points[j - 1].time)
+                snprintf(rate, sizeof(rate), "%.6g",
+                         (points[j].last - points[j - 1].last)
+                         / (points[j].time - points[j - 1].time));
+
+            if (CSV(flags))
+                printf("%s, %19s, %8u, %16.6g, %16.6g, %16.6g, %16.6g, "
+                       "%16s\n", names[i], date, points[j].count, avg,
+                       points[j].min, points[j].max, points[j].last, rate);
+            else
+                printf("    %s:  avg=%.6g min=%.6g max=%.6g last=%.6g%s%s%s\n",
+                       date, avg, points[j].min, points[j].max,
+                       points[j].last, rate[0] ? " (" : "", rate,
+                       rate[0] ? "/sec)" : "");
+        }
+
+        if (points != NULL)
+            MemFree(points);
+        MemFree(names[i]);
+    }
+    if (names != NULL)
+        MemFree(names);
+}
+
 static void report_activity(int flags)
 {
     char value[1024];
@@ -770,6 +1022,8 @@ static void report_activity(int flags)
 
     rc = getvar_helper(&lmgr, LAST_SCAN_ENTRIES_SCANNED, value, sizeof(value));
     if (rc == 0) {
+        unsigned long long scanned = strtoull(value, NULL, 10);
+
         // entries scanned
         if (!CSV(flags)) {
             printf("\n");
@@ -825,6 +1079,9 @@ static void report_activity(int flags)
             else
                 printf("        >>> current speed:   %.2f entries/sec\n",
                        speed);
+
+            // progress and ETA
+            report_scan_progress(flags, scanned, timestamp);
         }
     }
 
@@ -1013,9 +1270,9 @@ static int mk_global_filters(lmgr_filter_t *filter, bool do_display,
 }
 
 /**
- * Manage fid2path resolution
+ * Check if the filesystem is mounted, to resolve ids.
  */
-static int TryId2path(lmgr_t *p_mgr, const entry_id_t *p_id, char *path)
+static bool id2path_ready(lmgr_t *p_mgr)
 {
     static int is_init = 0;
     static int is_resolvable = 0;
@@ -1025,22 +1282,29 @@ static int TryId2path(lmgr_t *p_mgr, const entry_id_t *p_id, char *path)
     if (!is_init) {
         is_init = 1;
         /* try to get fspath from DB */
-        rc = ListMgr_GetVar(&lmgr, FS_PATH_VAR, value, sizeof(value));
+        rc = ListMgr_GetVar(p_mgr, FS_PATH_VAR, value, sizeof(value));
         if (rc)
-            return -1;
+            return false;
 
         if (InitFS() == 0)
             is_resolvable = 1;
         else
-            return -1;
+            return false;
     }
-    if (!is_resolvable)
+    return is_resolvable;
+}
+
+/**
+ * Manage fid2path resolution
+ */
+static int TryId2path(lmgr_t *p_mgr, const entry_id_t *p_id, char *path)
+{
+    if (!id2path_ready(p_mgr))
         return -1;
 
 #ifdef _HAVE_FID
     /* filesystem is mounted and fsname can be get: solve the fid */
-    rc = Lustre_GetFullPath(p_id, path, RBH_PATH_MAX);
-    return rc;
+    return Lustre_GetFullPath(p_id, path, RBH_PATH_MAX);
 #else
     entry_id_t root_id;
     if (Path2Id(global_config.fs_path, &root_id) == 0) {
@@ -1053,35 +1317,54 @@ static int TryId2path(lmgr_t *p_mgr, const entry_id_t *p_id, char *path)
 #endif
 }
 
+/**
+ * Resolve the path of a directory. Directory paths are cached,
+ * as the entries of a report are often in the same directories.
+ */
+static int TryDirId2path(lmgr_t *p_mgr, const entry_id_t *p_id, char *path)
+{
+#ifdef _HAVE_FID
+    if (!id2path_ready(p_mgr))
+        return -1;
+    return fidpath_dir_lookup(p_id, path, RBH_PATH_MAX);
+#else
+    return TryId2path(p_mgr, p_id, path);
+#endif
+}
+
 static const char *ResolvName(const entry_id_t *p_id, attr_set_t *attrs,
                               char *buff)
 {
-    if (ATTR_MASK_TEST(attrs, fullpath)) {
+    bool has_name = ATTR_MASK_TEST(attrs, parent_id)
+                    && ATTR_MASK_TEST(attrs, name);
+    char tmpstr[RBH_PATH_MAX];
+    struct stat st;
+
+    if (ATTR_MASK_TEST(attrs, fullpath))
         return ATTR(attrs, fullpath);
+
+    /* if parent id and name are set: try to resolve parent
+     * (faster than resolving the entry if its path is cached) */
+    if (has_name && TryDirId2path(&lmgr, &ATTR(attrs, parent_id),
+                                  tmpstr) == 0) {
+        snprintf(ATTR(attrs, fullpath), RBH_PATH_MAX, "%s/%s", tmpstr,
+                 ATTR(attrs, name));
+        ATTR_MASK_SET(attrs, fullpath);
     }
     /* try to get dir path from fid if it's mounted */
-    else if (TryId2path(&lmgr, p_id, ATTR(attrs, fullpath)) == 0) {
-        struct stat st;
+    else if (TryId2path(&lmgr, p_id, ATTR(attrs, fullpath)) == 0)
         ATTR_MASK_SET(attrs, fullpath);
 
+    if (ATTR_MASK_TEST(attrs, fullpath)) {
         /* we're lucky, try lstat now! */
         if (lstat(ATTR(attrs, fullpath), &st) == 0)
             stat2rbh_attrs(&st, attrs, true);
         return ATTR(attrs, fullpath);
-    }
-    /* if parent id and name are set: try to resolve parent */
-    else if (ATTR_MASK_TEST(attrs, parent_id) && ATTR_MASK_TEST(attrs, name)) {
-        char tmpstr[RBH_PATH_MAX];
-        if (TryId2path(&lmgr, &ATTR(attrs, parent_id), tmpstr) == 0) {
-            snprintf(ATTR(attrs, fullpath), RBH_PATH_MAX, "%s/%s", tmpstr,
-                     ATTR(attrs, name));
-            return ATTR(attrs, fullpath);
-        } else {    /* print <parent_id>/name */
-
-            sprintf(buff, DFID "/%s", PFID(&ATTR(attrs, parent_id)),
-                    ATTR(attrs, name));
-            return buff;
-        }
+    } else if (has_name) {
+        /* print <parent_id>/name */
+        sprintf(buff, DFID "/%s", PFID(&ATTR(attrs, parent_id)),
+                ATTR(attrs, name));
+        return buff;
     } else {
         /* last case: display the raw ID */
         sprintf(buff, DFID, PFID(p_id));
@@ -1089,6 +1372,115 @@ static const char *ResolvName(const entry_id_t *p_id, attr_set_t *attrs,
     }
 }
 
+#ifdef _LUSTRE
+/** display the usage of all OSTs from OST aggregates */
+static void report_ost_usage(int flags)
+{
+    ost_agg_t *tab = NULL;
+    unsigned int i, n = 0;
+    int rc;
+
+    rc = ListMgr_GetOSTAgg(&lmgr, -1, &tab, &n);
+    if (rc == DB_NOT_SUPPORTED) {
+        DisplayLog(LVL_MAJOR, REPORT_TAG, "OST aggregates are not "
+                   "maintained: enable ost_aggregates");
+        return;
+    } else if (rc) {
+        DisplayLog(LVL_CRIT, REPORT_TAG, "ERROR: could not retrieve OST "
+                   "usage: %s", lmgr_err2str(rc));
+        return;
+    }
+
+    if (!NOHEADER(flags)) {
+        if (CSV(flags))
+            printf("%6s, %10s, %16s, %16s\n", "ost", "count", "size",
+                   "spc_used");
+        else
+            printf("\n%6s  %10s  %12s  %12s\n", "ost", "files", "size",
+                   "spc_used");
+    }
+
+    for (i = 0; i < n; i++) {
+        if (CSV(flags))
+            printf("%6u, %10"PRIu64", %16"PRIu64", %16"PRIu64"\n",
+                   tab[i].ost_index, tab[i].count, tab[i].size,
+                   tab[i].blocks * DEV_BSIZE);
+        else {
+            char strsz[128], strspc[128];
+
+            FormatFileSize(strsz, sizeof(strsz), tab[i].size);
+            FormatFileSize(strspc, sizeof(strspc),
+                           tab[i].blocks * DEV_BSIZE);
+            printf("%6u  %10"PRIu64"  %12s  %12s\n", tab[i].ost_index,
+                   tab[i].count, strsz, strspc);
+        }
+    }
+
+    if (tab != NULL)
+        MemFree(tab);
+}
+
+/** display the usage history of a set of OSTs */
+static void report_ost_history(value_list_t *ost_list, int flags)
+{
+    unsigned int i, j;
+
+    if (CSV(flags) && !NOHEADER(flags))
+        printf("%6s, %19s, %16s, %16s, %16s, %6s\n", "ost", "time", "size",
+               "used", "avail", "used%");
+
+    for (i = 0; i < ost_list->count; i++) {
+        unsigned int idx = ost_list->values[i].val_uint;
+        ost_usage_sample_t *samples = NULL;
+        time_t *times = NULL;
+        unsigned int n = 0;
+        int rc;
+
+        rc = ListMgr_GetOSTUsageHistory(&lmgr, idx, 0, &times, &samples, &n);
+        if (rc == DB_NOT_EXISTS) {
+            DisplayLog(LVL_MAJOR, REPORT_TAG, "No OST usage history "
+                       "available: check ost_history_interval");
+            return;
+        } else if (rc) {
+            DisplayLog(LVL_CRIT, REPORT_TAG, "ERROR: could not retrieve "
+                       "history of OST #%u: %s", idx, lmgr_err2str(rc));
+            return;
+        }
+
+        if (!CSV(flags))
+            printf("\nOST #%u: %u samples\n", idx, n);
+
+        for (j = 0; j < n; j++) {
+            char date[128];
+            struct tm t;
+            double pct = samples[j].size ?
+                100.0 * samples[j].used / samples[j].size : 0.0;
+
+            strftime(date, sizeof(date), "%Y/%m/%d %T",
+                     localtime_r(&times[j], &t));
+
+            if (CSV(flags))
+                printf("%6u, %19s, %16"PRIu64", %16"PRIu64", %16"PRIu64
+                       ", %5.1f%%\n", idx, date, samples[j].size,
+                       samples[j].used, samples[j].avail, pct);
+            else {
+                char strsz[128], strused[128];
+
+                FormatFileSize(strsz, sizeof(strsz), samples[j].size);
+                FormatFileSize(strused, sizeof(strused), samples[j].used);
+                printf("    %s:  %s used / %s (%.1f%%)\n", date, strused,
+                       strsz, pct);
+            }
+        }
+
+        if (times != NULL)
+            MemFree(times);
+        if (samples != NULL)
+            MemFree(samples);
+    }
+}
+#endif
+
 static void dump_entries(type_dump type, int int_arg, char *str_arg,
                          value_list_t *ost_list, int flags)
 {
@@ -1098,6 +1490,7 @@ static void dump_entries(type_dump type, int int_arg, char *str_arg,
     lmgr_filter_t filter;
     filter_value_t fv;
     struct lmgr_iterator_t *it;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     attr_set_t attrs;
     entry_id_t id;
     int custom_len = 0;
@@ -1220,7 +1613,9 @@ static void dump_entries(type_dump type, int int_arg, char *str_arg,
     ATTR_MASK_INIT(&attrs);
     mask_sav = attrs.attr_mask = list2mask(list, list_cnt);
 
-    it = ListMgr_Iterator(&lmgr, &filter, NULL, NULL);
+    /* the result may not fit in memory: stream it */
+    opt.stream = 1;
+    it = ListMgr_Iterator(&lmgr, &filter, NULL, &opt);
 
     lmgr_simple_filter_free(&filter);
 
@@ -1330,7 +1725,7 @@ static void report_fs_info(int flags)
         {ATTR_INDEX_size, REPORT_MAX, SORT_NONE, false, 0, FV_NULL},
         {ATTR_INDEX_size, REPORT_AVG, SORT_NONE, false, 0, FV_NULL},
     };
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     profile_u prof;
     bool display_header = !NOHEADER(flags);
 
@@ -1493,7 +1888,7 @@ static void report_usergroup_info(char *name, int flags)
     bool is_filter = false;
     bool display_header = !NOHEADER(flags);
     unsigned long long total_size, total_used, total_count;
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
 #define USERINFOCOUNT_MAX 10
     db_value_t result[USERINFOCOUNT_MAX];
     profile_u prof;
@@ -1580,6 +1975,7 @@ static void report_usergroup_info(char *name, int flags)
     opt.list_count_max = 0;
     /* skip missing entries */
     opt.allow_no_attr = false;
+    opt.snapshot = !FRESH(flags);
 
     if (name) {
         lmgr_simple_filter_init(&filter);
@@ -1666,7 +2062,7 @@ static void report_topdirs(unsigned int count, int flags)
     lmgr_sort_type_t sorttype;
     lmgr_filter_t filter;
     filter_value_t fv;
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     struct lmgr_iterator_t *it;
     attr_set_t attrs;
     entry_id_t id;
@@ -1748,6 +2144,114 @@ static void report_topdirs(unsigned int count, int flags)
     ListMgr_CloseIterator(it);
 }
 
+/** entry of a report built from a sketch */
+struct sketch_entry {
+    entry_id_t  id;
+    attr_set_t  attrs;
+    uint64_t    val;
+};
+
+static int cmp_sketch_desc(const void *a, const void *b)
+{
+    const struct sketch_entry *e1 = a, *e2 = b;
+
+    return e1->val < e2->val ? 1 : (e1->val > e2->val ? -1 : 0);
+}
+
+static int cmp_sketch_asc(const void *a, const void *b)
+{
+    return cmp_sketch_desc(b, a);
+}
+
+/**
+ * Display the top entries of a sketch maintained by the daemon.
+ * The attributes of sketch entries are read from the DB, to skip removed
+ * entries and to sort them by their current value.
+ * @param sort_attr  ATTR_INDEX_size or ATTR_INDEX_last_access.
+ * @return 0 if the report was displayed, else the exact report must be run.
+ */
+static int report_sketch(const char *sketch, unsigned int sort_attr,
+                         bool desc, unsigned int count, unsigned int *list,
+                         int list_cnt, int flags)
+{
+    struct sketch_entry *entries;
+    entry_id_t *ids = NULL;
+    uint64_t *vals = NULL;
+    unsigned int i, n = 0, nb = 0;
+    int rc;
+
+    if (REVERSE(flags) || !EMPTY_STRING(path_filter)
+        || !EMPTY_STRING(class_filter)) {
+        DisplayLog(LVL_MAJOR, REPORT_TAG, "--approx is not supported with "
+                   "--reverse or filters: running the exact report");
+        return EINVAL;
+    }
+
+    rc = ListMgr_GetSketch(&lmgr, sketch, desc, &ids, &vals, &n);
+    if (rc == DB_SUCCESS && n == 0)
+        rc = DB_NOT_EXISTS;
+    if (rc) {
+        DisplayLog(LVL_MAJOR, REPORT_TAG, "No sketch '%s' available (%s): "
+                   "running the exact report", sketch, lmgr_err2str(rc));
+        goto free_ids;
+    }
+
+    entries = MemCalloc(n, sizeof(*entries));
+    if (entries == NULL) {
+        rc = ENOMEM;
+        goto free_ids;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct sketch_entry *e = &entries[nb];
+
+        ATTR_MASK_INIT(&e->attrs);
+        e->attrs.attr_mask = list2mask(list, list_cnt);
+
+        /* skip entries removed since the sketch was stored */
+        if (ListMgr_Get(&lmgr, &ids[i], &e->attrs) != DB_SUCCESS)
+            continue;
+
+        if (sort_attr == ATTR_INDEX_size && ATTR_MASK_TEST(&e->attrs, size))
+            e->val = ATTR(&e->attrs, size);
+        else if (sort_attr == ATTR_INDEX_last_access
+                 && ATTR_MASK_TEST(&e->attrs, last_access))
+            e->val = ATTR(&e->attrs, last_access);
+        else {
+            ListMgr_FreeAttrs(&e->attrs);
+            continue;
+        }
+        e->id = ids[i];
+        nb++;
+    }
+
+    qsort(entries, nb, sizeof(*entries),
+          desc ? cmp_sketch_desc : cmp_sketch_asc);
+
+    if (!(NOHEADER(flags)))
+        print_attr_list(1, list, list_cnt, NULL, CSV(flags));
+
+    for (i = 0; i < nb; i++) {
+        if (i < count || count == 0)
+            print_attr_values(i + 1, list, list_cnt, &entries[i].attrs,
+                              &entries[i].id, CSV(flags), NULL);
+        ListMgr_FreeAttrs(&entries[i].attrs);
+    }
+
+    if (!(NOHEADER(flags)))
+        printf("\n(approximate report: top %u of %u sketched entries)\n",
+               MIN2(count ? count : nb, nb), nb);
+
+    MemFree(entries);
+
+ free_ids:
+    if (ids != NULL)
+        MemFree(ids);
+    if (vals != NULL)
+        MemFree(vals);
+    return rc;
+}
+
 static void report_topsize(unsigned int count, int flags)
 {
     /* To be retrieved for files
@@ -1759,7 +2263,7 @@ static void report_topsize(unsigned int count, int flags)
     lmgr_sort_type_t sorttype;
     lmgr_filter_t filter;
     filter_value_t fv;
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     struct lmgr_iterator_t *it;
     attr_set_t attrs;
     entry_id_t id;
@@ -1776,6 +2280,11 @@ static void report_topsize(unsigned int count, int flags)
     };
     int list_cnt = sizeof(list) / sizeof(*list);
 
+    if (APPROX(flags)
+        && report_sketch(SKETCH_NAME_SIZE, ATTR_INDEX_size, true, count,
+                         list, list_cnt, flags) == 0)
+        return;
+
     /* select only files */
     fv.value.val_str = STR_TYPE_FILE;
     lmgr_simple_filter_init(&filter);
@@ -1830,7 +2339,7 @@ static void report_oldest(obj_type_t type, unsigned int count, int flags)
     lmgr_sort_type_t sorttype;
     lmgr_filter_t filter;
     filter_value_t fv;
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     struct lmgr_iterator_t *it;
     attr_set_t attrs;
     entry_id_t id;
@@ -1872,6 +2381,14 @@ static void report_oldest(obj_type_t type, unsigned int count, int flags)
     } else {
         list = list_files;
         list_cnt = sizeof(list_files) / sizeof(int);
+
+        if (APPROX(flags)
+            && report_sketch(SKETCH_NAME_ATIME, ATTR_INDEX_last_access, false,
+                             count, list, list_cnt, flags) == 0) {
+            lmgr_simple_filter_free(&filter);
+            return;
+        }
+
         fv.value.val_str = STR_TYPE_FILE;
         sorttype.attr_index = ATTR_INDEX_last_access;
     }
@@ -1932,7 +2449,7 @@ static void report_topuser(unsigned int count, int flags)
 {
     unsigned int result_count;
     struct lmgr_report_t *it;
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     int rc;
     unsigned int rank = 1;
     lmgr_filter_t filter;
@@ -1985,6 +2502,7 @@ static void report_topuser(unsigned int count, int flags)
     /* skip missing entries */
     opt.allow_no_attr = 0;
     opt.force_no_acct = FORCE_NO_ACCT(flags);
+    opt.snapshot = !FRESH(flags);
 
     /* select only files */
     lmgr_simple_filter_init(&filter);
@@ -2110,6 +2628,7 @@ static void report_class_info(int flags)
     unsigned int result_count;
     profile_u prof;
     bool is_filter = false;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
 
     unsigned long long total_size, total_count, total_used;
     total_size = total_count = total_used = 0;
@@ -2134,9 +2653,11 @@ static void report_class_info(int flags)
     mk_global_filters(&filter, !NOHEADER(flags), &is_filter);
     result_count = CLASSINFO_FIELDS;
 
+    opt.snapshot = !FRESH(flags);
+
     it = ListMgr_Report(&lmgr, class_info, CLASSINFO_FIELDS,
                         SPROF(flags) ? &size_profile : NULL,
-                        is_filter ? &filter : NULL, NULL);
+                        is_filter ? &filter : NULL, &opt);
 
     if (it == NULL) {
         DisplayLog(LVL_CRIT, REPORT_TAG,
@@ -2187,7 +2708,7 @@ static void report_status_info(int smi_index, const char *val, int flags)
 
     struct lmgr_report_t *it;
     lmgr_filter_t filter;
-    lmgr_iter_opt_t opt;
+    lmgr_iter_opt_t opt = LMGR_ITER_OPT_INIT;
     int rc;
     bool header;
     unsigned int result_count;
@@ -2241,6 +2762,7 @@ static void report_status_info(int smi_index, const char *val, int flags)
     opt.list_count_max = 0;
     /* skip missing entries */
     opt.allow_no_attr = false;
+    opt.snapshot = !FRESH(flags);
 
     /* @TODO add filter on status, if a value is specified */
 
@@ -2368,6 +2890,10 @@ int main(int argc, char **argv)
     char config_file[MAX_OPT_LEN] = "";
 
     bool activity = false;
+    bool trend = false;
+    char *trend_series = NULL;
+    stat_res_e trend_res = STAT_RES_HOUR;
+    int trend_since = -1;
     bool fs_info = false;
 
     bool entry_info = false;
@@ -2397,6 +2923,9 @@ int main(int argc, char **argv)
     bool dump_ost = false;
     value_list_t dump_ost_set = { 0, NULL };
     char ost_set_str[256] = "";
+    bool ost_history = false;
+    bool ost_usage = false;
+    value_list_t ost_history_set = { 0, NULL };
 #endif
     char *status_name = NULL;
     char *status_value = NULL;
@@ -2425,6 +2954,36 @@ int main(int argc, char **argv)
             activity = true;
             break;
 
+        case OPT_TREND:
+            trend = true;
+            trend_series = optarg;
+            break;
+
+        case OPT_TREND_RES:
+            if (!strcasecmp(optarg, "minute"))
+                trend_res = STAT_RES_MINUTE;
+            else if (!strcasecmp(optarg, "hour"))
+                trend_res = STAT_RES_HOUR;
+            else if (!strcasecmp(optarg, "day"))
+                trend_res = STAT_RES_DAY;
+            else {
+                fprintf(stderr,
+                        "Invalid value '%s' for --trend-res option: minute, hour or day expected.\n",
+                        optarg);
+                exit(1);
+            }
+            break;
+
+        case OPT_TREND_SINCE:
+            trend_since = str2duration(optarg);
+            if (trend_since == -1) {
+                fprintf(stderr,
+                        "Invalid value '%s' for --trend-since option: duration expected (e.g. 12h, 30d).\n",
+                        optarg);
+                exit(1);
+            }
+            break;
+
         case 'P':
             if (!optarg) {
                 fprintf(stderr,
@@ -2535,6 +3094,20 @@ int main(int argc, char **argv)
             /* copy arg to display it */
             rh_strncpy(ost_set_str, optarg, sizeof(ost_set_str));
             break;
+
+        case OPT_OST_USAGE:
+            ost_usage = true;
+            break;
+
+        case OPT_OST_HISTORY:
+            ost_history = true;
+            if (lmgr_range2list(optarg, DB_UINT, &ost_history_set)) {
+                fprintf(stderr,
+                        "Invalid value '%s' for --ost-history option: integer or set expected (e.g. 2 or 3,5-8,10-12).\n",
+                        optarg);
+                exit(1);
+            }
+            break;
 #endif
 
         case OPT_DUMP_STATUS:
@@ -2677,6 +3250,12 @@ int main(int argc, char **argv)
         case 'F':
             flags |= OPT_FLAG_NO_ACCT;
             break;
+        case OPT_FRESH:
+            flags |= OPT_FLAG_FRESH;
+            break;
+        case OPT_APPROX:
+            flags |= OPT_FLAG_APPROX;
+            break;
         case 'S':
             flags |= OPT_FLAG_SPLITUSERGROUP;
             break;
@@ -2723,13 +3302,13 @@ int main(int argc, char **argv)
     if (size_profile.range_ratio_len > 0)
         size_profile.range_ratio_sort = REVERSE(flags) ? SORT_ASC : SORT_DESC;
 
-    if (!activity && !fs_info && !user_info && !group_info
+    if (!activity && !trend && !fs_info && !user_info && !group_info
         && !topsize && !topuser && !dump_all && !dump_user
         && !dump_group && !class_info && !entry_info
         && (status_name == NULL) && (status_info_name == NULL)
         && !topdirs && !deferred_rm && !old_dirs && !old_files
 #ifdef _LUSTRE
-        && !dump_ost
+        && !dump_ost && !ost_history && !ost_usage
 #endif
         && !next_maint && !get_next_maint && !cancel_next_maint) {
         display_help(bin);
@@ -2799,6 +3378,19 @@ int main(int argc, char **argv)
     if (activity)
         report_activity(flags);
 
+    if (trend) {
+        time_t since = 0;
+
+        /* default period, depending on the resolution */
+        if (trend_since == -1)
+            trend_since = (trend_res == STAT_RES_MINUTE) ? 86400 :
+                (trend_res == STAT_RES_HOUR) ? 7 * 86400 : 0;
+        if (trend_since > 0)
+            since = time(NULL) - trend_since;
+
+        report_trend(trend_series, trend_res, since, flags);
+    }
+
     if (fs_info)
         report_fs_info(flags);
 
@@ -2850,6 +3442,15 @@ int main(int argc, char **argv)
         if (dump_ost_set.values)
             MemFree(dump_ost_set.values);
     }
+
+    if (ost_usage)
+        report_ost_usage(flags);
+
+    if (ost_history) {
+        report_ost_history(&ost_history_set, flags);
+        if (ost_history_set.values)
+            MemFree(ost_history_set.values);
+    }
 #endif
 
     if (status_name != NULL) {
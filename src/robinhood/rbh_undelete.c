@@ -27,6 +27,7 @@
 #include "xplatform_print.h"
 #include "rbh_basename.h"
 #include "cmd_helpers.h"
+#include "Memory.h"
 
 #include <unistd.h>
 #include <getopt.h>
@@ -34,6 +35,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 
 #define LOGTAG "Undelete"
 
@@ -44,6 +46,7 @@ static struct option option_tab[] = {
 
     {"statusmgr", required_argument, NULL, 's'},
     {"status-mgr", required_argument, NULL, 's'},
+    {"threads", required_argument, NULL, 't'},
 
     /* config file options */
     {"config-file", required_argument, NULL, 'f'},
@@ -59,13 +62,15 @@ static struct option option_tab[] = {
 
 };
 
-#define SHORT_OPT_STRING    "LRs:f:l:hV"
+#define SHORT_OPT_STRING    "LRs:t:f:l:hV"
 
 /* global variables */
 
 static lmgr_t         lmgr;
 char                  path_filter[RBH_PATH_MAX] = "";
 static sm_instance_t *smi = NULL;
+static unsigned int   nb_threads = 1;
+static bool           terminate = false;
 
 /* special character sequences for displaying help */
 
@@ -90,6 +95,11 @@ static const char *help_string =
     "\n"
     _B "Behavior options:" B_ "\n"
     "    " _B "--status-mgr" B_ _U "statusmgr" U_", " _B "-s" B_ _U "statusmgr" U_"\n"
+    "    " _B "--threads" B_ " " _U "count" U_ ", " _B "-t" B_ " " _U "count" U_ "\n"
+    "        Restore entries with parallel threads (default: 1).\n"
+    "        Directories and symlinks are always restored first, by depth order,\n"
+    "        then the data of files. An interrupted restore can be run again\n"
+    "        to restore the remaining entries.\n"
     "\n"
     _B "Config file options:" B_ "\n"
     "    " _B "-f" B_ " " _U "file" U_ ", " _B "--config-file=" B_ _U "file" U_ "\n"
@@ -307,40 +317,105 @@ static const char *st_names[] = {
     [RS_ERROR] = "errors"
 };
 
-static void undelete_helper(const entry_id_t *id, const attr_set_t *attrs)
+/** DB updates of restored entries, applied by batches */
+#define UNDEL_BATCH_SIZE 256
+
+struct undel_batch {
+    unsigned int count;
+    entry_id_t   old_ids[UNDEL_BATCH_SIZE];
+    entry_id_t   new_ids[UNDEL_BATCH_SIZE];
+    attr_set_t   new_attrs[UNDEL_BATCH_SIZE];
+};
+
+static void undel_batch_flush(lmgr_t *p_mgr, struct undel_batch *batch)
+{
+    const entry_id_t *old_ids[UNDEL_BATCH_SIZE];
+    entry_id_t *ids[UNDEL_BATCH_SIZE];
+    attr_set_t *attrs[UNDEL_BATCH_SIZE];
+    unsigned int i, first;
+    int rc;
+
+    if (batch->count == 0)
+        return;
+
+    for (i = 0; i < batch->count; i++)
+        old_ids[i] = &batch->old_ids[i];
+
+    /* discard entries from remove list */
+    rc = ListMgr_SoftRemove_BatchDiscard(p_mgr, batch->count, old_ids);
+    if (rc) {
+        __sync_fetch_and_add(&db_err, batch->count);
+        fprintf(stderr, "Error %d: could not remove %u previous ids from "
+                "database\n", rc, batch->count);
+    }
+
+    /* insert entries by groups with the same attribute mask */
+    for (first = 0; first < batch->count; first = i) {
+        for (i = first; i < batch->count
+             && attr_mask_equal(&batch->new_attrs[i].attr_mask,
+                                &batch->new_attrs[first].attr_mask); i++) {
+            ids[i - first] = &batch->new_ids[i];
+            attrs[i - first] = &batch->new_attrs[i];
+        }
+
+        rc = ListMgr_BatchInsert(p_mgr, ids, attrs, i - first, true);
+        if (rc) {
+            __sync_fetch_and_add(&db_err, i - first);
+            fprintf(stderr, "ERROR %d inserting %u entries in the "
+                    "database\n", rc, i - first);
+        }
+    }
+
+    for (i = 0; i < batch->count; i++)
+        ListMgr_FreeAttrs(&batch->new_attrs[i]);
+    batch->count = 0;
+}
+
+/**
+ * Restore an entry.
+ * @param batch  if not NULL, DB updates are added to this batch
+ *               instead of being applied immediately.
+ */
+static void undelete_helper(lmgr_t *p_mgr, struct undel_batch *batch,
+                            const entry_id_t *id, const attr_set_t *attrs)
 {
     entry_id_t new_id = { 0 };
     recov_status_t st;
     attr_set_t new_attrs = ATTR_SET_INIT;
     int rc;
 
-    printf("Restoring '%s'...", ATTR(attrs, fullpath));
-
     st = smi->sm->undelete_func(smi, id, attrs, &new_id, &new_attrs, false);
 
-    counters[st]++;
+    __sync_fetch_and_add(&counters[st], 1);
 
+    /* print a single line, as several threads may restore entries */
     switch (st) {
     case RS_FILE_OK:
-        printf("\t restore OK (file)\n");
+        printf("Restoring '%s'...\t restore OK (file)\n",
+               ATTR(attrs, fullpath));
         break;
     case RS_FILE_DELTA:
-        printf("\t restored previous version (file)\n");
+        printf("Restoring '%s'...\t restored previous version (file)\n",
+               ATTR(attrs, fullpath));
         break;
     case RS_FILE_EMPTY:
-        printf("\t restore OK (empty file)\n");
+        printf("Restoring '%s'...\t restore OK (empty file)\n",
+               ATTR(attrs, fullpath));
         break;
     case RS_NON_FILE:
-        printf("\t restore OK (%s)\n", ATTR(attrs, type));
+        printf("Restoring '%s'...\t restore OK (%s)\n",
+               ATTR(attrs, fullpath), ATTR(attrs, type));
         break;
     case RS_NOBACKUP:
-        printf("\t cannot restore %s (no backup)\n", ATTR(attrs, type));
+        printf("Restoring '%s'...\t cannot restore %s (no backup)\n",
+               ATTR(attrs, fullpath), ATTR(attrs, type));
         break;
     case RS_ERROR:
-        printf("\t ERROR\n");
+        printf("Restoring '%s'...\t ERROR\n", ATTR(attrs, fullpath));
         break;
     default:
-        printf("ERROR: UNEXPECTED STATUS %d\n", st);
+        printf("Restoring '%s'...ERROR: UNEXPECTED STATUS %d\n",
+               ATTR(attrs, fullpath), st);
     }
     /* TODO for symlinks and dir, we can implement a common recovery
      * that consists in setting entry attributes from DB.
@@ -349,18 +424,28 @@ static void undelete_helper(const entry_id_t *id, const attr_set_t *attrs)
 
     if ((st == RS_FILE_OK) || (st == RS_FILE_DELTA) || (st == RS_FILE_EMPTY)
         || (st == RS_NON_FILE)) {
+        /* clean read-only attrs */
+        attr_mask_unset_readonly(&new_attrs.attr_mask);
+
+        if (batch != NULL) {
+            batch->old_ids[batch->count] = *id;
+            batch->new_ids[batch->count] = new_id;
+            batch->new_attrs[batch->count] = new_attrs;
+            batch->count++;
+            if (batch->count == UNDEL_BATCH_SIZE)
+                undel_batch_flush(p_mgr, batch);
+            return;
+        }
+
         /* discard entry from remove list */
-        if (ListMgr_SoftRemove_Discard(&lmgr, id) != 0) {
+        if (ListMgr_SoftRemove_Discard(p_mgr, id) != 0) {
             db_err++;
             fprintf(stderr, "Error: could not remove previous id " DFID
                     " from database\n", PFID(id));
         }
 
-        /* clean read-only attrs */
-        attr_mask_unset_readonly(&new_attrs.attr_mask);
-
         /* insert or update it in the db */
-        rc = ListMgr_Insert(&lmgr, &new_id, &new_attrs, true);
+        rc = ListMgr_Insert(p_mgr, &new_id, &new_attrs, true);
         if (rc == 0)
             printf("\tEntry successfully updated in the dabatase\n");
         else {
@@ -370,10 +455,317 @@ static void undelete_helper(const entry_id_t *id, const attr_set_t *attrs)
     }
 }
 
+/* ---- parallel restore ----
+ * The main thread lists removed entries and queues them to worker
+ * threads. Each worker has its own DB connection and applies DB updates by
+ * batches. Restored entries leave the list of removed entries, so an
+ * interrupted restore can simply be run again.
+ */
+#define UNDEL_QUEUE_SIZE 1024
+
+struct undel_job {
+    entry_id_t   id;
+    attr_set_t   attrs;
+    unsigned int depth;     /* path depth, to restore parents first */
+};
+
+static struct undel_queue {
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    struct undel_job *jobs;     /* ring of UNDEL_QUEUE_SIZE jobs */
+    unsigned int      first;
+    unsigned int      count;
+    unsigned int      busy;     /* jobs being processed */
+    bool              done;     /* no more jobs will be queued */
+} undel_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct undel_worker {
+    pthread_t          thread;
+    lmgr_t             lmgr;
+    struct undel_batch batch;
+};
+
+/** queue an entry (the queue takes ownership of its attributes) */
+static void undel_queue_push(const entry_id_t *id, attr_set_t *attrs)
+{
+    struct undel_job *job;
+
+    P(undel_queue.lock);
+    while (undel_queue.count == UNDEL_QUEUE_SIZE)
+        pthread_cond_wait(&undel_queue.cond, &undel_queue.lock);
+
+    job = &undel_queue.jobs[(undel_queue.first + undel_queue.count)
+                            % UNDEL_QUEUE_SIZE];
+    job->id = *id;
+    job->attrs = *attrs;
+    undel_queue.count++;
+    pthread_cond_broadcast(&undel_queue.cond);
+    V(undel_queue.lock);
+}
+
+/** @return false when there is no more job */
+static bool undel_queue_pop(struct undel_job *job)
+{
+    P(undel_queue.lock);
+    while (undel_queue.count == 0 && !undel_queue.done)
+        pthread_cond_wait(&undel_queue.cond, &undel_queue.lock);
+
+    if (undel_queue.count == 0) {
+        V(undel_queue.lock);
+        return false;
+    }
+
+    *job = undel_queue.jobs[undel_queue.first];
+    undel_queue.first = (undel_queue.first + 1) % UNDEL_QUEUE_SIZE;
+    undel_queue.count--;
+    undel_queue.busy++;
+    pthread_cond_broadcast(&undel_queue.cond);
+    V(undel_queue.lock);
+    return true;
+}
+
+static void undel_queue_job_done(void)
+{
+    P(undel_queue.lock);
+    undel_queue.busy--;
+    pthread_cond_broadcast(&undel_queue.cond);
+    V(undel_queue.lock);
+}
+
+/** wait for all queued entries to be restored */
+static void undel_queue_wait_idle(void)
+{
+    P(undel_queue.lock);
+    while (undel_queue.count > 0 || undel_queue.busy > 0)
+        pthread_cond_wait(&undel_queue.cond, &undel_queue.lock);
+    V(undel_queue.lock);
+}
+
+static void *undel_worker_thr(void *arg)
+{
+    struct undel_worker *w = arg;
+    struct undel_job job;
+
+    while (undel_queue_pop(&job)) {
+        undelete_helper(&w->lmgr, &w->batch, &job.id, &job.attrs);
+        ListMgr_FreeAttrs(&job.attrs);
+        undel_queue_job_done();
+    }
+    undel_batch_flush(&w->lmgr, &w->batch);
+    return NULL;
+}
+
+static void undel_terminate_handler(int sig)
+{
+    terminate = true;
+}
+
+static unsigned int path_depth(const attr_set_t *attrs)
+{
+    const char *c;
+    unsigned int depth = 0;
+
+    if (!ATTR_MASK_TEST(attrs, fullpath))
+        return 0;
+
+    for (c = ATTR(attrs, fullpath); *c != '\0'; c++)
+        if (*c == '/')
+            depth++;
+    return depth;
+}
+
+static int cmp_depth(const void *a, const void *b)
+{
+    unsigned int da = ((const struct undel_job *)a)->depth;
+    unsigned int db = ((const struct undel_job *)b)->depth;
+
+    return (da > db) - (da < db);
+}
+
+/**
+ * List removed entries of the given type (files or other entries).
+ * @return NULL on error.
+ */
+static struct lmgr_rm_list_t *rm_list_by_type(bool files)
+{
+    struct lmgr_rm_list_t *list;
+    lmgr_filter_t filter = { 0 };
+    filter_value_t fv;
+
+    lmgr_simple_filter_init(&filter);
+    mk_path_filter(&filter, false, NULL);
+
+    fv.value.val_str = STR_TYPE_FILE;
+    lmgr_simple_filter_add(&filter, ATTR_INDEX_type, files ? EQUAL : NOTEQUAL,
+                           fv, 0);
+
+    list = ListMgr_RmList(&lmgr, &filter, NULL);
+    lmgr_simple_filter_free(&filter);
+
+    if (list == NULL)
+        DisplayLog(LVL_CRIT, LOGTAG,
+                   "ERROR: Could not retrieve removed entries from database.");
+    return list;
+}
+
+/** restore directories and symlinks, by depth order */
+static int undelete_non_files(attr_mask_t mask)
+{
+    struct lmgr_rm_list_t *list;
+    struct undel_job *entries = NULL;
+    unsigned int count = 0, size = 0, i;
+    entry_id_t id;
+    attr_set_t attrs = ATTR_SET_INIT;
+
+    list = rm_list_by_type(false);
+    if (list == NULL)
+        return -1;
+
+    attrs.attr_mask = mask;
+    while (ListMgr_GetNextRmEntry(list, &id, &attrs) == DB_SUCCESS) {
+        if (count == size) {
+            struct undel_job *tmp;
+
+            size = size ? 2 * size : 1024;
+            tmp = MemRealloc(entries, size * sizeof(*entries));
+            if (tmp == NULL) {
+                DisplayLog(LVL_CRIT, LOGTAG, "ERROR: cannot allocate memory "
+                           "to list removed directories");
+                ListMgr_FreeAttrs(&attrs);
+                break;
+            }
+            entries = tmp;
+        }
+        entries[count].id = id;
+        entries[count].attrs = attrs;
+        entries[count].depth = path_depth(&attrs);
+        count++;
+
+        memset(&attrs, 0, sizeof(attrs));
+        attrs.attr_mask = mask;
+    }
+    ListMgr_CloseRmList(list);
+
+    /* parents must exist before their children are restored */
+    qsort(entries, count, sizeof(*entries), cmp_depth);
+
+    for (i = 0; i < count; i++) {
+        if (terminate) {
+            ListMgr_FreeAttrs(&entries[i].attrs);
+            continue;
+        }
+        /* restore the entries of a level in parallel */
+        if (i > 0 && entries[i].depth != entries[i - 1].depth)
+            undel_queue_wait_idle();
+
+        undel_queue_push(&entries[i].id, &entries[i].attrs);
+    }
+    undel_queue_wait_idle();
+
+    MemFree(entries);
+    return 0;
+}
+
+/** restore file data */
+static int undelete_files(attr_mask_t mask)
+{
+    struct lmgr_rm_list_t *list;
+    entry_id_t id;
+    attr_set_t attrs = ATTR_SET_INIT;
+
+    list = rm_list_by_type(true);
+    if (list == NULL)
+        return -1;
+
+    attrs.attr_mask = mask;
+    while (!terminate
+           && ListMgr_GetNextRmEntry(list, &id, &attrs) == DB_SUCCESS) {
+        undel_queue_push(&id, &attrs);
+
+        memset(&attrs, 0, sizeof(attrs));
+        attrs.attr_mask = mask;
+    }
+    ListMgr_CloseRmList(list);
+    return 0;
+}
+
+static int undelete_parallel(attr_mask_t mask)
+{
+    struct undel_worker *workers;
+    struct sigaction act;
+    unsigned int i, started;
+    int rc;
+
+    undel_queue.jobs = MemCalloc(UNDEL_QUEUE_SIZE, sizeof(*undel_queue.jobs));
+    workers = MemCalloc(nb_threads, sizeof(*workers));
+    if (undel_queue.jobs == NULL || workers == NULL) {
+        MemFree(undel_queue.jobs);
+        MemFree(workers);
+        return -ENOMEM;
+    }
+
+    /* stop listing entries on SIGINT/SIGTERM, and flush pending DB
+     * updates */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = undel_terminate_handler;
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT, &act, NULL);
+
+    for (started = 0; started < nb_threads; started++) {
+        rc = ListMgr_InitAccess(&workers[started].lmgr);
+        if (rc) {
+            DisplayLog(LVL_CRIT, LOGTAG, "Error %d: cannot connect to "
+                       "database", rc);
+            break;
+        }
+        if (pthread_create(&workers[started].thread, NULL, undel_worker_thr,
+                           &workers[started]) != 0) {
+            DisplayLog(LVL_CRIT, LOGTAG, "Error starting restore thread: %s",
+                       strerror(errno));
+            ListMgr_CloseAccess(&workers[started].lmgr);
+            break;
+        }
+    }
+
+    if (started == 0) {
+        rc = -1;
+        goto out;
+    }
+
+    if (started > 1)
+        printf("Restoring entries with %u threads\n", started);
+
+    rc = undelete_non_files(mask);
+    if (rc == 0)
+        rc = undelete_files(mask);
+
+    /* let workers restore queued entries and exit */
+    P(undel_queue.lock);
+    undel_queue.done = true;
+    pthread_cond_broadcast(&undel_queue.cond);
+    V(undel_queue.lock);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ListMgr_CloseAccess(&workers[i].lmgr);
+    }
+
+    if (terminate)
+        printf("\nInterrupted: run the same command again to restore "
+               "the remaining entries.\n");
+
+ out:
+    MemFree(workers);
+    MemFree(undel_queue.jobs);
+    return rc;
+}
+
 static int undelete(void)
 {
     int rc;
-    struct lmgr_rm_list_t *list;
     entry_id_t id;
     attr_set_t attrs = ATTR_SET_INIT;
     attr_mask_t mask;
@@ -388,7 +780,7 @@ static int undelete(void)
     if (is_id_filter(&id)) {    /* 1 single entry */
         rc = ListMgr_GetRmEntry(&lmgr, &id, &attrs);
         if (rc == DB_SUCCESS) {
-            undelete_helper(&id, &attrs);
+            undelete_helper(&lmgr, NULL, &id, &attrs);
         } else if (rc == DB_NOT_EXISTS)
             DisplayLog(LVL_CRIT, LOGTAG,
                        DFID ": fid not found in removed entries", PFID(&id));
@@ -397,35 +789,12 @@ static int undelete(void)
                        "ERROR %d in ListMgr_GetRmEntry(" DFID ")",
                        rc, PFID(&id));
         return rc;
-    } else {    /* recover a list of entries */
-
-        lmgr_filter_t filter = { 0 };
-        bool filter_init = false;
-
-        /* set filters */
-        mk_path_filter(&filter, false, &filter_init);
-
-        /* list files to be recovered */
-        list = ListMgr_RmList(&lmgr, filter_init ? &filter : NULL, NULL);
-
-        if (filter_init)
-            lmgr_simple_filter_free(&filter);
-
-        if (list == NULL) {
-            DisplayLog(LVL_CRIT, LOGTAG,
-                       "ERROR: Could not retrieve removed entries from database.");
-            return -1;
-        }
-
-        while ((rc = ListMgr_GetNextRmEntry(list, &id, &attrs)) == DB_SUCCESS) {
-            undelete_helper(&id, &attrs);
-
-            /* prepare next call */
-            ListMgr_FreeAttrs(&attrs);
-            memset(&attrs, 0, sizeof(attrs));
-            attrs.attr_mask = mask;
-        }
-        ListMgr_CloseRmList(list);
+    } else {
+        /* recover a list of entries: parents first, with batched DB
+         * updates (with a single worker by default) */
+        rc = undelete_parallel(mask);
+        if (rc)
+            return rc;
     }
 
     /* display summary */
@@ -544,6 +913,18 @@ int main(int argc, char **argv)
                 rh_strncpy(sm_name, optarg, sizeof(sm_name));
             break;
 
+        case 't':
+        {
+            int n = str2int(optarg);
+
+            if (n <= 0) {
+                fprintf(stderr, "Invalid value '%s' for --threads: "
+                        "positive integer expected\n", optarg);
+                exit(1);
+            }
+            nb_threads = n;
+            break;
+        }
         case 'f':
             rh_strncpy(config_file, optarg, MAX_OPT_LEN);
             break;
@@ -28,6 +28,7 @@
 #endif
 
 #include "uidgidcache.h"
+#include "rbh_intern.h"
 #include "rbh_logs.h"
 
 #include <stdio.h>
@@ -40,6 +41,10 @@
  * and the cache only care about the names and the UID/GID, so don't
  * fill the rest of the structures. */
 #define MAX_UID 100000
+/* number of lookups of unknown ids */
+static unsigned int unknown_uid_calls;
+static unsigned int unknown_gid_calls;
+
 int getpwuid_r(uid_t uid, struct passwd *pwd,
                char *buf, size_t buflen, struct passwd **result)
 {
@@ -47,8 +52,10 @@ int getpwuid_r(uid_t uid, struct passwd *pwd,
     sprintf(buf, "%ld", (long)uid);
     pwd->pw_name = buf;
 
-    if (uid >= MAX_UID)
+    if (uid >= MAX_UID) {
+        unknown_uid_calls++;
         *result = NULL;
+    }
     else
         *result = pwd;
 
@@ -63,8 +70,10 @@ int getgrgid_r(gid_t gid, struct group *grp,
     sprintf(buf, "%ld", (long)gid);
     grp->gr_name = buf;
 
-    if (gid >= MAX_GID)
+    if (gid >= MAX_GID) {
+        unknown_gid_calls++;
         *result = NULL;
+    }
     else
         *result = grp;
 
@@ -172,9 +181,14 @@ int main(int argc, char **argv)
 
         sprintf(buf, "%ld", (long)u);
         assert(strcmp(ppw->pw_name, buf) == 0);
+        /* names are interned */
+        assert(ppw->pw_name == str_intern(buf));
     }
 
     assert(GetPwUid(MAX_UID) == NULL);
+    /* failed lookups are cached */
+    assert(GetPwUid(MAX_UID) == NULL);
+    assert(unknown_uid_calls == 1);
 
     printf("\nTest of group cache\n");
 
@@ -228,9 +242,13 @@ int main(int argc, char **argv)
 
         sprintf(buf, "%ld", (long)g);
         assert(strcmp(pgr->gr_name, buf) == 0);
+        assert(pgr->gr_name == str_intern(buf));
     }
 
     assert(GetGrGid(MAX_GID) == NULL);
+    /* failed lookups are cached */
+    assert(GetGrGid(MAX_GID) == NULL);
+    assert(unknown_gid_calls == 1);
 
     printf("Stats:\n");
     printf("  password cache hit=%d, miss=%d\n", pw_nb_get, pw_nb_set);
@@ -0,0 +1,170 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * Copyright (C) 2009, 2010 CEA/DAM
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Capture raw changelog records of a MDT to a file, so they can be
+ * replayed later by 'robinhood --replay=<file>'.
+ * Records are not cleared from the changelog.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "rbh_misc.h"
+#include "rbh_basename.h"
+#include "../robinhood/cmd_helpers.h"
+#include "../chglog_reader/cl_spool.h"
+#include <unistd.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#define OPT_STRING    "s:n:F"
+
+static const char *help_string =
+    _B "Usage:" B_ " %s [-s <start_rec>][-n <count>][-F] <mdt_device> <output_file>\n"
+    "\n"
+    "Capture the changelog records of "_U"mdt_device"U_" (e.g. lustre-MDT0000)\n"
+    "to "_U"output_file"U_", to replay them with 'robinhood --replay'.\n"
+    "Records are not cleared from the changelog.\n"
+    "    -s "_U"start_rec"U_"\n"
+    "        Start from the given record (default: first record).\n"
+    "    -n "_U"count"U_"\n"
+    "        Stop after "_U"count"U_" records.\n"
+    "    -F\n"
+    "        Wait for new records until interrupted (else, stop at the end of\n"
+    "        the changelog).\n";
+
+static inline void display_help(const char *bin_name)
+{
+    printf(help_string, bin_name);
+}
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_stop(int sig)
+{
+    stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+    int c, rc, fd;
+    const char *bin;
+    long long start_rec = 0;
+    long long max_count = 0;
+    unsigned long long count = 0;
+    int flags = CHANGELOG_FLAG_BLOCK;
+    struct sigaction act;
+    void *hdlr;
+
+    bin = rh_basename(argv[0]);
+
+    while ((c = getopt(argc, argv, OPT_STRING)) != -1) {
+        switch (c) {
+        case 's':
+            start_rec = str2bigint(optarg);
+            if (start_rec < 0) {
+                fprintf(stderr, "Invalid parameter '%s' for '-s' option: "
+                        "positive integer expected\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            max_count = str2bigint(optarg);
+            if (max_count <= 0) {
+                fprintf(stderr, "Invalid parameter '%s' for '-n' option: "
+                        "positive integer expected\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'F':
+            flags |= CHANGELOG_FLAG_FOLLOW;
+            break;
+        case ':':
+        case '?':
+        default:
+            display_help(bin);
+            exit(1);
+            break;
+        }
+    }
+
+    if (optind != argc - 2) {
+        display_help(bin);
+        exit(1);
+    }
+
+    fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        rc = errno;
+        fprintf(stderr, "Cannot open '%s' for writing: %s\n", argv[optind + 1],
+                strerror(rc));
+        exit(rc);
+    }
+
+    rc = llapi_changelog_start(&hdlr, flags, argv[optind], start_rec);
+    if (rc) {
+        fprintf(stderr, "Error %d opening changelog of '%s': %s\n", rc,
+                argv[optind], strerror(abs(rc)));
+        close(fd);
+        exit(abs(rc));
+    }
+
+    /* interrupt the capture cleanly */
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handle_stop;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    while (!stop && (max_count == 0 || count < max_count)) {
+        CL_REC_TYPE *rec;
+
+        rc = llapi_changelog_recv(hdlr, &rec);
+        if (rc == -EINTR)
+            continue;
+        if (rc == 1) { /* EOF */
+            rc = 0;
+            break;
+        }
+        if (rc) {
+            fprintf(stderr, "Error %d reading changelog: %s\n", rc,
+                    strerror(abs(rc)));
+            break;
+        }
+
+        rc = cl_recfile_write(fd, rec);
+        llapi_changelog_free(&rec);
+        if (rc) {
+            fprintf(stderr, "Error writing to '%s': %s\n", argv[optind + 1],
+                    strerror(rc));
+            break;
+        }
+        count++;
+    }
+
+    llapi_changelog_fini(&hdlr);
+    if (close(fd) != 0 && rc == 0)
+        rc = errno;
+
+    fprintf(stderr, "%llu records captured to '%s'\n", count,
+            argv[optind + 1]);
+
+    return abs(rc);
+}
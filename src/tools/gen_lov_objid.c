@@ -178,6 +178,14 @@ int main( int argc, char **argv )
         exit( rc );
     }
 
+    /* object ids are packed with other stripe items */
+    if (lmgr_config.compact_stripes)
+    {
+        DisplayLog(LVL_CRIT, TAG, "Object ids cannot be retrieved when "
+                   "ListManager::compact_stripes is enabled");
+        return ENOTSUP;
+    }
+
     out = fopen(output_file, "w");
     if (!out)
     {
@@ -12,7 +12,8 @@
  * accept its terms.
  */
 
-/* read rbh-diff fid_remap as input, and update trusted.fid xattr for OST objects */
+/* read rbh-diff fid_remap as input, and update trusted.fid xattr for OST objects
+ * (in parallel, see tool_batch.h) */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -30,13 +31,15 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include "lustre_extended_types.h"
+#include "tool_batch.h"
 
 static void usage(const char *argv0)
 {
-    fprintf(stderr, "Usage: %s <ost_index> <ost_mount_point> <fid_remap_file>\n",
-            rh_basename(argv0));
+    fprintf(stderr, "Usage: %s " BATCH_USAGE " <ost_index> <ost_mount_point> "
+            "<fid_remap_file>\n", rh_basename(argv0));
     exit(1);
 }
 
@@ -63,38 +66,121 @@ static int str2int(const char *str)
         return -1;
 }
 
-int main(int argc, char ** argv)
+struct remap_arg {
+    unsigned int    ost_idx;
+    const char     *ost_root;
+};
+
+/* remap the object of a fid_remap line */
+static int remap_line(char *buff, unsigned long nl, void *arg)
 {
-    char buff[4096];
+    const struct remap_arg *ra = arg;
     char path[PATH_MAX];
     char xattr[4096];
     ssize_t s;
-    int len, rc;
-    int nl = 0;
-    int errors = 0;
-    int ignored_lines = 0;
-    int ok = 0;
-    int match_ost = 0;
-    const char *ost_root, *file;
+    unsigned int ost_idx = 0, snum = 0;
+    uint64_t     obj_id = 0;
+    lustre_fid   oldfid = {0},
+                 newfid = {0};
+
+    /* line format: ost_idx obj_id oldfid newfid */
+    if (sscanf(buff, "%u %u %"PRIu64" ["SFID"] ["SFID"]",
+               &ost_idx, &snum, &obj_id, RFID(&oldfid), RFID(&newfid)) != 9)
+    {
+        fprintf(stderr, "ERROR: Invalid line format or empty line at line %lu\n", nl);
+        return LINE_IGNORED;
+    }
+
+    if (ra->ost_idx != ost_idx)
+        return LINE_IGNORED;
+
+    /* build path related to object index */
+    sprintf(path,"%s/O/0/d%u/%"PRIu64, ra->ost_root, (unsigned int)(obj_id % 32), obj_id);
+
+    /* get previous fid for the object */
+    s = lgetxattr(path, "trusted.fid", xattr, 4096);
+    if (s < 0)
+    {
+        fprintf(stderr, "Can't check previous FID for object %"PRIu64" (%s): %s.\n",
+                obj_id, path, strerror(errno));
+        return LINE_ERROR;
+    }
+    if (s != sizeof(struct filter_fid))
+    {
+        fprintf(stderr, "ERROR: unexpected size for fid xattr: %zu != %zu\n",
+                s, sizeof(lustre_fid));
+        return LINE_ERROR;
+    }
+    struct filter_fid *ffid = (struct filter_fid *)xattr;
+
+    // ff_parent.f_ver == file stripe number
+    oldfid.f_ver = snum;
+    newfid.f_ver = snum;
+
+    if (memcmp(&ffid->ff_parent, &oldfid, sizeof(lustre_fid)))
+    {
+        if (memcmp(&ffid->ff_parent, &newfid, sizeof(lustre_fid)) == 0)
+            fprintf(stderr, "ERROR: new FID is already set for object %"PRIu64" (%s): "
+                    "current="DFID", old="DFID", new="DFID"\n", obj_id, path,
+                    PFID(&ffid->ff_parent), PFID(&oldfid), PFID(&newfid));
+        else
+            fprintf(stderr, "ERROR: unexpected FID for object %"PRIu64" (%s): "
+                    "current="DFID", expected="DFID"\n", obj_id, path,
+                    PFID(&ffid->ff_parent), PFID(&oldfid));
+        return LINE_ERROR;
+    }
+    if (ffid->ff_objid != obj_id)
+    {
+        fprintf(stderr, "ERROR: object id doesn't match! got: %"PRIu64", expected: %"PRIu64" (%s)\n",
+                (uint64_t)ffid->ff_objid, obj_id, path);
+        return LINE_ERROR;
+    }
+
+    /* set the filter with the right fid */
+    memcpy(&ffid->ff_parent, &newfid, sizeof(lustre_fid));
+    printf("objid %"PRIu64": "DFID"->"DFID"\n", obj_id, PFID(&oldfid), PFID(&newfid));
+    if (lsetxattr(path, "trusted.fid", ffid, sizeof(struct filter_fid), XATTR_REPLACE))
+    {
+        fprintf(stderr, "ERROR: failed to update object's FID for object %"PRIu64" (%s): %s",
+                obj_id, path, strerror(errno));
+        return LINE_ERROR;
+    }
+    return LINE_OK;
+}
+
+int main(int argc, char ** argv)
+{
+    struct batch_opts opts = BATCH_OPTS_DEFAULT;
+    struct batch_stats stats;
+    struct remap_arg ra;
+    const char *file;
     int idx = 0;
+    int c, rc;
     FILE *f;
 
-    if (argc != 4)
+    while ((c = getopt(argc, argv, BATCH_OPTSTRING)) != -1)
+    {
+        if (batch_getopt(c, optarg, &opts) != 1)
+            usage(argv[0]);
+    }
+
+    if (argc - optind != 3)
         usage(argv[0]);
 
-    if (argv[2][0] != '/')
+    if (argv[optind + 1][0] != '/')
     {
         fprintf(stderr, "ERROR: absolute path expected for <ost_mount_point>\n");
         usage(argv[0]);
     }
-    idx = str2int(argv[1]);
+    idx = str2int(argv[optind]);
     if (idx == -1)
     {
         fprintf(stderr, "ERROR: positive integer expected for <ost_index>\n");
         usage(argv[0]);
     }
-    ost_root = argv[2];
-    file = argv[3];
+    ra.ost_idx = idx;
+    ra.ost_root = argv[optind + 1];
+    file = argv[optind + 2];
 
     f = fopen(file,"r");
     if (f == NULL)
@@ -105,97 +191,16 @@ int main(int argc, char ** argv)
         exit(rc);
     }
 
-    while(fgets(buff, 4096, f))
-    {
-        unsigned int ost_idx = 0, snum = 0;
-        uint64_t     obj_id = 0;
-        lustre_fid   oldfid = {0},
-                     newfid = {0};
-
-        nl++;
-
-        len = strlen(buff);
-        /* remove final '\n' */
-        if (len > 0 && buff[len-1] == '\n')
-            buff[len-1] = '\0';
-
-        /* line format: ost_idx obj_id oldfid newfid */
-        if (sscanf(buff, "%u %u %"PRIu64" ["SFID"] ["SFID"]",
-                   &ost_idx, &snum, &obj_id, RFID(&oldfid), RFID(&newfid)) != 9)
-        {
-            fprintf(stderr, "ERROR: Invalid line format or empty line at line %u\n", nl);
-            ignored_lines++;
-            continue;
-        }
-
-        if (idx != ost_idx)
-        {
-            ignored_lines++;
-            continue;
-        }
-        match_ost++;
-
-        /* build path related to object index */
-        sprintf(path,"%s/O/0/d%u/%"PRIu64, ost_root, (unsigned int)(obj_id % 32), obj_id);
-
-        /* get previous fid for the object */
-        s = lgetxattr(path, "trusted.fid", xattr, 4096);
-        if (s < 0)
-        {
-            fprintf(stderr, "Can't check previous FID for object %"PRIu64" (%s): %s.\n",
-                    obj_id, path, strerror(errno));
-            errors ++;
-            continue;
-        }
-        if (s != sizeof(struct filter_fid))
-        {
-            fprintf(stderr, "ERROR: unexpected size for fid xattr: %zu != %zu\n",
-                    s, sizeof(lustre_fid));
-            errors ++;
-            continue;
-        }
-        struct filter_fid *ffid = (struct filter_fid *)xattr;
-
-        // ff_parent.f_ver == file stripe number
-        oldfid.f_ver = snum;
-        newfid.f_ver = snum;
-
-        if (memcmp(&ffid->ff_parent, &oldfid, sizeof(lustre_fid)))
-        {
-            if (memcmp(&ffid->ff_parent, &newfid, sizeof(lustre_fid)) == 0)
-                fprintf(stderr, "ERROR: new FID is already set for object %"PRIu64" (%s): "
-                        "current="DFID", old="DFID", new="DFID"\n", obj_id, path,
-                        PFID(&ffid->ff_parent), PFID(&oldfid), PFID(&newfid));
-            else
-                fprintf(stderr, "ERROR: unexpected FID for object %"PRIu64" (%s): "
-                        "current="DFID", expected="DFID"\n", obj_id, path,
-                        PFID(&ffid->ff_parent), PFID(&oldfid));
-            errors ++;
-            continue;
-        }
-        if (ffid->ff_objid != obj_id)
-        {
-            fprintf(stderr, "ERROR: object id doesn't match! got: %"PRIu64", expected: %"PRIu64" (%s)\n",
-                    (uint64_t)ffid->ff_objid, obj_id, path);
-            errors ++;
-            continue;
-        }
-
-        /* set the filter with the right fid */
-        memcpy(&ffid->ff_parent, &newfid, sizeof(lustre_fid));
-        printf("objid %"PRIu64": "DFID"->"DFID"\n", obj_id, PFID(&oldfid), PFID(&newfid));
-        if (lsetxattr(path, "trusted.fid", ffid, sizeof(struct filter_fid), XATTR_REPLACE))
-        {
-            fprintf(stderr, "ERROR: failed to update object's FID for object %"PRIu64" (%s): %s",
-                    obj_id, path, strerror(errno));
-            errors ++;
-            continue;
-        }
-        ok ++;
-    }
-    printf("\nSummary: %u input lines, %u matching ost#%u, %u success, %u ignored, %u errors\n",
-           nl, match_ost, idx, ok, ignored_lines, errors);
-    if (errors)
+    rc = batch_run(f, remap_line, &ra, &opts, &stats);
+    fclose(f);
+    if (rc)
+        fprintf(stderr, "ERROR: failed to process %s: %s\n", file, strerror(rc));
+
+    /* note: lines are ignored if they are invalid, or for another OST */
+    printf("\nSummary: %lu input lines, %lu skipped (checkpoint), %lu matching ost#%u, "
+           "%lu success, %lu ignored, %lu errors\n", stats.lines, stats.skipped,
+           stats.ok + stats.errors, ra.ost_idx, stats.ok, stats.ignored, stats.errors);
+    if (stats.errors || rc)
         exit(1);
     else
         exit(0);
@@ -23,8 +23,12 @@
 #include <attr/xattr.h>
 #include <stdlib.h>
 #include <sys/param.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
 
 #include "lustre_extended_types.h"
+#include "tool_batch.h"
 
 static ssize_t hex2bin(const char * hex, void * buff)
 {
@@ -90,91 +94,102 @@ static int set_lov_ea(struct lov_user_md * p_lum, size_t sz_in, const char * pat
     return 0;
 }
 
-int main(int argc, char ** argv)
+/* apply the LOV EA of an input line */
+static int lovea_line(char *buff, unsigned long nl, void *arg)
 {
-    char buff[4096];
+    const char *mdt_root = arg;
     char path[MAXPATHLEN];
     char lum_buff[4096];
-    int len;
     ssize_t s;
     char *lovea;
-    int nl = 0;
-    int errors = 0;
-    int ignored_lines = 0;
-    int ok = 0;
+
+    /* line format: <relative path of file> <lov_ea(hex)>*/
+    lovea = strrchr(buff, ' ');
+    if (!lovea)
+    {
+        fprintf(stderr, "ERROR: Invalid line format or empty line at line %lu\n", nl);
+        return LINE_IGNORED;
+    }
+    /* split path and lovea */
+    *lovea = '\0';
+    lovea++;
+
+    /* convert hex buffer to binary */
+    if (strlen(lovea) > 2 * sizeof(lum_buff))
+    {
+        fprintf(stderr, "ERROR: lov_ea is too large at line %lu\n", nl);
+        return LINE_ERROR;
+    }
+    s = hex2bin(lovea, lum_buff);
+    if (s < 0)
+        return LINE_ERROR;
+
+    if (s < sizeof(struct lov_user_md_v1))
+    {
+        fprintf(stderr, "ERROR: lov_ea is too small: %Lu/%Lu bytes\n",
+                (unsigned long long)s, (unsigned long long)sizeof(struct lov_user_md_v1));
+        return LINE_ERROR;
+    }
+
+    snprintf(path, sizeof(path), "%s/ROOT/%s", mdt_root, buff);
+    if (set_lov_ea((struct lov_user_md *)lum_buff, s, path))
+        return LINE_ERROR;
+
+    return LINE_OK;
+}
+
+static void usage(const char *bin)
+{
+    fprintf(stderr, "Usage: %s " BATCH_USAGE " <mdt_mount_point> [lovea_file]\n", bin);
+    exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+    struct batch_opts opts = BATCH_OPTS_DEFAULT;
+    struct batch_stats stats;
     char * mdt_root;
     FILE * lovea_stream = stdin;
+    int c, rc;
 
-    if (argc != 2 && argc != 3)
+    while ((c = getopt(argc, argv, BATCH_OPTSTRING)) != -1)
     {
-        fprintf(stderr, "Usage: %s <mdt_mount_point> [lovea_file]\n", argv[0]);
-        exit(1);
+        if (batch_getopt(c, optarg, &opts) != 1)
+            usage(argv[0]);
     }
-    if (argv[1][0] != '/')
+
+    if (argc - optind != 1 && argc - optind != 2)
+        usage(argv[0]);
+
+    if (argv[optind][0] != '/')
     {
         fprintf(stderr, "ERROR: absolute path expected for <mdt_mount_point>\n");
-        fprintf(stderr, "Usage: %s <mdt_mount_point> [lovea_file]\n", argv[0]);
-        exit(1);
+        usage(argv[0]);
     }
-    mdt_root = argv[1];
-    if (argc == 3)
+    mdt_root = argv[optind];
+    if (argc - optind == 2)
     {
-        lovea_stream = fopen(argv[2],"r");
+        lovea_stream = fopen(argv[optind + 1],"r");
         if (!lovea_stream)
         {
             fprintf(stderr,"Failed to open %s for reading: %s\n",
-                argv[2], strerror(errno));
+                argv[optind + 1], strerror(errno));
             exit(1);
         }
     }
-
-    while(fgets(buff, 4096, lovea_stream))
+    else if (opts.checkpoint != NULL)
     {
-        nl++;
-
-        len = strlen(buff);
-        /* remove final '\n' */
-        if (len > 0 && buff[len-1] == '\n')
-            buff[len-1] = '\0';
-
-        /* line format: <relative path of file> <lov_ea(hex)>*/
-        lovea = strrchr(buff, ' ');
-        if (!lovea)
-        {
-            fprintf(stderr, "ERROR: Invalid line format or empty line at line %u\n", nl);
-            ignored_lines++;
-            continue;
-        }
-        /* split path and lovea */
-        *lovea = '\0';
-        lovea++;
-
-        /* convert hex buffer to binary */
-        s = hex2bin(lovea, lum_buff);
-        if (s < 0)
-        {
-            errors ++;
-            continue;
-        }
+        fprintf(stderr, "ERROR: a checkpoint requires an input file (not stdin)\n");
+        exit(1);
+    }
 
-        if (s < sizeof(struct lov_user_md_v1))
-        {
-            fprintf(stderr, "ERROR: lov_ea is too small: %Lu/%Lu bytes\n",
-                    (unsigned long long)s, (unsigned long long)sizeof(struct lov_user_md_v1));
-            errors ++;
-            continue;
-        }
+    rc = batch_run(lovea_stream, lovea_line, mdt_root, &opts, &stats);
+    if (rc)
+        fprintf(stderr, "ERROR: failed to read input: %s\n", strerror(rc));
 
-        sprintf(path, "%s/ROOT/%s", mdt_root, buff);
-        if (set_lov_ea((struct lov_user_md *)lum_buff, s, path))
-        {
-            errors ++;
-            continue;
-        }
-        ok ++;
-    }
-    printf("\nSummary: %u input lines, %u ok, %u ignored, %u errors\n", nl, ok, ignored_lines, errors);
-    if (errors)
+    printf("\nSummary: %lu input lines, %lu skipped (checkpoint), %lu ok, %lu ignored, %lu errors\n",
+           stats.lines, stats.skipped, stats.ok, stats.ignored, stats.errors);
+    if (stats.errors || rc)
         exit(1);
     else
         exit(0);
@@ -0,0 +1,362 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/* parallel processing of input lists, with progress and checkpoint */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "tool_batch.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+struct chunk {
+    unsigned long   id;
+    unsigned long   first_line;
+    unsigned int    count;
+    char          **lines;
+    struct chunk   *next;
+};
+
+struct batch_ctx {
+    line_func_t         func;
+    void               *arg;
+    const struct batch_opts *opts;
+    struct batch_stats *stats;
+
+    pthread_mutex_t     lock;
+    /* a chunk was queued, or end of input */
+    pthread_cond_t      cond_work;
+    /* a chunk was completed */
+    pthread_cond_t      cond_done;
+
+    /* chunks to be processed */
+    struct chunk       *head;
+    struct chunk       *tail;
+    bool                eof;
+
+    /* chunks in flight: id of the first chunk that is not completed,
+     * and completion of the next ones (by id % window) */
+    unsigned int        window;
+    unsigned long       next_done;
+    unsigned int       *done_count;
+
+    /* all lines before this one are processed */
+    unsigned long       watermark;
+
+    time_t              start;
+    time_t              last_progress;
+};
+
+int batch_getopt(int opt, const char *optarg, struct batch_opts *opts)
+{
+    char *end;
+    long val;
+
+    switch (opt) {
+    case 'j':
+    case 'b':
+        val = strtol(optarg, &end, 10);
+        if (*end != '\0' || val <= 0)
+            return -1;
+        if (opt == 'j')
+            opts->nb_threads = val;
+        else
+            opts->chunk_lines = val;
+        return 1;
+    case 'c':
+        opts->checkpoint = optarg;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/** read the number of lines processed by a previous run */
+static unsigned long checkpoint_load(const char *file)
+{
+    unsigned long val = 0;
+    FILE *f;
+
+    f = fopen(file, "r");
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "%lu", &val) != 1)
+        val = 0;
+    fclose(f);
+    return val;
+}
+
+/** atomically save the number of lines processed */
+static void checkpoint_save(const char *file, unsigned long lines)
+{
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot write checkpoint %s: %s\n", tmp,
+                strerror(errno));
+        return;
+    }
+    fprintf(f, "%lu\n", lines);
+    if (fclose(f) != 0 || rename(tmp, file) != 0)
+        fprintf(stderr, "ERROR: cannot write checkpoint %s: %s\n", file,
+                strerror(errno));
+}
+
+static void print_progress(struct batch_ctx *ctx, time_t now)
+{
+    struct batch_stats *st = ctx->stats;
+    unsigned long done = st->ok + st->ignored + st->errors;
+
+    fprintf(stderr, "progress: %lu lines processed (%lu ok, %lu ignored, "
+            "%lu errors), %.0f lines/s\n", done, st->ok, st->ignored,
+            st->errors, now > ctx->start ?
+            (double)done / (now - ctx->start) : 0.0);
+}
+
+/** mark a chunk as completed. Must be called with the lock held. */
+static void chunk_done(struct batch_ctx *ctx, const struct chunk *c)
+{
+    bool advanced = false;
+    time_t now;
+
+    ctx->done_count[c->id % ctx->window] = c->count;
+
+    /* advance the watermark on consecutive completed chunks */
+    while (ctx->done_count[ctx->next_done % ctx->window] != 0) {
+        ctx->watermark += ctx->done_count[ctx->next_done % ctx->window];
+        ctx->done_count[ctx->next_done % ctx->window] = 0;
+        ctx->next_done++;
+        advanced = true;
+    }
+
+    if (advanced && ctx->opts->checkpoint != NULL)
+        checkpoint_save(ctx->opts->checkpoint, ctx->watermark);
+
+    now = time(NULL);
+    if (ctx->opts->progress_sec != 0
+        && now - ctx->last_progress >= ctx->opts->progress_sec) {
+        ctx->last_progress = now;
+        print_progress(ctx, now);
+    }
+
+    pthread_cond_broadcast(&ctx->cond_done);
+}
+
+static void chunk_free(struct chunk *c)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->count; i++)
+        free(c->lines[i]);
+    free(c->lines);
+    free(c);
+}
+
+static void *batch_worker(void *arg)
+{
+    struct batch_ctx *ctx = arg;
+    struct batch_stats *st = ctx->stats;
+
+    for (;;) {
+        struct chunk *c;
+        unsigned int i;
+
+        pthread_mutex_lock(&ctx->lock);
+        while (ctx->head == NULL && !ctx->eof)
+            pthread_cond_wait(&ctx->cond_work, &ctx->lock);
+        c = ctx->head;
+        if (c == NULL) {
+            pthread_mutex_unlock(&ctx->lock);
+            return NULL;
+        }
+        ctx->head = c->next;
+        if (ctx->head == NULL)
+            ctx->tail = NULL;
+        pthread_mutex_unlock(&ctx->lock);
+
+        for (i = 0; i < c->count; i++) {
+            switch (ctx->func(c->lines[i], c->first_line + i, ctx->arg)) {
+            case LINE_OK:
+                __sync_fetch_and_add(&st->ok, 1);
+                break;
+            case LINE_IGNORED:
+                __sync_fetch_and_add(&st->ignored, 1);
+                break;
+            default:
+                __sync_fetch_and_add(&st->errors, 1);
+            }
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        chunk_done(ctx, c);
+        pthread_mutex_unlock(&ctx->lock);
+        chunk_free(c);
+    }
+}
+
+/** queue a chunk, waiting for the window to have room for it */
+static void chunk_queue(struct batch_ctx *ctx, struct chunk *c)
+{
+    pthread_mutex_lock(&ctx->lock);
+    while (c->id - ctx->next_done >= ctx->window)
+        pthread_cond_wait(&ctx->cond_done, &ctx->lock);
+
+    c->next = NULL;
+    if (ctx->tail)
+        ctx->tail->next = c;
+    else
+        ctx->head = c;
+    ctx->tail = c;
+    pthread_cond_signal(&ctx->cond_work);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static struct chunk *chunk_new(unsigned long id, unsigned long first_line,
+                               unsigned int size)
+{
+    struct chunk *c = calloc(1, sizeof(*c));
+
+    if (c == NULL)
+        return NULL;
+    c->lines = calloc(size, sizeof(char *));
+    if (c->lines == NULL) {
+        free(c);
+        return NULL;
+    }
+    c->id = id;
+    c->first_line = first_line;
+    return c;
+}
+
+int batch_run(FILE *input, line_func_t func, void *arg,
+              const struct batch_opts *opts, struct batch_stats *stats)
+{
+    struct batch_ctx ctx;
+    pthread_t *threads;
+    struct chunk *c = NULL;
+    unsigned long skip = 0, id = 0;
+    unsigned int i, started;
+    char *line = NULL;
+    size_t line_sz = 0;
+    ssize_t len;
+    int rc = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.func = func;
+    ctx.arg = arg;
+    ctx.opts = opts;
+    ctx.stats = stats;
+    ctx.window = 2 * opts->nb_threads + 2;
+    ctx.start = ctx.last_progress = time(NULL);
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond_work, NULL);
+    pthread_cond_init(&ctx.cond_done, NULL);
+
+    ctx.done_count = calloc(ctx.window, sizeof(unsigned int));
+    threads = calloc(opts->nb_threads, sizeof(pthread_t));
+    if (ctx.done_count == NULL || threads == NULL) {
+        free(ctx.done_count);
+        free(threads);
+        return ENOMEM;
+    }
+
+    /* resume after the lines processed by a previous run */
+    if (opts->checkpoint != NULL) {
+        skip = checkpoint_load(opts->checkpoint);
+        if (skip > 0)
+            fprintf(stderr, "Resuming from checkpoint %s: skipping %lu "
+                    "lines\n", opts->checkpoint, skip);
+    }
+    ctx.watermark = skip;
+
+    for (started = 0; started < opts->nb_threads; started++) {
+        rc = pthread_create(&threads[started], NULL, batch_worker, &ctx);
+        if (rc) {
+            fprintf(stderr, "ERROR: cannot start worker thread: %s\n",
+                    strerror(rc));
+            break;
+        }
+    }
+    if (started == 0)
+        goto out_free;
+    rc = 0;
+
+    while ((len = getline(&line, &line_sz, input)) != -1) {
+        stats->lines++;
+        if (stats->lines <= skip) {
+            stats->skipped++;
+            continue;
+        }
+
+        /* remove final '\n' */
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        if (c == NULL) {
+            c = chunk_new(id, stats->lines, opts->chunk_lines);
+            if (c == NULL) {
+                rc = ENOMEM;
+                break;
+            }
+        }
+        c->lines[c->count] = strdup(line);
+        if (c->lines[c->count] == NULL) {
+            rc = ENOMEM;
+            break;
+        }
+        c->count++;
+
+        if (c->count == opts->chunk_lines) {
+            chunk_queue(&ctx, c);
+            c = NULL;
+            id++;
+        }
+    }
+    if (rc == 0 && ferror(input))
+        rc = errno ? errno : EIO;
+
+    if (c != NULL) {
+        if (rc == 0 && c->count > 0)
+            chunk_queue(&ctx, c);
+        else
+            chunk_free(c);
+    }
+
+    /* the workers exit when all chunks are processed */
+    pthread_mutex_lock(&ctx.lock);
+    ctx.eof = true;
+    pthread_cond_broadcast(&ctx.cond_work);
+    pthread_mutex_unlock(&ctx.lock);
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (opts->progress_sec != 0)
+        print_progress(&ctx, time(NULL));
+
+ out_free:
+    free(line);
+    free(threads);
+    free(ctx.done_count);
+    return rc;
+}
@@ -0,0 +1,76 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ * vim:expandtab:shiftwidth=4:tabstop=4:
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the CeCILL License.
+ *
+ * The fact that you are presently reading this means that you have had
+ * knowledge of the CeCILL license (http://www.cecill.info) and that you
+ * accept its terms.
+ */
+
+/**
+ * Parallel processing of the lines of an input list, for recovery tools
+ * (set_lovea, ost_fids_remap).
+ *
+ * Lines are read by chunks, and chunks are processed by worker threads.
+ * The number of lines processed so far (all lines before it are done) can
+ * be saved to a checkpoint file, so an interrupted run can be resumed
+ * without processing lines twice.
+ */
+
+#ifndef _TOOL_BATCH_H
+#define _TOOL_BATCH_H
+
+#include <stdio.h>
+
+/** line processing status */
+#define LINE_OK         0
+#define LINE_IGNORED    1
+#define LINE_ERROR      (-1)
+
+/**
+ * Process a line (without its final newline).
+ * Called concurrently by worker threads.
+ * @return LINE_OK, LINE_IGNORED or LINE_ERROR.
+ */
+typedef int (*line_func_t)(char *line, unsigned long line_no, void *arg);
+
+struct batch_opts {
+    unsigned int    nb_threads;     /**< worker threads */
+    unsigned int    chunk_lines;    /**< lines per chunk */
+    const char     *checkpoint;     /**< checkpoint file (NULL for none) */
+    unsigned int    progress_sec;   /**< progress interval (0 for none) */
+};
+
+#define BATCH_OPTS_DEFAULT { .nb_threads = 1, .chunk_lines = 1000, \
+                             .checkpoint = NULL, .progress_sec = 10 }
+
+struct batch_stats {
+    unsigned long   lines;          /**< lines read (including skipped) */
+    unsigned long   skipped;        /**< done by a previous run */
+    unsigned long   ok;
+    unsigned long   ignored;
+    unsigned long   errors;
+};
+
+/**
+ * Parse a batch option (-j, -c, -b).
+ * @return 1 if the option was handled, 0 if it is not a batch option,
+ *         -1 if the value is invalid.
+ */
+int batch_getopt(int opt, const char *optarg, struct batch_opts *opts);
+
+/** getopt string and usage of batch options */
+#define BATCH_OPTSTRING "j:c:b:"
+#define BATCH_USAGE "[-j <threads>] [-c <checkpoint_file>] [-b <chunk_lines>]"
+
+/**
+ * Process all the lines of the input stream.
+ * @return 0 if all lines were read, an errno value else.
+ */
+int batch_run(FILE *input, line_func_t func, void *arg,
+              const struct batch_opts *opts, struct batch_stats *stats);
+
+#endif
@@ -26,7 +26,7 @@ fi
 
 PROC=$CMD
 CFG_SCRIPT="../../scripts/rbh-config"
-CLEAN="rh_scan.log rh_migr.log rh_rm.log rh.pid rh_purge.log rh_report.log report.out rh_syntax.log"
+CLEAN="rh_scan.log rh_chglogs.log rh_migr.log rh_rm.log rh.pid rh_purge.log rh_report.log report.out rh_syntax.log"
 
 SUMMARY="/tmp/test_${PROC}_summary.$$"
 
@@ -177,6 +177,225 @@ function test_scan_report
 
 }
 
+########################## PERFORMANCE TESTS #########################
+
+# namespace parameters (see ../test_suite/create-random)
+PERF_FILES=${PERF_FILES:-100000}
+PERF_DEPTH=${PERF_DEPTH:-2}
+PERF_WIDTH=${PERF_WIDTH:-20}
+PERF_NAME_LEN=${PERF_NAME_LEN:-16}
+PERF_SIZE=${PERF_SIZE:-0}
+PERF_SEED=${PERF_SEED:-42}
+# number of runs of each report command (for latency percentiles)
+PERF_REPORT_ITER=${PERF_REPORT_ITER:-10}
+# changelog records captured by chglog_capture (replay test is skipped if unset)
+PERF_CL_CAPTURE=${PERF_CL_CAPTURE:-""}
+
+# results are appended to PERF_RESULTS, as: <run_id>;<scenario>;<metric>;<value>
+# and compared to PERF_BASELINE (same format) if it exists: the latest value
+# of each metric in the baseline is used as reference, so a previous results
+# file can be used as baseline as is.
+PERF_RESULTS=${PERF_RESULTS:-perf_results.csv}
+PERF_BASELINE=${PERF_BASELINE:-perf_baseline.csv}
+# tolerated degradation vs. baseline (percent)
+PERF_TOLERANCE=${PERF_TOLERANCE:-10}
+PERF_RUN_ID=${PERF_RUN_ID:-`date +%Y%m%d-%H%M%S`}
+
+PERF_NS="$ROOT/perf_ns"
+CREATE_RANDOM="../test_suite/create-random"
+TIME_CMD="/usr/bin/time"
+TMP_TIME="/tmp/rbh_perf_time.$$"
+
+# record a result and compare it to the baseline
+# metrics named *_per_sec are expected to be higher than the baseline,
+# others (durations, latencies, memory) lower.
+function perf_record # (scenario, metric, value)
+{
+	scenario=$1
+	metric=$2
+	value=$3
+
+	echo "    $scenario.$metric = $value"
+	echo "$PERF_RUN_ID;$scenario;$metric;$value" >> $PERF_RESULTS
+
+	[ -f $PERF_BASELINE ] || return 0
+	ref=`grep ";$scenario;$metric;" $PERF_BASELINE | tail -1 | cut -d ';' -f 4`
+	[ -z "$ref" ] && return 0
+
+	if [[ $metric = *_per_sec ]]; then
+		bad=`echo "$value < $ref * (100 - $PERF_TOLERANCE) / 100" | bc -l`
+	else
+		bad=`echo "$value > $ref * (100 + $PERF_TOLERANCE) / 100" | bc -l`
+	fi
+	if (( $bad )); then
+		error "performance regression for $scenario.$metric: $value (baseline: $ref)"
+	fi
+}
+
+# run a command, and set perf_dur (seconds) and perf_rss (max RSS in KB)
+function perf_run
+{
+	if [ -x $TIME_CMD ]; then
+		$TIME_CMD -f "%e %M" -o $TMP_TIME "$@"
+		rc=$?
+		perf_dur=`tail -1 $TMP_TIME | awk '{print $1}'`
+		perf_rss=`tail -1 $TMP_TIME | awk '{print $2}'`
+		rm -f $TMP_TIME
+	else
+		t0=`date +%s.%N`
+		"$@"
+		rc=$?
+		t1=`date +%s.%N`
+		perf_dur=`echo "$t1 - $t0" | bc -l`
+		perf_rss=""
+	fi
+	return $rc
+}
+
+# compute a percentile of the values of a file (1 per line)
+function percentile # (file, pct)
+{
+	sort -n $1 | awk -v p=$2 '{v[NR]=$1} END {i=int((NR*p+99)/100); if (i<1) i=1; print v[i]}'
+}
+
+# record the common metrics of a robinhood run: duration, peak RSS,
+# DB ops/sec and DB_APPLY stage latency
+function perf_record_run # (scenario, log)
+{
+	scenario=$1
+	log=$2
+
+	perf_record $scenario duration_sec $perf_dur
+	[ -n "$perf_rss" ] && perf_record $scenario peak_rss_kb $perf_rss
+
+	# DB ops counters from the last stats dump
+	ops=`grep "DB ops:" $log | tail -1 | sed -e 's/.*DB ops: //' | tr '/' '\n' | cut -d '=' -f 2 | awk '{s+=$1} END {print s+0}'`
+	if [ -n "$ops" ] && (( `echo "$perf_dur > 0" | bc -l` )); then
+		perf_record $scenario db_ops_per_sec `echo "$ops / $perf_dur" | bc -l | xargs printf "%.1f"`
+	fi
+
+	# DB_APPLY processing time (p50/p90/p99) from the stage latency table
+	lat=`grep "STATS" $log | grep "DB_APPLY" | grep "/.*/" | tail -1 | cut -d '|' -f 5`
+	if [ -n "$lat" ]; then
+		perf_record $scenario db_apply_p50_ms `echo $lat | cut -d '/' -f 1 | tr -d ' '`
+		perf_record $scenario db_apply_p90_ms `echo $lat | cut -d '/' -f 2 | tr -d ' '`
+		perf_record $scenario db_apply_p99_ms `echo $lat | cut -d '/' -f 3 | tr -d ' '`
+	fi
+}
+
+# create the test namespace, if it doesn't exist with the same parameters
+function perf_namespace
+{
+	params="$PERF_FILES $PERF_DEPTH $PERF_WIDTH $PERF_NAME_LEN $PERF_SIZE $PERF_SEED"
+
+	if [ -f $PERF_NS.params ] && [ "`cat $PERF_NS.params`" = "$params" ]; then
+		return 0
+	fi
+
+	echo "Creating namespace: $PERF_FILES files, depth=$PERF_DEPTH, width=$PERF_WIDTH, seed=$PERF_SEED..."
+	rm -rf $PERF_NS $PERF_NS.params
+	mkdir -p $PERF_NS || return 1
+	$CREATE_RANDOM -p -s $PERF_SEED -d $PERF_DEPTH -w $PERF_WIDTH -S $PERF_SIZE \
+		$PERF_FILES $PERF_NAME_LEN $PERF_NS || return 1
+	echo "$params" > $PERF_NS.params
+}
+
+# scan the namespace, and record scan metrics
+function perf_scan_once # (config, scenario)
+{
+	cfg=./cfg/$1
+	scenario=$2
+
+	cp /dev/null rh_scan.log
+	perf_run $RH -f $cfg --scan -l EVENT -L rh_scan.log --once || error "scanning filesystem"
+
+	entries=`grep "Full scan of $ROOT completed" rh_scan.log | sed -e 's/.*completed, \([0-9]*\) entries.*/\1/'`
+	[ -z "$entries" ] && error "no scan summary in log" && return 1
+	perf_record $scenario entries $entries
+	perf_record $scenario entries_per_sec `echo "$entries / $perf_dur" | bc -l | xargs printf "%.1f"`
+	perf_record_run $scenario rh_scan.log
+}
+
+function perf_scan
+{
+	config_file=$1
+
+	clean_logs
+	perf_namespace || error "creating namespace"
+
+	echo "1-Initial scan (empty DB)..."
+	perf_scan_once $config_file scan
+	echo "2-Second scan (DB up to date)..."
+	perf_scan_once $config_file rescan
+}
+
+function perf_changelog
+{
+	config_file=$1
+
+	if [ -z "$PERF_CL_CAPTURE" ]; then
+		echo "PERF_CL_CAPTURE not set: skipped"
+		set_skipped
+		return 1
+	fi
+
+	clean_logs
+	perf_run $RH -f ./cfg/$config_file --readlog --replay=$PERF_CL_CAPTURE -l EVENT \
+		-L rh_chglogs.log --once || error "replaying changelogs"
+
+	line=`grep "Replay of" rh_chglogs.log | tail -1`
+	[ -z "$line" ] && error "no replay summary in log" && return 1
+	rec=`echo $line | sed -e 's/.*: \([0-9]*\) records.*/\1/'`
+	speed=`echo $line | sed -e 's/.*(\([0-9.]*\) records\/sec).*/\1/'`
+	perf_record changelog records $rec
+	perf_record changelog records_per_sec $speed
+	perf_record_run changelog rh_chglogs.log
+}
+
+function perf_policy
+{
+	config_file=$1
+
+	clean_logs
+	perf_namespace || error "creating namespace"
+	$RH -f ./cfg/$config_file --scan -l EVENT -L rh_scan.log --once || error "scanning filesystem"
+
+	perf_run $RH -f ./cfg/$config_file --run=cleanup --target=all --dry-run --no-limit \
+		-l EVENT -L rh_purge.log --once || error "running policy"
+
+	line=`grep "Policy run summary" rh_purge.log | tail -1`
+	[ -z "$line" ] && error "no policy run summary in log" && return 1
+	count=`echo $line | sed -e 's/.*; \([0-9]*\) successful actions.*/\1/'`
+	perf_record policy actions $count
+	perf_record policy actions_per_sec `echo "$count / $perf_dur" | bc -l | xargs printf "%.1f"`
+	perf_record_run policy rh_purge.log
+}
+
+function perf_report
+{
+	config_file=$1
+
+	clean_logs
+	perf_namespace || error "creating namespace"
+	$RH -f ./cfg/$config_file --scan -l EVENT -L rh_scan.log --once || error "scanning filesystem"
+
+	rss_max=0
+	for opt in "--fs-info" "--class-info" "--user-info=root" "--top-dirs" "--top-size" "--top-users"; do
+		name=`echo $opt | sed -e 's/^--//' -e 's/=.*//'`
+		cp /dev/null /tmp/report_lat.$$
+		for i in `seq 1 $PERF_REPORT_ITER`; do
+			perf_run $REPORT -f ./cfg/$config_file $opt > /dev/null || error "report $opt"
+			echo "$perf_dur * 1000" | bc -l >> /tmp/report_lat.$$
+			[ -n "$perf_rss" ] && (( $perf_rss > $rss_max )) && rss_max=$perf_rss
+		done
+		perf_record report ${name}_p50_ms `percentile /tmp/report_lat.$$ 50`
+		perf_record report ${name}_p90_ms `percentile /tmp/report_lat.$$ 90`
+		perf_record report ${name}_p99_ms `percentile /tmp/report_lat.$$ 99`
+		rm -f /tmp/report_lat.$$
+	done
+	(( $rss_max > 0 )) && perf_record report peak_rss_kb $rss_max
+}
+
 ######################### END OF TEST FUNCTIONS #####################
 
 only_test=""
@@ -339,6 +558,10 @@ fi
 
 run_test	1	test_scan_report common.conf "scan and reports on large FS"
 run_test	2	test_scan_report innodb.conf "scan and reports on large FS (innodb)"
+run_test	3	perf_scan	perf.conf "scan throughput"
+run_test	4	perf_changelog	perf.conf "changelog replay throughput"
+run_test	5	perf_policy	perf.conf "policy run throughput"
+run_test	6	perf_report	perf.conf "report latency"
 
 
 
@@ -9,7 +9,11 @@
  */
 
 /* Create several files with random names. Names can include any byte
- * except NUL and /, which are not legal in filenames. */
+ * except NUL and /, which are not legal in filenames.
+ *
+ * Options make it possible to generate parameterized namespaces, for
+ * performance tests: files can be spread in a directory tree, with a given
+ * size, and names can be reproduced from a seed. */
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -23,8 +27,39 @@
 #include <glib.h>
 
 static int urandom;
+static GRand *rng;
+static gboolean printable;
 static GString *filename;
 
+static const char name_chars[] =
+	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.";
+
+/* Get a random byte, from the seeded generator if any, else from
+ * /dev/urandom. */
+static int random_byte(char *byte)
+{
+	int rc;
+
+	if (rng != NULL)
+	{
+		*byte = (char)g_rand_int_range(rng, 0, 256);
+	}
+	else
+	{
+		rc = read(urandom, byte, 1);
+		if (rc == -1)
+		{
+			fprintf(stderr, "urandom read failed: %d\n", errno);
+			return -1;
+		}
+	}
+
+	if (printable)
+		*byte = name_chars[(unsigned char)*byte % (sizeof(name_chars) - 1)];
+
+	return 0;
+}
+
 /* Create a filename. Not the fastest algorithm, but it's good enough
  * for our purpose. */
 static char *make_name(const char *dirname, size_t len)
@@ -36,12 +71,9 @@ static char *make_name(const char *dirname, size_t len)
 	{
 		char byte;
 
-		rc = read(urandom, &byte, 1);
-		if (rc == -1)
-		{
-			fprintf(stderr, "urandom read failed: %d\n", errno);
+		rc = random_byte(&byte);
+		if (rc)
 			return NULL;
-		}
 
 		if (byte == '\0' || byte == '/')
 			continue;
@@ -54,6 +86,69 @@ static char *make_name(const char *dirname, size_t len)
 	return filename->str;
 }
 
+/* Create directory levels under dirname, and add the deepest ones
+ * to leaves. */
+static int make_tree(const char *dirname, int depth, int width,
+					 GPtrArray *leaves)
+{
+	int i, rc;
+
+	if (depth == 0)
+	{
+		g_ptr_array_add(leaves, g_strdup(dirname));
+		return 0;
+	}
+
+	for (i = 0; i < width; i++)
+	{
+		char *sub = g_strdup_printf("%s/dir.%d", dirname, i);
+
+		if (mkdir(sub, S_IRWXU) && errno != EEXIST)
+		{
+			fprintf(stderr, "mkdir(%s) failed: %d\n", sub, errno);
+			g_free(sub);
+			return -1;
+		}
+		rc = make_tree(sub, depth - 1, width, leaves);
+		g_free(sub);
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+/* Fill a file with size bytes */
+static int write_data(int fd, const char *buf, size_t buf_len, size_t size)
+{
+	int rc;
+
+	while (size > 0)
+	{
+		size_t len = size < buf_len ? size : buf_len;
+
+		rc = write(fd, buf, len);
+		if (rc == -1)
+			return -1;
+		size -= rc;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] <number of files> "
+			"<length of file names (1 to 255)> <directory>\n", prog);
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -s <seed>   generate reproducible names from seed\n");
+	fprintf(stderr, "  -p          only use printable characters in names\n");
+	fprintf(stderr, "  -d <depth>  spread files in a directory tree of this "
+			"depth (default: 0)\n");
+	fprintf(stderr, "  -w <width>  number of subdirectories per directory "
+			"(default: 10)\n");
+	fprintf(stderr, "  -S <size>   size of files, in bytes (default: a short "
+			"text)\n");
+}
+
 int main(int argc, char *argv[])
 {
 	int i;
@@ -62,24 +157,53 @@ int main(int argc, char *argv[])
 	int num;
 	size_t length;
 	char *dirname;
+	int opt;
+	int depth = 0;
+	int width = 10;
+	long long size = -1;
+	char data[4096];
+	GPtrArray *leaves;
 
-	if (argc != 4)
+	while ((opt = getopt(argc, argv, "s:pd:w:S:")) != -1)
 	{
-		fprintf(stderr, "%s needs 3 arguments:\n", argv[0]);
-		fprintf(stderr, "  - number of files\n");
-		fprintf(stderr, "  - length of file names (1 to 255)\n");
-		fprintf(stderr, "  - directory where to create the files\n");
+		switch (opt)
+		{
+		case 's':
+			rng = g_rand_new_with_seed(strtoul(optarg, NULL, 0));
+			break;
+		case 'p':
+			printable = TRUE;
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'S':
+			size = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 3 || depth < 0 || width <= 0 ||
+		(size < 0 && size != -1))
+	{
+		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	num = atoi(argv[1]);
+	num = atoi(argv[optind]);
 	if (num <= 0)
 	{
 		fprintf(stderr, "invalid number of files to create: %d\n", num);
 		return EXIT_FAILURE;
 	}
 
-	length = atoi(argv[2]);
+	length = atoi(argv[optind + 1]);
 	if (length <= 0 || length >= 256)
 	{
 		fprintf(stderr,
@@ -87,23 +211,34 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	dirname = argv[3];
+	dirname = argv[optind + 2];
 
-	urandom = open("/dev/urandom", O_RDONLY);
-	if (urandom == -1)
+	if (rng == NULL)
 	{
-		fprintf(stderr, "can't open urandom: %d\n", errno);
-		return EXIT_FAILURE;
+		urandom = open("/dev/urandom", O_RDONLY);
+		if (urandom == -1)
+		{
+			fprintf(stderr, "can't open urandom: %d\n", errno);
+			return EXIT_FAILURE;
+		}
 	}
 
 	filename = g_string_sized_new(1000);
 
+	leaves = g_ptr_array_new();
+	if (make_tree(dirname, depth, width, leaves))
+		return EXIT_FAILURE;
+
+	memset(data, 'x', sizeof(data));
+
 	for (i = 0; i < num; i++)
 	{
 		char buf[100];
 		int fd;
 
-		name = make_name(dirname, length);
+		/* spread files in leaf directories */
+		name = make_name(g_ptr_array_index(leaves, i % leaves->len),
+						 length);
 		if (name == NULL)
 			return EXIT_FAILURE;
 
@@ -113,8 +248,15 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
-		sprintf(buf, "file with weird name #%d", i);
-		rc = write(fd, buf, strlen(buf));
+		if (size == -1)
+		{
+			sprintf(buf, "file with weird name #%d", i);
+			rc = write(fd, buf, strlen(buf));
+		}
+		else
+		{
+			rc = write_data(fd, data, sizeof(data), size);
+		}
 		if (rc == -1) {
 			fprintf(stderr, "write failed: %d\n", errno);
 			return EXIT_FAILURE;
@@ -123,7 +265,13 @@ int main(int argc, char *argv[])
 		close(fd);
 	}
 
-	close(urandom);
+	if (rng == NULL)
+		close(urandom);
+	else
+		g_rand_free(rng);
+	for (i = 0; i < leaves->len; i++)
+		g_free(g_ptr_array_index(leaves, i));
+	g_ptr_array_free(leaves, TRUE);
 	g_string_free(filename, TRUE);
 
 	return EXIT_SUCCESS;
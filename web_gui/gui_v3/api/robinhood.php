@@ -102,6 +102,39 @@ class MyAPI extends API
 
 
     }
+    /***************************************
+     * return the refresh time of the summary
+     * tables maintained by the daemon
+     **************************************/
+    protected function summary() {
+        global $db;
+
+        if ($this->method == 'GET') {
+            if (!check_access("api-ro"))
+                return "Permission denied";
+
+            $data = array();
+            try {
+                $req = $db->query("SELECT name, last_update, refresh_interval FROM SUMMARY_INFO;");
+            } catch (PDOException $e) {
+                $req = false;
+            }
+            if ($req) {
+                while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
+                    $data[$sqldata['name']] = array(
+                        'last_update' => intval($sqldata['last_update']),
+                        'refresh_interval' => intval($sqldata['refresh_interval']),
+                        'uptodate' => summary_time($sqldata['name']) !== false
+                    );
+                }
+            }
+            return $data;
+
+        } else {
+            return "\"Faint hearts never won fair ladies.\"";
+        }
+    }
+
     /***************************************
      * return differents kinds of graph
      * JSON output with graphjs format
@@ -123,13 +156,23 @@ class MyAPI extends API
             $size = array();
             $count = array();
             $color = array();
+            //refresh time of the summary table used, false for live data
+            $updated = false;
 
             switch ($content_requested) {
             case 'uid':
             case 'gid':
-                $fullfilter = build_filter($this->args, array('uid'=>'uid', 'gid'=>'gid'), $self);
-                $sqlfilter=$fullfilter[0];
-                $req = $db->prepare("SELECT $content_requested, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested");
+                $table = ($content_requested == 'uid') ? 'SUMMARY_USER' : 'SUMMARY_GROUP';
+                $fullfilter = summary_filter($table, $content_requested, $this->args, $self);
+                if ($fullfilter) {
+                    $updated = summary_time($table);
+                    $sqlfilter=$fullfilter[0];
+                    $req = $db->prepare("SELECT $content_requested, size AS ssize, count AS scount FROM $table $sqlfilter");
+                } else {
+                    $fullfilter = build_filter($this->args, array('uid'=>'uid', 'gid'=>'gid'), $self);
+                    $sqlfilter=$fullfilter[0];
+                    $req = $db->prepare("SELECT $content_requested, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested");
+                }
                 $req->execute($fullfilter[1]);
                 while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
                     $labels[] = $sqldata[$content_requested];
@@ -149,13 +192,23 @@ class MyAPI extends API
                 break;
 
             case 'Sizes':
-                $fullfilter = build_filter($this->args, array('uid'=>'uid', 'gid'=>'gid'), $self);
+                $table = 'ACCT_STAT';
+                foreach (array('SUMMARY_USER'=>'uid', 'SUMMARY_GROUP'=>'gid') as $t => $key) {
+                    $fullfilter = summary_filter($t, $key, $this->args, $self);
+                    if ($fullfilter) {
+                        $table = $t;
+                        $updated = summary_time($table);
+                        break;
+                    }
+                }
+                if (!$fullfilter)
+                    $fullfilter = build_filter($this->args, array('uid'=>'uid', 'gid'=>'gid'), $self);
                 $sqlfilter=$fullfilter[0];
                 $ssize = array("sz0","sz1","sz32","sz1K","sz32K","sz1M","sz32M","sz1G","sz32G","sz1T");
                 $select_str = "SUM(sz0) AS ssz0";
                 foreach ($ssize as $ssz)
                     $select_str = $select_str.", SUM($ssz) AS s$ssz";
-                $req = $db->prepare("SELECT $select_str FROM ACCT_STAT $sqlfilter;");
+                $req = $db->prepare("SELECT $select_str FROM $table $sqlfilter;");
                 $req->execute($fullfilter[1]);
                 while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
                     foreach ($ssize as $ssz) {
@@ -199,6 +252,29 @@ class MyAPI extends API
 
                 break;
 
+            case 'History':
+                if ($self != '$SELF')
+                    return "Permission denied";
+                $updated = summary_time('SUMMARY_FS_HISTORY');
+                if ($updated !== false) {
+                    $req = $db->prepare("SELECT from_unixtime(time) AS stime, size, count FROM SUMMARY_FS_HISTORY ORDER BY time;");
+                    $req->execute();
+                    while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
+                        $labels[] = $sqldata['stime'];
+                        $size[] = $sqldata['size'];
+                    }
+                }
+
+                $data = array(
+                    'labels' => $labels,
+                    'default_graph' => 'line',
+                    'filter' => array(),
+                    'datasets' => array()
+                );
+                $data['datasets'][] = array('data'=>$size, 'label'=>'Used space', 'unit'=>'size');
+
+                break;
+
 
 
             default:
@@ -206,8 +282,14 @@ class MyAPI extends API
                 $sqlfilter=$fullfilter[0];
 
                 if (endsWith($content_requested,"_status")) {
-                    $req = $db->prepare("SELECT $content_requested AS sstatus, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested;");
-                    $req->execute($fullfilter[1]);
+                    if (summary_filter('SUMMARY_STATUS', null, $this->args, $self)) {
+                        $updated = summary_time('SUMMARY_STATUS');
+                        $req = $db->prepare("SELECT status AS sstatus, size AS ssize, count AS scount FROM SUMMARY_STATUS WHERE field = :field;");
+                        $req->execute(array('field' => $content_requested));
+                    } else {
+                        $req = $db->prepare("SELECT $content_requested AS sstatus, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested;");
+                        $req->execute($fullfilter[1]);
+                    }
                     while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
                         $labels[] = ($sqldata['sstatus'] == '') ? 'None': $sqldata['sstatus'];
                         $size[] = $sqldata['ssize'];
@@ -234,6 +316,7 @@ class MyAPI extends API
                 }
                 break;
             }
+            $data['updated'] = $updated;
             return $data;
 
         } else {
@@ -260,6 +343,8 @@ class MyAPI extends API
             $columns = array();
             $columnsDefs = array();
             $datasets = array();
+            //refresh time of the summary table used, false for live data
+            $updated = false;
             switch ($content_requested) {
             case 'uid':
             case 'gid':
@@ -270,8 +355,15 @@ class MyAPI extends API
                 $columns[] = array('title' => 'Size');
                 $columns[] = array('title' => 'File Count');
                 $columnsDefs[] = array('type' => 'file-size', 'targets' => 1);
-                $req = $db->prepare("SELECT $content_requested, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested;");
-                $req->execute($fullfilter[1]);
+                $table = ($content_requested == 'uid') ? 'SUMMARY_USER' : 'SUMMARY_GROUP';
+                if ($sumfilter = summary_filter($table, $content_requested, $this->args, $self)) {
+                    $updated = summary_time($table);
+                    $req = $db->prepare("SELECT $content_requested, size AS ssize, count AS scount FROM $table $sumfilter[0];");
+                    $req->execute($sumfilter[1]);
+                } else {
+                    $req = $db->prepare("SELECT $content_requested, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested;");
+                    $req->execute($fullfilter[1]);
+                }
                 while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
                     $datasets[] = array( $sqldata[$content_requested],formatSizeNumber($sqldata['ssize']),$sqldata['scount']);
                 }
@@ -288,8 +380,14 @@ class MyAPI extends API
                     $select_str = $select_str.", SUM($ssz) AS s$ssz";
                     $columns[] = array('title' => l($ssz));
                 }
-                $req = $db->prepare("SELECT uid, $select_str FROM ACCT_STAT $sqlfilter GROUP BY uid;");
-                $req->execute($fullfilter[1]);
+                if ($sumfilter = summary_filter('SUMMARY_USER', 'uid', $this->args, $self)) {
+                    $updated = summary_time('SUMMARY_USER');
+                    $req = $db->prepare("SELECT uid, $select_str FROM SUMMARY_USER $sumfilter[0] GROUP BY uid;");
+                    $req->execute($sumfilter[1]);
+                } else {
+                    $req = $db->prepare("SELECT uid, $select_str FROM ACCT_STAT $sqlfilter GROUP BY uid;");
+                    $req->execute($fullfilter[1]);
+                }
                 while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
                     $list = array();
                     $list[]=$sqldata["uid"];
@@ -325,6 +423,24 @@ class MyAPI extends API
                 }
                 break;
 
+            case 'History':
+                global $MAX_ROWS;
+                if ($self != '$SELF')
+                    return "Permission denied";
+                $columns[] = array('title' => 'Date');
+                $columns[] = array('title' => 'Size');
+                $columns[] = array('title' => 'File Count');
+                $columnsDefs[] = array('type' => 'file-size', 'targets' => 1);
+                $updated = summary_time('SUMMARY_FS_HISTORY');
+                if ($updated !== false) {
+                    $req = $db->prepare("SELECT from_unixtime(time) AS stime, size, count FROM SUMMARY_FS_HISTORY ORDER BY time DESC LIMIT $MAX_ROWS;");
+                    $req->execute();
+                    while($sqldata = $req->fetch(PDO::FETCH_ASSOC)) {
+                        $datasets[] = array($sqldata['stime'], formatSizeNumber($sqldata['size']), $sqldata['count']);
+                    }
+                }
+                break;
+
 
             default:
                 if (endsWith($content_requested,"_status")) {
@@ -335,8 +451,14 @@ class MyAPI extends API
                     $columns[] = array('title' => 'Size');
                     $columns[] = array('title' => 'File Count');
                     $columnsDefs[] = array('type' => 'file-size', 'targets' => 1);
-                    $req = $db->prepare("SELECT $content_requested AS sstatus, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested;");
-                    $req->execute($fullfilter[1]);
+                    if (summary_filter('SUMMARY_STATUS', null, $this->args, $self)) {
+                        $updated = summary_time('SUMMARY_STATUS');
+                        $req = $db->prepare("SELECT status AS sstatus, size AS ssize, count AS scount FROM SUMMARY_STATUS WHERE field = :field;");
+                        $req->execute(array('field' => $content_requested));
+                    } else {
+                        $req = $db->prepare("SELECT $content_requested AS sstatus, SUM(size) AS ssize, SUM(count) AS scount FROM ACCT_STAT $sqlfilter GROUP BY $content_requested;");
+                        $req->execute($fullfilter[1]);
+                    }
 
                     while($sqldata = $req->fetch()) {
                         $datasets[] = array( ($sqldata['sstatus'] == '') ? 'None': $sqldata['sstatus'],formatSizeNumber($sqldata['ssize']),$sqldata['scount']);
@@ -347,6 +469,7 @@ class MyAPI extends API
             $data['columns'] = $columns;
             $data['datasets'] = $datasets;
             $data['columnsDefs'] = $columnsDefs;
+            $data['updated'] = $updated;
             return $data;
 
         } else {
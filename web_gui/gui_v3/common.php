@@ -207,6 +207,65 @@ function build_filter($args, $filter, $self='$SELF') {
         return array($sqlfilter, $values);
 }
 
+/**
+ *
+ * Get the time of the last refresh of a summary table maintained by
+ * the robinhood daemon (see summary_interval in ListManager config)
+ *
+ * @param string $table Name of the summary table
+ * @return int|bool Refresh time, false if the table is missing or outdated
+ */
+function summary_time($table) {
+        global $db;
+        static $info = null;
+
+        if ($info === null) {
+                $info = array();
+                try {
+                        $req = $db->query("SELECT name, last_update, refresh_interval FROM SUMMARY_INFO;");
+                } catch (PDOException $e) {
+                        $req = false;
+                }
+                if ($req) {
+                        while ($row = $req->fetch(PDO::FETCH_ASSOC))
+                                $info[$row['name']] = $row;
+                }
+        }
+        if (!array_key_exists($table, $info))
+                return false;
+
+        //Not refreshed for 2 intervals: the daemon is not running
+        $row = $info[$table];
+        if (time() - $row['last_update'] > 2 * $row['refresh_interval'])
+                return false;
+        return intval($row['last_update']);
+}
+
+/**
+ *
+ * Build the filter of a request on a summary table, when the table is
+ * up to date and the REST args only filter on its key
+ *
+ * @param string $table Name of the summary table
+ * @param string $key Key of the table (uid, gid...), null for no filter
+ * @param array $args REST args as key/val/key/val/... list
+ * @param self Filter to show only user data (for self service)
+ * @return array|bool String,Array like build_filter, false to use ACCT_STAT
+ */
+function summary_filter($table, $key, $args, $self='$SELF') {
+        if (summary_time($table) === false)
+                return false;
+        if ($self!='$SELF' && $key!='uid')
+                return false;
+        foreach (array('uid', 'gid', 'filename') as $k) {
+                if ($k!=$key && get_filter_from_list($args,$k))
+                        return false;
+        }
+        if ($key === null)
+                return array("", array());
+        return build_filter($args, array($key=>$key), $self);
+}
+
 /**
  *
  * Build SQLRequest from REST args
@@ -89,6 +89,8 @@ foreach ($fields as $field) {
 }
 
 echo '<li><a href="#"  onclick="GetGraph(\'Files\')">Files</a></li>';
+if (summary_time('SUMMARY_FS_HISTORY') !== false)
+        echo '<li><a href="#"  onclick="GetGraph(\'History\')">History</a></li>';
 ?>
 
           </ul>